@@ -0,0 +1,28 @@
+#
+# Benchmark: array access and sort.
+#
+def insertion_sort(a)
+  i = 1
+  while i < a.size
+    v = a[i]
+    j = i - 1
+    while j >= 0 && a[j] > v
+      a[j + 1] = a[j]
+      j -= 1
+    end
+    a[j + 1] = v
+    i += 1
+  end
+  a
+end
+
+seed = 1
+data = []
+200.times {
+  seed = (seed * 75 + 74) % 65537
+  data << seed
+}
+
+a1 = insertion_sort(data.dup)
+a2 = data.sort
+raise "sort" if a1 != a2
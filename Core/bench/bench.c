@@ -0,0 +1,310 @@
+/*! @file
+  @brief
+  mruby/c host-side benchmark driver.
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  (usage)
+    cd Core/mrubyc_src
+    make MRBC_USE_HAL_POSIX=1 bench
+
+    or run the driver directly.
+    ../build/bench ../bench/fib.mrb ../bench/tak.mrb ...
+
+  Each program is run repeatedly in a new VM for at least
+  BENCH_MIN_TIME seconds, and reported with runs/sec and the peak heap
+  usage, that is the high-water mark of mrbc_alloc_statistics().
+
+  With "-j N", each program is run by N processes at once, and the
+  total runs/sec is reported. The runtime keeps its state (memory pool,
+  symbols, classes and scheduler) in static variables, so a process is
+  one independent instance, e.g. one per core for a simulation farm.
+    ../build/bench -j 8 ../bench/fib.mrb
+  </pre>
+*/
+
+/***** Feature test switches ************************************************/
+#define _POSIX_C_SOURCE 200809L
+
+/***** System headers *******************************************************/
+//@cond
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+#include "mrubyc.h"
+
+/***** Constat values *******************************************************/
+//! same as the target. (see start_mrubyc.c)
+#if !defined(BENCH_MEMORY_SIZE)
+#define BENCH_MEMORY_SIZE (1024*30)
+#endif
+
+#if !defined(BENCH_MIN_TIME)
+#define BENCH_MIN_TIME 1.0
+#endif
+
+#if !defined(BENCH_MIN_RUNS)
+#define BENCH_MIN_RUNS 3
+#endif
+
+
+/***** Typedefs *************************************************************/
+//! result of a program, sent from the worker process.
+typedef struct BENCH_RESULT {
+  int ret;		//!< 0 if no error.
+  int runs;		//!< number of runs.
+  double runs_per_sec;
+  unsigned int peak;	//!< peak heap usage in bytes.
+} BENCH_RESULT;
+
+
+/***** Local variables ******************************************************/
+static uint8_t memory_pool[BENCH_MEMORY_SIZE];
+static int n_jobs = 1;		//!< number of the processes for a program.
+
+
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! monotonic clock in seconds.
+*/
+static double now_sec( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+//================================================================
+/*! statistics of the memory pool.
+
+  @param  peak		returns high-water mark.
+  @return		used bytes.
+*/
+static unsigned int heap_used( unsigned int *peak )
+{
+  struct MRBC_ALLOC_STATISTICS st;
+  mrbc_alloc_statistics( &st );
+  if( peak ) *peak = st.peak;
+  return st.used;
+}
+
+
+//================================================================
+/*! read the whole file.
+
+  @param  filename	file name.
+  @return		allocated buffer or NULL.
+*/
+static uint8_t * load_file( const char *filename )
+{
+  FILE *fp = fopen( filename, "rb" );
+  if( !fp ) return NULL;
+
+  fseek( fp, 0, SEEK_END );
+  long size = ftell( fp );
+  fseek( fp, 0, SEEK_SET );
+
+  uint8_t *buf = malloc( size );
+  if( buf && fread( buf, 1, size, fp ) != (size_t)size ) {
+    free( buf );
+    buf = NULL;
+  }
+  fclose( fp );
+
+  return buf;
+}
+
+
+//================================================================
+/*! run the program once in a new VM.
+
+  @param  bytecode	RITE binary.
+  @return		0 if no error.
+*/
+static int run_once( const uint8_t *bytecode )
+{
+  mrbc_vm *vm = mrbc_vm_open( NULL );
+  if( !vm ) return -1;
+
+  if( mrbc_load_mrb( vm, bytecode ) != 0 ) {
+    mrbc_print_vm_exception( vm );
+    mrbc_vm_close( vm );
+    return -1;
+  }
+  mrbc_vm_begin( vm );
+
+  int ret;
+  do {
+    ret = mrbc_vm_run( vm );
+    vm->flag_preemption = 0;
+  } while( ret == 0 );
+
+  int error = (ret == 2) || mrbc_israised( vm );
+  mrbc_vm_end( vm );	// prints the exception.
+  mrbc_vm_close( vm );
+
+  return error;
+}
+
+
+//================================================================
+/*! run the program repeatedly.
+
+  @param  bytecode	RITE binary.
+  @param  res		returns the result.
+*/
+static void measure( const uint8_t *bytecode, BENCH_RESULT *res )
+{
+  mrbc_init( memory_pool, BENCH_MEMORY_SIZE );
+  unsigned int base = heap_used( NULL );
+  unsigned int peak;
+  mrbc_alloc_reset_peak();
+  int runs = 0;
+  int ret = 0;
+  double t0 = now_sec();
+  double elapsed = 0;
+
+  do {
+    ret = run_once( bytecode );
+    if( ret != 0 ) break;
+    runs++;
+    elapsed = now_sec() - t0;
+  } while( runs < BENCH_MIN_RUNS || elapsed < BENCH_MIN_TIME );
+
+  heap_used( &peak );
+  res->ret = ret;
+  res->runs = runs;
+  res->runs_per_sec = (ret == 0) ? runs / elapsed : 0;
+  res->peak = peak - base;
+
+  mrbc_cleanup();
+}
+
+
+//================================================================
+/*! run the program in n_jobs processes at once, and sum the results.
+
+  @param  bytecode	RITE binary.
+  @param  res		returns the result. (peak is the largest one)
+*/
+static void measure_parallel( const uint8_t *bytecode, BENCH_RESULT *res )
+{
+  int fd[2];
+  memset( res, 0, sizeof(BENCH_RESULT) );
+  if( pipe( fd ) != 0 ) {
+    res->ret = -1;
+    return;
+  }
+  fflush( stdout );
+
+  int n_started = 0;
+  for( ; n_started < n_jobs; n_started++ ) {
+    pid_t pid = fork();
+    if( pid < 0 ) {
+      res->ret = -1;
+      break;
+    }
+    if( pid == 0 ) {		// worker, with its own copy of the runtime.
+      BENCH_RESULT r;
+      close( fd[0] );
+      measure( bytecode, &r );
+      ssize_t n = write( fd[1], &r, sizeof(r) );	// atomic, < PIPE_BUF.
+      _exit( n != sizeof(r) );
+    }
+  }
+  close( fd[1] );
+
+  for( int i = 0; i < n_started; i++ ) {
+    BENCH_RESULT r;
+    if( read( fd[0], &r, sizeof(r) ) != sizeof(r) ) {
+      res->ret = -1;
+      break;
+    }
+    if( r.ret != 0 ) res->ret = r.ret;
+    res->runs += r.runs;
+    res->runs_per_sec += r.runs_per_sec;
+    if( res->peak < r.peak ) res->peak = r.peak;
+  }
+  close( fd[0] );
+
+  for( int i = 0; i < n_started; i++ ) {
+    int status;
+    if( wait( &status ) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+      res->ret = -1;
+    }
+  }
+}
+
+
+//================================================================
+/*! run a benchmark program and print the result.
+
+  @param  filename	.mrb file name.
+  @return		0 if no error.
+*/
+static int bench( const char *filename )
+{
+  uint8_t *bytecode = load_file( filename );
+  if( !bytecode ) {
+    fprintf( stderr, "%s: can't read.\n", filename );
+    return 1;
+  }
+
+  BENCH_RESULT res;
+  if( n_jobs > 1 ) {
+    measure_parallel( bytecode, &res );
+  } else {
+    measure( bytecode, &res );
+  }
+
+  if( res.ret == 0 ) {
+    printf( "%-24s %8d %12.2f %10u\n",
+	    filename, res.runs, res.runs_per_sec, res.peak );
+  } else {
+    printf( "%-24s %8s %12s %10s\n", filename, "error", "-", "-" );
+  }
+
+  free( bytecode );
+
+  return res.ret != 0;
+}
+
+
+/***** Global functions *****************************************************/
+//================================================================
+/*! main
+*/
+int main( int argc, char *argv[] )
+{
+  int i = 1;
+  if( argc > 2 && strcmp( argv[1], "-j" ) == 0 ) {
+    n_jobs = atoi( argv[2] );
+    if( n_jobs == 0 ) n_jobs = sysconf( _SC_NPROCESSORS_ONLN );
+    i = 3;
+  }
+  if( i >= argc || n_jobs < 1 ) {
+    fprintf( stderr, "Usage: %s [-j jobs] program.mrb ...\n", argv[0] );
+    return 1;
+  }
+
+  printf( "%-24s %8s %12s %10s\n", "program", "runs", "runs/sec", "peak heap" );
+
+  int n_error = 0;
+  for( ; i < argc; i++ ) {
+    n_error += bench( argv[i] );
+  }
+
+  return n_error != 0;
+}
@@ -0,0 +1,8 @@
+#
+# Benchmark: recursive method calls.
+#
+def fib(n)
+  n < 2 ? n : fib(n - 1) + fib(n - 2)
+end
+
+raise "fib" if fib(20) != 6765
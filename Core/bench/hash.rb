@@ -0,0 +1,21 @@
+#
+# Benchmark: hash insert and lookup.
+#
+h = {}
+500.times {|i|
+  h[i] = i * 2
+}
+
+sum = 0
+500.times {|i|
+  sum += h[i]
+}
+raise "hash" if sum != 249500
+
+h = {}
+100.times {|i|
+  h["key#{i}"] = i
+}
+100.times {|i|
+  raise "hash" if h["key#{i}"] != i
+}
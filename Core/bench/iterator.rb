@@ -0,0 +1,17 @@
+#
+# Benchmark: iterator loops with blocks.
+#
+a = []
+100.times {|i|
+  a << i
+}
+
+sum = 0
+20.times {
+  a.each {|v| sum += v }
+  a.each_with_index {|v, i| sum += i }
+  b = a.map {|v| v * 2 }
+  sum += b.last
+  1.upto(10) {|i| sum += i }
+}
+raise "iterator" if sum != 203060
@@ -0,0 +1,60 @@
+#
+# Benchmark: instance variable heavy class.
+#  A push switch like ruby_prog/task2.rb, on a fake pin.
+#
+class FakePin
+  def initialize
+    @n = 0
+  end
+
+  def read
+    @n += 1
+    (@n / 7) % 2
+  end
+end
+
+class PushSwitch
+  attr_accessor :polarity
+  attr_accessor :long_press_th
+
+  def initialize(pin)
+    @polarity = 0
+    @long_press_th = 10
+    @long_press_cnt = 0
+
+    @sw = pin
+    @sw1 = 1 - @polarity
+  end
+
+  def read
+    @sw0 = @sw1
+    @sw1 = @sw.read
+
+    ret = (@sw1 == @polarity)
+    if ret
+      @long_press_cnt += 1
+    else
+      @long_press_cnt = 0
+    end
+
+    return ret
+  end
+
+  def pressed?
+    return @polarity == 0 ? (@sw0 > @sw1) : (@sw0 < @sw1)
+  end
+
+  def released?
+    return @polarity == 0 ? (@sw0 < @sw1) : (@sw0 > @sw1)
+  end
+end
+
+sw = PushSwitch.new(FakePin.new)
+n_pressed = 0
+n_released = 0
+2000.times {
+  sw.read
+  n_pressed += 1 if sw.pressed?
+  n_released += 1 if sw.released?
+}
+raise "ivar" if n_pressed != 143 || n_released != 143
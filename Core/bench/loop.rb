@@ -0,0 +1,23 @@
+#
+# Benchmark: instruction dispatch, by a loop of simple operations.
+# (compare the cycles with and without MRBC_USE_RAMFUNC)
+#
+class Counter
+  def initialize
+    @n = 0
+  end
+  def add(x)
+    @n += x
+  end
+  attr_reader :n
+end
+
+c = Counter.new
+i = 0
+x = 0
+while i < 20000
+  x = (x + i * 3) & 0xffff
+  c.add(i & 7)
+  i += 1
+end
+raise "loop" if x != 53456 || c.n != 70000
@@ -0,0 +1,15 @@
+#
+# Benchmark: string split and join.
+#
+words = []
+100.times {|i|
+  words << i.to_s
+}
+
+line = words.join(",")
+20.times {
+  a = line.split(",")
+  raise "split" if a.size != 100
+  line = a.join(",")
+}
+raise "join" if line.size != 289
@@ -0,0 +1,43 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== ADC class =====*/
+static const mrbc_sym method_symbols_ADC[] = {
+  MRBC_SYM(new),
+  MRBC_SYM(read),
+  MRBC_SYM(read_latest),
+  MRBC_SYM(read_raw),
+  MRBC_SYM(read_samples),
+  MRBC_SYM(read_scan),
+  MRBC_SYM(read_voltage),
+  MRBC_SYM(sample_time),
+  MRBC_SYM(sample_time_EQ),
+  MRBC_SYM(start_scan),
+  MRBC_SYM(stop_scan),
+};
+
+static const mrbc_func_t method_functions_ADC[] = {
+  c_adc_new,
+  c_adc_read_voltage,
+  c_adc_read_latest,
+  c_adc_read_raw,
+  c_adc_read_samples,
+  c_adc_read_scan,
+  c_adc_read_voltage,
+  c_adc_sample_time,
+  c_adc_set_sample_time,
+  c_adc_start_scan,
+  c_adc_stop_scan,
+};
+
+struct RBuiltinClass mrbc_class_ADC = {
+  .sym_id = MRBC_SYM(ADC),
+  .num_builtin_method = sizeof(method_symbols_ADC) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "ADC",
+#endif
+  .method_symbols = method_symbols_ADC,
+  .method_functions = method_functions_ADC,
+};
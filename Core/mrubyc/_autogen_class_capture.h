@@ -0,0 +1,31 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== InputCapture class =====*/
+static const mrbc_sym method_symbols_InputCapture[] = {
+  MRBC_SYM(average),
+  MRBC_SYM(count),
+  MRBC_SYM(period),
+  MRBC_SYM(stop),
+  MRBC_SYM(width),
+};
+
+static const mrbc_func_t method_functions_InputCapture[] = {
+  c_capture_average,
+  c_capture_count,
+  c_capture_period,
+  c_capture_stop,
+  c_capture_width,
+};
+
+struct RBuiltinClass mrbc_class_InputCapture = {
+  .sym_id = MRBC_SYM(InputCapture),
+  .num_builtin_method = sizeof(method_symbols_InputCapture) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "InputCapture",
+#endif
+  .method_symbols = method_symbols_InputCapture,
+  .method_functions = method_functions_InputCapture,
+};
@@ -0,0 +1,39 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== System class =====*/
+static const mrbc_sym method_symbols_System[] = {
+  MRBC_SYM(clock),
+  MRBC_SYM(clock_EQ),
+  MRBC_SYM(notify_low_memory),
+#if defined(MRBC_STACK_CHECK)
+  MRBC_SYM(stack_size),
+#endif
+#if defined(MRBC_STACK_CHECK)
+  MRBC_SYM(stack_used),
+#endif
+};
+
+static const mrbc_func_t method_functions_System[] = {
+  c_system_clock,
+  c_system_set_clock,
+  c_system_notify_low_memory,
+#if defined(MRBC_STACK_CHECK)
+  c_system_stack_size,
+#endif
+#if defined(MRBC_STACK_CHECK)
+  c_system_stack_used,
+#endif
+};
+
+struct RBuiltinClass mrbc_class_System = {
+  .sym_id = MRBC_SYM(System),
+  .num_builtin_method = sizeof(method_symbols_System) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "System",
+#endif
+  .method_symbols = method_symbols_System,
+  .method_functions = method_functions_System,
+};
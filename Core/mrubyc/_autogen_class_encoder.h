@@ -0,0 +1,31 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== Encoder class =====*/
+static const mrbc_sym method_symbols_Encoder[] = {
+  MRBC_SYM(position),
+  MRBC_SYM(position_EQ),
+  MRBC_SYM(read),
+  MRBC_SYM(stop),
+  MRBC_SYM(write),
+};
+
+static const mrbc_func_t method_functions_Encoder[] = {
+  c_encoder_read,
+  c_encoder_write,
+  c_encoder_read,
+  c_encoder_stop,
+  c_encoder_write,
+};
+
+struct RBuiltinClass mrbc_class_Encoder = {
+  .sym_id = MRBC_SYM(Encoder),
+  .num_builtin_method = sizeof(method_symbols_Encoder) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "Encoder",
+#endif
+  .method_symbols = method_symbols_Encoder,
+  .method_functions = method_functions_Encoder,
+};
@@ -0,0 +1,55 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== GPIO class =====*/
+static const mrbc_sym method_symbols_GPIO[] = {
+  MRBC_SYM(high_Q),
+  MRBC_SYM(high_at_Q),
+  MRBC_SYM(irq),
+  MRBC_SYM(low_Q),
+  MRBC_SYM(low_at_Q),
+  MRBC_SYM(new),
+  MRBC_SYM(play_port),
+  MRBC_SYM(read),
+  MRBC_SYM(read_at),
+  MRBC_SYM(read_port),
+  MRBC_SYM(sample_port),
+  MRBC_SYM(setmode),
+  MRBC_SYM(setmode_port),
+  MRBC_SYM(wait_edge),
+  MRBC_SYM(write),
+  MRBC_SYM(write_at),
+  MRBC_SYM(write_port),
+};
+
+static const mrbc_func_t method_functions_GPIO[] = {
+  c_gpio_high,
+  c_gpio_high_at,
+  c_gpio_irq,
+  c_gpio_low,
+  c_gpio_low_at,
+  c_gpio_new,
+  c_gpio_play_port,
+  c_gpio_read,
+  c_gpio_read_at,
+  c_gpio_read_port,
+  c_gpio_sample_port,
+  c_gpio_setmode,
+  c_gpio_setmode_port,
+  c_gpio_wait_edge,
+  c_gpio_write,
+  c_gpio_write_at,
+  c_gpio_write_port,
+};
+
+struct RBuiltinClass mrbc_class_GPIO = {
+  .sym_id = MRBC_SYM(GPIO),
+  .num_builtin_method = sizeof(method_symbols_GPIO) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "GPIO",
+#endif
+  .method_symbols = method_symbols_GPIO,
+  .method_functions = method_functions_GPIO,
+};
@@ -0,0 +1,33 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== I2C class =====*/
+static const mrbc_sym method_symbols_I2C[] = {
+  MRBC_SYM(listen),
+  MRBC_SYM(listen_status),
+  MRBC_SYM(read),
+  MRBC_SYM(transaction),
+  MRBC_SYM(unlisten),
+  MRBC_SYM(write),
+};
+
+static const mrbc_func_t method_functions_I2C[] = {
+  c_i2c_listen,
+  c_i2c_listen_status,
+  c_i2c_read,
+  c_i2c_transaction,
+  c_i2c_unlisten,
+  c_i2c_write,
+};
+
+struct RBuiltinClass mrbc_class_I2C = {
+  .sym_id = MRBC_SYM(I2C),
+  .num_builtin_method = sizeof(method_symbols_I2C) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "I2C",
+#endif
+  .method_symbols = method_symbols_I2C,
+  .method_functions = method_functions_I2C,
+};
@@ -0,0 +1,41 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== PWM class =====*/
+static const mrbc_sym method_symbols_PWM[] = {
+  MRBC_SYM(duty),
+  MRBC_SYM(duty_u16_EQ),
+  MRBC_SYM(frequency),
+  MRBC_SYM(period_ticks),
+  MRBC_SYM(period_us),
+  MRBC_SYM(pulse_ticks_EQ),
+  MRBC_SYM(pulse_width_us),
+  MRBC_SYM(stop),
+  MRBC_SYM(wait_half),
+  MRBC_SYM(write_duty_u16),
+};
+
+static const mrbc_func_t method_functions_PWM[] = {
+  c_pwm_duty,
+  c_pwm_set_duty_u16,
+  c_pwm_frequency,
+  c_pwm_period_ticks,
+  c_pwm_period_us,
+  c_pwm_set_pulse_ticks,
+  c_pwm_pulse_width_us,
+  c_pwm_stop,
+  c_pwm_wait_half,
+  c_pwm_write_duty_u16,
+};
+
+struct RBuiltinClass mrbc_class_PWM = {
+  .sym_id = MRBC_SYM(PWM),
+  .num_builtin_method = sizeof(method_symbols_PWM) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "PWM",
+#endif
+  .method_symbols = method_symbols_PWM,
+  .method_functions = method_functions_PWM,
+};
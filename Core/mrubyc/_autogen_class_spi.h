@@ -0,0 +1,33 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== SPI class =====*/
+static const mrbc_sym method_symbols_SPI[] = {
+  MRBC_SYM(listen),
+  MRBC_SYM(listen_status),
+  MRBC_SYM(read),
+  MRBC_SYM(transfer),
+  MRBC_SYM(unlisten),
+  MRBC_SYM(write),
+};
+
+static const mrbc_func_t method_functions_SPI[] = {
+  c_spi_listen,
+  c_spi_listen_status,
+  c_spi_read,
+  c_spi_transfer,
+  c_spi_unlisten,
+  c_spi_write,
+};
+
+struct RBuiltinClass mrbc_class_SPI = {
+  .sym_id = MRBC_SYM(SPI),
+  .num_builtin_method = sizeof(method_symbols_SPI) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "SPI",
+#endif
+  .method_symbols = method_symbols_SPI,
+  .method_functions = method_functions_SPI,
+};
@@ -0,0 +1,59 @@
+/* Auto generated by make_method_table.rb */
+#include "../mrubyc_src/_autogen_builtin_symbol.h"
+
+/*===== UART class =====*/
+static const mrbc_sym method_symbols_UART[] = {
+  MRBC_SYM(bytes_available),
+  MRBC_SYM(bytes_to_write),
+  MRBC_SYM(can_read_line),
+  MRBC_SYM(clear_rx_buffer),
+  MRBC_SYM(clear_tx_buffer),
+  MRBC_SYM(flush),
+  MRBC_SYM(gets),
+  MRBC_SYM(gets_into),
+  MRBC_SYM(puts),
+  MRBC_SYM(read),
+  MRBC_SYM(read_frame),
+  MRBC_SYM(read_into),
+  MRBC_SYM(read_packet),
+  MRBC_SYM(rx_buffer_size),
+  MRBC_SYM(rx_lost),
+  MRBC_SYM(rx_overrun),
+  MRBC_SYM(send_break),
+  MRBC_SYM(write),
+  MRBC_SYM(write_packet),
+};
+
+static const mrbc_func_t method_functions_UART[] = {
+  c_uart_bytes_available,
+  c_uart_bytes_to_write,
+  c_uart_can_read_line,
+  c_uart_clear_rx_buffer,
+  c_uart_clear_tx_buffer,
+  c_uart_flush,
+  c_uart_gets,
+  c_uart_gets_into,
+  c_uart_puts,
+  c_uart_read,
+  c_uart_read_frame,
+  c_uart_read_into,
+  c_uart_read_packet,
+  c_uart_rx_buffer_size,
+  c_uart_rx_lost,
+  c_uart_rx_overrun,
+  c_uart_send_break,
+  c_uart_write,
+  c_uart_write_packet,
+};
+
+struct RBuiltinClass mrbc_class_UART = {
+  .sym_id = MRBC_SYM(UART),
+  .num_builtin_method = sizeof(method_symbols_UART) / sizeof(mrbc_sym),
+  .super = MRBC_CLASS(Object),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "UART",
+#endif
+  .method_symbols = method_symbols_UART,
+  .method_functions = method_functions_UART,
+};
@@ -0,0 +1,38 @@
+/*! @file
+  @brief
+  CRC functions. Table driven, and by the CRC unit.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef CRC_H
+#define CRC_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  function prototypes.
+*/
+uint32_t calc_crc( const void *data, int len );
+uint8_t crc8( const void *data, int len, uint8_t crc );
+uint16_t crc16_modbus( const void *data, int len, uint16_t crc );
+uint16_t crc16_ccitt( const void *data, int len, uint16_t crc );
+uint32_t crc32( const void *data, int len, uint32_t crc );
+void mrbc_init_class_crc( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
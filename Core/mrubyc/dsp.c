@@ -0,0 +1,494 @@
+/*! @file
+  @brief
+  DSP class. Signal processing kernels for typed arrays.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  Int16Array (Q15) kernels use the Cortex-M4 SIMD instructions
+  (SMLAD/SMLALD, SSAT) when __ARM_FEATURE_DSP is available.
+  FloatArray kernels use the single precision FPU.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+#include <math.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "typed_array.h"
+
+
+//================================================================
+/*! get an element as float.
+*/
+static inline float elem_f( const TYPED_ARRAY *ta, int i )
+{
+  switch( ta->type ) {
+  case TYPED_ARRAY_UINT8: return ((const uint8_t *)ta->buf)[i];
+  case TYPED_ARRAY_INT16: return ((const int16_t *)ta->buf)[i];
+  default:		  return ((const float *)ta->buf)[i];
+  }
+}
+
+
+//================================================================
+/*! set an element from float, with saturation.
+*/
+static inline void set_elem_f( TYPED_ARRAY *ta, int i, float f )
+{
+  switch( ta->type ) {
+  case TYPED_ARRAY_UINT8:
+    ((uint8_t *)ta->buf)[i] = f < 0 ? 0 : f > 255 ? 255 : (uint8_t)(f + 0.5f);
+    break;
+  case TYPED_ARRAY_INT16:
+    f += (f < 0) ? -0.5f : 0.5f;
+    ((int16_t *)ta->buf)[i] = f < -32768 ? -32768 : f > 32767 ? 32767 : (int16_t)f;
+    break;
+  default:
+    ((float *)ta->buf)[i] = f;
+  }
+}
+
+
+//================================================================
+/*! read two int16 as a packed word. (unaligned access is allowed on M4)
+*/
+static inline uint32_t read_q15x2( const int16_t *p )
+{
+  uint32_t w;
+  memcpy( &w, p, sizeof(w) );
+  return w;
+}
+
+
+//================================================================
+/*! Q15 dot product with 64bit accumulator.
+*/
+static int64_t dot_q15( const int16_t *a, const int16_t *b, int n )
+{
+  int64_t acc = 0;
+  int i = 0;
+
+#if defined(__ARM_FEATURE_DSP)
+  for( ; i + 1 < n; i += 2 ) {
+    acc = __SMLALD( read_q15x2(a+i), read_q15x2(b+i), acc );
+  }
+#endif
+  for( ; i < n; i++ ) {
+    acc += (int32_t)a[i] * b[i];
+  }
+
+  return acc;
+}
+
+
+//================================================================
+/*! saturate to int16.
+*/
+static inline int16_t sat_q15( int32_t x )
+{
+#if defined(__ARM_FEATURE_DSP)
+  return __SSAT( x, 16 );
+#else
+  return x < -32768 ? -32768 : x > 32767 ? 32767 : x;
+#endif
+}
+
+
+//================================================================
+/*! get a typed array argument, or raise ArgumentError.
+*/
+static TYPED_ARRAY *get_arg( mrbc_vm *vm, mrbc_value *v )
+{
+  TYPED_ARRAY *ta = typed_array_get( v );
+  if( !ta ) mrbc_raise(vm, MRBC_CLASS(ArgumentError), "typed array required.");
+  return ta;
+}
+
+
+//================================================================
+/*! get a numeric value as float.
+*/
+static int get_float( const mrbc_value *v, float *f )
+{
+  switch( v->tt ) {
+  case MRBC_TT_INTEGER:	*f = mrbc_integer(*v); return 0;
+  case MRBC_TT_FLOAT:	*f = mrbc_float(*v);   return 0;
+  default:		return -1;
+  }
+}
+
+
+//================================================================
+/*! dot product
+
+  DSP.dot( a, b ) -> Integer (Int16Array, ByteArray) or Float
+*/
+static void c_dsp_dot(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 2 ) goto ERROR_RETURN;
+  TYPED_ARRAY *a = get_arg( vm, &v[1] );
+  TYPED_ARRAY *b = get_arg( vm, &v[2] );
+  if( !a || !b ) return;
+  if( a->type != b->type || a->size != b->size ) goto ERROR_RETURN;
+
+  if( a->type == TYPED_ARRAY_INT16 ) {
+    int64_t acc = dot_q15( typed_array_data(a), typed_array_data(b), a->size );
+    if( (mrbc_int_t)acc == acc ) {
+      SET_INT_RETURN( acc );
+    } else {
+      SET_FLOAT_RETURN( acc );
+    }
+    return;
+  }
+
+  float acc = 0;
+  for( int i = 0; i < a->size; i++ ) {
+    acc += elem_f(a, i) * elem_f(b, i);
+  }
+  if( a->type == TYPED_ARRAY_UINT8 ) {
+    SET_INT_RETURN( acc );
+  } else {
+    SET_FLOAT_RETURN( acc );
+  }
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! root mean square
+
+  DSP.rms( a ) -> Float
+*/
+static void c_dsp_rms(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *a = get_arg( vm, &v[1] );
+  if( !a ) return;
+  if( a->size == 0 ) {
+    SET_FLOAT_RETURN( 0 );
+    return;
+  }
+
+  double sum;
+  if( a->type == TYPED_ARRAY_INT16 ) {
+    sum = dot_q15( typed_array_data(a), typed_array_data(a), a->size );
+  } else {
+    float acc = 0;
+    for( int i = 0; i < a->size; i++ ) {
+      float f = elem_f(a, i);
+      acc += f * f;
+    }
+    sum = acc;
+  }
+
+  SET_FLOAT_RETURN( sqrt( sum / a->size ) );
+}
+
+
+//================================================================
+/*! argmin, argmax sub function.
+*/
+static void dsp_arg_minmax(mrbc_vm *vm, mrbc_value v[], int flag_max)
+{
+  TYPED_ARRAY *a = get_arg( vm, &v[1] );
+  if( !a ) return;
+  if( a->size == 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  int found = 0;
+  if( a->type == TYPED_ARRAY_INT16 ) {
+    const int16_t *p = typed_array_data(a);
+    for( int i = 1; i < a->size; i++ ) {
+      if( flag_max ? (p[i] > p[found]) : (p[i] < p[found]) ) found = i;
+    }
+  } else {
+    float val = elem_f(a, 0);
+    for( int i = 1; i < a->size; i++ ) {
+      float f = elem_f(a, i);
+      if( flag_max ? (f > val) : (f < val) ) {
+	val = f;
+	found = i;
+      }
+    }
+  }
+
+  SET_INT_RETURN( found );
+}
+
+
+//================================================================
+/*! index of the maximum element
+
+  DSP.argmax( a ) -> Integer
+*/
+static void c_dsp_argmax(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  dsp_arg_minmax( vm, v, 1 );
+}
+
+
+//================================================================
+/*! index of the minimum element
+
+  DSP.argmin( a ) -> Integer
+*/
+static void c_dsp_argmin(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  dsp_arg_minmax( vm, v, 0 );
+}
+
+
+//================================================================
+/*! moving average
+
+  DSP.moving_average( src, window ) -> same class as src
+
+  Returns src.size - window + 1 elements.
+*/
+static void c_dsp_moving_average(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 2 || v[2].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+  TYPED_ARRAY *src = get_arg( vm, &v[1] );
+  if( !src ) return;
+  int window = mrbc_integer(v[2]);
+  if( window <= 0 || window > src->size ) goto ERROR_RETURN;
+
+  int n = src->size - window + 1;
+  mrbc_value ret = typed_array_new( vm, src->type, n );
+  TYPED_ARRAY *dst = typed_array_get( &ret );
+  if( !dst ) return;	// ENOMEM
+
+  if( src->type == TYPED_ARRAY_FLOAT ) {
+    const float *s = typed_array_data(src);
+    float *d = typed_array_data(dst);
+    float sum = 0;
+    for( int i = 0; i < window; i++ ) sum += s[i];
+    d[0] = sum / window;
+    for( int i = 1; i < n; i++ ) {
+      sum += s[i + window - 1] - s[i - 1];
+      d[i] = sum / window;
+    }
+  } else {
+    int32_t sum = 0;
+    for( int i = 0; i < window; i++ ) sum += elem_f(src, i);
+    set_elem_f( dst, 0, (float)sum / window );
+    for( int i = 1; i < n; i++ ) {
+      sum += (int32_t)elem_f(src, i + window - 1) - (int32_t)elem_f(src, i - 1);
+      set_elem_f( dst, i, (float)sum / window );
+    }
+  }
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! FIR filter
+
+  DSP.fir( src, coeffs ) -> same class as src
+
+  y[i] = sum( coeffs[k] * src[i + taps-1 - k] ), for k in 0...taps
+  Returns src.size - taps + 1 elements. Int16Array src requires Q15
+  Int16Array coeffs; FloatArray src requires FloatArray coeffs.
+*/
+static void c_dsp_fir(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 2 ) goto ERROR_RETURN;
+  TYPED_ARRAY *src = get_arg( vm, &v[1] );
+  TYPED_ARRAY *h = get_arg( vm, &v[2] );
+  if( !src || !h ) return;
+  if( src->type != h->type || src->type == TYPED_ARRAY_UINT8 ) goto ERROR_RETURN;
+  int taps = h->size;
+  if( taps == 0 || taps > src->size ) goto ERROR_RETURN;
+
+  int n = src->size - taps + 1;
+  mrbc_value ret = typed_array_new( vm, src->type, n );
+  TYPED_ARRAY *dst = typed_array_get( &ret );
+  if( !dst ) return;	// ENOMEM
+
+  if( src->type == TYPED_ARRAY_INT16 ) {
+    // time reversed coefficients, to run SMLAD along the samples.
+    int16_t *hr = mrbc_alloc( vm, taps * sizeof(int16_t) );
+    if( !hr ) {
+      mrbc_decref( &ret );
+      return;		// ENOMEM
+    }
+    const int16_t *hp = typed_array_data(h);
+    for( int k = 0; k < taps; k++ ) hr[k] = hp[taps - 1 - k];
+
+    const int16_t *s = typed_array_data(src);
+    int16_t *d = typed_array_data(dst);
+    for( int i = 0; i < n; i++ ) {
+      d[i] = sat_q15( dot_q15( s + i, hr, taps ) >> 15 );
+    }
+    mrbc_free( vm, hr );
+
+  } else {
+    const float *s = typed_array_data(src);
+    const float *hp = typed_array_data(h);
+    float *d = typed_array_data(dst);
+    for( int i = 0; i < n; i++ ) {
+      float acc = 0;
+      for( int k = 0; k < taps; k++ ) acc += hp[k] * s[i + taps - 1 - k];
+      d[i] = acc;
+    }
+  }
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! IIR filter, cascaded biquad sections.
+
+  DSP.biquad( src, coeffs ) -> same class as src
+
+  coeffs = [b0, b1, b2, a1, a2, ...]  (Array or FloatArray, 5 per section)
+  y[n] = b0*x[n] + b1*x[n-1] + b2*x[n-2] - a1*y[n-1] - a2*y[n-2]
+*/
+static void c_dsp_biquad(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 2 ) goto ERROR_RETURN;
+  TYPED_ARRAY *src = get_arg( vm, &v[1] );
+  if( !src ) return;
+
+  // get coefficients.
+  TYPED_ARRAY *tc = typed_array_get( &v[2] );
+  int n_coef;
+  if( tc ) {
+    if( tc->type != TYPED_ARRAY_FLOAT ) goto ERROR_RETURN;
+    n_coef = tc->size;
+  } else if( v[2].tt == MRBC_TT_ARRAY ) {
+    n_coef = mrbc_array_size(&v[2]);
+  } else {
+    goto ERROR_RETURN;
+  }
+  if( n_coef == 0 || n_coef % 5 != 0 ) goto ERROR_RETURN;
+
+  // coefficients, followed by the state x1, x2, y1, y2 of each section.
+  int n_sec = n_coef / 5;
+  float *coef = mrbc_alloc( vm, (n_coef + n_sec * 4) * sizeof(float) );
+  if( !coef ) return;	// ENOMEM
+  for( int i = 0; i < n_coef; i++ ) {
+    if( tc ) {
+      coef[i] = ((float *)typed_array_data(tc))[i];
+    } else if( get_float( &v[2].array->data[i], &coef[i] ) != 0 ) {
+      mrbc_free( vm, coef );
+      goto ERROR_RETURN;
+    }
+  }
+  float *state = coef + n_coef;
+  memset( state, 0, n_sec * 4 * sizeof(float) );
+
+  mrbc_value ret = typed_array_new( vm, src->type, src->size );
+  TYPED_ARRAY *dst = typed_array_get( &ret );
+  if( !dst ) {
+    mrbc_free( vm, coef );
+    return;		// ENOMEM
+  }
+
+  // Direct form I.
+  for( int i = 0; i < src->size; i++ ) {
+    float x = elem_f(src, i);
+    for( int j = 0; j < n_sec; j++ ) {
+      const float *c = coef + j * 5;
+      float *st = state + j * 4;
+      float y = c[0] * x + c[1] * st[0] + c[2] * st[1] - c[3] * st[2] - c[4] * st[3];
+      st[1] = st[0];
+      st[0] = x;
+      st[3] = st[2];
+      st[2] = y;
+      x = y;
+    }
+    set_elem_f( dst, i, x );
+  }
+
+  mrbc_free( vm, coef );
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! fixed-point scaling, in place.
+
+  DSP.scale( src, mul, shift = 0 ) -> src
+
+  Int16Array:  src[i] = saturate( (src[i] * mul) >> shift )
+  FloatArray:  src[i] = src[i] * mul / 2**shift
+*/
+static void c_dsp_scale(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc < 2 || argc > 3 ) goto ERROR_RETURN;
+  TYPED_ARRAY *src = get_arg( vm, &v[1] );
+  if( !src ) return;
+  int shift = 0;
+  if( argc == 3 ) {
+    if( v[3].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    shift = mrbc_integer(v[3]);
+    if( shift < 0 || shift > 31 ) goto ERROR_RETURN;
+  }
+
+  if( typed_array_modify( vm, src ) != 0 ) return;
+
+  if( src->type == TYPED_ARRAY_INT16 && v[2].tt == MRBC_TT_INTEGER ) {
+    int32_t mul = mrbc_integer(v[2]);
+    int16_t *p = typed_array_data(src);
+    for( int i = 0; i < src->size; i++ ) {
+      p[i] = sat_q15( ((int64_t)p[i] * mul) >> shift );
+    }
+  } else {
+    float mul;
+    if( get_float( &v[2], &mul ) != 0 ) goto ERROR_RETURN;
+    mul /= (float)(1UL << shift);
+    for( int i = 0; i < src->size; i++ ) {
+      set_elem_f( src, i, elem_f(src, i) * mul );
+    }
+  }
+
+  mrbc_incref( &v[1] );
+  SET_RETURN( v[1] );
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_dsp(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "DSP", 0);
+
+  mrbc_define_method(0, cls, "dot", c_dsp_dot);
+  mrbc_define_method(0, cls, "rms", c_dsp_rms);
+  mrbc_define_method(0, cls, "argmax", c_dsp_argmax);
+  mrbc_define_method(0, cls, "argmin", c_dsp_argmin);
+  mrbc_define_method(0, cls, "moving_average", c_dsp_moving_average);
+  mrbc_define_method(0, cls, "fir", c_dsp_fir);
+  mrbc_define_method(0, cls, "biquad", c_dsp_biquad);
+  mrbc_define_method(0, cls, "scale", c_dsp_scale);
+}
@@ -0,0 +1,957 @@
+/*! @file
+  @brief
+  File class. FAT16 and FAT32 on SD card.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+    File.mount( "PB6" )			# CS pin of the SD card.
+    f = File.open( "LOG.CSV", "a" )	# "r", "w" or "a"
+    f.write( "12.3,45.6\n" )
+    f.close
+    f = File.open( "LOG.CSV" )		# -> nil if not found.
+    s = f.read( 100 )			# -> String, or nil at the end.
+
+  Only the 8.3 names in the root directory. The long names are skipped.
+  The writes are buffered in 512 bytes, and the whole sectors are
+  written from the data directly by the multi block write. The
+  directory entry (size) is updated at flush and close, so close the
+  file to keep the data. Don't open a file twice to write.
+  The SD card is on SPI3, shared with SPI class.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_gpio.h"
+#include "stm32f4_spi.h"
+#include "sdcard.h"
+
+#define SECTOR_SIZE SD_BLOCK_SIZE
+
+//! file open mode.
+enum {
+  FILE_CLOSED = 0,
+  FILE_READ,
+  FILE_WRITE,
+};
+
+//! date of the files, because no clock. (2024-01-01)
+#define FAT_DATE (((2024 - 1980) << 9) | (1 << 5) | 1)
+
+
+/*!@brief
+  mounted volume.
+*/
+typedef struct FAT_VOLUME {
+  uint8_t type;			//!< 16 or 32, or 0 if not mounted.
+  uint8_t mount_id;		//!< incremented at each mount.
+  uint8_t spc;			//!< sectors per cluster.
+  uint8_t n_fats;		//!< number of FATs.
+  uint32_t fat_start;		//!< sector of FAT.
+  uint32_t fat_size;		//!< sectors per FAT.
+  uint32_t root_start;		//!< sector of the root directory (FAT16)
+				//!< or its cluster (FAT32)
+  uint32_t root_sectors;	//!< sectors of the root directory. (FAT16)
+  uint32_t data_start;		//!< sector of cluster 2.
+  uint32_t n_clusters;		//!< number of clusters.
+  uint32_t last_alloc;		//!< the cluster allocated last.
+  int32_t freq;			//!< SPI clock.
+} FAT_VOLUME;
+
+
+/*!@brief
+  an opened file, in the instance data.
+*/
+typedef struct FAT_FILE {
+  uint8_t mode;			//!< FILE_*
+  uint8_t mount_id;		//!< the volume opened.
+  uint8_t flag_dirty;		//!< buf is modified.
+  uint16_t dir_ofs;		//!< offset of the entry in dir_sect.
+  uint32_t dir_sect;		//!< sector of the directory entry.
+  uint32_t start_clus;		//!< first cluster, or 0 if empty.
+  uint32_t clus;		//!< cluster of the byte at pos-1, or 0.
+  uint32_t size;		//!< file size.
+  uint32_t pos;			//!< read/write position.
+  uint32_t buf_sect;		//!< sector in buf, or ~0.
+  uint8_t buf[SECTOR_SIZE];
+} FAT_FILE;
+
+
+static FAT_VOLUME vol_;
+static uint8_t win_[SECTOR_SIZE];	//!< sector cache of FAT and directory.
+static uint32_t win_sect_ = ~0;
+static uint8_t win_dirty_;
+
+
+static inline uint16_t ld16( const uint8_t *p ) { return p[0] | p[1] << 8; }
+static inline uint32_t ld32( const uint8_t *p ) { return ld16(p) | (uint32_t)ld16(p+2) << 16; }
+static inline void st16( uint8_t *p, uint16_t v ) { p[0] = v; p[1] = v >> 8; }
+static inline void st32( uint8_t *p, uint32_t v ) { st16( p, v ); st16( p+2, v >> 16 ); }
+
+
+//================================================================
+/*! write back the sector cache, to all FATs if it is of FAT.
+*/
+static int win_sync( void )
+{
+  if( !win_dirty_ ) return 0;
+  if( sd_write_blocks( win_sect_, win_, 1 ) != 0 ) return -1;
+
+  if( win_sect_ >= vol_.fat_start && win_sect_ < vol_.fat_start + vol_.fat_size ) {
+    for( int i = 1; i < vol_.n_fats; i++ ) {
+      if( sd_write_blocks( win_sect_ + vol_.fat_size * i, win_, 1 ) != 0 ) return -1;
+    }
+  }
+  win_dirty_ = 0;
+  return 0;
+}
+
+
+//================================================================
+/*! read the sector to the cache.
+*/
+static int win_move( uint32_t sect )
+{
+  if( sect == win_sect_ ) return 0;
+  if( win_sync() != 0 ) return -1;
+
+  win_sect_ = ~0;
+  if( sd_read_blocks( sect, win_, 1 ) != 0 ) return -1;
+  win_sect_ = sect;
+  return 0;
+}
+
+
+//================================================================
+/*! cluster to sector.
+*/
+static inline uint32_t clus_to_sect( uint32_t clus )
+{
+  return vol_.data_start + (clus - 2) * vol_.spc;
+}
+
+static inline int clus_valid( uint32_t clus )
+{
+  return clus >= 2 && clus < vol_.n_clusters + 2;
+}
+
+
+//================================================================
+/*! get the FAT entry.
+
+  @return	the next cluster, end of chain, or ~0 if I/O error.
+*/
+static uint32_t fat_get( uint32_t clus )
+{
+  if( vol_.type == 16 ) {
+    if( win_move( vol_.fat_start + clus / 256 ) != 0 ) return ~0;
+    return ld16( win_ + (clus % 256) * 2 );
+  }
+
+  if( win_move( vol_.fat_start + clus / 128 ) != 0 ) return ~0;
+  return ld32( win_ + (clus % 128) * 4 ) & 0x0fffffff;
+}
+
+
+//================================================================
+/*! set the FAT entry.
+*/
+static int fat_put( uint32_t clus, uint32_t val )
+{
+  if( vol_.type == 16 ) {
+    if( win_move( vol_.fat_start + clus / 256 ) != 0 ) return -1;
+    st16( win_ + (clus % 256) * 2, val );
+  } else {
+    if( win_move( vol_.fat_start + clus / 128 ) != 0 ) return -1;
+    uint8_t *p = win_ + (clus % 128) * 4;
+    st32( p, (ld32(p) & 0xf0000000) | (val & 0x0fffffff) );
+  }
+  win_dirty_ = 1;
+  return 0;
+}
+
+
+//================================================================
+/*! allocate a cluster, and link it.
+
+  @param  prev	the last cluster of the chain, or 0.
+  @return	new cluster, or 0 if full or error.
+*/
+static uint32_t fat_alloc( uint32_t prev )
+{
+  uint32_t clus = vol_.last_alloc;
+
+  for( uint32_t i = 0; i < vol_.n_clusters; i++ ) {
+    if( ++clus >= vol_.n_clusters + 2 ) clus = 2;
+
+    uint32_t val = fat_get( clus );
+    if( val == ~0U ) return 0;
+    if( val != 0 ) continue;
+
+    if( fat_put( clus, 0x0fffffff ) != 0 ) return 0;	// end of chain.
+    if( prev && fat_put( prev, clus ) != 0 ) return 0;
+    vol_.last_alloc = clus;
+    return clus;
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! free the cluster chain.
+*/
+static int fat_free_chain( uint32_t clus )
+{
+  while( clus_valid( clus ) ) {
+    uint32_t next = fat_get( clus );
+    if( next == ~0U || fat_put( clus, 0 ) != 0 ) return -1;
+    clus = next;
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! mount the volume. (the first partition, or no partition table)
+
+  @return	0 if no error.
+*/
+static int fat_mount( void )
+{
+  uint32_t base = 0;
+
+  vol_.type = 0;
+  vol_.mount_id++;
+  win_sect_ = ~0;
+  win_dirty_ = 0;
+
+  if( win_move( 0 ) != 0 ) return -1;
+  if( ld16( win_ + 510 ) != 0xaa55 ) return -1;
+  if( win_[0] != 0xeb && win_[0] != 0xe9 ) {
+    base = ld32( win_ + 446 + 8 );	// MBR
+    if( win_move( base ) != 0 || ld16( win_ + 510 ) != 0xaa55 ) return -1;
+  }
+  if( ld16( win_ + 11 ) != SECTOR_SIZE || win_[13] == 0 ) return -1;
+
+  uint32_t total = ld16( win_ + 19 ) ? ld16( win_ + 19 ) : ld32( win_ + 32 );
+  vol_.spc = win_[13];
+  vol_.n_fats = win_[16];
+  vol_.fat_start = base + ld16( win_ + 14 );
+  vol_.fat_size = ld16( win_ + 22 ) ? ld16( win_ + 22 ) : ld32( win_ + 36 );
+  vol_.root_sectors = (ld16( win_ + 17 ) * 32 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+  uint32_t root = vol_.fat_start + vol_.fat_size * vol_.n_fats;
+  vol_.data_start = root + vol_.root_sectors;
+  vol_.n_clusters = (total - (vol_.data_start - base)) / vol_.spc;
+  vol_.last_alloc = 1;
+
+  if( vol_.n_clusters < 4085 ) return -1;	// FAT12 is not supported.
+  if( vol_.n_clusters < 65525 ) {
+    vol_.type = 16;
+    vol_.root_start = root;
+  } else {
+    vol_.type = 32;
+    vol_.root_start = ld32( win_ + 44 );
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! get the sector of the root directory.
+
+  @param  n	index of the sector.
+  @param  sect	[out] the sector.
+  @param  extend extend the directory. (FAT32)
+  @retval 0	no error.
+  @retval 1	end of the directory.
+  @retval -1	error.
+*/
+static int dir_sector( uint32_t n, uint32_t *sect, int extend )
+{
+  if( vol_.type == 16 ) {
+    if( n >= vol_.root_sectors ) return 1;
+    *sect = vol_.root_start + n;
+    return 0;
+  }
+
+  uint32_t clus = vol_.root_start;
+  for( uint32_t i = n / vol_.spc; i > 0; i-- ) {
+    uint32_t next = fat_get( clus );
+    if( next == ~0U ) return -1;
+    if( !clus_valid( next ) ) {
+      if( !extend ) return 1;
+      if( (next = fat_alloc( clus )) == 0 ) return -1;
+
+      // clear the new cluster.
+      if( win_sync() != 0 ) return -1;
+      win_sect_ = ~0;
+      memset( win_, 0, sizeof(win_) );
+      for( int j = 0; j < vol_.spc; j++ ) {
+	if( sd_write_blocks( clus_to_sect( next ) + j, win_, 1 ) != 0 ) return -1;
+      }
+    }
+    clus = next;
+  }
+
+  *sect = clus_to_sect( clus ) + n % vol_.spc;
+  return 0;
+}
+
+
+//================================================================
+/*! find the directory entry.
+
+  @param  name	8.3 name. (11 bytes)
+  @param  sect	[out] sector of the entry, or of the free entry.
+  @param  ofs	[out] offset of the entry in the sector.
+  @retval 0	found. the entry is in win_.
+  @retval 1	not found. ~0 to sect if no free entry.
+  @retval -1	error.
+*/
+static int dir_find( const uint8_t *name, uint32_t *sect, uint16_t *ofs )
+{
+  uint32_t s;
+  int flag_free = 0;
+
+  *sect = ~0;
+  for( uint32_t n = 0; ; n++ ) {
+    int ret = dir_sector( n, &s, 0 );
+    if( ret != 0 ) return ret;
+    if( win_move( s ) != 0 ) return -1;
+
+    for( int i = 0; i < SECTOR_SIZE; i += 32 ) {
+      const uint8_t *e = win_ + i;
+      if( e[0] == 0x00 || e[0] == 0xe5 ) {	// end, or deleted.
+	if( !flag_free ) {
+	  flag_free = 1;
+	  *sect = s;
+	  *ofs = i;
+	}
+	if( e[0] == 0x00 ) return 1;
+	continue;
+      }
+      if( e[11] == 0x0f || (e[11] & 0x08) ) continue;	// long name, label.
+      if( memcmp( e, name, 11 ) == 0 ) {
+	*sect = s;
+	*ofs = i;
+	return 0;
+      }
+    }
+  }
+}
+
+
+//================================================================
+/*! create the directory entry.
+
+  @param  name	8.3 name.
+  @param  sect	the free entry by dir_find(), or ~0.
+  @param  ofs	the free entry.
+  @return	0 if no error. the entry is in win_.
+*/
+static int dir_create( const uint8_t *name, uint32_t *sect, uint16_t *ofs )
+{
+  if( *sect == ~0U ) {
+    // extend the directory. (FAT32)
+    uint32_t n = 0, s;
+    int ret;
+    while( (ret = dir_sector( n, &s, 0 )) == 0 ) n++;
+    if( ret < 0 || dir_sector( n, &s, 1 ) != 0 ) return -1;
+    *sect = s;
+    *ofs = 0;
+  }
+
+  if( win_move( *sect ) != 0 ) return -1;
+  uint8_t *e = win_ + *ofs;
+  memset( e, 0, 32 );
+  memcpy( e, name, 11 );
+  e[11] = 0x20;			// archive
+  st16( e + 16, FAT_DATE );	// created
+  st16( e + 18, FAT_DATE );	// accessed
+  st16( e + 24, FAT_DATE );	// modified
+  win_dirty_ = 1;
+
+  return 0;
+}
+
+
+//================================================================
+/*! make the 8.3 name.
+
+  @param  s	file name.
+  @param  name	[out] 11 bytes, space padded.
+  @return	0 if no error.
+*/
+static int fat_make_name( const char *s, uint8_t *name )
+{
+  int i = 0, lim = 8;
+
+  memset( name, ' ', 11 );
+  if( *s == '/' ) s++;
+
+  for( ; *s; s++ ) {
+    int ch = (uint8_t)*s;
+    if( ch == '.' && lim == 8 && i > 0 ) {
+      i = 8;
+      lim = 11;
+      continue;
+    }
+    if( ch <= ' ' || ch >= 0x7f || strchr( "\"*+,./:;<=>?[\\]|", ch ) ) return -1;
+    if( i >= lim ) return -1;
+    if( 'a' <= ch && ch <= 'z' ) ch -= 'a' - 'A';
+    name[i++] = ch;
+  }
+
+  return name[0] == ' ' ? -1 : 0;
+}
+
+
+//================================================================
+/*! move to the cluster of pos, at the cluster boundary.
+
+  @param  f	file.
+  @param  flag_alloc allocate if the chain ends.
+  @return	0 if no error.
+*/
+static int file_next_cluster( FAT_FILE *f, int flag_alloc )
+{
+  uint32_t next = f->clus ? fat_get( f->clus ) : f->start_clus;
+  if( next == ~0U ) return -1;
+
+  if( !clus_valid( next ) ) {
+    if( !flag_alloc || (next = fat_alloc( f->clus )) == 0 ) return -1;
+    if( !f->start_clus ) f->start_clus = next;
+  }
+
+  f->clus = next;
+  return 0;
+}
+
+
+//================================================================
+/*! read the file.
+
+  @return	bytes read, or -1 if error.
+*/
+static int file_read( FAT_FILE *f, uint8_t *p, uint32_t n )
+{
+  const uint32_t clus_size = vol_.spc * SECTOR_SIZE;
+
+  if( n > f->size - f->pos ) n = f->size - f->pos;
+  uint32_t total = n;
+
+  while( n > 0 ) {
+    uint32_t ofs_c = f->pos % clus_size;
+    if( ofs_c == 0 && file_next_cluster( f, 0 ) != 0 ) return -1;
+
+    uint32_t sect = clus_to_sect( f->clus ) + ofs_c / SECTOR_SIZE;
+    uint32_t ofs = f->pos % SECTOR_SIZE;
+    uint32_t m;
+
+    if( ofs == 0 && n >= SECTOR_SIZE ) {
+      // whole sectors to the data directly, up to the cluster end.
+      m = n / SECTOR_SIZE;
+      if( m > vol_.spc - ofs_c / SECTOR_SIZE ) m = vol_.spc - ofs_c / SECTOR_SIZE;
+      if( sd_read_blocks( sect, p, m ) != 0 ) return -1;
+      m *= SECTOR_SIZE;
+
+    } else {
+      if( f->buf_sect != sect ) {
+	f->buf_sect = ~0;
+	if( sd_read_blocks( sect, f->buf, 1 ) != 0 ) return -1;
+	f->buf_sect = sect;
+      }
+      m = SECTOR_SIZE - ofs;
+      if( m > n ) m = n;
+      memcpy( p, f->buf + ofs, m );
+    }
+
+    p += m;
+    n -= m;
+    f->pos += m;
+  }
+
+  return total;
+}
+
+
+//================================================================
+/*! write to the end of file.
+
+  @return	0 if no error.
+*/
+static int file_write( FAT_FILE *f, const uint8_t *p, uint32_t n )
+{
+  const uint32_t clus_size = vol_.spc * SECTOR_SIZE;
+
+  while( n > 0 ) {
+    uint32_t ofs_c = f->pos % clus_size;
+    if( ofs_c == 0 && file_next_cluster( f, 1 ) != 0 ) return -1;
+
+    uint32_t sect = clus_to_sect( f->clus ) + ofs_c / SECTOR_SIZE;
+    uint32_t ofs = f->pos % SECTOR_SIZE;
+    uint32_t m;
+
+    if( ofs == 0 && n >= SECTOR_SIZE ) {
+      // whole sectors from the data directly, up to the cluster end.
+      m = n / SECTOR_SIZE;
+      if( m > vol_.spc - ofs_c / SECTOR_SIZE ) m = vol_.spc - ofs_c / SECTOR_SIZE;
+      if( sd_write_blocks( sect, p, m ) != 0 ) return -1;
+      m *= SECTOR_SIZE;
+
+    } else {
+      // a new sector, or the last one loaded at open.
+      f->buf_sect = sect;
+      m = SECTOR_SIZE - ofs;
+      if( m > n ) m = n;
+      memcpy( f->buf + ofs, p, m );
+      f->flag_dirty = 1;
+
+      if( ofs + m == SECTOR_SIZE ) {
+	if( sd_write_blocks( sect, f->buf, 1 ) != 0 ) return -1;
+	f->flag_dirty = 0;
+	f->buf_sect = ~0;
+      }
+    }
+
+    p += m;
+    n -= m;
+    f->pos += m;
+    f->size = f->pos;
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! write the buffer and the directory entry.
+
+  @return	0 if no error.
+*/
+static int file_flush( FAT_FILE *f )
+{
+  if( f->mode != FILE_WRITE ) return 0;
+
+  if( f->flag_dirty ) {
+    if( sd_write_blocks( f->buf_sect, f->buf, 1 ) != 0 ) return -1;
+    f->flag_dirty = 0;
+  }
+
+  if( win_move( f->dir_sect ) != 0 ) return -1;
+  uint8_t *e = win_ + f->dir_ofs;
+  st16( e + 20, f->start_clus >> 16 );
+  st16( e + 26, f->start_clus );
+  st32( e + 28, f->size );
+  st16( e + 24, FAT_DATE );
+  win_dirty_ = 1;
+
+  return win_sync();
+}
+
+
+//================================================================
+/*! open the file.
+
+  @param  f	file.
+  @param  name	8.3 name.
+  @param  mode	FILE_READ or FILE_WRITE.
+  @param  flag_append append to the end.
+  @retval 0	no error.
+  @retval 1	not found.
+  @retval -1	error.
+*/
+static int file_open( FAT_FILE *f, const uint8_t *name, int mode, int flag_append )
+{
+  int ret = dir_find( name, &f->dir_sect, &f->dir_ofs );
+  if( ret < 0 ) return -1;
+  if( ret > 0 ) {
+    if( mode == FILE_READ ) return 1;
+    if( dir_create( name, &f->dir_sect, &f->dir_ofs ) != 0 ) return -1;
+  }
+
+  const uint8_t *e = win_ + f->dir_ofs;
+  if( e[11] & 0x10 ) return -1;			// directory.
+  if( mode == FILE_WRITE && (e[11] & 0x01) ) return -1;	// read only.
+
+  f->start_clus = ld16( e + 26 );
+  if( vol_.type == 32 ) f->start_clus |= (uint32_t)ld16( e + 20 ) << 16;
+  f->size = ld32( e + 28 );
+  f->clus = 0;
+  f->pos = 0;
+  f->buf_sect = ~0;
+  f->flag_dirty = 0;
+  f->mode = mode;
+  f->mount_id = vol_.mount_id;
+  if( mode == FILE_READ ) return 0;
+
+  // truncate.
+  if( !flag_append || f->size == 0 ) {
+    if( fat_free_chain( f->start_clus ) != 0 ) goto ERROR;
+    f->start_clus = 0;
+    f->size = 0;
+    return file_flush( f ) == 0 ? 0 : -1;
+  }
+
+  // move to the end, and load the last sector if partial.
+  const uint32_t clus_size = vol_.spc * SECTOR_SIZE;
+  f->clus = f->start_clus;
+  for( uint32_t i = (f->size - 1) / clus_size; i > 0; i-- ) {
+    f->clus = fat_get( f->clus );
+    if( !clus_valid( f->clus ) ) goto ERROR;
+  }
+  f->pos = f->size;
+  if( f->pos % SECTOR_SIZE ) {
+    uint32_t sect = clus_to_sect( f->clus ) + (f->pos % clus_size) / SECTOR_SIZE;
+    if( sd_read_blocks( sect, f->buf, 1 ) != 0 ) goto ERROR;
+    f->buf_sect = sect;
+  }
+  return 0;
+
+ ERROR:
+  f->mode = FILE_CLOSED;
+  return -1;
+}
+
+
+//================================================================
+/*! get the file of the instance, checking it is opened.
+*/
+static FAT_FILE * file_get( mrbc_vm *vm, mrbc_value v[] )
+{
+  FAT_FILE *f = (FAT_FILE *)v[0].instance->data;
+
+  if( f->mode == FILE_CLOSED || f->mount_id != vol_.mount_id ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "file is not opened");
+    return 0;
+  }
+  return f;
+}
+
+
+//================================================================
+/*! mount
+
+  File.mount( cs_pin, frequency = 20_000_000 )	# -> true
+*/
+static void c_file_mount(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  PIN_HANDLE pin;
+  uint16_t stm32_pin;
+  GPIO_TypeDef *port;
+
+  if( argc < 1 || gpio_set_pin_handle( &pin, &v[1] ) != 0 ||
+      (port = gpio_get_stm32_port( &pin, &stm32_pin )) == 0 ||
+      (argc >= 2 && v[2].tt != MRBC_TT_INTEGER) ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  if( spi_bus_acquire( vm, 400000 ) != 0 ) return;
+
+  HAL_GPIO_WritePin( port, stm32_pin, GPIO_PIN_SET );
+  gpio_setmode( &pin, GPIO_OUT );
+  vol_.freq = (argc >= 2) ? mrbc_integer(v[2]) : 20000000;
+  int ret = sd_init( port, stm32_pin );
+  spi_bus_release( vm );
+
+  if( ret != 0 ) {
+    vol_.type = 0;
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "SD card not found");
+    return;
+  }
+
+  if( spi_bus_acquire( vm, vol_.freq ) != 0 ) return;	// init again at retry.
+  ret = fat_mount();
+  spi_bus_release( vm );
+
+  if( ret != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "no FAT16/FAT32 volume");
+    return;
+  }
+  SET_TRUE_RETURN();
+}
+
+
+//================================================================
+/*! open
+
+  f = File.open( name, mode = "r" )	# mode: "r", "w" or "a"
+
+  @return	File, or nil if not found to read.
+*/
+static void c_file_open(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  uint8_t name[11];
+  int mode = FILE_READ;
+  int flag_append = 0;
+
+  if( argc < 1 || v[1].tt != MRBC_TT_STRING ||
+      fat_make_name( mrbc_string_cstr(&v[1]), name ) != 0 ) goto ERROR_ARGUMENT;
+  if( argc >= 2 ) {
+    if( v[2].tt != MRBC_TT_STRING ) goto ERROR_ARGUMENT;
+    const char *s = mrbc_string_cstr(&v[2]);
+    if( strcmp( s, "r" ) == 0 || strcmp( s, "rb" ) == 0 ) {
+      mode = FILE_READ;
+    } else if( strcmp( s, "w" ) == 0 || strcmp( s, "wb" ) == 0 ) {
+      mode = FILE_WRITE;
+    } else if( strcmp( s, "a" ) == 0 || strcmp( s, "ab" ) == 0 ) {
+      mode = FILE_WRITE;
+      flag_append = 1;
+    } else {
+      goto ERROR_ARGUMENT;
+    }
+  }
+  if( vol_.type == 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "not mounted");
+    return;
+  }
+
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls, sizeof(FAT_FILE));
+  if( !ret.instance ) return;
+  FAT_FILE *f = (FAT_FILE *)ret.instance->data;
+  f->mode = FILE_CLOSED;
+
+  if( spi_bus_acquire( vm, vol_.freq ) != 0 ) {
+    mrbc_decref( &ret );
+    return;
+  }
+  int sts = file_open( f, name, mode, flag_append );
+  spi_bus_release( vm );
+
+  if( sts < 0 ) {
+    mrbc_decref( &ret );
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "SD card I/O error");
+    return;
+  }
+  if( sts > 0 ) {
+    mrbc_decref( &ret );
+    SET_NIL_RETURN();
+    return;
+  }
+  SET_RETURN( ret );
+  return;
+
+ ERROR_ARGUMENT:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! exist?, delete
+
+  File.exist?( name )	# -> true or false
+  File.delete( name )	# -> true if deleted.
+*/
+static void file_find_or_delete(mrbc_vm *vm, mrbc_value v[], int argc, int flag_delete)
+{
+  uint8_t name[11];
+  uint32_t sect;
+  uint16_t ofs;
+
+  if( argc < 1 || v[1].tt != MRBC_TT_STRING ||
+      fat_make_name( mrbc_string_cstr(&v[1]), name ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  if( vol_.type == 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "not mounted");
+    return;
+  }
+
+  if( spi_bus_acquire( vm, vol_.freq ) != 0 ) return;
+  int ret = dir_find( name, &sect, &ofs );
+  if( ret == 0 && flag_delete ) {
+    uint8_t *e = win_ + ofs;
+    if( e[11] & 0x11 ) {
+      ret = 1;		// directory or read only.
+    } else {
+      uint32_t clus = ld16( e + 26 );
+      if( vol_.type == 32 ) clus |= (uint32_t)ld16( e + 20 ) << 16;
+      e[0] = 0xe5;
+      win_dirty_ = 1;
+      if( fat_free_chain( clus ) != 0 || win_sync() != 0 ) ret = -1;
+    }
+  }
+  spi_bus_release( vm );
+
+  if( ret < 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "SD card I/O error");
+    return;
+  }
+  SET_BOOL_RETURN( ret == 0 );
+}
+
+static void c_file_exist(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  file_find_or_delete( vm, v, argc, 0 );
+}
+
+static void c_file_delete(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  file_find_or_delete( vm, v, argc, 1 );
+}
+
+
+//================================================================
+/*! read
+
+  s = f.read( n = nil )	# -> String, or nil at the end.
+*/
+static void c_file_read(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  FAT_FILE *f = file_get( vm, v );
+  if( !f ) return;
+  if( f->mode != FILE_READ ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "not opened for reading");
+    return;
+  }
+
+  uint32_t n = f->size - f->pos;
+  if( argc >= 1 && v[1].tt != MRBC_TT_NIL ) {
+    if( v[1].tt != MRBC_TT_INTEGER || mrbc_integer(v[1]) < 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+      return;
+    }
+    if( n > (uint32_t)mrbc_integer(v[1]) ) n = mrbc_integer(v[1]);
+  }
+  if( n == 0 && f->pos >= f->size ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  if( spi_bus_acquire( vm, vol_.freq ) != 0 ) return;
+
+  mrbc_value ret = mrbc_string_new(vm, 0, n);
+  uint8_t *buf = (uint8_t *)mrbc_string_cstr(&ret);
+  int len = buf ? file_read( f, buf, n ) : 0;
+  spi_bus_release( vm );
+
+  if( !buf ) return;
+  if( len < 0 ) {
+    mrbc_decref( &ret );
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "SD card I/O error");
+    return;
+  }
+  ret.string->size = len;
+  buf[len] = '\0';
+  SET_RETURN( ret );
+}
+
+
+//================================================================
+/*! write
+
+  f.write( s )	# -> Integer
+*/
+static void c_file_write(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  FAT_FILE *f = file_get( vm, v );
+  if( !f ) return;
+  if( f->mode != FILE_WRITE ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "not opened for writing");
+    return;
+  }
+  if( argc < 1 || v[1].tt != MRBC_TT_STRING ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  if( spi_bus_acquire( vm, vol_.freq ) != 0 ) return;
+  int ret = file_write( f, (const uint8_t *)mrbc_string_cstr(&v[1]),
+			mrbc_string_size(&v[1]) );
+  spi_bus_release( vm );
+
+  if( ret != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "SD card I/O error, or full");
+    return;
+  }
+  SET_INT_RETURN( mrbc_string_size(&v[1]) );
+}
+
+
+//================================================================
+/*! flush, close
+
+  f.flush
+  f.close
+*/
+static void file_flush_or_close(mrbc_vm *vm, mrbc_value v[], int argc, int flag_close)
+{
+  FAT_FILE *f = (FAT_FILE *)v[0].instance->data;
+  if( f->mode == FILE_CLOSED ) return;
+  if( !(f = file_get( vm, v )) ) return;
+
+  if( spi_bus_acquire( vm, vol_.freq ) != 0 ) return;
+  int ret = file_flush( f );
+  spi_bus_release( vm );
+
+  if( flag_close ) f->mode = FILE_CLOSED;
+  if( ret != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "SD card I/O error");
+  }
+}
+
+static void c_file_flush(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  file_flush_or_close( vm, v, argc, 0 );
+}
+
+static void c_file_close(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  file_flush_or_close( vm, v, argc, 1 );
+  SET_NIL_RETURN();
+}
+
+
+//================================================================
+/*! size, pos, eof?
+*/
+static void c_file_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  FAT_FILE *f = file_get( vm, v );
+  if( f ) SET_INT_RETURN( f->size );
+}
+
+static void c_file_pos(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  FAT_FILE *f = file_get( vm, v );
+  if( f ) SET_INT_RETURN( f->pos );
+}
+
+static void c_file_eof(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  FAT_FILE *f = file_get( vm, v );
+  if( f ) SET_BOOL_RETURN( f->pos >= f->size );
+}
+
+
+//================================================================
+/*! initialize
+*/
+void mrbc_init_class_file(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "File", 0);
+
+  mrbc_define_method(0, cls, "mount",	c_file_mount);
+  mrbc_define_method(0, cls, "open",	c_file_open);
+  mrbc_define_method(0, cls, "exist?",	c_file_exist);
+  mrbc_define_method(0, cls, "delete",	c_file_delete);
+  mrbc_define_method(0, cls, "read",	c_file_read);
+  mrbc_define_method(0, cls, "write",	c_file_write);
+  mrbc_define_method(0, cls, "flush",	c_file_flush);
+  mrbc_define_method(0, cls, "close",	c_file_close);
+  mrbc_define_method(0, cls, "size",	c_file_size);
+  mrbc_define_method(0, cls, "pos",	c_file_pos);
+  mrbc_define_method(0, cls, "eof?",	c_file_eof);
+}
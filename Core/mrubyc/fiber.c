@@ -0,0 +1,164 @@
+/*! @file
+  @brief
+  Fiber class, coroutines in one task.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  A fiber runs the block in its own register segment, in the same VM
+  as the task. The switching is done in the VM (mrbc_fiber_resume and
+  mrbc_fiber_yield), so a fiber costs only the Fiber object, and
+  a blocking method (e.g. Semaphore#acquire) waits the whole task.
+
+    f = Fiber.new {|x|
+      while true
+        x = Fiber.yield( x * 2 )
+      end
+    }
+    f.resume( 1 )		# -> 2
+    f.resume( 5 )		# -> 10
+    f.alive?			# -> true
+
+    Fiber.new( 64 ) { ... }	# with 64 registers. (default 32)
+  </pre>
+
+  (note) A suspended fiber is kept until it ends, even if not referenced.
+  The block must not break or return out of the fiber, and Fiber.yield
+  can't be called in the block given to a C function that uses
+  mrbc_funcall().
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "../mrubyc_src/mrubyc.h"
+
+#if defined(MRBC_USE_FIBER)
+
+static mrbc_sym sym_block;
+
+
+//================================================================
+/*! (method) new
+
+  Fiber.new( regs_size = MRBC_FIBER_REGS_SIZE ) { block }
+*/
+static void c_fiber_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int regs_size = MRBC_FIBER_REGS_SIZE;
+  if( argc > 1 ) goto ERROR_RETURN;
+  if( argc == 1 ) {
+    if( v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    regs_size = mrbc_integer(v[1]);
+    if( regs_size < MRBC_C_ITER_REGS + 2 || regs_size > UINT16_MAX ) goto ERROR_RETURN;
+  }
+  if( v[argc+1].tt != MRBC_TT_PROC ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "tried to create Proc object without a block");
+    return;
+  }
+
+  int size = sizeof(mrbc_fiber) + sizeof(mrbc_value) * regs_size;
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls, size);
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  mrbc_fiber *fiber = (mrbc_fiber *)ret.instance->data;
+  memset( fiber, 0, size );		// state CREATED, regs empty.
+  fiber->regs_size = regs_size;
+
+  // the block is held by the object until the first resume.
+  mrbc_instance_setiv( &ret, sym_block, &v[argc+1] );
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) resume
+
+  fiber.resume( *args ) -> the value of Fiber.yield, or the block.
+*/
+static void c_fiber_resume(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_fiber *fiber = (mrbc_fiber *)v[0].instance->data;
+
+  if( fiber->state == MRBC_FIBER_CREATED ) {
+    mrbc_value blk = mrbc_instance_getiv( &v[0], sym_block );
+    if( blk.tt != MRBC_TT_PROC ) {
+      mrbc_decref( &blk );
+      mrbc_raise(vm, MRBC_CLASS(RuntimeError), "dead fiber called");
+      return;
+    }
+    fiber->regs[0] = mrbc_nil_value();
+    fiber->regs[1] = blk;
+    mrbc_instance_setiv( &v[0], sym_block, &(mrbc_value){.tt = MRBC_TT_NIL} );
+  }
+
+  mrbc_fiber_resume( vm, v, argc );
+}
+
+
+//================================================================
+/*! (method) yield
+
+  Fiber.yield( *args ) -> the arguments of the next resume.
+*/
+static void c_fiber_yield(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_fiber_yield( vm, v, argc );
+}
+
+
+//================================================================
+/*! (method) alive?
+
+  fiber.alive? -> true, or false if ended.
+*/
+static void c_fiber_alive(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_fiber *fiber = (mrbc_fiber *)v[0].instance->data;
+
+  SET_BOOL_RETURN( fiber->state != MRBC_FIBER_TERMINATED );
+}
+
+
+//================================================================
+/*! (method) current
+
+  Fiber.current -> Fiber, or nil if root.
+*/
+static void c_fiber_current(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( !vm->cur_fiber ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  mrbc_incref( &vm->cur_fiber->self );
+  SET_RETURN( vm->cur_fiber->self );
+}
+#endif
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_fiber(void)
+{
+#if defined(MRBC_USE_FIBER)
+  mrbc_class *cls = mrbc_define_class(0, "Fiber", 0);
+  sym_block = mrbc_str_to_symid("block");
+
+  mrbc_define_method(0, cls, "new", c_fiber_new);
+  mrbc_define_method(0, cls, "resume", c_fiber_resume);
+  mrbc_define_method(0, cls, "yield", c_fiber_yield);
+  mrbc_define_method(0, cls, "alive?", c_fiber_alive);
+  mrbc_define_method(0, cls, "current", c_fiber_current);
+#endif
+}
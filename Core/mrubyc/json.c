@@ -0,0 +1,761 @@
+/*! @file
+  @brief
+  JSON class. Generator and parser in native code.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The generator walks the values and writes the text into one buffer,
+  without making a String for each element. Numbers are formatted by
+  mrbc_printf_int() and mrbc_printf_float().
+
+    json = JSON.generate( {"temp"=>23.5, "id"=>[1,2]} )
+    JSON.generate( obj, buf )		# append to StringBuffer.
+    JSON.generate( obj, uart1 )		# stream to UART.
+
+  The parser reads the text once from the top, and makes only the
+  resulting objects. A string without escapes is made by one copy.
+
+    obj = JSON.parse( json )
+    obj = JSON.parse( json, symbolize_names:true )
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+#include <stdlib.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_uart.h"
+#include "string_buffer.h"
+
+//! nesting level of Array and Hash, to limit the stack usage.
+#if !defined(JSON_MAX_NESTING)
+#define JSON_MAX_NESTING 16
+#endif
+
+//! significant digits of Float, by the size of mrbc_float_t.
+#if MRBC_USE_FLOAT == 1
+#define JSON_FLOAT_DIGITS 7
+#else
+#define JSON_FLOAT_DIGITS 15
+#endif
+
+//! buffer size to stream to UART.
+#define JSON_UART_CHUNK 64
+
+
+/*!@brief
+  output of the generator.
+*/
+typedef struct JSON_WRITER {
+  mrbc_vm *vm;
+  char *buf;		//!< output buffer.
+  int len;		//!< data length in the buffer.
+  int size;		//!< buffer size.
+  UART_HANDLE *uart;	//!< stream to this UART, or NULL.
+  uint8_t flag_fixed;	//!< the buffer can't grow. (StringBuffer)
+} JSON_WRITER;
+
+
+/*!@brief
+  state of the parser.
+*/
+typedef struct JSON_PARSER {
+  mrbc_vm *vm;
+  const char *top;	//!< top of the text.
+  const char *p;	//!< read point.
+  int depth;		//!< nesting level.
+  uint8_t flag_symbolize;	//!< make Symbol keys.
+} JSON_PARSER;
+
+
+static mrbc_class *cls_json;
+static mrbc_class *cls_parser_error;
+static mrbc_class *cls_uart;
+
+
+//================================================================
+/*! make room in the output buffer.
+
+  @param  w	pointer to writer.
+  @param  n	bytes to write.
+  @return	0 if no error, or -1 if buffer full or no memory.
+*/
+static int json_reserve( JSON_WRITER *w, int n )
+{
+  if( w->len + n <= w->size ) return 0;
+
+  if( w->uart ) {
+    uart_write( w->uart, w->buf, w->len );
+    w->len = 0;
+    return -(n > w->size);
+  }
+  if( w->flag_fixed ) return -1;
+
+  int size = w->size * 2;
+  while( size < w->len + n ) size *= 2;
+  char *buf = mrbc_realloc( w->vm, w->buf, size );
+  if( !buf ) return -1;
+
+  w->buf = buf;
+  w->size = size;
+  return 0;
+}
+
+
+//================================================================
+/*! write bytes.
+*/
+static int json_write( JSON_WRITER *w, const void *s, int n )
+{
+  if( w->uart && n > w->size ) {	// too long for the chunk.
+    if( json_reserve( w, w->size ) != 0 ) return -1;
+    uart_write( w->uart, s, n );
+    return 0;
+  }
+  if( json_reserve( w, n ) != 0 ) return -1;
+
+  memcpy( w->buf + w->len, s, n );
+  w->len += n;
+  return 0;
+}
+
+
+//================================================================
+/*! write a character.
+*/
+static inline int json_putc( JSON_WRITER *w, int ch )
+{
+  if( json_reserve( w, 1 ) != 0 ) return -1;
+
+  w->buf[w->len++] = ch;
+  return 0;
+}
+
+
+//================================================================
+/*! write a string with quotes and escapes.
+*/
+static int json_write_string( JSON_WRITER *w, const char *s, int len )
+{
+  static const char HEX[] = "0123456789abcdef";
+  const char *run = s;		// top of the bytes without escape.
+  const char *end = s + len;
+
+  if( json_putc( w, '"' ) != 0 ) return -1;
+
+  for( ; s < end; s++ ) {
+    uint8_t ch = *s;
+    if( ch >= 0x20 && ch != '"' && ch != '\\' ) continue;
+
+    if( json_write( w, run, s - run ) != 0 ) return -1;
+    run = s + 1;
+
+    char esc[6] = { '\\', 0 };
+    int n = 2;
+    switch( ch ) {
+    case '"':  esc[1] = '"';  break;
+    case '\\': esc[1] = '\\'; break;
+    case '\b': esc[1] = 'b';  break;
+    case '\f': esc[1] = 'f';  break;
+    case '\n': esc[1] = 'n';  break;
+    case '\r': esc[1] = 'r';  break;
+    case '\t': esc[1] = 't';  break;
+    default:
+      memcpy( esc + 1, "u00", 3 );
+      esc[4] = HEX[ch >> 4];
+      esc[5] = HEX[ch & 0x0f];
+      n = 6;
+    }
+    if( json_write( w, esc, n ) != 0 ) return -1;
+  }
+  if( json_write( w, run, s - run ) != 0 ) return -1;
+
+  return json_putc( w, '"' );
+}
+
+
+//================================================================
+/*! write a number by the formatter of printf.
+
+  @param  w	pointer to writer.
+  @param  v	Integer or Float.
+*/
+static int json_write_number( JSON_WRITER *w, const mrbc_value *v )
+{
+  static const int MAX_LEN = 32;
+  mrbc_printf_t pf;
+  int ret;
+
+  if( json_reserve( w, MAX_LEN ) != 0 ) return -1;
+
+  if( v->tt == MRBC_TT_INTEGER ) {
+    mrbc_printf_init( &pf, w->buf + w->len, MAX_LEN, "" );
+    ret = mrbc_printf_int( &pf, mrbc_integer(*v), 10 );
+
+  } else {
+#if MRBC_USE_FLOAT
+    static const char FSTR[] = "%.g";	// the precision is in pf.fmt.
+    double d = mrbc_float(*v);
+    if( d != d || d - d != 0 ) {	// NaN and Infinity are not in JSON.
+      return json_write( w, "null", 4 );
+    }
+    // mrbc_printf_float() refers the format backward from pf.fstr.
+    mrbc_printf_init( &pf, w->buf + w->len, MAX_LEN, FSTR + sizeof(FSTR) - 1 );
+    pf.fmt.type = 'g';
+    pf.fmt.precision = JSON_FLOAT_DIGITS;
+    ret = mrbc_printf_float( &pf, d );
+
+    // "1" to "1.0", not to be read as Integer.
+    if( ret == 0 && !memchr( pf.buf, '.', mrbc_printf_len(&pf) ) &&
+	!memchr( pf.buf, 'e', mrbc_printf_len(&pf) ) ) {
+      ret = mrbc_printf_bstr( &pf, ".0", 2, ' ' );
+    }
+#else
+    ret = -1;
+#endif
+  }
+  if( ret != 0 ) return -1;
+
+  w->len += mrbc_printf_len( &pf );
+  return 0;
+}
+
+
+//================================================================
+/*! write a value.
+
+  @param  w	pointer to writer.
+  @param  v	value.
+  @param  depth	nesting level.
+  @return	0 if no error, -1 if buffer full, -2 if type error
+		or -3 if too deep.
+*/
+static int json_generate( JSON_WRITER *w, const mrbc_value *v, int depth )
+{
+  int ret;
+
+  switch( mrbc_type(*v) ) {
+  case MRBC_TT_NIL:	return json_write( w, "null", 4 );
+  case MRBC_TT_FALSE:	return json_write( w, "false", 5 );
+  case MRBC_TT_TRUE:	return json_write( w, "true", 4 );
+
+  case MRBC_TT_INTEGER:
+  case MRBC_TT_FLOAT:
+    return json_write_number( w, v );
+
+  case MRBC_TT_STRING:
+    return json_write_string( w, mrbc_string_cstr(v), mrbc_string_size(v) );
+
+  case MRBC_TT_SYMBOL: {
+    const char *s = mrbc_symbol_cstr( v );
+    return json_write_string( w, s, strlen(s) );
+  }
+
+  case MRBC_TT_ARRAY:
+    if( depth >= JSON_MAX_NESTING ) return -3;
+    if( json_putc( w, '[' ) != 0 ) return -1;
+    for( int i = 0; i < v->array->n_stored; i++ ) {
+      if( i != 0 && json_putc( w, ',' ) != 0 ) return -1;
+      ret = json_generate( w, &v->array->data[i], depth + 1 );
+      if( ret != 0 ) return ret;
+    }
+    return json_putc( w, ']' );
+
+  case MRBC_TT_HASH: {
+    if( depth >= JSON_MAX_NESTING ) return -3;
+    if( json_putc( w, '{' ) != 0 ) return -1;
+    mrbc_hash_iterator ite = mrbc_hash_iterator_new( v );
+    int first = 1;
+    while( mrbc_hash_i_has_next( &ite ) ) {
+      mrbc_value *kv = mrbc_hash_i_next( &ite );
+      if( !first && json_putc( w, ',' ) != 0 ) return -1;
+      first = 0;
+
+      // the key must be a string in JSON.
+      if( kv[0].tt == MRBC_TT_INTEGER ) {
+	if( json_putc( w, '"' ) != 0 ) return -1;
+	ret = json_write_number( w, &kv[0] );
+	if( ret != 0 ) return ret;
+	if( json_putc( w, '"' ) != 0 ) return -1;
+      } else if( kv[0].tt == MRBC_TT_STRING || kv[0].tt == MRBC_TT_SYMBOL ) {
+	ret = json_generate( w, &kv[0], depth + 1 );
+	if( ret != 0 ) return ret;
+      } else {
+	return -2;
+      }
+      if( json_putc( w, ':' ) != 0 ) return -1;
+      ret = json_generate( w, &kv[1], depth + 1 );
+      if( ret != 0 ) return ret;
+    }
+    return json_putc( w, '}' );
+  }
+
+  default:
+    break;
+  }
+
+  // StringBuffer is written as a string.
+  const STRING_BUFFER *sb = string_buffer_get( v );
+  if( sb ) return json_write_string( w, sb->data, sb->length );
+
+  return -2;
+}
+
+
+//================================================================
+/*! skip the white spaces.
+*/
+static inline void json_skip_space( JSON_PARSER *ps )
+{
+  while( *ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r' ) {
+    ps->p++;
+  }
+}
+
+
+//================================================================
+/*! read 4 hex digits of \\uXXXX.
+
+  @return	code, or -1 if error.
+*/
+static int json_read_hex4( const char *s )
+{
+  int code = 0;
+
+  for( int i = 0; i < 4; i++ ) {
+    int ch = s[i];
+    if( '0' <= ch && ch <= '9' ) ch -= '0';
+    else if( 'a' <= (ch | 0x20) && (ch | 0x20) <= 'f' ) ch = (ch | 0x20) - 'a' + 10;
+    else return -1;
+    code = code << 4 | ch;
+  }
+  return code;
+}
+
+
+//================================================================
+/*! decode the escape sequence.
+
+  @param  s	pointer to the next of '\\'.
+  @param  out	[out] decoded bytes. (up to 4 bytes in UTF-8)
+  @param  n_out	[out] length of the decoded bytes.
+  @return	length of the sequence after '\\', or 0 if error.
+*/
+static int json_unescape( const char *s, char *out, int *n_out )
+{
+  static const char ESC_FROM[] = "\"\\/bfnrt";
+  static const char ESC_TO[]   = "\"\\/\b\f\n\r\t";
+
+  const char *e = strchr( ESC_FROM, *s );
+  if( *s && e ) {
+    out[0] = ESC_TO[e - ESC_FROM];
+    *n_out = 1;
+    return 1;
+  }
+  if( *s != 'u' ) return 0;
+
+  int code = json_read_hex4( s + 1 );
+  int len = 5;
+  if( code < 0 ) return 0;
+
+  // surrogate pair.
+  if( 0xd800 <= code && code < 0xdc00 && s[5] == '\\' && s[6] == 'u' ) {
+    int low = json_read_hex4( s + 7 );
+    if( 0xdc00 <= low && low < 0xe000 ) {
+      code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+      len = 11;
+    }
+  }
+
+  // to UTF-8
+  if( code < 0x80 ) {
+    out[0] = code;
+    *n_out = 1;
+  } else if( code < 0x800 ) {
+    out[0] = 0xc0 | (code >> 6);
+    out[1] = 0x80 | (code & 0x3f);
+    *n_out = 2;
+  } else if( code < 0x10000 ) {
+    out[0] = 0xe0 | (code >> 12);
+    out[1] = 0x80 | ((code >> 6) & 0x3f);
+    out[2] = 0x80 | (code & 0x3f);
+    *n_out = 3;
+  } else {
+    out[0] = 0xf0 | (code >> 18);
+    out[1] = 0x80 | ((code >> 12) & 0x3f);
+    out[2] = 0x80 | ((code >> 6) & 0x3f);
+    out[3] = 0x80 | (code & 0x3f);
+    *n_out = 4;
+  }
+  return len;
+}
+
+
+//================================================================
+/*! parse a string.
+
+  The text is scanned once to get the decoded length, then decoded into
+  the new String, so that the String is allocated only once.
+
+  @param  ps	pointer to parser, the read point is at '"'.
+  @param  ret	[out] String, or Symbol if flag_sym.
+  @param  flag_sym make Symbol.
+  @return	0 if no error, -1 if syntax error, or -2 if no memory.
+*/
+static int json_parse_string( JSON_PARSER *ps, mrbc_value *ret, int flag_sym )
+{
+  const char *s = ++ps->p;
+  char tmp[4];
+  int n, len = 0;
+
+  // get the length.
+  while( *s != '"' ) {
+    if( (uint8_t)*s < 0x20 ) return -1;		// including '\0'.
+    if( *s == '\\' ) {
+      int skip = json_unescape( s + 1, tmp, &n );
+      if( skip == 0 ) return -1;
+      s += skip + 1;
+      len += n;
+    } else {
+      s++;
+      len++;
+    }
+  }
+
+  mrbc_value str = mrbc_string_new( ps->vm, NULL, len );
+  if( !str.string ) return -2;
+
+  // decode.
+  char *d = (char *)mrbc_string_cstr( &str );
+  for( s = ps->p; *s != '"'; ) {
+    if( *s == '\\' ) {
+      s += json_unescape( s + 1, d, &n ) + 1;
+      d += n;
+    } else {
+      *d++ = *s++;
+    }
+  }
+  *d = '\0';
+  ps->p = s + 1;
+
+  if( flag_sym ) {
+    *ret = mrbc_symbol_new( ps->vm, mrbc_string_cstr( &str ) );
+    mrbc_decref( &str );
+    return (ret->tt == MRBC_TT_SYMBOL) ? 0 : -2;
+  }
+
+  *ret = str;
+  return 0;
+}
+
+
+//================================================================
+/*! parse a number.
+
+  @return	0 if no error, or -1 if syntax error.
+*/
+static int json_parse_number( JSON_PARSER *ps, mrbc_value *ret )
+{
+  const char *s = ps->p;
+  int flag_neg = (*s == '-');
+  const mrbc_uint_t max = ((mrbc_uint_t)-1 >> 1) + flag_neg;
+  mrbc_uint_t n = 0;
+  int flag_float = 0;
+
+  if( flag_neg ) s++;
+  if( *s < '0' || '9' < *s ) return -1;
+  if( *s == '0' ) {
+    s++;
+  } else {
+    for( ; '0' <= *s && *s <= '9'; s++ ) {
+      int d = *s - '0';
+      if( n > (max - d) / 10 ) flag_float = 1;	// overflow.
+      n = n * 10 + d;
+    }
+  }
+
+  if( *s == '.' ) {
+    s++;
+    if( *s < '0' || '9' < *s ) return -1;
+    while( '0' <= *s && *s <= '9' ) s++;
+    flag_float = 1;
+  }
+  if( *s == 'e' || *s == 'E' ) {
+    s++;
+    if( *s == '+' || *s == '-' ) s++;
+    if( *s < '0' || '9' < *s ) return -1;
+    while( '0' <= *s && *s <= '9' ) s++;
+    flag_float = 1;
+  }
+
+  if( flag_float ) {
+#if MRBC_USE_FLOAT
+    *ret = mrbc_float_value( ps->vm, atof( ps->p ) );
+#else
+    return -1;
+#endif
+  } else {
+    *ret = mrbc_integer_value( flag_neg ? -(mrbc_int_t)n : (mrbc_int_t)n );
+  }
+
+  ps->p = s;
+  return 0;
+}
+
+
+//================================================================
+/*! parse a value.
+
+  @param  ps	pointer to parser.
+  @param  ret	[out] parsed value.
+  @return	0 if no error, -1 if syntax error, -2 if no memory
+		or -3 if too deep.
+*/
+static int json_parse_value( JSON_PARSER *ps, mrbc_value *ret )
+{
+  int err = 0;
+
+  json_skip_space( ps );
+
+  switch( *ps->p ) {
+  case '"':
+    return json_parse_string( ps, ret, 0 );
+
+  case '[':
+    if( ++ps->depth > JSON_MAX_NESTING ) return -3;
+    ps->p++;
+    *ret = mrbc_array_new( ps->vm, 0 );
+    if( !ret->array ) return -2;
+
+    json_skip_space( ps );
+    if( *ps->p == ']' ) goto END_OF_CONTAINER;
+    while( 1 ) {
+      mrbc_value v;
+      if( (err = json_parse_value( ps, &v )) != 0 ) goto ERROR_CONTAINER;
+      if( mrbc_array_push( ret, &v ) != 0 ) {
+	mrbc_decref( &v );
+	err = -2;
+	goto ERROR_CONTAINER;
+      }
+      json_skip_space( ps );
+      if( *ps->p == ']' ) goto END_OF_CONTAINER;
+      if( *ps->p++ != ',' ) goto SYNTAX_ERROR_CONTAINER;
+    }
+
+  case '{':
+    if( ++ps->depth > JSON_MAX_NESTING ) return -3;
+    ps->p++;
+    *ret = mrbc_hash_new( ps->vm, 0 );
+    if( !ret->hash ) return -2;
+
+    json_skip_space( ps );
+    if( *ps->p == '}' ) goto END_OF_CONTAINER;
+    while( 1 ) {
+      mrbc_value key, v;
+      json_skip_space( ps );
+      if( *ps->p != '"' ) goto SYNTAX_ERROR_CONTAINER;
+      err = json_parse_string( ps, &key, ps->flag_symbolize );
+      if( err != 0 ) goto ERROR_CONTAINER;
+      json_skip_space( ps );
+      if( *ps->p++ != ':' ) {
+	mrbc_decref( &key );
+	goto SYNTAX_ERROR_CONTAINER;
+      }
+      if( (err = json_parse_value( ps, &v )) != 0 ) {
+	mrbc_decref( &key );
+	goto ERROR_CONTAINER;
+      }
+      if( mrbc_hash_set( ret, &key, &v ) != 0 ) {
+	mrbc_decref( &key );
+	mrbc_decref( &v );
+	err = -2;
+	goto ERROR_CONTAINER;
+      }
+      json_skip_space( ps );
+      if( *ps->p == '}' ) goto END_OF_CONTAINER;
+      if( *ps->p++ != ',' ) goto SYNTAX_ERROR_CONTAINER;
+    }
+
+  case 't':
+    if( strncmp( ps->p, "true", 4 ) != 0 ) return -1;
+    ps->p += 4;
+    *ret = mrbc_true_value();
+    return 0;
+
+  case 'f':
+    if( strncmp( ps->p, "false", 5 ) != 0 ) return -1;
+    ps->p += 5;
+    *ret = mrbc_false_value();
+    return 0;
+
+  case 'n':
+    if( strncmp( ps->p, "null", 4 ) != 0 ) return -1;
+    ps->p += 4;
+    *ret = mrbc_nil_value();
+    return 0;
+
+  default:
+    return json_parse_number( ps, ret );
+  }
+
+ END_OF_CONTAINER:
+  ps->p++;
+  ps->depth--;
+  return 0;
+
+ SYNTAX_ERROR_CONTAINER:
+  err = -1;
+ ERROR_CONTAINER:
+  mrbc_decref( ret );
+  return err;
+}
+
+
+//================================================================
+/*! (method) generate
+
+  JSON.generate( obj ) -> String
+  JSON.generate( obj, buf ) -> buf	(append to StringBuffer)
+  JSON.generate( obj, uart ) -> nil	(write to UART)
+*/
+static void c_json_generate(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  JSON_WRITER w = { .vm = vm };
+  STRING_BUFFER *sb = NULL;
+  char chunk[JSON_UART_CHUNK];
+
+  if( argc < 1 || argc > 2 ) goto ARGUMENT_ERROR;
+
+  if( argc == 1 ) {
+    w.size = 32;
+    w.buf = mrbc_alloc( vm, w.size );
+    if( !w.buf ) return;	// ENOMEM
+
+  } else if( (sb = string_buffer_get( &v[2] )) != NULL ) {
+    w.buf = sb->data + sb->length;
+    w.size = sb->capacity - sb->length;
+    w.flag_fixed = 1;
+
+  } else if( v[2].tt == MRBC_TT_OBJECT && cls_uart && v[2].instance->cls == cls_uart ) {
+    w.buf = chunk;
+    w.size = sizeof(chunk);
+    w.uart = *(UART_HANDLE **)(v[2].instance->data);
+
+  } else {
+    goto ARGUMENT_ERROR;
+  }
+
+  int ret = json_generate( &w, &v[1], 0 );
+  if( argc == 1 && ret == 0 ) ret = json_reserve( &w, 1 );	// for '\0'.
+
+  if( argc == 1 ) {
+    if( ret == 0 ) {
+      mrbc_realloc( vm, w.buf, w.len+1 );	// shrink suitable size.
+      w.buf[w.len] = '\0';
+      mrbc_value str = mrbc_string_new_alloc( vm, w.buf, w.len );
+      SET_RETURN( str );
+      return;
+    }
+    mrbc_free( vm, w.buf );
+
+  } else if( sb ) {
+    if( ret == 0 ) sb->length += w.len;
+    sb->data[sb->length] = '\0';
+    SET_RETURN( v[2] );
+
+  } else {
+    if( w.len ) uart_write( w.uart, w.buf, w.len );
+    SET_NIL_RETURN();
+  }
+
+  switch( ret ) {
+  case -1:
+    if( sb ) {
+      mrbc_raise(vm, MRBC_CLASS(IndexError), "StringBuffer is full.");
+    } else {
+      mrbc_raise(vm, MRBC_CLASS(NoMemoryError), 0);
+    }
+    break;
+  case -2: mrbc_raise(vm, MRBC_CLASS(TypeError), "can't generate JSON");  break;
+  case -3: mrbc_raise(vm, MRBC_CLASS(ArgumentError), "nesting too deep"); break;
+  }
+  return;
+
+ ARGUMENT_ERROR:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) parse
+
+  JSON.parse( str, symbolize_names:false ) -> Object
+*/
+static void c_json_parse(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  MRBC_KW_ARG(symbolize_names);
+  if( !MRBC_KW_END() ) goto RETURN;
+  if( MRBC_KW_NARGC() != 1 || v[1].tt != MRBC_TT_STRING ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    goto RETURN;
+  }
+
+  JSON_PARSER ps = {
+    .vm = vm,
+    .top = mrbc_string_cstr(&v[1]),
+    .p = mrbc_string_cstr(&v[1]),
+    .flag_symbolize = MRBC_KW_ISVALID(symbolize_names) &&
+		      mrbc_type(symbolize_names) != MRBC_TT_NIL &&
+		      mrbc_type(symbolize_names) != MRBC_TT_FALSE,
+  };
+  mrbc_value ret;
+  int err = json_parse_value( &ps, &ret );
+  if( err == 0 ) {
+    json_skip_space( &ps );
+    if( *ps.p != '\0' ) {
+      mrbc_decref( &ret );
+      err = -1;
+    }
+  }
+
+  switch( err ) {
+  case 0:
+    SET_RETURN( ret );
+    break;
+  case -2:
+    mrbc_raise(vm, MRBC_CLASS(NoMemoryError), 0);
+    break;
+  case -3:
+    mrbc_raise(vm, cls_parser_error, "nesting too deep");
+    break;
+  default:
+    mrbc_raisef(vm, cls_parser_error, "unexpected character at %d",
+		(int)(ps.p - ps.top));
+  }
+
+ RETURN:
+  MRBC_KW_DELETE(symbolize_names);
+}
+
+
+//================================================================
+/*! Initializer
+
+  @note  Call after mrbc_init_class_uart().
+*/
+void mrbc_init_class_json(void)
+{
+  cls_json = mrbc_define_class(0, "JSON", 0);
+  cls_parser_error = mrbc_define_class_under(0, cls_json, "ParserError",
+					     MRBC_CLASS(StandardError));
+  cls_uart = mrbc_get_class_by_name("UART");
+
+  mrbc_define_method(0, cls_json, "generate", c_json_generate);
+  mrbc_define_method_kw(0, cls_json, "parse", c_json_parse);
+}
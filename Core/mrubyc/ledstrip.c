@@ -0,0 +1,328 @@
+/*! @file
+  @brief
+  LEDStrip class. WS2812 (NeoPixel) by SPI DMA.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+    strip = LEDStrip.new( 300 )
+    strip[0] = 0xff0000		# RGB
+    strip.set( 1, 0, 255, 0 )	# index, R, G, B
+    strip.fill( 0x000010 )
+    strip.brightness = 64	# 0..255, scales at show.
+    strip.show			# sent by DMA in background.
+
+  Connect DIN of the strip to SPI3 MOSI. (PC12, CN7 3)
+  A bit of WS2812 is 3 bits of SPI at 2.625MHz, 0 is 100 and 1 is 110.
+  So a LED is 9 bytes, and 300 LEDs take 8.5ms of DMA.
+  The bus is shared with SPI class, and show waits while it is used.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_spi.h"
+
+//! SPI clock. 42MHz / 16
+static const int32_t LEDSTRIP_SPI_FREQ = 2625000;
+
+//! reset (latch) time before the data, in SPI bytes. (>= 280us)
+#define LEDSTRIP_RESET_BYTES 96
+
+//! SPI bytes per LED.
+#define LEDSTRIP_BYTES_PER_LED 9
+
+
+/*!@brief
+  LED strip, in the instance data.
+*/
+typedef struct LEDSTRIP {
+  uint16_t n_led;		//!< number of LEDs.
+  uint8_t brightness;		//!< 0..255
+  uint8_t *pixel;		//!< RGB, 3 bytes per LED.
+  uint8_t *spi_data;		//!< encoded, sent by DMA.
+  uint8_t data[];		//!< pixel and spi_data.
+} LEDSTRIP;
+
+
+//================================================================
+/*! encode a byte into 3 bytes of SPI bits.
+*/
+static inline uint8_t * ledstrip_encode_byte( uint8_t *p, uint8_t b )
+{
+  uint32_t x = 0;
+
+  for( int i = 0; i < 8; i++ ) {
+    x = (x << 3) | ((b & 0x80) ? 0x6 : 0x4);
+    b <<= 1;
+  }
+  *p++ = x >> 16;
+  *p++ = x >> 8;
+  *p++ = x;
+
+  return p;
+}
+
+
+//================================================================
+/*! encode the pixels, in GRB order of WS2812.
+*/
+static void ledstrip_encode( LEDSTRIP *s )
+{
+  const uint8_t *px = s->pixel;
+  uint8_t *p = s->spi_data + LEDSTRIP_RESET_BYTES;
+  unsigned scale = s->brightness + 1;
+
+  for( int i = 0; i < s->n_led; i++, px += 3 ) {
+    p = ledstrip_encode_byte( p, (px[1] * scale) >> 8 );
+    p = ledstrip_encode_byte( p, (px[0] * scale) >> 8 );
+    p = ledstrip_encode_byte( p, (px[2] * scale) >> 8 );
+  }
+}
+
+
+//================================================================
+/*! get the index argument.
+
+  @return	index, or -1 if out of range.
+*/
+static int ledstrip_get_index( const LEDSTRIP *s, const mrbc_value *v )
+{
+  if( v->tt != MRBC_TT_INTEGER ) return -1;
+
+  int i = mrbc_integer(*v);
+  if( i < 0 ) i += s->n_led;
+  return (i >= 0 && i < s->n_led) ? i : -1;
+}
+
+
+//================================================================
+/*! set the color of the LED.
+
+  @param  p	pixel.
+  @param  argc	1 for 0xRRGGBB or [r, g, b], 3 for r, g, b.
+  @return	0 if no error.
+*/
+static int ledstrip_set_color( uint8_t *p, const mrbc_value *v, int argc )
+{
+  mrbc_int_t rgb[3];
+
+  if( argc == 1 && v->tt == MRBC_TT_INTEGER ) {
+    mrbc_int_t c = mrbc_integer(*v);
+    rgb[0] = (c >> 16) & 0xff;
+    rgb[1] = (c >> 8) & 0xff;
+    rgb[2] = c & 0xff;
+
+  } else if( argc == 1 && v->tt == MRBC_TT_ARRAY && mrbc_array_size(v) == 3 ) {
+    for( int i = 0; i < 3; i++ ) {
+      mrbc_value c = mrbc_array_get(v, i);
+      if( c.tt != MRBC_TT_INTEGER ) return -1;
+      rgb[i] = mrbc_integer(c);
+    }
+
+  } else if( argc == 3 ) {
+    for( int i = 0; i < 3; i++ ) {
+      if( v[i].tt != MRBC_TT_INTEGER ) return -1;
+      rgb[i] = mrbc_integer(v[i]);
+    }
+
+  } else {
+    return -1;
+  }
+
+  for( int i = 0; i < 3; i++ ) {
+    if( rgb[i] < 0 || rgb[i] > 255 ) return -1;
+    p[i] = rgb[i];
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! constructor
+
+  strip = LEDStrip.new( n_led )
+*/
+static void c_ledstrip_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER ||
+      mrbc_integer(v[1]) < 1 || mrbc_integer(v[1]) > 2000 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  int n = mrbc_integer(v[1]);
+  int spi_bytes = LEDSTRIP_RESET_BYTES + n * LEDSTRIP_BYTES_PER_LED;
+
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls,
+			sizeof(LEDSTRIP) + n * 3 + spi_bytes);
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  LEDSTRIP *s = (LEDSTRIP *)ret.instance->data;
+  s->n_led = n;
+  s->brightness = 255;
+  s->pixel = s->data;
+  s->spi_data = s->data + n * 3;
+  memset( s->data, 0, n * 3 + spi_bytes );
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! setter
+
+  strip[i] = 0xRRGGBB, or [r, g, b]
+*/
+static void c_ledstrip_set_index(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  LEDSTRIP *s = (LEDSTRIP *)v[0].instance->data;
+  int i = (argc == 2) ? ledstrip_get_index( s, &v[1] ) : -1;
+
+  if( i < 0 || ledstrip_set_color( s->pixel + i * 3, &v[2], 1 ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+  }
+}
+
+
+//================================================================
+/*! set
+
+  strip.set( i, r, g, b )
+*/
+static void c_ledstrip_set(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  LEDSTRIP *s = (LEDSTRIP *)v[0].instance->data;
+  int i = (argc == 4 || argc == 2) ? ledstrip_get_index( s, &v[1] ) : -1;
+
+  if( i < 0 || ledstrip_set_color( s->pixel + i * 3, &v[2], argc - 1 ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+  }
+}
+
+
+//================================================================
+/*! getter
+
+  strip[i]	# -> 0xRRGGBB
+*/
+static void c_ledstrip_get_index(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  LEDSTRIP *s = (LEDSTRIP *)v[0].instance->data;
+  int i = (argc == 1) ? ledstrip_get_index( s, &v[1] ) : -1;
+
+  if( i < 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+  const uint8_t *p = s->pixel + i * 3;
+  SET_INT_RETURN( (mrbc_int_t)p[0] << 16 | p[1] << 8 | p[2] );
+}
+
+
+//================================================================
+/*! fill, clear
+
+  strip.fill( 0xRRGGBB )	# or [r, g, b], or r, g, b
+  strip.clear
+*/
+static void c_ledstrip_fill(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  LEDSTRIP *s = (LEDSTRIP *)v[0].instance->data;
+  uint8_t rgb[3] = {0};
+
+  if( argc != 0 && ledstrip_set_color( rgb, &v[1], argc ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  uint8_t *p = s->pixel;
+  for( int i = 0; i < s->n_led; i++ ) {
+    *p++ = rgb[0];
+    *p++ = rgb[1];
+    *p++ = rgb[2];
+  }
+}
+
+
+//================================================================
+/*! brightness=
+
+  strip.brightness = 0..255
+*/
+static void c_ledstrip_set_brightness(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  LEDSTRIP *s = (LEDSTRIP *)v[0].instance->data;
+
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER ||
+      mrbc_integer(v[1]) < 0 || mrbc_integer(v[1]) > 255 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  s->brightness = mrbc_integer(v[1]);
+}
+
+
+//================================================================
+/*! brightness, size
+*/
+static void c_ledstrip_brightness(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  LEDSTRIP *s = (LEDSTRIP *)v[0].instance->data;
+  SET_INT_RETURN( s->brightness );
+}
+
+static void c_ledstrip_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  LEDSTRIP *s = (LEDSTRIP *)v[0].instance->data;
+  SET_INT_RETURN( s->n_led );
+}
+
+
+//================================================================
+/*! show
+
+  strip.show
+
+  Waits for the previous frame and the other users of SPI, and starts
+  DMA of the frame. It returns without waiting for the end.
+*/
+static void c_ledstrip_show(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  LEDSTRIP *s = (LEDSTRIP *)v[0].instance->data;
+
+  // encode after the bus is acquired, while the previous frame is not in DMA.
+  if( spi_bus_acquire( vm, LEDSTRIP_SPI_FREQ ) != 0 ) return;
+  ledstrip_encode( s );
+
+  int ret = spi_bus_transmit_background( vm, &v[0], s->spi_data,
+			LEDSTRIP_RESET_BYTES + s->n_led * LEDSTRIP_BYTES_PER_LED );
+  if( ret < 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "LEDStrip: SPI DMA error");
+  }
+}
+
+
+//================================================================
+/*! initialize
+*/
+void mrbc_init_class_ledstrip(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "LEDStrip", 0);
+
+  mrbc_define_method(0, cls, "new", c_ledstrip_new);
+  mrbc_define_method(0, cls, "[]=", c_ledstrip_set_index);
+  mrbc_define_method(0, cls, "[]", c_ledstrip_get_index);
+  mrbc_define_method(0, cls, "set", c_ledstrip_set);
+  mrbc_define_method(0, cls, "fill", c_ledstrip_fill);
+  mrbc_define_method(0, cls, "clear", c_ledstrip_fill);
+  mrbc_define_method(0, cls, "brightness=", c_ledstrip_set_brightness);
+  mrbc_define_method(0, cls, "brightness", c_ledstrip_brightness);
+  mrbc_define_method(0, cls, "size", c_ledstrip_size);
+  mrbc_define_method(0, cls, "show", c_ledstrip_show);
+}
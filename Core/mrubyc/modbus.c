@@ -0,0 +1,773 @@
+/*! @file
+  @brief
+  Modbus class. Modbus RTU master and slave on UART.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The frames are sent and received by the UART FIFO, and split at the
+  IDLE line detected by the UART driver. (see uart_irq_handler) The
+  CRC and the register tables are processed in C.
+
+  (slave)
+    regs = Array.new(100, 0)
+    mb = Modbus.new( uart, unit_id:17, holding_registers:regs )
+    loop {
+      mb.serve		# process one request.
+    }
+
+  (master)
+    mb = Modbus.new( uart )
+    v = mb.read_holding_registers( 17, 0, 4 )	# -> [1,2,3,4] or nil
+    mb.write_register( 17, 10, 1234 )		# -> true or nil
+    p mb.error if !v
+
+  A table is an Array, or an object that has the methods [] and []=.
+  The coils and the discrete inputs are true, false, 1 or 0.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_uart.h"
+#include "crc.h"
+
+//! the maximum frame size of Modbus RTU.
+#define MODBUS_SIZE_FRAME 256
+
+//! the exception codes.
+#define MODBUS_EX_ILLEGAL_FUNCTION	1
+#define MODBUS_EX_ILLEGAL_ADDRESS	2
+#define MODBUS_EX_ILLEGAL_VALUE		3
+#define MODBUS_EX_DEVICE_FAILURE	4
+
+//! the errors of the master.
+#define MODBUS_ERROR_TIMEOUT		(-1)
+#define MODBUS_ERROR_CRC		(-2)
+#define MODBUS_ERROR_BAD_RESPONSE	(-3)
+
+
+/*!@brief
+  state of a Modbus instance, in the instance data.
+*/
+typedef struct MODBUS_HANDLE {
+  UART_HANDLE *uart;
+  const mrbc_vm *vm;		//!< the VM waiting for the response.
+  uint32_t deadline;		//!< tick of the response timeout.
+  uint16_t timeout;		//!< response timeout in ms.
+  int16_t error;		//!< last error, or the exception code.
+  uint8_t unit_id;		//!< slave address, or 0 if master only.
+  uint8_t flag_waiting;		//!< waiting for the response.
+  uint8_t req[6];		//!< header of the request in waiting.
+} MODBUS_HANDLE;
+
+
+//! the register tables. kept in the instance variables.
+static const char * const TBL_NAME[] = {
+  0, "coils", "discrete_inputs", "holding_registers", "input_registers"
+};
+static mrbc_sym_cache sym_table_[5];
+static mrbc_sym_cache sym_uart_, sym_aref_, sym_aset_;
+
+
+//================================================================
+/*! get the register table.
+
+  @param  self	Modbus instance.
+  @param  func	function code 1 to 4, or 5,6,15,16 for the writes.
+  @return	the table (incremented), or nil.
+*/
+static mrbc_value modbus_get_table( mrbc_value *self, int func )
+{
+  switch( func ) {
+  case 5: case 15: func = 1; break;
+  case 6: case 16: func = 3; break;
+  }
+
+  mrbc_sym sym_id = mrbc_str_to_symid_cached( &sym_table_[func], TBL_NAME[func] );
+  return mrbc_instance_getiv( self, sym_id );
+}
+
+
+//================================================================
+/*! read a register or a bit from the table.
+
+  @param  vm	pointer to VM.
+  @param  tbl	the table.
+  @param  addr	address.
+  @param  ret	[out] the value.
+  @return	0 if no error, or the exception code.
+*/
+static int modbus_table_read( mrbc_vm *vm, mrbc_value *tbl, int addr, uint16_t *ret )
+{
+  mrbc_value val;
+
+  if( tbl->tt == MRBC_TT_ARRAY ) {
+    if( addr >= mrbc_array_size(tbl) ) return MODBUS_EX_ILLEGAL_ADDRESS;
+    val = mrbc_array_get( tbl, addr );
+    mrbc_incref( &val );
+
+  } else {
+    mrbc_value idx = mrbc_integer_value( addr );
+    val = mrbc_funcall( vm, tbl, mrbc_str_to_symid_cached( &sym_aref_, "[]" ),
+			1, &idx );
+    if( mrbc_israised(vm) ) return MODBUS_EX_DEVICE_FAILURE;
+  }
+
+  int ex = 0;
+  switch( val.tt ) {
+  case MRBC_TT_INTEGER: *ret = mrbc_integer(val); break;
+  case MRBC_TT_TRUE:	*ret = 1;	break;
+  case MRBC_TT_FALSE:	*ret = 0;	break;
+  case MRBC_TT_NIL:	ex = MODBUS_EX_ILLEGAL_ADDRESS; break;
+  default:		ex = MODBUS_EX_DEVICE_FAILURE; break;
+  }
+
+  mrbc_decref( &val );
+  return ex;
+}
+
+
+//================================================================
+/*! write a register or a bit to the table.
+
+  @param  vm	pointer to VM.
+  @param  tbl	the table.
+  @param  addr	address.
+  @param  value	the value.
+  @param  is_bit write a coil. the type of the element in Array is kept.
+  @return	0 if no error, or the exception code.
+*/
+static int modbus_table_write( mrbc_vm *vm, mrbc_value *tbl, int addr, uint16_t value, int is_bit )
+{
+  mrbc_value val = mrbc_integer_value( value );
+
+  if( tbl->tt == MRBC_TT_ARRAY ) {
+    if( addr >= mrbc_array_size(tbl) ) return MODBUS_EX_ILLEGAL_ADDRESS;
+    if( is_bit && mrbc_array_get( tbl, addr ).tt != MRBC_TT_INTEGER ) {
+      val = mrbc_bool_value( value );
+    }
+    mrbc_array_set( tbl, addr, &val );
+    return 0;
+  }
+
+  if( is_bit ) val = mrbc_bool_value( value );
+
+  mrbc_value args[2] = { mrbc_integer_value( addr ), val };
+  mrbc_value ret = mrbc_funcall( vm, tbl,
+		mrbc_str_to_symid_cached( &sym_aset_, "[]=" ), 2, args );
+  mrbc_decref( &ret );
+
+  return mrbc_israised(vm) ? MODBUS_EX_DEVICE_FAILURE : 0;
+}
+
+
+//================================================================
+/*! process a request, and make the response in the same buffer.
+
+  @param  vm	pointer to VM.
+  @param  self	Modbus instance.
+  @param  buf	the request without CRC, and the response.
+  @param  len	length of the request.
+  @return	length of the response without CRC.
+*/
+static int modbus_slave_process( mrbc_vm *vm, mrbc_value *self, uint8_t *buf, int len )
+{
+  int func = buf[1];
+  int addr = (buf[2] << 8) | buf[3];
+  int n = (buf[4] << 8) | buf[5];
+  int ex = 0;
+  int i;
+
+  if( func < 1 || (func > 6 && func != 15 && func != 16) ) {
+    ex = MODBUS_EX_ILLEGAL_FUNCTION;
+    goto EXCEPTION;
+  }
+  if( len < 6 ) {
+    ex = MODBUS_EX_ILLEGAL_VALUE;
+    goto EXCEPTION;
+  }
+
+  mrbc_value tbl = modbus_get_table( self, func );
+  if( tbl.tt == MRBC_TT_NIL ) {
+    ex = MODBUS_EX_ILLEGAL_FUNCTION;
+    goto EXCEPTION;
+  }
+
+  switch( func ) {
+  case 1:	// Read Coils
+  case 2: {	// Read Discrete Inputs
+    if( len != 6 || n < 1 || n > 2000 ) { ex = MODBUS_EX_ILLEGAL_VALUE; break; }
+    if( addr + n > 0x10000 ) { ex = MODBUS_EX_ILLEGAL_ADDRESS; break; }
+
+    buf[2] = (n + 7) / 8;
+    memset( buf + 3, 0, buf[2] );
+    for( i = 0; i < n && !ex; i++ ) {
+      uint16_t bit;
+      ex = modbus_table_read( vm, &tbl, addr + i, &bit );
+      if( bit ) buf[3 + i/8] |= 1 << (i % 8);
+    }
+    len = 3 + buf[2];
+  } break;
+
+  case 3:	// Read Holding Registers
+  case 4: {	// Read Input Registers
+    if( len != 6 || n < 1 || n > 125 ) { ex = MODBUS_EX_ILLEGAL_VALUE; break; }
+    if( addr + n > 0x10000 ) { ex = MODBUS_EX_ILLEGAL_ADDRESS; break; }
+
+    buf[2] = n * 2;
+    for( i = 0; i < n && !ex; i++ ) {
+      uint16_t reg;
+      ex = modbus_table_read( vm, &tbl, addr + i, &reg );
+      buf[3 + i*2] = reg >> 8;
+      buf[4 + i*2] = reg;
+    }
+    len = 3 + buf[2];
+  } break;
+
+  case 5:	// Write Single Coil
+    if( len != 6 || (n != 0xff00 && n != 0x0000) ) {
+      ex = MODBUS_EX_ILLEGAL_VALUE;
+      break;
+    }
+    ex = modbus_table_write( vm, &tbl, addr, n != 0, 1 );
+    break;	// echo the request.
+
+  case 6:	// Write Single Register
+    if( len != 6 ) { ex = MODBUS_EX_ILLEGAL_VALUE; break; }
+    ex = modbus_table_write( vm, &tbl, addr, n, 0 );
+    break;	// echo the request.
+
+  case 15:	// Write Multiple Coils
+    if( len < 7 || n < 1 || n > 1968 ||
+	buf[6] != (n + 7) / 8 || len != 7 + buf[6] ) {
+      ex = MODBUS_EX_ILLEGAL_VALUE;
+      break;
+    }
+    if( addr + n > 0x10000 ) { ex = MODBUS_EX_ILLEGAL_ADDRESS; break; }
+
+    for( i = 0; i < n && !ex; i++ ) {
+      ex = modbus_table_write( vm, &tbl, addr + i,
+			       (buf[7 + i/8] >> (i % 8)) & 1, 1 );
+    }
+    len = 6;
+    break;
+
+  case 16:	// Write Multiple Registers
+    if( len < 7 || n < 1 || n > 123 || buf[6] != n * 2 || len != 7 + n * 2 ) {
+      ex = MODBUS_EX_ILLEGAL_VALUE;
+      break;
+    }
+    if( addr + n > 0x10000 ) { ex = MODBUS_EX_ILLEGAL_ADDRESS; break; }
+
+    for( i = 0; i < n && !ex; i++ ) {
+      ex = modbus_table_write( vm, &tbl, addr + i,
+			       (buf[7 + i*2] << 8) | buf[8 + i*2], 0 );
+    }
+    len = 6;
+    break;
+  }
+
+  mrbc_decref( &tbl );
+  if( !ex ) return len;
+
+ EXCEPTION:
+  buf[1] = func | 0x80;
+  buf[2] = ex;
+  return 3;
+}
+
+
+//================================================================
+/*! send a frame with CRC.
+
+  @param  hndl	Modbus handle.
+  @param  buf	the frame, and 2 bytes room for CRC.
+  @param  len	length of the frame without CRC.
+*/
+static void modbus_send( MODBUS_HANDLE *hndl, uint8_t *buf, int len )
+{
+  uint16_t crc = crc16_modbus( buf, len, 0xffff );
+  buf[len++] = crc;		// low byte first.
+  buf[len++] = crc >> 8;
+
+  uart_write( hndl->uart, buf, len );
+}
+
+
+//================================================================
+/*! wait for the silent interval before the response.
+
+  The IDLE line is detected after 1 character time with no data, so
+  this waits the remaining of 3.5 character times. (1750us if the
+  baudrate is more than 19200)
+*/
+static void modbus_wait_turnaround( MODBUS_HANDLE *hndl )
+{
+  uint32_t baud = hndl->uart->hal_uart->Init.BaudRate;
+  uint32_t us = (baud > 19200) ? (1750 - 11000000 / baud) : (27500000 / baud);
+  uint64_t t0 = hal_monotonic_us();
+
+  while( hal_monotonic_us() - t0 < us ) {
+  }
+}
+
+
+//================================================================
+/*! wait for the response, and receive it.
+
+  @param  vm	pointer to VM.
+  @param  hndl	Modbus handle.
+  @param  buf	[out] the response without CRC.
+  @return	length of the response, 0 if to wait again, or -1 if error.
+*/
+static int modbus_master_receive( mrbc_vm *vm, MODBUS_HANDLE *hndl, uint8_t *buf )
+{
+  while( 1 ) {
+    hal_disable_irq();
+    int len = uart_can_read_frame( hndl->uart );
+    if( len == 0 ) {
+      int32_t remain = (int32_t)(hndl->deadline - HAL_GetTick());
+      if( remain > 0 ) {
+	mrbc_wait_io_timeout( VM2TCB(vm), hndl->uart, remain );
+	vm->flag_retry_call = 1;
+	hal_enable_irq();
+	return 0;
+      }
+      hal_enable_irq();
+      hndl->flag_waiting = 0;
+      hndl->error = MODBUS_ERROR_TIMEOUT;
+      return -1;
+    }
+    hal_enable_irq();
+
+    len = uart_read_frame( hndl->uart, buf, MODBUS_SIZE_FRAME );
+
+    // the response must come from the slave requested.
+    if( len < 5 || buf[0] != hndl->req[0] ) continue;	// noise
+    hndl->flag_waiting = 0;
+
+    if( crc16_modbus( buf, len, 0xffff ) != 0 ) {
+      hndl->error = MODBUS_ERROR_CRC;
+      return -1;
+    }
+    len -= 2;
+
+    if( buf[1] == (hndl->req[1] | 0x80) ) {
+      hndl->error = buf[2];		// exception code.
+      return -1;
+    }
+    if( buf[1] != hndl->req[1] ) {
+      hndl->error = MODBUS_ERROR_BAD_RESPONSE;
+      return -1;
+    }
+
+    return len;
+  }
+}
+
+
+//================================================================
+/*! send a request and receive the response.
+
+  If the request is the same as in waiting, this is the retried call,
+  so only waits for the response.
+
+  @param  vm	pointer to VM.
+  @param  v	argument. v[0] is self.
+  @param  req	the request, and 2 bytes room for CRC.
+  @param  len	length of the request without CRC.
+  @param  buf	[out] the response without CRC.
+  @return	length of the response, 0 if to wait again, or -1 if error.
+*/
+static int modbus_master_transact( mrbc_vm *vm, mrbc_value v[], uint8_t *req, int len, uint8_t *buf )
+{
+  MODBUS_HANDLE *hndl = (MODBUS_HANDLE *)v[0].instance->data;
+
+  if( !hndl->flag_waiting || hndl->vm != vm ||
+      memcmp( hndl->req, req, sizeof(hndl->req) ) != 0 ) {
+    uart_clear_rx_buffer( hndl->uart );
+    memcpy( hndl->req, req, sizeof(hndl->req) );
+    modbus_send( hndl, req, len );
+
+    hndl->error = 0;
+    if( req[0] == 0 ) return 0;		// broadcast, no response.
+    hndl->vm = vm;
+    hndl->deadline = HAL_GetTick() + hndl->timeout;
+    hndl->flag_waiting = 1;
+  }
+
+  return modbus_master_receive( vm, hndl, buf );
+}
+
+
+//================================================================
+/*! get the arguments (unit_id, address, integer) of the master methods.
+
+  @return	0 if no error.
+*/
+static int modbus_get_args( mrbc_vm *vm, mrbc_value v[], int argc, uint8_t *req, int func )
+{
+  if( argc < 3 || v[1].tt != MRBC_TT_INTEGER || v[2].tt != MRBC_TT_INTEGER ) {
+    goto ERROR_RETURN;
+  }
+
+  mrbc_int_t id = mrbc_integer(v[1]);
+  mrbc_int_t addr = mrbc_integer(v[2]);
+  if( id < 0 || id > 247 || addr < 0 || addr > 0xffff ) goto ERROR_RETURN;
+  if( id == 0 && func <= 4 ) goto ERROR_RETURN;	// read can't broadcast.
+
+  req[0] = id;
+  req[1] = func;
+  req[2] = addr >> 8;
+  req[3] = addr;
+  return 0;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+  return -1;
+}
+
+
+//================================================================
+/*! get the table value. true, false or Integer.
+*/
+static int modbus_get_uint16( const mrbc_value *val, uint16_t *ret )
+{
+  switch( val->tt ) {
+  case MRBC_TT_INTEGER:
+    if( mrbc_integer(*val) < -32768 || mrbc_integer(*val) > 0xffff ) return -1;
+    *ret = mrbc_integer(*val);
+    return 0;
+  case MRBC_TT_TRUE:	*ret = 1;	return 0;
+  case MRBC_TT_FALSE:	*ret = 0;	return 0;
+  default:		return -1;
+  }
+}
+
+
+//================================================================
+/*! constructor
+
+  mb = Modbus.new( uart )					# master
+  mb = Modbus.new( uart, unit_id:17, holding_registers:ary )	# slave
+
+  keyword arguments: unit_id, coils, discrete_inputs,
+		     holding_registers, input_registers
+*/
+static void c_modbus_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  MRBC_KW_ARG( unit_id, coils, discrete_inputs, holding_registers, input_registers );
+  mrbc_value tbl[5] = { {0}, coils, discrete_inputs, holding_registers, input_registers };
+
+  mrbc_class *cls_uart = mrbc_get_class_by_name("UART");
+  if( argc < 1 || !cls_uart || !mrbc_obj_is_kind_of( &v[1], cls_uart ) ) {
+    goto ERROR_RETURN;
+  }
+  if( MRBC_KW_ISVALID(unit_id) && (unit_id.tt != MRBC_TT_INTEGER ||
+	mrbc_integer(unit_id) < 1 || mrbc_integer(unit_id) > 247) ) {
+    goto ERROR_RETURN;
+  }
+
+  mrbc_value self = mrbc_instance_new(vm, v[0].cls, sizeof(MODBUS_HANDLE));
+  MODBUS_HANDLE *hndl = (MODBUS_HANDLE *)self.instance->data;
+  memset( hndl, 0, sizeof(MODBUS_HANDLE) );
+  hndl->uart = *(UART_HANDLE **)(v[1].instance->data);
+  hndl->timeout = 100;
+  if( MRBC_KW_ISVALID(unit_id) ) hndl->unit_id = mrbc_integer(unit_id);
+
+  // keep the UART and the tables in the instance variables.
+  mrbc_instance_setiv( &self, mrbc_str_to_symid_cached( &sym_uart_, "uart" ),
+		       &v[1] );
+  for( int i = 1; i < 5; i++ ) {
+    if( !MRBC_KW_ISVALID(tbl[i]) ) continue;
+    mrbc_sym sym_id = mrbc_str_to_symid_cached( &sym_table_[i], TBL_NAME[i] );
+    mrbc_instance_setiv( &self, sym_id, &tbl[i] );
+  }
+
+  SET_RETURN( self );
+  goto RETURN;
+
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), "Modbus initialize.");
+
+ RETURN:
+  MRBC_KW_DELETE( unit_id, coils, discrete_inputs, holding_registers, input_registers );
+}
+
+
+//================================================================
+/*! process a request (slave)
+
+  mb.serve()	# -> function code
+
+  Waits until the request to this unit_id comes, and responds it.
+  No response to the broadcast.
+*/
+static void c_modbus_serve(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  MODBUS_HANDLE *hndl = (MODBUS_HANDLE *)v[0].instance->data;
+  uint8_t buf[MODBUS_SIZE_FRAME];
+
+  if( hndl->unit_id == 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "unit_id is not specified");
+    return;
+  }
+
+  while( 1 ) {
+    // wait for receiving a frame in other task running.
+    hal_disable_irq();
+    int len = uart_can_read_frame( hndl->uart );
+    if( len == 0 ) {
+      mrbc_wait_io( VM2TCB(vm), hndl->uart );
+      vm->flag_retry_call = 1;
+    }
+    hal_enable_irq();
+    if( len == 0 ) return;
+
+    len = uart_read_frame( hndl->uart, buf, sizeof(buf) );
+    if( len < 4 || crc16_modbus( buf, len, 0xffff ) != 0 ) continue;
+    if( buf[0] != hndl->unit_id && buf[0] != 0 ) continue;
+
+    int func = buf[1];
+    len = modbus_slave_process( vm, &v[0], buf, len - 2 );
+    if( buf[0] != 0 ) {
+      modbus_wait_turnaround( hndl );
+      modbus_send( hndl, buf, len );
+    }
+
+    SET_INT_RETURN( func );
+    return;
+  }
+}
+
+
+//================================================================
+/*! read bits or registers (master)
+
+  mb.read_coils( unit_id, address, count )		# -> [true, false, ...]
+  mb.read_discrete_inputs( unit_id, address, count )
+  mb.read_holding_registers( unit_id, address, count )	# -> [1, 2, ...]
+  mb.read_input_registers( unit_id, address, count )
+
+  @return	Array, or nil if error.
+*/
+static void modbus_read(mrbc_vm *vm, mrbc_value v[], int argc, int func)
+{
+  uint8_t req[8];
+  uint8_t buf[MODBUS_SIZE_FRAME];
+
+  if( modbus_get_args( vm, v, argc, req, func ) != 0 ) return;
+  mrbc_int_t n = (argc >= 3 && v[3].tt == MRBC_TT_INTEGER) ? mrbc_integer(v[3]) : -1;
+  if( n < 1 || n > (func <= 2 ? 2000 : 125) ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  req[4] = n >> 8;
+  req[5] = n;
+
+  int len = modbus_master_transact( vm, v, req, 6, buf );
+  if( len == 0 ) return;		// wait for the response.
+  if( len < 0 ) goto NIL_RETURN;
+
+  int nbytes = (func <= 2) ? (n + 7) / 8 : n * 2;
+  if( len != 3 + nbytes || buf[2] != nbytes ) {
+    ((MODBUS_HANDLE *)v[0].instance->data)->error = MODBUS_ERROR_BAD_RESPONSE;
+    goto NIL_RETURN;
+  }
+
+  mrbc_value ret = mrbc_array_new( vm, n );
+  for( int i = 0; i < n; i++ ) {
+    mrbc_value val;
+    if( func <= 2 ) {
+      val = mrbc_bool_value( (buf[3 + i/8] >> (i % 8)) & 1 );
+    } else {
+      val = mrbc_integer_value( (buf[3 + i*2] << 8) | buf[4 + i*2] );
+    }
+    mrbc_array_set( &ret, i, &val );
+  }
+  SET_RETURN( ret );
+  return;
+
+ NIL_RETURN:
+  SET_NIL_RETURN();
+}
+
+static void c_modbus_read_coils(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  modbus_read( vm, v, argc, 1 );
+}
+
+static void c_modbus_read_discrete_inputs(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  modbus_read( vm, v, argc, 2 );
+}
+
+static void c_modbus_read_holding_registers(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  modbus_read( vm, v, argc, 3 );
+}
+
+static void c_modbus_read_input_registers(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  modbus_read( vm, v, argc, 4 );
+}
+
+
+//================================================================
+/*! write bits or registers (master)
+
+  mb.write_coil( unit_id, address, true )
+  mb.write_register( unit_id, address, 1234 )
+  mb.write_coils( unit_id, address, [true, false, ...] )
+  mb.write_registers( unit_id, address, [1, 2, ...] )
+
+  @return	true, or nil if error. true to the broadcast (unit_id 0).
+*/
+static void modbus_write(mrbc_vm *vm, mrbc_value v[], int argc, int func)
+{
+  uint8_t req[MODBUS_SIZE_FRAME];
+  uint8_t buf[MODBUS_SIZE_FRAME];
+  uint16_t val;
+  int len;
+
+  if( modbus_get_args( vm, v, argc, req, func ) != 0 ) return;
+
+  if( func == 5 || func == 6 ) {
+    if( modbus_get_uint16( &v[3], &val ) != 0 ) goto ERROR_ARGUMENT;
+    if( func == 5 ) val = val ? 0xff00 : 0;
+    req[4] = val >> 8;
+    req[5] = val;
+    len = 6;
+
+  } else {
+    if( v[3].tt != MRBC_TT_ARRAY ) goto ERROR_ARGUMENT;
+    int n = mrbc_array_size( &v[3] );
+    if( n < 1 || n > (func == 15 ? 1968 : 123) ) goto ERROR_ARGUMENT;
+
+    req[4] = n >> 8;
+    req[5] = n;
+    req[6] = (func == 15) ? (n + 7) / 8 : n * 2;
+    memset( req + 7, 0, req[6] );
+    for( int i = 0; i < n; i++ ) {
+      mrbc_value e = mrbc_array_get( &v[3], i );
+      if( modbus_get_uint16( &e, &val ) != 0 ) goto ERROR_ARGUMENT;
+      if( func == 15 ) {
+	if( val ) req[7 + i/8] |= 1 << (i % 8);
+      } else {
+	req[7 + i*2] = val >> 8;
+	req[8 + i*2] = val;
+      }
+    }
+    len = 7 + req[6];
+  }
+
+  int n_res = modbus_master_transact( vm, v, req, len, buf );
+  if( n_res == 0 ) {
+    if( req[0] == 0 ) SET_TRUE_RETURN();	// broadcast.
+    return;					// or wait for the response.
+  }
+  if( n_res < 0 ) goto NIL_RETURN;
+
+  // the response is the echo of the request header.
+  if( n_res != 6 || memcmp( buf, req, 6 ) != 0 ) {
+    ((MODBUS_HANDLE *)v[0].instance->data)->error = MODBUS_ERROR_BAD_RESPONSE;
+    goto NIL_RETURN;
+  }
+  SET_TRUE_RETURN();
+  return;
+
+ NIL_RETURN:
+  SET_NIL_RETURN();
+  return;
+
+ ERROR_ARGUMENT:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+static void c_modbus_write_coil(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  modbus_write( vm, v, argc, 5 );
+}
+
+static void c_modbus_write_register(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  modbus_write( vm, v, argc, 6 );
+}
+
+static void c_modbus_write_coils(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  modbus_write( vm, v, argc, 15 );
+}
+
+static void c_modbus_write_registers(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  modbus_write( vm, v, argc, 16 );
+}
+
+
+//================================================================
+/*! last error (master)
+
+  mb.error	# -> 0, exception code 1.., or TIMEOUT, CRC_ERROR, BAD_RESPONSE
+*/
+static void c_modbus_error(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  MODBUS_HANDLE *hndl = (MODBUS_HANDLE *)v[0].instance->data;
+
+  SET_INT_RETURN( hndl->error );
+}
+
+
+//================================================================
+/*! set the response timeout (master)
+
+  mb.timeout = 200	# ms
+*/
+static void c_modbus_set_timeout(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  MODBUS_HANDLE *hndl = (MODBUS_HANDLE *)v[0].instance->data;
+
+  if( v[1].tt != MRBC_TT_INTEGER ||
+      mrbc_integer(v[1]) < 1 || mrbc_integer(v[1]) > 0xffff ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  hndl->timeout = mrbc_integer(v[1]);
+}
+
+
+//================================================================
+/*! initialize
+*/
+void mrbc_init_class_modbus(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Modbus", 0);
+
+  mrbc_define_method_kw(0, cls, "new",		c_modbus_new);
+  mrbc_define_method(0, cls, "serve",		c_modbus_serve);
+  mrbc_define_method(0, cls, "read_coils",	c_modbus_read_coils);
+  mrbc_define_method(0, cls, "read_discrete_inputs", c_modbus_read_discrete_inputs);
+  mrbc_define_method(0, cls, "read_holding_registers", c_modbus_read_holding_registers);
+  mrbc_define_method(0, cls, "read_input_registers", c_modbus_read_input_registers);
+  mrbc_define_method(0, cls, "write_coil",	c_modbus_write_coil);
+  mrbc_define_method(0, cls, "write_register",	c_modbus_write_register);
+  mrbc_define_method(0, cls, "write_coils",	c_modbus_write_coils);
+  mrbc_define_method(0, cls, "write_registers",	c_modbus_write_registers);
+  mrbc_define_method(0, cls, "error",		c_modbus_error);
+  mrbc_define_method(0, cls, "timeout=",	c_modbus_set_timeout);
+
+  mrbc_set_class_const(cls, mrbc_str_to_symid("TIMEOUT"),
+		       &mrbc_integer_value(MODBUS_ERROR_TIMEOUT));
+  mrbc_set_class_const(cls, mrbc_str_to_symid("CRC_ERROR"),
+		       &mrbc_integer_value(MODBUS_ERROR_CRC));
+  mrbc_set_class_const(cls, mrbc_str_to_symid("BAD_RESPONSE"),
+		       &mrbc_integer_value(MODBUS_ERROR_BAD_RESPONSE));
+}
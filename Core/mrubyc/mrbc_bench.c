@@ -0,0 +1,217 @@
+/*! @file
+  @brief
+  On-target benchmark mode.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  Runs the programs in ../bench, which are built in flash by
+  "make bench" (bench_*.c), and prints the results to the console
+  as comma separated lines.
+
+    bench,name,cycles,cpu_us,peak_heap,dispatch,preempt,max_latency_us,result
+    bench,ramfunc,0
+    bench,fib,12345678,146972,1234,15,14,3,ok
+    ...
+    bench,end,8
+
+  The "ramfunc" line tells if the VM runs from SRAM. (MRBC_USE_RAMFUNC)
+  The loop program is mostly the instruction fetch, to compare it.
+
+  cycles is DWT->CYCCNT spent in mrbc_run(), so a program should finish
+  in about 50 seconds (2^32 cycles at 84MHz). dispatch, preempt and
+  max_latency_us are the task statistics, or 0 without MRBC_TASK_STATS.
+
+  With MRBC_ALLOC_TIMING, the maximum cycles of the allocator in each
+  program, and of a random alloc/realloc/free sequence in C follow.
+
+    alloc,name,max_alloc,max_free,max_realloc
+    alloc,fib,180,95,0
+    ...
+    alloc,random,212,120,390
+  </pre>
+*/
+
+#if defined(MRBC_BENCH_FIRMWARE)
+//@cond
+#include <stdint.h>
+//@endcond
+
+#include "../mrubyc_src/mrubyc.h"
+
+#if !defined(MRBC_SCHEDULER_EXIT) || !MRBC_SCHEDULER_EXIT
+#error "MRBC_BENCH_FIRMWARE needs MRBC_SCHEDULER_EXIT=1"
+#endif
+
+
+extern const uint8_t bench_fib[];
+extern const uint8_t bench_tak[];
+extern const uint8_t bench_array_sort[];
+extern const uint8_t bench_hash[];
+extern const uint8_t bench_string[];
+extern const uint8_t bench_ivar[];
+extern const uint8_t bench_iterator[];
+extern const uint8_t bench_loop[];
+
+//! benchmark table.
+static const struct BENCH_T {
+  const char *name;
+  const uint8_t *bytecode;
+} TBL_BENCH[] = {
+  { "fib",		bench_fib },
+  { "tak",		bench_tak },
+  { "array_sort",	bench_array_sort },
+  { "hash",		bench_hash },
+  { "string",		bench_string },
+  { "ivar",		bench_ivar },
+  { "iterator",		bench_iterator },
+  { "loop",		bench_loop },
+};
+static const int NUM_TBL_BENCH = sizeof(TBL_BENCH) / sizeof(struct BENCH_T);
+
+
+#if defined(MRBC_ALLOC_TIMING)
+//================================================================
+/*! print the maximum cycles of the allocator.
+
+  @param  name		name of the program.
+*/
+static void alloc_timing_print( const char *name )
+{
+  struct MRBC_ALLOC_TIMING_STAT t[MRBC_ALLOC_TIMING_NUM];
+
+  mrbc_alloc_timing( t );
+  mrbc_printf("alloc,%s,%u,%u,%u\n", name, t[MRBC_ALLOC_TIMING_ALLOC].max,
+	      t[MRBC_ALLOC_TIMING_FREE].max, t[MRBC_ALLOC_TIMING_REALLOC].max );
+}
+
+
+//================================================================
+/*! allocate, resize and free random sizes in the memory pool.
+
+  The sizes are 4..259 bytes, to go through the small and the large
+  size classes, and about 64 blocks are alive to fragment the pool.
+
+  @param  pool		memory pool.
+  @param  size		size of memory pool.
+*/
+static void alloc_random_run( void *pool, unsigned int size )
+{
+  enum { N_SLOT = 64, N_STEP = 20000 };
+  void *slot[N_SLOT] = {0};
+  uint32_t rnd = 1;
+
+  mrbc_init_alloc( pool, size );
+  mrbc_alloc_timing_reset();
+
+  for( int i = 0; i < N_STEP; i++ ) {
+    rnd = rnd * 1103515245 + 12345;
+    int idx = (rnd >> 16) % N_SLOT;
+    unsigned int n = 4 + ((rnd >> 8) & 0xff);
+
+    if( !slot[idx] ) {
+      slot[idx] = mrbc_raw_alloc( n );
+    } else if( rnd & 0x80000000 ) {
+      void *p = mrbc_raw_realloc( slot[idx], n );
+      if( p ) slot[idx] = p;
+    } else {
+      mrbc_raw_free( slot[idx] );
+      slot[idx] = 0;
+    }
+  }
+
+  alloc_timing_print( "random" );
+  mrbc_cleanup_alloc();
+}
+#endif
+
+
+//================================================================
+/*! run a benchmark program in a new VM and print the result.
+
+  @param  bench		benchmark.
+  @param  pool		memory pool.
+  @param  size		size of memory pool.
+  @return		0 if no error.
+*/
+static int bench_run( const struct BENCH_T *bench, void *pool, unsigned int size )
+{
+  struct MRBC_ALLOC_STATISTICS st;
+
+  mrbc_init( pool, size );
+  mrbc_alloc_statistics( &st );
+  unsigned int base = st.used;
+
+  mrbc_tcb *tcb = mrbc_create_task( bench->bytecode, 0 );
+  if( !tcb ) {
+    mrbc_printf("bench,%s,0,0,0,0,0,0,error\n", bench->name );
+    mrbc_cleanup();
+    return 1;
+  }
+  mrbc_alloc_reset_peak();
+#if defined(MRBC_ALLOC_TIMING)
+  mrbc_alloc_timing_reset();
+#endif
+
+  uint32_t t0 = hal_cycle_count();
+  int ret = mrbc_run();
+  uint32_t cycles = hal_cycle_count() - t0;
+
+  mrbc_alloc_statistics( &st );
+  unsigned int cpu_us = cycles / hal_cycles_per_us();
+
+#if defined(MRBC_TASK_STATS)
+  unsigned int n_dispatch = tcb->stats.n_dispatch;
+  unsigned int n_preempt = tcb->stats.n_preempt;
+  unsigned int max_latency = tcb->stats.max_latency / hal_cycles_per_us();
+#else
+  unsigned int n_dispatch = 0;
+  unsigned int n_preempt = 0;
+  unsigned int max_latency = 0;
+#endif
+
+  mrbc_printf("bench,%s,%u,%u,%u,%u,%u,%u,%s\n", bench->name,
+	      (unsigned int)cycles, cpu_us, st.peak - base,
+	      n_dispatch, n_preempt, max_latency, ret == 0 ? "ok" : "error" );
+#if defined(MRBC_ALLOC_TIMING)
+  alloc_timing_print( bench->name );
+#endif
+
+  mrbc_cleanup();
+
+  return ret != 0;
+}
+
+
+//================================================================
+/*! benchmark mode
+
+  @param  pool		memory pool.
+  @param  size		size of memory pool.
+  @return		number of failed programs.
+*/
+int run_benchmark( void *pool, unsigned int size )
+{
+  int n_error = 0;
+
+  mrbc_printf("bench,name,cycles,cpu_us,peak_heap,dispatch,preempt,max_latency_us,result\n");
+#if defined(MRBC_USE_RAMFUNC)
+  mrbc_printf("bench,ramfunc,1\n");
+#else
+  mrbc_printf("bench,ramfunc,0\n");
+#endif
+  for( int i = 0; i < NUM_TBL_BENCH; i++ ) {
+    n_error += bench_run( &TBL_BENCH[i], pool, size );
+  }
+#if defined(MRBC_ALLOC_TIMING)
+  alloc_random_run( pool, size );
+#endif
+  mrbc_printf("bench,end,%d\n", NUM_TBL_BENCH - n_error );
+  hal_flush( 1 );
+
+  return n_error;
+}
+
+#endif // MRBC_BENCH_FIRMWARE
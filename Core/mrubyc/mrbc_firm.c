@@ -7,6 +7,18 @@
 
   This file is distributed under BSD 3-Clause License.
 
+  On a shared bus such as RS-485, give each node an address by
+  MRBC_FIRM_NODE_ADDRESS or firm_node_address(). The node then takes
+  only the addressed commands, and replies only to its own address.
+
+    @3 showprog		unicast to the node 3.
+    @* clear		broadcast, no reply.
+    @1,2,5 binary	multicast, no reply.
+
+  The broadcast 'binary' mode sends no acks, so the host paces the
+  frames. It erases the rest of the slot at the start, so the host
+  waits for the erase before the first frame. After the upload, each
+  node is checked by '@<addr> verify', and activated when it matches.
   </pre>
 */
 
@@ -18,33 +30,140 @@
 #include "main.h"
 #include "../mrubyc_src/mrubyc.h"
 #include "stm32f4_uart.h"
+#include "usb_cdc.h"
+#include "mrbc_firm.h"
 
 
 #define VERSION_STRING   "mruby/c v3.3 RITE0300 MRBW1.2"
 
-const uint32_t IREP_START_ADDR = 0x08060000;	// This is sector 7
-const uint32_t IREP_END_ADDR   = 0x0807FFFF;	//  (see: cmd_clear function)
+// The bytecode area is the IREP region of the linker script, divided
+// into two slots A and B at a sector boundary. An update is written to
+// the inactive slot, and activated by writing its SLOT_HEADER at last.
+// The header is followed by the directory of the bytecode files, so
+// the files are found without scanning the slot.
+extern const uint8_t _irep_start[], _irep_end[];
+#define IREP_START_ADDR ((uint32_t)_irep_start)
+#define SLOT_SIZE	(((uint32_t)_irep_end - IREP_START_ADDR) / 2)
+#define SLOT_ADDR(n)	(IREP_START_ADDR + SLOT_SIZE * (n))
+#define SLOT_OF(addr)	(((uint32_t)(addr) - IREP_START_ADDR) / SLOT_SIZE)
+#define SLOT_DIR(n)	((const BYTECODE_ENTRY *)(SLOT_ADDR(n) + sizeof(SLOT_HEADER)))
+#define SLOT_DIR_MAX	16
+#define SLOT_BYTECODE_ADDR(n) ((uint32_t)(SLOT_DIR(n) + SLOT_DIR_MAX))
+#if defined(MRBC_USE_IREP_IMAGE)
+// The upper half of each slot holds the IREP images, built at the first
+// boot after activating and erased together with the bytecode.
+#define SLOT_IMAGE_ADDR(n) (SLOT_ADDR(n) + SLOT_SIZE / 2)
+#define SLOT_AREA_END(n) SLOT_IMAGE_ADDR(n)
+#else
+#define SLOT_AREA_END(n) (SLOT_ADDR(n) + SLOT_SIZE)
+#endif
+#if defined(MRBC_SNAPSHOT)
+// The end of the bytecode area holds the snapshot of the VM, taken at
+// the first boot after activating.
+#if !defined(MRBC_SNAPSHOT_SIZE)
+#define MRBC_SNAPSHOT_SIZE (1024*40)
+#endif
+#define SLOT_SNAPSHOT_ADDR(n) (SLOT_AREA_END(n) - MRBC_SNAPSHOT_SIZE)
+#define SLOT_BYTECODE_END(n) SLOT_SNAPSHOT_ADDR(n)
+#else
+#define SLOT_BYTECODE_END(n) SLOT_AREA_END(n)
+#endif
+
+//! header at the top of a slot.
+typedef struct SLOT_HEADER {
+  char magic[4];	//!< "MRBS", programmed at last.
+  uint32_t version;	//!< the valid slot of the larger one is active.
+  uint32_t length;	//!< length of the bytecode.
+  uint32_t crc;		//!< CRC of the directory and the bytecode.
+} SLOT_HEADER;
+
+#if defined(MRBC_SNAPSHOT)
+//! header of the snapshot, followed by the .data and .bss of the VM.
+typedef struct SNAPSHOT_HEADER {
+  char magic[4];	//!< "MRSS", programmed at last.
+  uint32_t firmware_crc;	//!< CRC of the firmware that took it.
+  uint32_t data_size;
+  uint32_t bss_size;
+  uint32_t crc;		//!< CRC of the data and bss.
+} SNAPSHOT_HEADER;
+
+// the VM state, gathered by the linker script.
+extern uint8_t _mrbc_state_data_start[], _mrbc_state_data_end[];
+extern uint8_t _mrbc_state_bss_start[], _mrbc_state_bss_end[];
+extern const uint8_t _firmware_start[], _sidata[], _sdata[], _edata[];
+#define STATE_DATA_SIZE (_mrbc_state_data_end - _mrbc_state_data_start)
+#define STATE_BSS_SIZE (_mrbc_state_bss_end - _mrbc_state_bss_start)
+#endif
+
+//! bytecode is programmed by this size, while the Rx DMA fills the
+//! other half of the Rx FIFO.
+#define WRITE_CHUNK_SIZE (UART_SIZE_RXFIFO / 2)
+
+//! start address of the FLASH sectors. (STM32F401xE)
+static const uint32_t TBL_FLASH_SECTOR[] = {
+  0x08000000, 0x08004000, 0x08008000, 0x0800C000,	// 16KB * 4
+  0x08010000,						// 64KB
+  0x08020000, 0x08040000, 0x08060000,			// 128KB * 3
+  0x08080000,						// (end)
+};
 
 static const char RITE[4] = "RITE";
+#if defined(MRBC_BYTECODE_LZ4)
+// "RLZ4", raw size(32), size(32) in big endian, and the LZ4 block.
+static const char RLZ4[4] = "RLZ4";
+#define RLZ4_HEADER_SIZE 12
+#endif
+#define BOOT_REQUEST_UPLOAD 0x55504c44	// "UPLD" in the backup register.
 static const char WHITE_SPACE[] = " \t\r\n\f\v";
 
 
+// replies are not sent to the broadcast and multicast commands.
+#if defined(MRBC_CONSOLE_USB_CDC)
+#define STRM_READ(buf, len)	usb_cdc_read(buf, len)
+#define STRM_WRITE(buf, len)	(flag_silent_ ? 0 : usb_cdc_write(buf, len))
+#define STRM_GETS(buf, size)	usb_cdc_gets(buf, size)
+#define STRM_PUTS(buf)		(flag_silent_ ? 0 : usb_cdc_write(buf, strlen(buf)))
+#define STRM_AVAILABLE()	usb_cdc_bytes_available()
+#define STRM_RESET()		usb_cdc_clear_rx_buffer()
+#define STRM_FLUSH()		usb_cdc_flush()
+#else
 #define STRM_READ(buf, len)	uart_read(UART_HANDLE_CONSOLE, buf, len)
+#define STRM_WRITE(buf, len)	(flag_silent_ ? 0 : uart_write(UART_HANDLE_CONSOLE, buf, len))
 #define STRM_GETS(buf, size)	uart_gets(UART_HANDLE_CONSOLE, buf, size)
-#define STRM_PUTS(buf)		uart_write(UART_HANDLE_CONSOLE, buf, strlen(buf))
+#define STRM_PUTS(buf)		(flag_silent_ ? 0 : uart_write(UART_HANDLE_CONSOLE, buf, strlen(buf)))
+#define STRM_AVAILABLE()	uart_bytes_available(UART_HANDLE_CONSOLE)
 #define STRM_RESET()		uart_clear_rx_buffer(UART_HANDLE_CONSOLE)
+#define STRM_FLUSH()		uart_flush(UART_HANDLE_CONSOLE)
+#endif
 #define SYSTEM_RESET()		HAL_NVIC_SystemReset()
 
+#if !defined(MRBC_FIRM_NODE_ADDRESS)
+#define MRBC_FIRM_NODE_ADDRESS 0
+#endif
+
 static int cmd_help();
 static int cmd_version();
 static int cmd_reset();
 static int cmd_execute();
 static int cmd_clear();
 static int cmd_write();
+static int cmd_patch();
+static int cmd_activate();
 static int cmd_showprog();
+static int cmd_binary();
+static int cmd_verify();
+#if defined(MRBC_METRICS)
+static int cmd_stats();
+#endif
+static int slot_activate(void);
 
 
 static uint32_t irep_write_addr_;	//!< IREP file write point.
+static uint32_t irep_write_end_;	//!< end of the slot in update.
+static int update_slot_ = -1;		//!< slot in update, or -1.
+static uint32_t erase_pending_;		//!< bit n: sector n is not erased yet.
+static int flag_silent_;		//!< in the broadcast or multicast command.
+static const char *upload_error_;	//!< error of the last broadcast upload.
 
 //! command table.
 static struct COMMAND_T {
@@ -58,7 +177,14 @@ static struct COMMAND_T {
   {"execute",	cmd_execute },
   {"clear",	cmd_clear },
   {"write",	cmd_write },
+  {"patch",	cmd_patch },
+  {"activate",	cmd_activate },
   {"showprog",	cmd_showprog },
+  {"binary",	cmd_binary },
+  {"verify",	cmd_verify },
+#if defined(MRBC_METRICS)
+  {"stats",	cmd_stats },
+#endif
 };
 
 static const int NUM_TBL_COMMANDS = sizeof(TBL_COMMANDS)/sizeof(struct COMMAND_T);
@@ -96,6 +222,7 @@ static int cmd_version(void)
 */
 static int cmd_reset(void)
 {
+  STRM_FLUSH();
   SYSTEM_RESET();
   return 0;
 }
@@ -106,99 +233,464 @@ static int cmd_reset(void)
 */
 static int cmd_execute(void)
 {
+  // activate the update not activated yet.
+  if( update_slot_ >= 0 && irep_write_addr_ != SLOT_BYTECODE_ADDR(update_slot_) &&
+      slot_activate() != 0 ) {
+    STRM_PUTS("-ERR Activate error.\r\n");
+    return 0;
+  }
+
   STRM_PUTS("+OK Execute mruby/c.\r\n");
   return 1;	// to execute VM.
 }
 
 
 //================================================================
-/*! command 'clear'
+/*! is it the top of a bytecode file?
+
+  @param  p	data.
+  @param  len	length of data.
 */
-static int cmd_clear(void)
+static int is_bytecode( const void *p, int len )
 {
-  HAL_FLASH_Unlock();
+  if( len < (int)sizeof(RITE) ) return 0;
+  if( strncmp( p, RITE, sizeof(RITE)) == 0 ) return 1;
+#if defined(MRBC_BYTECODE_LZ4)
+  if( strncmp( p, RLZ4, sizeof(RLZ4)) == 0 ) return 1;
+#endif
+  return 0;
+}
+
+
+//================================================================
+/*! FLASH sector number of the address.
+*/
+static int flash_sector( uint32_t addr )
+{
+  int s = 0;
+  while( addr >= TBL_FLASH_SECTOR[s+1] ) s++;
+  return s;
+}
+
+
+//================================================================
+/*! erase the sector of the address, if not erased since 'clear'.
+
+  A sector which is already blank is not erased.
+
+  @param  addr	address in the sector.
+  @return	zero if no error.
+  @note		Call between HAL_FLASH_Unlock() and HAL_FLASH_Lock().
+*/
+static int prepare_sector( uint32_t addr )
+{
+  int s = flash_sector( addr );
+  if( !(erase_pending_ & (1 << s)) ) return 0;
+  erase_pending_ &= ~(1 << s);
+
+  const uint32_t *p = (const uint32_t *)TBL_FLASH_SECTOR[s];
+  const uint32_t *end = (const uint32_t *)TBL_FLASH_SECTOR[s+1];
+  while( p < end && *p == 0xFFFFFFFF ) p++;
+  if( p == end ) return 0;
 
   FLASH_EraseInitTypeDef erase = {
     .TypeErase = FLASH_TYPEERASE_SECTORS,
-    .Sector = FLASH_SECTOR_7,
+    .Sector = s,
     .NbSectors = 1,
     .VoltageRange = FLASH_VOLTAGE_RANGE_3,  // Device operating range: 2.7V to 3.6V
   };
   uint32_t error = 0;
   HAL_StatusTypeDef sts = HAL_FLASHEx_Erase(&erase, &error);
+
+  return (sts == HAL_OK && error == 0xFFFFFFFF) ? 0 : -1;
+}
+
+
+//================================================================
+/*! erase the sectors to write the data from irep_write_addr_.
+
+  The next sector is also erased if the data ends at its top, not to
+  continue to the old programs.
+  This is done before the data is received, because the CPU stalls
+  during the erase and the Rx FIFO would overflow.
+
+  @param  size	size of data.
+  @return	zero if no error.
+  @note		Call between HAL_FLASH_Unlock() and HAL_FLASH_Lock().
+*/
+static int prepare_write( int size )
+{
+  uint32_t end = irep_write_addr_ + size + (-size & 3);
+  if( end >= irep_write_end_ ) end = irep_write_end_ - 1;
+
+  for( int s = flash_sector( irep_write_addr_ ); s <= flash_sector( end ); s++ ) {
+    if( prepare_sector( TBL_FLASH_SECTOR[s] ) != 0 ) return -1;
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! program the data.
+
+  @param  addr	address to program, aligned to 4.
+  @param  data	data.
+  @param  len	length of data. the last word is padded by 0xff.
+  @return	zero if no error.
+  @note		Call between HAL_FLASH_Unlock() and HAL_FLASH_Lock().
+*/
+static int program_flash( uint32_t addr, const void *data, int len )
+{
+  const uint8_t *p = data;
+
+  for( int i = 0; i < len; i += 4 ) {
+    uint32_t word = 0;
+    for( int j = 3; j >= 0; j-- ) {
+      word = word << 8 | (i + j < len ? p[i + j] : 0xff);
+    }
+
+    HAL_StatusTypeDef sts;
+    sts = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + i, word);
+    if( sts != HAL_OK ) return -1;
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! program the data at irep_write_addr_, and advance it.
+
+  @param  p	data.
+  @param  len	length of data.
+  @return	zero if no error.
+  @note		Call between HAL_FLASH_Unlock() and HAL_FLASH_Lock().
+*/
+static int write_flash( const uint8_t *p, int len )
+{
+  if( program_flash( irep_write_addr_, p, len ) != 0 ) return -1;
+  irep_write_addr_ += len + (-len & 3);
+
+  return 0;
+}
+
+
+//================================================================
+/*! check the slot.
+
+  @param  n	slot number.
+  @return	pointer to the header, or NULL if the slot is not valid.
+*/
+static const SLOT_HEADER * slot_header( int n )
+{
+  const SLOT_HEADER *h = (const SLOT_HEADER *)SLOT_ADDR(n);
+
+  if( strncmp( h->magic, "MRBS", 4 ) != 0 ) return 0;
+  if( h->length > SLOT_BYTECODE_END(n) - SLOT_BYTECODE_ADDR(n) ) return 0;
+  if( h->crc != calc_crc( SLOT_DIR(n), sizeof(BYTECODE_ENTRY) * SLOT_DIR_MAX
+			  + h->length ) ) {
+    return 0;
+  }
+
+  return h;
+}
+
+
+//================================================================
+/*! the active slot.
+
+  @return	slot number, or -1 if no slot is valid.
+*/
+static int active_slot(void)
+{
+  const SLOT_HEADER *a = slot_header(0);
+  const SLOT_HEADER *b = slot_header(1);
+
+  if( a && (!b || (int32_t)(a->version - b->version) > 0) ) return 0;
+  return b ? 1 : -1;
+}
+
+
+//================================================================
+/*! number of the directory entries in use.
+*/
+static int dir_count( int n )
+{
+  int i;
+  for( i = 0; i < SLOT_DIR_MAX; i++ ) {
+    if( SLOT_DIR(n)[i].offset == 0xFFFFFFFF ) break;
+  }
+  return i;
+}
+
+
+//================================================================
+/*! add a directory entry of the file written in the slot in update.
+
+  @param  addr		address of the file.
+  @param  size		size of the file.
+  @param  name		task name or NULL.
+  @param  priority	task priority, or 0 for the default.
+  @return		zero if no error.
+  @note		Call between HAL_FLASH_Unlock() and HAL_FLASH_Lock().
+*/
+static int dir_add( uint32_t addr, int size, const char *name, int priority )
+{
+  int n = update_slot_;
+  int i = dir_count( n );
+  if( i >= SLOT_DIR_MAX ) return -1;
+
+  BYTECODE_ENTRY e = {
+    .offset = addr - SLOT_BYTECODE_ADDR(n),
+    .size = size,
+    .crc = calc_crc( (const void *)addr, size ),
+    .priority = priority,
+  };
+  if( name ) strncpy( e.name, name, sizeof(e.name) - 1 );
+
+  return program_flash( (uint32_t)&SLOT_DIR(n)[i], &e, sizeof(e) );
+}
+
+
+//================================================================
+/*! add the directory entries of the files written without them.
+
+  (e.g. by Firmware.write) They are found by the RITE headers.
+  @note		Call between HAL_FLASH_Unlock() and HAL_FLASH_Lock().
+*/
+static int dir_index_rest(void)
+{
+  int n = update_slot_;
+  int i = dir_count( n );
+  uint32_t addr = SLOT_BYTECODE_ADDR(n);
+
+  if( i > 0 ) {
+    const BYTECODE_ENTRY *e = &SLOT_DIR(n)[i-1];
+    addr += e->offset + e->size + (-e->size & 3);
+  }
+
+  while( addr < irep_write_addr_ ) {
+    const uint8_t *p = (const uint8_t *)addr;
+    if( !is_bytecode( p, irep_write_addr_ - addr ) ) return -1;
+
+    unsigned int size = 0;
+    for( int i = 0; i < 4; i++ ) {
+      size = (size << 8) | p[8 + i];
+    }
+    if( dir_add( addr, size, 0, 0 ) != 0 ) return -1;
+
+    addr += size + (-size & 3);	// align 4 byte.
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! start an update: clear the inactive slot to write the bytecode.
+
+  Only the first sector of the slot is erased here. The other sectors
+  are erased when a write reaches them, so a small update doesn't wait
+  for the erase of the whole slot.
+
+  @return	zero if no error.
+*/
+static int slot_clear(void)
+{
+  int n = (active_slot() == 0);
+  int ret = 0;
+
+  HAL_FLASH_Unlock();
+
+  for( int s = flash_sector( SLOT_ADDR(n) );
+       s <= flash_sector( SLOT_ADDR(n) + SLOT_SIZE - 1 ); s++ ) {
+    erase_pending_ |= 1 << s;
+  }
+  ret |= prepare_sector( SLOT_ADDR(n) );
+#if defined(MRBC_USE_IREP_IMAGE)
+  // the images are found by its bytecode address, so erase all of them.
+  for( int s = flash_sector( SLOT_IMAGE_ADDR(n) );
+       s <= flash_sector( SLOT_ADDR(n) + SLOT_SIZE - 1 ); s++ ) {
+    ret |= prepare_sector( TBL_FLASH_SECTOR[s] );
+  }
+#endif
+  HAL_FLASH_Lock();
+
+  irep_write_addr_ = SLOT_BYTECODE_ADDR(n);
+  irep_write_end_ = SLOT_BYTECODE_END(n);
+  update_slot_ = ret ? -1 : n;
+  upload_error_ = 0;
+
+  return ret;
+}
+
+
+//================================================================
+/*! append the data to the slot in update.
+
+  @param  p	data. only the last one of each file can be unaligned to 4.
+  @param  len	length of data.
+  @return	zero if no error.
+*/
+static int slot_write( const void *p, int len )
+{
+  if( update_slot_ < 0 || irep_write_addr_ + len > irep_write_end_ ) return -1;
+
+  HAL_FLASH_Unlock();
+  int ret = prepare_write( len ) || write_flash( p, len );
+  HAL_FLASH_Lock();
+
+  return ret ? -1 : 0;
+}
+
+
+//================================================================
+/*! activate the slot in update.
+
+  The header is programmed after the bytecode, and its magic at last,
+  so a power failure leaves the current slot active.
+
+  @return	zero if no error.
+*/
+static int slot_activate(void)
+{
+  int n = update_slot_;
+  if( n < 0 || irep_write_addr_ == SLOT_BYTECODE_ADDR(n) ) return -1;
+  if( upload_error_ ) return -1;	// the broadcast upload is broken.
+
+  HAL_FLASH_Unlock();
+  int ret = dir_index_rest();
+
+  int a = active_slot();
+  SLOT_HEADER h;
+  h.version = a < 0 ? 1 : slot_header(a)->version + 1;
+  h.length = irep_write_addr_ - SLOT_BYTECODE_ADDR(n);
+  h.crc = calc_crc( SLOT_DIR(n), sizeof(BYTECODE_ENTRY) * SLOT_DIR_MAX
+		    + h.length );
+
+  // the magic at last.
+  if( ret == 0 ) {
+    ret = program_flash( SLOT_ADDR(n) + 4, &h.version, sizeof(h) - 4 );
+  }
+  if( ret == 0 ) {
+    ret = program_flash( SLOT_ADDR(n), "MRBS", 4 );
+  }
   HAL_FLASH_Lock();
 
-  if( sts == HAL_OK && error == 0xFFFFFFFF ) {
+  update_slot_ = -1;
+  return (ret == 0 && slot_header(n)) ? 0 : -1;
+}
+
+
+//================================================================
+/*! command 'clear'
+
+  Clears the inactive slot. The active slot is kept running until
+  the 'activate' command.
+*/
+static int cmd_clear(void)
+{
+  if( slot_clear() == 0 ) {
     STRM_PUTS("+OK\r\n");
   } else {
     STRM_PUTS("-ERR\r\n");
   }
 
-  irep_write_addr_ = IREP_START_ADDR;
   return 0;
 }
 
 
 //================================================================
-/*! command 'write'
+/*! command 'write <size> [name [priority]]'
+
+  The bytecode is programmed to FLASH chunk by chunk as it arrives,
+  so the size is limited by the FLASH area, not by the buffer.
+  The name and priority are set to the task at boot.
 */
 static int cmd_write( void *buffer, int buffer_size )
 {
   char *token = strtok( NULL, WHITE_SPACE );
-  if( token == NULL ) {
+  char *name = strtok( NULL, WHITE_SPACE );
+  char *prio = strtok( NULL, WHITE_SPACE );
+  int priority = prio ? mrbc_atoi(prio, 10) : 0;
+  if( token == NULL || update_slot_ < 0 || priority < 0 || priority > 255 ) {
     STRM_PUTS("-ERR\r\n");
     return -1;
   }
+  if( dir_count( update_slot_ ) >= SLOT_DIR_MAX ) {
+    STRM_PUTS("-ERR Too many files.\r\n");
+    return -1;
+  }
 
   // check size
   int size = mrbc_atoi(token, 10);
   uint32_t irep_write_end = irep_write_addr_ + size;
-  if( (irep_write_end > IREP_END_ADDR) || (size > buffer_size) ) {
+  if( (size < (int)sizeof(RITE)) || (irep_write_end > irep_write_end_) ) {
     STRM_PUTS("-ERR IREP file size overflow.\r\n");
     return -1;
   }
 
-  STRM_PUTS("+OK Write bytecode.\r\n");
-
-  // get a bytecode.
-  uint8_t *p = buffer;
-  int n = size;
-  while (n > 0) {
-    int readed_size = STRM_READ( p, size );
-    p += readed_size;
-    n -= readed_size;
-  }
-
-  // check 'RITE' magick code.
-  p = buffer;
-  if( strncmp( (const char *)p, RITE, sizeof(RITE)) != 0 ) {
-    STRM_PUTS("-ERR No RITE code received.\r\n");
+  HAL_FLASH_Unlock();
+  if( prepare_write( size ) != 0 ) {
+    HAL_FLASH_Lock();
+    STRM_PUTS("-ERR Flash erase error.\r\n");
     return -1;
   }
 
-  // Write bytecode to FLASH.
-  HAL_FLASH_Unlock();
+  STRM_PUTS("+OK Write bytecode.\r\n");
 
-  size += (-size & 3);		// align 4 byte.
-  irep_write_end = irep_write_addr_ + size;
+  uint32_t addr = irep_write_addr_;
+  uint8_t *chunk = buffer;
+  int chunk_size = buffer_size < WRITE_CHUNK_SIZE ? buffer_size : WRITE_CHUNK_SIZE;
+  chunk_size &= ~3;
+  const char *error = 0;
+  int n = size;
 
-  while( irep_write_addr_ < irep_write_end ) {
-    uint32_t data = p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+  while( n > 0 ) {
+    // get a chunk of bytecode.
+    int len = n < chunk_size ? n : chunk_size;
+    STRM_READ( chunk, len );
+    n -= len;
 
-    HAL_StatusTypeDef sts;
-    sts = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, irep_write_addr_, data);
+    // receive the rest after an error, not to take it as commands.
+    if( error ) continue;
 
-    if( sts != HAL_OK ) {
-      STRM_PUTS("-ERR Flash write error.\r\n");
-      HAL_FLASH_Lock();
-      return -1;
+    // check 'RITE' magick code.
+    if( n + len == size && !is_bytecode( chunk, len ) ) {
+      error = "-ERR No RITE code received.\r\n";
+      continue;
+    }
+
+    // Write the chunk to FLASH.
+    if( write_flash( chunk, len ) != 0 ) {
+      error = "-ERR Flash write error.\r\n";
     }
+  }
 
-    p += 4;
-    irep_write_addr_ += 4;
+#if defined(MRBC_VERIFY_BYTECODE)
+  // the compressed one is verified when loaded.
+  const char *reason = 0;
+  if( !error && memcmp( (const void *)addr, RITE, sizeof(RITE) ) == 0 ) {
+    reason = mrbc_verify_mrb( (const void *)addr, size );
+    if( reason ) error = "-ERR Illegal bytecode: ";
+  }
+#endif
+  if( !error && dir_add( addr, size, name, priority ) != 0 ) {
+    error = "-ERR Flash write error.\r\n";
   }
   HAL_FLASH_Lock();
 
+  if( error ) {
+    STRM_PUTS(error);
+#if defined(MRBC_VERIFY_BYTECODE)
+    if( reason ) {
+      STRM_PUTS(reason);
+      STRM_PUTS("\r\n");
+    }
+#endif
+    return -1;
+  }
   STRM_PUTS("+DONE\r\n");
 
   return 0;
@@ -206,102 +698,1144 @@ static int cmd_write( void *buffer, int buffer_size )
 
 
 //================================================================
-/*! command 'showprog'
+/*! apply the patch, and write the image to the slot in update.
+
+  @param  p		patch.
+  @param  size		size of the patch.
+  @param  base		image of the active slot.
+  @param  base_size	size of the base image.
+  @param  max		maximum size of the image.
+  @return		size of the image, or -1 if error.
+  @note		Call between HAL_FLASH_Unlock() and HAL_FLASH_Lock().
 */
-static int cmd_showprog(void)
+static int patch_apply( const uint8_t *p, int size,
+			const uint8_t *base, uint32_t base_size, int max )
 {
-  uint8_t *addr = (uint8_t *)IREP_START_ADDR;
-  int n = 0;
-  char buf[80];
-
-  STRM_PUTS("idx size offset\r\n");
-  while( strncmp( (const char *)addr, RITE, sizeof(RITE)) == 0 ) {
-    unsigned int size = 0;
-    for( int i = 0; i < 4; i++ ) {
-      size = (size << 8) | addr[8 + i];
+  const uint8_t *end = p + size;
+  uint8_t stage[256];		// write to FLASH by the multiple of 4.
+  int n_stage = 0;
+  int total = 0;
+
+  while( p < end ) {
+    const uint8_t *src;
+    uint32_t len;
+
+    switch( *p++ ) {
+    case 'C': {		// copy: offset(32) len(32)
+      if( end - p < 8 ) return -1;
+      uint32_t offset = p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
+      len = p[4] | p[5] << 8 | p[6] << 16 | p[7] << 24;
+      p += 8;
+      if( offset > base_size || len > base_size - offset ) return -1;
+      src = base + offset;
+    } break;
+
+    case 'I':		// insert: len(16) data(len)
+      if( end - p < 2 ) return -1;
+      len = p[0] | p[1] << 8;
+      p += 2;
+      if( len > end - p ) return -1;
+      src = p;
+      p += len;
+      break;
+
+    default:
+      return -1;
     }
-    mrbc_snprintf(buf, sizeof(buf), " %d  %-4d %p\r\n", n++, size, addr);
-    STRM_PUTS(buf);
 
-    addr += size + (-size & 3);	// align 4 byte.
+    if( len > max - total ) return -1;
+    total += len;
+
+    while( len > 0 ) {
+      int n = sizeof(stage) - n_stage;
+      if( n > len ) n = len;
+      memcpy( stage + n_stage, src, n );
+      n_stage += n;
+      src += n;
+      len -= n;
+
+      if( n_stage == sizeof(stage) ) {
+	if( write_flash( stage, n_stage ) != 0 ) return -1;
+	n_stage = 0;
+      }
+    }
   }
 
-  int total = (IREP_END_ADDR - IREP_START_ADDR + 1);
-  int used = (uintptr_t)addr - IREP_START_ADDR;
-  int percent = 100 * used / total;
-  mrbc_snprintf(buf, sizeof(buf), "total %d / %d (%d%%)\r\n", used, total, percent);
-  STRM_PUTS(buf);
-  STRM_PUTS("+DONE\r\n");
+  if( n_stage > 0 && write_flash( stage, n_stage ) != 0 ) return -1;
 
-  return 0;
+  return total;
 }
 
 
 //================================================================
-/*! receive bytecode mode
+/*! command 'patch <size> <image size> <base crc> <image crc>'
+
+  Make the update from the active slot and a patch, not to send all
+  the bytecode over a slow link. The image is the directory and the
+  bytecode of a slot, as in the FLASH. The patch is received into the
+  buffer at once, then applied to the inactive slot.
+
+  (patch, little endian)
+    'C' offset(32) len(32)	copy from the image of the active slot.
+    'I' len(16) data(len)	insert the data.
+
+  The crc are of the images by the CRC unit, in hex. The base crc is
+  the one in the header of the active slot.
 */
-int receive_bytecode( void *buffer, int buffer_size )
+static int cmd_patch( void *buffer, int buffer_size )
 {
-  char buf[50];
+  char *token[4];
+  for( int i = 0; i < 4; i++ ) {
+    token[i] = strtok( NULL, WHITE_SPACE );
+    if( token[i] == NULL ) {
+      STRM_PUTS("-ERR\r\n");
+      return -1;
+    }
+  }
+  int size = mrbc_atoi(token[0], 10);
+  int image_size = mrbc_atoi(token[1], 10);
+  uint32_t base_crc = mrbc_atoi(token[2], 16);
+  uint32_t image_crc = mrbc_atoi(token[3], 16);
+
+  int a = active_slot();
+  if( a < 0 || slot_header(a)->crc != base_crc ) {
+    STRM_PUTS("-ERR Base image mismatch.\r\n");
+    return -1;
+  }
+  const uint8_t *base = (const uint8_t *)SLOT_DIR(a);
+  uint32_t base_size = SLOT_BYTECODE_ADDR(a) - (uint32_t)base
+			+ slot_header(a)->length;
 
-  STRM_PUTS("+OK mruby/c\r\n");
+  if( size <= 0 || size > buffer_size ) {
+    STRM_PUTS("-ERR Patch size overflow.\r\n");
+    return -1;
+  }
 
-  while( 1 ) {
-    // get the command string.
-    if( STRM_GETS(buf, sizeof(buf)) < 0 ) {
-      STRM_RESET();
-      continue;
-    }
+  if( slot_clear() != 0 ) {
+    STRM_PUTS("-ERR Flash erase error.\r\n");
+    return -1;
+  }
 
-    // split tokens.
-    char *token = strtok( buf, WHITE_SPACE );
-    if( token == NULL ) {
-      STRM_PUTS("+OK mruby/c\r\n");
-      continue;
-    }
+  // the image is written from the directory.
+  int n = update_slot_;
+  uint32_t image = (uint32_t)SLOT_DIR(n);
+  irep_write_addr_ = image;
+  if( image_size < (int)(SLOT_BYTECODE_ADDR(n) - image) || (image_size & 3) ||
+      image + image_size > irep_write_end_ ) {
+    update_slot_ = -1;
+    STRM_PUTS("-ERR IREP file size overflow.\r\n");
+    return -1;
+  }
 
-    // find command.
-    int i;
-    for( i = 0; i < NUM_TBL_COMMANDS; i++ ) {
-      if( strcmp( token, TBL_COMMANDS[i].command ) == 0 ) break;
-    }
-    if( i == NUM_TBL_COMMANDS ) {
-      STRM_PUTS("-ERR Illegal command. '");
-      STRM_PUTS(token);
-      STRM_PUTS("'\r\n");
-      continue;
-    }
+  HAL_FLASH_Unlock();
+  if( prepare_write( image_size ) != 0 ) {
+    HAL_FLASH_Lock();
+    update_slot_ = -1;
+    STRM_PUTS("-ERR Flash erase error.\r\n");
+    return -1;
+  }
 
-    // execute command.
-    if( (TBL_COMMANDS[i].function)(buffer, buffer_size) == 1 ) break;
+  STRM_PUTS("+OK Write patch.\r\n");
+  STRM_READ( buffer, size );
+
+  const char *error = 0;
+  if( patch_apply( buffer, size, base, base_size, image_size ) != image_size ) {
+    error = "-ERR Patch error.\r\n";
+  }
+  HAL_FLASH_Lock();
+
+  if( !error && calc_crc( (const void *)image, image_size ) != image_crc ) {
+    error = "-ERR Image CRC error.\r\n";
+  }
+  if( error ) {
+    update_slot_ = -1;		// never activate it.
+    STRM_PUTS(error);
+    return -1;
   }
+  STRM_PUTS("+DONE\r\n");
 
   return 0;
 }
 
 
 //================================================================
-/*! pick up a task
+/*! command 'activate'
 */
-void * pickup_task( void *task )
+static int cmd_activate(void)
 {
-  uint8_t *addr = (uint8_t *)IREP_START_ADDR;
+  int n = update_slot_;
 
-  if( task ) {
-    if( strncmp( task, RITE, sizeof(RITE)) != 0 ) return 0;
+  if( slot_activate() != 0 ) {
+    STRM_PUTS("-ERR\r\n");
+    return -1;
+  }
 
-    addr = task;
-    unsigned int size = 0;
-    for( int i = 0; i < 4; i++ ) {
-      size = (size << 8) | addr[8 + i];
+  char buf[40];
+  mrbc_snprintf( buf, sizeof(buf), "+OK slot %c version %d\r\n",
+		 'A' + n, (int)slot_header(n)->version );
+  STRM_PUTS(buf);
+
+  return 0;
+}
+
+
+//================================================================
+/*! command 'showprog'
+*/
+static int cmd_showprog(void)
+{
+  int slot = active_slot();
+  void *addr = pickup_task( 0 );
+  int n = 0;
+  char buf[80];
+
+  STRM_PUTS("idx size offset     prio name\r\n");
+  for( ; addr; addr = pickup_task( addr ) ) {
+    const BYTECODE_ENTRY *e = bytecode_entry( addr );
+    mrbc_snprintf(buf, sizeof(buf), " %d  %-4d %p %-4d %s\r\n",
+		  n++, (int)e->size, addr, e->priority, e->name);
+    STRM_PUTS(buf);
+  }
+
+  if( slot >= 0 ) {
+    const SLOT_HEADER *h = slot_header(slot);
+    int total = SLOT_BYTECODE_END(slot) - SLOT_BYTECODE_ADDR(slot);
+    int percent = 100 * h->length / total;
+    mrbc_snprintf(buf, sizeof(buf), "slot %c version %d\r\n",
+		  'A' + slot, (int)h->version);
+    STRM_PUTS(buf);
+    mrbc_snprintf(buf, sizeof(buf), "total %d / %d (%d%%)\r\n",
+		  (int)h->length, total, percent);
+    STRM_PUTS(buf);
+  }
+  STRM_PUTS("+DONE\r\n");
+
+  return 0;
+}
+
+
+//================================================================
+/*! binary framed upload mode.
+
+  (frame, little endian. the same for both directions)
+    sync(8) 0xA5, type(8), seq(8), len(16), payload(len), crc(32)
+
+    crc is by the CRC unit of STM32 (CRC-32/MPEG-2 on 32bit words)
+    over sync..payload, zero padded to 4 bytes, read as LE words.
+
+  (type, host to target)
+    'S'  start a file. payload: size(32) [priority(8) name]
+    'D'  data of the file. only the last one can be unaligned to 4.
+    'E'  end of the file.
+    'Q'  quit the binary mode.
+
+  (type, target to host)
+    'A'  accepted the frame seq.
+    'N'  frame lost or broken. resend from seq (go-back-N).
+    'R'  rejected, payload: message. the binary mode is quit.
+
+  The host may send FRAME_WINDOW frames ahead of the acks.
+*/
+#define FRAME_SYNC		0xA5
+#define FRAME_HEADER_SIZE	5
+#define FRAME_PAYLOAD_MAX	256
+#define FRAME_WINDOW		3	// frames fit the Rx FIFO.
+#define FRAME_TIMEOUT_ms	200
+
+typedef struct FRAME {
+  uint8_t type;
+  uint8_t seq;
+  uint16_t len;
+  uint8_t *payload;
+} FRAME;
+
+//! the file in upload.
+typedef struct UPLOAD_FILE {
+  uint32_t addr;
+  int size;
+  int remain;		//!< -1 if no file is open.
+  int priority;
+  char name[16];
+} UPLOAD_FILE;
+
+
+//================================================================
+/*! read with timeout.
+
+  @return	zero if no error, or -1 if timed out.
+*/
+static int strm_read_timeout( void *buf, int size, uint32_t timeout_ms )
+{
+  uint32_t t0 = HAL_GetTick();
+
+  while( STRM_AVAILABLE() < size ) {
+    if( HAL_GetTick() - t0 >= timeout_ms ) return -1;
+  }
+  STRM_READ( buf, size );
+
+  return 0;
+}
+
+
+//================================================================
+/*! send a frame.
+*/
+static void frame_send( int type, int seq, const char *message )
+{
+  uint8_t buf[FRAME_HEADER_SIZE + 48 + 4];
+  int len = message ? strlen(message) : 0;
+  if( len > 48 ) len = 48;
+
+  buf[0] = FRAME_SYNC;
+  buf[1] = type;
+  buf[2] = seq;
+  buf[3] = len;
+  buf[4] = 0;
+  memcpy( buf + FRAME_HEADER_SIZE, message, len );
+  len += FRAME_HEADER_SIZE;
+
+  uint32_t crc = calc_crc( buf, len );
+  for( int i = 0; i < 4; i++ ) {
+    buf[len++] = crc >> (8 * i);
+  }
+
+  STRM_WRITE( buf, len );
+}
+
+
+//================================================================
+/*! receive a frame.
+
+  @param  buf	buffer for a frame.
+  @param  f	received frame.
+  @return	zero if no error, or -1 if broken or timed out.
+*/
+static int frame_receive( uint8_t *buf, FRAME *f )
+{
+  // wait for the sync, without timeout.
+  do {
+    STRM_READ( buf, 1 );
+  } while( buf[0] != FRAME_SYNC );
+
+  if( strm_read_timeout( buf + 1, FRAME_HEADER_SIZE - 1, FRAME_TIMEOUT_ms ) ) {
+    return -1;
+  }
+  f->type = buf[1];
+  f->seq = buf[2];
+  f->len = buf[3] | buf[4] << 8;
+  f->payload = buf + FRAME_HEADER_SIZE;
+  if( f->len > FRAME_PAYLOAD_MAX ) return -1;
+
+  if( strm_read_timeout( f->payload, f->len + 4, FRAME_TIMEOUT_ms ) ) {
+    return -1;
+  }
+
+  const uint8_t *p = f->payload + f->len;
+  uint32_t crc = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+
+  return crc == calc_crc( buf, FRAME_HEADER_SIZE + f->len ) ? 0 : -1;
+}
+
+
+//================================================================
+/*! process a frame in order.
+
+  @return	NULL if accepted, or the message to reject.
+*/
+static const char * frame_process( const FRAME *f, UPLOAD_FILE *file )
+{
+  switch( f->type ) {
+  case 'S': {
+    if( f->len < 4 || f->len > 4 + sizeof(file->name) ||
+	file->remain > 0 ) return "bad frame";
+    const uint8_t *p = f->payload;
+    int size = p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
+    if( size < (int)sizeof(RITE) || update_slot_ < 0 ||
+	irep_write_addr_ + size > irep_write_end_ ) {
+      return "IREP file size overflow";
     }
+    if( dir_count( update_slot_ ) >= SLOT_DIR_MAX ) return "Too many files";
+    if( prepare_write( size ) != 0 ) return "Flash erase error";
+    file->addr = irep_write_addr_;
+    file->size = size;
+    file->remain = size;
+    file->priority = f->len > 4 ? p[4] : 0;
+    memset( file->name, 0, sizeof(file->name) );
+    if( f->len > 5 ) memcpy( file->name, p + 5, f->len - 5 );
+    break;
+  }
 
-    addr += size + (-size & 3);	// align 4 byte.
+  case 'D':
+    if( file->remain <= 0 || f->len > file->remain ) return "bad frame";
+    if( (f->len & 3) && f->len != file->remain ) return "unaligned frame";
+
+    // check 'RITE' magick code at the top of the file.
+    if( file->remain == file->size && !is_bytecode( f->payload, f->len ) ) {
+      return "No RITE code received";
+    }
+
+    if( write_flash( f->payload, f->len ) != 0 ) return "Flash write error";
+    file->remain -= f->len;
+    break;
+
+  case 'E':
+    if( file->remain != 0 ) return "file size mismatch";
+    if( dir_add( file->addr, file->size, file->name, file->priority ) != 0 ) {
+      return "Flash write error";
+    }
+    file->remain = -1;
+    break;
+
+  case 'Q':
+    break;
+
+  default:
+    return "bad frame";
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! command 'binary [baud]'
+*/
+static int cmd_binary( void *buffer, int buffer_size )
+{
+  char *token = strtok( NULL, WHITE_SPACE );
+#if defined(MRBC_CONSOLE_USB_CDC)
+  // USB has no baud rate, the argument is only echoed.
+  uint32_t baud = 115200;
+#else
+  UART_HandleTypeDef *huart = UART_HANDLE_CONSOLE->hal_uart;
+  uint32_t baud = huart->Init.BaudRate;
+#endif
+  uint32_t new_baud = token ? mrbc_atoi(token, 10) : baud;
+
+  if( buffer_size < FRAME_HEADER_SIZE + FRAME_PAYLOAD_MAX + 4 ||
+      new_baud == 0 ) {
+    STRM_PUTS("-ERR\r\n");
+    return -1;
+  }
+
+  char buf[60];
+  mrbc_snprintf( buf, sizeof(buf), "+OK binary %d window %d frame %d\r\n",
+		 (int)new_baud, FRAME_WINDOW, FRAME_PAYLOAD_MAX );
+  STRM_PUTS(buf);
+#if !defined(MRBC_CONSOLE_USB_CDC)
+  if( new_baud != baud ) {
+    uart_setmode( UART_HANDLE_CONSOLE, new_baud, -1, -1 );
+  }
+#endif
+  STRM_RESET();
+
+  HAL_FLASH_Unlock();
+
+  uint8_t seq = 0;		// expected seq.
+  int flag_nak = 0;		// nak is sent and not recovered yet.
+  UPLOAD_FILE file = { .remain = -1 };
+  const char *error = 0;
+  FRAME f;
+
+  // the broadcast frames don't wait for the erase, so erase it first.
+  if( flag_silent_ ) {
+    upload_error_ = 0;
+    if( update_slot_ < 0 ) {
+      upload_error_ = "not cleared";
+    } else if( prepare_write( irep_write_end_ - irep_write_addr_ ) != 0 ) {
+      upload_error_ = "Flash erase error";
+    }
+  }
+
+  while( 1 ) {
+    int ret = frame_receive( buffer, &f );
+    if( flag_silent_ ) {
+      // no acks nor resends. the error is reported by 'verify'.
+      if( ret == 0 && f.type == 'Q' ) {
+	if( file.remain >= 0 && !upload_error_ ) upload_error_ = "file not ended";
+	error = upload_error_;
+	break;
+      }
+      if( ret != 0 || f.seq != seq ) {
+	if( !upload_error_ ) upload_error_ = "frame lost";
+      } else {
+	if( !upload_error_ ) upload_error_ = frame_process( &f, &file );
+	seq++;
+      }
+      continue;
+    }
+
+    if( ret != 0 || f.seq != seq ) {
+      // discard the frames in flight, until the lost one is resent.
+      if( !flag_nak ) frame_send( 'N', seq, 0 );
+      flag_nak = 1;
+      continue;
+    }
+    flag_nak = 0;
+
+    error = frame_process( &f, &file );
+    if( error ) {
+      frame_send( 'R', seq, error );
+      break;
+    }
+    frame_send( 'A', seq++, 0 );
+    if( f.type == 'Q' ) break;
   }
 
-  if( strncmp( (const char *)addr, RITE, sizeof(RITE)) == 0 ) {
-    return addr;
+  HAL_FLASH_Lock();
+
+  STRM_FLUSH();
+#if !defined(MRBC_CONSOLE_USB_CDC)
+  if( new_baud != baud ) {
+    uart_setmode( UART_HANDLE_CONSOLE, baud, -1, -1 );
   }
+#endif
+  STRM_RESET();
+
+  return error ? -1 : 0;
+}
+
+
+//================================================================
+/*! command 'verify'
+
+  Lists the files in the slot in update with their CRC, to check the
+  broadcast upload on each node.
+*/
+static int cmd_verify(void)
+{
+  char buf[60];
+
+  if( upload_error_ || update_slot_ < 0 ) {
+    STRM_PUTS("-ERR ");
+    STRM_PUTS(upload_error_ ? upload_error_ : "not cleared");
+    STRM_PUTS("\r\n");
+    return -1;
+  }
+
+  int n = dir_count( update_slot_ );
+  mrbc_snprintf( buf, sizeof(buf), "+OK %d\r\n", n );
+  STRM_PUTS(buf);
+  for( int i = 0; i < n; i++ ) {
+    const BYTECODE_ENTRY *e = &SLOT_DIR(update_slot_)[i];
+    mrbc_snprintf( buf, sizeof(buf), " %d %d %08x %s\r\n",
+		   i, (int)e->size, (unsigned int)e->crc, e->name );
+    STRM_PUTS(buf);
+  }
+  STRM_PUTS("+DONE\r\n");
 
   return 0;
 }
+
+
+#if defined(MRBC_METRICS)
+//================================================================
+/*! reply to the stats command.
+
+  "stats"		"+OK <len>", binary stats record, "+DONE"
+  "stats name <idx>"	"+OK <idx> <type> <name>"
+
+  (see metrics.c for the record format)
+
+  @param  hndl		UART to reply, or NULL for the console.
+  @param  sub		sub command or NULL.
+  @param  arg		argument of the sub command or NULL.
+  @param  flag_nowait	don't wait for the Tx FIFO, to be called from ISR.
+  @return		0 if replied, or -1 if the Tx FIFO is short.
+*/
+static int stats_reply( UART_HANDLE *hndl, const char *sub, const char *arg,
+			int flag_nowait )
+{
+  static const char DONE[] = "+DONE\r\n";
+  uint8_t rec[8 + 4 * MRBC_METRICS_MAX + 1];
+  char head[64];
+  int n = 0;
+
+  if( !sub ) {
+    n = mrbc_metrics_encode( rec, sizeof(rec), HAL_GetTick() );
+    mrbc_snprintf( head, sizeof(head), "+OK %d\r\n", n );
+  } else {
+    const mrbc_metric *m = 0;
+    if( strcmp( sub, "name" ) == 0 && arg ) {
+      m = mrbc_metric_get( mrbc_atoi( arg, 10 ) );
+    }
+    if( m ) {
+      mrbc_snprintf( head, sizeof(head), "+OK %s %c %s\r\n",
+		     arg, m->type, m->name );
+    } else {
+      strcpy( head, "-ERR\r\n" );
+    }
+  }
+
+  int len = strlen(head);
+  int total = len + (n > 0 ? n + sizeof(DONE) - 1 : 0);
+  if( !hndl ) {
+    STRM_WRITE( head, len );
+    if( n > 0 ) {
+      STRM_WRITE( rec, n );
+      STRM_WRITE( DONE, sizeof(DONE) - 1 );
+    }
+    return 0;
+  }
+
+  if( flag_nowait &&
+      total > hndl->txfifo_size - 1 - uart_bytes_to_write(hndl) ) return -1;
+
+  uart_write( hndl, head, len );
+  if( n > 0 ) {
+    uart_write( hndl, rec, n );
+    uart_write( hndl, DONE, sizeof(DONE) - 1 );
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! command 'stats'
+*/
+static int cmd_stats(void)
+{
+  char *sub = strtok( NULL, WHITE_SPACE );
+  char *arg = strtok( NULL, WHITE_SPACE );
+
+  stats_reply( 0, sub, arg, 0 );
+  return 0;
+}
+
+
+//================================================================
+/*! serve the stats command on the UART, while the VM is running.
+
+  Called from the UART interrupt, so the reply is dropped if the Tx
+  FIFO doesn't have enough space, and never blocks.
+
+  @param  hndl	UART dedicated to the stats. (see MRBC_METRICS_UART)
+*/
+void serve_stats( UART_HANDLE *hndl )
+{
+  int len;
+  char buf[32];
+
+  while( (len = uart_can_read_line(hndl)) > 0 ) {
+    if( len >= sizeof(buf) ) {
+      uart_clear_rx_buffer(hndl);
+      return;
+    }
+    uart_gets( hndl, buf, sizeof(buf) );
+
+    char *save;
+    char *token = strtok_r( buf, WHITE_SPACE, &save );
+    if( !token || strcmp( token, "stats" ) != 0 ) continue;
+
+    char *sub = strtok_r( NULL, WHITE_SPACE, &save );
+    char *arg = strtok_r( NULL, WHITE_SPACE, &save );
+    stats_reply( hndl, sub, arg, 1 );
+  }
+}
+#endif
+
+
+//================================================================
+/*! get the node address on the shared bus.
+
+  Override this to read it from e.g. DIP switches.
+
+  @return	1..255, or 0 if not on a shared bus.
+*/
+__attribute__((weak)) int firm_node_address( void )
+{
+  return MRBC_FIRM_NODE_ADDRESS;
+}
+
+
+//================================================================
+/*! check the address part of a command. "@3", "@1,2,5" or "@*"
+
+  @param  s	after '@'.
+  @param  addr	address of this node.
+  @return	1 if unicast to this node, 2 if broadcast or multicast
+		including this node, or 0 if not.
+*/
+static int node_addressed( const char *s, int addr )
+{
+  if( strcmp( s, "*" ) == 0 ) return 2;
+
+  int found = 0, n = 0;
+  while( 1 ) {
+    const char *p = s;
+    while( *s >= '0' && *s <= '9' ) s++;
+    if( s == p ) return 0;		// broken.
+    if( mrbc_atoi( p, 10 ) == addr ) found = 1;
+    n++;
+    if( *s == 0 ) break;
+    if( *s++ != ',' ) return 0;
+  }
+
+  return found ? (n == 1 ? 1 : 2) : 0;
+}
+
+
+//================================================================
+/*! receive bytecode mode
+*/
+int receive_bytecode( void *buffer, int buffer_size )
+{
+  char buf[50];
+  int addr = firm_node_address();
+
+  // the nodes on a shared bus speak only when asked.
+  flag_silent_ = (addr != 0);
+  STRM_PUTS("+OK mruby/c\r\n");
+
+  while( 1 ) {
+    // get the command string.
+    flag_silent_ = (addr != 0);
+    if( STRM_GETS(buf, sizeof(buf)) < 0 ) {
+      STRM_RESET();
+      continue;
+    }
+
+    // split tokens.
+    char *token = strtok( buf, WHITE_SPACE );
+    if( token && token[0] == '@' ) {
+      int to = node_addressed( token + 1, addr );
+      if( to == 0 ) continue;		// to the other nodes.
+      flag_silent_ = (to == 2);
+      token = strtok( NULL, WHITE_SPACE );
+    } else if( addr != 0 ) {
+      continue;				// not addressed on the shared bus.
+    }
+    if( token == NULL ) {
+      STRM_PUTS("+OK mruby/c\r\n");
+      continue;
+    }
+
+    // find command.
+    int i;
+    for( i = 0; i < NUM_TBL_COMMANDS; i++ ) {
+      if( strcmp( token, TBL_COMMANDS[i].command ) == 0 ) break;
+    }
+    if( i == NUM_TBL_COMMANDS ) {
+      STRM_PUTS("-ERR Illegal command. '");
+      STRM_PUTS(token);
+      STRM_PUTS("'\r\n");
+      continue;
+    }
+
+    // execute command.
+    if( (TBL_COMMANDS[i].function)(buffer, buffer_size) == 1 ) break;
+  }
+  flag_silent_ = 0;
+
+  return 0;
+}
+
+
+//================================================================
+/*! pick up a task
+
+  @param  task	the previous task, or NULL to get the first task.
+  @return	bytecode of the task in the active slot, or NULL.
+*/
+void * pickup_task( void *task )
+{
+  const BYTECODE_ENTRY *e;
+  int n;
+
+  if( !task ) {
+    n = active_slot();
+    if( n < 0 ) return 0;
+    e = SLOT_DIR(n);
+
+  } else {
+    n = SLOT_OF(task);
+    e = bytecode_entry( task );
+    if( !e ) return 0;
+    e++;
+  }
+
+  const SLOT_HEADER *h = (const SLOT_HEADER *)SLOT_ADDR(n);
+  if( e < SLOT_DIR(n) + SLOT_DIR_MAX && e->offset < h->length ) {
+    return (void *)(SLOT_BYTECODE_ADDR(n) + e->offset);
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! get the directory entry of a task.
+
+  @param  task	bytecode of the task. (see pickup_task)
+  @return	pointer to the entry, or NULL.
+*/
+const BYTECODE_ENTRY * bytecode_entry( const void *task )
+{
+  int n = SLOT_OF(task);
+  uint32_t offset = (uint32_t)task - SLOT_BYTECODE_ADDR(n);
+
+  for( int i = 0; i < SLOT_DIR_MAX; i++ ) {
+    if( SLOT_DIR(n)[i].offset == offset ) return &SLOT_DIR(n)[i];
+  }
+
+  return 0;
+}
+
+
+#if defined(MRBC_SNAPSHOT)
+//================================================================
+/*! CRC of the firmware, that is the code and the initial data.
+*/
+static uint32_t firmware_crc(void)
+{
+  return calc_crc( _firmware_start,
+		   (_sidata - _firmware_start) + (_edata - _sdata) );
+}
+
+
+//================================================================
+/*! save the snapshot of the VM to the active slot.
+
+  The .data and .bss of the VM (see the linker script) are saved after
+  the tasks are created, once for each activation of the slot.
+
+  @return	zero if saved.
+*/
+int snapshot_save(void)
+{
+  int n = active_slot();
+  if( n < 0 ) return -1;
+
+  uint32_t addr = SLOT_SNAPSHOT_ADDR(n);
+  int size = STATE_DATA_SIZE + STATE_BSS_SIZE;
+  if( sizeof(SNAPSHOT_HEADER) + size > MRBC_SNAPSHOT_SIZE ) return -1;
+
+  // already taken, or not erased.
+  for( int i = 0; i < sizeof(SNAPSHOT_HEADER) + size; i += 4 ) {
+    if( *(const uint32_t *)(addr + i) != 0xFFFFFFFF ) return -1;
+  }
+
+  SNAPSHOT_HEADER h = {
+    .firmware_crc = firmware_crc(),
+    .data_size = STATE_DATA_SIZE,
+    .bss_size = STATE_BSS_SIZE,
+  };
+  uint32_t state = addr + sizeof(SNAPSHOT_HEADER);
+
+  HAL_FLASH_Unlock();
+  int ret = program_flash( state, _mrbc_state_data_start, h.data_size );
+  if( ret == 0 ) {
+    ret = program_flash( state + h.data_size, _mrbc_state_bss_start, h.bss_size );
+  }
+  h.crc = calc_crc( (const void *)state, size );
+
+  // the magic at last.
+  if( ret == 0 ) {
+    ret = program_flash( addr + 4, &h.firmware_crc, sizeof(h) - 4 );
+  }
+  if( ret == 0 ) {
+    ret = program_flash( addr, "MRSS", 4 );
+  }
+  HAL_FLASH_Lock();
+
+  return ret;
+}
+
+
+//================================================================
+/*! restore the VM from the snapshot in the active slot.
+
+  The snapshot is valid only for the firmware that took it.
+
+  @return	zero if restored, then the tasks are ready to mrbc_run().
+*/
+int snapshot_restore(void)
+{
+  int n = active_slot();
+  if( n < 0 ) return -1;
+
+  const SNAPSHOT_HEADER *h = (const SNAPSHOT_HEADER *)SLOT_SNAPSHOT_ADDR(n);
+  const uint8_t *state = (const uint8_t *)(h + 1);
+  if( strncmp( h->magic, "MRSS", 4 ) != 0 ||
+      h->data_size != STATE_DATA_SIZE || h->bss_size != STATE_BSS_SIZE ||
+      h->firmware_crc != firmware_crc() ||
+      h->crc != calc_crc( state, h->data_size + h->bss_size ) ) {
+    return -1;
+  }
+
+  hal_disable_irq();
+  memcpy( _mrbc_state_data_start, state, h->data_size );
+  memcpy( _mrbc_state_bss_start, state + h->data_size, h->bss_size );
+  hal_enable_irq();
+
+  hal_init();
+  return 0;
+}
+#endif
+
+
+#if defined(MRBC_BYTECODE_LZ4)
+//================================================================
+/*! decode a LZ4 block.
+
+  @param  src		LZ4 block.
+  @param  src_len	size of the block.
+  @param  dst		output buffer.
+  @param  dst_len	size of the buffer.
+  @return		size of the output, or -1 if broken.
+*/
+static int lz4_decode( const uint8_t *src, int src_len, uint8_t *dst, int dst_len )
+{
+  const uint8_t *s_end = src + src_len;
+  uint8_t *d = dst;
+  uint8_t *d_end = dst + dst_len;
+
+  while( src < s_end ) {
+    int token = *src++;
+
+    // literals.
+    int len = token >> 4;
+    if( len == 15 ) {
+      int b;
+      do {
+	if( src >= s_end ) return -1;
+	b = *src++;
+	len += b;
+      } while( b == 255 );
+    }
+    if( len > s_end - src || len > d_end - d ) return -1;
+    memcpy( d, src, len );
+    d += len;
+    src += len;
+    if( src == s_end ) break;		// the last literals.
+
+    // match.
+    if( s_end - src < 2 ) return -1;
+    int offset = src[0] | src[1] << 8;
+    src += 2;
+    if( offset == 0 || offset > d - dst ) return -1;
+
+    len = (token & 15) + 4;
+    if( (token & 15) == 15 ) {
+      int b;
+      do {
+	if( src >= s_end ) return -1;
+	b = *src++;
+	len += b;
+      } while( b == 255 );
+    }
+    if( len > d_end - d ) return -1;
+
+    const uint8_t *m = d - offset;
+    while( len-- > 0 ) *d++ = *m++;	// they can overlap.
+  }
+
+  return d - dst;
+}
+#endif
+
+
+//================================================================
+/*! get the bytecode to create the task.
+
+  A compressed file is decompressed into the memory pool, that is kept
+  for the task.
+
+  @param  task	bytecode of the task. (see pickup_task)
+  @return	pointer to the bytecode, or NULL if error.
+*/
+const void * task_bytecode( const void *task )
+{
+#if defined(MRBC_BYTECODE_LZ4)
+  const uint8_t *p = task;
+  if( strncmp( task, RLZ4, sizeof(RLZ4)) != 0 ) return task;
+
+  int raw_size = p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+  int size = p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11];
+  uint8_t *buf = mrbc_raw_alloc( raw_size );
+  if( !buf ) return 0;		// ENOMEM
+
+  if( lz4_decode( p + RLZ4_HEADER_SIZE, size - RLZ4_HEADER_SIZE,
+		  buf, raw_size ) != raw_size ) {
+    mrbc_raw_free( buf );
+    return 0;
+  }
+
+  return buf;
+#else
+  return task;
+#endif
+}
+
+
+#if defined(MRBC_USE_IREP_IMAGE)
+//================================================================
+/*! pick up the IREP image built from the task.
+
+  @param  task	bytecode of the task. (see pickup_task)
+  @return	pointer to the image, or NULL if not built yet.
+*/
+void * pickup_irep_image( const void *task )
+{
+  const mrbc_irep_image *image =
+    (const mrbc_irep_image *)SLOT_IMAGE_ADDR(SLOT_OF(task));
+
+  while( strncmp( image->magic, "MRBI", 4 ) == 0 ) {
+    if( image->bytecode == task ) return (void *)image;
+
+    image = (const mrbc_irep_image *)
+		((uintptr_t)image + image->size + (-image->size & 3));
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! IREP image writer. (see mrbc_irep_image_writer)
+
+  ctx is {write address, end address}.
+*/
+static int irep_image_writer( void *ctx, const void *data, int size )
+{
+  uint32_t *addr = ctx;
+  const uint8_t *p = data;
+
+  if( addr[0] + size > addr[1] ) return -1;
+
+  for( int i = 0; i < size; i++ ) {
+    if( HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, *addr, p[i]) != HAL_OK ) {
+      return -1;
+    }
+    (*addr)++;
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! write the IREP image of the task loaded in the VM.
+
+  @param  vm		VM which loaded the task.
+  @param  task		bytecode of the task.
+  @param  sym_base	mrbc_symbol_count() before loading the task.
+  @return int		zero if no error.
+*/
+int write_irep_image( const mrbc_vm *vm, const void *task, int sym_base )
+{
+  // find the free space.
+  int n = SLOT_OF(task);
+  const mrbc_irep_image *image = (const mrbc_irep_image *)SLOT_IMAGE_ADDR(n);
+  while( strncmp( image->magic, "MRBI", 4 ) == 0 ) {
+    image = (const mrbc_irep_image *)
+		((uintptr_t)image + image->size + (-image->size & 3));
+  }
+
+  uint32_t addr[2] = { (uintptr_t)image, SLOT_ADDR(n) + SLOT_SIZE };
+  HAL_FLASH_Unlock();
+  int ret = mrbc_irep_image_build( vm, task, sym_base, addr[0],
+				   irep_image_writer, addr );
+  HAL_FLASH_Lock();
+
+  // (note) a broken image is left as is, until the next 'clear'.
+  return ret < 0;
+}
+#endif
+
+
+//================================================================
+/*! (method) start an update of the program in the inactive slot.
+
+  Firmware.clear
+*/
+static void c_firmware_clear(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( slot_clear() != 0 ) {
+    mrbc_raise(vm, 0, "Firmware.clear: flash erase error.");
+  }
+}
+
+
+//================================================================
+/*! (method) append the bytecode to the update.
+
+  Firmware.write( bytecode )
+
+  Only the last string of each .mrb file can be unaligned to 4 bytes.
+  The VM stalls during the erase of a sector. (about 1-2 sec / 128KB)
+*/
+static void c_firmware_write(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || mrbc_type(v[1]) != MRBC_TT_STRING ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  if( slot_write( mrbc_string_cstr(&v[1]), mrbc_string_size(&v[1]) ) != 0 ) {
+    mrbc_raise(vm, 0, "Firmware.write: flash write error.");
+  }
+}
+
+
+//================================================================
+/*! (method) activate the update. it runs after the reset.
+
+  Firmware.activate
+*/
+static void c_firmware_activate(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( slot_activate() != 0 ) {
+    mrbc_raise(vm, 0, "Firmware.activate: activate error.");
+  }
+}
+
+
+//================================================================
+/*! (method) reset into the upload mode.
+
+  Firmware.upload_mode
+*/
+static void c_firmware_upload_mode(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  HAL_PWR_EnableBkUpAccess();
+  RTC->BKP0R = BOOT_REQUEST_UPLOAD;
+  HAL_PWR_DisableBkUpAccess();
+
+  NVIC_SystemReset();
+}
+
+
+//================================================================
+/*! take the request of the upload mode, made by Firmware.upload_mode.
+
+  The request is kept in the RTC backup register over the reset,
+  and cleared by this. (the register is cleared at power on)
+
+  @return	non-zero if requested.
+*/
+int take_upload_request(void)
+{
+  if( RTC->BKP0R != BOOT_REQUEST_UPLOAD ) return 0;
+
+  HAL_PWR_EnableBkUpAccess();
+  RTC->BKP0R = 0;
+  HAL_PWR_DisableBkUpAccess();
+
+  return 1;
+}
+
+
+//================================================================
+/*! initialize the Firmware class, to update the program while running.
+*/
+void mrbc_init_class_firmware(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Firmware", 0);
+
+  mrbc_define_method(0, cls, "clear", c_firmware_clear);
+  mrbc_define_method(0, cls, "write", c_firmware_write);
+  mrbc_define_method(0, cls, "activate", c_firmware_activate);
+  mrbc_define_method(0, cls, "upload_mode", c_firmware_upload_mode);
+}
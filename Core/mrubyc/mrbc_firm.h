@@ -11,5 +11,42 @@
 */
 
 
+//@cond
+#include <stdint.h>
+//@endcond
+
+#include "crc.h"
+
+/*!@brief
+  An entry of the bytecode directory, written along with the bytecode.
+*/
+typedef struct BYTECODE_ENTRY {
+  uint32_t offset;	//!< from the top of the bytecode, or ~0 if unused.
+  uint32_t size;	//!< size of the .mrb file.
+  uint32_t crc;		//!< CRC of the file, by the CRC unit.
+  uint8_t priority;	//!< task priority, or 0 for the default.
+  uint8_t reserved[3];
+  char name[16];	//!< task name, or "".
+} BYTECODE_ENTRY;
+
+
 int receive_bytecode(void *buffer, int buffer_size);
+int firm_node_address(void);
+#if defined(MRBC_METRICS)
+struct UART_HANDLE;
+void serve_stats(struct UART_HANDLE *hndl);
+#endif
 void *pickup_task(void *task);
+const BYTECODE_ENTRY *bytecode_entry(const void *task);
+const void *task_bytecode(const void *task);
+void mrbc_init_class_firmware(void);
+int take_upload_request(void);
+#if defined(MRBC_SNAPSHOT)
+int snapshot_save(void);
+int snapshot_restore(void);
+#endif
+#if defined(MRBC_USE_IREP_IMAGE)
+struct VM;
+void *pickup_irep_image(const void *task);
+int write_irep_image(const struct VM *vm, const void *task, int sym_base);
+#endif
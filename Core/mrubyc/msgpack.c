@@ -0,0 +1,506 @@
+/*! @file
+  @brief
+  MessagePack class. Binary serialization for the telemetry.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The values are encoded directly into one growable buffer, and the
+  buffer becomes the result String as it is.
+
+    bin = MessagePack.pack( {"t"=>23.5, "v"=>[1,2,3]} )
+    obj = MessagePack.unpack( bin )
+
+  Supported types are nil, true, false, Integer, Float, String, Symbol
+  (packed as a string), Array and Hash. bin 8/16/32 is unpacked to
+  String, and ext types are not supported.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "../mrubyc_src/mrubyc.h"
+
+//! nesting level of Array and Hash, to limit the stack usage.
+#if !defined(MSGPACK_MAX_NESTING)
+#define MSGPACK_MAX_NESTING 16
+#endif
+
+
+/*!@brief
+  output buffer of the packer.
+*/
+typedef struct MSGPACK_WRITER {
+  mrbc_vm *vm;
+  uint8_t *buf;		//!< output buffer.
+  int len;		//!< data length in the buffer.
+  int size;		//!< buffer size.
+} MSGPACK_WRITER;
+
+
+/*!@brief
+  state of the unpacker.
+*/
+typedef struct MSGPACK_READER {
+  mrbc_vm *vm;
+  const uint8_t *p;	//!< read point.
+  const uint8_t *end;	//!< end of the data.
+  int depth;		//!< nesting level.
+} MSGPACK_READER;
+
+
+//================================================================
+/*! make room in the output buffer.
+
+  @return	0 if no error, or -1 if no memory.
+*/
+static int msgpack_reserve( MSGPACK_WRITER *w, int n )
+{
+  if( w->len + n <= w->size ) return 0;
+
+  int size = w->size * 2;
+  while( size < w->len + n ) size *= 2;
+  uint8_t *buf = mrbc_realloc( w->vm, w->buf, size );
+  if( !buf ) return -1;
+
+  w->buf = buf;
+  w->size = size;
+  return 0;
+}
+
+
+//================================================================
+/*! write the type byte and the big endian value.
+
+  @param  w	pointer to writer.
+  @param  type	type byte.
+  @param  v	value.
+  @param  n	bytes of the value. (0, 1, 2, 4 or 8)
+*/
+static int msgpack_write_uint( MSGPACK_WRITER *w, int type, uint64_t v, int n )
+{
+  if( msgpack_reserve( w, n + 1 ) != 0 ) return -1;
+
+  uint8_t *p = w->buf + w->len;
+  *p++ = type;
+  for( int i = n - 1; i >= 0; i-- ) {
+    *p++ = (uint8_t)(v >> (i * 8));
+  }
+  w->len += n + 1;
+  return 0;
+}
+
+
+//================================================================
+/*! write the header of the sized type. (fix, 8, 16 and 32 bit)
+
+  @param  w	pointer to writer.
+  @param  size	size or number of elements.
+  @param  fix	type byte of the fix type.
+  @param  fix_max max size of the fix type.
+  @param  type16 type byte of 16bit size. 32bit follows it.
+  @param  flag_size8 8bit size type exists before type16.
+*/
+static int msgpack_write_size( MSGPACK_WRITER *w, uint32_t size, int fix,
+			       uint32_t fix_max, int type16, int flag_size8 )
+{
+  if( size <= fix_max ) return msgpack_write_uint( w, fix | size, 0, 0 );
+  if( flag_size8 && size <= 0xff ) {
+    return msgpack_write_uint( w, type16 - 1, size, 1 );
+  }
+  if( size <= 0xffff ) return msgpack_write_uint( w, type16, size, 2 );
+  return msgpack_write_uint( w, type16 + 1, size, 4 );
+}
+
+
+//================================================================
+/*! write a string.
+*/
+static int msgpack_write_str( MSGPACK_WRITER *w, const char *s, int len )
+{
+  if( msgpack_write_size( w, len, 0xa0, 31, 0xda, 1 ) != 0 ) return -1;
+  if( msgpack_reserve( w, len ) != 0 ) return -1;
+
+  memcpy( w->buf + w->len, s, len );
+  w->len += len;
+  return 0;
+}
+
+
+//================================================================
+/*! write an integer by the smallest type.
+*/
+static int msgpack_write_int( MSGPACK_WRITER *w, int64_t v )
+{
+  if( v >= 0 ) {
+    if( v <= 0x7f )	  return msgpack_write_uint( w, (int)v, 0, 0 );
+    if( v <= 0xff )	  return msgpack_write_uint( w, 0xcc, v, 1 );
+    if( v <= 0xffff )	  return msgpack_write_uint( w, 0xcd, v, 2 );
+    if( v <= 0xffffffff ) return msgpack_write_uint( w, 0xce, v, 4 );
+    return msgpack_write_uint( w, 0xcf, v, 8 );
+  }
+
+  if( v >= -32 )	  return msgpack_write_uint( w, (int)v & 0xff, 0, 0 );
+  if( v >= INT8_MIN )	  return msgpack_write_uint( w, 0xd0, v, 1 );
+  if( v >= INT16_MIN )	  return msgpack_write_uint( w, 0xd1, v, 2 );
+  if( v >= INT32_MIN )	  return msgpack_write_uint( w, 0xd2, v, 4 );
+  return msgpack_write_uint( w, 0xd3, v, 8 );
+}
+
+
+//================================================================
+/*! pack a value.
+
+  @param  w	pointer to writer.
+  @param  v	value.
+  @param  depth	nesting level.
+  @return	0 if no error, -1 if no memory, -2 if type error
+		or -3 if too deep.
+*/
+static int msgpack_pack( MSGPACK_WRITER *w, const mrbc_value *v, int depth )
+{
+  int ret;
+
+  switch( mrbc_type(*v) ) {
+  case MRBC_TT_NIL:	return msgpack_write_uint( w, 0xc0, 0, 0 );
+  case MRBC_TT_FALSE:	return msgpack_write_uint( w, 0xc2, 0, 0 );
+  case MRBC_TT_TRUE:	return msgpack_write_uint( w, 0xc3, 0, 0 );
+
+  case MRBC_TT_INTEGER:
+    return msgpack_write_int( w, mrbc_integer(*v) );
+
+#if defined(MRBC_INT_WIDE)
+  case MRBC_TT_WIDE_INT:
+    return msgpack_write_int( w, mrbc_int_wide_get(v) );
+#endif
+
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT: {
+    // float 32 or float 64, by the size of mrbc_float_t.
+    mrbc_float_t d = mrbc_float(*v);
+    if( sizeof(d) == 4 ) {
+      uint32_t bits;
+      memcpy( &bits, &d, 4 );
+      return msgpack_write_uint( w, 0xca, bits, 4 );
+    } else {
+      uint64_t bits;
+      memcpy( &bits, &d, 8 );
+      return msgpack_write_uint( w, 0xcb, bits, 8 );
+    }
+  }
+#endif
+
+  case MRBC_TT_STRING:
+    return msgpack_write_str( w, mrbc_string_cstr(v), mrbc_string_size(v) );
+
+  case MRBC_TT_SYMBOL: {
+    const char *s = mrbc_symbol_cstr( v );
+    return msgpack_write_str( w, s, strlen(s) );
+  }
+
+  case MRBC_TT_ARRAY: {
+    if( depth >= MSGPACK_MAX_NESTING ) return -3;
+    int n = v->array->n_stored;
+    if( msgpack_write_size( w, n, 0x90, 15, 0xdc, 0 ) != 0 ) return -1;
+    for( int i = 0; i < n; i++ ) {
+      ret = msgpack_pack( w, &v->array->data[i], depth + 1 );
+      if( ret != 0 ) return ret;
+    }
+    return 0;
+  }
+
+  case MRBC_TT_HASH: {
+    if( depth >= MSGPACK_MAX_NESTING ) return -3;
+    if( msgpack_write_size( w, mrbc_hash_size(v), 0x80, 15, 0xde, 0 ) != 0 ) return -1;
+    mrbc_hash_iterator ite = mrbc_hash_iterator_new( v );
+    while( mrbc_hash_i_has_next( &ite ) ) {
+      mrbc_value *kv = mrbc_hash_i_next( &ite );
+      if( (ret = msgpack_pack( w, &kv[0], depth + 1 )) != 0 ) return ret;
+      if( (ret = msgpack_pack( w, &kv[1], depth + 1 )) != 0 ) return ret;
+    }
+    return 0;
+  }
+
+  default:
+    return -2;
+  }
+}
+
+
+//================================================================
+/*! read the big endian value.
+
+  @param  r	pointer to reader.
+  @param  n	bytes. (1, 2, 4 or 8)
+  @param  v	[out] value.
+  @return	0 if no error, or -1 if the data is short.
+*/
+static int msgpack_read_uint( MSGPACK_READER *r, int n, uint64_t *v )
+{
+  if( r->end - r->p < n ) return -1;
+
+  uint64_t ret = 0;
+  for( int i = 0; i < n; i++ ) {
+    ret = ret << 8 | *r->p++;
+  }
+  *v = ret;
+  return 0;
+}
+
+
+//================================================================
+/*! unpack a value.
+
+  @param  r	pointer to reader.
+  @param  ret	[out] value.
+  @return	0 if no error, -1 if broken data, -2 if no memory,
+		-3 if too deep or -4 if not supported type.
+*/
+static int msgpack_unpack( MSGPACK_READER *r, mrbc_value *ret )
+{
+  uint64_t n;
+  int err;
+
+  if( r->p >= r->end ) return -1;
+  int type = *r->p++;
+
+  // fix types
+  if( type <= 0x7f ) {
+    *ret = mrbc_integer_value( type );
+    return 0;
+  }
+  if( type >= 0xe0 ) {
+    *ret = mrbc_integer_value( (int8_t)type );
+    return 0;
+  }
+  if( (type & 0xe0) == 0xa0 ) {
+    n = type & 0x1f;
+    goto STRING;
+  }
+  if( (type & 0xf0) == 0x90 ) {
+    n = type & 0x0f;
+    goto ARRAY;
+  }
+  if( (type & 0xf0) == 0x80 ) {
+    n = type & 0x0f;
+    goto MAP;
+  }
+
+  switch( type ) {
+  case 0xc0: *ret = mrbc_nil_value();	return 0;
+  case 0xc2: *ret = mrbc_false_value();	return 0;
+  case 0xc3: *ret = mrbc_true_value();	return 0;
+
+  // unsigned and signed integers.
+  case 0xcc: case 0xcd: case 0xce: case 0xcf:
+  case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+    int bytes = 1 << (type & 0x03);
+    if( msgpack_read_uint( r, bytes, &n ) != 0 ) return -1;
+
+    int64_t i;
+    int flag_fit;
+    if( type <= 0xcf ) {
+      flag_fit = (n <= (mrbc_uint_t)-1 >> 1);
+      i = n;
+    } else {
+      int shift = 64 - bytes * 8;
+      i = (int64_t)(n << shift) >> shift;	// sign extension.
+      flag_fit = ((mrbc_int_t)i == i);
+    }
+    if( flag_fit ) {
+      *ret = mrbc_integer_value( (mrbc_int_t)i );
+      return 0;
+    }
+#if defined(MRBC_INT_WIDE)
+    if( (type > 0xcf || n <= INT64_MAX) && mrbc_int_wide_set( ret, i ) == 0 ) {
+      return 0;
+    }
+#endif
+#if MRBC_USE_FLOAT
+    // out of the Integer range.
+    *ret = mrbc_float_value( r->vm, (type <= 0xcf) ? (mrbc_float_t)n : (mrbc_float_t)i );
+    return 0;
+#else
+    return -4;
+#endif
+  }
+
+#if MRBC_USE_FLOAT
+  case 0xca: {
+    float f;
+    uint32_t bits;
+    if( msgpack_read_uint( r, 4, &n ) != 0 ) return -1;
+    bits = n;
+    memcpy( &f, &bits, 4 );
+    *ret = mrbc_float_value( r->vm, f );
+    return 0;
+  }
+  case 0xcb: {
+    double d;
+    if( msgpack_read_uint( r, 8, &n ) != 0 ) return -1;
+    memcpy( &d, &n, 8 );
+    *ret = mrbc_float_value( r->vm, d );
+    return 0;
+  }
+#endif
+
+  // str 8/16/32 and bin 8/16/32
+  case 0xd9: case 0xda: case 0xdb:
+  case 0xc4: case 0xc5: case 0xc6: {
+    int bytes = 1 << ((type >= 0xd9) ? type - 0xd9 : type - 0xc4);
+    if( msgpack_read_uint( r, bytes, &n ) != 0 ) return -1;
+    goto STRING;
+  }
+
+  case 0xdc: case 0xdd:
+    if( msgpack_read_uint( r, (type == 0xdc) ? 2 : 4, &n ) != 0 ) return -1;
+    goto ARRAY;
+
+  case 0xde: case 0xdf:
+    if( msgpack_read_uint( r, (type == 0xde) ? 2 : 4, &n ) != 0 ) return -1;
+    goto MAP;
+
+  default:
+    return -4;
+  }
+
+
+ STRING:
+  if( (uint64_t)(r->end - r->p) < n ) return -1;
+  *ret = mrbc_string_new( r->vm, r->p, n );
+  if( !ret->string ) return -2;
+  r->p += n;
+  return 0;
+
+
+ ARRAY:
+  // each element takes 1 byte at least, so the size is checked first.
+  if( (uint64_t)(r->end - r->p) < n ) return -1;
+  if( n > UINT16_MAX ) return -2;
+  if( ++r->depth > MSGPACK_MAX_NESTING ) return -3;
+
+  *ret = mrbc_array_new( r->vm, n );
+  if( !ret->array ) return -2;
+  for( uint32_t i = 0; i < n; i++ ) {
+    if( (err = msgpack_unpack( r, &ret->array->data[i] )) != 0 ) goto ERROR_CONTAINER;
+    ret->array->n_stored++;
+  }
+  r->depth--;
+  return 0;
+
+
+ MAP:
+  if( (uint64_t)(r->end - r->p) < n * 2 ) return -1;
+  if( n > UINT16_MAX / 2 ) return -2;
+  if( ++r->depth > MSGPACK_MAX_NESTING ) return -3;
+
+  *ret = mrbc_hash_new( r->vm, n );
+  if( !ret->hash ) return -2;
+  for( uint32_t i = 0; i < n; i++ ) {
+    mrbc_value key, val;
+    if( (err = msgpack_unpack( r, &key )) != 0 ) goto ERROR_CONTAINER;
+    if( (err = msgpack_unpack( r, &val )) != 0 ) {
+      mrbc_decref( &key );
+      goto ERROR_CONTAINER;
+    }
+    if( mrbc_hash_set( ret, &key, &val ) != 0 ) {
+      mrbc_decref( &key );
+      mrbc_decref( &val );
+      err = -2;
+      goto ERROR_CONTAINER;
+    }
+  }
+  r->depth--;
+  return 0;
+
+
+ ERROR_CONTAINER:
+  mrbc_decref( ret );
+  return err;
+}
+
+
+//================================================================
+/*! (method) pack
+
+  MessagePack.pack( obj ) -> String
+*/
+static void c_msgpack_pack(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  MSGPACK_WRITER w = { .vm = vm, .size = 32 };
+  w.buf = mrbc_alloc( vm, w.size );
+  if( !w.buf ) return;		// ENOMEM
+
+  int ret = msgpack_pack( &w, &v[1], 0 );
+  if( ret == 0 ) ret = msgpack_reserve( &w, 1 );	// for '\0'.
+
+  switch( ret ) {
+  case 0: {
+    mrbc_realloc( vm, w.buf, w.len+1 );	// shrink suitable size.
+    w.buf[w.len] = '\0';
+    mrbc_value str = mrbc_string_new_alloc( vm, w.buf, w.len );
+    SET_RETURN( str );
+    return;
+  }
+  case -1: mrbc_raise(vm, MRBC_CLASS(NoMemoryError), 0);			break;
+  case -2: mrbc_raise(vm, MRBC_CLASS(TypeError), "can't pack the object");	break;
+  case -3: mrbc_raise(vm, MRBC_CLASS(ArgumentError), "nesting too deep");	break;
+  }
+  mrbc_free( vm, w.buf );
+}
+
+
+//================================================================
+/*! (method) unpack
+
+  MessagePack.unpack( str ) -> Object
+*/
+static void c_msgpack_unpack(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || v[1].tt != MRBC_TT_STRING ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  const uint8_t *p = (const uint8_t *)mrbc_string_cstr(&v[1]);
+  MSGPACK_READER r = {
+    .vm = vm,
+    .p = p,
+    .end = p + mrbc_string_size(&v[1]),
+  };
+  mrbc_value ret;
+  int err = msgpack_unpack( &r, &ret );
+  if( err == 0 && r.p != r.end ) {
+    mrbc_decref( &ret );
+    err = -1;
+  }
+
+  switch( err ) {
+  case 0:  SET_RETURN( ret );						break;
+  case -2: mrbc_raise(vm, MRBC_CLASS(NoMemoryError), 0);		break;
+  case -3: mrbc_raise(vm, MRBC_CLASS(ArgumentError), "nesting too deep");	break;
+  case -4: mrbc_raise(vm, MRBC_CLASS(TypeError), "not supported type");	break;
+  default: mrbc_raise(vm, MRBC_CLASS(ArgumentError), "broken data");	break;
+  }
+}
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_msgpack(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "MessagePack", 0);
+
+  mrbc_define_method(0, cls, "pack", c_msgpack_pack);
+  mrbc_define_method(0, cls, "unpack", c_msgpack_unpack);
+}
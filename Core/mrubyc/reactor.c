@@ -0,0 +1,360 @@
+/*! @file
+  @brief
+  Reactor class, waits for any of the event sources.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The task waits for all the sources at once in the scheduler, and is
+  woken up by the interrupt handler of the source that became ready.
+  So one task serves many sources without polling them.
+
+    r = Reactor.new
+    r.add( uart1 )		# when received some bytes.
+    r.add( uart2, :line )	# when received a line.
+    r.add( button )		# GPIO, when an edge is queued.
+    r.add( queue )		# Queue, when not empty.
+
+    while true
+      r.wait( 1000 ).each {|src|	# -> Array of the ready sources,
+        case src			#    or [] if timed out.
+        when uart1  then s = uart1.read( uart1.bytes_available )
+        when uart2  then s = uart2.gets
+        when button then edge, tick = button.wait_edge
+        when queue  then item = queue.pop
+        end
+      }
+    end
+  </pre>
+
+  (note) The sources are not consumed by wait, so read them until they
+  are not ready. A source can be waited by only one task at a time.
+*/
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_uart.h"
+#include "stm32f4_gpio.h"
+#include "spsc_queue.h"
+
+
+//! kind of the source.
+enum {
+  REACTOR_UART = 1,	//!< UART, some bytes received.
+  REACTOR_UART_LINE,	//!< UART, a line received.
+  REACTOR_GPIO,		//!< GPIO, an edge queued.
+  REACTOR_QUEUE,	//!< Queue, not empty.
+};
+
+#define REACTOR_MAX_SOURCES 32	//!< by the bitmap of the ready sources.
+
+/*!@brief
+  reactor, stored in the instance data area.
+
+  Followed by kind[capacity]. The source objects are kept in the
+  instance variable in the same order, so they are released with it.
+*/
+typedef struct REACTOR {
+  uint8_t capacity;		//!< max number of the sources.
+  uint8_t n_sources;		//!< number of the sources.
+  uint8_t flag_waiting;		//!< waited, and this is called again.
+  uint32_t deadline;		//!< HAL_GetTick() at the timeout.
+  const void *io[];		//!< I/O objects for the scheduler.
+} REACTOR;
+
+static mrbc_class *cls_uart;
+static mrbc_class *cls_gpio;
+static mrbc_sym sym_sources;
+static mrbc_sym sym_line;
+
+
+//================================================================
+/*! kind of the sources, after io[].
+*/
+static inline uint8_t * reactor_kind( REACTOR *r )
+{
+  return (uint8_t *)&r->io[r->capacity];
+}
+
+
+//================================================================
+/*! check the source, and set it to wake up the task.
+
+  @param  r		pointer to REACTOR.
+  @param  i		index of the source.
+  @param  flag_wait	to wait, if not ready.
+  @return		non-zero if ready.
+  @note  Call this with interrupts disabled.
+*/
+static int reactor_poll( REACTOR *r, int i, int flag_wait )
+{
+  void *io = (void *)r->io[i];
+
+  switch( reactor_kind(r)[i] ) {
+  case REACTOR_UART:
+    return uart_bytes_available( (UART_HANDLE *)io ) > 0;	// always woken.
+
+  case REACTOR_UART_LINE:
+    return uart_can_read_line( (UART_HANDLE *)io ) > 0;
+
+  case REACTOR_GPIO:
+    return gpio_edge_poll( io, flag_wait );
+
+  case REACTOR_QUEUE: {
+    SPSC_QUEUE *q = (SPSC_QUEUE *)io;
+    int ready = (q->tail != q->head);
+    if( !ready && flag_wait ) {
+      q->waiting |= SPSC_QUEUE_WAIT_POP;
+    } else {
+      q->waiting &= ~SPSC_QUEUE_WAIT_POP;
+    }
+    return ready;
+  }
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! (method) new
+
+  Reactor.new( capacity = 8 )
+*/
+static void c_reactor_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int capacity = 8;
+  if( argc > 1 ) goto ERROR_RETURN;
+  if( argc == 1 ) {
+    if( v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    capacity = mrbc_integer(v[1]);
+    if( capacity < 1 || capacity > REACTOR_MAX_SOURCES ) goto ERROR_RETURN;
+  }
+
+  mrbc_value ary = mrbc_array_new(vm, capacity);
+  if( ary.array == NULL ) return;	// ENOMEM
+
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls,
+			sizeof(REACTOR) + (sizeof(void *) + 1) * capacity);
+  if( ret.instance == NULL ) {		// ENOMEM
+    mrbc_decref( &ary );
+    return;
+  }
+
+  REACTOR *r = (REACTOR *)ret.instance->data;
+  r->capacity = capacity;
+  r->n_sources = 0;
+  r->flag_waiting = 0;
+  r->deadline = 0;
+
+  mrbc_instance_setiv( &ret, sym_sources, &ary );
+  mrbc_decref( &ary );
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) add
+
+  r.add( uart )			# UART, some bytes received.
+  r.add( uart, :line )		# UART, a line received.
+  r.add( gpio )			# GPIO, an edge queued.
+  r.add( queue )		# Queue, not empty.
+*/
+static void c_reactor_add(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  REACTOR *r = (REACTOR *)v[0].instance->data;
+  const void *io = NULL;
+  uint8_t kind = 0;
+
+  if( argc < 1 || argc > 2 ) goto ERROR_RETURN;
+  if( argc == 2 && v[2].tt != MRBC_TT_NIL &&
+      (v[2].tt != MRBC_TT_SYMBOL || mrbc_symbol(v[2]) != sym_line) ) goto ERROR_RETURN;
+
+  if( v[1].tt == MRBC_TT_OBJECT ) {
+    mrbc_class *cls = v[1].instance->cls;
+    if( cls == cls_uart ) {
+      io = *(UART_HANDLE **)(v[1].instance->data);
+      kind = (argc == 2 && v[2].tt == MRBC_TT_SYMBOL) ? REACTOR_UART_LINE : REACTOR_UART;
+    } else if( cls == cls_gpio ) {
+      io = gpio_edge_line( (PIN_HANDLE *)v[1].instance->data );
+      if( !io ) {
+	mrbc_raise(vm, MRBC_CLASS(ArgumentError), "GPIO Can't setup irq");
+	return;
+      }
+      kind = REACTOR_GPIO;
+    } else if( (io = spsc_queue_get( &v[1] )) != NULL ) {
+      kind = REACTOR_QUEUE;
+    }
+  }
+  if( !kind ) goto ERROR_RETURN;
+
+  if( r->n_sources >= r->capacity ) {
+    mrbc_raise(vm, MRBC_CLASS(IndexError), "too many sources");
+    return;
+  }
+
+  mrbc_value ary = mrbc_instance_getiv( &v[0], sym_sources );
+  if( mrbc_array_push( &ary, &v[1] ) != 0 ) {	// ENOMEM
+    mrbc_decref( &ary );
+    return;
+  }
+  mrbc_incref( &v[1] );
+  mrbc_decref( &ary );
+
+  hal_disable_irq();
+  r->io[r->n_sources] = io;
+  reactor_kind(r)[r->n_sources] = kind;
+  r->n_sources++;
+  hal_enable_irq();
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) remove
+
+  r.remove( src ) -> true, or false if not added.
+*/
+static void c_reactor_remove(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  REACTOR *r = (REACTOR *)v[0].instance->data;
+
+  if( argc != 1 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  mrbc_value ary = mrbc_instance_getiv( &v[0], sym_sources );
+  int i;
+  for( i = 0; i < r->n_sources; i++ ) {
+    mrbc_value src = mrbc_array_get( &ary, i );
+    if( mrbc_compare( &src, &v[1] ) == 0 ) break;
+  }
+  if( i == r->n_sources ) {
+    mrbc_decref( &ary );
+    SET_FALSE_RETURN();
+    return;
+  }
+
+  hal_disable_irq();
+  reactor_poll( r, i, 0 );		// not to be woken up by this.
+  uint8_t *kind = reactor_kind(r);
+  for( int j = i+1; j < r->n_sources; j++ ) {
+    r->io[j-1] = r->io[j];
+    kind[j-1] = kind[j];
+  }
+  r->n_sources--;
+  hal_enable_irq();
+
+  mrbc_value src = mrbc_array_remove( &ary, i );
+  mrbc_decref( &src );
+  mrbc_decref( &ary );
+
+  SET_TRUE_RETURN();
+}
+
+
+//================================================================
+/*! (method) wait
+
+  r.wait( timeout = nil ) -> Array of the ready sources.
+
+  @param  timeout	timeout in milliseconds, or nil to wait forever.
+  @return		[] if timed out.
+*/
+static void c_reactor_wait(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  REACTOR *r = (REACTOR *)v[0].instance->data;
+  int timeout = -1;
+
+  if( argc > 1 ) goto ERROR_RETURN;
+  if( argc == 1 && v[1].tt != MRBC_TT_NIL ) {
+    if( v[1].tt != MRBC_TT_INTEGER || mrbc_integer(v[1]) < 0 ) goto ERROR_RETURN;
+    timeout = mrbc_integer(v[1]);
+  }
+
+  hal_disable_irq();
+  uint32_t ready = 0;
+  for( int i = 0; i < r->n_sources; i++ ) {
+    if( reactor_poll( r, i, 0 ) ) ready |= 1UL << i;
+  }
+
+  // wait for any of them, again if woken up by the other event.
+  if( !ready && timeout != 0 && (r->n_sources != 0 || timeout > 0) ) {
+    if( !r->flag_waiting ) r->deadline = HAL_GetTick() + timeout;
+    int remain = (timeout < 0) ? -1 : (int32_t)(r->deadline - HAL_GetTick());
+    if( timeout < 0 || remain > 0 ) {
+      for( int i = 0; i < r->n_sources; i++ ) {
+	reactor_poll( r, i, 1 );
+      }
+      r->flag_waiting = 1;
+      mrbc_wait_io_set( VM2TCB(vm), r->io, r->n_sources, remain );
+      vm->flag_retry_call = 1;
+      hal_enable_irq();
+      return;
+    }
+  }
+  r->flag_waiting = 0;
+  hal_enable_irq();
+
+  mrbc_value ret = mrbc_array_new(vm, __builtin_popcount(ready));
+  if( ret.array == NULL ) return;	// ENOMEM
+
+  mrbc_value ary = mrbc_instance_getiv( &v[0], sym_sources );
+  for( int i = 0; ready != 0; i++, ready >>= 1 ) {
+    if( !(ready & 1) ) continue;
+    mrbc_value src = mrbc_array_get( &ary, i );
+    mrbc_incref( &src );
+    mrbc_array_push( &ret, &src );
+  }
+  mrbc_decref( &ary );
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) size
+
+  r.size -> Integer	# number of the sources.
+*/
+static void c_reactor_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  REACTOR *r = (REACTOR *)v[0].instance->data;
+
+  SET_INT_RETURN( r->n_sources );
+}
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_reactor(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Reactor", 0);
+  cls_uart = mrbc_get_class_by_name("UART");
+  cls_gpio = mrbc_get_class_by_name("GPIO");
+  sym_sources = mrbc_str_to_symid("sources");
+  sym_line = mrbc_str_to_symid("line");
+
+  mrbc_define_method(0, cls, "new", c_reactor_new);
+  mrbc_define_method(0, cls, "add", c_reactor_add);
+  mrbc_define_method(0, cls, "remove", c_reactor_remove);
+  mrbc_define_method(0, cls, "wait", c_reactor_wait);
+  mrbc_define_method(0, cls, "size", c_reactor_size);
+}
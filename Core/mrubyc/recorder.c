@@ -0,0 +1,403 @@
+/*! @file
+  @brief
+  Recorder class. Double buffered data logger.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The producers append the records to one buffer in RAM, and a writer
+  task takes the other full buffer and writes it to UART, File or
+  flash. So the sampling task never waits for the slow write.
+  A record is never split between the buffers.
+
+    rec = Recorder.new( 1024 )		# 2 buffers of 1024 bytes.
+    rec = Recorder.new( 1024, Recorder::BLOCK )
+
+    rec << "12.3,45.6\n"		# producer. -> true, or false if dropped.
+
+    while s = rec.take( 1000 )		# writer task. the full buffer,
+      f.write( s )			#  or the partial one after 1 second.
+    end
+
+  When both buffers are full, by the policy,
+    DROP_OLDEST  the buffer not written yet is discarded. (default)
+    DROP_NEWEST  the new record is discarded.
+    BLOCK        the producer task waits for the writer.
+  The records from recorder_write() in C, such as in an interrupt
+  handler, never wait.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "recorder.h"
+
+
+static mrbc_class *cls_recorder;
+
+
+//================================================================
+/*! get the recorder from the object.
+
+  @param  v	pointer to value.
+  @return	pointer to RECORDER, or NULL if not a Recorder.
+*/
+RECORDER *recorder_get( const mrbc_value *v )
+{
+  if( v->tt != MRBC_TT_OBJECT ) return NULL;
+  if( v->instance->cls != cls_recorder ) return NULL;
+
+  return (RECORDER *)v->instance->data;
+}
+
+
+//================================================================
+/*! append the record.
+
+  @param  rec	pointer to RECORDER.
+  @param  data	record.
+  @param  len	length of the record.
+  @param  flag_block can wait. (BLOCK policy)
+  @retval 0	no error.
+  @retval 1	to wait for the writer.
+  @retval -1	dropped.
+*/
+static int recorder_append( RECORDER *rec, const void *data, int len, int flag_block )
+{
+  if( len > rec->size ) {
+    rec->n_dropped++;
+    return -1;
+  }
+
+  hal_disable_irq();
+  int a = rec->active;
+
+  if( rec->len[a] + len > rec->size ) {
+    if( rec->ready ) {
+      // both buffers are full.
+      if( !(rec->waiting & RECORDER_WAIT_WRITE) ) rec->n_overrun++;
+
+      if( rec->policy == RECORDER_BLOCK && flag_block ) {
+	hal_enable_irq();
+	return 1;
+      }
+      if( rec->policy != RECORDER_DROP_OLDEST || rec->taking ) {
+	rec->n_dropped++;
+	hal_enable_irq();
+	return -1;
+      }
+      rec->n_dropped += rec->n_rec[ rec->ready - 1 ];
+      rec->ready = 0;
+    }
+
+    // swap the buffers.
+    rec->ready = a + 1;
+    a ^= 1;
+    rec->active = a;
+    rec->len[a] = 0;
+    rec->n_rec[a] = 0;
+    if( rec->waiting & RECORDER_WAIT_TAKE ) mrbc_wakeup_io( rec );
+  }
+
+  memcpy( rec->data + a * rec->size + rec->len[a], data, len );
+  rec->len[a] += len;
+  rec->n_rec[a]++;
+  hal_enable_irq();
+
+  return 0;
+}
+
+
+//================================================================
+/*! append the record, from C.
+
+  @param  rec	pointer to RECORDER.
+  @param  data	record.
+  @param  len	length of the record.
+  @return	0 if no error, or -1 if dropped.
+  @note
+    This can be called from interrupt handler. It never waits, so the
+    record is dropped by BLOCK policy too.
+*/
+int recorder_write( RECORDER *rec, const void *data, int len )
+{
+  return recorder_append( rec, data, len, 0 );
+}
+
+
+//================================================================
+/*! make the partial buffer ready to write.
+
+  @return	non zero if there is a ready buffer.
+  @note	call with the interrupt disabled.
+*/
+static int recorder_swap_partial( RECORDER *rec )
+{
+  if( rec->ready ) return 1;
+
+  int a = rec->active;
+  if( rec->len[a] == 0 ) return 0;
+
+  rec->ready = a + 1;
+  a ^= 1;
+  rec->active = a;
+  rec->len[a] = 0;
+  rec->n_rec[a] = 0;
+  return 1;
+}
+
+
+//================================================================
+/*! wait in other task running.
+
+  @return	0 if ready, 1 to wait (called again), or -1 if timed out.
+*/
+static int recorder_wait( mrbc_vm *vm, RECORDER *rec, int flag, int timeout )
+{
+  mrbc_tcb *tcb = VM2TCB(vm);
+
+  if( (rec->waiting & flag) || timeout == 0 ) {
+    rec->waiting &= ~flag;		// timed out.
+    return -1;
+  }
+
+  rec->waiting |= flag;
+  if( timeout < 0 ) {
+    mrbc_wait_io( tcb, rec );
+  } else {
+    mrbc_wait_io_timeout( tcb, rec, timeout );
+  }
+  vm->flag_retry_call = 1;
+
+  return 1;
+}
+
+
+//================================================================
+/*! get timeout argument.
+
+  @return	timeout in milliseconds, -1 if nil, or -2 if error.
+*/
+static int recorder_get_timeout( mrbc_value v[], int argc, int idx )
+{
+  if( argc < idx || v[idx].tt == MRBC_TT_NIL ) return -1;
+  if( v[idx].tt != MRBC_TT_INTEGER || mrbc_integer(v[idx]) < 0 ) return -2;
+
+  return mrbc_integer(v[idx]);
+}
+
+
+//================================================================
+/*! (method) new
+
+  Recorder.new( size, policy = Recorder::DROP_OLDEST )
+
+  @param  size		bytes per buffer.
+  @param  policy	when both buffers are full.
+*/
+static void c_recorder_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc < 1 || argc > 2 || v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+  int size = mrbc_integer(v[1]);
+  int policy = RECORDER_DROP_OLDEST;
+  if( argc == 2 ) {
+    if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    policy = mrbc_integer(v[2]);
+  }
+  if( size < 1 || size > UINT16_MAX ) goto ERROR_RETURN;
+  if( policy < RECORDER_DROP_OLDEST || policy > RECORDER_BLOCK ) goto ERROR_RETURN;
+
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls, sizeof(RECORDER) + 2 * size);
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  RECORDER *rec = (RECORDER *)ret.instance->data;
+  memset( rec, 0, sizeof(RECORDER) );
+  rec->size = size;
+  rec->policy = policy;
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) write, <<
+
+  rec << "record"	# -> true, or false if dropped.
+*/
+static void c_recorder_write(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  RECORDER *rec = (RECORDER *)v[0].instance->data;
+
+  if( argc != 1 || v[1].tt != MRBC_TT_STRING ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  int ret = recorder_append( rec, mrbc_string_cstr(&v[1]),
+			     mrbc_string_size(&v[1]), 1 );
+  if( ret == 1 ) {
+    hal_disable_irq();
+    if( rec->ready ) {
+      rec->waiting |= RECORDER_WAIT_WRITE;
+      mrbc_wait_io( VM2TCB(vm), rec );
+      vm->flag_retry_call = 1;
+      hal_enable_irq();
+      return;
+    }
+    hal_enable_irq();
+    ret = recorder_append( rec, mrbc_string_cstr(&v[1]),
+			   mrbc_string_size(&v[1]), 1 );
+  }
+  rec->waiting &= ~RECORDER_WAIT_WRITE;
+
+  SET_BOOL_RETURN( ret == 0 );
+}
+
+
+//================================================================
+/*! (method) take
+
+  rec.take( timeout = nil )	# -> String, or nil if timed out.
+
+  @param  timeout	in milliseconds, or nil to wait forever.
+			At the timeout, the partial buffer is taken.
+*/
+static void c_recorder_take(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  RECORDER *rec = (RECORDER *)v[0].instance->data;
+  int timeout = recorder_get_timeout( v, argc, 1 );
+
+  if( argc > 1 || timeout == -2 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  hal_disable_irq();
+  if( !rec->ready ) {
+    int sts = recorder_wait( vm, rec, RECORDER_WAIT_TAKE, timeout );
+    if( sts == 1 ) {
+      hal_enable_irq();
+      return;
+    }
+    if( !recorder_swap_partial( rec ) ) {
+      hal_enable_irq();
+      SET_NIL_RETURN();		// timed out, and empty.
+      return;
+    }
+  }
+  rec->waiting &= ~RECORDER_WAIT_TAKE;
+  rec->taking = 1;
+  int idx = rec->ready - 1;
+  hal_enable_irq();
+
+  // copy out, and the buffer becomes free.
+  mrbc_value ret = mrbc_string_new(vm, rec->data + idx * rec->size, rec->len[idx]);
+
+  hal_disable_irq();
+  if( ret.string ) rec->ready = 0;	// or keep it at ENOMEM.
+  rec->taking = 0;
+  if( rec->waiting & RECORDER_WAIT_WRITE ) mrbc_wakeup_io( rec );
+  hal_enable_irq();
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! (method) flush
+
+  rec.flush	# -> true if the partial buffer is made ready to take.
+*/
+static void c_recorder_flush(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  RECORDER *rec = (RECORDER *)v[0].instance->data;
+
+  hal_disable_irq();
+  int flag_ready = !rec->ready && recorder_swap_partial( rec );
+  if( flag_ready && (rec->waiting & RECORDER_WAIT_TAKE) ) mrbc_wakeup_io( rec );
+  hal_enable_irq();
+
+  SET_BOOL_RETURN( flag_ready );
+}
+
+
+//================================================================
+/*! (method) size
+
+  rec.size	# -> bytes not taken yet.
+*/
+static void c_recorder_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  RECORDER *rec = (RECORDER *)v[0].instance->data;
+
+  hal_disable_irq();
+  int n = rec->len[ rec->active ];
+  if( rec->ready ) n += rec->len[ rec->ready - 1 ];
+  hal_enable_irq();
+
+  SET_INT_RETURN( n );
+}
+
+
+//================================================================
+/*! (method) dropped, overruns
+*/
+static void c_recorder_dropped(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  RECORDER *rec = (RECORDER *)v[0].instance->data;
+
+  SET_INT_RETURN( rec->n_dropped );
+}
+
+static void c_recorder_overruns(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  RECORDER *rec = (RECORDER *)v[0].instance->data;
+
+  SET_INT_RETURN( rec->n_overrun );
+}
+
+
+//================================================================
+/*! (method) clear_count
+*/
+static void c_recorder_clear_count(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  RECORDER *rec = (RECORDER *)v[0].instance->data;
+
+  rec->n_dropped = 0;
+  rec->n_overrun = 0;
+}
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_recorder(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Recorder", 0);
+  cls_recorder = cls;
+
+  mrbc_define_method(0, cls, "new", c_recorder_new);
+  mrbc_define_method(0, cls, "write", c_recorder_write);
+  mrbc_define_method(0, cls, "<<", c_recorder_write);
+  mrbc_define_method(0, cls, "take", c_recorder_take);
+  mrbc_define_method(0, cls, "flush", c_recorder_flush);
+  mrbc_define_method(0, cls, "size", c_recorder_size);
+  mrbc_define_method(0, cls, "dropped", c_recorder_dropped);
+  mrbc_define_method(0, cls, "overruns", c_recorder_overruns);
+  mrbc_define_method(0, cls, "clear_count", c_recorder_clear_count);
+
+  mrbc_set_class_const(cls, mrbc_str_to_symid("DROP_OLDEST"), &mrbc_integer_value(RECORDER_DROP_OLDEST));
+  mrbc_set_class_const(cls, mrbc_str_to_symid("DROP_NEWEST"), &mrbc_integer_value(RECORDER_DROP_NEWEST));
+  mrbc_set_class_const(cls, mrbc_str_to_symid("BLOCK"), &mrbc_integer_value(RECORDER_BLOCK));
+}
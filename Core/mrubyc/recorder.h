@@ -0,0 +1,64 @@
+/*! @file
+  @brief
+  Recorder class header.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#include "../mrubyc_src/mrubyc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! policy when both buffers are full.
+#define RECORDER_DROP_OLDEST	0	//!< discard the buffer not written yet.
+#define RECORDER_DROP_NEWEST	1	//!< discard the new record.
+#define RECORDER_BLOCK		2	//!< the producer waits. (task only)
+
+
+/*!@brief
+  double buffered recorder, stored in the instance data area.
+*/
+typedef struct RECORDER {
+  uint16_t size;		//!< bytes per buffer.
+  uint8_t policy;		//!< RECORDER_*
+  volatile uint8_t active;	//!< index of the buffer appended.
+  volatile uint8_t ready;	//!< index + 1 of the buffer to write, or 0.
+  volatile uint8_t taking;	//!< the consumer is copying the ready buffer.
+  volatile uint8_t waiting;	//!< RECORDER_WAIT_* of the waiting task.
+  volatile uint16_t len[2];	//!< bytes in each buffer.
+  volatile uint16_t n_rec[2];	//!< records in each buffer.
+  uint32_t n_dropped;		//!< count of the dropped records.
+  uint32_t n_overrun;		//!< count of the both buffers were full.
+  uint8_t data[];		//!< 2 * size bytes.
+} RECORDER;
+
+#define RECORDER_WAIT_TAKE	0x01
+#define RECORDER_WAIT_WRITE	0x02
+
+
+/*
+  function prototypes.
+*/
+RECORDER *recorder_get( const mrbc_value *v );
+int recorder_write( RECORDER *rec, const void *data, int len );
+void mrbc_init_class_recorder( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,349 @@
+/*! @file
+  @brief
+  SD card block driver on SPI3.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  SDv1, SDv2 (SDHC/SDXC) and MMC in SPI mode. The data blocks are
+  transferred by DMA, and the multi block commands (CMD18, CMD25) are
+  used for the consecutive blocks.
+  The caller acquires the bus by spi_bus_acquire(), at 400kHz for
+  sd_init(), and up to 21MHz for the others.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "sdcard.h"
+
+extern SPI_HandleTypeDef hspi3;
+
+//! command index. ACMDn are with 0x80.
+#define CMD0	0		// GO_IDLE_STATE
+#define CMD1	1		// SEND_OP_COND (MMC)
+#define CMD8	8		// SEND_IF_COND
+#define CMD12	12		// STOP_TRANSMISSION
+#define CMD16	16		// SET_BLOCKLEN
+#define CMD17	17		// READ_SINGLE_BLOCK
+#define CMD18	18		// READ_MULTIPLE_BLOCK
+#define CMD24	24		// WRITE_BLOCK
+#define CMD25	25		// WRITE_MULTIPLE_BLOCK
+#define CMD55	55		// APP_CMD
+#define CMD58	58		// READ_OCR
+#define ACMD41	(0x80 + 41)	// SD_SEND_OP_COND
+
+static const uint32_t SD_TIMEOUT_ms = 500;
+
+static GPIO_TypeDef *cs_port_;
+static uint16_t cs_pin_;
+static uint8_t flag_block_addr_;	//!< SDHC/SDXC, addressed in blocks.
+
+
+//================================================================
+/*! exchange a byte.
+*/
+static uint8_t sd_xchg( uint8_t data )
+{
+  uint8_t ret = 0xff;
+
+  HAL_SPI_TransmitReceive( &hspi3, &data, &ret, 1, SD_TIMEOUT_ms );
+  return ret;
+}
+
+
+//================================================================
+/*! wait for the DMA transfer.
+
+  @return	0 if no error.
+*/
+static int sd_dma_wait( void )
+{
+  uint32_t t0 = HAL_GetTick();
+
+  while( HAL_SPI_GetState( &hspi3 ) != HAL_SPI_STATE_READY ) {
+    if( HAL_GetTick() - t0 > SD_TIMEOUT_ms ) {
+      HAL_SPI_Abort( &hspi3 );
+      return -1;
+    }
+    __WFI();
+  }
+
+  return hspi3.ErrorCode == HAL_SPI_ERROR_NONE ? 0 : -1;
+}
+
+
+//================================================================
+/*! receive a block.
+*/
+static int sd_receive( uint8_t *buf, int len )
+{
+  memset( buf, 0xff, len );
+
+  if( !hspi3.hdmarx ) {
+    return HAL_SPI_TransmitReceive( &hspi3, buf, buf, len, SD_TIMEOUT_ms ) == HAL_OK ? 0 : -1;
+  }
+  if( HAL_SPI_TransmitReceive_DMA( &hspi3, buf, buf, len ) != HAL_OK ) return -1;
+
+  return sd_dma_wait();
+}
+
+
+//================================================================
+/*! send a block.
+*/
+static int sd_send( const uint8_t *buf, int len )
+{
+  if( !hspi3.hdmatx ) {
+    return HAL_SPI_Transmit( &hspi3, (uint8_t *)buf, len, SD_TIMEOUT_ms ) == HAL_OK ? 0 : -1;
+  }
+  if( HAL_SPI_Transmit_DMA( &hspi3, (uint8_t *)buf, len ) != HAL_OK ) return -1;
+
+  return sd_dma_wait();
+}
+
+
+//================================================================
+/*! wait for the card ready. (not busy)
+
+  @return	0 if ready.
+*/
+static int sd_wait_ready( void )
+{
+  uint32_t t0 = HAL_GetTick();
+
+  do {
+    if( sd_xchg( 0xff ) == 0xff ) return 0;
+  } while( HAL_GetTick() - t0 < SD_TIMEOUT_ms );
+
+  return -1;
+}
+
+
+//================================================================
+/*! deselect the card.
+*/
+static void sd_deselect( void )
+{
+  HAL_GPIO_WritePin( cs_port_, cs_pin_, GPIO_PIN_SET );
+  sd_xchg( 0xff );		// release DO.
+}
+
+
+//================================================================
+/*! select the card, and wait for ready.
+
+  @return	0 if no error.
+*/
+static int sd_select( void )
+{
+  HAL_GPIO_WritePin( cs_port_, cs_pin_, GPIO_PIN_RESET );
+  sd_xchg( 0xff );
+
+  if( sd_wait_ready() == 0 ) return 0;
+
+  sd_deselect();
+  return -1;
+}
+
+
+//================================================================
+/*! send a command.
+
+  @param  cmd	command index.
+  @param  arg	argument.
+  @return	R1 response, or 0xff if timed out.
+*/
+static uint8_t sd_send_cmd( uint8_t cmd, uint32_t arg )
+{
+  uint8_t r1;
+
+  if( cmd & 0x80 ) {		// ACMD is CMD55 + CMD.
+    cmd &= 0x7f;
+    r1 = sd_send_cmd( CMD55, 0 );
+    if( r1 > 1 ) return r1;
+  }
+
+  if( cmd != CMD12 ) {
+    sd_deselect();
+    if( sd_select() != 0 ) return 0xff;
+  }
+
+  uint8_t buf[6] = { 0x40 | cmd, arg >> 24, arg >> 16, arg >> 8, arg,
+		     cmd == CMD0 ? 0x95 : cmd == CMD8 ? 0x87 : 0x01 };
+  HAL_SPI_Transmit( &hspi3, buf, sizeof(buf), SD_TIMEOUT_ms );
+  if( cmd == CMD12 ) sd_xchg( 0xff );	// skip a stuff byte.
+
+  int n = 10;
+  do {
+    r1 = sd_xchg( 0xff );
+  } while( (r1 & 0x80) && --n );
+
+  return r1;
+}
+
+
+//================================================================
+/*! receive a data block.
+
+  @return	0 if no error.
+*/
+static int sd_receive_block( uint8_t *buf )
+{
+  uint32_t t0 = HAL_GetTick();
+  uint8_t token;
+
+  do {
+    token = sd_xchg( 0xff );
+  } while( token == 0xff && HAL_GetTick() - t0 < SD_TIMEOUT_ms );
+  if( token != 0xfe ) return -1;
+
+  if( sd_receive( buf, SD_BLOCK_SIZE ) != 0 ) return -1;
+  sd_xchg( 0xff );		// discard CRC.
+  sd_xchg( 0xff );
+
+  return 0;
+}
+
+
+//================================================================
+/*! send a data block.
+
+  @param  buf	data, or NULL with the stop token.
+  @param  token	0xfe (single), 0xfc (multi) or 0xfd (stop).
+  @return	0 if no error.
+*/
+static int sd_send_block( const uint8_t *buf, uint8_t token )
+{
+  if( sd_wait_ready() != 0 ) return -1;
+
+  sd_xchg( token );
+  if( token == 0xfd ) return 0;
+
+  if( sd_send( buf, SD_BLOCK_SIZE ) != 0 ) return -1;
+  sd_xchg( 0xff );		// dummy CRC.
+  sd_xchg( 0xff );
+
+  // data response: xxx0 0101 is accepted.
+  return (sd_xchg( 0xff ) & 0x1f) == 0x05 ? 0 : -1;
+}
+
+
+//================================================================
+/*! initialize the card.
+
+  @param  cs_port	chip select port.
+  @param  cs_pin	chip select pin. (GPIO_PIN_x)
+  @return		0 if no error.
+  @note			The pin must be set to the output, and the bus
+			clock must be 100-400kHz.
+*/
+int sd_init( GPIO_TypeDef *cs_port, uint16_t cs_pin )
+{
+  uint8_t ocr[4];
+  int ok = 0;
+
+  cs_port_ = cs_port;
+  cs_pin_ = cs_pin;
+  flag_block_addr_ = 0;
+
+  // 80 dummy clocks with CS high.
+  HAL_GPIO_WritePin( cs_port_, cs_pin_, GPIO_PIN_SET );
+  for( int i = 0; i < 10; i++ ) sd_xchg( 0xff );
+
+  if( sd_send_cmd( CMD0, 0 ) != 1 ) goto RETURN;
+
+  uint32_t t0 = HAL_GetTick();
+  if( sd_send_cmd( CMD8, 0x1aa ) == 1 ) {
+    // SDv2
+    for( int i = 0; i < 4; i++ ) ocr[i] = sd_xchg( 0xff );
+    if( ocr[2] != 0x01 || ocr[3] != 0xaa ) goto RETURN;
+
+    while( sd_send_cmd( ACMD41, 1UL << 30 ) != 0 ) {
+      if( HAL_GetTick() - t0 > 1000 ) goto RETURN;
+    }
+    if( sd_send_cmd( CMD58, 0 ) != 0 ) goto RETURN;
+    for( int i = 0; i < 4; i++ ) ocr[i] = sd_xchg( 0xff );
+    flag_block_addr_ = (ocr[0] & 0x40) != 0;	// CCS
+
+  } else {
+    // SDv1 or MMC
+    uint8_t cmd = (sd_send_cmd( ACMD41, 0 ) <= 1) ? ACMD41 : CMD1;
+    while( sd_send_cmd( cmd, 0 ) != 0 ) {
+      if( HAL_GetTick() - t0 > 1000 ) goto RETURN;
+    }
+    if( sd_send_cmd( CMD16, SD_BLOCK_SIZE ) != 0 ) goto RETURN;
+  }
+  ok = 1;
+
+ RETURN:
+  sd_deselect();
+  return ok ? 0 : -1;
+}
+
+
+//================================================================
+/*! read blocks.
+
+  @param  lba		block address.
+  @param  buffer	pointer to buffer.
+  @param  n		number of blocks.
+  @return		0 if no error.
+*/
+int sd_read_blocks( uint32_t lba, void *buffer, int n )
+{
+  uint8_t *buf = buffer;
+
+  if( !flag_block_addr_ ) lba *= SD_BLOCK_SIZE;
+
+  if( n == 1 ) {
+    if( sd_send_cmd( CMD17, lba ) == 0 && sd_receive_block( buf ) == 0 ) n = 0;
+
+  } else if( sd_send_cmd( CMD18, lba ) == 0 ) {
+    do {
+      if( sd_receive_block( buf ) != 0 ) break;
+      buf += SD_BLOCK_SIZE;
+    } while( --n );
+    sd_send_cmd( CMD12, 0 );
+  }
+
+  sd_deselect();
+  return n ? -1 : 0;
+}
+
+
+//================================================================
+/*! write blocks.
+
+  @param  lba		block address.
+  @param  buffer	pointer to data.
+  @param  n		number of blocks.
+  @return		0 if no error.
+  @note			This returns after the card has programmed them.
+*/
+int sd_write_blocks( uint32_t lba, const void *buffer, int n )
+{
+  const uint8_t *buf = buffer;
+
+  if( !flag_block_addr_ ) lba *= SD_BLOCK_SIZE;
+
+  if( n == 1 ) {
+    if( sd_send_cmd( CMD24, lba ) == 0 && sd_send_block( buf, 0xfe ) == 0 ) n = 0;
+
+  } else if( sd_send_cmd( CMD25, lba ) == 0 ) {
+    do {
+      if( sd_send_block( buf, 0xfc ) != 0 ) break;
+      buf += SD_BLOCK_SIZE;
+    } while( --n );
+    if( sd_send_block( 0, 0xfd ) != 0 ) n = 1;
+  }
+
+  if( sd_wait_ready() != 0 ) n = 1;
+  sd_deselect();
+  return n ? -1 : 0;
+}
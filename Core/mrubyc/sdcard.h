@@ -0,0 +1,39 @@
+/*! @file
+  @brief
+  SD card block driver on SPI3.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef SDCARD_H
+#define SDCARD_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! block size.
+#define SD_BLOCK_SIZE 512
+
+
+/*
+  function prototypes.
+*/
+int sd_init( GPIO_TypeDef *cs_port, uint16_t cs_pin );
+int sd_read_blocks( uint32_t lba, void *buffer, int n );
+int sd_write_blocks( uint32_t lba, const void *buffer, int n );
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,492 @@
+/*! @file
+  @brief
+  Queue class.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  A fixed capacity queue between one producer and one consumer.
+  The producer and the consumer may be tasks or interrupt handlers,
+  and no lock nor per-item allocation is needed.
+
+    q = Queue.new( 16 )		# queue of objects.
+    q.push( 123 )		# -> true, or false if full.
+    q.pop			# -> 123, or nil if empty.
+    q.pop_wait( 100 )		# wait for an item up to 100 ms.
+
+    q = Queue.new( 64, 4 )	# queue of raw 4 byte items, such as
+				# filled from C by spsc_queue_push().
+    s = q.pop_wait		# -> String of 4 bytes.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "spsc_queue.h"
+
+
+static mrbc_class *cls_spsc_queue;
+
+
+//================================================================
+/*! get the queue from the object.
+
+  @param  v	pointer to value.
+  @return	pointer to SPSC_QUEUE, or NULL if not a Queue.
+*/
+SPSC_QUEUE *spsc_queue_get( const mrbc_value *v )
+{
+  if( v->tt != MRBC_TT_OBJECT ) return NULL;
+  if( v->instance->cls != cls_spsc_queue ) return NULL;
+
+  return (SPSC_QUEUE *)v->instance->data;
+}
+
+
+//================================================================
+/*! bytes per slot.
+*/
+static inline int spsc_item_size( const SPSC_QUEUE *q )
+{
+  return q->item_size ? q->item_size : sizeof(mrbc_value);
+}
+
+
+//================================================================
+/*! next index of the slot.
+*/
+static inline uint16_t spsc_next( const SPSC_QUEUE *q, uint16_t idx )
+{
+  return (idx == q->capacity) ? 0 : idx + 1;
+}
+
+
+//================================================================
+/*! push an item.
+
+  @param  q	pointer to SPSC_QUEUE.
+  @param  item	pointer to the item. (mrbc_value if item_size is 0)
+  @return	0 if no error, or -1 if full.
+  @note
+    This can be called from interrupt handler, if it is the only producer.
+    The value pushed to an object queue from interrupt handler must be
+    an immediate value such as Integer, because no reference count
+    is handled here.
+*/
+int spsc_queue_push( SPSC_QUEUE *q, const void *item )
+{
+  uint16_t head = q->head;
+  uint16_t next = spsc_next( q, head );
+  if( next == q->tail ) return -1;
+
+  int size = spsc_item_size( q );
+  memcpy( q->data + head * size, item, size );
+  __DMB();
+  q->head = next;
+
+  if( q->waiting & SPSC_QUEUE_WAIT_POP ) mrbc_wakeup_io( q );
+  return 0;
+}
+
+
+//================================================================
+/*! push an Integer, such as an event from interrupt handler.
+
+  @param  q	pointer to SPSC_QUEUE.
+  @param  n	value.
+  @return	0 if no error, -1 if full, or -2 if raw items over 4 bytes.
+  @note	A raw item is stored in native byte order, as Queue#push.
+*/
+int spsc_queue_push_int( SPSC_QUEUE *q, mrbc_int_t n )
+{
+  if( q->item_size == 0 ) {
+    mrbc_value v = mrbc_integer_value( n );
+    return spsc_queue_push( q, &v );
+  }
+  if( q->item_size > 4 ) return -2;
+
+  uint32_t u = n;
+  return spsc_queue_push( q, &u );
+}
+
+
+//================================================================
+/*! pop an item.
+
+  @param  q	pointer to SPSC_QUEUE.
+  @param  item	pointer to the buffer of an item.
+  @return	0 if no error, or -1 if empty.
+  @note
+    This can be called from interrupt handler, if it is the only consumer.
+    The reference of the popped mrbc_value is moved to the caller.
+*/
+int spsc_queue_pop( SPSC_QUEUE *q, void *item )
+{
+  uint16_t tail = q->tail;
+  if( tail == q->head ) return -1;
+
+  int size = spsc_item_size( q );
+  memcpy( item, q->data + tail * size, size );
+  __DMB();
+  q->tail = spsc_next( q, tail );
+
+  if( q->waiting & SPSC_QUEUE_WAIT_PUSH ) mrbc_wakeup_io( q );
+  return 0;
+}
+
+
+//================================================================
+/*! number of items in the queue.
+*/
+int spsc_queue_size( const SPSC_QUEUE *q )
+{
+  int n = (int)q->head - (int)q->tail;
+  return (n < 0) ? n + q->capacity + 1 : n;
+}
+
+
+//================================================================
+/*! wait for the queue to become ready, in other task running.
+
+  @param  vm		pointer to VM.
+  @param  q		pointer to SPSC_QUEUE.
+  @param  flag		SPSC_QUEUE_WAIT_POP or SPSC_QUEUE_WAIT_PUSH
+  @param  timeout	timeout in milliseconds, or -1 to wait forever.
+  @retval 0		ready. go ahead.
+  @retval 1		to wait, and this method will be called again.
+  @retval -1		timed out.
+*/
+static int spsc_wait( mrbc_vm *vm, SPSC_QUEUE *q, int flag, int timeout )
+{
+  hal_disable_irq();
+
+  int ready = (flag == SPSC_QUEUE_WAIT_POP) ?
+    (q->tail != q->head) : (spsc_next( q, q->head ) != q->tail);
+  if( ready ) {
+    q->waiting &= ~flag;
+    hal_enable_irq();
+    return 0;
+  }
+
+  if( (q->waiting & flag) || timeout == 0 ) {
+    q->waiting &= ~flag;		// timed out.
+    hal_enable_irq();
+    return -1;
+  }
+
+  q->waiting |= flag;
+  if( timeout < 0 ) {
+    mrbc_wait_io( VM2TCB(vm), q );
+  } else {
+    mrbc_wait_io_timeout( VM2TCB(vm), q, timeout );
+  }
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+
+  return 1;
+}
+
+
+//================================================================
+/*! get timeout argument.
+
+  @return	timeout in milliseconds, -1 if nil, or -2 if error.
+*/
+static int spsc_get_timeout( mrbc_value v[], int argc, int idx )
+{
+  if( argc < idx || v[idx].tt == MRBC_TT_NIL ) return -1;
+  if( v[idx].tt != MRBC_TT_INTEGER || mrbc_integer(v[idx]) < 0 ) return -2;
+
+  return mrbc_integer(v[idx]);
+}
+
+
+//================================================================
+/*! push the Ruby object.
+
+  @return	0 if no error, -1 if full, or -2 if type error.
+*/
+static int spsc_push_value( SPSC_QUEUE *q, mrbc_value *v )
+{
+  if( q->item_size == 0 ) {
+    mrbc_incref( v );
+    if( spsc_queue_push( q, v ) == 0 ) return 0;
+    mrbc_decref( v );
+    return -1;
+  }
+
+  // raw item. Integer is stored in native byte order.
+  uint8_t buf[4];
+  const void *item;
+  if( v->tt == MRBC_TT_STRING && mrbc_string_size(v) == q->item_size ) {
+    item = mrbc_string_cstr(v);
+  } else if( v->tt == MRBC_TT_INTEGER && q->item_size <= sizeof(buf) ) {
+    uint32_t n = mrbc_integer(*v);
+    memcpy( buf, &n, sizeof(buf) );
+    item = buf;
+  } else {
+    return -2;
+  }
+
+  return spsc_queue_push( q, item );
+}
+
+
+//================================================================
+/*! pop to the Ruby object.
+
+  @return	popped object, or nil if empty.
+*/
+static mrbc_value spsc_pop_value( mrbc_vm *vm, SPSC_QUEUE *q )
+{
+  mrbc_value ret = mrbc_nil_value();
+
+  if( q->item_size == 0 ) {
+    spsc_queue_pop( q, &ret );
+    return ret;
+  }
+
+  if( q->tail == q->head ) return ret;
+  ret = mrbc_string_new( vm, 0, q->item_size );
+  if( ret.string == NULL ) return mrbc_nil_value();	// ENOMEM
+
+  spsc_queue_pop( q, mrbc_string_cstr(&ret) );
+  return ret;
+}
+
+
+//================================================================
+/*! (method) new
+
+  Queue.new( capacity, item_size = 0 )
+
+  @param  capacity	number of items.
+  @param  item_size	bytes per raw item, or 0 for the queue of objects.
+*/
+static void c_queue_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc < 1 || argc > 2 || v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+  int capacity = mrbc_integer(v[1]);
+  int item_size = 0;
+  if( argc == 2 ) {
+    if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    item_size = mrbc_integer(v[2]);
+  }
+  if( capacity < 1 || capacity >= UINT16_MAX ) goto ERROR_RETURN;
+  if( item_size < 0 || item_size > UINT8_MAX ) goto ERROR_RETURN;
+
+  int slot_size = item_size ? item_size : sizeof(mrbc_value);
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls,
+			sizeof(SPSC_QUEUE) + (capacity + 1) * slot_size);
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  SPSC_QUEUE *q = (SPSC_QUEUE *)ret.instance->data;
+  q->capacity = capacity;
+  q->item_size = item_size;
+  q->head = 0;
+  q->tail = 0;
+  q->waiting = 0;
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) push
+
+  q.push( obj ) -> true, or false if full.
+*/
+static void c_queue_push(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+
+  if( argc != 1 ) goto ERROR_RETURN;
+  int ret = spsc_push_value( q, &v[1] );
+  if( ret == -2 ) goto ERROR_RETURN;
+
+  SET_BOOL_RETURN( ret == 0 );
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) push_wait
+
+  q.push_wait( obj, timeout = nil ) -> true, or false if timed out.
+
+  @param  timeout	timeout in milliseconds, or nil to wait forever.
+*/
+static void c_queue_push_wait(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+  int timeout = spsc_get_timeout( v, argc, 2 );
+
+  if( argc < 1 || argc > 2 || timeout == -2 ) goto ERROR_RETURN;
+
+  switch( spsc_wait( vm, q, SPSC_QUEUE_WAIT_PUSH, timeout ) ) {
+  case 0:
+    if( spsc_push_value( q, &v[1] ) == -2 ) goto ERROR_RETURN;
+    SET_TRUE_RETURN();
+    break;
+
+  case -1:
+    SET_FALSE_RETURN();
+    break;
+
+  default:
+    break;
+  }
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) pop
+
+  q.pop -> obj, or nil if empty.
+*/
+static void c_queue_pop(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+  mrbc_value ret = spsc_pop_value( vm, q );
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! (method) pop_wait
+
+  q.pop_wait( timeout = nil ) -> obj, or nil if timed out.
+
+  @param  timeout	timeout in milliseconds, or nil to wait forever.
+*/
+static void c_queue_pop_wait(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+  int timeout = spsc_get_timeout( v, argc, 1 );
+
+  if( argc > 1 || timeout == -2 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  switch( spsc_wait( vm, q, SPSC_QUEUE_WAIT_POP, timeout ) ) {
+  case 0: {
+    mrbc_value ret = spsc_pop_value( vm, q );
+    SET_RETURN(ret);
+  } break;
+
+  case -1:
+    SET_NIL_RETURN();
+    break;
+
+  default:
+    break;
+  }
+}
+
+
+//================================================================
+/*! (method) size, length
+*/
+static void c_queue_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+
+  SET_INT_RETURN( spsc_queue_size( q ) );
+}
+
+
+//================================================================
+/*! (method) capacity
+*/
+static void c_queue_capacity(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+
+  SET_INT_RETURN( q->capacity );
+}
+
+
+//================================================================
+/*! (method) empty?
+*/
+static void c_queue_empty(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+
+  SET_BOOL_RETURN( q->tail == q->head );
+}
+
+
+//================================================================
+/*! (method) full?
+*/
+static void c_queue_full(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+
+  SET_BOOL_RETURN( spsc_next( q, q->head ) == q->tail );
+}
+
+
+//================================================================
+/*! (method) clear
+
+  q.clear -> self
+
+  (note) call from the consumer side.
+*/
+static void c_queue_clear(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SPSC_QUEUE *q = (SPSC_QUEUE *)v[0].instance->data;
+  mrbc_value item;
+
+  if( q->item_size == 0 ) {
+    while( spsc_queue_pop( q, &item ) == 0 ) {
+      mrbc_decref( &item );
+    }
+  } else {
+    q->tail = q->head;
+    if( q->waiting & SPSC_QUEUE_WAIT_PUSH ) mrbc_wakeup_io( q );
+  }
+}
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_spsc_queue(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Queue", 0);
+  cls_spsc_queue = cls;
+
+  mrbc_define_method(0, cls, "new", c_queue_new);
+  mrbc_define_method(0, cls, "push", c_queue_push);
+  mrbc_define_method(0, cls, "push_wait", c_queue_push_wait);
+  mrbc_define_method(0, cls, "pop", c_queue_pop);
+  mrbc_define_method(0, cls, "pop_wait", c_queue_pop_wait);
+  mrbc_define_method(0, cls, "size", c_queue_size);
+  mrbc_define_method(0, cls, "length", c_queue_size);
+  mrbc_define_method(0, cls, "capacity", c_queue_capacity);
+  mrbc_define_method(0, cls, "empty?", c_queue_empty);
+  mrbc_define_method(0, cls, "full?", c_queue_full);
+  mrbc_define_method(0, cls, "clear", c_queue_clear);
+}
@@ -0,0 +1,57 @@
+/*! @file
+  @brief
+  Queue class header.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#include "../mrubyc_src/mrubyc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!@brief
+  single producer single consumer queue, stored in the instance data area.
+*/
+typedef struct SPSC_QUEUE {
+  uint16_t capacity;		//!< number of items.
+  uint16_t item_size;		//!< bytes per item, or 0 for mrbc_value.
+  volatile uint16_t head;	//!< write index, only by the producer.
+  volatile uint16_t tail;	//!< read index, only by the consumer.
+  volatile uint8_t waiting;	//!< SPSC_QUEUE_WAIT_* of the waiting task.
+  uint8_t data[];		//!< (capacity + 1) slots.
+} SPSC_QUEUE;
+
+#define SPSC_QUEUE_WAIT_POP	0x01
+#define SPSC_QUEUE_WAIT_PUSH	0x02
+
+
+/*
+  function prototypes.
+*/
+SPSC_QUEUE *spsc_queue_get( const mrbc_value *v );
+int spsc_queue_push( SPSC_QUEUE *q, const void *item );
+int spsc_queue_push_int( SPSC_QUEUE *q, mrbc_int_t n );
+int spsc_queue_pop( SPSC_QUEUE *q, void *item );
+int spsc_queue_size( const SPSC_QUEUE *q );
+void mrbc_init_class_spsc_queue( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -16,35 +16,76 @@
 #include "main.h"
 #include "../mrubyc_src/mrubyc.h"
 #include "stm32f4_uart.h"
+#include "usb_cdc.h"
 #include "mrbc_firm.h"
 
 static void c_led_write(mrbc_vm *vm, mrbc_value v[], int argc);
 static void c_sw_read(mrbc_vm *vm, mrbc_value v[], int argc);
 static void c_tick(mrbc_vm *vm, mrbc_value v[], int argc);
+static void c_monotonic_us(mrbc_vm *vm, mrbc_value v[], int argc);
+static void c_sleep_us(mrbc_vm *vm, mrbc_value v[], int argc);
+static void sleep_us_init(void);
 
 /* mruby/c プログラムが使うワークメモリの確保 */
+#if defined(MRBC_SNAPSHOT)
+// the pool is in .bss, to be saved in the snapshot as the VM state.
 #define MRBC_MEMORY_SIZE (1024*30)
 static uint8_t memory_pool[MRBC_MEMORY_SIZE];
+#else
+// all free RAM after .bss, defined by the linker script.
+extern uint8_t _mrbc_pool_start[], _mrbc_pool_end[];
+#define memory_pool _mrbc_pool_start
+#define MRBC_MEMORY_SIZE ((unsigned int)(_mrbc_pool_end - _mrbc_pool_start))
+#endif
 
 
 /*! バイトコード書き込みモードに移行するか？
 
   (Strategy)
   LED1を点滅させながら、一定時間内にコンソール(UART)へ改行文字が入力されたら1を返す
+  MRBC_BENCH_FIRMWARE 指定時、入力が "bench" ならベンチマークモード(2)を返す
+  Firmware.upload_mode によるリセット後は、待たずに1を返す
+  MRBC_FAST_BOOT 指定時、B1を押していなければ待たずに0を返す
 */
 int check_boot_mode( void )
 {
   const int MAX_WAIT_CYCLE = 256;
   int ret = 0;
 
+  if( take_upload_request() ) return 1;	// by Firmware.upload_mode
+
+#if defined(MRBC_FAST_BOOT)
+  // 書き込み済みのプログラムがあり、B1を押していなければ待たない
+  if( HAL_GPIO_ReadPin( B1_GPIO_Port, B1_Pin ) == GPIO_PIN_SET &&
+      pickup_task( 0 ) ) return 0;
+#endif
+
   for( int i = 0; i < MAX_WAIT_CYCLE; i++ ) {
     HAL_GPIO_WritePin( GPIOA, GPIO_PIN_5,
 		       ((i>>4) | (i>>1)) & 0x01 );	// Blink LED1
+#if defined(MRBC_CONSOLE_USB_CDC)
+    if( usb_cdc_can_read_line() ) {
+      ret = 1;
+#if defined(MRBC_BENCH_FIRMWARE)
+      char buf[16];
+      if( usb_cdc_gets( buf, sizeof(buf) ) > 0 &&
+	  strncmp( buf, "bench", 5 ) == 0 ) ret = 2;
+#endif
+      usb_cdc_clear_rx_buffer();
+      break;
+    }
+#else
     if( uart_can_read_line( UART_HANDLE_CONSOLE )) {
-      uart_clear_rx_buffer( UART_HANDLE_CONSOLE );
       ret = 1;
+#if defined(MRBC_BENCH_FIRMWARE)
+      char buf[16];
+      if( uart_gets( UART_HANDLE_CONSOLE, buf, sizeof(buf) ) > 0 &&
+	  strncmp( buf, "bench", 5 ) == 0 ) ret = 2;
+#endif
+      uart_clear_rx_buffer( UART_HANDLE_CONSOLE );
       break;
     }
+#endif
     HAL_Delay( 10 );
   }
   HAL_GPIO_WritePin( GPIOA, GPIO_PIN_5, 0 );
@@ -57,6 +98,12 @@ int check_boot_mode( void )
 */
 void start_mrubyc( void )
 {
+#if defined(MRBC_STACK_CHECK)
+  hal_stack_check_init();
+#endif
+#if defined(MRBC_CONSOLE_USB_CDC)
+  usb_cdc_init();	// may double the PLL VCO, keeping SYSCLK.
+#endif
   uart_init();
 
   switch( check_boot_mode() ) {
@@ -65,10 +112,29 @@ void start_mrubyc( void )
     memset( memory_pool, 0, MRBC_MEMORY_SIZE );
     break;
 
+#if defined(MRBC_BENCH_FIRMWARE)
+  case 2: {
+    int run_benchmark(void *pool, unsigned int size);
+    run_benchmark( memory_pool, MRBC_MEMORY_SIZE );
+    memset( memory_pool, 0, MRBC_MEMORY_SIZE );
+  } break;
+#endif
+
   default:
     break;
   }
 
+  void storage_init(void);
+  storage_init();
+
+#if defined(MRBC_SNAPSHOT)
+  // 前回保存したVMの状態から、初期化を省略して実行開始
+  if( snapshot_restore() == 0 ) {
+    mrbc_run();
+    return;
+  }
+#endif
+
   mrbc_init(memory_pool, MRBC_MEMORY_SIZE);
 
   // 各クラスの初期化
@@ -80,10 +146,53 @@ void start_mrubyc( void )
   mrbc_init_class_adc();
   void mrbc_init_class_pwm(void);
   mrbc_init_class_pwm();
+  void mrbc_init_class_input_capture(void);
+  mrbc_init_class_input_capture();
+  void mrbc_init_class_encoder(void);
+  mrbc_init_class_encoder();
   void mrbc_init_class_i2c(void);
   mrbc_init_class_i2c();
   void mrbc_init_class_spi(void);
   mrbc_init_class_spi();
+  void mrbc_init_class_typed_array(void);
+  mrbc_init_class_typed_array();
+  void mrbc_init_class_string_buffer(void);
+  mrbc_init_class_string_buffer();
+  void mrbc_init_class_json(void);
+  mrbc_init_class_json();
+  void mrbc_init_class_msgpack(void);
+  mrbc_init_class_msgpack();
+  void mrbc_init_class_modbus(void);
+  mrbc_init_class_modbus();
+  void mrbc_init_class_crc(void);
+  mrbc_init_class_crc();
+  void mrbc_init_class_file(void);
+  mrbc_init_class_file();
+  void mrbc_init_class_recorder(void);
+  mrbc_init_class_recorder();
+  void mrbc_init_class_ledstrip(void);
+  mrbc_init_class_ledstrip();
+  void mrbc_init_class_spsc_queue(void);
+  mrbc_init_class_spsc_queue();
+  void mrbc_init_class_sync(void);
+  mrbc_init_class_sync();
+  void mrbc_init_class_fiber(void);
+  mrbc_init_class_fiber();
+  void mrbc_init_class_timer(void);
+  mrbc_init_class_timer();
+  void mrbc_init_class_reactor(void);
+  mrbc_init_class_reactor();
+  void mrbc_init_class_dsp(void);
+  mrbc_init_class_dsp();
+  void mrbc_init_class_storage(void);
+  mrbc_init_class_storage();
+  void mrbc_init_class_system(void);
+  mrbc_init_class_system();
+  mrbc_init_class_firmware();
+#if defined(MRBC_USE_AOT)
+  void mrbc_aot_init(void);
+  mrbc_aot_init();
+#endif
 
   // ユーザ定義メソッドの登録
   mrbc_define_method(0, 0, "led_write", c_led_write);
@@ -91,6 +200,9 @@ void start_mrubyc( void )
 
   // tickメソッド
   mrbc_define_method(0, 0, "tick", c_tick);
+  mrbc_define_method(0, 0, "monotonic_us", c_monotonic_us);
+  sleep_us_init();
+  mrbc_define_method(0, 0, "sleep_us", c_sleep_us);
 
   // タスクの登録
 #if 1
@@ -99,7 +211,27 @@ void start_mrubyc( void )
     task = pickup_task( task );
     if( task == 0 ) break;
 
-    mrbc_create_task( task, 0 );
+    mrbc_tcb *tcb;
+#if defined(MRBC_USE_IREP_IMAGE)
+    // run the IREP image in place, or build it for the next boot.
+    void *image = pickup_irep_image( task );
+    if( image ) {
+      tcb = mrbc_create_task( image, 0 );
+    } else {
+      int sym_base = mrbc_symbol_count();
+      tcb = mrbc_create_task( task, 0 );
+      if( tcb ) write_irep_image( &tcb->vm, task, sym_base );
+    }
+#else
+    const void *bytecode = task_bytecode( task );
+    tcb = bytecode ? mrbc_create_task( bytecode, 0 ) : 0;
+#endif
+    if( !tcb ) continue;
+
+    // the name and priority in the bytecode directory.
+    const BYTECODE_ENTRY *e = bytecode_entry( task );
+    if( e->name[0] ) mrbc_set_task_name( tcb, e->name );
+    if( e->priority ) mrbc_change_priority( tcb, e->priority );
   }
 
 #else
@@ -114,6 +246,10 @@ void start_mrubyc( void )
   mrbc_create_task( task1, 0 );
 #endif
 
+#if defined(MRBC_SNAPSHOT)
+  snapshot_save();
+#endif
+
   // 実行開始
   mrbc_run();
 }
@@ -150,25 +286,455 @@ static void c_tick(mrbc_vm *vm, mrbc_value v[], int argc)
   SET_INT_RETURN( now );
 }
 
+/* monotonic_usメソッドの実装
+
+  起動からのマイクロ秒を返す
+  32bit Integer では桁あふれするが、71分未満の差は引き算で正しく求まる
+  MRBC_INT_WIDE 指定時は桁あふれしない
+*/
+static void c_monotonic_us(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  uint64_t now = hal_monotonic_us();
+#if defined(MRBC_INT_WIDE)
+  mrbc_decref( &v[0] );
+  mrbc_int_wide_set( &v[0], (int64_t)now );
+#else
+  SET_INT_RETURN( (mrbc_int_t)(mrbc_uint_t)now );
+#endif
+}
+
+
+/*! sleep_us
+
+  The waits shorter than SLEEP_US_SPIN spin on DWT->CYCCNT, because
+  a task switch takes a few microseconds. The longer ones wait in the
+  scheduler, and are woken up by the compare interrupt of TIM11, that
+  counts at 1MHz. The waits over 16bit are rounded up to milliseconds.
+  (note) The clock level should not be changed while waiting.
+*/
+#define SLEEP_US_SPIN 20	//!< wait shorter than this by spinning.
+#define SLEEP_US_SLOTS 4	//!< number of tasks waiting on TIM11 at once.
+
+static struct SLEEP_US {
+  mrbc_tcb *tcb;	//!< waiting task, or NULL if free.
+  uint16_t start;	//!< TIM11 counter at the start.
+  uint16_t us;		//!< wait time.
+} sleep_us_[SLEEP_US_SLOTS];
+
+/*! set the compare to the first expiry, or stop TIM11 if no wait.
+
+  @note  Call this with interrupts disabled.
+*/
+static void sleep_us_arm( void )
+{
+  uint16_t now = TIM11->CNT;
+  uint32_t remain = 0x10000;
+
+  for( int i = 0; i < SLEEP_US_SLOTS; i++ ) {
+    if( !sleep_us_[i].tcb ) continue;
+    uint16_t elapsed = now - sleep_us_[i].start;
+    uint32_t r = (elapsed < sleep_us_[i].us) ? sleep_us_[i].us - elapsed : 1;
+    if( r < remain ) remain = r;
+  }
+  if( remain == 0x10000 ) {
+    TIM11->DIER &= ~TIM_DIER_CC1IE;
+    TIM11->CR1 &= ~TIM_CR1_CEN;
+    return;
+  }
+
+  TIM11->CCR1 = (uint16_t)(now + remain);
+  TIM11->SR = ~(uint32_t)TIM_SR_CC1IF;
+  TIM11->DIER |= TIM_DIER_CC1IE;
+  if( (uint16_t)(TIM11->CNT - now) >= remain ) {
+    TIM11->EGR = TIM_EGR_CC1G;		// passed while setting.
+  }
+}
+
+/*! initialize TIM11 and the cycle counter for sleep_us.
+*/
+static void sleep_us_init( void )
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  __HAL_RCC_TIM11_CLK_ENABLE();
+  TIM11->CR1 = 0;
+  TIM11->ARR = 0xffff;
+  TIM11->CCMR1 = 0;			// CC1 is the output compare, frozen.
+
+  HAL_NVIC_SetPriority( TIM1_TRG_COM_TIM11_IRQn, TICK_INT_PRIORITY, 0 );
+  HAL_NVIC_EnableIRQ( TIM1_TRG_COM_TIM11_IRQn );
+}
+
+/*! TIM11 interrupt handler. (sleep_us)
+*/
+void TIM1_TRG_COM_TIM11_IRQHandler( void )
+{
+  TIM11->SR = ~(uint32_t)TIM_SR_CC1IF;
+  MRBC_ISR_ENTER();
+
+  uint16_t now = TIM11->CNT;
+  for( int i = 0; i < SLEEP_US_SLOTS; i++ ) {
+    if( !sleep_us_[i].tcb ) continue;
+    if( (uint16_t)(now - sleep_us_[i].start) < sleep_us_[i].us ) continue;
+    sleep_us_[i].tcb = NULL;
+    mrbc_wakeup_io( &sleep_us_[i] );
+  }
+
+  hal_disable_irq();
+  sleep_us_arm();
+  hal_enable_irq();
+  MRBC_ISR_EXIT();
+}
+
+/* sleep_usメソッドの実装
+
+  sleep_us( n ) -> n
+  n マイクロ秒待つ　待っている間は他のタスクが動く
+  SLEEP_US_SPIN 未満は他のタスクを止めて待つ
+*/
+static void c_sleep_us(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER || mrbc_integer(v[1]) < 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  mrbc_int_t us = mrbc_integer(v[1]);
+  SET_INT_RETURN( us );
+
+  if( us < SLEEP_US_SPIN ) {
+    uint32_t cycles = us * (SystemCoreClock / 1000000);
+    uint32_t start = DWT->CYCCNT;
+    while( DWT->CYCCNT - start < cycles ) {
+    }
+    return;
+  }
+
+  mrbc_tcb *tcb = VM2TCB(vm);
+  if( us <= 0xffff ) {
+    hal_disable_irq();
+    int i_free = -1, n_used = 0;
+    for( int i = 0; i < SLEEP_US_SLOTS; i++ ) {
+      if( sleep_us_[i].tcb ) n_used++; else if( i_free < 0 ) i_free = i;
+    }
+    if( i_free >= 0 ) {
+      struct SLEEP_US *s = &sleep_us_[i_free];
+      if( n_used == 0 ) {
+	// the timer is stopped, set the prescaler for the current clock.
+	TIM11->PSC = HAL_RCC_GetPCLK2Freq() / 1000000 - 1;	// APB2 is not divided.
+	TIM11->CNT = 0;
+	TIM11->EGR = TIM_EGR_UG;		// load PSC.
+	TIM11->CR1 |= TIM_CR1_CEN;
+      }
+      s->tcb = tcb;
+      s->start = TIM11->CNT;
+      s->us = us;
+
+      // the timeout is a backstop, and keeps the tickless idle short.
+      mrbc_wait_io_timeout( tcb, s, us / 1000 + 2 );
+      sleep_us_arm();
+      hal_enable_irq();
+      return;
+    }
+    hal_enable_irq();
+  }
+
+  // too long, or all the slots are in use.
+  mrbc_sleep_ms( tcb, (us + 999) / 1000 );
+}
+
+
+/*! HAL: the upper 32 bits of the millisecond tick.
+*/
+static volatile uint32_t tick_ms_hi;
+static volatile uint32_t tick_ms_last;
+
+/*! HAL: extend the millisecond tick to 64bit.
+
+  Called from SysTick_Handler() after HAL_IncTick().
+*/
+void hal_monotonic_update( void )
+{
+  uint32_t now = uwTick;
+  if( now < tick_ms_last ) tick_ms_hi++;
+  tick_ms_last = now;
+}
+
+/*! HAL: microseconds since the boot, monotonic.
+
+  The millisecond tick is interpolated by the SysTick counter, so it
+  keeps counting in the sleep mode, unlike DWT->CYCCNT.
+  It can be called with the interrupts disabled, and from the
+  interrupt handlers except during the tickless idle.
+*/
+uint64_t hal_monotonic_us( void )
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  uint32_t ms = uwTick;
+  uint32_t load = SysTick->LOAD;
+  uint32_t val = SysTick->VAL;
+  uint32_t hi = tick_ms_hi + (ms < tick_ms_last);
+  uint32_t pending = 0;
+  if( SCB->ICSR & SCB_ICSR_PENDSTSET_Msk ) {
+    // the counter reloaded, but the tick is not counted yet.
+    val = SysTick->VAL;
+    pending = uwTickFreq;
+  }
+
+  __set_PRIMASK( primask );
+
+  uint64_t ms64 = ((uint64_t)hi << 32 | ms) + pending;
+  uint32_t us = (load - val) / (SystemCoreClock / 1000000);
+
+  return ms64 * 1000 + us;
+}
+
+
+#if defined(MRBC_STACK_CHECK)
+/*! HAL: the stack check.
+
+  The main stack is the last _Min_Stack_Size bytes of RAM, and the
+  lowest STACK_GUARD_SIZE bytes of it are guarded by MPU. The rest is
+  painted at the start, and the lowest word changed is the watermark.
+*/
+extern uint32_t _estack[];
+extern uint32_t _Min_Stack_Size;
+static const uint32_t STACK_PAINT = 0xA5A5A5A5U;
+#define STACK_GUARD_SIZE 32	// the minimum region size of MPU.
+#define STACK_LIMIT ((uint32_t *)((uint8_t *)_estack - (uint32_t)&_Min_Stack_Size + STACK_GUARD_SIZE))
+
+/*! HAL: paint the stack, and set the MPU guard region below it.
+*/
+void hal_stack_check_init( void )
+{
+  // paint below the current frame.
+  uint32_t *sp = (uint32_t *)__get_MSP() - 16;
+  for( uint32_t *p = STACK_LIMIT; p < sp; p++ ) {
+    *p = STACK_PAINT;
+  }
+
+  // no access to the guard, and the default map for the others.
+  MPU_Region_InitTypeDef region = {
+    .Enable = MPU_REGION_ENABLE,
+    .Number = MPU_REGION_NUMBER0,
+    .BaseAddress = (uint32_t)STACK_LIMIT - STACK_GUARD_SIZE,
+    .Size = MPU_REGION_SIZE_32B,
+    .SubRegionDisable = 0,
+    .TypeExtField = MPU_TEX_LEVEL0,
+    .AccessPermission = MPU_REGION_NO_ACCESS,
+    .DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE,
+    .IsShareable = MPU_ACCESS_NOT_SHAREABLE,
+    .IsCacheable = MPU_ACCESS_CACHEABLE,
+    .IsBufferable = MPU_ACCESS_NOT_BUFFERABLE,
+  };
+  HAL_MPU_Disable();
+  HAL_MPU_ConfigRegion( &region );
+  HAL_MPU_Enable( MPU_PRIVILEGED_DEFAULT );	// and MemManage fault.
+}
+
+/*! HAL: the usable stack size in bytes.
+*/
+unsigned int hal_stack_size( void )
+{
+  return (uint8_t *)_estack - (uint8_t *)STACK_LIMIT;
+}
+
+/*! HAL: the maximum stack usage since the boot, in bytes.
+*/
+unsigned int hal_stack_max_used( void )
+{
+  const uint32_t *p = STACK_LIMIT;
+  while( p < _estack && *p == STACK_PAINT ) {
+    p++;
+  }
+  return (uint8_t *)_estack - (uint8_t *)p;
+}
+
+/*! HAL: report the stack overflow and stop.
+
+  Called from the fault handlers, with MSP set to the top again.
+  The frames in the stack are lost.
+*/
+void hal_stack_overflow( void )
+{
+  static const char MSG[] = "\r\nFatal: stack overflow.\r\n";
+
+  __disable_irq();
+  HAL_MPU_Disable();
+  hal_write( 1, MSG, sizeof(MSG) - 1 );
+  hal_flush( 1 );
+  while( 1 ) {
+  }
+}
+#endif
+
 
 /*! HAL
 */
 int hal_write(int fd, const void *buf, int nbytes)
 {
-  extern UART_HandleTypeDef huart2;
-  HAL_UART_Transmit( &huart2, buf, nbytes, HAL_MAX_DELAY );
-
+#if defined(MRBC_CONSOLE_ITM)
+  // ITM stimulus port 0, not to interfere with the bytecode writer.
+  hal_itm_write( 0, buf, nbytes );
   return nbytes;
+#elif defined(MRBC_CONSOLE_USB_CDC)
+  return usb_cdc_write( buf, nbytes );
+#else
+  return uart_write( UART_HANDLE_CONSOLE, buf, nbytes );
+#endif
 }
 int _write(int file, char *ptr, int len)
 {
   return hal_write(file, ptr, len);
 }
 
+#if defined(MRBC_TICKLESS_IDLE)
+/*! HAL: idle the CPU with SysTick interrupts suppressed.
+
+  Called and returns with interrupts disabled.
+  SysTick is reprogrammed to expire after the given ticks, so the CPU
+  keeps sleeping through them unless another interrupt wakes it up.
+  The last tick interrupt is left pending, and it is not counted.
+
+  @param  ticks	ticks until the next wakeup. (>= 2)
+  @return	number of elapsed ticks without tick interrupt.
+*/
+uint32_t hal_idle_cpu_tickless( uint32_t ticks )
+{
+  const uint32_t per_tick = SystemCoreClock / (1000U / uwTickFreq);
+  const uint32_t max_ticks = SysTick_LOAD_RELOAD_Msk / per_tick;
+  if( ticks > max_ticks ) ticks = max_ticks;
+
+  // stop SysTick. give up if the tick interrupt is already pending.
+  SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+  if( SCB->ICSR & SCB_ICSR_PENDSTSET_Msk ) {
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    return 0;
+  }
+
+  uint32_t reload = SysTick->VAL + per_tick * (ticks - 1);
+  SysTick->LOAD = reload;
+  SysTick->VAL = 0;
+  SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+
+  hal_idle_cpu();
+
+  // read CTRL only once, because it clears COUNTFLAG.
+  uint32_t ctrl = SysTick->CTRL;
+  SysTick->CTRL = ctrl & ~SysTick_CTRL_ENABLE_Msk;
+
+  uint32_t elapsed;
+  if( ctrl & SysTick_CTRL_COUNTFLAG_Msk ) {
+    // expired. the pending interrupt will count the last tick.
+    uint32_t load = (per_tick - 1) - (reload - SysTick->VAL);
+    if( load == 0 || load >= per_tick ) load = per_tick - 1;
+    SysTick->LOAD = load;
+    elapsed = ticks - 1;
+
+  } else {
+    // woken up by another interrupt.
+    uint32_t counts = ticks * per_tick - SysTick->VAL;
+    elapsed = counts / per_tick;
+    SysTick->LOAD = (elapsed + 1) * per_tick - counts;
+  }
+
+  // restart SysTick from the remainder, and restore the period.
+  SysTick->VAL = 0;
+  SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+  SysTick->LOAD = per_tick - 1;
+
+  uwTick += elapsed * uwTickFreq;
+
+  return elapsed;
+}
+#endif
+
+#if defined(MRBC_PROFILE_SAMPLING)
+/*! HAL: start the sampling timer.
+
+  TIM4 counts at 1MHz, and interrupts at the given rate. (16Hz..)
+  The interrupt has the same priority as SysTick, not to nest with
+  mrbc_tick().
+
+  @param  hz	sampling rate.
+*/
+void hal_profile_timer_start( unsigned int hz )
+{
+  uint32_t clock = HAL_RCC_GetPCLK1Freq() * 2;	// APB1 timer clock.
+  uint32_t arr = 1000000 / hz;
+  if( arr < 2 ) arr = 2;
+  if( arr > 0x10000 ) arr = 0x10000;
+
+  TIM4->CR1 &= ~TIM_CR1_CEN;
+  TIM4->PSC = clock / 1000000 - 1;
+  TIM4->ARR = arr - 1;
+  TIM4->CNT = 0;
+  TIM4->EGR = TIM_EGR_UG;		// load PSC.
+  TIM4->SR = ~(uint32_t)TIM_SR_UIF;
+  TIM4->DIER |= TIM_DIER_UIE;
+
+  HAL_NVIC_SetPriority( TIM4_IRQn, TICK_INT_PRIORITY, 0 );
+  HAL_NVIC_EnableIRQ( TIM4_IRQn );
+  TIM4->CR1 |= TIM_CR1_CEN;
+}
+
+/*! HAL: stop the sampling timer.
+*/
+void hal_profile_timer_stop( void )
+{
+  TIM4->CR1 &= ~TIM_CR1_CEN;
+  TIM4->DIER &= ~TIM_DIER_UIE;
+  HAL_NVIC_DisableIRQ( TIM4_IRQn );
+}
+
+/*! TIM4 interrupt handler. (sampling timer)
+*/
+void TIM4_IRQHandler( void )
+{
+  TIM4->SR = ~(uint32_t)TIM_SR_UIF;
+  MRBC_ISR_ENTER();
+  mrbc_profile_tick();
+  MRBC_ISR_EXIT();
+}
+#endif
+
 int hal_flush(int fd)
 {
+  if( fd == 1 ) mrbc_console_flush();
+#if defined(MRBC_CONSOLE_USB_CDC)
+  usb_cdc_flush();
+#elif !defined(MRBC_CONSOLE_ITM)
+  uart_flush( UART_HANDLE_CONSOLE );
+#endif
   return 0;
 }
+
+/*! HAL: abort the program.
+
+  Called at the fatal errors (e.g. MRBC_OUT_OF_MEMORY), possibly in the
+  allocator or an interrupt handler, so it doesn't allocate nor wait
+  for the interrupts. It halts if a debugger is attached, else resets.
+
+  @param  s	message or NULL.
+*/
 void hal_abort(const char *s)
 {
+  static const char MSG[] = "\r\nFatal: abort.\r\n";
+
+  __disable_irq();
+  if( s ) {
+    hal_write( 1, "\r\n", 2 );
+    hal_write( 1, s, strlen(s) );
+  }
+  hal_write( 1, MSG, sizeof(MSG) - 1 );
+  hal_flush( 1 );
+
+  if( CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk ) {
+    __BKPT( 0 );
+    while( 1 ) {
+    }
+  }
+  NVIC_SystemReset();
 }
@@ -10,15 +10,39 @@
 
   This file is distributed under BSD 3-Clause License.
 
+  The scan can be triggered by a running PWM instead of TIM5, so that
+  one set is converted at the same point of every PWM period.
+
+    pwm = PWM.new( "PA8", frequency:20000, duty:30 )
+    ADC.start_scan( pwm, adc0, adc1 )		# in the middle of the pulse.
+    ADC.start_scan( [pwm, 100], adc0, adc1 )	# at the counter value 100.
   </pre>
 */
 
+//@cond
+#include <string.h>
+//@endcond
+
 #include "main.h"
 #include "../mrubyc_src/mrubyc.h"
 #include "stm32f4_gpio.h"
+#include "typed_array.h"
 
 
 extern ADC_HandleTypeDef hadc1;
+extern TIM_HandleTypeDef htim5;
+
+uint32_t pwm_adc_trigger_source( const mrbc_value *pwm, uint32_t max_freq );
+int pwm_adc_trigger_start( const mrbc_value *pwm, int ticks );
+void pwm_adc_trigger_stop( void );
+
+#if !defined(ADC_SCAN_BUF_SIZE)
+#define ADC_SCAN_BUF_SIZE 240	//!< scan ring buffer size in samples.
+#endif
+
+// TIM5 clock is HCLK, 84MHz at the full speed. (see stm32f4_clock.c)
+#define ADC_TRIG_TIMER_FREQ SystemCoreClock
+static const uint32_t ADC_SCAN_MAX_FREQ = 100000;	// 100kHz per set
 
 /*!
   Pin assign vs ADC channel table.
@@ -38,6 +62,292 @@ static struct ADC_HANDLE {
 };
 static const int NUM_TBL_ADC_CHANNELS = sizeof(TBL_ADC_CHANNELS)/sizeof(struct ADC_HANDLE);
 
+//! sampling time of each channel, by table index. (ADC_SAMPLETIME_*)
+static uint8_t adc_sample_time_[sizeof(TBL_ADC_CHANNELS)/sizeof(struct ADC_HANDLE)];
+
+//! sampling time in ADC clock cycles, by ADC_SAMPLETIME_*
+static const uint16_t TBL_ADC_SAMPLE_CYCLES[] = { 3, 15, 28, 56, 84, 112, 144, 480 };
+
+//! maximum number of conversions averaged by read_raw(n) and read_voltage(n).
+static const int ADC_AVERAGE_MAX = 1024;
+
+/*!
+  Scan mode state.
+
+  TIM5 CC1 (or the PWM timer) triggers one conversion of the whole
+  sequence, and DMA2
+  Stream0 stores the results into adc_scan_buf in circular mode.
+  Sample positions are kept as absolute counts so that readers can
+  tell how far behind they are.
+*/
+static struct ADC_SCAN {
+  uint8_t n_ch;			//!< number of channels in the sequence. 0 = off.
+  uint8_t flag_pwm;		//!< triggered by the PWM timer.
+  int8_t rank[sizeof(TBL_ADC_CHANNELS)/sizeof(struct ADC_HANDLE)];
+				//!< sequence position by table index, or -1.
+  uint16_t len;			//!< DMA length, multiple of n_ch.
+  volatile uint32_t laps;	//!< count of completed DMA laps.
+  uint32_t rd_cnt;		//!< samples consumed by read_scan.
+} adc_scan;
+
+static uint16_t adc_scan_buf[ADC_SCAN_BUF_SIZE];
+
+//! block sampling state.
+enum {
+  ADC_BLOCK_IDLE = 0,	//!< ADC free.
+  ADC_BLOCK_BUSY,	//!< in sampling.
+  ADC_BLOCK_DONE,	//!< sampling completed.
+  ADC_BLOCK_ERROR,	//!< sampling failed.
+};
+
+//! block sampling context.
+static struct {
+  volatile uint8_t state;	//!< ADC_BLOCK_*
+  uint32_t error;		//!< HAL error code.
+  mrbc_tcb *tcb;		//!< owner task.
+  mrbc_value ret;		//!< String to be returned, or nil.
+} adc_block;
+
+
+//================================================================
+/*! (re)initialize ADC1 for single conversion or for triggered scan.
+
+  @param  n_ch		number of conversions. 0 means software start.
+  @param  trigger	ADC_EXTERNALTRIGCONV_*, if n_ch is not 0.
+  @return int		0 if no error.
+*/
+static int adc_configure( int n_ch, uint32_t trigger )
+{
+  hadc1.Init.ScanConvMode = n_ch ? ENABLE : DISABLE;
+  hadc1.Init.ContinuousConvMode = DISABLE;
+  hadc1.Init.DiscontinuousConvMode = DISABLE;
+  hadc1.Init.ExternalTrigConvEdge = n_ch ? ADC_EXTERNALTRIGCONVEDGE_RISING :
+					   ADC_EXTERNALTRIGCONVEDGE_NONE;
+  hadc1.Init.ExternalTrigConv = n_ch ? trigger : ADC_SOFTWARE_START;
+  hadc1.Init.NbrOfConversion = n_ch ? n_ch : 1;
+  hadc1.Init.DMAContinuousRequests = n_ch ? ENABLE : DISABLE;
+  hadc1.Init.EOCSelection = n_ch ? ADC_EOC_SEQ_CONV : ADC_EOC_SINGLE_CONV;
+
+  return HAL_ADC_Init(&hadc1) != HAL_OK;
+}
+
+
+//================================================================
+/*! start the conversion trigger timer.
+
+  @param  freq		trigger frequency (Hz).
+  @return int		0 if no error.
+*/
+static int adc_trigger_start( uint32_t freq )
+{
+  // TIM5 is 32bit, so no prescaler is needed down to 1Hz.
+  uint32_t arr = ADC_TRIG_TIMER_FREQ / freq - 1;
+  __HAL_TIM_SET_PRESCALER(&htim5, 0);
+  __HAL_TIM_SET_AUTORELOAD(&htim5, arr);
+  __HAL_TIM_SET_COMPARE(&htim5, TIM_CHANNEL_1, arr / 2);
+  __HAL_TIM_SET_COUNTER(&htim5, 0);
+
+  return HAL_TIM_PWM_Start(&htim5, TIM_CHANNEL_1) != HAL_OK;
+}
+
+
+//================================================================
+/*! stop scan mode and return to single conversion.
+*/
+static void adc_scan_stop( void )
+{
+  if( adc_scan.n_ch == 0 ) return;
+
+  if( adc_scan.flag_pwm ) {
+    pwm_adc_trigger_stop();
+  } else {
+    HAL_TIM_PWM_Stop(&htim5, TIM_CHANNEL_1);
+  }
+  HAL_ADC_Stop_DMA(&hadc1);
+  adc_scan.n_ch = 0;
+  adc_configure( 0, 0 );
+}
+
+
+//================================================================
+/*! start scan mode.
+
+  @param  idx		array of TBL_ADC_CHANNELS index.
+  @param  n_ch		number of elements in idx.
+  @param  freq		sequence frequency (Hz), if pwm is NULL.
+  @param  pwm		PWM object to trigger, or NULL for TIM5.
+  @param  ticks		counter value of the PWM to trigger, or -1.
+  @return int		0 if no error.
+*/
+static int adc_scan_start( const int *idx, int n_ch, uint32_t freq,
+			   const mrbc_value *pwm, int ticks )
+{
+  adc_scan_stop();
+  uint32_t trigger = pwm ? pwm_adc_trigger_source( pwm, ADC_SCAN_MAX_FREQ ) :
+			   ADC_EXTERNALTRIGCONV_T5_CC1;
+  adc_scan.flag_pwm = !!pwm;
+  if( adc_configure( n_ch, trigger ) != 0 ) goto ERROR_RETURN;
+
+  memset( adc_scan.rank, -1, sizeof(adc_scan.rank) );
+  for( int i = 0; i < n_ch; i++ ) {
+    ADC_ChannelConfTypeDef sConfig = {
+      .Channel = TBL_ADC_CHANNELS[idx[i]].channel,
+      .Rank = i + 1,
+      .SamplingTime = adc_sample_time_[idx[i]],
+    };
+    if( HAL_ADC_ConfigChannel(&hadc1, &sConfig) != HAL_OK ) goto ERROR_RETURN;
+    adc_scan.rank[idx[i]] = i;
+  }
+
+  adc_scan.n_ch = n_ch;
+  adc_scan.len = ADC_SCAN_BUF_SIZE / n_ch * n_ch;
+  adc_scan.laps = 0;
+  adc_scan.rd_cnt = 0;
+  if( HAL_ADC_Start_DMA(&hadc1, (uint32_t *)adc_scan_buf, adc_scan.len)
+      != HAL_OK ) goto ERROR_RETURN;
+
+  if( pwm ) {
+    if( pwm_adc_trigger_start( pwm, ticks ) != 0 ) goto ERROR_RETURN;
+  } else {
+    if( adc_trigger_start( freq ) != 0 ) goto ERROR_RETURN;
+  }
+
+  return 0;
+
+ ERROR_RETURN:
+  adc_scan.n_ch = n_ch;		// force stop.
+  adc_scan_stop();
+  return -1;
+}
+
+
+//================================================================
+/*! get the number of samples written so far.
+
+  @return uint32_t	absolute count of samples, rounded down to a set.
+*/
+static uint32_t adc_scan_wr_cnt( void )
+{
+  DMA_HandleTypeDef *hdma = hadc1.DMA_Handle;
+
+  hal_disable_irq();
+  uint32_t laps = adc_scan.laps;
+  uint32_t pos = adc_scan.len - __HAL_DMA_GET_COUNTER(hdma);
+  // the counter has wrapped but the TC interrupt is not serviced yet.
+  if( __HAL_DMA_GET_FLAG(hdma, __HAL_DMA_GET_TC_FLAG_INDEX(hdma)) &&
+      pos < adc_scan.len / 2 ) laps++;
+  hal_enable_irq();
+
+  pos -= pos % adc_scan.n_ch;
+  return laps * adc_scan.len + pos;
+}
+
+
+//================================================================
+/*! acquire the ADC for block sampling, or take the own result.
+
+  @param  vm	Pointer to vm
+  @return int	ADC_BLOCK_IDLE if acquired, ADC_BLOCK_BUSY if waiting,
+		or the state of own sampling.
+*/
+static int adc_block_acquire( mrbc_vm *vm )
+{
+  mrbc_tcb *tcb = VM2TCB(vm);
+  int ret = ADC_BLOCK_IDLE;
+
+  hal_disable_irq();
+
+  // discard the result if the owner task has been terminated.
+  if( adc_block.state >= ADC_BLOCK_DONE && adc_block.tcb != tcb &&
+      adc_block.tcb->state == TASKSTATE_DORMANT ) {
+    adc_block.state = ADC_BLOCK_IDLE;
+  }
+
+  if( adc_block.state == ADC_BLOCK_IDLE ) {
+    adc_block.state = ADC_BLOCK_BUSY;
+    adc_block.tcb = tcb;
+    adc_block.ret = mrbc_nil_value();
+
+  } else if( adc_block.tcb == tcb && adc_block.state != ADC_BLOCK_BUSY ) {
+    ret = adc_block.state;
+
+  } else {
+    mrbc_wait_io( tcb, &hadc1 );
+    vm->flag_retry_call = 1;
+    ret = ADC_BLOCK_BUSY;
+  }
+
+  hal_enable_irq();
+
+  return ret;
+}
+
+
+//================================================================
+/*! release the ADC.
+*/
+static void adc_block_release( void )
+{
+  adc_block.ret = mrbc_nil_value();
+  adc_block.state = ADC_BLOCK_IDLE;
+
+  mrbc_wakeup_io( &hadc1 );	// for tasks waiting for the ADC.
+}
+
+
+//================================================================
+/*! block sampling complete or error. (in ISR)
+
+  The DMA stream is set up in circular mode for the scan, so stop
+  the trigger and the DMA here before the buffer is overwritten.
+*/
+static void adc_block_complete( int state )
+{
+  HAL_TIM_PWM_Stop(&htim5, TIM_CHANNEL_1);
+  HAL_ADC_Stop_DMA(&hadc1);
+  adc_block.error = hadc1.ErrorCode;
+  adc_configure( 0, 0 );
+
+  adc_block.state = state;
+  mrbc_wakeup_io( &hadc1 );
+}
+
+
+//================================================================
+/*! HAL ADC conversion (DMA lap) complete callback.
+*/
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+{
+  if( hadc != &hadc1 ) return;
+  if( adc_block.state == ADC_BLOCK_BUSY ) {
+    adc_block_complete( ADC_BLOCK_DONE );
+    return;
+  }
+  adc_scan.laps++;
+}
+
+
+//================================================================
+/*! HAL ADC error callback.
+
+  On overrun, the ADC stops DMA requests. Restart it so that the scan
+  keeps running; the lost samples are not reported.
+*/
+void HAL_ADC_ErrorCallback(ADC_HandleTypeDef *hadc)
+{
+  if( hadc != &hadc1 ) return;
+  if( adc_block.state == ADC_BLOCK_BUSY ) {
+    adc_block_complete( ADC_BLOCK_ERROR );
+    return;
+  }
+  if( adc_scan.n_ch == 0 ) return;
+
+  HAL_ADC_Stop_DMA(&hadc1);
+  uint32_t laps = adc_scan.laps + 1;
+  HAL_ADC_Start_DMA(&hadc1, (uint32_t *)adc_scan_buf, adc_scan.len);
+  adc_scan.laps = laps;
+}
+
 
 //================================================================
 /*! constructor
@@ -89,21 +399,73 @@ static void c_adc_new(mrbc_vm *vm, mrbc_value v[], int argc)
 
 
 //----------------------------------------------------------------
-static uint32_t read_sub(mrbc_vm *vm, mrbc_value v[], int argc)
+/*! read the sum of conversions.
+
+  @param  n_avg	(out) number of conversions in the sum.
+  @return	sum of the raw values.
+  @note	The number is given by the argument, and the conversions are
+	done back to back. In scan mode, the latest sets are summed.
+*/
+static uint32_t read_sub(mrbc_vm *vm, mrbc_value v[], int argc, int *n_avg)
 {
   int idx = *((int *)(v[0].instance->data));
+  int n = 1;
+  *n_avg = 1;
+
+  if( argc >= 1 ) {
+    if( v[1].tt != MRBC_TT_INTEGER ||
+	mrbc_integer(v[1]) < 1 || mrbc_integer(v[1]) > ADC_AVERAGE_MAX ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+      return 0;
+    }
+    n = mrbc_integer(v[1]);
+  }
+
+  if( adc_block.state == ADC_BLOCK_BUSY ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "ADC is in block sampling.");
+    return 0;
+  }
+
+  if( adc_scan.n_ch ) {
+    if( adc_scan.rank[idx] < 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(RuntimeError), "ADC channel is not in the scan.");
+      return 0;
+    }
+    uint32_t cnt = adc_scan_wr_cnt();
+    if( cnt == 0 ) return 0;
+
+    // the oldest set may be in overwriting.
+    uint32_t sets = cnt / adc_scan.n_ch;
+    if( sets > adc_scan.len / adc_scan.n_ch - 1 ) {
+      sets = adc_scan.len / adc_scan.n_ch - 1;
+    }
+    if( n > sets ) n = sets;
+
+    uint32_t sum = 0;
+    for( int i = 1; i <= n; i++ ) {
+      uint32_t pos = (cnt - i * adc_scan.n_ch) % adc_scan.len;
+      sum += adc_scan_buf[ pos + adc_scan.rank[idx] ];
+    }
+    *n_avg = n;
+    return sum;
+  }
 
   ADC_ChannelConfTypeDef sConfig = {
     .Channel = TBL_ADC_CHANNELS[idx].channel,
     .Rank = 1,
-    .SamplingTime = ADC_SAMPLETIME_3CYCLES,
+    .SamplingTime = adc_sample_time_[idx],
   };
   if( HAL_ADC_ConfigChannel(&hadc1, &sConfig) != HAL_OK ) return 0;
 
-  HAL_ADC_Start(&hadc1);
-  if( HAL_ADC_PollForConversion(&hadc1, 1000) != HAL_OK ) return 0;
+  uint32_t sum = 0;
+  for( int i = 0; i < n; i++ ) {
+    HAL_ADC_Start(&hadc1);
+    if( HAL_ADC_PollForConversion(&hadc1, 1000) != HAL_OK ) return 0;
+    sum += HAL_ADC_GetValue(&hadc1);
+  }
+  *n_avg = n;
 
-  return HAL_ADC_GetValue(&hadc1);
+  return sum;
 }
 
 
@@ -111,12 +473,14 @@ static uint32_t read_sub(mrbc_vm *vm, mrbc_value v[], int argc)
 /*! read_voltage
 
   adc1.read_voltage() -> Float
+  adc1.read_voltage( 16 ) -> Float	# average of 16 conversions.
 */
 static void c_adc_read_voltage(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  uint32_t raw_val = read_sub( vm, v, argc );
+  int n;
+  uint32_t raw_val = read_sub( vm, v, argc, &n );
 
-  SET_FLOAT_RETURN( raw_val * 3.3 / 4095 );
+  SET_FLOAT_RETURN( raw_val * (mrbc_float_t)(3.3 / 4095) / n );
 }
 
 
@@ -124,24 +488,326 @@ static void c_adc_read_voltage(mrbc_vm *vm, mrbc_value v[], int argc)
 /*! read_raw
 
   adc1.read_raw() -> Integer
+  adc1.read_raw( 16 ) -> Integer	# rounded average of 16 conversions.
 */
 static void c_adc_read_raw(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  uint32_t raw_val = read_sub( vm, v, argc );
+  int n;
+  uint32_t raw_val = read_sub( vm, v, argc, &n );
+
+  SET_INT_RETURN( (raw_val + n / 2) / n );
+}
+
+
+//================================================================
+/*! sampling time
+
+  adc1.sample_time = 56		# in ADC clock cycles. (3,15,28,56,84,112,144,480)
+  adc1.sample_time -> Integer
+
+  A longer sampling time is needed for a source of high impedance.
+  It is used from the next conversion, and by the scan and the block
+  sampling.
+*/
+static void c_adc_set_sample_time(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int idx = *((int *)(v[0].instance->data));
+  static const int NUM = sizeof(TBL_ADC_SAMPLE_CYCLES)/sizeof(TBL_ADC_SAMPLE_CYCLES[0]);
+
+  if( argc == 1 && v[1].tt == MRBC_TT_INTEGER ) {
+    for( int i = 0; i < NUM; i++ ) {
+      if( TBL_ADC_SAMPLE_CYCLES[i] == mrbc_integer(v[1]) ) {
+	adc_sample_time_[idx] = i;	// ADC_SAMPLETIME_* is 0..7
+	return;
+      }
+    }
+  }
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+static void c_adc_sample_time(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int idx = *((int *)(v[0].instance->data));
+
+  SET_INT_RETURN( TBL_ADC_SAMPLE_CYCLES[ adc_sample_time_[idx] ] );
+}
+
+
+//================================================================
+/*! read block of samples
+
+  adc1.read_samples( n, rate_hz ) -> String
+  adc1.read_samples( Int16Array.new(n), rate_hz ) -> Int16Array
+
+  Sample n times at rate_hz, and return the raw 12-bit values packed
+  as little-endian unsigned 16-bit integers (String#unpack("S*")),
+  or stored in the given Int16Array.
+  The calling task sleeps until the block is complete.
+*/
+static void c_adc_read_samples(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 2 ) goto ERROR_RETURN;
+  TYPED_ARRAY *ta = typed_array_get(&v[1]);
+  if( ta && ta->type != TYPED_ARRAY_INT16 ) goto ERROR_RETURN;
+  if( !ta && v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+  if( ta && typed_array_modify( vm, ta ) != 0 ) return;
+  int n = ta ? ta->size : mrbc_integer(v[1]);
+  uint32_t freq;
+  switch( v[2].tt ) {
+  case MRBC_TT_INTEGER: freq = mrbc_integer(v[2]); break;
+  case MRBC_TT_FLOAT:	freq = mrbc_float(v[2]);   break;
+  default: goto ERROR_RETURN;
+  }
+  if( n <= 0 || n > 0xffff || freq == 0 || freq > ADC_SCAN_MAX_FREQ ) {
+    goto ERROR_RETURN;
+  }
+  if( adc_scan.n_ch ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "ADC is in scan mode.");
+    return;
+  }
+
+  // Acquire the ADC, or take the result of sampling.
+  int sts = adc_block_acquire( vm );
+  if( sts == ADC_BLOCK_BUSY ) return;	// will be called again.
+  if( sts != ADC_BLOCK_IDLE ) {
+    mrbc_value ret = adc_block.ret;
+    adc_block_release();
+    if( sts == ADC_BLOCK_ERROR ) {
+      mrbc_decref( &ret );
+      mrbc_raisef(vm, 0, "HAL layer error (error code %d)", (int)adc_block.error);
+      return;
+    }
+    SET_RETURN(ret);
+    return;
+  }
+
+  mrbc_value ret;
+  uint16_t *buf;
+  if( ta ) {
+    ret = v[1];
+    mrbc_incref( &ret );
+    buf = typed_array_data(ta);
+  } else {
+    ret = mrbc_string_new(vm, 0, n * sizeof(uint16_t));
+    buf = (uint16_t *)mrbc_string_cstr(&ret);
+    if( buf ) mrbc_alloc_compact_remove( &ret.string->data );	// by DMA.
+  }
+  if( !buf ) {
+    adc_block_release();
+    return;		// ENOMEM
+  }
+
+  int idx = *((int *)(v[0].instance->data));
+  ADC_ChannelConfTypeDef sConfig = {
+    .Channel = TBL_ADC_CHANNELS[idx].channel,
+    .Rank = 1,
+    .SamplingTime = adc_sample_time_[idx],
+  };
+  adc_block.ret = ret;
+  if( adc_configure( 1, ADC_EXTERNALTRIGCONV_T5_CC1 ) != 0 ||
+      HAL_ADC_ConfigChannel(&hadc1, &sConfig) != HAL_OK ||
+      HAL_ADC_Start_DMA(&hadc1, (uint32_t *)buf, n) != HAL_OK ||
+      adc_trigger_start( freq ) != 0 ) {
+    HAL_TIM_PWM_Stop(&htim5, TIM_CHANNEL_1);
+    HAL_ADC_Stop_DMA(&hadc1);
+    adc_configure( 0, 0 );
+    adc_block_release();
+    mrbc_decref( &ret );
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "ADC sampling start failed.");
+    return;
+  }
+
+  // wait in other task running.
+  hal_disable_irq();
+  if( adc_block.state == ADC_BLOCK_BUSY ) {
+    mrbc_wait_io( VM2TCB(vm), &hadc1 );
+  }
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+  return;		// will be called again.
 
-  SET_INT_RETURN( raw_val );
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
 }
 
 
+//================================================================
+/*! start scan mode (class method)
+
+  ADC.start_scan( freq, adc0, adc1, ... )
+  ADC.start_scan( freq, 0, 1, ... )
+  ADC.start_scan( pwm, adc0, adc1, ... )
+  ADC.start_scan( [pwm, ticks], adc0, adc1, ... )
+
+  Convert the given channels as one sequence, freq times per second.
+  If a running PWM is given, one sequence is converted in every period
+  of it, at the counter value ticks or in the middle of the pulse.
+*/
+static void c_adc_start_scan(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int idx[sizeof(adc_scan.rank)];
+  uint32_t freq = 0;
+  mrbc_value pwm = v[1];
+  int ticks = -1;
+
+  if( argc < 2 || argc - 1 > NUM_TBL_ADC_CHANNELS ) goto ERROR_RETURN;
+  if( v[1].tt == MRBC_TT_ARRAY ) {
+    if( mrbc_array_size(&v[1]) != 2 ) goto ERROR_RETURN;
+    pwm = mrbc_array_get(&v[1], 0);
+    mrbc_value t = mrbc_array_get(&v[1], 1);
+    if( t.tt != MRBC_TT_INTEGER || mrbc_integer(t) < 0 ) goto ERROR_RETURN;
+    ticks = mrbc_integer(t);
+  }
+  switch( pwm.tt ) {
+  case MRBC_TT_INTEGER: freq = mrbc_integer(pwm); break;
+  case MRBC_TT_FLOAT:	freq = mrbc_float(pwm);   break;
+  case MRBC_TT_OBJECT:
+    if( pwm_adc_trigger_source( &pwm, ADC_SCAN_MAX_FREQ ) == 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), "PWM is not running or too fast.");
+      return;
+    }
+    break;
+  default: goto ERROR_RETURN;
+  }
+  if( pwm.tt != MRBC_TT_OBJECT &&
+      (ticks >= 0 || freq == 0 || freq > ADC_SCAN_MAX_FREQ) ) goto ERROR_RETURN;
+
+  for( int i = 0; i < argc - 1; i++ ) {
+    mrbc_value *arg = &v[i+2];
+    if( arg->tt == MRBC_TT_INTEGER ) {
+      idx[i] = mrbc_integer(*arg);
+      if( idx[i] < 0 || idx[i] >= NUM_TBL_ADC_CHANNELS ) goto ERROR_RETURN;
+      PIN_HANDLE pin = TBL_ADC_CHANNELS[idx[i]].pin;
+      gpio_setmode( &pin, GPIO_ANALOG|GPIO_IN );
+    } else if( arg->tt == MRBC_TT_OBJECT && arg->instance->cls == v[0].cls ) {
+      idx[i] = *((int *)(arg->instance->data));
+    } else {
+      goto ERROR_RETURN;
+    }
+    for( int j = 0; j < i; j++ ) {
+      if( idx[j] == idx[i] ) goto ERROR_RETURN;
+    }
+  }
+
+  if( adc_block.state == ADC_BLOCK_BUSY ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "ADC is in block sampling.");
+    return;
+  }
+  if( adc_scan_start( idx, argc - 1, freq,
+		      pwm.tt == MRBC_TT_OBJECT ? &pwm : NULL, ticks ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "ADC scan start failed.");
+  }
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! stop scan mode (class method)
+
+  ADC.stop_scan()
+*/
+static void c_adc_stop_scan(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  adc_scan_stop();
+}
+
+
+//================================================================
+/*! read latest values of all scanned channels (class method)
+
+  ADC.read_latest() -> Array[Integer] or nil
+
+  Values are in the order given to start_scan.
+*/
+static void c_adc_read_latest(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  uint32_t cnt;
+  if( adc_scan.n_ch == 0 || (cnt = adc_scan_wr_cnt()) == 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  cnt = (cnt - adc_scan.n_ch) % adc_scan.len;
+  mrbc_value ret = mrbc_array_new(vm, adc_scan.n_ch);
+  for( int i = 0; i < adc_scan.n_ch; i++ ) {
+    mrbc_array_push( &ret, &mrbc_integer_value(adc_scan_buf[cnt + i]) );
+  }
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! read block of samples (class method)
+
+  ADC.read_scan( max_sets = nil ) -> Array[Integer] or nil
+
+  Returns samples converted since the previous call, interleaved in
+  the order given to start_scan. If the reader fell behind by more
+  than the ring buffer, older samples are dropped.
+*/
+static void c_adc_read_scan(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( adc_scan.n_ch == 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  uint32_t wr_cnt = adc_scan_wr_cnt();
+  uint32_t n = wr_cnt - adc_scan.rd_cnt;
+  uint32_t limit = adc_scan.len - adc_scan.n_ch;
+
+  if( argc >= 1 && v[1].tt == MRBC_TT_INTEGER && mrbc_integer(v[1]) >= 0 &&
+      mrbc_integer(v[1]) * adc_scan.n_ch < limit ) {
+    limit = mrbc_integer(v[1]) * adc_scan.n_ch;
+  }
+  if( n > adc_scan.len - adc_scan.n_ch ) {
+    adc_scan.rd_cnt = wr_cnt - (adc_scan.len - adc_scan.n_ch);
+    n = adc_scan.len - adc_scan.n_ch;
+  }
+  if( n > limit ) n = limit;
+
+  mrbc_value ret = mrbc_array_new(vm, n);
+  uint32_t pos = adc_scan.rd_cnt % adc_scan.len;
+  for( uint32_t i = 0; i < n; i++ ) {
+    mrbc_array_push( &ret, &mrbc_integer_value(adc_scan_buf[pos]) );
+    if( ++pos >= adc_scan.len ) pos = 0;
+  }
+  adc_scan.rd_cnt += n;
+
+  SET_RETURN(ret);
+}
+
+
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("ADC")
+  FILE("_autogen_class_adc.h")
+
+  METHOD( "new",		c_adc_new )
+  METHOD( "read_voltage",	c_adc_read_voltage )
+  METHOD( "read",		c_adc_read_voltage )
+  METHOD( "read_raw",		c_adc_read_raw )
+  METHOD( "read_samples",	c_adc_read_samples )
+  METHOD( "sample_time=",	c_adc_set_sample_time )
+  METHOD( "sample_time",	c_adc_sample_time )
+  METHOD( "start_scan",		c_adc_start_scan )
+  METHOD( "stop_scan",		c_adc_stop_scan )
+  METHOD( "read_latest",	c_adc_read_latest )
+  METHOD( "read_scan",		c_adc_read_scan )
+*/
+#include "_autogen_class_adc.h"
+
+
 //================================================================
 /*! Initializer
 */
 void mrbc_init_class_adc(void)
 {
-  mrbc_class *cls = mrbc_define_class(0, "ADC", 0);
+  mrbc_class *cls = MRBC_CLASS(ADC);
+  mrbc_set_const( MRBC_SYM(ADC), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
 
-  mrbc_define_method(0, cls, "new", c_adc_new);
-  mrbc_define_method(0, cls, "read_voltage", c_adc_read_voltage);
-  mrbc_define_method(0, cls, "read", c_adc_read_voltage);
-  mrbc_define_method(0, cls, "read_raw", c_adc_read_raw);
 }
@@ -0,0 +1,445 @@
+/*! @file
+  @brief
+  InputCapture class. Period and pulse width measurement by timer.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The timer runs in PWM input mode: the rising edge of TI1 captures
+  the period into CCR1 and resets the counter, and the falling edge
+  captures the high width into CCR2. Each capture of CCR1 requests a
+  DMA burst of CCR1 and CCR2 through DMAR into a ring buffer, so that
+  no CPU time is spent per edge.
+  </pre>
+*/
+
+//@cond
+#include <stddef.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_gpio.h"
+
+extern TIM_HandleTypeDef htim1;
+extern TIM_HandleTypeDef htim3;
+
+// the timer clock is HCLK, 84MHz at the full speed. (see stm32f4_clock.c)
+#define CAPTURE_TIMER_FREQ SystemCoreClock
+
+//! number of (period, width) pairs in the ring buffer.
+#define CAPTURE_RING_SIZE 32
+
+//! maximum prescaler, that keeps the result in ns in 31 bits.
+#define CAPTURE_PRESCALER_MAX 2048
+
+int pwm_find_pin_assign( const PIN_HANDLE *pin, int *unit_num, int *channel );
+
+/*
+  capture unit table.
+
+  Only the channel 1 (TI1) can be used, for the PWM input mode.
+  TIM2_CH1 and TIM4_CH1 are not here, because their DMA streams are
+  used by USART2_RX and I2C1_RX.
+*/
+static struct CAPTURE_UNIT {
+  uint8_t unit_num;		//!< timer unit number.
+  uint8_t dma_channel;		//!< DMA request channel.
+  uint8_t flag_shift;		//!< bit position of the stream in ISR/IFCR.
+  TIM_HandleTypeDef *htim;	//!< timer.
+  DMA_Stream_TypeDef *stream;	//!< DMA stream.
+  volatile uint32_t *isr;	//!< DMA interrupt status register.
+  volatile uint32_t *ifcr;	//!< DMA interrupt flag clear register.
+  IRQn_Type irqn;		//!< DMA stream IRQ number.
+} const CAPTURE_UNIT[] = {
+  { 1, 6, 22, &htim1, DMA2_Stream3, &DMA2->LISR, &DMA2->LIFCR, DMA2_Stream3_IRQn },
+  { 3, 5,  0, &htim3, DMA1_Stream4, &DMA1->HISR, &DMA1->HIFCR, DMA1_Stream4_IRQn },
+};
+#define NUM_CAPTURE_UNIT (sizeof(CAPTURE_UNIT)/sizeof(CAPTURE_UNIT[0]))
+
+//! flags of a stream in ISR/IFCR, from the bit position.
+#define CAPTURE_DMA_FLAGS	0x3d
+#define CAPTURE_DMA_TCIF	0x20
+#define CAPTURE_DMA_TEIF	0x08
+
+/*!
+  capture state of a unit.
+*/
+static struct CAPTURE_STATE {
+  uint8_t flag_in_use;		//!< used by an instance.
+  volatile uint8_t flag_error;	//!< DMA transfer error.
+  uint16_t psc;			//!< value in the PSC register.
+  volatile uint32_t laps;	//!< count of completed DMA laps.
+  struct {
+    uint32_t cr1, ccmr1, ccer, smcr, dier, dcr, psc, arr;
+  } saved;			//!< timer registers before the capture.
+  uint16_t buf[CAPTURE_RING_SIZE][2];	//!< (period, width) in ticks.
+} capture_state_[NUM_CAPTURE_UNIT];
+
+/*!
+  InputCapture handle
+*/
+typedef struct CAPTURE_HANDLE {
+  PIN_HANDLE pin;	//!< pin
+  uint8_t idx;		//!< index of CAPTURE_UNIT.
+  uint8_t flag_running;	//!< the timer is used by this instance.
+} CAPTURE_HANDLE;
+
+
+//================================================================
+/*! start the capture.
+*/
+static void capture_start( int idx )
+{
+  const struct CAPTURE_UNIT *unit = &CAPTURE_UNIT[idx];
+  struct CAPTURE_STATE *st = &capture_state_[idx];
+  TIM_TypeDef *tim = unit->htim->Instance;
+
+  st->saved.cr1 = tim->CR1;
+  tim->CR1 &= ~TIM_CR1_CEN;
+  st->saved.ccmr1 = tim->CCMR1;
+  st->saved.ccer = tim->CCER;
+  st->saved.smcr = tim->SMCR;
+  st->saved.dier = tim->DIER;
+  st->saved.dcr = tim->DCR;
+  st->saved.psc = tim->PSC;
+  st->saved.arr = tim->ARR;
+
+  // IC1 on TI1 rising, IC2 on TI1 falling, reset by TI1FP1.
+  tim->DIER = 0;
+  tim->CCER &= ~(TIM_CCER_CC1E | TIM_CCER_CC1P | TIM_CCER_CC1NP |
+		 TIM_CCER_CC2E | TIM_CCER_CC2P | TIM_CCER_CC2NP);
+  tim->CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_CC2S_1;
+  tim->CCER |= TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC2P;
+  tim->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_0 | TIM_SMCR_SMS_2;
+  tim->PSC = st->psc;
+  tim->ARR = 0xffff;
+  tim->EGR = TIM_EGR_UG;
+  tim->DCR = (1 << TIM_DCR_DBL_Pos) |
+	     ((offsetof(TIM_TypeDef, CCR1) / 4) << TIM_DCR_DBA_Pos);
+
+  unit->stream->CR = 0;
+  while( unit->stream->CR & DMA_SxCR_EN )
+    ;
+  *unit->ifcr = CAPTURE_DMA_FLAGS << unit->flag_shift;
+  unit->stream->PAR = (uint32_t)&tim->DMAR;
+  unit->stream->M0AR = (uint32_t)st->buf;
+  unit->stream->NDTR = CAPTURE_RING_SIZE * 2;
+  unit->stream->FCR = 0;		// direct mode.
+  unit->stream->CR = (unit->dma_channel << DMA_SxCR_CHSEL_Pos) |
+		     DMA_SxCR_PL_0 | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 |
+		     DMA_SxCR_MINC | DMA_SxCR_CIRC |
+		     DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+
+  st->laps = 0;
+  st->flag_error = 0;
+  HAL_NVIC_SetPriority( unit->irqn, 0, 0 );
+  HAL_NVIC_EnableIRQ( unit->irqn );
+  unit->stream->CR |= DMA_SxCR_EN;
+  tim->DIER = TIM_DIER_CC1DE;
+  tim->CR1 |= TIM_CR1_CEN;
+}
+
+
+//================================================================
+/*! stop the capture, and restore the timer.
+*/
+static void capture_stop( int idx )
+{
+  const struct CAPTURE_UNIT *unit = &CAPTURE_UNIT[idx];
+  struct CAPTURE_STATE *st = &capture_state_[idx];
+  TIM_TypeDef *tim = unit->htim->Instance;
+
+  tim->CR1 &= ~TIM_CR1_CEN;
+  tim->DIER = 0;
+  unit->stream->CR &= ~DMA_SxCR_EN;
+  HAL_NVIC_DisableIRQ( unit->irqn );
+
+  tim->CCER &= ~(TIM_CCER_CC1E | TIM_CCER_CC2E);
+  tim->CCMR1 = st->saved.ccmr1;
+  tim->CCER = st->saved.ccer;
+  tim->SMCR = st->saved.smcr;
+  tim->DCR = st->saved.dcr;
+  tim->PSC = st->saved.psc;
+  tim->ARR = st->saved.arr;
+  tim->EGR = TIM_EGR_UG;
+  tim->DIER = st->saved.dier;
+  tim->CR1 = st->saved.cr1;
+
+  st->flag_in_use = 0;
+}
+
+
+//================================================================
+/*! get the number of pairs captured so far.
+*/
+static uint32_t capture_count( int idx )
+{
+  const struct CAPTURE_UNIT *unit = &CAPTURE_UNIT[idx];
+  struct CAPTURE_STATE *st = &capture_state_[idx];
+
+  hal_disable_irq();
+  uint32_t laps = st->laps;
+  uint32_t pos = CAPTURE_RING_SIZE * 2 - unit->stream->NDTR;
+  // the counter has wrapped but the TC interrupt is not serviced yet.
+  if( (*unit->isr & (CAPTURE_DMA_TCIF << unit->flag_shift)) &&
+      pos < CAPTURE_RING_SIZE ) laps++;
+  hal_enable_irq();
+
+  return laps * CAPTURE_RING_SIZE + pos / 2;	// a half pair is in burst.
+}
+
+
+//================================================================
+/*! DMA interrupt handler.
+*/
+static void capture_dma_irq( int idx )
+{
+  const struct CAPTURE_UNIT *unit = &CAPTURE_UNIT[idx];
+  uint32_t sts = *unit->isr >> unit->flag_shift;
+  *unit->ifcr = CAPTURE_DMA_FLAGS << unit->flag_shift;
+
+  if( sts & CAPTURE_DMA_TEIF ) capture_state_[idx].flag_error = 1;
+  if( sts & CAPTURE_DMA_TCIF ) capture_state_[idx].laps++;
+}
+
+void DMA2_Stream3_IRQHandler(void)
+{
+  MRBC_ISR_ENTER(); capture_dma_irq( 0 ); MRBC_ISR_EXIT();
+}
+
+void DMA1_Stream4_IRQHandler(void)
+{
+  MRBC_ISR_ENTER(); capture_dma_irq( 1 ); MRBC_ISR_EXIT();
+}
+
+
+//================================================================
+/*! convert the sum of n ticks to the average in ns.
+*/
+static mrbc_int_t capture_ticks_to_ns( int idx, uint32_t sum, int n )
+{
+  uint64_t div = (uint64_t)CAPTURE_TIMER_FREQ * n;
+  return ((uint64_t)sum * (capture_state_[idx].psc + 1) * 1000000000 + div/2)
+	 / div;
+}
+
+
+//================================================================
+/*! get the average of the latest pairs in ns.
+
+  @param  idx	index of CAPTURE_UNIT.
+  @param  n	number of pairs.
+  @param  ret	(out) period and width.
+  @return	number of pairs averaged. 0 if no pair.
+  @note	The first pair is not used, because its period is not from an edge.
+*/
+static int capture_average( int idx, int n, mrbc_int_t ret[2] )
+{
+  struct CAPTURE_STATE *st = &capture_state_[idx];
+  uint32_t cnt = capture_count( idx );
+
+  if( cnt <= 1 || st->flag_error ) return 0;
+  if( n > cnt - 1 ) n = cnt - 1;
+
+  uint32_t sum[2] = {0, 0};
+  for( int i = 1; i <= n; i++ ) {
+    const uint16_t *p = st->buf[(cnt - i) % CAPTURE_RING_SIZE];
+    sum[0] += p[0];
+    sum[1] += p[1];
+  }
+  ret[0] = capture_ticks_to_ns( idx, sum[0], n );
+  ret[1] = capture_ticks_to_ns( idx, sum[1], n );
+
+  return n;
+}
+
+
+//================================================================
+/*! constructor
+
+  ic = InputCapture.new("PA6")			# 11.9ns, up to 780us.
+  ic = InputCapture.new("PA6", prescaler:84 )	# 1us, up to 65ms.
+
+  @note
+    PA8 (TIM1) and PA6, PB4 (TIM3) can be used.
+    The timer can't be used by PWM while capturing.
+*/
+static void c_capture_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  MRBC_KW_ARG(prescaler);
+  if( !MRBC_KW_END() ) goto RETURN;
+  if( MRBC_KW_NARGC() != 1 ) goto ERROR_RETURN;
+
+  PIN_HANDLE pin;
+  int unit_num, channel;
+  if( gpio_set_pin_handle( &pin, &v[1] ) != 0 ) goto ERROR_RETURN;
+  if( pwm_find_pin_assign( &pin, &unit_num, &channel ) != 0 ) goto ERROR_RETURN;
+  if( channel != 1 ) goto ERROR_RETURN;
+
+  int idx;
+  for( idx = 0; idx < NUM_CAPTURE_UNIT; idx++ ) {
+    if( CAPTURE_UNIT[idx].unit_num == unit_num ) break;
+  }
+  if( idx == NUM_CAPTURE_UNIT ) goto ERROR_RETURN;
+
+  int psc = 1;
+  if( MRBC_KW_ISVALID(prescaler) ) {
+    if( prescaler.tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    psc = mrbc_integer(prescaler);
+    if( psc < 1 || psc > CAPTURE_PRESCALER_MAX ) goto ERROR_RETURN;
+  }
+
+  struct CAPTURE_STATE *st = &capture_state_[idx];
+  if( st->flag_in_use ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "InputCapture timer in use");
+    goto RETURN;
+  }
+
+  v[0] = mrbc_instance_new(vm, v[0].cls, sizeof(CAPTURE_HANDLE));
+  CAPTURE_HANDLE *h = (CAPTURE_HANDLE *)v[0].instance->data;
+  h->pin = pin;
+  h->idx = idx;
+  h->flag_running = 1;
+
+  st->flag_in_use = 1;
+  st->psc = psc - 1;
+  gpio_setmode_pwm( &pin, unit_num );
+  capture_start( idx );
+  goto RETURN;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), "InputCapture initialize.");
+
+ RETURN:
+  MRBC_KW_DELETE(prescaler);
+}
+
+
+//================================================================
+/*! latest period in ns.
+
+  ic.period	# -> Integer, or nil if not captured yet.
+*/
+static void c_capture_period(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  CAPTURE_HANDLE *h = (CAPTURE_HANDLE *)v[0].instance->data;
+  mrbc_int_t ret[2];
+
+  if( capture_average( h->idx, 1, ret ) == 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+  SET_INT_RETURN( ret[0] );
+}
+
+
+//================================================================
+/*! high width of the latest period in ns.
+
+  ic.width	# -> Integer, or nil if not captured yet.
+*/
+static void c_capture_width(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  CAPTURE_HANDLE *h = (CAPTURE_HANDLE *)v[0].instance->data;
+  mrbc_int_t ret[2];
+
+  if( capture_average( h->idx, 1, ret ) == 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+  SET_INT_RETURN( ret[1] );
+}
+
+
+//================================================================
+/*! average of the latest periods and widths in ns.
+
+  period, width = ic.average( 16 )
+
+  @param  n	number of periods, up to the ring buffer size. (32)
+  @return	[period, width], or nil if not captured yet.
+*/
+static void c_capture_average(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  CAPTURE_HANDLE *h = (CAPTURE_HANDLE *)v[0].instance->data;
+  int n = CAPTURE_RING_SIZE / 2;
+
+  if( argc >= 1 ) {
+    if( v[1].tt != MRBC_TT_INTEGER || mrbc_integer(v[1]) < 1 ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+      return;
+    }
+    n = mrbc_integer(v[1]);
+  }
+  // keep the oldest few entries, that DMA may be writing.
+  if( n > CAPTURE_RING_SIZE - 2 ) n = CAPTURE_RING_SIZE - 2;
+
+  mrbc_int_t val[2];
+  if( capture_average( h->idx, n, val ) == 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  mrbc_value ret = mrbc_array_new(vm, 2);
+  mrbc_array_push( &ret, &mrbc_integer_value(val[0]) );
+  mrbc_array_push( &ret, &mrbc_integer_value(val[1]) );
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! number of periods captured.
+
+  ic.count	# -> Integer
+*/
+static void c_capture_count(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  CAPTURE_HANDLE *h = (CAPTURE_HANDLE *)v[0].instance->data;
+  uint32_t cnt = capture_count( h->idx );
+
+  SET_INT_RETURN( cnt ? cnt - 1 : 0 );
+}
+
+
+//================================================================
+/*! stop the capture, and release the timer.
+
+  ic.stop
+*/
+static void c_capture_stop(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  CAPTURE_HANDLE *h = (CAPTURE_HANDLE *)v[0].instance->data;
+
+  if( !h->flag_running ) return;
+  h->flag_running = 0;
+  capture_stop( h->idx );
+}
+
+
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("InputCapture")
+  FILE("_autogen_class_capture.h")
+
+  METHOD( "period",		c_capture_period )
+  METHOD( "width",		c_capture_width )
+  METHOD( "average",		c_capture_average )
+  METHOD( "count",		c_capture_count )
+  METHOD( "stop",		c_capture_stop )
+*/
+#include "_autogen_class_capture.h"
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_input_capture(void)
+{
+  mrbc_class *cls = MRBC_CLASS(InputCapture);
+  mrbc_set_const( MRBC_SYM(InputCapture), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
+
+  mrbc_define_method_kw(0, cls, "new", c_capture_new);
+}
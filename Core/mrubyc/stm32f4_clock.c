@@ -0,0 +1,250 @@
+/*! @file
+  @brief
+  System clock scaling, and the System class.
+
+  HCLK is SYSCLK (84MHz) divided by the AHB prescaler, 2^level. The PLL
+  is not touched, so the USB clock is kept. APB1 is HCLK/2 and APB2 is
+  HCLK as before, so all the timer clocks are the same as HCLK.
+
+  At the change, SysTick, the flash wait states, the UART baud rates
+  and the running PWM are set again for the new clock. The other
+  peripherals compute their dividers by the clock at the setup, so
+  I2C and SPI run slower until they are set up again, and GPIO.play_port,
+  InputCapture and ADC sampling by the timer should be restarted.
+
+  <pre>
+  An implementation of common peripheral I/O API for mruby/c.
+  https://github.com/mruby/microcontroller-peripheral-interface-guide
+
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_uart.h"
+
+void pwm_clock_changed( uint32_t old_hz, uint32_t new_hz );
+
+//! AHB prescaler and the flash wait states at 3.3V, of each level.
+static uint32_t const TBL_HPRE[MRBC_CLOCK_LEVELS] = {
+  RCC_SYSCLK_DIV1, RCC_SYSCLK_DIV2, RCC_SYSCLK_DIV4,
+#if MRBC_CLOCK_LEVELS > 3
+  RCC_SYSCLK_DIV8,
+#endif
+};
+static uint32_t const TBL_FLASH_LATENCY[MRBC_CLOCK_LEVELS] = {
+  FLASH_LATENCY_2, FLASH_LATENCY_1, FLASH_LATENCY_0,
+#if MRBC_CLOCK_LEVELS > 3
+  FLASH_LATENCY_0,
+#endif
+};
+
+static int clock_level_;
+
+//! task and the event bits, notified at the low memory.
+static mrbc_tcb *low_memory_task_;
+static uint32_t low_memory_bits_;
+
+#if defined(MRBC_STACK_CHECK) && defined(MRBC_METRICS)
+static uint32_t stack_metric_read( const mrbc_metric *m )
+{
+  return hal_stack_max_used();
+}
+static mrbc_metric metric_stack_used_ =
+  MRBC_METRIC_READER("sys.stack_used", MRBC_METRIC_GAUGE, stack_metric_read, 0);
+#endif
+
+
+//================================================================
+/*! HAL: change the clock level.
+
+  @param  level	0: full speed .. MRBC_CLOCK_LEVELS-1
+  @note	The UART bytes in the FIFOs are sent out before the change,
+	but a byte in reception may be broken.
+*/
+void hal_clock_set_level( int level )
+{
+  if( level < 0 ) level = 0;
+  if( level >= MRBC_CLOCK_LEVELS ) level = MRBC_CLOCK_LEVELS - 1;
+  if( level == clock_level_ ) return;
+
+  uart_flush_all();
+
+  uint32_t old_hz = SystemCoreClock;
+  RCC_ClkInitTypeDef clk = {
+    .ClockType = RCC_CLOCKTYPE_HCLK,
+    .AHBCLKDivider = TBL_HPRE[level],
+  };
+
+  hal_disable_irq();
+  // SystemCoreClock and SysTick are updated by HAL_InitTick() in this.
+  HAL_RCC_ClockConfig( &clk, TBL_FLASH_LATENCY[level] );
+  clock_level_ = level;
+
+  uart_clock_changed();
+  pwm_clock_changed( old_hz, SystemCoreClock );
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! HAL: get the clock level.
+*/
+int hal_clock_get_level( void )
+{
+  return clock_level_;
+}
+
+
+//================================================================
+/*! low memory hook, called in the allocator.
+*/
+static void low_memory_hook( unsigned int free_size )
+{
+  if( low_memory_task_ ) {
+    mrbc_task_notify_from_isr( low_memory_task_, low_memory_bits_ );
+  }
+}
+
+
+//================================================================
+/*! get the CPU clock in Hz.
+
+  System.clock		# -> Integer
+*/
+static void c_system_clock(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SET_INT_RETURN( SystemCoreClock );
+}
+
+
+//================================================================
+/*! set the CPU clock.
+
+  System.clock = 21_000_000	# the slowest clock not below it.
+  System.clock = nil		# let the governor decide it.
+
+  The clock fixed by this is kept until nil is given, even with the
+  governor. (MRBC_CLOCK_GOVERNOR)
+*/
+static void c_system_set_clock(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 ) goto ERROR_RETURN;
+
+  if( mrbc_type(v[1]) == MRBC_TT_NIL ) {
+#if defined(MRBC_CLOCK_GOVERNOR)
+    mrbc_clock_governor_hold( 0 );
+#else
+    hal_clock_set_level( 0 );
+#endif
+    return;
+  }
+  if( mrbc_type(v[1]) != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+
+  uint32_t sysclk = HAL_RCC_GetSysClockFreq();
+  mrbc_int_t hz = mrbc_integer(v[1]);
+  if( hz <= 0 || (uint32_t)hz > sysclk ) goto ERROR_RETURN;
+
+  int level = 0;
+  while( level < MRBC_CLOCK_LEVELS-1 && (sysclk >> (level+1)) >= (uint32_t)hz ) {
+    level++;
+  }
+
+#if defined(MRBC_CLOCK_GOVERNOR)
+  mrbc_clock_governor_hold( 1 );
+#endif
+  hal_clock_set_level( level );
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! notify the current task at the low memory.
+
+  System.notify_low_memory( 4096, 0x01 )	# below 4096 bytes free.
+  Task.wait_event( 0x01 )			# and release the caches.
+  System.notify_low_memory( nil )		# stop it.
+
+  The task is notified when the free memory goes below the threshold,
+  (once, until it is back to the threshold) and at the out of memory.
+  Only one task can be set, and it must stop this before it ends.
+*/
+static void c_system_notify_low_memory(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc == 1 && mrbc_type(v[1]) == MRBC_TT_NIL ) {
+    mrbc_alloc_set_low_memory_hook( 0, 0 );
+    low_memory_task_ = 0;
+    return;
+  }
+
+  if( argc != 2 || mrbc_type(v[1]) != MRBC_TT_INTEGER ||
+      mrbc_type(v[2]) != MRBC_TT_INTEGER || mrbc_integer(v[1]) <= 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  low_memory_task_ = VM2TCB(vm);
+  low_memory_bits_ = mrbc_integer(v[2]);
+  mrbc_alloc_set_low_memory_hook( low_memory_hook, mrbc_integer(v[1]) );
+}
+
+
+#if defined(MRBC_STACK_CHECK)
+//================================================================
+/*! get the maximum usage of the main stack since the boot.
+
+  System.stack_used	# -> Integer (bytes)
+*/
+static void c_system_stack_used(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SET_INT_RETURN( hal_stack_max_used() );
+}
+
+
+//================================================================
+/*! get the size of the main stack, without the guard.
+
+  System.stack_size	# -> Integer (bytes)
+*/
+static void c_system_stack_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SET_INT_RETURN( hal_stack_size() );
+}
+#endif
+
+
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("System")
+  FILE("_autogen_class_clock.h")
+
+  METHOD( "clock",		c_system_clock )
+  METHOD( "clock=",		c_system_set_clock )
+  METHOD( "notify_low_memory",	c_system_notify_low_memory )
+#if defined(MRBC_STACK_CHECK)
+  METHOD( "stack_used",		c_system_stack_used )
+  METHOD( "stack_size",		c_system_stack_size )
+#endif
+*/
+#include "_autogen_class_clock.h"
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_system(void)
+{
+  mrbc_class *cls = MRBC_CLASS(System);
+  mrbc_set_const( MRBC_SYM(System), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
+
+#if defined(MRBC_STACK_CHECK) && defined(MRBC_METRICS)
+  mrbc_metric_register( &metric_stack_used_ );
+#endif
+}
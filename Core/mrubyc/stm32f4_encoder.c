@@ -0,0 +1,337 @@
+/*! @file
+  @brief
+  Encoder class. Quadrature encoder by the timer encoder mode.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The counter of the timer counts the edges of TI1 and TI2 up and down.
+  TIM2 has a 32bit counter, and the position is read from it at once.
+  The 16bit counter of TIM3 is extended to 32bit by the update
+  interrupt at the overflow and the underflow.
+  </pre>
+*/
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_gpio.h"
+
+extern TIM_HandleTypeDef htim2;
+extern TIM_HandleTypeDef htim3;
+
+int pwm_find_pin_assign( const PIN_HANDLE *pin, int *unit_num, int *channel );
+
+/*
+  encoder unit table.
+
+  TIM4 is not here, because it is the sampling timer of the profiler,
+  and PB7 (TIM4_CH2) is not in the PWM pin table.
+*/
+static struct ENCODER_UNIT {
+  uint8_t unit_num;		//!< timer unit number.
+  uint8_t flag_32bit;		//!< the counter is in 32bit.
+  TIM_HandleTypeDef *htim;	//!< timer.
+  IRQn_Type irqn;		//!< timer IRQ number.
+} const ENCODER_UNIT[] = {
+  { 2, 1, &htim2, TIM2_IRQn },
+  { 3, 0, &htim3, TIM3_IRQn },
+};
+#define NUM_ENCODER_UNIT (sizeof(ENCODER_UNIT)/sizeof(ENCODER_UNIT[0]))
+
+/*!
+  encoder state of a unit.
+*/
+static struct ENCODER_STATE {
+  uint8_t flag_in_use;		//!< used by an instance.
+  volatile int16_t high;	//!< upper 16 bits of the 16bit counter.
+  struct {
+    uint32_t cr1, ccmr1, ccer, smcr, dier, psc, arr, cnt;
+  } saved;			//!< timer registers before the encoder.
+} encoder_state_[NUM_ENCODER_UNIT];
+
+/*!
+  Encoder handle
+*/
+typedef struct ENCODER_HANDLE {
+  uint8_t idx;		//!< index of ENCODER_UNIT.
+  uint8_t flag_running;	//!< the timer is used by this instance.
+} ENCODER_HANDLE;
+
+
+//================================================================
+/*! start the encoder mode.
+
+  @param  idx	index of ENCODER_UNIT.
+  @param  sms	slave mode, 1 (x2, TI1 edges) or 3 (x4, TI1 and TI2 edges).
+*/
+static void encoder_start( int idx, int sms )
+{
+  const struct ENCODER_UNIT *unit = &ENCODER_UNIT[idx];
+  struct ENCODER_STATE *st = &encoder_state_[idx];
+  TIM_TypeDef *tim = unit->htim->Instance;
+
+  st->saved.cr1 = tim->CR1;
+  tim->CR1 &= ~TIM_CR1_CEN;
+  st->saved.ccmr1 = tim->CCMR1;
+  st->saved.ccer = tim->CCER;
+  st->saved.smcr = tim->SMCR;
+  st->saved.dier = tim->DIER;
+  st->saved.psc = tim->PSC;
+  st->saved.arr = tim->ARR;
+  st->saved.cnt = tim->CNT;
+
+  // IC1 on TI1, IC2 on TI2, filtered by 8 samples at fCK_INT.
+  tim->DIER = 0;
+  tim->CCER &= ~(TIM_CCER_CC1E | TIM_CCER_CC1P | TIM_CCER_CC1NP |
+		 TIM_CCER_CC2E | TIM_CCER_CC2P | TIM_CCER_CC2NP);
+  tim->CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_CC2S_0 |
+	       (3 << TIM_CCMR1_IC1F_Pos) | (3 << TIM_CCMR1_IC2F_Pos);
+  tim->SMCR = sms << TIM_SMCR_SMS_Pos;
+  tim->PSC = 0;
+  tim->ARR = unit->flag_32bit ? 0xffffffff : 0xffff;
+  tim->EGR = TIM_EGR_UG;
+  tim->CNT = 0;
+  st->high = 0;
+
+  if( !unit->flag_32bit ) {
+    tim->SR = ~(uint32_t)TIM_SR_UIF;
+    tim->CR1 |= TIM_CR1_URS;		// UIF only by the counter.
+    tim->DIER = TIM_DIER_UIE;
+    HAL_NVIC_SetPriority( unit->irqn, 0, 0 );
+    HAL_NVIC_EnableIRQ( unit->irqn );
+  }
+  tim->CR1 |= TIM_CR1_CEN;
+}
+
+
+//================================================================
+/*! stop the encoder mode, and restore the timer.
+*/
+static void encoder_stop( int idx )
+{
+  const struct ENCODER_UNIT *unit = &ENCODER_UNIT[idx];
+  struct ENCODER_STATE *st = &encoder_state_[idx];
+  TIM_TypeDef *tim = unit->htim->Instance;
+
+  tim->CR1 &= ~TIM_CR1_CEN;
+  tim->DIER = 0;
+  HAL_NVIC_DisableIRQ( unit->irqn );
+
+  tim->CCMR1 = st->saved.ccmr1;
+  tim->CCER = st->saved.ccer;
+  tim->SMCR = st->saved.smcr;
+  tim->PSC = st->saved.psc;
+  tim->ARR = st->saved.arr;
+  tim->EGR = TIM_EGR_UG;
+  tim->CNT = st->saved.cnt;
+  tim->SR = 0;
+  tim->DIER = st->saved.dier;
+  tim->CR1 = st->saved.cr1;
+
+  st->flag_in_use = 0;
+}
+
+
+//================================================================
+/*! read the position.
+*/
+static int32_t encoder_read( int idx )
+{
+  const struct ENCODER_UNIT *unit = &ENCODER_UNIT[idx];
+  TIM_TypeDef *tim = unit->htim->Instance;
+
+  if( unit->flag_32bit ) return tim->CNT;
+
+  hal_disable_irq();
+  int16_t high = encoder_state_[idx].high;
+  uint16_t cnt = tim->CNT;
+  // the counter has wrapped but the interrupt is not serviced yet.
+  if( tim->SR & TIM_SR_UIF ) {
+    high += (cnt < 0x8000) ? 1 : -1;
+  }
+  hal_enable_irq();
+
+  return (int32_t)((uint32_t)(uint16_t)high << 16 | cnt);
+}
+
+
+//================================================================
+/*! write the position.
+*/
+static void encoder_write( int idx, int32_t pos )
+{
+  const struct ENCODER_UNIT *unit = &ENCODER_UNIT[idx];
+  TIM_TypeDef *tim = unit->htim->Instance;
+
+  hal_disable_irq();
+  if( unit->flag_32bit ) {
+    tim->CNT = pos;
+  } else {
+    tim->CNT = pos & 0xffff;
+    tim->SR = ~(uint32_t)TIM_SR_UIF;
+    encoder_state_[idx].high = pos >> 16;
+  }
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! TIM3 interrupt handler. (overflow of the 16bit encoder counter)
+
+  The counter is near 0 just after the overflow, and near 0xffff after
+  the underflow. This is right as long as the interrupt is serviced
+  within a half turn of the counter.
+*/
+void TIM3_IRQHandler( void )
+{
+  MRBC_ISR_ENTER();
+
+  TIM_TypeDef *tim = ENCODER_UNIT[1].htim->Instance;
+  if( tim->SR & TIM_SR_UIF ) {
+    tim->SR = ~(uint32_t)TIM_SR_UIF;
+    encoder_state_[1].high += (tim->CNT < 0x8000) ? 1 : -1;
+  }
+
+  MRBC_ISR_EXIT();
+}
+
+
+//================================================================
+/*! constructor
+
+  enc = Encoder.new("PA0", "PA1")		# TIM2, 32bit counter.
+  enc = Encoder.new("PA6", "PA7", mode:2 )	# TIM3, count only A edges.
+
+  @param  mode	4 (default) counts all edges of A and B, 2 counts A.
+*/
+static void c_encoder_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  MRBC_KW_ARG(mode);
+  if( !MRBC_KW_END() ) goto RETURN;
+  if( MRBC_KW_NARGC() != 2 ) goto ERROR_RETURN;
+
+  PIN_HANDLE pin_a, pin_b;
+  int unit_a, unit_b, ch_a, ch_b;
+  if( gpio_set_pin_handle( &pin_a, &v[1] ) != 0 ) goto ERROR_RETURN;
+  if( gpio_set_pin_handle( &pin_b, &v[2] ) != 0 ) goto ERROR_RETURN;
+  if( pwm_find_pin_assign( &pin_a, &unit_a, &ch_a ) != 0 ) goto ERROR_RETURN;
+  if( pwm_find_pin_assign( &pin_b, &unit_b, &ch_b ) != 0 ) goto ERROR_RETURN;
+  if( unit_a != unit_b || ch_a != 1 || ch_b != 2 ) goto ERROR_RETURN;
+
+  int idx;
+  for( idx = 0; idx < NUM_ENCODER_UNIT; idx++ ) {
+    if( ENCODER_UNIT[idx].unit_num == unit_a ) break;
+  }
+  if( idx == NUM_ENCODER_UNIT ) goto ERROR_RETURN;
+
+  int sms = 3;
+  if( MRBC_KW_ISVALID(mode) ) {
+    if( mode.tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    switch( mrbc_integer(mode) ) {
+    case 2: sms = 1; break;
+    case 4: sms = 3; break;
+    default: goto ERROR_RETURN;
+    }
+  }
+
+  struct ENCODER_STATE *st = &encoder_state_[idx];
+  if( st->flag_in_use ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "Encoder timer in use");
+    goto RETURN;
+  }
+
+  v[0] = mrbc_instance_new(vm, v[0].cls, sizeof(ENCODER_HANDLE));
+  ENCODER_HANDLE *h = (ENCODER_HANDLE *)v[0].instance->data;
+  h->idx = idx;
+  h->flag_running = 1;
+
+  st->flag_in_use = 1;
+  gpio_setmode_pwm( &pin_a, unit_a );
+  gpio_setmode_pwm( &pin_b, unit_b );
+  encoder_start( idx, sms );
+  goto RETURN;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), "Encoder initialize.");
+
+ RETURN:
+  MRBC_KW_DELETE(mode);
+}
+
+
+//================================================================
+/*! read the position.
+
+  enc.read	# -> Integer
+*/
+static void c_encoder_read(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  ENCODER_HANDLE *h = (ENCODER_HANDLE *)v[0].instance->data;
+
+  if( !h->flag_running ) {
+    SET_NIL_RETURN();
+    return;
+  }
+  SET_INT_RETURN( encoder_read( h->idx ) );
+}
+
+
+//================================================================
+/*! write the position.
+
+  enc.write( 0 )
+*/
+static void c_encoder_write(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  ENCODER_HANDLE *h = (ENCODER_HANDLE *)v[0].instance->data;
+
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  if( !h->flag_running ) return;
+  encoder_write( h->idx, mrbc_integer(v[1]) );
+}
+
+
+//================================================================
+/*! stop the encoder, and release the timer.
+
+  enc.stop
+*/
+static void c_encoder_stop(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  ENCODER_HANDLE *h = (ENCODER_HANDLE *)v[0].instance->data;
+
+  if( !h->flag_running ) return;
+  h->flag_running = 0;
+  encoder_stop( h->idx );
+}
+
+
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("Encoder")
+  FILE("_autogen_class_encoder.h")
+
+  METHOD( "read",		c_encoder_read )
+  METHOD( "position",		c_encoder_read )
+  METHOD( "write",		c_encoder_write )
+  METHOD( "position=",		c_encoder_write )
+  METHOD( "stop",		c_encoder_stop )
+*/
+#include "_autogen_class_encoder.h"
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_encoder(void)
+{
+  mrbc_class *cls = MRBC_CLASS(Encoder);
+  mrbc_set_const( MRBC_SYM(Encoder), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
+
+  mrbc_define_method_kw(0, cls, "new", c_encoder_new);
+}
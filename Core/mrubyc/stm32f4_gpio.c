@@ -13,9 +13,18 @@
   </pre>
 */
 
+//@cond
+#include <string.h>
+//@endcond
+
 #include "main.h"
 #include "../mrubyc_src/mrubyc.h"
 #include "stm32f4_gpio.h"
+#include "typed_array.h"
+
+#if !defined(GPIO_EDGE_QUEUE_SIZE)
+#define GPIO_EDGE_QUEUE_SIZE 8	//!< edge events per line. power of 2.
+#endif
 
 static uint16_t const TBL_NUM_TO_STM32PIN[/* num */] = {
   GPIO_PIN_0,  GPIO_PIN_1,  GPIO_PIN_2,  GPIO_PIN_3,
@@ -46,6 +55,72 @@ static uint8_t const TBL_ARDUINO_DIGITAL_PIN_TO_PIN[/* num */] = {
   0x18,  // D15 => PB8
 };
 
+static IRQn_Type const TBL_NUM_TO_EXTI_IRQN[/* num */] = {
+  EXTI0_IRQn,     EXTI1_IRQn,     EXTI2_IRQn,     EXTI3_IRQn,
+  EXTI4_IRQn,     EXTI9_5_IRQn,   EXTI9_5_IRQn,   EXTI9_5_IRQn,
+  EXTI9_5_IRQn,   EXTI9_5_IRQn,   EXTI15_10_IRQn, EXTI15_10_IRQn,
+  EXTI15_10_IRQn, EXTI15_10_IRQn, EXTI15_10_IRQn, EXTI15_10_IRQn };
+
+
+/*!@brief
+  edge event queue of an EXTI line.
+
+  Single producer (interrupt handler) and single consumer (task),
+  so that the interrupt handler pushes events without locking.
+*/
+typedef struct GPIO_EDGE_LINE {
+  uint8_t pin;			//!< port << 4 | num, or 0 if unused.
+  uint8_t edge;			//!< enabled edges. GPIO_EDGE_*
+  volatile uint8_t head;	//!< write index, by interrupt handler.
+  volatile uint8_t tail;	//!< read index, by task.
+  uint8_t flag_waiting;		//!< the task is waiting for an event.
+  struct {
+    uint32_t tick;		//!< HAL_GetTick() at the edge.
+    uint8_t edge;		//!< GPIO_EDGE_RISE or GPIO_EDGE_FALL
+  } queue[GPIO_EDGE_QUEUE_SIZE];
+} GPIO_EDGE_LINE;
+
+static GPIO_EDGE_LINE *gpio_edge_line_[16];	//!< by EXTI line number.
+
+//! waveform output state.
+enum {
+  GPIO_WAVE_IDLE = 0,	//!< not used.
+  GPIO_WAVE_BUSY,	//!< in output.
+  GPIO_WAVE_DONE,	//!< output completed.
+  GPIO_WAVE_ERROR,	//!< DMA transfer error.
+};
+
+/*!@brief
+  waveform output and sampling context.
+
+  TIM1 update event requests DMA2 Stream5 (channel 6) to write a word
+  to BSRR, or to read a half word from IDR. TIM1 is used because only
+  DMA2 can access the GPIO ports, and the updates of TIM2..4 are on DMA1.
+*/
+static struct {
+  volatile uint8_t state;	//!< GPIO_WAVE_*
+  uint8_t flag_sample;		//!< sampling, returns the buffer.
+  mrbc_tcb *tcb;		//!< owner task.
+  mrbc_value buf;		//!< buffer in transfer, kept from freeing.
+} gpio_wave;
+
+// TIM1 clock is HCLK, 84MHz at the full speed. (see stm32f4_clock.c)
+#define GPIO_WAVE_TIMER_FREQ SystemCoreClock
+
+// minimum TIM1 clocks per sample, leaving the bus time to the DMA.
+#define GPIO_SAMPLE_TIMER_MIN 8
+
+/*!@brief
+  GPIO instance data.
+
+  The port registers and the bit are kept for the fast read and write.
+*/
+typedef struct GPIO_HANDLE {
+  PIN_HANDLE pin;	//!< the first member, read as PIN_HANDLE.
+  uint16_t mask;	//!< bit of the pin.
+  GPIO_TypeDef *gpio;	//!< port registers.
+} GPIO_HANDLE;
+
 
 
 //================================================================
@@ -131,6 +206,22 @@ int gpio_setmode( const PIN_HANDLE *pin, unsigned int mode )
 }
 
 
+//================================================================
+/*! get the STM32 HAL port and pin.
+
+  @param  pin		target pin.
+  @param  stm32_pin	[out] GPIO_PIN_x.
+  @return		GPIO port, or NULL if not exist.
+*/
+GPIO_TypeDef * gpio_get_stm32_port( const PIN_HANDLE *pin, uint16_t *stm32_pin )
+{
+  if( pin->port >= sizeof(TBL_PORT_TO_STM32GPIO)/sizeof(GPIO_TypeDef *) ) return 0;
+
+  *stm32_pin = TBL_NUM_TO_STM32PIN[pin->num];
+  return TBL_PORT_TO_STM32GPIO[pin->port];
+}
+
+
 //================================================================
 /*! set mode to PWM
 
@@ -157,6 +248,147 @@ int gpio_setmode_pwm( const PIN_HANDLE *pin, int unit_num )
 }
 
 
+//================================================================
+/*! set up the EXTI line for the pin.
+
+  @param  pin	target pin.
+  @param  edge	edges to detect, GPIO_EDGE_*, or 0 to disable.
+  @return	pointer to the edge line, or NULL if error.
+  @note	An EXTI line is shared by the same pin number of all ports.
+*/
+static GPIO_EDGE_LINE * gpio_edge_config( const PIN_HANDLE *pin, int edge )
+{
+  uint8_t pin_id = (pin->port << 4) | pin->num;
+  uint32_t bit = 1UL << pin->num;
+  GPIO_EDGE_LINE *line = gpio_edge_line_[pin->num];
+
+  if( line && line->pin != 0 && line->pin != pin_id ) return NULL;	// busy.
+  if( line == NULL ) {
+    if( edge == 0 ) return NULL;
+    line = mrbc_raw_alloc( sizeof(GPIO_EDGE_LINE) );
+    if( line == NULL ) return NULL;
+    memset( line, 0, sizeof(GPIO_EDGE_LINE) );
+    gpio_edge_line_[pin->num] = line;
+  }
+
+  hal_disable_irq();
+  EXTI->IMR &= ~bit;
+  line->head = line->tail = 0;
+  line->edge = edge;
+  line->pin = edge ? pin_id : 0;
+  hal_enable_irq();
+  if( edge == 0 ) return line;
+
+  __HAL_RCC_SYSCFG_CLK_ENABLE();
+  uint32_t shift = (pin->num & 0x03) * 4;
+  uint32_t exticr = SYSCFG->EXTICR[pin->num >> 2] & ~(0x0FUL << shift);
+  SYSCFG->EXTICR[pin->num >> 2] = exticr | ((uint32_t)(pin->port - 1) << shift);
+
+  if( edge & GPIO_EDGE_RISE ) EXTI->RTSR |= bit; else EXTI->RTSR &= ~bit;
+  if( edge & GPIO_EDGE_FALL ) EXTI->FTSR |= bit; else EXTI->FTSR &= ~bit;
+  EXTI->PR = bit;
+  EXTI->IMR |= bit;
+
+  HAL_NVIC_SetPriority( TBL_NUM_TO_EXTI_IRQN[pin->num], 0, 0 );
+  HAL_NVIC_EnableIRQ( TBL_NUM_TO_EXTI_IRQN[pin->num] );
+
+  return line;
+}
+
+
+//================================================================
+/*! EXTI callback. (override the HAL weak function)
+
+  Pushes the edge event to the queue, and wakes up the waiting task.
+*/
+void HAL_GPIO_EXTI_Callback( uint16_t GPIO_Pin )
+{
+  int num = __builtin_ctz( GPIO_Pin );
+  GPIO_EDGE_LINE *line = gpio_edge_line_[num];
+  if( line == NULL || line->pin == 0 ) return;
+
+  uint8_t edge = line->edge;
+  if( edge == (GPIO_EDGE_RISE|GPIO_EDGE_FALL) ) {
+    edge = HAL_GPIO_ReadPin( TBL_PORT_TO_STM32GPIO[line->pin >> 4], GPIO_Pin ) ?
+      GPIO_EDGE_RISE : GPIO_EDGE_FALL;
+  }
+
+  uint8_t head = line->head;
+  if( (uint8_t)(head - line->tail) >= GPIO_EDGE_QUEUE_SIZE ) return;	// full.
+  line->queue[head % GPIO_EDGE_QUEUE_SIZE].tick = HAL_GetTick();
+  line->queue[head % GPIO_EDGE_QUEUE_SIZE].edge = edge;
+  line->head = head + 1;
+
+  if( line->flag_waiting ) mrbc_wakeup_io( line );
+}
+
+
+//================================================================
+/*! EXTI interrupt handlers. (override the startup weak functions)
+*/
+#define EXTI_HANDLER(pin) \
+  MRBC_ISR_ENTER(); HAL_GPIO_EXTI_IRQHandler( pin ); MRBC_ISR_EXIT()
+
+void EXTI0_IRQHandler(void) { EXTI_HANDLER( GPIO_PIN_0 ); }
+void EXTI1_IRQHandler(void) { EXTI_HANDLER( GPIO_PIN_1 ); }
+void EXTI2_IRQHandler(void) { EXTI_HANDLER( GPIO_PIN_2 ); }
+void EXTI3_IRQHandler(void) { EXTI_HANDLER( GPIO_PIN_3 ); }
+void EXTI4_IRQHandler(void) { EXTI_HANDLER( GPIO_PIN_4 ); }
+
+void EXTI9_5_IRQHandler(void)
+{
+  MRBC_ISR_ENTER();
+  for( int i = 5; i <= 9; i++ ) {
+    HAL_GPIO_EXTI_IRQHandler( TBL_NUM_TO_STM32PIN[i] );
+  }
+  MRBC_ISR_EXIT();
+}
+
+void EXTI15_10_IRQHandler(void)
+{
+  MRBC_ISR_ENTER();
+  for( int i = 10; i <= 15; i++ ) {
+    HAL_GPIO_EXTI_IRQHandler( TBL_NUM_TO_STM32PIN[i] );
+  }
+  MRBC_ISR_EXIT();
+}
+
+
+//================================================================
+/*! get the edge event line of the pin, for Reactor.
+
+  Both edges are enabled, if irq is not set up.
+
+  @param  pin	target pin.
+  @return	I/O object of the line, or NULL if error.
+*/
+void * gpio_edge_line( const PIN_HANDLE *pin )
+{
+  GPIO_EDGE_LINE *line = gpio_edge_line_[pin->num];
+  if( line && line->pin == ((pin->port << 4) | pin->num) ) return line;
+
+  return gpio_edge_config( pin, GPIO_EDGE_RISE|GPIO_EDGE_FALL );
+}
+
+
+//================================================================
+/*! check the edge events of the line, for Reactor.
+
+  @param  io		line by gpio_edge_line().
+  @param  flag_wait	to wait, if no event.
+  @return		non-zero if an event is queued.
+  @note  Call this with interrupts disabled.
+*/
+int gpio_edge_poll( void *io, int flag_wait )
+{
+  GPIO_EDGE_LINE *line = io;
+  int ready = (line->head != line->tail);
+
+  line->flag_waiting = !ready && flag_wait;
+  return ready;
+}
+
+
 //================================================================
 /*! constructor
 
@@ -165,14 +397,17 @@ int gpio_setmode_pwm( const PIN_HANDLE *pin, int unit_num )
 */
 static void c_gpio_new(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_instance_new(vm, v[0].cls, sizeof(PIN_HANDLE));
+  v[0] = mrbc_instance_new(vm, v[0].cls, sizeof(GPIO_HANDLE));
 
-  PIN_HANDLE *pin = (PIN_HANDLE *)v[0].instance->data;
+  GPIO_HANDLE *h = (GPIO_HANDLE *)v[0].instance->data;
+  PIN_HANDLE *pin = &h->pin;
 
   if( argc != 2 ) goto ERROR_RETURN;
   if( gpio_set_pin_handle( pin, &v[1] ) != 0 ) goto ERROR_RETURN;
   if( (mrbc_integer(v[2]) & (GPIO_IN|GPIO_OUT|GPIO_HIGH_Z)) == 0 ) goto ERROR_RETURN;
   if( gpio_setmode( pin, mrbc_integer(v[2]) ) < 0 ) goto ERROR_RETURN;
+  h->mask = TBL_NUM_TO_STM32PIN[pin->num];
+  h->gpio = TBL_PORT_TO_STM32GPIO[pin->port];
   return;
 
  ERROR_RETURN:
@@ -304,10 +539,9 @@ static void c_gpio_write_at(mrbc_vm *vm, mrbc_value v[], int argc)
 */
 static void c_gpio_read(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  PIN_HANDLE *pin = (PIN_HANDLE *)v[0].instance->data;
+  const GPIO_HANDLE *h = (GPIO_HANDLE *)v[0].instance->data;
 
-  SET_INT_RETURN( HAL_GPIO_ReadPin( TBL_PORT_TO_STM32GPIO[pin->port],
-                                    TBL_NUM_TO_STM32PIN[pin->num] ));
+  SET_INT_RETURN( (h->gpio->IDR & h->mask) != 0 );
 }
 
 
@@ -318,10 +552,9 @@ static void c_gpio_read(mrbc_vm *vm, mrbc_value v[], int argc)
 */
 static void c_gpio_high(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  PIN_HANDLE *pin = (PIN_HANDLE *)v[0].instance->data;
+  const GPIO_HANDLE *h = (GPIO_HANDLE *)v[0].instance->data;
 
-  SET_BOOL_RETURN( HAL_GPIO_ReadPin( TBL_PORT_TO_STM32GPIO[pin->port],
-                                     TBL_NUM_TO_STM32PIN[pin->num] ));
+  SET_BOOL_RETURN( (h->gpio->IDR & h->mask) != 0 );
 }
 
 
@@ -332,10 +565,9 @@ static void c_gpio_high(mrbc_vm *vm, mrbc_value v[], int argc)
 */
 static void c_gpio_low(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  PIN_HANDLE *pin = (PIN_HANDLE *)v[0].instance->data;
+  const GPIO_HANDLE *h = (GPIO_HANDLE *)v[0].instance->data;
 
-  SET_BOOL_RETURN(!HAL_GPIO_ReadPin( TBL_PORT_TO_STM32GPIO[pin->port],
-                                     TBL_NUM_TO_STM32PIN[pin->num] ));
+  SET_BOOL_RETURN( (h->gpio->IDR & h->mask) == 0 );
 }
 
 
@@ -346,14 +578,14 @@ static void c_gpio_low(mrbc_vm *vm, mrbc_value v[], int argc)
 */
 static void c_gpio_write(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  PIN_HANDLE *pin = (PIN_HANDLE *)v[0].instance->data;
+  const GPIO_HANDLE *h = (GPIO_HANDLE *)v[0].instance->data;
 
   if( v[1].tt != MRBC_TT_INTEGER ) return;
 
   int val = mrbc_integer(v[1]);
   if( 0 <= val && val <= 1 ) {
-    HAL_GPIO_WritePin( TBL_PORT_TO_STM32GPIO[pin->port],
-                       TBL_NUM_TO_STM32PIN[pin->num], val );
+    // BSRR: the lower half sets, the upper half resets. (atomic)
+    h->gpio->BSRR = val ? h->mask : (uint32_t)h->mask << 16;
   } else {
     mrbc_raise(vm, MRBC_CLASS(RangeError), 0);
   }
@@ -361,23 +593,493 @@ static void c_gpio_write(mrbc_vm *vm, mrbc_value v[], int argc)
 
 
 //================================================================
-/*! set up the GPIO class.
+/*! get the port number from the argument.
+
+  @param  val	"PA".."PH", or 1 (A) .. 8 (H).
+  @return	port number, or -1 if error.
 */
-void mrbc_init_class_gpio( void )
+static int get_port( const mrbc_value *val )
+{
+  int port = -1;
+
+  if( val->tt == MRBC_TT_STRING ) {
+    const char *s = mrbc_string_cstr(val);
+    if( s[0] == 'P' && 'A' <= s[1] && s[1] <= 'Z' && s[2] == 0 ) {
+      port = s[1] - 'A' + 1;
+    }
+  } else if( val->tt == MRBC_TT_INTEGER ) {
+    port = mrbc_integer(*val);
+  }
+
+  if( port < 0 ||
+      port >= sizeof(TBL_PORT_TO_STM32GPIO)/sizeof(GPIO_TypeDef *) ||
+      !TBL_PORT_TO_STM32GPIO[port] ) return -1;
+  return port;
+}
+
+
+//================================================================
+/*! setmode of the pins in a port.
+
+  GPIO.setmode_port( "PB", 0x00ff, GPIO::OUT )
+*/
+static void c_gpio_setmode_port(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int port = argc == 3 ? get_port( &v[1] ) : -1;
+  if( port < 0 || v[2].tt != MRBC_TT_INTEGER || v[3].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  PIN_HANDLE pin = { .port = port };
+  int mask = mrbc_integer(v[2]);
+
+  for( pin.num = 0; pin.num < 16; pin.num++ ) {
+    if( !(mask & (1 << pin.num)) ) continue;
+    if( gpio_setmode( &pin, mrbc_integer(v[3]) ) < 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+      return;
+    }
+  }
+}
+
+
+//================================================================
+/*! read the pins in a port at once.
+
+  GPIO.read_port( "PB" )		# -> Integer, all the 16 pins.
+  GPIO.read_port( "PB", 0x00ff )	# -> Integer, masked.
+*/
+static void c_gpio_read_port(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int port = argc >= 1 ? get_port( &v[1] ) : -1;
+  uint32_t mask = 0xffff;
+  if( argc >= 2 ) {
+    if( v[2].tt != MRBC_TT_INTEGER ) port = -1;
+    mask = mrbc_integer(v[2]);
+  }
+  if( port < 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  SET_INT_RETURN( TBL_PORT_TO_STM32GPIO[port]->IDR & mask );
+}
+
+
+//================================================================
+/*! write the pins in a port at once.
+
+  GPIO.write_port( "PB", 0x00ff, 0x5a )	# PB0..7 = 0x5a, the same time.
+*/
+static void c_gpio_write_port(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int port = argc == 3 ? get_port( &v[1] ) : -1;
+  if( port < 0 || v[2].tt != MRBC_TT_INTEGER || v[3].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  uint32_t mask = mrbc_integer(v[2]) & 0xffff;
+  uint32_t val = mrbc_integer(v[3]);
+
+  // set the 1 bits and reset the 0 bits, by a write of BSRR.
+  TBL_PORT_TO_STM32GPIO[port]->BSRR = (val & mask) | ((~val & mask) << 16);
+}
+
+
+//================================================================
+/*! start the waveform output or the sampling.
+
+  @param  reg	BSRR (output) or IDR (sampling) of the port.
+  @param  data	BSRR words, or the buffer of IDR half words.
+  @param  n	number of transfers.
+  @param  psc	TIM1 prescaler.
+  @param  arr	TIM1 auto reload.
+*/
+static void gpio_wave_start( volatile uint32_t *reg, const void *data, int n,
+			     uint32_t psc, uint32_t arr )
+{
+  TIM1->CR1 &= ~TIM_CR1_CEN;
+  TIM1->DIER &= ~TIM_DIER_UDE;
+
+  DMA2_Stream5->CR = 0;
+  while( DMA2_Stream5->CR & DMA_SxCR_EN )
+    ;
+  DMA2->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 |
+		DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+  DMA2_Stream5->PAR = (uint32_t)reg;
+  DMA2_Stream5->M0AR = (uint32_t)data;
+  DMA2_Stream5->NDTR = n;
+  DMA2_Stream5->FCR = 0;		// direct mode.
+  if( gpio_wave.flag_sample ) {		// IDR to memory, by half word.
+    DMA2_Stream5->CR = (6 << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1 |
+		       DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC |
+		       DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+  } else {				// memory to BSRR, by word.
+    DMA2_Stream5->CR = (6 << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1 |
+		       DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1 | DMA_SxCR_MINC |
+		       DMA_SxCR_DIR_0 | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+  }
+
+  TIM1->PSC = psc;
+  TIM1->ARR = arr;
+  TIM1->CNT = 0;
+  TIM1->EGR = TIM_EGR_UG;		// load PSC, without DMA request.
+
+  HAL_NVIC_SetPriority( DMA2_Stream5_IRQn, 0, 0 );
+  HAL_NVIC_EnableIRQ( DMA2_Stream5_IRQn );
+  DMA2_Stream5->CR |= DMA_SxCR_EN;
+  TIM1->DIER |= TIM_DIER_UDE;
+  TIM1->CR1 |= TIM_CR1_CEN;
+}
+
+
+//================================================================
+/*! take the result of the waveform output or the sampling.
+
+  @param  vm	pointer to VM.
+  @param  v	arguments. the return value is set to v[0].
+  @retval 0	TIM1 and DMA are free to start.
+  @retval 1	the result of this task is returned, or waiting for the
+		other task. (retried)
+*/
+static int gpio_wave_take( mrbc_vm *vm, mrbc_value v[] )
+{
+  mrbc_tcb *tcb = VM2TCB(vm);
+
+  hal_disable_irq();
+  if( gpio_wave.state >= GPIO_WAVE_DONE && gpio_wave.tcb != tcb &&
+      gpio_wave.tcb->state == TASKSTATE_DORMANT ) {
+    gpio_wave.state = GPIO_WAVE_IDLE;
+  }
+  if( gpio_wave.state == GPIO_WAVE_IDLE ) {
+    hal_enable_irq();
+    return 0;
+  }
+
+  int sts = gpio_wave.state;
+  if( gpio_wave.tcb != tcb || sts == GPIO_WAVE_BUSY ) {
+    mrbc_wait_io( tcb, &gpio_wave );
+    vm->flag_retry_call = 1;
+    hal_enable_irq();
+    return 1;
+  }
+
+  gpio_wave.state = GPIO_WAVE_IDLE;
+  hal_enable_irq();
+  mrbc_value buf = gpio_wave.buf;
+  gpio_wave.buf = mrbc_nil_value();
+  mrbc_wakeup_io( &gpio_wave );		// for tasks waiting.
+
+  if( sts == GPIO_WAVE_ERROR ) {
+    mrbc_decref( &buf );
+    mrbc_raise(vm, 0, "GPIO DMA transfer error");
+    return 1;
+  }
+  if( gpio_wave.flag_sample ) {
+    SET_RETURN( buf );			// pass the reference.
+  } else {
+    mrbc_decref( &buf );
+    SET_NIL_RETURN();
+  }
+  return 1;
+}
+
+
+//================================================================
+/*! calculate TIM1 settings for the transfer rate.
+
+  @param  freq	transfers per second. (Hz)
+  @param  min	minimum TIM1 clocks per transfer.
+  @param  psc	returns TIM1 prescaler.
+  @param  arr	returns TIM1 auto reload.
+  @return	zero if the rate can be made.
+*/
+static int gpio_wave_timer( mrbc_int_t freq, uint32_t min,
+			    uint32_t *psc, uint32_t *arr )
+{
+  uint32_t ps_ar = GPIO_WAVE_TIMER_FREQ / freq;
+  if( ps_ar < min ) return -1;
+
+  *psc = ps_ar >> 16;
+  *arr = ps_ar / (*psc+1) - 1;
+  return 0;
+}
+
+
+//================================================================
+/*! DMA2 Stream5 interrupt handler. (waveform output and sampling)
+*/
+void DMA2_Stream5_IRQHandler(void)
+{
+  MRBC_ISR_ENTER();
+
+  uint32_t sts = DMA2->HISR;
+  DMA2->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 |
+		DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+
+  if( sts & (DMA_HISR_TCIF5 | DMA_HISR_TEIF5) ) {
+    TIM1->DIER &= ~TIM_DIER_UDE;
+    TIM1->CR1 &= ~TIM_CR1_CEN;
+    DMA2_Stream5->CR &= ~DMA_SxCR_EN;
+
+    if( gpio_wave.state == GPIO_WAVE_BUSY ) {
+      gpio_wave.state = (sts & DMA_HISR_TEIF5) ? GPIO_WAVE_ERROR : GPIO_WAVE_DONE;
+      mrbc_wakeup_io( &gpio_wave );
+    }
+  }
+
+  MRBC_ISR_EXIT();
+}
+
+
+//================================================================
+/*! play a waveform to the pins in a port.
+
+  GPIO.play_port( "PB", buf, 1_000_000 )	# a word per 1us.
+
+  @param  buf	String (by pack("V*")) or typed array, of BSRR words.
+		the low 16 bits set the pins, and the high 16 bits reset.
+  @param  freq	words per second. (Hz)
+  @note
+    The task sleeps until the last word is written.
+    TIM1 is used for the pacing, so PWM on TIM1 (PA8) is stopped.
+    The pins must be set to output mode by setmode_port.
+*/
+static void c_gpio_play_port(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  // take the result, or wait for the other task.
+  if( gpio_wave_take( vm, v ) ) return;
+
+  // check the arguments.
+  int port = argc == 3 ? get_port( &v[1] ) : -1;
+  const void *data = 0;
+  int bytes = 0;
+  TYPED_ARRAY *ta;
+  if( v[2].tt == MRBC_TT_STRING ) {
+    mrbc_alloc_compact_remove( &v[2].string->data );	// by DMA.
+    data = mrbc_string_cstr(&v[2]);
+    bytes = mrbc_string_size(&v[2]);
+  } else if( (ta = typed_array_get(&v[2])) != 0 ) {
+    data = typed_array_data(ta);
+    bytes = typed_array_bytes(ta);
+  }
+  int n = bytes / 4;
+  if( port < 0 || n == 0 || n > 0xffff || (bytes & 3) ||
+      ((uintptr_t)data & 3) ||
+      v[3].tt != MRBC_TT_INTEGER || mrbc_integer(v[3]) <= 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  uint32_t psc, arr;
+  if( gpio_wave_timer( mrbc_integer(v[3]), 2, &psc, &arr ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "GPIO frequency too high");
+    return;
+  }
+
+  // start the output, and wait in other task running.
+  mrbc_incref( &v[2] );
+  gpio_wave.buf = v[2];
+  gpio_wave.tcb = VM2TCB(vm);
+  gpio_wave.flag_sample = 0;
+
+  hal_disable_irq();
+  gpio_wave.state = GPIO_WAVE_BUSY;
+  gpio_wave_start( &TBL_PORT_TO_STM32GPIO[port]->BSRR, data, n, psc, arr );
+  mrbc_wait_io( gpio_wave.tcb, &gpio_wave );
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! sample the pins in a port. (logic analyzer)
+
+  buf = GPIO.sample_port( "PB", 2_000_000, 1000 )	# 1000 samples at 2MHz.
+  bit3 = (buf[0] >> 3) & 1
+
+  @param  freq	samples per second. (Hz)
+  @param  n	number of samples.
+  @return Int16Array	IDR values. (PX15 is the sign bit)
+  @note
+    The task sleeps until the last sample is read.
+    TIM1 is used for the pacing, so PWM on TIM1 (PA8) is stopped, and
+    play_port waits for the sampling.
+    Up to about 10MHz, depending on the load of the bus.
+*/
+static void c_gpio_sample_port(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  mrbc_class *cls = mrbc_define_class(0, "GPIO", 0);
+  // take the samples, or wait for the other task.
+  if( gpio_wave_take( vm, v ) ) return;
+
+  // check the arguments.
+  int port = argc == 3 ? get_port( &v[1] ) : -1;
+  if( port < 0 ||
+      v[2].tt != MRBC_TT_INTEGER || mrbc_integer(v[2]) <= 0 ||
+      v[3].tt != MRBC_TT_INTEGER || mrbc_integer(v[3]) <= 0 ||
+      mrbc_integer(v[3]) > 0xffff ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  uint32_t psc, arr;
+  if( gpio_wave_timer( mrbc_integer(v[2]), GPIO_SAMPLE_TIMER_MIN,
+		       &psc, &arr ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "GPIO frequency too high");
+    return;
+  }
+
+  int n = mrbc_integer(v[3]);
+  mrbc_value buf = typed_array_new( vm, TYPED_ARRAY_INT16, n );
+  if( buf.tt == MRBC_TT_NIL ) {
+    mrbc_raise(vm, MRBC_CLASS(NoMemoryError), 0);
+    return;
+  }
+
+  // start the sampling, and wait in other task running.
+  gpio_wave.buf = buf;
+  gpio_wave.tcb = VM2TCB(vm);
+  gpio_wave.flag_sample = 1;
+
+  hal_disable_irq();
+  gpio_wave.state = GPIO_WAVE_BUSY;
+  gpio_wave_start( &TBL_PORT_TO_STM32GPIO[port]->IDR,
+		   typed_array_data( typed_array_get(&buf) ), n, psc, arr );
+  mrbc_wait_io( gpio_wave.tcb, &gpio_wave );
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! irq
+
+  gpio1.irq( GPIO::EDGE_FALL )			# detect falling edge.
+  gpio1.irq( GPIO::EDGE_RISE | GPIO::EDGE_FALL )	# both edges.
+  gpio1.irq( 0 )				# disable.
+
+  (note) The events are received by wait_edge method.
+*/
+static void c_gpio_irq(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  PIN_HANDLE *pin = (PIN_HANDLE *)v[0].instance->data;
+
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+  int edge = mrbc_integer(v[1]);
+  if( edge & ~(GPIO_EDGE_RISE|GPIO_EDGE_FALL) ) goto ERROR_RETURN;
+
+  if( !gpio_edge_config( pin, edge ) && edge ) goto ERROR_RETURN;
+  SET_NIL_RETURN();
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), "GPIO Can't setup irq");
+}
 
-  mrbc_define_method(0, cls, "new", c_gpio_new);
-  mrbc_define_method(0, cls, "setmode", c_gpio_setmode);
-  mrbc_define_method(0, cls, "read_at", c_gpio_read_at);
-  mrbc_define_method(0, cls, "high_at?", c_gpio_high_at);
-  mrbc_define_method(0, cls, "low_at?", c_gpio_low_at);
-  mrbc_define_method(0, cls, "write_at", c_gpio_write_at);
 
-  mrbc_define_method(0, cls, "read", c_gpio_read);
-  mrbc_define_method(0, cls, "high?", c_gpio_high);
-  mrbc_define_method(0, cls, "low?", c_gpio_low);
-  mrbc_define_method(0, cls, "write", c_gpio_write);
+//================================================================
+/*! wait_edge
+
+  edge, tick = gpio1.wait_edge()		# wait forever.
+  edge, tick = gpio1.wait_edge( 100 )	# timeout 100 ms.
+
+  @param  timeout	timeout in milliseconds, or nil.
+  @return Array		[edge, tick], or nil if timed out.
+  @note
+    If irq is not set up, both edges are enabled.
+    Tick is the value of HAL_GetTick() in milliseconds at the edge.
+    Only one task can wait for the pin.
+*/
+static void c_gpio_wait_edge(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  PIN_HANDLE *pin = (PIN_HANDLE *)v[0].instance->data;
+  int timeout = -1;
+
+  if( argc >= 1 && v[1].tt != MRBC_TT_NIL ) {
+    if( v[1].tt != MRBC_TT_INTEGER || mrbc_integer(v[1]) < 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+      return;
+    }
+    timeout = mrbc_integer(v[1]);
+  }
+
+  GPIO_EDGE_LINE *line = gpio_edge_line_[pin->num];
+  if( !line || line->pin != ((pin->port << 4) | pin->num) ) {
+    line = gpio_edge_config( pin, GPIO_EDGE_RISE|GPIO_EDGE_FALL );
+    if( !line ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), "GPIO Can't setup irq");
+      return;
+    }
+  }
+
+  // wait for an event in other task running.
+  hal_disable_irq();
+  uint8_t tail = line->tail;
+  if( line->head == tail ) {
+    if( line->flag_waiting || timeout == 0 ) {
+      line->flag_waiting = 0;		// timed out.
+      hal_enable_irq();
+      SET_NIL_RETURN();
+      return;
+    }
+
+    line->flag_waiting = 1;
+    if( timeout < 0 ) {
+      mrbc_wait_io( VM2TCB(vm), line );
+    } else {
+      mrbc_wait_io_timeout( VM2TCB(vm), line, timeout );
+    }
+    vm->flag_retry_call = 1;
+    hal_enable_irq();
+    return;
+  }
+  line->flag_waiting = 0;
+  hal_enable_irq();
+
+  mrbc_value ret = mrbc_array_new(vm, 2);
+  mrbc_array_push( &ret, &mrbc_integer_value(line->queue[tail % GPIO_EDGE_QUEUE_SIZE].edge) );
+  mrbc_array_push( &ret, &mrbc_integer_value(line->queue[tail % GPIO_EDGE_QUEUE_SIZE].tick) );
+  line->tail = tail + 1;
+
+  SET_RETURN(ret);
+}
+
+
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("GPIO")
+  FILE("_autogen_class_gpio.h")
+
+  METHOD( "new",		c_gpio_new )
+  METHOD( "setmode",		c_gpio_setmode )
+  METHOD( "read_at",		c_gpio_read_at )
+  METHOD( "high_at?",		c_gpio_high_at )
+  METHOD( "low_at?",		c_gpio_low_at )
+  METHOD( "write_at",		c_gpio_write_at )
+  METHOD( "setmode_port",	c_gpio_setmode_port )
+  METHOD( "read_port",		c_gpio_read_port )
+  METHOD( "write_port",		c_gpio_write_port )
+  METHOD( "play_port",		c_gpio_play_port )
+  METHOD( "sample_port",	c_gpio_sample_port )
+  METHOD( "read",		c_gpio_read )
+  METHOD( "high?",		c_gpio_high )
+  METHOD( "low?",		c_gpio_low )
+  METHOD( "write",		c_gpio_write )
+  METHOD( "irq",		c_gpio_irq )
+  METHOD( "wait_edge",		c_gpio_wait_edge )
+*/
+#include "_autogen_class_gpio.h"
+
+
+//================================================================
+/*! set up the GPIO class.
+*/
+void mrbc_init_class_gpio( void )
+{
+  mrbc_class *cls = MRBC_CLASS(GPIO);
+  mrbc_set_const( MRBC_SYM(GPIO), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
 
   mrbc_set_class_const(cls, mrbc_str_to_symid("IN"),         &mrbc_integer_value(GPIO_IN));
   mrbc_set_class_const(cls, mrbc_str_to_symid("OUT"),        &mrbc_integer_value(GPIO_OUT));
@@ -385,4 +1087,6 @@ void mrbc_init_class_gpio( void )
   mrbc_set_class_const(cls, mrbc_str_to_symid("PULL_UP"),    &mrbc_integer_value(GPIO_PULL_UP));
   mrbc_set_class_const(cls, mrbc_str_to_symid("PULL_DOWN"),  &mrbc_integer_value(GPIO_PULL_DOWN));
   mrbc_set_class_const(cls, mrbc_str_to_symid("OPEN_DRAIN"), &mrbc_integer_value(GPIO_OPEN_DRAIN));
+  mrbc_set_class_const(cls, mrbc_str_to_symid("EDGE_RISE"),  &mrbc_integer_value(GPIO_EDGE_RISE));
+  mrbc_set_class_const(cls, mrbc_str_to_symid("EDGE_FALL"),  &mrbc_integer_value(GPIO_EDGE_FALL));
 }
@@ -41,6 +41,9 @@ typedef struct PIN_HANDLE {
 #define GPIO_PULL_DOWN		0x20
 #define GPIO_OPEN_DRAIN		0x40
 
+#define GPIO_EDGE_RISE		0x01
+#define GPIO_EDGE_FALL		0x02
+
 
 /*
   function prototypes.
@@ -49,6 +52,9 @@ struct RObject;
 int gpio_set_pin_handle( PIN_HANDLE *pin_handle, const struct RObject *val );
 int gpio_setmode( const PIN_HANDLE *pin, unsigned int mode );
 int gpio_setmode_pwm( const PIN_HANDLE *pin, int ch );
+GPIO_TypeDef * gpio_get_stm32_port( const PIN_HANDLE *pin, uint16_t *stm32_pin );
+void * gpio_edge_line( const PIN_HANDLE *pin );
+int gpio_edge_poll( void *io, int flag_wait );
 void mrbc_init_class_gpio( void );
 
 
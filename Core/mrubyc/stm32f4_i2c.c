@@ -10,11 +10,24 @@
 
   This file is distributed under BSD 3-Clause License.
 
+  The slave mode exposes a register bank to the host.
+
+    bank = ByteArray.new( 16 )
+    q = Queue.new( 8 )
+    i2c.listen( 0x42, bank, q )	# own 7bit address.
+    x = q.pop_wait		# written by the host. (reg << 16 | length)
+
+  The host writes the register number and the data, or writes the
+  register number and reads from it after repeated start.
+  The bytes are handled in the interrupt handler, and the queue is
+  pushed at the end of each write.
   </pre>
 */
 
 #include "main.h"
 #include "../mrubyc_src/mrubyc.h"
+#include "typed_array.h"
+#include "spsc_queue.h"
 
 //@cond
 #include <string.h>
@@ -24,6 +37,373 @@ extern I2C_HandleTypeDef hi2c1;
 
 static const uint32_t I2C_TIMEOUT_ms = 3000;
 
+//! Transfers of this size or more use DMA (write uses interrupt)
+//! and do not block other tasks.
+static const int I2C_DMA_MIN_BYTES = 8;
+
+//! non-blocking transfer state.
+enum {
+  I2C_XFER_IDLE = 0,	//!< bus free.
+  I2C_XFER_BUSY,	//!< in transfer, or the bus is used.
+  I2C_XFER_DONE,	//!< DMA transfer completed.
+  I2C_XFER_ERROR,	//!< DMA transfer failed.
+  I2C_XFER_SLAVE,	//!< listening as slave.
+};
+
+//! a step of the transaction.
+typedef struct I2C_STEP {
+  uint8_t adrs;			//!< 7bit address.
+  uint16_t wlen;		//!< bytes to write.
+  uint16_t rlen;		//!< bytes to read, after repeated start.
+  uint8_t *wdata;		//!< write data.
+  uint8_t *rdata;		//!< read buffer.
+} I2C_STEP;
+
+//! non-blocking transfer context. (I2C1 only)
+static struct {
+  volatile uint8_t state;	//!< I2C_XFER_*
+  uint32_t error;		//!< HAL error code.
+  mrbc_tcb *tcb;		//!< bus owner task.
+  uint8_t *buf;			//!< DMA buffer.
+  int size;			//!< DMA buffer size.
+
+  // transaction, chained in the interrupt handler.
+  I2C_STEP *step;		//!< steps in buf, or NULL.
+  uint8_t n_step;		//!< number of steps.
+  uint8_t i_step;		//!< current step.
+  uint8_t phase;		//!< 0: write, 1: read of the step.
+} i2c_xfer;
+
+//! maximum number of steps in a transaction.
+static const int I2C_MAX_STEPS = 32;
+
+//! slave transfer phase.
+enum {
+  I2C_SLAVE_IDLE = 0,	//!< waiting for the address.
+  I2C_SLAVE_REG,	//!< receiving the register number.
+  I2C_SLAVE_RX,		//!< receiving the data from the host.
+  I2C_SLAVE_TX,		//!< sending the data to the host.
+};
+
+//! slave mode context.
+static struct {
+  mrbc_value bank;		//!< register bank, typed array.
+  mrbc_value queue;		//!< Queue to notify the writes, or nil.
+  uint8_t phase;		//!< I2C_SLAVE_*
+  uint8_t reg;			//!< register pointer.
+  uint8_t reg_rx;		//!< received register number.
+  uint16_t rx_size;		//!< bytes requested to receive.
+  uint32_t n_write;		//!< count of the writes by the host.
+  uint32_t n_error;		//!< count of the bus errors.
+  I2C_InitTypeDef saved_init;	//!< setting of the master mode.
+} i2c_slave;
+
+#if defined(MRBC_METRICS)
+static mrbc_metric metric_i2c_errors_ =
+  MRBC_METRIC_INITIALIZER("i2c1.errors", MRBC_METRIC_COUNTER);
+#define I2C_COUNT_ERROR()	mrbc_metric_add( &metric_i2c_errors_, 1 )
+#else
+#define I2C_COUNT_ERROR()	((void)0)
+#endif
+
+
+//================================================================
+/*! acquire the bus, or get the result of DMA transfer.
+
+  @param  vm	Pointer to vm
+  @return	I2C_XFER_IDLE	bus acquired. start new transfer.
+		I2C_XFER_BUSY	must wait. the method will be called again.
+		I2C_XFER_DONE or I2C_XFER_ERROR   result of own transfer.
+*/
+static int i2c_xfer_acquire( mrbc_vm *vm )
+{
+  mrbc_tcb *tcb = VM2TCB(vm);
+  int ret = I2C_XFER_IDLE;
+
+  hal_disable_irq();
+
+  // discard the result if the owner task has been terminated.
+  if( (i2c_xfer.state == I2C_XFER_DONE || i2c_xfer.state == I2C_XFER_ERROR) &&
+      i2c_xfer.tcb != tcb && i2c_xfer.tcb->state == TASKSTATE_DORMANT ) {
+    if( i2c_xfer.buf ) mrbc_raw_free( i2c_xfer.buf );
+    i2c_xfer.buf = 0;
+    i2c_xfer.step = 0;
+    i2c_xfer.state = I2C_XFER_IDLE;
+  }
+
+  if( i2c_xfer.state == I2C_XFER_IDLE ) {
+    i2c_xfer.state = I2C_XFER_BUSY;
+    i2c_xfer.tcb = tcb;
+
+  } else if( i2c_xfer.state == I2C_XFER_SLAVE ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "I2C is listening as slave");
+    ret = I2C_XFER_BUSY;
+
+  } else if( i2c_xfer.tcb == tcb && i2c_xfer.state != I2C_XFER_BUSY ) {
+    ret = i2c_xfer.state;
+
+  } else {
+    mrbc_wait_io( tcb, &hi2c1 );
+    vm->flag_retry_call = 1;
+    ret = I2C_XFER_BUSY;
+  }
+
+  hal_enable_irq();
+
+  return ret;
+}
+
+
+//================================================================
+/*! release the bus.
+*/
+static void i2c_xfer_release( void )
+{
+  hal_disable_irq();
+  if( i2c_xfer.buf ) mrbc_raw_free( i2c_xfer.buf );
+  i2c_xfer.buf = 0;
+  i2c_xfer.step = 0;
+  i2c_xfer.state = I2C_XFER_IDLE;
+  hal_enable_irq();
+
+  mrbc_wakeup_io( &hi2c1 );	// for tasks waiting for the bus.
+}
+
+
+//================================================================
+/*! wait for DMA transfer started.
+
+  @param  vm	Pointer to vm
+  @note   The method will be called again to get the result.
+*/
+static void i2c_xfer_wait( mrbc_vm *vm )
+{
+  hal_disable_irq();
+  if( i2c_xfer.state == I2C_XFER_BUSY ) {
+    mrbc_wait_io( VM2TCB(vm), &hi2c1 );
+  }
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! start the current phase of the transaction step.
+
+  Write and read of a step are joined by repeated start.
+*/
+static HAL_StatusTypeDef i2c_step_start( void )
+{
+  const I2C_STEP *s = &i2c_xfer.step[i2c_xfer.i_step];
+  uint16_t adrs = s->adrs << 1;
+
+  if( i2c_xfer.phase == 0 && s->wlen ) {
+    if( s->rlen ) {
+      return HAL_I2C_Master_Seq_Transmit_IT( &hi2c1, adrs, s->wdata, s->wlen,
+					     I2C_FIRST_FRAME );
+    }
+    return HAL_I2C_Master_Transmit_IT( &hi2c1, adrs, s->wdata, s->wlen );
+  }
+  if( s->wlen ) {
+    return HAL_I2C_Master_Seq_Receive_IT( &hi2c1, adrs, s->rdata, s->rlen,
+					  I2C_LAST_FRAME );
+  }
+  return HAL_I2C_Master_Receive_IT( &hi2c1, adrs, s->rdata, s->rlen );
+}
+
+
+//================================================================
+/*! go to the next phase of the transaction. (in ISR)
+
+  @return	1 if started, 0 if all done, or -1 if error.
+*/
+static int i2c_step_next( void )
+{
+  const I2C_STEP *s = &i2c_xfer.step[i2c_xfer.i_step];
+
+  if( i2c_xfer.phase == 0 && s->wlen && s->rlen ) {
+    i2c_xfer.phase = 1;
+  } else {
+    i2c_xfer.phase = 0;
+    if( ++i2c_xfer.i_step >= i2c_xfer.n_step ) return 0;
+  }
+
+  return i2c_step_start() == HAL_OK ? 1 : -1;
+}
+
+
+//================================================================
+/*! DMA transfer complete or error.
+*/
+static void i2c_xfer_complete( I2C_HandleTypeDef *hi2c, int state )
+{
+  if( hi2c != &hi2c1 ) return;
+  if( i2c_xfer.state != I2C_XFER_BUSY ) return;
+
+  if( state == I2C_XFER_DONE && i2c_xfer.step ) {
+    int r = i2c_step_next();
+    if( r > 0 ) return;
+    if( r < 0 ) state = I2C_XFER_ERROR;
+  }
+
+  i2c_xfer.error = hi2c->ErrorCode;
+  i2c_xfer.state = state;
+  mrbc_wakeup_io( &hi2c1 );
+}
+
+
+//================================================================
+/*! end of the slave transaction. (in ISR)
+*/
+static void i2c_slave_end( I2C_HandleTypeDef *hi2c )
+{
+  if( i2c_slave.phase == I2C_SLAVE_RX ) {
+    int n = i2c_slave.rx_size - hi2c->XferCount;
+    SPSC_QUEUE *q = spsc_queue_get( &i2c_slave.queue );
+    if( n > 0 ) i2c_slave.n_write++;
+    if( n > 0 && q ) {
+      spsc_queue_push_int( q, (mrbc_int_t)i2c_slave.reg << 16 | n );
+    }
+  }
+  i2c_slave.phase = I2C_SLAVE_IDLE;
+}
+
+
+//================================================================
+/*! HAL slave callbacks. (override HAL weak functions)
+*/
+void HAL_I2C_AddrCallback( I2C_HandleTypeDef *hi2c, uint8_t TransferDirection,
+			   uint16_t AddrMatchCode )
+{
+  if( hi2c != &hi2c1 || i2c_xfer.state != I2C_XFER_SLAVE ) return;
+
+  TYPED_ARRAY *ta = typed_array_get( &i2c_slave.bank );
+  int size = typed_array_bytes( ta );
+
+  if( TransferDirection == I2C_DIRECTION_TRANSMIT ) {
+    // the host writes the register number first.
+    i2c_slave.phase = I2C_SLAVE_REG;
+    HAL_I2C_Slave_Seq_Receive_IT( hi2c, &i2c_slave.reg_rx, 1, I2C_FIRST_FRAME );
+    return;
+  }
+
+  // the host reads, may be after the register number by repeated start.
+  i2c_slave_end( hi2c );
+  i2c_slave.phase = I2C_SLAVE_TX;
+  HAL_I2C_Slave_Seq_Transmit_IT( hi2c, typed_array_data(ta) + i2c_slave.reg,
+				 size - i2c_slave.reg, I2C_LAST_FRAME );
+}
+
+void HAL_I2C_SlaveRxCpltCallback( I2C_HandleTypeDef *hi2c )
+{
+  if( hi2c != &hi2c1 || i2c_xfer.state != I2C_XFER_SLAVE ) return;
+  if( i2c_slave.phase != I2C_SLAVE_REG ) return;
+
+  // receive the data to the register.
+  TYPED_ARRAY *ta = typed_array_get( &i2c_slave.bank );
+  int size = typed_array_bytes( ta );
+
+  i2c_slave.reg = i2c_slave.reg_rx % size;
+  i2c_slave.rx_size = size - i2c_slave.reg;
+  i2c_slave.phase = I2C_SLAVE_RX;
+  HAL_I2C_Slave_Seq_Receive_IT( hi2c, typed_array_data(ta) + i2c_slave.reg,
+				i2c_slave.rx_size, I2C_LAST_FRAME );
+}
+
+void HAL_I2C_ListenCpltCallback( I2C_HandleTypeDef *hi2c )
+{
+  if( hi2c != &hi2c1 || i2c_xfer.state != I2C_XFER_SLAVE ) return;
+
+  // at STOP, or NACK of the last byte sent.
+  i2c_slave_end( hi2c );
+  HAL_I2C_EnableListen_IT( hi2c );
+}
+
+
+//================================================================
+/*! slave error. (in ISR)
+
+  NACK is a normal end, followed by HAL_I2C_ListenCpltCallback().
+*/
+static void i2c_slave_error( I2C_HandleTypeDef *hi2c )
+{
+  if( hi2c->ErrorCode == HAL_I2C_ERROR_AF ) return;
+
+  i2c_slave.n_error++;
+  I2C_COUNT_ERROR();
+  i2c_slave.phase = I2C_SLAVE_IDLE;
+
+  if( hi2c->State == HAL_I2C_STATE_LISTEN ) HAL_I2C_DisableListen_IT( hi2c );
+  if( hi2c->State == HAL_I2C_STATE_READY ) HAL_I2C_EnableListen_IT( hi2c );
+}
+
+
+//================================================================
+/*! HAL callbacks. (override HAL weak functions)
+*/
+void HAL_I2C_MasterTxCpltCallback( I2C_HandleTypeDef *hi2c )
+{
+  i2c_xfer_complete( hi2c, I2C_XFER_DONE );
+}
+
+void HAL_I2C_MasterRxCpltCallback( I2C_HandleTypeDef *hi2c )
+{
+  i2c_xfer_complete( hi2c, I2C_XFER_DONE );
+}
+
+void HAL_I2C_MemRxCpltCallback( I2C_HandleTypeDef *hi2c )
+{
+  i2c_xfer_complete( hi2c, I2C_XFER_DONE );
+}
+
+void HAL_I2C_ErrorCallback( I2C_HandleTypeDef *hi2c )
+{
+  if( hi2c == &hi2c1 && i2c_xfer.state == I2C_XFER_SLAVE ) {
+    i2c_slave_error( hi2c );
+    return;
+  }
+  i2c_xfer_complete( hi2c, I2C_XFER_ERROR );
+}
+
+void HAL_I2C_AbortCpltCallback( I2C_HandleTypeDef *hi2c )
+{
+  i2c_xfer_complete( hi2c, I2C_XFER_ERROR );
+}
+
+
+//================================================================
+/*! borrow output data without copy
+
+  @param v	argments
+  @param argc	num of arguments
+  @param start_idx  Argument parsing start position.
+  @param ret_bufsiz data size.
+  @return	pointer to the data of the String or typed array, or NULL
+		if the arguments are not a single one of them.
+  @note	The data is valid while the argument is kept in the register.
+	The String is not moved by the compactor after this.
+*/
+const uint8_t * borrow_output_buffer(mrb_value v[], int argc,
+				     int start_idx, int *ret_bufsiz)
+{
+  if( argc != start_idx ) return 0;
+
+  if( v[start_idx].tt == MRBC_TT_STRING ) {
+    if( mrbc_string_size(&v[start_idx]) == 0 ) return 0;
+    *ret_bufsiz = mrbc_string_size(&v[start_idx]);
+    mrbc_alloc_compact_remove( &v[start_idx].string->data );	// by DMA.
+    return (const uint8_t *)mrbc_string_cstr(&v[start_idx]);
+  }
+
+  TYPED_ARRAY *ta = typed_array_get(&v[start_idx]);
+  if( ta && typed_array_bytes(ta) != 0 ) {
+    *ret_bufsiz = typed_array_bytes(ta);
+    return typed_array_data(ta);
+  }
+
+  return 0;
+}
+
 
 //================================================================
 /*! make output buffer
@@ -56,6 +436,11 @@ uint8_t * make_output_buffer(mrb_vm *vm, mrb_value v[], int argc,
       bufsiz += mrbc_array_size(&v[i]);
       break;
 
+    case MRBC_TT_OBJECT:
+      if( !typed_array_get(&v[i]) ) goto ERROR_PARAM;
+      bufsiz += typed_array_bytes( typed_array_get(&v[i]) );
+      break;
+
     default:
       goto ERROR_PARAM;
     }
@@ -85,6 +470,12 @@ uint8_t * make_output_buffer(mrb_vm *vm, mrb_value v[], int argc,
       }
     } break;
 
+    case MRBC_TT_OBJECT: {
+      TYPED_ARRAY *ta = typed_array_get(&v[i]);
+      memcpy( pbuf, typed_array_data(ta), typed_array_bytes(ta) );
+      pbuf += typed_array_bytes(ta);
+    } break;
+
     default:
       //
     }
@@ -108,9 +499,10 @@ uint8_t * make_output_buffer(mrb_vm *vm, mrb_value v[], int argc,
   (mruby usage)
   s = i2c.read( i2c_adrs_7, read_bytes, *param )
   s.getbyte(n)  # bytes
+  buf = i2c.read( i2c_adrs_7, ByteArray.new(n), *param )
 
   i2c_adrs_7 = Integer
-  read_byres = Integer
+  read_byres = Integer, or typed array to be filled and returned.
   *param     = (option)
 
   (I2C Sequence)
@@ -132,20 +524,95 @@ static void c_i2c_read(mrb_vm *vm, mrb_value v[], int argc)
   if( v[1].tt != MRBC_TT_INTEGER ) goto ERROR_PARAM;
   int i2c_adrs_7 = mrbc_integer(v[1]);
 
-  if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_PARAM;
-  int read_bytes = mrbc_integer(v[2]);
-  if( read_bytes < 0 ) goto ERROR_PARAM;
+  TYPED_ARRAY *ta = typed_array_get(&v[2]);
+  int read_bytes;
+  if( ta ) {
+    read_bytes = typed_array_bytes(ta);
+  } else {
+    if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_PARAM;
+    read_bytes = mrbc_integer(v[2]);
+    if( read_bytes < 0 ) goto ERROR_PARAM;
+  }
 
   if( argc > 2 ) {
     buf = make_output_buffer( vm, v, argc, 3, &bufsiz );
     if( !buf ) goto RETURN;
   }
+  if( bufsiz > 2 ) {
+    mrbc_raise(vm, 0, "i2c#read: output parameter must be less than 2 bytes.");
+    goto RETURN;
+  }
 
-  // Start I2C communication
-  ret = mrbc_string_new(vm, 0, read_bytes);
-  uint8_t *p = (uint8_t *)mrbc_string_cstr(&ret);
   HAL_StatusTypeDef sts;
 
+  // Acquire the bus, or take the result of DMA transfer.
+  switch( i2c_xfer_acquire( vm ) ) {
+  case I2C_XFER_BUSY:
+    if( buf ) mrbc_free( vm, buf );
+    return;		// will be called again.
+
+  case I2C_XFER_DONE:
+    if( ta ) {
+      memcpy( typed_array_data(ta), i2c_xfer.buf, i2c_xfer.size );
+      ret = v[2];
+      mrbc_incref( &ret );
+    } else {
+      ret = mrbc_string_new( vm, i2c_xfer.buf, i2c_xfer.size );
+    }
+    i2c_xfer_release();
+    goto RETURN;
+
+  case I2C_XFER_ERROR:
+    I2C_COUNT_ERROR();
+    mrbc_raisef(vm, 0, "i2c#read: HAL layer error (error code %d)",
+		(int)i2c_xfer.error);
+    i2c_xfer_release();
+    goto RETURN;
+  }
+
+  // Start DMA transfer, and wait in other task running.
+  if( read_bytes >= I2C_DMA_MIN_BYTES ) {
+    i2c_xfer.buf = mrbc_raw_alloc( read_bytes );
+    if( !i2c_xfer.buf ) {
+      i2c_xfer_release();
+      goto RETURN;		// ENOMEM
+    }
+    i2c_xfer.size = read_bytes;
+
+    if( buf == 0 ) {
+      sts = HAL_I2C_Master_Receive_DMA( &hi2c1, i2c_adrs_7 << 1,
+					i2c_xfer.buf, read_bytes );
+    } else if( bufsiz == 1 ) {
+      sts = HAL_I2C_Mem_Read_DMA( &hi2c1, i2c_adrs_7 << 1, buf[0],
+		I2C_MEMADD_SIZE_8BIT, i2c_xfer.buf, read_bytes );
+    } else {
+      sts = HAL_I2C_Mem_Read_DMA( &hi2c1, i2c_adrs_7 << 1, buf[0] << 8 | buf[1],
+		I2C_MEMADD_SIZE_16BIT, i2c_xfer.buf, read_bytes );
+    }
+
+    if( sts == HAL_OK ) {
+      i2c_xfer_wait( vm );
+      if( buf ) mrbc_free( vm, buf );
+      return;		// will be called again.
+    }
+
+    i2c_xfer_release();
+    I2C_COUNT_ERROR();
+    mrbc_raisef(vm, 0, "i2c#read: HAL layer error (status code %d)", sts);
+    goto RETURN;
+  }
+
+  // Start I2C communication
+  uint8_t *p;
+  if( ta ) {
+    ret = v[2];
+    mrbc_incref( &ret );
+    p = typed_array_data(ta);
+  } else {
+    ret = mrbc_string_new(vm, 0, read_bytes);
+    p = (uint8_t *)mrbc_string_cstr(&ret);
+  }
+
   if( buf == 0 ) {
     sts = HAL_I2C_Master_Receive( &hi2c1, i2c_adrs_7 << 1,
 				  p, read_bytes, I2C_TIMEOUT_ms );
@@ -154,16 +621,14 @@ static void c_i2c_read(mrb_vm *vm, mrb_value v[], int argc)
     sts = HAL_I2C_Mem_Read( &hi2c1, i2c_adrs_7 << 1, buf[0],
 		I2C_MEMADD_SIZE_8BIT, p, read_bytes, I2C_TIMEOUT_ms );
 
-  } else if( bufsiz == 2 ) {
+  } else {
     sts = HAL_I2C_Mem_Read( &hi2c1, i2c_adrs_7 << 1, buf[0] << 8 | buf[1],
 		I2C_MEMADD_SIZE_16BIT, p, read_bytes, I2C_TIMEOUT_ms );
-
-  } else {
-    mrbc_raise(vm, 0, "i2c#read: output parameter must be less than 2 bytes.");
-    goto RETURN;
   }
+  i2c_xfer_release();
 
   if( sts != HAL_OK ) {
+    I2C_COUNT_ERROR();
     mrbc_raisef(vm, 0, "i2c#read: HAL layer error (status code %d)", sts);
   }
   goto RETURN;
@@ -185,7 +650,7 @@ static void c_i2c_read(mrb_vm *vm, mrb_value v[], int argc)
   i2c.write( i2c_adrs_7, write_data, ... )
 
   i2c_adrs_7 = Integer
-  write_data = String, Integer, or Array<Integer>
+  write_data = String, Integer, Array<Integer>, or typed array
 
   (I2C Sequence)
   S - ADRS W A - data1 A... - P
@@ -196,7 +661,8 @@ static void c_i2c_read(mrb_vm *vm, mrb_value v[], int argc)
 */
 static void c_i2c_write(mrb_vm *vm, mrb_value v[], int argc)
 {
-  uint8_t *buf = 0;
+  uint8_t *buf = 0;		// allocated buffer, or NULL if borrowed.
+  const uint8_t *data;
   int bufsiz = 0;
 
   // Get parameter
@@ -204,16 +670,74 @@ static void c_i2c_write(mrb_vm *vm, mrb_value v[], int argc)
   if( v[1].tt != MRBC_TT_INTEGER ) goto ERROR_PARAM;
   int i2c_adrs_7 = mrbc_integer(v[1]);
 
-  buf = make_output_buffer( vm, v, argc, 2, &bufsiz );
-  if( !buf ) goto RETURN;
+  // a single String or typed array is sent directly.
+  data = borrow_output_buffer( v, argc, 2, &bufsiz );
+  if( !data ) {
+    data = buf = make_output_buffer( vm, v, argc, 2, &bufsiz );
+    if( !buf ) goto RETURN;
+  }
 
-  // Start I2C communication
   HAL_StatusTypeDef sts;
+
+  // Acquire the bus, or take the result of DMA transfer.
+  switch( i2c_xfer_acquire( vm ) ) {
+  case I2C_XFER_BUSY:
+    if( buf ) mrbc_free( vm, buf );
+    return;		// will be called again.
+
+  case I2C_XFER_DONE:
+    if( buf ) mrbc_free( vm, buf );
+    i2c_xfer_release();
+    goto RETURN;
+
+  case I2C_XFER_ERROR:
+    if( buf ) mrbc_free( vm, buf );
+    I2C_COUNT_ERROR();
+    mrbc_raisef(vm, 0, "i2c#write: HAL layer error (error code %d)",
+		(int)i2c_xfer.error);
+    i2c_xfer_release();
+    goto RETURN;
+  }
+
+  // Start IT transfer, and wait in other task running.
+  //  (DMA1 Stream7 is used by SPI3_TX)
+  if( bufsiz >= I2C_DMA_MIN_BYTES ) {
+    // the borrowed data is kept in the register until this method is
+    // called again. the allocated one is moved out of the VM memory.
+    if( buf ) {
+      i2c_xfer.buf = mrbc_raw_alloc( bufsiz );
+      if( !i2c_xfer.buf ) {
+	mrbc_free( vm, buf );
+	i2c_xfer_release();
+	goto RETURN;		// ENOMEM
+      }
+      i2c_xfer.size = bufsiz;
+      memcpy( i2c_xfer.buf, buf, bufsiz );
+      mrbc_free( vm, buf );
+      data = i2c_xfer.buf;
+    }
+
+    sts = HAL_I2C_Master_Transmit_IT( &hi2c1, i2c_adrs_7 << 1,
+				      (uint8_t *)data, bufsiz );
+    if( sts == HAL_OK ) {
+      i2c_xfer_wait( vm );
+      return;		// will be called again.
+    }
+
+    i2c_xfer_release();
+    I2C_COUNT_ERROR();
+    mrbc_raisef(vm, 0, "i2c#write: HAL layer error (status code %d)", sts);
+    goto RETURN;
+  }
+
+  // Start I2C communication
   sts = HAL_I2C_Master_Transmit( &hi2c1, i2c_adrs_7 << 1,
-				 buf, bufsiz, I2C_TIMEOUT_ms );
-  mrbc_free( vm, buf );
+				 (uint8_t *)data, bufsiz, I2C_TIMEOUT_ms );
+  if( buf ) mrbc_free( vm, buf );
+  i2c_xfer_release();
 
   if( sts != HAL_OK ) {
+    I2C_COUNT_ERROR();
     mrbc_raisef(vm, 0, "i2c#write: HAL layer error (status code %d)", sts);
   }
   goto RETURN;
@@ -227,13 +751,294 @@ static void c_i2c_write(mrb_vm *vm, mrb_value v[], int argc)
 }
 
 
+//================================================================
+/*! count or copy the write data of a transaction step.
+
+  @param  val	nil, Integer, String or Array of Integer.
+  @param  p	output, or NULL to count.
+  @return	number of bytes, or -1 if error.
+*/
+static int i2c_step_wdata( const mrbc_value *val, uint8_t *p )
+{
+  switch( val->tt ) {
+  case MRBC_TT_NIL:
+    return 0;
+
+  case MRBC_TT_INTEGER:
+    if( p ) *p = mrbc_integer(*val);
+    return 1;
+
+  case MRBC_TT_STRING:
+    if( p ) memcpy( p, mrbc_string_cstr(val), mrbc_string_size(val) );
+    return mrbc_string_size(val);
+
+  case MRBC_TT_ARRAY:
+    for( int i = 0; i < mrbc_array_size(val); i++ ) {
+      mrbc_value v1 = mrbc_array_get(val, i);
+      if( v1.tt != MRBC_TT_INTEGER ) return -1;
+      if( p ) *p++ = mrbc_integer(v1);
+    }
+    return mrbc_array_size(val);
+
+  default:
+    return -1;
+  }
+}
+
+
+//================================================================
+/*! batch transaction.
+
+  (mruby usage)
+  s = i2c.transaction( [[i2c_adrs_7, write_data, read_bytes], ...] )
+
+  write_data = nil, Integer, String or Array of Integer.
+  read_bytes = Integer (option, default 0)
+  s          = all read data in one String, in the order of the steps.
+
+  (I2C Sequence of a step)
+  S - adrs W A - data A... - Sr - adrs R A - data_1 A... data_n N - P
+    The write or the read is omitted if its length is 0.
+
+  (note) The steps run back to back in the interrupt handler, and
+	 other tasks run in the meantime.
+*/
+static void c_i2c_transaction(mrb_vm *vm, mrb_value v[], int argc)
+{
+  mrbc_value ret = mrbc_nil_value();
+
+  // Acquire the bus, or take the result of the transaction.
+  switch( i2c_xfer_acquire( vm ) ) {
+  case I2C_XFER_BUSY:
+    return;		// will be called again.
+
+  case I2C_XFER_DONE:
+    ret = mrbc_string_new( vm, i2c_xfer.step + i2c_xfer.n_step, i2c_xfer.size );
+    i2c_xfer_release();
+    goto RETURN;
+
+  case I2C_XFER_ERROR:
+    I2C_COUNT_ERROR();
+    mrbc_raisef(vm, 0, "i2c#transaction: HAL layer error in step %d (error code %d)",
+		i2c_xfer.i_step, (int)i2c_xfer.error);
+    i2c_xfer_release();
+    goto RETURN;
+  }
+
+  // Get parameter, and count the bytes.
+  if( argc != 1 || v[1].tt != MRBC_TT_ARRAY ) goto ERROR_PARAM;
+  int n_step = mrbc_array_size(&v[1]);
+  if( n_step < 1 || n_step > I2C_MAX_STEPS ) goto ERROR_PARAM;
+
+  int wtotal = 0, rtotal = 0;
+  for( int i = 0; i < n_step; i++ ) {
+    mrbc_value st = mrbc_array_get(&v[1], i);
+    if( st.tt != MRBC_TT_ARRAY ) goto ERROR_PARAM;
+    int n = mrbc_array_size(&st);
+    if( n < 2 || n > 3 ) goto ERROR_PARAM;
+
+    mrbc_value adrs = mrbc_array_get(&st, 0);
+    mrbc_value wdata = mrbc_array_get(&st, 1);
+    mrbc_value rlen = mrbc_array_get(&st, 2);
+    if( adrs.tt != MRBC_TT_INTEGER ) goto ERROR_PARAM;
+    int wlen = i2c_step_wdata( &wdata, 0 );
+    if( wlen < 0 || wlen > 0xffff ) goto ERROR_PARAM;
+    if( n == 3 ) {
+      if( rlen.tt != MRBC_TT_INTEGER ) goto ERROR_PARAM;
+      if( mrbc_integer(rlen) < 0 || mrbc_integer(rlen) > 0xffff ) goto ERROR_PARAM;
+      rtotal += mrbc_integer(rlen);
+    } else if( wlen == 0 ) {
+      goto ERROR_PARAM;
+    }
+    wtotal += wlen;
+  }
+
+  // steps, read area and write data in one buffer.
+  i2c_xfer.buf = mrbc_raw_alloc( sizeof(I2C_STEP) * n_step + rtotal + wtotal );
+  if( !i2c_xfer.buf ) {
+    i2c_xfer_release();
+    goto RETURN;		// ENOMEM
+  }
+  I2C_STEP *step = (I2C_STEP *)i2c_xfer.buf;
+  uint8_t *rp = (uint8_t *)(step + n_step);
+  uint8_t *wp = rp + rtotal;
+
+  for( int i = 0; i < n_step; i++ ) {
+    mrbc_value st = mrbc_array_get(&v[1], i);
+    mrbc_value wdata = mrbc_array_get(&st, 1);
+
+    step[i].adrs = mrbc_integer( mrbc_array_get(&st, 0) );
+    step[i].wdata = wp;
+    step[i].wlen = i2c_step_wdata( &wdata, wp );
+    step[i].rdata = rp;
+    step[i].rlen = (mrbc_array_size(&st) == 3) ?
+		     mrbc_integer( mrbc_array_get(&st, 2) ) : 0;
+    if( step[i].wlen == 0 && step[i].rlen == 0 ) goto ERROR_PARAM;
+    wp += step[i].wlen;
+    rp += step[i].rlen;
+  }
+
+  i2c_xfer.size = rtotal;
+  i2c_xfer.n_step = n_step;
+  i2c_xfer.i_step = 0;
+  i2c_xfer.phase = 0;
+  i2c_xfer.step = step;
+
+  // Start the first step, and the rest are chained in the interrupt.
+  HAL_StatusTypeDef sts = i2c_step_start();
+  if( sts == HAL_OK ) {
+    i2c_xfer_wait( vm );
+    return;		// will be called again.
+  }
+
+  i2c_xfer_release();
+  I2C_COUNT_ERROR();
+  mrbc_raisef(vm, 0, "i2c#transaction: HAL layer error (status code %d)", sts);
+  goto RETURN;
+
+
+ ERROR_PARAM:
+  i2c_xfer_release();
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), "i2c#transaction: parameter error.");
+
+ RETURN:
+  SET_RETURN(ret);
+}
+
+
+static void c_i2c_unlisten(mrb_vm *vm, mrb_value v[], int argc);
+
+//================================================================
+/*! listen as slave.
+
+  (mruby usage)
+  i2c.listen( i2c_adrs_7, bank, queue = nil )
+
+  i2c_adrs_7 = Integer, own address.
+  bank       = typed array up to 256 bytes, the register bank.
+  queue      = Queue, pushed reg << 16 | length at the end of each write.
+
+  (I2C Sequence)
+  S - adrs W A - reg A - data_1 A... - P		write to bank[reg..]
+  S - adrs W A - reg A - Sr - adrs R A - data_1 A... N - P  read bank[reg..]
+  S - adrs R A - data_1 A... N - P			read at the last reg.
+*/
+static void c_i2c_listen(mrb_vm *vm, mrb_value v[], int argc)
+{
+  if( argc < 2 || argc > 3 ) goto ERROR_PARAM;
+  if( v[1].tt != MRBC_TT_INTEGER ) goto ERROR_PARAM;
+  int i2c_adrs_7 = mrbc_integer(v[1]);
+  if( i2c_adrs_7 < 0x08 || i2c_adrs_7 > 0x77 ) goto ERROR_PARAM;
+
+  TYPED_ARRAY *ta = typed_array_get(&v[2]);
+  if( !ta || typed_array_bytes(ta) == 0 || typed_array_bytes(ta) > 256 ) goto ERROR_PARAM;
+
+  SPSC_QUEUE *q = 0;
+  if( argc == 3 && v[3].tt != MRBC_TT_NIL ) {
+    q = spsc_queue_get(&v[3]);
+    if( !q || q->item_size > 4 ) goto ERROR_PARAM;
+  }
+
+  if( i2c_xfer_acquire( vm ) == I2C_XFER_BUSY ) return;
+
+  i2c_slave.bank = v[2];
+  mrbc_incref( &i2c_slave.bank );
+  i2c_slave.queue = q ? v[3] : mrbc_nil_value();
+  mrbc_incref( &i2c_slave.queue );
+  i2c_slave.phase = I2C_SLAVE_IDLE;
+  i2c_slave.reg = 0;
+  i2c_slave.n_write = 0;
+  i2c_slave.n_error = 0;
+  i2c_slave.saved_init = hi2c1.Init;
+
+  hi2c1.Init.OwnAddress1 = i2c_adrs_7 << 1;
+  hi2c1.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
+  hi2c1.Init.NoStretchMode = I2C_NOSTRETCH_DISABLE;
+  HAL_StatusTypeDef sts = HAL_I2C_Init( &hi2c1 );
+
+  hal_disable_irq();
+  i2c_xfer.state = I2C_XFER_SLAVE;
+  if( sts == HAL_OK ) sts = HAL_I2C_EnableListen_IT( &hi2c1 );
+  hal_enable_irq();
+
+  if( sts != HAL_OK ) {
+    c_i2c_unlisten( vm, v, 0 );
+    mrbc_raisef(vm, 0, "i2c#listen: HAL layer error (status code %d)", sts);
+  }
+  return;
+
+ ERROR_PARAM:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), "i2c#listen: parameter error.");
+}
+
+
+//================================================================
+/*! stop the slave mode, and back to master.
+
+  (mruby usage)
+  i2c.unlisten
+*/
+static void c_i2c_unlisten(mrb_vm *vm, mrb_value v[], int argc)
+{
+  if( i2c_xfer.state != I2C_XFER_SLAVE ) return;
+
+  hal_disable_irq();
+  i2c_xfer.state = I2C_XFER_BUSY;	// the callbacks ignore, and to be released.
+  i2c_slave.phase = I2C_SLAVE_IDLE;
+  hal_enable_irq();
+
+  // (re-init resets the peripheral, also in the middle of the transfer)
+  HAL_I2C_DisableListen_IT( &hi2c1 );
+  hi2c1.Init = i2c_slave.saved_init;
+  HAL_I2C_Init( &hi2c1 );
+
+  mrbc_decref( &i2c_slave.bank );
+  mrbc_decref( &i2c_slave.queue );
+  i2c_slave.bank = mrbc_nil_value();
+  i2c_slave.queue = mrbc_nil_value();
+  i2c_xfer_release();
+}
+
+
+//================================================================
+/*! slave status.
+
+  (mruby usage)
+  i2c.listen_status  # -> [writes, errors]
+*/
+static void c_i2c_listen_status(mrb_vm *vm, mrb_value v[], int argc)
+{
+  mrbc_value ret = mrbc_array_new(vm, 2);
+  mrbc_array_push( &ret, &mrbc_integer_value(i2c_slave.n_write) );
+  mrbc_array_push( &ret, &mrbc_integer_value(i2c_slave.n_error) );
+  SET_RETURN(ret);
+}
+
+
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("I2C")
+  FILE("_autogen_class_i2c.h")
+
+  METHOD( "read",		c_i2c_read )
+  METHOD( "write",		c_i2c_write )
+  METHOD( "transaction",	c_i2c_transaction )
+  METHOD( "listen",		c_i2c_listen )
+  METHOD( "unlisten",		c_i2c_unlisten )
+  METHOD( "listen_status",	c_i2c_listen_status )
+*/
+#include "_autogen_class_i2c.h"
+
+
 //================================================================
 /*! initialize
 */
 void mrbc_init_class_i2c(void)
 {
-  mrbc_class *cls = mrbc_define_class(0, "I2C", 0);
+  mrbc_class *cls = MRBC_CLASS(I2C);
+  mrbc_set_const( MRBC_SYM(I2C), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
 
-  mrbc_define_method(0, cls, "read", c_i2c_read);
-  mrbc_define_method(0, cls, "write", c_i2c_write);
+#if defined(MRBC_METRICS)
+  mrbc_metric_register( &metric_i2c_errors_ );
+#endif
 }
@@ -16,13 +16,15 @@
 #include "main.h"
 #include "../mrubyc_src/mrubyc.h"
 #include "stm32f4_gpio.h"
+#include "typed_array.h"
 
 extern TIM_HandleTypeDef htim1;
 extern TIM_HandleTypeDef htim2;
 extern TIM_HandleTypeDef htim3;
 extern TIM_HandleTypeDef htim4;
 
-static const uint32_t PWM_TIMER_FREQ = 84000000;	// 84MHz
+// the timer clock is HCLK, 84MHz at the full speed. (see stm32f4_clock.c)
+#define PWM_TIMER_FREQ SystemCoreClock
 
 /*
   PWM pin assign table
@@ -61,11 +63,87 @@ typedef struct PWM_HANDLE {
   PIN_HANDLE pin;	//!< pin
   uint8_t unit_num;	//!< timer unit number.
   uint8_t channel;	//!< timer channel number.
-  uint16_t psc;         //!< value in the PSC register.
-  uint16_t period;	//!< value in the ARR register.
+  uint16_t period;	//!< value in the ARR register, or 0 if stopped.
   uint16_t duty;	//!< percent but stretch 100% to UINT16_MAX
 } PWM_HANDLE;
 
+/*
+  compare streaming.
+
+  The update event of the timer requests DMA1 Stream1 (channel 3) to
+  write the next sample to CCR. Only TIM2 has a free stream; TIM1_UP is
+  used by GPIO.play_port, and TIM3_UP and TIM4_UP share the streams of
+  SPI3_RX and USART2_TX.
+*/
+static const int PWM_STREAM_UNIT = 2;
+
+//! compare streaming state.
+enum {
+  PWM_STREAM_IDLE = 0,	//!< not used.
+  PWM_STREAM_BUSY,	//!< one-shot in play.
+  PWM_STREAM_LOOP,	//!< circular in play.
+  PWM_STREAM_DONE,	//!< one-shot completed.
+  PWM_STREAM_ERROR,	//!< DMA transfer error.
+};
+
+//! compare streaming context.
+static struct {
+  volatile uint8_t state;	//!< PWM_STREAM_*
+  volatile uint32_t halves;	//!< count of played halves of the buffer.
+  uint32_t rd_halves;		//!< halves taken by wait_half.
+  mrbc_tcb *tcb;		//!< owner task.
+  mrbc_value buf;		//!< buffer in play, kept from freeing.
+} pwm_stream;
+
+#define PWM_STREAM_FLAGS (DMA_LIFCR_CTCIF1 | DMA_LIFCR_CHTIF1 | \
+			  DMA_LIFCR_CTEIF1 | DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1)
+
+/*
+  ADC trigger.
+
+  A spare channel of the timer, that has no pin in PWM_PIN_ASSIGN, is
+  set in PWM mode 2. Its OCxREF rises at the compare match in every
+  period, and starts the ADC scan. Only CC1 of TIM3 is an ADC trigger
+  and it is used by the pins, so OC4REF is given to TRGO instead.
+*/
+static struct PWM_ADC_TRIGGER {
+  uint8_t channel;	//!< spare timer channel. (1..4)
+  uint32_t source;	//!< ADC_EXTERNALTRIGCONV_*
+} const TBL_UNIT_TO_ADC_TRIGGER[/* unit */] = {
+  { 0, 0 },
+  { 3, ADC_EXTERNALTRIGCONV_T1_CC3 },
+  { 4, ADC_EXTERNALTRIGCONV_T2_CC4 },
+  { 4, ADC_EXTERNALTRIGCONV_T3_TRGO },
+  { 4, ADC_EXTERNALTRIGCONV_T4_CC4 },
+};
+
+static uint8_t pwm_adc_unit;	//!< timer unit triggering the ADC, or 0.
+
+
+//================================================================
+/*! find the timer unit and channel of the pin.
+
+  @param  pin		target pin.
+  @param  unit_num	(out) timer unit number.
+  @param  channel	(out) timer channel.
+  @return		zero if found.
+  @note	Also used by InputCapture class.
+*/
+int pwm_find_pin_assign( const PIN_HANDLE *pin, int *unit_num, int *channel )
+{
+  static const int NUM = sizeof(PWM_PIN_ASSIGN)/sizeof(PWM_PIN_ASSIGN[0]);
+
+  for( int i = 0; i < NUM; i++ ) {
+    if( (PWM_PIN_ASSIGN[i].pin.port == pin->port) &&
+	(PWM_PIN_ASSIGN[i].pin.num  == pin->num) ) {
+      *unit_num = PWM_PIN_ASSIGN[i].unit_num;
+      *channel = PWM_PIN_ASSIGN[i].channel;
+      return 0;
+    }
+  }
+  return -1;
+}
+
 
 //================================================================
 /*! set frequency
@@ -88,12 +166,71 @@ static int pwm_set_frequency( PWM_HANDLE *hndl, double freq )
   __HAL_TIM_SET_AUTORELOAD(htim, arr);
   __HAL_TIM_SET_COMPARE(htim, TBL_CHANNEL_TO_HAL_CHANNEL[ hndl->channel ],
                         (uint32_t)arr * hndl->duty / UINT16_MAX);
-  hndl->psc = psc;
   hndl->period = arr;
 
   return 0;
 }
 
+
+//================================================================
+/*! get the period in ticks - 1.
+
+  ARR is read from the timer, since it may be scaled by the change of
+  the clock. (see pwm_clock_changed)
+*/
+static uint32_t pwm_get_period( const PWM_HANDLE *hndl )
+{
+  if( hndl->period == 0 ) return 0;
+  return __HAL_TIM_GET_AUTORELOAD( TBL_UNIT_TO_HAL_HANDLE[ hndl->unit_num ] );
+}
+
+//================================================================
+/*! set the running PWM again, after the change of the clock.
+
+  The prescaler is scaled to keep the ticks. If it can't, ARR and CCR
+  are scaled instead, so the frequency and the duty are kept, but
+  period_ticks changes.
+
+  @param  old_hz	timer clock before the change.
+  @param  new_hz	timer clock after the change.
+  @note	Called by hal_clock_set_level(). (see stm32f4_clock.c)
+*/
+void pwm_clock_changed( uint32_t old_hz, uint32_t new_hz )
+{
+  static const int NUM = sizeof(TBL_UNIT_TO_HAL_HANDLE)/sizeof(TBL_UNIT_TO_HAL_HANDLE[0]);
+
+  for( int unit = 1; unit < NUM; unit++ ) {
+    TIM_TypeDef *tim = TBL_UNIT_TO_HAL_HANDLE[unit]->Instance;
+    if( !(tim->CR1 & TIM_CR1_CEN) ) continue;
+
+    // any channel in the output PWM mode 1? (OCxM at bit 4, 12, 20, 28)
+    uint32_t ccmr = (tim->CCMR2 << 16) | (tim->CCMR1 & 0xffff);
+    int ch;
+    for( ch = 0; ch < 4; ch++ ) {
+      if( (tim->CCER & (TIM_CCER_CC1E << (ch*4))) &&
+	  ((ccmr >> (ch*8)) & 3) == 0 &&
+	  ((ccmr >> (ch*8 + 4)) & 7) == 6 ) break;
+    }
+    if( ch == 4 ) continue;	// used by InputCapture or GPIO.play_port.
+
+    uint64_t psc1 = (uint64_t)(tim->PSC + 1) * new_hz;
+    if( psc1 % old_hz == 0 && psc1 / old_hz <= 0x10000 ) {
+      tim->PSC = psc1 / old_hz - 1;
+      continue;
+    }
+
+    uint64_t arr1 = (uint64_t)(tim->ARR + 1) * new_hz / old_hz;
+    if( arr1 < 2 ) arr1 = 2;
+    if( arr1 > 0x10000 ) arr1 = 0x10000;
+    tim->ARR = arr1 - 1;
+    tim->CCR1 = (uint64_t)tim->CCR1 * new_hz / old_hz;
+    tim->CCR2 = (uint64_t)tim->CCR2 * new_hz / old_hz;
+    tim->CCR3 = (uint64_t)tim->CCR3 * new_hz / old_hz;
+    tim->CCR4 = (uint64_t)tim->CCR4 * new_hz / old_hz;
+  }
+}
+
+
 //================================================================
 /*! set period (us)
 */
@@ -104,18 +241,28 @@ static int pwm_set_period_us( PWM_HANDLE *hndl, unsigned int us )
 }
 
 //================================================================
-/*! set duty cycle in percentage.
+/*! set duty cycle in 0..UINT16_MAX, without float.
 */
-static int pwm_set_duty( PWM_HANDLE *hndl, double duty )
+static int pwm_set_duty_u16( PWM_HANDLE *hndl, uint16_t duty )
 {
   TIM_HandleTypeDef *htim = TBL_UNIT_TO_HAL_HANDLE[ hndl->unit_num ];
 
-  hndl->duty = duty / 100 * UINT16_MAX;
+  hndl->duty = duty;
   __HAL_TIM_SET_COMPARE(htim, TBL_CHANNEL_TO_HAL_CHANNEL[ hndl->channel ],
-                        (uint32_t)hndl->period * duty / 100);
+                        pwm_get_period( hndl ) * duty / UINT16_MAX);
   return 0;
 }
 
+//================================================================
+/*! set duty cycle in percentage.
+*/
+static int pwm_set_duty( PWM_HANDLE *hndl, double duty )
+{
+  if( duty < 0 ) duty = 0;
+  if( duty > 100 ) duty = 100;
+  return pwm_set_duty_u16( hndl, duty / 100 * UINT16_MAX );
+}
+
 
 //================================================================
 /*! set pulse width.
@@ -123,7 +270,7 @@ static int pwm_set_duty( PWM_HANDLE *hndl, double duty )
 static int pwm_set_pulse_width_us( PWM_HANDLE *hndl, unsigned int us )
 {
   TIM_HandleTypeDef *htim = TBL_UNIT_TO_HAL_HANDLE[ hndl->unit_num ];
-  uint16_t pw_cnt = (us * (PWM_TIMER_FREQ / 1000000)) / (hndl->psc + 1) - 1;
+  uint16_t pw_cnt = (us * (PWM_TIMER_FREQ / 1000000)) / (htim->Instance->PSC + 1) - 1;
 
   __HAL_TIM_SET_COMPARE(htim, TBL_CHANNEL_TO_HAL_CHANNEL[ hndl->channel ],
 			pw_cnt);
@@ -131,6 +278,174 @@ static int pwm_set_pulse_width_us( PWM_HANDLE *hndl, unsigned int us )
 }
 
 
+//================================================================
+/*! start the compare streaming.
+
+  @param  hndl		PWM handle on PWM_STREAM_UNIT.
+  @param  data		samples in 16bit.
+  @param  n		number of samples.
+  @param  circular	play in circular mode.
+*/
+static void pwm_stream_start( const PWM_HANDLE *hndl, const void *data,
+			      int n, int circular )
+{
+  TIM_TypeDef *tim = TBL_UNIT_TO_HAL_HANDLE[ PWM_STREAM_UNIT ]->Instance;
+
+  tim->DIER &= ~TIM_DIER_UDE;
+  DMA1_Stream1->CR = 0;
+  while( DMA1_Stream1->CR & DMA_SxCR_EN )
+    ;
+  DMA1->LIFCR = PWM_STREAM_FLAGS;
+  DMA1_Stream1->PAR = (uint32_t)(&tim->CCR1 + (hndl->channel - 1));
+  DMA1_Stream1->M0AR = (uint32_t)data;
+  DMA1_Stream1->NDTR = n;
+  DMA1_Stream1->FCR = 0;		// direct mode.
+  DMA1_Stream1->CR = (3 << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1 |
+		     DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC |
+		     DMA_SxCR_DIR_0 | DMA_SxCR_TCIE | DMA_SxCR_TEIE |
+		     (circular ? (DMA_SxCR_CIRC | DMA_SxCR_HTIE) : 0);
+
+  HAL_NVIC_SetPriority( DMA1_Stream1_IRQn, 0, 0 );
+  HAL_NVIC_EnableIRQ( DMA1_Stream1_IRQn );
+  DMA1_Stream1->CR |= DMA_SxCR_EN;
+  tim->DIER |= TIM_DIER_UDE;
+}
+
+
+//================================================================
+/*! stop the compare streaming. The last sample is kept in CCR.
+*/
+static void pwm_stream_stop( void )
+{
+  TBL_UNIT_TO_HAL_HANDLE[ PWM_STREAM_UNIT ]->Instance->DIER &= ~TIM_DIER_UDE;
+  DMA1_Stream1->CR &= ~DMA_SxCR_EN;
+}
+
+
+//================================================================
+/*! release the compare streaming. (in task)
+*/
+static void pwm_stream_release( void )
+{
+  mrbc_decref( &pwm_stream.buf );
+  pwm_stream.buf = mrbc_nil_value();
+  pwm_stream.state = PWM_STREAM_IDLE;
+
+  mrbc_wakeup_io( &pwm_stream );	// for tasks waiting.
+}
+
+
+//================================================================
+/*! DMA1 Stream1 interrupt handler. (TIM2_UP, compare streaming)
+*/
+void DMA1_Stream1_IRQHandler(void)
+{
+  MRBC_ISR_ENTER();
+
+  uint32_t sts = DMA1->LISR;
+  DMA1->LIFCR = PWM_STREAM_FLAGS;
+
+  if( sts & DMA_LISR_TEIF1 ) {
+    pwm_stream_stop();
+    pwm_stream.state = PWM_STREAM_ERROR;
+    mrbc_wakeup_io( &pwm_stream );
+
+  } else if( pwm_stream.state == PWM_STREAM_LOOP ) {
+    if( sts & DMA_LISR_HTIF1 ) pwm_stream.halves++;
+    if( sts & DMA_LISR_TCIF1 ) pwm_stream.halves++;
+    mrbc_wakeup_io( &pwm_stream );
+
+  } else if( pwm_stream.state == PWM_STREAM_BUSY && (sts & DMA_LISR_TCIF1) ) {
+    pwm_stream_stop();
+    pwm_stream.state = PWM_STREAM_DONE;
+    mrbc_wakeup_io( &pwm_stream );
+  }
+
+  MRBC_ISR_EXIT();
+}
+
+
+//================================================================
+/*! get the ADC trigger source of the PWM.
+
+  @param  pwm		PWM object.
+  @param  max_freq	maximum frequency of the trigger.
+  @return		ADC_EXTERNALTRIGCONV_*, or 0 if not a running PWM
+			or too fast.
+  @note	Used by ADC class. (see stm32f4_adc.c)
+*/
+uint32_t pwm_adc_trigger_source( const mrbc_value *pwm, uint32_t max_freq )
+{
+  if( pwm->tt != MRBC_TT_OBJECT || pwm->instance->cls->sym_id != MRBC_SYM(PWM) ) return 0;
+
+  const PWM_HANDLE *hndl = (const PWM_HANDLE *)(pwm->instance->data);
+  if( hndl->period == 0 ) return 0;
+
+  TIM_TypeDef *tim = TBL_UNIT_TO_HAL_HANDLE[ hndl->unit_num ]->Instance;
+  if( PWM_TIMER_FREQ / (tim->PSC + 1) / (tim->ARR + 1) > max_freq ) return 0;
+
+  return TBL_UNIT_TO_ADC_TRIGGER[ hndl->unit_num ].source;
+}
+
+
+//================================================================
+/*! stop the ADC trigger.
+
+  @note	Used by ADC class. (see stm32f4_adc.c)
+*/
+void pwm_adc_trigger_stop( void )
+{
+  if( pwm_adc_unit == 0 ) return;
+
+  HAL_TIM_PWM_Stop( TBL_UNIT_TO_HAL_HANDLE[ pwm_adc_unit ],
+		    TBL_CHANNEL_TO_HAL_CHANNEL[
+		      TBL_UNIT_TO_ADC_TRIGGER[ pwm_adc_unit ].channel ] );
+  pwm_adc_unit = 0;
+}
+
+
+//================================================================
+/*! start the ADC trigger in every period of the PWM.
+
+  @param  pwm		PWM object, checked by pwm_adc_trigger_source().
+  @param  ticks		counter value to trigger, or -1 for the middle of
+			the pulse.
+  @return		zero if started.
+  @note	Used by ADC class. (see stm32f4_adc.c)
+*/
+int pwm_adc_trigger_start( const mrbc_value *pwm, int ticks )
+{
+  const PWM_HANDLE *hndl = (const PWM_HANDLE *)(pwm->instance->data);
+  TIM_HandleTypeDef *htim = TBL_UNIT_TO_HAL_HANDLE[ hndl->unit_num ];
+  uint32_t channel = TBL_CHANNEL_TO_HAL_CHANNEL[
+			TBL_UNIT_TO_ADC_TRIGGER[ hndl->unit_num ].channel ];
+
+  // the pulse is from 0 to CCR. (edge aligned, PWM mode 1)
+  if( ticks < 0 ) {
+    ticks = __HAL_TIM_GET_COMPARE( htim, TBL_CHANNEL_TO_HAL_CHANNEL[ hndl->channel ] ) / 2;
+  }
+  if( ticks == 0 ) ticks = 1;	// OCxREF doesn't rise at CCR=0 in PWM mode 2.
+  if( (uint32_t)ticks > pwm_get_period( hndl ) ) return -1;
+
+  pwm_adc_trigger_stop();
+
+  TIM_OC_InitTypeDef sConfigOC = {
+    .OCMode = TIM_OCMODE_PWM2,
+    .Pulse = ticks,
+    .OCPolarity = TIM_OCPOLARITY_HIGH,
+    .OCFastMode = TIM_OCFAST_DISABLE,
+  };
+  if( HAL_TIM_PWM_ConfigChannel( htim, &sConfigOC, channel ) != HAL_OK ) return -1;
+  if( hndl->unit_num == 3 ) {
+    htim->Instance->CR2 = (htim->Instance->CR2 & ~TIM_CR2_MMS) | TIM_TRGO_OC4REF;
+  }
+  if( HAL_TIM_PWM_Start( htim, channel ) != HAL_OK ) return -1;
+
+  pwm_adc_unit = hndl->unit_num;
+  return 0;
+}
+
+
 //================================================================
 /*! constructor
 
@@ -147,21 +462,16 @@ static void c_pwm_new(mrbc_vm *vm, mrbc_value v[], int argc)
   if( gpio_set_pin_handle( &pin, &v[1] ) != 0 ) goto ERROR_RETURN;
 
   // find from PWM_PIN_ASSIGN table
-  static const int NUM = sizeof(PWM_PIN_ASSIGN)/sizeof(PWM_PIN_ASSIGN[0]);
-  int i;
-  for( i = 0; i < NUM; i++ ) {
-    if( (PWM_PIN_ASSIGN[i].pin.port == pin.port) &&
-	(PWM_PIN_ASSIGN[i].pin.num  == pin.num) ) break;
-  }
-  if( i == NUM ) goto ERROR_RETURN;
+  int unit_num, channel;
+  if( pwm_find_pin_assign( &pin, &unit_num, &channel ) != 0 ) goto ERROR_RETURN;
 
   // allocate instance with PWM_HANDLE.
   v[0] = mrbc_instance_new(vm, v[0].cls, sizeof(PWM_HANDLE));
   PWM_HANDLE *hndl = (PWM_HANDLE *)(v[0].instance->data);
 
   hndl->pin = pin;
-  hndl->unit_num = PWM_PIN_ASSIGN[i].unit_num;
-  hndl->channel  = PWM_PIN_ASSIGN[i].channel;
+  hndl->unit_num = unit_num;
+  hndl->channel  = channel;
   hndl->duty = UINT16_MAX / 2;
 
   // set frequency and duty
@@ -175,6 +485,11 @@ static void c_pwm_new(mrbc_vm *vm, mrbc_value v[], int argc)
     pwm_set_duty( hndl, MRBC_TO_FLOAT(duty));
   }
 
+  // ARR and CCR are loaded at the update event, not to cut a pulse.
+  TIM_HandleTypeDef *htim = TBL_UNIT_TO_HAL_HANDLE[hndl->unit_num];
+  htim->Instance->CR1 |= TIM_CR1_ARPE;
+  __HAL_TIM_ENABLE_OCxPRELOAD( htim, TBL_CHANNEL_TO_HAL_CHANNEL[hndl->channel] );
+
   // set GPIO pin.
   gpio_setmode_pwm( &pin, hndl->unit_num );
 
@@ -254,16 +569,272 @@ static void c_pwm_pulse_width_us(mrbc_vm *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! PWM set duty cycle in 0..65535, without float.
+
+  pwm1.duty_u16 = 32768
+*/
+static void c_pwm_set_duty_u16(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  PWM_HANDLE *hndl = (PWM_HANDLE *)(v[0].instance->data);
+
+  if( v[1].tt != MRBC_TT_INTEGER ||
+      mrbc_integer(v[1]) < 0 || mrbc_integer(v[1]) > UINT16_MAX ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  pwm_set_duty_u16( hndl, mrbc_integer(v[1]) );
+}
+
+
+//================================================================
+/*! PWM set pulse width in timer ticks.
+
+  pwm1.pulse_ticks = 100	# 0..period_ticks
+*/
+static void c_pwm_set_pulse_ticks(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  PWM_HANDLE *hndl = (PWM_HANDLE *)(v[0].instance->data);
+  TIM_HandleTypeDef *htim = TBL_UNIT_TO_HAL_HANDLE[ hndl->unit_num ];
+
+  if( v[1].tt != MRBC_TT_INTEGER ||
+      mrbc_integer(v[1]) < 0 || mrbc_integer(v[1]) > pwm_get_period( hndl ) + 1 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  __HAL_TIM_SET_COMPARE(htim, TBL_CHANNEL_TO_HAL_CHANNEL[ hndl->channel ],
+			mrbc_integer(v[1]));
+}
+
+
+//================================================================
+/*! PWM get the period in timer ticks.
+
+  pwm1.period_ticks	# -> Integer
+*/
+static void c_pwm_period_ticks(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  PWM_HANDLE *hndl = (PWM_HANDLE *)(v[0].instance->data);
+
+  SET_INT_RETURN( pwm_get_period( hndl ) + 1 );
+}
+
+
+//================================================================
+/*! PWM set duty cycles of the channels of a timer at once.
+
+  PWM.write_duty_u16( [pwm1, pwm2, pwm3, pwm4], [d1, d2, d3, d4] )
+
+  @note
+    All the PWMs must be on the same timer unit.
+    The new values are taken at the same update event.
+*/
+static void c_pwm_write_duty_u16(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 2 || v[1].tt != MRBC_TT_ARRAY || v[2].tt != MRBC_TT_ARRAY ||
+      mrbc_array_size(&v[1]) != mrbc_array_size(&v[2]) ) goto ERROR_RETURN;
+
+  int n = mrbc_array_size(&v[1]);
+  int unit_num = 0;
+  for( int i = 0; i < n; i++ ) {
+    mrbc_value *pwm = &v[1].array->data[i];
+    mrbc_value *duty = &v[2].array->data[i];
+    if( pwm->tt != MRBC_TT_OBJECT || pwm->instance->cls != v[0].cls ) goto ERROR_RETURN;
+    if( duty->tt != MRBC_TT_INTEGER ||
+	mrbc_integer(*duty) < 0 || mrbc_integer(*duty) > UINT16_MAX ) goto ERROR_RETURN;
+
+    PWM_HANDLE *hndl = (PWM_HANDLE *)(pwm->instance->data);
+    if( i == 0 ) unit_num = hndl->unit_num;
+    if( hndl->unit_num != unit_num ) goto ERROR_RETURN;
+  }
+  if( n == 0 ) return;
+
+  // the preloads are not taken while UDIS is set.
+  TIM_TypeDef *tim = TBL_UNIT_TO_HAL_HANDLE[unit_num]->Instance;
+  tim->CR1 |= TIM_CR1_UDIS;
+  for( int i = 0; i < n; i++ ) {
+    PWM_HANDLE *hndl = (PWM_HANDLE *)(v[1].array->data[i].instance->data);
+    pwm_set_duty_u16( hndl, mrbc_integer(v[2].array->data[i]) );
+  }
+  tim->CR1 &= ~TIM_CR1_UDIS;
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! PWM play the samples in the compare register by DMA.
+
+  pwm1.play( buf, 8000 )		# one-shot, wait until the end.
+  pwm1.play( buf, 8000, loop:true )	# circular, returns at once.
+
+  @param  buf	Int16Array of the pulse widths in ticks. (0..period_ticks)
+  @param  rate	samples per second, that is also the PWM frequency.
+  @note
+    Only the PWMs on TIM2 (PA0, PA1, PB10) can play.
+    In circular mode, wait_half tells the half of the buffer to refill.
+*/
+static void c_pwm_play(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  MRBC_KW_ARG(loop);
+  if( !MRBC_KW_END() ) goto RETURN;
+
+  PWM_HANDLE *hndl = (PWM_HANDLE *)(v[0].instance->data);
+  mrbc_tcb *tcb = VM2TCB(vm);
+
+  // take the result, or wait for the other task.
+  hal_disable_irq();
+  int sts = pwm_stream.state;
+  if( sts != PWM_STREAM_IDLE && pwm_stream.tcb != tcb &&
+      pwm_stream.tcb->state == TASKSTATE_DORMANT ) {
+    pwm_stream_stop();
+    sts = PWM_STREAM_IDLE;
+    pwm_stream.state = sts;
+  }
+  if( sts == PWM_STREAM_BUSY ||
+      (sts >= PWM_STREAM_DONE && pwm_stream.tcb != tcb) ) {
+    mrbc_wait_io( tcb, &pwm_stream );
+    vm->flag_retry_call = 1;
+    hal_enable_irq();
+    goto RETURN;
+  }
+  hal_enable_irq();
+
+  if( sts == PWM_STREAM_LOOP && pwm_stream.tcb != tcb ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "PWM stream in use");
+    goto RETURN;
+  }
+  if( sts >= PWM_STREAM_DONE ) {
+    pwm_stream_release();
+    if( sts == PWM_STREAM_ERROR ) {
+      mrbc_raise(vm, 0, "PWM DMA transfer error");
+    } else {
+      SET_NIL_RETURN();
+    }
+    goto RETURN;
+  }
+  if( sts == PWM_STREAM_LOOP ) {	// restart by the owner.
+    pwm_stream_stop();
+    pwm_stream_release();
+  }
+
+  // check the arguments.
+  TYPED_ARRAY *ta = MRBC_KW_NARGC() == 2 ? typed_array_get(&v[1]) : 0;
+  if( !ta || ta->elsize != 2 || ta->size == 0 || ta->size > 0xffff ||
+      !MRBC_ISNUMERIC(v[2]) || MRBC_TO_FLOAT(v[2]) <= 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    goto RETURN;
+  }
+  if( hndl->unit_num != PWM_STREAM_UNIT ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "PWM play needs TIM2");
+    goto RETURN;
+  }
+  int circular = MRBC_KW_ISVALID(loop) && mrbc_type(loop) != MRBC_TT_NIL &&
+		 mrbc_type(loop) != MRBC_TT_FALSE;
+
+  pwm_set_frequency( hndl, MRBC_TO_FLOAT(v[2]) );
+  HAL_TIM_PWM_Start( TBL_UNIT_TO_HAL_HANDLE[hndl->unit_num],
+		     TBL_CHANNEL_TO_HAL_CHANNEL[hndl->channel] );
+
+  mrbc_incref( &v[1] );
+  pwm_stream.buf = v[1];
+  pwm_stream.tcb = tcb;
+  pwm_stream.halves = 0;
+  pwm_stream.rd_halves = 0;
+
+  hal_disable_irq();
+  pwm_stream.state = circular ? PWM_STREAM_LOOP : PWM_STREAM_BUSY;
+  pwm_stream_start( hndl, typed_array_data(ta), ta->size, circular );
+  if( !circular ) {
+    mrbc_wait_io( tcb, &pwm_stream );
+    vm->flag_retry_call = 1;
+  }
+  hal_enable_irq();
+
+ RETURN:
+  MRBC_KW_DELETE(loop);
+}
+
+
+//================================================================
+/*! PWM wait for a half of the buffer played, in circular mode.
+
+  half = pwm1.wait_half		# -> 0 (first half) or 1 (second half)
+
+  @return	the half of the buffer to refill, or nil if not playing.
+  @note	If the refill is late more than a half, the older one is skipped.
+*/
+static void c_pwm_wait_half(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_tcb *tcb = VM2TCB(vm);
+
+  hal_disable_irq();
+  if( pwm_stream.state != PWM_STREAM_LOOP || pwm_stream.tcb != tcb ) {
+    hal_enable_irq();
+    SET_NIL_RETURN();
+    return;
+  }
+  uint32_t halves = pwm_stream.halves;
+  if( halves == pwm_stream.rd_halves ) {
+    mrbc_wait_io( tcb, &pwm_stream );
+    vm->flag_retry_call = 1;
+    hal_enable_irq();
+    return;
+  }
+  hal_enable_irq();
+
+  if( halves - pwm_stream.rd_halves > 1 ) pwm_stream.rd_halves = halves - 1;
+  SET_INT_RETURN( pwm_stream.rd_halves++ & 1 );
+}
+
+
+//================================================================
+/*! PWM stop playing.
+
+  pwm1.stop
+*/
+static void c_pwm_stop(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  PWM_HANDLE *hndl = (PWM_HANDLE *)(v[0].instance->data);
+
+  if( hndl->unit_num != PWM_STREAM_UNIT ) return;
+  if( pwm_stream.state == PWM_STREAM_IDLE ) return;
+  if( pwm_stream.tcb != VM2TCB(vm) ) return;
+
+  pwm_stream_stop();
+  pwm_stream_release();
+}
+
+
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("PWM")
+  FILE("_autogen_class_pwm.h")
+
+  METHOD( "frequency",		c_pwm_frequency )
+  METHOD( "period_us",		c_pwm_period_us )
+  METHOD( "duty",		c_pwm_duty )
+  METHOD( "pulse_width_us",	c_pwm_pulse_width_us )
+  METHOD( "duty_u16=",		c_pwm_set_duty_u16 )
+  METHOD( "pulse_ticks=",	c_pwm_set_pulse_ticks )
+  METHOD( "period_ticks",	c_pwm_period_ticks )
+  METHOD( "write_duty_u16",	c_pwm_write_duty_u16 )
+  METHOD( "wait_half",		c_pwm_wait_half )
+  METHOD( "stop",		c_pwm_stop )
+*/
+#include "_autogen_class_pwm.h"
+
+
 //================================================================
 /*! Initializer
 */
 void mrbc_init_class_pwm(void)
 {
-  mrbc_class *cls = mrbc_define_class(0, "PWM", 0);
+  mrbc_class *cls = MRBC_CLASS(PWM);
+  mrbc_set_const( MRBC_SYM(PWM), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
 
-  mrbc_define_method(0, cls, "new", c_pwm_new);
-  mrbc_define_method(0, cls, "frequency", c_pwm_frequency);
-  mrbc_define_method(0, cls, "period_us", c_pwm_period_us);
-  mrbc_define_method(0, cls, "duty", c_pwm_duty);
-  mrbc_define_method(0, cls, "pulse_width_us", c_pwm_pulse_width_us);
+  mrbc_define_method_kw(0, cls, "new", c_pwm_new);
+  mrbc_define_method_kw(0, cls, "play", c_pwm_play);
 }
@@ -10,11 +10,25 @@
 
   This file is distributed under BSD 3-Clause License.
 
+  The slave mode exchanges the frames of the fixed length by DMA.
+
+    tx = ByteArray.new( 8 )	# read by the host.
+    rx = ByteArray.new( 8 )	# written by the host.
+    q = Queue.new( 4 )
+    spi.listen( tx, rx, q )	# NSS is PA15. (CN7 17)
+    n = q.pop_wait		# count of the frames.
+
+  The host must transfer the whole frame while NSS is low. The DMA is
+  restarted at the end of each frame in the interrupt handler, and
+  the queue is pushed then.
   </pre>
 */
 
 #include "main.h"
 #include "../mrubyc_src/mrubyc.h"
+#include "typed_array.h"
+#include "spsc_queue.h"
+#include "stm32f4_spi.h"
 
 //@cond
 #include <string.h>
@@ -23,11 +37,51 @@
 extern SPI_HandleTypeDef hspi3;
 
 static const uint32_t SPI_TIMEOUT_ms = 3000;
-static const uint32_t SPI_BASEFREQ = 42000000U;	// 42MHz
+// APB1 clock, HCLK/2. 42MHz at the full speed. (see stm32f4_clock.c)
+#define SPI_BASEFREQ (SystemCoreClock / 2)
+
+//! Transfers of this size or more use DMA and do not block other tasks.
+static const int SPI_DMA_MIN_BYTES = 16;
+
+//! non-blocking transfer state.
+enum {
+  SPI_XFER_IDLE = 0,	//!< bus free.
+  SPI_XFER_BUSY,	//!< in transfer, or the bus is used.
+  SPI_XFER_DONE,	//!< DMA transfer completed.
+  SPI_XFER_ERROR,	//!< DMA transfer failed.
+  SPI_XFER_LOCKED,	//!< the bus is used by the other driver.
+  SPI_XFER_SLAVE,	//!< listening as slave.
+  SPI_XFER_BACKGROUND,	//!< DMA transmit of the other driver, released at the end.
+};
+
+//! non-blocking transfer context.
+static struct {
+  volatile uint8_t state;	//!< SPI_XFER_*
+  uint32_t error;		//!< HAL error code.
+  mrbc_tcb *tcb;		//!< bus owner task.
+  mrbc_value ret;		//!< String to be returned, or nil.
+  uint8_t *buf;			//!< temporary buffer to be freed, or NULL.
+  mrbc_value bg_owner;		//!< object kept during the background DMA.
+  mrbc_tcb *bg_tcb;		//!< task of bg_owner.
+} spi_xfer;
+
+//! setting of the SPI class, kept while the bus is locked or in slave.
+static SPI_InitTypeDef spi_saved_init;
+
+//! slave mode context.
+static struct {
+  mrbc_value tx;		//!< frame sent to the host, typed array.
+  mrbc_value rx;		//!< frame received from the host, typed array.
+  mrbc_value queue;		//!< Queue to notify the frames, or nil.
+  uint32_t n_frame;		//!< count of the frames.
+  uint32_t n_error;		//!< count of the errors. (overrun)
+} spi_slave;
 
 
 uint8_t * make_output_buffer(mrb_vm *vm, mrb_value v[], int argc,
 			     int start_idx, int *ret_bufsiz);
+const uint8_t * borrow_output_buffer(mrb_value v[], int argc,
+				     int start_idx, int *ret_bufsiz);
 static void c_spi_setmode(mrbc_vm *vm, mrbc_value v[], int argc);
 
 
@@ -101,6 +155,270 @@ static int spi_setmode( SPI_HandleTypeDef *hspi,
 }
 
 
+//================================================================
+/*! acquire the bus, or get the result of DMA transfer.
+
+  @param  vm	Pointer to vm
+  @return	SPI_XFER_IDLE	bus acquired. start new transfer.
+		SPI_XFER_BUSY	must wait. the method will be called again.
+		SPI_XFER_DONE or SPI_XFER_ERROR   result of own transfer.
+*/
+static int spi_xfer_acquire( mrbc_vm *vm )
+{
+  mrbc_tcb *tcb = VM2TCB(vm);
+  int ret = SPI_XFER_IDLE;
+
+  hal_disable_irq();
+
+  // discard the result if the owner task has been terminated.
+  // (its memory has been released together with the VM)
+  if( (spi_xfer.state == SPI_XFER_DONE || spi_xfer.state == SPI_XFER_ERROR) &&
+      spi_xfer.tcb != tcb && spi_xfer.tcb->state == TASKSTATE_DORMANT ) {
+    spi_xfer.state = SPI_XFER_IDLE;
+  }
+
+  // the background DMA has ended. (the owner is released with the VM)
+  if( spi_xfer.state == SPI_XFER_IDLE && spi_xfer.bg_tcb ) {
+    mrbc_value owner = spi_xfer.bg_owner;
+    int flag_alive = spi_xfer.bg_tcb->state != TASKSTATE_DORMANT;
+    spi_xfer.bg_tcb = 0;
+    hal_enable_irq();
+    if( flag_alive ) mrbc_decref( &owner );
+    hal_disable_irq();
+  }
+
+  if( spi_xfer.state == SPI_XFER_IDLE ) {
+    spi_xfer.state = SPI_XFER_BUSY;
+    spi_xfer.tcb = tcb;
+    spi_xfer.ret = mrbc_nil_value();
+    spi_xfer.buf = 0;
+
+  } else if( spi_xfer.state == SPI_XFER_SLAVE ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "SPI is listening as slave");
+    ret = SPI_XFER_BUSY;
+
+  } else if( spi_xfer.tcb == tcb &&
+	     (spi_xfer.state == SPI_XFER_DONE || spi_xfer.state == SPI_XFER_ERROR) ) {
+    ret = spi_xfer.state;
+
+  } else {
+    mrbc_wait_io( tcb, &hspi3 );
+    vm->flag_retry_call = 1;
+    ret = SPI_XFER_BUSY;
+  }
+
+  hal_enable_irq();
+
+  return ret;
+}
+
+
+//================================================================
+/*! release the bus.
+
+  @param  vm	Pointer to vm
+*/
+static void spi_xfer_release( mrbc_vm *vm )
+{
+  if( spi_xfer.buf ) mrbc_free( vm, spi_xfer.buf );
+  spi_xfer.buf = 0;
+  spi_xfer.ret = mrbc_nil_value();
+  spi_xfer.state = SPI_XFER_IDLE;
+
+  mrbc_wakeup_io( &hspi3 );	// for tasks waiting for the bus.
+}
+
+
+//================================================================
+/*! wait for DMA transfer started.
+
+  @param  vm	Pointer to vm
+  @note   The method will be called again to get the result.
+*/
+static void spi_xfer_wait( mrbc_vm *vm )
+{
+  hal_disable_irq();
+  if( spi_xfer.state == SPI_XFER_BUSY ) {
+    mrbc_wait_io( VM2TCB(vm), &hspi3 );
+  }
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! take the result of own DMA transfer.
+
+  @param  vm	Pointer to vm
+  @param  v	argments
+  @param  sts	acquire status. SPI_XFER_DONE or SPI_XFER_ERROR
+*/
+static void spi_xfer_result( mrbc_vm *vm, mrbc_value v[], int sts )
+{
+  mrbc_value ret = spi_xfer.ret;
+  spi_xfer.ret = mrbc_nil_value();
+  spi_xfer_release( vm );
+
+  if( sts == SPI_XFER_ERROR ) {
+    mrbc_decref( &ret );
+    mrbc_raisef(vm, 0, "HAL layer error (error code %d)", (int)spi_xfer.error);
+    return;
+  }
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! acquire the bus for the other driver, such as SD card.
+
+  The driver transfers with hspi3 directly, and the DMA callbacks are
+  ignored here while the bus is locked.
+
+  @param  vm	Pointer to vm
+  @param  freq	clock frequency (Hz). mode 0, MSB first.
+  @retval 0	bus acquired.
+  @retval 1	must wait. the method will be called again.
+*/
+int spi_bus_acquire( mrbc_vm *vm, int32_t freq )
+{
+  if( spi_xfer_acquire( vm ) == SPI_XFER_BUSY ) return 1;
+
+  spi_xfer.state = SPI_XFER_LOCKED;
+  spi_saved_init = hspi3.Init;
+  spi_setmode( &hspi3, freq, 0, 0 );
+
+  return 0;
+}
+
+
+//================================================================
+/*! release the bus acquired by spi_bus_acquire().
+
+  @param  vm	Pointer to vm
+*/
+void spi_bus_release( mrbc_vm *vm )
+{
+  hspi3.Init = spi_saved_init;
+  __HAL_SPI_DISABLE( &hspi3 );
+  HAL_SPI_Init( &hspi3 );
+  __HAL_SPI_ENABLE( &hspi3 );
+
+  spi_xfer_release( vm );
+}
+
+
+//================================================================
+/*! transmit by DMA in background, on the bus acquired by spi_bus_acquire().
+
+  The bus is released at the end of the transfer in the interrupt
+  handler, instead of spi_bus_release(). The owner object, holding
+  the data, is kept until the bus is acquired next.
+
+  @param  vm	Pointer to vm
+  @param  owner	object holding the data.
+  @param  data	data to send.
+  @param  len	length of data.
+  @return	0 if started, or -1 if HAL error. (the bus is released)
+*/
+int spi_bus_transmit_background( mrbc_vm *vm, mrbc_value *owner,
+				 const void *data, int len )
+{
+  mrbc_incref( owner );
+  spi_xfer.bg_owner = *owner;
+  spi_xfer.bg_tcb = VM2TCB(vm);
+
+  hal_disable_irq();
+  spi_xfer.state = SPI_XFER_BACKGROUND;
+  HAL_StatusTypeDef sts = HAL_SPI_Transmit_DMA( &hspi3, (uint8_t *)data, len );
+  hal_enable_irq();
+
+  if( sts != HAL_OK ) {
+    spi_bus_release( vm );
+    return -1;
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! start the DMA of the slave frame.
+*/
+static HAL_StatusTypeDef spi_slave_start( void )
+{
+  TYPED_ARRAY *tx = typed_array_get( &spi_slave.tx );
+  TYPED_ARRAY *rx = typed_array_get( &spi_slave.rx );
+
+  return HAL_SPI_TransmitReceive_DMA( &hspi3, typed_array_data(tx),
+			typed_array_data(rx), typed_array_bytes(tx) );
+}
+
+
+//================================================================
+/*! end of the slave frame, or error. (in ISR)
+*/
+static void spi_slave_complete( SPI_HandleTypeDef *hspi, int state )
+{
+  if( state == SPI_XFER_DONE ) {
+    spi_slave.n_frame++;
+    SPSC_QUEUE *q = spsc_queue_get( &spi_slave.queue );
+    if( q ) spsc_queue_push_int( q, spi_slave.n_frame );
+  } else {
+    spi_slave.n_error++;
+    __HAL_SPI_CLEAR_OVRFLAG( hspi );
+  }
+
+  spi_slave_start();
+}
+
+
+//================================================================
+/*! DMA transfer complete or error.
+*/
+static void spi_xfer_complete( SPI_HandleTypeDef *hspi, int state )
+{
+  if( hspi != &hspi3 ) return;
+  if( spi_xfer.state == SPI_XFER_SLAVE ) {
+    spi_slave_complete( hspi, state );
+    return;
+  }
+  if( spi_xfer.state == SPI_XFER_BACKGROUND ) {
+    spi_xfer.error = hspi->ErrorCode;
+    hspi->Init = spi_saved_init;
+    __HAL_SPI_DISABLE( hspi );
+    HAL_SPI_Init( hspi );
+    __HAL_SPI_ENABLE( hspi );
+    spi_xfer.state = SPI_XFER_IDLE;
+    mrbc_wakeup_io( &hspi3 );
+    return;
+  }
+  if( spi_xfer.state != SPI_XFER_BUSY ) return;
+
+  spi_xfer.error = hspi->ErrorCode;
+  spi_xfer.state = state;
+  mrbc_wakeup_io( &hspi3 );
+}
+
+
+//================================================================
+/*! HAL callbacks. (override HAL weak functions)
+*/
+void HAL_SPI_TxCpltCallback( SPI_HandleTypeDef *hspi )
+{
+  spi_xfer_complete( hspi, SPI_XFER_DONE );
+}
+
+void HAL_SPI_TxRxCpltCallback( SPI_HandleTypeDef *hspi )
+{
+  spi_xfer_complete( hspi, SPI_XFER_DONE );
+}
+
+void HAL_SPI_ErrorCallback( SPI_HandleTypeDef *hspi )
+{
+  spi_xfer_complete( hspi, SPI_XFER_ERROR );
+}
+
+
 //================================================================
 /*! SPI constructor
 
@@ -139,6 +457,10 @@ static void c_spi_setmode(mrbc_vm *vm, mrbc_value v[], int argc)
 {
   MRBC_KW_ARG( unit, frequency, mode, first_bit );
   if( !MRBC_KW_END() ) goto RETURN;
+  if( spi_xfer.state == SPI_XFER_SLAVE ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "SPI is listening as slave");
+    goto RETURN;
+  }
 
   int32_t spi_freq = -1;
   int spi_mode = -1;
@@ -162,23 +484,60 @@ static void c_spi_setmode(mrbc_vm *vm, mrbc_value v[], int argc)
 
   @verbatim
   s = spi.read(read_bytes) -> String
+  buf = spi.read(ByteArray.new(n)) -> buf
   @endverbatim
 */
 static void c_spi_read(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  if( v[1].tt != MRBC_TT_INTEGER ) {
+  TYPED_ARRAY *ta = typed_array_get(&v[1]);
+  if( !ta && v[1].tt != MRBC_TT_INTEGER ) {
     mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
     return;
   }
 
-  int read_bytes = mrbc_integer(v[1]);
-  mrbc_value ret = mrbc_string_new(vm, 0, read_bytes);
-  uint8_t *buf = (uint8_t *)mrbc_string_cstr(&ret);
+  int read_bytes = ta ? typed_array_bytes(ta) : mrbc_integer(v[1]);
+
+  // Acquire the bus, or take the result of DMA transfer.
+  int sts_xfer = spi_xfer_acquire( vm );
+  if( sts_xfer == SPI_XFER_BUSY ) return;	// will be called again.
+  if( sts_xfer != SPI_XFER_IDLE ) {
+    spi_xfer_result( vm, v, sts_xfer );
+    return;
+  }
+
+  mrbc_value ret;
+  uint8_t *buf;
+  if( ta ) {
+    // receive into the typed array directly.
+    ret = v[1];
+    mrbc_incref( &ret );
+    buf = typed_array_data(ta);
+  } else {
+    ret = mrbc_string_new(vm, 0, read_bytes);
+    buf = (uint8_t *)mrbc_string_cstr(&ret);
+    if( buf ) mrbc_alloc_compact_remove( &ret.string->data );	// by DMA.
+  }
+  if( !buf ) {
+    spi_xfer_release( vm );
+    return;		// ENOMEM
+  }
 
   memset(buf, 0, read_bytes);
 
   HAL_StatusTypeDef sts;
-  sts = HAL_SPI_TransmitReceive(&hspi3, buf, buf, read_bytes, SPI_TIMEOUT_ms );
+  if( read_bytes >= SPI_DMA_MIN_BYTES ) {
+    // receive into the String directly, and wait in other task running.
+    spi_xfer.ret = ret;
+    sts = HAL_SPI_TransmitReceive_DMA(&hspi3, buf, buf, read_bytes );
+    if( sts == HAL_OK ) {
+      spi_xfer_wait( vm );
+      return;		// will be called again.
+    }
+    spi_xfer.ret = mrbc_nil_value();
+  } else {
+    sts = HAL_SPI_TransmitReceive(&hspi3, buf, buf, read_bytes, SPI_TIMEOUT_ms );
+  }
+  spi_xfer_release( vm );
 
   if( sts != HAL_OK ) {
     mrbc_raisef(vm, 0, "HAL layer error (status code %d)", sts);
@@ -195,17 +554,44 @@ static void c_spi_read(mrbc_vm *vm, mrbc_value v[], int argc)
   spi.write( "str" )
   spi.write( d1, d2, ...)
   spi.write( [d1, d2,...] )
+  spi.write( ByteArray )
   @endverbatim
 */
 static void c_spi_write(mrbc_vm *vm, mrbc_value v[], int argc)
 {
+  // Acquire the bus, or take the result of DMA transfer.
+  int sts_xfer = spi_xfer_acquire( vm );
+  if( sts_xfer == SPI_XFER_BUSY ) return;	// will be called again.
+  if( sts_xfer != SPI_XFER_IDLE ) {
+    spi_xfer_result( vm, v, sts_xfer );	// returns nil.
+    return;
+  }
+
   int bufsiz;
-  uint8_t *buf = make_output_buffer(vm, v, argc, 1, &bufsiz );
-  if( !buf ) return;
+  uint8_t *buf;
+  // send a single String or typed array directly.
+  // it is kept in the register until this method is called again.
+  buf = (uint8_t *)borrow_output_buffer( v, argc, 1, &bufsiz );
+  if( !buf ) {
+    buf = make_output_buffer(vm, v, argc, 1, &bufsiz );
+    if( !buf ) {
+      spi_xfer_release( vm );
+      return;
+    }
+    spi_xfer.buf = buf;
+  }
 
   HAL_StatusTypeDef sts;
-  sts = HAL_SPI_Transmit(&hspi3, buf, bufsiz, SPI_TIMEOUT_ms );
-  mrbc_free( vm, buf );
+  if( bufsiz >= SPI_DMA_MIN_BYTES ) {
+    sts = HAL_SPI_Transmit_DMA(&hspi3, buf, bufsiz );
+    if( sts == HAL_OK ) {
+      spi_xfer_wait( vm );
+      return;		// will be called again.
+    }
+  } else {
+    sts = HAL_SPI_Transmit(&hspi3, buf, bufsiz, SPI_TIMEOUT_ms );
+  }
+  spi_xfer_release( vm );
 
   if( sts != HAL_OK ) {
     mrbc_raisef(vm, 0, "HAL layer error (status code %d)", sts);
@@ -228,17 +614,29 @@ static void c_spi_transfer(mrbc_vm *vm, mrbc_value v[], int argc)
   int bufsiz;
 
   if( argc == 0 ) goto ERROR_ARGUMENT;
+  if( argc >= 2 && v[2].tt != MRBC_TT_INTEGER ) goto ERROR_ARGUMENT;
+
+  // Acquire the bus, or take the result of DMA transfer.
+  int sts_xfer = spi_xfer_acquire( vm );
+  if( sts_xfer == SPI_XFER_BUSY ) return;	// will be called again.
+  if( sts_xfer != SPI_XFER_IDLE ) {
+    spi_xfer_result( vm, v, sts_xfer );
+    return;
+  }
 
   buf = make_output_buffer(vm, v, 1, 1, &bufsiz );
-  if( !buf ) return;
+  if( !buf ) {
+    spi_xfer_release( vm );
+    return;
+  }
 
   if( argc >= 2 ) {
-    if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_ARGUMENT;
     int additional_read_bytes = mrbc_integer(v[2]);
 
     uint8_t *buf2 = mrbc_realloc(vm, buf, bufsiz + additional_read_bytes);
     if( !buf2 ) {
       mrbc_free(vm, buf);
+      spi_xfer_release( vm );
       mrbc_raise(vm, 0, 0);
       return;
     }
@@ -249,9 +647,22 @@ static void c_spi_transfer(mrbc_vm *vm, mrbc_value v[], int argc)
   }
 
   mrbc_value ret = mrbc_string_new_alloc(vm, buf, bufsiz);
+  if( ret.string ) mrbc_alloc_compact_remove( &ret.string->data );	// by DMA.
 
   HAL_StatusTypeDef sts;
-  sts = HAL_SPI_TransmitReceive(&hspi3, buf, buf, bufsiz, SPI_TIMEOUT_ms );
+  if( bufsiz >= SPI_DMA_MIN_BYTES ) {
+    // transfer in the String buffer, and wait in other task running.
+    spi_xfer.ret = ret;
+    sts = HAL_SPI_TransmitReceive_DMA(&hspi3, buf, buf, bufsiz );
+    if( sts == HAL_OK ) {
+      spi_xfer_wait( vm );
+      return;		// will be called again.
+    }
+    spi_xfer.ret = mrbc_nil_value();
+  } else {
+    sts = HAL_SPI_TransmitReceive(&hspi3, buf, buf, bufsiz, SPI_TIMEOUT_ms );
+  }
+  spi_xfer_release( vm );
 
   if( sts != HAL_OK ) {
     mrbc_raisef(vm, 0, "HAL layer error (status code %d)", sts);
@@ -266,18 +677,147 @@ static void c_spi_transfer(mrbc_vm *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! stop the slave mode, and back to master.
+
+  @verbatim
+  spi.unlisten
+  @endverbatim
+*/
+static void c_spi_unlisten(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( spi_xfer.state != SPI_XFER_SLAVE ) return;
+
+  hal_disable_irq();
+  spi_xfer.state = SPI_XFER_BUSY;	// the callbacks ignore, and to be released.
+  hal_enable_irq();
+
+  HAL_SPI_Abort( &hspi3 );
+  HAL_GPIO_DeInit( GPIOA, GPIO_PIN_15 );
+  hspi3.Init = spi_saved_init;
+  __HAL_SPI_DISABLE( &hspi3 );
+  HAL_SPI_Init( &hspi3 );
+  __HAL_SPI_ENABLE( &hspi3 );
+
+  mrbc_decref( &spi_slave.tx );
+  mrbc_decref( &spi_slave.rx );
+  mrbc_decref( &spi_slave.queue );
+  spi_slave.tx = spi_slave.rx = spi_slave.queue = mrbc_nil_value();
+  spi_xfer_release( vm );
+}
+
+
+//================================================================
+/*! listen as slave.
+
+  @verbatim
+  spi.listen( tx, rx, queue = nil )
+    tx, rx  typed arrays of the same size, a frame.
+    queue   Queue, pushed the count of the frames.
+
+  The clock mode and bit order are of setmode.
+  CN   pin   GPIO  Usage
+  CN7  17    PA15  SPI3_NSS
+  @endverbatim
+*/
+static void c_spi_listen(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc < 2 || argc > 3 ) goto ERROR_PARAM;
+  TYPED_ARRAY *tx = typed_array_get(&v[1]);
+  TYPED_ARRAY *rx = typed_array_get(&v[2]);
+  if( !tx || !rx || typed_array_bytes(tx) == 0 ||
+      typed_array_bytes(tx) != typed_array_bytes(rx) ||
+      typed_array_bytes(tx) > UINT16_MAX ) goto ERROR_PARAM;
+
+  SPSC_QUEUE *q = 0;
+  if( argc == 3 && v[3].tt != MRBC_TT_NIL ) {
+    q = spsc_queue_get(&v[3]);
+    if( !q || q->item_size > 4 ) goto ERROR_PARAM;
+  }
+
+  if( spi_xfer_acquire( vm ) != SPI_XFER_IDLE ) return;
+
+  spi_slave.tx = v[1];
+  spi_slave.rx = v[2];
+  spi_slave.queue = q ? v[3] : mrbc_nil_value();
+  mrbc_incref( &spi_slave.tx );
+  mrbc_incref( &spi_slave.rx );
+  mrbc_incref( &spi_slave.queue );
+  spi_slave.n_frame = 0;
+  spi_slave.n_error = 0;
+
+  GPIO_InitTypeDef GPIO_InitStruct = {
+    .Pin = GPIO_PIN_15,
+    .Mode = GPIO_MODE_AF_PP,
+    .Pull = GPIO_PULLUP,
+    .Speed = GPIO_SPEED_FREQ_VERY_HIGH,
+    .Alternate = GPIO_AF6_SPI3,
+  };
+  HAL_GPIO_Init( GPIOA, &GPIO_InitStruct );
+
+  spi_saved_init = hspi3.Init;
+  hspi3.Init.Mode = SPI_MODE_SLAVE;
+  hspi3.Init.NSS = SPI_NSS_HARD_INPUT;
+  __HAL_SPI_DISABLE( &hspi3 );
+  HAL_StatusTypeDef sts = HAL_SPI_Init( &hspi3 );
+
+  hal_disable_irq();
+  spi_xfer.state = SPI_XFER_SLAVE;
+  if( sts == HAL_OK ) sts = spi_slave_start();
+  hal_enable_irq();
+
+  if( sts != HAL_OK ) {
+    c_spi_unlisten( vm, v, 0 );
+    mrbc_raisef(vm, 0, "HAL layer error (status code %d)", sts);
+  }
+  return;
+
+ ERROR_PARAM:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! slave status.
+
+  @verbatim
+  spi.listen_status  # -> [frames, errors]
+  @endverbatim
+*/
+static void c_spi_listen_status(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_value ret = mrbc_array_new(vm, 2);
+  mrbc_array_push( &ret, &mrbc_integer_value(spi_slave.n_frame) );
+  mrbc_array_push( &ret, &mrbc_integer_value(spi_slave.n_error) );
+  SET_RETURN(ret);
+}
+
+
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("SPI")
+  FILE("_autogen_class_spi.h")
+
+  METHOD( "read",		c_spi_read )
+  METHOD( "write",		c_spi_write )
+  METHOD( "transfer",		c_spi_transfer )
+  METHOD( "listen",		c_spi_listen )
+  METHOD( "unlisten",		c_spi_unlisten )
+  METHOD( "listen_status",	c_spi_listen_status )
+*/
+#include "_autogen_class_spi.h"
+
+
 //================================================================
 /*! initialize
 */
 void mrbc_init_class_spi(void)
 {
-  mrbc_class *cls = mrbc_define_class(0, "SPI", 0);
+  mrbc_class *cls = MRBC_CLASS(SPI);
+  mrbc_set_const( MRBC_SYM(SPI), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
 
-  mrbc_define_method(0, cls, "new", c_spi_new);
-  mrbc_define_method(0, cls, "setmode", c_spi_setmode);
-  mrbc_define_method(0, cls, "read", c_spi_read);
-  mrbc_define_method(0, cls, "write", c_spi_write);
-  mrbc_define_method(0, cls, "transfer", c_spi_transfer);
+  mrbc_define_method_kw(0, cls, "new", c_spi_new);
+  mrbc_define_method_kw(0, cls, "setmode", c_spi_setmode);
 
   mrbc_set_class_const(cls, mrbc_str_to_symid("MSB_FIRST"), &mrbc_integer_value(0));
   mrbc_set_class_const(cls, mrbc_str_to_symid("LSB_FIRST"), &mrbc_integer_value(1));
@@ -0,0 +1,41 @@
+/*! @file
+  @brief
+  SPI class header.
+
+  <pre>
+  An implementation of common peripheral I/O API for mruby/c.
+  https://github.com/mruby/microcontroller-peripheral-interface-guide
+
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef STM32F4_SPI_H
+#define STM32F4_SPI_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  function prototypes.
+*/
+struct VM;
+int spi_bus_acquire( struct VM *vm, int32_t freq );
+void spi_bus_release( struct VM *vm );
+int spi_bus_transmit_background( struct VM *vm, struct RObject *owner,
+				 const void *data, int len );
+void mrbc_init_class_spi( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
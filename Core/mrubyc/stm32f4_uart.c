@@ -13,9 +13,16 @@
   </pre>
 */
 
+//@cond
+#include <string.h>
+//@endcond
+
 #include "main.h"
 #include "../mrubyc_src/mrubyc.h"
 #include "stm32f4_uart.h"
+#include "stm32f4_gpio.h"
+#include "string_buffer.h"
+#include "mrbc_firm.h"
 
 extern UART_HandleTypeDef huart1;
 extern UART_HandleTypeDef huart2;
@@ -30,6 +37,7 @@ UART_HANDLE * const TBL_UART_HANDLE[/*unit*/] = {
     .delimiter = '\n',
     .hal_uart = &huart1,
     .rxfifo_size = UART_SIZE_RXFIFO,
+    .txfifo_size = UART_SIZE_TXFIFO,
   },
 
   // UART2
@@ -38,6 +46,7 @@ UART_HANDLE * const TBL_UART_HANDLE[/*unit*/] = {
     .delimiter = '\n',
     .hal_uart = &huart2,
     .rxfifo_size = UART_SIZE_RXFIFO,
+    .txfifo_size = UART_SIZE_TXFIFO,
   },
 
   0,0,0,
@@ -48,9 +57,30 @@ UART_HANDLE * const TBL_UART_HANDLE[/*unit*/] = {
     .delimiter = '\n',
     .hal_uart = &huart6,
     .rxfifo_size = UART_SIZE_RXFIFO,
+    .txfifo_size = UART_SIZE_TXFIFO,
   },
 };
 
+#if defined(MRBC_METRICS)
+static uint32_t uart_metric_read( const mrbc_metric *m );
+
+//! metrics of each UART. arg is (unit number << 8 | item).
+#define UART_METRICS(n) \
+  MRBC_METRIC_READER("uart" #n ".rx_bytes", MRBC_METRIC_COUNTER, uart_metric_read, (void *)(n << 8 | 0)), \
+  MRBC_METRIC_READER("uart" #n ".tx_bytes", MRBC_METRIC_COUNTER, uart_metric_read, (void *)(n << 8 | 1)), \
+  MRBC_METRIC_READER("uart" #n ".rx_overrun", MRBC_METRIC_COUNTER, uart_metric_read, (void *)(n << 8 | 2)), \
+  MRBC_METRIC_READER("uart" #n ".rx_errors", MRBC_METRIC_COUNTER, uart_metric_read, (void *)(n << 8 | 3)), \
+  MRBC_METRIC_READER("uart" #n ".rx_lost", MRBC_METRIC_COUNTER, uart_metric_read, (void *)(n << 8 | 4))
+
+static mrbc_metric uart_metrics_[] = {
+  UART_METRICS(1), UART_METRICS(2), UART_METRICS(6),
+};
+#endif
+
+//! region for the large Rx FIFO, that allocated at UART.new.
+static uint8_t uart_rx_region_[UART_SIZE_RXREGION] __attribute__((aligned(4)));
+static int uart_rx_region_used_;
+
 
 //================================================================
 /*! get the Rx FIFO write position.
@@ -61,6 +91,296 @@ static inline int uart_get_wr_pos( const UART_HANDLE *hndl )
 }
 
 
+//================================================================
+/*! get the Rx FIFO write position in total byte count.
+
+  @note  It is counted from the last DMA half or full transfer, so it
+	 is right even when the scan is left behind.
+*/
+static uint32_t uart_get_wr_cnt( const UART_HANDLE *hndl )
+{
+  int n = uart_get_wr_pos(hndl) - hndl->rx_dma_pos;
+  if( n < 0 ) n += hndl->rxfifo_size;
+
+  return hndl->rx_dma_cnt + n;
+}
+
+
+#if defined(MRBC_METRICS)
+//================================================================
+/*! read a UART metric.
+*/
+static uint32_t uart_metric_read( const mrbc_metric *m )
+{
+  uintptr_t arg = (uintptr_t)m->arg;
+  const UART_HANDLE *hndl = TBL_UART_HANDLE[arg >> 8];
+
+  switch( arg & 0xff ) {
+  case 0: {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t cnt = uart_get_wr_cnt( hndl );
+    __set_PRIMASK( primask );
+    return cnt;
+  }
+  case 1:  return hndl->tx_cnt;
+  case 2:  return hndl->rx_overrun_cnt;
+  case 3:  return hndl->rx_error_cnt;
+  default: return hndl->rx_lost_cnt;
+  }
+}
+#endif
+
+
+//================================================================
+/*! scan the received data and record the delimiter positions.
+
+  @note  Call with interrupts disabled, or from the interrupt.
+*/
+static void uart_rx_scan( UART_HANDLE *hndl )
+{
+  uint16_t rx_wr = uart_get_wr_pos(hndl);
+
+  while( hndl->rx_scan != rx_wr ) {
+    // when the index is full, the rest will be scanned after read.
+    if( hndl->n_line >= UART_SIZE_RXINDEX ) break;
+
+    uint8_t ch = hndl->rxfifo[hndl->rx_scan++];
+    if( hndl->rx_scan >= hndl->rxfifo_size ) hndl->rx_scan = 0;
+    hndl->rx_scan_cnt++;
+
+    if( ch == hndl->delimiter ) {
+      hndl->line_end[hndl->n_line++] = hndl->rx_scan_cnt;
+    }
+  }
+}
+
+
+//================================================================
+/*! record the frame end position at IDLE line.
+
+  @note  Call from the interrupt.
+*/
+static void uart_rx_mark_frame( UART_HANDLE *hndl )
+{
+  uint32_t wr_cnt = uart_get_wr_cnt(hndl);
+  if( wr_cnt == hndl->rx_rd_cnt ) return;	// no data.
+
+  int n = hndl->n_frame;
+  if( n > 0 && hndl->frame_end[n-1] == wr_cnt ) return;
+
+  // when the index is full, joins to the last frame.
+  if( n >= UART_SIZE_RXINDEX ) n--;
+  hndl->frame_end[n++] = wr_cnt;
+  hndl->n_frame = n;
+}
+
+
+//================================================================
+/*! record the DMA position at the half or full transfer, and check
+    that the unread data is not overwritten.
+
+  @param  pos	index of rxfifo. 0 (full) or the half.
+  @note  Call from the interrupt.
+*/
+static void uart_rx_dma_mark( UART_HANDLE *hndl, int pos )
+{
+  // the same position again means that a callback was missed.
+  int n = pos - hndl->rx_dma_pos;
+  if( n <= 0 ) n += hndl->rxfifo_size;
+
+  hndl->rx_dma_cnt += n;
+  hndl->rx_dma_pos = pos;
+}
+
+
+//================================================================
+/*! check the Rx FIFO lapped the read position.
+
+  The reader resynchronizes to the write position by uart_rx_resync(),
+  because the data in the FIFO is broken.
+
+  @note  Call with interrupts disabled, or from the interrupt.
+*/
+static void uart_rx_check_lost( UART_HANDLE *hndl )
+{
+  if( hndl->flag_rx_lost ) return;
+  if( uart_get_wr_cnt(hndl) - hndl->rx_rd_cnt < (uint32_t)hndl->rxfifo_size ) return;
+
+  hndl->flag_rx_lost = 1;
+  hndl->rx_lost_cnt++;
+}
+
+
+//================================================================
+/*! discard the received data, if the FIFO lapped.
+
+  @note  Call from the reader, not from the interrupt.
+*/
+static inline void uart_rx_resync( UART_HANDLE *hndl )
+{
+  if( hndl->flag_rx_lost ) uart_clear_rx_buffer( hndl );
+}
+
+
+//================================================================
+/*! remove the index entries before the position.
+*/
+static void uart_index_drop( uint32_t *index, uint8_t *n_entry, uint32_t pos )
+{
+  int i;
+  for( i = 0; i < *n_entry; i++ ) {
+    if( (int32_t)(index[i] - pos) > 0 ) break;
+  }
+  if( i == 0 ) return;
+
+  *n_entry -= i;
+  memmove( index, index + i, sizeof(uint32_t) * *n_entry );
+}
+
+
+//================================================================
+/*! copy data from the Rx FIFO and update the index.
+*/
+static void uart_rx_copy( UART_HANDLE *hndl, uint8_t *buf, int len )
+{
+  // two blocks at most, before and after the wrap around.
+  int len1 = hndl->rxfifo_size - hndl->rx_rd;
+  if( len1 > len ) len1 = len;
+  memcpy( buf, hndl->rxfifo + hndl->rx_rd, len1 );
+  memcpy( buf + len1, hndl->rxfifo, len - len1 );
+
+  int rd = hndl->rx_rd + len;
+  if( rd >= hndl->rxfifo_size ) rd -= hndl->rxfifo_size;
+  hndl->rx_rd = rd;
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  hndl->rx_rd_cnt += len;
+  uart_index_drop( hndl->line_end, &hndl->n_line, hndl->rx_rd_cnt );
+  uart_index_drop( hndl->frame_end, &hndl->n_frame, hndl->rx_rd_cnt );
+
+  // the scan may be left behind, when the index was full.
+  if( (int32_t)(hndl->rx_rd_cnt - hndl->rx_scan_cnt) > 0 ) {
+    hndl->rx_scan = hndl->rx_rd;
+    hndl->rx_scan_cnt = hndl->rx_rd_cnt;
+  }
+
+  __set_PRIMASK( primask );
+}
+
+
+//================================================================
+/*! start DMA transfer from the Tx FIFO, if it is idle.
+
+  @note  Call with interrupts disabled, or from the DMA interrupt.
+*/
+static void uart_tx_start( UART_HANDLE *hndl )
+{
+  if( hndl->tx_len != 0 ) return;		// in transfer.
+
+  uint16_t rd = hndl->tx_rd;
+  uint16_t wr = hndl->tx_wr;
+  if( rd == wr ) return;			// FIFO is empty.
+
+  // transfer up to the FIFO end. the rest will be sent by next time.
+  uint16_t len = (rd < wr) ? (wr - rd) : (hndl->txfifo_size - rd);
+  hndl->tx_len = len;
+
+  // RS-485 driver on, and it is turned off by TC interrupt at the end.
+  if( hndl->de_port ) {
+    hndl->de_port->BSRR = hndl->de_pin;
+    __HAL_UART_DISABLE_IT( hndl->hal_uart, UART_IT_TC );
+    __HAL_UART_CLEAR_FLAG( hndl->hal_uart, UART_FLAG_TC );
+  }
+  HAL_DMA_Start_IT( hndl->hal_uart->hdmatx, (uint32_t)&hndl->txfifo[rd],
+		    (uint32_t)&hndl->hal_uart->Instance->DR, len );
+}
+
+
+//================================================================
+/*! find UART_HANDLE from HAL UART handle.
+*/
+static UART_HANDLE * uart_find_handle( const UART_HandleTypeDef *huart )
+{
+  for( int i = 0; i < sizeof(TBL_UART_HANDLE)/sizeof(UART_HANDLE *); i++ ) {
+    if( TBL_UART_HANDLE[i] && TBL_UART_HANDLE[i]->hal_uart == huart ) {
+      return TBL_UART_HANDLE[i];
+    }
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! wait for receiving data.
+
+  @note  The CPU sleeps until any interrupt, such as IDLE line or DMA.
+*/
+static inline void uart_rx_wait( void )
+{
+  __WFI();
+}
+
+
+//================================================================
+/*! Tx DMA transfer complete or error callback.
+*/
+static void uart_tx_dma_callback( DMA_HandleTypeDef *hdma )
+{
+  UART_HANDLE *hndl = uart_find_handle( hdma->Parent );
+  if( !hndl ) return;
+
+  // data sent, or discard it when error.
+  uint16_t rd = hndl->tx_rd + hndl->tx_len;
+  if( rd >= hndl->txfifo_size ) rd = 0;
+  hndl->tx_rd = rd;
+  hndl->tx_len = 0;
+
+  uart_tx_start( hndl );
+
+  // the last byte is in the shift register yet.
+  if( hndl->tx_len == 0 && hndl->de_port ) {
+    __HAL_UART_ENABLE_IT( hndl->hal_uart, UART_IT_TC );
+  }
+}
+
+
+//================================================================
+/*! wait for the Tx FIFO progress.
+*/
+static void uart_tx_wait( UART_HANDLE *hndl )
+{
+  // when interrupts are disabled, drive the DMA interrupt handler here.
+  if( __get_PRIMASK() ) {
+    HAL_DMA_IRQHandler( hndl->hal_uart->hdmatx );
+  } else {
+    __NOP(); __NOP(); __NOP(); __NOP();
+  }
+}
+
+
+//================================================================
+/*! start the reception by DMA circular mode, from the FIFO top.
+*/
+static void uart_rx_start( UART_HANDLE *hndl )
+{
+  hndl->rx_rd = 0;
+  hndl->rx_rd_cnt = 0;
+  hndl->rx_scan = 0;
+  hndl->rx_scan_cnt = 0;
+  hndl->n_line = 0;
+  hndl->n_frame = 0;
+  hndl->rx_dma_cnt = 0;
+  hndl->rx_dma_pos = 0;
+  hndl->flag_rx_lost = 0;
+
+  HAL_UART_Receive_DMA(hndl->hal_uart, hndl->rxfifo, hndl->rxfifo_size);
+  __HAL_UART_ENABLE_IT(hndl->hal_uart, UART_IT_IDLE);
+}
+
+
 //================================================================
 /*! initialize unit
 */
@@ -70,7 +390,15 @@ void uart_init(void)
     UART_HANDLE *hndl = TBL_UART_HANDLE[i];
     if( !hndl ) continue;
 
-    HAL_UART_Receive_DMA(hndl->hal_uart, hndl->rxfifo, hndl->rxfifo_size);
+    hndl->rxfifo = hndl->rxfifo_default;
+    uart_rx_start( hndl );
+
+    DMA_HandleTypeDef *hdmatx = hndl->hal_uart->hdmatx;
+    if( hdmatx ) {
+      hdmatx->XferCpltCallback = uart_tx_dma_callback;
+      hdmatx->XferErrorCallback = uart_tx_dma_callback;
+      SET_BIT( hndl->hal_uart->Instance->CR3, USART_CR3_DMAT );
+    }
   }
 }
 
@@ -111,12 +439,103 @@ int uart_setmode( const UART_HANDLE *hndl, int baud, int parity, int stop_bits )
     hndl->hal_uart->Init.StopBits = TBL_STOPBITS[ stop_bits - 1 ];
   }
 
+  // wait for the data which has been written in old mode.
+  uart_flush( (UART_HANDLE *)hndl );
+
   if( HAL_UART_Init( hndl->hal_uart ) != HAL_OK ) return -1;
 
   return 0;
 }
 
 
+//================================================================
+/*! Wait until the Tx FIFOs of all units are sent out.
+*/
+void uart_flush_all( void )
+{
+  for( int i = 0; i < sizeof(TBL_UART_HANDLE)/sizeof(UART_HANDLE *); i++ ) {
+    if( TBL_UART_HANDLE[i] ) uart_flush( TBL_UART_HANDLE[i] );
+  }
+}
+
+
+//================================================================
+/*! set the baud rates again, after the change of the clock.
+
+  @note	Call this with the Tx FIFOs empty. (see stm32f4_clock.c)
+*/
+void uart_clock_changed( void )
+{
+  for( int i = 0; i < sizeof(TBL_UART_HANDLE)/sizeof(UART_HANDLE *); i++ ) {
+    UART_HANDLE *hndl = TBL_UART_HANDLE[i];
+    if( !hndl ) continue;
+
+    UART_HandleTypeDef *huart = hndl->hal_uart;
+    uint32_t pclk = (huart->Instance == USART1 || huart->Instance == USART6) ?
+      HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+
+    if( huart->Init.OverSampling == UART_OVERSAMPLING_8 ) {
+      huart->Instance->BRR = UART_BRR_SAMPLING8( pclk, huart->Init.BaudRate );
+    } else {
+      huart->Instance->BRR = UART_BRR_SAMPLING16( pclk, huart->Init.BaudRate );
+    }
+  }
+}
+
+
+//================================================================
+/*! set the Rx FIFO size.
+
+  The FIFO up to UART_SIZE_RXFIFO is in the handle, and the larger one
+  is allocated from the region. The region is not released, but the
+  unit reuses its own area, or extends it if it is the last one.
+  The received data not read yet is discarded.
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @param  size		FIFO size in bytes.
+  @retval 0		No error.
+  @retval -1		Not enough region, or too large.
+*/
+int uart_set_rx_buffer_size( UART_HANDLE *hndl, int size )
+{
+  size = (size + 3) & ~3;		// align 4, and DMA half at even.
+  if( size < 4 || size > 0xfffc ) return -1;	// limit of NDTR.
+  if( size == hndl->rxfifo_size ) return 0;
+
+  uint8_t *buf;
+  if( size <= UART_SIZE_RXFIFO ) {
+    buf = hndl->rxfifo_default;
+
+  } else if( size <= hndl->rx_region_size ) {
+    buf = hndl->rx_region;
+
+  } else {
+    // extend the area if it is the last, or allocate new one.
+    int top = hndl->rx_region &&
+      (hndl->rx_region + hndl->rx_region_size == uart_rx_region_ + uart_rx_region_used_) ?
+      (hndl->rx_region - uart_rx_region_) : uart_rx_region_used_;
+    if( top + size > UART_SIZE_RXREGION ) return -1;
+
+    buf = uart_rx_region_ + top;
+    hndl->rx_region = buf;
+    hndl->rx_region_size = size;
+    uart_rx_region_used_ = top + size;
+  }
+
+  HAL_UART_AbortReceive( hndl->hal_uart );
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  hndl->rxfifo = buf;
+  hndl->rxfifo_size = size;
+  uart_rx_start( hndl );
+  __set_PRIMASK( primask );
+
+  return 0;
+}
+
+
 //================================================================
 /*! Receive binary data.
 
@@ -136,7 +555,7 @@ int uart_read( UART_HANDLE *hndl, void *buffer, int size )
   while( cnt > 0 ) {
     int ba = uart_bytes_available(hndl);
     if( ba == 0 ) {
-      __NOP(); __NOP(); __NOP(); __NOP();
+      uart_rx_wait();
       continue;
     }
 
@@ -148,10 +567,8 @@ int uart_read( UART_HANDLE *hndl, void *buffer, int size )
     }
 
     // copy fifo to buffer
-    for( ; ba > 0; ba-- ) {
-      *buf++ = hndl->rxfifo[hndl->rx_rd++];
-      if( hndl->rx_rd >= hndl->rxfifo_size ) hndl->rx_rd = 0;
-    }
+    uart_rx_copy( hndl, buf, ba );
+    buf += ba;
   }
 
   return size;
@@ -166,17 +583,365 @@ int uart_read( UART_HANDLE *hndl, void *buffer, int size )
   @param  buffer	pointer to buffer.
   @param  size		Size of buffer.
   @return		Size of transmitted.
+
+  @note			Data is sent by DMA in background.
+			It blocks execution only while the FIFO is full.
 */
 int uart_write( UART_HANDLE *hndl, const void *buffer, int size )
 {
-  HAL_UART_Transmit( hndl->hal_uart, buffer, size, HAL_MAX_DELAY );
+  if( !hndl->hal_uart->hdmatx ) {
+    // HAL_UART_Transmit() returns after the TC flag.
+    if( hndl->de_port ) hndl->de_port->BSRR = hndl->de_pin;
+    HAL_UART_Transmit( hndl->hal_uart, buffer, size, HAL_MAX_DELAY );
+    if( hndl->de_port ) hndl->de_port->BSRR = (uint32_t)hndl->de_pin << 16;
+#if defined(MRBC_METRICS)
+    hndl->tx_cnt += size;
+#endif
+    return size;
+  }
+
+  const uint8_t *buf = buffer;
+  int cnt = size;
+#if defined(MRBC_METRICS)
+  hndl->tx_cnt += size;
+#endif
+
+  while( cnt > 0 ) {
+    int space = hndl->txfifo_size - 1 - uart_bytes_to_write(hndl);
+    if( space == 0 ) {
+      uart_tx_wait( hndl );
+      continue;
+    }
+    if( space > cnt ) space = cnt;
+    cnt -= space;
+
+    // copy buffer to fifo
+    uint16_t wr = hndl->tx_wr;
+    for( ; space > 0; space-- ) {
+      hndl->txfifo[wr++] = *buf++;
+      if( wr >= hndl->txfifo_size ) wr = 0;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    hndl->tx_wr = wr;
+    uart_tx_start( hndl );
+    __set_PRIMASK( primask );
+  }
+
+  return size;
+}
+
+
+//================================================================
+/*! set the RS-485 driver enable pin.
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @param  port		GPIO port, or NULL to stop using.
+  @param  pin		GPIO_PIN_x.
+  @note			The pin must be set to the output.
+*/
+void uart_set_de_pin( UART_HANDLE *hndl, GPIO_TypeDef *port, uint16_t pin )
+{
+  uart_flush( hndl );
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  __HAL_UART_DISABLE_IT( hndl->hal_uart, UART_IT_TC );
+  if( hndl->de_port ) hndl->de_port->BSRR = (uint32_t)hndl->de_pin << 16;
+  hndl->de_port = port;
+  hndl->de_pin = pin;
+  if( port ) port->BSRR = (uint32_t)pin << 16;
+
+  __set_PRIMASK( primask );
+}
+
+
+//================================================================
+/*! set the packet framing.
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @param  framing	UART_FRAMING_*
+  @note			The delimiter of gets is changed too.
+*/
+void uart_set_framing( UART_HANDLE *hndl, int framing )
+{
+  static const uint8_t TBL_DELIMITER[] = { '\n', 0x00, 0xc0 };
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  hndl->framing = framing;
+  hndl->delimiter = TBL_DELIMITER[framing];
+
+  // scan again from the read point with the new delimiter.
+  hndl->rx_scan = hndl->rx_rd;
+  hndl->rx_scan_cnt = hndl->rx_rd_cnt;
+  hndl->n_line = 0;
+  uart_rx_scan( hndl );
+
+  __set_PRIMASK( primask );
+}
+
+
+//================================================================
+/*! check data length that waiting to be sent.
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @return int		result (bytes)
+*/
+int uart_bytes_to_write( const UART_HANDLE *hndl )
+{
+  uint16_t tx_rd = hndl->tx_rd;
+  uint16_t tx_wr = hndl->tx_wr;
+
+  if( tx_rd <= tx_wr ) {
+    return tx_wr - tx_rd;
+  }
+  else {
+    return hndl->txfifo_size - tx_rd + tx_wr;
+  }
+}
+
+
+//================================================================
+/*! Wait until all data in the Tx FIFO are sent out.
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+*/
+void uart_flush( UART_HANDLE *hndl )
+{
+  if( !hndl->hal_uart->hdmatx ) return;
+
+  while( uart_bytes_to_write(hndl) != 0 ) {
+    uart_tx_wait( hndl );
+  }
+
+  // wait for the last byte in the shift register.
+  while( !__HAL_UART_GET_FLAG( hndl->hal_uart, UART_FLAG_TC ) ) {
+    __NOP();
+  }
+}
+
+
+//================================================================
+/*! Clear transmit buffer.
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @note  Data already in DMA transfer can not be cancelled.
+*/
+void uart_clear_tx_buffer( UART_HANDLE *hndl )
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  uint16_t wr = hndl->tx_rd + hndl->tx_len;
+  if( wr >= hndl->txfifo_size ) wr = 0;
+  hndl->tx_wr = wr;
+
+  __set_PRIMASK( primask );
+}
+
+
+//================================================================
+/*! Receive string.
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @param  buffer	pointer to buffer.
+  @param  size		Size of buffer.
+  @return int		Num of received bytes.
+
+  @note			If no data received, it blocks execution.
+*/
+int uart_gets( UART_HANDLE *hndl, void *buffer, int size )
+{
+  uint8_t *buf = buffer;
+  int len;
+
+  while( 1 ) {
+    len = uart_can_read_line(hndl);
+    if( len > 0 ) break;
+
+    uart_rx_wait();
+  }
+
+  if( len >= size ) return -1;		// buffer size too small.
+
+  // copy fifo to buffer
+  uart_rx_copy( hndl, buf, len );
+  buf[len] = '\0';
+
+  return len;
+}
+
+
+//================================================================
+/*! decode the packet in place.
+
+  @param  framing	UART_FRAMING_*
+  @param  buf		the packet without the delimiter.
+  @param  len		length of the packet.
+  @return		length of the decoded data, or -1 if error.
+*/
+static int uart_decode_packet( int framing, uint8_t *buf, int len )
+{
+  int rd = 0, wr = 0;
+
+  switch( framing ) {
+  case UART_FRAMING_COBS:
+    while( rd < len ) {
+      int code = buf[rd++];
+      if( code == 0 || rd + code - 1 > len ) return -1;
+      for( int i = 1; i < code; i++ ) {
+	buf[wr++] = buf[rd++];
+      }
+      // the zero is implied, except the block of 254 bytes and the last.
+      if( code < 0xff && rd < len ) buf[wr++] = 0;
+    }
+    break;
+
+  case UART_FRAMING_SLIP:
+    while( rd < len ) {
+      uint8_t ch = buf[rd++];
+      if( ch == 0xdb ) {		// ESC
+	if( rd >= len ) return -1;
+	ch = buf[rd++];
+	if( ch == 0xdc ) ch = 0xc0;
+	else if( ch == 0xdd ) ch = 0xdb;
+	else return -1;
+      }
+      buf[wr++] = ch;
+    }
+    break;
+
+  default:
+    return len;
+  }
+
+  return wr;
+}
+
+
+//================================================================
+/*! Receive a packet. (delimited and encoded by the framing)
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @param  buffer	pointer to buffer.
+  @param  size		Size of buffer.
+  @return int		Num of decoded bytes, -1 if broken,
+			or -2 if the buffer is too small.
+
+  @note			If no packet received, it blocks execution.
+			An empty packet is returned as 0 byte.
+*/
+int uart_read_packet( UART_HANDLE *hndl, void *buffer, int size )
+{
+  int len;
+
+  while( 1 ) {
+    len = uart_can_read_line(hndl);
+    if( len > 0 ) break;
+
+    uart_rx_wait();
+  }
+
+  if( len > size ) return -2;
+
+  uart_rx_copy( hndl, buffer, len );
+  return uart_decode_packet( hndl->framing, buffer, len - 1 );
+}
+
+
+/*!@brief
+  small buffer to write a packet to the Tx FIFO.
+*/
+typedef struct UART_PACKET_WRITER {
+  UART_HANDLE *hndl;
+  int len;
+  uint8_t buf[32];
+} UART_PACKET_WRITER;
+
+static void uart_packet_put( UART_PACKET_WRITER *w, const uint8_t *p, int n )
+{
+  while( --n >= 0 ) {
+    w->buf[w->len++] = *p++;
+    if( w->len == sizeof(w->buf) ) {
+      uart_write( w->hndl, w->buf, w->len );
+      w->len = 0;
+    }
+  }
+}
+
+static void uart_packet_put_byte( UART_PACKET_WRITER *w, uint8_t ch )
+{
+  uart_packet_put( w, &ch, 1 );
+}
+
+
+//================================================================
+/*! Send a packet. (encoded and delimited by the framing)
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @param  buffer	pointer to buffer.
+  @param  size		Size of buffer.
+  @return		Size of transmitted data. (before encode)
+*/
+int uart_write_packet( UART_HANDLE *hndl, const void *buffer, int size )
+{
+  UART_PACKET_WRITER w = { .hndl = hndl };
+  const uint8_t *p = buffer;
+  const uint8_t *end = p + size;
+
+  switch( hndl->framing ) {
+  case UART_FRAMING_COBS:
+    while( 1 ) {
+      // a block is the code byte and up to 254 bytes before zero.
+      const uint8_t *q = p;
+      while( q < end && *q != 0 && q - p < 254 ) q++;
+      int n = q - p;
+      uart_packet_put_byte( &w, n + 1 );
+      uart_packet_put( &w, p, n );
+      if( q == end ) break;
+      p = (n < 254) ? q + 1 : q;	// skip the zero.
+    }
+    uart_packet_put_byte( &w, 0x00 );
+    break;
+
+  case UART_FRAMING_SLIP:
+    uart_packet_put_byte( &w, 0xc0 );	// flush the noise on the line.
+    for( ; p < end; p++ ) {
+      if( *p == 0xc0 ) {
+	uart_packet_put( &w, (const uint8_t *)"\xdb\xdc", 2 );
+      } else if( *p == 0xdb ) {
+	uart_packet_put( &w, (const uint8_t *)"\xdb\xdd", 2 );
+      } else {
+	uart_packet_put_byte( &w, *p );
+      }
+    }
+    uart_packet_put_byte( &w, 0xc0 );
+    break;
+
+  default:
+    uart_packet_put( &w, p, size );
+    break;
+  }
 
+  if( w.len ) uart_write( hndl, w.buf, w.len );
   return size;
 }
 
 
 //================================================================
-/*! Receive string.
+/*! Receive a frame. (data separated by IDLE line)
 
   @memberof UART_HANDLE
   @param  hndl		target UART_HANDLE
@@ -184,30 +949,103 @@ int uart_write( UART_HANDLE *hndl, const void *buffer, int size )
   @param  size		Size of buffer.
   @return int		Num of received bytes.
 
-  @note			If no data received, it blocks execution.
+  @note			If no frame received, it blocks execution.
+			If the frame is longer than the buffer,
+			the rest remains as the next frame.
 */
-int uart_gets( UART_HANDLE *hndl, void *buffer, int size )
+int uart_read_frame( UART_HANDLE *hndl, void *buffer, int size )
 {
-  uint8_t *buf = buffer;
   int len;
 
   while( 1 ) {
-    len = uart_can_read_line(hndl);
+    len = uart_can_read_frame(hndl);
     if( len > 0 ) break;
 
-    __NOP(); __NOP(); __NOP(); __NOP();
+    uart_rx_wait();
   }
 
-  if( len >= size ) return -1;		// buffer size too small.
+  if( len > size ) len = size;
+  uart_rx_copy( hndl, buffer, len );
 
-  // copy fifo to buffer
-  for( int ba = len; ba > 0; ba-- ) {
-    *buf++ = hndl->rxfifo[hndl->rx_rd++];
-    if( hndl->rx_rd >= hndl->rxfifo_size ) hndl->rx_rd = 0;
+  return len;
+}
+
+
+//================================================================
+/*! USART interrupt handler.
+
+  @param  huart		HAL UART handle.
+  @note
+    The reception is done by DMA circular mode, so this handles
+    only the IDLE line event to wake up the tasks waiting for data,
+    and TC event to turn off the RS-485 driver.
+*/
+void uart_irq_handler( UART_HandleTypeDef *huart )
+{
+  uint32_t sr = huart->Instance->SR;
+
+  if( (huart->Instance->CR1 & USART_CR1_TCIE) && (sr & USART_SR_TC) ) {
+    __HAL_UART_DISABLE_IT( huart, UART_IT_TC );
+    UART_HANDLE *hndl = uart_find_handle( huart );
+    if( hndl && hndl->de_port && hndl->tx_len == 0 ) {
+      hndl->de_port->BSRR = (uint32_t)hndl->de_pin << 16;
+    }
+
+    // don't read DR, if no reception event.
+    if( !(sr & (USART_SR_IDLE | USART_SR_ORE | USART_SR_NE |
+		USART_SR_FE | USART_SR_PE)) ) return;
   }
-  *buf = '\0';
 
-  return len;
+  // clear IDLE and error flags. (SR read followed by DR read)
+  __HAL_UART_CLEAR_IDLEFLAG( huart );
+
+  UART_HANDLE *hndl = uart_find_handle( huart );
+  if( !hndl ) return;
+
+  MRBC_ISR_ENTER();
+  if( sr & USART_SR_ORE ) hndl->rx_overrun_cnt++;
+#if defined(MRBC_METRICS)
+  if( sr & (USART_SR_NE | USART_SR_FE | USART_SR_PE) ) hndl->rx_error_cnt++;
+#endif
+  uart_rx_check_lost( hndl );
+  uart_rx_scan( hndl );
+  uart_rx_mark_frame( hndl );
+#if defined(MRBC_METRICS_UART)
+  // the stats port is served here, and must not be used by the program.
+  if( hndl == TBL_UART_HANDLE[MRBC_METRICS_UART] ) serve_stats( hndl );
+#endif
+  mrbc_wakeup_io( hndl );
+  MRBC_ISR_EXIT();
+}
+
+
+//================================================================
+/*! Rx DMA half transfer callback. (override HAL weak function)
+*/
+void HAL_UART_RxHalfCpltCallback( UART_HandleTypeDef *huart )
+{
+  UART_HANDLE *hndl = uart_find_handle( huart );
+  if( !hndl ) return;
+
+  uart_rx_dma_mark( hndl, hndl->rxfifo_size / 2 );
+  uart_rx_check_lost( hndl );
+  uart_rx_scan( hndl );
+  mrbc_wakeup_io( hndl );
+}
+
+
+//================================================================
+/*! Rx DMA transfer complete callback. (override HAL weak function)
+*/
+void HAL_UART_RxCpltCallback( UART_HandleTypeDef *huart )
+{
+  UART_HANDLE *hndl = uart_find_handle( huart );
+  if( !hndl ) return;
+
+  uart_rx_dma_mark( hndl, 0 );
+  uart_rx_check_lost( hndl );
+  uart_rx_scan( hndl );
+  mrbc_wakeup_io( hndl );
 }
 
 
@@ -218,8 +1056,9 @@ int uart_gets( UART_HANDLE *hndl, void *buffer, int size )
   @param  hndl		target UART_HANDLE
   @return int           result (bool)
 */
-int uart_is_readable( const UART_HANDLE *hndl )
+int uart_is_readable( UART_HANDLE *hndl )
 {
+  uart_rx_resync( hndl );
   return hndl->rx_rd != uart_get_wr_pos( hndl );
 }
 
@@ -231,8 +1070,9 @@ int uart_is_readable( const UART_HANDLE *hndl )
   @param  hndl		target UART_HANDLE
   @return int		result (bytes)
 */
-int uart_bytes_available( const UART_HANDLE *hndl )
+int uart_bytes_available( UART_HANDLE *hndl )
 {
+  uart_rx_resync( hndl );
   uint16_t rx_wr = uart_get_wr_pos(hndl);
 
   if( hndl->rx_rd <= rx_wr ) {
@@ -251,23 +1091,42 @@ int uart_bytes_available( const UART_HANDLE *hndl )
   @param  hndl		target UART_HANDLE
   @return int		string length.
 */
-int uart_can_read_line( const UART_HANDLE *hndl )
+int uart_can_read_line( UART_HANDLE *hndl )
 {
-  uint16_t idx   = hndl->rx_rd;
-  uint16_t rx_wr = uart_get_wr_pos(hndl);
+  uart_rx_resync( hndl );
 
-  while( idx != rx_wr ) {
-    if( hndl->rxfifo[idx++] == hndl->delimiter ) {
-      if( hndl->rx_rd < idx ) {
-	return idx - hndl->rx_rd;
-      } else {
-	return hndl->rxfifo_size - hndl->rx_rd + idx;
-      }
-    }
-    if( idx >= hndl->rxfifo_size ) idx = 0;
-  }
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
 
-  return 0;
+  // scan only the data that arrived after the last interrupt.
+  if( hndl->n_line == 0 ) uart_rx_scan( hndl );
+  int len = hndl->n_line ? (hndl->line_end[0] - hndl->rx_rd_cnt) : 0;
+
+  __set_PRIMASK( primask );
+
+  return len;
+}
+
+
+//================================================================
+/*! check data can be read a frame.
+
+  @memberof UART_HANDLE
+  @param  hndl		target UART_HANDLE
+  @return int		frame length.
+*/
+int uart_can_read_frame( UART_HANDLE *hndl )
+{
+  uart_rx_resync( hndl );
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  int len = hndl->n_frame ? (hndl->frame_end[0] - hndl->rx_rd_cnt) : 0;
+
+  __set_PRIMASK( primask );
+
+  return len;
 }
 
 
@@ -279,7 +1138,18 @@ int uart_can_read_line( const UART_HANDLE *hndl )
 */
 void uart_clear_rx_buffer( UART_HANDLE *hndl )
 {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  hndl->rx_rd_cnt = uart_get_wr_cnt( hndl );
   hndl->rx_rd = uart_get_wr_pos( hndl );
+  hndl->rx_scan = hndl->rx_rd;
+  hndl->rx_scan_cnt = hndl->rx_rd_cnt;
+  hndl->n_line = 0;
+  hndl->n_frame = 0;
+  hndl->flag_rx_lost = 0;
+
+  __set_PRIMASK( primask );
 }
 
 
@@ -289,10 +1159,13 @@ static void c_uart_setmode(mrbc_vm *vm, mrbc_value v[], int argc);
 /*! UART constructor
 
   uart1 = UART.new( id, *params )	# id = 1,2 or 6
+  uart1 = UART.new( id, rx_buffer_size:4096, *params )
+  uart1 = UART.new( id, de_pin:"PA8", *params )	# RS-485
+  uart1 = UART.new( id, framing:UART::COBS, *params )	# or UART::SLIP
 */
 static void c_uart_new(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  MRBC_KW_ARG( unit );
+  MRBC_KW_ARG( unit, rx_buffer_size );
 
   // get UART unit num.
   int unit_num = 1;		// default is UART1
@@ -312,6 +1185,15 @@ static void c_uart_new(mrbc_vm *vm, mrbc_value v[], int argc)
     goto ERROR_RETURN;
   }
 
+  // Rx FIFO size. it is kept if not specified.
+  if( MRBC_KW_ISVALID(rx_buffer_size) ) {
+    if( rx_buffer_size.tt != MRBC_TT_INTEGER ||
+	uart_set_rx_buffer_size( TBL_UART_HANDLE[unit_num],
+				 mrbc_integer(rx_buffer_size) ) != 0 ) {
+      goto ERROR_RETURN;
+    }
+  }
+
   // allocate instance with UART_HANDLE pointer.
   v[0] = mrbc_instance_new(vm, v[0].cls, sizeof(UART_HANDLE *));
   *(UART_HANDLE**)(v[0].instance->data) = TBL_UART_HANDLE[unit_num];
@@ -325,7 +1207,7 @@ static void c_uart_new(mrbc_vm *vm, mrbc_value v[], int argc)
   mrbc_raise(vm, MRBC_CLASS(ArgumentError), "UART initialize.");
 
  RETURN:
-  MRBC_KW_DELETE( unit );
+  MRBC_KW_DELETE( unit, rx_buffer_size );
 }
 
 
@@ -336,7 +1218,7 @@ static void c_uart_new(mrbc_vm *vm, mrbc_value v[], int argc)
 */
 static void c_uart_setmode(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  MRBC_KW_ARG( baudrate, baud, data_bits, stop_bits, parity, flow_control, txd_pin, rxd_pin, rts_pin, cts_pin );
+  MRBC_KW_ARG( baudrate, baud, data_bits, stop_bits, parity, flow_control, txd_pin, rxd_pin, rts_pin, cts_pin, de_pin, framing );
   if( !MRBC_KW_END() ) goto RETURN;
 
   UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
@@ -357,6 +1239,29 @@ static void c_uart_setmode(mrbc_vm *vm, mrbc_value v[], int argc)
 
   // set to UART
   if( uart_setmode( hndl, baud_rate, mrbc_integer(parity), mrbc_integer(stop_bits) ) != 0 ) goto ERROR_ARGUMENT;
+
+  if( MRBC_KW_ISVALID(framing) ) {
+    if( framing.tt != MRBC_TT_INTEGER ||
+	mrbc_integer(framing) < UART_FRAMING_NONE ||
+	mrbc_integer(framing) > UART_FRAMING_SLIP ) goto ERROR_ARGUMENT;
+    uart_set_framing( hndl, mrbc_integer(framing) );
+  }
+
+  // RS-485 driver enable pin. nil to stop using.
+  if( MRBC_KW_ISVALID(de_pin) ) {
+    if( de_pin.tt == MRBC_TT_NIL ) {
+      uart_set_de_pin( hndl, 0, 0 );
+    } else {
+      PIN_HANDLE pin;
+      uint16_t stm32_pin;
+      GPIO_TypeDef *port;
+      if( gpio_set_pin_handle( &pin, &de_pin ) != 0 ||
+	  (port = gpio_get_stm32_port( &pin, &stm32_pin )) == 0 ) goto ERROR_ARGUMENT;
+      HAL_GPIO_WritePin( port, stm32_pin, GPIO_PIN_RESET );
+      gpio_setmode( &pin, GPIO_OUT );
+      uart_set_de_pin( hndl, port, stm32_pin );
+    }
+  }
   goto RETURN;
 
 
@@ -369,7 +1274,7 @@ static void c_uart_setmode(mrbc_vm *vm, mrbc_value v[], int argc)
   goto RETURN;
 
  RETURN:
-  MRBC_KW_DELETE( baudrate, baud, data_bits, stop_bits, parity, flow_control, txd_pin, rxd_pin, rts_pin, cts_pin );
+  MRBC_KW_DELETE( baudrate, baud, data_bits, stop_bits, parity, flow_control, txd_pin, rxd_pin, rts_pin, cts_pin, de_pin, framing );
 }
 
 
@@ -391,6 +1296,19 @@ static void c_uart_read(mrbc_vm *vm, mrbc_value v[], int argc)
   }
 
   int read_bytes = mrbc_integer(v[1]);
+
+  // wait for receiving in other task running, if the FIFO can hold it.
+  if( read_bytes < hndl->rxfifo_size ) {
+    hal_disable_irq();
+    int ba = uart_bytes_available(hndl);
+    if( ba < read_bytes ) {
+      mrbc_wait_io( VM2TCB(vm), hndl );
+      vm->flag_retry_call = 1;
+    }
+    hal_enable_irq();
+    if( ba < read_bytes ) return;
+  }
+
   mrbc_value ret = mrbc_string_new(vm, 0, read_bytes);
   char *buf = mrbc_string_cstr(&ret);
   if( !buf ) {
@@ -410,18 +1328,23 @@ static void c_uart_read(mrbc_vm *vm, mrbc_value v[], int argc)
 
   uart1.write(s)
 
-  @param  s	  Write data.
+  @param  s	  Write data. (String or StringBuffer)
 */
 static void c_uart_write(mrbc_vm *vm, mrbc_value v[], int argc)
 {
   UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
-
-  if( v[1].tt != MRBC_TT_STRING ) {
+  STRING_BUFFER *sb;
+  int n;
+
+  if( v[1].tt == MRBC_TT_STRING ) {
+    n = uart_write( hndl, mrbc_string_cstr(&v[1]), mrbc_string_size(&v[1]));
+  } else if( (sb = string_buffer_get(&v[1])) != NULL ) {
+    n = uart_write( hndl, sb->data, sb->length );
+  } else {
     mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
     return;
   }
 
-  int n = uart_write( hndl, mrbc_string_cstr(&v[1]), mrbc_string_size(&v[1]));
   SET_INT_RETURN(n);
 }
 
@@ -437,13 +1360,189 @@ static void c_uart_gets(mrbc_vm *vm, mrbc_value v[], int argc)
 {
   UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
 
-  int len;
-  while( 1 ) {
-    len = uart_can_read_line(hndl);
-    if( len > 0 ) break;
+  // wait for receiving a line in other task running.
+  hal_disable_irq();
+  int len = uart_can_read_line(hndl);
+  if( len == 0 ) {
+    mrbc_wait_io( VM2TCB(vm), hndl );
+    vm->flag_retry_call = 1;
+  }
+  hal_enable_irq();
+  if( len == 0 ) return;
 
-    __NOP(); __NOP(); __NOP(); __NOP();
+  mrbc_value ret = mrbc_string_new(vm, 0, len);
+  char *buf = mrbc_string_cstr(&ret);
+  if( !buf ) {
+    SET_RETURN(mrbc_nil_value());
+    return;
+  }
+
+  uart_read( hndl, buf, len );
+  buf[len] = '\0';
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! get the place to receive len bytes at offset of the buffer.
+
+  The String is truncated or extended to offset + len, and it keeps the
+  allocated memory when truncated. So reusing it doesn't allocate.
+
+  @param  vm		pointer to VM.
+  @param  dst		String or StringBuffer.
+  @param  offset	offset in the buffer.
+  @param  len		length.
+  @return		pointer to write, or NULL if raised.
+*/
+static uint8_t * uart_dest_buffer( mrbc_vm *vm, mrbc_value *dst, int offset, int len )
+{
+  STRING_BUFFER *sb;
+
+  if( dst->tt == MRBC_TT_STRING ) {
+    int size = mrbc_string_size(dst);
+    if( offset > size ) goto INDEX_ERROR;
+
+    int ret = (offset + len > size) ?
+      mrbc_string_append_cbuf( dst, NULL, offset + len - size ) :
+      mrbc_string_modify( dst );
+    if( ret != 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(NoMemoryError), 0);
+      return NULL;
+    }
+    dst->string->size = offset + len;
+    dst->string->data[offset + len] = '\0';
+    return dst->string->data + offset;
+  }
+
+  if( (sb = string_buffer_get(dst)) != NULL ) {
+    if( offset > sb->length || offset + len > sb->capacity ) goto INDEX_ERROR;
+    sb->length = offset + len;
+    sb->data[offset + len] = '\0';
+    return (uint8_t *)sb->data + offset;
+  }
+
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+  return NULL;
+
+ INDEX_ERROR:
+  mrbc_raise(vm, MRBC_CLASS(IndexError), "buffer too small");
+  return NULL;
+}
+
+
+//================================================================
+/*! read into the buffer
+
+  n = uart1.read_into( buf, offset = 0, len = nil )
+
+  @param  buf		String or StringBuffer, reused by the caller.
+  @param  offset	offset in buf.
+  @param  len		Number of bytes receive, or nil for the received bytes.
+  @return Integer	Number of received bytes.
+*/
+static void c_uart_read_into(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+  int offset = 0;
+  int len = -1;
+
+  if( argc < 1 || argc > 3 ) goto ERROR_RETURN;
+  if( argc >= 2 ) {
+    if( v[2].tt != MRBC_TT_INTEGER || mrbc_integer(v[2]) < 0 ) goto ERROR_RETURN;
+    offset = mrbc_integer(v[2]);
+  }
+  if( argc == 3 && v[3].tt != MRBC_TT_NIL ) {
+    if( v[3].tt != MRBC_TT_INTEGER || mrbc_integer(v[3]) < 0 ) goto ERROR_RETURN;
+    len = mrbc_integer(v[3]);
+  }
+
+  // wait for receiving in other task running, if the FIFO can hold it.
+  if( len < hndl->rxfifo_size ) {
+    hal_disable_irq();
+    int ba = uart_bytes_available(hndl);
+    int wait = (len < 0) ? (ba == 0) : (ba < len);
+    if( wait ) {
+      mrbc_wait_io( VM2TCB(vm), hndl );
+      vm->flag_retry_call = 1;
+    }
+    hal_enable_irq();
+    if( wait ) return;
+    if( len < 0 ) len = ba;
+  }
+
+  uint8_t *buf = uart_dest_buffer( vm, &v[1], offset, len );
+  if( !buf ) return;
+
+  uart_read( hndl, buf, len );
+
+  SET_INT_RETURN(len);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! gets into the buffer
+
+  n = uart1.gets_into( buf )
+
+  @param  buf		String or StringBuffer, reused by the caller.
+  @return Integer	Length of the received line.
+  @note			IndexError if the line is longer than StringBuffer,
+			and the line is left in the FIFO.
+*/
+static void c_uart_gets_into(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  if( argc != 1 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  // wait for receiving a line in other task running.
+  hal_disable_irq();
+  int len = uart_can_read_line(hndl);
+  if( len == 0 ) {
+    mrbc_wait_io( VM2TCB(vm), hndl );
+    vm->flag_retry_call = 1;
+  }
+  hal_enable_irq();
+  if( len == 0 ) return;
+
+  uint8_t *buf = uart_dest_buffer( vm, &v[1], 0, len );
+  if( !buf ) return;
+
+  uart_read( hndl, buf, len );
+
+  SET_INT_RETURN(len);
+}
+
+
+//================================================================
+/*! read frame
+
+  s = uart1.read_frame()
+
+  @return String	Received data until IDLE line.
+*/
+static void c_uart_read_frame(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  // wait for receiving a frame in other task running.
+  hal_disable_irq();
+  int len = uart_can_read_frame(hndl);
+  if( len == 0 ) {
+    mrbc_wait_io( VM2TCB(vm), hndl );
+    vm->flag_retry_call = 1;
   }
+  hal_enable_irq();
+  if( len == 0 ) return;
 
   mrbc_value ret = mrbc_string_new(vm, 0, len);
   char *buf = mrbc_string_cstr(&ret);
@@ -459,6 +1558,92 @@ static void c_uart_gets(mrbc_vm *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! read a packet
+
+  s = uart1.read_packet()
+
+  @return String	Decoded packet, or nil if broken.
+  @note			The framing is set by framing: parameter.
+*/
+static void c_uart_read_packet(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  if( hndl->framing == UART_FRAMING_NONE ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "framing is not set");
+    return;
+  }
+
+  while( 1 ) {
+    // wait for receiving a packet in other task running.
+    hal_disable_irq();
+    int len = uart_can_read_line(hndl);
+    if( len == 0 ) {
+      mrbc_wait_io( VM2TCB(vm), hndl );
+      vm->flag_retry_call = 1;
+    }
+    hal_enable_irq();
+    if( len == 0 ) return;
+
+    mrbc_value ret = mrbc_string_new(vm, 0, len);
+    char *buf = mrbc_string_cstr(&ret);
+    if( !buf ) {
+      SET_RETURN(mrbc_nil_value());
+      return;
+    }
+
+    int n = uart_read_packet( hndl, buf, len );
+    if( n == 0 ) {			// empty, such as the leading END of SLIP.
+      mrbc_decref( &ret );
+      continue;
+    }
+    if( n < 0 ) {
+      mrbc_decref( &ret );
+      SET_RETURN(mrbc_nil_value());
+      return;
+    }
+
+    ret.string->size = n;
+    buf[n] = '\0';
+    SET_RETURN(ret);
+    return;
+  }
+}
+
+
+//================================================================
+/*! write a packet
+
+  uart1.write_packet(s)
+
+  @param  s	  Write data. String or StringBuffer.
+  @return Integer Size of the data.
+*/
+static void c_uart_write_packet(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+  STRING_BUFFER *sb;
+  int n;
+
+  if( hndl->framing == UART_FRAMING_NONE ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "framing is not set");
+    return;
+  }
+
+  if( v[1].tt == MRBC_TT_STRING ) {
+    n = uart_write_packet( hndl, mrbc_string_cstr(&v[1]), mrbc_string_size(&v[1]));
+  } else if( (sb = string_buffer_get(&v[1])) != NULL ) {
+    n = uart_write_packet( hndl, sb->data, sb->length );
+  } else {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  SET_INT_RETURN(n);
+}
+
+
 //================================================================
 /*! write string with LF
 
@@ -514,8 +1699,9 @@ static void c_uart_bytes_available(mrbc_vm *vm, mrbc_value v[], int argc)
 */
 static void c_uart_bytes_to_write(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  // always zero return because no write buffer.
-  SET_INT_RETURN( 0 );
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  SET_INT_RETURN( uart_bytes_to_write( hndl ) );
 }
 
 
@@ -536,6 +1722,44 @@ static void c_uart_can_read_line(mrbc_vm *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! Returns the count of the overruns.
+
+  uart1.rx_overrun()	# hardware overrun errors. (ORE)
+  uart1.rx_lost()	# the Rx FIFO was lapped, and the data discarded.
+
+  @return Integer
+*/
+static void c_uart_rx_overrun(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  SET_INT_RETURN( hndl->rx_overrun_cnt );
+}
+
+static void c_uart_rx_lost(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  SET_INT_RETURN( hndl->rx_lost_cnt );
+}
+
+
+//================================================================
+/*! Returns the Rx FIFO size.
+
+  uart1.rx_buffer_size()
+
+  @return Integer
+*/
+static void c_uart_rx_buffer_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  SET_INT_RETURN( hndl->rxfifo_size );
+}
+
+
 //================================================================
 /*! flush tx buffer.
 
@@ -543,7 +1767,9 @@ static void c_uart_can_read_line(mrbc_vm *vm, mrbc_value v[], int argc)
 */
 static void c_uart_flush(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  // nothing to do.
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  uart_flush( hndl );
 }
 
 
@@ -554,7 +1780,9 @@ static void c_uart_flush(mrbc_vm *vm, mrbc_value v[], int argc)
 */
 static void c_uart_clear_tx_buffer(mrbc_vm *vm, mrbc_value v[], int argc)
 {
-  // nothing to do.
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[0].instance->data);
+
+  uart_clear_tx_buffer( hndl );
 }
 
 
@@ -582,29 +1810,55 @@ static void c_uart_send_break(mrbc_vm *vm, mrbc_value v[], int argc)
 }
 
 
+/* MRBC_AUTOGEN_METHOD_TABLE
+
+  CLASS("UART")
+  FILE("_autogen_class_uart.h")
+
+  METHOD( "read",		c_uart_read )
+  METHOD( "write",		c_uart_write )
+  METHOD( "gets",		c_uart_gets )
+  METHOD( "read_into",		c_uart_read_into )
+  METHOD( "gets_into",		c_uart_gets_into )
+  METHOD( "read_frame",		c_uart_read_frame )
+  METHOD( "read_packet",	c_uart_read_packet )
+  METHOD( "write_packet",	c_uart_write_packet )
+  METHOD( "puts",		c_uart_puts )
+  METHOD( "bytes_available",	c_uart_bytes_available )
+  METHOD( "bytes_to_write",	c_uart_bytes_to_write )
+  METHOD( "can_read_line",	c_uart_can_read_line )
+  METHOD( "rx_overrun",		c_uart_rx_overrun )
+  METHOD( "rx_lost",		c_uart_rx_lost )
+  METHOD( "rx_buffer_size",	c_uart_rx_buffer_size )
+  METHOD( "flush",		c_uart_flush )
+  METHOD( "clear_rx_buffer",	c_uart_clear_rx_buffer )
+  METHOD( "clear_tx_buffer",	c_uart_clear_tx_buffer )
+  METHOD( "send_break",		c_uart_send_break )
+*/
+#include "_autogen_class_uart.h"
+
+
 //================================================================
 /*! initialize
 */
 void mrbc_init_class_uart(void)
 {
-  // define class and methods.
-  mrbc_class *cls = mrbc_define_class(0, "UART", 0);
-
-  mrbc_define_method(0, cls, "new",		c_uart_new);
-  mrbc_define_method(0, cls, "setmode",		c_uart_setmode);
-  mrbc_define_method(0, cls, "read",		c_uart_read);
-  mrbc_define_method(0, cls, "write",		c_uart_write);
-  mrbc_define_method(0, cls, "gets",		c_uart_gets);
-  mrbc_define_method(0, cls, "puts",		c_uart_puts);
-  mrbc_define_method(0, cls, "bytes_available",	c_uart_bytes_available);
-  mrbc_define_method(0, cls, "bytes_to_write",	c_uart_bytes_to_write);
-  mrbc_define_method(0, cls, "can_read_line",	c_uart_can_read_line);
-  mrbc_define_method(0, cls, "flush",		c_uart_flush);
-  mrbc_define_method(0, cls, "clear_rx_buffer",	c_uart_clear_rx_buffer);
-  mrbc_define_method(0, cls, "clear_tx_buffer",	c_uart_clear_tx_buffer);
-  mrbc_define_method(0, cls, "send_break",	c_uart_send_break);
+  // register the class. the methods are in the table above.
+  mrbc_class *cls = MRBC_CLASS(UART);
+  mrbc_set_const( MRBC_SYM(UART), &(mrbc_value){.tt = MRBC_TT_CLASS, .cls = cls} );
+
+  mrbc_define_method_kw(0, cls, "new",		c_uart_new);
+  mrbc_define_method_kw(0, cls, "setmode",	c_uart_setmode);
 
   mrbc_set_class_const(cls, mrbc_str_to_symid("NONE"), &mrbc_integer_value(0));
   mrbc_set_class_const(cls, mrbc_str_to_symid("ODD"), &mrbc_integer_value(1));
   mrbc_set_class_const(cls, mrbc_str_to_symid("EVEN"), &mrbc_integer_value(2));
+  mrbc_set_class_const(cls, mrbc_str_to_symid("COBS"), &mrbc_integer_value(UART_FRAMING_COBS));
+  mrbc_set_class_const(cls, mrbc_str_to_symid("SLIP"), &mrbc_integer_value(UART_FRAMING_SLIP));
+
+#if defined(MRBC_METRICS)
+  for( int i = 0; i < sizeof(uart_metrics_)/sizeof(mrbc_metric); i++ ) {
+    mrbc_metric_register( &uart_metrics_[i] );
+  }
+#endif
 }
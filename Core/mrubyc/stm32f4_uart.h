@@ -27,6 +27,20 @@ extern "C" {
 #ifndef UART_SIZE_RXFIFO
 #define UART_SIZE_RXFIFO 1024
 #endif
+#ifndef UART_SIZE_TXFIFO
+#define UART_SIZE_TXFIFO 256
+#endif
+#ifndef UART_SIZE_RXINDEX
+#define UART_SIZE_RXINDEX 8
+#endif
+//! packet framing. (see read_packet)
+#define UART_FRAMING_NONE 0
+#define UART_FRAMING_COBS 1	//!< delimited by 0x00.
+#define UART_FRAMING_SLIP 2	//!< delimited by 0xC0. (RFC 1055)
+//! region for the Rx FIFO larger than UART_SIZE_RXFIFO. (see rx_buffer_size)
+#ifndef UART_SIZE_RXREGION
+#define UART_SIZE_RXREGION 2048
+#endif
 
 /*!@brief
   UART Handle
@@ -38,8 +52,42 @@ typedef struct UART_HANDLE {
 
   UART_HandleTypeDef *hal_uart;		//!< STM32 HAL library UART handle.
   int rxfifo_size;			//!< FIFO size
-  uint8_t rxfifo[UART_SIZE_RXFIFO];	//!< FIFO for received data.
-
+  uint8_t *rxfifo;			//!< FIFO for received data.
+  uint8_t rxfifo_default[UART_SIZE_RXFIFO]; //!< FIFO up to the default size.
+  uint8_t *rx_region;			//!< FIFO in the region, or NULL.
+  int rx_region_size;			//!< size of rx_region.
+
+  // DMA position. kept at the half and full transfer.
+  uint32_t rx_dma_cnt;			//!< total count of received bytes.
+  uint16_t rx_dma_pos;			//!< index of rxfifo at rx_dma_cnt.
+  volatile uint8_t flag_rx_lost;	//!< DMA overwrote the unread data.
+
+  // Rx index. positions are kept in total byte count from the start.
+  uint32_t rx_rd_cnt;			//!< total count of read bytes.
+  uint32_t rx_scan_cnt;			//!< total count of scanned bytes.
+  uint16_t rx_scan;			//!< index of rxfifo for next scan.
+  uint8_t n_line;			//!< num of entries in line_end[].
+  uint8_t n_frame;			//!< num of entries in frame_end[].
+  uint32_t line_end[UART_SIZE_RXINDEX];	//!< position after delimiter.
+  uint32_t frame_end[UART_SIZE_RXINDEX];//!< position at IDLE line.
+
+  volatile uint16_t tx_rd;		//!< index of txfifo for DMA read.
+  volatile uint16_t tx_wr;		//!< index of txfifo for write.
+  volatile uint16_t tx_len;		//!< bytes in DMA transfer, 0 if idle.
+  int txfifo_size;			//!< FIFO size
+  uint8_t txfifo[UART_SIZE_TXFIFO];	//!< FIFO for transmit data.
+
+  // RS-485 driver enable. it is high while transmitting.
+  GPIO_TypeDef *de_port;		//!< DE pin port, or NULL if not used.
+  uint16_t de_pin;			//!< DE pin. (GPIO_PIN_x)
+  uint8_t framing;			//!< packet framing. UART_FRAMING_*
+
+  uint32_t rx_overrun_cnt;		//!< count of overrun errors. (ORE)
+  uint32_t rx_lost_cnt;			//!< count of the Rx FIFO lapped.
+#if defined(MRBC_METRICS)
+  uint32_t tx_cnt;			//!< total count of written bytes.
+  uint32_t rx_error_cnt;		//!< count of noise, framing, parity errors.
+#endif
 } UART_HANDLE;
 
 extern UART_HANDLE * const TBL_UART_HANDLE[];
@@ -54,13 +102,26 @@ extern UART_HANDLE * const TBL_UART_HANDLE[];
 */
 void uart_init(void);
 int uart_setmode(const UART_HANDLE *hndl, int baud, int parity, int stop_bits);
+void uart_flush_all(void);
+void uart_clock_changed(void);
+int uart_set_rx_buffer_size(UART_HANDLE *hndl, int size);
+void uart_set_de_pin(UART_HANDLE *hndl, GPIO_TypeDef *port, uint16_t pin);
+void uart_set_framing(UART_HANDLE *hndl, int framing);
 int uart_read(UART_HANDLE *hndl, void *buffer, int size);
 int uart_write(UART_HANDLE *hndl, const void *buffer, int size);
+int uart_bytes_to_write(const UART_HANDLE *hndl);
+void uart_flush(UART_HANDLE *hndl);
+void uart_clear_tx_buffer(UART_HANDLE *hndl);
 int uart_gets(UART_HANDLE *hndl, void *buffer, int size);
-int uart_is_readable(const UART_HANDLE *hndl);
-int uart_bytes_available(const UART_HANDLE *hndl);
-int uart_can_read_line(const UART_HANDLE *hndl);
+int uart_read_frame(UART_HANDLE *hndl, void *buffer, int size);
+int uart_read_packet(UART_HANDLE *hndl, void *buffer, int size);
+int uart_write_packet(UART_HANDLE *hndl, const void *buffer, int size);
+int uart_is_readable(UART_HANDLE *hndl);
+int uart_bytes_available(UART_HANDLE *hndl);
+int uart_can_read_line(UART_HANDLE *hndl);
+int uart_can_read_frame(UART_HANDLE *hndl);
 void uart_clear_rx_buffer(UART_HANDLE *hndl);
+void uart_irq_handler(UART_HandleTypeDef *huart);
 void mrbc_init_class_uart(void);
 
 
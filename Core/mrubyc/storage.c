@@ -0,0 +1,613 @@
+/*! @file
+  @brief
+  Storage class. A persistent key-value store in FLASH.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The values are kept over the reset, in the STORAGE region of the
+  linker script.
+
+    Storage.set( "count", 123 )	# Integer, Float or String.
+    Storage["offset"] = 1.5
+    Storage.get( "count" )	# -> 123, or nil if not found.
+    Storage.delete( "count" )	# -> true if found.
+    Storage.flush		# write the buffered changes now.
+
+  (log structure)
+  The region is two sectors. The records are appended to the active
+  one, and the latest record of a key is valid. When the sector is full,
+  the valid records are copied to the other sector, that is made active
+  by its header programmed at last.
+
+    sector header: magic(32) "KVS1", seq(32). the larger seq is active.
+    record: key_len(8) type(8) val_len(16), key, value, padded to 4,
+	    crc(32) of the above.
+
+  Writes are buffered in RAM, and the changes of the same key are
+  coalesced. The buffer is written when it is full, at Storage.flush,
+  or at a Storage call MRBC_STORAGE_FLUSH_MS after the first change.
+  Programming a record takes about 20 us per word, but the STM32F401
+  can't read FLASH during a sector erase, so the spare sector is erased
+  at the boot (storage_init). It is erased at run time only if the
+  sector gets full again before the reset.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "mrbc_firm.h"
+
+
+#if !defined(MRBC_STORAGE_KEYS)
+#define MRBC_STORAGE_KEYS	32	//!< maximum number of keys.
+#endif
+#if !defined(MRBC_STORAGE_BUFFER_SIZE)
+#define MRBC_STORAGE_BUFFER_SIZE 256	//!< write buffer.
+#endif
+#if !defined(MRBC_STORAGE_FLUSH_MS)
+#define MRBC_STORAGE_FLUSH_MS	1000
+#endif
+#define STORAGE_KEY_MAX		32
+#define STORAGE_MAGIC		0x3153564b	// "KVS1"
+#define STORAGE_HEADER_SIZE	8
+
+// the region, by the linker script.
+extern const uint8_t _storage_start[], _storage_end[];
+#define SECTOR_SIZE	((_storage_end - _storage_start) / 2)
+#define SECTOR_ADDR(n)	(_storage_start + SECTOR_SIZE * (n))
+#define SECTOR_END(n)	(SECTOR_ADDR(n) + SECTOR_SIZE)
+
+//! size of a record.
+#define RECORD_SIZE(key_len, val_len) \
+  (4 + (((key_len) + (val_len) + 3) & ~3) + 4)
+#define REC_KEY_LEN(p)	((p)[0])
+#define REC_TYPE(p)	((p)[1])
+#define REC_VAL_LEN(p)	((p)[2] | (p)[3] << 8)
+#define REC_KEY(p)	((p) + 4)
+#define REC_VAL(p)	((p) + 4 + REC_KEY_LEN(p))
+
+//! type of value.
+enum {
+  STORAGE_INTEGER = 'i',
+  STORAGE_FLOAT = 'f',
+  STORAGE_STRING = 's',
+  STORAGE_DELETED = 'd',
+};
+
+
+static int active_;		//!< active sector.
+static uint32_t seq_;		//!< seq of the active sector.
+static const uint8_t *free_;	//!< write point in the active sector.
+static const uint8_t *index_[MRBC_STORAGE_KEYS]; //!< valid records.
+static int n_index_;
+static uint8_t buffer_[MRBC_STORAGE_BUFFER_SIZE]; //!< records to write.
+static int buffer_len_;
+static uint32_t buffer_tick_;	//!< tick of the first change in buffer.
+
+
+//================================================================
+/*! is the area erased?
+*/
+static int is_blank( const uint8_t *p, const uint8_t *end )
+{
+  for( ; p < end; p += 4 ) {
+    if( *(const uint32_t *)p != 0xFFFFFFFF ) return 0;
+  }
+  return 1;
+}
+
+
+//================================================================
+/*! erase a sector. (the 16KB sectors 1 - 3)
+*/
+static int erase_sector( int n )
+{
+  FLASH_EraseInitTypeDef erase = {
+    .TypeErase = FLASH_TYPEERASE_SECTORS,
+    .Sector = (SECTOR_ADDR(n) - (const uint8_t *)FLASH_BASE) / 0x4000,
+    .NbSectors = 1,
+    .VoltageRange = FLASH_VOLTAGE_RANGE_3,
+  };
+  uint32_t error;
+
+  HAL_FLASH_Unlock();
+  HAL_StatusTypeDef sts = HAL_FLASHEx_Erase( &erase, &error );
+  HAL_FLASH_Lock();
+
+  return sts == HAL_OK ? 0 : -1;
+}
+
+
+//================================================================
+/*! program the words.
+
+  @note		Call between HAL_FLASH_Unlock() and HAL_FLASH_Lock().
+*/
+static int program( const uint8_t *addr, const void *data, int len )
+{
+  const uint8_t *p = data;
+
+  for( int i = 0; i < len; i += 4 ) {
+    uint32_t word;
+    memcpy( &word, p + i, 4 );
+    if( HAL_FLASH_Program( FLASH_TYPEPROGRAM_WORD,
+			   (uint32_t)addr + i, word ) != HAL_OK ) return -1;
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! find the record of the key.
+
+  @param  p	records.
+  @param  end	end of the records.
+  @return	the last record of the key, or NULL.
+*/
+static const uint8_t * find_record( const uint8_t *p, const uint8_t *end,
+				    const char *key, int key_len )
+{
+  const uint8_t *found = 0;
+
+  for( ; p < end; p += RECORD_SIZE(REC_KEY_LEN(p), REC_VAL_LEN(p)) ) {
+    if( REC_KEY_LEN(p) == key_len &&
+	memcmp( REC_KEY(p), key, key_len ) == 0 ) found = p;
+  }
+
+  return found;
+}
+
+
+//================================================================
+/*! find the index of the key.
+
+  @return	index, or -1 if not found.
+*/
+static int find_index( const char *key, int key_len )
+{
+  for( int i = 0; i < n_index_; i++ ) {
+    const uint8_t *p = index_[i];
+    if( REC_KEY_LEN(p) == key_len &&
+	memcmp( REC_KEY(p), key, key_len ) == 0 ) return i;
+  }
+
+  return -1;
+}
+
+
+//================================================================
+/*! update the index by a record in FLASH.
+*/
+static void index_record( const uint8_t *rec )
+{
+  int i = find_index( (const char *)REC_KEY(rec), REC_KEY_LEN(rec) );
+
+  if( REC_TYPE(rec) == STORAGE_DELETED ) {
+    if( i >= 0 ) index_[i] = index_[--n_index_];
+    return;
+  }
+
+  if( i >= 0 ) {
+    index_[i] = rec;
+  } else if( n_index_ < MRBC_STORAGE_KEYS ) {
+    index_[n_index_++] = rec;
+  }
+}
+
+
+//================================================================
+/*! number of the keys, including the ones in buffer.
+*/
+static int count_keys(void)
+{
+  int n = n_index_;
+  const uint8_t *end = buffer_ + buffer_len_;
+
+  for( const uint8_t *p = buffer_; p < end;
+       p += RECORD_SIZE(REC_KEY_LEN(p), REC_VAL_LEN(p)) ) {
+    int found = find_index( (const char *)REC_KEY(p), REC_KEY_LEN(p) ) >= 0;
+    if( REC_TYPE(p) == STORAGE_DELETED ) {
+      n -= found;
+    } else {
+      n += !found;
+    }
+  }
+
+  return n;
+}
+
+
+//================================================================
+/*! copy the valid records to the other sector, and make it active.
+
+  The records in buffer are not copied, because they replace them.
+*/
+static int compact(void)
+{
+  int n = !active_;
+  const uint8_t *dst = SECTOR_ADDR(n) + STORAGE_HEADER_SIZE;
+
+  if( !is_blank( SECTOR_ADDR(n), SECTOR_END(n) ) &&
+      erase_sector( n ) != 0 ) return -1;
+
+  const uint8_t *index[MRBC_STORAGE_KEYS];
+  int n_index = 0;
+  int ret = 0;
+
+  HAL_FLASH_Unlock();
+  for( int i = 0; i < n_index_ && ret == 0; i++ ) {
+    const uint8_t *rec = index_[i];
+    if( find_record( buffer_, buffer_ + buffer_len_,
+		     (const char *)REC_KEY(rec), REC_KEY_LEN(rec) ) ) continue;
+
+    int size = RECORD_SIZE(REC_KEY_LEN(rec), REC_VAL_LEN(rec));
+    ret = program( dst, rec, size );
+    index[n_index++] = dst;
+    dst += size;
+  }
+
+  // the header, the magic at last.
+  uint32_t header[2] = { STORAGE_MAGIC, seq_ + 1 };
+  if( ret == 0 ) ret = program( SECTOR_ADDR(n) + 4, &header[1], 4 );
+  if( ret == 0 ) ret = program( SECTOR_ADDR(n), &header[0], 4 );
+  HAL_FLASH_Lock();
+
+  if( ret != 0 ) return -1;	// the old sector is still active.
+
+  // (note) the old sector is erased at the next boot.
+  active_ = n;
+  seq_++;
+  memcpy( index_, index, sizeof(index[0]) * n_index );
+  n_index_ = n_index;
+  free_ = dst;
+
+  return 0;
+}
+
+
+//================================================================
+/*! write the buffer to FLASH.
+
+  @return	zero if no error.
+*/
+static int flush(void)
+{
+  if( buffer_len_ == 0 ) return 0;
+
+  if( buffer_len_ > SECTOR_END(active_) - free_ && compact() != 0 ) return -1;
+  if( buffer_len_ > SECTOR_END(active_) - free_ ) return -1;	// full.
+
+  HAL_FLASH_Unlock();
+  int ret = program( free_, buffer_, buffer_len_ );
+  HAL_FLASH_Lock();
+  if( ret != 0 ) return -1;
+
+  const uint8_t *end = free_ + buffer_len_;
+  for( const uint8_t *p = free_; p < end;
+       p += RECORD_SIZE(REC_KEY_LEN(p), REC_VAL_LEN(p)) ) {
+    index_record( p );
+  }
+  free_ = end;
+  buffer_len_ = 0;
+
+  return 0;
+}
+
+
+//================================================================
+/*! put a record in the buffer, replacing the one of the same key.
+
+  @return	zero if no error.
+*/
+static int put_record( const char *key, int key_len, int type,
+		       const void *val, int val_len )
+{
+  // coalesce the changes of the key.
+  const uint8_t *old = find_record( buffer_, buffer_ + buffer_len_,
+				    key, key_len );
+  if( old ) {
+    int size = RECORD_SIZE(REC_KEY_LEN(old), REC_VAL_LEN(old));
+    uint8_t *p = buffer_ + (old - buffer_);
+    memmove( p, p + size, buffer_ + buffer_len_ - (p + size) );
+    buffer_len_ -= size;
+  }
+
+  // deleting the key only in buffer.
+  if( type == STORAGE_DELETED && find_index( key, key_len ) < 0 ) return 0;
+
+  int size = RECORD_SIZE(key_len, val_len);
+  if( buffer_len_ + size > sizeof(buffer_) && flush() != 0 ) return -1;
+  if( buffer_len_ + size > sizeof(buffer_) ) return -1;
+
+  uint8_t *p = buffer_ + buffer_len_;
+  memset( p, 0, size );
+  p[0] = key_len;
+  p[1] = type;
+  p[2] = val_len;
+  p[3] = val_len >> 8;
+  memcpy( REC_KEY(p), key, key_len );
+  memcpy( REC_VAL(p), val, val_len );
+  uint32_t crc = calc_crc( p, size - 4 );
+  memcpy( p + size - 4, &crc, 4 );
+
+  if( buffer_len_ == 0 ) buffer_tick_ = HAL_GetTick();
+  buffer_len_ += size;
+
+  return 0;
+}
+
+
+//================================================================
+/*! write the buffer, if it is kept long.
+*/
+static int flush_if_old(void)
+{
+  if( buffer_len_ == 0 ) return 0;
+  if( HAL_GetTick() - buffer_tick_ < MRBC_STORAGE_FLUSH_MS ) return 0;
+
+  return flush();
+}
+
+
+//================================================================
+/*! get the key from the argument.
+
+  @return	key, or NULL if not a String nor Symbol.
+*/
+static const char * get_key( mrbc_vm *vm, const mrbc_value *v, int *key_len )
+{
+  const char *key;
+
+  switch( mrbc_type(*v) ) {
+  case MRBC_TT_STRING:	key = mrbc_string_cstr(v);	break;
+  case MRBC_TT_SYMBOL:	key = mrbc_symbol_cstr(v);	break;
+  default:
+    mrbc_raise(vm, MRBC_CLASS(TypeError), 0);
+    return 0;
+  }
+
+  *key_len = strlen(key);
+  if( *key_len == 0 || *key_len > STORAGE_KEY_MAX ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "Storage: bad key length.");
+    return 0;
+  }
+
+  return key;
+}
+
+
+//================================================================
+/*! (class method) get the value.
+
+  Storage.get( key )
+  Storage[ key ]
+*/
+static void c_storage_get(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int key_len;
+  const char *key = get_key( vm, &v[1], &key_len );
+  if( !key ) return;
+
+  const uint8_t *rec = find_record( buffer_, buffer_ + buffer_len_,
+				    key, key_len );
+  if( !rec ) {
+    int i = find_index( key, key_len );
+    if( i >= 0 ) rec = index_[i];
+  }
+  if( !rec ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  mrbc_value ret = mrbc_nil_value();
+  switch( REC_TYPE(rec) ) {
+  case STORAGE_INTEGER: {
+    int32_t i;
+    memcpy( &i, REC_VAL(rec), sizeof(i) );
+    ret = mrbc_integer_value(i);
+  } break;
+
+#if MRBC_USE_FLOAT
+  case STORAGE_FLOAT: {
+    mrbc_float_t f;
+    memcpy( &f, REC_VAL(rec), sizeof(f) );
+    ret = mrbc_float_value(vm, f);
+  } break;
+#endif
+
+  case STORAGE_STRING:
+    ret = mrbc_string_new(vm, REC_VAL(rec), REC_VAL_LEN(rec));
+    break;
+  }
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! (class method) set the value.
+
+  Storage.set( key, value )
+  Storage[ key ] = value
+*/
+static void c_storage_set(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 2 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  int key_len;
+  const char *key = get_key( vm, &v[1], &key_len );
+  if( !key ) return;
+
+  int32_t i;
+#if MRBC_USE_FLOAT
+  mrbc_float_t d;
+#endif
+  int type;
+  const void *val;
+  int val_len;
+
+  switch( mrbc_type(v[2]) ) {
+  case MRBC_TT_INTEGER:
+    i = mrbc_integer(v[2]);
+    type = STORAGE_INTEGER;
+    val = &i;
+    val_len = sizeof(i);
+    break;
+
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT:
+    d = mrbc_float(v[2]);
+    type = STORAGE_FLOAT;
+    val = &d;
+    val_len = sizeof(d);
+    break;
+#endif
+
+  case MRBC_TT_STRING:
+    type = STORAGE_STRING;
+    val = mrbc_string_cstr(&v[2]);
+    val_len = mrbc_string_size(&v[2]);
+    if( val_len <= MRBC_STORAGE_BUFFER_SIZE - RECORD_SIZE(key_len, 0) ) break;
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "Storage: too long value.");
+    return;
+
+  default:
+    mrbc_raise(vm, MRBC_CLASS(TypeError), 0);
+    return;
+  }
+
+  if( find_index( key, key_len ) < 0 &&
+      !find_record( buffer_, buffer_ + buffer_len_, key, key_len ) &&
+      count_keys() >= MRBC_STORAGE_KEYS ) {
+    mrbc_raise(vm, MRBC_CLASS(IndexError), "Storage: too many keys.");
+    return;
+  }
+
+  if( put_record( key, key_len, type, val, val_len ) != 0 ||
+      flush_if_old() != 0 ) {
+    mrbc_raise(vm, 0, "Storage: flash write error.");
+    return;
+  }
+
+  mrbc_incref( &v[2] );
+  SET_RETURN(v[2]);
+}
+
+
+//================================================================
+/*! (class method) delete the key.
+
+  Storage.delete( key )	# -> true if found.
+*/
+static void c_storage_delete(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int key_len;
+  const char *key = get_key( vm, &v[1], &key_len );
+  if( !key ) return;
+
+  const uint8_t *rec = find_record( buffer_, buffer_ + buffer_len_,
+				    key, key_len );
+  int found = rec ? REC_TYPE(rec) != STORAGE_DELETED
+		  : find_index( key, key_len ) >= 0;
+
+  if( put_record( key, key_len, STORAGE_DELETED, 0, 0 ) != 0 ||
+      flush_if_old() != 0 ) {
+    mrbc_raise(vm, 0, "Storage: flash write error.");
+    return;
+  }
+
+  SET_BOOL_RETURN( found );
+}
+
+
+//================================================================
+/*! (class method) write the buffered changes.
+
+  Storage.flush
+*/
+static void c_storage_flush(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( flush() != 0 ) {
+    mrbc_raise(vm, 0, "Storage: flash write error.");
+  }
+}
+
+
+//================================================================
+/*! read the store from FLASH, and erase the spare sector.
+
+  Call this at every boot, before the scheduler starts.
+*/
+void storage_init(void)
+{
+  const uint32_t *h0 = (const uint32_t *)SECTOR_ADDR(0);
+  const uint32_t *h1 = (const uint32_t *)SECTOR_ADDR(1);
+  int valid0 = h0[0] == STORAGE_MAGIC;
+  int valid1 = h1[0] == STORAGE_MAGIC;
+
+  if( valid0 && valid1 ) {
+    active_ = (int32_t)(h1[1] - h0[1]) > 0;
+  } else if( valid0 || valid1 ) {
+    active_ = valid1;
+  } else {
+    // make a new store.
+    active_ = 0;
+    if( !is_blank( SECTOR_ADDR(0), SECTOR_END(0) ) ) erase_sector( 0 );
+    uint32_t header[2] = { STORAGE_MAGIC, 0 };
+    HAL_FLASH_Unlock();
+    program( SECTOR_ADDR(0) + 4, &header[1], 4 );
+    program( SECTOR_ADDR(0), &header[0], 4 );
+    HAL_FLASH_Lock();
+  }
+  seq_ = ((const uint32_t *)SECTOR_ADDR(active_))[1];
+
+  // erase the spare sector.
+  int spare = !active_;
+  if( !is_blank( SECTOR_ADDR(spare), SECTOR_END(spare) ) ) erase_sector( spare );
+
+  // read the records.
+  n_index_ = 0;
+  buffer_len_ = 0;
+  const uint8_t *p = SECTOR_ADDR(active_) + STORAGE_HEADER_SIZE;
+  const uint8_t *end = SECTOR_END(active_);
+  while( p < end && *(const uint32_t *)p != 0xFFFFFFFF ) {
+    int key_len = REC_KEY_LEN(p);
+    int size = RECORD_SIZE(key_len, REC_VAL_LEN(p));
+    if( key_len == 0 || key_len > STORAGE_KEY_MAX || size > end - p ) {
+      p = end;		// broken. the next write compacts it.
+      break;
+    }
+
+    uint32_t crc;
+    memcpy( &crc, p + size - 4, 4 );
+    if( crc == calc_crc( p, size - 4 ) ) index_record( p );	// or torn.
+    p += size;
+  }
+  free_ = p;
+}
+
+
+//================================================================
+/*! initialize the Storage class.
+*/
+void mrbc_init_class_storage(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Storage", 0);
+
+  mrbc_define_method(0, cls, "get", c_storage_get);
+  mrbc_define_method(0, cls, "[]", c_storage_get);
+  mrbc_define_method(0, cls, "set", c_storage_set);
+  mrbc_define_method(0, cls, "[]=", c_storage_set);
+  mrbc_define_method(0, cls, "delete", c_storage_delete);
+  mrbc_define_method(0, cls, "flush", c_storage_flush);
+}
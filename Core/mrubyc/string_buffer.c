@@ -0,0 +1,420 @@
+/*! @file
+  @brief
+  StringBuffer class.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  A fixed capacity buffer to build a text line such as CSV or JSON.
+  Values are formatted directly into the buffer, so no String is
+  created and no realloc happens while appending.
+
+    buf = StringBuffer.new(128)
+    buf << "temp," << 23 << "," << 1.5
+    buf.append_int( 7, 3 ).append_float( 3.14159, 2 )
+    buf.write_to( uart1 )
+    buf.clear
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "stm32f4_uart.h"
+#include "string_buffer.h"
+
+
+static mrbc_class *cls_string_buffer;
+static mrbc_class *cls_uart;
+
+
+//================================================================
+/*! get the string buffer from the object.
+
+  @param  v	pointer to value.
+  @return	pointer to STRING_BUFFER, or NULL if not a StringBuffer.
+*/
+STRING_BUFFER *string_buffer_get( const mrbc_value *v )
+{
+  if( v->tt != MRBC_TT_OBJECT ) return NULL;
+  if( v->instance->cls != cls_string_buffer ) return NULL;
+
+  return (STRING_BUFFER *)v->instance->data;
+}
+
+
+//================================================================
+/*! initialize printf container to write the rest of buffer.
+
+  The container has one extra byte, so that a result that just fills
+  the buffer is not reported as overflow by mrbc_printf_*().
+*/
+static void sb_printf_init( mrbc_printf_t *pf, STRING_BUFFER *sb,
+			    const char *fstr )
+{
+  mrbc_printf_init( pf, sb->data + sb->length,
+		    sb->capacity - sb->length + 2, fstr );
+}
+
+
+//================================================================
+/*! commit the printf result.
+
+  @return	0 if no error, or -1 if buffer full. (nothing is appended)
+*/
+static int sb_printf_end( STRING_BUFFER *sb, mrbc_printf_t *pf, int ret )
+{
+  int len = mrbc_printf_len( pf );
+
+  if( ret < 0 || sb->length + len > sb->capacity ) {
+    sb->data[sb->length] = '\0';
+    return -1;
+  }
+
+  sb->length += len;
+  sb->data[sb->length] = '\0';
+  return 0;
+}
+
+
+//================================================================
+/*! append byte string.
+
+  @return	0 if no error, or -1 if buffer full. (nothing is appended)
+*/
+static int sb_append_bstr( STRING_BUFFER *sb, const void *s, int len )
+{
+  if( sb->length + len > sb->capacity ) return -1;
+
+  memcpy( sb->data + sb->length, s, len );
+  sb->length += len;
+  sb->data[sb->length] = '\0';
+  return 0;
+}
+
+
+//================================================================
+/*! append integer.
+
+  @param  sb	pointer to STRING_BUFFER.
+  @param  val	value.
+  @param  width	minimum width, padded with '0'.
+  @param  base	n base.
+  @return	0 if no error, or -1 if buffer full. (nothing is appended)
+*/
+static int sb_append_int( STRING_BUFFER *sb, mrbc_int_t val, int width,
+			  int base )
+{
+  mrbc_printf_t pf;
+
+  sb_printf_init( &pf, sb, "" );
+  pf.fmt.width = width;
+  pf.fmt.flag_zero = 1;
+
+  return sb_printf_end( sb, &pf, mrbc_printf_int( &pf, val, base ) );
+}
+
+
+#if MRBC_USE_FLOAT
+//================================================================
+/*! append float.
+
+  @param  sb	pointer to STRING_BUFFER.
+  @param  val	value.
+  @param  prec	digits after the decimal point, or -1 to use "%g".
+  @return	0 if no error, or -1 if buffer full. (nothing is appended)
+*/
+static int sb_append_float( STRING_BUFFER *sb, double val, int prec )
+{
+  char fstr[] = "%.0f";
+  mrbc_printf_t pf;
+
+  if( prec < 0 ) {
+    strcpy( fstr, "%g" );
+  } else {
+    fstr[2] = '0' + (prec > 9 ? 9 : prec);
+  }
+
+  // mrbc_printf_float() refers the format backward from pf.fstr.
+  sb_printf_init( &pf, sb, fstr + strlen(fstr) );
+
+  return sb_printf_end( sb, &pf, mrbc_printf_float( &pf, val ) );
+}
+#endif
+
+
+//================================================================
+/*! append a value.
+
+  @return	0 if no error, -1 if buffer full or -2 if type error.
+*/
+static int sb_append( STRING_BUFFER *sb, const mrbc_value *val )
+{
+  switch( val->tt ) {
+  case MRBC_TT_STRING:
+    return sb_append_bstr( sb, mrbc_string_cstr(val), mrbc_string_size(val) );
+
+  case MRBC_TT_SYMBOL: {
+    const char *s = mrbc_symbol_cstr( val );
+    return sb_append_bstr( sb, s, strlen(s) );
+  }
+
+  case MRBC_TT_INTEGER:
+    return sb_append_int( sb, mrbc_integer(*val), 0, 10 );
+
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT:
+    return sb_append_float( sb, mrbc_float(*val), -1 );
+#endif
+
+  default: {
+    const STRING_BUFFER *sb2 = string_buffer_get( val );
+    if( !sb2 ) return -2;
+    return sb_append_bstr( sb, sb2->data, sb2->length );
+  }
+  }
+}
+
+
+//================================================================
+/*! raise the error of sb_append*()
+*/
+static void sb_raise( mrbc_vm *vm, int err )
+{
+  if( err == -1 ) {
+    mrbc_raise(vm, MRBC_CLASS(IndexError), "StringBuffer is full.");
+  } else {
+    mrbc_raise(vm, MRBC_CLASS(TypeError), 0);
+  }
+}
+
+
+//================================================================
+/*! (method) new
+
+  StringBuffer.new( capacity = 128 )
+*/
+static void c_sb_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int capacity = 128;
+
+  if( argc >= 1 ) {
+    if( v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    capacity = mrbc_integer(v[1]);
+  }
+  if( capacity < 0 || capacity > UINT16_MAX - 2 ) goto ERROR_RETURN;
+
+  // data[] has two extra bytes. one for '\0', one for sb_printf_init().
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls,
+				sizeof(STRING_BUFFER) + capacity + 2);
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  STRING_BUFFER *sb = (STRING_BUFFER *)ret.instance->data;
+  sb->capacity = capacity;
+  sb->length = 0;
+  sb->data[0] = '\0';
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) <<
+
+  buf << obj -> self	(obj: String, Symbol, Integer, Float or StringBuffer)
+*/
+static void c_sb_append(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  STRING_BUFFER *sb = (STRING_BUFFER *)v[0].instance->data;
+
+  for( int i = 1; i <= argc; i++ ) {
+    int err = sb_append( sb, &v[i] );
+    if( err ) {
+      sb_raise( vm, err );
+      return;
+    }
+  }
+}
+
+
+//================================================================
+/*! (method) append_int
+
+  buf.append_int( val, width = 0, base = 10 ) -> self
+
+  @param  width	minimum width, padded with '0'.
+*/
+static void c_sb_append_int(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  STRING_BUFFER *sb = (STRING_BUFFER *)v[0].instance->data;
+  int width = 0;
+  int base = 10;
+
+  if( argc < 1 || argc > 3 || v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+  if( argc >= 2 ) {
+    if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    width = mrbc_integer(v[2]);
+  }
+  if( argc >= 3 ) {
+    if( v[3].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    base = mrbc_integer(v[3]);
+  }
+  if( width < 0 || width > sb->capacity || base < 2 || base > 36 ) {
+    goto ERROR_RETURN;
+  }
+
+  if( sb_append_int( sb, mrbc_integer(v[1]), width, base ) != 0 ) {
+    sb_raise( vm, -1 );
+  }
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+#if MRBC_USE_FLOAT
+//================================================================
+/*! (method) append_float
+
+  buf.append_float( val, digits = 3 ) -> self
+
+  @param  digits  digits after the decimal point. (0..9)
+*/
+static void c_sb_append_float(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  STRING_BUFFER *sb = (STRING_BUFFER *)v[0].instance->data;
+  double val;
+  int digits = 3;
+
+  if( argc < 1 || argc > 2 ) goto ERROR_RETURN;
+  switch( v[1].tt ) {
+  case MRBC_TT_INTEGER:	val = mrbc_integer(v[1]);	break;
+  case MRBC_TT_FLOAT:	val = mrbc_float(v[1]);		break;
+  default:		goto ERROR_RETURN;
+  }
+  if( argc >= 2 ) {
+    if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+    digits = mrbc_integer(v[2]);
+    if( digits < 0 || digits > 9 ) goto ERROR_RETURN;
+  }
+
+  if( sb_append_float( sb, val, digits ) != 0 ) {
+    sb_raise( vm, -1 );
+  }
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+#endif
+
+
+//================================================================
+/*! (method) size, length
+*/
+static void c_sb_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  STRING_BUFFER *sb = (STRING_BUFFER *)v[0].instance->data;
+
+  SET_INT_RETURN( sb->length );
+}
+
+
+//================================================================
+/*! (method) capacity
+*/
+static void c_sb_capacity(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  STRING_BUFFER *sb = (STRING_BUFFER *)v[0].instance->data;
+
+  SET_INT_RETURN( sb->capacity );
+}
+
+
+//================================================================
+/*! (method) clear
+
+  buf.clear -> self
+*/
+static void c_sb_clear(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  STRING_BUFFER *sb = (STRING_BUFFER *)v[0].instance->data;
+
+  sb->length = 0;
+  sb->data[0] = '\0';
+}
+
+
+//================================================================
+/*! (method) to_s
+
+  buf.to_s -> String  (copy of the contents)
+*/
+static void c_sb_to_s(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  STRING_BUFFER *sb = (STRING_BUFFER *)v[0].instance->data;
+
+  SET_RETURN( mrbc_string_new(vm, sb->data, sb->length) );
+}
+
+
+//================================================================
+/*! (method) write_to
+
+  buf.write_to( uart ) -> Integer  (bytes written)
+
+  The contents are copied into the UART Tx FIFO and sent by DMA,
+  so the buffer can be cleared and reused as soon as this returns.
+*/
+static void c_sb_write_to(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  STRING_BUFFER *sb = (STRING_BUFFER *)v[0].instance->data;
+
+  if( argc != 1 || v[1].tt != MRBC_TT_OBJECT ||
+      cls_uart == NULL || v[1].instance->cls != cls_uart ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "UART required.");
+    return;
+  }
+
+  UART_HANDLE *hndl = *(UART_HANDLE **)(v[1].instance->data);
+  int n = uart_write( hndl, sb->data, sb->length );
+
+  SET_INT_RETURN(n);
+}
+
+
+//================================================================
+/*! Initializer
+
+  @note  Call after mrbc_init_class_uart().
+*/
+void mrbc_init_class_string_buffer(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "StringBuffer", 0);
+  cls_string_buffer = cls;
+  cls_uart = mrbc_get_class_by_name("UART");
+
+  mrbc_define_method(0, cls, "new", c_sb_new);
+  mrbc_define_method(0, cls, "<<", c_sb_append);
+  mrbc_define_method(0, cls, "append", c_sb_append);
+  mrbc_define_method(0, cls, "append_int", c_sb_append_int);
+#if MRBC_USE_FLOAT
+  mrbc_define_method(0, cls, "append_float", c_sb_append_float);
+#endif
+  mrbc_define_method(0, cls, "size", c_sb_size);
+  mrbc_define_method(0, cls, "length", c_sb_size);
+  mrbc_define_method(0, cls, "capacity", c_sb_capacity);
+  mrbc_define_method(0, cls, "clear", c_sb_clear);
+  mrbc_define_method(0, cls, "to_s", c_sb_to_s);
+  mrbc_define_method(0, cls, "write_to", c_sb_write_to);
+}
@@ -0,0 +1,47 @@
+/*! @file
+  @brief
+  StringBuffer class header.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef STRING_BUFFER_H
+#define STRING_BUFFER_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#include "../mrubyc_src/mrubyc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!@brief
+  string buffer, stored in the instance data area.
+*/
+typedef struct STRING_BUFFER {
+  uint16_t capacity;	//!< buffer size, without '\0' terminator.
+  uint16_t length;	//!< length of the stored data.
+  char data[];		//!< buffer.
+} STRING_BUFFER;
+
+
+/*
+  function prototypes.
+*/
+STRING_BUFFER *string_buffer_get( const mrbc_value *v );
+void mrbc_init_class_string_buffer( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,547 @@
+/*! @file
+  @brief
+  Semaphore, ConditionVariable and EventGroup class.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The waiting tasks are held in the wait queue of the object, and woken
+  up at once by the other task or the interrupt handler, so no polling
+  is needed. The timeout is by the sleep queue of the scheduler.
+
+    sem = Semaphore.new( 0 )
+    sem.acquire( 100 )		# -> true, or false if timed out.
+    sem.release			# in the other task.
+
+    m = Mutex.new
+    cv = ConditionVariable.new
+    m.lock
+    cv.wait( m ) until ready?	# unlock m while waiting.
+    m.unlock
+    cv.signal			# or broadcast, in the other task.
+
+    eg = EventGroup.new
+    eg.wait_any( 0x03, 100 )	# -> bits of the mask set, or nil.
+    eg.wait_all( 0x03 )		# -> 0x03, when both are set.
+    eg.set( 0x01 )		# in the other task.
+    eg.clear( 0x01 )		# the bits are kept until cleared.
+  </pre>
+
+  (note) The object must not be released while some task is waiting.
+*/
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "sync.h"
+
+
+static mrbc_class *cls_semaphore;
+static mrbc_class *cls_event_group;
+static mrbc_class *cls_mutex;
+
+
+//================================================================
+/*! get timeout argument.
+
+  @return	timeout in milliseconds, -1 if nil, or -2 if error.
+*/
+static int sync_get_timeout( mrbc_value v[], int argc, int idx )
+{
+  if( argc < idx || v[idx].tt == MRBC_TT_NIL ) return -1;
+  if( v[idx].tt != MRBC_TT_INTEGER || mrbc_integer(v[idx]) < 0 ) return -2;
+
+  return mrbc_integer(v[idx]);
+}
+
+
+/*
+  Semaphore class
+*/
+//================================================================
+/*! get the semaphore from the object.
+
+  @param  v	pointer to value.
+  @return	pointer to SYNC_SEMAPHORE, or NULL if not a Semaphore.
+*/
+SYNC_SEMAPHORE *sync_semaphore_get( const mrbc_value *v )
+{
+  if( v->tt != MRBC_TT_OBJECT ) return NULL;
+  if( v->instance->cls != cls_semaphore ) return NULL;
+
+  return (SYNC_SEMAPHORE *)v->instance->data;
+}
+
+
+//================================================================
+/*! release the semaphore.
+
+  The count is handed to the first waiting task, if any.
+
+  @param  sem	pointer to SYNC_SEMAPHORE.
+  @note  This can be called from interrupt handler.
+*/
+void sync_semaphore_release( SYNC_SEMAPHORE *sem )
+{
+  hal_disable_irq();
+  if( sem->wq.head != NULL ) {
+    mrbc_wait_queue_wakeup_task( &sem->wq, sem->wq.head, 1 );
+  } else {
+    sem->count++;
+  }
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! (method) new
+
+  Semaphore.new( count = 0 )
+*/
+static void c_semaphore_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int count = 0;
+  if( argc > 1 ) goto ERROR_RETURN;
+  if( argc == 1 ) {
+    if( v[1].tt != MRBC_TT_INTEGER || mrbc_integer(v[1]) < 0 ) goto ERROR_RETURN;
+    count = mrbc_integer(v[1]);
+  }
+
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls, sizeof(SYNC_SEMAPHORE));
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  SYNC_SEMAPHORE *sem = (SYNC_SEMAPHORE *)ret.instance->data;
+  sem->count = count;
+  sem->wq = (mrbc_wait_queue)MRBC_WAIT_QUEUE_INITIALIZER;
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) acquire
+
+  sem.acquire( timeout = nil ) -> true, or false if timed out.
+
+  @param  timeout	timeout in milliseconds, or nil to wait forever.
+*/
+static void c_semaphore_acquire(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SYNC_SEMAPHORE *sem = (SYNC_SEMAPHORE *)v[0].instance->data;
+  mrbc_tcb *tcb = VM2TCB(vm);
+  int timeout = sync_get_timeout( v, argc, 1 );
+  uint32_t value;
+
+  if( argc > 1 || timeout == -2 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  // called again, the count is handed by release or timed out.
+  if( mrbc_wait_queue_resumed( &sem->wq, tcb, &value ) ) {
+    SET_BOOL_RETURN( value != 0 );
+    return;
+  }
+
+  hal_disable_irq();
+  if( sem->count > 0 ) {
+    sem->count--;
+    hal_enable_irq();
+    SET_TRUE_RETURN();
+    return;
+  }
+  if( timeout == 0 ) {
+    hal_enable_irq();
+    SET_FALSE_RETURN();
+    return;
+  }
+
+  mrbc_wait_queue_wait( &sem->wq, tcb, timeout, 0 );
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! (method) try_acquire
+
+  sem.try_acquire -> true, or false if not available.
+*/
+static void c_semaphore_try_acquire(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SYNC_SEMAPHORE *sem = (SYNC_SEMAPHORE *)v[0].instance->data;
+  int ret = 0;
+
+  hal_disable_irq();
+  if( sem->count > 0 ) {
+    sem->count--;
+    ret = 1;
+  }
+  hal_enable_irq();
+
+  SET_BOOL_RETURN( ret );
+}
+
+
+//================================================================
+/*! (method) release
+
+  sem.release -> self
+*/
+static void c_semaphore_release(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  sync_semaphore_release( (SYNC_SEMAPHORE *)v[0].instance->data );
+}
+
+
+//================================================================
+/*! (method) count
+
+  sem.count -> Integer
+*/
+static void c_semaphore_count(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SYNC_SEMAPHORE *sem = (SYNC_SEMAPHORE *)v[0].instance->data;
+
+  SET_INT_RETURN( sem->count );
+}
+
+
+/*
+  ConditionVariable class
+*/
+//================================================================
+/*! (method) new
+
+  ConditionVariable.new
+*/
+static void c_condvar_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls, sizeof(SYNC_CONDVAR));
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  SYNC_CONDVAR *cv = (SYNC_CONDVAR *)ret.instance->data;
+  cv->wq = (mrbc_wait_queue)MRBC_WAIT_QUEUE_INITIALIZER;
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! (method) wait
+
+  cv.wait( mutex, timeout = nil ) -> true, or false if timed out.
+
+  The mutex is unlocked while waiting, and is locked again before
+  the return, in either case.
+
+  @param  mutex		Mutex locked by the current task.
+  @param  timeout	timeout in milliseconds, or nil to wait forever.
+*/
+static void c_condvar_wait(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SYNC_CONDVAR *cv = (SYNC_CONDVAR *)v[0].instance->data;
+  mrbc_tcb *tcb = VM2TCB(vm);
+  int timeout = sync_get_timeout( v, argc, 2 );
+  uint32_t value;
+
+  if( argc < 1 || argc > 2 || timeout == -2 ||
+      v[1].tt != MRBC_TT_OBJECT || v[1].instance->cls != cls_mutex ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  mrbc_mutex *mutex = (mrbc_mutex *)v[1].instance->data;
+
+  // called again, lock the mutex. it may wait for the mutex.
+  if( mrbc_wait_queue_resumed( &cv->wq, tcb, &value ) ) {
+    mrbc_mutex_lock( mutex, tcb );
+    SET_BOOL_RETURN( value != 0 );
+    return;
+  }
+
+  if( !mutex->lock || mutex->tcb != tcb ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "Mutex is not locked by the current task.");
+    return;
+  }
+  if( timeout == 0 ) {
+    SET_FALSE_RETURN();
+    return;
+  }
+
+  // only the tasks signal, so no wakeup is missed after the unlock.
+  mrbc_mutex_unlock( mutex, tcb );
+  hal_disable_irq();
+  mrbc_wait_queue_wait( &cv->wq, tcb, timeout, 0 );
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! (method) signal
+
+  cv.signal -> self	# wake up a waiting task.
+*/
+static void c_condvar_signal(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SYNC_CONDVAR *cv = (SYNC_CONDVAR *)v[0].instance->data;
+
+  mrbc_wait_queue_wakeup( &cv->wq, 1, 1 );
+}
+
+
+//================================================================
+/*! (method) broadcast
+
+  cv.broadcast -> self	# wake up all waiting tasks.
+*/
+static void c_condvar_broadcast(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SYNC_CONDVAR *cv = (SYNC_CONDVAR *)v[0].instance->data;
+
+  mrbc_wait_queue_wakeup( &cv->wq, -1, 1 );
+}
+
+
+/*
+  EventGroup class
+*/
+//================================================================
+/*! get the event group from the object.
+
+  @param  v	pointer to value.
+  @return	pointer to SYNC_EVENT_GROUP, or NULL if not an EventGroup.
+*/
+SYNC_EVENT_GROUP *sync_event_group_get( const mrbc_value *v )
+{
+  if( v->tt != MRBC_TT_OBJECT ) return NULL;
+  if( v->instance->cls != cls_event_group ) return NULL;
+
+  return (SYNC_EVENT_GROUP *)v->instance->data;
+}
+
+
+//================================================================
+/*! set the event bits, and wake up the tasks waiting for them.
+
+  @param  eg	pointer to SYNC_EVENT_GROUP.
+  @param  bits	event bits.
+  @note  This can be called from interrupt handler.
+*/
+void sync_event_group_set( SYNC_EVENT_GROUP *eg, uint32_t bits )
+{
+  hal_disable_irq();
+  eg->bits |= bits;
+
+  // tcb->wait_value is the mask while waiting.
+  mrbc_tcb *tcb, *next;
+  for( tcb = eg->wq_any.head; tcb != NULL; tcb = next ) {
+    next = tcb->wait_next;
+    uint32_t set = eg->bits & tcb->wait_value;
+    if( set ) mrbc_wait_queue_wakeup_task( &eg->wq_any, tcb, set );
+  }
+  for( tcb = eg->wq_all.head; tcb != NULL; tcb = next ) {
+    next = tcb->wait_next;
+    uint32_t mask = tcb->wait_value;
+    if( (eg->bits & mask) == mask ) mrbc_wait_queue_wakeup_task( &eg->wq_all, tcb, mask );
+  }
+
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! (method) new
+
+  EventGroup.new( bits = 0 )
+*/
+static void c_event_group_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  uint32_t bits = 0;
+  if( argc > 1 || (argc == 1 && v[1].tt != MRBC_TT_INTEGER) ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  if( argc == 1 ) bits = mrbc_integer(v[1]);
+
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls, sizeof(SYNC_EVENT_GROUP));
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  SYNC_EVENT_GROUP *eg = (SYNC_EVENT_GROUP *)ret.instance->data;
+  eg->bits = bits;
+  eg->wq_any = (mrbc_wait_queue)MRBC_WAIT_QUEUE_INITIALIZER;
+  eg->wq_all = (mrbc_wait_queue)MRBC_WAIT_QUEUE_INITIALIZER;
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! wait for the bits.
+
+  @param  flag_all	wait for all of the mask.
+*/
+static void event_group_wait(mrbc_vm *vm, mrbc_value v[], int argc, int flag_all)
+{
+  SYNC_EVENT_GROUP *eg = (SYNC_EVENT_GROUP *)v[0].instance->data;
+  mrbc_wait_queue *wq = flag_all ? &eg->wq_all : &eg->wq_any;
+  mrbc_tcb *tcb = VM2TCB(vm);
+  int timeout = sync_get_timeout( v, argc, 2 );
+  uint32_t value;
+
+  if( argc < 1 || argc > 2 || timeout == -2 ||
+      v[1].tt != MRBC_TT_INTEGER || (uint32_t)mrbc_integer(v[1]) == 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  uint32_t mask = mrbc_integer(v[1]);
+
+  // called again, woken up by the bits or timed out.
+  if( mrbc_wait_queue_resumed( wq, tcb, &value ) ) {
+    if( value ) {
+      SET_INT_RETURN( value );
+    } else {
+      SET_NIL_RETURN();
+    }
+    return;
+  }
+
+  hal_disable_irq();
+  uint32_t set = eg->bits & mask;
+  if( flag_all ? (set == mask) : (set != 0) ) {
+    hal_enable_irq();
+    SET_INT_RETURN( set );
+    return;
+  }
+  if( timeout == 0 ) {
+    hal_enable_irq();
+    SET_NIL_RETURN();
+    return;
+  }
+
+  mrbc_wait_queue_wait( wq, tcb, timeout, mask );
+  vm->flag_retry_call = 1;
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! (method) wait_any
+
+  eg.wait_any( mask, timeout = nil ) -> Integer, or nil if timed out.
+
+  @param  mask		bits to wait for, any of them.
+  @param  timeout	timeout in milliseconds, or nil to wait forever.
+  @return		bits of the mask set.
+*/
+static void c_event_group_wait_any(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  event_group_wait( vm, v, argc, 0 );
+}
+
+
+//================================================================
+/*! (method) wait_all
+
+  eg.wait_all( mask, timeout = nil ) -> Integer, or nil if timed out.
+
+  @param  mask		bits to wait for, all of them.
+  @param  timeout	timeout in milliseconds, or nil to wait forever.
+  @return		mask.
+*/
+static void c_event_group_wait_all(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  event_group_wait( vm, v, argc, 1 );
+}
+
+
+//================================================================
+/*! (method) set
+
+  eg.set( bits ) -> self
+*/
+static void c_event_group_set(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  sync_event_group_set( (SYNC_EVENT_GROUP *)v[0].instance->data,
+			mrbc_integer(v[1]) );
+}
+
+
+//================================================================
+/*! (method) clear
+
+  eg.clear( bits ) -> Integer	# the bits before cleared.
+*/
+static void c_event_group_clear(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SYNC_EVENT_GROUP *eg = (SYNC_EVENT_GROUP *)v[0].instance->data;
+
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  hal_disable_irq();
+  uint32_t bits = eg->bits;
+  eg->bits = bits & ~(uint32_t)mrbc_integer(v[1]);
+  hal_enable_irq();
+
+  SET_INT_RETURN( bits );
+}
+
+
+//================================================================
+/*! (method) bits
+
+  eg.bits -> Integer
+*/
+static void c_event_group_bits(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SYNC_EVENT_GROUP *eg = (SYNC_EVENT_GROUP *)v[0].instance->data;
+
+  SET_INT_RETURN( eg->bits );
+}
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_sync(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Semaphore", 0);
+  cls_semaphore = cls;
+
+  mrbc_define_method(0, cls, "new", c_semaphore_new);
+  mrbc_define_method(0, cls, "acquire", c_semaphore_acquire);
+  mrbc_define_method(0, cls, "try_acquire", c_semaphore_try_acquire);
+  mrbc_define_method(0, cls, "release", c_semaphore_release);
+  mrbc_define_method(0, cls, "count", c_semaphore_count);
+
+  cls = mrbc_define_class(0, "ConditionVariable", 0);
+  cls_mutex = mrbc_get_class_by_name("Mutex");
+
+  mrbc_define_method(0, cls, "new", c_condvar_new);
+  mrbc_define_method(0, cls, "wait", c_condvar_wait);
+  mrbc_define_method(0, cls, "signal", c_condvar_signal);
+  mrbc_define_method(0, cls, "broadcast", c_condvar_broadcast);
+
+  cls = mrbc_define_class(0, "EventGroup", 0);
+  cls_event_group = cls;
+
+  mrbc_define_method(0, cls, "new", c_event_group_new);
+  mrbc_define_method(0, cls, "wait_any", c_event_group_wait_any);
+  mrbc_define_method(0, cls, "wait_all", c_event_group_wait_all);
+  mrbc_define_method(0, cls, "set", c_event_group_set);
+  mrbc_define_method(0, cls, "clear", c_event_group_clear);
+  mrbc_define_method(0, cls, "bits", c_event_group_bits);
+}
@@ -0,0 +1,65 @@
+/*! @file
+  @brief
+  Semaphore, ConditionVariable and EventGroup class header.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef SYNC_H
+#define SYNC_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#include "../mrubyc_src/mrubyc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*!@brief
+  counting semaphore, stored in the instance data area.
+*/
+typedef struct SYNC_SEMAPHORE {
+  volatile int count;		//!< available count.
+  mrbc_wait_queue wq;		//!< tasks waiting in acquire.
+} SYNC_SEMAPHORE;
+
+/*!@brief
+  condition variable, stored in the instance data area.
+*/
+typedef struct SYNC_CONDVAR {
+  mrbc_wait_queue wq;		//!< tasks waiting in wait.
+} SYNC_CONDVAR;
+
+/*!@brief
+  event group, stored in the instance data area.
+*/
+typedef struct SYNC_EVENT_GROUP {
+  volatile uint32_t bits;	//!< event bits.
+  mrbc_wait_queue wq_any;	//!< tasks waiting for any of the mask.
+  mrbc_wait_queue wq_all;	//!< tasks waiting for all of the mask.
+} SYNC_EVENT_GROUP;
+
+
+/*
+  function prototypes.
+*/
+SYNC_SEMAPHORE *sync_semaphore_get( const mrbc_value *v );
+void sync_semaphore_release( SYNC_SEMAPHORE *sem );
+SYNC_EVENT_GROUP *sync_event_group_get( const mrbc_value *v );
+void sync_event_group_set( SYNC_EVENT_GROUP *eg, uint32_t bits );
+void mrbc_init_class_sync( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,261 @@
+/*! @file
+  @brief
+  Timer class, software timers dispatched in one task.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The timers are kept in one list in the order of the expiry, and the
+  task that calls Timer.run sleeps in the sleep queue of the scheduler
+  until the first one expires. So the timers cost only the Timer
+  objects, instead of a task each.
+
+    Timer.every( 500 ) {|t| led.write( led.read ^ 1 ) }
+    Timer.after( 3000 ) { $timeout = true }
+    Timer.run			# dispatch the callbacks, forever.
+
+    t = Timer.every( 100 ) { ... }
+    t.cancel			# from the callback or the other task.
+  </pre>
+
+  (note) The callbacks are the blocks of the timer task, so the timers
+  must be made in the task that calls Timer.run. (before Timer.run or in
+  the callbacks.) Timer.run returns when no timer is left, or by the
+  exception in a callback.
+*/
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+
+
+/*!@brief
+  software timer, stored in the instance data area.
+*/
+typedef struct SOFT_TIMER {
+  struct SOFT_TIMER *next;	//!< next timer in the list.
+  mrbc_value self;		//!< Timer object, counted while in the list.
+  uint32_t expire;		//!< HAL_GetTick() at the expiry.
+  uint32_t interval;		//!< period in milliseconds, or 0 if one shot.
+  uint8_t active;		//!< in the list.
+} SOFT_TIMER;
+
+
+static SOFT_TIMER *timer_list_;		//!< active timers, by expiry.
+static mrbc_tcb *timer_task_;		//!< task in Timer.run.
+static mrbc_sym sym_block;
+
+
+//================================================================
+/*! insert the timer to the list, in the order of the expiry.
+*/
+static void timer_insert( SOFT_TIMER *t )
+{
+  SOFT_TIMER **pp = &timer_list_;
+  while( *pp && (int32_t)((*pp)->expire - t->expire) <= 0 ) {
+    pp = &(*pp)->next;
+  }
+  t->next = *pp;
+  *pp = t;
+  t->active = 1;
+}
+
+
+//================================================================
+/*! remove the timer from the list.
+*/
+static void timer_remove( SOFT_TIMER *t )
+{
+  SOFT_TIMER **pp = &timer_list_;
+  while( *pp && *pp != t ) {
+    pp = &(*pp)->next;
+  }
+  if( *pp ) *pp = t->next;
+  t->next = NULL;
+  t->active = 0;
+}
+
+
+//================================================================
+/*! make the timer. (Timer.after and Timer.every)
+*/
+static void timer_new( mrbc_vm *vm, mrbc_value v[], int argc, int periodic )
+{
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER || mrbc_integer(v[1]) < 0 ||
+      (periodic && mrbc_integer(v[1]) == 0) ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  if( v[2].tt != MRBC_TT_PROC ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "no block given");
+    return;
+  }
+  if( timer_task_ && timer_task_ != VM2TCB(vm) ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "timer must be made in the timer task");
+    return;
+  }
+
+  mrbc_value ret = mrbc_instance_new(vm, v[0].cls, sizeof(SOFT_TIMER));
+  if( ret.instance == NULL ) return;	// ENOMEM
+
+  mrbc_instance_setiv( &ret, sym_block, &v[2] );
+
+  SOFT_TIMER *t = (SOFT_TIMER *)ret.instance->data;
+  t->self = ret;
+  t->expire = HAL_GetTick() + mrbc_integer(v[1]);
+  t->interval = periodic ? mrbc_integer(v[1]) : 0;
+  timer_insert( t );
+  mrbc_incref( &ret );		// by the list.
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! (method) after
+
+  Timer.after( ms ) {|timer| ... } -> Timer
+*/
+static void c_timer_after(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  timer_new( vm, v, argc, 0 );
+}
+
+
+//================================================================
+/*! (method) every
+
+  Timer.every( ms ) {|timer| ... } -> Timer
+*/
+static void c_timer_every(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  timer_new( vm, v, argc, 1 );
+}
+
+
+//================================================================
+/*! resume Timer.run, called when the callback returned.
+
+  v[0]: Timer class, v[1]: callback running, v[MRBC_C_ITER_REGS]: result.
+*/
+static void c_timer_run_resume(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SOFT_TIMER *t = timer_list_;
+  if( !t ) {
+    timer_task_ = NULL;
+    mrbc_decref( &v[0] );
+    mrbc_set_nil( &v[0] );
+    mrbc_c_iter_end( vm, v );
+    return;
+  }
+
+  uint32_t now = HAL_GetTick();
+  int32_t remain = (int32_t)(t->expire - now);
+  if( remain > 0 ) {
+    mrbc_sleep_ms( VM2TCB(vm), remain );
+    vm->inst = vm->cur_irep->inst;	// call this again after the sleep.
+    return;
+  }
+
+  // the callback is kept in v[1], even if the timer is cancelled in it.
+  mrbc_decref( &v[1] );
+  v[1] = mrbc_instance_getiv( &t->self, sym_block );
+
+  timer_remove( t );
+  if( t->interval ) {
+    t->expire += t->interval;
+    if( (int32_t)(t->expire - now) <= 0 ) {
+      t->expire = now + t->interval;	// skip the missed periods.
+    }
+    timer_insert( t );
+  }
+
+  mrbc_value self = t->self;
+  mrbc_c_iter_yield( vm, v, &v[1], 1, &self );
+  if( !t->active ) mrbc_decref( &self );	// released by the list.
+}
+
+
+//================================================================
+/*! (method) run
+
+  Timer.run -> nil, when no timer is left.
+*/
+static void c_timer_run(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_tcb *tcb = VM2TCB(vm);
+
+  if( timer_task_ && timer_task_ != tcb ) {
+    mrbc_raise(vm, MRBC_CLASS(RuntimeError), "Timer.run is running in the other task");
+    return;
+  }
+  if( !timer_list_ ) {
+    timer_task_ = NULL;
+    SET_NIL_RETURN();
+    return;
+  }
+  timer_task_ = tcb;
+
+  int32_t remain = (int32_t)(timer_list_->expire - HAL_GetTick());
+  if( remain > 0 ) {
+    mrbc_sleep_ms( tcb, remain );
+    vm->flag_retry_call = 1;
+    return;
+  }
+
+  // the C iterator frame needs a block at the start.
+  mrbc_decref( &v[1] );
+  v[1] = mrbc_instance_getiv( &timer_list_->self, sym_block );
+  if( mrbc_c_iter_begin( vm, v, 0, c_timer_run_resume ) != 0 ) return;
+  c_timer_run_resume( vm, v, 0 );
+}
+
+
+//================================================================
+/*! (method) cancel
+
+  timer.cancel -> true, or false if not active.
+*/
+static void c_timer_cancel(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SOFT_TIMER *t = (SOFT_TIMER *)v[0].instance->data;
+
+  if( !t->active ) {
+    SET_FALSE_RETURN();
+    return;
+  }
+
+  timer_remove( t );
+  mrbc_decref( &t->self );	// v[0] is still referenced.
+  SET_TRUE_RETURN();
+}
+
+
+//================================================================
+/*! (method) active?
+
+  timer.active? -> true, or false if expired or cancelled.
+*/
+static void c_timer_active(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  SOFT_TIMER *t = (SOFT_TIMER *)v[0].instance->data;
+
+  SET_BOOL_RETURN( t->active );
+}
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_timer(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Timer", 0);
+  sym_block = mrbc_str_to_symid("block");
+
+  mrbc_define_method(0, cls, "after", c_timer_after);
+  mrbc_define_method(0, cls, "every", c_timer_every);
+  mrbc_define_method(0, cls, "run", c_timer_run);
+  mrbc_define_method(0, cls, "cancel", c_timer_cancel);
+  mrbc_define_method(0, cls, "active?", c_timer_active);
+}
@@ -0,0 +1,489 @@
+/*! @file
+  @brief
+  Typed numeric array classes. (ByteArray, Int16Array, FloatArray)
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  Elements are kept in a raw buffer instead of mrbc_value slots,
+  so a 1000 samples Int16Array takes about 2KB of the heap.
+  An array made from a String literal refers to the bytecode in flash,
+  and is frozen.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "typed_array.h"
+
+
+static mrbc_class *cls_typed_array[3];		//!< index by TYPED_ARRAY_*
+static const uint8_t TBL_ELSIZE[3] = { 1, 2, 4 };
+
+
+//================================================================
+/*! constructor
+
+  @param  vm	pointer to VM.
+  @param  type	element type. TYPED_ARRAY_*
+  @param  size	number of elements.
+  @return	new object, or nil if no memory.
+*/
+mrbc_value typed_array_new( struct VM *vm, int type, int size )
+{
+  mrbc_value ret = mrbc_instance_new(vm, cls_typed_array[type],
+		sizeof(TYPED_ARRAY) + size * TBL_ELSIZE[type]);
+  if( ret.instance == NULL ) return mrbc_nil_value();	// ENOMEM
+
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)ret.instance->data;
+  ta->type = type;
+  ta->elsize = TBL_ELSIZE[type];
+  ta->flag_frozen = 0;
+  ta->size = size;
+  ta->buf = ta->data;
+  memset( ta->data, 0, size * TBL_ELSIZE[type] );
+
+  return ret;
+}
+
+
+//================================================================
+/*! get the typed array from the object.
+
+  @param  v	pointer to value.
+  @return	pointer to TYPED_ARRAY, or NULL if not a typed array.
+*/
+TYPED_ARRAY *typed_array_get( const mrbc_value *v )
+{
+  if( v->tt != MRBC_TT_OBJECT ) return NULL;
+
+  for( int i = 0; i < sizeof(cls_typed_array)/sizeof(mrbc_class *); i++ ) {
+    if( v->instance->cls == cls_typed_array[i] ) {
+      return (TYPED_ARRAY *)v->instance->data;
+    }
+  }
+  return NULL;
+}
+
+
+//================================================================
+/*! check that the elements can be changed.
+
+  @param  vm	pointer to VM.
+  @param  ta	pointer to TYPED_ARRAY.
+  @return	0 if writable, or -1 if frozen. (raised)
+*/
+int typed_array_modify( struct VM *vm, const TYPED_ARRAY *ta )
+{
+  if( !ta->flag_frozen ) return 0;
+
+  mrbc_raise(vm, MRBC_CLASS(RuntimeError), "can't modify frozen array");
+  return -1;
+}
+
+
+//================================================================
+/*! make a typed array from the binary String.
+
+  The elements are in little endian. If the String is a literal and
+  aligned, the array refers to it instead of copying, and is frozen.
+*/
+static void ta_new_binary(mrbc_vm *vm, mrbc_value v[], int type)
+{
+  const mrbc_string *str = v[1].string;
+  int elsize = TBL_ELSIZE[type];
+  if( str->size % elsize != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  int size = str->size / elsize;
+
+  if( str->flag_literal && str->shared_idx == 0 &&
+      ((uintptr_t)str->data & (elsize - 1)) == 0 ) {
+    mrbc_value ret = mrbc_instance_new(vm, cls_typed_array[type],
+				       sizeof(TYPED_ARRAY));
+    if( ret.instance == NULL ) return;	// ENOMEM
+
+    TYPED_ARRAY *ta = (TYPED_ARRAY *)ret.instance->data;
+    ta->type = type;
+    ta->elsize = elsize;
+    ta->flag_frozen = 1;
+    ta->size = size;
+    ta->buf = str->data;
+    SET_RETURN(ret);
+    return;
+  }
+
+  mrbc_value ret = typed_array_new(vm, type, size);
+  TYPED_ARRAY *ta = typed_array_get(&ret);
+  if( !ta ) return;	// ENOMEM
+
+  memcpy( ta->buf, str->data, str->size );
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! get an element.
+*/
+static mrbc_value ta_get( const TYPED_ARRAY *ta, int idx )
+{
+  switch( ta->type ) {
+  case TYPED_ARRAY_UINT8:
+    return mrbc_integer_value( ((const uint8_t *)ta->buf)[idx] );
+  case TYPED_ARRAY_INT16:
+    return mrbc_integer_value( ((const int16_t *)ta->buf)[idx] );
+  default:
+    return mrbc_float_value( 0, ((const float *)ta->buf)[idx] );
+  }
+}
+
+
+//================================================================
+/*! set an element.
+
+  @return	0 if no error.
+*/
+static int ta_set( TYPED_ARRAY *ta, int idx, const mrbc_value *val )
+{
+  switch( ta->type ) {
+  case TYPED_ARRAY_UINT8:
+    if( val->tt != MRBC_TT_INTEGER ) return -1;
+    ((uint8_t *)ta->buf)[idx] = mrbc_integer(*val);
+    break;
+
+  case TYPED_ARRAY_INT16:
+    if( val->tt != MRBC_TT_INTEGER ) return -1;
+    ((int16_t *)ta->buf)[idx] = mrbc_integer(*val);
+    break;
+
+  default:
+    if( val->tt == MRBC_TT_INTEGER ) {
+      ((float *)ta->buf)[idx] = mrbc_integer(*val);
+    } else if( val->tt == MRBC_TT_FLOAT ) {
+      ((float *)ta->buf)[idx] = mrbc_float(*val);
+    } else {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! get the element as double, for sum/min/max.
+*/
+static double ta_get_d( const TYPED_ARRAY *ta, int idx )
+{
+  switch( ta->type ) {
+  case TYPED_ARRAY_UINT8: return ((const uint8_t *)ta->buf)[idx];
+  case TYPED_ARRAY_INT16: return ((const int16_t *)ta->buf)[idx];
+  default:		  return ((const float *)ta->buf)[idx];
+  }
+}
+
+
+//================================================================
+/*! (method) new
+
+  ByteArray.new( size, init = 0 )
+  Int16Array.new( [1, 2, 3] )
+  ByteArray.new( "\x01\x02\x03" )	# frozen, refers to the literal.
+*/
+static void c_ta_new(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int type;
+  for( type = 0; type < 3; type++ ) {
+    if( v[0].cls == cls_typed_array[type] ) break;
+  }
+  if( type >= 3 || argc < 1 || argc > 2 ) goto ERROR_RETURN;
+
+  int size;
+  switch( v[1].tt ) {
+  case MRBC_TT_INTEGER:
+    size = mrbc_integer(v[1]);
+    if( size < 0 ) goto ERROR_RETURN;
+    break;
+
+  case MRBC_TT_ARRAY:
+    size = mrbc_array_size(&v[1]);
+    break;
+
+  case MRBC_TT_STRING:
+    if( argc != 1 ) goto ERROR_RETURN;
+    ta_new_binary( vm, v, type );
+    return;
+
+  default:
+    goto ERROR_RETURN;
+  }
+
+  mrbc_value ret = typed_array_new(vm, type, size);
+  TYPED_ARRAY *ta = typed_array_get(&ret);
+  if( !ta ) return;	// ENOMEM
+
+  for( int i = 0; i < size; i++ ) {
+    int err = 0;
+    if( v[1].tt == MRBC_TT_ARRAY ) {
+      err = ta_set( ta, i, &v[1].array->data[i] );
+    } else if( argc == 2 ) {
+      err = ta_set( ta, i, &v[2] );
+    }
+    if( err ) {
+      mrbc_decref( &ret );
+      goto ERROR_RETURN;
+    }
+  }
+
+  SET_RETURN(ret);
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) []
+
+  ary[idx] -> Integer or Float, or nil if out of range.
+*/
+static void c_ta_get(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  int idx = mrbc_integer(v[1]);
+  if( idx < 0 ) idx += ta->size;
+  if( idx < 0 || idx >= ta->size ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  SET_RETURN( ta_get( ta, idx ) );
+}
+
+
+//================================================================
+/*! (method) []=
+
+  ary[idx] = val
+*/
+static void c_ta_set(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  if( argc != 2 || v[1].tt != MRBC_TT_INTEGER ) goto ERROR_RETURN;
+
+  int idx = mrbc_integer(v[1]);
+  if( idx < 0 ) idx += ta->size;
+  if( idx < 0 || idx >= ta->size ) {
+    mrbc_raise(vm, MRBC_CLASS(IndexError), 0);
+    return;
+  }
+  if( typed_array_modify( vm, ta ) != 0 ) return;
+  if( ta_set( ta, idx, &v[2] ) != 0 ) goto ERROR_RETURN;
+
+  mrbc_incref( &v[2] );
+  SET_RETURN( v[2] );
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) size, length
+*/
+static void c_ta_size(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  SET_INT_RETURN( ta->size );
+}
+
+
+//================================================================
+/*! (method) sum
+
+  Integer for ByteArray and Int16Array, Float for FloatArray.
+*/
+static void c_ta_sum(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  if( ta->type == TYPED_ARRAY_FLOAT ) {
+    double sum = 0;
+    for( int i = 0; i < ta->size; i++ ) sum += ((float *)ta->buf)[i];
+    SET_FLOAT_RETURN( sum );
+    return;
+  }
+
+  mrbc_int_t sum = 0;
+  if( ta->type == TYPED_ARRAY_UINT8 ) {
+    for( int i = 0; i < ta->size; i++ ) sum += ((uint8_t *)ta->buf)[i];
+  } else {
+    for( int i = 0; i < ta->size; i++ ) sum += ((int16_t *)ta->buf)[i];
+  }
+  SET_INT_RETURN( sum );
+}
+
+
+//================================================================
+/*! min and max sub function.
+*/
+static void ta_minmax(mrbc_vm *vm, mrbc_value v[], int flag_max)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  if( ta->size == 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  int found = 0;
+  double val = ta_get_d( ta, 0 );
+  for( int i = 1; i < ta->size; i++ ) {
+    double d = ta_get_d( ta, i );
+    if( flag_max ? (d > val) : (d < val) ) {
+      val = d;
+      found = i;
+    }
+  }
+
+  SET_RETURN( ta_get( ta, found ) );
+}
+
+
+//================================================================
+/*! (method) min
+*/
+static void c_ta_min(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  ta_minmax( vm, v, 0 );
+}
+
+
+//================================================================
+/*! (method) max
+*/
+static void c_ta_max(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  ta_minmax( vm, v, 1 );
+}
+
+
+//================================================================
+/*! (method) fill
+
+  ary.fill( val ) -> self
+*/
+static void c_ta_fill(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  if( argc != 1 ) goto ERROR_RETURN;
+  if( typed_array_modify( vm, ta ) != 0 ) return;
+  for( int i = 0; i < ta->size; i++ ) {
+    if( ta_set( ta, i, &v[1] ) != 0 ) goto ERROR_RETURN;
+  }
+  return;
+
+ ERROR_RETURN:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) freeze
+
+  ary.freeze -> self
+*/
+static void c_ta_freeze(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  ta->flag_frozen = 1;
+}
+
+
+//================================================================
+/*! (method) frozen?
+*/
+static void c_ta_frozen(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  SET_BOOL_RETURN( ta->flag_frozen );
+}
+
+
+//================================================================
+/*! (method) to_a
+
+  ary.to_a -> Array
+*/
+static void c_ta_to_a(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  mrbc_value ret = mrbc_array_new(vm, ta->size);
+  for( int i = 0; i < ta->size; i++ ) {
+    mrbc_value val = ta_get( ta, i );
+    mrbc_array_push( &ret, &val );
+  }
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! (method) to_s
+
+  ary.to_s -> String  (element buffer as a binary String)
+*/
+static void c_ta_to_s(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  TYPED_ARRAY *ta = (TYPED_ARRAY *)v[0].instance->data;
+
+  SET_RETURN( mrbc_string_new(vm, ta->buf, typed_array_bytes(ta)) );
+}
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_typed_array(void)
+{
+  static const char * const TBL_NAME[3] = {
+    "ByteArray", "Int16Array", "FloatArray" };
+
+  for( int i = 0; i < 3; i++ ) {
+    mrbc_class *cls = mrbc_define_class(0, TBL_NAME[i], 0);
+    cls_typed_array[i] = cls;
+
+    mrbc_define_method(0, cls, "new", c_ta_new);
+    mrbc_define_method(0, cls, "[]", c_ta_get);
+    mrbc_define_method(0, cls, "[]=", c_ta_set);
+    mrbc_define_method(0, cls, "size", c_ta_size);
+    mrbc_define_method(0, cls, "length", c_ta_size);
+    mrbc_define_method(0, cls, "sum", c_ta_sum);
+    mrbc_define_method(0, cls, "min", c_ta_min);
+    mrbc_define_method(0, cls, "max", c_ta_max);
+    mrbc_define_method(0, cls, "fill", c_ta_fill);
+    mrbc_define_method(0, cls, "freeze", c_ta_freeze);
+    mrbc_define_method(0, cls, "frozen?", c_ta_frozen);
+    mrbc_define_method(0, cls, "to_a", c_ta_to_a);
+    mrbc_define_method(0, cls, "to_s", c_ta_to_s);
+  }
+}
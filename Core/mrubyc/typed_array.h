@@ -0,0 +1,80 @@
+/*! @file
+  @brief
+  Typed numeric array classes header. (ByteArray, Int16Array, FloatArray)
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef TYPED_ARRAY_H
+#define TYPED_ARRAY_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#include "../mrubyc_src/mrubyc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//! element type.
+enum {
+  TYPED_ARRAY_UINT8 = 0,	//!< ByteArray
+  TYPED_ARRAY_INT16,		//!< Int16Array
+  TYPED_ARRAY_FLOAT,		//!< FloatArray
+};
+
+/*!@brief
+  typed array, stored in the instance data area.
+*/
+typedef struct TYPED_ARRAY {
+  uint8_t type;		//!< TYPED_ARRAY_*
+  uint8_t elsize;	//!< element size in bytes.
+  uint8_t flag_frozen;	//!< elements are read only.
+  uint8_t reserved;
+  uint32_t size;	//!< number of elements.
+  void *buf;		//!< elements. (data, or a literal in bytecode)
+  uint32_t data[];	//!< element buffer. (aligned for float)
+} TYPED_ARRAY;
+
+
+/*
+  function prototypes.
+*/
+mrbc_value typed_array_new( struct VM *vm, int type, int size );
+TYPED_ARRAY *typed_array_get( const mrbc_value *v );
+int typed_array_modify( struct VM *vm, const TYPED_ARRAY *ta );
+void mrbc_init_class_typed_array( void );
+
+
+/*
+  inline functions.
+*/
+//================================================================
+/*! get the element buffer.
+*/
+static inline void *typed_array_data( TYPED_ARRAY *ta )
+{
+  return ta->buf;
+}
+
+//================================================================
+/*! get the buffer size in bytes.
+*/
+static inline int typed_array_bytes( const TYPED_ARRAY *ta )
+{
+  return ta->size * ta->elsize;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,814 @@
+/*! @file
+  @brief
+  USB CDC (virtual COM port) device on USB OTG FS.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  The console and the bytecode writer use it instead of the UART,
+  if MRBC_CONSOLE_USB_CDC is defined. (see vm_config.h)
+
+    usb_cdc_init();
+    usb_cdc_write( "hello\r\n", 7 );
+    n = usb_cdc_gets( buf, sizeof(buf) );
+
+  The device is a CDC-ACM of full speed, driven by the registers of
+  the OTG FS core directly. Connect a USB connector to PA11 (D-) and
+  PA12 (D+). VBUS is not sensed, so the device always attaches.
+  EP1 is the bulk IN/OUT for the data, and EP2 is the interrupt IN
+  for the notification, that is never sent.
+  The baud rate from the host is ignored, and the bytes go through
+  at the speed of USB.
+  The Rx is NAK'ed while the buffer doesn't have the space for a
+  packet, so no byte is lost. The Tx is dropped while the host is
+  not connected, or doesn't read it for USB_CDC_TX_TIMEOUT_ms.
+  </pre>
+*/
+
+//@cond
+#include <string.h>
+//@endcond
+
+#include "main.h"
+#include "../mrubyc_src/mrubyc.h"
+#include "usb_cdc.h"
+
+#if defined(MRBC_CONSOLE_USB_CDC)
+
+//! the OTG FS registers.
+#define USBx		USB_OTG_FS
+#define USBx_DEVICE	((USB_OTG_DeviceTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_DEVICE_BASE))
+#define USBx_INEP(n)	((USB_OTG_INEndpointTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_IN_ENDPOINT_BASE + (n) * USB_OTG_EP_REG_SIZE))
+#define USBx_OUTEP(n)	((USB_OTG_OUTEndpointTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_OUT_ENDPOINT_BASE + (n) * USB_OTG_EP_REG_SIZE))
+#define USBx_FIFO(n)	(*(__IO uint32_t *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_FIFO_BASE + (n) * USB_OTG_FIFO_SIZE))
+#define USBx_PCGCCTL	(*(__IO uint32_t *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_PCGCCTL_BASE))
+
+//! packet size of the endpoints.
+#define EP0_SIZE	64
+#define EP_DATA_SIZE	64
+#define EP_NOTIFY_SIZE	8
+
+//! FIFO size in words. 320 words (1.25KB) in total.
+#define FIFO_RX_WORDS	128
+#define FIFO_TX0_WORDS	16
+#define FIFO_TX1_WORDS	128
+#define FIFO_TX2_WORDS	16
+
+//! the Tx is dropped if the host doesn't read for this time.
+#define USB_CDC_TX_TIMEOUT_ms 100
+
+//! packet status in GRXSTSP.
+#define PKTSTS_OUT_DATA		2
+#define PKTSTS_SETUP_DATA	6
+
+//! DIEPCTL/DOEPCTL EPTYP
+#define EPTYP_BULK		2
+#define EPTYP_INTERRUPT		3
+
+// standard requests.
+#define REQ_GET_STATUS		0x00
+#define REQ_SET_ADDRESS		0x05
+#define REQ_GET_DESCRIPTOR	0x06
+#define REQ_GET_CONFIGURATION	0x08
+#define REQ_SET_CONFIGURATION	0x09
+// CDC class requests.
+#define CDC_SET_LINE_CODING	0x20
+#define CDC_GET_LINE_CODING	0x21
+#define CDC_SET_CONTROL_LINE_STATE 0x22
+#define CDC_SEND_BREAK		0x23
+
+
+//! device descriptor. (ST's VID and the PID of the VCP)
+static const uint8_t DEVICE_DESCRIPTOR[] = {
+  18, 1, 0x00, 0x02,		// bcdUSB 2.00
+  0x02, 0x00, 0x00, EP0_SIZE,	// CDC
+  0x83, 0x04, 0x40, 0x57,	// VID 0x0483, PID 0x5740
+  0x00, 0x02, 1, 2, 3, 1,
+};
+
+//! configuration descriptor, with the comm and data interfaces.
+static const uint8_t CONFIG_DESCRIPTOR[] = {
+  9, 2, 67, 0, 2, 1, 0, 0x80, 50,	// 2 interfaces, 100mA
+  9, 4, 0, 0, 1, 0x02, 0x02, 0x01, 0,	// comm interface, ACM, AT
+  5, 0x24, 0x00, 0x10, 0x01,		// header
+  5, 0x24, 0x01, 0x00, 1,		// call management
+  4, 0x24, 0x02, 0x02,			// ACM, line coding and state
+  5, 0x24, 0x06, 0, 1,			// union
+  7, 5, 0x82, EPTYP_INTERRUPT, EP_NOTIFY_SIZE, 0, 16,
+  9, 4, 1, 0, 2, 0x0a, 0x00, 0x00, 0,	// data interface
+  7, 5, 0x01, EPTYP_BULK, EP_DATA_SIZE, 0, 0,
+  7, 5, 0x81, EPTYP_BULK, EP_DATA_SIZE, 0, 0,
+};
+
+//! string descriptors. 3 is the serial number from UID.
+static const char * const TBL_STRINGS[] = {
+  0, "mruby/c", "mruby/c Virtual COM Port",
+};
+
+
+/*!@brief
+  the device, and the buffers.
+*/
+static struct USB_CDC {
+  volatile uint8_t configured;	//!< SET_CONFIGURATION is done.
+  volatile uint8_t dtr;		//!< DTR from SET_CONTROL_LINE_STATE.
+  volatile uint8_t rx_paused;	//!< EP1 OUT is not armed for the lack of space.
+  volatile uint8_t tx_busy;	//!< EP1 IN is sending a packet.
+  uint8_t tx_last_len;		//!< length of the last packet, for ZLP.
+  uint8_t ep0_data_out;		//!< the control OUT data is expected.
+  uint8_t ep0_zlp;		//!< the control IN needs a ZLP at the end.
+  uint16_t ep0_remain;		//!< control IN bytes not sent yet.
+  const uint8_t *ep0_data;	//!< control IN data not sent yet.
+  uint32_t setup[2];		//!< the last SETUP packet.
+  uint8_t ep0_buf[EP0_SIZE];	//!< control IN/OUT data.
+  uint8_t line_coding[7];	//!< kept only to be read back.
+
+  volatile uint16_t rx_wr, rx_rd;	//!< free running indexes.
+  volatile uint16_t tx_wr, tx_rd;
+  uint8_t rx_buf[USB_CDC_SIZE_RXBUF];
+  uint8_t tx_buf[USB_CDC_SIZE_TXBUF];
+} cdc = {
+  .line_coding = { 0x00, 0xc2, 0x01, 0x00, 0, 0, 8 },	// 115200 8N1
+};
+
+
+//================================================================
+/*! make USB 48MHz from PLLQ, with the same SYSCLK.
+
+  The VCO is doubled and PLLP is doubled, if needed.
+  SYSCLK is switched to HSE while the PLL is changed.
+*/
+static void usb_cdc_clock_init( void )
+{
+  RCC_OscInitTypeDef osc;
+  RCC_ClkInitTypeDef clk, clk_hse;
+  uint32_t latency;
+
+  HAL_RCC_GetOscConfig( &osc );
+  HAL_RCC_GetClockConfig( &clk, &latency );
+
+  uint32_t fin = (osc.PLL.PLLSource == RCC_PLLSOURCE_HSE) ?
+	HSE_VALUE : HSI_VALUE;
+  uint32_t vco = fin / osc.PLL.PLLM * osc.PLL.PLLN;
+  if( vco == 48000000 * osc.PLL.PLLQ ) return;
+
+  vco *= 2;
+  if( osc.PLL.PLLP > RCC_PLLP_DIV4 || vco > 432000000 ||
+      vco % 48000000 != 0 ) return;	// can't make it.
+
+  clk_hse = clk;
+  clk_hse.SYSCLKSource = (osc.PLL.PLLSource == RCC_PLLSOURCE_HSE) ?
+	RCC_SYSCLKSOURCE_HSE : RCC_SYSCLKSOURCE_HSI;
+  HAL_RCC_ClockConfig( &clk_hse, latency );
+
+  osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+  osc.PLL.PLLState = RCC_PLL_ON;
+  osc.PLL.PLLN *= 2;
+  osc.PLL.PLLP *= 2;			// RCC_PLLP_DIVn is n.
+  osc.PLL.PLLQ = vco / 48000000;
+  HAL_RCC_OscConfig( &osc );
+
+  HAL_RCC_ClockConfig( &clk, latency );
+}
+
+
+//================================================================
+/*! wait for the core, with a limit.
+*/
+static void usb_cdc_wait_grstctl( uint32_t mask, uint32_t value )
+{
+  for( int i = 0; i < 200000; i++ ) {
+    if( (USBx->GRSTCTL & mask) == value ) return;
+  }
+}
+
+
+//================================================================
+/*! flush all Tx FIFOs and the Rx FIFO.
+*/
+static void usb_cdc_flush_fifo( void )
+{
+  USBx->GRSTCTL = USB_OTG_GRSTCTL_TXFFLSH | (0x10 << USB_OTG_GRSTCTL_TXFNUM_Pos);
+  usb_cdc_wait_grstctl( USB_OTG_GRSTCTL_TXFFLSH, 0 );
+  USBx->GRSTCTL = USB_OTG_GRSTCTL_RXFFLSH;
+  usb_cdc_wait_grstctl( USB_OTG_GRSTCTL_RXFFLSH, 0 );
+}
+
+
+//================================================================
+/*! write a packet to the Tx FIFO of the IN endpoint.
+
+  The data can wrap around the ring buffer by the mask.
+*/
+static void usb_cdc_write_fifo( int ep, const uint8_t *buf, int idx,
+				int mask, int len )
+{
+  while( len > 0 ) {
+    uint32_t w = 0;
+    for( int i = 0; i < 4 && len > 0; i++, len-- ) {
+      w |= (uint32_t)buf[idx++ & mask] << (8 * i);
+    }
+    USBx_FIFO(ep) = w;
+  }
+}
+
+
+//================================================================
+/*! arm EP0 OUT for the SETUP and the status or data stage.
+*/
+static void usb_cdc_ep0_arm_out( void )
+{
+  USBx_OUTEP(0)->DOEPTSIZ = (3 << USB_OTG_DOEPTSIZ_STUPCNT_Pos) |
+    (1 << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | EP0_SIZE;
+  USBx_OUTEP(0)->DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+}
+
+
+//================================================================
+/*! send a packet of the control IN data, or ZLP.
+*/
+static void usb_cdc_ep0_send_packet( void )
+{
+  int len = cdc.ep0_remain < EP0_SIZE ? cdc.ep0_remain : EP0_SIZE;
+
+  USBx_INEP(0)->DIEPTSIZ = (1 << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | len;
+  USBx_INEP(0)->DIEPCTL |= USB_OTG_DIEPCTL_EPENA | USB_OTG_DIEPCTL_CNAK;
+  usb_cdc_write_fifo( 0, cdc.ep0_data, 0, 0xffff, len );
+
+  cdc.ep0_data += len;
+  cdc.ep0_remain -= len;
+}
+
+
+//================================================================
+/*! start the control IN data stage.
+
+  @param  data	data, kept until sent.
+  @param  len	length.
+*/
+static void usb_cdc_ep0_send( const void *data, int len )
+{
+  int w_length = cdc.setup[1] >> 16;
+  if( len > w_length ) len = w_length;
+
+  cdc.ep0_data = data;
+  cdc.ep0_remain = len;
+  cdc.ep0_zlp = (len < w_length && len % EP0_SIZE == 0 && len != 0);
+  usb_cdc_ep0_send_packet();
+}
+
+
+//================================================================
+/*! stall EP0 for the request not supported.
+*/
+static void usb_cdc_ep0_stall( void )
+{
+  USBx_INEP(0)->DIEPCTL |= USB_OTG_DIEPCTL_STALL;
+  USBx_OUTEP(0)->DOEPCTL |= USB_OTG_DOEPCTL_STALL;
+}
+
+
+//================================================================
+/*! make the string descriptor in ep0_buf.
+
+  @return	length, or 0 if no such string.
+*/
+static int usb_cdc_string_descriptor( int index )
+{
+  uint8_t *p = cdc.ep0_buf;
+  char serial[25];
+  const char *s;
+
+  if( index == 0 ) {
+    static const uint8_t LANGID[] = { 4, 3, 0x09, 0x04 };
+    memcpy( p, LANGID, sizeof(LANGID) );
+    return sizeof(LANGID);
+  }
+
+  if( index == 3 ) {
+    const uint32_t *uid = (const uint32_t *)UID_BASE;
+    mrbc_snprintf( serial, sizeof(serial), "%08X%08X%08X",
+		   (unsigned)uid[0], (unsigned)uid[1], (unsigned)uid[2] );
+    s = serial;
+  } else if( index < (int)(sizeof(TBL_STRINGS)/sizeof(TBL_STRINGS[0])) ) {
+    s = TBL_STRINGS[index];
+  } else {
+    return 0;
+  }
+
+  int n = 2;
+  while( *s && n < EP0_SIZE ) {
+    p[n++] = *s++;
+    p[n++] = 0;
+  }
+  p[0] = n;
+  p[1] = 3;
+
+  return n;
+}
+
+
+//================================================================
+/*! activate the data endpoints by SET_CONFIGURATION.
+*/
+static void usb_cdc_configure( void )
+{
+  USBx_INEP(1)->DIEPCTL = USB_OTG_DIEPCTL_USBAEP | USB_OTG_DIEPCTL_SD0PID_SEVNFRM |
+    (EPTYP_BULK << USB_OTG_DIEPCTL_EPTYP_Pos) |
+    (1 << USB_OTG_DIEPCTL_TXFNUM_Pos) | EP_DATA_SIZE;
+  USBx_INEP(2)->DIEPCTL = USB_OTG_DIEPCTL_USBAEP | USB_OTG_DIEPCTL_SD0PID_SEVNFRM |
+    (EPTYP_INTERRUPT << USB_OTG_DIEPCTL_EPTYP_Pos) |
+    (2 << USB_OTG_DIEPCTL_TXFNUM_Pos) | EP_NOTIFY_SIZE;
+  USBx_OUTEP(1)->DOEPCTL = USB_OTG_DOEPCTL_USBAEP | USB_OTG_DOEPCTL_SD0PID_SEVNFRM |
+    (EPTYP_BULK << USB_OTG_DOEPCTL_EPTYP_Pos) | EP_DATA_SIZE;
+  USBx_DEVICE->DAINTMSK |= (1 << 1) | (1 << (16 + 1));
+
+  cdc.tx_busy = 0;
+  cdc.rx_paused = 1;
+  cdc.configured = 1;
+}
+
+
+//================================================================
+/*! arm EP1 OUT, if the Rx buffer has the space for a packet.
+
+  Called with the USB interrupt disabled, or in it.
+*/
+static void usb_cdc_rx_arm( void )
+{
+  if( !cdc.rx_paused || !cdc.configured ) return;
+  if( USB_CDC_SIZE_RXBUF - (uint16_t)(cdc.rx_wr - cdc.rx_rd) < EP_DATA_SIZE ) return;
+
+  cdc.rx_paused = 0;
+  USBx_OUTEP(1)->DOEPTSIZ = (1 << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | EP_DATA_SIZE;
+  USBx_OUTEP(1)->DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+}
+
+
+//================================================================
+/*! send a packet of EP1 IN from the Tx buffer, if not busy.
+
+  A ZLP follows a full packet at the end, to finish the transfer.
+  Called with the USB interrupt disabled, or in it.
+*/
+static void usb_cdc_tx_start( void )
+{
+  if( cdc.tx_busy || !cdc.configured ) return;
+
+  int len = (uint16_t)(cdc.tx_wr - cdc.tx_rd);
+  if( len == 0 && cdc.tx_last_len != EP_DATA_SIZE ) return;
+  if( len > EP_DATA_SIZE ) len = EP_DATA_SIZE;
+
+  cdc.tx_busy = 1;
+  cdc.tx_last_len = len;
+  USBx_INEP(1)->DIEPTSIZ = (1 << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | len;
+  USBx_INEP(1)->DIEPCTL |= USB_OTG_DIEPCTL_EPENA | USB_OTG_DIEPCTL_CNAK;
+  usb_cdc_write_fifo( 1, cdc.tx_buf, cdc.tx_rd, USB_CDC_SIZE_TXBUF - 1, len );
+  cdc.tx_rd += len;
+}
+
+
+//================================================================
+/*! process the SETUP packet.
+*/
+static void usb_cdc_setup( void )
+{
+  int bm_request_type = cdc.setup[0] & 0xff;
+  int b_request = (cdc.setup[0] >> 8) & 0xff;
+  int w_value = cdc.setup[0] >> 16;
+
+  cdc.ep0_data_out = 0;
+
+  switch( bm_request_type << 8 | b_request ) {
+  case 0x8000 | REQ_GET_STATUS:
+  case 0x8100 | REQ_GET_STATUS:
+  case 0x8200 | REQ_GET_STATUS:
+    memset( cdc.ep0_buf, 0, 2 );
+    usb_cdc_ep0_send( cdc.ep0_buf, 2 );
+    return;
+
+  case 0x0000 | REQ_SET_ADDRESS:
+    // set it now, the core sends the status by the old address.
+    USBx_DEVICE->DCFG = (USBx_DEVICE->DCFG & ~USB_OTG_DCFG_DAD) |
+      ((w_value & 0x7f) << USB_OTG_DCFG_DAD_Pos);
+    break;
+
+  case 0x8000 | REQ_GET_DESCRIPTOR:
+    switch( w_value >> 8 ) {
+    case 1:
+      usb_cdc_ep0_send( DEVICE_DESCRIPTOR, sizeof(DEVICE_DESCRIPTOR) );
+      return;
+    case 2:
+      usb_cdc_ep0_send( CONFIG_DESCRIPTOR, sizeof(CONFIG_DESCRIPTOR) );
+      return;
+    case 3: {
+      int len = usb_cdc_string_descriptor( w_value & 0xff );
+      if( len == 0 ) break;
+      usb_cdc_ep0_send( cdc.ep0_buf, len );
+      return;
+    }
+    }
+    usb_cdc_ep0_stall();	// and the device qualifier.
+    return;
+
+  case 0x8000 | REQ_GET_CONFIGURATION:
+    cdc.ep0_buf[0] = cdc.configured;
+    usb_cdc_ep0_send( cdc.ep0_buf, 1 );
+    return;
+
+  case 0x0000 | REQ_SET_CONFIGURATION:
+    if( w_value ) {
+      usb_cdc_configure();
+      usb_cdc_rx_arm();
+    } else {
+      cdc.configured = 0;
+    }
+    break;
+
+  case 0x2100 | CDC_SET_LINE_CODING:
+    cdc.ep0_data_out = 1;	// the status is sent after the data.
+    return;
+
+  case 0xa100 | CDC_GET_LINE_CODING:
+    usb_cdc_ep0_send( cdc.line_coding, sizeof(cdc.line_coding) );
+    return;
+
+  case 0x2100 | CDC_SET_CONTROL_LINE_STATE:
+    cdc.dtr = w_value & 0x01;
+    break;
+
+  case 0x2100 | CDC_SEND_BREAK:
+    break;
+
+  default:
+    usb_cdc_ep0_stall();
+    return;
+  }
+
+  // status stage of no data request.
+  cdc.ep0_remain = 0;
+  cdc.ep0_zlp = 0;
+  usb_cdc_ep0_send_packet();
+}
+
+
+//================================================================
+/*! USB reset from the host.
+*/
+static void usb_cdc_bus_reset( void )
+{
+  for( int i = 0; i < 4; i++ ) {
+    USBx_INEP(i)->DIEPINT = 0xfb7f;
+    USBx_OUTEP(i)->DOEPINT = 0xfb7f;
+    USBx_OUTEP(i)->DOEPCTL |= USB_OTG_DOEPCTL_SNAK;
+  }
+  usb_cdc_flush_fifo();
+
+  USBx_DEVICE->DCFG &= ~USB_OTG_DCFG_DAD;
+  USBx_DEVICE->DAINTMSK = (1 << 0) | (1 << 16);
+  cdc.configured = 0;
+  cdc.dtr = 0;
+  cdc.tx_busy = 0;
+  cdc.tx_last_len = 0;
+
+  usb_cdc_ep0_arm_out();
+}
+
+
+//================================================================
+/*! pop a packet from the Rx FIFO.
+*/
+static void usb_cdc_rx_fifo( void )
+{
+  uint32_t sts = USBx->GRXSTSP;
+  int ep = sts & USB_OTG_GRXSTSP_EPNUM;
+  int len = (sts & USB_OTG_GRXSTSP_BCNT) >> USB_OTG_GRXSTSP_BCNT_Pos;
+  int words = (len + 3) / 4;
+
+  switch( (sts & USB_OTG_GRXSTSP_PKTSTS) >> USB_OTG_GRXSTSP_PKTSTS_Pos ) {
+  case PKTSTS_SETUP_DATA:
+    cdc.setup[0] = USBx_FIFO(0);
+    cdc.setup[1] = USBx_FIFO(0);
+    return;
+
+  case PKTSTS_OUT_DATA:
+    if( ep == 1 ) {
+      uint16_t wr = cdc.rx_wr;
+      while( words-- > 0 ) {
+	uint32_t w = USBx_FIFO(0);
+	for( int i = 0; i < 4 && len > 0; i++, len-- ) {
+	  cdc.rx_buf[wr++ & (USB_CDC_SIZE_RXBUF - 1)] = w >> (8 * i);
+	}
+      }
+      cdc.rx_wr = wr;
+      return;
+    }
+    // EP0 data, that is the line coding.
+    for( int i = 0; i < words; i++ ) {
+      uint32_t w = USBx_FIFO(0);
+      if( i < 2 ) memcpy( cdc.ep0_buf + i * 4, &w, 4 );
+    }
+    if( cdc.ep0_data_out && len >= 7 ) {
+      memcpy( cdc.line_coding, cdc.ep0_buf, 7 );
+    }
+    return;
+
+  default:	// transfer or setup completed.
+    return;
+  }
+}
+
+
+/***** Global functions *****************************************************/
+//================================================================
+/*! initialize.
+
+  Called before the UART and the console, because the clock of the
+  PLL may be changed for USB.
+*/
+void usb_cdc_init( void )
+{
+  usb_cdc_clock_init();
+
+  // PA11: D-, PA12: D+
+  __HAL_RCC_GPIOA_CLK_ENABLE();
+  GPIO_InitTypeDef init = {
+    .Pin = GPIO_PIN_11 | GPIO_PIN_12,
+    .Mode = GPIO_MODE_AF_PP,
+    .Pull = GPIO_NOPULL,
+    .Speed = GPIO_SPEED_FREQ_VERY_HIGH,
+    .Alternate = GPIO_AF10_OTG_FS,
+  };
+  HAL_GPIO_Init( GPIOA, &init );
+  __HAL_RCC_USB_OTG_FS_CLK_ENABLE();
+
+  // core reset.
+  usb_cdc_wait_grstctl( USB_OTG_GRSTCTL_AHBIDL, USB_OTG_GRSTCTL_AHBIDL );
+  USBx->GRSTCTL |= USB_OTG_GRSTCTL_CSRST;
+  usb_cdc_wait_grstctl( USB_OTG_GRSTCTL_CSRST, 0 );
+
+  // device mode of full speed, by the internal PHY.
+  USBx->GCCFG = USB_OTG_GCCFG_PWRDWN | USB_OTG_GCCFG_NOVBUSSENS;
+  USBx->GUSBCFG = (USBx->GUSBCFG & ~(USB_OTG_GUSBCFG_TRDT | USB_OTG_GUSBCFG_FHMOD)) |
+    USB_OTG_GUSBCFG_FDMOD | USB_OTG_GUSBCFG_PHYSEL |
+    (6 << USB_OTG_GUSBCFG_TRDT_Pos);
+  HAL_Delay( 25 );		// to take the device mode.
+  USBx_PCGCCTL = 0;
+  USBx_DEVICE->DCFG |= USB_OTG_DCFG_DSPD;
+  USBx_DEVICE->DCTL |= USB_OTG_DCTL_SDIS;	// detach while setup.
+
+  // FIFO
+  USBx->GRXFSIZ = FIFO_RX_WORDS;
+  USBx->DIEPTXF0_HNPTXFSIZ = (FIFO_TX0_WORDS << 16) | FIFO_RX_WORDS;
+  USBx->DIEPTXF[0] = (FIFO_TX1_WORDS << 16) | (FIFO_RX_WORDS + FIFO_TX0_WORDS);
+  USBx->DIEPTXF[1] = (FIFO_TX2_WORDS << 16) |
+    (FIFO_RX_WORDS + FIFO_TX0_WORDS + FIFO_TX1_WORDS);
+  usb_cdc_flush_fifo();
+
+  // interrupts.
+  USBx_DEVICE->DIEPMSK = USB_OTG_DIEPMSK_XFRCM;
+  USBx_DEVICE->DOEPMSK = USB_OTG_DOEPMSK_STUPM | USB_OTG_DOEPMSK_XFRCM;
+  USBx->GINTSTS = 0xffffffff;
+  USBx->GINTMSK = USB_OTG_GINTMSK_USBRST | USB_OTG_GINTMSK_ENUMDNEM |
+    USB_OTG_GINTMSK_RXFLVLM | USB_OTG_GINTMSK_IEPINT | USB_OTG_GINTMSK_OEPINT;
+  USBx->GAHBCFG |= USB_OTG_GAHBCFG_GINT;
+  HAL_NVIC_SetPriority( OTG_FS_IRQn, 0, 0 );
+  HAL_NVIC_EnableIRQ( OTG_FS_IRQn );
+
+  USBx_DEVICE->DCTL &= ~USB_OTG_DCTL_SDIS;	// attach.
+}
+
+
+//================================================================
+/*! the host has configured the device.
+*/
+int usb_cdc_is_configured( void )
+{
+  return cdc.configured;
+}
+
+
+//================================================================
+/*! Receive data.
+
+  @param  buffer	Pointer to buffer.
+  @param  size		Size of buffer.
+  @return int		Number of bytes read, always the size.
+*/
+int usb_cdc_read( void *buffer, int size )
+{
+  uint8_t *buf = buffer;
+  int n = 0;
+
+  while( n < size ) {
+    int len = (uint16_t)(cdc.rx_wr - cdc.rx_rd);
+    if( len == 0 ) {
+      __WFI();
+      continue;
+    }
+    if( len > size - n ) len = size - n;
+
+    for( int i = 0; i < len; i++ ) {
+      buf[n++] = cdc.rx_buf[cdc.rx_rd++ & (USB_CDC_SIZE_RXBUF - 1)];
+    }
+
+    HAL_NVIC_DisableIRQ( OTG_FS_IRQn );
+    usb_cdc_rx_arm();
+    HAL_NVIC_EnableIRQ( OTG_FS_IRQn );
+  }
+
+  return n;
+}
+
+
+//================================================================
+/*! Send data.
+
+  It waits while the Tx buffer is full, and drops the data if the
+  host is not connected or doesn't read.
+
+  @param  buffer	Pointer to data.
+  @param  size		Size of data.
+  @return int		Number of bytes written.
+*/
+int usb_cdc_write( const void *buffer, int size )
+{
+  const uint8_t *buf = buffer;
+  uint32_t t0 = HAL_GetTick();
+  int n = 0;
+
+  while( n < size && cdc.configured ) {
+    int len = USB_CDC_SIZE_TXBUF - (uint16_t)(cdc.tx_wr - cdc.tx_rd);
+    if( len == 0 ) {
+      if( HAL_GetTick() - t0 >= USB_CDC_TX_TIMEOUT_ms ) break;
+      __WFI();
+      continue;
+    }
+    if( len > size - n ) len = size - n;
+
+    uint16_t wr = cdc.tx_wr;
+    for( int i = 0; i < len; i++ ) {
+      cdc.tx_buf[wr++ & (USB_CDC_SIZE_TXBUF - 1)] = buf[n++];
+    }
+    cdc.tx_wr = wr;
+    t0 = HAL_GetTick();
+
+    HAL_NVIC_DisableIRQ( OTG_FS_IRQn );
+    usb_cdc_tx_start();
+    HAL_NVIC_EnableIRQ( OTG_FS_IRQn );
+  }
+
+  return size;
+}
+
+
+//================================================================
+/*! wait until the Tx buffer is sent.
+*/
+void usb_cdc_flush( void )
+{
+  uint32_t t0 = HAL_GetTick();
+
+  while( cdc.configured && (cdc.tx_busy || cdc.tx_wr != cdc.tx_rd) ) {
+    if( HAL_GetTick() - t0 >= USB_CDC_TX_TIMEOUT_ms ) return;
+  }
+}
+
+
+//================================================================
+/*! Receive string.
+
+  @param  buffer	Pointer to buffer.
+  @param  size		Size of buffer.
+  @return int		Num of received bytes, or -1 if the buffer is too small.
+*/
+int usb_cdc_gets( void *buffer, int size )
+{
+  int len;
+
+  while( (len = usb_cdc_can_read_line()) == 0 ) {
+    __WFI();
+  }
+  if( len >= size ) return -1;		// buffer size too small.
+
+  usb_cdc_read( buffer, len );
+  ((char *)buffer)[len] = '\0';
+
+  return len;
+}
+
+
+//================================================================
+/*! Returns the number of bytes in the Rx buffer.
+*/
+int usb_cdc_bytes_available( void )
+{
+  return (uint16_t)(cdc.rx_wr - cdc.rx_rd);
+}
+
+
+//================================================================
+/*! check data can be read a line.
+
+  @return int		string length including the new line, or 0.
+*/
+int usb_cdc_can_read_line( void )
+{
+  uint16_t rd = cdc.rx_rd;
+  uint16_t wr = cdc.rx_wr;
+
+  for( int len = 1; rd != wr; len++ ) {
+    if( cdc.rx_buf[rd++ & (USB_CDC_SIZE_RXBUF - 1)] == '\n' ) return len;
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! Clear the Rx buffer.
+*/
+void usb_cdc_clear_rx_buffer( void )
+{
+  HAL_NVIC_DisableIRQ( OTG_FS_IRQn );
+  cdc.rx_rd = cdc.rx_wr;
+  usb_cdc_rx_arm();
+  HAL_NVIC_EnableIRQ( OTG_FS_IRQn );
+}
+
+
+//================================================================
+/*! USB OTG FS interrupt handler.
+*/
+void OTG_FS_IRQHandler( void )
+{
+  uint32_t sts = USBx->GINTSTS & USBx->GINTMSK;
+
+  if( sts & USB_OTG_GINTSTS_USBRST ) {
+    USBx->GINTSTS = USB_OTG_GINTSTS_USBRST;
+    usb_cdc_bus_reset();
+  }
+
+  if( sts & USB_OTG_GINTSTS_ENUMDNE ) {
+    USBx->GINTSTS = USB_OTG_GINTSTS_ENUMDNE;
+    USBx_INEP(0)->DIEPCTL &= ~USB_OTG_DIEPCTL_MPSIZ;	// 64 bytes.
+    USBx_DEVICE->DCTL |= USB_OTG_DCTL_CGINAK;
+  }
+
+  while( USBx->GINTSTS & USB_OTG_GINTSTS_RXFLVL ) {
+    usb_cdc_rx_fifo();
+  }
+
+  if( sts & USB_OTG_GINTSTS_OEPINT ) {
+    uint32_t daint = USBx_DEVICE->DAINT & USBx_DEVICE->DAINTMSK;
+
+    if( daint & (1 << 16) ) {
+      uint32_t epint = USBx_OUTEP(0)->DOEPINT;
+      USBx_OUTEP(0)->DOEPINT = epint;
+      if( (epint & USB_OTG_DOEPINT_XFRC) && cdc.ep0_data_out ) {
+	cdc.ep0_data_out = 0;
+	cdc.ep0_remain = 0;
+	cdc.ep0_zlp = 0;
+	usb_cdc_ep0_send_packet();	// status stage.
+      }
+      if( epint & USB_OTG_DOEPINT_STUP ) usb_cdc_setup();
+      usb_cdc_ep0_arm_out();
+    }
+
+    if( daint & (1 << (16 + 1)) ) {
+      uint32_t epint = USBx_OUTEP(1)->DOEPINT;
+      USBx_OUTEP(1)->DOEPINT = epint;
+      if( epint & USB_OTG_DOEPINT_XFRC ) {
+	cdc.rx_paused = 1;
+	usb_cdc_rx_arm();
+      }
+    }
+  }
+
+  if( sts & USB_OTG_GINTSTS_IEPINT ) {
+    uint32_t daint = USBx_DEVICE->DAINT & USBx_DEVICE->DAINTMSK;
+
+    if( daint & (1 << 0) ) {
+      uint32_t epint = USBx_INEP(0)->DIEPINT;
+      USBx_INEP(0)->DIEPINT = epint;
+      if( epint & USB_OTG_DIEPINT_XFRC ) {
+	if( cdc.ep0_remain > 0 || cdc.ep0_zlp ) {
+	  if( cdc.ep0_remain == 0 ) cdc.ep0_zlp = 0;
+	  usb_cdc_ep0_send_packet();
+	}
+      }
+    }
+
+    if( daint & (1 << 1) ) {
+      uint32_t epint = USBx_INEP(1)->DIEPINT;
+      USBx_INEP(1)->DIEPINT = epint;
+      if( epint & USB_OTG_DIEPINT_XFRC ) {
+	cdc.tx_busy = 0;
+	usb_cdc_tx_start();
+      }
+    }
+  }
+}
+
+#endif	// defined(MRBC_CONSOLE_USB_CDC)
@@ -0,0 +1,50 @@
+/*! @file
+  @brief
+  USB CDC (virtual COM port) device on USB OTG FS.
+
+  <pre>
+  Copyright (C) 2024- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef USB_CDC_H
+#define USB_CDC_H
+
+//@cond
+#include <stdint.h>
+//@endcond
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! buffer size, must be a power of 2.
+#if !defined(USB_CDC_SIZE_RXBUF)
+#define USB_CDC_SIZE_RXBUF 1024
+#endif
+#if !defined(USB_CDC_SIZE_TXBUF)
+#define USB_CDC_SIZE_TXBUF 1024
+#endif
+
+
+/*
+  function prototypes.
+*/
+void usb_cdc_init( void );
+int usb_cdc_is_configured( void );
+int usb_cdc_read( void *buffer, int size );
+int usb_cdc_write( const void *buffer, int size );
+void usb_cdc_flush( void );
+int usb_cdc_gets( void *buffer, int size );
+int usb_cdc_bytes_available( void );
+int usb_cdc_can_read_line( void );
+void usb_cdc_clear_rx_buffer( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -25,200 +25,286 @@ static const char *builtin_symbols[] = {
   ">",			// MRBC_SYMID_GT = 18(0x12)
   ">=",			// MRBC_SYMID_GT_EQ = 19(0x13)
   ">>",			// MRBC_SYMID_GT_GT = 20(0x14)
-  "ArgumentError",	// MRBC_SYMID_ArgumentError = 21(0x15)
-  "Array",		// MRBC_SYMID_Array = 22(0x16)
-  "E",			// MRBC_SYMID_E = 23(0x17)
-  "Exception",		// MRBC_SYMID_Exception = 24(0x18)
-  "FalseClass",		// MRBC_SYMID_FalseClass = 25(0x19)
-  "Float",		// MRBC_SYMID_Float = 26(0x1a)
-  "Hash",		// MRBC_SYMID_Hash = 27(0x1b)
-  "IndexError",		// MRBC_SYMID_IndexError = 28(0x1c)
-  "Integer",		// MRBC_SYMID_Integer = 29(0x1d)
-  "MRUBYC_VERSION",	// MRBC_SYMID_MRUBYC_VERSION = 30(0x1e)
-  "MRUBY_VERSION",	// MRBC_SYMID_MRUBY_VERSION = 31(0x1f)
-  "Math",		// MRBC_SYMID_Math = 32(0x20)
-  "Mutex",		// MRBC_SYMID_Mutex = 33(0x21)
-  "NameError",		// MRBC_SYMID_NameError = 34(0x22)
-  "NilClass",		// MRBC_SYMID_NilClass = 35(0x23)
-  "NoMemoryError",	// MRBC_SYMID_NoMemoryError = 36(0x24)
-  "NoMethodError",	// MRBC_SYMID_NoMethodError = 37(0x25)
-  "NotImplementedError",	// MRBC_SYMID_NotImplementedError = 38(0x26)
-  "Object",		// MRBC_SYMID_Object = 39(0x27)
-  "PI",			// MRBC_SYMID_PI = 40(0x28)
-  "Proc",		// MRBC_SYMID_Proc = 41(0x29)
-  "RUBY_ENGINE",	// MRBC_SYMID_RUBY_ENGINE = 42(0x2a)
-  "RUBY_VERSION",	// MRBC_SYMID_RUBY_VERSION = 43(0x2b)
-  "Range",		// MRBC_SYMID_Range = 44(0x2c)
-  "RangeError",		// MRBC_SYMID_RangeError = 45(0x2d)
-  "RuntimeError",	// MRBC_SYMID_RuntimeError = 46(0x2e)
-  "StandardError",	// MRBC_SYMID_StandardError = 47(0x2f)
-  "String",		// MRBC_SYMID_String = 48(0x30)
-  "Symbol",		// MRBC_SYMID_Symbol = 49(0x31)
-  "Task",		// MRBC_SYMID_Task = 50(0x32)
-  "TrueClass",		// MRBC_SYMID_TrueClass = 51(0x33)
-  "TypeError",		// MRBC_SYMID_TypeError = 52(0x34)
-  "VM",			// MRBC_SYMID_VM = 53(0x35)
-  "ZeroDivisionError",	// MRBC_SYMID_ZeroDivisionError = 54(0x36)
-  "[]",			// MRBC_SYMID_BL_BR = 55(0x37)
-  "[]=",		// MRBC_SYMID_BL_BR_EQ = 56(0x38)
-  "^",			// MRBC_SYMID_XOR = 57(0x39)
-  "__ljust_rjust_argcheck",	// MRBC_SYMID___ljust_rjust_argcheck = 58(0x3a)
-  "abs",		// MRBC_SYMID_abs = 59(0x3b)
-  "acos",		// MRBC_SYMID_acos = 60(0x3c)
-  "acosh",		// MRBC_SYMID_acosh = 61(0x3d)
-  "all?",		// MRBC_SYMID_all_Q = 62(0x3e)
-  "all_symbols",	// MRBC_SYMID_all_symbols = 63(0x3f)
-  "any?",		// MRBC_SYMID_any_Q = 64(0x40)
-  "asin",		// MRBC_SYMID_asin = 65(0x41)
-  "asinh",		// MRBC_SYMID_asinh = 66(0x42)
-  "at",			// MRBC_SYMID_at = 67(0x43)
-  "atan",		// MRBC_SYMID_atan = 68(0x44)
-  "atan2",		// MRBC_SYMID_atan2 = 69(0x45)
-  "atanh",		// MRBC_SYMID_atanh = 70(0x46)
-  "attr_accessor",	// MRBC_SYMID_attr_accessor = 71(0x47)
-  "attr_reader",	// MRBC_SYMID_attr_reader = 72(0x48)
-  "b",			// MRBC_SYMID_b = 73(0x49)
-  "block_given?",	// MRBC_SYMID_block_given_Q = 74(0x4a)
-  "bytes",		// MRBC_SYMID_bytes = 75(0x4b)
-  "call",		// MRBC_SYMID_call = 76(0x4c)
-  "cbrt",		// MRBC_SYMID_cbrt = 77(0x4d)
-  "chomp",		// MRBC_SYMID_chomp = 78(0x4e)
-  "chomp!",		// MRBC_SYMID_chomp_E = 79(0x4f)
-  "chr",		// MRBC_SYMID_chr = 80(0x50)
-  "clamp",		// MRBC_SYMID_clamp = 81(0x51)
-  "class",		// MRBC_SYMID_class = 82(0x52)
-  "clear",		// MRBC_SYMID_clear = 83(0x53)
-  "collect",		// MRBC_SYMID_collect = 84(0x54)
-  "collect!",		// MRBC_SYMID_collect_E = 85(0x55)
-  "cos",		// MRBC_SYMID_cos = 86(0x56)
-  "cosh",		// MRBC_SYMID_cosh = 87(0x57)
-  "count",		// MRBC_SYMID_count = 88(0x58)
-  "create",		// MRBC_SYMID_create = 89(0x59)
-  "current",		// MRBC_SYMID_current = 90(0x5a)
-  "delete",		// MRBC_SYMID_delete = 91(0x5b)
-  "delete_at",		// MRBC_SYMID_delete_at = 92(0x5c)
-  "delete_if",		// MRBC_SYMID_delete_if = 93(0x5d)
-  "downcase",		// MRBC_SYMID_downcase = 94(0x5e)
-  "downcase!",		// MRBC_SYMID_downcase_E = 95(0x5f)
-  "downto",		// MRBC_SYMID_downto = 96(0x60)
-  "dup",		// MRBC_SYMID_dup = 97(0x61)
-  "each",		// MRBC_SYMID_each = 98(0x62)
-  "each_byte",		// MRBC_SYMID_each_byte = 99(0x63)
-  "each_char",		// MRBC_SYMID_each_char = 100(0x64)
-  "each_index",		// MRBC_SYMID_each_index = 101(0x65)
-  "each_with_index",	// MRBC_SYMID_each_with_index = 102(0x66)
-  "empty?",		// MRBC_SYMID_empty_Q = 103(0x67)
-  "end_with?",		// MRBC_SYMID_end_with_Q = 104(0x68)
-  "erf",		// MRBC_SYMID_erf = 105(0x69)
-  "erfc",		// MRBC_SYMID_erfc = 106(0x6a)
-  "exclude_end?",	// MRBC_SYMID_exclude_end_Q = 107(0x6b)
-  "exp",		// MRBC_SYMID_exp = 108(0x6c)
-  "find_index",		// MRBC_SYMID_find_index = 109(0x6d)
-  "first",		// MRBC_SYMID_first = 110(0x6e)
-  "get",		// MRBC_SYMID_get = 111(0x6f)
-  "getbyte",		// MRBC_SYMID_getbyte = 112(0x70)
-  "has_key?",		// MRBC_SYMID_has_key_Q = 113(0x71)
-  "has_value?",		// MRBC_SYMID_has_value_Q = 114(0x72)
-  "hypot",		// MRBC_SYMID_hypot = 115(0x73)
-  "id2name",		// MRBC_SYMID_id2name = 116(0x74)
-  "include?",		// MRBC_SYMID_include_Q = 117(0x75)
-  "index",		// MRBC_SYMID_index = 118(0x76)
-  "initialize",		// MRBC_SYMID_initialize = 119(0x77)
-  "inspect",		// MRBC_SYMID_inspect = 120(0x78)
-  "instance_methods",	// MRBC_SYMID_instance_methods = 121(0x79)
-  "instance_variables",	// MRBC_SYMID_instance_variables = 122(0x7a)
-  "intern",		// MRBC_SYMID_intern = 123(0x7b)
-  "is_a?",		// MRBC_SYMID_is_a_Q = 124(0x7c)
-  "join",		// MRBC_SYMID_join = 125(0x7d)
-  "key",		// MRBC_SYMID_key = 126(0x7e)
-  "keys",		// MRBC_SYMID_keys = 127(0x7f)
-  "kind_of?",		// MRBC_SYMID_kind_of_Q = 128(0x80)
-  "last",		// MRBC_SYMID_last = 129(0x81)
-  "ldexp",		// MRBC_SYMID_ldexp = 130(0x82)
-  "length",		// MRBC_SYMID_length = 131(0x83)
-  "list",		// MRBC_SYMID_list = 132(0x84)
-  "ljust",		// MRBC_SYMID_ljust = 133(0x85)
-  "lock",		// MRBC_SYMID_lock = 134(0x86)
-  "locked?",		// MRBC_SYMID_locked_Q = 135(0x87)
-  "log",		// MRBC_SYMID_log = 136(0x88)
-  "log10",		// MRBC_SYMID_log10 = 137(0x89)
-  "log2",		// MRBC_SYMID_log2 = 138(0x8a)
-  "loop",		// MRBC_SYMID_loop = 139(0x8b)
-  "lstrip",		// MRBC_SYMID_lstrip = 140(0x8c)
-  "lstrip!",		// MRBC_SYMID_lstrip_E = 141(0x8d)
-  "map",		// MRBC_SYMID_map = 142(0x8e)
-  "map!",		// MRBC_SYMID_map_E = 143(0x8f)
-  "max",		// MRBC_SYMID_max = 144(0x90)
-  "memory_statistics",	// MRBC_SYMID_memory_statistics = 145(0x91)
-  "merge",		// MRBC_SYMID_merge = 146(0x92)
-  "merge!",		// MRBC_SYMID_merge_E = 147(0x93)
-  "message",		// MRBC_SYMID_message = 148(0x94)
-  "min",		// MRBC_SYMID_min = 149(0x95)
-  "minmax",		// MRBC_SYMID_minmax = 150(0x96)
-  "name",		// MRBC_SYMID_name = 151(0x97)
-  "name=",		// MRBC_SYMID_name_EQ = 152(0x98)
-  "name_list",		// MRBC_SYMID_name_list = 153(0x99)
-  "new",		// MRBC_SYMID_new = 154(0x9a)
-  "nil?",		// MRBC_SYMID_nil_Q = 155(0x9b)
-  "object_id",		// MRBC_SYMID_object_id = 156(0x9c)
-  "ord",		// MRBC_SYMID_ord = 157(0x9d)
-  "owned?",		// MRBC_SYMID_owned_Q = 158(0x9e)
-  "p",			// MRBC_SYMID_p = 159(0x9f)
-  "pass",		// MRBC_SYMID_pass = 160(0xa0)
-  "pop",		// MRBC_SYMID_pop = 161(0xa1)
-  "print",		// MRBC_SYMID_print = 162(0xa2)
-  "printf",		// MRBC_SYMID_printf = 163(0xa3)
-  "priority",		// MRBC_SYMID_priority = 164(0xa4)
-  "priority=",		// MRBC_SYMID_priority_EQ = 165(0xa5)
-  "push",		// MRBC_SYMID_push = 166(0xa6)
-  "puts",		// MRBC_SYMID_puts = 167(0xa7)
-  "raise",		// MRBC_SYMID_raise = 168(0xa8)
-  "reject",		// MRBC_SYMID_reject = 169(0xa9)
-  "reject!",		// MRBC_SYMID_reject_E = 170(0xaa)
-  "resume",		// MRBC_SYMID_resume = 171(0xab)
-  "rewind",		// MRBC_SYMID_rewind = 172(0xac)
-  "rjust",		// MRBC_SYMID_rjust = 173(0xad)
-  "rstrip",		// MRBC_SYMID_rstrip = 174(0xae)
-  "rstrip!",		// MRBC_SYMID_rstrip_E = 175(0xaf)
-  "run",		// MRBC_SYMID_run = 176(0xb0)
-  "shift",		// MRBC_SYMID_shift = 177(0xb1)
-  "sin",		// MRBC_SYMID_sin = 178(0xb2)
-  "sinh",		// MRBC_SYMID_sinh = 179(0xb3)
-  "size",		// MRBC_SYMID_size = 180(0xb4)
-  "slice!",		// MRBC_SYMID_slice_E = 181(0xb5)
-  "sort",		// MRBC_SYMID_sort = 182(0xb6)
-  "sort!",		// MRBC_SYMID_sort_E = 183(0xb7)
-  "split",		// MRBC_SYMID_split = 184(0xb8)
-  "sprintf",		// MRBC_SYMID_sprintf = 185(0xb9)
-  "sqrt",		// MRBC_SYMID_sqrt = 186(0xba)
-  "start_with?",	// MRBC_SYMID_start_with_Q = 187(0xbb)
-  "status",		// MRBC_SYMID_status = 188(0xbc)
-  "strip",		// MRBC_SYMID_strip = 189(0xbd)
-  "strip!",		// MRBC_SYMID_strip_E = 190(0xbe)
-  "suspend",		// MRBC_SYMID_suspend = 191(0xbf)
-  "tan",		// MRBC_SYMID_tan = 192(0xc0)
-  "tanh",		// MRBC_SYMID_tanh = 193(0xc1)
-  "terminate",		// MRBC_SYMID_terminate = 194(0xc2)
-  "tick",		// MRBC_SYMID_tick = 195(0xc3)
-  "times",		// MRBC_SYMID_times = 196(0xc4)
-  "to_a",		// MRBC_SYMID_to_a = 197(0xc5)
-  "to_f",		// MRBC_SYMID_to_f = 198(0xc6)
-  "to_h",		// MRBC_SYMID_to_h = 199(0xc7)
-  "to_i",		// MRBC_SYMID_to_i = 200(0xc8)
-  "to_s",		// MRBC_SYMID_to_s = 201(0xc9)
-  "to_sym",		// MRBC_SYMID_to_sym = 202(0xca)
-  "tr",			// MRBC_SYMID_tr = 203(0xcb)
-  "tr!",		// MRBC_SYMID_tr_E = 204(0xcc)
-  "try_lock",		// MRBC_SYMID_try_lock = 205(0xcd)
-  "unlock",		// MRBC_SYMID_unlock = 206(0xce)
-  "unshift",		// MRBC_SYMID_unshift = 207(0xcf)
-  "upcase",		// MRBC_SYMID_upcase = 208(0xd0)
-  "upcase!",		// MRBC_SYMID_upcase_E = 209(0xd1)
-  "upto",		// MRBC_SYMID_upto = 210(0xd2)
-  "value",		// MRBC_SYMID_value = 211(0xd3)
-  "values",		// MRBC_SYMID_values = 212(0xd4)
-  "|",			// MRBC_SYMID_OR = 213(0xd5)
-  "~",			// MRBC_SYMID_NEG = 214(0xd6)
+  "ADC",		// MRBC_SYMID_ADC = 21(0x15)
+  "ArgumentError",	// MRBC_SYMID_ArgumentError = 22(0x16)
+  "Array",		// MRBC_SYMID_Array = 23(0x17)
+  "E",			// MRBC_SYMID_E = 24(0x18)
+  "Encoder",		// MRBC_SYMID_Encoder = 25(0x19)
+  "Exception",		// MRBC_SYMID_Exception = 26(0x1a)
+  "FalseClass",		// MRBC_SYMID_FalseClass = 27(0x1b)
+  "Float",		// MRBC_SYMID_Float = 28(0x1c)
+  "GPIO",		// MRBC_SYMID_GPIO = 29(0x1d)
+  "Hash",		// MRBC_SYMID_Hash = 30(0x1e)
+  "I2C",		// MRBC_SYMID_I2C = 31(0x1f)
+  "IndexError",		// MRBC_SYMID_IndexError = 32(0x20)
+  "InputCapture",	// MRBC_SYMID_InputCapture = 33(0x21)
+  "Integer",		// MRBC_SYMID_Integer = 34(0x22)
+  "MRUBYC_VERSION",	// MRBC_SYMID_MRUBYC_VERSION = 35(0x23)
+  "MRUBY_VERSION",	// MRBC_SYMID_MRUBY_VERSION = 36(0x24)
+  "Math",		// MRBC_SYMID_Math = 37(0x25)
+  "Mutex",		// MRBC_SYMID_Mutex = 38(0x26)
+  "NameError",		// MRBC_SYMID_NameError = 39(0x27)
+  "NilClass",		// MRBC_SYMID_NilClass = 40(0x28)
+  "NoMemoryError",	// MRBC_SYMID_NoMemoryError = 41(0x29)
+  "NoMethodError",	// MRBC_SYMID_NoMethodError = 42(0x2a)
+  "NotImplementedError",	// MRBC_SYMID_NotImplementedError = 43(0x2b)
+  "Object",		// MRBC_SYMID_Object = 44(0x2c)
+  "PI",			// MRBC_SYMID_PI = 45(0x2d)
+  "PWM",		// MRBC_SYMID_PWM = 46(0x2e)
+  "Proc",		// MRBC_SYMID_Proc = 47(0x2f)
+  "RUBY_ENGINE",	// MRBC_SYMID_RUBY_ENGINE = 48(0x30)
+  "RUBY_VERSION",	// MRBC_SYMID_RUBY_VERSION = 49(0x31)
+  "Range",		// MRBC_SYMID_Range = 50(0x32)
+  "RangeError",		// MRBC_SYMID_RangeError = 51(0x33)
+  "RuntimeError",	// MRBC_SYMID_RuntimeError = 52(0x34)
+  "SPI",		// MRBC_SYMID_SPI = 53(0x35)
+  "StandardError",	// MRBC_SYMID_StandardError = 54(0x36)
+  "String",		// MRBC_SYMID_String = 55(0x37)
+  "Symbol",		// MRBC_SYMID_Symbol = 56(0x38)
+  "System",		// MRBC_SYMID_System = 57(0x39)
+  "SystemStackError",	// MRBC_SYMID_SystemStackError = 58(0x3a)
+  "Task",		// MRBC_SYMID_Task = 59(0x3b)
+  "TrueClass",		// MRBC_SYMID_TrueClass = 60(0x3c)
+  "TypeError",		// MRBC_SYMID_TypeError = 61(0x3d)
+  "UART",		// MRBC_SYMID_UART = 62(0x3e)
+  "VM",			// MRBC_SYMID_VM = 63(0x3f)
+  "ZeroDivisionError",	// MRBC_SYMID_ZeroDivisionError = 64(0x40)
+  "[]",			// MRBC_SYMID_BL_BR = 65(0x41)
+  "[]=",		// MRBC_SYMID_BL_BR_EQ = 66(0x42)
+  "^",			// MRBC_SYMID_XOR = 67(0x43)
+  "__ljust_rjust_argcheck",	// MRBC_SYMID___ljust_rjust_argcheck = 68(0x44)
+  "abs",		// MRBC_SYMID_abs = 69(0x45)
+  "acos",		// MRBC_SYMID_acos = 70(0x46)
+  "acosh",		// MRBC_SYMID_acosh = 71(0x47)
+  "all?",		// MRBC_SYMID_all_Q = 72(0x48)
+  "all_symbols",	// MRBC_SYMID_all_symbols = 73(0x49)
+  "any?",		// MRBC_SYMID_any_Q = 74(0x4a)
+  "asin",		// MRBC_SYMID_asin = 75(0x4b)
+  "asinh",		// MRBC_SYMID_asinh = 76(0x4c)
+  "at",			// MRBC_SYMID_at = 77(0x4d)
+  "atan",		// MRBC_SYMID_atan = 78(0x4e)
+  "atan2",		// MRBC_SYMID_atan2 = 79(0x4f)
+  "atanh",		// MRBC_SYMID_atanh = 80(0x50)
+  "attr_accessor",	// MRBC_SYMID_attr_accessor = 81(0x51)
+  "attr_reader",	// MRBC_SYMID_attr_reader = 82(0x52)
+  "average",		// MRBC_SYMID_average = 83(0x53)
+  "b",			// MRBC_SYMID_b = 84(0x54)
+  "block_given?",	// MRBC_SYMID_block_given_Q = 85(0x55)
+  "bytes",		// MRBC_SYMID_bytes = 86(0x56)
+  "bytes_available",	// MRBC_SYMID_bytes_available = 87(0x57)
+  "bytes_to_write",	// MRBC_SYMID_bytes_to_write = 88(0x58)
+  "call",		// MRBC_SYMID_call = 89(0x59)
+  "can_read_line",	// MRBC_SYMID_can_read_line = 90(0x5a)
+  "cbrt",		// MRBC_SYMID_cbrt = 91(0x5b)
+  "chomp",		// MRBC_SYMID_chomp = 92(0x5c)
+  "chomp!",		// MRBC_SYMID_chomp_E = 93(0x5d)
+  "chr",		// MRBC_SYMID_chr = 94(0x5e)
+  "clamp",		// MRBC_SYMID_clamp = 95(0x5f)
+  "class",		// MRBC_SYMID_class = 96(0x60)
+  "clear",		// MRBC_SYMID_clear = 97(0x61)
+  "clear_rx_buffer",	// MRBC_SYMID_clear_rx_buffer = 98(0x62)
+  "clear_tx_buffer",	// MRBC_SYMID_clear_tx_buffer = 99(0x63)
+  "clock",		// MRBC_SYMID_clock = 100(0x64)
+  "clock=",		// MRBC_SYMID_clock_EQ = 101(0x65)
+  "collect",		// MRBC_SYMID_collect = 102(0x66)
+  "collect!",		// MRBC_SYMID_collect_E = 103(0x67)
+  "cos",		// MRBC_SYMID_cos = 104(0x68)
+  "cosh",		// MRBC_SYMID_cosh = 105(0x69)
+  "count",		// MRBC_SYMID_count = 106(0x6a)
+  "create",		// MRBC_SYMID_create = 107(0x6b)
+  "current",		// MRBC_SYMID_current = 108(0x6c)
+  "delete",		// MRBC_SYMID_delete = 109(0x6d)
+  "delete_at",		// MRBC_SYMID_delete_at = 110(0x6e)
+  "delete_if",		// MRBC_SYMID_delete_if = 111(0x6f)
+  "downcase",		// MRBC_SYMID_downcase = 112(0x70)
+  "downcase!",		// MRBC_SYMID_downcase_E = 113(0x71)
+  "downto",		// MRBC_SYMID_downto = 114(0x72)
+  "dup",		// MRBC_SYMID_dup = 115(0x73)
+  "duty",		// MRBC_SYMID_duty = 116(0x74)
+  "duty_u16=",		// MRBC_SYMID_duty_u16_EQ = 117(0x75)
+  "each",		// MRBC_SYMID_each = 118(0x76)
+  "each_byte",		// MRBC_SYMID_each_byte = 119(0x77)
+  "each_char",		// MRBC_SYMID_each_char = 120(0x78)
+  "each_index",		// MRBC_SYMID_each_index = 121(0x79)
+  "each_with_index",	// MRBC_SYMID_each_with_index = 122(0x7a)
+  "empty?",		// MRBC_SYMID_empty_Q = 123(0x7b)
+  "end_with?",		// MRBC_SYMID_end_with_Q = 124(0x7c)
+  "erf",		// MRBC_SYMID_erf = 125(0x7d)
+  "erfc",		// MRBC_SYMID_erfc = 126(0x7e)
+  "every",		// MRBC_SYMID_every = 127(0x7f)
+  "exclude_end?",	// MRBC_SYMID_exclude_end_Q = 128(0x80)
+  "exp",		// MRBC_SYMID_exp = 129(0x81)
+  "find_index",		// MRBC_SYMID_find_index = 130(0x82)
+  "first",		// MRBC_SYMID_first = 131(0x83)
+  "flush",		// MRBC_SYMID_flush = 132(0x84)
+  "frequency",		// MRBC_SYMID_frequency = 133(0x85)
+  "get",		// MRBC_SYMID_get = 134(0x86)
+  "getbyte",		// MRBC_SYMID_getbyte = 135(0x87)
+  "gets",		// MRBC_SYMID_gets = 136(0x88)
+  "gets_into",		// MRBC_SYMID_gets_into = 137(0x89)
+  "has_key?",		// MRBC_SYMID_has_key_Q = 138(0x8a)
+  "has_value?",		// MRBC_SYMID_has_value_Q = 139(0x8b)
+  "high?",		// MRBC_SYMID_high_Q = 140(0x8c)
+  "high_at?",		// MRBC_SYMID_high_at_Q = 141(0x8d)
+  "hypot",		// MRBC_SYMID_hypot = 142(0x8e)
+  "id2name",		// MRBC_SYMID_id2name = 143(0x8f)
+  "include?",		// MRBC_SYMID_include_Q = 144(0x90)
+  "index",		// MRBC_SYMID_index = 145(0x91)
+  "initialize",		// MRBC_SYMID_initialize = 146(0x92)
+  "inspect",		// MRBC_SYMID_inspect = 147(0x93)
+  "instance_methods",	// MRBC_SYMID_instance_methods = 148(0x94)
+  "instance_variables",	// MRBC_SYMID_instance_variables = 149(0x95)
+  "intern",		// MRBC_SYMID_intern = 150(0x96)
+  "irq",		// MRBC_SYMID_irq = 151(0x97)
+  "is_a?",		// MRBC_SYMID_is_a_Q = 152(0x98)
+  "join",		// MRBC_SYMID_join = 153(0x99)
+  "key",		// MRBC_SYMID_key = 154(0x9a)
+  "keys",		// MRBC_SYMID_keys = 155(0x9b)
+  "kind_of?",		// MRBC_SYMID_kind_of_Q = 156(0x9c)
+  "last",		// MRBC_SYMID_last = 157(0x9d)
+  "ldexp",		// MRBC_SYMID_ldexp = 158(0x9e)
+  "length",		// MRBC_SYMID_length = 159(0x9f)
+  "list",		// MRBC_SYMID_list = 160(0xa0)
+  "listen",		// MRBC_SYMID_listen = 161(0xa1)
+  "listen_status",	// MRBC_SYMID_listen_status = 162(0xa2)
+  "ljust",		// MRBC_SYMID_ljust = 163(0xa3)
+  "lock",		// MRBC_SYMID_lock = 164(0xa4)
+  "locked?",		// MRBC_SYMID_locked_Q = 165(0xa5)
+  "log",		// MRBC_SYMID_log = 166(0xa6)
+  "log10",		// MRBC_SYMID_log10 = 167(0xa7)
+  "log2",		// MRBC_SYMID_log2 = 168(0xa8)
+  "loop",		// MRBC_SYMID_loop = 169(0xa9)
+  "low?",		// MRBC_SYMID_low_Q = 170(0xaa)
+  "low_at?",		// MRBC_SYMID_low_at_Q = 171(0xab)
+  "lstrip",		// MRBC_SYMID_lstrip = 172(0xac)
+  "lstrip!",		// MRBC_SYMID_lstrip_E = 173(0xad)
+  "map",		// MRBC_SYMID_map = 174(0xae)
+  "map!",		// MRBC_SYMID_map_E = 175(0xaf)
+  "max",		// MRBC_SYMID_max = 176(0xb0)
+  "mean",		// MRBC_SYMID_mean = 177(0xb1)
+  "memory_statistics",	// MRBC_SYMID_memory_statistics = 178(0xb2)
+  "merge",		// MRBC_SYMID_merge = 179(0xb3)
+  "merge!",		// MRBC_SYMID_merge_E = 180(0xb4)
+  "message",		// MRBC_SYMID_message = 181(0xb5)
+  "min",		// MRBC_SYMID_min = 182(0xb6)
+  "minmax",		// MRBC_SYMID_minmax = 183(0xb7)
+  "name",		// MRBC_SYMID_name = 184(0xb8)
+  "name=",		// MRBC_SYMID_name_EQ = 185(0xb9)
+  "name_list",		// MRBC_SYMID_name_list = 186(0xba)
+  "new",		// MRBC_SYMID_new = 187(0xbb)
+  "nil?",		// MRBC_SYMID_nil_Q = 188(0xbc)
+  "notify",		// MRBC_SYMID_notify = 189(0xbd)
+  "notify_low_memory",	// MRBC_SYMID_notify_low_memory = 190(0xbe)
+  "object_id",		// MRBC_SYMID_object_id = 191(0xbf)
+  "ord",		// MRBC_SYMID_ord = 192(0xc0)
+  "owned?",		// MRBC_SYMID_owned_Q = 193(0xc1)
+  "p",			// MRBC_SYMID_p = 194(0xc2)
+  "pack",		// MRBC_SYMID_pack = 195(0xc3)
+  "pass",		// MRBC_SYMID_pass = 196(0xc4)
+  "period",		// MRBC_SYMID_period = 197(0xc5)
+  "period_ticks",	// MRBC_SYMID_period_ticks = 198(0xc6)
+  "period_us",		// MRBC_SYMID_period_us = 199(0xc7)
+  "play_port",		// MRBC_SYMID_play_port = 200(0xc8)
+  "pool",		// MRBC_SYMID_pool = 201(0xc9)
+  "pop",		// MRBC_SYMID_pop = 202(0xca)
+  "position",		// MRBC_SYMID_position = 203(0xcb)
+  "position=",		// MRBC_SYMID_position_EQ = 204(0xcc)
+  "print",		// MRBC_SYMID_print = 205(0xcd)
+  "printf",		// MRBC_SYMID_printf = 206(0xce)
+  "priority",		// MRBC_SYMID_priority = 207(0xcf)
+  "priority=",		// MRBC_SYMID_priority_EQ = 208(0xd0)
+  "pulse_ticks=",	// MRBC_SYMID_pulse_ticks_EQ = 209(0xd1)
+  "pulse_width_us",	// MRBC_SYMID_pulse_width_us = 210(0xd2)
+  "push",		// MRBC_SYMID_push = 211(0xd3)
+  "puts",		// MRBC_SYMID_puts = 212(0xd4)
+  "raise",		// MRBC_SYMID_raise = 213(0xd5)
+  "read",		// MRBC_SYMID_read = 214(0xd6)
+  "read_at",		// MRBC_SYMID_read_at = 215(0xd7)
+  "read_frame",		// MRBC_SYMID_read_frame = 216(0xd8)
+  "read_into",		// MRBC_SYMID_read_into = 217(0xd9)
+  "read_latest",	// MRBC_SYMID_read_latest = 218(0xda)
+  "read_packet",	// MRBC_SYMID_read_packet = 219(0xdb)
+  "read_port",		// MRBC_SYMID_read_port = 220(0xdc)
+  "read_raw",		// MRBC_SYMID_read_raw = 221(0xdd)
+  "read_samples",	// MRBC_SYMID_read_samples = 222(0xde)
+  "read_scan",		// MRBC_SYMID_read_scan = 223(0xdf)
+  "read_voltage",	// MRBC_SYMID_read_voltage = 224(0xe0)
+  "reject",		// MRBC_SYMID_reject = 225(0xe1)
+  "reject!",		// MRBC_SYMID_reject_E = 226(0xe2)
+  "resume",		// MRBC_SYMID_resume = 227(0xe3)
+  "rewind",		// MRBC_SYMID_rewind = 228(0xe4)
+  "rjust",		// MRBC_SYMID_rjust = 229(0xe5)
+  "rstrip",		// MRBC_SYMID_rstrip = 230(0xe6)
+  "rstrip!",		// MRBC_SYMID_rstrip_E = 231(0xe7)
+  "run",		// MRBC_SYMID_run = 232(0xe8)
+  "rx_buffer_size",	// MRBC_SYMID_rx_buffer_size = 233(0xe9)
+  "rx_lost",		// MRBC_SYMID_rx_lost = 234(0xea)
+  "rx_overrun",		// MRBC_SYMID_rx_overrun = 235(0xeb)
+  "sample_port",	// MRBC_SYMID_sample_port = 236(0xec)
+  "sample_time",	// MRBC_SYMID_sample_time = 237(0xed)
+  "sample_time=",	// MRBC_SYMID_sample_time_EQ = 238(0xee)
+  "send_break",		// MRBC_SYMID_send_break = 239(0xef)
+  "setmode",		// MRBC_SYMID_setmode = 240(0xf0)
+  "setmode_port",	// MRBC_SYMID_setmode_port = 241(0xf1)
+  "shift",		// MRBC_SYMID_shift = 242(0xf2)
+  "sin",		// MRBC_SYMID_sin = 243(0xf3)
+  "sinh",		// MRBC_SYMID_sinh = 244(0xf4)
+  "size",		// MRBC_SYMID_size = 245(0xf5)
+  "slice!",		// MRBC_SYMID_slice_E = 246(0xf6)
+  "sort",		// MRBC_SYMID_sort = 247(0xf7)
+  "sort!",		// MRBC_SYMID_sort_E = 248(0xf8)
+  "split",		// MRBC_SYMID_split = 249(0xf9)
+  "sprintf",		// MRBC_SYMID_sprintf = 250(0xfa)
+  "sqrt",		// MRBC_SYMID_sqrt = 251(0xfb)
+  "stack_size",		// MRBC_SYMID_stack_size = 252(0xfc)
+  "stack_used",		// MRBC_SYMID_stack_used = 253(0xfd)
+  "start_scan",		// MRBC_SYMID_start_scan = 254(0xfe)
+  "start_with?",	// MRBC_SYMID_start_with_Q = 255(0xff)
+  "status",		// MRBC_SYMID_status = 256(0x100)
+  "stop",		// MRBC_SYMID_stop = 257(0x101)
+  "stop_scan",		// MRBC_SYMID_stop_scan = 258(0x102)
+  "strip",		// MRBC_SYMID_strip = 259(0x103)
+  "strip!",		// MRBC_SYMID_strip_E = 260(0x104)
+  "sum",		// MRBC_SYMID_sum = 261(0x105)
+  "suspend",		// MRBC_SYMID_suspend = 262(0x106)
+  "tan",		// MRBC_SYMID_tan = 263(0x107)
+  "tanh",		// MRBC_SYMID_tanh = 264(0x108)
+  "terminate",		// MRBC_SYMID_terminate = 265(0x109)
+  "tick",		// MRBC_SYMID_tick = 266(0x10a)
+  "times",		// MRBC_SYMID_times = 267(0x10b)
+  "timeslice",		// MRBC_SYMID_timeslice = 268(0x10c)
+  "timeslice=",		// MRBC_SYMID_timeslice_EQ = 269(0x10d)
+  "to_a",		// MRBC_SYMID_to_a = 270(0x10e)
+  "to_f",		// MRBC_SYMID_to_f = 271(0x10f)
+  "to_h",		// MRBC_SYMID_to_h = 272(0x110)
+  "to_i",		// MRBC_SYMID_to_i = 273(0x111)
+  "to_s",		// MRBC_SYMID_to_s = 274(0x112)
+  "to_sym",		// MRBC_SYMID_to_sym = 275(0x113)
+  "tr",			// MRBC_SYMID_tr = 276(0x114)
+  "tr!",		// MRBC_SYMID_tr_E = 277(0x115)
+  "transaction",	// MRBC_SYMID_transaction = 278(0x116)
+  "transfer",		// MRBC_SYMID_transfer = 279(0x117)
+  "try_lock",		// MRBC_SYMID_try_lock = 280(0x118)
+  "unlisten",		// MRBC_SYMID_unlisten = 281(0x119)
+  "unlock",		// MRBC_SYMID_unlock = 282(0x11a)
+  "unpack",		// MRBC_SYMID_unpack = 283(0x11b)
+  "unshift",		// MRBC_SYMID_unshift = 284(0x11c)
+  "upcase",		// MRBC_SYMID_upcase = 285(0x11d)
+  "upcase!",		// MRBC_SYMID_upcase_E = 286(0x11e)
+  "upto",		// MRBC_SYMID_upto = 287(0x11f)
+  "value",		// MRBC_SYMID_value = 288(0x120)
+  "values",		// MRBC_SYMID_values = 289(0x121)
+  "wait_edge",		// MRBC_SYMID_wait_edge = 290(0x122)
+  "wait_event",		// MRBC_SYMID_wait_event = 291(0x123)
+  "wait_half",		// MRBC_SYMID_wait_half = 292(0x124)
+  "width",		// MRBC_SYMID_width = 293(0x125)
+  "write",		// MRBC_SYMID_write = 294(0x126)
+  "write_at",		// MRBC_SYMID_write_at = 295(0x127)
+  "write_duty_u16",	// MRBC_SYMID_write_duty_u16 = 296(0x128)
+  "write_packet",	// MRBC_SYMID_write_packet = 297(0x129)
+  "write_port",		// MRBC_SYMID_write_port = 298(0x12a)
+  "|",			// MRBC_SYMID_OR = 299(0x12b)
+  "~",			// MRBC_SYMID_NEG = 300(0x12c)
 };
 #endif
 
@@ -244,200 +330,286 @@ enum {
   MRBC_SYMID_GT = 18,
   MRBC_SYMID_GT_EQ = 19,
   MRBC_SYMID_GT_GT = 20,
-  MRBC_SYMID_ArgumentError = 21,
-  MRBC_SYMID_Array = 22,
-  MRBC_SYMID_E = 23,
-  MRBC_SYMID_Exception = 24,
-  MRBC_SYMID_FalseClass = 25,
-  MRBC_SYMID_Float = 26,
-  MRBC_SYMID_Hash = 27,
-  MRBC_SYMID_IndexError = 28,
-  MRBC_SYMID_Integer = 29,
-  MRBC_SYMID_MRUBYC_VERSION = 30,
-  MRBC_SYMID_MRUBY_VERSION = 31,
-  MRBC_SYMID_Math = 32,
-  MRBC_SYMID_Mutex = 33,
-  MRBC_SYMID_NameError = 34,
-  MRBC_SYMID_NilClass = 35,
-  MRBC_SYMID_NoMemoryError = 36,
-  MRBC_SYMID_NoMethodError = 37,
-  MRBC_SYMID_NotImplementedError = 38,
-  MRBC_SYMID_Object = 39,
-  MRBC_SYMID_PI = 40,
-  MRBC_SYMID_Proc = 41,
-  MRBC_SYMID_RUBY_ENGINE = 42,
-  MRBC_SYMID_RUBY_VERSION = 43,
-  MRBC_SYMID_Range = 44,
-  MRBC_SYMID_RangeError = 45,
-  MRBC_SYMID_RuntimeError = 46,
-  MRBC_SYMID_StandardError = 47,
-  MRBC_SYMID_String = 48,
-  MRBC_SYMID_Symbol = 49,
-  MRBC_SYMID_Task = 50,
-  MRBC_SYMID_TrueClass = 51,
-  MRBC_SYMID_TypeError = 52,
-  MRBC_SYMID_VM = 53,
-  MRBC_SYMID_ZeroDivisionError = 54,
-  MRBC_SYMID_BL_BR = 55,
-  MRBC_SYMID_BL_BR_EQ = 56,
-  MRBC_SYMID_XOR = 57,
-  MRBC_SYMID___ljust_rjust_argcheck = 58,
-  MRBC_SYMID_abs = 59,
-  MRBC_SYMID_acos = 60,
-  MRBC_SYMID_acosh = 61,
-  MRBC_SYMID_all_Q = 62,
-  MRBC_SYMID_all_symbols = 63,
-  MRBC_SYMID_any_Q = 64,
-  MRBC_SYMID_asin = 65,
-  MRBC_SYMID_asinh = 66,
-  MRBC_SYMID_at = 67,
-  MRBC_SYMID_atan = 68,
-  MRBC_SYMID_atan2 = 69,
-  MRBC_SYMID_atanh = 70,
-  MRBC_SYMID_attr_accessor = 71,
-  MRBC_SYMID_attr_reader = 72,
-  MRBC_SYMID_b = 73,
-  MRBC_SYMID_block_given_Q = 74,
-  MRBC_SYMID_bytes = 75,
-  MRBC_SYMID_call = 76,
-  MRBC_SYMID_cbrt = 77,
-  MRBC_SYMID_chomp = 78,
-  MRBC_SYMID_chomp_E = 79,
-  MRBC_SYMID_chr = 80,
-  MRBC_SYMID_clamp = 81,
-  MRBC_SYMID_class = 82,
-  MRBC_SYMID_clear = 83,
-  MRBC_SYMID_collect = 84,
-  MRBC_SYMID_collect_E = 85,
-  MRBC_SYMID_cos = 86,
-  MRBC_SYMID_cosh = 87,
-  MRBC_SYMID_count = 88,
-  MRBC_SYMID_create = 89,
-  MRBC_SYMID_current = 90,
-  MRBC_SYMID_delete = 91,
-  MRBC_SYMID_delete_at = 92,
-  MRBC_SYMID_delete_if = 93,
-  MRBC_SYMID_downcase = 94,
-  MRBC_SYMID_downcase_E = 95,
-  MRBC_SYMID_downto = 96,
-  MRBC_SYMID_dup = 97,
-  MRBC_SYMID_each = 98,
-  MRBC_SYMID_each_byte = 99,
-  MRBC_SYMID_each_char = 100,
-  MRBC_SYMID_each_index = 101,
-  MRBC_SYMID_each_with_index = 102,
-  MRBC_SYMID_empty_Q = 103,
-  MRBC_SYMID_end_with_Q = 104,
-  MRBC_SYMID_erf = 105,
-  MRBC_SYMID_erfc = 106,
-  MRBC_SYMID_exclude_end_Q = 107,
-  MRBC_SYMID_exp = 108,
-  MRBC_SYMID_find_index = 109,
-  MRBC_SYMID_first = 110,
-  MRBC_SYMID_get = 111,
-  MRBC_SYMID_getbyte = 112,
-  MRBC_SYMID_has_key_Q = 113,
-  MRBC_SYMID_has_value_Q = 114,
-  MRBC_SYMID_hypot = 115,
-  MRBC_SYMID_id2name = 116,
-  MRBC_SYMID_include_Q = 117,
-  MRBC_SYMID_index = 118,
-  MRBC_SYMID_initialize = 119,
-  MRBC_SYMID_inspect = 120,
-  MRBC_SYMID_instance_methods = 121,
-  MRBC_SYMID_instance_variables = 122,
-  MRBC_SYMID_intern = 123,
-  MRBC_SYMID_is_a_Q = 124,
-  MRBC_SYMID_join = 125,
-  MRBC_SYMID_key = 126,
-  MRBC_SYMID_keys = 127,
-  MRBC_SYMID_kind_of_Q = 128,
-  MRBC_SYMID_last = 129,
-  MRBC_SYMID_ldexp = 130,
-  MRBC_SYMID_length = 131,
-  MRBC_SYMID_list = 132,
-  MRBC_SYMID_ljust = 133,
-  MRBC_SYMID_lock = 134,
-  MRBC_SYMID_locked_Q = 135,
-  MRBC_SYMID_log = 136,
-  MRBC_SYMID_log10 = 137,
-  MRBC_SYMID_log2 = 138,
-  MRBC_SYMID_loop = 139,
-  MRBC_SYMID_lstrip = 140,
-  MRBC_SYMID_lstrip_E = 141,
-  MRBC_SYMID_map = 142,
-  MRBC_SYMID_map_E = 143,
-  MRBC_SYMID_max = 144,
-  MRBC_SYMID_memory_statistics = 145,
-  MRBC_SYMID_merge = 146,
-  MRBC_SYMID_merge_E = 147,
-  MRBC_SYMID_message = 148,
-  MRBC_SYMID_min = 149,
-  MRBC_SYMID_minmax = 150,
-  MRBC_SYMID_name = 151,
-  MRBC_SYMID_name_EQ = 152,
-  MRBC_SYMID_name_list = 153,
-  MRBC_SYMID_new = 154,
-  MRBC_SYMID_nil_Q = 155,
-  MRBC_SYMID_object_id = 156,
-  MRBC_SYMID_ord = 157,
-  MRBC_SYMID_owned_Q = 158,
-  MRBC_SYMID_p = 159,
-  MRBC_SYMID_pass = 160,
-  MRBC_SYMID_pop = 161,
-  MRBC_SYMID_print = 162,
-  MRBC_SYMID_printf = 163,
-  MRBC_SYMID_priority = 164,
-  MRBC_SYMID_priority_EQ = 165,
-  MRBC_SYMID_push = 166,
-  MRBC_SYMID_puts = 167,
-  MRBC_SYMID_raise = 168,
-  MRBC_SYMID_reject = 169,
-  MRBC_SYMID_reject_E = 170,
-  MRBC_SYMID_resume = 171,
-  MRBC_SYMID_rewind = 172,
-  MRBC_SYMID_rjust = 173,
-  MRBC_SYMID_rstrip = 174,
-  MRBC_SYMID_rstrip_E = 175,
-  MRBC_SYMID_run = 176,
-  MRBC_SYMID_shift = 177,
-  MRBC_SYMID_sin = 178,
-  MRBC_SYMID_sinh = 179,
-  MRBC_SYMID_size = 180,
-  MRBC_SYMID_slice_E = 181,
-  MRBC_SYMID_sort = 182,
-  MRBC_SYMID_sort_E = 183,
-  MRBC_SYMID_split = 184,
-  MRBC_SYMID_sprintf = 185,
-  MRBC_SYMID_sqrt = 186,
-  MRBC_SYMID_start_with_Q = 187,
-  MRBC_SYMID_status = 188,
-  MRBC_SYMID_strip = 189,
-  MRBC_SYMID_strip_E = 190,
-  MRBC_SYMID_suspend = 191,
-  MRBC_SYMID_tan = 192,
-  MRBC_SYMID_tanh = 193,
-  MRBC_SYMID_terminate = 194,
-  MRBC_SYMID_tick = 195,
-  MRBC_SYMID_times = 196,
-  MRBC_SYMID_to_a = 197,
-  MRBC_SYMID_to_f = 198,
-  MRBC_SYMID_to_h = 199,
-  MRBC_SYMID_to_i = 200,
-  MRBC_SYMID_to_s = 201,
-  MRBC_SYMID_to_sym = 202,
-  MRBC_SYMID_tr = 203,
-  MRBC_SYMID_tr_E = 204,
-  MRBC_SYMID_try_lock = 205,
-  MRBC_SYMID_unlock = 206,
-  MRBC_SYMID_unshift = 207,
-  MRBC_SYMID_upcase = 208,
-  MRBC_SYMID_upcase_E = 209,
-  MRBC_SYMID_upto = 210,
-  MRBC_SYMID_value = 211,
-  MRBC_SYMID_values = 212,
-  MRBC_SYMID_OR = 213,
-  MRBC_SYMID_NEG = 214,
+  MRBC_SYMID_ADC = 21,
+  MRBC_SYMID_ArgumentError = 22,
+  MRBC_SYMID_Array = 23,
+  MRBC_SYMID_E = 24,
+  MRBC_SYMID_Encoder = 25,
+  MRBC_SYMID_Exception = 26,
+  MRBC_SYMID_FalseClass = 27,
+  MRBC_SYMID_Float = 28,
+  MRBC_SYMID_GPIO = 29,
+  MRBC_SYMID_Hash = 30,
+  MRBC_SYMID_I2C = 31,
+  MRBC_SYMID_IndexError = 32,
+  MRBC_SYMID_InputCapture = 33,
+  MRBC_SYMID_Integer = 34,
+  MRBC_SYMID_MRUBYC_VERSION = 35,
+  MRBC_SYMID_MRUBY_VERSION = 36,
+  MRBC_SYMID_Math = 37,
+  MRBC_SYMID_Mutex = 38,
+  MRBC_SYMID_NameError = 39,
+  MRBC_SYMID_NilClass = 40,
+  MRBC_SYMID_NoMemoryError = 41,
+  MRBC_SYMID_NoMethodError = 42,
+  MRBC_SYMID_NotImplementedError = 43,
+  MRBC_SYMID_Object = 44,
+  MRBC_SYMID_PI = 45,
+  MRBC_SYMID_PWM = 46,
+  MRBC_SYMID_Proc = 47,
+  MRBC_SYMID_RUBY_ENGINE = 48,
+  MRBC_SYMID_RUBY_VERSION = 49,
+  MRBC_SYMID_Range = 50,
+  MRBC_SYMID_RangeError = 51,
+  MRBC_SYMID_RuntimeError = 52,
+  MRBC_SYMID_SPI = 53,
+  MRBC_SYMID_StandardError = 54,
+  MRBC_SYMID_String = 55,
+  MRBC_SYMID_Symbol = 56,
+  MRBC_SYMID_System = 57,
+  MRBC_SYMID_SystemStackError = 58,
+  MRBC_SYMID_Task = 59,
+  MRBC_SYMID_TrueClass = 60,
+  MRBC_SYMID_TypeError = 61,
+  MRBC_SYMID_UART = 62,
+  MRBC_SYMID_VM = 63,
+  MRBC_SYMID_ZeroDivisionError = 64,
+  MRBC_SYMID_BL_BR = 65,
+  MRBC_SYMID_BL_BR_EQ = 66,
+  MRBC_SYMID_XOR = 67,
+  MRBC_SYMID___ljust_rjust_argcheck = 68,
+  MRBC_SYMID_abs = 69,
+  MRBC_SYMID_acos = 70,
+  MRBC_SYMID_acosh = 71,
+  MRBC_SYMID_all_Q = 72,
+  MRBC_SYMID_all_symbols = 73,
+  MRBC_SYMID_any_Q = 74,
+  MRBC_SYMID_asin = 75,
+  MRBC_SYMID_asinh = 76,
+  MRBC_SYMID_at = 77,
+  MRBC_SYMID_atan = 78,
+  MRBC_SYMID_atan2 = 79,
+  MRBC_SYMID_atanh = 80,
+  MRBC_SYMID_attr_accessor = 81,
+  MRBC_SYMID_attr_reader = 82,
+  MRBC_SYMID_average = 83,
+  MRBC_SYMID_b = 84,
+  MRBC_SYMID_block_given_Q = 85,
+  MRBC_SYMID_bytes = 86,
+  MRBC_SYMID_bytes_available = 87,
+  MRBC_SYMID_bytes_to_write = 88,
+  MRBC_SYMID_call = 89,
+  MRBC_SYMID_can_read_line = 90,
+  MRBC_SYMID_cbrt = 91,
+  MRBC_SYMID_chomp = 92,
+  MRBC_SYMID_chomp_E = 93,
+  MRBC_SYMID_chr = 94,
+  MRBC_SYMID_clamp = 95,
+  MRBC_SYMID_class = 96,
+  MRBC_SYMID_clear = 97,
+  MRBC_SYMID_clear_rx_buffer = 98,
+  MRBC_SYMID_clear_tx_buffer = 99,
+  MRBC_SYMID_clock = 100,
+  MRBC_SYMID_clock_EQ = 101,
+  MRBC_SYMID_collect = 102,
+  MRBC_SYMID_collect_E = 103,
+  MRBC_SYMID_cos = 104,
+  MRBC_SYMID_cosh = 105,
+  MRBC_SYMID_count = 106,
+  MRBC_SYMID_create = 107,
+  MRBC_SYMID_current = 108,
+  MRBC_SYMID_delete = 109,
+  MRBC_SYMID_delete_at = 110,
+  MRBC_SYMID_delete_if = 111,
+  MRBC_SYMID_downcase = 112,
+  MRBC_SYMID_downcase_E = 113,
+  MRBC_SYMID_downto = 114,
+  MRBC_SYMID_dup = 115,
+  MRBC_SYMID_duty = 116,
+  MRBC_SYMID_duty_u16_EQ = 117,
+  MRBC_SYMID_each = 118,
+  MRBC_SYMID_each_byte = 119,
+  MRBC_SYMID_each_char = 120,
+  MRBC_SYMID_each_index = 121,
+  MRBC_SYMID_each_with_index = 122,
+  MRBC_SYMID_empty_Q = 123,
+  MRBC_SYMID_end_with_Q = 124,
+  MRBC_SYMID_erf = 125,
+  MRBC_SYMID_erfc = 126,
+  MRBC_SYMID_every = 127,
+  MRBC_SYMID_exclude_end_Q = 128,
+  MRBC_SYMID_exp = 129,
+  MRBC_SYMID_find_index = 130,
+  MRBC_SYMID_first = 131,
+  MRBC_SYMID_flush = 132,
+  MRBC_SYMID_frequency = 133,
+  MRBC_SYMID_get = 134,
+  MRBC_SYMID_getbyte = 135,
+  MRBC_SYMID_gets = 136,
+  MRBC_SYMID_gets_into = 137,
+  MRBC_SYMID_has_key_Q = 138,
+  MRBC_SYMID_has_value_Q = 139,
+  MRBC_SYMID_high_Q = 140,
+  MRBC_SYMID_high_at_Q = 141,
+  MRBC_SYMID_hypot = 142,
+  MRBC_SYMID_id2name = 143,
+  MRBC_SYMID_include_Q = 144,
+  MRBC_SYMID_index = 145,
+  MRBC_SYMID_initialize = 146,
+  MRBC_SYMID_inspect = 147,
+  MRBC_SYMID_instance_methods = 148,
+  MRBC_SYMID_instance_variables = 149,
+  MRBC_SYMID_intern = 150,
+  MRBC_SYMID_irq = 151,
+  MRBC_SYMID_is_a_Q = 152,
+  MRBC_SYMID_join = 153,
+  MRBC_SYMID_key = 154,
+  MRBC_SYMID_keys = 155,
+  MRBC_SYMID_kind_of_Q = 156,
+  MRBC_SYMID_last = 157,
+  MRBC_SYMID_ldexp = 158,
+  MRBC_SYMID_length = 159,
+  MRBC_SYMID_list = 160,
+  MRBC_SYMID_listen = 161,
+  MRBC_SYMID_listen_status = 162,
+  MRBC_SYMID_ljust = 163,
+  MRBC_SYMID_lock = 164,
+  MRBC_SYMID_locked_Q = 165,
+  MRBC_SYMID_log = 166,
+  MRBC_SYMID_log10 = 167,
+  MRBC_SYMID_log2 = 168,
+  MRBC_SYMID_loop = 169,
+  MRBC_SYMID_low_Q = 170,
+  MRBC_SYMID_low_at_Q = 171,
+  MRBC_SYMID_lstrip = 172,
+  MRBC_SYMID_lstrip_E = 173,
+  MRBC_SYMID_map = 174,
+  MRBC_SYMID_map_E = 175,
+  MRBC_SYMID_max = 176,
+  MRBC_SYMID_mean = 177,
+  MRBC_SYMID_memory_statistics = 178,
+  MRBC_SYMID_merge = 179,
+  MRBC_SYMID_merge_E = 180,
+  MRBC_SYMID_message = 181,
+  MRBC_SYMID_min = 182,
+  MRBC_SYMID_minmax = 183,
+  MRBC_SYMID_name = 184,
+  MRBC_SYMID_name_EQ = 185,
+  MRBC_SYMID_name_list = 186,
+  MRBC_SYMID_new = 187,
+  MRBC_SYMID_nil_Q = 188,
+  MRBC_SYMID_notify = 189,
+  MRBC_SYMID_notify_low_memory = 190,
+  MRBC_SYMID_object_id = 191,
+  MRBC_SYMID_ord = 192,
+  MRBC_SYMID_owned_Q = 193,
+  MRBC_SYMID_p = 194,
+  MRBC_SYMID_pack = 195,
+  MRBC_SYMID_pass = 196,
+  MRBC_SYMID_period = 197,
+  MRBC_SYMID_period_ticks = 198,
+  MRBC_SYMID_period_us = 199,
+  MRBC_SYMID_play_port = 200,
+  MRBC_SYMID_pool = 201,
+  MRBC_SYMID_pop = 202,
+  MRBC_SYMID_position = 203,
+  MRBC_SYMID_position_EQ = 204,
+  MRBC_SYMID_print = 205,
+  MRBC_SYMID_printf = 206,
+  MRBC_SYMID_priority = 207,
+  MRBC_SYMID_priority_EQ = 208,
+  MRBC_SYMID_pulse_ticks_EQ = 209,
+  MRBC_SYMID_pulse_width_us = 210,
+  MRBC_SYMID_push = 211,
+  MRBC_SYMID_puts = 212,
+  MRBC_SYMID_raise = 213,
+  MRBC_SYMID_read = 214,
+  MRBC_SYMID_read_at = 215,
+  MRBC_SYMID_read_frame = 216,
+  MRBC_SYMID_read_into = 217,
+  MRBC_SYMID_read_latest = 218,
+  MRBC_SYMID_read_packet = 219,
+  MRBC_SYMID_read_port = 220,
+  MRBC_SYMID_read_raw = 221,
+  MRBC_SYMID_read_samples = 222,
+  MRBC_SYMID_read_scan = 223,
+  MRBC_SYMID_read_voltage = 224,
+  MRBC_SYMID_reject = 225,
+  MRBC_SYMID_reject_E = 226,
+  MRBC_SYMID_resume = 227,
+  MRBC_SYMID_rewind = 228,
+  MRBC_SYMID_rjust = 229,
+  MRBC_SYMID_rstrip = 230,
+  MRBC_SYMID_rstrip_E = 231,
+  MRBC_SYMID_run = 232,
+  MRBC_SYMID_rx_buffer_size = 233,
+  MRBC_SYMID_rx_lost = 234,
+  MRBC_SYMID_rx_overrun = 235,
+  MRBC_SYMID_sample_port = 236,
+  MRBC_SYMID_sample_time = 237,
+  MRBC_SYMID_sample_time_EQ = 238,
+  MRBC_SYMID_send_break = 239,
+  MRBC_SYMID_setmode = 240,
+  MRBC_SYMID_setmode_port = 241,
+  MRBC_SYMID_shift = 242,
+  MRBC_SYMID_sin = 243,
+  MRBC_SYMID_sinh = 244,
+  MRBC_SYMID_size = 245,
+  MRBC_SYMID_slice_E = 246,
+  MRBC_SYMID_sort = 247,
+  MRBC_SYMID_sort_E = 248,
+  MRBC_SYMID_split = 249,
+  MRBC_SYMID_sprintf = 250,
+  MRBC_SYMID_sqrt = 251,
+  MRBC_SYMID_stack_size = 252,
+  MRBC_SYMID_stack_used = 253,
+  MRBC_SYMID_start_scan = 254,
+  MRBC_SYMID_start_with_Q = 255,
+  MRBC_SYMID_status = 256,
+  MRBC_SYMID_stop = 257,
+  MRBC_SYMID_stop_scan = 258,
+  MRBC_SYMID_strip = 259,
+  MRBC_SYMID_strip_E = 260,
+  MRBC_SYMID_sum = 261,
+  MRBC_SYMID_suspend = 262,
+  MRBC_SYMID_tan = 263,
+  MRBC_SYMID_tanh = 264,
+  MRBC_SYMID_terminate = 265,
+  MRBC_SYMID_tick = 266,
+  MRBC_SYMID_times = 267,
+  MRBC_SYMID_timeslice = 268,
+  MRBC_SYMID_timeslice_EQ = 269,
+  MRBC_SYMID_to_a = 270,
+  MRBC_SYMID_to_f = 271,
+  MRBC_SYMID_to_h = 272,
+  MRBC_SYMID_to_i = 273,
+  MRBC_SYMID_to_s = 274,
+  MRBC_SYMID_to_sym = 275,
+  MRBC_SYMID_tr = 276,
+  MRBC_SYMID_tr_E = 277,
+  MRBC_SYMID_transaction = 278,
+  MRBC_SYMID_transfer = 279,
+  MRBC_SYMID_try_lock = 280,
+  MRBC_SYMID_unlisten = 281,
+  MRBC_SYMID_unlock = 282,
+  MRBC_SYMID_unpack = 283,
+  MRBC_SYMID_unshift = 284,
+  MRBC_SYMID_upcase = 285,
+  MRBC_SYMID_upcase_E = 286,
+  MRBC_SYMID_upto = 287,
+  MRBC_SYMID_value = 288,
+  MRBC_SYMID_values = 289,
+  MRBC_SYMID_wait_edge = 290,
+  MRBC_SYMID_wait_event = 291,
+  MRBC_SYMID_wait_half = 292,
+  MRBC_SYMID_width = 293,
+  MRBC_SYMID_write = 294,
+  MRBC_SYMID_write_at = 295,
+  MRBC_SYMID_write_duty_u16 = 296,
+  MRBC_SYMID_write_packet = 297,
+  MRBC_SYMID_write_port = 298,
+  MRBC_SYMID_OR = 299,
+  MRBC_SYMID_NEG = 300,
 };
 
 #define MRB_SYM(sym)  MRBC_SYMID_##sym
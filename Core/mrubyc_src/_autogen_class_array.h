@@ -25,13 +25,20 @@ static const mrbc_sym method_symbols_Array[] = {
   MRBC_SYM(last),
   MRBC_SYM(length),
   MRBC_SYM(max),
+#if MRBC_USE_FLOAT
+  MRBC_SYM(mean),
+#endif
   MRBC_SYM(min),
   MRBC_SYM(minmax),
   MRBC_SYM(new),
+#if MRBC_USE_STRING
+  MRBC_SYM(pack),
+#endif
   MRBC_SYM(pop),
   MRBC_SYM(push),
   MRBC_SYM(shift),
   MRBC_SYM(size),
+  MRBC_SYM(sum),
 #if MRBC_USE_STRING
   MRBC_SYM(to_s),
 #endif
@@ -62,13 +69,20 @@ static const mrbc_func_t method_functions_Array[] = {
   c_array_last,
   c_array_size,
   c_array_max,
+#if MRBC_USE_FLOAT
+  c_array_mean,
+#endif
   c_array_min,
   c_array_minmax,
   c_array_new,
+#if MRBC_USE_STRING
+  c_array_pack,
+#endif
   c_array_pop,
   c_array_push,
   c_array_shift,
   c_array_size,
+  c_array_sum,
 #if MRBC_USE_STRING
   c_array_inspect,
 #endif
@@ -46,6 +46,17 @@ struct RClass mrbc_class_NotImplementedError = {
 #endif
 };
 
+/*===== SystemStackError class =====*/
+struct RClass mrbc_class_SystemStackError = {
+  .sym_id = MRBC_SYM(SystemStackError),
+  .num_builtin_method = 0,
+  .super = MRBC_CLASS(Exception),
+  .method_link = 0,
+#if defined(MRBC_DEBUG)
+  .name = "SystemStackError",
+#endif
+};
+
 /*===== StandardError class =====*/
 struct RClass mrbc_class_StandardError = {
   .sym_id = MRBC_SYM(StandardError),
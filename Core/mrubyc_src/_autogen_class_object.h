@@ -35,6 +35,9 @@ static const mrbc_sym method_symbols_Object[] = {
   MRBC_SYM(object_id),
 #endif
   MRBC_SYM(p),
+#if defined(MRBC_USE_OBJECT_POOL)
+  MRBC_SYM(pool),
+#endif
   MRBC_SYM(print),
 #if MRBC_USE_STRING
   MRBC_SYM(printf),
@@ -82,6 +85,9 @@ static const mrbc_func_t method_functions_Object[] = {
   c_object_object_id,
 #endif
   c_object_p,
+#if defined(MRBC_USE_OBJECT_POOL)
+  c_object_pool,
+#endif
   c_object_print,
 #if MRBC_USE_STRING
   c_object_printf,
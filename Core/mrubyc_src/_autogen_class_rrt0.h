@@ -5,12 +5,14 @@
 static const mrbc_sym method_symbols_Task[] = {
   MRBC_SYM(create),
   MRBC_SYM(current),
+  MRBC_SYM(every),
   MRBC_SYM(get),
   MRBC_SYM(join),
   MRBC_SYM(list),
   MRBC_SYM(name),
   MRBC_SYM(name_EQ),
   MRBC_SYM(name_list),
+  MRBC_SYM(notify),
   MRBC_SYM(pass),
   MRBC_SYM(priority),
   MRBC_SYM(priority_EQ),
@@ -21,18 +23,23 @@ static const mrbc_sym method_symbols_Task[] = {
   MRBC_SYM(status),
   MRBC_SYM(suspend),
   MRBC_SYM(terminate),
+  MRBC_SYM(timeslice),
+  MRBC_SYM(timeslice_EQ),
   MRBC_SYM(value),
+  MRBC_SYM(wait_event),
 };
 
 static const mrbc_func_t method_functions_Task[] = {
   c_task_create,
   c_task_get,
+  c_task_every,
   c_task_get,
   c_task_join,
   c_task_list,
   c_task_name,
   c_task_set_name,
   c_task_name_list,
+  c_task_notify,
   c_task_pass,
   c_task_priority,
   c_task_set_priority,
@@ -43,7 +50,10 @@ static const mrbc_func_t method_functions_Task[] = {
   c_task_status,
   c_task_suspend,
   c_task_terminate,
+  c_task_timeslice,
+  c_task_set_timeslice,
   c_task_value,
+  c_task_wait_event,
 };
 
 struct RBuiltinClass mrbc_class_Task = {
@@ -44,6 +44,7 @@ static const mrbc_sym method_symbols_String[] = {
   MRBC_SYM(to_sym),
   MRBC_SYM(tr),
   MRBC_SYM(tr_E),
+  MRBC_SYM(unpack),
   MRBC_SYM(upcase),
   MRBC_SYM(upcase_E),
 };
@@ -90,6 +91,7 @@ static const mrbc_func_t method_functions_String[] = {
   c_string_to_sym,
   c_string_tr,
   c_string_tr_self,
+  c_string_unpack,
   c_string_upcase,
   c_string_upcase_self,
 };
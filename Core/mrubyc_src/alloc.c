@@ -12,6 +12,46 @@
 
   STRATEGY
    Using TLSF and FistFit algorithm.
+   Optionally, small fixed size objects are served from size-class slabs
+   carved out of the memory pool. (see MRBC_ALLOC_SLAB)
+   Optionally, each VM can reserve its own arena, that is a sub memory pool
+   carved out of the memory pool, or another memory given by the
+   application. (see MRBC_ALLOC_ARENA)
+   Permanent objects (classes, methods, symbols, ...) are packed into
+   the sentinel block, that grows downward from the tail of the pool.
+   (see mrbc_raw_alloc_no_free)
+   Optionally, the allocation site of each live block is recorded for
+   the heap report. (see MRBC_ALLOC_TRACE)
+   Optionally, alloc/free/realloc events are recorded in a ring buffer or
+   streamed out, for tools/alloc_event_decode.rb. (see MRBC_ALLOC_EVENT_LOG)
+   The high-water mark and allocation counters are kept always, and
+   optionally for each VM ID, with the quota of used bytes.
+   (see MRBC_ALLOC_VM_STATS)
+   Optionally, the count and the maximum cycles of each operation are
+   kept. (see MRBC_ALLOC_TIMING)
+   Optionally, the data buffers of String, Array and Hash are slid into
+   the free block before them while no task is ready, so that the free
+   blocks are merged. (see MRBC_ALLOC_COMPACT)
+
+  TIME BOUNDS
+   mrbc_raw_alloc: two free list heads, two bitmap searches (NLZ) and a
+     split. With MRBC_ALLOC_SLAB, a new slab page links
+     MRBC_ALLOC_SLAB_ITEMS items.
+   mrbc_raw_free: a slab item, or two merges and a free list insertion.
+   mrbc_raw_realloc: in place, or mrbc_raw_alloc + copy of the old size
+     + mrbc_raw_free.
+   Not bounded by a constant:
+   - the first-fit search in the free list of the same size class, when
+     the bitmaps find no block. (not done with MRBC_ALLOC_REALTIME)
+   - the caches eviction and the low memory hook at the out of memory.
+     (not done with MRBC_ALLOC_REALTIME)
+   - mrbc_free_all, that scans the whole pool at the end of a VM.
+  - mrbc_alloc_compact_step, that scans the whole pool and moves a block.
+   - the double free check with MRBC_DEBUG, that scans the whole pool.
+     (only the free flag is checked with MRBC_ALLOC_REALTIME)
+   - MRBC_ALLOC_TRACE.
+   With MRBC_ALLOC_REALTIME, an allocation that needs the first-fit
+   search fails, even if a block could be found by it.
 
   MEMORY POOL USAGE (see struct MEMORY_POOL)
      | Memory pool header | Memory blocks to provide to application     |
@@ -54,7 +94,15 @@
 /***** Local headers ********************************************************/
 #include "alloc.h"
 #include "hal.h"
-#if defined(MRBC_DEBUG)
+#if defined(MRBC_ALLOC_VMID)
+#include "vm.h"
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+#include "value.h"
+#include "class.h"
+#include "error.h"
+#endif
+#if defined(MRBC_DEBUG) || defined(MRBC_ALLOC_EVENT_LOG)
 #include "console.h"
 #endif
 
@@ -98,6 +146,66 @@
 // #define MRBC_MIN_MEMORY_BLOCK_SIZE (1 << MRBC_ALLOC_IGNORE_LSBS)
 #endif
 
+/*
+  Slab size classes. (usable size, ascending order, max 252)
+  and number of items in one slab page. (max 255)
+*/
+#if defined(MRBC_ALLOC_SLAB)
+#if !defined(MRBC_ALLOC_SLAB_SIZES)
+#define MRBC_ALLOC_SLAB_SIZES	8, 12, 16, 20, 24, 32
+#endif
+#if !defined(MRBC_ALLOC_SLAB_ITEMS)
+#define MRBC_ALLOC_SLAB_ITEMS	8
+#endif
+#endif
+
+/*
+  Allocation trace table size, history of the largest free block,
+  and the sampling interval (number of allocations) of the history.
+*/
+#if defined(MRBC_ALLOC_TRACE)
+#if !defined(MRBC_ALLOC_TRACE_SIZE)
+#define MRBC_ALLOC_TRACE_SIZE		256
+#endif
+#if !defined(MRBC_ALLOC_TRACE_HISTORY)
+#define MRBC_ALLOC_TRACE_HISTORY	8
+#endif
+#if !defined(MRBC_ALLOC_TRACE_INTERVAL)
+#define MRBC_ALLOC_TRACE_INTERVAL	1024
+#endif
+#endif
+
+/*
+  Allocation event ring buffer size (number of events),
+  and the clocks to make a time stamp and a latency.
+*/
+#if defined(MRBC_ALLOC_EVENT_LOG)
+#if !defined(MRBC_ALLOC_EVENT_LOG_SIZE)
+#define MRBC_ALLOC_EVENT_LOG_SIZE	128
+#endif
+#if !defined(hal_event_tick)
+#define hal_event_tick()	0
+#endif
+#endif
+#if defined(MRBC_ALLOC_EVENT_LOG) || defined(MRBC_ALLOC_TIMING)
+#if !defined(hal_cycle_count)
+#define hal_cycle_count()	0
+#endif
+#endif
+
+/*
+  Number of the relocatable buffers that the compactor knows.
+*/
+#if defined(MRBC_ALLOC_COMPACT)
+#if !defined(MRBC_ALLOC_COMPACT_SLOTS)
+#define MRBC_ALLOC_COMPACT_SLOTS	32
+#endif
+#endif
+
+#if defined(MRBC_ALLOC_REALTIME) && defined(MRBC_ALLOC_LIBC)
+#error "MRBC_ALLOC_REALTIME can't be used with MRBC_ALLOC_LIBC."
+#endif
+
 
 /***** Macros ***************************************************************/
 #define FLI(x) ((x) >> MRBC_ALLOC_SLI_BIT_WIDTH)
@@ -212,6 +320,8 @@ typedef struct MEMORY_POOL {
 
   // free memory block index
   FREE_BLOCK *free_blocks[SIZE_FREE_BLOCKS +1];	// +1=sentinel
+
+  MRBC_ALLOC_MEMSIZE_T free_size;	// total size of free blocks.
 } MEMORY_POOL;
 
 #define BLOCK_TOP(p) ((void *)((uint8_t *)(p) + sizeof(MEMORY_POOL)))
@@ -223,11 +333,226 @@ typedef struct MEMORY_POOL {
 #define NLZ_SLI(x) nlz8(x)
 
 
+#if defined(MRBC_ALLOC_SLAB)
+/*
+  define slab page header
+
+  A slab page is a used block of the memory pool, divided into fixed
+  size items. Each item has a USED_BLOCK compatible header for vm_id,
+  and its size member holds the following instead of the block size.
+
+    bit 0   : always 0. (TLSF used block always 1)
+    bit 1   : 1 = used item, 0 = free item.
+    bit 2-7 : size class index.
+    bit 8-  : item index in the page.
+*/
+typedef struct SLAB_PAGE {
+  struct SLAB_PAGE *next;	//!< next page of the same size class.
+  USED_BLOCK *free_item;	//!< linked list of free items in this page.
+  uint16_t n_used;		//!< number of used items.
+  uint8_t  class_idx;		//!< size class index.
+  uint8_t  pad[1];
+} SLAB_PAGE;
+
+#define SLAB_ITEM_HEADER(cls,idx) (((idx) << 8) | ((cls) << 2))
+#define IS_SLAB_ITEM(p)		(((p)->size & 0x03) == 0x02)
+#define SLAB_CLASS_IDX(p)	(((p)->size >> 2) & 0x3f)
+#define SLAB_ITEM_IDX(p)	((p)->size >> 8)
+#define SLAB_ITEM_SIZE(cls)	((sizeof(USED_BLOCK) + slab_sizes[cls] + 3) & ~3)
+#define SLAB_USABLE_SIZE(cls)	(SLAB_ITEM_SIZE(cls) - sizeof(USED_BLOCK))
+#define SLAB_NEXT_FREE(p)	(*(USED_BLOCK **)((uint8_t *)(p) + sizeof(USED_BLOCK)))
+#define SLAB_NUM_CLASSES	(sizeof(slab_sizes) / sizeof(slab_sizes[0]))
+#endif
+
+
+#if defined(MRBC_ALLOC_ARENA)
+/*
+  define per-VM arena
+
+  An arena is a used block of the memory pool, that initialized as
+  another memory pool. mrbc_alloc() of the owner VM allocates from it,
+  and mrbc_free_all() resets it at once if all blocks belong to the owner.
+  An external arena is a memory outside of the memory pool, so the other
+  VMs can't exhaust it. (see mrbc_alloc_arena_attach)
+*/
+typedef struct ALLOC_ARENA {
+  MEMORY_POOL *pool;		//!< arena memory pool, or NULL if unused.
+  uint8_t  vm_id;		//!< owner VM ID, 0 if detached.
+  uint8_t  flag_spilled;	//!< owner VM also used the memory pool.
+  uint8_t  flag_external;	//!< not a block of the memory pool.
+  uint16_t n_foreign;		//!< number of blocks owned by other VM ID.
+} ALLOC_ARENA;
+#endif
+
+
+#if defined(MRBC_ALLOC_COMPACT)
+/*
+  define relocatable buffer entry
+
+  A pointer member of the object that holds its own buffer, such as the
+  data of String. The compactor moves the buffer, and rewrites the member.
+  The entry is found by the buffer address, so a member pointing into
+  the middle of the buffer (e.g. Array after shift) is not moved.
+*/
+typedef struct ALLOC_COMPACT_SLOT {
+  void *obj;		//!< owner object, to be dropped with its VM ID.
+  void **slot;		//!< pointer member of the owner, or NULL if unused.
+} ALLOC_COMPACT_SLOT;
+#endif
+
+
+#if defined(MRBC_ALLOC_TRACE)
+/*
+  define allocation trace entry
+
+  site is an irep and pc is the byte offset of the instruction,
+  if allocated by VM. Otherwise, site is the return address of the
+  caller and pc is TRACE_PC_CFUNC.
+*/
+typedef struct ALLOC_TRACE {
+  void *ptr;			//!< allocated memory, or NULL if empty.
+  const void *site;		//!< irep or C caller address.
+  uint16_t pc;			//!< instruction offset in irep.
+} ALLOC_TRACE;
+
+#define TRACE_DELETED	((void *)1)
+#define TRACE_PC_CFUNC	0xffff
+#endif
+
+
+#if defined(MRBC_ALLOC_EVENT_LOG)
+/*
+  define allocation event (16 bytes, little endian)
+
+  ofs is (address - memory pool) / 4, or 0xffff if NULL (out of memory).
+  cycles is the time spent in the allocator, in hal_cycle_count() unit.
+  In case of ALLOC_EVENT_RESET, all blocks in ofs..(ofs + size/4) are
+  released at once (arena reset).
+*/
+typedef struct ALLOC_EVENT {
+  uint32_t tick;		//!< hal_event_tick()
+  uint32_t caller;		//!< return address of the caller.
+  uint16_t ofs;			//!< offset of the memory block.
+  uint16_t size;		//!< request size.
+  uint16_t cycles;		//!< latency.
+  uint8_t  op;			//!< ALLOC_EVENT_*
+  uint8_t  vm_id;		//!< VM ID
+} ALLOC_EVENT;
+
+#define ALLOC_EVENT_ALLOC	'A'
+#define ALLOC_EVENT_FREE	'F'
+#define ALLOC_EVENT_REALLOC	'R'
+#define ALLOC_EVENT_NO_FREE	'N'
+#define ALLOC_EVENT_RESET	'X'
+#endif
+
+
+#if defined(MRBC_ALLOC_VM_STATS)
+/*
+  define allocation counters of VM ID
+
+  A block passed to another VM ID by mrbc_set_vm_id() is counted as
+  released by the former, and allocated by the latter.
+*/
+typedef struct ALLOC_VM_STATS {
+  MRBC_ALLOC_MEMSIZE_T used;	//!< used bytes, header included.
+  MRBC_ALLOC_MEMSIZE_T peak;	//!< high-water mark of used.
+  uint32_t n_alloc;		//!< number of allocated blocks.
+  uint32_t n_free;		//!< number of released blocks.
+  uint32_t alloc_bytes;		//!< total allocated bytes.
+  MRBC_ALLOC_MEMSIZE_T quota;	//!< limit of used, or 0 if unlimited.
+  uint32_t n_quota_over;	//!< number of allocations over the quota.
+} ALLOC_VM_STATS;
+#endif
+
+
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
 // memory pool
 static MEMORY_POOL *memory_pool;
 
+// sentinel block of the memory pool, that holds permanent objects.
+static USED_BLOCK *permanent_block;
+
+// high-water mark of the memory pool, header included.
+static MRBC_ALLOC_MEMSIZE_T peak_used;
+
+// allocation counters since mrbc_init_alloc(). (wrap around)
+static uint32_t n_alloc_total;
+static uint32_t n_free_total;
+static uint32_t alloc_bytes_total;
+
+#if defined(MRBC_ALLOC_VM_STATS)
+static ALLOC_VM_STATS vm_stats[MAX_VM_COUNT + 1];	// [0] is not owned.
+#endif
+
+#if defined(MRBC_ALLOC_PERMANENT_SIZE)
+// reserved area for permanent objects.
+static uint8_t *permanent_reserve;
+static unsigned int permanent_reserve_size;
+#endif
+
+// evictable caches, in the order of the priority.
+static mrbc_alloc_cache *cache_head;
+#if !defined(MRBC_ALLOC_REALTIME)
+static uint8_t flag_evicting;	//!< in the eviction.
+#endif
+
+// low memory hook, and it was called below the threshold.
+static void (*low_memory_hook)(unsigned int free_size);
+static unsigned int low_memory_threshold;
+static uint8_t low_memory_fired;
+
+#if defined(MRBC_ALLOC_EMERGENCY_SIZE)
+// reserved block, released at the out of memory.
+static void *emergency_block;
+#endif
+
+#if defined(MRBC_ALLOC_SLAB)
+// slab size classes and pages.
+static const uint8_t slab_sizes[] = { MRBC_ALLOC_SLAB_SIZES };
+static SLAB_PAGE *slab_pages[SLAB_NUM_CLASSES];
+#endif
+
+#if defined(MRBC_ALLOC_ARENA)
+// per-VM arenas.
+static ALLOC_ARENA arenas[MAX_VM_COUNT];
+#endif
+
+#if defined(MRBC_ALLOC_COMPACT)
+// relocatable buffers, and the number of used entries at most.
+static ALLOC_COMPACT_SLOT compact_slots[MRBC_ALLOC_COMPACT_SLOTS];
+static unsigned int compact_n_slots;
+#endif
+
+#if defined(MRBC_ALLOC_TRACE)
+// live blocks and the largest free block history.
+static ALLOC_TRACE alloc_trace[MRBC_ALLOC_TRACE_SIZE];
+static unsigned int trace_overflow;
+static unsigned int trace_oom;
+static uint32_t trace_alloc_count;
+static unsigned int trace_largest_min;
+static uint16_t trace_largest_history[MRBC_ALLOC_TRACE_HISTORY];
+#endif
+
+#if defined(MRBC_ALLOC_EVENT_LOG)
+// event ring buffer. (not used if MRBC_ALLOC_EVENT_OUTPUT is defined)
+#if !defined(MRBC_ALLOC_EVENT_OUTPUT)
+#if defined(MRBC_ALLOC_EVENT_LOG_SECTION)
+__attribute__((section(MRBC_ALLOC_EVENT_LOG_SECTION)))
+#endif
+static ALLOC_EVENT alloc_event_log[MRBC_ALLOC_EVENT_LOG_SIZE];
+#endif
+static uint32_t event_count;	//!< total number of events.
+static uint8_t  event_depth;	//!< nesting level of the allocator API.
+#endif
+
+#if defined(MRBC_ALLOC_TIMING)
+// cycles of each operation.
+static struct MRBC_ALLOC_TIMING_STAT alloc_timing[MRBC_ALLOC_TIMING_NUM];
+static uint8_t timing_depth;	//!< nesting level of the allocator API.
+#endif
+
 
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
@@ -309,6 +634,7 @@ static inline unsigned int calc_index(MRBC_ALLOC_MEMSIZE_T alloc_size)
 static void add_free_block(MEMORY_POOL *pool, FREE_BLOCK *target)
 {
   SET_FREE_BLOCK(target);
+  pool->free_size += BLOCK_SIZE(target);
 
   FREE_BLOCK **top_adrs = (FREE_BLOCK **)((uint8_t*)target + BLOCK_SIZE(target) - sizeof(FREE_BLOCK *));
   *top_adrs = target;
@@ -338,6 +664,8 @@ static void add_free_block(MEMORY_POOL *pool, FREE_BLOCK *target)
 */
 static void remove_free_block(MEMORY_POOL *pool, FREE_BLOCK *target)
 {
+  pool->free_size -= BLOCK_SIZE(target);
+
   // top of linked list?
   if( target->prev_free == NULL ) {
     unsigned int index = calc_index(BLOCK_SIZE(target));
@@ -399,441 +727,1966 @@ static inline void merge_block(FREE_BLOCK *target, FREE_BLOCK *next)
 }
 
 
-/***** Global functions *****************************************************/
+#if defined(MRBC_ALLOC_TRACE)
 //================================================================
-/*! initialize
+/*! get the largest free block size in the pool.
 
-  @param  ptr	pointer to free memory block.
-  @param  size	size. (max 64KB. see MRBC_ALLOC_MEMSIZE_T)
+  @param  pool		pointer to memory pool.
+  @return		block size.
 */
-void mrbc_init_alloc(void *ptr, unsigned int size)
+static unsigned int largest_free_block(const MEMORY_POOL *pool)
 {
-  assert( MRBC_MIN_MEMORY_BLOCK_SIZE >= sizeof(FREE_BLOCK) );
-  assert( MRBC_MIN_MEMORY_BLOCK_SIZE >= (1 << MRBC_ALLOC_IGNORE_LSBS) );
-  /*
-    If you get this assertion, you can change minimum memory block size
-    parameter to `MRBC_MIN_MEMORY_BLOCK_SIZE (1 << MRBC_ALLOC_IGNORE_LSBS)`
-    and #define MRBC_ALLOC_16BIT.
-  */
-
-  assert( (sizeof(MEMORY_POOL) & 0x03) == 0 );
-  assert( size != 0 );
-  assert( size <= (MRBC_ALLOC_MEMSIZE_T)(~0) );
+  int index;
+  for( index = SIZE_FREE_BLOCKS - 1; index >= 0; index-- ) {
+    if( pool->free_blocks[index] ) break;
+  }
+  if( index < 0 ) return 0;
 
-  if( memory_pool != NULL ) return;
-  size &= ~(unsigned int)0x03;	// align 4 byte.
-  memory_pool = ptr;
-  memset( memory_pool, 0, sizeof(MEMORY_POOL) );
-  memory_pool->size = size;
+  unsigned int max = 0;
+  const FREE_BLOCK *block;
+  for( block = pool->free_blocks[index]; block; block = block->next_free ) {
+    if( max < BLOCK_SIZE(block) ) max = BLOCK_SIZE(block);
+  }
+  return max;
+}
 
-  // initialize memory pool
-  //  large free block + zero size used block (sentinel).
-  MRBC_ALLOC_MEMSIZE_T sentinel_size = sizeof(USED_BLOCK);
-  sentinel_size += (-sentinel_size & 0x03);
-  MRBC_ALLOC_MEMSIZE_T free_size = size - sizeof(MEMORY_POOL) - sentinel_size;
-  FREE_BLOCK *free_block = BLOCK_TOP(memory_pool);
-  USED_BLOCK *used_block = (USED_BLOCK *)((uint8_t *)free_block + free_size);
 
-  free_block->size = free_size | 0x02;		// flag prev=1, used=0
-  used_block->size = sentinel_size | 0x01;	// flag prev=0, used=1
-  SET_VM_ID( used_block, 0xff );
+//================================================================
+/*! find the trace entry.
 
-  add_free_block( memory_pool, free_block );
+  @param  ptr		pointer to allocated memory.
+  @return		pointer to entry, or NULL if not found.
+*/
+static ALLOC_TRACE * trace_find(const void *ptr)
+{
+  unsigned int idx = ((uintptr_t)ptr >> 2) % MRBC_ALLOC_TRACE_SIZE;
+  unsigned int i;
+  for( i = 0; i < MRBC_ALLOC_TRACE_SIZE; i++ ) {
+    ALLOC_TRACE *t = &alloc_trace[idx];
+    if( t->ptr == ptr ) return t;
+    if( t->ptr == NULL ) break;
+    if( ++idx == MRBC_ALLOC_TRACE_SIZE ) idx = 0;
+  }
+  return NULL;
 }
 
 
 //================================================================
-/*! cleanup memory pool
+/*! record (or overwrite) an allocation site.
+
+  @param  ptr		pointer to allocated memory.
+  @param  site		irep or C caller address.
+  @param  pc		instruction offset, or TRACE_PC_CFUNC.
 */
-void mrbc_cleanup_alloc(void)
+static void trace_set(void *ptr, const void *site, unsigned int pc)
 {
-#if defined(MRBC_DEBUG)
-  if( memory_pool ) {
-    memset( memory_pool, 0, memory_pool->size );
+  ALLOC_TRACE *t = trace_find(ptr);
+  if( !t ) {
+    unsigned int idx = ((uintptr_t)ptr >> 2) % MRBC_ALLOC_TRACE_SIZE;
+    unsigned int i;
+    for( i = 0; i < MRBC_ALLOC_TRACE_SIZE; i++ ) {
+      if( alloc_trace[idx].ptr == NULL ||
+	  alloc_trace[idx].ptr == TRACE_DELETED ) break;
+      if( ++idx == MRBC_ALLOC_TRACE_SIZE ) idx = 0;
+    }
+    if( i == MRBC_ALLOC_TRACE_SIZE ) {	// table full.
+      trace_overflow++;
+      return;
+    }
+    t = &alloc_trace[idx];
+    t->ptr = ptr;
+  }
+  t->site = site;
+  t->pc = pc;
+
+  // sampling the largest free block.
+  unsigned int largest = largest_free_block(memory_pool);
+  if( trace_largest_min > largest ) trace_largest_min = largest;
+  if( (++trace_alloc_count % MRBC_ALLOC_TRACE_INTERVAL) == 0 ) {
+    memmove( trace_largest_history + 1, trace_largest_history,
+	     sizeof(trace_largest_history) - sizeof(uint16_t) );
+    trace_largest_history[0] = largest > UINT16_MAX ? UINT16_MAX : largest;
   }
-#endif
-
-  memory_pool = 0;
 }
 
 
 //================================================================
-/*! allocate memory
+/*! delete the trace entry.
 
-  @param  size	request size.
-  @return void * pointer to allocated memory.
-  @retval NULL	error.
+  @param  ptr		pointer to released memory.
 */
-void * mrbc_raw_alloc(unsigned int size)
+static void trace_del(const void *ptr)
 {
-  MEMORY_POOL *pool = memory_pool;
-  MRBC_ALLOC_MEMSIZE_T alloc_size = size + sizeof(USED_BLOCK);
+  ALLOC_TRACE *t = trace_find(ptr);
+  if( t ) t->ptr = TRACE_DELETED;
+}
 
-  // align 4 byte
-  alloc_size += (-alloc_size & 3);
 
-  // check minimum alloc size.
-  if( alloc_size < MRBC_MIN_MEMORY_BLOCK_SIZE ) alloc_size = MRBC_MIN_MEMORY_BLOCK_SIZE;
+//================================================================
+/*! move the allocation site to the re-allocated memory.
 
-  FREE_BLOCK *target;
-  unsigned int fli, sli;
-  unsigned int index = calc_index(alloc_size);
+  @param  ptr		pointer to old memory.
+  @param  new_ptr	pointer to new memory.
+*/
+static void trace_move(const void *ptr, void *new_ptr)
+{
+  const ALLOC_TRACE *t = trace_find(ptr);
+  if( t ) trace_set( new_ptr, t->site, t->pc );
+}
 
-  // At first, check only the beginning of the same size block.
-  // because it immediately responds to the pattern in which
-  // same size memory are allocated and released continuously.
-  target = pool->free_blocks[index];
-  if( target && BLOCK_SIZE(target) >= alloc_size ) {
-    fli = FLI(index);
-    sli = SLI(index);
-    goto FOUND_TARGET_BLOCK;
-  }
 
-  // and then, check the next (larger) size block.
-  target = pool->free_blocks[++index];
-  fli = FLI(index);
-  sli = SLI(index);
-  if( target ) goto FOUND_TARGET_BLOCK;
+//================================================================
+/*! delete all entries in the memory range.
 
-  // check in SLI bitmap table.
-  uint16_t masked = pool->free_sli_bitmap[fli] & ((MSB_BIT1_SLI >> sli) - 1);
-  if( masked != 0 ) {
-    sli = NLZ_SLI( masked );
-    goto FOUND_FLI_SLI;
+  @param  top		top of the range.
+  @param  size		size of the range.
+*/
+static void trace_del_range(const void *top, unsigned int size)
+{
+  int i;
+  for( i = 0; i < MRBC_ALLOC_TRACE_SIZE; i++ ) {
+    const uint8_t *p = alloc_trace[i].ptr;
+    if( p > (const uint8_t *)TRACE_DELETED && p >= (const uint8_t *)top &&
+	p < (const uint8_t *)top + size ) {
+      alloc_trace[i].ptr = TRACE_DELETED;
+    }
   }
+}
 
-  // check in FLI bitmap table.
-  masked = pool->free_fli_bitmap & ((MSB_BIT1_FLI >> fli) - 1);
-  if( masked != 0 ) {
-    fli = NLZ_FLI( masked );
-    sli = NLZ_SLI( pool->free_sli_bitmap[fli] );
-    goto FOUND_FLI_SLI;
-  }
+#define TRACE_ALLOC(ptr,site,pc)	trace_set((ptr),(site),(pc))
+#define TRACE_FREE(ptr)			trace_del(ptr)
 
-  // Change strategy to First-fit.
-  target = pool->free_blocks[--index];
-  while( target ) {
-    if( BLOCK_SIZE(target) >= alloc_size ) {
-      remove_free_block( pool, target );
-      goto SPLIT_BLOCK;
-    }
-    target = target->next_free;
-  }
+#else
+#define TRACE_ALLOC(ptr,site,pc)	((void)0)
+#define TRACE_FREE(ptr)			((void)0)
+#endif	// defined(MRBC_ALLOC_TRACE)
 
-  // else out of memory
-#if defined(MRBC_OUT_OF_MEMORY)
-  MRBC_OUT_OF_MEMORY();
+
+#if defined(MRBC_ALLOC_EVENT_LOG)
+//================================================================
+/*! put an allocation event.
+
+  @param  op		ALLOC_EVENT_*
+  @param  ptr		pointer to memory block, or NULL.
+  @param  size		size.
+  @param  vm_id		VM ID.
+  @param  caller	return address of the caller.
+  @param  t0		hal_cycle_count() at the beginning.
+*/
+static void event_put(int op, const void *ptr, unsigned int size, int vm_id,
+		      const void *caller, uint32_t t0)
+{
+  ALLOC_EVENT ev;
+  uint32_t cycles = hal_cycle_count() - t0;
+
+  ev.tick = hal_event_tick();
+  ev.caller = (uint32_t)(uintptr_t)caller;
+  ev.ofs = ptr ? ((const uint8_t *)ptr - (const uint8_t *)memory_pool) >> 2 : 0xffff;
+  ev.size = size > UINT16_MAX ? UINT16_MAX : size;
+  ev.cycles = cycles > UINT16_MAX ? UINT16_MAX : cycles;
+  ev.op = op;
+  ev.vm_id = vm_id;
+
+#if defined(MRBC_ALLOC_EVENT_OUTPUT)
+  MRBC_ALLOC_EVENT_OUTPUT( &ev, sizeof(ev) );
 #else
-  static const char msg[] = "Fatal error: Out of memory.\n";
-  hal_write(2, msg, sizeof(msg)-1);
+  alloc_event_log[event_count % MRBC_ALLOC_EVENT_LOG_SIZE] = ev;
 #endif
-  return NULL;  // ENOMEM
+  event_count++;
+}
 
+/*
+  Only the outermost API call makes an event.
+  (e.g. mrbc_alloc -> mrbc_raw_alloc, mrbc_raw_realloc -> mrbc_raw_free)
+*/
+#define EVENT_BEGIN() \
+  uint32_t ev_t0 = hal_cycle_count(); event_depth++
+#define EVENT_END(op,ptr,size,vm_id) \
+  if( --event_depth == 0 ) \
+    event_put((op),(ptr),(size),(vm_id),__builtin_return_address(0),ev_t0)
+#define EVENT_FREE(ptr) \
+  if( event_depth == 0 && (ptr) ) \
+    event_put(ALLOC_EVENT_FREE,(ptr),0,GET_VM_ID((uint8_t *)(ptr) - sizeof(USED_BLOCK)), \
+	      __builtin_return_address(0),hal_cycle_count())
+#define EVENT_RESET(pool,size) \
+  event_put(ALLOC_EVENT_RESET,BLOCK_TOP(pool),(size),0,__builtin_return_address(0),hal_cycle_count())
+
+// in mrbc_raw_realloc(). moved block is recorded as FREE and REALLOC.
+#define REALLOC_RETURN(p) do { \
+    void *ev_p = (p); \
+    int ev_id = ev_p ? GET_VM_ID((uint8_t *)ev_p - sizeof(USED_BLOCK)) : 0; \
+    if( event_depth == 1 && ev_p && ev_p != ptr ) \
+      event_put(ALLOC_EVENT_FREE,ptr,0,ev_id,__builtin_return_address(0),ev_t0); \
+    EVENT_END( ALLOC_EVENT_REALLOC, ev_p, size, ev_id ); \
+    TIMING_END( MRBC_ALLOC_TIMING_REALLOC ); \
+    return ev_p; \
+  } while(0)
 
- FOUND_FLI_SLI:
-  index = (fli << MRBC_ALLOC_SLI_BIT_WIDTH) + sli;
-  assert( index < SIZE_FREE_BLOCKS );
-  target = pool->free_blocks[index];
-  assert( target != NULL );
+#else
+#define EVENT_BEGIN()			((void)0)
+#define EVENT_END(op,ptr,size,vm_id)	((void)0)
+#define EVENT_FREE(ptr)			((void)0)
+#define EVENT_RESET(pool,size)		((void)0)
+#define REALLOC_RETURN(p)		do { TIMING_END(MRBC_ALLOC_TIMING_REALLOC); return (p); } while(0)
+#endif	// defined(MRBC_ALLOC_EVENT_LOG)
 
- FOUND_TARGET_BLOCK:
-  assert(BLOCK_SIZE(target) >= alloc_size);
 
-  // remove free_blocks index
-  pool->free_blocks[index] = target->next_free;
-  if( target->next_free == NULL ) {
-    pool->free_sli_bitmap[fli] &= ~(MSB_BIT1_SLI >> sli);
-    if( pool->free_sli_bitmap[fli] == 0 ) pool->free_fli_bitmap &= ~(MSB_BIT1_FLI >> fli);
-  }
-  else {
-    target->next_free->prev_free = NULL;
-  }
+#if defined(MRBC_ALLOC_TIMING)
+//================================================================
+/*! account the cycles of an operation.
 
- SPLIT_BLOCK: {
-    FREE_BLOCK *release = split_block(target, alloc_size);
-    if( release != NULL ) {
-      SET_PREV_USED(release);
-      add_free_block( pool, release );
-    } else {
-      FREE_BLOCK *next = PHYS_NEXT(target);
-      SET_PREV_USED(next);
-    }
-  }
+  @param  op		MRBC_ALLOC_TIMING_*
+  @param  t0		hal_cycle_count() at the beginning.
+*/
+static void timing_put(int op, uint32_t t0)
+{
+  uint32_t cycles = hal_cycle_count() - t0;
+  struct MRBC_ALLOC_TIMING_STAT *t = &alloc_timing[op];
 
-  SET_USED_BLOCK(target);
-  SET_VM_ID( target, 0 );
+  t->count++;
+  t->total += cycles;
+  if( t->max < cycles ) t->max = cycles;
+}
 
-#if defined(MRBC_DEBUG)
-  memset( (uint8_t *)target + sizeof(USED_BLOCK), 0xaa,
-          BLOCK_SIZE(target) - sizeof(USED_BLOCK) );
-#endif
+/*
+  Only the outermost API call is accounted, as EVENT_BEGIN/END.
+*/
+#define TIMING_BEGIN() \
+  uint32_t tm_t0 = hal_cycle_count(); timing_depth++
+#define TIMING_END(op) do { \
+    if( --timing_depth == 0 ) timing_put((op), tm_t0); \
+  } while(0)
+
+#else
+#define TIMING_BEGIN()			((void)0)
+#define TIMING_END(op)			((void)0)
+#endif	// defined(MRBC_ALLOC_TIMING)
+
+
+//================================================================
+/*! update the high-water mark of the memory pool.
+
+  Call it after an allocation completed, because free blocks are
+  removed and added back in the middle of it.
+*/
+static inline void update_peak(void)
+{
+  MRBC_ALLOC_MEMSIZE_T used = memory_pool->size - memory_pool->free_size;
+  if( peak_used < used ) peak_used = used;
+}
+
+
+//================================================================
+/*! call the low memory hook, when the free memory goes below the threshold.
+
+  It is called once, until the free memory is back to the threshold.
+*/
+static inline void check_low_memory(void)
+{
+  if( !low_memory_hook || low_memory_fired ) return;
+  if( memory_pool->free_size >= low_memory_threshold ) return;
+
+  low_memory_fired = 1;
+  low_memory_hook( memory_pool->free_size );
+}
+
+
+//================================================================
+/*! size of used block or slab item, header included.
+
+  @param  ptr	pointer to allocated memory.
+*/
+static inline unsigned int block_bytes(const void *ptr)
+{
+  const USED_BLOCK *block = (const USED_BLOCK *)((const uint8_t *)ptr - sizeof(USED_BLOCK));
+#if defined(MRBC_ALLOC_SLAB)
+  if( IS_SLAB_ITEM(block) ) return SLAB_ITEM_SIZE( SLAB_CLASS_IDX(block) );
+#endif
+  return BLOCK_SIZE(block);
+}
+
+
+#if defined(MRBC_ALLOC_VM_STATS)
+//================================================================
+/*! add the block to the counters of VM ID.
+
+  @param  vm_id	VM ID.
+  @param  size	block size.
+*/
+static void vm_stats_add(int vm_id, unsigned int size)
+{
+  if( vm_id > MAX_VM_COUNT ) return;	// slab page, arena and so on.
+
+  ALLOC_VM_STATS *st = &vm_stats[vm_id];
+  st->n_alloc++;
+  st->alloc_bytes += size;
+  st->used += size;
+  if( st->peak < st->used ) st->peak = st->used;
+}
+
+
+//================================================================
+/*! remove the block from the counters of VM ID.
+
+  @param  vm_id	VM ID.
+  @param  size	block size.
+*/
+static void vm_stats_sub(int vm_id, unsigned int size)
+{
+  if( vm_id > MAX_VM_COUNT ) return;
+
+  vm_stats[vm_id].n_free++;
+  vm_stats[vm_id].used -= size;
+}
+
+
+//================================================================
+/*! check the quota of VM ID.
+
+  @param  vm_id	VM ID.
+  @param  size	bytes to be added.
+  @return	non zero if it will be over the quota.
+*/
+static inline int vm_quota_over(int vm_id, unsigned int size)
+{
+  if( vm_id > MAX_VM_COUNT ) return 0;
+
+  const ALLOC_VM_STATS *st = &vm_stats[vm_id];
+  return st->quota != 0 && (unsigned int)st->used + size > st->quota;
+}
+#define VM_STATS_ADD(id,size)	vm_stats_add((id),(size))
+#define VM_STATS_SUB(id,size)	vm_stats_sub((id),(size))
+#define VM_QUOTA_OVER(id,size)	vm_quota_over((id),(size))
+
+#else
+#define VM_STATS_ADD(id,size)	((void)0)
+#define VM_STATS_SUB(id,size)	((void)0)
+#define VM_QUOTA_OVER(id,size)	0
+#endif
+
+
+//================================================================
+/*! count an allocation.
+
+  @param  ptr	pointer to allocated memory.
+*/
+static inline void count_alloc(const void *ptr)
+{
+  unsigned int size = block_bytes(ptr);
+
+  n_alloc_total++;
+  alloc_bytes_total += size;
+  VM_STATS_ADD( GET_VM_ID((const uint8_t *)ptr - sizeof(USED_BLOCK)), size );
+}
+
+
+//================================================================
+/*! count a release.
+
+  @param  ptr	pointer to allocated memory.
+*/
+static inline void count_free(const void *ptr)
+{
+  n_free_total++;
+  VM_STATS_SUB( GET_VM_ID((const uint8_t *)ptr - sizeof(USED_BLOCK)),
+		block_bytes(ptr) );
+}
+
+
+//================================================================
+/*! count the size change of realloc in place.
+
+  @param  ptr	pointer to allocated memory.
+  @param  old_size	block size before.
+*/
+static inline void count_resize(const void *ptr, unsigned int old_size)
+{
+  unsigned int size = block_bytes(ptr);
+  if( size > old_size ) alloc_bytes_total += size - old_size;
+
+#if defined(MRBC_ALLOC_VM_STATS)
+  int vm_id = GET_VM_ID((const uint8_t *)ptr - sizeof(USED_BLOCK));
+  if( vm_id > MAX_VM_COUNT ) return;
+
+  ALLOC_VM_STATS *st = &vm_stats[vm_id];
+  if( size > old_size ) st->alloc_bytes += size - old_size;
+  st->used += size - old_size;
+  if( st->peak < st->used ) st->peak = st->used;
+#endif
+}
+
+
+//================================================================
+/*! initialize memory pool
+
+  @param  pool	pointer to memory pool.
+  @param  size	size. (aligned 4 byte)
+*/
+static void init_pool(MEMORY_POOL *pool, unsigned int size)
+{
+  memset( pool, 0, sizeof(MEMORY_POOL) );
+  pool->size = size;
+#if defined(MRBC_ALLOC_TRACE)
+  trace_del_range( pool, size );	// in case of arena reset.
+#endif
+
+  // initialize memory pool
+  //  large free block + zero size used block (sentinel).
+  MRBC_ALLOC_MEMSIZE_T sentinel_size = sizeof(USED_BLOCK);
+  sentinel_size += (-sentinel_size & 0x03);
+  MRBC_ALLOC_MEMSIZE_T free_size = size - sizeof(MEMORY_POOL) - sentinel_size;
+  FREE_BLOCK *free_block = BLOCK_TOP(pool);
+  USED_BLOCK *used_block = (USED_BLOCK *)((uint8_t *)free_block + free_size);
+
+  free_block->size = free_size | 0x02;		// flag prev=1, used=0
+  used_block->size = sentinel_size | 0x01;	// flag prev=0, used=1
+  SET_VM_ID( used_block, 0xff );
+
+  add_free_block( pool, free_block );
+}
+
+
+//================================================================
+/*! allocate memory block from the memory pool.
+
+  @param  pool	pointer to memory pool.
+  @param  size	request size.
+  @return void * pointer to allocated memory.
+  @retval NULL	not enough memory.
+*/
+static void * alloc_block(MEMORY_POOL *pool, unsigned int size)
+{
+  MRBC_ALLOC_MEMSIZE_T alloc_size = size + sizeof(USED_BLOCK);
+
+  // align 4 byte
+  alloc_size += (-alloc_size & 3);
+
+  // check minimum alloc size.
+  if( alloc_size < MRBC_MIN_MEMORY_BLOCK_SIZE ) alloc_size = MRBC_MIN_MEMORY_BLOCK_SIZE;
+
+  FREE_BLOCK *target;
+  unsigned int fli, sli;
+  unsigned int index = calc_index(alloc_size);
+
+  // At first, check only the beginning of the same size block.
+  // because it immediately responds to the pattern in which
+  // same size memory are allocated and released continuously.
+  target = pool->free_blocks[index];
+  if( target && BLOCK_SIZE(target) >= alloc_size ) {
+    fli = FLI(index);
+    sli = SLI(index);
+    goto FOUND_TARGET_BLOCK;
+  }
+
+  // and then, check the next (larger) size block.
+  target = pool->free_blocks[++index];
+  fli = FLI(index);
+  sli = SLI(index);
+  if( target ) goto FOUND_TARGET_BLOCK;
+
+  // check in SLI bitmap table.
+  uint16_t masked = pool->free_sli_bitmap[fli] & ((MSB_BIT1_SLI >> sli) - 1);
+  if( masked != 0 ) {
+    sli = NLZ_SLI( masked );
+    goto FOUND_FLI_SLI;
+  }
+
+  // check in FLI bitmap table.
+  masked = pool->free_fli_bitmap & ((MSB_BIT1_FLI >> fli) - 1);
+  if( masked != 0 ) {
+    fli = NLZ_FLI( masked );
+    sli = NLZ_SLI( pool->free_sli_bitmap[fli] );
+    goto FOUND_FLI_SLI;
+  }
+
+#if defined(MRBC_ALLOC_REALTIME)
+  return NULL;  // ENOMEM, not to search the list.
+#endif
+
+  // Change strategy to First-fit.
+  target = pool->free_blocks[--index];
+  while( target ) {
+    if( BLOCK_SIZE(target) >= alloc_size ) {
+      remove_free_block( pool, target );
+      goto SPLIT_BLOCK;
+    }
+    target = target->next_free;
+  }
+
+  return NULL;  // ENOMEM
+
+
+ FOUND_FLI_SLI:
+  index = (fli << MRBC_ALLOC_SLI_BIT_WIDTH) + sli;
+  assert( index < SIZE_FREE_BLOCKS );
+  target = pool->free_blocks[index];
+  assert( target != NULL );
+
+ FOUND_TARGET_BLOCK:
+  assert(BLOCK_SIZE(target) >= alloc_size);
+
+  // remove free_blocks index
+  pool->free_size -= BLOCK_SIZE(target);
+  pool->free_blocks[index] = target->next_free;
+  if( target->next_free == NULL ) {
+    pool->free_sli_bitmap[fli] &= ~(MSB_BIT1_SLI >> sli);
+    if( pool->free_sli_bitmap[fli] == 0 ) pool->free_fli_bitmap &= ~(MSB_BIT1_FLI >> fli);
+  }
+  else {
+    target->next_free->prev_free = NULL;
+  }
+
+ SPLIT_BLOCK: {
+    FREE_BLOCK *release = split_block(target, alloc_size);
+    if( release != NULL ) {
+      SET_PREV_USED(release);
+      add_free_block( pool, release );
+    } else {
+      FREE_BLOCK *next = PHYS_NEXT(target);
+      SET_PREV_USED(next);
+    }
+  }
+
+  SET_USED_BLOCK(target);
+  SET_VM_ID( target, 0 );
+
+#if defined(MRBC_DEBUG)
+  memset( (uint8_t *)target + sizeof(USED_BLOCK), 0xaa,
+          BLOCK_SIZE(target) - sizeof(USED_BLOCK) );
+#endif
+
+  return (uint8_t *)target + sizeof(USED_BLOCK);
+}
+
+
+//================================================================
+/*! release the used block, and merge with the free blocks around it.
+
+  @param  pool		pointer to memory pool.
+  @param  target	pointer to the block.
+*/
+static void free_block(MEMORY_POOL *pool, FREE_BLOCK *target)
+{
+  // check next block, merge?
+  FREE_BLOCK *next = PHYS_NEXT(target);
+
+  if( IS_FREE_BLOCK(next) ) {
+    remove_free_block( pool, next );
+    merge_block(target, next);
+  } else {
+    SET_PREV_FREE(next);
+  }
+
+  // check prev block, merge?
+  if( IS_PREV_FREE(target) ) {
+    FREE_BLOCK *prev = *((FREE_BLOCK **)((uint8_t*)target - sizeof(FREE_BLOCK *)));
+
+    assert( IS_FREE_BLOCK(prev) );
+    remove_free_block( pool, prev );
+    merge_block(prev, target);
+    target = prev;
+  }
+
+  // target, add to index
+  add_free_block( pool, target );
+}
+
+
+#if defined(MRBC_ALLOC_EMERGENCY_SIZE)
+//================================================================
+/*! reserve the emergency block again, if there is enough free memory.
+*/
+static void emergency_reserve(void)
+{
+  if( emergency_block ) return;
+#if !defined(MRBC_ALLOC_REALTIME)
+  if( flag_evicting ) return;
+#endif
+  if( memory_pool->free_size < MRBC_ALLOC_EMERGENCY_SIZE * 2 ) return;
+
+  emergency_block = alloc_block(memory_pool, MRBC_ALLOC_EMERGENCY_SIZE);
+  if( emergency_block ) {
+    // it must not be released by mrbc_free_all().
+    SET_VM_ID( (uint8_t *)emergency_block - sizeof(USED_BLOCK), 0xff );
+  }
+}
+#endif
+
+
+#if defined(MRBC_ALLOC_SLAB)
+//================================================================
+/*! make a new slab page and link it to the top of the size class.
+
+  @param  cls		size class index.
+  @return SLAB_PAGE *	pointer to new page.
+  @retval NULL		not enough memory.
+*/
+static SLAB_PAGE * slab_new_page(unsigned int cls)
+{
+  unsigned int item_size = SLAB_ITEM_SIZE(cls);
+  SLAB_PAGE *page = alloc_block(memory_pool, sizeof(SLAB_PAGE)
+					     + item_size * MRBC_ALLOC_SLAB_ITEMS);
+  if( page == NULL ) return NULL;	// ENOMEM
+
+  // the page itself must not be released by mrbc_free_all().
+  SET_VM_ID( (uint8_t *)page - sizeof(USED_BLOCK), 0xff );
+  page->n_used = 0;
+  page->class_idx = cls;
+  page->free_item = NULL;
+
+  // make a free item list, lower address first.
+  uint8_t *p = (uint8_t *)page + sizeof(SLAB_PAGE) + item_size * MRBC_ALLOC_SLAB_ITEMS;
+  int i;
+  for( i = MRBC_ALLOC_SLAB_ITEMS - 1; i >= 0; i-- ) {
+    p -= item_size;
+    USED_BLOCK *item = (USED_BLOCK *)p;
+    item->size = SLAB_ITEM_HEADER(cls, i);
+    SET_VM_ID( item, 0xff );
+    SLAB_NEXT_FREE( item ) = page->free_item;
+    page->free_item = item;
+  }
+
+  page->next = slab_pages[cls];
+  slab_pages[cls] = page;
+
+  return page;
+}
+
+
+//================================================================
+/*! allocate memory from slab
+
+  @param  size	request size.
+  @return void * pointer to allocated memory.
+  @retval NULL	size is not fit to slab, or not enough memory.
+*/
+static void * slab_alloc(unsigned int size)
+{
+  if( size > slab_sizes[SLAB_NUM_CLASSES - 1] ) return NULL;
+
+  unsigned int cls = 0;
+  while( size > slab_sizes[cls] ) cls++;
+
+  // find a page that has free item.
+  SLAB_PAGE *page = slab_pages[cls];
+  SLAB_PAGE *prev = NULL;
+  while( page && page->free_item == NULL ) {
+    prev = page;
+    page = page->next;
+  }
+
+  if( page == NULL ) {
+    page = slab_new_page(cls);
+    if( page == NULL ) return NULL;	// ENOMEM
+
+  } else if( prev != NULL ) {
+    // move to the top of list for the next allocation.
+    prev->next = page->next;
+    page->next = slab_pages[cls];
+    slab_pages[cls] = page;
+  }
+
+  USED_BLOCK *item = page->free_item;
+  page->free_item = SLAB_NEXT_FREE( item );
+  page->n_used++;
+
+  item->size |= 0x02;
+  SET_VM_ID( item, 0 );
+
+#if defined(MRBC_DEBUG)
+  memset( (uint8_t *)item + sizeof(USED_BLOCK), 0xaa, SLAB_USABLE_SIZE(cls) );
+#endif
+
+  return (uint8_t *)item + sizeof(USED_BLOCK);
+}
+
+
+//================================================================
+/*! release slab item
+
+  @param  item	pointer to target item.
+*/
+static void slab_free(USED_BLOCK *item)
+{
+  unsigned int cls = SLAB_CLASS_IDX(item);
+  SLAB_PAGE *page = (SLAB_PAGE *)((uint8_t *)item - sizeof(SLAB_PAGE)
+			- SLAB_ITEM_IDX(item) * SLAB_ITEM_SIZE(cls));
+  assert( page->class_idx == cls );
+
+#if defined(MRBC_DEBUG)
+  memset( (uint8_t *)item + sizeof(USED_BLOCK), 0xff, SLAB_USABLE_SIZE(cls) );
+#endif
+
+  item->size &= ~0x02;
+  SET_VM_ID( item, 0xff );
+  SLAB_NEXT_FREE( item ) = page->free_item;
+  page->free_item = item;
+
+  if( --page->n_used != 0 ) return;
+
+  // release an empty page, but keep the page if it is the only one.
+  if( slab_pages[cls] == page && page->next == NULL ) return;
+
+  SLAB_PAGE **pp = &slab_pages[cls];
+  while( *pp != page ) pp = &(*pp)->next;
+  *pp = page->next;
+
+  free_block( memory_pool, (FREE_BLOCK *)((uint8_t *)page - sizeof(USED_BLOCK)) );
+}
+#endif	// defined(MRBC_ALLOC_SLAB)
+
+
+#if defined(MRBC_ALLOC_ARENA)
+//================================================================
+/*! find the arena that contains the memory block.
+
+  @param  ptr		pointer to allocated memory.
+  @return ALLOC_ARENA *	pointer to arena, or NULL if memory pool.
+*/
+static ALLOC_ARENA * arena_find_by_ptr(const void *ptr)
+{
+  int i;
+  for( i = 0; i < MAX_VM_COUNT; i++ ) {
+    MEMORY_POOL *pool = arenas[i].pool;
+    if( pool && (const uint8_t *)ptr > (uint8_t *)pool &&
+		(const uint8_t *)ptr < (uint8_t *)BLOCK_END(pool) ) {
+      return &arenas[i];
+    }
+  }
+  return NULL;
+}
+
+
+//================================================================
+/*! find the arena owned by VM.
+
+  @param  vm_id		VM ID.
+  @return ALLOC_ARENA *	pointer to arena, or NULL if not reserved.
+*/
+static ALLOC_ARENA * arena_find_by_vm_id(int vm_id)
+{
+  if( vm_id == 0 ) return NULL;
+
+  int i;
+  for( i = 0; i < MAX_VM_COUNT; i++ ) {
+    if( arenas[i].pool && arenas[i].vm_id == vm_id ) return &arenas[i];
+  }
+  return NULL;
+}
+
+
+//================================================================
+/*! allocate memory from the arena, or the memory pool if it is full.
+
+  @param  arena	pointer to arena.
+  @param  size	request size.
+  @return void * pointer to allocated memory.
+  @retval NULL	error.
+*/
+static void * arena_alloc(ALLOC_ARENA *arena, unsigned int size)
+{
+  void *ptr = alloc_block(arena->pool, size);
+  if( ptr != NULL ) {
+    SET_VM_ID( (uint8_t *)ptr - sizeof(USED_BLOCK), arena->vm_id );
+    count_alloc( ptr );
+    return ptr;
+  }
+
+  ptr = mrbc_raw_alloc(size);
+  if( ptr != NULL ) mrbc_set_vm_id(ptr, arena->vm_id);	// will be spilled.
+
+  return ptr;
+}
+
+
+//================================================================
+/*! get an unused arena for VM.
+
+  @param  vm		pointer to VM.
+  @return ALLOC_ARENA *	pointer to arena, or NULL if VM has it already or no room.
+*/
+static ALLOC_ARENA * arena_new(const struct VM *vm)
+{
+  if( arena_find_by_vm_id(vm->vm_id) ) return NULL;
+
+  int i;
+  for( i = 0; i < MAX_VM_COUNT; i++ ) {
+    if( arenas[i].pool == NULL ) return &arenas[i];
+  }
+  return NULL;
+}
+
+
+//================================================================
+/*! release the arena. the memory pool block is returned, if not external.
+
+  @param  arena	pointer to arena.
+*/
+static void arena_release(ALLOC_ARENA *arena)
+{
+  MEMORY_POOL *pool = arena->pool;
+
+  arena->pool = NULL;
+  if( arena->flag_external ) return;
+  free_block( memory_pool, (FREE_BLOCK *)((uint8_t *)pool - sizeof(USED_BLOCK)) );
+}
+
+
+//================================================================
+/*! release the detached arena, if it has no used block.
+
+  @param  arena	pointer to arena.
+*/
+static void arena_release_if_empty(ALLOC_ARENA *arena)
+{
+  MEMORY_POOL *pool = arena->pool;
+  FREE_BLOCK *block = BLOCK_TOP(pool);
+
+  if( IS_USED_BLOCK(block) ) return;
+  USED_BLOCK *sentinel = PHYS_NEXT(block);
+  if( PHYS_NEXT(sentinel) < BLOCK_END(pool) ) return;
+
+  arena_release( arena );
+}
+
+
+//================================================================
+/*! the owner's blocks in the arena are released at once.
+
+  They are removed from the used bytes of the owner, but not counted
+  as released blocks.
+
+  @param  arena	pointer to arena.
+*/
+static void arena_drop_stats(const ALLOC_ARENA *arena)
+{
+#if defined(MRBC_ALLOC_VM_STATS)
+  const MEMORY_POOL *pool = arena->pool;
+  MRBC_ALLOC_MEMSIZE_T sentinel_size = sizeof(USED_BLOCK);
+  sentinel_size += (-sentinel_size & 0x03);
+
+  vm_stats[arena->vm_id].used -=
+    pool->size - pool->free_size - sizeof(MEMORY_POOL) - sentinel_size;
+#endif
+}
+#endif	// defined(MRBC_ALLOC_ARENA)
+
+
+//================================================================
+/*! extend the permanent block downward.
+
+  The free block just before the sentinel block is found by its top
+  address, so this does not walk the memory blocks.
+
+  @param  alloc_size	size. (aligned 4 byte)
+  @return void *	pointer to allocated memory.
+  @retval NULL		the block before is used or not enough size.
+*/
+static void * permanent_extend(MRBC_ALLOC_MEMSIZE_T alloc_size)
+{
+  MEMORY_POOL *pool = memory_pool;
+  FREE_BLOCK *tail = (FREE_BLOCK *)permanent_block;
+
+  if( IS_PREV_USED(tail) ) return NULL;
+  FREE_BLOCK *prev = *((FREE_BLOCK **)((uint8_t *)tail - sizeof(FREE_BLOCK *)));
+  assert( IS_FREE_BLOCK(prev) );
+  if( (BLOCK_SIZE(prev) - sizeof(USED_BLOCK)) < alloc_size ) return NULL;
+
+  remove_free_block( pool, prev );
+  MRBC_ALLOC_MEMSIZE_T free_size = BLOCK_SIZE(prev) - alloc_size;
+
+  if( free_size <= MRBC_MIN_MEMORY_BLOCK_SIZE ) {
+    // no split, use all
+    prev->size += BLOCK_SIZE(tail);
+    SET_USED_BLOCK( prev );
+    tail = prev;
+  }
+  else {
+    // split block
+    MRBC_ALLOC_MEMSIZE_T tail_size = tail->size + alloc_size;	// w/ flags.
+    tail = (FREE_BLOCK*)((uint8_t *)tail - alloc_size);
+    tail->size = tail_size;
+    prev->size -= alloc_size;		// w/ flags.
+    add_free_block( pool, prev );
+  }
+  SET_VM_ID( tail, 0xff );
+  permanent_block = (USED_BLOCK *)tail;
+
+  return (uint8_t *)tail + sizeof(USED_BLOCK);
+}
+
+
+#if defined(MRBC_ALLOC_VMID)
+//================================================================
+/*! release all memory blocks in the pool, that owned by VM.
+
+  @param  pool	pointer to memory pool
+  @param  vm_id	VM ID
+*/
+static void free_all_in_pool(MEMORY_POOL *pool, int vm_id)
+{
+  USED_BLOCK *target = BLOCK_TOP(pool);
+  USED_BLOCK *next;
+
+  while( target < (USED_BLOCK *)BLOCK_END(pool) ) {
+    next = PHYS_NEXT(target);
+    if( IS_FREE_BLOCK(next) ) next = PHYS_NEXT(next);
+
+    if( IS_USED_BLOCK(target) && (target->vm_id == vm_id) ) {
+      mrbc_raw_free( (uint8_t *)target + sizeof(USED_BLOCK) );
+    }
+    target = next;
+  }
+}
+#endif
+
+
+#if defined(MRBC_ALLOC_COMPACT)
+//================================================================
+/*! find the relocatable buffer entry by the block.
+
+  @param  block	pointer to used block.
+  @return	pointer to entry, or NULL if not relocatable.
+*/
+static ALLOC_COMPACT_SLOT * compact_find(const USED_BLOCK *block)
+{
+  const void *ptr = (const uint8_t *)block + sizeof(USED_BLOCK);
+  unsigned int i;
+
+  for( i = 0; i < compact_n_slots; i++ ) {
+    if( compact_slots[i].slot && *compact_slots[i].slot == ptr ) {
+      return &compact_slots[i];
+    }
+  }
+  return NULL;
+}
+
+
+//================================================================
+/*! drop the entries of the objects owned by VM.
+
+  @param  vm_id	VM ID
+*/
+static void compact_drop_vm(int vm_id)
+{
+  unsigned int i;
+
+  for( i = 0; i < compact_n_slots; i++ ) {
+    if( compact_slots[i].slot &&
+	GET_VM_ID((uint8_t *)compact_slots[i].obj - sizeof(USED_BLOCK)) == vm_id ) {
+      compact_slots[i].slot = NULL;
+    }
+  }
+  while( compact_n_slots > 0 && !compact_slots[compact_n_slots-1].slot ) {
+    compact_n_slots--;
+  }
+}
+
+
+//================================================================
+/*! slide the used block into the free block just before it.
+
+  The free block moves to after the block, and it is merged with the
+  next free block if any.
+
+  @param  pool		pointer to memory pool.
+  @param  target	pointer to used block, the previous one is free.
+  @param  entry		entry of the buffer in the block.
+*/
+static void compact_move(MEMORY_POOL *pool, USED_BLOCK *target, ALLOC_COMPACT_SLOT *entry)
+{
+  FREE_BLOCK *prev = *((FREE_BLOCK **)((uint8_t *)target - sizeof(FREE_BLOCK *)));
+  FREE_BLOCK *next = PHYS_NEXT(target);
+  MRBC_ALLOC_MEMSIZE_T used_size = BLOCK_SIZE(target);
+  MRBC_ALLOC_MEMSIZE_T free_size = BLOCK_SIZE(prev);
+  assert( IS_FREE_BLOCK(prev) );
+
+  remove_free_block( pool, prev );
+  if( IS_FREE_BLOCK(next) ) {
+    remove_free_block( pool, next );
+    free_size += BLOCK_SIZE(next);
+  } else {
+    SET_PREV_FREE( next );
+  }
+
+  // the header is copied too, so vm_id is kept.
+  USED_BLOCK *moved = (USED_BLOCK *)prev;
+  memmove( moved, target, used_size );
+  moved->size = used_size | 0x03;	// the block before a free block is used.
+
+  FREE_BLOCK *free = PHYS_NEXT(moved);
+  free->size = free_size | 0x02;
+  add_free_block( pool, free );
+
+  void *ptr = (uint8_t *)target + sizeof(USED_BLOCK);
+  void *new_ptr = (uint8_t *)moved + sizeof(USED_BLOCK);
+  *entry->slot = new_ptr;
+
+#if defined(MRBC_ALLOC_TRACE)
+  trace_move( ptr, new_ptr );
+#endif
+#if defined(MRBC_ALLOC_EVENT_LOG)
+  event_put( ALLOC_EVENT_FREE, ptr, 0, GET_VM_ID(moved),
+	     __builtin_return_address(0), hal_cycle_count() );
+  event_put( ALLOC_EVENT_REALLOC, new_ptr, used_size - sizeof(USED_BLOCK),
+	     GET_VM_ID(moved), __builtin_return_address(0), hal_cycle_count() );
+#endif
+  (void)ptr;
+}
+#endif	// defined(MRBC_ALLOC_COMPACT)
+
+
+//================================================================
+/*! allocate at the out of memory.
+
+  The registered caches are evicted, and the low memory hook is called.
+  At last the emergency block is released, so that the exception can
+  be raised.
+
+  @param  size	request size.
+  @return void * pointer to allocated memory.
+  @retval NULL	error.
+*/
+static void * alloc_retry(unsigned int size)
+{
+  void *ptr = NULL;
+
+#if !defined(MRBC_ALLOC_REALTIME)
+  mrbc_alloc_cache *cache;
+
+  flag_evicting = 1;
+  for( cache = cache_head; cache != NULL; cache = cache->next ) {
+    if( cache->evict( size ) == 0 ) continue;
+    cache->n_evicted++;
+    ptr = alloc_block(memory_pool, size);
+    if( ptr ) break;
+  }
+  flag_evicting = 0;
+  if( ptr ) return ptr;
+
+  if( low_memory_hook ) {
+    low_memory_fired = 1;
+    low_memory_hook( memory_pool->free_size );
+    ptr = alloc_block(memory_pool, size);
+  }
+#endif
+
+#if defined(MRBC_ALLOC_EMERGENCY_SIZE)
+  if( ptr == NULL && emergency_block ) {
+    free_block( memory_pool,
+		(FREE_BLOCK *)((uint8_t *)emergency_block - sizeof(USED_BLOCK)) );
+    emergency_block = NULL;
+    ptr = alloc_block(memory_pool, size);
+  }
+#endif
+
+  return ptr;
+}
+
+
+/***** Global functions *****************************************************/
+//================================================================
+/*! initialize
+
+  @param  ptr	pointer to free memory block.
+  @param  size	size. (max 64KB. see MRBC_ALLOC_MEMSIZE_T)
+*/
+void mrbc_init_alloc(void *ptr, unsigned int size)
+{
+  assert( MRBC_MIN_MEMORY_BLOCK_SIZE >= sizeof(FREE_BLOCK) );
+  assert( MRBC_MIN_MEMORY_BLOCK_SIZE >= (1 << MRBC_ALLOC_IGNORE_LSBS) );
+  /*
+    If you get this assertion, you can change minimum memory block size
+    parameter to `MRBC_MIN_MEMORY_BLOCK_SIZE (1 << MRBC_ALLOC_IGNORE_LSBS)`
+    and #define MRBC_ALLOC_16BIT.
+  */
+
+  assert( (sizeof(MEMORY_POOL) & 0x03) == 0 );
+  assert( size != 0 );
+  assert( size <= (MRBC_ALLOC_MEMSIZE_T)(~0) );
+
+  if( memory_pool != NULL ) return;
+#if defined(MRBC_ALLOC_SLAB)
+  memset( slab_pages, 0, sizeof(slab_pages) );
+#endif
+#if defined(MRBC_ALLOC_ARENA)
+  memset( arenas, 0, sizeof(arenas) );
+#endif
+#if defined(MRBC_ALLOC_TRACE)
+  memset( alloc_trace, 0, sizeof(alloc_trace) );
+  memset( trace_largest_history, 0, sizeof(trace_largest_history) );
+  trace_overflow = 0;
+  trace_oom = 0;
+  trace_alloc_count = 0;
+  trace_largest_min = size;
+#endif
+#if defined(MRBC_ALLOC_EVENT_LOG)
+  event_count = 0;
+  event_depth = 0;
+#endif
+  size &= ~(unsigned int)0x03;	// align 4 byte.
+  memory_pool = ptr;
+  init_pool( memory_pool, size );
+  permanent_block = PHYS_NEXT( (FREE_BLOCK *)BLOCK_TOP(memory_pool) );
+
+#if defined(MRBC_ALLOC_PERMANENT_SIZE)
+  permanent_reserve_size = MRBC_ALLOC_PERMANENT_SIZE + (-MRBC_ALLOC_PERMANENT_SIZE & 3);
+  permanent_reserve = permanent_extend( permanent_reserve_size );
+  if( !permanent_reserve ) permanent_reserve_size = 0;
+#endif
+#if defined(MRBC_ALLOC_EMERGENCY_SIZE)
+  emergency_block = NULL;
+  emergency_reserve();
+#endif
+  low_memory_fired = 0;
+  peak_used = 0;
+  update_peak();
+  n_alloc_total = 0;
+  n_free_total = 0;
+  alloc_bytes_total = 0;
+#if defined(MRBC_ALLOC_VM_STATS)
+  memset( vm_stats, 0, sizeof(vm_stats) );
+#endif
+}
+
+
+//================================================================
+/*! cleanup memory pool
+*/
+void mrbc_cleanup_alloc(void)
+{
+#if defined(MRBC_DEBUG)
+  if( memory_pool ) {
+    memset( memory_pool, 0, memory_pool->size );
+  }
+#endif
+
+  memory_pool = 0;
+  permanent_block = 0;
+#if defined(MRBC_ALLOC_EMERGENCY_SIZE)
+  emergency_block = 0;
+#endif
+#if defined(MRBC_ALLOC_PERMANENT_SIZE)
+  permanent_reserve = 0;
+  permanent_reserve_size = 0;
+#endif
+#if defined(MRBC_ALLOC_SLAB)
+  memset( slab_pages, 0, sizeof(slab_pages) );
+#endif
+#if defined(MRBC_ALLOC_ARENA)
+  memset( arenas, 0, sizeof(arenas) );
+#endif
+#if defined(MRBC_ALLOC_COMPACT)
+  memset( compact_slots, 0, sizeof(compact_slots) );
+  compact_n_slots = 0;
+#endif
+}
+
+
+//================================================================
+/*! allocate memory
+
+  @param  size	request size.
+  @return void * pointer to allocated memory.
+  @retval NULL	error.
+*/
+void * mrbc_raw_alloc(unsigned int size)
+{
+  TIMING_BEGIN();
+  EVENT_BEGIN();
+#if defined(MRBC_ALLOC_SLAB)
+  void *ptr = slab_alloc(size);
+  if( ptr == NULL ) ptr = alloc_block(memory_pool, size);
+#else
+  void *ptr = alloc_block(memory_pool, size);
+#endif
+  if( ptr == NULL ) ptr = alloc_retry(size);
+  EVENT_END( ALLOC_EVENT_ALLOC, ptr, size, 0 );
+  if( ptr != NULL ) {
+    update_peak();
+    count_alloc( ptr );
+    TRACE_ALLOC( ptr, __builtin_return_address(0), TRACE_PC_CFUNC );
+    check_low_memory();
+    TIMING_END( MRBC_ALLOC_TIMING_ALLOC );
+    return ptr;
+  }
+
+  // else out of memory
+#if defined(MRBC_ALLOC_TRACE)
+  trace_oom++;
+#endif
+#if defined(MRBC_OUT_OF_MEMORY)
+  MRBC_OUT_OF_MEMORY();
+#else
+  static const char msg[] = "Fatal error: Out of memory.\n";
+  hal_write(2, msg, sizeof(msg)-1);
+#endif
+  TIMING_END( MRBC_ALLOC_TIMING_ALLOC );
+  return NULL;  // ENOMEM
+}
+
+
+//================================================================
+/*! allocate memory that cannot free and realloc
+
+  @param  size	request size.
+  @return void * pointer to allocated memory.
+  @retval NULL	error.
+*/
+void * mrbc_raw_alloc_no_free(unsigned int size)
+{
+  MRBC_ALLOC_MEMSIZE_T alloc_size = size + (-size & 3);	// align 4 byte
+  void *ptr;
+  EVENT_BEGIN();
+
+#if defined(MRBC_ALLOC_PERMANENT_SIZE)
+  // at first, use the reserved area.
+  if( alloc_size <= permanent_reserve_size ) {
+    ptr = permanent_reserve;
+    permanent_reserve += alloc_size;
+    permanent_reserve_size -= alloc_size;
+    goto DONE;
+  }
+#endif
 
-  return (uint8_t *)target + sizeof(USED_BLOCK);
+  ptr = permanent_extend( alloc_size );
+  if( ptr != NULL ) update_peak();
+
+  // the tail of memory pool is used by other objects.
+  if( ptr == NULL ) ptr = mrbc_raw_alloc(alloc_size);
+
+#if defined(MRBC_ALLOC_PERMANENT_SIZE)
+ DONE:
+#endif
+  EVENT_END( ALLOC_EVENT_NO_FREE, ptr, size, 0 );
+  return ptr;
 }
 
 
 //================================================================
-/*! allocate memory that cannot free and realloc
+/*! release memory
 
-  @param  size	request size.
+  @param  ptr	Return value of mrbc_raw_alloc()
+*/
+void mrbc_raw_free(void *ptr)
+{
+  TIMING_BEGIN();
+  TRACE_FREE( ptr );
+  EVENT_FREE( ptr );
+  if( ptr != NULL ) count_free( ptr );
+
+#if defined(MRBC_ALLOC_SLAB)
+  if( ptr != NULL &&
+      IS_SLAB_ITEM((USED_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK))) ) {
+    slab_free( (USED_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK)) );
+    TIMING_END( MRBC_ALLOC_TIMING_FREE );
+    return;
+  }
+#endif
+
+  MEMORY_POOL *pool = memory_pool;
+#if defined(MRBC_ALLOC_ARENA)
+  ALLOC_ARENA *arena = arena_find_by_ptr(ptr);
+  if( arena ) {
+    pool = arena->pool;
+    if( GET_VM_ID((uint8_t *)ptr - sizeof(USED_BLOCK)) != arena->vm_id ) {
+      arena->n_foreign--;
+    }
+  }
+#endif
+
+#if defined(MRBC_DEBUG)
+  {
+    if( ptr == NULL ) {
+      static const char msg[] = "mrbc_raw_free(): NULL pointer was given.\n";
+      hal_write(2, msg, sizeof(msg)-1);
+      TIMING_END( MRBC_ALLOC_TIMING_FREE );
+      return;
+    }
+
+    FREE_BLOCK *target = (FREE_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK));
+#if !defined(MRBC_ALLOC_REALTIME)
+    FREE_BLOCK *block = BLOCK_TOP(pool);
+    while( block < (FREE_BLOCK *)BLOCK_END(pool) ) {
+      if( block == target ) break;
+      block = PHYS_NEXT(block);
+    }
+#else
+    // don't scan the pool. only a block already marked free is detected.
+    FREE_BLOCK *block = target;
+#endif
+
+    if( block != target || IS_FREE_BLOCK(block) ) {
+      static const char msg[] = "mrbc_raw_free(): double free detected.\n";
+      hal_write(2, msg, sizeof(msg)-1);
+      TIMING_END( MRBC_ALLOC_TIMING_FREE );
+      return;
+    }
+
+    SET_VM_ID( target, 0xff );
+    memset( ptr, 0xff, BLOCK_SIZE(target) - sizeof(USED_BLOCK) );
+  }
+#endif
+
+  free_block( pool, (FREE_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK)) );
+
+#if defined(MRBC_ALLOC_ARENA)
+  if( arena && arena->vm_id == 0 ) arena_release_if_empty( arena );
+#endif
+  if( pool == memory_pool ) {
+#if defined(MRBC_ALLOC_EMERGENCY_SIZE)
+    emergency_reserve();
+#endif
+    if( memory_pool->free_size >= low_memory_threshold ) low_memory_fired = 0;
+  }
+
+  TIMING_END( MRBC_ALLOC_TIMING_FREE );
+}
+
+
+//================================================================
+/*! re-allocate memory
+
+  @param  ptr	Return value of mrbc_raw_alloc()
+  @param  size	request size
   @return void * pointer to allocated memory.
   @retval NULL	error.
 */
-void * mrbc_raw_alloc_no_free(unsigned int size)
+void * mrbc_raw_realloc(void *ptr, unsigned int size)
 {
+  TIMING_BEGIN();
+  EVENT_BEGIN();
   MEMORY_POOL *pool = memory_pool;
-  MRBC_ALLOC_MEMSIZE_T alloc_size = size + (-size & 3);	// align 4 byte
+#if defined(MRBC_ALLOC_ARENA)
+  ALLOC_ARENA *arena = arena_find_by_ptr(ptr);
+  if( arena ) pool = arena->pool;
+#endif
+  volatile USED_BLOCK *target = (USED_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK));
+  MRBC_ALLOC_MEMSIZE_T alloc_size = size + sizeof(USED_BLOCK);
+  FREE_BLOCK *next;
 
-  // find the tail block
-  FREE_BLOCK *tail = BLOCK_TOP(pool);
-  FREE_BLOCK *prev;
-  do {
-    prev = tail;
-    tail = PHYS_NEXT(tail);
-  } while( PHYS_NEXT(tail) < BLOCK_END(pool) );
+#if defined(MRBC_ALLOC_SLAB)
+  if( IS_SLAB_ITEM(target) ) {
+    unsigned int usable_size = SLAB_USABLE_SIZE( SLAB_CLASS_IDX(target) );
+    if( size <= usable_size ) REALLOC_RETURN(ptr);
 
-  // can resize it block?
-  if( IS_USED_BLOCK(prev) ) goto FALLBACK;
-  if( (BLOCK_SIZE(prev) - sizeof(USED_BLOCK)) < alloc_size ) goto FALLBACK;
+    void *new_ptr = mrbc_raw_alloc(size);
+    if( new_ptr == NULL ) REALLOC_RETURN(NULL);  // ENOMEM
 
-  remove_free_block( pool, prev );
-  MRBC_ALLOC_MEMSIZE_T free_size = BLOCK_SIZE(prev) - alloc_size;
+    memcpy(new_ptr, ptr, usable_size);
+    mrbc_set_vm_id(new_ptr, target->vm_id);
+#if defined(MRBC_ALLOC_TRACE)
+    trace_move( ptr, new_ptr );
+#endif
 
-  if( free_size <= MRBC_MIN_MEMORY_BLOCK_SIZE ) {
-    // no split, use all
-    prev->size += BLOCK_SIZE(tail);
-    SET_USED_BLOCK( prev );
-    tail = prev;
+    count_free( ptr );
+    slab_free( (USED_BLOCK *)target );
+
+    REALLOC_RETURN(new_ptr);
   }
-  else {
-    // split block
-    MRBC_ALLOC_MEMSIZE_T tail_size = tail->size + alloc_size;	// w/ flags.
-    tail = (FREE_BLOCK*)((uint8_t *)tail - alloc_size);
-    tail->size = tail_size;
-    prev->size -= alloc_size;		// w/ flags.
-    add_free_block( pool, prev );
+#endif
+
+  // align 4 byte
+  alloc_size += (-alloc_size & 3);
+
+  // check minimum alloc size.
+  if( alloc_size < MRBC_MIN_MEMORY_BLOCK_SIZE ) alloc_size = MRBC_MIN_MEMORY_BLOCK_SIZE;
+  unsigned int old_size = BLOCK_SIZE(target);
+
+  if( alloc_size > old_size &&
+      VM_QUOTA_OVER( GET_VM_ID(target), alloc_size - old_size ) ) {
+    REALLOC_RETURN(NULL);	// over the quota.
   }
-  SET_VM_ID( tail, 0xff );
 
-  return (uint8_t *)tail + sizeof(USED_BLOCK);
+  // expand? part1.
+  // next phys block is free and enough size?
+  if( alloc_size > BLOCK_SIZE(target) ) {
+    next = PHYS_NEXT(target);
+    if( IS_USED_BLOCK(next) ) goto EXPAND_BACKWARD;
+    if( (BLOCK_SIZE(target) + BLOCK_SIZE(next)) < alloc_size ) goto EXPAND_BACKWARD;
+
+    remove_free_block( pool, next );
+    merge_block((FREE_BLOCK *)target, next);
+  }
+
+ TRY_SHRINK:
+  next = PHYS_NEXT(target);
+
+  // try shrink.
+  FREE_BLOCK *release = split_block((FREE_BLOCK *)target, alloc_size);
+  if( release != NULL ) {
+    SET_PREV_USED(release);
+  } else {
+    SET_PREV_USED(next);
+    update_peak();
+    count_resize( (uint8_t *)target + sizeof(USED_BLOCK), old_size );
+    REALLOC_RETURN( (uint8_t *)target + sizeof(USED_BLOCK) );
+  }
+
+  // check next block, merge?
+  if( IS_FREE_BLOCK(next) ) {
+    remove_free_block( pool, next );
+    merge_block(release, next);
+  } else {
+    SET_PREV_FREE(next);
+  }
+  add_free_block( pool, release );
+  update_peak();
+  count_resize( (uint8_t *)target + sizeof(USED_BLOCK), old_size );
+  REALLOC_RETURN( (uint8_t *)target + sizeof(USED_BLOCK) );
+
+
+  // expand part2.
+  // prev phys block (and next one) is free and enough size?
+  // move the contents to the prev block, instead of new alloc and copy.
+ EXPAND_BACKWARD:
+  if( IS_PREV_FREE(target) ) {
+    FREE_BLOCK *prev = *((FREE_BLOCK **)((uint8_t*)target - sizeof(FREE_BLOCK *)));
+    next = PHYS_NEXT(target);
+    MRBC_ALLOC_MEMSIZE_T total = BLOCK_SIZE(prev) + BLOCK_SIZE(target);
+    if( IS_FREE_BLOCK(next) ) total += BLOCK_SIZE(next);
+
+    if( total >= alloc_size ) {
+      unsigned int n = BLOCK_SIZE(target) - sizeof(USED_BLOCK);
+
+      remove_free_block( pool, prev );
+      if( IS_FREE_BLOCK(next) ) {
+	remove_free_block( pool, next );
+	merge_block((FREE_BLOCK *)target, next);
+      }
+      merge_block(prev, (FREE_BLOCK *)target);
+      SET_USED_BLOCK(prev);
+      SET_VM_ID(prev, GET_VM_ID(target));
+
+      target = (USED_BLOCK *)prev;
+      memmove( (uint8_t *)target + sizeof(USED_BLOCK), ptr, n );
+#if defined(MRBC_ALLOC_TRACE)
+      trace_move( ptr, (uint8_t *)target + sizeof(USED_BLOCK) );
+#endif
+      goto TRY_SHRINK;
+    }
+  }
+
+  // expand part3.
+  // new alloc and copy
+ {
+#if defined(MRBC_ALLOC_ARENA)
+    void *new_ptr = ( arena && arena->vm_id != 0 ) ?
+			arena_alloc(arena, size) : mrbc_raw_alloc(size);
+#else
+    void *new_ptr = mrbc_raw_alloc(size);
+#endif
+    if( new_ptr == NULL ) REALLOC_RETURN(NULL);  // ENOMEM
+
+    memcpy(new_ptr, ptr, BLOCK_SIZE(target) - sizeof(USED_BLOCK));
+    mrbc_set_vm_id(new_ptr, target->vm_id);
+#if defined(MRBC_ALLOC_TRACE)
+    trace_move( ptr, new_ptr );
+#endif
+
+    mrbc_raw_free(ptr);
+
+    REALLOC_RETURN(new_ptr);
+  }
+}
+
+
+//================================================================
+/*! allocated memory size
+
+  @param  ptr           Return value of mrbc_alloc()
+  @retval unsigned int  pointer to allocated memory.
+*/
+unsigned int mrbc_alloc_usable_size(void *ptr)
+{
+  USED_BLOCK *target = (USED_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK));
+#if defined(MRBC_ALLOC_SLAB)
+  if( IS_SLAB_ITEM(target) ) {
+    return (unsigned int)SLAB_USABLE_SIZE( SLAB_CLASS_IDX(target) );
+  }
+#endif
+  return (unsigned int)(BLOCK_SIZE(target) - sizeof(USED_BLOCK));
+}
+
+
+#if defined(MRBC_ALLOC_VMID)
+//================================================================
+/*! allocate memory
+
+  @param  vm	pointer to VM.
+  @param  size	request size.
+  @return void * pointer to allocated memory.
+  @retval NULL	error.
+*/
+void * mrbc_alloc(const struct VM *vm, unsigned int size)
+{
+  void *ptr;
+
+  // over the quota, only this VM gets ENOMEM and NoMemoryError.
+  if( vm && VM_QUOTA_OVER( vm->vm_id, size + sizeof(USED_BLOCK) ) ) {
+#if defined(MRBC_ALLOC_VM_STATS)
+    vm_stats[vm->vm_id].n_quota_over++;
+    mrbc_raise( (struct VM *)vm, MRBC_CLASS(NoMemoryError), 0 );
+#endif
+    return NULL;
+  }
+
+  EVENT_BEGIN();
+
+#if defined(MRBC_ALLOC_ARENA)
+  ALLOC_ARENA *arena = vm ? arena_find_by_vm_id(vm->vm_id) : NULL;
+  if( arena ) {
+    ptr = arena_alloc(arena, size);
+  } else
+#endif
+  {
+    ptr = mrbc_raw_alloc(size);
+    if( ptr != NULL && vm ) mrbc_set_vm_id(ptr, vm->vm_id);
+  }
+  EVENT_END( ALLOC_EVENT_ALLOC, ptr, size, vm ? vm->vm_id : 0 );
+
+#if defined(MRBC_ALLOC_TRACE)
+  if( ptr != NULL ) {
+    if( vm && vm->cur_irep ) {
+      TRACE_ALLOC( ptr, vm->cur_irep, vm->inst - vm->cur_irep->inst );
+    } else {
+      TRACE_ALLOC( ptr, __builtin_return_address(0), TRACE_PC_CFUNC );
+    }
+  }
+#endif
+
+  return ptr;
+}
+
+
+//================================================================
+/*! release memory, vm used.
+
+  @param  vm	pointer to VM.
+*/
+void mrbc_free_all(const struct VM *vm)
+{
+  int vm_id = vm->vm_id;
+
+#if defined(MRBC_ALLOC_COMPACT)
+  compact_drop_vm( vm_id );
+#endif
+
+#if defined(MRBC_ALLOC_ARENA)
+  ALLOC_ARENA *arena = arena_find_by_vm_id(vm_id);
+  if( arena ) {
+    // reset the arena at once, if no other VM ID block was left.
+    if( arena->n_foreign == 0 ) {
+      EVENT_RESET( arena->pool, arena->pool->size );
+      arena_drop_stats( arena );
+      init_pool( arena->pool, arena->pool->size );
+    } else {
+      free_all_in_pool( arena->pool, vm_id );
+    }
+
+    if( !arena->flag_spilled ) return;
+    arena->flag_spilled = 0;
+  }
+#endif
+
+  free_all_in_pool( memory_pool, vm_id );
+
+#if defined(MRBC_ALLOC_SLAB)
+  unsigned int cls;
+  for( cls = 0; cls < SLAB_NUM_CLASSES; cls++ ) {
+    SLAB_PAGE *page = slab_pages[cls];
+    while( page ) {
+      SLAB_PAGE *next_page = page->next;
+      uint8_t *p = (uint8_t *)page + sizeof(SLAB_PAGE);
+      int i;
+      for( i = 0; i < MRBC_ALLOC_SLAB_ITEMS; i++, p += SLAB_ITEM_SIZE(cls) ) {
+        USED_BLOCK *item = (USED_BLOCK *)p;
+        if( !IS_SLAB_ITEM(item) || item->vm_id != vm_id ) continue;
+
+        // the page may be released by the last item.
+        int flag_last = (page->n_used == 1);
+        count_free( (uint8_t *)item + sizeof(USED_BLOCK) );
+        slab_free( item );
+        if( flag_last ) break;
+      }
+      page = next_page;
+    }
+  }
+#endif
+}
+
+
+//================================================================
+/*! set vm id
+
+  @param  ptr	Return value of mrbc_alloc()
+  @param  vm_id	vm id
+*/
+void mrbc_set_vm_id(void *ptr, int vm_id)
+{
+#if defined(MRBC_ALLOC_ARENA)
+  ALLOC_ARENA *arena = arena_find_by_ptr(ptr);
+  if( arena ) {
+    int owner = arena->vm_id;
+    int old_id = GET_VM_ID( (uint8_t *)ptr - sizeof(USED_BLOCK) );
+    if( old_id == owner && vm_id != owner ) arena->n_foreign++;
+    if( old_id != owner && vm_id == owner ) arena->n_foreign--;
+
+  } else {
+    // block of the owner VM in the memory pool.
+    arena = arena_find_by_vm_id(vm_id);
+    if( arena ) arena->flag_spilled = 1;
+  }
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+  int old_vm_id = GET_VM_ID( (uint8_t *)ptr - sizeof(USED_BLOCK) );
+  if( old_vm_id != vm_id ) {
+    unsigned int size = block_bytes(ptr);
+    vm_stats_sub( old_vm_id, size );
+    vm_stats_add( vm_id, size );
+  }
+#endif
+
+  SET_VM_ID( (uint8_t *)ptr - sizeof(USED_BLOCK), vm_id );
+}
+
+
+//================================================================
+/*! get vm id
+
+  @param  ptr	Return value of mrbc_alloc()
+  @return int	vm id
+*/
+int mrbc_get_vm_id(void *ptr)
+{
+  return GET_VM_ID( (uint8_t *)ptr - sizeof(USED_BLOCK) );
+}
+
+
+#if defined(MRBC_ALLOC_ARENA)
+//================================================================
+/*! reserve the arena for VM.
+
+  @param  vm	pointer to VM.
+  @param  size	arena size.
+  @retval 0	No error.
+  @retval -1	error.
+*/
+int mrbc_alloc_arena_create(const struct VM *vm, unsigned int size)
+{
+  ALLOC_ARENA *arena = arena_new(vm);
+  if( arena == NULL ) return -1;
+
+  size &= ~(unsigned int)0x03;	// align 4 byte.
+  if( size < sizeof(MEMORY_POOL) + MRBC_MIN_MEMORY_BLOCK_SIZE * 2 ) return -1;
+
+  MEMORY_POOL *pool = alloc_block(memory_pool, size);
+  if( pool == NULL ) return -1;		// ENOMEM
+
+  // the arena itself must not be released by mrbc_free_all().
+  SET_VM_ID( (uint8_t *)pool - sizeof(USED_BLOCK), 0xff );
+  init_pool( pool, size );
+
+  arena->pool = pool;
+  arena->vm_id = vm->vm_id;
+  arena->flag_spilled = 0;
+  arena->flag_external = 0;
+  arena->n_foreign = 0;
 
- FALLBACK:
-  return mrbc_raw_alloc(alloc_size);
+  return 0;
 }
 
 
 //================================================================
-/*! release memory
+/*! use the memory as the arena for VM.
 
-  @param  ptr	Return value of mrbc_raw_alloc()
+  The memory is independent of the memory pool, so allocations of the
+  other VMs never exhaust it, nor disturb its allocation time.
+  It isn't released to anywhere, and can be used again after the VM
+  is closed.
+
+  @param  vm	pointer to VM.
+  @param  ptr	pointer to the memory. (4 byte aligned)
+  @param  size	size. (max 64KB. see MRBC_ALLOC_MEMSIZE_T)
+  @retval 0	No error.
+  @retval -1	error.
 */
-void mrbc_raw_free(void *ptr)
+int mrbc_alloc_arena_attach(const struct VM *vm, void *ptr, unsigned int size)
 {
-#if defined(MRBC_DEBUG)
-  {
-    if( ptr == NULL ) {
-      static const char msg[] = "mrbc_raw_free(): NULL pointer was given.\n";
-      hal_write(2, msg, sizeof(msg)-1);
-      return;
-    }
+  assert( ((uintptr_t)ptr & 0x03) == 0 );
+  assert( size <= (MRBC_ALLOC_MEMSIZE_T)(~0) );
 
-    FREE_BLOCK *target = (FREE_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK));
-    FREE_BLOCK *block = BLOCK_TOP(memory_pool);
-    while( block < (FREE_BLOCK *)BLOCK_END(memory_pool) ) {
-      if( block == target ) break;
-      block = PHYS_NEXT(block);
-    }
+  ALLOC_ARENA *arena = arena_new(vm);
+  if( arena == NULL ) return -1;
 
-    if( block != target || IS_FREE_BLOCK(block) ) {
-      static const char msg[] = "mrbc_raw_free(): double free detected.\n";
-      hal_write(2, msg, sizeof(msg)-1);
-      return;
-    }
+  size &= ~(unsigned int)0x03;	// align 4 byte.
+  if( size < sizeof(MEMORY_POOL) + MRBC_MIN_MEMORY_BLOCK_SIZE * 2 ) return -1;
 
-    SET_VM_ID( target, 0xff );
-    memset( ptr, 0xff, BLOCK_SIZE(target) - sizeof(USED_BLOCK) );
-  }
-#endif
+  init_pool( ptr, size );
 
-  MEMORY_POOL *pool = memory_pool;
+  arena->pool = ptr;
+  arena->vm_id = vm->vm_id;
+  arena->flag_spilled = 0;
+  arena->flag_external = 1;
+  arena->n_foreign = 0;
+
+  return 0;
+}
 
-  // get target block
-  FREE_BLOCK *target = (FREE_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK));
 
-  // check next block, merge?
-  FREE_BLOCK *next = PHYS_NEXT(target);
+//================================================================
+/*! release the arena of VM.
 
-  if( IS_FREE_BLOCK(next) ) {
-    remove_free_block( pool, next );
-    merge_block(target, next);
-  } else {
-    SET_PREV_FREE(next);
-  }
+  If blocks owned by other VM ID are still left, the arena is detached
+  from the VM, and it will be released when the last block is freed.
 
-  // check prev block, merge?
-  if( IS_PREV_FREE(target) ) {
-    FREE_BLOCK *prev = *((FREE_BLOCK **)((uint8_t*)target - sizeof(FREE_BLOCK *)));
+  @param  vm	pointer to VM.
+*/
+void mrbc_alloc_arena_delete(const struct VM *vm)
+{
+  ALLOC_ARENA *arena = arena_find_by_vm_id(vm->vm_id);
+  if( arena == NULL ) return;
 
-    assert( IS_FREE_BLOCK(prev) );
-    remove_free_block( pool, prev );
-    merge_block(prev, target);
-    target = prev;
+  if( arena->n_foreign == 0 ) {
+    arena_drop_stats( arena );
+    arena_release( arena );
+    return;
   }
 
-  // target, add to index
-  add_free_block( pool, target );
+  free_all_in_pool( arena->pool, arena->vm_id );
+
+  // detach. all left blocks are regarded as the owner's.
+  arena->vm_id = 0;
+  arena->n_foreign = 0;
+  arena_release_if_empty( arena );
 }
+#endif	// defined(MRBC_ALLOC_ARENA)
+#endif	// defined(MRBC_ALLOC_VMID)
 
 
 //================================================================
-/*! re-allocate memory
+/*! set the low memory hook.
 
-  @param  ptr	Return value of mrbc_raw_alloc()
-  @param  size	request size
-  @return void * pointer to allocated memory.
-  @retval NULL	error.
+  The hook is called in the allocator when the free memory goes below
+  the threshold, and once more at the out of memory before it fails.
+  It can release the memory not in use (e.g. caches), or notify a task.
+  It must not allocate memory.
+
+  @param  func		hook function, or NULL to remove it.
+  @param  threshold	free memory in bytes.
 */
-void * mrbc_raw_realloc(void *ptr, unsigned int size)
+void mrbc_alloc_set_low_memory_hook(void (*func)(unsigned int free_size), unsigned int threshold)
 {
-  MEMORY_POOL *pool = memory_pool;
-  volatile USED_BLOCK *target = (USED_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK));
-  MRBC_ALLOC_MEMSIZE_T alloc_size = size + sizeof(USED_BLOCK);
-  FREE_BLOCK *next;
+  low_memory_hook = func;
+  low_memory_threshold = threshold;
+  low_memory_fired = 0;
+}
 
-  // align 4 byte
-  alloc_size += (-alloc_size & 3);
 
-  // check minimum alloc size.
-  if( alloc_size < MRBC_MIN_MEMORY_BLOCK_SIZE ) alloc_size = MRBC_MIN_MEMORY_BLOCK_SIZE;
+//================================================================
+/*! register an evictable cache.
 
-  // expand? part1.
-  // next phys block is free and enough size?
-  if( alloc_size > BLOCK_SIZE(target) ) {
-    next = PHYS_NEXT(target);
-    if( IS_USED_BLOCK(next) ) goto ALLOC_AND_COPY;
-    if( (BLOCK_SIZE(target) + BLOCK_SIZE(next)) < alloc_size ) goto ALLOC_AND_COPY;
+  @param  cache	pointer to cache entry, that must be static.
+*/
+void mrbc_alloc_register_cache(mrbc_alloc_cache *cache)
+{
+  mrbc_alloc_cache **pp;
 
-    remove_free_block( pool, next );
-    merge_block((FREE_BLOCK *)target, next);
+  for( pp = &cache_head; *pp != NULL; pp = &(*pp)->next ) {
+    if( *pp == cache ) return;		// already registered.
   }
-  next = PHYS_NEXT(target);
 
-  // try shrink.
-  FREE_BLOCK *release = split_block((FREE_BLOCK *)target, alloc_size);
-  if( release != NULL ) {
-    SET_PREV_USED(release);
-  } else {
-    SET_PREV_USED(next);
-    return ptr;
+  for( pp = &cache_head; *pp != NULL; pp = &(*pp)->next ) {
+    if( (*pp)->priority > cache->priority ) break;
   }
+  cache->next = *pp;
+  *pp = cache;
+}
 
-  // check next block, merge?
-  if( IS_FREE_BLOCK(next) ) {
-    remove_free_block( pool, next );
-    merge_block(release, next);
-  } else {
-    SET_PREV_FREE(next);
-  }
-  add_free_block( pool, release );
-  return ptr;
 
+#if defined(MRBC_ALLOC_COMPACT)
+//================================================================
+/*! register the buffer of the object as relocatable.
 
-  // expand part2.
-  // new alloc and copy
- ALLOC_AND_COPY: {
-    void *new_ptr = mrbc_raw_alloc(size);
-    if( new_ptr == NULL ) return NULL;  // ENOMEM
+  The compactor moves the buffer pointed by *slot, and rewrites *slot.
+  Call this only if nobody else keeps the pointer to the buffer, and
+  mrbc_alloc_compact_remove() before the buffer is given to the others
+  or the object is released. If the entries are full, it is not moved.
 
-    memcpy(new_ptr, ptr, BLOCK_SIZE(target) - sizeof(USED_BLOCK));
-    mrbc_set_vm_id(new_ptr, target->vm_id);
+  @param  obj	pointer to the owner object, allocated by mrbc_alloc().
+  @param  slot	pointer to the member of the object, that holds the buffer.
+*/
+void mrbc_alloc_compact_add(void *obj, void *slot)
+{
+  unsigned int i;
 
-    mrbc_raw_free(ptr);
+  for( i = 0; i < MRBC_ALLOC_COMPACT_SLOTS; i++ ) {
+    if( compact_slots[i].slot ) continue;
 
-    return new_ptr;
+    compact_slots[i].obj = obj;
+    compact_slots[i].slot = (void **)slot;
+    if( compact_n_slots <= i ) compact_n_slots = i + 1;
+    return;
   }
 }
 
 
 //================================================================
-/*! allocated memory size
+/*! unregister the relocatable buffer.
 
-  @param  ptr           Return value of mrbc_alloc()
-  @retval unsigned int  pointer to allocated memory.
+  @param  slot	pointer to the member given to mrbc_alloc_compact_add().
 */
-unsigned int mrbc_alloc_usable_size(void *ptr)
+void mrbc_alloc_compact_remove(void *slot)
 {
-  USED_BLOCK *target = (USED_BLOCK *)((uint8_t *)ptr - sizeof(USED_BLOCK));
-  return (unsigned int)(BLOCK_SIZE(target) - sizeof(USED_BLOCK));
+  unsigned int i;
+
+  for( i = 0; i < compact_n_slots; i++ ) {
+    if( compact_slots[i].slot != slot ) continue;
+
+    compact_slots[i].slot = NULL;
+    while( compact_n_slots > 0 && !compact_slots[compact_n_slots-1].slot ) {
+      compact_n_slots--;
+    }
+    return;
+  }
 }
 
 
-#if defined(MRBC_ALLOC_VMID)
 //================================================================
-/*! allocate memory
+/*! move one of the relocatable buffers into the free block before it.
 
-  @param  vm	pointer to VM.
-  @param  size	request size.
-  @return void * pointer to allocated memory.
-  @retval NULL	error.
+  It is moved only if the free block will be merged with the next free
+  block, or the next block can be moved again. Call this while no task
+  is ready, so that nobody else is in the middle of using the buffer.
+
+  @return	non zero if a block was moved, or 0 if nothing to do.
 */
-void * mrbc_alloc(const struct VM *vm, unsigned int size)
+int mrbc_alloc_compact_step(void)
+{
+  if( compact_n_slots == 0 ) return 0;
+
+  MEMORY_POOL *pool = memory_pool;
+  USED_BLOCK *target = BLOCK_TOP(pool);
+
+  for( ; target < (USED_BLOCK *)BLOCK_END(pool); target = PHYS_NEXT(target) ) {
+    if( IS_FREE_BLOCK(target) || IS_PREV_USED(target) ) continue;
+
+    ALLOC_COMPACT_SLOT *entry = compact_find( target );
+    if( !entry ) continue;
+
+    USED_BLOCK *next = PHYS_NEXT(target);
+    if( IS_USED_BLOCK(next) && !compact_find( next ) ) continue;
+
+    compact_move( pool, target, entry );
+    return 1;
+  }
+
+  return 0;
+}
+#endif
+
+
+#if defined(MRBC_DEBUG)
+//================================================================
+/*! print the registered caches and the eviction counts.
+*/
+void mrbc_alloc_print_caches(void)
 {
-  void *ptr = mrbc_raw_alloc(size);
-  if( ptr == NULL ) return NULL;	// ENOMEM
+  mrbc_alloc_cache *cache;
+
+  for( cache = cache_head; cache != NULL; cache = cache->next ) {
+    mrbc_printf("%-12s prio=%d evicted=%u\n",
+		cache->name, cache->priority, cache->n_evicted);
+  }
+}
+#endif
 
-  if( vm ) mrbc_set_vm_id(ptr, vm->vm_id);
 
-  return ptr;
+//================================================================
+/*! reset the high-water marks to the current usage.
+*/
+void mrbc_alloc_reset_peak( void )
+{
+  peak_used = 0;
+  update_peak();
+
+#if defined(MRBC_ALLOC_VM_STATS)
+  int i;
+  for( i = 0; i <= MAX_VM_COUNT; i++ ) {
+    vm_stats[i].peak = vm_stats[i].used;
+  }
+#endif
 }
 
 
+#if defined(MRBC_ALLOC_TIMING)
 //================================================================
-/*! release memory, vm used.
+/*! get the cycles of each operation.
 
-  @param  vm	pointer to VM.
+  @param  ret	array of MRBC_ALLOC_TIMING_NUM, indexed by MRBC_ALLOC_TIMING_*
 */
-void mrbc_free_all(const struct VM *vm)
+void mrbc_alloc_timing(struct MRBC_ALLOC_TIMING_STAT ret[])
 {
-  MEMORY_POOL *pool = memory_pool;
-  USED_BLOCK *target = BLOCK_TOP(pool);
-  USED_BLOCK *next;
-  int vm_id = vm->vm_id;
+  memcpy( ret, alloc_timing, sizeof(alloc_timing) );
+}
 
-  while( target < (USED_BLOCK *)BLOCK_END(pool) ) {
-    next = PHYS_NEXT(target);
-    if( IS_FREE_BLOCK(next) ) next = PHYS_NEXT(next);
 
-    if( IS_USED_BLOCK(target) && (target->vm_id == vm_id) ) {
-      mrbc_raw_free( (uint8_t *)target + sizeof(USED_BLOCK) );
-    }
-    target = next;
-  }
+//================================================================
+/*! reset the cycles of each operation.
+*/
+void mrbc_alloc_timing_reset(void)
+{
+  memset( alloc_timing, 0, sizeof(alloc_timing) );
 }
+#endif
 
 
+#if defined(MRBC_ALLOC_VM_STATS)
 //================================================================
-/*! set vm id
+/*! statistics of VM ID
 
-  @param  ptr	Return value of mrbc_alloc()
-  @param  vm_id	vm id
+  Only used, peak, the allocation counters and the quota are set.
+  The blocks not owned by VM (vm_id 0) are counted as VM ID 0.
+
+  @param  vm_id	VM ID.
+  @param  ret	pointer to return value.
+  @retval 0	No error.
+  @retval -1	vm_id is out of range.
 */
-void mrbc_set_vm_id(void *ptr, int vm_id)
+int mrbc_alloc_vm_statistics( int vm_id, struct MRBC_ALLOC_STATISTICS *ret )
 {
-  SET_VM_ID( (uint8_t *)ptr - sizeof(USED_BLOCK), vm_id );
+  if( vm_id < 0 || vm_id > MAX_VM_COUNT ) return -1;
+
+  const ALLOC_VM_STATS *st = &vm_stats[vm_id];
+  memset( ret, 0, sizeof(struct MRBC_ALLOC_STATISTICS) );
+  ret->total = memory_pool->size;
+  ret->used = st->used;
+  ret->peak = st->peak;
+  ret->n_alloc = st->n_alloc;
+  ret->n_free = st->n_free;
+  ret->alloc_bytes = st->alloc_bytes;
+  ret->quota = st->quota;
+  ret->n_quota_over = st->n_quota_over;
+
+  return 0;
 }
 
 
 //================================================================
-/*! get vm id
+/*! set the quota of VM.
 
-  @param  ptr	Return value of mrbc_alloc()
-  @return int	vm id
+  mrbc_alloc() for VM returns NULL and raises NoMemoryError in VM, if
+  the used bytes of VM will be over the quota. The other VMs are not
+  affected.
+
+  @param  vm	pointer to VM.
+  @param  size	quota in bytes. 0 is unlimited.
 */
-int mrbc_get_vm_id(void *ptr)
+void mrbc_alloc_set_quota(const struct VM *vm, unsigned int size)
 {
-  return GET_VM_ID( (uint8_t *)ptr - sizeof(USED_BLOCK) );
+  vm_stats[vm->vm_id].quota = size;
 }
-#endif	// defined(MRBC_ALLOC_VMID)
+#endif
 
 
 //================================================================
@@ -851,6 +2704,11 @@ void mrbc_alloc_statistics( struct MRBC_ALLOC_STATISTICS *ret )
   ret->used = 0;
   ret->free = 0;
   ret->fragmentation = -1;
+  ret->permanent = BLOCK_SIZE(permanent_block);
+  ret->peak = peak_used - sizeof(MEMORY_POOL);
+  ret->n_alloc = n_alloc_total;
+  ret->n_free = n_free_total;
+  ret->alloc_bytes = alloc_bytes_total;
 
   while( block < (USED_BLOCK *)BLOCK_END(pool) ) {
     if( IS_FREE_BLOCK(block) ) {
@@ -864,6 +2722,44 @@ void mrbc_alloc_statistics( struct MRBC_ALLOC_STATISTICS *ret )
     }
     block = PHYS_NEXT(block);
   }
+
+#if defined(MRBC_ALLOC_SLAB)
+  ret->slab_total = 0;
+  ret->slab_used = 0;
+
+  unsigned int cls;
+  for( cls = 0; cls < SLAB_NUM_CLASSES; cls++ ) {
+    SLAB_PAGE *page;
+    for( page = slab_pages[cls]; page != NULL; page = page->next ) {
+      ret->slab_total += BLOCK_SIZE((USED_BLOCK *)((uint8_t *)page - sizeof(USED_BLOCK)));
+      ret->slab_used += page->n_used * SLAB_ITEM_SIZE(cls);
+    }
+  }
+#endif
+}
+
+
+//================================================================
+/*! statistics counters, without walking the memory pool.
+
+  Only total, used, free, peak, n_alloc, n_free and alloc_bytes are
+  set. This takes a constant time and can be called from interrupt
+  handler.
+
+  @param  ret		pointer to return value.
+*/
+void mrbc_alloc_counters( struct MRBC_ALLOC_STATISTICS *ret )
+{
+  MEMORY_POOL *pool = memory_pool;
+
+  memset( ret, 0, sizeof(struct MRBC_ALLOC_STATISTICS) );
+  ret->total = pool->size;
+  ret->free = pool->free_size;
+  ret->used = pool->size - pool->free_size - sizeof(MEMORY_POOL);
+  ret->peak = peak_used - sizeof(MEMORY_POOL);
+  ret->n_alloc = n_alloc_total;
+  ret->n_free = n_free_total;
+  ret->alloc_bytes = alloc_bytes_total;
 }
 
 
@@ -948,5 +2844,166 @@ void mrbc_alloc_print_memory_pool( void )
   }
 }
 
+
+#if defined(MRBC_ALLOC_TRACE)
+//================================================================
+/*! print the heap report.
+
+  histograms by size class, by object type and by allocation site,
+  and the largest free block history.
+  Object type is guessed from the type tag in the object header.
+*/
+void mrbc_alloc_print_heap_report( void )
+{
+  static const char type_tags[][2] = {
+    {'S','T'}, {'A','R'}, {'H','A'}, {'I','N'}, {'P','R'}, {'R','A'},
+    {'E','X'}, {'V','M'},
+  };
+  enum { N_TYPES = sizeof(type_tags) / sizeof(type_tags[0]), N_SITES = 10 };
+  MEMORY_POOL *pool = memory_pool;
+  int i;
+
+  // by size class.
+  unsigned int used_cnt[MRBC_ALLOC_FLI_BIT_WIDTH+1] = {0};
+  unsigned int used_siz[MRBC_ALLOC_FLI_BIT_WIDTH+1] = {0};
+  unsigned int free_cnt[MRBC_ALLOC_FLI_BIT_WIDTH+1] = {0};
+  unsigned int free_siz[MRBC_ALLOC_FLI_BIT_WIDTH+1] = {0};
+  USED_BLOCK *block = BLOCK_TOP(pool);
+  while( block < (USED_BLOCK *)permanent_block ) {
+    unsigned int fli = FLI(calc_index(BLOCK_SIZE(block)));
+    if( IS_USED_BLOCK(block) ) {
+      used_cnt[fli]++;
+      used_siz[fli] += BLOCK_SIZE(block);
+    } else {
+      free_cnt[fli]++;
+      free_siz[fli] += BLOCK_SIZE(block);
+    }
+    block = PHYS_NEXT(block);
+  }
+
+  mrbc_printf("== HEAP REPORT ==\n");
+  mrbc_printf(" size class    used       (bytes)  free       (bytes)\n");
+  for( i = 0; i <= MRBC_ALLOC_FLI_BIT_WIDTH; i++ ) {
+    if( used_cnt[i] == 0 && free_cnt[i] == 0 ) continue;
+    unsigned int lo = i ? (1 << (i + MRBC_ALLOC_SLI_BIT_WIDTH + MRBC_ALLOC_IGNORE_LSBS - 1)) : 0;
+    mrbc_printf(" >=%6d  %6d %10d   %6d %10d\n", lo,
+		used_cnt[i], used_siz[i], free_cnt[i], free_siz[i] );
+  }
+  mrbc_printf(" permanent   %17d\n", BLOCK_SIZE(permanent_block));
+
+  // by object type and allocation site.
+  unsigned int type_cnt[N_TYPES+1] = {0};
+  unsigned int type_siz[N_TYPES+1] = {0};
+  struct {
+    const void *site;
+    uint16_t pc;
+    unsigned int cnt;
+    unsigned int siz;
+  } sites[N_SITES+1] = {{0}};
+  int n_sites = 0;
+
+  for( i = 0; i < MRBC_ALLOC_TRACE_SIZE; i++ ) {
+    const ALLOC_TRACE *t = &alloc_trace[i];
+    if( t->ptr == NULL || t->ptr == TRACE_DELETED ) continue;
+    unsigned int siz = mrbc_alloc_usable_size( t->ptr );
+
+    const uint8_t *p = (const uint8_t *)t->ptr;
+    int j;
+    for( j = 0; j < N_TYPES; j++ ) {
+      if( p[0] == type_tags[j][0] && p[1] == type_tags[j][1] ) break;
+    }
+    type_cnt[j]++;
+    type_siz[j] += siz;
+
+    for( j = 0; j < n_sites; j++ ) {
+      if( sites[j].site == t->site && sites[j].pc == t->pc ) break;
+    }
+    if( j == n_sites ) {
+      if( n_sites < N_SITES ) {
+	n_sites++;
+	sites[j].site = t->site;
+	sites[j].pc = t->pc;
+      } else {
+	j = N_SITES;		// others.
+      }
+    }
+    sites[j].cnt++;
+    sites[j].siz += siz;
+  }
+
+  mrbc_printf(" type   count    (bytes)\n");
+  for( i = 0; i <= N_TYPES; i++ ) {
+    if( type_cnt[i] == 0 ) continue;
+    if( i < N_TYPES ) {
+      mrbc_printf("   %c%c", type_tags[i][0], type_tags[i][1] );
+    } else {
+      mrbc_printf("  buf" );
+    }
+    mrbc_printf(" %7d %10d\n", type_cnt[i], type_siz[i] );
+  }
+
+  mrbc_printf(" site          pc   count    (bytes)\n");
+  while( 1 ) {
+    int max = -1;
+    for( i = 0; i < n_sites; i++ ) {
+      if( sites[i].cnt && (max < 0 || sites[max].siz < sites[i].siz) ) max = i;
+    }
+    if( max < 0 ) break;
+    if( sites[max].pc == TRACE_PC_CFUNC ) {
+      mrbc_printf(" %p   C", sites[max].site );
+    } else {
+      mrbc_printf(" %p %4d", sites[max].site, sites[max].pc );
+    }
+    mrbc_printf(" %7d %10d\n", sites[max].cnt, sites[max].siz );
+    sites[max].cnt = 0;
+  }
+  if( sites[N_SITES].cnt ) {
+    mrbc_printf(" (others)       %7d %10d\n", sites[N_SITES].cnt, sites[N_SITES].siz );
+  }
+
+  // largest free block.
+  mrbc_printf(" largest free: %d (min %d) history:",
+	      largest_free_block(pool), trace_largest_min );
+  for( i = 0; i < MRBC_ALLOC_TRACE_HISTORY; i++ ) {
+    mrbc_printf(" %d", trace_largest_history[i] );
+  }
+  mrbc_printf("\n allocs: %d  out of memory: %d  untraced: %d\n",
+	      trace_alloc_count, trace_oom, trace_overflow );
+}
+#endif // defined(MRBC_ALLOC_TRACE)
+
 #endif // defined(MRBC_DEBUG)
+
+
+#if defined(MRBC_ALLOC_EVENT_LOG)
+//================================================================
+/*! print the allocation event ring buffer in hex, oldest first.
+
+  (format)
+    == ALLOC EVENT LOG pool:<address> count:<total events> ==
+    one event (16 bytes) in 32 hex digits per line
+    == END ==
+  see tools/alloc_event_decode.rb
+  If the events are streamed out, only the header is printed.
+*/
+void mrbc_alloc_print_event_log( void )
+{
+  uint32_t count = event_count;
+
+  mrbc_printf("== ALLOC EVENT LOG pool:%p count:%d ==\n", memory_pool, count );
+#if !defined(MRBC_ALLOC_EVENT_OUTPUT)
+  uint32_t n = count < MRBC_ALLOC_EVENT_LOG_SIZE ? count : MRBC_ALLOC_EVENT_LOG_SIZE;
+  uint32_t i;
+  for( i = count - n; i != count; i++ ) {
+    const uint8_t *p = (const uint8_t *)&alloc_event_log[i % MRBC_ALLOC_EVENT_LOG_SIZE];
+    int j;
+    for( j = 0; j < sizeof(ALLOC_EVENT); j++ ) {
+      mrbc_printf("%02x", p[j] );
+    }
+    mrbc_printf("\n");
+  }
+#endif
+  mrbc_printf("== END ==\n");
+}
+#endif
 #endif // !defined(MRBC_ALLOC_LIBC)
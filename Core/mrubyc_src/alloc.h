@@ -40,8 +40,58 @@ struct MRBC_ALLOC_STATISTICS {
   unsigned int used;		//!< returns used memory.
   unsigned int free;		//!< returns free memory.
   unsigned int fragmentation;	//!< returns memory fragmentation count.
+  unsigned int permanent;	//!< returns memory size of permanent objects.
+  unsigned int peak;		//!< returns high-water mark of used memory.
+  unsigned int n_alloc;		//!< returns number of allocations.
+  unsigned int n_free;		//!< returns number of releases.
+  unsigned int alloc_bytes;	//!< returns total allocated bytes.
+#if defined(MRBC_ALLOC_SLAB)
+  unsigned int slab_total;	//!< returns memory size of slab pages.
+  unsigned int slab_used;	//!< returns memory size of used slab items.
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+  unsigned int quota;		//!< returns quota of VM ID, or 0 if unlimited.
+  unsigned int n_quota_over;	//!< returns number of allocations over the quota.
+#endif
+};
+
+/*!@brief
+  Return value structure for mrbc_alloc_timing function.
+*/
+struct MRBC_ALLOC_TIMING_STAT {
+  unsigned int count;		//!< number of calls.
+  unsigned int max;		//!< maximum cycles of a call.
+  unsigned int total;		//!< total cycles. (wrap around)
 };
 
+//! index of mrbc_alloc_timing().
+enum {
+  MRBC_ALLOC_TIMING_ALLOC,
+  MRBC_ALLOC_TIMING_FREE,
+  MRBC_ALLOC_TIMING_REALLOC,
+  MRBC_ALLOC_TIMING_NUM,
+};
+
+/*!@brief
+  Cache that can be released at the out of memory.
+
+  The caches are evicted in the order of the priority, lower first,
+  until the allocation is satisfied. evict() is called in the allocator,
+  so it must not allocate memory. It can be called in the middle of any
+  allocation, also in the owner of the cache.
+*/
+typedef struct MRBC_ALLOC_CACHE {
+  const char *name;		//!< name, such as "symid".
+  int priority;			//!< lower is evicted first.
+  unsigned int (*evict)(unsigned int size);	//!< returns released bytes.
+  unsigned int n_evicted;	//!< number of times released something.
+  struct MRBC_ALLOC_CACHE *next;	//!< next entry in the registry.
+} mrbc_alloc_cache;
+
+//! initializer of a static cache entry.
+#define MRBC_ALLOC_CACHE_INITIALIZER(name, priority, evict) \
+  { (name), (priority), (evict) }
+
 struct VM;
 
 /***** Global variables *****************************************************/
@@ -60,7 +110,27 @@ void *mrbc_raw_realloc(void *ptr, unsigned int size);
 #define mrbc_realloc(vm,ptr,size)	mrbc_raw_realloc(ptr, size)
 unsigned int mrbc_alloc_usable_size(void *ptr);
 void mrbc_alloc_statistics(struct MRBC_ALLOC_STATISTICS *ret);
+void mrbc_alloc_counters(struct MRBC_ALLOC_STATISTICS *ret);
+void mrbc_alloc_reset_peak(void);
+void mrbc_alloc_set_low_memory_hook(void (*func)(unsigned int free_size), unsigned int threshold);
+void mrbc_alloc_register_cache(mrbc_alloc_cache *cache);
+#if defined(MRBC_DEBUG)
+void mrbc_alloc_print_caches(void);
+#endif
+#if defined(MRBC_ALLOC_TIMING)
+void mrbc_alloc_timing(struct MRBC_ALLOC_TIMING_STAT ret[]);
+void mrbc_alloc_timing_reset(void);
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+int mrbc_alloc_vm_statistics(int vm_id, struct MRBC_ALLOC_STATISTICS *ret);
+#endif
 void mrbc_alloc_print_memory_pool(void);
+#if defined(MRBC_ALLOC_TRACE)
+void mrbc_alloc_print_heap_report(void);
+#endif
+#if defined(MRBC_ALLOC_EVENT_LOG)
+void mrbc_alloc_print_event_log(void);
+#endif
 
 
 #if defined(MRBC_ALLOC_VMID)
@@ -69,6 +139,19 @@ void *mrbc_alloc(const struct VM *vm, unsigned int size);
 void mrbc_free_all(const struct VM *vm);
 void mrbc_set_vm_id(void *ptr, int vm_id);
 int mrbc_get_vm_id(void *ptr);
+#if defined(MRBC_ALLOC_ARENA)
+int mrbc_alloc_arena_create(const struct VM *vm, unsigned int size);
+int mrbc_alloc_arena_attach(const struct VM *vm, void *ptr, unsigned int size);
+void mrbc_alloc_arena_delete(const struct VM *vm);
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+void mrbc_alloc_set_quota(const struct VM *vm, unsigned int size);
+#endif
+#if defined(MRBC_ALLOC_COMPACT)
+void mrbc_alloc_compact_add(void *obj, void *slot);
+void mrbc_alloc_compact_remove(void *slot);
+int mrbc_alloc_compact_step(void);
+#endif
 
 # else
 #define mrbc_alloc(vm,size)	mrbc_raw_alloc(size)
@@ -100,6 +183,10 @@ static inline void mrbc_raw_free(void *ptr) {
 static inline void *mrbc_raw_realloc(void *ptr, unsigned int size) {
   return realloc(ptr, size);
 }
+static inline void mrbc_alloc_set_low_memory_hook(void (*func)(unsigned int free_size), unsigned int threshold) {
+}
+static inline void mrbc_alloc_register_cache(mrbc_alloc_cache *cache) {
+}
 /*
  * When MRBC_ALLOC_LIBC is defined, you can not use mrbc_alloc_usable_size()
  * as malloc_usable_size() is not defined in C99.
@@ -127,6 +214,11 @@ static inline int mrbc_get_vm_id(void *ptr) {
 }
 #endif	// MRBC_ALLOC_LIBC
 
+#if !defined(MRBC_ALLOC_COMPACT)
+#define mrbc_alloc_compact_add(obj,slot)	((void)0)
+#define mrbc_alloc_compact_remove(slot)		((void)0)
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,227 @@
+/*! @file
+  @brief
+  mruby/c support of the AOT compiled methods. (see tools/mrbc_aot.rb)
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  A compiled method is a C function that uses the registers of the VM
+  as the method would do. The fast paths of Integer and Float are done
+  in place, and the other cases are run in the VM by mrbc_aot_exec()
+  or mrbc_aot_send().
+  </pre>
+*/
+
+#ifndef MRBC_SRC_AOT_H_
+#define MRBC_SRC_AOT_H_
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+/***** Local headers ********************************************************/
+#include "value.h"
+#include "class.h"
+#include "error.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/***** Constat values *******************************************************/
+//! maximum number of the compiled methods.
+#if !defined(MRBC_AOT_METHODS_MAX)
+#define MRBC_AOT_METHODS_MAX 16
+#endif
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+/***** Global variables *****************************************************/
+/***** Function prototypes **************************************************/
+struct VM;
+struct IREP;
+int mrbc_aot_define(const char *class_name, const char *method_name, uint32_t hash, mrbc_func_t func);
+mrbc_func_t mrbc_aot_find(const mrbc_class *cls, mrbc_sym sym_id, const struct IREP *irep);
+int mrbc_aot_exec(struct VM *vm, mrbc_value *regs, const uint8_t *inst);
+int mrbc_aot_send(struct VM *vm, mrbc_value *regs, const uint8_t *site, mrbc_sym sym_id, int a, int c);
+int mrbc_aot_getconst(struct VM *vm, mrbc_value *regs, int a, mrbc_sym sym_id);
+void mrbc_aot_return(mrbc_value *regs, int a, int nregs);
+
+
+/***** Inline functions *****************************************************/
+
+//================================================================
+/*! R[a] = R[b]
+*/
+static inline void mrbc_aot_move( mrbc_value *dst, mrbc_value *src )
+{
+  mrbc_incref( src );
+  mrbc_decref( dst );
+  *dst = *src;
+}
+
+
+//================================================================
+/*! R[a] = value, that is not reference counted.
+*/
+static inline void mrbc_aot_set( mrbc_value *dst, mrbc_value v )
+{
+  mrbc_decref( dst );
+  *dst = v;
+}
+
+
+//================================================================
+/*! R[a] = ivget(sym_id)
+
+  @return	non-zero if an exception is raised.
+*/
+static inline int mrbc_aot_getiv( struct VM *vm, mrbc_value *regs, int a, mrbc_sym sym_id )
+{
+  if( regs[0].tt != MRBC_TT_OBJECT ) {
+    mrbc_raise(vm, MRBC_CLASS(NotImplementedError), 0);
+    return -1;
+  }
+  mrbc_decref( &regs[a] );
+  regs[a] = mrbc_instance_getiv( &regs[0], sym_id );
+  return 0;
+}
+
+
+//================================================================
+/*! ivset(sym_id, R[a])
+
+  @return	non-zero if an exception is raised.
+*/
+static inline int mrbc_aot_setiv( struct VM *vm, mrbc_value *regs, int a, mrbc_sym sym_id )
+{
+  if( regs[0].tt != MRBC_TT_OBJECT ) {
+    mrbc_raise(vm, MRBC_CLASS(NotImplementedError), 0);
+    return -1;
+  }
+  mrbc_instance_setiv( &regs[0], sym_id, &regs[a] );
+  return 0;
+}
+
+
+//================================================================
+/*! arithmetic instructions, R[a] = R[a] op R[a+1]
+
+  Integer without overflow, and Float are done here. The others are
+  by the instruction in the VM.
+  @return	non-zero if an exception is raised.
+*/
+#if MRBC_USE_FLOAT
+#define MRBC_AOT_ARITH_FLOAT(r, op) \
+  if( r[0].tt == MRBC_TT_FLOAT && r[1].tt == MRBC_TT_FLOAT ) { \
+    r[0].d = r[0].d op r[1].d; \
+    return 0; \
+  }
+#else
+#define MRBC_AOT_ARITH_FLOAT(r, op)
+#endif
+
+#define MRBC_AOT_ARITH(name, builtin, op) \
+static inline int mrbc_aot_##name( struct VM *vm, mrbc_value *regs, int a, const uint8_t *inst ) \
+{ \
+  mrbc_value *r = &regs[a]; \
+  mrbc_int_t n; \
+  if( r[0].tt == MRBC_TT_INTEGER && r[1].tt == MRBC_TT_INTEGER && \
+      !builtin( r[0].i, r[1].i, &n ) ) { \
+    r[0].i = n; \
+    return 0; \
+  } \
+  MRBC_AOT_ARITH_FLOAT(r, op) \
+  return mrbc_aot_exec( vm, regs, inst ); \
+}
+
+MRBC_AOT_ARITH(add, __builtin_add_overflow, +)
+MRBC_AOT_ARITH(sub, __builtin_sub_overflow, -)
+MRBC_AOT_ARITH(mul, __builtin_mul_overflow, *)
+
+
+//================================================================
+/*! R[a] = R[a] / R[a+1]
+
+  @return	non-zero if an exception is raised.
+*/
+static inline int mrbc_aot_div( struct VM *vm, mrbc_value *regs, int a, const uint8_t *inst )
+{
+  mrbc_value *r = &regs[a];
+  if( r[0].tt == MRBC_TT_INTEGER && r[1].tt == MRBC_TT_INTEGER &&
+      r[1].i != 0 && r[1].i != -1 ) {
+    r[0].i /= r[1].i;		// truncated as the VM does.
+    return 0;
+  }
+  MRBC_AOT_ARITH_FLOAT(r, /)
+  return mrbc_aot_exec( vm, regs, inst );
+}
+
+
+//================================================================
+/*! R[a] = R[a] op R[a+1], compare instructions.
+
+  @return	non-zero if an exception is raised.
+*/
+#if MRBC_USE_FLOAT
+#define MRBC_AOT_COMPARE_FLOAT(r, op) \
+  if( r[0].tt == MRBC_TT_FLOAT && r[1].tt == MRBC_TT_FLOAT ) { \
+    r[0].tt = MRBC_TT_FALSE + (r[0].d op r[1].d); \
+    return 0; \
+  }
+#else
+#define MRBC_AOT_COMPARE_FLOAT(r, op)
+#endif
+
+#define MRBC_AOT_COMPARE(name, op) \
+static inline int mrbc_aot_##name( struct VM *vm, mrbc_value *regs, int a, const uint8_t *inst ) \
+{ \
+  mrbc_value *r = &regs[a]; \
+  if( r[0].tt == MRBC_TT_INTEGER && r[1].tt == MRBC_TT_INTEGER ) { \
+    r[0].tt = MRBC_TT_FALSE + (r[0].i op r[1].i); \
+    return 0; \
+  } \
+  MRBC_AOT_COMPARE_FLOAT(r, op) \
+  return mrbc_aot_exec( vm, regs, inst ); \
+}
+
+MRBC_AOT_COMPARE(eq, ==)
+MRBC_AOT_COMPARE(lt, <)
+MRBC_AOT_COMPARE(le, <=)
+MRBC_AOT_COMPARE(gt, >)
+MRBC_AOT_COMPARE(ge, >=)
+
+
+//================================================================
+/*! R[a] = R[a] + b, and R[a] - b
+
+  @return	non-zero if an exception is raised.
+*/
+static inline int mrbc_aot_addi( struct VM *vm, mrbc_value *regs, int a, int b, const uint8_t *inst )
+{
+  mrbc_int_t n;
+  if( regs[a].tt == MRBC_TT_INTEGER &&
+      !__builtin_add_overflow( regs[a].i, b, &n ) ) {
+    regs[a].i = n;
+    return 0;
+  }
+  return mrbc_aot_exec( vm, regs, inst );
+}
+
+static inline int mrbc_aot_subi( struct VM *vm, mrbc_value *regs, int a, int b, const uint8_t *inst )
+{
+  mrbc_int_t n;
+  if( regs[a].tt == MRBC_TT_INTEGER &&
+      !__builtin_sub_overflow( regs[a].i, b, &n ) ) {
+    regs[a].i = n;
+    return 0;
+  }
+  return mrbc_aot_exec( vm, regs, inst );
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
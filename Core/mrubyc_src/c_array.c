@@ -27,15 +27,95 @@
 #include "c_string.h"
 #include "c_array.h"
 #include "console.h"
+#include "vm.h"
+#include "profile.h"
 
 /***** Constat values *******************************************************/
+//! kind of the C iterator. (see c_array_iter_resume)
+enum {
+  ARRAY_ITER_EACH,
+  ARRAY_ITER_EACH_INDEX,
+  ARRAY_ITER_EACH_WITH_INDEX,
+  ARRAY_ITER_COLLECT,
+  ARRAY_ITER_COLLECT_BANG,
+  ARRAY_ITER_SELECT,
+};
+
+//! below this size, the sort uses the insertion sort.
+#define ARRAY_SORT_INSERTION 16
+
+//! mrbc_array_dup() shares the buffer of this size or more.
+#define ARRAY_SHARE_MIN_SIZE 8
+
+
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
+//! comparator of the sort.
+typedef int (*array_cmp_t)(const mrbc_value *v1, const mrbc_value *v2);
+
+
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
+#if MRBC_ARRAY_SHARED_MAX > 0
+//! buffers shared by duplicated arrays. (see mrbc_array_dup)
+static struct {
+  mrbc_value *buf;	//!< the buffer owned by this entry.
+  uint16_t ref_count;	//!< num of arrays using it, or 0 if free.
+} array_shared_[MRBC_ARRAY_SHARED_MAX];
+#endif
+
+
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
+#if MRBC_ARRAY_SHARED_MAX > 0
+//================================================================
+/*! share the buffer of the array.
+
+  The array becomes read only, and the buffer and the references of
+  the elements are owned by the entry of array_shared_, until the last
+  array using it is modified or released.
+
+  @param  h	pointer to array handle
+  @return	zero if shared.
+*/
+static int array_share( mrbc_array *h )
+{
+  if( h->shared_idx ) return 0;
+
+  for( int i = 0; i < MRBC_ARRAY_SHARED_MAX; i++ ) {
+    if( array_shared_[i].ref_count != 0 ) continue;
+
+    mrbc_alloc_compact_remove( &h->data );
+    array_shared_[i].buf = h->data - h->head;
+    array_shared_[i].ref_count = 1;
+    h->shared_idx = i + 1;
+    return 0;
+  }
+
+  return -1;
+}
+
+
+//================================================================
+/*! stop sharing the buffer of the array.
+
+  @param  h	pointer to array handle
+  @return	non-zero if it was the last one, and has taken over the
+		buffer and the elements.
+*/
+static int array_unshare( mrbc_array *h )
+{
+  int idx = h->shared_idx - 1;
+  h->shared_idx = 0;
+  if( --array_shared_[idx].ref_count != 0 ) return 0;
+
+  array_shared_[idx].buf = 0;
+  return 1;
+}
+#endif
+
+
 /***** Global functions *****************************************************/
 /*
   function summary
@@ -69,6 +149,7 @@
     mrbc_array_dup
     mrbc_array_divide
     mrbc_array_include
+    mrbc_array_sort
 */
 
 
@@ -98,7 +179,10 @@ mrbc_value mrbc_array_new(struct VM *vm, int size)
   MRBC_INIT_OBJECT_HEADER( h, "AR" );
   h->data_size = size;
   h->n_stored = 0;
+  h->head = 0;
+  h->shared_idx = 0;
   h->data = data;
+  mrbc_alloc_compact_add( h, &h->data );
 
   value.array = h;
   return value;
@@ -114,6 +198,13 @@ void mrbc_array_delete(mrbc_value *ary)
 {
   mrbc_array *h = ary->array;
 
+#if MRBC_ARRAY_SHARED_MAX > 0
+  if( h->shared_idx && !array_unshare(h) ) {
+    mrbc_raw_free(h);			// the others still use the buffer.
+    return;
+  }
+#endif
+
   mrbc_value *p1 = h->data;
   const mrbc_value *p2 = p1 + h->n_stored;
   while( p1 < p2 ) {
@@ -135,6 +226,11 @@ void mrbc_array_clear_vm_id(mrbc_value *ary)
   mrbc_array *h = ary->array;
 
   mrbc_set_vm_id( h, 0 );
+#if MRBC_ARRAY_SHARED_MAX > 0
+  if( h->shared_idx ) {
+    mrbc_set_vm_id( array_shared_[h->shared_idx - 1].buf, 0 );
+  }
+#endif
 
   mrbc_value *p1 = h->data;
   const mrbc_value *p2 = p1 + h->n_stored;
@@ -142,9 +238,83 @@ void mrbc_array_clear_vm_id(mrbc_value *ary)
     mrbc_clear_vm_id(p1++);
   }
 }
+
+
+//================================================================
+/*! forget the shared buffers of the VM
+
+  They are released by mrbc_free_all() with the arrays using them.
+*/
+void mrbc_array_shared_release_vm(const struct VM *vm)
+{
+#if MRBC_ARRAY_SHARED_MAX > 0
+  for( int i = 0; i < MRBC_ARRAY_SHARED_MAX; i++ ) {
+    if( array_shared_[i].ref_count == 0 ) continue;
+    if( mrbc_get_vm_id( array_shared_[i].buf ) != vm->vm_id ) continue;
+
+    array_shared_[i].buf = 0;
+    array_shared_[i].ref_count = 0;
+  }
+#endif
+}
 #endif
 
 
+//================================================================
+/*! make the array writable
+
+  If the buffer is shared by mrbc_array_dup(), copy it and count the
+  elements, or take it over if this is the last one using it.
+  Call this before changing the data in place.
+
+  @param  ary	pointer to target value
+  @return	mrbc_error_code
+*/
+int mrbc_array_modify(mrbc_value *ary)
+{
+#if MRBC_ARRAY_SHARED_MAX > 0
+  mrbc_array *h = ary->array;
+  if( !h->shared_idx ) return 0;
+
+  if( array_shared_[h->shared_idx - 1].ref_count > 1 ) {
+    mrbc_value *data = mrbc_raw_alloc( sizeof(mrbc_value) * h->n_stored );
+    if( !data ) return E_NOMEMORY_ERROR;
+    mrbc_set_vm_id( data, mrbc_get_vm_id(h) );
+
+    memcpy( data, h->data, sizeof(mrbc_value) * h->n_stored );
+    for( int i = 0; i < h->n_stored; i++ ) {
+      mrbc_incref( &data[i] );
+    }
+    h->data = data;
+    h->data_size = h->n_stored;
+    h->head = 0;
+  }
+  array_unshare( h );
+  mrbc_alloc_compact_add( h, &h->data );
+#endif
+
+  return 0;
+}
+
+
+//================================================================
+/*! move the data to the top of the buffer, and take back the cells
+    left by shift.
+
+  @param  h	pointer to array handle
+*/
+static void array_compact(mrbc_array *h)
+{
+  if( h->head == 0 ) return;
+
+  mrbc_value *base = h->data - h->head;
+  memmove(base, h->data, sizeof(mrbc_value) * h->n_stored);
+  h->data = base;
+  h->data_size += h->head;
+  h->head = 0;
+}
+
+
 //================================================================
 /*! resize buffer
 
@@ -156,6 +326,9 @@ int mrbc_array_resize(mrbc_value *ary, int size)
 {
   mrbc_array *h = ary->array;
 
+  if( mrbc_array_modify(ary) != 0 ) return E_NOMEMORY_ERROR;	// ENOMEM
+
+  array_compact(h);
   mrbc_value *data2 = mrbc_raw_realloc(h->data, sizeof(mrbc_value) * size);
   if( !data2 ) return E_NOMEMORY_ERROR;	// ENOMEM
 
@@ -166,6 +339,37 @@ int mrbc_array_resize(mrbc_value *ary, int size)
 }
 
 
+//================================================================
+/*! expand buffer
+
+  Grows the buffer 1.5 times (at least 6 elements) at once,
+  so that repeated push doesn't copy the whole buffer each time.
+
+  @param  ary		pointer to target value
+  @param  min_size	required size
+  @return		mrbc_error_code
+*/
+static int array_expand(mrbc_value *ary, int min_size)
+{
+  mrbc_array *h = ary->array;
+
+  // reuse the cells left by shift, if they are more than the data to move.
+  if( h->head >= h->n_stored && h->data_size + h->head >= min_size ) {
+    array_compact(h);
+    return 0;
+  }
+
+  int size = h->data_size + h->head;
+  size += (size / 2 < 6) ? 6 : size / 2;
+  if( size < min_size ) size = min_size;
+
+  if( mrbc_array_resize(ary, size) == 0 ) return 0;
+
+  // retry with the minimum size.
+  return mrbc_array_resize(ary, min_size);
+}
+
+
 //================================================================
 /*! setter
 
@@ -178,13 +382,15 @@ int mrbc_array_set(mrbc_value *ary, int idx, mrbc_value *set_val)
 {
   mrbc_array *h = ary->array;
 
+  if( mrbc_array_modify(ary) != 0 ) return E_NOMEMORY_ERROR;	// ENOMEM
+
   if( idx < 0 ) {
     idx = h->n_stored + idx;
     if( idx < 0 ) return E_INDEX_ERROR;
   }
 
   // need resize?
-  if( idx >= h->data_size && mrbc_array_resize(ary, idx + 1) != 0 ) {
+  if( idx >= h->data_size && array_expand(ary, idx + 1) != 0 ) {
     return E_NOMEMORY_ERROR;			// ENOMEM
   }
 
@@ -235,9 +441,10 @@ int mrbc_array_push(mrbc_value *ary, mrbc_value *set_val)
 {
   mrbc_array *h = ary->array;
 
+  if( mrbc_array_modify(ary) != 0 ) return E_NOMEMORY_ERROR;	// ENOMEM
+
   if( h->n_stored >= h->data_size ) {
-    int size = h->data_size + 6;
-    if( mrbc_array_resize(ary, size) != 0 ) return E_NOMEMORY_ERROR; // ENOMEM
+    if( array_expand(ary, h->data_size + 1) != 0 ) return E_NOMEMORY_ERROR; // ENOMEM
   }
 
   h->data[h->n_stored++] = *set_val;
@@ -259,6 +466,7 @@ int mrbc_array_push_m(mrbc_value *ary, mrbc_value *set_val)
   mrbc_array *ha_s = set_val->array;
   int new_size = ha_d->n_stored + ha_s->n_stored;
 
+  if( mrbc_array_modify(ary) != 0 ) return E_NOMEMORY_ERROR;	// ENOMEM
   if( new_size > ha_d->data_size ) {
     if( mrbc_array_resize(ary, new_size) != 0 )
       return E_NOMEMORY_ERROR;		// ENOMEM
@@ -283,6 +491,7 @@ mrbc_value mrbc_array_pop(mrbc_value *ary)
   mrbc_array *h = ary->array;
 
   if( h->n_stored <= 0 ) return mrbc_nil_value();
+  if( mrbc_array_modify(ary) != 0 ) return mrbc_nil_value();	// ENOMEM
   return h->data[--h->n_stored];
 }
 
@@ -296,7 +505,29 @@ mrbc_value mrbc_array_pop(mrbc_value *ary)
 */
 int mrbc_array_unshift(mrbc_value *ary, mrbc_value *set_val)
 {
-  return mrbc_array_insert(ary, 0, set_val);
+  mrbc_array *h = ary->array;
+
+  if( mrbc_array_modify(ary) != 0 ) return E_NOMEMORY_ERROR;	// ENOMEM
+
+  // make free cells before the data, as many as array_expand() grows.
+  if( h->head == 0 ) {
+    int gap = (h->n_stored / 2 < 6) ? 6 : h->n_stored / 2;
+    int size = h->data_size + gap;
+    mrbc_value *data2 = mrbc_raw_realloc(h->data, sizeof(mrbc_value) * size);
+    if( !data2 ) return mrbc_array_insert(ary, 0, set_val);
+
+    memmove(data2 + gap, data2, sizeof(mrbc_value) * h->n_stored);
+    h->data = data2 + gap;
+    h->head = gap;
+  }
+
+  h->data--;
+  h->head--;
+  h->data_size++;
+  h->data[0] = *set_val;
+  h->n_stored++;
+
+  return 0;
 }
 
 
@@ -311,9 +542,14 @@ mrbc_value mrbc_array_shift(mrbc_value *ary)
   mrbc_array *h = ary->array;
 
   if( h->n_stored <= 0 ) return mrbc_nil_value();
+  if( mrbc_array_modify(ary) != 0 ) return mrbc_nil_value();	// ENOMEM
 
+  // leave the cell before the data, instead of moving all data.
   mrbc_value ret = h->data[0];
-  memmove(h->data, h->data+1, sizeof(mrbc_value) * --h->n_stored);
+  h->data++;
+  h->head++;
+  h->data_size--;
+  h->n_stored--;
 
   return ret;
 }
@@ -335,6 +571,7 @@ int mrbc_array_insert(mrbc_value *ary, int idx, mrbc_value *set_val)
     idx = h->n_stored + idx + 1;
     if( idx < 0 ) return E_INDEX_ERROR;
   }
+  if( mrbc_array_modify(ary) != 0 ) return E_NOMEMORY_ERROR;	// ENOMEM
 
   // need resize?
   int size = 0;
@@ -343,7 +580,7 @@ int mrbc_array_insert(mrbc_value *ary, int idx, mrbc_value *set_val)
   } else if( h->n_stored >= h->data_size ) {
     size = h->data_size + 1;
   }
-  if( size && mrbc_array_resize(ary, size) != 0 ) {
+  if( size && array_expand(ary, size) != 0 ) {
     return E_NOMEMORY_ERROR;			// ENOMEM
   }
 
@@ -383,6 +620,7 @@ mrbc_value mrbc_array_remove(mrbc_value *ary, int idx)
 
   if( idx < 0 ) idx = h->n_stored + idx;
   if( idx < 0 || idx >= h->n_stored ) return mrbc_nil_value();
+  if( mrbc_array_modify(ary) != 0 ) return mrbc_nil_value();	// ENOMEM
 
   mrbc_value val = h->data[idx];
   h->n_stored--;
@@ -404,6 +642,8 @@ void mrbc_array_clear(mrbc_value *ary)
 {
   mrbc_array *h = ary->array;
 
+  if( mrbc_array_modify(ary) != 0 ) return;	// ENOMEM
+
   mrbc_value *p1 = h->data;
   const mrbc_value *p2 = p1 + h->n_stored;
   while( p1 < p2 ) {
@@ -411,6 +651,7 @@ void mrbc_array_clear(mrbc_value *ary)
   }
 
   h->n_stored = 0;
+  array_compact(h);
 }
 
 
@@ -437,6 +678,32 @@ int mrbc_array_compare(const mrbc_value *v1, const mrbc_value *v2)
 }
 
 
+//================================================================
+/*! check whether the values are all Integer or all Float.
+
+  @param  p	pointer to the values.
+  @param  n	num of the values.
+  @return	MRBC_TT_INTEGER, MRBC_TT_FLOAT, or MRBC_TT_EMPTY if not.
+*/
+static mrbc_vtype array_numeric_type(const mrbc_value *p, int n)
+{
+  if( n == 0 ) return MRBC_TT_EMPTY;
+
+  mrbc_vtype tt = mrbc_type(p[0]);
+  if( tt != MRBC_TT_INTEGER
+#if MRBC_USE_FLOAT
+      && tt != MRBC_TT_FLOAT
+#endif
+      ) return MRBC_TT_EMPTY;
+
+  for( int i = 1; i < n; i++ ) {
+    if( mrbc_type(p[i]) != tt ) return MRBC_TT_EMPTY;
+  }
+
+  return tt;
+}
+
+
 //================================================================
 /*! get min, max value
 
@@ -456,8 +723,30 @@ void mrbc_array_minmax(mrbc_value *ary, mrbc_value **pp_min_value, mrbc_value **
 
   mrbc_value *p_min_value = h->data;
   mrbc_value *p_max_value = h->data;
-
   int i;
+
+  // compare the numbers directly, if all are the same type.
+  switch( array_numeric_type(h->data, h->n_stored) ) {
+  case MRBC_TT_INTEGER:
+    for( i = 1; i < h->n_stored; i++ ) {
+      if( h->data[i].i < p_min_value->i ) p_min_value = &h->data[i];
+      if( h->data[i].i > p_max_value->i ) p_max_value = &h->data[i];
+    }
+    goto RETURN;
+
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT:
+    for( i = 1; i < h->n_stored; i++ ) {
+      if( h->data[i].d < p_min_value->d ) p_min_value = &h->data[i];
+      if( h->data[i].d > p_max_value->d ) p_max_value = &h->data[i];
+    }
+    goto RETURN;
+#endif
+
+  default:
+    break;
+  }
+
   for( i = 1; i < h->n_stored; i++ ) {
     if( mrbc_compare( &h->data[i], p_min_value ) < 0 ) {
       p_min_value = &h->data[i];
@@ -467,6 +756,7 @@ void mrbc_array_minmax(mrbc_value *ary, mrbc_value **pp_min_value, mrbc_value **
     }
   }
 
+ RETURN:
   *pp_min_value = p_min_value;
   *pp_max_value = p_max_value;
 }
@@ -475,6 +765,10 @@ void mrbc_array_minmax(mrbc_value *ary, mrbc_value **pp_min_value, mrbc_value **
 //================================================================
 /*! duplicate (shallow copy)
 
+  A large array shares the buffer with the source, instead of copying
+  and counting all the elements. Both of them are copied when modified.
+  (see mrbc_array_modify)
+
   @param  vm	pointer to VM.
   @param  ary	source
   @return	result
@@ -483,6 +777,25 @@ mrbc_value mrbc_array_dup(struct VM *vm, const mrbc_value *ary)
 {
   mrbc_array *sh = ary->array;
 
+#if MRBC_ARRAY_SHARED_MAX > 0
+  if( sh->n_stored >= ARRAY_SHARE_MIN_SIZE && array_share(sh) == 0 ) {
+    mrbc_value dv = {.tt = MRBC_TT_ARRAY};
+    mrbc_array *h = mrbc_alloc(vm, sizeof(mrbc_array));
+    if( !h ) return dv;		// ENOMEM
+
+    MRBC_INIT_OBJECT_HEADER( h, "AR" );
+    h->data_size = sh->data_size;
+    h->n_stored = sh->n_stored;
+    h->head = sh->head;
+    h->shared_idx = sh->shared_idx;
+    h->data = sh->data;
+    array_shared_[sh->shared_idx - 1].ref_count++;
+
+    dv.array = h;
+    return dv;
+  }
+#endif
+
   mrbc_value dv = mrbc_array_new(vm, sh->n_stored);
   if( dv.array == NULL ) return dv;		// ENOMEM
 
@@ -493,6 +806,7 @@ mrbc_value mrbc_array_dup(struct VM *vm, const mrbc_value *ary)
   const mrbc_value *p2 = p1 + dv.array->n_stored;
   while( p1 < p2 ) {
     mrbc_incref(p1++);
+    MRBC_YIELD_POINT();
   }
 
   return dv;
@@ -514,6 +828,9 @@ mrbc_value mrbc_array_dup(struct VM *vm, const mrbc_value *ary)
 mrbc_value mrbc_array_divide(struct VM *vm, mrbc_value *src, int pos)
 {
   mrbc_array *ha_s = src->array;
+  if( mrbc_array_modify(src) != 0 ) {	// ENOMEM
+    return (mrbc_value){.tt = MRBC_TT_ARRAY};
+  }
   if( pos < 0 ) pos = 0;
   int new_size = ha_s->n_stored - pos;
   if( new_size < 0 ) new_size = 0;
@@ -549,6 +866,183 @@ int mrbc_array_include(const mrbc_value *ary, const mrbc_value *val)
 }
 
 
+//================================================================
+/*! comparators for the sort of all Integer or all Float.
+*/
+static int array_cmp_integer(const mrbc_value *v1, const mrbc_value *v2)
+{
+  return (v1->i > v2->i) - (v1->i < v2->i);
+}
+
+#if MRBC_USE_FLOAT
+static int array_cmp_float(const mrbc_value *v1, const mrbc_value *v2)
+{
+  return (v1->d > v2->d) - (v1->d < v2->d);
+}
+#endif
+
+
+//================================================================
+/*! select the comparator for the values.
+
+  @param  p	pointer to the values.
+  @param  n	num of the values.
+  @return	comparator.
+*/
+static array_cmp_t array_select_cmp(const mrbc_value *p, int n)
+{
+  switch( array_numeric_type(p, n) ) {
+  case MRBC_TT_INTEGER:	return array_cmp_integer;
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT:	return array_cmp_float;
+#endif
+  default:		return mrbc_compare;
+  }
+}
+
+
+//================================================================
+/*! swap two values, and the values in the companion if given.
+*/
+static inline void array_swap(mrbc_value *a, mrbc_value *c, int i, int j)
+{
+  mrbc_value t = a[i]; a[i] = a[j]; a[j] = t;
+  if( c ) {
+    t = c[i]; c[i] = c[j]; c[j] = t;
+  }
+}
+
+
+//================================================================
+/*! insertion sort, for the small range.
+*/
+static void array_insertion_sort(mrbc_value *a, mrbc_value *c, int n, array_cmp_t cmp)
+{
+  for( int i = 1; i < n; i++ ) {
+    mrbc_value t = a[i];
+    mrbc_value tc = c ? c[i] : t;
+    int j;
+    for( j = i; j > 0 && cmp(&a[j-1], &t) > 0; j-- ) {
+      a[j] = a[j-1];
+      if( c ) c[j] = c[j-1];
+    }
+    a[j] = t;
+    if( c ) c[j] = tc;
+  }
+}
+
+
+//================================================================
+/*! heap sort, when the quick sort goes too deep.
+*/
+static void array_heap_sort(mrbc_value *a, mrbc_value *c, int n, array_cmp_t cmp)
+{
+  for( int k = n / 2 - 1, end = n; end > 1; ) {
+    int root;
+    if( k >= 0 ) {
+      root = k--;		// make the heap.
+    } else {
+      array_swap(a, c, 0, --end);	// take the largest.
+      root = 0;
+    }
+
+    // sift down.
+    while( 1 ) {
+      int child = root * 2 + 1;
+      if( child >= end ) break;
+      if( child + 1 < end && cmp(&a[child], &a[child+1]) < 0 ) child++;
+      if( cmp(&a[root], &a[child]) >= 0 ) break;
+      array_swap(a, c, root, child);
+      root = child;
+    }
+  }
+}
+
+
+//================================================================
+/*! introsort. (quick sort, falls back to heap sort and insertion sort)
+
+  @param  a	values to sort.
+  @param  c	companion, moved with a. (or NULL)
+  @param  n	num of the values.
+  @param  depth	depth limit of the quick sort.
+  @param  cmp	comparator.
+*/
+static void array_sort_sub(mrbc_value *a, mrbc_value *c, int n, int depth, array_cmp_t cmp)
+{
+  while( n > ARRAY_SORT_INSERTION ) {
+    if( depth-- <= 0 ) {
+      array_heap_sort(a, c, n, cmp);
+      return;
+    }
+    MRBC_YIELD_POINT();
+
+    // the median of three to a[0], as the pivot.
+    int m = n / 2;
+    if( cmp(&a[m], &a[0]) < 0 ) array_swap(a, c, m, 0);
+    if( cmp(&a[n-1], &a[0]) < 0 ) array_swap(a, c, n-1, 0);
+    if( cmp(&a[n-1], &a[m]) < 0 ) array_swap(a, c, n-1, m);
+    array_swap(a, c, 0, m);
+
+    // partition. a[n-1] >= pivot stops i, and the pivot stops j.
+    int i = 0, j = n;
+    while( 1 ) {
+      do { i++; } while( i < n && cmp(&a[i], &a[0]) < 0 );
+      do { j--; } while( cmp(&a[j], &a[0]) > 0 );
+      if( i >= j ) break;
+      array_swap(a, c, i, j);
+    }
+    array_swap(a, c, 0, j);
+
+    // recurse into the smaller part, and loop for the larger one.
+    int n_left = j;
+    int n_right = n - j - 1;
+    if( n_left < n_right ) {
+      array_sort_sub(a, c, n_left, depth, cmp);
+      a += j + 1;
+      if( c ) c += j + 1;
+      n = n_right;
+    } else {
+      array_sort_sub(a + j + 1, c ? c + j + 1 : 0, n_right, depth, cmp);
+      n = n_left;
+    }
+  }
+
+  array_insertion_sort(a, c, n, cmp);
+}
+
+
+//================================================================
+/*! sort the values, and the companion values along with them.
+
+  @param  a	values to sort.
+  @param  c	companion, moved with a. (or NULL)
+  @param  n	num of the values.
+*/
+static void array_sort_values(mrbc_value *a, mrbc_value *c, int n)
+{
+  int depth = 0;
+  for( int i = n; i > 1; i >>= 1 ) depth += 2;
+
+  array_sort_sub(a, c, n, depth, array_select_cmp(a, n));
+}
+
+
+//================================================================
+/*! sort in place
+
+  Integers only or Floats only are compared directly, and the others
+  by mrbc_compare().
+
+  @param  ary	pointer to target value
+*/
+void mrbc_array_sort(mrbc_value *ary)
+{
+  if( mrbc_array_modify(ary) != 0 ) return;	// ENOMEM
+  array_sort_values(ary->array->data, 0, ary->array->n_stored);
+}
+
+
 //================================================================
 /*! method new
 */
@@ -978,10 +1472,12 @@ static void c_array_shift(struct VM *vm, mrbc_value v[], int argc)
     mrbc_array tmp = *v[0].array;
     v[0].array->data_size = val.array->data_size;
     v[0].array->n_stored = val.array->n_stored;
+    v[0].array->head = val.array->head;
     v[0].array->data = val.array->data;
 
     val.array->data_size = tmp.data_size;
     val.array->n_stored = tmp.n_stored;
+    val.array->head = tmp.head;
     val.array->data = tmp.data;
 
     SET_RETURN(val);
@@ -1065,6 +1561,121 @@ static void c_array_minmax(struct VM *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! sum of the numbers.
+
+  @param  vm	pointer to VM.
+  @param  ary	pointer to target value
+  @param  init	initial value.
+  @param  ret	returns the sum.
+  @return	zero if no error.
+*/
+static int array_sum(struct VM *vm, const mrbc_value *ary, const mrbc_value *init, mrbc_value *ret)
+{
+  const mrbc_value *p = ary->array->data;
+  int n = ary->array->n_stored;
+  mrbc_int_t si = 0;
+#if MRBC_USE_FLOAT
+  mrbc_float_t sd = 0;
+  int flag_float = 0;
+#endif
+  int i;
+
+  switch( mrbc_type(*init) ) {
+  case MRBC_TT_INTEGER:	si = init->i; break;
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT:	sd = init->d; flag_float = 1; break;
+#endif
+  default:		goto TYPE_ERROR;
+  }
+
+  // tight loops for all Integer or all Float.
+  switch( array_numeric_type(p, n) ) {
+  case MRBC_TT_INTEGER:
+    for( i = 0; i < n; i++ ) si += p[i].i;
+    break;
+
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT:
+    for( i = 0; i < n; i++ ) sd += p[i].d;
+    flag_float = 1;
+    break;
+#endif
+
+  default:
+    for( i = 0; i < n; i++ ) {
+      switch( mrbc_type(p[i]) ) {
+      case MRBC_TT_INTEGER:	si += p[i].i; break;
+#if MRBC_USE_FLOAT
+      case MRBC_TT_FLOAT:	sd += p[i].d; flag_float = 1; break;
+#endif
+      default:			goto TYPE_ERROR;
+      }
+    }
+    break;
+  }
+
+#if MRBC_USE_FLOAT
+  if( flag_float ) {
+    *ret = mrbc_float_value(vm, sd + si);
+    return 0;
+  }
+#endif
+  *ret = mrbc_integer_value(si);
+  return 0;
+
+ TYPE_ERROR:
+  mrbc_raise(vm, MRBC_CLASS(TypeError), "sum supports only Integer and Float");
+  return -1;
+}
+
+
+//================================================================
+/*! (method) sum
+
+  Subset of Array#sum, not support the block and non numeric values.
+*/
+static void c_array_sum(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_value init = mrbc_integer_value(0);
+  mrbc_value ret;
+
+  if( argc > 1 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+  if( argc == 1 ) init = v[1];
+
+  if( array_sum(vm, &v[0], &init, &ret) != 0 ) return;
+  SET_RETURN(ret);
+}
+
+
+#if MRBC_USE_FLOAT
+//================================================================
+/*! (method) mean
+
+  [1, 2, 3, 4].mean	# => 2.5
+  [].mean		# => nil
+*/
+static void c_array_mean(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_value init = mrbc_integer_value(0);
+  mrbc_value ret;
+  int n = mrbc_array_size(&v[0]);
+
+  if( n == 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+  if( array_sum(vm, &v[0], &init, &ret) != 0 ) return;
+
+  mrbc_float_t d = (mrbc_type(ret) == MRBC_TT_FLOAT) ? ret.d : ret.i;
+  SET_FLOAT_RETURN( d / n );
+}
+#endif
+
+
 #if MRBC_USE_STRING
 //================================================================
 /*! (method) inspect, to_s
@@ -1072,7 +1683,7 @@ static void c_array_minmax(struct VM *vm, mrbc_value v[], int argc)
 static void c_array_inspect(struct VM *vm, mrbc_value v[], int argc)
 {
   if( v[0].tt == MRBC_TT_CLASS ) {
-    v[0] = mrbc_string_new_cstr(vm, mrbc_symid_to_str( v[0].cls->sym_id ));
+    v[0] = mrbc_string_new_symbol(vm, v[0].cls->sym_id);
     return;
   }
 
@@ -1087,6 +1698,7 @@ static void c_array_inspect(struct VM *vm, mrbc_value v[], int argc)
     mrbc_value s1 = mrbc_send( vm, v, argc, &v1, "inspect", 0 );
     mrbc_string_append( &ret, &s1 );
     mrbc_string_delete( &s1 );
+    MRBC_YIELD_POINT();
   }
 
   mrbc_string_append_cstr( &ret, "]" );
@@ -1101,48 +1713,550 @@ static void c_array_inspect(struct VM *vm, mrbc_value v[], int argc)
 
 //================================================================
 /*! (method) join
+
+  The items are converted to strings first, and the result is allocated
+  at once for the total length.
 */
-static void c_array_join_1(struct VM *vm, mrbc_value v[], int argc,
-			   mrbc_value *src, mrbc_value *ret, mrbc_value *separator)
+static int c_array_join_1(struct VM *vm, mrbc_value v[], int argc,
+			  mrbc_value *src, mrbc_value *list, int *len)
 {
-  if( mrbc_array_size(src) == 0 ) return;
+  // an empty array joins as an empty item.
+  if( mrbc_array_size(src) == 0 ) {
+    mrbc_value nil = mrbc_nil_value();
+    return mrbc_array_push( list, &nil );
+  }
 
-  int i = 0;
-  int flag_error = 0;
-  while( !flag_error ) {
-    if( mrbc_type(src->array->data[i]) == MRBC_TT_ARRAY ) {
-      c_array_join_1(vm, v, argc, &src->array->data[i], ret, separator);
-    } else {
-      mrbc_value v1 = mrbc_send( vm, v, argc, &src->array->data[i], "to_s", 0 );
-      flag_error |= mrbc_string_append( ret, &v1 );
+  for( int i = 0; i < mrbc_array_size(src); i++ ) {
+    mrbc_value *item = &src->array->data[i];
+    mrbc_value v1;
+
+    switch( mrbc_type(*item) ) {
+    case MRBC_TT_ARRAY:
+      if( c_array_join_1(vm, v, argc, item, list, len) != 0 ) return -1;
+      continue;
+
+    case MRBC_TT_STRING:
+      v1 = *item;
+      mrbc_incref(&v1);
+      break;
+
+    default:
+      v1 = mrbc_send( vm, v, argc, item, "to_s", 0 );
+      if( mrbc_type(v1) != MRBC_TT_STRING ) {
+	mrbc_decref(&v1);
+	mrbc_raise(vm, MRBC_CLASS(TypeError), 0);
+	return -1;
+      }
+      break;
+    }
+
+    *len += mrbc_string_size(&v1);
+    if( mrbc_array_push( list, &v1 ) != 0 ) {
       mrbc_decref(&v1);
+      return -1;			// ENOMEM
     }
-    if( ++i >= mrbc_array_size(src) ) break;	// normal return.
-    flag_error |= mrbc_string_append( ret, separator );
+    MRBC_YIELD_POINT();
   }
+
+  return 0;
 }
 
 static void c_array_join(struct VM *vm, mrbc_value v[], int argc)
 {
-  mrbc_value ret = mrbc_string_new(vm, NULL, 0);
-  if( !ret.string ) goto RETURN_NIL;		// ENOMEM
-
   mrbc_value separator = (argc == 0) ? mrbc_string_new_cstr(vm, "") :
     mrbc_send( vm, v, argc, &v[1], "to_s", 0 );
+  mrbc_value list = mrbc_array_new(vm, mrbc_array_size(&v[0]));
+  mrbc_value ret = mrbc_nil_value();
+  int len = 0;
+
+  if( !separator.string || !list.array ) goto RETURN;	// ENOMEM
+
+  // collect the items as strings, and then copy them at once.
+  if( mrbc_array_size(&v[0]) != 0 &&
+      c_array_join_1(vm, v, argc, &v[0], &list, &len) != 0 ) goto RETURN;
 
-  c_array_join_1(vm, v, argc, &v[0], &ret, &separator );
-  mrbc_decref(&separator);
+  int n = mrbc_array_size(&list);
+  int sep_len = mrbc_string_size(&separator);
+  if( n > 1 ) len += sep_len * (n - 1);
+
+  ret = mrbc_string_new(vm, NULL, len);
+  if( !ret.string ) goto RETURN;	// ENOMEM
+
+  char *p = mrbc_string_cstr(&ret);
+  for( int i = 0; i < n; i++ ) {
+    const mrbc_value *item = &list.array->data[i];
+    if( i != 0 ) {
+      memcpy( p, mrbc_string_cstr(&separator), sep_len );
+      p += sep_len;
+    }
+    if( mrbc_type(*item) == MRBC_TT_STRING ) {
+      memcpy( p, mrbc_string_cstr(item), mrbc_string_size(item) );
+      p += mrbc_string_size(item);
+    }
+  }
+  *p = '\0';
 
+ RETURN:
+  if( list.array ) mrbc_decref(&list);
+  if( separator.string ) mrbc_decref(&separator);
   SET_RETURN(ret);
-  return;
+}
 
- RETURN_NIL:
-  SET_NIL_RETURN();
+
+//================================================================
+/*! (method) pack
+
+  [513, 772].pack("vn") -> "\x01\x02\x03\x04"
+  (see mrbc_pack_parse() for the directives)
+*/
+static void c_array_pack(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || mrbc_type(v[1]) != MRBC_TT_STRING ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  const mrbc_array *h = v[0].array;
+  const char *fmt = mrbc_string_cstr(&v[1]);
+  mrbc_pack_directive pd;
+  int idx = 0;
+  int len = 0;
+  int res;
+
+  // calculate the result size.
+  while( (res = mrbc_pack_parse(&fmt, &pd)) == 0 ) {
+    int n = (pd.count < 0) ? h->n_stored - idx : pd.count;
+    if( idx + n > h->n_stored ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), "too few arguments.");
+      return;
+    }
+    idx += n;
+    len += n * pd.size;
+  }
+  if( res < 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "unknown pack directive.");
+    return;
+  }
+
+  mrbc_value ret = mrbc_string_new(vm, NULL, len);
+  if( !ret.string ) return;		// ENOMEM
+  uint8_t *p = ret.string->data;
+  p[len] = '\0';
+
+  // pack items.
+  fmt = mrbc_string_cstr(&v[1]);
+  idx = 0;
+  while( mrbc_pack_parse(&fmt, &pd) == 0 ) {
+    int n = (pd.count < 0) ? h->n_stored - idx : pd.count;
+
+    for( ; n > 0; n--, idx++ ) {
+      const mrbc_value *val = &h->data[idx];
+      uint32_t bits;
+
+      switch( mrbc_type(*val) ) {
+      case MRBC_TT_INTEGER:
+#if MRBC_USE_FLOAT
+	if( pd.flag_float ) {
+	  float f = mrbc_integer(*val);
+	  memcpy( &bits, &f, sizeof(bits) );
+	  break;
+	}
+#endif
+	bits = mrbc_integer(*val);
+	break;
+
+#if MRBC_USE_FLOAT
+      case MRBC_TT_FLOAT:
+	if( pd.flag_float ) {
+	  float f = mrbc_float(*val);
+	  memcpy( &bits, &f, sizeof(bits) );
+	  break;
+	}
+	bits = (mrbc_int_t)mrbc_float(*val);
+	break;
+#endif
+
+      default:
+	mrbc_decref( &ret );
+	mrbc_raise(vm, MRBC_CLASS(TypeError), 0);
+	return;
+      }
+
+      mrbc_pack_put_bits( p, &pd, bits );
+      p += pd.size;
+    }
+  }
+
+  SET_RETURN(ret);
 }
 
 #endif
 
 
+//================================================================
+/*! (method) each, each_index, each_with_index, collect, collect!, select
+
+  v[1]: block, v[2]: index of the last yielded element,
+  v[3]: kind (ARRAY_ITER_*), v[4]: new array
+*/
+static void c_array_iter_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_value *ret = &v[MRBC_C_ITER_REGS];
+  int i = v[2].i;
+
+  // receive the return value of the block.
+  if( i >= 0 ) {
+    switch( v[3].i ) {
+    case ARRAY_ITER_COLLECT:
+      mrbc_array_set( &v[4], i, ret );
+      ret->tt = MRBC_TT_EMPTY;
+      break;
+
+    case ARRAY_ITER_COLLECT_BANG:
+      mrbc_array_set( &v[0], i, ret );
+      ret->tt = MRBC_TT_EMPTY;
+      break;
+
+    case ARRAY_ITER_SELECT:
+      if( mrbc_type(*ret) > MRBC_TT_FALSE && i < mrbc_array_size(&v[0]) ) {
+	mrbc_value val = mrbc_array_get( &v[0], i );
+	mrbc_incref( &val );
+	mrbc_array_push( &v[4], &val );
+      }
+      break;
+    }
+  }
+
+  i = ++v[2].i;
+  if( i >= mrbc_array_size(&v[0]) ) {
+    if( mrbc_type(v[4]) == MRBC_TT_ARRAY ) {
+      mrbc_decref( &v[0] );
+      v[0] = v[4];
+      v[4].tt = MRBC_TT_EMPTY;
+    }
+    mrbc_c_iter_end(vm, v);
+    return;
+  }
+
+  mrbc_value args[2] = { v[0].array->data[i], mrbc_integer_value(i) };
+  switch( v[3].i ) {
+  case ARRAY_ITER_EACH_INDEX:
+    mrbc_c_iter_yield(vm, v, &v[1], 1, &args[1]);
+    break;
+
+  case ARRAY_ITER_EACH_WITH_INDEX:
+    mrbc_c_iter_yield(vm, v, &v[1], 2, args);
+    break;
+
+  default:
+    mrbc_c_iter_yield(vm, v, &v[1], 1, args);
+    break;
+  }
+}
+
+static void c_array_iter_sub(struct VM *vm, mrbc_value v[], int argc, int kind)
+{
+  if( argc != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+  if( mrbc_c_iter_begin(vm, v, argc, c_array_iter_resume) != 0 ) return;
+
+  mrbc_decref( &v[2] );
+  v[2] = mrbc_integer_value(-1);
+  mrbc_decref( &v[3] );
+  v[3] = mrbc_integer_value(kind);
+  mrbc_decref( &v[4] );
+  mrbc_set_nil( &v[4] );
+
+  if( kind == ARRAY_ITER_COLLECT || kind == ARRAY_ITER_SELECT ) {
+    v[4] = mrbc_array_new( vm, (kind == ARRAY_ITER_COLLECT) ?
+			   mrbc_array_size(&v[0]) : 0 );
+    if( !v[4].array ) {
+      v[4].tt = MRBC_TT_EMPTY;
+      mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+      return;
+    }
+  }
+
+  c_array_iter_resume(vm, v, argc);
+}
+
+static void c_array_each(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_array_iter_sub(vm, v, argc, ARRAY_ITER_EACH);
+}
+
+static void c_array_each_index(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_array_iter_sub(vm, v, argc, ARRAY_ITER_EACH_INDEX);
+}
+
+static void c_array_each_with_index(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_array_iter_sub(vm, v, argc, ARRAY_ITER_EACH_WITH_INDEX);
+}
+
+static void c_array_collect(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_array_iter_sub(vm, v, argc, ARRAY_ITER_COLLECT);
+}
+
+static void c_array_collect_bang(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_array_iter_sub(vm, v, argc, ARRAY_ITER_COLLECT_BANG);
+}
+
+static void c_array_select(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_array_iter_sub(vm, v, argc, ARRAY_ITER_SELECT);
+}
+
+
+//================================================================
+/*! (method) sort!, sort with the block
+
+  Binary insertion sort, that needs O(n log n) calls of the block.
+
+  v[1]: block, v[2]: element to insert, v[3]: low, v[4]: high
+*/
+static void c_array_sort_block_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_value *ret = &v[MRBC_C_ITER_REGS];
+  mrbc_array *h = v[0].array;
+  int i = v[2].i;
+
+  // receive the result of the comparison.
+  if( v[3].i < v[4].i ) {
+    int mid = (v[3].i + v[4].i) / 2;
+    int r;
+
+    switch( mrbc_type(*ret) ) {
+    case MRBC_TT_INTEGER: r = (mrbc_integer(*ret) > 0) - (mrbc_integer(*ret) < 0); break;
+#if MRBC_USE_FLOAT
+    case MRBC_TT_FLOAT:	  r = (mrbc_float(*ret) > 0) - (mrbc_float(*ret) < 0); break;
+#endif
+    default:
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), "comparison failed");
+      return;
+    }
+    if( r < 0 ) {
+      v[4].i = mid;
+    } else {
+      v[3].i = mid + 1;		// after the equal ones, to be stable.
+    }
+  }
+
+  // the block may have changed the array.
+  if( i >= h->n_stored ) {
+    mrbc_c_iter_end(vm, v);
+    return;
+  }
+
+  // insert it, and go to the next element.
+  if( v[3].i >= v[4].i ) {
+    int pos = v[3].i;
+    if( pos < i ) {
+      if( mrbc_array_modify(&v[0]) != 0 ) {	// dup in the block.
+	mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+	return;
+      }
+      mrbc_value t = h->data[i];
+      memmove(h->data + pos + 1, h->data + pos, sizeof(mrbc_value) * (i - pos));
+      h->data[pos] = t;
+    }
+
+    i = ++v[2].i;
+    if( i >= h->n_stored ) {
+      mrbc_c_iter_end(vm, v);
+      return;
+    }
+    v[3].i = 0;
+    v[4].i = i;
+  }
+
+  mrbc_value args[2] = { h->data[i], h->data[(v[3].i + v[4].i) / 2] };
+  mrbc_c_iter_yield(vm, v, &v[1], 2, args);
+}
+
+static void c_array_sort_sub(struct VM *vm, mrbc_value v[], int argc, int flag_dup)
+{
+  if( argc != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+
+  if( flag_dup ) {
+    mrbc_value ret = mrbc_array_dup(vm, &v[0]);
+    if( !ret.array ) {
+      mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+      return;
+    }
+    SET_RETURN(ret);
+  }
+
+  if( mrbc_type(v[1]) != MRBC_TT_PROC ) {
+    mrbc_array_sort(&v[0]);
+    return;
+  }
+
+  if( mrbc_c_iter_begin(vm, v, argc, c_array_sort_block_resume) != 0 ) return;
+
+  mrbc_decref( &v[2] );
+  v[2] = mrbc_integer_value(0);
+  mrbc_decref( &v[3] );
+  v[3] = mrbc_integer_value(0);
+  mrbc_decref( &v[4] );
+  v[4] = mrbc_integer_value(0);
+
+  c_array_sort_block_resume(vm, v, argc);
+}
+
+static void c_array_sort(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_array_sort_sub(vm, v, argc, 1);
+}
+
+static void c_array_sort_bang(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_array_sort_sub(vm, v, argc, 0);
+}
+
+
+//================================================================
+/*! (method) sort_by
+
+  The block is called once for each element, and the elements are
+  sorted by the results natively.
+
+  v[1]: block, v[2]: index of the last yielded element,
+  v[3]: keys, v[4]: copy of the elements
+*/
+static void c_array_sort_by_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_value *ret = &v[MRBC_C_ITER_REGS];
+  int i = v[2].i;
+
+  if( i >= 0 ) {
+    mrbc_array_set( &v[3], i, ret );
+    ret->tt = MRBC_TT_EMPTY;
+  }
+
+  i = ++v[2].i;
+  if( i < mrbc_array_size(&v[4]) ) {
+    mrbc_c_iter_yield(vm, v, &v[1], 1, &v[4].array->data[i]);
+    return;
+  }
+
+  array_sort_values( v[3].array->data, v[4].array->data, mrbc_array_size(&v[4]) );
+  mrbc_decref( &v[0] );
+  v[0] = v[4];
+  v[4].tt = MRBC_TT_EMPTY;
+  mrbc_c_iter_end(vm, v);
+}
+
+static void c_array_sort_by(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+  if( mrbc_c_iter_begin(vm, v, argc, c_array_sort_by_resume) != 0 ) return;
+
+  int n = mrbc_array_size(&v[0]);
+  mrbc_decref( &v[2] );
+  v[2] = mrbc_integer_value(-1);
+  mrbc_decref( &v[3] );
+  mrbc_decref( &v[4] );
+  v[3] = mrbc_array_new( vm, n );
+  v[4] = mrbc_array_dup( vm, &v[0] );
+  if( !v[3].array || !v[4].array || mrbc_array_modify( &v[4] ) != 0 ) {
+    if( v[3].array ) mrbc_decref( &v[3] );
+    if( v[4].array ) mrbc_decref( &v[4] );
+    v[3].tt = v[4].tt = MRBC_TT_EMPTY;
+    mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+    return;
+  }
+
+  c_array_sort_by_resume(vm, v, argc);
+}
+
+
+//================================================================
+/*! (method) bsearch
+
+  The find-minimum mode (the block returns true or false) and the
+  find-any mode (the block returns a number) of the sorted array.
+
+  v[1]: block, v[2]: low, v[3]: high, v[4]: index found, or -1
+*/
+static void c_array_bsearch_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_value *ret = &v[MRBC_C_ITER_REGS];
+  int mid = (v[2].i + v[3].i) / 2;
+
+  if( v[2].i < v[3].i ) {
+    int r;
+
+    switch( mrbc_type(*ret) ) {
+    case MRBC_TT_TRUE:	  r = -1; v[4].i = mid; break;
+    case MRBC_TT_NIL:
+    case MRBC_TT_FALSE:	  r = 1; break;
+    case MRBC_TT_INTEGER: r = (mrbc_integer(*ret) > 0) - (mrbc_integer(*ret) < 0); break;
+#if MRBC_USE_FLOAT
+    case MRBC_TT_FLOAT:	  r = (mrbc_float(*ret) > 0) - (mrbc_float(*ret) < 0); break;
+#endif
+    default:
+      mrbc_raise(vm, MRBC_CLASS(TypeError), "wrong argument type (must be numeric, true, false or nil)");
+      return;
+    }
+
+    if( r == 0 && mrbc_type(*ret) != MRBC_TT_TRUE ) {
+      v[4].i = mid;
+      v[2].i = v[3].i;		// found.
+    } else if( r < 0 ) {
+      v[3].i = mid;
+    } else {
+      v[2].i = mid + 1;
+    }
+  }
+
+  // the block may have changed the array.
+  if( v[3].i > mrbc_array_size(&v[0]) ) v[3].i = mrbc_array_size(&v[0]);
+
+  if( v[2].i >= v[3].i ) {
+    mrbc_value val = mrbc_nil_value();
+    if( v[4].i >= 0 ) val = mrbc_array_get( &v[0], v[4].i );
+    mrbc_incref( &val );
+    mrbc_decref( &v[0] );
+    v[0] = val;
+    mrbc_c_iter_end(vm, v);
+    return;
+  }
+
+  mid = (v[2].i + v[3].i) / 2;
+  mrbc_c_iter_yield(vm, v, &v[1], 1, &v[0].array->data[mid]);
+}
+
+static void c_array_bsearch(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+  if( mrbc_c_iter_begin(vm, v, argc, c_array_bsearch_resume) != 0 ) return;
+
+  mrbc_decref( &v[2] );
+  v[2] = mrbc_integer_value(0);
+  mrbc_decref( &v[3] );
+  v[3] = mrbc_integer_value( mrbc_array_size(&v[0]) );
+  mrbc_decref( &v[4] );
+  v[4] = mrbc_integer_value(-1);
+
+  c_array_bsearch_resume(vm, v, argc);
+}
+
+
 /* MRBC_AUTOGEN_METHOD_TABLE
 
   CLASS("Array")
@@ -1173,10 +2287,37 @@ static void c_array_join(struct VM *vm, mrbc_value v[], int argc)
   METHOD( "min",	c_array_min )
   METHOD( "max",	c_array_max )
   METHOD( "minmax",	c_array_minmax )
+  METHOD( "sum",	c_array_sum )
+#if MRBC_USE_FLOAT
+  METHOD( "mean",	c_array_mean )
+#endif
 #if MRBC_USE_STRING
   METHOD( "inspect",	c_array_inspect )
   METHOD( "to_s",	c_array_inspect )
   METHOD( "join",	c_array_join )
+  METHOD( "pack",	c_array_pack )
 #endif
 */
 #include "_autogen_class_array.h"
+
+
+//================================================================
+/*! define the iterators of Array.
+
+  They override the ones in mrblib, so this must be called after it.
+*/
+void mrbc_init_iterator_array(void)
+{
+  mrbc_define_method(0, MRBC_CLASS(Array), "each",	c_array_each);
+  mrbc_define_method(0, MRBC_CLASS(Array), "each_index", c_array_each_index);
+  mrbc_define_method(0, MRBC_CLASS(Array), "each_with_index", c_array_each_with_index);
+  mrbc_define_method(0, MRBC_CLASS(Array), "collect",	c_array_collect);
+  mrbc_define_method(0, MRBC_CLASS(Array), "map",	c_array_collect);
+  mrbc_define_method(0, MRBC_CLASS(Array), "collect!",	c_array_collect_bang);
+  mrbc_define_method(0, MRBC_CLASS(Array), "map!",	c_array_collect_bang);
+  mrbc_define_method(0, MRBC_CLASS(Array), "select",	c_array_select);
+  mrbc_define_method(0, MRBC_CLASS(Array), "sort",	c_array_sort);
+  mrbc_define_method(0, MRBC_CLASS(Array), "sort!",	c_array_sort_bang);
+  mrbc_define_method(0, MRBC_CLASS(Array), "sort_by",	c_array_sort_by);
+  mrbc_define_method(0, MRBC_CLASS(Array), "bsearch",	c_array_bsearch);
+}
@@ -29,6 +29,11 @@ extern "C" {
 #endif
 
 /***** Constat values *******************************************************/
+// number of buffers that duplicated arrays can share with the source. (0 to 255)
+#if !defined(MRBC_ARRAY_SHARED_MAX)
+#define MRBC_ARRAY_SHARED_MAX 8
+#endif
+
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
 //================================================================
@@ -42,7 +47,9 @@ typedef struct RArray {
 
   uint16_t data_size;	//!< data buffer size.
   uint16_t n_stored;	//!< num of stored.
-  mrbc_value *data;	//!< pointer to allocated memory.
+  uint16_t head;	//!< free cells before data, left by shift.
+  uint8_t shared_idx;	//!< shared buffer number + 1, or 0. (read only)
+  mrbc_value *data;	//!< pointer to the first data in allocated memory.
 
 } mrbc_array;
 
@@ -52,6 +59,8 @@ typedef struct RArray {
 mrbc_value mrbc_array_new(struct VM *vm, int size);
 void mrbc_array_delete(mrbc_value *ary);
 void mrbc_array_clear_vm_id(mrbc_value *ary);
+void mrbc_array_shared_release_vm(const struct VM *vm);
+int mrbc_array_modify(mrbc_value *ary);
 int mrbc_array_resize(mrbc_value *ary, int size);
 int mrbc_array_set(mrbc_value *ary, int idx, mrbc_value *set_val);
 mrbc_value mrbc_array_get(const mrbc_value *ary, int idx);
@@ -68,6 +77,7 @@ void mrbc_array_minmax(mrbc_value *ary, mrbc_value **pp_min_value, mrbc_value **
 mrbc_value mrbc_array_dup(struct VM *vm, const mrbc_value *ary);
 mrbc_value mrbc_array_divide(struct VM *vm, mrbc_value *src, int pos);
 int mrbc_array_include(const mrbc_value *ary, const mrbc_value *val);
+void mrbc_array_sort(mrbc_value *ary);
 
 /***** Inline functions *****************************************************/
 //================================================================
@@ -81,12 +91,15 @@ static inline int mrbc_array_size(const mrbc_value *ary)
 
 //================================================================
 /*! delete handle (do not decrement reference counter)
+
+  The array must not be shared. (see mrbc_array_modify)
 */
 static inline void mrbc_array_delete_handle(mrbc_value *ary)
 {
   mrbc_array *h = ary->array;
 
-  mrbc_raw_free(h->data);
+  mrbc_alloc_compact_remove(&h->data);
+  mrbc_raw_free(h->data - h->head);
   mrbc_raw_free(h);
 }
 
@@ -0,0 +1,333 @@
+/*! @file
+  @brief
+  mruby/c Fixed class (Q16.16 fixed-point number)
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  Fixed is an immediate value as Integer, so it needs no memory.
+  The arithmetic and comparison operators are executed in the VM
+  directly with Fixed, Integer and Float. (see op_add in vm.c)
+
+    kp = Fixed.new(0.8)
+    u = kp * err + (ki * sum)
+    u.round		# -> Integer
+  </pre>
+*/
+
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+//@cond
+#include "vm_config.h"
+#include <stdint.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+#include "value.h"
+#include "symbol.h"
+#include "error.h"
+#include "class.h"
+#include "c_string.h"
+#include "c_fixed.h"
+#include "console.h"
+#include "vm.h"
+
+#if defined(MRBC_USE_FIXED)
+
+/***** Constat values *******************************************************/
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+/***** Function prototypes **************************************************/
+/***** Local variables ******************************************************/
+/***** Global variables *****************************************************/
+//! Fixed class. defined at run time, different from the built-in classes.
+struct RClass *mrbc_class_fixed;
+
+
+/***** Signal catching functions ********************************************/
+/***** Local functions ******************************************************/
+//================================================================
+/*! convert the value to Fixed.
+
+  @param  src	source value. Integer, Float or Fixed.
+  @param  ret	[out] Fixed value.
+  @retval 0	no error.
+  @retval -1	type error.
+  @retval -2	out of range.
+*/
+static int fixed_from_value(const mrbc_value *src, int32_t *ret)
+{
+  switch( mrbc_type(*src) ) {
+  case MRBC_TT_FIXED:
+    *ret = mrbc_fixed(*src);
+    return 0;
+
+  case MRBC_TT_INTEGER: {
+    mrbc_int_t i = mrbc_integer(*src);
+    if( i < INT16_MIN || i > INT16_MAX ) return -2;
+    *ret = mrbc_fixed_from_int( i );
+    return 0;
+  }
+
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT: {
+    mrbc_float_t d = mrbc_float(*src) * MRBC_FIXED_ONE;
+    d += (d < 0) ? -0.5 : 0.5;		// round half away from zero.
+    if( !(d > -2147483649.0 && d < 2147483648.0) ) return -2;	// and NaN
+    *ret = (int32_t)d;
+    return 0;
+  }
+#endif
+
+  default:
+    return -1;
+  }
+}
+
+
+//================================================================
+/*! set the Fixed value to v[0], or raise the error.
+*/
+static void fixed_set_return(struct VM *vm, mrbc_value v[], const mrbc_value *src)
+{
+  int32_t x;
+
+  switch( fixed_from_value( src, &x ) ) {
+  case 0:
+    mrbc_decref( &v[0] );
+    mrbc_set_fixed( &v[0], x );
+    break;
+
+  case -1:
+    mrbc_raise(vm, MRBC_CLASS(TypeError), "can't convert into Fixed");
+    break;
+
+  default:
+    mrbc_raise(vm, MRBC_CLASS(RangeError), "out of Fixed range");
+    break;
+  }
+}
+
+
+/***** Global functions *****************************************************/
+//================================================================
+/*! convert Fixed to string.
+
+  The fraction has the fewest digits (5 at most) to get the same
+  Fixed from the string.
+
+  @param  buf	output buffer.
+  @param  bufsiz buffer size.
+  @param  x	Fixed value.
+*/
+void mrbc_fixed_to_cstr(char *buf, int bufsiz, int32_t x)
+{
+  uint32_t u = (x < 0) ? -(uint32_t)x : (uint32_t)x;
+  uint32_t ip = u >> MRBC_FIXED_FRAC_BITS;
+  uint32_t f16 = u & (MRBC_FIXED_ONE - 1);
+  uint32_t fp, scale = 1;
+  int n = 0;
+
+  // 10^5 > 2^16, so it ends by 5 digits at most.
+  do {
+    n++;
+    scale *= 10;
+    fp = ((uint64_t)f16 * scale + MRBC_FIXED_ONE / 2) >> MRBC_FIXED_FRAC_BITS;
+  } while( (((uint64_t)fp << MRBC_FIXED_FRAC_BITS) + scale / 2) / scale != f16 );
+
+  char frac[6];
+  frac[n] = '\0';
+  for( int i = n-1; i >= 0; i-- ) {
+    frac[i] = '0' + fp % 10;
+    fp /= 10;
+  }
+
+  mrbc_snprintf( buf, bufsiz, "%s%u.%s", (x < 0) ? "-" : "", (unsigned)ip, frac );
+}
+
+
+//================================================================
+/*! (method) new
+
+  Fixed.new( 1.5 )	# Integer, Float or Fixed.
+*/
+static void c_fixed_new(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments");
+    return;
+  }
+
+  fixed_set_return( vm, v, &v[1] );
+}
+
+
+//================================================================
+/*! (method) from_raw
+
+  Fixed.from_raw( 0x18000 )	# -> 1.5
+*/
+static void c_fixed_from_raw(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || mrbc_type(v[1]) != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  mrbc_value ret = mrbc_fixed_value( (int32_t)mrbc_integer(v[1]) );
+  SET_RETURN( ret );
+}
+
+
+//================================================================
+/*! (method) to_fixed for Integer and Float.
+*/
+static void c_numeric_to_fixed(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_value src = v[0];
+  fixed_set_return( vm, v, &src );
+}
+
+
+//================================================================
+/*! (method) raw
+*/
+static void c_fixed_raw(struct VM *vm, mrbc_value v[], int argc)
+{
+  SET_INT_RETURN( mrbc_fixed(v[0]) );
+}
+
+
+//================================================================
+/*! (method) -@
+*/
+static void c_fixed_negative(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_fixed(v[0]) = mrbc_fixed_sub( 0, mrbc_fixed(v[0]) );
+}
+
+
+//================================================================
+/*! (method) abs
+*/
+static void c_fixed_abs(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( mrbc_fixed(v[0]) < 0 ) {
+    mrbc_fixed(v[0]) = mrbc_fixed_sub( 0, mrbc_fixed(v[0]) );
+  }
+}
+
+
+//================================================================
+/*! (method) to_i, truncate toward zero.
+*/
+static void c_fixed_to_i(struct VM *vm, mrbc_value v[], int argc)
+{
+  int32_t x = mrbc_fixed(v[0]);
+  uint32_t u = ((x < 0) ? -(uint32_t)x : (uint32_t)x) >> MRBC_FIXED_FRAC_BITS;
+
+  SET_INT_RETURN( (x < 0) ? -(mrbc_int_t)u : (mrbc_int_t)u );
+}
+
+
+//================================================================
+/*! (method) floor
+*/
+static void c_fixed_floor(struct VM *vm, mrbc_value v[], int argc)
+{
+  SET_INT_RETURN( mrbc_fixed(v[0]) >> MRBC_FIXED_FRAC_BITS );
+}
+
+
+//================================================================
+/*! (method) ceil
+*/
+static void c_fixed_ceil(struct VM *vm, mrbc_value v[], int argc)
+{
+  int64_t x = (int64_t)mrbc_fixed(v[0]) + (MRBC_FIXED_ONE - 1);
+  SET_INT_RETURN( (mrbc_int_t)(x >> MRBC_FIXED_FRAC_BITS) );
+}
+
+
+//================================================================
+/*! (method) round, half away from zero.
+*/
+static void c_fixed_round(struct VM *vm, mrbc_value v[], int argc)
+{
+  int32_t x = mrbc_fixed(v[0]);
+  uint32_t u = ((x < 0) ? -(uint32_t)x : (uint32_t)x) + MRBC_FIXED_ONE / 2;
+  u >>= MRBC_FIXED_FRAC_BITS;
+
+  SET_INT_RETURN( (x < 0) ? -(mrbc_int_t)u : (mrbc_int_t)u );
+}
+
+
+#if MRBC_USE_FLOAT
+//================================================================
+/*! (method) to_f
+*/
+static void c_fixed_to_f(struct VM *vm, mrbc_value v[], int argc)
+{
+  SET_FLOAT_RETURN( mrbc_fixed_to_float( mrbc_fixed(v[0]) ) );
+}
+#endif
+
+
+#if MRBC_USE_STRING
+//================================================================
+/*! (method) inspect, to_s
+*/
+static void c_fixed_inspect(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( v[0].tt == MRBC_TT_CLASS ) {
+    v[0] = mrbc_string_new_symbol(vm, v[0].cls->sym_id);
+    return;
+  }
+
+  char buf[16];
+
+  mrbc_fixed_to_cstr( buf, sizeof(buf), mrbc_fixed(v[0]) );
+  mrbc_value value = mrbc_string_new_cstr(vm, buf);
+  SET_RETURN(value);
+}
+#endif
+
+
+//================================================================
+/*! Initializer
+*/
+void mrbc_init_class_fixed(void)
+{
+  mrbc_class *cls = mrbc_define_class(0, "Fixed", 0);
+  mrbc_class_fixed = cls;
+
+  mrbc_define_method(0, cls, "new", c_fixed_new);
+  mrbc_define_method(0, cls, "from_raw", c_fixed_from_raw);
+  mrbc_define_method(0, cls, "raw", c_fixed_raw);
+  mrbc_define_method(0, cls, "+@", c_ineffect);
+  mrbc_define_method(0, cls, "-@", c_fixed_negative);
+  mrbc_define_method(0, cls, "abs", c_fixed_abs);
+  mrbc_define_method(0, cls, "to_i", c_fixed_to_i);
+  mrbc_define_method(0, cls, "floor", c_fixed_floor);
+  mrbc_define_method(0, cls, "ceil", c_fixed_ceil);
+  mrbc_define_method(0, cls, "round", c_fixed_round);
+  mrbc_define_method(0, cls, "to_fixed", c_ineffect);
+#if MRBC_USE_FLOAT
+  mrbc_define_method(0, cls, "to_f", c_fixed_to_f);
+#endif
+#if MRBC_USE_STRING
+  mrbc_define_method(0, cls, "inspect", c_fixed_inspect);
+  mrbc_define_method(0, cls, "to_s", c_fixed_inspect);
+#endif
+
+  mrbc_define_method(0, MRBC_CLASS(Integer), "to_fixed", c_numeric_to_fixed);
+#if MRBC_USE_FLOAT
+  mrbc_define_method(0, MRBC_CLASS(Float), "to_fixed", c_numeric_to_fixed);
+#endif
+}
+
+#endif  // MRBC_USE_FIXED
@@ -0,0 +1,111 @@
+/*! @file
+  @brief
+  mruby/c Fixed class (Q16.16 fixed-point number)
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef MRBC_SRC_C_FIXED_H_
+#define MRBC_SRC_C_FIXED_H_
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+//@cond
+#include <stdint.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***** Constat values *******************************************************/
+//! number of the fraction bits.
+#define MRBC_FIXED_FRAC_BITS 16
+
+//! 1.0 in the Fixed.
+#define MRBC_FIXED_ONE ((int32_t)1 << MRBC_FIXED_FRAC_BITS)
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+/***** Global variables *****************************************************/
+/***** Function prototypes **************************************************/
+void mrbc_fixed_to_cstr(char *buf, int bufsiz, int32_t x);
+void mrbc_init_class_fixed(void);
+
+
+/***** Inline functions *****************************************************/
+/*
+  (note)
+  The add, sub and mul wrap around at overflow same as Integer.
+  Every result is exact or rounded to the nearest by integer
+  operations, so same on every target.
+*/
+
+//================================================================
+/*! convert Integer to Fixed.
+*/
+static inline int32_t mrbc_fixed_from_int(mrbc_int_t i)
+{
+  return (int32_t)((uint32_t)i << MRBC_FIXED_FRAC_BITS);
+}
+
+//================================================================
+/*! add
+*/
+static inline int32_t mrbc_fixed_add(int32_t x, int32_t y)
+{
+  return (int32_t)((uint32_t)x + (uint32_t)y);
+}
+
+//================================================================
+/*! sub
+*/
+static inline int32_t mrbc_fixed_sub(int32_t x, int32_t y)
+{
+  return (int32_t)((uint32_t)x - (uint32_t)y);
+}
+
+//================================================================
+/*! mul, rounded to the nearest.
+*/
+static inline int32_t mrbc_fixed_mul(int32_t x, int32_t y)
+{
+  int64_t p = (int64_t)x * y + (MRBC_FIXED_ONE / 2);
+  return (int32_t)(p >> MRBC_FIXED_FRAC_BITS);
+}
+
+//================================================================
+/*! div, truncated toward zero.
+
+  @note	y must not be zero.
+*/
+static inline int32_t mrbc_fixed_div(int32_t x, int32_t y)
+{
+  return (int32_t)((int64_t)x * MRBC_FIXED_ONE / y);
+}
+
+#if MRBC_USE_FLOAT
+//================================================================
+/*! convert Fixed to Float.
+*/
+static inline mrbc_float_t mrbc_fixed_to_float(int32_t x)
+{
+  return (mrbc_float_t)x / MRBC_FIXED_ONE;
+}
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -27,6 +27,8 @@
 #include "c_string.h"
 #include "c_array.h"
 #include "c_hash.h"
+#include "vm.h"
+#include "profile.h"
 
 
 /***** Constat values *******************************************************/
@@ -37,12 +39,350 @@
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
+#if defined(MRBC_USE_HASH_INDEX)
+//================================================================
+/*! calculate hash value of the key.
+
+  @param  key	pointer to key.
+  @param  ret	hash value.
+  @return	zero if key is not supported by index.
+*/
+static int hash_index_calc( const mrbc_value *key, uint32_t *ret )
+{
+  uint32_t h;
+
+  switch( mrbc_type(*key) ) {
+  case MRBC_TT_EMPTY:	// same as nil. (see mrbc_compare)
+  case MRBC_TT_NIL:	h = MRBC_TT_NIL;	break;
+  case MRBC_TT_FALSE:
+  case MRBC_TT_TRUE:	h = mrbc_type(*key);	break;
+
+  case MRBC_TT_INTEGER: {
+    uint32_t n = (uint32_t)mrbc_integer(*key);
+#if defined(MRBC_INT64)
+    n ^= (uint32_t)((uint64_t)mrbc_integer(*key) >> 32);
+#endif
+    h = n * 2654435761U;
+  } break;
+
+  case MRBC_TT_SYMBOL:
+    h = (uint32_t)mrbc_symbol(*key) * 2654435761U + MRBC_TT_SYMBOL;
+    break;
+
+#if MRBC_USE_STRING
+  case MRBC_TT_STRING: {
+    const uint8_t *p = (const uint8_t *)mrbc_string_cstr(key);
+    int len = mrbc_string_size(key);
+    h = 2166136261U;	// FNV-1a
+    while( --len >= 0 ) {
+      h = (h ^ *p++) * 16777619U;
+    }
+  } break;
+#endif
+
+  default:
+    return 0;
+  }
+
+  *ret = h ^ (h >> 16);
+  return 1;
+}
+
+
+//================================================================
+/*! discard the index.
+
+  @param  h	pointer to hash.
+*/
+static void hash_index_discard( mrbc_hash *h )
+{
+  if( !h->index ) return;
+
+  mrbc_raw_free( h->index );
+  h->index = NULL;
+}
+
+
+//================================================================
+/*! make the index follow the data.
+
+  @param  h	pointer to hash.
+  @return	pointer to usable index or NULL.
+*/
+static mrbc_hash_index * hash_index_sync( mrbc_hash *h )
+{
+  int n_entry = h->n_stored / 2;
+  mrbc_hash_index *idx = h->index;
+
+  if( n_entry < MRBC_HASH_INDEX_THRESHOLD ) {
+    hash_index_discard( h );
+    return NULL;
+  }
+  if( idx ) {
+    if( idx->n_indexed > n_entry ) {
+      hash_index_discard( h );	// data was shrunk? rebuild.
+      idx = NULL;
+    } else if( idx->size == 0 ) {
+      return NULL;		// contains keys that can not be indexed.
+    } else if( n_entry * 2 > idx->size ) {
+      hash_index_discard( h );	// grow the index.
+      idx = NULL;
+    }
+  }
+
+  if( !idx ) {
+    int size = 4;
+    while( size < n_entry * 4 ) size *= 2;
+    if( size > UINT16_MAX ) return NULL;
+
+    idx = mrbc_raw_alloc( sizeof(mrbc_hash_index) + sizeof(uint16_t) * size );
+    if( !idx ) return NULL;	// ENOMEM. use linear search.
+    mrbc_set_vm_id( idx, mrbc_get_vm_id(h) );
+
+    idx->size = size;
+    idx->n_indexed = 0;
+    memset( idx->slot, 0, sizeof(uint16_t) * size );
+    h->index = idx;
+  }
+
+  // add appended entries.
+  for( ; idx->n_indexed < n_entry; idx->n_indexed++ ) {
+    uint32_t hv;
+    if( !hash_index_calc( &h->data[idx->n_indexed * 2], &hv ) ) {
+      // disable index until the entry is removed.
+      mrbc_hash_index *idx2 = mrbc_raw_realloc( idx, sizeof(mrbc_hash_index) );
+      if( idx2 ) h->index = idx = idx2;
+      idx->size = 0;
+      idx->n_indexed = 0;
+      return NULL;
+    }
+
+    int mask = idx->size - 1;
+    int i = hv & mask;
+    while( idx->slot[i] != 0 ) {
+      i = (i + 1) & mask;
+    }
+    idx->slot[i] = idx->n_indexed + 1;
+  }
+
+  return idx;
+}
+
+
+//================================================================
+/*! remove an entry from the index.
+
+  Call this before the entry is removed from RHash::data. The slot is
+  closed by shifting the following slots in the cluster, and the entries
+  after it are renumbered, so the index is kept without rebuilding.
+
+  @param  h	pointer to hash.
+  @param  n	entry number to be removed.
+*/
+static void hash_index_remove( mrbc_hash *h, int n )
+{
+  mrbc_hash_index *idx = h->index;
+
+  if( !idx ) return;
+  if( idx->size == 0 ) {
+    hash_index_discard( h );	// the entry may be the one can't be indexed.
+    return;
+  }
+  if( n >= idx->n_indexed ) return;	// not indexed yet.
+
+  uint32_t hv;
+  hash_index_calc( &h->data[n * 2], &hv );
+
+  int mask = idx->size - 1;
+  int i = hv & mask;
+  while( idx->slot[i] != n + 1 ) {
+    i = (i + 1) & mask;
+  }
+
+  // move the following slots, unless its home position is after the gap.
+  int j = i;
+  while( 1 ) {
+    j = (j + 1) & mask;
+    if( idx->slot[j] == 0 ) break;
+
+    hash_index_calc( &h->data[(idx->slot[j] - 1) * 2], &hv );
+    if( ((j - (int)(hv & mask)) & mask) < ((j - i) & mask) ) continue;
+    idx->slot[i] = idx->slot[j];
+    i = j;
+  }
+  idx->slot[i] = 0;
+
+  // renumber the entries after the removed one.
+  for( j = 0; j < idx->size; j++ ) {
+    if( idx->slot[j] > n + 1 ) idx->slot[j]--;
+  }
+  idx->n_indexed--;
+}
+#endif
+
+
+//================================================================
+/*! allocate a hash object.
+
+  @param  vm		pointer to VM.
+  @param  data_bytes	size of data buffer in bytes.
+  @return		hash object
+*/
+static mrbc_value hash_alloc( struct VM *vm, unsigned int data_bytes )
+{
+  mrbc_value value = {.tt = MRBC_TT_HASH};
+
+  mrbc_hash *h = mrbc_alloc(vm, sizeof(mrbc_hash));
+  if( !h ) return value;	// ENOMEM
+
+  void *data = mrbc_alloc(vm, data_bytes);
+  if( !data ) {			// ENOMEM
+    mrbc_raw_free( h );
+    return value;
+  }
+
+  MRBC_INIT_OBJECT_HEADER( h, "HA" );
+  h->n_stored = 0;
+  h->head = 0;
+  h->shared_idx = 0;
+#if defined(MRBC_USE_HASH_SYMKEY)
+  h->flag_symkey = 0;
+#endif
+  h->data = data;
+  mrbc_alloc_compact_add( h, &h->data );
+#if defined(MRBC_USE_HASH_INDEX)
+  h->index = NULL;
+  mrbc_alloc_compact_add( h, &h->index );
+#endif
+
+  value.hash = h;
+  return value;
+}
+
+
+#if defined(MRBC_USE_HASH_SYMKEY)
+//================================================================
+/*! make a key-value handle view of the symbol key layout.
+
+  @param  h	pointer to hash.
+  @return	key-value handle that shares the buffer of hash.
+*/
+static inline mrbc_kv_handle hash_symkey_handle( const mrbc_hash *h )
+{
+  return (mrbc_kv_handle){ .data_size = h->data_size,
+			   .n_stored = h->n_stored, .data = h->kv };
+}
+
+
+//================================================================
+/*! write back the key-value handle view to the hash.
+
+  @param  h	pointer to hash.
+  @param  kvh	pointer to key-value handle.
+*/
+static inline void hash_symkey_store( mrbc_hash *h, const mrbc_kv_handle *kvh )
+{
+  h->data_size = kvh->data_size;
+  h->n_stored = kvh->n_stored;
+  h->kv = kvh->data;
+}
+
+
+//================================================================
+/*! search by symbol ID in the symbol key layout.
+
+  @param  h		pointer to hash.
+  @param  sym_id	symbol ID
+  @return		pointer to the value or NULL(not found).
+*/
+static mrbc_value * hash_symkey_search( const mrbc_hash *h, mrbc_sym sym_id )
+{
+  mrbc_kv_handle kvh = hash_symkey_handle( h );
+  return mrbc_kv_get( &kvh, sym_id );
+}
+
+
+//================================================================
+/*! convert the symbol key layout to the generic layout.
+
+  @param  h	pointer to hash.
+  @return	mrbc_error_code
+*/
+static int hash_symkey_to_generic( mrbc_hash *h )
+{
+  int size = (h->n_stored < h->data_size ? h->data_size : h->n_stored + 1) * 2;
+  mrbc_value *data = mrbc_raw_alloc( sizeof(mrbc_value) * size );
+  if( !data ) return E_NOMEMORY_ERROR;		// ENOMEM
+  mrbc_set_vm_id( data, mrbc_get_vm_id(h) );
+
+  int i;
+  for( i = 0; i < h->n_stored; i++ ) {
+    data[i*2] = mrbc_symbol_value( h->kv[i].sym_id );
+    data[i*2+1] = h->kv[i].value;
+  }
+
+  mrbc_raw_free( h->kv );
+  h->data = data;
+  h->data_size = size;
+  h->n_stored *= 2;
+  h->flag_symkey = 0;
+
+  return 0;
+}
+
+
+//================================================================
+/*! remove an entry in the symbol key layout.
+
+  @param  h		pointer to hash.
+  @param  sym_id	symbol ID
+  @return		removed data, or TT_EMPTY if not found.
+*/
+static mrbc_value hash_symkey_remove( mrbc_hash *h, mrbc_sym sym_id )
+{
+  mrbc_value *v = hash_symkey_search( h, sym_id );
+  if( !v ) return (mrbc_value){.tt = MRBC_TT_EMPTY};
+
+  mrbc_value val = *v;
+  mrbc_incref( &val );		// mrbc_kv_remove() releases it.
+
+  mrbc_kv_handle kvh = hash_symkey_handle( h );
+  mrbc_kv_remove( &kvh, sym_id );
+  hash_symkey_store( h, &kvh );
+
+  return val;
+}
+#endif
+
+
+//================================================================
+/*! get the pointer to the value.
+
+  @param  hash	pointer to target hash
+  @param  key	pointer to key value
+  @return	pointer to the value or NULL(not found).
+*/
+static mrbc_value * hash_value_ptr( const mrbc_value *hash, const mrbc_value *key )
+{
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( hash->hash->flag_symkey ) {
+    if( mrbc_type(*key) != MRBC_TT_SYMBOL ) return NULL;
+    return mrbc_hash_get_by_id( hash, mrbc_symbol(*key) );
+  }
+#endif
+
+  mrbc_value *v = mrbc_hash_search(hash, key);
+  return v ? v + 1 : NULL;
+}
+
+
 /***** Global functions *****************************************************/
 /*
   function summary
 
  (constructor)
     mrbc_hash_new
+    mrbc_hash_new_pairs
 
  (destructor)
     mrbc_hash_delete
@@ -56,6 +396,7 @@
     mrbc_hash_get	    *K      V	Data remains in the container
     mrbc_hash_search	    *K     *K	Data remains in the container
     mrbc_hash_search_by_id  SymID  *K	Data remains in the container
+    mrbc_hash_get_by_id	    SymID  *V	Data remains in the container
     mrbc_hash_remove	    *K      V	Data does not remain in the container
     mrbc_hash_remove_by_id  SymID   V	Data does not remain in the container
 
@@ -83,26 +424,59 @@
 */
 mrbc_value mrbc_hash_new(struct VM *vm, int size)
 {
-  mrbc_value value = {.tt = MRBC_TT_HASH};
+  mrbc_value value = hash_alloc( vm, sizeof(mrbc_value) * size * 2 );
+  if( value.hash ) value.hash->data_size = size * 2;
 
-  /*
-    Allocate handle and data buffer.
-  */
-  mrbc_hash *h = mrbc_alloc(vm, sizeof(mrbc_hash));
-  if( !h ) return value;	// ENOMEM
+  return value;
+}
+
+
+//================================================================
+/*! constructor with the pairs of key and value.
+
+  The pairs are moved into the hash, so the caller must forget them.
+  If all keys are symbols, it is stored in the symbol key layout, and a
+  duplicated key keeps the last value.
+
+  @param  vm	pointer to VM.
+  @param  src	pointer to the pairs. (key, value, key, value...)
+  @param  size	num of pairs.
+  @return 	hash object
+  @note		Do not detect duplicate keys in the generic layout.
+*/
+mrbc_value mrbc_hash_new_pairs(struct VM *vm, mrbc_value *src, int size)
+{
+#if defined(MRBC_USE_HASH_SYMKEY)
+  int i;
+  for( i = 0; i < size; i++ ) {
+    if( mrbc_type(src[i*2]) != MRBC_TT_SYMBOL ) break;
+  }
+
+  if( i == size && size <= MRBC_HASH_SYMKEY_MAX ) {
+    mrbc_value value = hash_alloc( vm, sizeof(mrbc_kv) * (size ? size : 1) );
+    mrbc_hash *h = value.hash;
+    if( !h ) return value;	// ENOMEM
+
+    h->flag_symkey = 1;
+    h->data_size = size ? size : 1;
+
+    // insert in order of symbol ID. the buffer is large enough.
+    mrbc_kv_handle kvh = hash_symkey_handle( h );
+    for( i = 0; i < size; i++ ) {
+      mrbc_kv_set( &kvh, mrbc_symbol(src[i*2]), &src[i*2+1] );
+    }
+    hash_symkey_store( h, &kvh );
 
-  mrbc_value *data = mrbc_alloc(vm, sizeof(mrbc_value) * size * 2);
-  if( !data ) {			// ENOMEM
-    mrbc_raw_free( h );
     return value;
   }
+#endif
 
-  MRBC_INIT_OBJECT_HEADER( h, "HA" );
-  h->data_size = size * 2;
-  h->n_stored = 0;
-  h->data = data;
+  mrbc_value value = mrbc_hash_new( vm, size );
+  if( !value.hash ) return value;	// ENOMEM
+
+  memcpy( value.hash->data, src, sizeof(mrbc_value) * size * 2 );
+  value.hash->n_stored = size * 2;
 
-  value.hash = h;
   return value;
 }
 
@@ -114,21 +488,87 @@ mrbc_value mrbc_hash_new(struct VM *vm, int size)
 */
 void mrbc_hash_delete(mrbc_value *hash)
 {
-  // TODO: delete other members (for search).
+#if defined(MRBC_USE_HASH_INDEX)
+  hash_index_discard( hash->hash );
+  mrbc_alloc_compact_remove( &hash->hash->index );
+#endif
+
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( hash->hash->flag_symkey ) {
+    mrbc_hash_clear( hash );
+    mrbc_array_delete_handle( hash );
+    return;
+  }
+#endif
 
   mrbc_array_delete(hash);
 }
 
 
+#if defined(MRBC_ALLOC_VMID)
+//================================================================
+/*! clear vm_id
+
+  @param  hash	pointer to target hash
+*/
+void mrbc_hash_clear_vm_id(mrbc_value *hash)
+{
+#if defined(MRBC_USE_HASH_SYMKEY)
+  mrbc_hash *h = hash->hash;
+  if( h->flag_symkey ) {
+    mrbc_set_vm_id( h, 0 );
+    mrbc_set_vm_id( h->kv, 0 );
+
+    int i;
+    for( i = 0; i < h->n_stored; i++ ) {
+      mrbc_clear_vm_id( &h->kv[i].value );
+    }
+    return;
+  }
+#endif
+
+  mrbc_array_clear_vm_id(hash);
+#if defined(MRBC_USE_HASH_INDEX)
+  if( hash->hash->index ) mrbc_set_vm_id( hash->hash->index, 0 );
+#endif
+}
+#endif
+
+
 //================================================================
 /*! search by key
 
   @param  hash	pointer to target hash
   @param  key	pointer to key value
   @return	pointer to found key or NULL(not found).
+  @note		the symbol key layout is converted to the generic layout.
 */
 mrbc_value * mrbc_hash_search(const mrbc_value *hash, const mrbc_value *key)
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( hash->hash->flag_symkey &&
+      hash_symkey_to_generic( hash->hash ) != 0 ) return NULL;	// ENOMEM
+#endif
+
+#if defined(MRBC_USE_HASH_INDEX)
+  if( mrbc_type(*key) == MRBC_TT_SYMBOL ) {
+    return mrbc_hash_search_by_id( hash, mrbc_symbol(*key) );
+  }
+
+  uint32_t hv;
+  mrbc_hash_index *idx;
+  if( hash_index_calc( key, &hv ) && (idx = hash_index_sync( hash->hash )) ) {
+    int mask = idx->size - 1;
+    int i = hv & mask;
+    while( idx->slot[i] != 0 ) {
+      mrbc_value *p = &hash->hash->data[ (idx->slot[i] - 1) * 2 ];
+      if( mrbc_compare(p, key) == 0 ) return p;
+      i = (i + 1) & mask;
+    }
+    return NULL;
+  }
+#endif
+
   mrbc_value *p1 = hash->hash->data;
   const mrbc_value *p2 = p1 + hash->hash->n_stored;
 
@@ -147,10 +587,33 @@ mrbc_value * mrbc_hash_search(const mrbc_value *hash, const mrbc_value *key)
   @param  hash		pointer to target hash
   @param  sym_id	symbol ID
   @return		pointer to found key or NULL(not found).
-  @note			for use with OP_KEY_P.
+  @note			the symbol key layout is converted to the generic layout.
 */
 mrbc_value * mrbc_hash_search_by_id(const mrbc_value *hash, mrbc_sym sym_id)
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( hash->hash->flag_symkey &&
+      hash_symkey_to_generic( hash->hash ) != 0 ) return NULL;	// ENOMEM
+#endif
+
+#if defined(MRBC_USE_HASH_INDEX)
+  mrbc_hash_index *idx = hash_index_sync( hash->hash );
+  if( idx ) {
+    uint32_t hv;
+    hash_index_calc( &mrbc_symbol_value(sym_id), &hv );
+
+    int mask = idx->size - 1;
+    int i = hv & mask;
+    while( idx->slot[i] != 0 ) {
+      mrbc_value *p = &hash->hash->data[ (idx->slot[i] - 1) * 2 ];
+      if( mrbc_type(*p) == MRBC_TT_SYMBOL &&
+	  mrbc_symbol(*p) == sym_id ) return p;
+      i = (i + 1) & mask;
+    }
+    return NULL;
+  }
+#endif
+
   mrbc_value *p1 = hash->hash->data;
   const mrbc_value *p2 = p1 + hash->hash->n_stored;
 
@@ -164,6 +627,27 @@ mrbc_value * mrbc_hash_search_by_id(const mrbc_value *hash, mrbc_sym sym_id)
 }
 
 
+//================================================================
+/*! get the value by symbol ID
+
+  @param  hash		pointer to target hash
+  @param  sym_id	symbol ID
+  @return		pointer to the value or NULL(not found).
+  @note			for use with OP_KEY_P.
+*/
+mrbc_value * mrbc_hash_get_by_id(const mrbc_value *hash, mrbc_sym sym_id)
+{
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( hash->hash->flag_symkey ) {
+    return hash_symkey_search( hash->hash, sym_id );
+  }
+#endif
+
+  mrbc_value *v = mrbc_hash_search_by_id(hash, sym_id);
+  return v ? v + 1 : NULL;
+}
+
+
 //================================================================
 /*! setter
 
@@ -174,6 +658,22 @@ mrbc_value * mrbc_hash_search_by_id(const mrbc_value *hash, mrbc_sym sym_id)
 */
 int mrbc_hash_set(mrbc_value *hash, mrbc_value *key, mrbc_value *val)
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  mrbc_hash *h = hash->hash;
+  if( h->flag_symkey ) {
+    if( mrbc_type(*key) == MRBC_TT_SYMBOL &&
+	(h->n_stored < MRBC_HASH_SYMKEY_MAX ||
+	 hash_symkey_search( h, mrbc_symbol(*key) )) ) {
+      mrbc_kv_handle kvh = hash_symkey_handle( h );
+      int ret = mrbc_kv_set( &kvh, mrbc_symbol(*key), val );
+      hash_symkey_store( h, &kvh );
+      return ret;
+    }
+
+    if( hash_symkey_to_generic( h ) != 0 ) return E_NOMEMORY_ERROR;
+  }
+#endif
+
   mrbc_value *v = mrbc_hash_search(hash, key);
   int ret = 0;
   if( v == NULL ) {
@@ -203,8 +703,8 @@ int mrbc_hash_set(mrbc_value *hash, mrbc_value *key, mrbc_value *val)
 */
 mrbc_value mrbc_hash_get(const mrbc_value *hash, const mrbc_value *key)
 {
-  mrbc_value *v = mrbc_hash_search(hash, key);
-  return v ? *++v : mrbc_nil_value();
+  mrbc_value *v = hash_value_ptr(hash, key);
+  return v ? *v : mrbc_nil_value();
 }
 
 
@@ -217,19 +717,29 @@ mrbc_value mrbc_hash_get(const mrbc_value *hash, const mrbc_value *key)
 */
 mrbc_value mrbc_hash_remove(mrbc_value *hash, const mrbc_value *key)
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( hash->hash->flag_symkey ) {
+    if( mrbc_type(*key) != MRBC_TT_SYMBOL ) return mrbc_nil_value();
+    mrbc_value val = hash_symkey_remove( hash->hash, mrbc_symbol(*key) );
+    return (val.tt == MRBC_TT_EMPTY) ? mrbc_nil_value() : val;
+  }
+#endif
+
   mrbc_value *v = mrbc_hash_search(hash, key);
   if( v == NULL ) return mrbc_nil_value();
 
+  mrbc_hash *h = hash->hash;
+#if defined(MRBC_USE_HASH_INDEX)
+  hash_index_remove( h, (v - h->data) / 2 );
+#endif
+
   mrbc_decref(v);		// key
   mrbc_value val = v[1];	// value
 
-  mrbc_hash *h = hash->hash;
   h->n_stored -= 2;
 
   memmove(v, v+2, (char*)(h->data + h->n_stored) - (char*)v);
 
-  // TODO: re-index hash table if need.
-
   return val;
 }
 
@@ -245,18 +755,26 @@ mrbc_value mrbc_hash_remove(mrbc_value *hash, const mrbc_value *key)
 */
 mrbc_value mrbc_hash_remove_by_id(mrbc_value *hash, mrbc_sym sym_id)
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( hash->hash->flag_symkey ) {
+    return hash_symkey_remove( hash->hash, sym_id );
+  }
+#endif
+
   mrbc_value *v = mrbc_hash_search_by_id(hash, sym_id);
   if( !v ) return (mrbc_value){.tt = MRBC_TT_EMPTY};
 
+  mrbc_hash *h = hash->hash;
+#if defined(MRBC_USE_HASH_INDEX)
+  hash_index_remove( h, (v - h->data) / 2 );
+#endif
+
   mrbc_value val = v[1];	// value
 
-  mrbc_hash *h = hash->hash;
   h->n_stored -= 2;
 
   memmove(v, v+2, (char*)(h->data + h->n_stored) - (char*)v);
 
-  // TODO: re-index hash table if need.
-
   return val;
 }
 
@@ -268,9 +786,23 @@ mrbc_value mrbc_hash_remove_by_id(mrbc_value *hash, mrbc_sym sym_id)
 */
 void mrbc_hash_clear(mrbc_value *hash)
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  mrbc_hash *h = hash->hash;
+  if( h->flag_symkey ) {
+    int i;
+    for( i = 0; i < h->n_stored; i++ ) {
+      mrbc_decref( &h->kv[i].value );
+    }
+    h->n_stored = 0;
+    return;
+  }
+#endif
+
   mrbc_array_clear(hash);
 
-  // TODO: re-index hash table if need.
+#if defined(MRBC_USE_HASH_INDEX)
+  hash_index_discard( hash->hash );
+#endif
 }
 
 
@@ -284,14 +816,14 @@ void mrbc_hash_clear(mrbc_value *hash)
 */
 int mrbc_hash_compare(const mrbc_value *v1, const mrbc_value *v2)
 {
-  if( v1->hash->n_stored != v2->hash->n_stored ) return 1;
+  if( mrbc_hash_size(v1) != mrbc_hash_size(v2) ) return 1;
 
-  mrbc_value *d1 = v1->hash->data;
-  int i;
-  for( i = 0; i < mrbc_hash_size(v1); i++, d1++ ) {
-    mrbc_value *d2 = mrbc_hash_search(v2, d1);	// check key
+  mrbc_hash_iterator ite = mrbc_hash_iterator_new(v1);
+  while( mrbc_hash_i_has_next(&ite) ) {
+    mrbc_value *kv = mrbc_hash_i_next(&ite);
+    mrbc_value *d2 = hash_value_ptr(v2, &kv[0]);	// check key
     if( d2 == NULL ) return 1;
-    if( mrbc_compare( ++d1, ++d2 ) ) return 1;	// check data
+    if( mrbc_compare( &kv[1], d2 ) ) return 1;		// check data
   }
 
   return 0;
@@ -306,6 +838,25 @@ int mrbc_hash_compare(const mrbc_value *v1, const mrbc_value *v2)
 */
 mrbc_value mrbc_hash_dup( struct VM *vm, mrbc_value *src )
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( src->hash->flag_symkey ) {
+    mrbc_hash *h = src->hash;
+    mrbc_value ret = hash_alloc( vm, sizeof(mrbc_kv) * h->data_size );
+    if( ret.hash == NULL ) return ret;		// ENOMEM
+
+    ret.hash->flag_symkey = 1;
+    ret.hash->data_size = h->data_size;
+    memcpy( ret.hash->kv, h->kv, sizeof(mrbc_kv) * h->n_stored );
+    ret.hash->n_stored = h->n_stored;
+
+    int i;
+    for( i = 0; i < h->n_stored; i++ ) {
+      mrbc_incref( &h->kv[i].value );
+    }
+    return ret;
+  }
+#endif
+
   mrbc_value ret = mrbc_hash_new(vm, mrbc_hash_size(src));
   if( ret.hash == NULL ) return ret;		// ENOMEM
 
@@ -317,14 +868,39 @@ mrbc_value mrbc_hash_dup( struct VM *vm, mrbc_value *src )
   const mrbc_value *p2 = p1 + h->n_stored;
   while( p1 < p2 ) {
     mrbc_incref(p1++);
+    MRBC_YIELD_POINT();
   }
 
-  // TODO: dup other members.
-
   return ret;
 }
 
 
+//================================================================
+/*! resize buffer
+
+  @param  hash	pointer to target hash
+  @param  size	num of entries.
+  @return	mrbc_error_code
+*/
+int mrbc_hash_resize(mrbc_value *hash, int size)
+{
+#if defined(MRBC_USE_HASH_SYMKEY)
+  mrbc_hash *h = hash->hash;
+  if( h->flag_symkey ) {
+    if( size > MRBC_HASH_SYMKEY_MAX ) return hash_symkey_to_generic( h );
+    if( size < h->n_stored || size == 0 ) return 0;
+
+    mrbc_kv_handle kvh = hash_symkey_handle( h );
+    int ret = mrbc_kv_resize( &kvh, size );
+    hash_symkey_store( h, &kvh );
+    return ret;
+  }
+#endif
+
+  return mrbc_array_resize(hash, size * 2);
+}
+
+
 
 
 //================================================================
@@ -426,7 +1002,7 @@ static void c_hash_empty(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_hash_has_key(struct VM *vm, mrbc_value v[], int argc)
 {
-  mrbc_value *res = mrbc_hash_search(v, v+1);
+  mrbc_value *res = hash_value_ptr(v, v+1);
 
   if( res ) {
     SET_TRUE_RETURN();
@@ -574,7 +1150,7 @@ static void c_hash_values(struct VM *vm, mrbc_value v[], int argc)
 static void c_hash_inspect(struct VM *vm, mrbc_value v[], int argc)
 {
   if( v[0].tt == MRBC_TT_CLASS ) {
-    v[0] = mrbc_string_new_cstr(vm, mrbc_symid_to_str( v[0].cls->sym_id ));
+    v[0] = mrbc_string_new_symbol(vm, v[0].cls->sym_id);
     return;
   }
 
@@ -598,6 +1174,7 @@ static void c_hash_inspect(struct VM *vm, mrbc_value v[], int argc)
     s1 = mrbc_send( vm, v, argc, &kv[1], "inspect", 0 );
     mrbc_string_append( &ret, &s1 );
     mrbc_string_delete( &s1 );
+    MRBC_YIELD_POINT();
   }
 
   mrbc_string_append_cstr( &ret, "}" );
@@ -611,6 +1188,60 @@ static void c_hash_inspect(struct VM *vm, mrbc_value v[], int argc)
 #endif
 
 
+//================================================================
+/*! (method) each
+
+  v[1]: block, v[2]: index of the next pair.
+*/
+static void c_hash_each_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  int i = v[2].i;
+  if( i >= mrbc_hash_size(&v[0]) ) {
+    mrbc_c_iter_end(vm, v);
+    return;
+  }
+  v[2].i++;
+
+  // yields [key, value] as mrblib did.
+  mrbc_value pair = mrbc_array_new(vm, 2);
+  if( !pair.array ) {
+    mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+    return;
+  }
+
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( v[0].hash->flag_symkey ) {
+    const mrbc_kv *p = &v[0].hash->kv[i];
+    mrbc_array_push( &pair, &mrbc_symbol_value(p->sym_id) );
+    mrbc_array_push( &pair, (mrbc_value *)&p->value );
+  } else
+#endif
+  {
+    const mrbc_value *kv = v[0].hash->data + i * 2;
+    mrbc_array_push( &pair, (mrbc_value *)&kv[0] );
+    mrbc_array_push( &pair, (mrbc_value *)&kv[1] );
+  }
+  mrbc_incref( &pair.array->data[0] );
+  mrbc_incref( &pair.array->data[1] );
+
+  mrbc_c_iter_yield(vm, v, &v[1], 1, &pair);
+  mrbc_decref( &pair );
+}
+
+static void c_hash_each(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+  if( mrbc_c_iter_begin(vm, v, argc, c_hash_each_resume) != 0 ) return;
+
+  mrbc_decref(&v[2]);
+  v[2] = mrbc_integer_value(0);
+  c_hash_each_resume(vm, v, argc);
+}
+
+
 /* MRBC_AUTOGEN_METHOD_TABLE
 
   CLASS("Hash")
@@ -640,3 +1271,14 @@ static void c_hash_inspect(struct VM *vm, mrbc_value v[], int argc)
 #endif
 */
 #include "_autogen_class_hash.h"
+
+
+//================================================================
+/*! define the iterators of Hash.
+
+  They override the ones in mrblib, so this must be called after it.
+*/
+void mrbc_init_iterator_hash(void)
+{
+  mrbc_define_method(0, MRBC_CLASS(Hash), "each", c_hash_each);
+}
@@ -23,6 +23,7 @@
 /***** Local headers ********************************************************/
 #include "value.h"
 #include "c_array.h"
+#include "keyvalue.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -44,30 +45,80 @@ typedef struct RHash {
 
   uint16_t data_size;	//!< data buffer size.
   uint16_t n_stored;	//!< num of stored.
-  mrbc_value *data;	//!< pointer to allocated memory.
+  uint16_t head;	//!< free cells before data. (always 0)
+  uint8_t shared_idx;	//!< shared buffer number + 1. (always 0)
+#if defined(MRBC_USE_HASH_SYMKEY)
+  uint8_t flag_symkey;	//!< data is kv[] sorted by symbol ID, and sizes count the entries.
+#endif
+  union {
+    mrbc_value *data;	//!< pointer to allocated memory.
+#if defined(MRBC_USE_HASH_SYMKEY)
+    mrbc_kv *kv;	//!< pointer to allocated memory. (if flag_symkey)
+#endif
+  };
 
-  // TODO: and other member for search.
+#if defined(MRBC_USE_HASH_INDEX)
+  struct RHashIndex *index;	//!< search index or NULL.
+#endif
 
 } mrbc_hash;
 
 
+#if defined(MRBC_USE_HASH_INDEX)
+//================================================================
+/*!@brief
+  Open addressing index for Hash.
+
+  slot[] holds (entry number + 1) into RHash::data, or zero if empty.
+  Entries are appended to the index lazily, so members that only append
+  to RHash::data (e.g. OP_HASHADD) keep the index valid. Removing an entry
+  removes it from the index too.
+
+  @note String keys must not be modified destructively while stored.
+*/
+typedef struct RHashIndex {
+  uint16_t size;	//!< num of slots. (power of 2) zero if disabled.
+  uint16_t n_indexed;	//!< num of entries reflected in index.
+  uint16_t slot[];	//!< slots.
+} mrbc_hash_index;
+#endif
+
+
 //================================================================
 /*!@brief
   Define Hash iterator.
 */
 typedef struct RHashIterator {
   mrbc_hash *target;
-  mrbc_value *point;
-  mrbc_value *p_end;
+  union {
+    mrbc_value *point;
+#if defined(MRBC_USE_HASH_SYMKEY)
+    mrbc_kv *kv_point;
+#endif
+  };
+  union {
+    mrbc_value *p_end;
+#if defined(MRBC_USE_HASH_SYMKEY)
+    mrbc_kv *kv_end;
+#endif
+  };
+#if defined(MRBC_USE_HASH_SYMKEY)
+  mrbc_value kv[2];	//!< copy of the key and the value. (if flag_symkey)
+#endif
 } mrbc_hash_iterator;
 
 
 /***** Global variables *****************************************************/
 /***** Function prototypes **************************************************/
 mrbc_value mrbc_hash_new(struct VM *vm, int size);
+mrbc_value mrbc_hash_new_pairs(struct VM *vm, mrbc_value *src, int size);
 void mrbc_hash_delete(mrbc_value *hash);
+#if defined(MRBC_ALLOC_VMID)
+void mrbc_hash_clear_vm_id(mrbc_value *hash);
+#endif
 mrbc_value *mrbc_hash_search(const mrbc_value *hash, const mrbc_value *key);
 mrbc_value *mrbc_hash_search_by_id(const mrbc_value *hash, mrbc_sym sym_id);
+mrbc_value *mrbc_hash_get_by_id(const mrbc_value *hash, mrbc_sym sym_id);
 int mrbc_hash_set(mrbc_value *hash, mrbc_value *key, mrbc_value *val);
 mrbc_value mrbc_hash_get(const mrbc_value *hash, const mrbc_value *key);
 mrbc_value mrbc_hash_remove(mrbc_value *hash, const mrbc_value *key);
@@ -75,6 +126,7 @@ mrbc_value mrbc_hash_remove_by_id(mrbc_value *hash, mrbc_sym sym_id);
 void mrbc_hash_clear(mrbc_value *hash);
 int mrbc_hash_compare(const mrbc_value *v1, const mrbc_value *v2);
 mrbc_value mrbc_hash_dup(struct VM *vm, mrbc_value *src);
+int mrbc_hash_resize(mrbc_value *hash, int size);
 
 
 /***** Inline functions *****************************************************/
@@ -82,24 +134,10 @@ mrbc_value mrbc_hash_dup(struct VM *vm, mrbc_value *src);
 /*! get size
 */
 static inline int mrbc_hash_size(const mrbc_value *hash) {
-  return hash->hash->n_stored / 2;
-}
-
-#if defined(MRBC_ALLOC_VMID)
-//================================================================
-/*! clear vm_id
-*/
-static inline void mrbc_hash_clear_vm_id(mrbc_value *hash) {
-  mrbc_array_clear_vm_id(hash);
-}
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( hash->hash->flag_symkey ) return hash->hash->n_stored;
 #endif
-
-//================================================================
-/*! resize buffer
-*/
-static inline int mrbc_hash_resize(mrbc_value *hash, int size)
-{
-  return mrbc_array_resize(hash, size * 2);
+  return hash->hash->n_stored / 2;
 }
 
 
@@ -114,11 +152,21 @@ static inline int mrbc_hash_resize(mrbc_value *hash, int size)
     // using kv[0] as key, kv[1] as value
   }
 @endcode
+
+  @note kv points to a copy in the iterator if the hash is stored in
+	the symbol key layout, so don't modify the hash through it.
 */
 static inline mrbc_hash_iterator mrbc_hash_iterator_new( const mrbc_value *v )
 {
   mrbc_hash_iterator ite;
   ite.target = v->hash;
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( v->hash->flag_symkey ) {
+    ite.kv_point = v->hash->kv;
+    ite.kv_end = ite.kv_point + v->hash->n_stored;
+    return ite;
+  }
+#endif
   ite.point = v->hash->data;
   ite.p_end = ite.point + v->hash->n_stored;
 
@@ -130,6 +178,9 @@ static inline mrbc_hash_iterator mrbc_hash_iterator_new( const mrbc_value *v )
 */
 static inline int mrbc_hash_i_has_next( mrbc_hash_iterator *ite )
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( ite->target->flag_symkey ) return ite->kv_point < ite->kv_end;
+#endif
   return ite->point < ite->p_end;
 }
 
@@ -138,6 +189,14 @@ static inline int mrbc_hash_i_has_next( mrbc_hash_iterator *ite )
 */
 static inline mrbc_value *mrbc_hash_i_next( mrbc_hash_iterator *ite )
 {
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( ite->target->flag_symkey ) {
+    ite->kv[0] = mrbc_symbol_value( ite->kv_point->sym_id );
+    ite->kv[1] = ite->kv_point->value;
+    ite->kv_point++;
+    return ite->kv;
+  }
+#endif
   mrbc_value *ret = ite->point;
   ite->point += 2;
   return ret;
@@ -27,21 +27,81 @@
 
 /***** Constat values *******************************************************/
 /***** Macros ***************************************************************/
+#if defined(MRBC_MATH_SINGLE_PRECISION)
+#define MATH_FUNC(fn) fn##f	//!< libm function in single precision.
+#else
+#define MATH_FUNC(fn) MRBC_FLOAT_FUNC(fn)
+#endif
+
 /***** Typedefs *************************************************************/
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
+#if MRBC_USE_FLOAT && MRBC_USE_MATH && defined(MRBC_USE_MATH_FAST)
+//! sin(i * PI/256), a quarter turn in 128 steps.
+static const float SIN_TABLE[129] = {
+  0.0f, 0.012271538f, 0.024541229f, 0.036807223f, 0.0490676743f, 0.061320736f,
+  0.073564564f, 0.08579731f, 0.09801714f, 0.110222207f, 0.12241068f, 0.1345807f,
+  0.14673047f, 0.158858143f, 0.17096189f, 0.18303989f, 0.19509032f, 0.20711138f,
+  0.21910124f, 0.2310581f, 0.24298018f, 0.25486566f, 0.26671276f, 0.2785197f,
+  0.290284677f, 0.30200595f, 0.31368174f, 0.3253103f, 0.33688985f, 0.34841868f,
+  0.35989504f, 0.3713172f, 0.38268343f, 0.39399204f, 0.4052413f, 0.41642956f,
+  0.42755509f, 0.43861624f, 0.44961133f, 0.46053871f, 0.47139674f, 0.48218377f,
+  0.4928982f, 0.50353838f, 0.51410274f, 0.52458968f, 0.53499762f, 0.545325f,
+  0.55557023f, 0.5657318f, 0.57580819f, 0.58579786f, 0.5956993f, 0.60551104f,
+  0.6152316f, 0.6248595f, 0.6343933f, 0.64383154f, 0.65317284f, 0.6624158f,
+  0.671559f, 0.680601f, 0.68954054f, 0.69837625f, 0.70710678f, 0.71573083f,
+  0.7242471f, 0.7326543f, 0.7409511f, 0.7491364f, 0.7572088f, 0.765167266f,
+  0.77301045f, 0.7807372f, 0.7883464f, 0.7958369f, 0.8032075f, 0.810457198f,
+  0.8175848f, 0.8245893f, 0.8314696f, 0.8382247f, 0.8448536f, 0.8513552f,
+  0.8577286f, 0.86397286f, 0.87008699f, 0.8760701f, 0.8819213f, 0.88763962f,
+  0.8932243f, 0.8986745f, 0.9039893f, 0.909168f, 0.9142098f, 0.9191139f,
+  0.9238795f, 0.9285061f, 0.9329928f, 0.937339f, 0.94154407f, 0.9456073f,
+  0.94952818f, 0.953306f, 0.95694034f, 0.9604305f, 0.96377607f, 0.96697647f,
+  0.97003125f, 0.97293995f, 0.9757021f, 0.9783174f, 0.98078528f, 0.9831055f,
+  0.98527764f, 0.9873014f, 0.9891765f, 0.99090264f, 0.992479535f, 0.993907f,
+  0.9951847f, 0.9963126f, 0.99729046f, 0.9981181f, 0.99879546f, 0.99932238f,
+  0.9996988f, 0.9999247f, 1.0f,
+};
+
+//! atan(i / 128)
+static const float ATAN_TABLE[129] = {
+  0.0f, 0.007812341f, 0.015623729f, 0.02343321f, 0.031239833f, 0.03904265f,
+  0.046840713f, 0.05463308f, 0.06241881f, 0.07019697f, 0.07796663f, 0.0857268758f,
+  0.09347678f, 0.101215442f, 0.10894196f, 0.11665544f, 0.124354995f, 0.13203976f,
+  0.13970887f, 0.14736148f, 0.15499674f, 0.16261383f, 0.17021193f, 0.17779023f,
+  0.18534795f, 0.19288431f, 0.20039855f, 0.20788993f, 0.2153577f, 0.22280115f,
+  0.23021959f, 0.2376123f, 0.24497866f, 0.252318f, 0.25962963f, 0.266913f,
+  0.27416745f, 0.28139243f, 0.28858736f, 0.2957517f, 0.30288487f, 0.30998639f,
+  0.31705575f, 0.32409247f, 0.33109608f, 0.33806612f, 0.34500218f, 0.35190383f,
+  0.35877067f, 0.36560233f, 0.37239845f, 0.37915867f, 0.38588267f, 0.39257014f,
+  0.39922077f, 0.4058343f, 0.41241044f, 0.41894897f, 0.42544964f, 0.43191224f,
+  0.43833656f, 0.4447224f, 0.45106966f, 0.4573781f, 0.4636476f, 0.46987806f,
+  0.47606933f, 0.482221324f, 0.48833395f, 0.49440714f, 0.50044081f, 0.5064349f,
+  0.5123895f, 0.51830436f, 0.52417963f, 0.53001525f, 0.53581124f, 0.5415676f,
+  0.54728438f, 0.5529616f, 0.5585993f, 0.5641976f, 0.56975645f, 0.575276f,
+  0.58075635f, 0.58619755f, 0.5915997f, 0.5969629f, 0.60228735f, 0.60757306f,
+  0.6128202f, 0.61802891f, 0.62319933f, 0.6283316f, 0.6334259f, 0.63848233f,
+  0.6435011f, 0.6484824f, 0.65342634f, 0.6583331f, 0.663203f, 0.66803606f,
+  0.67283255f, 0.67759265f, 0.68231655f, 0.6870045f, 0.69165662f, 0.6962732f,
+  0.7008544f, 0.70540048f, 0.70991162f, 0.7143881f, 0.71883f, 0.7232377f,
+  0.7276113f, 0.7319512f, 0.73625743f, 0.7405303f, 0.7447701f, 0.748977f,
+  0.7531513f, 0.7572931f, 0.7614028f, 0.76548048f, 0.7695265f, 0.77354101f,
+  0.7775243f, 0.7814766f, 0.7853982f,
+};
+#endif
+
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
 #if MRBC_USE_FLOAT && MRBC_USE_MATH
 //================================================================
-/*! convert mrbc_value to c double
+/*! convert mrbc_value to c float or double (mrbc_float_t)
 */
-static double to_double( struct VM *vm, const mrbc_value *v )
+static mrbc_float_t to_float( struct VM *vm, const mrbc_value *v )
 {
   switch( mrbc_type(*v) ) {
-  case MRBC_TT_INTEGER:	return (double)v->i;
-  case MRBC_TT_FLOAT:	return (double)v->d;
+  case MRBC_TT_INTEGER:	return (mrbc_float_t)v->i;
+  case MRBC_TT_FLOAT:	return v->d;
   default: break;
   }
 
@@ -49,12 +109,68 @@ static double to_double( struct VM *vm, const mrbc_value *v )
   return 0.0;
 }
 
+
+#if defined(MRBC_USE_MATH_FAST)
+//================================================================
+/*! sin by the table and the linear interpolation.
+
+  @param  p	angle in 1/512 turn.
+*/
+static float fast_sin_steps( float p )
+{
+  if( !(p > -2147483648.0f && p < 2147483648.0f) ) {
+    return sinf( p * (float)(2 * M_PI / 512) );		// and NaN
+  }
+
+  int32_t n = (int32_t)p;
+  if( p < n ) n--;		// floor
+  float f = p - n;
+  uint32_t i = (uint32_t)n & 511;
+  uint32_t j = i & 127;
+  float s;
+
+  if( i & 128 ) {		// 2nd and 4th quadrant are mirrored.
+    s = SIN_TABLE[128-j] + (SIN_TABLE[127-j] - SIN_TABLE[128-j]) * f;
+  } else {
+    s = SIN_TABLE[j] + (SIN_TABLE[j+1] - SIN_TABLE[j]) * f;
+  }
+  return (i & 256) ? -s : s;
+}
+
+
+//================================================================
+/*! atan2 by the table and the linear interpolation.
+*/
+static float fast_atan2f( float y, float x )
+{
+  float ax = fabsf(x);
+  float ay = fabsf(y);
+  if( !(ax + ay < INFINITY) ) return atan2f( y, x );	// inf and NaN
+
+  // atan in the 1st octant.
+  float z;
+  if( ax >= ay ) {
+    z = (ax == 0) ? 0 : ay / ax;
+  } else {
+    z = ax / ay;
+  }
+  float p = z * 128;
+  int32_t i = (int32_t)p;
+  if( i > 127 ) i = 127;
+  float a = ATAN_TABLE[i] + (ATAN_TABLE[i+1] - ATAN_TABLE[i]) * (p - i);
+
+  if( ax < ay ) a = (float)(M_PI / 2) - a;
+  if( x < 0 ) a = (float)M_PI - a;
+  return (y < 0) ? -a : a;
+}
+#endif
+
 //================================================================
 /*! (method) acos
 */
 static void c_math_acos(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, acos( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(acos)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -62,7 +178,7 @@ static void c_math_acos(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_acosh(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, acosh( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(acosh)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -70,7 +186,7 @@ static void c_math_acosh(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_asin(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, asin( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(asin)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -78,7 +194,7 @@ static void c_math_asin(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_asinh(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, asinh( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(asinh)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -86,7 +202,7 @@ static void c_math_asinh(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_atan(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, atan( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(atan)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -94,7 +210,7 @@ static void c_math_atan(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_atan2(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, atan2( to_double(vm, &v[1]), to_double(vm, &v[2]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(atan2)( to_float(vm, &v[1]), to_float(vm, &v[2]) ));
 }
 
 //================================================================
@@ -102,7 +218,7 @@ static void c_math_atan2(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_atanh(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, atanh( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(atanh)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -110,7 +226,7 @@ static void c_math_atanh(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_cbrt(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, cbrt( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(cbrt)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -118,7 +234,7 @@ static void c_math_cbrt(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_cos(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, cos( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(cos)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -126,7 +242,7 @@ static void c_math_cos(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_cosh(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, cosh( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(cosh)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -134,7 +250,7 @@ static void c_math_cosh(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_erf(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, erf( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(erf)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -142,7 +258,7 @@ static void c_math_erf(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_erfc(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, erfc( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(erfc)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -150,7 +266,7 @@ static void c_math_erfc(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_exp(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, exp( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(exp)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -158,7 +274,7 @@ static void c_math_exp(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_hypot(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, hypot( to_double(vm, &v[1]), to_double(vm, &v[2]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(hypot)( to_float(vm, &v[1]), to_float(vm, &v[2]) ));
 }
 
 //================================================================
@@ -175,7 +291,7 @@ static void c_math_ldexp(struct VM *vm, mrbc_value v[], int argc)
     return;
   }
 
-  v[0] = mrbc_float_value(vm, ldexp( to_double(vm, &v[1]), exp ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(ldexp)( to_float(vm, &v[1]), exp ));
 }
 
 //================================================================
@@ -183,7 +299,7 @@ static void c_math_ldexp(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_log(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, log( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(log)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -191,7 +307,7 @@ static void c_math_log(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_log10(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, log10( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(log10)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -199,7 +315,7 @@ static void c_math_log10(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_log2(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, log2( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(log2)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -207,7 +323,7 @@ static void c_math_log2(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_sin(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, sin( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(sin)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -215,7 +331,7 @@ static void c_math_sin(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_sinh(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, sinh( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(sinh)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -223,7 +339,7 @@ static void c_math_sinh(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_sqrt(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, sqrt( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(sqrt)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -231,7 +347,7 @@ static void c_math_sqrt(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_tan(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, tan( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(tan)( to_float(vm, &v[1]) ));
 }
 
 //================================================================
@@ -239,9 +355,44 @@ static void c_math_tan(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_math_tanh(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_float_value(vm, tanh( to_double(vm, &v[1]) ));
+  v[0] = mrbc_float_value(vm, MATH_FUNC(tanh)( to_float(vm, &v[1]) ));
 }
 
+#if defined(MRBC_USE_MATH_FAST)
+//================================================================
+/*! (method) fast_sin
+
+  The absolute error is less than 2.5e-5 for |x| <= 100, and
+  grows beyond it by the precision of float.
+*/
+static void c_math_fast_sin(struct VM *vm, mrbc_value v[], int argc)
+{
+  float p = to_float(vm, &v[1]) * (float)(512 / (2 * M_PI));
+  v[0] = mrbc_float_value(vm, fast_sin_steps( p ));
+}
+
+//================================================================
+/*! (method) fast_cos
+
+  The error is same as fast_sin.
+*/
+static void c_math_fast_cos(struct VM *vm, mrbc_value v[], int argc)
+{
+  float p = to_float(vm, &v[1]) * (float)(512 / (2 * M_PI));
+  v[0] = mrbc_float_value(vm, fast_sin_steps( p + 128 ));
+}
+
+//================================================================
+/*! (method) fast_atan2
+
+  The absolute error is less than 1e-5 radian.
+*/
+static void c_math_fast_atan2(struct VM *vm, mrbc_value v[], int argc)
+{
+  v[0] = mrbc_float_value(vm, fast_atan2f( to_float(vm, &v[1]), to_float(vm, &v[2]) ));
+}
+#endif
+
 /***** Global functions *****************************************************/
 //================================================================
 /*! initialize
@@ -253,6 +404,12 @@ void mrbc_init_class_math(void)
 
   static mrbc_value pi = mrbc_float_value(0, M_PI);
   mrbc_set_class_const( MRBC_CLASS(Math), MRBC_SYM(PI), &pi );
+
+#if defined(MRBC_USE_MATH_FAST)
+  mrbc_define_method(0, MRBC_CLASS(Math), "fast_sin", c_math_fast_sin);
+  mrbc_define_method(0, MRBC_CLASS(Math), "fast_cos", c_math_fast_cos);
+  mrbc_define_method(0, MRBC_CLASS(Math), "fast_atan2", c_math_fast_atan2);
+#endif
 }
 
 /* MRBC_AUTOGEN_METHOD_TABLE
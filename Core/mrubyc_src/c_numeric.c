@@ -16,7 +16,6 @@
 /***** System headers *******************************************************/
 //@cond
 #include "vm_config.h"
-#include <stdio.h>
 #include <limits.h>
 #if MRBC_USE_FLOAT
 #include <math.h>
@@ -29,17 +28,125 @@
 #include "error.h"
 #include "class.h"
 #include "c_string.h"
+#include "c_numeric.h"
 #include "console.h"
+#include "vm.h"
 
 
 /***** Constat values *******************************************************/
 /***** Macros ***************************************************************/
+#if defined(MRBC_INT_WIDE)
+//! the method supports 32bit Integer only.
+#define WIDE_INT_UNSUPPORTED() \
+  if( wide_int_unsupported( vm, v, argc ) ) return
+#else
+#define WIDE_INT_UNSUPPORTED() ((void)0)
+#endif
+
 /***** Typedefs *************************************************************/
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
 /***** Global variables *****************************************************/
+#if defined(MRBC_NUMERIC_FAST_SEND)
+//! some of the methods executed in OP_SEND directly are redefined.
+uint8_t mrbc_numeric_redefined;
+#endif
+
+
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
+#if defined(MRBC_INT_WIDE)
+//================================================================
+/*! raise RangeError if the receiver or an argument is the wide Integer.
+*/
+static int wide_int_unsupported(struct VM *vm, mrbc_value v[], int argc)
+{
+  for( int i = 0; i <= argc; i++ ) {
+    if( mrbc_type(v[i]) == MRBC_TT_WIDE_INT ) {
+      mrbc_raise(vm, MRBC_CLASS(RangeError), "out of 32bit Integer");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! set the wide Integer to v[0], or raise the error.
+*/
+static void wide_int_set_return(struct VM *vm, mrbc_value v[], int64_t n)
+{
+  if( mrbc_int_wide_set( &v[0], n ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(RangeError), "integer overflow");
+  }
+}
+#endif
+
+
+/***** Global functions *****************************************************/
+#if defined(MRBC_NUMERIC_FAST_SEND)
+//================================================================
+/*! check the redefinition of the methods that OP_SEND executes directly.
+
+  @param  cls	class which the method link changed.
+*/
+void mrbc_numeric_method_changed(const struct RClass *cls)
+{
+  if( cls != MRBC_CLASS(Integer)
+#if MRBC_USE_FLOAT
+      && cls != MRBC_CLASS(Float)
+#endif
+      ) return;
+
+  // the built-in methods are not in the method link, only the defined at run time.
+  for( const mrbc_method *m = cls->method_link; m; m = m->next ) {
+    switch( m->sym_id ) {
+    case MRBC_SYM(abs):
+    case MRBC_SYM(to_i):
+    case MRBC_SYM(to_f):
+    case MRBC_SYM(MOD):
+    case MRBC_SYM(AND):
+    case MRBC_SYM(OR):
+    case MRBC_SYM(XOR):
+    case MRBC_SYM(NEG):
+    case MRBC_SYM(LT_LT):
+    case MRBC_SYM(GT_GT):
+      mrbc_numeric_redefined = 1;
+      return;
+    }
+  }
+}
+#endif
+
+
+
+#if defined(MRBC_INT_WIDE)
+//================================================================
+/*! convert the wide Integer to string.
+
+  @param  buf	output buffer.
+  @param  bufsiz buffer size.
+  @param  n	value.
+  @param  base	base. 2 to 36.
+*/
+void mrbc_int_wide_to_cstr(char *buf, int bufsiz, int64_t n, int base)
+{
+  char tmp[66];
+  char *p = tmp + sizeof(tmp);
+  uint64_t u = (n < 0) ? -(uint64_t)n : (uint64_t)n;
+
+  *--p = '\0';
+  do {
+    int d = u % base;
+    *--p = (d < 10) ? '0' + d : 'a' - 10 + d;
+    u /= base;
+  } while( u != 0 );
+  if( n < 0 ) *--p = '-';
+
+  mrbc_snprintf( buf, bufsiz, "%s", p );
+}
+#endif
+
 
 /***** Integer class ********************************************************/
 //================================================================
@@ -47,6 +154,8 @@
  */
 static void c_integer_bitref(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   if( mrbc_integer(v[1]) < 0 ) {
     SET_INT_RETURN( 0 );
   } else {
@@ -70,8 +179,12 @@ static void c_integer_positive(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_integer_negative(struct VM *vm, mrbc_value v[], int argc)
 {
+#if defined(MRBC_INT_WIDE)
+  wide_int_set_return( vm, v, -mrbc_int_wide_get( &v[0] ) );
+#else
   mrbc_int_t num = mrbc_integer(v[0]);
   SET_INT_RETURN( -num );
+#endif
 }
 
 
@@ -80,6 +193,8 @@ static void c_integer_negative(struct VM *vm, mrbc_value v[], int argc)
  */
 static void c_integer_power(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   if( mrbc_type(v[1]) == MRBC_TT_INTEGER ) {
     mrbc_int_t x = 1;
     int i;
@@ -93,7 +208,7 @@ static void c_integer_power(struct VM *vm, mrbc_value v[], int argc)
 
 #if MRBC_USE_FLOAT && MRBC_USE_MATH
   else if( mrbc_type(v[1]) == MRBC_TT_FLOAT ) {
-    SET_FLOAT_RETURN( pow( mrbc_integer(v[0]), mrbc_float(v[1])));
+    SET_FLOAT_RETURN( MRBC_FLOAT_FUNC(pow)( mrbc_integer(v[0]), mrbc_float(v[1])));
   }
 #endif
 }
@@ -104,6 +219,22 @@ static void c_integer_power(struct VM *vm, mrbc_value v[], int argc)
  */
 static void c_integer_mod(struct VM *vm, mrbc_value v[], int argc)
 {
+#if defined(MRBC_INT_WIDE)
+  if( mrbc_type(v[0]) == MRBC_TT_WIDE_INT || mrbc_type(v[1]) == MRBC_TT_WIDE_INT ) {
+    if( mrbc_type(v[1]) != MRBC_TT_INTEGER && mrbc_type(v[1]) != MRBC_TT_WIDE_INT ) {
+      mrbc_raise(vm, MRBC_CLASS(TypeError), 0);
+      return;
+    }
+    int64_t n = mrbc_int_wide_get( &v[1] );
+    if( n == 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(ZeroDivisionError), 0);
+      return;
+    }
+    wide_int_set_return( vm, v, mrbc_int_wide_get( &v[0] ) % n );
+    return;
+  }
+#endif
+
   mrbc_int_t num = mrbc_integer(v[1]);
   SET_INT_RETURN( v->i % num );
 }
@@ -114,6 +245,8 @@ static void c_integer_mod(struct VM *vm, mrbc_value v[], int argc)
  */
 static void c_integer_and(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   mrbc_int_t num = mrbc_integer(v[1]);
   SET_INT_RETURN(v->i & num);
 }
@@ -124,6 +257,8 @@ static void c_integer_and(struct VM *vm, mrbc_value v[], int argc)
  */
 static void c_integer_or(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   mrbc_int_t num = mrbc_integer(v[1]);
   SET_INT_RETURN(v->i | num);
 }
@@ -134,6 +269,8 @@ static void c_integer_or(struct VM *vm, mrbc_value v[], int argc)
  */
 static void c_integer_xor(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   mrbc_int_t num = mrbc_integer(v[1]);
   SET_INT_RETURN( v->i ^ num );
 }
@@ -144,33 +281,22 @@ static void c_integer_xor(struct VM *vm, mrbc_value v[], int argc)
  */
 static void c_integer_not(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   mrbc_int_t num = mrbc_integer(v[0]);
   SET_INT_RETURN( ~num );
 }
 
 
-//================================================================
-/*! x-bit left shift for x
- */
-static mrbc_int_t shift(mrbc_int_t x, mrbc_int_t y)
-{
-  // Don't support environments that include padding in int.
-  const int INT_BITS = sizeof(mrbc_int_t) * CHAR_BIT;
-
-  if( y >= INT_BITS ) return 0;
-  if( y >= 0 ) return x << y;
-  if( y <= -INT_BITS ) return 0;
-  return x >> -y;
-}
-
-
 //================================================================
 /*! (operator) <<; bit operation LEFT_SHIFT
  */
 static void c_integer_lshift(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   int num = mrbc_integer(v[1]);
-  SET_INT_RETURN( shift(v->i, num) );
+  SET_INT_RETURN( mrbc_integer_shift(v->i, num) );
 }
 
 
@@ -179,8 +305,10 @@ static void c_integer_lshift(struct VM *vm, mrbc_value v[], int argc)
  */
 static void c_integer_rshift(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   int num = mrbc_integer(v[1]);
-  SET_INT_RETURN( shift(v->i, -num) );
+  SET_INT_RETURN( mrbc_integer_shift(v->i, -num) );
 }
 
 
@@ -189,6 +317,14 @@ static void c_integer_rshift(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_integer_abs(struct VM *vm, mrbc_value v[], int argc)
 {
+#if defined(MRBC_INT_WIDE)
+  if( mrbc_type(v[0]) == MRBC_TT_WIDE_INT ) {
+    int64_t n = mrbc_int_wide_get( &v[0] );
+    if( n < 0 ) wide_int_set_return( vm, v, -n );
+    return;
+  }
+#endif
+
   if( mrbc_integer(v[0]) < 0 ) {
     mrbc_integer(v[0]) = -mrbc_integer(v[0]);
   }
@@ -238,7 +374,11 @@ static void c_numeric_clamp(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_integer_to_f(struct VM *vm, mrbc_value v[], int argc)
 {
+#if defined(MRBC_INT_WIDE)
+  mrbc_float_t f = mrbc_int_wide_get( &v[0] );
+#else
   mrbc_float_t f = mrbc_integer(v[0]);
+#endif
   SET_FLOAT_RETURN( f );
 }
 #endif
@@ -250,6 +390,8 @@ static void c_integer_to_f(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_integer_chr(struct VM *vm, mrbc_value v[], int argc)
 {
+  WIDE_INT_UNSUPPORTED();
+
   char buf[2] = { mrbc_integer(v[0]) };
 
   mrbc_value value = mrbc_string_new(vm, buf, 1);
@@ -263,7 +405,7 @@ static void c_integer_chr(struct VM *vm, mrbc_value v[], int argc)
 static void c_integer_inspect(struct VM *vm, mrbc_value v[], int argc)
 {
   if( v[0].tt == MRBC_TT_CLASS ) {
-    v[0] = mrbc_string_new_cstr(vm, mrbc_symid_to_str( v[0].cls->sym_id ));
+    v[0] = mrbc_string_new_symbol(vm, v[0].cls->sym_id);
     return;
   }
 
@@ -276,6 +418,16 @@ static void c_integer_inspect(struct VM *vm, mrbc_value v[], int argc)
     }
   }
 
+#if defined(MRBC_INT_WIDE)
+  if( mrbc_type(v[0]) == MRBC_TT_WIDE_INT ) {
+    char buf[60];
+    mrbc_int_wide_to_cstr( buf, sizeof(buf), mrbc_int_wide_get( &v[0] ), base );
+    mrbc_value value = mrbc_string_new_cstr(vm, buf);
+    SET_RETURN(value);
+    return;
+  }
+#endif
+
   mrbc_printf_t pf;
   char buf[16];
   mrbc_printf_init( &pf, buf, sizeof(buf), NULL );
@@ -289,6 +441,100 @@ static void c_integer_inspect(struct VM *vm, mrbc_value v[], int argc)
 #endif
 
 
+//================================================================
+/*! (method) times
+
+  v[1]: block, v[2]: counter
+*/
+static void c_integer_times_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( v[2].i >= v[0].i ) {
+    mrbc_c_iter_end(vm, v);
+    return;
+  }
+
+  mrbc_value i = v[2];
+  v[2].i++;
+  mrbc_c_iter_yield(vm, v, &v[1], 1, &i);
+}
+
+static void c_integer_times(struct VM *vm, mrbc_value v[], int argc)
+{
+  WIDE_INT_UNSUPPORTED();
+  if( argc != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+  if( mrbc_c_iter_begin(vm, v, argc, c_integer_times_resume) != 0 ) return;
+
+  mrbc_decref(&v[2]);
+  v[2] = mrbc_integer_value(0);
+  c_integer_times_resume(vm, v, argc);
+}
+
+
+//================================================================
+/*! (method) upto, downto
+
+  v[1]: limit, v[2]: block, v[3]: counter, v[4]: step (1 or -1)
+*/
+static void c_integer_upto_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_int_t i = v[3].i;
+  int over;
+
+#if MRBC_USE_FLOAT
+  if( mrbc_type(v[1]) == MRBC_TT_FLOAT ) {
+    over = (v[4].i > 0) ? (i > v[1].d) : (i < v[1].d);
+  } else
+#endif
+  over = (v[4].i > 0) ? (i > v[1].i) : (i < v[1].i);
+
+  if( over ) {
+    mrbc_c_iter_end(vm, v);
+    return;
+  }
+
+  v[3].i += v[4].i;
+  mrbc_c_iter_yield(vm, v, &v[2], 1, &mrbc_integer_value(i));
+}
+
+static void c_integer_upto_sub(struct VM *vm, mrbc_value v[], int argc, int step)
+{
+  WIDE_INT_UNSUPPORTED();
+  if( argc != 1 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+  switch( mrbc_type(v[1]) ) {
+  case MRBC_TT_INTEGER: break;
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT: break;
+#endif
+  default:
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "comparison failed");
+    return;
+  }
+  if( mrbc_c_iter_begin(vm, v, argc, c_integer_upto_resume) != 0 ) return;
+
+  mrbc_decref(&v[3]);
+  v[3] = v[0];
+  mrbc_decref(&v[4]);
+  v[4] = mrbc_integer_value(step);
+  c_integer_upto_resume(vm, v, argc);
+}
+
+static void c_integer_upto(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_integer_upto_sub(vm, v, argc, 1);
+}
+
+static void c_integer_downto(struct VM *vm, mrbc_value v[], int argc)
+{
+  c_integer_upto_sub(vm, v, argc, -1);
+}
+
+
 /* MRBC_AUTOGEN_METHOD_TABLE
 
   CLASS("Integer")
@@ -320,6 +566,19 @@ static void c_integer_inspect(struct VM *vm, mrbc_value v[], int argc)
 #include "_autogen_class_integer.h"
 
 
+//================================================================
+/*! define the iterators of Integer.
+
+  They override the ones in mrblib, so this must be called after it.
+*/
+void mrbc_init_iterator_integer(void)
+{
+  mrbc_define_method(0, MRBC_CLASS(Integer), "times",  c_integer_times);
+  mrbc_define_method(0, MRBC_CLASS(Integer), "upto",   c_integer_upto);
+  mrbc_define_method(0, MRBC_CLASS(Integer), "downto", c_integer_downto);
+}
+
+
 
 /***** Float class **********************************************************/
 #if MRBC_USE_FLOAT
@@ -356,7 +615,7 @@ static void c_float_power(struct VM *vm, mrbc_value v[], int argc)
   default:					break;
   }
 
-  SET_FLOAT_RETURN( pow( mrbc_float(v[0]), n ));
+  SET_FLOAT_RETURN( MRBC_FLOAT_FUNC(pow)( mrbc_float(v[0]), n ));
 }
 #endif
 
@@ -389,13 +648,13 @@ static void c_float_to_i(struct VM *vm, mrbc_value v[], int argc)
 static void c_float_inspect(struct VM *vm, mrbc_value v[], int argc)
 {
   if( v[0].tt == MRBC_TT_CLASS ) {
-    v[0] = mrbc_string_new_cstr(vm, mrbc_symid_to_str( v[0].cls->sym_id ));
+    v[0] = mrbc_string_new_symbol(vm, v[0].cls->sym_id);
     return;
   }
 
   char buf[16];
 
-  snprintf( buf, sizeof(buf), "%g", v->d );
+  mrbc_snprintf( buf, sizeof(buf), "%g", v->d );
   mrbc_value value = mrbc_string_new_cstr(vm, buf);
   SET_RETURN(value);
 }
@@ -15,11 +15,92 @@
 #ifndef MRBC_SRC_C_NUMERIC_H_
 #define MRBC_SRC_C_NUMERIC_H_
 
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+//@cond
+#include <stdint.h>
+#include <limits.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+#include "value.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/***** Constat values *******************************************************/
+#if defined(MRBC_INT_WIDE)
+//! range of the wide Integer. (56bit)
+#define MRBC_INT_WIDE_MAX (((int64_t)1 << 55) - 1)
+#define MRBC_INT_WIDE_MIN (-((int64_t)1 << 55))
+#endif
+
+
+/***** Global variables *****************************************************/
+#if defined(MRBC_NUMERIC_FAST_SEND)
+extern uint8_t mrbc_numeric_redefined;
+#endif
+
+
+/***** Function prototypes **************************************************/
+#if defined(MRBC_INT_WIDE)
+void mrbc_int_wide_to_cstr(char *buf, int bufsiz, int64_t n, int base);
+#endif
+
+
+/***** Inline functions *****************************************************/
+//================================================================
+/*! y-bit left shift for x. (right shift if y < 0)
+*/
+static inline mrbc_int_t mrbc_integer_shift(mrbc_int_t x, mrbc_int_t y)
+{
+  // Don't support environments that include padding in int.
+  const int INT_BITS = sizeof(mrbc_int_t) * CHAR_BIT;
+
+  if( y >= INT_BITS ) return 0;
+  if( y >= 0 ) return x << y;
+  if( y <= -INT_BITS ) return 0;
+  return x >> -y;
+}
+
+
+#if defined(MRBC_INT_WIDE)
+//================================================================
+/*! get the value of Integer, normal or wide.
+
+  @param  v	pointer to Integer.
+  @return	value.
+*/
+static inline int64_t mrbc_int_wide_get(const mrbc_value *v)
+{
+  if( v->tt == MRBC_TT_INTEGER ) return v->i;
+  return (int64_t)((uint64_t)(int64_t)v->i_hi << 32 | (uint32_t)v->i);
+}
+
+//================================================================
+/*! set the value to Integer, normal if it is in 32bit, otherwise wide.
+
+  @param  v	pointer to the destination.
+  @param  n	value.
+  @return	0 if no error, or -1 if out of the wide range.
+*/
+static inline int mrbc_int_wide_set(mrbc_value *v, int64_t n)
+{
+  if( n == (int32_t)n ) {
+    v->tt = MRBC_TT_INTEGER;
+    v->i = (int32_t)n;
+    return 0;
+  }
+  if( n < MRBC_INT_WIDE_MIN || n > MRBC_INT_WIDE_MAX ) return -1;
+
+  v->tt = MRBC_TT_WIDE_INT;
+  v->i = (int32_t)n;
+  v->i_hi = (int32_t)(n >> 32);
+  return 0;
+}
+#endif
+
 
 #ifdef __cplusplus
 }
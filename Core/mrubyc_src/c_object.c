@@ -34,6 +34,7 @@
 #include "c_hash.h"
 #include "global.h"
 #include "vm.h"
+#include "profile.h"
 #include "console.h"
 
 
@@ -100,6 +101,28 @@ static void c_object_new(struct VM *vm, mrbc_value v[], int argc)
 }
 
 
+#if defined(MRBC_USE_OBJECT_POOL)
+//================================================================
+/*! (method) pool
+
+  Frame.pool( 8 )	# keep up to 8 released instances for reuse.
+  Frame.pool( 0 )	# stop it.
+ */
+static void c_object_pool(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( mrbc_type(v[0]) != MRBC_TT_CLASS || argc != 1 ||
+      mrbc_type(v[1]) != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  if( mrbc_instance_pool_set( v[0].cls, mrbc_integer(v[1]) ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+  }
+}
+#endif
+
+
 //================================================================
 /*! (operator) !
  */
@@ -174,7 +197,15 @@ static void c_object_dup(struct VM *vm, mrbc_value v[], int argc)
 {
   if( mrbc_type(v[0]) == MRBC_TT_OBJECT ) {
     mrbc_value new_obj = mrbc_instance_new(vm, v->instance->cls, 0);
+#if defined(MRBC_USE_IVAR_SHAPE)
+    for( int i = 0; i < v->instance->n_ivar; i++ ) {
+      if( v->instance->ivar[i].tt == MRBC_TT_EMPTY ) continue;
+      mrbc_instance_setiv( &new_obj, v->instance->cls->ivar_shape[i],
+			   &v->instance->ivar[i] );
+    }
+#else
     mrbc_kv_dup( &v->instance->ivar, &new_obj.instance->ivar );
+#endif
 
     mrbc_decref( v );
     *v = new_obj;
@@ -408,6 +439,15 @@ static void c_object_instance_variables(struct VM *vm, mrbc_value v[], int argc)
   // temporary code for operation check.
 
   mrbc_value ret = mrbc_array_new( vm, 0 );
+#if defined(MRBC_USE_IVAR_SHAPE)
+  if( v[0].tt == MRBC_TT_OBJECT ) {
+    mrbc_instance *inst = v[0].instance;
+    for( int i = 0; i < inst->n_ivar; i++ ) {
+      if( inst->ivar[i].tt == MRBC_TT_EMPTY ) continue;
+      mrbc_array_push( &ret, &mrbc_symbol_value(inst->cls->ivar_shape[i]) );
+    }
+  }
+#else
   mrbc_kv_handle *kvh = &v[0].instance->ivar;
 #if 0
   mrbc_printf("n = %d/%d ", kvh->n_stored, kvh->data_size);
@@ -418,6 +458,7 @@ static void c_object_instance_variables(struct VM *vm, mrbc_value v[], int argc)
       mrbc_array_push( &ret, &mrbc_symbol_value(kvh->data[i].sym_id) );
     }
   }
+#endif
 
   SET_RETURN(ret);
 }
@@ -438,10 +479,17 @@ static void c_object_memory_statistics(struct VM *vm, mrbc_value v[], int argc)
     mrbc_printf("  Used : %d\n", mem.used);
     mrbc_printf("  Free : %d\n", mem.free);
     mrbc_printf("  Frag.: %d\n", mem.fragmentation);
+    mrbc_printf("  Perm.: %d\n", mem.permanent);
+    mrbc_printf("  Peak : %d\n", mem.peak);
+    mrbc_printf("  Alloc: %u (%u bytes)\n", mem.n_alloc, mem.alloc_bytes);
+    mrbc_printf("  Free : %u\n", mem.n_free);
+#if defined(MRBC_ALLOC_SLAB)
+    mrbc_printf("  Slab : %d/%d\n", mem.slab_used, mem.slab_total);
+#endif
   }
 
   // make a return value.
-  mrbc_value ret = mrbc_hash_new(vm, 4);
+  mrbc_value ret = mrbc_hash_new(vm, 9);
   mrbc_hash_set(&ret, &mrbc_symbol_value( mrbc_str_to_symid("total") ),
 		      &mrbc_integer_value( mem.total ));
   mrbc_hash_set(&ret, &mrbc_symbol_value( mrbc_str_to_symid("used") ),
@@ -450,6 +498,16 @@ static void c_object_memory_statistics(struct VM *vm, mrbc_value v[], int argc)
 		      &mrbc_integer_value( mem.free ));
   mrbc_hash_set(&ret, &mrbc_symbol_value( mrbc_str_to_symid("fragmentation") ),
 		      &mrbc_integer_value( mem.fragmentation ));
+  mrbc_hash_set(&ret, &mrbc_symbol_value( mrbc_str_to_symid("permanent") ),
+		      &mrbc_integer_value( mem.permanent ));
+  mrbc_hash_set(&ret, &mrbc_symbol_value( mrbc_str_to_symid("peak") ),
+		      &mrbc_integer_value( mem.peak ));
+  mrbc_hash_set(&ret, &mrbc_symbol_value( mrbc_str_to_symid("alloc_count") ),
+		      &mrbc_integer_value( mem.n_alloc ));
+  mrbc_hash_set(&ret, &mrbc_symbol_value( mrbc_str_to_symid("free_count") ),
+		      &mrbc_integer_value( mem.n_free ));
+  mrbc_hash_set(&ret, &mrbc_symbol_value( mrbc_str_to_symid("alloc_bytes") ),
+		      &mrbc_integer_value( mem.alloc_bytes ));
 
   SET_RETURN(ret);
 }
@@ -460,7 +518,7 @@ static void c_object_memory_statistics(struct VM *vm, mrbc_value v[], int argc)
 //================================================================
 /*! (method) instance variable getter used by attr_reader.
  */
-static void c_object_getiv(struct VM *vm, mrbc_value v[], int argc)
+void c_object_getiv(struct VM *vm, mrbc_value v[], int argc)
 {
   mrbc_sym sym_id = mrbc_get_callee_symid(vm);
   mrbc_value ret = mrbc_instance_getiv(&v[0], sym_id);
@@ -472,7 +530,7 @@ static void c_object_getiv(struct VM *vm, mrbc_value v[], int argc)
 //================================================================
 /*! (method) instance variable setter used by attr_accessor.
  */
-static void c_object_setiv(struct VM *vm, mrbc_value v[], int argc)
+void c_object_setiv(struct VM *vm, mrbc_value v[], int argc)
 {
   const char *name = mrbc_get_callee_name(vm);
   int len = strlen(name);
@@ -559,6 +617,12 @@ static void c_object_sprintf(struct VM *vm, mrbc_value v[], int argc)
 
   mrbc_printf_t pf;
   mrbc_printf_init( &pf, buf, buflen, mrbc_string_cstr(format) );
+#if defined(MRBC_USE_FORMAT_CACHE)
+  // the literal in bytecode is parsed once.
+  if( format->string->flag_literal && !format->string->shared_idx ) {
+    mrbc_printf_use_cache( &pf );
+  }
+#endif
 
   int i = 2;
   int ret;
@@ -732,6 +796,9 @@ static void c_object_to_s(struct VM *vm, mrbc_value v[], int argc)
   METHOD( "print",	c_object_print )
   METHOD( "puts",	c_object_puts )
   METHOD( "raise",	c_object_raise )
+#if defined(MRBC_USE_OBJECT_POOL)
+  METHOD( "pool",	c_object_pool )
+#endif
   METHOD( "attr_reader",c_object_attr_reader )
   METHOD( "attr_accessor", c_object_attr_accessor )
 
@@ -777,12 +844,14 @@ static void c_proc_new(struct VM *vm, mrbc_value v[], int argc)
 static void c_proc_call(struct VM *vm, mrbc_value v[], int argc)
 {
   assert( mrbc_type(v[0]) == MRBC_TT_PROC );
+  if( mrbc_check_regs( vm, v, v[0].proc->irep->nregs ) != 0 ) return;
 
   mrbc_callinfo *callinfo_self = v[0].proc->callinfo_self;
   mrbc_callinfo *callinfo = mrbc_push_callinfo(vm,
 				(callinfo_self ? callinfo_self->method_id : 0),
 				v - vm->cur_regs, argc);
   if( !callinfo ) return;
+  MRBC_PROFILE_CALL_KIND(callinfo, MRBC_PROFILE_BLOCK);
 
   if( callinfo_self ) {
     callinfo->own_class = callinfo_self->own_class;
@@ -851,7 +920,7 @@ static void c_nil_to_f(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_nil_inspect(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_string_new_cstr(vm, "nil");
+  v[0] = mrbc_string_new_literal(vm, "nil", 3);
 }
 
 
@@ -860,7 +929,7 @@ static void c_nil_inspect(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_nil_to_s(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_string_new(vm, NULL, 0);
+  v[0] = mrbc_string_new_literal(vm, "", 0);
 }
 #endif  // MRBC_USE_STRING
 
@@ -893,7 +962,7 @@ static void c_nil_to_s(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_true_to_s(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_string_new_cstr(vm, "true");
+  v[0] = mrbc_string_new_literal(vm, "true", 4);
 }
 #endif
 
@@ -918,7 +987,7 @@ static void c_true_to_s(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_false_to_s(struct VM *vm, mrbc_value v[], int argc)
 {
-  v[0] = mrbc_string_new_cstr(vm, "false");
+  v[0] = mrbc_string_new_literal(vm, "false", 5);
 }
 #endif  // MRBC_USE_STRING
 
@@ -30,6 +30,8 @@ struct VM;
 struct RObject;
 
 void mrbc_instance_call_initialize(struct VM *vm, struct RObject v[], int argc);
+void c_object_getiv(struct VM *vm, struct RObject v[], int argc);
+void c_object_setiv(struct VM *vm, struct RObject v[], int argc);
 
 
 /***** Inline functions *****************************************************/
@@ -26,15 +26,64 @@
 #include "c_string.h"
 #include "c_range.h"
 #include "console.h"
+#include "vm.h"
 
 /***** Constat values *******************************************************/
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
+#if MRBC_RANGE_FREE_MAX > 0 && !defined(MRBC_ALLOC_ARENA)
+// freed Range objects, owned by VM ID 0. (not with arenas, that are
+// released at once)
+static mrbc_range *range_free_[MRBC_RANGE_FREE_MAX];
+static int range_n_free_;
+#define RANGE_USE_FREE_LIST
+#endif
+
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
+//================================================================
+/*! take a Range object from the free list.
+
+  @param  vm	pointer to VM.
+  @return	pointer to the object, or NULL if empty.
+*/
+static mrbc_range * range_take_free(struct VM *vm)
+{
+#if defined(RANGE_USE_FREE_LIST)
+  if( range_n_free_ == 0 ) return NULL;
+
+  mrbc_range *range = range_free_[--range_n_free_];
+  if( vm ) mrbc_set_vm_id( range, vm->vm_id );
+  return range;
+#else
+  return NULL;
+#endif
+}
+
+
+//================================================================
+/*! put a Range object back to the free list.
+
+  @param  range	pointer to the object.
+  @return	true if kept, false if the list is full.
+*/
+static int range_put_free(mrbc_range *range)
+{
+#if defined(RANGE_USE_FREE_LIST)
+  if( range_n_free_ == MRBC_RANGE_FREE_MAX ) return 0;
+
+  mrbc_set_vm_id( range, 0 );
+  range_free_[range_n_free_++] = range;
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+
 /***** Global functions *****************************************************/
 
 //================================================================
@@ -50,7 +99,8 @@ mrbc_value mrbc_range_new(struct VM *vm, mrbc_value *first, mrbc_value *last, in
 {
   mrbc_value value = {.tt = MRBC_TT_RANGE};
 
-  value.range = mrbc_alloc(vm, sizeof(mrbc_range));
+  value.range = range_take_free(vm);
+  if( !value.range ) value.range = mrbc_alloc(vm, sizeof(mrbc_range));
   if( !value.range ) return value;		// ENOMEM
 
   MRBC_INIT_OBJECT_HEADER( value.range, "RA" );
@@ -71,6 +121,7 @@ void mrbc_range_delete(mrbc_value *v)
 {
   mrbc_decref( &v->range->first );
   mrbc_decref( &v->range->last );
+  if( range_put_free( v->range ) ) return;
 
   mrbc_raw_free( v->range );
 }
@@ -177,7 +228,7 @@ static void c_range_exclude_end(struct VM *vm, mrbc_value v[], int argc)
 static void c_range_inspect(struct VM *vm, mrbc_value v[], int argc)
 {
   if( v[0].tt == MRBC_TT_CLASS ) {
-    v[0] = mrbc_string_new_cstr(vm, mrbc_symid_to_str( v[0].cls->sym_id ));
+    v[0] = mrbc_string_new_symbol(vm, v[0].cls->sym_id);
     return;
   }
 
@@ -202,6 +253,95 @@ static void c_range_inspect(struct VM *vm, mrbc_value v[], int argc)
 #endif
 
 
+//================================================================
+/*! (method) each
+
+  v[1]: block, v[2]: counter, v[3]: limit (excluded)
+*/
+static void c_range_each_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( v[2].i >= v[3].i ) {
+    mrbc_c_iter_end(vm, v);
+    return;
+  }
+
+  mrbc_value i = v[2];
+  v[2].i++;
+  mrbc_c_iter_yield(vm, v, &v[1], 1, &i);
+}
+
+static void c_range_each(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+
+  const mrbc_range *range = v[0].range;
+  if( mrbc_type(range->first) != MRBC_TT_INTEGER ||
+      mrbc_type(range->last) != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(TypeError), "can't iterate");
+    return;
+  }
+  if( mrbc_c_iter_begin(vm, v, argc, c_range_each_resume) != 0 ) return;
+
+  mrbc_decref(&v[2]);
+  v[2] = range->first;
+  mrbc_decref(&v[3]);
+  v[3] = mrbc_integer_value( range->last.i + !range->flag_exclude );
+  c_range_each_resume(vm, v, argc);
+}
+
+
+//================================================================
+/*! (method) step
+
+  v[1]: step, v[2]: block, v[3]: counter, v[4]: limit (excluded)
+*/
+static void c_range_step_resume(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( v[3].i >= v[4].i ) {
+    mrbc_c_iter_end(vm, v);
+    return;
+  }
+
+  mrbc_value i = v[3];
+  if( v[4].i - v[3].i > v[1].i ) {
+    v[3].i += v[1].i;
+  } else {
+    v[3].i = v[4].i;
+  }
+  mrbc_c_iter_yield(vm, v, &v[2], 1, &i);
+}
+
+static void c_range_step(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || mrbc_type(v[1]) != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "wrong number of arguments.");
+    return;
+  }
+  if( mrbc_integer(v[1]) <= 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "step must be positive");
+    return;
+  }
+
+  const mrbc_range *range = v[0].range;
+  if( mrbc_type(range->first) != MRBC_TT_INTEGER ||
+      mrbc_type(range->last) != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(TypeError), "can't iterate");
+    return;
+  }
+
+  if( mrbc_c_iter_begin(vm, v, argc, c_range_step_resume) != 0 ) return;
+  mrbc_decref(&v[3]);
+  v[3] = range->first;
+  mrbc_decref(&v[4]);
+  v[4] = mrbc_integer_value( range->last.i + !range->flag_exclude );
+
+  c_range_step_resume(vm, v, argc);
+}
+
+
 /* MRBC_AUTOGEN_METHOD_TABLE
 
   CLASS("Range")
@@ -217,3 +357,19 @@ static void c_range_inspect(struct VM *vm, mrbc_value v[], int argc)
 #endif
 */
 #include "_autogen_class_range.h"
+
+
+//================================================================
+/*! define the iterators of Range.
+
+  They override the ones in mrblib, so this must be called after it.
+*/
+void mrbc_init_iterator_range(void)
+{
+#if defined(RANGE_USE_FREE_LIST)
+  range_n_free_ = 0;		// the memory pool is initialized.
+#endif
+
+  mrbc_define_method(0, MRBC_CLASS(Range), "each", c_range_each);
+  mrbc_define_method(0, MRBC_CLASS(Range), "step", c_range_step);
+}
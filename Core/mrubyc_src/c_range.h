@@ -28,6 +28,11 @@ extern "C" {
 #endif
 
 /***** Constat values *******************************************************/
+// number of freed Range objects kept for reuse. (0 to disable)
+#if !defined(MRBC_RANGE_FREE_MAX)
+#define MRBC_RANGE_FREE_MAX 4
+#endif
+
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
 
@@ -30,17 +30,87 @@
 #include "c_array.h"
 #include "vm.h"
 #include "console.h"
+#include "profile.h"
 
 
 /***** Constat values *******************************************************/
+//! mrbc_string_index() uses Horspool for the pattern of this size or more,
+//! and the search of this number of positions or more. (the table costs)
+#define STRING_INDEX_HORSPOOL_MIN_LEN	4
+#define STRING_INDEX_HORSPOOL_MIN_TRY	64
+
+//! minimum buffer size when expanded, for the interpolation of short strings.
+#define STRING_EXPAND_MIN_SIZE	32
+
+
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
+#if MRBC_USE_STRING && MRBC_STRING_SHARED_MAX > 0
+//! buffers shared by substrings and duplicates. (see mrbc_string_substr)
+static struct {
+  uint8_t *buf;		//!< the buffer owned by this entry.
+  uint16_t ref_count;	//!< num of strings using it, or 0 if free.
+} string_shared_[MRBC_STRING_SHARED_MAX];
+#endif
+
+
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
 #if MRBC_USE_STRING
+//================================================================
+/*! share the buffer of the string.
+
+  The string becomes read only, and the buffer is owned by the entry
+  of string_shared_ until the last string using it is released.
+
+  @param  h	pointer to string handle
+  @return	zero if shared.
+*/
+static int string_share( mrbc_string *h )
+{
+#if MRBC_STRING_SHARED_MAX > 0
+  if( h->shared_idx ) return 0;
+  if( h->flag_literal || h->flag_inline ) return -1;
+
+  for( int i = 0; i < MRBC_STRING_SHARED_MAX; i++ ) {
+    if( string_shared_[i].ref_count != 0 ) continue;
+
+    mrbc_alloc_compact_remove( &h->data );
+    string_shared_[i].buf = h->data;
+    string_shared_[i].ref_count = 1;
+    h->shared_idx = i + 1;
+    h->flag_literal = 1;
+    return 0;
+  }
+#endif
+
+  return -1;
+}
+
+
+//================================================================
+/*! release the shared buffer of the string.
+
+  @param  h	pointer to string handle
+*/
+static void string_unshare( mrbc_string *h )
+{
+#if MRBC_STRING_SHARED_MAX > 0
+  if( h->shared_idx == 0 ) return;
+
+  int idx = h->shared_idx - 1;
+  h->shared_idx = 0;
+  if( --string_shared_[idx].ref_count == 0 ) {
+    mrbc_raw_free( string_shared_[idx].buf );
+    string_shared_[idx].buf = 0;
+  }
+#endif
+}
+
+
 //================================================================
 /*! white space character test
 
@@ -74,19 +144,33 @@ mrbc_value mrbc_string_new(struct VM *vm, const void *src, int len)
 
   /*
     Allocate handle and string buffer.
+    A short string is stored just after the handle.
   */
-  mrbc_string *h = mrbc_alloc(vm, sizeof(mrbc_string));
-  if( !h ) return value;		// ENOMEM
+  mrbc_string *h;
+  uint8_t *str;
+  if( len <= MRBC_STRING_INLINE_MAX ) {
+    h = mrbc_alloc(vm, sizeof(mrbc_string) + len+1);
+    if( !h ) return value;		// ENOMEM
+    str = (uint8_t *)(h + 1);
 
-  uint8_t *str = mrbc_alloc(vm, len+1);
-  if( !str ) {				// ENOMEM
-    mrbc_raw_free( h );
-    return value;
+  } else {
+    h = mrbc_alloc(vm, sizeof(mrbc_string));
+    if( !h ) return value;		// ENOMEM
+
+    str = mrbc_alloc(vm, len+1);
+    if( !str ) {			// ENOMEM
+      mrbc_raw_free( h );
+      return value;
+    }
   }
 
   MRBC_INIT_OBJECT_HEADER( h, "ST" );
   h->size = len;
+  h->flag_literal = 0;
+  h->flag_inline = (str == (uint8_t *)(h + 1));
+  h->shared_idx = 0;
   h->data = str;
+  if( !h->flag_inline ) mrbc_alloc_compact_add( h, &h->data );
 
   /*
     Copy a source string.
@@ -123,13 +207,158 @@ mrbc_value mrbc_string_new_alloc(struct VM *vm, void *buf, int len)
 
   MRBC_INIT_OBJECT_HEADER( h, "ST" );
   h->size = len;
+  h->flag_literal = 0;
+  h->flag_inline = 0;
+  h->shared_idx = 0;
+  h->data = buf;
+  mrbc_alloc_compact_add( h, &h->data );
+
+  value.string = h;
+  return value;
+}
+
+
+//================================================================
+/*! resize the string buffer
+
+  An inline buffer can't be expanded, so move it to the heap.
+  The size field is not changed.
+
+  @param  h	pointer to string handle
+  @param  size	new buffer size
+  @return	pointer to buffer or NULL if error.
+*/
+static uint8_t * string_resize( mrbc_string *h, int size )
+{
+  uint8_t *buf;
+
+  if( h->flag_inline ) {
+    if( size <= h->size + 1 ) return h->data;	// shrink. keep it inline.
+
+    buf = mrbc_raw_alloc( size );
+    if( !buf ) return NULL;
+    mrbc_set_vm_id( buf, mrbc_get_vm_id(h) );
+    memcpy( buf, h->data, h->size + 1 );
+    h->flag_inline = 0;
+    mrbc_alloc_compact_add( h, &h->data );
+
+  } else {
+    buf = mrbc_raw_realloc( h->data, size );
+    if( !buf ) return NULL;
+  }
+
   h->data = buf;
+  return buf;
+}
+
+
+//================================================================
+/*! expand the string buffer to append
+
+  Grows the buffer 1.5 times at once, and to STRING_EXPAND_MIN_SIZE at
+  least, so that repeated appending doesn't copy the whole buffer each time.
+
+  @param  h	pointer to string handle
+  @param  size	required buffer size
+  @return	pointer to buffer or NULL if error.
+*/
+static uint8_t * string_expand( mrbc_string *h, int size )
+{
+#if !defined(MRBC_ALLOC_LIBC)
+  // enough capacity already?
+  if( !h->flag_inline &&
+      size <= (int)mrbc_alloc_usable_size( h->data ) ) return h->data;
+
+  int new_size = h->size + h->size / 2 + 1;
+  if( new_size < STRING_EXPAND_MIN_SIZE ) new_size = STRING_EXPAND_MIN_SIZE;
+  if( new_size > size ) {
+    uint8_t *buf = string_resize( h, new_size );
+    if( buf ) return buf;
+  }
+#endif
+
+  return string_resize( h, size );
+}
+
+
+//================================================================
+/*! constructor by string literal
+
+  The buffer is not copied. It must be '\0' terminated and must not be
+  released while the string lives, such as the pool data in bytecode.
+  It is copied to the heap when the string is modified.
+
+  @param  vm	pointer to VM.
+  @param  src	pointer to literal
+  @param  len	length
+  @return 	string object
+*/
+mrbc_value mrbc_string_new_literal(struct VM *vm, const void *src, int len)
+{
+  mrbc_value value = {.tt = MRBC_TT_STRING};
+
+  mrbc_string *h = mrbc_alloc(vm, sizeof(mrbc_string));
+  if( !h ) return value;		// ENOMEM
+
+  MRBC_INIT_OBJECT_HEADER( h, "ST" );
+  h->size = len;
+  h->flag_literal = 1;
+  h->flag_inline = 0;
+  h->shared_idx = 0;
+  h->data = (uint8_t *)src;
 
   value.string = h;
   return value;
 }
 
 
+//================================================================
+/*! constructor by symbol name
+
+  The name in the symbol table is referred as a literal, so only the
+  string handle is allocated. (e.g. Symbol#to_s, and class names)
+
+  @param  vm	pointer to VM.
+  @param  sym_id symbol id.
+  @return 	string object
+*/
+mrbc_value mrbc_string_new_symbol(struct VM *vm, mrbc_sym sym_id)
+{
+  const char *str = mrbc_symid_to_str( sym_id );
+  if( !str ) str = "";
+
+  return mrbc_string_new_literal( vm, str, strlen(str) );
+}
+
+
+//================================================================
+/*! make the string writable
+
+  If the data is a literal or shared, copy it into the heap.
+  Call this before changing the data in place.
+
+  @param  str	pointer to target value
+  @return	mrbc_error_code
+*/
+int mrbc_string_modify(mrbc_value *str)
+{
+  mrbc_string *h = str->string;
+  if( !h->flag_literal ) return 0;
+
+  uint8_t *buf = mrbc_raw_alloc( h->size + 1 );
+  if( !buf ) return E_NOMEMORY_ERROR;
+  mrbc_set_vm_id( buf, mrbc_get_vm_id(h) );
+
+  memcpy( buf, h->data, h->size + 1 );
+  string_unshare( h );
+  h->data = buf;
+  h->flag_literal = 0;
+  mrbc_alloc_compact_add( h, &h->data );
+
+  return 0;
+}
+
+
 //================================================================
 /*! destructor
 
@@ -137,7 +366,12 @@ mrbc_value mrbc_string_new_alloc(struct VM *vm, void *buf, int len)
 */
 void mrbc_string_delete(mrbc_value *str)
 {
-  mrbc_raw_free(str->string->data);
+  if( str->string->flag_literal ) {
+    string_unshare( str->string );
+  } else if( !str->string->flag_inline ) {
+    mrbc_alloc_compact_remove( &str->string->data );
+    mrbc_raw_free(str->string->data);
+  }
   mrbc_raw_free(str->string);
 }
 
@@ -148,7 +382,14 @@ void mrbc_string_delete(mrbc_value *str)
 */
 void mrbc_string_clear(mrbc_value *str)
 {
-  mrbc_raw_realloc(str->string->data, 1);
+  if( str->string->flag_literal ) {
+    string_unshare( str->string );
+    str->string->data = (uint8_t *)"";
+    str->string->size = 0;
+    return;
+  }
+
+  string_resize(str->string, 1);
   str->string->data[0] = '\0';
   str->string->size = 0;
 }
@@ -161,7 +402,33 @@ void mrbc_string_clear(mrbc_value *str)
 void mrbc_string_clear_vm_id(mrbc_value *str)
 {
   mrbc_set_vm_id( str->string, 0 );
-  mrbc_set_vm_id( str->string->data, 0 );
+  if( !str->string->flag_literal && !str->string->flag_inline ) {
+    mrbc_set_vm_id( str->string->data, 0 );
+  }
+#if MRBC_STRING_SHARED_MAX > 0
+  if( str->string->shared_idx ) {
+    mrbc_set_vm_id( string_shared_[str->string->shared_idx - 1].buf, 0 );
+  }
+#endif
+}
+
+
+//================================================================
+/*! forget the shared buffers of the VM
+
+  They are released by mrbc_free_all() with the strings using them.
+*/
+void mrbc_string_shared_release_vm(const struct VM *vm)
+{
+#if MRBC_STRING_SHARED_MAX > 0
+  for( int i = 0; i < MRBC_STRING_SHARED_MAX; i++ ) {
+    if( string_shared_[i].ref_count == 0 ) continue;
+    if( mrbc_get_vm_id( string_shared_[i].buf ) != vm->vm_id ) continue;
+
+    string_shared_[i].buf = 0;
+    string_shared_[i].ref_count = 0;
+  }
+#endif
 }
 #endif
 
@@ -169,6 +436,9 @@ void mrbc_string_clear_vm_id(mrbc_value *str)
 //================================================================
 /*! duplicate string
 
+  A long string shares the buffer with the source, instead of copying.
+  Both of them become read only, and are copied when modified.
+
   @param  vm	pointer to VM.
   @param  s1	pointer to target value
   @return	new string as s1 + s2
@@ -177,6 +447,28 @@ mrbc_value mrbc_string_dup(struct VM *vm, mrbc_value *s1)
 {
   mrbc_string *h1 = s1->string;
 
+  if( h1->flag_literal ) {		// share the literal too.
+    mrbc_value value = mrbc_string_new_literal(vm, h1->data, h1->size);
+#if MRBC_STRING_SHARED_MAX > 0
+    if( value.string && h1->shared_idx ) {
+      value.string->shared_idx = h1->shared_idx;
+      string_shared_[h1->shared_idx - 1].ref_count++;
+    }
+#endif
+    return value;
+  }
+
+#if MRBC_STRING_SHARED_MAX > 0
+  if( h1->size > MRBC_STRING_INLINE_MAX && string_share(h1) == 0 ) {
+    mrbc_value value = mrbc_string_new_literal(vm, h1->data, h1->size);
+    if( value.string ) {
+      value.string->shared_idx = h1->shared_idx;
+      string_shared_[h1->shared_idx - 1].ref_count++;
+    }
+    return value;
+  }
+#endif
+
   mrbc_value value = mrbc_string_new(vm, NULL, h1->size);
   if( value.string == NULL ) return value;		// ENOMEM
 
@@ -186,6 +478,48 @@ mrbc_value mrbc_string_dup(struct VM *vm, mrbc_value *s1)
 }
 
 
+//================================================================
+/*! substring
+
+  A long substring that reaches the end of the source shares the buffer
+  with it, instead of copying. Both of them become read only, and are
+  copied when modified. A substring in the middle is always copied,
+  because the data must be terminated by '\0'.
+
+  @param  vm	pointer to VM.
+  @param  src	pointer to source string.
+  @param  pos	start position. (0 <= pos <= size)
+  @param  len	length. (0 <= len <= size - pos)
+  @return	new string.
+*/
+mrbc_value mrbc_string_substr(struct VM *vm, mrbc_value *src, int pos, int len)
+{
+  mrbc_string *h = src->string;
+
+  if( len <= MRBC_STRING_INLINE_MAX || pos + len != h->size ) {
+    return mrbc_string_new(vm, h->data + pos, len);
+  }
+
+  // a literal needs no owner.
+  if( h->flag_literal && !h->shared_idx ) {
+    return mrbc_string_new_literal(vm, h->data + pos, len);
+  }
+
+#if MRBC_STRING_SHARED_MAX > 0
+  if( string_share(h) == 0 ) {
+    mrbc_value value = mrbc_string_new_literal(vm, h->data + pos, len);
+    if( value.string ) {
+      value.string->shared_idx = h->shared_idx;
+      string_shared_[h->shared_idx - 1].ref_count++;
+    }
+    return value;
+  }
+#endif
+
+  return mrbc_string_new(vm, h->data + pos, len);
+}
+
+
 //================================================================
 /*! add string (s1 + s2)
 
@@ -218,10 +552,12 @@ mrbc_value mrbc_string_add(struct VM *vm, const mrbc_value *s1, const mrbc_value
 */
 int mrbc_string_append(mrbc_value *s1, const mrbc_value *s2)
 {
+  if( mrbc_string_modify(s1) != 0 ) return E_NOMEMORY_ERROR;
+
   int len1 = s1->string->size;
   int len2 = (mrbc_type(*s2) == MRBC_TT_STRING) ? s2->string->size : 1;
 
-  uint8_t *str = mrbc_raw_realloc(s1->string->data, len1+len2+1);
+  uint8_t *str = string_expand(s1->string, len1+len2+1);
   if( !str ) return E_NOMEMORY_ERROR;
 
   if( mrbc_type(*s2) == MRBC_TT_STRING ) {
@@ -248,9 +584,11 @@ int mrbc_string_append(mrbc_value *s1, const mrbc_value *s2)
 */
 int mrbc_string_append_cbuf(mrbc_value *s1, const void *s2, int len2)
 {
+  if( mrbc_string_modify(s1) != 0 ) return E_NOMEMORY_ERROR;
+
   int len1 = s1->string->size;
 
-  uint8_t *str = mrbc_raw_realloc(s1->string->data, len1+len2+1);
+  uint8_t *str = string_expand(s1->string, len1+len2+1);
   if( !str ) return E_NOMEMORY_ERROR;
 
   if( s2 ) {
@@ -267,6 +605,38 @@ int mrbc_string_append_cbuf(mrbc_value *s1, const void *s2, int len2)
 }
 
 
+//================================================================
+/*! locate a pattern by Boyer-Moore-Horspool.
+
+  The shifts are limited to 255, to keep the table in bytes.
+
+  @param  s	string to search.
+  @param  n	size of the string.
+  @param  p	pattern.
+  @param  m	size of the pattern. (m >= 2)
+  @return	position index. or minus value if not found.
+*/
+static int string_index_horspool(const uint8_t *s, int n, const uint8_t *p, int m)
+{
+  uint8_t shift[256];
+  int i;
+
+  memset( shift, (m < 255) ? m : 255, sizeof(shift) );
+  for( i = (m > 255) ? m - 255 : 0; i < m - 1; i++ ) {
+    shift[p[i]] = m - 1 - i;
+  }
+
+  const uint8_t last = p[m - 1];
+  for( i = 0; i <= n - m; ) {
+    uint8_t ch = s[i + m - 1];
+    if( ch == last && memcmp( s + i, p, m - 1 ) == 0 ) return i;
+    i += shift[ch];
+  }
+
+  return -1;
+}
+
+
 //================================================================
 /*! locate a substring in a string
 
@@ -277,16 +647,30 @@ int mrbc_string_append_cbuf(mrbc_value *s1, const void *s2, int len2)
 */
 int mrbc_string_index(const mrbc_value *src, const mrbc_value *pattern, int offset)
 {
-  char *p1 = mrbc_string_cstr(src) + offset;
-  char *p2 = mrbc_string_cstr(pattern);
-  int try_cnt = mrbc_string_size(src) - mrbc_string_size(pattern) - offset;
+  const char *p1 = mrbc_string_cstr(src) + offset;
+  const char *p2 = mrbc_string_cstr(pattern);
+  int len = mrbc_string_size(pattern);
+  int try_cnt = mrbc_string_size(src) - len - offset;
+
+  if( len == 0 ) return (try_cnt >= 0) ? offset : -1;
+
+  // long pattern in long string, skip by the table.
+  if( len >= STRING_INDEX_HORSPOOL_MIN_LEN &&
+      try_cnt >= STRING_INDEX_HORSPOOL_MIN_TRY ) {
+    int pos = string_index_horspool( (const uint8_t *)p1, try_cnt + len,
+				     (const uint8_t *)p2, len );
+    return (pos < 0) ? -1 : pos + offset;
+  }
 
+  // find the first byte by memchr, and compare the rest.
   while( try_cnt >= 0 ) {
-    if( memcmp( p1, p2, mrbc_string_size(pattern) ) == 0 ) {
-      return p1 - mrbc_string_cstr(src);	// matched.
+    const char *p = memchr( p1, p2[0], try_cnt + 1 );
+    if( !p ) break;
+    if( memcmp( p + 1, p2 + 1, len - 1 ) == 0 ) {
+      return p - mrbc_string_cstr(src);	// matched.
     }
-    try_cnt--;
-    p1++;
+    try_cnt -= p - p1 + 1;
+    p1 = p + 1;
   }
 
   return -1;
@@ -324,10 +708,12 @@ int mrbc_string_strip(mrbc_value *src, int mode)
   int new_size = p2 - p1 + 1;
   if( mrbc_string_size(src) == new_size ) return 0;
 
+  int ofs = p1 - mrbc_string_cstr(src);
+  if( mrbc_string_modify(src) != 0 ) return 0;	// ENOMEM
   char *buf = mrbc_string_cstr(src);
-  if( p1 != buf ) memmove( buf, p1, new_size );
+  if( ofs ) memmove( buf, buf + ofs, new_size );
   buf[new_size] = '\0';
-  mrbc_raw_realloc(buf, new_size+1);	// shrink suitable size.
+  string_resize(src->string, new_size+1);	// shrink suitable size.
   src->string->size = new_size;
 
   return 1;
@@ -355,6 +741,7 @@ int mrbc_string_chomp(mrbc_value *src)
   int new_size = p2 - p1 + 1;
   if( mrbc_string_size(src) == new_size ) return 0;
 
+  if( mrbc_string_modify(src) != 0 ) return 0;	// ENOMEM
   char *buf = mrbc_string_cstr(src);
   buf[new_size] = '\0';
   src->string->size = new_size;
@@ -377,6 +764,10 @@ static int mrbc_string_upcase(mrbc_value *str)
   while (len != 0) {
     len--;
     if ('a' <= data[len] && data[len] <= 'z') {
+      if( count == 0 ) {		// copy the literal at first change.
+	if( mrbc_string_modify(str) != 0 ) return 0;
+	data = str->string->data;
+      }
       data[len] = data[len] - ('a' - 'A');
       count++;
     }
@@ -399,6 +790,10 @@ static int mrbc_string_downcase(mrbc_value *str)
   while (len != 0) {
     len--;
     if ('A' <= data[len] && data[len] <= 'Z') {
+      if( count == 0 ) {		// copy the literal at first change.
+	if( mrbc_string_modify(str) != 0 ) return 0;
+	data = str->string->data;
+      }
       data[len] = data[len] + ('a' - 'A');
       count++;
     }
@@ -517,7 +912,11 @@ static void c_string_to_i(struct VM *vm, mrbc_value v[], int argc)
 */
 static void c_string_to_f(struct VM *vm, mrbc_value v[], int argc)
 {
+#if MRBC_USE_FLOAT == 1
+  mrbc_float_t d = strtof(mrbc_string_cstr(v), 0);
+#else
   mrbc_float_t d = atof(mrbc_string_cstr(v));
+#endif
 
   SET_FLOAT_RETURN( d );
 }
@@ -530,7 +929,7 @@ static void c_string_to_f(struct VM *vm, mrbc_value v[], int argc)
 static void c_string_to_s(struct VM *vm, mrbc_value v[], int argc)
 {
   if( v[0].tt == MRBC_TT_CLASS ) {
-    v[0] = mrbc_string_new_cstr(vm, mrbc_symid_to_str( v[0].cls->sym_id ));
+    v[0] = mrbc_string_new_symbol(vm, v[0].cls->sym_id);
     return;
   }
 }
@@ -577,7 +976,7 @@ static void c_string_slice(struct VM *vm, mrbc_value v[], int argc)
   if( len < 0 ) goto RETURN_NIL;
   if( argc == 1 && len <= 0 ) goto RETURN_NIL;
 
-  mrbc_value ret = mrbc_string_new(vm, mrbc_string_cstr(v) + pos, len);
+  mrbc_value ret = mrbc_string_substr(vm, &v[0], pos, len);
   if( !ret.string ) goto RETURN_NIL;		// ENOMEM
 
   SET_RETURN(ret);
@@ -633,18 +1032,26 @@ static void c_string_insert(struct VM *vm, mrbc_value v[], int argc)
     return;
   }
 
+  if( mrbc_string_modify(v) != 0 ) {
+    mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+    return;
+  }
+
   int len3 = len1 + len2 - len;			// final length.
   uint8_t *str = v->string->data;
   if( len1 < len3 ) {
-    str = mrbc_realloc(vm, str, len3+1);	// expand
-    if( !str ) return;
+    str = string_resize(v->string, len3+1);	// expand
+    if( !str ) {
+      mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+      return;
+    }
   }
 
   memmove( str + nth + len2, str + nth + len, len1 - nth - len + 1 );
   memcpy( str + nth, mrbc_string_cstr(val), len2 );
 
   if( len1 > len3 ) {
-    str = mrbc_realloc(vm, str, len3+1);	// shrink
+    str = string_resize(v->string, len3+1);	// shrink
   }
 
   v->string->size = len1 + len2 - len;
@@ -833,10 +1240,15 @@ static void c_string_slice_self(struct VM *vm, mrbc_value v[], int argc)
   if( !ret.string ) goto RETURN_NIL;		// ENOMEM
 
   if( len > 0 ) {
+    if( mrbc_string_modify(v) != 0 ) {
+      mrbc_decref( &ret );
+      mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+      return;
+    }
     memmove( mrbc_string_cstr(v) + pos, mrbc_string_cstr(v) + pos + len,
 	     mrbc_string_size(v) - pos - len + 1 );
     v->string->size = mrbc_string_size(v) - len;
-    mrbc_raw_realloc( mrbc_string_cstr(v), mrbc_string_size(v)+1 );
+    string_resize( v->string, mrbc_string_size(v)+1 );
   }
 
   SET_RETURN(ret);
@@ -848,61 +1260,38 @@ static void c_string_slice_self(struct VM *vm, mrbc_value v[], int argc)
 
 
 //================================================================
-/*! (method) split
+/*! scan the pieces of split.
+
+  @param  vm	pointer to VM.
+  @param  src	target string.
+  @param  sep	separator.
+  @param  limit	limit parameter of split.
+  @param  ret	array to store the pieces, or NULL to count them.
+  @param  n_max	max num of the pieces to store.
+  @return	num of the pieces. (without the trailing empty ones, if limit is 0)
 */
-static void c_string_split(struct VM *vm, mrbc_value v[], int argc)
+static int string_split_scan(struct VM *vm, const mrbc_value *src, const mrbc_value *sep, int limit, mrbc_value *ret, int n_max)
 {
-  mrbc_value ret = mrbc_array_new(vm, 0);
-  if( mrbc_string_size(&v[0]) == 0 ) goto DONE;
-
-  // check limit parameter.
-  int limit = 0;
-  if( argc >= 2 ) {
-    if( mrbc_type(v[2]) != MRBC_TT_INTEGER ) {
-      mrbc_raise( vm, MRBC_CLASS(ArgumentError), 0 );
-      return;
-    }
-    limit = v[2].i;
-    if( limit == 1 ) {
-      mrbc_array_push( &ret, &v[0] );
-      mrbc_incref( &v[0] );
-      goto DONE;
-    }
-  }
-
-  // check separator parameter.
-  mrbc_value sep = (argc == 0) ? mrbc_string_new_cstr(vm, " ") : v[1];
-  switch( mrbc_type(sep) ) {
-  case MRBC_TT_NIL:
-    sep = mrbc_string_new_cstr(vm, " ");
-    break;
-
-  case MRBC_TT_STRING:
-    break;
-
-  default:
-    mrbc_raise( vm, MRBC_CLASS(TypeError), 0 );
-    return;
-  }
-
-  int flag_strip = (mrbc_string_cstr(&sep)[0] == ' ') &&
-		   (mrbc_string_size(&sep) == 1);
+  const char *s = mrbc_string_cstr(src);
+  int size = mrbc_string_size(src);
+  const char *sp = mrbc_string_cstr(sep);
+  int sep_size = mrbc_string_size(sep);
+  int flag_strip = (sep_size == 1) && (sp[0] == ' ');
+  int sep_len = (sep_size == 0) ? 1 : sep_size;
   int offset = 0;
-  int sep_len = mrbc_string_size(&sep);
-  if( sep_len == 0 ) sep_len++;
+  int n = 0;		// num of the pieces.
+  int n_keep = 0;	// num of the pieces up to the last non empty one.
 
   while( 1 ) {
     int pos, len = 0;
 
     if( flag_strip ) {
-      for( ; offset < mrbc_string_size(&v[0]); offset++ ) {
-	if( !is_space( mrbc_string_cstr(&v[0])[offset] )) break;
-      }
-      if( offset > mrbc_string_size(&v[0])) break;
+      while( offset < size && is_space( s[offset] )) offset++;
+      if( offset > size ) break;
     }
 
     // check limit
-    if( limit > 0 && mrbc_array_size(&ret)+1 >= limit ) {
+    if( limit > 0 && n+1 >= limit ) {
       pos = -1;
       goto SPLIT_ITEM;
     }
@@ -910,49 +1299,98 @@ static void c_string_split(struct VM *vm, mrbc_value v[], int argc)
     // split by space character.
     if( flag_strip ) {
       pos = offset;
-      for( ; pos < mrbc_string_size(&v[0]); pos++ ) {
-	if( is_space( mrbc_string_cstr(&v[0])[pos] )) break;
-      }
+      while( pos < size && !is_space( s[pos] )) pos++;
       len = pos - offset;
       goto SPLIT_ITEM;
     }
 
     // split by each character.
-    if( mrbc_string_size(&sep) == 0 ) {
-      pos = (offset < mrbc_string_size(&v[0])-1) ? offset : -1;
+    if( sep_size == 0 ) {
+      pos = (offset < size-1) ? offset : -1;
       len = 1;
       goto SPLIT_ITEM;
     }
 
     // split by specified character.
-    pos = mrbc_string_index( &v[0], &sep, offset );
+    if( sep_size == 1 ) {
+      const char *p = memchr( s + offset, sp[0], size - offset );
+      pos = p ? p - s : -1;
+    } else {
+      pos = mrbc_string_index( src, sep, offset );
+    }
     len = pos - offset;
 
 
   SPLIT_ITEM:
-    if( pos < 0 ) len = mrbc_string_size(&v[0]) - offset;
+    if( pos < 0 ) len = size - offset;
 
-    mrbc_value v1 = mrbc_string_new(vm, mrbc_string_cstr(&v[0]) + offset, len);
-    mrbc_array_push( &ret, &v1 );
+    if( ret ) {
+      if( n >= n_max ) break;
+      mrbc_value v1 = mrbc_string_new(vm, s + offset, len);
+      mrbc_array_push( ret, &v1 );
+      MRBC_YIELD_POINT();
+    }
+    n++;
+    if( len != 0 ) n_keep = n;
 
     if( pos < 0 ) break;
     offset = pos + sep_len;
   }
 
-  // remove trailing empty item
-  if( limit == 0 ) {
-    while( 1 ) {
-      int idx = mrbc_array_size(&ret) - 1;
-      if( idx < 0 ) break;
+  // trailing empty items are removed, if limit is 0.
+  return (limit == 0) ? n_keep : n;
+}
+
 
-      mrbc_value v1 = mrbc_array_get( &ret, idx );
-      if( mrbc_string_size(&v1) != 0 ) break;
+//================================================================
+/*! (method) split
 
-      mrbc_array_remove(&ret, idx);
-      mrbc_string_delete( &v1 );
+  The pieces are counted first, so that the result array is allocated
+  at once.
+*/
+static void c_string_split(struct VM *vm, mrbc_value v[], int argc)
+{
+  mrbc_value ret;
+  if( mrbc_string_size(&v[0]) == 0 ) {
+    ret = mrbc_array_new(vm, 0);
+    goto DONE;
+  }
+
+  // check limit parameter.
+  int limit = 0;
+  if( argc >= 2 ) {
+    if( mrbc_type(v[2]) != MRBC_TT_INTEGER ) {
+      mrbc_raise( vm, MRBC_CLASS(ArgumentError), 0 );
+      return;
     }
+    limit = v[2].i;
+    if( limit == 1 ) {
+      ret = mrbc_array_new(vm, 1);
+      mrbc_array_push( &ret, &v[0] );
+      mrbc_incref( &v[0] );
+      goto DONE;
+    }
+  }
+
+  // check separator parameter.
+  mrbc_value sep = (argc == 0) ? mrbc_string_new_cstr(vm, " ") : v[1];
+  switch( mrbc_type(sep) ) {
+  case MRBC_TT_NIL:
+    sep = mrbc_string_new_cstr(vm, " ");
+    break;
+
+  case MRBC_TT_STRING:
+    break;
+
+  default:
+    mrbc_raise( vm, MRBC_CLASS(TypeError), 0 );
+    return;
   }
 
+  int n = string_split_scan( vm, &v[0], &sep, limit, NULL, 0 );
+  ret = mrbc_array_new(vm, n);
+  if( n > 0 ) string_split_scan( vm, &v[0], &sep, limit, &ret, n );
+
   if( argc == 0 || mrbc_type(v[1]) == MRBC_TT_NIL ) {
     mrbc_string_delete(&sep);
   }
@@ -1183,6 +1621,11 @@ static int tr_main( struct VM *vm, mrbc_value v[], int argc )
     return -1;
   }
 
+  if( mrbc_string_modify( &v[0] ) != 0 ) {
+    mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+    return -1;
+  }
+
   struct tr_pattern *pat = tr_parse_pattern( vm, &v[1], 1 );
   if( pat == NULL ) return 0;
 
@@ -1296,6 +1739,138 @@ static void c_string_include(struct VM *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! parse a directive of pack/unpack format.
+
+  Supports C c S s L l n N v V e g, followed by a count or '*'.
+  S s L l are native endian. Whitespace is ignored.
+
+  @param  fmt	pointer to the format pointer. advanced to the next one.
+  @param  pd	pointer to result.
+  @retval 0	parsed.
+  @retval 1	end of format.
+  @retval -1	unknown directive.
+*/
+int mrbc_pack_parse(const char **fmt, mrbc_pack_directive *pd)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  static const int NATIVE_BIG = 1;
+#else
+  static const int NATIVE_BIG = 0;
+#endif
+  const char *p = *fmt;
+
+  while( *p == ' ' || *p == '\t' || *p == '\n' ) p++;
+  if( *p == '\0' ) return 1;
+
+  pd->flag_signed = 0;
+  pd->flag_big = NATIVE_BIG;
+  pd->flag_float = 0;
+
+  switch( *p++ ) {
+  case 'c': pd->flag_signed = 1;	// fall through
+  case 'C': pd->size = 1;		break;
+  case 's': pd->flag_signed = 1;	// fall through
+  case 'S': pd->size = 2;		break;
+  case 'l': pd->flag_signed = 1;	// fall through
+  case 'L': pd->size = 4;		break;
+  case 'n': pd->size = 2; pd->flag_big = 1; break;
+  case 'N': pd->size = 4; pd->flag_big = 1; break;
+  case 'v': pd->size = 2; pd->flag_big = 0; break;
+  case 'V': pd->size = 4; pd->flag_big = 0; break;
+#if MRBC_USE_FLOAT
+  case 'e': pd->size = 4; pd->flag_big = 0; pd->flag_float = 1; break;
+  case 'g': pd->size = 4; pd->flag_big = 1; pd->flag_float = 1; break;
+#endif
+  default:
+    return -1;
+  }
+
+  if( *p == '*' ) {
+    pd->count = -1;
+    p++;
+  } else if( '0' <= *p && *p <= '9' ) {
+    pd->count = 0;
+    while( '0' <= *p && *p <= '9' ) {
+      pd->count = pd->count * 10 + (*p++ - '0');
+    }
+  } else {
+    pd->count = 1;
+  }
+
+  *fmt = p;
+  return 0;
+}
+
+
+//================================================================
+/*! convert an unpacked item to the value.
+*/
+static mrbc_value unpack_item(struct VM *vm, uint32_t bits,
+			      const mrbc_pack_directive *pd)
+{
+#if MRBC_USE_FLOAT
+  if( pd->flag_float ) {
+    float f;
+    memcpy( &f, &bits, sizeof(f) );
+    return mrbc_float_value(vm, f);
+  }
+#endif
+  if( !pd->flag_signed ) return mrbc_integer_value(bits);
+
+  switch( pd->size ) {
+  case 1:  return mrbc_integer_value((int8_t)bits);
+  case 2:  return mrbc_integer_value((int16_t)bits);
+  default: return mrbc_integer_value((int32_t)bits);
+  }
+}
+
+
+//================================================================
+/*! (method) unpack
+
+  "\x01\x02\x03\x04".unpack("vn") -> [513, 772]
+*/
+static void c_string_unpack(struct VM *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || mrbc_type(v[1]) != MRBC_TT_STRING ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  const char *fmt = mrbc_string_cstr(&v[1]);
+  const uint8_t *p = v[0].string->data;
+  int remain = mrbc_string_size(&v[0]);
+  mrbc_value ret = mrbc_array_new(vm, 0);
+  mrbc_pack_directive pd;
+  int res;
+
+  while( (res = mrbc_pack_parse(&fmt, &pd)) == 0 ) {
+    int n = (pd.count < 0) ? remain / pd.size : pd.count;
+
+    for( ; n > 0; n-- ) {
+      mrbc_value val = mrbc_nil_value();
+
+      if( remain >= pd.size ) {
+	val = unpack_item( vm, mrbc_pack_get_bits( p, &pd ), &pd );
+	p += pd.size;
+	remain -= pd.size;
+      }
+
+      if( mrbc_array_push( &ret, &val ) != 0 ) break;	// ENOMEM
+    }
+  }
+
+  if( res < 0 ) {
+    mrbc_decref( &ret );
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), "unknown unpack directive.");
+    return;
+  }
+
+  SET_RETURN(ret);
+}
+
+
 //================================================================
 /*! (method) bytes
 */
@@ -1403,6 +1978,7 @@ static void c_string_downcase_self(struct VM *vm, mrbc_value v[], int argc)
   METHOD( "upcase!",	c_string_upcase_self )
   METHOD( "downcase",	c_string_downcase )
   METHOD( "downcase!",	c_string_downcase_self )
+  METHOD( "unpack",	c_string_unpack )
 
 #if MRBC_USE_FLOAT
   METHOD( "to_f",	c_string_to_f )
@@ -33,6 +33,16 @@ extern "C" {
 #define MRBC_STRING_SIZE_T uint16_t
 #endif
 
+// strings up to this length are stored in the same block as the header.
+#if !defined(MRBC_STRING_INLINE_MAX)
+#define MRBC_STRING_INLINE_MAX 15
+#endif
+
+// number of buffers that substrings and duplicates can share with the source. (0 to 255)
+#if !defined(MRBC_STRING_SHARED_MAX)
+#define MRBC_STRING_SHARED_MAX 8
+#endif
+
 /***** Macros ***************************************************************/
 #define RSTRING_LEN(str)	mrbc_string_size(&str)
 #define RSTRING_PTR(str)	mrbc_string_cstr(&str)
@@ -48,25 +58,47 @@ typedef struct RString {
   MRBC_OBJECT_HEADER;
 
   MRBC_STRING_SIZE_T size;	//!< string length.
+  uint8_t flag_literal : 1;	//!< data is read only, such as a literal in bytecode.
+  uint8_t flag_inline : 1;	//!< data is stored just after this header.
+  uint8_t shared_idx;		//!< shared buffer number + 1, or 0. (with flag_literal)
   uint8_t *data;		//!< pointer to allocated buffer.
 
 } mrbc_string;
 
 
+//================================================================
+/*!@brief
+  A directive of Array#pack and String#unpack format.
+*/
+typedef struct RPackDirective {
+  uint8_t size;			//!< bytes of an item.
+  uint8_t flag_signed : 1;	//!< signed integer.
+  uint8_t flag_big : 1;		//!< big endian.
+  uint8_t flag_float : 1;	//!< single precision float.
+  int count;			//!< number of items, or -1 for '*'.
+} mrbc_pack_directive;
+
+
 /***** Global variables *****************************************************/
 /***** Function prototypes **************************************************/
 mrbc_value mrbc_string_new(struct VM *vm, const void *src, int len);
 mrbc_value mrbc_string_new_alloc(struct VM *vm, void *buf, int len);
+mrbc_value mrbc_string_new_literal(struct VM *vm, const void *src, int len);
+mrbc_value mrbc_string_new_symbol(struct VM *vm, mrbc_sym sym_id);
+int mrbc_string_modify(mrbc_value *str);
 void mrbc_string_delete(mrbc_value *str);
 void mrbc_string_clear(mrbc_value *str);
 void mrbc_string_clear_vm_id(mrbc_value *str);
 mrbc_value mrbc_string_dup(struct VM *vm, mrbc_value *s1);
+mrbc_value mrbc_string_substr(struct VM *vm, mrbc_value *src, int pos, int len);
+void mrbc_string_shared_release_vm(const struct VM *vm);
 mrbc_value mrbc_string_add(struct VM *vm, const mrbc_value *s1, const mrbc_value *s2);
 int mrbc_string_append(mrbc_value *s1, const mrbc_value *s2);
 int mrbc_string_append_cbuf(mrbc_value *s1, const void *s2, int len2);
 int mrbc_string_index(const mrbc_value *src, const mrbc_value *pattern, int offset);
 int mrbc_string_strip(mrbc_value *src, int mode);
 int mrbc_string_chomp(mrbc_value *src);
+int mrbc_pack_parse(const char **fmt, mrbc_pack_directive *pd);
 
 
 /***** Inline functions *****************************************************/
@@ -126,6 +158,37 @@ static inline int mrbc_string_append_cstr(mrbc_value *s1, const char *s2)
   return mrbc_string_append_cbuf( s1, s2, strlen(s2) );
 }
 
+//================================================================
+/*! read an item of pack directive.
+
+  @param  p	pointer to packed data.
+  @param  pd	pointer to directive.
+  @return	item bits.
+*/
+static inline uint32_t mrbc_pack_get_bits(const uint8_t *p, const mrbc_pack_directive *pd)
+{
+  uint32_t v = 0;
+  for( int i = 0; i < pd->size; i++ ) {
+    v = (v << 8) | p[ pd->flag_big ? i : pd->size - 1 - i ];
+  }
+  return v;
+}
+
+//================================================================
+/*! write an item of pack directive.
+
+  @param  p	pointer to output buffer.
+  @param  pd	pointer to directive.
+  @param  v	item bits.
+*/
+static inline void mrbc_pack_put_bits(uint8_t *p, const mrbc_pack_directive *pd, uint32_t v)
+{
+  for( int i = pd->size - 1; i >= 0; i-- ) {
+    p[ pd->flag_big ? i : pd->size - 1 - i ] = v;
+    v >>= 8;
+  }
+}
+
 #ifdef __cplusplus
 }
 #endif
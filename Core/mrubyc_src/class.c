@@ -39,9 +39,40 @@
 /***** Constant values ******************************************************/
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
+#if defined(MRBC_USE_GLOBAL_METHOD_CACHE)
+/*!@brief
+  Global method cache entry.
+*/
+typedef struct GLOBAL_METHOD_CACHE {
+  mrbc_class *cls;		//!< search class.
+  uint32_t epoch;		//!< mrbc_method_cache_epoch at cached.
+  mrbc_method method;		//!< resolved method.
+} GLOBAL_METHOD_CACHE;
+#endif
+
+
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
+#if defined(MRBC_USE_GLOBAL_METHOD_CACHE)
+//! global method cache. (direct mapped by class and symbol)
+static GLOBAL_METHOD_CACHE global_method_cache[MRBC_GLOBAL_METHOD_CACHE_SIZE];
+#endif
+
+#if defined(MRBC_USE_OBJECT_POOL)
+//! all instance pools, and the eviction at the out of memory.
+static mrbc_instance_pool *instance_pools;
+static unsigned int instance_pool_evict( unsigned int size );
+static mrbc_alloc_cache instance_pool_cache_ =
+  MRBC_ALLOC_CACHE_INITIALIZER("object_pool", 20, instance_pool_evict);
+#endif
+
+
 /***** Global variables *****************************************************/
+#if defined(MRBC_USE_METHOD_CACHE) || defined(MRBC_USE_GLOBAL_METHOD_CACHE)
+//! method cache generation. see mrbc_method_cache_invalidate()
+uint32_t mrbc_method_cache_epoch;
+#endif
+
 /*! Builtin class table.
 
   @note must be same order as mrbc_vtype.
@@ -55,19 +86,344 @@ mrbc_class * const mrbc_class_tbl[MRBC_TT_MAXVAL+1] = {
   MRBC_CLASS(Integer),		// MRBC_TT_INTEGER   = 4,
   MRBC_CLASS(Float),		// MRBC_TT_FLOAT     = 5,
   MRBC_CLASS(Symbol),		// MRBC_TT_SYMBOL    = 6,
-  0,				// MRBC_TT_CLASS     = 7,
-  0,				// MRBC_TT_OBJECT    = 8,
-  MRBC_CLASS(Proc),		// MRBC_TT_PROC	     = 9,
-  MRBC_CLASS(Array),		// MRBC_TT_ARRAY     = 10,
-  MRBC_CLASS(String),		// MRBC_TT_STRING    = 11,
-  MRBC_CLASS(Range),		// MRBC_TT_RANGE     = 12,
-  MRBC_CLASS(Hash),		// MRBC_TT_HASH	     = 13,
-  0,				// MRBC_TT_EXCEPTION = 14,
+#if defined(MRBC_USE_FIXED)
+  0,				// MRBC_TT_FIXED
+#endif
+  MRBC_CLASS(Integer),		// MRBC_TT_WIDE_INT
+  0,				// MRBC_TT_CLASS
+  0,				// MRBC_TT_OBJECT
+  MRBC_CLASS(Proc),		// MRBC_TT_PROC
+  MRBC_CLASS(Array),		// MRBC_TT_ARRAY
+  MRBC_CLASS(String),		// MRBC_TT_STRING
+  MRBC_CLASS(Range),		// MRBC_TT_RANGE
+  MRBC_CLASS(Hash),		// MRBC_TT_HASH
+  0,				// MRBC_TT_EXCEPTION
 };
 
 
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
+#if defined(MRBC_USE_IVAR_SHAPE)
+//================================================================
+/*! get the slot index of instance variable.
+
+  The index cached by the call site is checked first, so that the
+  shape is searched only at the first access or when the class differs.
+
+  @param  cls		pointer to class.
+  @param  sym_id	instance variable's symbol ID.
+  @param  cache		pointer to cached slot index, or NULL.
+  @return		slot index or -1 if not found.
+*/
+static int ivar_shape_index(const mrbc_class *cls, mrbc_sym sym_id, uint8_t *cache)
+{
+  if( cache && *cache < cls->n_ivar && cls->ivar_shape[*cache] == sym_id ) {
+    return *cache;
+  }
+
+  for( int i = 0; i < cls->n_ivar; i++ ) {
+    if( cls->ivar_shape[i] != sym_id ) continue;
+    if( cache ) *cache = i;
+    return i;
+  }
+  return -1;
+}
+
+
+//================================================================
+/*! add instance variable to the class shape.
+
+  @param  cls		pointer to class.
+  @param  sym_id	instance variable's symbol ID.
+  @return		slot index or -1 if error.
+*/
+static int ivar_shape_append(mrbc_class *cls, mrbc_sym sym_id)
+{
+  if( cls->n_ivar == UINT8_MAX ) return -1;
+
+  mrbc_sym *shape;
+  if( cls->ivar_shape ) {
+    shape = mrbc_raw_realloc( cls->ivar_shape,
+			      sizeof(mrbc_sym) * (cls->n_ivar + 1) );
+  } else {
+    shape = mrbc_raw_alloc( sizeof(mrbc_sym) );
+  }
+  if( !shape ) return -1;	// ENOMEM
+
+  shape[cls->n_ivar] = sym_id;
+  cls->ivar_shape = shape;
+
+  return cls->n_ivar++;
+}
+
+
+//================================================================
+/*! resize instance variable slots to the class shape size.
+
+  @param  inst		pointer to instance.
+  @return		0 if no error.
+*/
+static int ivar_slots_resize(mrbc_instance *inst)
+{
+  int n = inst->cls->n_ivar;
+  mrbc_value *slots;
+
+  if( inst->ivar ) {
+    slots = mrbc_raw_realloc( inst->ivar, sizeof(mrbc_value) * n );
+  } else {
+    slots = mrbc_raw_alloc( sizeof(mrbc_value) * n );
+    if( slots ) mrbc_set_vm_id( slots, mrbc_get_vm_id(inst) );
+  }
+  if( !slots ) return -1;	// ENOMEM
+
+  memset( slots + inst->n_ivar, 0, sizeof(mrbc_value) * (n - inst->n_ivar) );
+  inst->ivar = slots;
+  inst->n_ivar = n;
+
+  return 0;
+}
+#endif
+
+
+#if defined(MRBC_USE_OBJECT_POOL)
+//================================================================
+/*! free the instance and its storage of instance variables.
+
+  @param  inst		pointer to instance, that has no values.
+*/
+static void instance_free(mrbc_instance *inst)
+{
+#if defined(MRBC_USE_IVAR_SHAPE)
+  if( inst->ivar ) mrbc_raw_free( inst->ivar );
+#else
+  mrbc_kv_delete_data( &inst->ivar );
+#endif
+  mrbc_raw_free( inst );
+}
+
+
+//================================================================
+/*! free all instances in the pool.
+
+  @param  pool		pointer to pool.
+  @return		released bytes. (approximate)
+*/
+static unsigned int instance_pool_drain(mrbc_instance_pool *pool)
+{
+  unsigned int released = 0;
+
+  while( pool->n_stored > 0 ) {
+    mrbc_instance *inst = pool->item[--pool->n_stored];
+#if defined(MRBC_USE_IVAR_SHAPE)
+    released += sizeof(mrbc_instance) + sizeof(mrbc_value) * inst->n_ivar;
+#else
+    released += sizeof(mrbc_instance) + sizeof(mrbc_kv) * inst->ivar.data_size;
+#endif
+    instance_free( inst );
+  }
+
+  return released;
+}
+
+
+//================================================================
+/*! free the pooled instances, at the out of memory.
+
+  @param  size	request size. (not used)
+  @return	released bytes.
+*/
+static unsigned int instance_pool_evict( unsigned int size )
+{
+  unsigned int released = 0;
+
+  for( mrbc_instance_pool *pool = instance_pools; pool; pool = pool->next ) {
+    released += instance_pool_drain( pool );
+  }
+  return released;
+}
+
+
+//================================================================
+/*! take an instance from the pool.
+
+  @param  vm		pointer to VM.
+  @param  pool		pointer to pool, that is not empty.
+  @return		pointer to instance.
+*/
+static mrbc_instance * instance_pool_take(struct VM *vm, mrbc_instance_pool *pool)
+{
+  mrbc_instance *inst = pool->item[--pool->n_stored];
+
+#if defined(MRBC_ALLOC_VMID)
+  int vm_id = vm ? vm->vm_id : 0;
+  mrbc_set_vm_id( inst, vm_id );
+#if defined(MRBC_USE_IVAR_SHAPE)
+  if( inst->ivar ) mrbc_set_vm_id( inst->ivar, vm_id );
+#else
+  if( inst->ivar.data_size ) mrbc_set_vm_id( inst->ivar.data, vm_id );
+#endif
+#endif
+#if !defined(MRBC_USE_IVAR_SHAPE)
+  if( inst->ivar.data_size == 0 ) inst->ivar.vm = vm;
+#endif
+
+  MRBC_INIT_OBJECT_HEADER( inst, "IN" );
+  return inst;
+}
+
+
+//================================================================
+/*! put the released instance to the pool of the class.
+
+  The instance variables are released, and the storage is kept.
+
+  @param  inst		pointer to instance.
+  @return		non zero if the instance is pooled or freed.
+*/
+static int instance_pool_put(mrbc_instance *inst)
+{
+  mrbc_instance_pool *pool = inst->cls->pool;
+  if( !pool || pool->n_stored >= pool->size ) return 0;
+
+#if defined(MRBC_USE_IVAR_SHAPE)
+  for( int i = 0; i < inst->n_ivar; i++ ) {
+    mrbc_decref( &inst->ivar[i] );
+  }
+  memset( inst->ivar, 0, sizeof(mrbc_value) * inst->n_ivar );
+#else
+  mrbc_kv_clear( &inst->ivar );
+#endif
+
+  // the instances released above may fill the pool.
+  if( pool->n_stored >= pool->size ) {
+    instance_free( inst );
+    return 1;
+  }
+
+  // the pooled instances are not owned by any VM.
+  mrbc_set_vm_id( inst, 0 );
+#if defined(MRBC_USE_IVAR_SHAPE)
+  if( inst->ivar ) mrbc_set_vm_id( inst->ivar, 0 );
+#else
+  if( inst->ivar.data_size ) mrbc_set_vm_id( inst->ivar.data, 0 );
+#endif
+
+  pool->item[pool->n_stored++] = inst;
+  return 1;
+}
+#endif
+
+
+#if defined(MRBC_USE_METHOD_INDEX)
+//================================================================
+/*! build the method index of the class.
+
+  The method link has the newer one first, and it may have the same
+  symbol twice by mrbc_define_method(), so the first one is kept.
+
+  @param  cls		pointer to class.
+*/
+static void method_index_build(mrbc_class *cls)
+{
+  int n = 0;
+  mrbc_method *method;
+
+  cls->n_method_index = -1;
+  for( method = cls->method_link; method != 0; method = method->next ) n++;
+  if( n < MRBC_METHOD_INDEX_MIN || n > INT16_MAX ) return;
+
+  mrbc_method **index = mrbc_raw_alloc( sizeof(mrbc_method *) * n );
+  if( !index ) return;		// ENOMEM, search the link.
+
+  // stable insertion sort by sym_id.
+  n = 0;
+  for( method = cls->method_link; method != 0; method = method->next ) {
+    int i;
+    for( i = n; i > 0 && index[i-1]->sym_id > method->sym_id; i-- ) {
+      index[i] = index[i-1];
+    }
+    if( i > 0 && index[i-1]->sym_id == method->sym_id ) {
+      memmove( &index[i], &index[i+1], sizeof(mrbc_method *) * (n - i) );
+      continue;			// older one.
+    }
+    index[i] = method;
+    n++;
+  }
+
+  cls->method_index = index;
+  cls->n_method_index = n;
+}
+#endif
+
+
+//================================================================
+/*! find method in the method link of the class. (not in super class)
+
+  @param  cls		pointer to class.
+  @param  sym_id	symbol id.
+  @return		pointer to method or NULL.
+*/
+MRBC_HOT_FUNC
+static mrbc_method * find_method_link(mrbc_class *cls, mrbc_sym sym_id)
+{
+#if defined(MRBC_USE_METHOD_INDEX)
+  if( cls->n_method_index == 0 && cls->method_link ) method_index_build( cls );
+
+  if( cls->n_method_index > 0 ) {
+    mrbc_method **index = cls->method_index;
+    int left = 0;
+    int right = cls->n_method_index - 1;
+
+    while( left < right ) {
+      int mid = (left + right) / 2;
+      if( index[mid]->sym_id < sym_id ) {
+	left = mid + 1;
+      } else {
+	right = mid;
+      }
+    }
+    return (index[right]->sym_id == sym_id) ? index[right] : 0;
+  }
+#endif
+
+  mrbc_method *method;
+  for( method = cls->method_link; method != 0; method = method->next ) {
+    if( method->sym_id == sym_id ) return method;
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! define C function method.
+
+  @param  vm		pointer to vm.
+  @param  cls		pointer to class.
+  @param  name		method name.
+  @param  cfunc		pointer to function.
+  @param  c_func	kind of C function. (see mrbc_method)
+*/
+static void define_c_method(struct VM *vm, mrbc_class *cls, const char *name, mrbc_func_t cfunc, int c_func)
+{
+  if( cls == NULL ) cls = mrbc_class_object;	// set default to Object.
+
+  mrbc_method *method = mrbc_raw_alloc_no_free( sizeof(mrbc_method) );
+  if( !method ) return; // ENOMEM
+
+  method->type = 'm';
+  method->c_func = c_func;
+  method->sym_id = mrbc_str_to_symid( name );
+  if( method->sym_id < 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(Exception), "Overflow MAX_SYMBOLS_COUNT");
+  }
+  method->func = cfunc;
+  method->next = cls->method_link;
+  cls->method_link = method;
+
+  mrbc_method_changed( cls );
+}
+
+
 /***** Global functions *****************************************************/
 //================================================================
 /*! define class
@@ -102,6 +458,17 @@ mrbc_class * mrbc_define_class(struct VM *vm, const char *name, mrbc_class *supe
   cls->num_builtin_method = 0;
   cls->super = super ? super : mrbc_class_object;
   cls->method_link = 0;
+#if defined(MRBC_USE_METHOD_INDEX)
+  cls->n_method_index = 0;
+  cls->method_index = 0;
+#endif
+#if defined(MRBC_USE_IVAR_SHAPE)
+  cls->n_ivar = 0;
+  cls->ivar_shape = 0;
+#endif
+#if defined(MRBC_USE_OBJECT_POOL)
+  cls->pool = 0;
+#endif
 #if defined(MRBC_DEBUG)
   cls->name = name;
 #endif
@@ -148,6 +515,17 @@ mrbc_class * mrbc_define_class_under(struct VM *vm, const mrbc_class *outer, con
   cls->num_builtin_method = 0;
   cls->super = super ? super : mrbc_class_object;
   cls->method_link = 0;
+#if defined(MRBC_USE_METHOD_INDEX)
+  cls->n_method_index = 0;
+  cls->method_index = 0;
+#endif
+#if defined(MRBC_USE_IVAR_SHAPE)
+  cls->n_ivar = 0;
+  cls->ivar_shape = 0;
+#endif
+#if defined(MRBC_USE_OBJECT_POOL)
+  cls->pool = 0;
+#endif
 #if defined(MRBC_DEBUG)
   cls->name = name;
 #endif
@@ -169,20 +547,26 @@ mrbc_class * mrbc_define_class_under(struct VM *vm, const mrbc_class *outer, con
 */
 void mrbc_define_method(struct VM *vm, mrbc_class *cls, const char *name, mrbc_func_t cfunc)
 {
-  if( cls == NULL ) cls = mrbc_class_object;	// set default to Object.
+  define_c_method(vm, cls, name, cfunc, 1);
+}
 
-  mrbc_method *method = mrbc_raw_alloc_no_free( sizeof(mrbc_method) );
-  if( !method ) return; // ENOMEM
 
-  method->type = 'm';
-  method->c_func = 1;
-  method->sym_id = mrbc_str_to_symid( name );
-  if( method->sym_id < 0 ) {
-    mrbc_raise(vm, MRBC_CLASS(Exception), "Overflow MAX_SYMBOLS_COUNT");
-  }
-  method->func = cfunc;
-  method->next = cls->method_link;
-  cls->method_link = method;
+//================================================================
+/*! define method that takes the keyword arguments in the registers.
+
+  The keyword arguments are passed by a Hash that is not allocated,
+  and refers to the registers of the caller. So the function can read
+  them by MRBC_KW_ARG() macro as well, but must not keep the Hash
+  (e.g. MRBC_KW_DICT) nor push a frame.
+
+  @param  vm		pointer to vm.
+  @param  cls		pointer to class.
+  @param  name		method name.
+  @param  cfunc		pointer to function.
+*/
+void mrbc_define_method_kw(struct VM *vm, mrbc_class *cls, const char *name, mrbc_func_t cfunc)
+{
+  define_c_method(vm, cls, name, cfunc, 3);
 }
 
 
@@ -197,14 +581,34 @@ void mrbc_define_method(struct VM *vm, mrbc_class *cls, const char *name, mrbc_f
 mrbc_value mrbc_instance_new(struct VM *vm, mrbc_class *cls, int size)
 {
   mrbc_value v = {.tt = MRBC_TT_OBJECT};
+
+#if defined(MRBC_USE_OBJECT_POOL)
+  if( size == 0 && cls->pool && cls->pool->n_stored ) {
+    v.instance = instance_pool_take( vm, cls->pool );
+    return v;
+  }
+#endif
+
   v.instance = mrbc_alloc(vm, sizeof(mrbc_instance) + size);
   if( v.instance == NULL ) return v;	// ENOMEM
 
+#if defined(MRBC_USE_IVAR_SHAPE)
+  // allocate slots as many as learned from the preceding instances.
+  v.instance->cls = cls;
+  v.instance->n_ivar = 0;
+  v.instance->ivar = 0;
+  if( cls->n_ivar && ivar_slots_resize( v.instance ) != 0 ) {
+    mrbc_raw_free(v.instance);
+    v.instance = NULL;
+    return v;
+  }
+#else
   if( mrbc_kv_init_handle(vm, &v.instance->ivar, 0) != 0 ) {
     mrbc_raw_free(v.instance);
     v.instance = NULL;
     return v;
   }
+#endif
 
   MRBC_INIT_OBJECT_HEADER( v.instance, "IN" );
   v.instance->cls = cls;
@@ -220,7 +624,18 @@ mrbc_value mrbc_instance_new(struct VM *vm, mrbc_class *cls, int size)
 */
 void mrbc_instance_delete(mrbc_value *v)
 {
+#if defined(MRBC_USE_OBJECT_POOL)
+  if( instance_pool_put( v->instance ) ) return;
+#endif
+
+#if defined(MRBC_USE_IVAR_SHAPE)
+  for( int i = 0; i < v->instance->n_ivar; i++ ) {
+    mrbc_decref( &v->instance->ivar[i] );
+  }
+  if( v->instance->ivar ) mrbc_raw_free( v->instance->ivar );
+#else
   mrbc_kv_delete_data( &v->instance->ivar );
+#endif
   mrbc_raw_free( v->instance );
 }
 
@@ -234,8 +649,40 @@ void mrbc_instance_delete(mrbc_value *v)
 */
 void mrbc_instance_setiv(mrbc_value *obj, mrbc_sym sym_id, mrbc_value *v)
 {
+  mrbc_instance_setiv_cached( obj, sym_id, v, 0 );
+}
+
+
+//================================================================
+/*! instance variable setter, with the slot index cache of the call site.
+
+  @param  obj		pointer to target.
+  @param  sym_id	key symbol ID.
+  @param  v		pointer to value.
+  @param  cache		pointer to cached slot index, or NULL.
+			(used only in MRBC_USE_IVAR_SHAPE)
+*/
+void mrbc_instance_setiv_cached(mrbc_value *obj, mrbc_sym sym_id, mrbc_value *v, uint8_t *cache)
+{
+#if defined(MRBC_USE_IVAR_SHAPE)
+  mrbc_instance *inst = obj->instance;
+  int idx = ivar_shape_index( inst->cls, sym_id, cache );
+  if( idx < 0 ) {
+    idx = ivar_shape_append( inst->cls, sym_id );
+    if( idx < 0 ) return;	// ENOMEM
+    if( cache ) *cache = idx;
+  }
+  if( idx >= inst->n_ivar ) {
+    if( ivar_slots_resize( inst ) != 0 ) return;	// ENOMEM
+  }
+
+  mrbc_incref(v);
+  mrbc_decref( &inst->ivar[idx] );
+  inst->ivar[idx] = *v;
+#else
   mrbc_incref(v);
   mrbc_kv_set( &obj->instance->ivar, sym_id, v );
+#endif
 }
 
 
@@ -248,8 +695,31 @@ void mrbc_instance_setiv(mrbc_value *obj, mrbc_sym sym_id, mrbc_value *v)
 */
 mrbc_value mrbc_instance_getiv(mrbc_value *obj, mrbc_sym sym_id)
 {
+  return mrbc_instance_getiv_cached( obj, sym_id, 0 );
+}
+
+
+//================================================================
+/*! instance variable getter, with the slot index cache of the call site.
+
+  @param  obj		pointer to target.
+  @param  sym_id	key symbol ID.
+  @param  cache		pointer to cached slot index, or NULL.
+			(used only in MRBC_USE_IVAR_SHAPE)
+  @return		value.
+*/
+mrbc_value mrbc_instance_getiv_cached(mrbc_value *obj, mrbc_sym sym_id, uint8_t *cache)
+{
+#if defined(MRBC_USE_IVAR_SHAPE)
+  int idx = ivar_shape_index( obj->instance->cls, sym_id, cache );
+  if( idx < 0 || idx >= obj->instance->n_ivar ) return mrbc_nil_value();
+
+  mrbc_value *v = &obj->instance->ivar[idx];
+  if( v->tt == MRBC_TT_EMPTY ) return mrbc_nil_value();
+#else
   mrbc_value *v = mrbc_kv_get( &obj->instance->ivar, sym_id );
   if( !v ) return mrbc_nil_value();
+#endif
 
   mrbc_incref(v);
   return *v;
@@ -265,7 +735,14 @@ mrbc_value mrbc_instance_getiv(mrbc_value *obj, mrbc_sym sym_id)
 void mrbc_instance_clear_vm_id(mrbc_value *v)
 {
   mrbc_set_vm_id( v->instance, 0 );
+#if defined(MRBC_USE_IVAR_SHAPE)
+  if( v->instance->ivar ) mrbc_set_vm_id( v->instance->ivar, 0 );
+  for( int i = 0; i < v->instance->n_ivar; i++ ) {
+    mrbc_clear_vm_id( &v->instance->ivar[i] );
+  }
+#else
   mrbc_kv_clear_vm_id( &v->instance->ivar );
+#endif
 }
 #endif
 
@@ -280,21 +757,30 @@ void mrbc_instance_clear_vm_id(mrbc_value *v)
 mrbc_value mrbc_proc_new(struct VM *vm, void *irep)
 {
   mrbc_value val = {.tt = MRBC_TT_PROC};
+  mrbc_proc *outer = 0;
+  int n = 1;
+
+  if( mrbc_type(vm->cur_regs[0]) == MRBC_TT_PROC ) {
+    outer = vm->cur_regs[0].proc;
+    if( outer->n_upvar_regs < UINT8_MAX ) n += outer->n_upvar_regs;
+  }
 
-  val.proc = mrbc_alloc(vm, sizeof(mrbc_proc));
+  val.proc = mrbc_alloc(vm, sizeof(mrbc_proc) + sizeof(mrbc_value *) * n);
   if( !val.proc ) return val;	// ENOMEM
 
   MRBC_INIT_OBJECT_HEADER( val.proc, "PR" );
   val.proc->callinfo = vm->callinfo_tail;
+  val.proc->callinfo_self = outer ? outer->callinfo_self : vm->callinfo_tail;
+  val.proc->irep = irep;
 
-  if( mrbc_type(vm->cur_regs[0]) == MRBC_TT_PROC ) {
-    val.proc->callinfo_self = vm->cur_regs[0].proc->callinfo_self;
-  } else {
-    val.proc->callinfo_self = vm->callinfo_tail;
+  // register windows of the outer frames don't move while the block runs.
+  // keep them flat for OP_GETUPVAR and OP_SETUPVAR.
+  val.proc->n_upvar_regs = n;
+  val.proc->upvar_regs[0] = vm->cur_regs;
+  for( int i = 1; i < n; i++ ) {
+    val.proc->upvar_regs[i] = outer->upvar_regs[i-1];
   }
 
-  val.proc->irep = irep;
-
   return val;
 }
 
@@ -343,6 +829,66 @@ int mrbc_obj_is_kind_of( const mrbc_value *obj, const mrbc_class *cls )
 }
 
 
+#if defined(MRBC_USE_METHOD_INDEX)
+//================================================================
+/*! clear the method index, to build again at the next lookup.
+
+  @param  cls		pointer to class.
+*/
+void mrbc_method_index_clear(mrbc_class *cls)
+{
+  if( cls->n_method_index > 0 ) mrbc_raw_free( cls->method_index );
+  cls->n_method_index = 0;
+  cls->method_index = 0;
+}
+#endif
+
+
+#if defined(MRBC_USE_OBJECT_POOL)
+//================================================================
+/*! set the size of the instance pool of the class.
+
+  The released instances of the class (not subclasses) are kept up to
+  the size, and reused by mrbc_instance_new() without allocation.
+
+  @param  cls		pointer to class.
+  @param  size		max number of instances, or 0 to stop pooling.
+  @return		0 if no error.
+*/
+int mrbc_instance_pool_set(mrbc_class *cls, int size)
+{
+  if( size < 0 || size > UINT8_MAX ) return -1;
+
+  mrbc_instance_pool *pool = cls->pool;
+  if( pool ) {
+    if( pool->size == size ) return 0;
+
+    // unlink and free the pool.
+    instance_pool_drain( pool );
+    mrbc_instance_pool **pp = &instance_pools;
+    while( *pp != pool ) pp = &(*pp)->next;
+    *pp = pool->next;
+    cls->pool = 0;
+    mrbc_raw_free( pool );
+  }
+  if( size == 0 ) return 0;
+
+  pool = mrbc_raw_alloc( sizeof(mrbc_instance_pool) + sizeof(mrbc_instance *) * size );
+  if( !pool ) return -1;	// ENOMEM
+
+  pool->cls = cls;
+  pool->size = size;
+  pool->n_stored = 0;
+  pool->next = instance_pools;
+  instance_pools = pool;
+  cls->pool = pool;
+  mrbc_alloc_register_cache( &instance_pool_cache_ );
+
+  return 0;
+}
+#endif
+
+
 //================================================================
 /*! find method
 
@@ -351,16 +897,20 @@ int mrbc_obj_is_kind_of( const mrbc_value *obj, const mrbc_class *cls )
   @param  sym_id	symbol id.
   @return		pointer to method or NULL.
 */
+#if defined(MRBC_USE_GLOBAL_METHOD_CACHE)
+MRBC_HOT_FUNC
+static mrbc_method * find_method_uncached( mrbc_method *r_method, mrbc_class *cls, mrbc_sym sym_id )
+#else
+MRBC_HOT_FUNC
 mrbc_method * mrbc_find_method( mrbc_method *r_method, mrbc_class *cls, mrbc_sym sym_id )
+#endif
 {
   do {
-    mrbc_method *method;
-    for( method = cls->method_link; method != 0; method = method->next ) {
-      if( method->sym_id == sym_id ) {
-	*r_method = *method;
-	r_method->cls = cls;
-	return r_method;
-      }
+    mrbc_method *method = find_method_link( cls, sym_id );
+    if( method ) {
+      *r_method = *method;
+      r_method->cls = cls;
+      return r_method;
     }
 
     struct RBuiltinClass *c = (struct RBuiltinClass *)cls;
@@ -377,7 +927,7 @@ mrbc_method * mrbc_find_method( mrbc_method *r_method, mrbc_class *cls, mrbc_sym
       }
     }
 
-    if( c->method_symbols[right] == sym_id ) {
+    if( right < c->num_builtin_method && c->method_symbols[right] == sym_id ) {
       *r_method = (mrbc_method){
 	.type = 'm',
 	.c_func = 2,
@@ -395,6 +945,41 @@ mrbc_method * mrbc_find_method( mrbc_method *r_method, mrbc_class *cls, mrbc_sym
 }
 
 
+#if defined(MRBC_USE_GLOBAL_METHOD_CACHE)
+//================================================================
+/*! find method with the global method cache.
+
+  Only the found method is cached.
+
+  @param  r_method	pointer to mrbc_method to return values.
+  @param  cls		search class.
+  @param  sym_id	symbol id.
+  @return		pointer to method or NULL.
+*/
+MRBC_HOT_FUNC
+mrbc_method * mrbc_find_method( mrbc_method *r_method, mrbc_class *cls, mrbc_sym sym_id )
+{
+  GLOBAL_METHOD_CACHE *cache = &global_method_cache[
+    (((uintptr_t)cls >> 2) ^ ((unsigned)sym_id * 7)) &
+    (MRBC_GLOBAL_METHOD_CACHE_SIZE - 1) ];
+
+  if( cache->cls == cls && cache->method.sym_id == sym_id &&
+      cache->epoch == mrbc_method_cache_epoch ) {
+    *r_method = cache->method;
+    return r_method;
+  }
+
+  if( find_method_uncached( r_method, cls, sym_id ) == 0 ) return 0;
+
+  cache->cls = cls;
+  cache->epoch = mrbc_method_cache_epoch;
+  cache->method = *r_method;
+
+  return r_method;
+}
+#endif
+
+
 //================================================================
 /*! get class by name
 
@@ -451,6 +1036,7 @@ mrbc_value mrbc_send( struct VM *vm, mrbc_value *v, int reg_ofs,
 
   // create call stack.
   mrbc_value *regs = v + reg_ofs + 2;
+  if( mrbc_check_regs( vm, regs, argc + 2 ) != 0 ) goto ERROR;
   mrbc_decref( &regs[0] );
   regs[0] = *recv;
   mrbc_incref(recv);
@@ -531,6 +1117,13 @@ void mrbc_init_class(void)
 {
   extern const uint8_t mrblib_bytecode[];
   void mrbc_init_class_math(void);
+#if defined(MRBC_USE_FIXED)
+  void mrbc_init_class_fixed(void);
+#endif
+  void mrbc_init_iterator_integer(void);
+  void mrbc_init_iterator_array(void);
+  void mrbc_init_iterator_range(void);
+  void mrbc_init_iterator_hash(void);
   mrbc_value cls = {.tt = MRBC_TT_CLASS};
 
   cls.cls = MRBC_CLASS(Object);
@@ -573,6 +1166,10 @@ void mrbc_init_class(void)
   cls.cls = MRBC_CLASS(Hash);
   mrbc_set_const( MRBC_SYM(Hash), &cls );
 
+#if defined(MRBC_USE_FIXED)
+  mrbc_init_class_fixed();
+#endif
+
 #if MRBC_USE_MATH
   cls.cls = MRBC_CLASS(Math);
   mrbc_set_const( MRBC_SYM(Math), &cls );
@@ -585,6 +1182,9 @@ void mrbc_init_class(void)
   cls.cls = MRBC_CLASS(NoMemoryError);
   mrbc_set_const( MRBC_SYM(NoMemoryError), &cls );
 
+  cls.cls = MRBC_CLASS(SystemStackError);
+  mrbc_set_const( MRBC_SYM(SystemStackError), &cls );
+
   cls.cls = MRBC_CLASS(StandardError);
   mrbc_set_const( MRBC_SYM(StandardError), &cls );
 
@@ -613,4 +1213,10 @@ void mrbc_init_class(void)
   mrbc_set_const( MRBC_SYM(ZeroDivisionError), &cls );
 
   mrbc_run_mrblib(mrblib_bytecode);
+
+  // replace the hot iterators in mrblib with C.
+  mrbc_init_iterator_integer();
+  mrbc_init_iterator_array();
+  mrbc_init_iterator_range();
+  mrbc_init_iterator_hash();
 }
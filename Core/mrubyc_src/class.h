@@ -45,6 +45,17 @@ typedef struct RClass {
   int16_t num_builtin_method;	//!< num of built-in method.
   struct RClass *super;		//!< pointer to super class.
   struct RMethod *method_link;	//!< pointer to method link.
+#if defined(MRBC_USE_METHOD_INDEX)
+  int16_t n_method_index;	//!< 0:not built, -1:not used, or num of entries.
+  struct RMethod **method_index; //!< method_link sorted by sym_id.
+#endif
+#if defined(MRBC_USE_IVAR_SHAPE)
+  uint8_t n_ivar;		//!< num of instance variables in ivar_shape.
+  mrbc_sym *ivar_shape;		//!< instance variable's sym_id by slot index.
+#endif
+#if defined(MRBC_USE_OBJECT_POOL)
+  struct RInstancePool *pool;	//!< released instances kept for reuse.
+#endif
 #if defined(MRBC_DEBUG)
   const char *name;
 #endif
@@ -62,6 +73,17 @@ struct RBuiltinClass {
   int16_t num_builtin_method;	//!< num of built-in method.
   struct RClass *super;		//!< pointer to super class.
   struct RMethod *method_link;	//!< pointer to method link.
+#if defined(MRBC_USE_METHOD_INDEX)
+  int16_t n_method_index;	//!< 0:not built, -1:not used, or num of entries.
+  struct RMethod **method_index; //!< method_link sorted by sym_id.
+#endif
+#if defined(MRBC_USE_IVAR_SHAPE)
+  uint8_t n_ivar;		//!< num of instance variables in ivar_shape.
+  mrbc_sym *ivar_shape;		//!< instance variable's sym_id by slot index.
+#endif
+#if defined(MRBC_USE_OBJECT_POOL)
+  struct RInstancePool *pool;	//!< released instances kept for reuse.
+#endif
 #if defined(MRBC_DEBUG)
   const char *name;
 #endif
@@ -81,13 +103,33 @@ typedef struct RInstance {
   MRBC_OBJECT_HEADER;
 
   struct RClass *cls;
+#if defined(MRBC_USE_IVAR_SHAPE)
+  uint8_t n_ivar;		//!< num of slots.
+  mrbc_value *ivar;		//!< instance variable slots. (see RClass::ivar_shape)
+#else
   struct RKeyValueHandle ivar;
+#endif
   uint8_t data[];
 
 } mrbc_instance;
 typedef struct RInstance mrb_instance;
 
 
+#if defined(MRBC_USE_OBJECT_POOL)
+//================================================================
+/*!@brief
+  Released instances of a class, kept for reuse. (see Object.pool)
+*/
+typedef struct RInstancePool {
+  struct RInstancePool *next;	//!< next pool, for the eviction.
+  struct RClass *cls;		//!< owner class.
+  uint8_t size;			//!< max number of instances.
+  uint8_t n_stored;		//!< num of stored.
+  struct RInstance *item[];
+} mrbc_instance_pool;
+#endif
+
+
 //================================================================
 /*!@brief
   Proc object.
@@ -101,6 +143,8 @@ typedef struct RProc {
   struct CALLINFO *callinfo_self;
   struct IREP *irep;
   mrbc_value ret_val;
+  uint8_t n_upvar_regs;		//!< number of upvar_regs.
+  mrbc_value *upvar_regs[];	//!< registers of outer frames. [0] is the creator.
 
 } mrbc_proc;
 typedef struct RProc mrb_proc;
@@ -112,7 +156,7 @@ typedef struct RProc mrb_proc;
 */
 typedef struct RMethod {
   uint8_t type;		//!< M:OP_DEF or OP_ALIAS, m:mrblib or define_method()
-  uint8_t c_func;	//!< 0:IREP, 1:C Func, 2:C Func (built-in)
+  uint8_t c_func;	//!< 0:IREP, 1:C Func, 2:C Func (built-in), 3:C Func (keyword args in registers)
   mrbc_sym sym_id;	//!< function names symbol ID
   union {
     struct IREP *irep;	//!< to IREP for ruby proc.
@@ -127,6 +171,9 @@ typedef struct RMethod {
 
 /***** Global variables *****************************************************/
 extern struct RClass * const mrbc_class_tbl[];
+#if defined(MRBC_USE_FIXED)
+extern struct RClass *mrbc_class_fixed;
+#endif
 extern struct RBuiltinClass mrbc_class_Object;
 extern struct RBuiltinClass mrbc_class_NilClass;
 extern struct RBuiltinClass mrbc_class_FalseClass;
@@ -143,6 +190,7 @@ extern struct RBuiltinClass mrbc_class_Math;
 extern struct RBuiltinClass mrbc_class_Exception;
 extern struct RClass mrbc_class_NoMemoryError;
 extern struct RClass mrbc_class_NotImplementedError;
+extern struct RClass mrbc_class_SystemStackError;
 extern struct RClass mrbc_class_StandardError;
 extern struct RClass mrbc_class_ArgumentError;
 extern struct RClass mrbc_class_IndexError;
@@ -156,15 +204,22 @@ extern struct RClass mrbc_class_ZeroDivisionError;
 // for old version compatibility.
 #define mrbc_class_object ((struct RClass*)(&mrbc_class_Object))
 
+#if defined(MRBC_USE_METHOD_CACHE) || defined(MRBC_USE_GLOBAL_METHOD_CACHE)
+extern uint32_t mrbc_method_cache_epoch;
+#endif
+
 
 /***** Function prototypes **************************************************/
 mrbc_class *mrbc_define_class(struct VM *vm, const char *name, mrbc_class *super);
 mrbc_class *mrbc_define_class_under(struct VM *vm, const mrbc_class *outer, const char *name, mrbc_class *super);
 void mrbc_define_method(struct VM *vm, mrbc_class *cls, const char *name, mrbc_func_t cfunc);
+void mrbc_define_method_kw(struct VM *vm, mrbc_class *cls, const char *name, mrbc_func_t cfunc);
 mrbc_value mrbc_instance_new(struct VM *vm, mrbc_class *cls, int size);
 void mrbc_instance_delete(mrbc_value *v);
 void mrbc_instance_setiv(mrbc_value *obj, mrbc_sym sym_id, mrbc_value *v);
 mrbc_value mrbc_instance_getiv(mrbc_value *obj, mrbc_sym sym_id);
+void mrbc_instance_setiv_cached(mrbc_value *obj, mrbc_sym sym_id, mrbc_value *v, uint8_t *cache);
+mrbc_value mrbc_instance_getiv_cached(mrbc_value *obj, mrbc_sym sym_id, uint8_t *cache);
 void mrbc_instance_clear_vm_id(mrbc_value *v);
 mrbc_value mrbc_proc_new(struct VM *vm, void *irep);
 void mrbc_proc_delete(mrbc_value *val);
@@ -174,6 +229,15 @@ mrbc_method *mrbc_find_method(mrbc_method *r_method, mrbc_class *cls, mrbc_sym s
 mrbc_class *mrbc_get_class_by_name(const char *name);
 mrbc_value mrbc_send(struct VM *vm, mrbc_value *v, int reg_ofs, mrbc_value *recv, const char *method_name, int argc, ...);
 void c_ineffect(struct VM *vm, mrbc_value v[], int argc);
+#if defined(MRBC_USE_METHOD_INDEX)
+void mrbc_method_index_clear(mrbc_class *cls);
+#endif
+#if defined(MRBC_USE_OBJECT_POOL)
+int mrbc_instance_pool_set(mrbc_class *cls, int size);
+#endif
+#if defined(MRBC_NUMERIC_FAST_SEND)
+void mrbc_numeric_method_changed(const struct RClass *cls);
+#endif
 int mrbc_run_mrblib(const void *bytecode);
 void mrbc_init_class(void);
 
@@ -194,6 +258,9 @@ static inline mrbc_class *find_class_by_object(const mrbc_value *obj)
   mrbc_class *cls = mrbc_class_tbl[ mrbc_type(*obj) ];
   if( !cls ) {
     switch( mrbc_type(*obj) ) {
+#if defined(MRBC_USE_FIXED)
+    case MRBC_TT_FIXED:		cls = mrbc_class_fixed;		break;
+#endif
     case MRBC_TT_CLASS:		cls = obj->cls;			break;
     case MRBC_TT_OBJECT:	cls = obj->instance->cls;	break;
     case MRBC_TT_EXCEPTION:	cls = obj->exception->cls;	break;
@@ -206,6 +273,34 @@ static inline mrbc_class *find_class_by_object(const mrbc_value *obj)
 }
 
 
+//================================================================
+/*! invalidate the method cache.
+
+  Must be called whenever a method table is changed.
+*/
+static inline void mrbc_method_cache_invalidate(void)
+{
+#if defined(MRBC_USE_METHOD_CACHE) || defined(MRBC_USE_GLOBAL_METHOD_CACHE)
+  mrbc_method_cache_epoch++;
+#endif
+}
+
+
+//================================================================
+/*! invalidate method index and cache, after the method link of the class changed.
+*/
+static inline void mrbc_method_changed(mrbc_class *cls)
+{
+#if defined(MRBC_USE_METHOD_INDEX)
+  mrbc_method_index_clear( cls );
+#endif
+#if defined(MRBC_NUMERIC_FAST_SEND)
+  mrbc_numeric_method_changed( cls );
+#endif
+  mrbc_method_cache_invalidate();
+}
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,9 +19,6 @@
 #include <stdarg.h>
 #include <string.h>
 #include <assert.h>
-#if MRBC_USE_FLOAT
-#include <stdio.h>
-#endif
 //@endcond
 
 /***** Local headers ********************************************************/
@@ -36,20 +33,356 @@
 #include "c_array.h"
 #include "c_hash.h"
 #include "c_range.h"
+#include "c_numeric.h"
+#include "c_fixed.h"
 #include "global.h"
 
 
 /***** Constant values ******************************************************/
 #define MRBC_PRINTF_MAX_WIDTH 82
 
+#if defined(MRBC_USE_FORMAT_CACHE) && !defined(MRBC_FORMAT_CACHE_DIRECTIVES)
+#define MRBC_FORMAT_CACHE_DIRECTIVES 8
+#endif
+
 
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
+#if defined(MRBC_USE_FORMAT_CACHE)
+/*!@brief
+  Compiled format cache entry.
+*/
+typedef struct FORMAT_CACHE {
+  const char *fstr;		//!< format string. (literal in bytecode)
+  uint8_t flag_compiled;	//!< 0 if the format can't be compiled.
+  struct RPrintfDirective dir[MRBC_FORMAT_CACHE_DIRECTIVES];
+} FORMAT_CACHE;
+#endif
+
+
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
+#if defined(MRBC_CONSOLE_BUFFER_SIZE)
+static char console_buf_[MRBC_CONSOLE_BUFFER_SIZE];
+static int console_buf_len_;
+#endif
+
+#if defined(MRBC_USE_FORMAT_CACHE)
+//! compiled format cache. (direct mapped)
+static FORMAT_CACHE format_cache_[MRBC_FORMAT_CACHE_SIZE];
+#endif
+
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
+//================================================================
+/*! convert the unsigned integer to digits, backward from the buffer end.
+
+  Decimal is converted by two digits per step in 32bit, and the 64bit
+  value is cut into 9 digits blocks first. Power of 2 bases use shifts.
+
+  @param  p	end of the buffer.
+  @param  v	value.
+  @param  base	n base.
+  @return	pointer to the first digit.
+*/
+static char * printf_utoa( char *p, mrbc_uint_t v, unsigned int base )
+{
+  static const char DIGIT_PAIRS[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+  if( base == 10 ) {
+#if defined(MRBC_INT64)
+    while( v > UINT32_MAX ) {
+      mrbc_uint_t q = v / 1000000000;
+      uint32_t r = (uint32_t)(v - q * 1000000000);
+      for( int i = 0; i < 4; i++ ) {
+	const char *d = &DIGIT_PAIRS[(r % 100) * 2];
+	r /= 100;
+	*--p = d[1];
+	*--p = d[0];
+      }
+      *--p = '0' + r;
+      v = q;
+    }
+#endif
+    uint32_t v32 = v;
+    while( v32 >= 100 ) {
+      const char *d = &DIGIT_PAIRS[(v32 % 100) * 2];
+      v32 /= 100;
+      *--p = d[1];
+      *--p = d[0];
+    }
+    if( v32 >= 10 ) {
+      *--p = DIGIT_PAIRS[v32 * 2 + 1];
+      *--p = DIGIT_PAIRS[v32 * 2];
+    } else {
+      *--p = '0' + v32;
+    }
+    return p;
+  }
+
+  if( (base & (base - 1)) == 0 ) {
+    int shift = 0;
+    while( (1U << shift) < base ) shift++;
+    do {
+      unsigned int ch = v & (base - 1);
+      *--p = ch + ((ch < 10)? '0' : 'a' - 10);
+      v >>= shift;
+    } while( v != 0 );
+    return p;
+  }
+
+  do {
+    unsigned int ch = v % base;
+    *--p = ch + ((ch < 10)? '0' : 'a' - 10);
+    v /= base;
+  } while( v != 0 );
+  return p;
+}
+
+
+#if MRBC_USE_FLOAT
+//================================================================
+/*! error of the product, by Dekker's algorithm.
+
+  @param  a, b	operands.
+  @param  ab	a * b in double.
+  @return	(exact a * b) - ab
+*/
+static double printf_float_mul_error( double a, double b, double ab )
+{
+  double c = 134217729.0 * a;	// 2^27 + 1
+  double ah = c - (c - a);
+  double al = a - ah;
+  c = 134217729.0 * b;
+  double bh = c - (c - b);
+  double bl = b - bh;
+
+  return ((ah * bh - ab) + ah * bl + al * bh) + al * bl;
+}
+
+
+//================================================================
+/*! multiply the double by 10 to the n-th power.
+
+  @param  v	value.
+  @param  n	exponent.
+  @param  err	[out] (exact result - returned value), or 0 if unknown.
+  @return	result.
+  @note	the result is correctly rounded, only if |n| <= 22.
+*/
+static double printf_float_scale( double v, int n, double *err )
+{
+  static const double POW10[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  double r;
+
+  *err = 0;
+  if( n > 22 || n < -22 ) {
+    for( ; n > 22; n -= 22 ) v *= 1e22;
+    for( ; n < -22; n += 22 ) v /= 1e22;
+    return (n >= 0) ? v * POW10[n] : v / POW10[-n];
+  }
+
+  if( n >= 0 ) {
+    r = v * POW10[n];
+    *err = printf_float_mul_error( v, POW10[n], r );
+  } else {
+    r = v / POW10[-n];
+    double p = r * POW10[-n];
+    *err = ((v - p) - printf_float_mul_error( r, POW10[-n], p )) / POW10[-n];
+  }
+  return r;
+}
+
+
+//================================================================
+/*! round the non-negative double (< 2^63) to integer, half to even.
+
+  @param  v	value.
+  @param  err	(exact value - v), less than 1 in magnitude.
+*/
+static uint64_t printf_float_round( double v, double err )
+{
+  uint64_t r = (uint64_t)v;
+  double frac = v - (double)r;
+
+  // compare (frac + err) with +-0.5, without rounding of the sum.
+  if( frac + 0.5 < -err || (frac + 0.5 == -err && (r & 1)) ) {
+    r--;
+  } else if( frac - 0.5 > -err || (frac - 0.5 == -err && (r & 1)) ) {
+    r++;
+  }
+  return r;
+}
+
+
+//================================================================
+/*! make the decimal digits of the positive double.
+
+  @param  v	value. (> 0)
+  @param  ndig	number of significant digits. (1..16)
+  @param  dig	[out] digits, not terminated.
+  @return	decimal exponent of the first digit.
+*/
+static int printf_float_digits( double v, int ndig, char *dig )
+{
+  uint64_t bits;
+  memcpy( &bits, &v, sizeof(bits) );
+  int e2 = (int)((bits >> 52) & 0x7ff) - 1023;
+  int e10 = e2 * 30103 / 100000;	// about log10(v), corrected below.
+
+  uint64_t lo = 1;
+  for( int i = 1; i < ndig; i++ ) lo *= 10;
+  uint64_t hi = lo * 10;
+  int step = 0;
+  double scaled, err;
+
+  while( 1 ) {
+    scaled = printf_float_scale( v, ndig - 1 - e10, &err );
+    if( scaled >= hi && step >= 0 ) {
+      e10++;
+      step = 1;
+    } else if( scaled < lo && step <= 0 ) {
+      e10--;
+      step = -1;
+    } else {
+      break;	// (note) not to go back and forth by the rounding errors.
+    }
+  }
+  uint64_t m = printf_float_round( scaled, err );
+  if( m == hi ) {		// e.g. 9.99 to 10.0
+    m = lo;
+    e10++;
+  }
+
+  // 32bit divisions only, for 8 digits each.
+  uint32_t part = (uint32_t)(m % 100000000);
+  uint32_t high = (uint32_t)(m / 100000000);
+  for( int i = ndig - 1, n = 0; i >= 0; i--, n++ ) {
+    if( n == 8 ) part = high;
+    dig[i] = '0' + part % 10;
+    part /= 10;
+  }
+  return e10;
+}
+
+
+//================================================================
+/*! output a character for mrbc_printf_float.
+*/
+static inline int printf_float_putc( mrbc_printf_t *pf, int ch )
+{
+  *pf->p++ = ch;
+  return -(pf->p >= pf->buf_end);
+}
+#endif
+
+
+#if defined(MRBC_USE_FORMAT_CACHE)
+//================================================================
+/*! compile the format string.
+
+  @param  dir	[out] directives.
+  @param  fstr	format string.
+  @return	0 if compiled, or -1 if not supported.
+*/
+static int printf_compile( struct RPrintfDirective *dir, const char *fstr )
+{
+  const char *s = fstr;
+
+  for( int n = 0; n < MRBC_FORMAT_CACHE_DIRECTIVES; n++ ) {
+    struct RPrintfDirective *d = &dir[n];
+    const char *lit = s;
+
+    while( *s && *s != '%' ) s++;
+    if( s - lit >= UINT16_MAX ) return -1;
+    d->lit_len = s - lit;
+    d->fmt = (struct RPrintfFormat){0};
+
+    if( *s == '\0' ) {
+      d->fstr_len = d->lit_len;
+      return 0;
+    }
+
+    if( s[1] == '%' ) {			// "%%"
+      d->lit_len++;
+      d->fmt.type = '%';
+      s += 2;
+    } else {
+      // parse the directive by mrbc_printf_main, without any output.
+      char dummy[2];
+      mrbc_printf_t pf;
+      mrbc_printf_init( &pf, dummy, sizeof(dummy), s );
+      mrbc_printf_main( &pf );
+      if( pf.fmt.type == 0 || pf.fmt.type == '%' ) return -1;
+      d->fmt = pf.fmt;
+      s = pf.fstr;
+    }
+    if( s - lit > UINT16_MAX ) return -1;
+    d->fstr_len = s - lit;
+  }
+
+  return -1;	// too many directives.
+}
+
+
+//================================================================
+/*! mrbc_printf_main with the compiled format.
+
+  The literal text is not output partly. If it doesn't fit in the buffer,
+  returns -1 without any output.
+*/
+static int printf_main_compiled( mrbc_printf_t *pf )
+{
+  while( 1 ) {
+    const struct RPrintfDirective *d = pf->dir;
+
+    if( pf->buf_end - pf->p < d->lit_len ) return -1;
+    memcpy( pf->p, pf->fstr, d->lit_len );
+    pf->p += d->lit_len;
+    pf->fstr += d->fstr_len;
+    pf->fmt = d->fmt;
+
+    if( d->fmt.type == 0 ) return 0;
+    pf->dir++;
+    if( d->fmt.type != '%' ) return 1;
+  }
+}
+#endif
+
+
+//================================================================
+/*! write to the console, through the buffer.
+
+  @param  buf		pointer to data.
+  @param  nbytes	data length.
+*/
+static void console_write(const void *buf, int nbytes)
+{
+#if defined(MRBC_CONSOLE_BUFFER_SIZE)
+  if( console_buf_len_ + nbytes > MRBC_CONSOLE_BUFFER_SIZE ) {
+    mrbc_console_flush();
+    if( nbytes >= MRBC_CONSOLE_BUFFER_SIZE ) {
+      hal_write(1, buf, nbytes);
+      return;
+    }
+  }
+  memcpy( console_buf_ + console_buf_len_, buf, nbytes );
+  console_buf_len_ += nbytes;
+
+#else
+  hal_write(1, buf, nbytes);
+#endif
+}
+
+
 //----------------------------------------------------------------
 /* sub function for mrbc_printf
 */
@@ -120,15 +453,31 @@ void mrbc_putchar(char c)
 #if defined(MRBC_CONVERT_CRLF)
   static const char CRLF[2] = "\r\n";
   if( c == '\n' ) {
-    hal_write(1, CRLF, 2);
+    console_write(CRLF, 2);
   } else {
-    hal_write(1, &c, 1);
+    console_write(&c, 1);
   }
 
 #else
-    hal_write(1, &c, 1);
+  console_write(&c, 1);
 #endif
+
+  if( c == '\n' ) mrbc_console_flush();
+}
+
+
+#if defined(MRBC_CONSOLE_BUFFER_SIZE)
+//================================================================
+/*! write out the buffered console output.
+*/
+void mrbc_console_flush(void)
+{
+  if( console_buf_len_ == 0 ) return;
+
+  hal_write(1, console_buf_, console_buf_len_);
+  console_buf_len_ = 0;
 }
+#endif
 
 
 //================================================================
@@ -170,17 +519,21 @@ void mrbc_nprint(const char *str, int size)
 
   for( i = 0; i < size; i++ ) {
     if( *p1++ == '\n' ) {
-      hal_write(1, p2, p1 - p2 - 1);
-      hal_write(1, CRLF, 2);
+      console_write(p2, p1 - p2 - 1);
+      console_write(CRLF, 2);
       p2 = p1;
     }
   }
   if( p1 != p2 ) {
-    hal_write(1, p2, p1 - p2);
+    console_write(p2, p1 - p2);
   }
 
 #else
-  hal_write(1, str, size);
+  console_write(str, size);
+#endif
+
+#if defined(MRBC_CONSOLE_BUFFER_SIZE)
+  if( memchr(str, '\n', size) ) mrbc_console_flush();
 #endif
 }
 
@@ -445,6 +798,20 @@ int mrbc_print_sub(const mrbc_value *v)
   case MRBC_TT_FLOAT:	mrbc_printf("%g", v->d);	break;
 #endif
   case MRBC_TT_SYMBOL:	mrbc_print_symbol(v->i);	break;
+#if defined(MRBC_USE_FIXED)
+  case MRBC_TT_FIXED: {
+    char buf[16];
+    mrbc_fixed_to_cstr( buf, sizeof(buf), v->fx );
+    mrbc_print( buf );
+  } break;
+#endif
+#if defined(MRBC_INT_WIDE)
+  case MRBC_TT_WIDE_INT: {
+    char buf[24];
+    mrbc_int_wide_to_cstr( buf, sizeof(buf), mrbc_int_wide_get(v), 10 );
+    mrbc_print( buf );
+  } break;
+#endif
   case MRBC_TT_CLASS:	mrbc_print_symbol(v->cls->sym_id); break;
 
   case MRBC_TT_OBJECT:
@@ -503,10 +870,9 @@ int mrbc_print_sub(const mrbc_value *v)
     break;
 
   case MRBC_TT_EXCEPTION:
-    mrbc_printf("#<%s: %s>", mrbc_symid_to_str(v->exception->cls->sym_id),
-		 v->exception->message ?
-		   (const char *)v->exception->message :
-		   mrbc_symid_to_str(v->exception->cls->sym_id) );
+    mrbc_printf("#<%s: ", mrbc_symid_to_str(v->exception->cls->sym_id));
+    mrbc_print_exception_message( v->exception );
+    mrbc_putchar('>');
     break;
 
   default:
@@ -545,6 +911,10 @@ void mrbc_printf_replace_buffer(mrbc_printf_t *pf, char *buf, int size)
 */
 int mrbc_printf_main( mrbc_printf_t *pf )
 {
+#if defined(MRBC_USE_FORMAT_CACHE)
+  if( pf->dir ) return printf_main_compiled( pf );
+#endif
+
   int ch = -1;
   pf->fmt = (struct RPrintfFormat){0};
 
@@ -594,6 +964,45 @@ int mrbc_printf_main( mrbc_printf_t *pf )
 }
 
 
+#if defined(MRBC_USE_FORMAT_CACHE)
+//================================================================
+/*! use the compiled format of pf->fstr.
+
+  The cache is keyed by the address of the format string, so it must be
+  a literal that lives until mrbc_printf_clear_cache() is called.
+
+  @param  pf	pointer to mrbc_printf, just initialized.
+  @retval 0	the compiled format is used.
+  @retval -1	the format is not supported, pf is not changed.
+*/
+int mrbc_printf_use_cache( mrbc_printf_t *pf )
+{
+  FORMAT_CACHE *cache =
+    &format_cache_[ ((uintptr_t)pf->fstr >> 2) & (MRBC_FORMAT_CACHE_SIZE - 1) ];
+
+  if( cache->fstr != pf->fstr ) {
+    cache->fstr = pf->fstr;
+    cache->flag_compiled = (printf_compile( cache->dir, pf->fstr ) == 0);
+  }
+  if( !cache->flag_compiled ) return -1;
+
+  pf->dir = cache->dir;
+  return 0;
+}
+
+
+//================================================================
+/*! clear the compiled format cache.
+
+  Call this when the bytecode that has the format strings is released.
+*/
+void mrbc_printf_clear_cache( void )
+{
+  memset( format_cache_, 0, sizeof(format_cache_) );
+}
+#endif
+
+
 //================================================================
 /*! sprintf subcontract function for char '%c'
 
@@ -710,13 +1119,7 @@ int mrbc_printf_int( mrbc_printf_t *pf, mrbc_int_t value, unsigned int base )
 
   // create string to temporary buffer
   char buf[sizeof(mrbc_int_t) * 8];
-  char *p = buf + sizeof(buf);
-
-  do {
-    unsigned int ch = v % base;
-    *--p = ch + ((ch < 10)? '0' : 'a' - 10);
-    v /= base;
-  } while( v != 0 );
+  char *p = printf_utoa( buf + sizeof(buf), v, base );
 
   int dig_width = buf + sizeof(buf) - p;
 
@@ -828,29 +1231,163 @@ int mrbc_printf_bit( mrbc_printf_t *pf, mrbc_int_t value, int bit )
 
 #if MRBC_USE_FLOAT
 //================================================================
-/*! sprintf subcontract function for float(double) '%f'
+/*! sprintf subcontract function for float(double) '%f', '%e' and '%g'
 
   @param  pf	pointer to mrbc_printf.
   @param  value	output value.
   @retval 0	done.
   @retval -1	buffer full.
+
+  @note
+    without snprintf in libc.
+    up to 16 significant digits, the rest is filled with zeros.
+    the last digits may differ from libc for |exponent| > 22.
+    not support '#' flag.
 */
 int mrbc_printf_float( mrbc_printf_t *pf, double value )
 {
-  char fstr[16];
-  const char *p1 = pf->fstr;
-  char *p2 = fstr + sizeof(fstr) - 1;
+  // the precision is given or not. ("%.0f" and "%f" are different)
+  const char *fp = pf->fstr;
+  int flag_prec = 0;
+  while( *--fp != '%' ) {
+    if( *fp == '.' ) flag_prec = 1;
+  }
+  int type = pf->fmt.type;
+  int prec = flag_prec ? pf->fmt.precision : 6;
 
-  *p2 = '\0';
-  while( (*--p2 = *--p1) != '%' )
-    ;
+  uint64_t bits;
+  memcpy( &bits, &value, sizeof(bits) );
+  int sign = 0;
+  if( bits >> 63 ) {
+    sign = '-';
+    value = -value;
+  } else if( pf->fmt.flag_plus ) {
+    sign = '+';
+  } else if( pf->fmt.flag_space ) {
+    sign = ' ';
+  }
 
-  snprintf( pf->p, (pf->buf_end - pf->p + 1), p2, value );
+  /*
+    make the digits.
+    the value is dig[0..nd-1] with the first digit at 10^exp.
+  */
+  char dig[16];
+  int nd = 1;
+  int exp = 0;
+  int n_frac = 0;		// digits after the point.
+  int flag_exp = (type == 'e' || type == 'E');
+  const char *special = 0;
+  dig[0] = '0';
+
+  if( value != value ) {
+    special = (type == 'E' || type == 'G') ? "NAN" : "nan";
+  } else if( value > 1.7976931348623157e308 ) {
+    special = (type == 'E' || type == 'G') ? "INF" : "inf";
+
+  } else if( type == 'f' ) {
+    double err;
+    double scaled = printf_float_scale( value, prec, &err );
+    if( scaled < 9007199254740992.0 ) {	// 2^53
+      uint64_t m = printf_float_round( scaled, err );
+      nd = 0;
+      for( uint64_t t = m; t != 0; t /= 10 ) nd++;
+      if( nd == 0 ) nd = 1;
+      for( int i = nd - 1; i >= 0; i-- ) {
+	dig[i] = '0' + (int)(m % 10);
+	m /= 10;
+      }
+      exp = nd - 1 - prec;
+    } else {
+      nd = 16;
+      exp = printf_float_digits( value, nd, dig );
+    }
+    n_frac = prec;
+
+  } else if( value == 0 ) {
+    exp = 0;
 
-  while( *pf->p != '\0' )
-    pf->p++;
+  } else {
+    int ndig = (type == 'g' || type == 'G') ? (prec ? prec : 1) : prec + 1;
+    nd = (ndig > 16) ? 16 : ndig;
+    exp = printf_float_digits( value, nd, dig );
+  }
 
-  return -(pf->p == pf->buf_end);
+  if( !special && type != 'f' ) {
+    if( flag_exp ) {
+      n_frac = prec;
+    } else {
+      // %g: exponential style if the exponent is < -4 or >= precision.
+      int p = prec ? prec : 1;
+      flag_exp = (exp < -4 || exp >= p);
+      while( nd > 1 && dig[nd - 1] == '0' ) nd--;  // remove trailing zeros.
+      n_frac = flag_exp ? nd - 1 : nd - 1 - exp;
+      if( n_frac < 0 ) n_frac = 0;
+    }
+  }
+
+  /*
+    calculate the width.
+  */
+  int width;
+  if( special ) {
+    width = 3;
+  } else if( flag_exp ) {
+    width = 1 + (n_frac ? n_frac + 1 : 0) + 2 + ((exp >= 100 || exp <= -100) ? 3 : 2);
+  } else {
+    width = (exp > 0 ? exp + 1 : 1) + (n_frac ? n_frac + 1 : 0);
+  }
+  width += !!sign;
+  int pad_width = pf->fmt.width - width;
+  int flag_zero = pf->fmt.flag_zero && !pf->fmt.flag_minus && !special;
+
+  /*
+    output
+  */
+  if( !pf->fmt.flag_minus && !flag_zero ) {
+    for( ; pad_width > 0; pad_width-- ) {
+      if( printf_float_putc( pf, ' ' ) ) return -1;
+    }
+  }
+  if( sign && printf_float_putc( pf, sign ) ) return -1;
+  if( flag_zero ) {
+    for( ; pad_width > 0; pad_width-- ) {
+      if( printf_float_putc( pf, '0' ) ) return -1;
+    }
+  }
+
+  if( special ) {
+    for( int i = 0; i < 3; i++ ) {
+      if( printf_float_putc( pf, special[i] ) ) return -1;
+    }
+
+  } else if( flag_exp ) {
+    if( printf_float_putc( pf, dig[0] ) ) return -1;
+    if( n_frac && printf_float_putc( pf, '.' ) ) return -1;
+    for( int i = 1; i <= n_frac; i++ ) {
+      if( printf_float_putc( pf, (i < nd) ? dig[i] : '0' ) ) return -1;
+    }
+    if( printf_float_putc( pf, (type == 'E' || type == 'G') ? 'E' : 'e' ) ) return -1;
+    if( printf_float_putc( pf, (exp < 0) ? '-' : '+' ) ) return -1;
+    int e = (exp < 0) ? -exp : exp;
+    if( e >= 100 && printf_float_putc( pf, '0' + e / 100 ) ) return -1;
+    if( printf_float_putc( pf, '0' + e / 10 % 10 ) ) return -1;
+    if( printf_float_putc( pf, '0' + e % 10 ) ) return -1;
+
+  } else {
+    for( int q = (exp > 0 ? exp : 0); q >= -n_frac; q-- ) {
+      if( q == -1 && printf_float_putc( pf, '.' ) ) return -1;
+      int i = exp - q;
+      if( printf_float_putc( pf, (0 <= i && i < nd) ? dig[i] : '0' ) ) return -1;
+    }
+  }
+
+  if( pf->fmt.flag_minus ) {
+    for( ; pad_width > 0; pad_width-- ) {
+      if( printf_float_putc( pf, ' ' ) ) return -1;
+    }
+  }
+
+  return 0;
 }
 #endif
 
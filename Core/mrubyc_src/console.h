@@ -55,6 +55,23 @@ struct RPrintfFormat {
 };
 
 
+#if defined(MRBC_USE_FORMAT_CACHE)
+//================================================================
+/*!@brief
+  compiled directive of the format string.
+
+  The literal text is output from the format string, and the fstr is
+  advanced by fstr_len. The type of fmt is '%' for "%%" (literal only),
+  and 0 at the end of the format.
+*/
+struct RPrintfDirective {
+  uint16_t lit_len;		//!< length of the literal text before it.
+  uint16_t fstr_len;		//!< length of the literal and the directive.
+  struct RPrintfFormat fmt;	//!< parsed directive.
+};
+#endif
+
+
 //================================================================
 /*!@brief
   printf tiny (mruby/c) version data container.
@@ -65,6 +82,9 @@ typedef struct RPrintf {
   char *p;			//!< output buffer write point.
   const char *fstr;		//!< format string. (e.g. "%d %03x")
   struct RPrintfFormat fmt;
+#if defined(MRBC_USE_FORMAT_CACHE)
+  const struct RPrintfDirective *dir;	//!< compiled format, or NULL.
+#endif
 } mrbc_printf_t;
 
 
@@ -74,6 +94,11 @@ void mrbc_putchar(char c);
 void mrbc_print_symbol(mrbc_sym sym_id);
 void mrbc_nprint(const char *str, int size);
 void mrbc_printf(const char *fstr, ...);
+#if defined(MRBC_CONSOLE_BUFFER_SIZE)
+void mrbc_console_flush(void);
+#else
+#define mrbc_console_flush()	((void)0)
+#endif
 void mrbc_asprintf(char **buf, int bufsiz, const char *fstr, ...);
 void mrbc_snprintf(char *buf, int bufsiz, const char *fstr, ...);
 void mrbc_vprintf(const char *fstr, va_list ap);
@@ -84,6 +109,12 @@ int mrbc_puts_sub(const mrbc_value *v);
 int mrbc_print_sub(const mrbc_value *v);
 void mrbc_printf_replace_buffer(mrbc_printf_t *pf, char *buf, int size);
 int mrbc_printf_main(mrbc_printf_t *pf);
+#if defined(MRBC_USE_FORMAT_CACHE)
+int mrbc_printf_use_cache(mrbc_printf_t *pf);
+void mrbc_printf_clear_cache(void);
+#else
+#define mrbc_printf_clear_cache()	((void)0)
+#endif
 int mrbc_printf_char(mrbc_printf_t *pf, int ch);
 int mrbc_printf_bstr(mrbc_printf_t *pf, const char *str, int len, int pad);
 int mrbc_printf_int(mrbc_printf_t *pf, mrbc_int_t value, unsigned int base);
@@ -120,6 +151,9 @@ static inline void mrbc_printf_init( mrbc_printf_t *pf, char *buf, int size,
   pf->buf_end = buf + size - 1;
   pf->fstr = fstr;
   pf->fmt = (struct RPrintfFormat){0};
+#if defined(MRBC_USE_FORMAT_CACHE)
+  pf->dir = 0;
+#endif
 }
 
 
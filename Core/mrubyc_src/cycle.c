@@ -0,0 +1,334 @@
+/*! @file
+  @brief
+  mruby/c cycle collector for the reference counted objects.
+
+  The objects are released by the reference counter, so a cycle such as
+  a parent and child referring to each other is never released. This
+  finds them by the trial deletion, in small steps while no task is
+  ready (see mrbc_run), so it doesn't add any pause to the tasks.
+
+  (STRATEGY)
+   - When the counter of Object, Array, Range or Hash is decreased but
+     not zero, it can be a garbage cycle. The object is held in the
+     candidate buffer with one reference, so it is never released
+     while buffered. If the buffer is full, the object is not buffered.
+     (Proc doesn't hold the registers of the outer frames by the
+     counter, so it can't make a cycle)
+   - A step takes one candidate, and collects the objects reachable
+     from it, up to MRBC_CYCLE_MAX_NODES. The reference count of each
+     object minus the references from the collected objects is the
+     number of the references from the outside.
+   - The objects referred from the outside are alive, and so are the
+     objects reachable from them. If the candidate is not alive, all
+     objects not alive are a garbage, and are released.
+   - The counts are kept in the node table, and the objects are not
+     modified until they are found garbage. So a step can give up at
+     any time, e.g. if the objects are too many.
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+//@cond
+#include "vm_config.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+#include "alloc.h"
+#include "value.h"
+#include "class.h"
+#include "c_array.h"
+#include "c_hash.h"
+#include "c_range.h"
+#include "vm.h"
+#include "cycle.h"
+
+#if defined(MRBC_CYCLE_COLLECT)
+/***** Constat values *******************************************************/
+/***** Macros ***************************************************************/
+//! the type can make a cycle.
+#define IS_CONTAINER(v) ( (v)->tt == MRBC_TT_OBJECT || \
+			  (v)->tt == MRBC_TT_ARRAY  || \
+			  (v)->tt == MRBC_TT_RANGE  || \
+			  (v)->tt == MRBC_TT_HASH )
+
+
+/***** Typedefs *************************************************************/
+/*!@brief
+  Object examined in a step.
+*/
+typedef struct CYCLE_NODE {
+  mrbc_value v;			//!< the object.
+  int count;			//!< references from the outside of the table.
+  uint8_t flag_live;		//!< reachable from the outside.
+} CYCLE_NODE;
+
+
+/***** Function prototypes **************************************************/
+/***** Local variables ******************************************************/
+static mrbc_value candidate_[MRBC_CYCLE_BUFFER_SIZE];
+static int n_candidate_;
+static CYCLE_NODE node_[MRBC_CYCLE_MAX_NODES];
+static int n_node_;
+static unsigned int n_collected_;
+
+
+/***** Global variables *****************************************************/
+/***** Signal catching functions ********************************************/
+/***** Local functions ******************************************************/
+//================================================================
+/*! get the reference to the object in the object.
+
+  @param  v	the object.
+  @param  i	index.
+  @return	pointer to the value, or NULL if no more.
+*/
+static mrbc_value * child_at(const mrbc_value *v, int i)
+{
+  switch( v->tt ) {
+  case MRBC_TT_OBJECT:
+#if defined(MRBC_USE_IVAR_SHAPE)
+    return (i < v->instance->n_ivar) ? &v->instance->ivar[i] : NULL;
+#else
+    return (i < v->instance->ivar.n_stored) ?
+      &v->instance->ivar.data[i].value : NULL;
+#endif
+
+  case MRBC_TT_HASH:
+#if defined(MRBC_USE_HASH_SYMKEY)
+    if( v->hash->flag_symkey ) {
+      return (i < v->hash->n_stored) ? &v->hash->kv[i].value : NULL;
+    }
+#endif
+    return (i < v->hash->n_stored) ? &v->hash->data[i] : NULL;
+
+  case MRBC_TT_ARRAY:
+    // the elements of a shared buffer are held by it, not by the array.
+    if( v->array->shared_idx ) return NULL;
+    return (i < v->array->n_stored) ? &v->array->data[i] : NULL;
+
+  case MRBC_TT_RANGE:
+    if( i == 0 ) return &v->range->first;
+    if( i == 1 ) return &v->range->last;
+    return NULL;
+
+  default:
+    return NULL;
+  }
+}
+
+
+//================================================================
+/*! find the object in the node table.
+
+  @param  obj	the object.
+  @return	index, or -1 if not found.
+*/
+static int node_find(const struct RBasic *obj)
+{
+  int i;
+  for( i = 0; i < n_node_; i++ ) {
+    if( node_[i].v.obj == obj ) return i;
+  }
+  return -1;
+}
+
+
+//================================================================
+/*! collect the objects reachable from the root, and count the
+    references from the outside.
+
+  @param  root	the candidate.
+  @retval 0	No error.
+  @retval -1	too many objects.
+*/
+static int collect_nodes(const mrbc_value *root)
+{
+  node_[0].v = *root;
+  node_[0].count = root->obj->ref_count - 1;	// held by the buffer.
+  node_[0].flag_live = 0;
+  n_node_ = 1;
+
+  int i;
+  for( i = 0; i < n_node_; i++ ) {
+    mrbc_value *p;
+    int j;
+    for( j = 0; (p = child_at( &node_[i].v, j )) != NULL; j++ ) {
+      if( !IS_CONTAINER(p) ) continue;
+
+      int k = node_find( p->obj );
+      if( k < 0 ) {
+	if( n_node_ >= MRBC_CYCLE_MAX_NODES ) return -1;
+	k = n_node_++;
+	node_[k].v = *p;
+	node_[k].count = p->obj->ref_count;
+	node_[k].flag_live = 0;
+      }
+      node_[k].count--;		// the reference inside of the table.
+    }
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! mark the objects referred from the outside, and reachable from them.
+
+  @return	non zero if the root is alive.
+*/
+static int mark_live(void)
+{
+  uint8_t work[MRBC_CYCLE_MAX_NODES];
+  int n_work = 0;
+  int i;
+
+  for( i = 0; i < n_node_; i++ ) {
+    assert( node_[i].count >= 0 );
+    if( node_[i].count == 0 ) continue;
+    node_[i].flag_live = 1;
+    work[n_work++] = i;
+  }
+
+  while( n_work > 0 ) {
+    const mrbc_value *v = &node_[ work[--n_work] ].v;
+    mrbc_value *p;
+    int j;
+    for( j = 0; (p = child_at( v, j )) != NULL; j++ ) {
+      if( !IS_CONTAINER(p) ) continue;
+
+      int k = node_find( p->obj );
+      if( node_[k].flag_live ) continue;
+      node_[k].flag_live = 1;
+      work[n_work++] = k;
+    }
+  }
+
+  return node_[0].flag_live;
+}
+
+
+//================================================================
+/*! release the objects not alive in the node table.
+*/
+static void release_garbage(void)
+{
+  int i;
+
+  // cut the references between the garbages first,
+  for( i = 0; i < n_node_; i++ ) {
+    if( node_[i].flag_live ) continue;
+
+    mrbc_value *p;
+    int j;
+    for( j = 0; (p = child_at( &node_[i].v, j )) != NULL; j++ ) {
+      if( !IS_CONTAINER(p) ) continue;
+      if( node_[ node_find( p->obj ) ].flag_live ) continue;
+      mrbc_set_nil( p );
+    }
+  }
+
+  // then nothing refers them, and the others are released by the counter.
+  for( i = 0; i < n_node_; i++ ) {
+    if( node_[i].flag_live ) continue;
+
+    node_[i].v.obj->ref_count = 1;
+    mrbc_decref( &node_[i].v );
+    n_collected_++;
+  }
+}
+
+
+/***** Global functions *****************************************************/
+//================================================================
+/*! add the candidate of a garbage cycle.
+
+  mrbc_decref() calls this, when the counter is decreased but not zero.
+
+  @param  v	the object.
+*/
+void mrbc_cycle_candidate(mrbc_value *v)
+{
+  if( !IS_CONTAINER(v) ) return;
+  if( n_candidate_ >= MRBC_CYCLE_BUFFER_SIZE ) return;
+
+  v->obj->flag_cycle = 1;
+  v->obj->ref_count++;
+  candidate_[n_candidate_++] = *v;
+}
+
+
+//================================================================
+/*! run a step of the collector.
+
+  This examines one candidate. The time is bounded by
+  MRBC_CYCLE_MAX_NODES and the size of the objects.
+
+  @return	non zero if a step was done, or 0 if nothing to do.
+*/
+int mrbc_cycle_collect_step(void)
+{
+  if( n_candidate_ == 0 ) return 0;
+
+  mrbc_value root = candidate_[--n_candidate_];
+  root.obj->flag_cycle = 0;
+
+  // nobody refers it other than the buffer.
+  if( root.obj->ref_count == 1 ) {
+    mrbc_decref( &root );
+    return 1;
+  }
+
+  if( collect_nodes( &root ) == 0 && !mark_live() ) {
+    release_garbage();
+    return 1;
+  }
+
+  // alive or too large to examine. (and it isn't empty yet)
+  root.obj->ref_count--;
+  return 1;
+}
+
+
+#if defined(MRBC_ALLOC_VMID)
+//================================================================
+/*! drop the candidates owned by VM.
+
+  Call this before mrbc_free_all(), that releases them at once.
+
+  @param  vm	pointer to VM.
+*/
+void mrbc_cycle_purge_vm(const struct VM *vm)
+{
+  int i, n = 0;
+
+  for( i = 0; i < n_candidate_; i++ ) {
+    if( mrbc_get_vm_id( candidate_[i].obj ) == vm->vm_id ) continue;
+    candidate_[n++] = candidate_[i];
+  }
+  n_candidate_ = n;
+}
+#endif
+
+
+//================================================================
+/*! number of the objects released by the collector.
+
+  @return	count. (wrap around)
+*/
+unsigned int mrbc_cycle_collected(void)
+{
+  return n_collected_;
+}
+
+#endif	// defined(MRBC_CYCLE_COLLECT)
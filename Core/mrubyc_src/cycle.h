@@ -0,0 +1,53 @@
+/*! @file
+  @brief
+  mruby/c cycle collector for the reference counted objects.
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef MRBC_SRC_CYCLE_H_
+#define MRBC_SRC_CYCLE_H_
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+/***** Local headers ********************************************************/
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/***** Constat values *******************************************************/
+//! number of candidates waiting for the collector.
+#if !defined(MRBC_CYCLE_BUFFER_SIZE)
+#define MRBC_CYCLE_BUFFER_SIZE 16
+#endif
+
+//! maximum number of objects examined in a step.
+#if !defined(MRBC_CYCLE_MAX_NODES)
+#define MRBC_CYCLE_MAX_NODES 32
+#endif
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+/***** Global variables *****************************************************/
+/***** Function prototypes **************************************************/
+struct VM;
+int mrbc_cycle_collect_step(void);
+void mrbc_cycle_purge_vm(const struct VM *vm);
+unsigned int mrbc_cycle_collected(void);
+
+
+/***** Inline functions *****************************************************/
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
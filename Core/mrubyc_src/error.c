@@ -32,21 +32,37 @@
 
 
 /***** Constat values *******************************************************/
+static const int MESSAGE_INI_LEN = 32;
+
+
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
+#if MRBC_EXCEPTION_SPARE_COUNT > 0
+//! freed exception objects, kept for reuse.
+static mrbc_exception *exception_spare[MRBC_EXCEPTION_SPARE_COUNT];
+static int n_exception_spare;
+#endif
+
+//! NoMemoryError raised at the out of memory, without allocation.
+//! (it holds a reference, so that it is never freed)
+static mrbc_exception no_memory_error_ = {
+  .ref_count = 1,
+  .cls = &mrbc_class_NoMemoryError,
+};
+
+
 /***** Global variables *****************************************************/
 /***** Local functions ******************************************************/
-static mrbc_exception * sub_exception_new(struct VM *vm, struct RClass *exc_cls)
+//================================================================
+/*! set the class and the raised place to the exception.
+*/
+static void exception_set_raised(struct VM *vm, mrbc_exception *ex, struct RClass *exc_cls)
 {
-  // allocate memory for instance.
-  mrbc_exception *ex = mrbc_alloc( vm, sizeof(mrbc_exception) );
-  if( !ex ) return ex;		// ENOMEM
-
-  MRBC_INIT_OBJECT_HEADER( ex, "EX" );
   ex->cls = exc_cls;
   ex->method_id = 0;
+  ex->n_args = 0;
 
   mrbc_callinfo *callinfo = vm->callinfo_tail;
   for( int i = 0; i < MRBC_EXCEPTION_CALL_NEST_LEVEL; i++ ) {
@@ -57,10 +73,88 @@ static mrbc_exception * sub_exception_new(struct VM *vm, struct RClass *exc_cls)
       ex->call_nest[i] = 0;
     }
   }
+}
+
+
+//================================================================
+/*! raise the preallocated NoMemoryError.
+*/
+static void raise_no_memory_error(struct VM *vm)
+{
+  mrbc_decref(&vm->exception);
+
+  exception_set_raised( vm, &no_memory_error_, MRBC_CLASS(NoMemoryError) );
+  no_memory_error_.ref_count++;
+  vm->exception = (mrbc_value){.tt = MRBC_TT_EXCEPTION,
+			       .exception = &no_memory_error_};
+  vm->flag_preemption = 2;
+}
+
+
+static mrbc_exception * sub_exception_new(struct VM *vm, struct RClass *exc_cls)
+{
+  mrbc_exception *ex;
+
+#if MRBC_EXCEPTION_SPARE_COUNT > 0
+  if( n_exception_spare > 0 ) {
+    ex = exception_spare[--n_exception_spare];
+    mrbc_set_vm_id( ex, vm->vm_id );
+  } else
+#endif
+  {
+    // allocate memory for instance.
+    ex = mrbc_alloc( vm, sizeof(mrbc_exception) );
+    if( !ex ) return ex;	// ENOMEM
+  }
+
+  MRBC_INIT_OBJECT_HEADER( ex, "EX" );
+  exception_set_raised( vm, ex, exc_cls );
 
   return ex;
 }
 
+
+//================================================================
+/*! count integer conversions in the format string.
+
+  @param  fstr		format string.
+  @return		number of conversions, or -1 if not lazily formattable.
+*/
+static int count_int_conversions( const char *fstr )
+{
+  int n = 0;
+
+  while( *fstr ) {
+    if( *fstr++ != '%' ) continue;
+
+    while( strchr("+ -0123456789.", *fstr) && *fstr ) fstr++;
+    if( !*fstr || !strchr("cdiubBxX", *fstr) ) return -1;
+    fstr++;
+    if( ++n > MRBC_EXCEPTION_FORMAT_ARGS ) return -1;
+  }
+
+  return n;
+}
+
+
+//================================================================
+/*! render the lazily formatted message.
+
+  @param  vm		pointer to VM.
+  @param  ex		exception object.
+  @return		allocated message buffer or NULL.
+*/
+static char * exception_render_message( struct VM *vm, const mrbc_exception *ex )
+{
+  char *buf = mrbc_alloc( vm, MESSAGE_INI_LEN );
+  if( !buf ) return 0;		// ENOMEM
+
+  mrbc_asprintf( &buf, MESSAGE_INI_LEN, (const char *)ex->message,
+		 ex->args[0], ex->args[1], ex->args[2] );
+  return buf;
+}
+
+
 /***** Global functions *****************************************************/
 //================================================================
 /*! constructor
@@ -144,6 +238,14 @@ void mrbc_exception_delete(mrbc_value *value)
   if( value->exception->message_size ) {
     mrbc_raw_free( (void *)value->exception->message );
   }
+
+#if MRBC_EXCEPTION_SPARE_COUNT > 0
+  if( n_exception_spare < MRBC_EXCEPTION_SPARE_COUNT ) {
+    mrbc_set_vm_id( value->exception, 0 );	// don't free at the VM end.
+    exception_spare[n_exception_spare++] = value->exception;
+    return;
+  }
+#endif
   mrbc_raw_free( value->exception );
 }
 
@@ -155,6 +257,8 @@ void mrbc_exception_delete(mrbc_value *value)
   @param  exc_cls	pointer to Exception class or NULL.
   @param  msg		message or NULL.
   @note	(usage) mrbc_raise(vm, MRBC_CLASS(TypeError), "message here.");
+  @note	NoMemoryError without message, or any exception at the out of
+	memory, is raised by the preallocated NoMemoryError.
 */
 void mrbc_raise( struct VM *vm, struct RClass *exc_cls, const char *msg )
 {
@@ -162,8 +266,17 @@ void mrbc_raise( struct VM *vm, struct RClass *exc_cls, const char *msg )
     struct RClass *cls = exc_cls ? exc_cls : MRBC_CLASS(RuntimeError);
     const char msg_len = msg ? strlen(msg) : 0;
 
+    mrbc_value exc = mrbc_nil_value();
+    if( cls != MRBC_CLASS(NoMemoryError) || msg ) {
+      exc = mrbc_exception_new( vm, cls, msg, msg_len );
+    }
+    if( !exc.exception ) {
+      raise_no_memory_error( vm );
+      return;
+    }
+
     mrbc_decref(&vm->exception);
-    vm->exception = mrbc_exception_new( vm, cls, msg, msg_len );
+    vm->exception = exc;
     vm->flag_preemption = 2;
 
   } else {
@@ -178,13 +291,32 @@ void mrbc_raise( struct VM *vm, struct RClass *exc_cls, const char *msg )
   @param  vm		pointer to VM.
   @param  exc_cls	pointer to Exception class.
   @param  fstr		format string.
+  @note	If the format has only integer conversions, the message is not
+	rendered here. The format (must be in ROM) and the arguments are
+	kept in the exception, and rendered by message method.
 */
 void mrbc_raisef( struct VM *vm, struct RClass *exc_cls, const char *fstr, ... )
 {
-  static const int MESSAGE_INI_LEN = 32;
   va_list ap;
   va_start( ap, fstr );
 
+  int n_args = vm ? count_int_conversions( fstr ) : -1;
+  if( n_args > 0 ) {
+    mrbc_value exc = mrbc_exception_new( vm,
+			exc_cls ? exc_cls : MRBC_CLASS(RuntimeError), fstr, 0 );
+    if( exc.exception ) {
+      exc.exception->n_args = n_args;
+      for( int i = 0; i < MRBC_EXCEPTION_FORMAT_ARGS; i++ ) {
+	exc.exception->args[i] = (i < n_args) ? va_arg(ap, int) : 0;
+      }
+      mrbc_decref(&vm->exception);
+      vm->exception = exc;
+      vm->flag_preemption = 2;
+      va_end( ap );
+      return;
+    }
+  }
+
   char *buf = 0;
   if( vm ) buf = mrbc_alloc( vm, MESSAGE_INI_LEN );
 
@@ -196,8 +328,10 @@ void mrbc_raisef( struct VM *vm, struct RClass *exc_cls, const char *fstr, ... )
 			buf, strlen(buf) );
     vm->flag_preemption = 2;
 
+  } else if( vm ) {
+    raise_no_memory_error( vm );
+
   } else {
-    // VM == NULL or ENOMEM
     mrbc_printf("Exception: ");
     mrbc_vprintf( fstr, ap );
     mrbc_printf(" (%s)\n", exc_cls ? mrbc_symid_to_str(exc_cls->sym_id) : "RuntimeError");
@@ -207,6 +341,24 @@ void mrbc_raisef( struct VM *vm, struct RClass *exc_cls, const char *fstr, ... )
 }
 
 
+//================================================================
+/*! display exception message, or class name if no message.
+
+  @param  exc	pointer to exception.
+*/
+void mrbc_print_exception_message( const mrbc_exception *exc )
+{
+  if( !exc->message ) {
+    mrbc_print( mrbc_symid_to_str(exc->cls->sym_id) );
+  } else if( exc->n_args ) {
+    mrbc_printf( (const char *)exc->message,
+		 exc->args[0], exc->args[1], exc->args[2] );
+  } else {
+    mrbc_print( (const char *)exc->message );
+  }
+}
+
+
 //================================================================
 /*! display exception
 
@@ -217,10 +369,10 @@ void mrbc_print_exception( const mrbc_value *v )
   if( mrbc_type(*v) != MRBC_TT_EXCEPTION ) return;
 
   const mrbc_exception *exc = v->exception;
-  const char *clsname = mrbc_symid_to_str(exc->cls->sym_id);
 
-  mrbc_printf("Exception: %s (%s)\n",
-	      exc->message ? (const char *)exc->message : clsname, clsname );
+  mrbc_print("Exception: ");
+  mrbc_print_exception_message( exc );
+  mrbc_printf(" (%s)\n", mrbc_symid_to_str(exc->cls->sym_id) );
 }
 
 
@@ -240,8 +392,9 @@ void mrbc_print_vm_exception( const struct VM *vm )
   if( exc->method_id ) {
     mrbc_printf(" in `%s':", mrbc_symid_to_str(exc->method_id) );
   }
-  mrbc_printf(" %s (%s)\n",
-	      exc->message ? (const char *)exc->message : clsname, clsname );
+  mrbc_print(" ");
+  mrbc_print_exception_message( exc );
+  mrbc_printf(" (%s)\n", clsname );
 
   for( int i = 0; i < MRBC_EXCEPTION_CALL_NEST_LEVEL; i++ ) {
     if( !exc->call_nest[i] ) return;
@@ -278,10 +431,16 @@ static void c_exception_message(struct VM *vm, mrbc_value v[], int argc)
 {
   mrbc_value value;
 
-  if( v[0].exception->message ) {
+  if( v[0].exception->n_args ) {
+    char *buf = exception_render_message( vm, v[0].exception );
+    if( !buf ) return;		// ENOMEM
+    value = mrbc_string_new_alloc( vm, buf, strlen(buf) );
+    if( !value.string ) mrbc_free( vm, buf );
+
+  } else if( v[0].exception->message ) {
     value = mrbc_string_new( vm, v[0].exception->message, v[0].exception->message_size );
   } else {
-    value = mrbc_string_new_cstr(vm, mrbc_symid_to_str(v->exception->cls->sym_id));
+    value = mrbc_string_new_symbol(vm, v->exception->cls->sym_id);
   }
 
   mrbc_decref( &v[0] );
@@ -294,6 +453,7 @@ static void c_exception_message(struct VM *vm, mrbc_value v[], int argc)
     Exception
       NoMemoryError
       NotImplementedError
+      SystemStackError
       StandardError
         ArgumentError
         IndexError
@@ -318,6 +478,9 @@ static void c_exception_message(struct VM *vm, mrbc_value v[], int argc)
   CLASS("NotImplementedError")
   SUPER("Exception")
 
+  CLASS("SystemStackError")
+  SUPER("Exception")
+
   CLASS("StandardError")
   SUPER("Exception")
 
@@ -32,6 +32,14 @@ extern "C" {
 #define MRBC_EXCEPTION_CALL_NEST_LEVEL 8
 #endif
 
+//! number of freed exception objects kept for reuse. (0 to disable)
+#if !defined(MRBC_EXCEPTION_SPARE_COUNT)
+#define MRBC_EXCEPTION_SPARE_COUNT 2
+#endif
+
+//! max number of integer arguments of a lazily formatted message.
+#define MRBC_EXCEPTION_FORMAT_ARGS 3
+
 
 /***** Macros ***************************************************************/
 #define mrbc_israised(vm) (mrbc_type((vm)->exception) == MRBC_TT_EXCEPTION)
@@ -50,7 +58,9 @@ typedef struct RException {
   struct RClass *cls;		//!< exception class.
   mrbc_sym method_id;		//!< raised method, if it is known.
   uint16_t message_size;	//!< message length.
+  uint8_t n_args;		//!< >0: message is a format string. (lazy)
   const uint8_t *message;	//!< to heap or ROM.
+  int args[MRBC_EXCEPTION_FORMAT_ARGS];	//!< arguments of the format string.
   mrbc_sym call_nest[MRBC_EXCEPTION_CALL_NEST_LEVEL];
 
 } mrbc_exception;
@@ -62,6 +72,7 @@ mrbc_value mrbc_exception_new_alloc(struct VM *vm, struct RClass *exc_cls, const
 void mrbc_exception_delete(mrbc_value *value);
 void mrbc_raise(struct VM *vm, struct RClass *exc_cls, const char *msg);
 void mrbc_raisef(struct VM *vm, struct RClass *exc_cls, const char *fstr, ...);
+void mrbc_print_exception_message(const mrbc_exception *exc);
 void mrbc_print_exception(const mrbc_value *v);
 void mrbc_print_vm_exception(const struct VM *vm);
 
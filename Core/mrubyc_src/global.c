@@ -31,9 +31,14 @@
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
 static mrbc_kv_handle handle_const;	//!< for global(Object) constants.
-static mrbc_kv_handle handle_global;	//!< for global variables.
+static mrbc_kv_handle handle_global;	//!< for global variables. (unsorted)
 
 /***** Global variables *****************************************************/
+#if defined(MRBC_USE_CONST_CACHE)
+//! constant cache generation. incremented whenever a constant is set.
+uint32_t mrbc_const_cache_epoch;
+#endif
+
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
 /***** Global functions *****************************************************/
@@ -60,6 +65,9 @@ int mrbc_set_const( mrbc_sym sym_id, mrbc_value *v )
   if( mrbc_kv_get( &handle_const, sym_id ) != NULL ) {
     mrbc_printf("warning: already initialized constant.\n");
   }
+#if defined(MRBC_USE_CONST_CACHE)
+  mrbc_const_cache_epoch++;
+#endif
 
   return mrbc_kv_set( &handle_const, sym_id, v );
 }
@@ -128,7 +136,13 @@ mrbc_value * mrbc_get_class_const( const struct RClass *cls, mrbc_sym sym_id )
 */
 int mrbc_set_global( mrbc_sym sym_id, mrbc_value *v )
 {
-  return mrbc_kv_set( &handle_global, sym_id, v );
+  int slot = mrbc_get_global_slot( sym_id );
+  if( slot < 0 ) {
+    return mrbc_kv_append( &handle_global, sym_id, v );
+  }
+
+  mrbc_set_global_by_slot( slot, v );
+  return 0;
 }
 
 
@@ -140,7 +154,54 @@ int mrbc_set_global( mrbc_sym sym_id, mrbc_value *v )
 */
 mrbc_value * mrbc_get_global( mrbc_sym sym_id )
 {
-  return mrbc_kv_get( &handle_global, sym_id );
+  int slot = mrbc_get_global_slot( sym_id );
+  if( slot < 0 ) return 0;
+
+  return mrbc_get_global_by_slot( slot );
+}
+
+
+//================================================================
+/*! get the slot number of global variable.
+
+  Global variables are appended in first assignment order and never
+  removed, so the slot number of a variable never changes.
+
+  @param  sym_id	symbol ID.
+  @return		slot number, or -1 if not defined.
+*/
+int mrbc_get_global_slot( mrbc_sym sym_id )
+{
+  for( int i = 0; i < handle_global.n_stored; i++ ) {
+    if( handle_global.data[i].sym_id == sym_id ) return i;
+  }
+
+  return -1;
+}
+
+
+//================================================================
+/*! getter global variable by slot number.
+
+  @param  slot		slot number. see mrbc_get_global_slot()
+  @return		pointer to mrbc_value.
+*/
+mrbc_value * mrbc_get_global_by_slot( int slot )
+{
+  return &handle_global.data[slot].value;
+}
+
+
+//================================================================
+/*! setter global variable by slot number.
+
+  @param  slot		slot number. see mrbc_get_global_slot()
+  @param  v		pointer to mrbc_value.
+*/
+void mrbc_set_global_by_slot( int slot, mrbc_value *v )
+{
+  mrbc_decref( &handle_global.data[slot].value );
+  handle_global.data[slot].value = *v;
 }
 
 
@@ -26,6 +26,10 @@ extern "C" {
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
 /***** Global variables *****************************************************/
+#if defined(MRBC_USE_CONST_CACHE)
+extern uint32_t mrbc_const_cache_epoch;
+#endif
+
 /***** Function prototypes **************************************************/
 void mrbc_init_global(void);
 int mrbc_set_const(mrbc_sym sym_id, mrbc_value *v);
@@ -34,6 +38,9 @@ mrbc_value *mrbc_get_const(mrbc_sym sym_id);
 mrbc_value *mrbc_get_class_const(const struct RClass *cls, mrbc_sym sym_id);
 int mrbc_set_global(mrbc_sym sym_id, mrbc_value *v);
 mrbc_value *mrbc_get_global(mrbc_sym sym_id);
+int mrbc_get_global_slot(mrbc_sym sym_id);
+mrbc_value *mrbc_get_global_by_slot(int slot);
+void mrbc_set_global_by_slot(int slot, mrbc_value *v);
 void mrbc_global_clear_vm_id(void);
 void mrbc_debug_dump_const(void);
 void mrbc_debug_dump_global(void);
@@ -6,14 +6,119 @@
 #define MRBC_TICK_UNIT 1
 #define MRBC_TIMESLICE_TICK_COUNT 10
 
+#if defined(MRBC_ALLOC_EVENT_LOG) || defined(MRBC_TASK_STATS) || \
+    defined(MRBC_PROFILE) || defined(MRBC_PROFILE_CALLS) || \
+    defined(MRBC_CFUNC_LATENCY) || defined(MRBC_BENCH_FIRMWARE) || \
+    defined(MRBC_SCHED_EVENT_LOG) || defined(MRBC_DEFERRED_QUEUE_SIZE)
+// start the DWT cycle counter for allocation event latency, task stats,
+// the profilers, the benchmark mode, the scheduler events and the
+// deferred call latency.
+#define hal_init()        (CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk, \
+                           DWT->CYCCNT = 0, \
+                           DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk)
+#define hal_event_tick()  HAL_GetTick()
+#define hal_cycle_count() (DWT->CYCCNT)
+#define hal_cycles_per_us() (SystemCoreClock / 1000000)
+#else
 #define hal_init()        ((void)0)
+#endif
 #define hal_enable_irq()  __enable_irq()
 #define hal_disable_irq() __disable_irq()
 //#define hal_idle_cpu()    ((void)0)
 //#define hal_idle_cpu()    HAL_PWR_EnterSTOPMode(PWR_MAINREGULATOR_ON,PWR_STOPENTRY_WFI)
 #define hal_idle_cpu()    HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI)
 //#define hal_idle_cpu()    HAL_PWR_EnterSLEEPMode(PWR_LOWPOWERREGULATOR_ON, PWR_SLEEPENTRY_WFI)
+#define hal_irq_number()  ((int)__get_IPSR() - 16)
+//#define hal_watchdog_kick() HAL_IWDG_Refresh(&hiwdg)	// with IWDG enabled.
 
+// set *p to new_val if it is old_val, by LDREX/STREX. non zero if set.
+static inline int hal_cas_word(volatile int *p, int old_val, int new_val)
+{
+  do {
+    if( (int)__LDREXW( (volatile uint32_t *)p ) != old_val ) {
+      __CLREX();
+      return 0;
+    }
+  } while( __STREXW( new_val, (volatile uint32_t *)p ) );
+  __DMB();
+  return 1;
+}
+#define hal_compare_and_swap(p,old_val,new_val) hal_cas_word((p),(old_val),(new_val))
+
+
+// microseconds since the boot. (see start_mrubyc.c)
+uint64_t hal_monotonic_us(void);
+void hal_monotonic_update(void);
+
+#if defined(MRBC_TICKLESS_IDLE)
+// SysTick must keep running in the idle mode, so don't use STOP mode.
+uint32_t hal_idle_cpu_tickless(uint32_t ticks);
+#endif
+
+#if defined(MRBC_STACK_CHECK)
+// stack painting and the MPU guard below the stack. (see start_mrubyc.c)
+void hal_stack_check_init(void);
+unsigned int hal_stack_size(void);
+unsigned int hal_stack_max_used(void);
+void hal_stack_overflow(void) __attribute__((noreturn));
+#endif
+
+// HCLK is SYSCLK divided by 2^level. (see stm32f4_clock.c)
+// HCLK must be 14.2MHz or more for USB OTG FS.
+#if defined(MRBC_CONSOLE_USB_CDC)
+#define MRBC_CLOCK_LEVELS 3
+#else
+#define MRBC_CLOCK_LEVELS 4
+#endif
+void hal_clock_set_level(int level);
+int hal_clock_get_level(void);
+
+#if defined(MRBC_CONSOLE_ITM) || defined(MRBC_ALLOC_EVENT_ITM) || \
+    defined(MRBC_PROFILE_SAMPLE_ITM) || defined(MRBC_SCHED_EVENT_ITM)
+//================================================================
+/*! write to ITM stimulus port. (drop if the port is disabled)
+
+  Words are written at once, and the rest by bytes. The stimulus ports
+  used are
+    0: console (MRBC_CONSOLE_ITM)
+    1: allocation events (MRBC_ALLOC_EVENT_ITM)
+    2: profiler samples (MRBC_PROFILE_SAMPLE_ITM)
+    3: scheduler events (MRBC_SCHED_EVENT_ITM)
+*/
+static inline void hal_itm_write(int port, const void *buf, int nbytes)
+{
+  const uint8_t *p = buf;
+
+  if( !(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & (1UL << port)) ) return;
+  for( ; nbytes >= 4; nbytes -= 4, p += 4 ) {
+    uint32_t w = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    while( ITM->PORT[port].u32 == 0 ) {
+    }
+    ITM->PORT[port].u32 = w;
+  }
+  for( ; nbytes > 0; nbytes-- ) {
+    while( ITM->PORT[port].u32 == 0 ) {
+    }
+    ITM->PORT[port].u8 = *p++;
+  }
+}
+#endif
+#if defined(MRBC_ALLOC_EVENT_LOG) && defined(MRBC_ALLOC_EVENT_ITM)
+#define MRBC_ALLOC_EVENT_OUTPUT(ptr,size) hal_itm_write(1, (ptr), (size))
+#endif
+#if defined(MRBC_PROFILE_SAMPLING) && defined(MRBC_PROFILE_SAMPLE_ITM)
+#define MRBC_PROFILE_SAMPLE_OUTPUT(ptr,size) hal_itm_write(2, (ptr), (size))
+#endif
+#if defined(MRBC_SCHED_EVENT_LOG) && defined(MRBC_SCHED_EVENT_ITM)
+#define MRBC_SCHED_EVENT_OUTPUT(ptr,size) hal_itm_write(3, (ptr), (size))
+#endif
+
+#if defined(MRBC_PROFILE_SAMPLING)
+// TIM4 interrupts at the given rate and calls mrbc_profile_tick().
+// PWM on PB6 (TIM4_CH1) is not available while sampling.
+void hal_profile_timer_start(unsigned int hz);
+void hal_profile_timer_stop(void);
+#endif
 
 int hal_write(int fd, const void *buf, int nbytes);
 int hal_flush(int fd);
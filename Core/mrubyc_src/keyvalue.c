@@ -265,7 +265,6 @@ mrbc_value * mrbc_kv_get(mrbc_kv_handle *kvh, mrbc_sym sym_id)
 }
 
 
-#if 0
 //================================================================
 /*! setter - only append tail
 
@@ -301,7 +300,7 @@ int mrbc_kv_append(mrbc_kv_handle *kvh, mrbc_sym sym_id, mrbc_value *set_val)
 }
 
 
-
+#if 0
 static int compare_key( const void *kv1, const void *kv2 )
 {
   return ((mrbc_kv *)kv1)->sym_id - ((mrbc_kv *)kv2)->sym_id;
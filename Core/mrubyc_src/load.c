@@ -29,6 +29,7 @@
 #include "error.h"
 #include "c_string.h"
 #include "load.h"
+#include "opcode.h"
 
 
 /***** Constat values *******************************************************/
@@ -40,6 +41,9 @@ static const int SIZE_RITE_SECTION_HEADER = 12;
 static const int SIZE_RITE_CATCH_HANDLER = 13;
 static const char IREP[4] = "IREP";
 static const char END[4] = "END\0";
+#if defined(MRBC_USE_IREP_IMAGE)
+static const char IMAGE_MAGIC[4] = "MRBI";
+#endif
 
 
 /*! IREP TT */
@@ -52,10 +56,127 @@ enum irep_pool_type {
 };
 
 
+#if defined(MRBC_USE_MOVE_ELISION) || defined(MRBC_VERIFY_BYTECODE)
+//! operand types. (see opcode.h)
+enum opcode_operand_type {
+  OPR_Z, OPR_B, OPR_BB, OPR_BBB, OPR_BS, OPR_BSS, OPR_S, OPR_W,
+};
+
+//! operand type of each opcode.
+static const uint8_t OPCODE_OPERAND_TYPE[] = {
+  OPR_Z, OPR_BB, OPR_BB, OPR_BB, OPR_BB, OPR_B, OPR_B, OPR_B, OPR_B, OPR_B,
+  OPR_B, OPR_B, OPR_B, OPR_B, OPR_BS, OPR_BSS, OPR_BB, OPR_B, OPR_B, OPR_B,
+  OPR_B, OPR_BB, OPR_BB, OPR_BB, OPR_BB, OPR_BB, OPR_BB, OPR_BB, OPR_BB,
+  OPR_BB, OPR_BB, OPR_BB, OPR_BB, OPR_BBB, OPR_BBB, OPR_B, OPR_B, OPR_S,
+  OPR_BS, OPR_BS, OPR_BS, OPR_S, OPR_B, OPR_BB, OPR_B, OPR_BBB, OPR_BBB,
+  OPR_BBB, OPR_BBB, OPR_Z, OPR_BB, OPR_BS, OPR_W, OPR_BB, OPR_Z, OPR_BB,
+  OPR_B, OPR_B, OPR_B, OPR_BS, OPR_B, OPR_BB, OPR_B, OPR_BB, OPR_B, OPR_B,
+  OPR_B, OPR_B, OPR_B, OPR_B, OPR_B, OPR_BB, OPR_BBB, OPR_B, OPR_BB, OPR_B,
+  OPR_BBB, OPR_BBB, OPR_BBB, OPR_B, OPR_BB, OPR_BB, OPR_B, OPR_BB, OPR_BB,
+  OPR_B, OPR_BB, OPR_BB, OPR_BB, OPR_B, OPR_B, OPR_B, OPR_BB, OPR_BB, OPR_BB,
+  OPR_BB, OPR_BB, OPR_B, OPR_B, OPR_B, OPR_BBB, OPR_B, OPR_Z, OPR_Z, OPR_Z,
+  OPR_Z
+};
+
+//! instruction length of each operand type, including opcode.
+static const uint8_t OPERAND_TYPE_LEN[] = { 1, 2, 3, 4, 4, 6, 3, 4 };
+#endif
+
+#if defined(MRBC_USE_MOVE_ELISION)
+//! number of instructions to look ahead for the overwrite of R[b].
+#define MOVE_ELISION_WINDOW 4
+#endif
+
+#if defined(MRBC_VERIFY_BYTECODE)
+//! meaning of the operand, checked by the verifier.
+enum opcode_operand_role {
+  ROLE_NUM,	//!< number, not checked.
+  ROLE_REG,	//!< register, less than nregs.
+  ROLE_SYM,	//!< index of the symbols.
+  ROLE_POOL,	//!< index of the pool.
+  ROLE_IREP,	//!< index of the child ireps.
+  ROLE_JUMP,	//!< offset from the next instruction.
+};
+#define ROLE(a, b)	((a) | (b) << 4)
+#define R_		ROLE_REG
+
+//! roles of the operand a and b of each opcode. (c is always a number)
+static const uint8_t OPCODE_OPERAND_ROLE[] = {
+  [OP_MOVE] = ROLE(R_, R_),		[OP_LOADL] = ROLE(R_, ROLE_POOL),
+  [OP_LOADI] = R_,	[OP_LOADINEG] = R_,	[OP_LOADI__1] = R_,
+  [OP_LOADI_0] = R_,	[OP_LOADI_1] = R_,	[OP_LOADI_2] = R_,
+  [OP_LOADI_3] = R_,	[OP_LOADI_4] = R_,	[OP_LOADI_5] = R_,
+  [OP_LOADI_6] = R_,	[OP_LOADI_7] = R_,	[OP_LOADI16] = R_,
+  [OP_LOADI32] = R_,	[OP_LOADSYM] = ROLE(R_, ROLE_SYM),
+  [OP_LOADNIL] = R_,	[OP_LOADSELF] = R_,	[OP_LOADT] = R_,
+  [OP_LOADF] = R_,
+  [OP_GETGV] = ROLE(R_, ROLE_SYM),	[OP_SETGV] = ROLE(R_, ROLE_SYM),
+  [OP_GETSV] = ROLE(R_, ROLE_SYM),	[OP_SETSV] = ROLE(R_, ROLE_SYM),
+  [OP_GETIV] = ROLE(R_, ROLE_SYM),	[OP_SETIV] = ROLE(R_, ROLE_SYM),
+  [OP_GETCV] = ROLE(R_, ROLE_SYM),	[OP_SETCV] = ROLE(R_, ROLE_SYM),
+  [OP_GETCONST] = ROLE(R_, ROLE_SYM),	[OP_SETCONST] = ROLE(R_, ROLE_SYM),
+  [OP_GETMCNST] = ROLE(R_, ROLE_SYM),	[OP_SETMCNST] = ROLE(R_, ROLE_SYM),
+  [OP_GETUPVAR] = R_,	[OP_SETUPVAR] = R_,
+  [OP_GETIDX] = R_,	[OP_SETIDX] = R_,
+  [OP_JMP] = ROLE_JUMP,			[OP_JMPIF] = ROLE(R_, ROLE_JUMP),
+  [OP_JMPNOT] = ROLE(R_, ROLE_JUMP),	[OP_JMPNIL] = ROLE(R_, ROLE_JUMP),
+  [OP_JMPUW] = ROLE_JUMP,
+  [OP_EXCEPT] = R_,	[OP_RESCUE] = ROLE(R_, R_),	[OP_RAISEIF] = R_,
+  [OP_SSEND] = ROLE(R_, ROLE_SYM),	[OP_SSENDB] = ROLE(R_, ROLE_SYM),
+  [OP_SEND] = ROLE(R_, ROLE_SYM),	[OP_SENDB] = ROLE(R_, ROLE_SYM),
+  [OP_SUPER] = R_,	[OP_ARGARY] = R_,
+  [OP_KEY_P] = ROLE(R_, ROLE_SYM),	[OP_KARG] = ROLE(R_, ROLE_SYM),
+  [OP_RETURN] = R_,	[OP_RETURN_BLK] = R_,	[OP_BREAK] = R_,
+  [OP_BLKPUSH] = R_,
+  [OP_ADD] = R_,	[OP_ADDI] = R_,		[OP_SUB] = R_,
+  [OP_SUBI] = R_,	[OP_MUL] = R_,		[OP_DIV] = R_,
+  [OP_EQ] = R_,		[OP_LT] = R_,		[OP_LE] = R_,
+  [OP_GT] = R_,		[OP_GE] = R_,
+  [OP_ARRAY] = R_,	[OP_ARRAY2] = ROLE(R_, R_),	[OP_ARYCAT] = R_,
+  [OP_ARYPUSH] = R_,	[OP_ARYDUP] = R_,	[OP_AREF] = ROLE(R_, R_),
+  [OP_ASET] = ROLE(R_, R_),	[OP_APOST] = R_,	[OP_INTERN] = R_,
+  [OP_SYMBOL] = ROLE(R_, ROLE_POOL),	[OP_STRING] = ROLE(R_, ROLE_POOL),
+  [OP_STRCAT] = R_,	[OP_HASH] = R_,		[OP_HASHADD] = R_,
+  [OP_HASHCAT] = R_,
+  [OP_LAMBDA] = ROLE(R_, ROLE_IREP),	[OP_BLOCK] = ROLE(R_, ROLE_IREP),
+  [OP_METHOD] = ROLE(R_, ROLE_IREP),
+  [OP_RANGE_INC] = R_,	[OP_RANGE_EXC] = R_,	[OP_OCLASS] = R_,
+  [OP_CLASS] = ROLE(R_, ROLE_SYM),	[OP_MODULE] = ROLE(R_, ROLE_SYM),
+  [OP_EXEC] = ROLE(R_, ROLE_IREP),	[OP_DEF] = ROLE(R_, ROLE_SYM),
+  [OP_ALIAS] = ROLE(ROLE_SYM, ROLE_SYM),	[OP_UNDEF] = ROLE_SYM,
+  [OP_SCLASS] = R_,	[OP_TCLASS] = R_,	[OP_ERR] = ROLE_POOL,
+  [OP_STOP] = 0,
+};
+#undef R_
+#endif
+
+
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
+#if defined(MRBC_USE_SYMID_CACHE)
+/*!@brief
+  Interned symbol IDs of a RITE binary.
+*/
+typedef struct SYMID_CACHE {
+  const uint8_t *bytecode;	//!< RITE binary. (key)
+  uint32_t size;		//!< binary size in the RITE header.
+  const mrbc_sym *syms;		//!< sym_id and ivar sym_id pairs, in load order.
+  int n_syms;			//!< number of symbols.
+} SYMID_CACHE;
+#endif
+
+
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
+#if defined(MRBC_USE_SYMID_CACHE)
+static SYMID_CACHE symid_cache[MRBC_SYMID_CACHE_SIZE];
+static const mrbc_sym *symid_cache_rd;	//!< read position while loading.
+static unsigned int symid_cache_evict( unsigned int size );
+static mrbc_alloc_cache symid_cache_entry_ =
+  MRBC_ALLOC_CACHE_INITIALIZER("symid", 10, symid_cache_evict);
+#endif
+
+
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
@@ -96,6 +217,319 @@ static int load_header(struct VM *vm, const uint8_t *bin)
 }
 
 
+//================================================================
+/*! size of the tables following the child irep table.
+
+  @param  irep	pointer to irep. (clen and ilen are used)
+  @return	size in bytes, padded to pointer size.
+*/
+static int irep_tail_size( const mrbc_irep *irep )
+{
+  int siz = sizeof(mrbc_irep_catch_handler) * irep->clen;	// tbl_catch
+#if defined(MRBC_USE_POOL_VALUE)
+  siz += sizeof(mrbc_value) * irep->plen;			// tbl_pool_values
+#endif
+#if defined(MRBC_USE_MOVE_ELISION)
+  siz += irep->ilen / 8 + 1;					// tbl_move_elision
+#endif
+
+  return (siz + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+
+#if defined(MRBC_USE_MOVE_ELISION) || defined(MRBC_VERIFY_BYTECODE)
+//================================================================
+/*! get the instruction length.
+
+  @param  inst	pointer to instruction.
+  @return	length in bytes, or 0 if unknown opcode.
+*/
+static int inst_length( const uint8_t *inst )
+{
+  int ext = 0;
+  int len = 0;
+
+  if( OP_EXT1 <= *inst && *inst <= OP_EXT3 ) {
+    ext = *inst++ - OP_EXT1 + 1;
+    len = 1;
+  }
+  if( *inst >= sizeof(OPCODE_OPERAND_TYPE) ) return 0;
+
+  int type = OPCODE_OPERAND_TYPE[*inst];
+  len += OPERAND_TYPE_LEN[type];
+  if( (ext & 1) && OPR_B <= type && type <= OPR_BSS ) len++;
+  if( (ext & 2) && (type == OPR_BB || type == OPR_BBB) ) len++;
+
+  return len;
+}
+#endif
+
+
+#if defined(MRBC_USE_MOVE_ELISION)
+//================================================================
+/*! get the destination register of a simple load instruction.
+
+  A simple load writes only R[a], reads at most one register, and
+  never raises an exception nor calls any method.
+
+  @param  inst	pointer to instruction.
+  @param  src	returns the register number read, or -1.
+  @return	destination register number, or -1 if not a simple load.
+*/
+static int simple_load_dest( const uint8_t *inst, int *src )
+{
+  *src = -1;
+
+  switch( inst[0] ) {
+  case OP_MOVE:		*src = inst[2];	return inst[1];
+  case OP_LOADSELF:	*src = 0;	return inst[1];
+
+  case OP_LOADI:    case OP_LOADINEG: case OP_LOADI__1: case OP_LOADI_0:
+  case OP_LOADI_1:  case OP_LOADI_2:  case OP_LOADI_3:  case OP_LOADI_4:
+  case OP_LOADI_5:  case OP_LOADI_6:  case OP_LOADI_7:  case OP_LOADI16:
+  case OP_LOADI32:  case OP_LOADSYM:  case OP_LOADNIL:  case OP_LOADT:
+  case OP_LOADF:
+    return inst[1];
+  }
+
+  return -1;
+}
+
+
+//================================================================
+/*! make the move elision table of the irep.
+
+  An OP_MOVE can steal R[b] without refcount update, if R[b] is
+  overwritten by simple loads in a straight line before it is read.
+  No jump, send or exception can happen in between, so nothing else
+  can see R[b].
+
+  @param  irep	pointer to irep.
+*/
+static void make_move_elision_table( mrbc_irep *irep )
+{
+  uint8_t *tbl = mrbc_irep_tbl_move_elision(irep);
+  const uint8_t *p = irep->inst;
+  const uint8_t *end = p + irep->ilen;
+
+  memset( tbl, 0, irep->ilen / 8 + 1 );
+
+  while( p < end ) {
+    int len = inst_length( p );
+    if( len == 0 ) return;	// unknown opcode.
+
+    int b = p[2];
+    if( p[0] == OP_MOVE && b != 0 && b != p[1] ) {
+      const uint8_t *p1 = p + len;
+      for( int i = 0; i < MOVE_ELISION_WINDOW && p1 < end; i++ ) {
+	int src;
+	int dst = simple_load_dest( p1, &src );
+	if( dst < 0 || src == b ) break;
+	if( dst == b ) {
+	  uint32_t ofs = p + len - irep->inst;	// offset of next instruction.
+	  tbl[ofs >> 3] |= 1 << (ofs & 7);
+	  break;
+	}
+	p1 += inst_length( p1 );
+      }
+    }
+
+    p += len;
+  }
+}
+#endif
+
+#if defined(MRBC_VERIFY_BYTECODE)
+//================================================================
+/*! decode the operands of the instruction.
+
+  @param  inst	pointer to instruction.
+  @param  opr	returns the operand a, b and c.
+  @return	opcode.
+*/
+static int decode_operands( const uint8_t *inst, uint32_t opr[3] )
+{
+  int ext = 0;
+  if( OP_EXT1 <= *inst && *inst <= OP_EXT3 ) ext = *inst++ - OP_EXT1 + 1;
+
+  int op = *inst++;
+  int type = OPCODE_OPERAND_TYPE[op];
+  opr[0] = opr[1] = opr[2] = 0;
+
+  switch( type ) {
+  case OPR_Z:
+    break;
+
+  case OPR_S:
+    opr[0] = bin_to_uint16(inst);
+    break;
+
+  case OPR_W:
+    opr[0] = (uint32_t)inst[0] << 16 | inst[1] << 8 | inst[2];
+    break;
+
+  default:
+    if( ext & 1 ) { opr[0] = bin_to_uint16(inst); inst += 2; }
+    else opr[0] = *inst++;
+    if( type == OPR_B ) break;
+
+    if( type == OPR_BS || type == OPR_BSS ) {
+      opr[1] = bin_to_uint16(inst);
+      if( type == OPR_BSS ) opr[2] = bin_to_uint16(inst + 2);
+      break;
+    }
+    if( ext & 2 ) { opr[1] = bin_to_uint16(inst); inst += 2; }
+    else opr[1] = *inst++;
+    if( type == OPR_BBB ) opr[2] = *inst;
+  }
+
+  return op;
+}
+
+
+//================================================================
+/*! check that the offset is at the start of an instruction.
+
+  @param  inst	pointer to the verified instructions.
+  @param  ofs	offset from inst.
+  @return	non-zero if ok.
+*/
+static int is_inst_boundary( const uint8_t *inst, uint32_t ofs )
+{
+  uint32_t i = 0;
+  while( i < ofs ) {
+    i += inst_length( inst + i );
+  }
+  return i == ofs;
+}
+
+
+//================================================================
+/*! verify one irep record and its children.
+
+  @param  bin	pointer to the irep record.
+  @param  end	end of the IREP section.
+  @param  next	returns the pointer to the next record.
+  @return	NULL if no error, or the error message.
+*/
+static const char * verify_irep( const uint8_t *bin, const uint8_t *end,
+				 const uint8_t **next )
+{
+  if( end - bin < 16 ) return "truncated irep";
+  uint32_t rec_size = bin_to_uint32(bin);
+  if( rec_size < 16 || rec_size > (uint32_t)(end - bin) ) return "irep size";
+  const uint8_t *rec_end = bin + rec_size;
+
+  uint32_t nregs = bin_to_uint16(bin + 6);
+  uint32_t rlen = bin_to_uint16(bin + 8);
+  uint32_t clen = bin_to_uint16(bin + 10);
+  uint32_t ilen = bin_to_uint32(bin + 12);
+  const uint8_t *inst = bin + 16;
+  const uint8_t *p = inst;
+
+  // instructions, catch handlers, pool and symbols in the record.
+  if( ilen > (uint32_t)(rec_end - p) ) return "iseq size";
+  p += ilen;
+  if( SIZE_RITE_CATCH_HANDLER * clen + 2 > (uint32_t)(rec_end - p) ) return "catch handler size";
+  const uint8_t *p_catch = p;
+  p += SIZE_RITE_CATCH_HANDLER * clen;
+
+  uint32_t plen = bin_to_uint16(p);	p += 2;
+  for( uint32_t i = 0; i < plen; i++ ) {
+    if( p >= rec_end ) return "pool size";
+    uint32_t siz;
+    switch( *p++ ) {
+    case IREP_TT_STR:
+    case IREP_TT_SSTR:
+      if( rec_end - p < 2 ) return "pool size";
+      siz = bin_to_uint16(p) + 3;
+      if( siz > (uint32_t)(rec_end - p) || p[siz-1] != 0 ) return "pool string";
+      break;
+    case IREP_TT_INT32:	siz = 4;	break;
+    case IREP_TT_INT64:
+    case IREP_TT_FLOAT:	siz = 8;	break;
+    default:		return "pool type";
+    }
+    if( siz > (uint32_t)(rec_end - p) ) return "pool size";
+    p += siz;
+  }
+
+  if( rec_end - p < 2 ) return "symbol size";
+  uint32_t slen = bin_to_uint16(p);	p += 2;
+  for( uint32_t i = 0; i < slen; i++ ) {
+    if( rec_end - p < 2 ) return "symbol size";
+    uint32_t siz = bin_to_uint16(p) + 1;	p += 2;
+    if( siz > (uint32_t)(rec_end - p) || p[siz-1] != 0 ) return "symbol string";
+    p += siz;
+  }
+
+  // opcodes and lengths.
+  uint32_t ofs = 0;
+  int op = OP_NOP;
+  while( ofs < ilen ) {
+    op = inst[ofs];
+    if( OP_EXT1 <= op && op <= OP_EXT3 ) {
+      if( ofs + 1 >= ilen ) return "truncated instruction";
+      op = inst[ofs + 1];
+    }
+    if( op >= sizeof(OPCODE_OPERAND_TYPE) ||
+	(OP_EXT1 <= op && op <= OP_EXT3) ) return "unknown opcode";
+    int len = inst_length( inst + ofs );
+    if( len > ilen - ofs ) return "truncated instruction";
+    ofs += len;
+  }
+  switch( op ) {
+  case OP_RETURN: case OP_RETURN_BLK: case OP_BREAK: case OP_STOP:
+  case OP_JMP: case OP_JMPUW: case OP_RAISEIF:
+    break;
+  default:
+    return "no return at the end";
+  }
+
+  // operands.
+  for( ofs = 0; ofs < ilen; ofs += inst_length( inst + ofs ) ) {
+    uint32_t opr[3];
+    op = decode_operands( inst + ofs, opr );
+    int roles = OPCODE_OPERAND_ROLE[op];
+
+    for( int i = 0; i < 2; i++, roles >>= 4 ) {
+      uint32_t n = opr[i];
+      switch( roles & 0x0f ) {
+      case ROLE_REG:	if( n >= nregs ) return "register index";	break;
+      case ROLE_SYM:	if( n >= slen ) return "symbol index";		break;
+      case ROLE_POOL:	if( n >= plen ) return "pool index";		break;
+      case ROLE_IREP:	if( n >= rlen ) return "irep index";		break;
+      case ROLE_JUMP: {
+	uint32_t target = ofs + inst_length( inst + ofs ) + (int16_t)n;
+	if( target >= ilen || !is_inst_boundary( inst, target ) ) return "jump target";
+	break;
+      }
+      }
+    }
+  }
+
+  // catch handlers.
+  for( uint32_t i = 0; i < clen; i++, p_catch += SIZE_RITE_CATCH_HANDLER ) {
+    uint32_t begin = bin_to_uint32(p_catch + 1);
+    uint32_t end = bin_to_uint32(p_catch + 5);
+    uint32_t target = bin_to_uint32(p_catch + 9);
+    if( p_catch[0] > 1 || begin > end || end > ilen ||
+	target >= ilen || !is_inst_boundary( inst, target ) ) return "catch handler";
+  }
+
+  // children.
+  p = rec_end;
+  for( uint32_t i = 0; i < rlen; i++ ) {
+    const char *error = verify_irep( p, end, &p );
+    if( error ) return error;
+  }
+
+  *next = p;
+  return NULL;
+}
+#endif
+
+
 //================================================================
 /*! read one irep section.
 
@@ -177,13 +611,20 @@ static mrbc_irep * load_irep_1(struct VM *vm, const uint8_t *bin, int *len, int
 
   // num of symbols, offset of tbl_ireps.
   irep.slen = bin_to_uint16(p);		p += 2;
-  int siz = sizeof(mrbc_sym) * irep.slen + sizeof(uint16_t) * irep.plen;
+  int siz = sizeof(mrbc_sym) * irep.slen * 2 + sizeof(uint16_t) * irep.plen;
+#if defined(MRBC_USE_IVAR_SHAPE)
+  siz += irep.slen;			// tbl_ivslots
+#endif
   siz += (-siz & 0x03);	// padding. 32bit align.
   irep.ofs_ireps = siz >> 2;
 
   // allocate new irep
   mrbc_irep *p_irep;
   siz = sizeof(mrbc_irep) + siz + sizeof(mrbc_irep*) * irep.rlen;
+#if defined(MRBC_LAZY_IREP)
+  siz += sizeof(uint8_t *) * irep.rlen;		// tbl_irep_bins
+#endif
+  siz += irep_tail_size( &irep );		// tbl_catch, etc.
   if( vm->vm_id == 0 && !flag_top ) {
     p_irep = mrbc_raw_alloc_no_free( siz );
   } else {
@@ -195,8 +636,46 @@ static mrbc_irep * load_irep_1(struct VM *vm, const uint8_t *bin, int *len, int
   }
   *p_irep = irep;
 
-  // make a sym_id table.
+  // make a decoded catch handler table, sorted by begin address.
+  // (insertion sort, keeps the original order of the same begin.)
+  mrbc_irep_catch_handler *tbl_catch =
+    (mrbc_irep_catch_handler *)mrbc_irep_tbl_catch(p_irep);
+  const uint8_t *p_catch = irep.inst + irep.ilen;
+  for( int i = 0; i < irep.clen; i++ ) {
+    mrbc_irep_catch_handler handler = {
+      .type = p_catch[0],
+      .begin = bin_to_uint32(p_catch + 1),
+      .end = bin_to_uint32(p_catch + 5),
+      .target = bin_to_uint32(p_catch + 9),
+    };
+    p_catch += SIZE_RITE_CATCH_HANDLER;
+
+    int j;
+    for( j = i; j > 0 && tbl_catch[j-1].begin > handler.begin; j-- ) {
+      tbl_catch[j] = tbl_catch[j-1];
+    }
+    tbl_catch[j] = handler;
+  }
+
+#if defined(MRBC_USE_MOVE_ELISION)
+  make_move_elision_table( p_irep );
+#endif
+
+  // make a sym_id table and the instance variable's one.
   mrbc_sym *tbl_syms = mrbc_irep_tbl_syms(p_irep);
+  mrbc_sym *tbl_ivsyms = mrbc_irep_tbl_ivsyms(p_irep);
+#if defined(MRBC_USE_IVAR_SHAPE)
+  memset( mrbc_irep_tbl_ivslots(p_irep), 0xff, irep.slen );	// not cached.
+#endif
+#if defined(MRBC_USE_SYMID_CACHE)
+  if( symid_cache_rd ) {
+    for( int i = 0; i < irep.slen; i++ ) {
+      *tbl_syms++ = *symid_cache_rd++;
+      *tbl_ivsyms++ = *symid_cache_rd++;
+      p += bin_to_uint16(p) + 3;	// length, string and '\0'.
+    }
+  } else
+#endif
   for( int i = 0; i < irep.slen; i++ ) {
     int siz = bin_to_uint16(p) + 1;	p += 2;
     char *sym_str;
@@ -212,11 +691,25 @@ static mrbc_irep * load_irep_1(struct VM *vm, const uint8_t *bin, int *len, int
       return NULL;
     }
     *tbl_syms++ = sym;
+
+    if( sym_str[0] == '@' && sym_str[1] != '@' ) {
+      sym = mrbc_str_to_symid( sym_str+1 );	// skip '@'
+      if( sym < 0 ) {
+	mrbc_raise(vm, MRBC_CLASS(Exception), "Overflow MAX_SYMBOLS_COUNT");
+	return NULL;
+      }
+    } else {
+      sym = -1;
+    }
+    *tbl_ivsyms++ = sym;
     p += (siz);
   }
 
   // make a pool data's offset table.
   uint16_t *ofs_pools = mrbc_irep_tbl_pools(p_irep);
+#if defined(MRBC_USE_POOL_VALUE)
+  mrbc_value *pool_values = mrbc_irep_tbl_pool_values(p_irep);
+#endif
   p = p_irep->pool + 2;
   for( int i = 0; i < irep.plen; i++ ) {
     int siz = 0;
@@ -225,13 +718,29 @@ static mrbc_irep * load_irep_1(struct VM *vm, const uint8_t *bin, int *len, int
       return NULL;
     }
     *ofs_pools++ = (uint16_t)(p - irep.pool);
-    switch( *p++ ) {
+    int tt = *p++;
+    switch( tt ) {
     case IREP_TT_STR:
     case IREP_TT_SSTR:	siz = bin_to_uint16(p) + 3;	break;
     case IREP_TT_INT32:	siz = 4;	break;
     case IREP_TT_INT64:
     case IREP_TT_FLOAT:	siz = 8;	break;
     }
+
+#if defined(MRBC_USE_POOL_VALUE)
+    // decode the numbers now, the strings are made by OP_STRING each time.
+    mrbc_value *pv = pool_values++;
+    pv->tt = MRBC_TT_EMPTY;
+    switch( tt ) {
+    case IREP_TT_INT32:	mrbc_set_integer(pv, bin_to_uint32(p));		break;
+#if MRBC_USE_FLOAT
+    case IREP_TT_FLOAT:	mrbc_set_float(pv, bin_to_double64(p));		break;
+#endif
+#if defined(MRBC_INT64)
+    case IREP_TT_INT64:	mrbc_set_integer(pv, bin_to_int64(p));		break;
+#endif
+    }
+#endif
     p += siz;
   }
 
@@ -241,6 +750,26 @@ static mrbc_irep * load_irep_1(struct VM *vm, const uint8_t *bin, int *len, int
 }
 
 
+#if defined(MRBC_LAZY_IREP)
+//================================================================
+/*! get the length of irep record including its children.
+
+  @param  bin	A pointer to RITE ISEQ.
+  @return	length in bytes.
+*/
+static int skip_irep( const uint8_t *bin )
+{
+  int rlen = bin_to_uint16(bin + 8);	// skip record size, nlocals, nregs.
+  int total_len = bin_to_uint32(bin);
+
+  for( int i = 0; i < rlen; i++ ) {
+    total_len += skip_irep( bin + total_len );
+  }
+  return total_len;
+}
+#endif
+
+
 //================================================================
 /*! Load IREP section.
 
@@ -258,19 +787,345 @@ static mrbc_irep *load_irep(struct VM *vm, const uint8_t *bin, int *len)
 
   mrbc_irep **tbl_ireps = mrbc_irep_tbl_ireps(irep);
   int i;
+#if defined(MRBC_LAZY_IREP)
+  // only remember where the child records are.
+  const uint8_t **tbl_bins = mrbc_irep_tbl_irep_bins(irep);
+  for( i = 0; i < irep->rlen; i++ ) {
+    tbl_ireps[i] = NULL;
+    tbl_bins[i] = bin + total_len;
+    total_len += skip_irep( bin + total_len );
+  }
+#else
   for( i = 0; i < irep->rlen; i++ ) {
     tbl_ireps[i] = load_irep(vm, bin + total_len, &len1);
     if( ! tbl_ireps[i] ) return NULL;
     total_len += len1;
   }
+#endif
 
   if( len ) *len = total_len;
   return irep;
 }
 
 
+#if defined(MRBC_USE_SYMID_CACHE)
+//================================================================
+/*! find the symbol ID cache of the RITE binary.
+
+  @param  vm	Pointer to VM.
+  @param  bin	Pointer to RITE binary.
+  @return	Pointer to cache entry or NULL.
+*/
+static const SYMID_CACHE * symid_cache_find( const struct VM *vm, const uint8_t *bin )
+{
+  if( vm->flag_permanence ) return 0;	// bytecode in temporary buffer.
+
+  for( int i = 0; i < MRBC_SYMID_CACHE_SIZE; i++ ) {
+    if( symid_cache[i].bytecode == bin &&
+	symid_cache[i].size == bin_to_uint32( bin + 8 ) ) {
+      return &symid_cache[i];
+    }
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! release the symbol ID caches, at the out of memory.
+
+  @param  size	request size. (not used)
+  @return	released bytes.
+*/
+static unsigned int symid_cache_evict( unsigned int size )
+{
+  if( symid_cache_rd ) return 0;	// in use.
+
+  unsigned int released = 0;
+  for( int i = 0; i < MRBC_SYMID_CACHE_SIZE; i++ ) {
+    if( !symid_cache[i].bytecode ) continue;
+
+    released += sizeof(mrbc_sym) * 2 * symid_cache[i].n_syms;
+    mrbc_raw_free( (void *)symid_cache[i].syms );
+    symid_cache[i].bytecode = 0;
+  }
+  return released;
+}
+
+
+//================================================================
+/*! count symbols in the irep tree.
+*/
+static int symid_cache_count( const mrbc_irep *irep )
+{
+  int n = irep->slen;
+
+  for( int i = 0; i < irep->rlen; i++ ) {
+    n += symid_cache_count( mrbc_irep_child_irep(irep, i) );
+  }
+  return n;
+}
+
+
+//================================================================
+/*! copy symbol IDs of the irep tree, in load order.
+*/
+static mrbc_sym * symid_cache_copy( const mrbc_irep *irep, mrbc_sym *p )
+{
+  for( int i = 0; i < irep->slen; i++ ) {
+    *p++ = mrbc_irep_symbol_id( irep, i );
+    *p++ = mrbc_irep_ivar_symbol_id( irep, i );
+  }
+
+  for( int i = 0; i < irep->rlen; i++ ) {
+    p = symid_cache_copy( mrbc_irep_child_irep(irep, i), p );
+  }
+  return p;
+}
+
+
+//================================================================
+/*! add the symbol IDs of the loaded RITE binary to the cache.
+
+  @param  vm	Pointer to VM which loaded the binary.
+  @param  bin	Pointer to RITE binary.
+*/
+static void symid_cache_add( const struct VM *vm, const uint8_t *bin )
+{
+  if( vm->flag_permanence ) return;
+
+  for( int i = 0; i < MRBC_SYMID_CACHE_SIZE; i++ ) {
+    if( symid_cache[i].bytecode ) continue;
+
+    int n = symid_cache_count( vm->top_irep );
+    if( n == 0 ) return;
+    // the symbols are kept, but the cache can be released at ENOMEM.
+    mrbc_sym *syms = mrbc_raw_alloc( sizeof(mrbc_sym) * 2 * n );
+    if( !syms ) return;
+    mrbc_alloc_register_cache( &symid_cache_entry_ );
+
+    symid_cache_copy( vm->top_irep, syms );
+    symid_cache[i].bytecode = bin;
+    symid_cache[i].size = bin_to_uint32( bin + 8 );
+    symid_cache[i].syms = syms;
+    symid_cache[i].n_syms = n;
+    return;
+  }
+}
+#endif
+
+
+#if defined(MRBC_USE_IREP_IMAGE)
+//================================================================
+/*! calculate the checksum of RITE binary.
+*/
+static uint32_t image_checksum( const uint8_t *bytecode )
+{
+  uint32_t size = bin_to_uint32( bytecode + 8 );	// total size in header.
+  uint32_t sum = 0;
+
+  for( uint32_t i = 0; i < size; i++ ) {
+    sum = (sum << 1 | sum >> 31) + bytecode[i];
+  }
+  return sum;
+}
+
+
+//================================================================
+/*! size of the irep without child table.
+*/
+static int image_irep_size( const mrbc_irep *irep )
+{
+  return sizeof(mrbc_irep) + irep->ofs_ireps * 4;
+}
+
+
+//================================================================
+/*! size of the irep tree.
+*/
+static int image_tree_size( const mrbc_irep *irep )
+{
+  int siz = image_irep_size(irep) + sizeof(mrbc_irep *) * irep->rlen
+	  + irep_tail_size(irep);
+
+  for( int i = 0; i < irep->rlen; i++ ) {
+    siz += image_tree_size( mrbc_irep_child_irep(irep, i) );
+  }
+  return siz;
+}
+
+
+//================================================================
+/*! write the irep tree, relocating the child pointers to addr.
+*/
+static int image_write_tree( const mrbc_irep *irep, uintptr_t addr,
+			     mrbc_irep_image_writer writer, void *ctx )
+{
+  int siz = image_irep_size(irep);
+  if( writer( ctx, irep, siz ) != 0 ) return -1;
+
+  int tail_siz = irep_tail_size(irep);
+  uintptr_t child = addr + siz + sizeof(mrbc_irep *) * irep->rlen + tail_siz;
+  for( int i = 0; i < irep->rlen; i++ ) {
+    const mrbc_irep *p = (const mrbc_irep *)child;
+    if( writer( ctx, &p, sizeof(p) ) != 0 ) return -1;
+    child += image_tree_size( mrbc_irep_child_irep(irep, i) );
+  }
+
+  // catch handlers, etc.
+  if( writer( ctx, mrbc_irep_tbl_catch(irep), tail_siz ) != 0 ) return -1;
+
+  child = addr + siz + sizeof(mrbc_irep *) * irep->rlen + tail_siz;
+  for( int i = 0; i < irep->rlen; i++ ) {
+    const mrbc_irep *p = mrbc_irep_child_irep(irep, i);
+    if( image_write_tree( p, child, writer, ctx ) != 0 ) return -1;
+    child += image_tree_size( p );
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! Load an IREP image.
+
+  @param  vm		Pointer to VM.
+  @param  image		Pointer to IREP image.
+  @return int		zero if no error.
+
+  The symbols are registered again in the same order. If they do not
+  get the same IDs, or the RITE binary was changed, the image is ignored
+  and the original bytecode is loaded as usual.
+*/
+static int load_image( struct VM *vm, const mrbc_irep_image *image )
+{
+  if( image_checksum( image->bytecode ) != image->checksum ) goto FALLBACK;
+
+  for( int i = 0; i < image->n_syms; i++ ) {
+    if( mrbc_str_to_symid( image->syms[i] ) != image->sym_base + i ) {
+      goto FALLBACK;
+    }
+  }
+
+  vm->top_irep = (mrbc_irep *)image->top_irep;
+  vm->flag_irep_image = 1;
+  return 0;
+
+ FALLBACK:
+  return mrbc_load_mrb( vm, image->bytecode );
+}
+
+
+//================================================================
+/*! Build an IREP image of the loaded bytecode.
+
+  @param  vm		Pointer to VM which loaded the bytecode.
+  @param  bytecode	Pointer to the RITE binary, placed at a fixed address.
+  @param  sym_base	mrbc_symbol_count() before loading the bytecode.
+  @param  image_addr	Address where the image will be placed.
+  @param  writer	Function to write the image sequentially.
+  @param  ctx		Parameter for writer.
+  @return int		size of the image, or negative value if error.
+
+  <pre>
+  (usage)
+  int sym_base = mrbc_symbol_count();
+  mrbc_tcb *tcb = mrbc_create_task( bytecode, 0 );
+  mrbc_irep_image_build( &tcb->vm, bytecode, sym_base, addr, writer, ctx );
+
+  After that, mrbc_create_task( addr, 0 ) runs the image in place,
+  when the same symbols are registered in the same order before.
+  </pre>
+*/
+int mrbc_irep_image_build( const struct VM *vm, const void *bytecode,
+			   int sym_base, uintptr_t image_addr,
+			   mrbc_irep_image_writer writer, void *ctx )
+{
+  if( vm->flag_irep_image || !vm->top_irep ) return -1;
+
+  const uint8_t *bin = bytecode;
+  uint32_t bin_size = bin_to_uint32( bin + 8 );
+  int n_syms = mrbc_symbol_count() - sym_base;
+  if( n_syms < 0 ) return -1;
+
+  // symbol strings must be in the bytecode, not in heap.
+  for( int i = 0; i < n_syms; i++ ) {
+    const uint8_t *s = (const uint8_t *)mrbc_symid_to_str( sym_base + i );
+    if( s < bin || s >= bin + bin_size ) return -1;
+  }
+
+  int hdr_size = sizeof(mrbc_irep_image) + sizeof(const char *) * n_syms;
+  mrbc_irep_image image = {
+    .size = hdr_size + image_tree_size( vm->top_irep ),
+    .bytecode = bin,
+    .checksum = image_checksum( bin ),
+    .sym_base = sym_base,
+    .n_syms = n_syms,
+    .top_irep = (const mrbc_irep *)(image_addr + hdr_size),
+  };
+  memcpy( image.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC) );
+
+  if( writer( ctx, &image, sizeof(image) ) != 0 ) return -1;
+  for( int i = 0; i < n_syms; i++ ) {
+    const char *s = mrbc_symid_to_str( sym_base + i );
+    if( writer( ctx, &s, sizeof(s) ) != 0 ) return -1;
+  }
+  if( image_write_tree( vm->top_irep, image_addr + hdr_size, writer, ctx ) != 0 ) {
+    return -1;
+  }
+
+  return image.size;
+}
+#endif
+
+
 /***** Global functions *****************************************************/
 
+#if defined(MRBC_VERIFY_BYTECODE)
+//================================================================
+/*! Verify the VM bytecode. (full .mrb file)
+
+  Checks the structure of the RITE binary without loading it: sizes,
+  opcodes, register, symbol, pool and irep indices, jump targets and
+  catch handlers. So the VM can run it without the bounds checks.
+
+  @param  bytecode	Pointer to bytecode.
+  @param  size		size of the buffer.
+  @return		NULL if no error, or the error message.
+*/
+const char * mrbc_verify_mrb(const void *bytecode, uint32_t size)
+{
+  const uint8_t *bin = bytecode;
+
+  if( size < SIZE_RITE_BINARY_HEADER ||
+      memcmp(bin, RITE, sizeof(RITE)) != 0 ||
+      memcmp(bin + sizeof(RITE), RITE_VERSION, sizeof(RITE_VERSION)) != 0 ) {
+    return "illegal header";
+  }
+  uint32_t total = bin_to_uint32(bin + 8);
+  if( total < SIZE_RITE_BINARY_HEADER || total > size ) return "binary size";
+
+  const uint8_t *end = bin + total;
+  const uint8_t *p = bin + SIZE_RITE_BINARY_HEADER;
+  while( 1 ) {
+    if( end - p < 8 ) return "no END section";
+    uint32_t sec_size = bin_to_uint32(p + 4);
+    if( sec_size < 8 || sec_size > (uint32_t)(end - p) ) return "section size";
+
+    if( memcmp(p, IREP, sizeof(IREP)) == 0 ) {
+      if( sec_size < SIZE_RITE_SECTION_HEADER ) return "section size";
+      const uint8_t *next;
+      const char *error = verify_irep( p + SIZE_RITE_SECTION_HEADER, p + sec_size, &next );
+      if( error ) return error;
+
+    } else if( memcmp(p, END, sizeof(END)) == 0 ) {
+      return NULL;
+    }
+    p += sec_size;
+  }
+}
+#endif
+
+
 //================================================================
 /*! Load the VM bytecode. (full .mrb file)
 
@@ -283,12 +1138,39 @@ int mrbc_load_mrb(struct VM *vm, const void *bytecode)
   const uint8_t *bin = bytecode;
 
   vm->exception = mrbc_nil_value();
+  vm->flag_irep_image = 0;
+#if defined(MRBC_USE_IREP_IMAGE)
+  if( memcmp(bin, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0 ) {
+    return load_image( vm, bytecode );
+  }
+#endif
   if( load_header(vm, bin) != 0 ) return -1;
 
+#if defined(MRBC_USE_SYMID_CACHE)
+  const SYMID_CACHE *cache = symid_cache_find( vm, bin );
+  int n_irep_section = 0;
+#endif
+#if defined(MRBC_VERIFY_BYTECODE)
+  // verify once. the cached bytecode has been verified when loaded.
+#if defined(MRBC_USE_SYMID_CACHE)
+  if( !cache )
+#endif
+  {
+    const char *error = mrbc_verify_mrb( bin, bin_to_uint32(bin + 8) );
+    if( error ) {
+      mrbc_raisef( vm, MRBC_CLASS(Exception), "Illegal bytecode (%s).", error );
+      return -1;
+    }
+  }
+#endif
   bin += SIZE_RITE_BINARY_HEADER;
 
   while( 1 ) {
     if( memcmp(bin, IREP, sizeof(IREP)) == 0 ) {
+#if defined(MRBC_USE_SYMID_CACHE)
+      symid_cache_rd = (cache && n_irep_section == 0) ? cache->syms : 0;
+      n_irep_section++;
+#endif
       if( mrbc_load_irep( vm, bin ) != 0 ) break;
 
     } else if( memcmp(bin, END, sizeof(END)) == 0 ) {
@@ -299,10 +1181,33 @@ int mrbc_load_mrb(struct VM *vm, const void *bytecode)
     bin += bin_to_uint32(bin+4);	// add section size, to next section.
   }
 
+#if defined(MRBC_USE_SYMID_CACHE)
+  symid_cache_rd = 0;
+  if( !cache && n_irep_section == 1 && !mrbc_israised(vm) ) {
+    symid_cache_add( vm, bytecode );
+  }
+#endif
+
   return mrbc_israised(vm);
 }
 
 
+#if defined(MRBC_USE_SYMID_CACHE)
+//================================================================
+/*! Clear the symbol ID cache.
+
+  Must be called when the symbol table is cleared.
+*/
+void mrbc_cleanup_symid_cache(void)
+{
+  symid_cache_rd = 0;
+  symid_cache_evict( 0 );
+  memset( symid_cache, 0, sizeof(symid_cache) );
+  symid_cache_rd = 0;
+}
+#endif
+
+
 //================================================================
 /*! Load the IREP section.
 
@@ -321,6 +1226,58 @@ int mrbc_load_irep(struct VM *vm, const void *bytecode)
 }
 
 
+#if defined(MRBC_LAZY_IREP)
+//================================================================
+/*! register depth of the irep record tree, not loaded yet.
+
+  @param  bin	A pointer to RITE ISEQ.
+  @return	number of registers.
+*/
+static int bin_regs_depth( const uint8_t *bin )
+{
+  int nregs = bin_to_uint16(bin + 6);	// skip record size, nlocals.
+  int rlen = bin_to_uint16(bin + 8);
+  const uint8_t *p = bin + bin_to_uint32(bin);
+  int max = 0;
+
+  for( int i = 0; i < rlen; i++ ) {
+    int n = bin_regs_depth( p );
+    if( max < n ) max = n;
+    p += skip_irep( p );
+  }
+  return nregs + max;
+}
+#endif
+
+
+//================================================================
+/*! estimate the number of registers used by the irep tree.
+
+  Sum of nregs along the deepest nesting of child ireps (blocks and
+  methods). Calls between the methods are not counted.
+
+  @param  irep	Pointer to top irep.
+  @return	number of registers.
+*/
+int mrbc_irep_regs_depth(const struct IREP *irep)
+{
+  int max = 0;
+
+  for( int i = 0; i < irep->rlen; i++ ) {
+    const mrbc_irep *child = mrbc_irep_child_irep(irep, i);
+    int n;
+#if defined(MRBC_LAZY_IREP)
+    if( !child ) {
+      n = bin_regs_depth( mrbc_irep_tbl_irep_bins(irep)[i] );
+    } else
+#endif
+    n = mrbc_irep_regs_depth( child );
+    if( max < n ) max = n;
+  }
+  return irep->nregs + max;
+}
+
+
 
 //================================================================
 /*! release mrbc_irep holds memory
@@ -333,6 +1290,12 @@ void mrbc_irep_free(struct IREP *irep)
   mrbc_irep **tbl_ireps = mrbc_irep_tbl_ireps(irep);
   int i;
   for( i = 0; i < irep->rlen; i++ ) {
+#if defined(MRBC_LAZY_IREP)
+    if( !*tbl_ireps ) {		// not loaded.
+      tbl_ireps++;
+      continue;
+    }
+#endif
     mrbc_irep_free( *tbl_ireps++ );
   }
 
@@ -340,6 +1303,28 @@ void mrbc_irep_free(struct IREP *irep)
 }
 
 
+//================================================================
+/*! get a n'th child irep, and load it if not yet.
+
+  @param  vm		Pointer to VM.
+  @param  irep		Pointer to parent irep.
+  @param  n		n'th
+  @return		Pointer to child irep, or NULL if error.
+*/
+mrbc_irep *mrbc_irep_load_child(struct VM *vm, const mrbc_irep *irep, int n)
+{
+  mrbc_irep *child = mrbc_irep_child_irep(irep, n);
+#if defined(MRBC_LAZY_IREP)
+  if( !child ) {
+    int len;
+    child = load_irep( vm, mrbc_irep_tbl_irep_bins(irep)[n], &len );
+    mrbc_irep_tbl_ireps(irep)[n] = child;
+  }
+#endif
+  return child;
+}
+
+
 //================================================================
 /*! get a mrbc_value in irep pool.
 
@@ -359,7 +1344,12 @@ mrbc_value mrbc_irep_pool_value(struct VM *vm, int n)
   case IREP_TT_STR:
   case IREP_TT_SSTR: {
     int len = bin_to_uint16(p);
-    obj = mrbc_string_new( vm, p+2, len );
+    // refer to the literal in bytecode directly, if it stays there.
+    if( vm->flag_permanence ) {
+      obj = mrbc_string_new( vm, p+2, len );
+    } else {
+      obj = mrbc_string_new_literal( vm, p+2, len );
+    }
     break;
   }
 #endif
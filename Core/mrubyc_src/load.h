@@ -29,12 +29,47 @@ extern "C" {
 /***** Constat values *******************************************************/
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
+#if defined(MRBC_USE_IREP_IMAGE)
+//================================================================
+/*!@brief
+  IREP image header.
+
+  A fully resolved irep tree, which can be run in place. The image
+  is followed by the symbol string table and the ireps. Instructions
+  and pools still point to the original RITE binary.
+*/
+typedef struct IREP_IMAGE {
+  char magic[4];		//!< "MRBI"
+  uint32_t size;		//!< total size of the image in bytes.
+  const uint8_t *bytecode;	//!< RITE binary which the image was built from.
+  uint32_t checksum;		//!< checksum of the RITE binary.
+  uint16_t sym_base;		//!< symbol ID of the first entry of syms.
+  uint16_t n_syms;		//!< num of symbols registered by the loader.
+  const struct IREP *top_irep;	//!< top level irep.
+  const char *syms[];		//!< symbol strings, in registration order.
+} mrbc_irep_image;
+
+//! image writer. appends size bytes of data and returns 0 if no error.
+typedef int (*mrbc_irep_image_writer)(void *ctx, const void *data, int size);
+#endif
+
 /***** Global variables *****************************************************/
 /***** Function prototypes **************************************************/
 int mrbc_load_mrb(struct VM *vm, const void *bytecode);
+#if defined(MRBC_VERIFY_BYTECODE)
+const char *mrbc_verify_mrb(const void *bytecode, uint32_t size);
+#endif
 int mrbc_load_irep(struct VM *vm, const void *bytecode);
 void mrbc_irep_free(struct IREP *irep);
+struct IREP *mrbc_irep_load_child(struct VM *vm, const struct IREP *irep, int n);
 mrbc_value mrbc_irep_pool_value(struct VM *vm, int n);
+int mrbc_irep_regs_depth(const struct IREP *irep);
+#if defined(MRBC_USE_SYMID_CACHE)
+void mrbc_cleanup_symid_cache(void);
+#endif
+#if defined(MRBC_USE_IREP_IMAGE)
+int mrbc_irep_image_build(const struct VM *vm, const void *bytecode, int sym_base, uintptr_t image_addr, mrbc_irep_image_writer writer, void *ctx);
+#endif
 
 /***** Inline functions *****************************************************/
 
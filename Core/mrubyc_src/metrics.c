@@ -0,0 +1,378 @@
+/*! @file
+  @brief
+  mruby/c runtime metrics registry.
+
+  Counters and gauges are registered from C (mrbc_metric_register) and
+  from Ruby (VM.metric_add, VM.metric_set), and read at once by
+  mrbc_metrics_encode() in a compact binary record, for polling the
+  device health. Reading doesn't stop the VM, and can be done from an
+  interrupt handler.
+
+  (binary stats record, little endian)
+    magic(16) "MS", version(8), n(8), uptime_ms(32),
+    value(32) * n in the registered order,
+    sum(8), that makes the sum of all bytes 0.
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+//@cond
+#include "vm_config.h"
+#include <stdint.h>
+#include <string.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+#include "alloc.h"
+#include "value.h"
+#include "symbol.h"
+#include "class.h"
+#include "c_string.h"
+#include "c_hash.h"
+#include "vm.h"
+#include "metrics.h"
+#include "hal.h"
+
+#if defined(MRBC_METRICS)
+/***** Constat values *******************************************************/
+#if MRBC_METRICS_MAX > 255
+#error "MRBC_METRICS_MAX must be less than 256."
+#endif
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+/***** Function prototypes **************************************************/
+/***** Local variables ******************************************************/
+static mrbc_metric *metrics_head_;
+static mrbc_metric *metrics_tail_;
+static int n_metrics_;
+
+#if !defined(MRBC_ALLOC_LIBC)
+static uint32_t read_heap(const mrbc_metric *m);
+
+//! heap metrics, read from the counters of the allocator.
+static mrbc_metric heap_metrics_[] = {
+  MRBC_METRIC_READER("heap.used", MRBC_METRIC_GAUGE, read_heap, (void *)0),
+  MRBC_METRIC_READER("heap.peak", MRBC_METRIC_GAUGE, read_heap, (void *)1),
+  MRBC_METRIC_READER("heap.alloc_count", MRBC_METRIC_COUNTER, read_heap, (void *)2),
+  MRBC_METRIC_READER("heap.free_count", MRBC_METRIC_COUNTER, read_heap, (void *)3),
+};
+#endif
+
+
+/***** Global variables *****************************************************/
+/***** Signal catching functions ********************************************/
+/***** Local functions ******************************************************/
+//================================================================
+/*! put 32bit value in little endian.
+*/
+static uint8_t * put32(uint8_t *p, uint32_t v)
+{
+  *p++ = v;
+  *p++ = v >> 8;
+  *p++ = v >> 16;
+  *p++ = v >> 24;
+  return p;
+}
+
+
+#if !defined(MRBC_ALLOC_LIBC)
+//================================================================
+/*! read a heap metric.
+*/
+static uint32_t read_heap(const mrbc_metric *m)
+{
+  struct MRBC_ALLOC_STATISTICS st;
+  mrbc_alloc_counters( &st );
+
+  switch( (uintptr_t)m->arg ) {
+  case 0:  return st.used;
+  case 1:  return st.peak;
+  case 2:  return st.n_alloc;
+  default: return st.n_free;
+  }
+}
+#endif
+
+
+//================================================================
+/*! find or add a metric by Ruby.
+
+  @param  vm	pointer to VM.
+  @param  name	name in String or Symbol.
+  @param  type	MRBC_METRIC_* to add.
+  @return	pointer to metric, or NULL and an exception is raised.
+*/
+static mrbc_metric * metric_by_name(mrbc_vm *vm, const mrbc_value *name, int type)
+{
+  const char *s;
+
+  switch( mrbc_type(*name) ) {
+  case MRBC_TT_STRING:	s = mrbc_string_cstr(name);	break;
+  case MRBC_TT_SYMBOL:	s = mrbc_symbol_cstr(name);	break;
+  default:
+    mrbc_raise(vm, MRBC_CLASS(TypeError), 0);
+    return NULL;
+  }
+
+  mrbc_metric *m = mrbc_metric_find(s);
+  if( m ) return m;
+
+  // the registry lives as long as the memory pool.
+  int len = strlen(s) + 1;
+  m = mrbc_raw_alloc_no_free( sizeof(mrbc_metric) + len );
+  if( !m ) return NULL;		// ENOMEM
+
+  memset( m, 0, sizeof(mrbc_metric) );
+  memcpy( m + 1, s, len );
+  m->name = (const char *)(m + 1);
+  m->type = type;
+  m->flag_in_pool = 1;
+
+  if( mrbc_metric_register( m ) != 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(IndexError), "too many metrics");
+    return NULL;
+  }
+  return m;
+}
+
+
+//================================================================
+/*! (method) add to a counter
+
+  VM.metric_add( name, n = 1 )
+*/
+static void c_vm_metric_add(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  uint32_t n = 1;
+  if( argc >= 2 ) {
+    if( mrbc_type(v[2]) != MRBC_TT_INTEGER ) {
+      mrbc_raise(vm, MRBC_CLASS(TypeError), 0);
+      return;
+    }
+    n = mrbc_integer(v[2]);
+  }
+
+  mrbc_metric *m = metric_by_name( vm, &v[1], MRBC_METRIC_COUNTER );
+  if( !m ) return;
+  mrbc_metric_add( m, n );
+}
+
+
+//================================================================
+/*! (method) set a gauge
+
+  VM.metric_set( name, value )
+*/
+static void c_vm_metric_set(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc < 2 || mrbc_type(v[2]) != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  mrbc_metric *m = metric_by_name( vm, &v[1], MRBC_METRIC_GAUGE );
+  if( !m ) return;
+  mrbc_metric_set( m, mrbc_integer(v[2]) );
+}
+
+
+//================================================================
+/*! (method) all metrics
+
+  VM.metrics  # => {"name"=>Integer, ...}
+*/
+static void c_vm_metrics(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_value ret = mrbc_hash_new(vm, n_metrics_);
+  if( !ret.hash ) return;	// ENOMEM
+
+  for( mrbc_metric *m = metrics_head_; m != NULL; m = m->next ) {
+    mrbc_value key = mrbc_string_new_cstr(vm, m->name);
+    mrbc_value val = mrbc_integer_value( mrbc_metric_value(m) );
+    mrbc_hash_set( &ret, &key, &val );
+  }
+
+  SET_RETURN(ret);
+}
+
+
+/***** Global functions *****************************************************/
+//================================================================
+/*! initialize the registry.
+
+  The metrics registered from Ruby are removed, because they are in
+  the memory pool to be initialized. The static ones are kept.
+*/
+void mrbc_metrics_init(void)
+{
+  hal_disable_irq();
+
+  mrbc_metric **pp = &metrics_head_;
+  metrics_tail_ = NULL;
+  n_metrics_ = 0;
+  while( *pp ) {
+    if( (*pp)->flag_in_pool ) {
+      *pp = (*pp)->next;
+      continue;
+    }
+    metrics_tail_ = *pp;
+    n_metrics_++;
+    pp = &(*pp)->next;
+  }
+
+  hal_enable_irq();
+
+#if !defined(MRBC_ALLOC_LIBC)
+  for( int i = 0; i < sizeof(heap_metrics_)/sizeof(mrbc_metric); i++ ) {
+    mrbc_metric_register( &heap_metrics_[i] );
+  }
+#endif
+}
+
+
+//================================================================
+/*! register a metric.
+
+  @param  m	pointer to metric, that must be static.
+  @return	0 if no error, or already registered.
+*/
+int mrbc_metric_register(mrbc_metric *m)
+{
+  int ret = 0;
+  hal_disable_irq();
+
+  for( mrbc_metric *m1 = metrics_head_; m1 != NULL; m1 = m1->next ) {
+    if( m1 == m ) goto DONE;
+  }
+  if( n_metrics_ >= MRBC_METRICS_MAX ) {
+    ret = -1;
+    goto DONE;
+  }
+
+  m->next = NULL;
+  if( metrics_tail_ ) {
+    metrics_tail_->next = m;
+  } else {
+    metrics_head_ = m;
+  }
+  metrics_tail_ = m;
+  n_metrics_++;
+
+ DONE:
+  hal_enable_irq();
+  return ret;
+}
+
+
+//================================================================
+/*! find a metric by name.
+
+  @param  name	name.
+  @return	pointer to metric, or NULL.
+*/
+mrbc_metric * mrbc_metric_find(const char *name)
+{
+  for( mrbc_metric *m = metrics_head_; m != NULL; m = m->next ) {
+    if( strcmp( m->name, name ) == 0 ) return m;
+  }
+  return NULL;
+}
+
+
+//================================================================
+/*! get a metric by index in the registered order.
+
+  @param  idx	index.
+  @return	pointer to metric, or NULL.
+*/
+mrbc_metric * mrbc_metric_get(int idx)
+{
+  mrbc_metric *m;
+  for( m = metrics_head_; m != NULL && idx > 0; m = m->next ) {
+    idx--;
+  }
+  return m;
+}
+
+
+//================================================================
+/*! number of metrics.
+*/
+int mrbc_metrics_count(void)
+{
+  return n_metrics_;
+}
+
+
+//================================================================
+/*! read the value of a metric.
+
+  @param  m	pointer to metric.
+  @return	value.
+*/
+uint32_t mrbc_metric_value(const mrbc_metric *m)
+{
+  return m->read ? m->read(m) : m->value;
+}
+
+
+//================================================================
+/*! make the binary stats record.
+
+  @param  buf		output buffer.
+  @param  size		size of buffer.
+  @param  uptime_ms	time stamp of the record.
+  @return		length of the record, or -1 if buffer is short.
+  @note	This can be called from interrupt handler.
+*/
+int mrbc_metrics_encode(void *buf, int size, uint32_t uptime_ms)
+{
+  uint8_t *p = buf;
+  int n = n_metrics_;
+  int len = 8 + 4 * n + 1;
+  if( size < len ) return -1;
+
+  *p++ = MRBC_METRICS_MAGIC & 0xff;
+  *p++ = MRBC_METRICS_MAGIC >> 8;
+  *p++ = MRBC_METRICS_VERSION;
+  *p++ = n;
+
+  p = put32( p, uptime_ms );
+  mrbc_metric *m = metrics_head_;
+  for( int i = 0; i < n; i++, m = m->next ) {
+    p = put32( p, mrbc_metric_value(m) );
+  }
+
+  uint8_t sum = 0;
+  for( uint8_t *p1 = buf; p1 < p; p1++ ) {
+    sum += *p1;
+  }
+  *p = -sum;
+
+  return len;
+}
+
+
+//================================================================
+/*! initialize the Ruby methods.
+
+  @param  cls	class VM.
+*/
+void mrbc_init_class_metrics(struct RClass *cls)
+{
+  mrbc_define_method(0, cls, "metric_add", c_vm_metric_add);
+  mrbc_define_method(0, cls, "metric_set", c_vm_metric_set);
+  mrbc_define_method(0, cls, "metrics", c_vm_metrics);
+}
+
+#endif // defined(MRBC_METRICS)
@@ -0,0 +1,111 @@
+/*! @file
+  @brief
+  mruby/c runtime metrics registry.
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef MRBC_SRC_METRICS_H_
+#define MRBC_SRC_METRICS_H_
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+//@cond
+#include <stdint.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/***** Constat values *******************************************************/
+//! maximum number of metrics, that fits a binary stats record.
+#if !defined(MRBC_METRICS_MAX)
+#define MRBC_METRICS_MAX 32
+#endif
+
+//! type of metric.
+enum {
+  MRBC_METRIC_COUNTER = 'c',	//!< increases only.
+  MRBC_METRIC_GAUGE = 'g',	//!< current value.
+};
+
+//! magic and version of the binary stats record.
+#define MRBC_METRICS_MAGIC	0x534d	// "MS"
+#define MRBC_METRICS_VERSION	1
+
+
+/***** Typedefs *************************************************************/
+/*!@brief
+  Metric.
+
+  The value is read by read() if it is given, at each polling.
+  read() must be short and safe in interrupt handler.
+*/
+typedef struct mrbc_metric {
+  const char *name;		//!< name, such as "uart2.rx_bytes".
+  uint8_t type;			//!< MRBC_METRIC_*
+  uint8_t flag_in_pool;		//!< allocated in the memory pool.
+  volatile uint32_t value;	//!< current value.
+  uint32_t (*read)(const struct mrbc_metric *m);	//!< or NULL.
+  const void *arg;		//!< argument for read().
+  struct mrbc_metric *next;	//!< next entry in the registry.
+} mrbc_metric;
+
+//! initializer of a static metric.
+#define MRBC_METRIC_INITIALIZER(name, type) { (name), (type) }
+#define MRBC_METRIC_READER(name, type, read, arg) \
+  { (name), (type), 0, 0, (read), (arg) }
+
+
+/***** Global variables *****************************************************/
+/***** Function prototypes **************************************************/
+void mrbc_metrics_init(void);
+int mrbc_metric_register(mrbc_metric *m);
+mrbc_metric *mrbc_metric_find(const char *name);
+int mrbc_metrics_count(void);
+uint32_t mrbc_metric_value(const mrbc_metric *m);
+int mrbc_metrics_encode(void *buf, int size, uint32_t uptime_ms);
+mrbc_metric *mrbc_metric_get(int idx);
+struct RClass;
+void mrbc_init_class_metrics(struct RClass *cls);
+
+
+/***** Inline functions *****************************************************/
+//================================================================
+/*! add to a counter.
+
+  @param  m	pointer to metric.
+  @param  n	value to add.
+  @note	A metric should be updated from one context, the task or
+	an interrupt handler, because this is not atomic.
+*/
+static inline void mrbc_metric_add(mrbc_metric *m, uint32_t n)
+{
+  m->value += n;
+}
+
+
+//================================================================
+/*! set a gauge.
+
+  @param  m	pointer to metric.
+  @param  v	value.
+*/
+static inline void mrbc_metric_set(mrbc_metric *m, uint32_t v)
+{
+  m->value = v;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
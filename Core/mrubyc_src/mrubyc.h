@@ -29,11 +29,14 @@
 #include "c_hash.h"
 #include "c_object.h"
 #include "c_numeric.h"
+#include "c_fixed.h"
 #include "c_range.h"
 #include "c_string.h"
 
 #include "load.h"
 #include "console.h"
 #include "rrt0.h"
+#include "metrics.h"
+#include "cycle.h"
 
 #endif
@@ -107,6 +107,12 @@ extern "C" {
 /*!@brief
   Operation codes.
 
+  OP(name, handler) defines OP_<name>, executed by op_<handler>() in vm.c.
+  EXTOP(name, n) defines the operand extension prefix OP_<name>, that
+  sets ext = n for the next instruction. The opcodes are numbered in this
+  order from 0x00, same as the mruby 3 bytecode. This list makes the enum
+  below, and the dispatch of mrbc_vm_run() and op_ext().
+
  operand types:
    Z: no operand
    B: 8bit	   (a)
@@ -117,118 +123,123 @@ extern "C" {
    S: 16bit	   (a)
    W: 24bit	   (a)
 */
+#define MRBC_OPCODE_LIST(OP, EXTOP) \
+  OP( NOP,        nop         ) /* Z    no operation */                                                        \
+  OP( MOVE,       move        ) /* BB   R[a] = R[b] */                                                         \
+  OP( LOADL,      loadl       ) /* BB   R[a] = Pool[b] */                                                      \
+  OP( LOADI,      loadi       ) /* BB   R[a] = mrb_int(b) */                                                   \
+  OP( LOADINEG,   loadineg    ) /* BB   R[a] = mrb_int(-b) */                                                  \
+  OP( LOADI__1,   loadi_n     ) /* B    R[a] = mrb_int(-1) */                                                  \
+  OP( LOADI_0,    loadi_n     ) /* B    R[a] = mrb_int(0) */                                                   \
+  OP( LOADI_1,    loadi_n     ) /* B    R[a] = mrb_int(1) */                                                   \
+  OP( LOADI_2,    loadi_n     ) /* B    R[a] = mrb_int(2) */                                                   \
+  OP( LOADI_3,    loadi_n     ) /* B    R[a] = mrb_int(3) */                                                   \
+  OP( LOADI_4,    loadi_n     ) /* B    R[a] = mrb_int(4) */                                                   \
+  OP( LOADI_5,    loadi_n     ) /* B    R[a] = mrb_int(5) */                                                   \
+  OP( LOADI_6,    loadi_n     ) /* B    R[a] = mrb_int(6) */                                                   \
+  OP( LOADI_7,    loadi_n     ) /* B    R[a] = mrb_int(7) */                                                   \
+  OP( LOADI16,    loadi16     ) /* BS   R[a] = mrb_int(b) */                                                   \
+  OP( LOADI32,    loadi32     ) /* BSS  R[a] = mrb_int((b<<16)+c) */                                           \
+  OP( LOADSYM,    loadsym     ) /* BB   R[a] = Syms[b] */                                                      \
+  OP( LOADNIL,    loadnil     ) /* B    R[a] = nil */                                                          \
+  OP( LOADSELF,   loadself    ) /* B    R[a] = self */                                                         \
+  OP( LOADT,      loadt       ) /* B    R[a] = true */                                                         \
+  OP( LOADF,      loadf       ) /* B    R[a] = false */                                                        \
+  OP( GETGV,      getgv       ) /* BB   R[a] = getglobal(Syms[b]) */                                           \
+  OP( SETGV,      setgv       ) /* BB   setglobal(Syms[b], R[a]) */                                            \
+  OP( GETSV,      unsupported ) /* BB   R[a] = Special[Syms[b]] */                                             \
+  OP( SETSV,      unsupported ) /* BB   Special[Syms[b]] = R[a] */                                             \
+  OP( GETIV,      getiv       ) /* BB   R[a] = ivget(Syms[b]) */                                               \
+  OP( SETIV,      setiv       ) /* BB   ivset(Syms[b],R[a]) */                                                 \
+  OP( GETCV,      unsupported ) /* BB   R[a] = cvget(Syms[b]) */                                               \
+  OP( SETCV,      unsupported ) /* BB   cvset(Syms[b],R[a]) */                                                 \
+  OP( GETCONST,   getconst    ) /* BB   R[a] = constget(Syms[b]) */                                            \
+  OP( SETCONST,   setconst    ) /* BB   constset(Syms[b],R[a]) */                                              \
+  OP( GETMCNST,   getmcnst    ) /* BB   R[a] = R[a]::Syms[b] */                                                \
+  OP( SETMCNST,   unsupported ) /* BB   R[a+1]::Syms[b] = R[a] */                                              \
+  OP( GETUPVAR,   getupvar    ) /* BBB  R[a] = uvget(b,c) */                                                   \
+  OP( SETUPVAR,   setupvar    ) /* BBB  uvset(b,c,R[a]) */                                                     \
+  OP( GETIDX,     getidx      ) /* B    R[a] = R[a][R[a+1]] */                                                 \
+  OP( SETIDX,     setidx      ) /* B    R[a][R[a+1]] = R[a+2] */                                               \
+  OP( JMP,        jmp         ) /* S    pc+=a */                                                               \
+  OP( JMPIF,      jmpif       ) /* BS   if R[a] pc+=b */                                                       \
+  OP( JMPNOT,     jmpnot      ) /* BS   if !R[a] pc+=b */                                                      \
+  OP( JMPNIL,     jmpnil      ) /* BS   if R[a]==nil pc+=b */                                                  \
+  OP( JMPUW,      jmpuw       ) /* S    unwind_and_jump_to(a) */                                               \
+  OP( EXCEPT,     except      ) /* B    R[a] = exc */                                                          \
+  OP( RESCUE,     rescue      ) /* BB   R[b] = R[a].isa?(R[b]) */                                              \
+  OP( RAISEIF,    raiseif     ) /* B    raise(R[a]) if R[a] */                                                 \
+  OP( SSEND,      ssend       ) /* BBB  R[a] = self.send(Syms[b],R[a+1]..,R[a+n+1]:R[a+n+2]..) (c=n|k<<4) */   \
+  OP( SSENDB,     ssendb      ) /* BBB  R[a] = self.send(Syms[b],R[a+1]..,R[a+n+1]:R[a+n+2]..,&R[a+n+2k+1]) */ \
+  OP( SEND,       send        ) /* BBB  R[a] = R[a].send(Syms[b],R[a+1]..,R[a+n+1]:R[a+n+2]..) (c=n|k<<4) */   \
+  OP( SENDB,      sendb       ) /* BBB  R[a] = R[a].send(Syms[b],R[a+1]..,R[a+n+1]:R[a+n+2]..,&R[a+n+2k+1]) */ \
+  OP( CALL,       call        ) /* Z    R[0] = self.call(frame.argc, frame.argv) */                            \
+  OP( SUPER,      super       ) /* BB   R[a] = super(R[a+1],... ,R[a+b+1]) */                                  \
+  OP( ARGARY,     argary      ) /* BS   R[a] = argument array (16=m5:r1:m5:d1:lv4) */                          \
+  OP( ENTER,      enter       ) /* W    arg setup according to flags (23=m5:o5:r1:m5:k5:d1:b1) */              \
+  OP( KEY_P,      key_p       ) /* BB   R[a] = kdict.key?(Syms[b]) */                                          \
+  OP( KEYEND,     keyend      ) /* Z    raise unless kdict.empty? */                                           \
+  OP( KARG,       karg        ) /* BB   R[a] = kdict[Syms[b]]; kdict.delete(Syms[b]) */                        \
+  OP( RETURN,     return      ) /* B    return R[a] (normal) */                                                \
+  OP( RETURN_BLK, return_blk  ) /* B    return R[a] (in-block return) */                                       \
+  OP( BREAK,      break       ) /* B    break R[a] */                                                          \
+  OP( BLKPUSH,    blkpush     ) /* BS   R[a] = block (16=m5:r1:m5:d1:lv4) */                                   \
+  OP( ADD,        add         ) /* B    R[a] = R[a]+R[a+1] */                                                  \
+  OP( ADDI,       addi        ) /* BB   R[a] = R[a]+mrb_int(b) */                                              \
+  OP( SUB,        sub         ) /* B    R[a] = R[a]-R[a+1] */                                                  \
+  OP( SUBI,       subi        ) /* BB   R[a] = R[a]-mrb_int(b) */                                              \
+  OP( MUL,        mul         ) /* B    R[a] = R[a]*R[a+1] */                                                  \
+  OP( DIV,        div         ) /* B    R[a] = R[a]/R[a+1] */                                                  \
+  OP( EQ,         eq          ) /* B    R[a] = R[a]==R[a+1] */                                                 \
+  OP( LT,         lt          ) /* B    R[a] = R[a]<R[a+1] */                                                  \
+  OP( LE,         le          ) /* B    R[a] = R[a]<=R[a+1] */                                                 \
+  OP( GT,         gt          ) /* B    R[a] = R[a]>R[a+1] */                                                  \
+  OP( GE,         ge          ) /* B    R[a] = R[a]>=R[a+1] */                                                 \
+  OP( ARRAY,      array       ) /* BB   R[a] = ary_new(R[a],R[a+1]..R[a+b]) */                                 \
+  OP( ARRAY2,     array2      ) /* BBB  R[a] = ary_new(R[b],R[b+1]..R[b+c]) */                                 \
+  OP( ARYCAT,     arycat      ) /* B    ary_cat(R[a],R[a+1]) */                                                \
+  OP( ARYPUSH,    arypush     ) /* BB   ary_push(R[a],R[a+1]..R[a+b]) */                                       \
+  OP( ARYDUP,     arydup      ) /* B    R[a] = ary_dup(R[a]) */                                                \
+  OP( AREF,       aref        ) /* BBB  R[a] = R[b][c] */                                                      \
+  OP( ASET,       aset        ) /* BBB  R[b][c] = R[a] */                                                      \
+  OP( APOST,      apost       ) /* BBB  *R[a],R[a+1]..R[a+c] = R[a][b..] */                                    \
+  OP( INTERN,     intern      ) /* B    R[a] = intern(R[a]) */                                                 \
+  OP( SYMBOL,     symbol      ) /* BB   R[a] = intern(Pool[b]) */                                              \
+  OP( STRING,     string      ) /* BB   R[a] = str_dup(Pool[b]) */                                             \
+  OP( STRCAT,     strcat      ) /* B    str_cat(R[a],R[a+1]) */                                                \
+  OP( HASH,       hash        ) /* BB   R[a] = hash_new(R[a],R[a+1]..R[a+b*2-1]) */                            \
+  OP( HASHADD,    hashadd     ) /* BB   hash_push(R[a],R[a+1]..R[a+b*2]) */                                    \
+  OP( HASHCAT,    hashcat     ) /* B    R[a] = hash_cat(R[a],R[a+1]) */                                        \
+  OP( LAMBDA,     unsupported ) /* BB   R[a] = lambda(Irep[b],L_LAMBDA) */                                     \
+  OP( BLOCK,      method      ) /* BB   R[a] = lambda(Irep[b],L_BLOCK) */                                      \
+  OP( METHOD,     method      ) /* BB   R[a] = lambda(Irep[b],L_METHOD) */                                     \
+  OP( RANGE_INC,  range_inc   ) /* B    R[a] = range_new(R[a],R[a+1],FALSE) */                                 \
+  OP( RANGE_EXC,  range_exc   ) /* B    R[a] = range_new(R[a],R[a+1],TRUE) */                                  \
+  OP( OCLASS,     oclass      ) /* B    R[a] = ::Object */                                                     \
+  OP( CLASS,      class       ) /* BB   R[a] = newclass(R[a],Syms[b],R[a+1]) */                                \
+  OP( MODULE,     unsupported ) /* BB   R[a] = newmodule(R[a],Syms[b]) */                                      \
+  OP( EXEC,       exec        ) /* BB   R[a] = blockexec(R[a],Irep[b]) */                                      \
+  OP( DEF,        def         ) /* BB   R[a].newmethod(Syms[b],R[a+1]); R[a] = Syms[b] */                      \
+  OP( ALIAS,      alias       ) /* BB   alias_method(target_class,Syms[a],Syms[b]) */                          \
+  OP( UNDEF,      unsupported ) /* B    undef_method(target_class,Syms[a]) */                                  \
+  OP( SCLASS,     sclass      ) /* B    R[a] = R[a].singleton_class */                                         \
+  OP( TCLASS,     tclass      ) /* B    R[a] = target_class */                                                 \
+  OP( DEBUG,      unsupported ) /* BBB  print a,b,c */                                                         \
+  OP( ERR,        unsupported ) /* B    raise(LocalJumpError, Pool[a]) */                                      \
+  EXTOP( EXT1,    1           ) /* Z    make 1st operand (a) 16bit */                                          \
+  EXTOP( EXT2,    2           ) /* Z    make 2nd operand (b) 16bit */                                          \
+  EXTOP( EXT3,    3           ) /* Z    make 1st and 2nd operands 16bit */                                     \
+  OP( STOP,       stop        ) /* Z    stop VM */
+
 enum OPCODE {
-/*-----------------------------------------------------------------------
-  operation code        operands  semantics
-------------------------------------------------------------------------*/
-  OP_NOP        = 0x00, //!< Z    no operation
-  OP_MOVE       = 0x01, //!< BB   R[a] = R[b]
-  OP_LOADL      = 0x02, //!< BB   R[a] = Pool[b]
-  OP_LOADI      = 0x03, //!< BB   R[a] = mrb_int(b)
-  OP_LOADINEG   = 0x04, //!< BB   R[a] = mrb_int(-b)
-  OP_LOADI__1   = 0x05, //!< B    R[a] = mrb_int(-1)
-  OP_LOADI_0    = 0x06, //!< B    R[a] = mrb_int(0)
-  OP_LOADI_1    = 0x07, //!< B    R[a] = mrb_int(1)
-  OP_LOADI_2    = 0x08, //!< B    R[a] = mrb_int(2)
-  OP_LOADI_3    = 0x09, //!< B    R[a] = mrb_int(3)
-  OP_LOADI_4    = 0x0A, //!< B    R[a] = mrb_int(4)
-  OP_LOADI_5    = 0x0B, //!< B    R[a] = mrb_int(5)
-  OP_LOADI_6    = 0x0C, //!< B    R[a] = mrb_int(6)
-  OP_LOADI_7    = 0x0D, //!< B    R[a] = mrb_int(7)
-  OP_LOADI16    = 0x0E, //!< BS   R[a] = mrb_int(b)
-  OP_LOADI32    = 0x0F, //!< BSS  R[a] = mrb_int((b<<16)+c)
-  OP_LOADSYM    = 0x10, //!< BB   R[a] = Syms[b]
-  OP_LOADNIL    = 0x11, //!< B    R[a] = nil
-  OP_LOADSELF   = 0x12, //!< B    R[a] = self
-  OP_LOADT      = 0x13, //!< B    R[a] = true
-  OP_LOADF      = 0x14, //!< B    R[a] = false
-  OP_GETGV      = 0x15, //!< BB   R[a] = getglobal(Syms[b])
-  OP_SETGV      = 0x16, //!< BB   setglobal(Syms[b], R[a])
-  OP_GETSV      = 0x17, //!< BB   R[a] = Special[Syms[b]]
-  OP_SETSV      = 0x18, //!< BB   Special[Syms[b]] = R[a]
-  OP_GETIV      = 0x19, //!< BB   R[a] = ivget(Syms[b])
-  OP_SETIV      = 0x1A, //!< BB   ivset(Syms[b],R[a])
-  OP_GETCV      = 0x1B, //!< BB   R[a] = cvget(Syms[b])
-  OP_SETCV      = 0x1C, //!< BB   cvset(Syms[b],R[a])
-  OP_GETCONST   = 0x1D, //!< BB   R[a] = constget(Syms[b])
-  OP_SETCONST   = 0x1E, //!< BB   constset(Syms[b],R[a])
-  OP_GETMCNST   = 0x1F, //!< BB   R[a] = R[a]::Syms[b]
-  OP_SETMCNST   = 0x20, //!< BB   R[a+1]::Syms[b] = R[a]
-  OP_GETUPVAR   = 0x21, //!< BBB  R[a] = uvget(b,c)
-  OP_SETUPVAR   = 0x22, //!< BBB  uvset(b,c,R[a])
-  OP_GETIDX     = 0x23, //!< B    R[a] = R[a][R[a+1]]
-  OP_SETIDX     = 0x24, //!< B    R[a][R[a+1]] = R[a+2]
-  OP_JMP        = 0x25, //!< S    pc+=a
-  OP_JMPIF      = 0x26, //!< BS   if R[a] pc+=b
-  OP_JMPNOT     = 0x27, //!< BS   if !R[a] pc+=b
-  OP_JMPNIL     = 0x28, //!< BS   if R[a]==nil pc+=b
-  OP_JMPUW      = 0x29, //!< S    unwind_and_jump_to(a)
-  OP_EXCEPT     = 0x2A, //!< B    R[a] = exc
-  OP_RESCUE     = 0x2B, //!< BB   R[b] = R[a].isa?(R[b])
-  OP_RAISEIF    = 0x2C, //!< B    raise(R[a]) if R[a]
-  OP_SSEND      = 0x2D, //!< BBB  R[a] = self.send(Syms[b],R[a+1]..,R[a+n+1]:R[a+n+2]..) (c=n|k<<4)
-  OP_SSENDB     = 0x2E, //!< BBB  R[a] = self.send(Syms[b],R[a+1]..,R[a+n+1]:R[a+n+2]..,&R[a+n+2k+1])
-  OP_SEND       = 0x2F, //!< BBB  R[a] = R[a].send(Syms[b],R[a+1]..,R[a+n+1]:R[a+n+2]..) (c=n|k<<4)
-  OP_SENDB      = 0x30, //!< BBB  R[a] = R[a].send(Syms[b],R[a+1]..,R[a+n+1]:R[a+n+2]..,&R[a+n+2k+1])
-  OP_CALL       = 0x31, //!< Z    R[0] = self.call(frame.argc, frame.argv)
-  OP_SUPER      = 0x32, //!< BB   R[a] = super(R[a+1],... ,R[a+b+1])
-  OP_ARGARY     = 0x33, //!< BS   R[a] = argument array (16=m5:r1:m5:d1:lv4)
-  OP_ENTER      = 0x34, //!< W    arg setup according to flags (23=m5:o5:r1:m5:k5:d1:b1)
-  OP_KEY_P      = 0x35, //!< BB   R[a] = kdict.key?(Syms[b])
-  OP_KEYEND     = 0x36, //!< Z    raise unless kdict.empty?
-  OP_KARG       = 0x37, //!< BB   R[a] = kdict[Syms[b]]; kdict.delete(Syms[b])
-  OP_RETURN     = 0x38, //!< B    return R[a] (normal)
-  OP_RETURN_BLK = 0x39, //!< B    return R[a] (in-block return)
-  OP_BREAK      = 0x3A, //!< B    break R[a]
-  OP_BLKPUSH    = 0x3B, //!< BS   R[a] = block (16=m5:r1:m5:d1:lv4)
-  OP_ADD        = 0x3C, //!< B    R[a] = R[a]+R[a+1]
-  OP_ADDI       = 0x3D, //!< BB   R[a] = R[a]+mrb_int(b)
-  OP_SUB        = 0x3E, //!< B    R[a] = R[a]-R[a+1]
-  OP_SUBI       = 0x3F, //!< BB   R[a] = R[a]-mrb_int(b)
-  OP_MUL        = 0x40, //!< B    R[a] = R[a]*R[a+1]
-  OP_DIV        = 0x41, //!< B    R[a] = R[a]/R[a+1]
-  OP_EQ         = 0x42, //!< B    R[a] = R[a]==R[a+1]
-  OP_LT         = 0x43, //!< B    R[a] = R[a]<R[a+1]
-  OP_LE         = 0x44, //!< B    R[a] = R[a]<=R[a+1]
-  OP_GT         = 0x45, //!< B    R[a] = R[a]>R[a+1]
-  OP_GE         = 0x46, //!< B    R[a] = R[a]>=R[a+1]
-  OP_ARRAY      = 0x47, //!< BB   R[a] = ary_new(R[a],R[a+1]..R[a+b])
-  OP_ARRAY2     = 0x48, //!< BBB  R[a] = ary_new(R[b],R[b+1]..R[b+c])
-  OP_ARYCAT     = 0x49, //!< B    ary_cat(R[a],R[a+1])
-  OP_ARYPUSH    = 0x4A, //!< BB   ary_push(R[a],R[a+1]..R[a+b])
-  OP_ARYDUP     = 0x4B, //!< B    R[a] = ary_dup(R[a])
-  OP_AREF       = 0x4C, //!< BBB  R[a] = R[b][c]
-  OP_ASET       = 0x4D, //!< BBB  R[b][c] = R[a]
-  OP_APOST      = 0x4E, //!< BBB  *R[a],R[a+1]..R[a+c] = R[a][b..]
-  OP_INTERN     = 0x4F, //!< B    R[a] = intern(R[a])
-  OP_SYMBOL     = 0x50, //!< BB   R[a] = intern(Pool[b])
-  OP_STRING     = 0x51, //!< BB   R[a] = str_dup(Pool[b])
-  OP_STRCAT     = 0x52, //!< B    str_cat(R[a],R[a+1])
-  OP_HASH       = 0x53, //!< BB   R[a] = hash_new(R[a],R[a+1]..R[a+b*2-1])
-  OP_HASHADD    = 0x54, //!< BB   hash_push(R[a],R[a+1]..R[a+b*2])
-  OP_HASHCAT    = 0x55, //!< B    R[a] = hash_cat(R[a],R[a+1])
-  OP_LAMBDA     = 0x56, //!< BB   R[a] = lambda(Irep[b],L_LAMBDA)
-  OP_BLOCK      = 0x57, //!< BB   R[a] = lambda(Irep[b],L_BLOCK)
-  OP_METHOD     = 0x58, //!< BB   R[a] = lambda(Irep[b],L_METHOD)
-  OP_RANGE_INC  = 0x59, //!< B    R[a] = range_new(R[a],R[a+1],FALSE)
-  OP_RANGE_EXC  = 0x5A, //!< B    R[a] = range_new(R[a],R[a+1],TRUE)
-  OP_OCLASS     = 0x5B, //!< B    R[a] = ::Object
-  OP_CLASS      = 0x5C, //!< BB   R[a] = newclass(R[a],Syms[b],R[a+1])
-  OP_MODULE     = 0x5D, //!< BB   R[a] = newmodule(R[a],Syms[b])
-  OP_EXEC       = 0x5E, //!< BB   R[a] = blockexec(R[a],Irep[b])
-  OP_DEF        = 0x5F, //!< BB   R[a].newmethod(Syms[b],R[a+1]); R[a] = Syms[b]
-  OP_ALIAS      = 0x60, //!< BB   alias_method(target_class,Syms[a],Syms[b])
-  OP_UNDEF      = 0x61, //!< B    undef_method(target_class,Syms[a])
-  OP_SCLASS     = 0x62, //!< B    R[a] = R[a].singleton_class
-  OP_TCLASS     = 0x63, //!< B    R[a] = target_class
-  OP_DEBUG      = 0x64, //!< BBB  print a,b,c
-  OP_ERR        = 0x65, //!< B    raise(LocalJumpError, Pool[a])
-  OP_EXT1       = 0x66, //!< Z    make 1st operand (a) 16bit
-  OP_EXT2       = 0x67, //!< Z    make 2nd operand (b) 16bit
-  OP_EXT3       = 0x68, //!< Z    make 1st and 2nd operands 16bit
-  OP_STOP       = 0x69, //!< Z    stop VM
+#define OPCODE_ENUM(name, ...) OP_##name,
+  MRBC_OPCODE_LIST( OPCODE_ENUM, OPCODE_ENUM )
+#undef OPCODE_ENUM
 };
 
+//! Number of opcodes. (OP_STOP is the last one)
+#define MRBC_NUM_OPCODES (OP_STOP + 1)
+
 
 #ifdef __cplusplus
 }
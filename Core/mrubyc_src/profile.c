@@ -0,0 +1,882 @@
+/*! @file
+  @brief
+  mruby/c opcode and hot-spot profiler.
+
+  MRBC_PROFILE counts the executions and the CPU cycles of each opcode,
+  each instruction (irep, pc) and each method. The cycles between two
+  dispatches are charged to the former instruction, in hal_cycle_count()
+  unit. (e.g. DWT->CYCCNT on Cortex-M)
+
+  MRBC_PROFILE_SAMPLING records the instruction of the running task
+  at each interrupt of a sampling timer into a ring buffer, instead.
+
+  MRBC_PROFILE_CALLS counts the calls, the inclusive and the exclusive
+  cycles of each (class, method), by timestamping callinfo push and pop
+  and C function calls. The time while the task is switched out is not
+  counted. (see mrbc_profile_vm_suspend)
+
+  MRBC_CFUNC_LATENCY keeps the longest call of each C function, that is
+  a stretch without preemption because flag_preemption is checked only
+  between opcodes, and counts the calls over the budget.
+  MRBC_YIELD_POINT() in the long loops of the builtins splits a call
+  into segments, to tell a long but divisible call from a long step.
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+//@cond
+#include "vm_config.h"
+#include <stdint.h>
+#include <string.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+#include "value.h"
+#include "symbol.h"
+#include "class.h"
+#include "vm.h"
+#include "opcode.h"
+#include "console.h"
+#include "profile.h"
+#include "hal.h"
+
+#if defined(MRBC_PROFILE) || defined(MRBC_PROFILE_SAMPLING) || \
+    defined(MRBC_PROFILE_CALLS) || defined(MRBC_CFUNC_LATENCY)
+/***** Constat values *******************************************************/
+#if (MRBC_PROFILE_BUCKETS & (MRBC_PROFILE_BUCKETS - 1)) != 0
+#error "MRBC_PROFILE_BUCKETS must be power of 2."
+#endif
+#if (MRBC_PROFILE_METHODS & (MRBC_PROFILE_METHODS - 1)) != 0
+#error "MRBC_PROFILE_METHODS must be power of 2."
+#endif
+#if (MRBC_PROFILE_SAMPLE_SIZE & (MRBC_PROFILE_SAMPLE_SIZE - 1)) != 0
+#error "MRBC_PROFILE_SAMPLE_SIZE must be power of 2."
+#endif
+#if (MRBC_PROFILE_CALL_SIZE & (MRBC_PROFILE_CALL_SIZE - 1)) != 0
+#error "MRBC_PROFILE_CALL_SIZE must be power of 2."
+#endif
+#if (MRBC_CFUNC_LATENCY_SIZE & (MRBC_CFUNC_LATENCY_SIZE - 1)) != 0
+#error "MRBC_CFUNC_LATENCY_SIZE must be power of 2."
+#endif
+
+//! C function call longer than this is counted as over. (default 1 tick)
+#if !defined(MRBC_CFUNC_LATENCY_BUDGET_US)
+#define MRBC_CFUNC_LATENCY_BUDGET_US	(MRBC_TICK_UNIT * 1000)
+#endif
+
+#if !defined(hal_cycle_count)
+#define hal_cycle_count()	0
+#endif
+#if !defined(hal_cycles_per_us)
+#define hal_cycles_per_us()	1
+#endif
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+/*!@brief
+  Execution counter.
+*/
+typedef struct PROFILE_COUNTER {
+  uint32_t count;		//!< number of executions.
+  uint32_t cycles;		//!< CPU cycles consumed.
+} PROFILE_COUNTER;
+
+
+/*!@brief
+  Instruction (irep, pc) counter.
+*/
+typedef struct PROFILE_BUCKET {
+  PROFILE_COUNTER c;		//!< counter. (must be first)
+  const uint8_t *inst;		//!< instruction address. (key)
+  const mrbc_irep *irep;	//!< irep that contains the instruction.
+  mrbc_sym method_id;		//!< method executing the instruction.
+} PROFILE_BUCKET;
+
+
+/*!@brief
+  Method counter.
+*/
+typedef struct PROFILE_METHOD {
+  PROFILE_COUNTER c;		//!< counter. (must be first)
+  mrbc_sym method_id;		//!< method ID. (key, 0 is top level)
+  uint8_t used;			//!< entry is in use.
+} PROFILE_METHOD;
+
+
+/*!@brief
+  Sample of the running task.
+*/
+typedef struct PROFILE_SAMPLE {
+  const mrbc_irep *irep;	//!< running irep. (NULL is idle)
+  mrbc_sym method_id;		//!< running method.
+  uint16_t pc;			//!< offset in irep. (0xffff is unknown)
+  uint8_t vm_id;		//!< running task.
+} PROFILE_SAMPLE;
+
+
+/*!@brief
+  (class, method) counter of the call profiler.
+*/
+typedef struct PROFILE_CALL {
+  const mrbc_class *cls;	//!< class that owns the method. (key)
+  mrbc_sym method_id;		//!< method ID. (key)
+  uint8_t kind;			//!< MRBC_PROFILE_METHOD etc. (key)
+  uint32_t calls;		//!< number of calls. (0 is unused entry)
+  uint64_t incl;		//!< inclusive cycles.
+  uint64_t excl;		//!< exclusive cycles.
+} PROFILE_CALL;
+
+
+/*!@brief
+  (class, method) entry of the C function latency table.
+*/
+typedef struct CFUNC_LATENCY {
+  const mrbc_class *cls;	//!< class that owns the method. (key)
+  mrbc_sym method_id;		//!< method ID. (key)
+  uint8_t vm_id;		//!< VM ID of the longest call.
+  uint32_t calls;		//!< number of calls. (0 is unused entry)
+  uint32_t n_over;		//!< number of calls over the budget.
+  uint32_t max_cycles;		//!< longest call.
+  uint32_t max_segment;		//!< longest segment between yield points.
+} CFUNC_LATENCY;
+
+
+/***** Function prototypes **************************************************/
+/***** Local variables ******************************************************/
+#if defined(MRBC_PROFILE)
+#define OPCODE_NAME(name, ...) [OP_##name] = #name,
+static const char * const OPCODE_NAMES[MRBC_NUM_OPCODES] = {
+  MRBC_OPCODE_LIST( OPCODE_NAME, OPCODE_NAME )
+};
+#undef OPCODE_NAME
+
+static PROFILE_COUNTER op_counter[MRBC_NUM_OPCODES + 1];  // last is unknown.
+static PROFILE_BUCKET buckets[MRBC_PROFILE_BUCKETS];
+static PROFILE_BUCKET bucket_others;	//!< when buckets are full.
+static PROFILE_METHOD methods[MRBC_PROFILE_METHODS];
+static PROFILE_METHOD method_others;	//!< when methods are full.
+
+static uint32_t last_cycle;		//!< cycle count at the last dispatch.
+static PROFILE_COUNTER *last_op;	//!< counters of the last instruction.
+static PROFILE_COUNTER *last_bucket;
+static PROFILE_COUNTER *last_method;
+#endif
+
+#if defined(MRBC_PROFILE_SAMPLING)
+static PROFILE_SAMPLE samples[MRBC_PROFILE_SAMPLE_SIZE];
+static volatile uint32_t n_samples;	//!< total, and the write index.
+static volatile uint8_t flag_sampling;
+#endif
+
+#if defined(MRBC_PROFILE_CALLS)
+static PROFILE_CALL calls[MRBC_PROFILE_CALL_SIZE];
+static PROFILE_CALL call_others;	//!< when calls are full.
+static uint32_t top_child;		//!< prof_child of the top level.
+#endif
+
+#if defined(MRBC_CFUNC_LATENCY)
+static CFUNC_LATENCY cfunc_latency[MRBC_CFUNC_LATENCY_SIZE];
+static CFUNC_LATENCY cfunc_latency_others;	//!< when the table is full.
+static mrbc_cfunc_latency *cfunc_current;	//!< innermost C function call.
+#endif
+
+
+/***** Global variables *****************************************************/
+/***** Signal catching functions ********************************************/
+/***** Local functions ******************************************************/
+#if defined(MRBC_PROFILE)
+//================================================================
+/*! find or add the bucket of the instruction.
+*/
+static PROFILE_BUCKET * find_bucket( const struct VM *vm, mrbc_sym method_id )
+{
+  int i = ((uintptr_t)vm->inst >> 1) & (MRBC_PROFILE_BUCKETS - 1);
+
+  for( int n = 0; n < MRBC_PROFILE_BUCKETS; n++ ) {
+    PROFILE_BUCKET *b = &buckets[i];
+    if( b->inst == vm->inst ) return b;
+    if( !b->inst ) {
+      b->inst = vm->inst;
+      b->irep = vm->cur_irep;
+      b->method_id = method_id;
+      return b;
+    }
+    i = (i + 1) & (MRBC_PROFILE_BUCKETS - 1);
+  }
+
+  return &bucket_others;
+}
+
+
+#endif
+
+
+#if defined(MRBC_PROFILE) || defined(MRBC_PROFILE_SAMPLING)
+//================================================================
+/*! find or add the method entry.
+
+  @param  tbl		method table. (MRBC_PROFILE_METHODS entries)
+  @param  method_id	method ID.
+  @return		entry, or NULL if the table is full.
+*/
+static PROFILE_METHOD * find_method( PROFILE_METHOD *tbl, mrbc_sym method_id )
+{
+  int i = method_id & (MRBC_PROFILE_METHODS - 1);
+
+  for( int n = 0; n < MRBC_PROFILE_METHODS; n++ ) {
+    PROFILE_METHOD *m = &tbl[i];
+    if( m->used && m->method_id == method_id ) return m;
+    if( !m->used ) {
+      m->used = 1;
+      m->method_id = method_id;
+      return m;
+    }
+    i = (i + 1) & (MRBC_PROFILE_METHODS - 1);
+  }
+
+  return 0;
+}
+
+
+//================================================================
+/*! sort the index of counters in descending order.
+
+  @param  idx		index array to sort.
+  @param  n		number of elements.
+  @param  base		counter array.
+  @param  stride	size of an element of counter array.
+  @param  by_cycles	sort by cycles, or by count if 0.
+*/
+static void sort_index( uint16_t *idx, int n, const void *base, int stride, int by_cycles )
+{
+#define KEY(i) (by_cycles ? \
+  ((const PROFILE_COUNTER *)((const uint8_t *)base + stride * (i)))->cycles : \
+  ((const PROFILE_COUNTER *)((const uint8_t *)base + stride * (i)))->count)
+
+  for( int i = 0; i < n; i++ ) idx[i] = i;
+
+  for( int i = 1; i < n; i++ ) {
+    uint16_t v = idx[i];
+    uint32_t key = KEY(v);
+    int j;
+    for( j = i; j > 0 && KEY(idx[j-1]) < key; j-- ) {
+      idx[j] = idx[j-1];
+    }
+    idx[j] = v;
+  }
+#undef KEY
+}
+#endif
+
+
+//================================================================
+/*! get the method name for printing.
+*/
+static const char * method_name( mrbc_sym method_id )
+{
+  return method_id ? mrbc_symid_to_str(method_id) : "(top)";
+}
+
+
+/***** Global functions *****************************************************/
+#if defined(MRBC_PROFILE)
+//================================================================
+/*! count the instruction at vm->inst.
+
+  @param  vm	pointer to VM.
+*/
+void mrbc_profile_count( struct VM *vm )
+{
+  uint32_t now = hal_cycle_count();
+
+  if( last_op ) {
+    uint32_t cycles = now - last_cycle;
+    last_op->cycles += cycles;
+    last_bucket->cycles += cycles;
+    last_method->cycles += cycles;
+  }
+
+  int op = *vm->inst;
+  if( op >= MRBC_NUM_OPCODES ) op = MRBC_NUM_OPCODES;
+  mrbc_sym method_id = vm->callinfo_tail ? vm->callinfo_tail->method_id : 0;
+
+  last_op = &op_counter[op];
+  last_bucket = &find_bucket( vm, method_id )->c;
+  PROFILE_METHOD *m = find_method( methods, method_id );
+  last_method = m ? &m->c : &method_others.c;
+  last_op->count++;
+  last_bucket->count++;
+  last_method->count++;
+
+  last_cycle = hal_cycle_count();	// exclude the profiler itself.
+}
+
+
+//================================================================
+/*! mrbc_vm_run() is (re)entered.
+
+  The cycles from the last dispatch (e.g. other tasks) are not charged.
+*/
+void mrbc_profile_enter( void )
+{
+  last_op = 0;
+}
+
+
+//================================================================
+/*! clear all counters.
+*/
+void mrbc_profile_clear( void )
+{
+  memset( op_counter, 0, sizeof(op_counter) );
+  memset( buckets, 0, sizeof(buckets) );
+  memset( &bucket_others, 0, sizeof(bucket_others) );
+  memset( methods, 0, sizeof(methods) );
+  memset( &method_others, 0, sizeof(method_others) );
+  last_op = 0;
+}
+
+
+//================================================================
+/*! print the top n of opcodes, instructions and methods.
+
+  Sorted by cycles, or by count if hal_cycle_count() is not available.
+
+  @param  n	number of lines for each.
+*/
+void mrbc_profile_dump( int n )
+{
+  uint16_t idx[MRBC_NUM_OPCODES + 1 > MRBC_PROFILE_BUCKETS ?
+	       MRBC_NUM_OPCODES + 1 : MRBC_PROFILE_BUCKETS];
+  uint32_t total_count = 0;
+  uint32_t total_cycles = 0;
+
+  for( int i = 0; i <= MRBC_NUM_OPCODES; i++ ) {
+    total_count += op_counter[i].count;
+    total_cycles += op_counter[i].cycles;
+  }
+  int by_cycles = (total_cycles != 0);
+
+  mrbc_printf("<< Profile >>\n total: %u instructions, %u cycles\n",
+	      total_count, total_cycles );
+
+  // opcodes.
+  mrbc_printf("\n %-10s %10s %10s\n", "opcode", "count", "cycles");
+  sort_index( idx, MRBC_NUM_OPCODES + 1, op_counter, sizeof(op_counter[0]), by_cycles );
+  for( int i = 0; i < n && i <= MRBC_NUM_OPCODES; i++ ) {
+    const PROFILE_COUNTER *c = &op_counter[idx[i]];
+    if( c->count == 0 ) break;
+    mrbc_printf(" %-10s %10u %10u\n",
+		idx[i] < MRBC_NUM_OPCODES ? OPCODE_NAMES[idx[i]] : "(unknown)",
+		c->count, c->cycles );
+  }
+
+  // instructions.
+  mrbc_printf("\n %-16s %6s %-10s %10s %10s\n",
+	      "method", "pc", "opcode", "count", "cycles");
+  sort_index( idx, MRBC_PROFILE_BUCKETS, buckets, sizeof(buckets[0]), by_cycles );
+  for( int i = 0; i < n && i < MRBC_PROFILE_BUCKETS; i++ ) {
+    const PROFILE_BUCKET *b = &buckets[idx[i]];
+    if( b->c.count == 0 ) break;
+    int op = *b->inst;
+    mrbc_printf(" %-16s %06x %-10s %10u %10u\n",
+		method_name(b->method_id), (int)(b->inst - b->irep->inst),
+		op < MRBC_NUM_OPCODES ? OPCODE_NAMES[op] : "(unknown)",
+		b->c.count, b->c.cycles );
+  }
+  if( bucket_others.c.count ) {
+    mrbc_printf(" %-16s %6s %-10s %10u %10u\n", "(others)", "", "",
+		bucket_others.c.count, bucket_others.c.cycles );
+  }
+
+  // methods.
+  mrbc_printf("\n %-16s %10s %10s\n", "method", "count", "cycles");
+  sort_index( idx, MRBC_PROFILE_METHODS, methods, sizeof(methods[0]), by_cycles );
+  for( int i = 0; i < n && i < MRBC_PROFILE_METHODS; i++ ) {
+    const PROFILE_METHOD *m = &methods[idx[i]];
+    if( m->c.count == 0 ) break;
+    mrbc_printf(" %-16s %10u %10u\n",
+		method_name(m->method_id), m->c.count, m->c.cycles );
+  }
+  if( method_others.c.count ) {
+    mrbc_printf(" %-16s %10u %10u\n", "(others)",
+		method_others.c.count, method_others.c.cycles );
+  }
+}
+
+#endif // defined(MRBC_PROFILE)
+
+
+#if defined(MRBC_PROFILE_SAMPLING)
+//================================================================
+/*! record a sample. (called from the sampling timer interrupt)
+
+  @param  vm	pointer to the running VM, or NULL if idle.
+*/
+void mrbc_profile_sample( const struct VM *vm )
+{
+  if( !flag_sampling ) return;
+
+  PROFILE_SAMPLE *s = &samples[ n_samples & (MRBC_PROFILE_SAMPLE_SIZE - 1) ];
+  n_samples++;
+
+  if( !vm ) {
+    s->irep = 0;
+    s->method_id = 0;
+    s->pc = 0xffff;
+    s->vm_id = 0;
+
+  } else {
+    // cur_irep and inst may be inconsistent during a call or return.
+    const mrbc_irep *irep = vm->cur_irep;
+    uint32_t pc = vm->inst - irep->inst;
+    s->irep = irep;
+    s->method_id = vm->callinfo_tail ? vm->callinfo_tail->method_id : 0;
+    s->pc = (pc < irep->ilen && pc < 0xffff) ? pc : 0xffff;
+    s->vm_id = vm->vm_id;
+  }
+
+#if defined(MRBC_PROFILE_SAMPLE_OUTPUT)
+  MRBC_PROFILE_SAMPLE_OUTPUT( s, sizeof(PROFILE_SAMPLE) );
+#endif
+}
+
+
+//================================================================
+/*! start sampling.
+
+  @param  hz	sampling rate.
+*/
+void mrbc_profile_sampling_start( int hz )
+{
+  hal_profile_timer_stop();
+  n_samples = 0;
+  flag_sampling = 1;
+  hal_profile_timer_start( hz );
+}
+
+
+//================================================================
+/*! stop sampling.
+*/
+void mrbc_profile_sampling_stop( void )
+{
+  hal_profile_timer_stop();
+  flag_sampling = 0;
+}
+
+
+//================================================================
+/*! print the samples in the buffer.
+
+  Prints the number of samples of each method, or each sample as
+  "vm_id method pc" lines for an external tool if raw is true.
+  The sampling is paused while printing.
+
+  @param  raw	print each sample.
+*/
+void mrbc_profile_print_samples( int raw )
+{
+  uint8_t flag = flag_sampling;
+  flag_sampling = 0;
+
+  uint32_t total = n_samples;
+  int n = total < MRBC_PROFILE_SAMPLE_SIZE ? total : MRBC_PROFILE_SAMPLE_SIZE;
+  uint32_t first = total - n;
+
+  mrbc_printf("<< Samples >>\n total: %u samples, %d in buffer\n", total, n );
+
+  if( raw ) {
+    for( int i = 0; i < n; i++ ) {
+      const PROFILE_SAMPLE *s =
+	&samples[ (first + i) & (MRBC_PROFILE_SAMPLE_SIZE - 1) ];
+      if( s->irep ) {
+	mrbc_printf(" %d %s %d\n", s->vm_id, method_name(s->method_id),
+		    s->pc == 0xffff ? -1 : s->pc );
+      } else {
+	mrbc_printf(" 0 (idle) -1\n");
+      }
+    }
+    flag_sampling = flag;
+    return;
+  }
+
+  PROFILE_METHOD tbl[MRBC_PROFILE_METHODS];
+  uint16_t idx[MRBC_PROFILE_METHODS];
+  int n_idle = 0;
+  int n_others = 0;
+  memset( tbl, 0, sizeof(tbl) );
+
+  for( int i = 0; i < n; i++ ) {
+    const PROFILE_SAMPLE *s = &samples[ (first + i) & (MRBC_PROFILE_SAMPLE_SIZE - 1) ];
+    if( !s->irep ) {
+      n_idle++;
+      continue;
+    }
+    PROFILE_METHOD *m = find_method( tbl, s->method_id );
+    if( m ) m->c.count++; else n_others++;
+  }
+
+  mrbc_printf("\n %-16s %8s %4s\n", "method", "samples", "%");
+  sort_index( idx, MRBC_PROFILE_METHODS, tbl, sizeof(tbl[0]), 0 );
+  for( int i = 0; i < MRBC_PROFILE_METHODS; i++ ) {
+    const PROFILE_METHOD *m = &tbl[idx[i]];
+    if( m->c.count == 0 ) break;
+    mrbc_printf(" %-16s %8d %4d\n",
+		method_name(m->method_id), m->c.count, m->c.count * 100 / n );
+  }
+  if( n_others ) {
+    mrbc_printf(" %-16s %8d %4d\n", "(others)", n_others, n_others * 100 / n );
+  }
+  if( n_idle ) {
+    mrbc_printf(" %-16s %8d %4d\n", "(idle)", n_idle, n_idle * 100 / n );
+  }
+
+  flag_sampling = flag;
+}
+#endif // defined(MRBC_PROFILE_SAMPLING)
+
+#if defined(MRBC_PROFILE_CALLS)
+//================================================================
+/*! clock of the VM, that stops while the task is switched out.
+*/
+static inline uint32_t vm_clock( const struct VM *vm )
+{
+  return hal_cycle_count() - vm->prof_clock_off;
+}
+
+
+//================================================================
+/*! add a call to the (class, method) entry.
+*/
+static void record_call( const mrbc_class *cls, mrbc_sym method_id, int kind,
+			 uint32_t incl, uint32_t excl )
+{
+  int i = ((uintptr_t)cls >> 2 ^ method_id ^ kind) & (MRBC_PROFILE_CALL_SIZE - 1);
+  PROFILE_CALL *e = &call_others;
+
+  for( int n = 0; n < MRBC_PROFILE_CALL_SIZE; n++ ) {
+    PROFILE_CALL *e1 = &calls[i];
+    if( e1->calls == 0 ) {
+      e1->cls = cls;
+      e1->method_id = method_id;
+      e1->kind = kind;
+      e = e1;
+      break;
+    }
+    if( e1->cls == cls && e1->method_id == method_id && e1->kind == kind ) {
+      e = e1;
+      break;
+    }
+    i = (i + 1) & (MRBC_PROFILE_CALL_SIZE - 1);
+  }
+
+  e->calls++;
+  e->incl += incl;
+  e->excl += excl;
+}
+
+
+//================================================================
+/*! the task is dispatched.
+
+  @param  vm	pointer to VM.
+*/
+void mrbc_profile_vm_resume( struct VM *vm )
+{
+  vm->prof_clock_off += hal_cycle_count() - vm->prof_clock_stop;
+}
+
+
+//================================================================
+/*! the task is switched out.
+
+  @param  vm	pointer to VM.
+*/
+void mrbc_profile_vm_suspend( struct VM *vm )
+{
+  vm->prof_clock_stop = hal_cycle_count();
+}
+
+
+//================================================================
+/*! a frame is pushed.
+
+  @param  vm	pointer to VM.
+  @param  ci	pushed callinfo.
+*/
+void mrbc_profile_call_push( const struct VM *vm, mrbc_callinfo *ci )
+{
+  ci->prof_start = vm_clock(vm);
+  ci->prof_child = 0;
+  ci->prof_kind = MRBC_PROFILE_METHOD;
+}
+
+
+//================================================================
+/*! a frame is popped.
+
+  @param  vm	pointer to VM.
+  @param  ci	callinfo to pop.
+*/
+void mrbc_profile_call_pop( const struct VM *vm, const mrbc_callinfo *ci )
+{
+  uint32_t incl = vm_clock(vm) - ci->prof_start;
+
+  if( ci->prev ) ci->prev->prof_child += incl;
+  record_call( ci->own_class, ci->method_id, ci->prof_kind,
+	       incl, incl - ci->prof_child );
+}
+
+
+//================================================================
+/*! a C function is going to be called.
+
+  @param  vm	pointer to VM.
+  @param  ci	callinfo of the caller, or NULL if top level.
+  @param  prof	state to be passed to mrbc_profile_cfunc_end().
+*/
+void mrbc_profile_cfunc_begin( const struct VM *vm, const mrbc_callinfo *ci, mrbc_profile_cfunc *prof )
+{
+  prof->start = vm_clock(vm);
+  prof->child = ci ? ci->prof_child : top_child;
+}
+
+
+//================================================================
+/*! a C function returned.
+
+  Frames pushed by the function (e.g. mrbc_send) are charged to the
+  caller while the function runs, so they are subtracted.
+
+  @param  vm		pointer to VM.
+  @param  ci		callinfo of the caller, or NULL if top level.
+  @param  prof		state set by mrbc_profile_cfunc_begin().
+  @param  cls		class that owns the function.
+  @param  method_id	method ID.
+*/
+void mrbc_profile_cfunc_end( const struct VM *vm, mrbc_callinfo *ci, const mrbc_profile_cfunc *prof, const mrbc_class *cls, mrbc_sym method_id )
+{
+  uint32_t incl = vm_clock(vm) - prof->start;
+  uint32_t *child = ci ? &ci->prof_child : &top_child;
+  uint32_t excl = incl - (*child - prof->child);
+
+  *child = prof->child + incl;
+  record_call( cls, method_id, MRBC_PROFILE_C_FUNC, incl, excl );
+}
+
+
+//================================================================
+/*! clear the call profile.
+*/
+void mrbc_profile_calls_clear( void )
+{
+  memset( calls, 0, sizeof(calls) );
+  memset( &call_others, 0, sizeof(call_others) );
+}
+
+
+//================================================================
+/*! print the top n of (class, method) by exclusive cycles.
+
+  A block is printed as "Class#method{}", and a C function as
+  "Class#method()".
+
+  @param  n	number of lines.
+*/
+void mrbc_profile_calls_dump( int n )
+{
+  static const char * const SUFFIX[] = { "", "{}", "", "()" };
+  uint16_t idx[MRBC_PROFILE_CALL_SIZE];
+  int n_used = 0;
+
+  // insertion sort by exclusive cycles.
+  for( int i = 0; i < MRBC_PROFILE_CALL_SIZE; i++ ) {
+    if( calls[i].calls == 0 ) continue;
+    int j;
+    for( j = n_used; j > 0 && calls[idx[j-1]].excl < calls[i].excl; j-- ) {
+      idx[j] = idx[j-1];
+    }
+    idx[j] = i;
+    n_used++;
+  }
+
+  mrbc_printf("<< Call profile >>\n %-28s %8s %10s %10s\n",
+	      "method", "calls", "incl(us)", "excl(us)");
+  for( int i = 0; i < n && i < n_used; i++ ) {
+    const PROFILE_CALL *e = &calls[idx[i]];
+    char name[40];
+
+    if( e->kind == MRBC_PROFILE_C_ITER ) {
+      mrbc_snprintf( name, sizeof(name), "(C iterator)" );
+    } else {
+      mrbc_snprintf( name, sizeof(name), "%s#%s%s",
+		     e->cls ? mrbc_symid_to_str(e->cls->sym_id) : "",
+		     method_name(e->method_id), SUFFIX[e->kind] );
+    }
+    mrbc_printf(" %-28s %8u %10u %10u\n", name, e->calls,
+		(uint32_t)(e->incl / hal_cycles_per_us()),
+		(uint32_t)(e->excl / hal_cycles_per_us()) );
+  }
+  if( call_others.calls ) {
+    mrbc_printf(" %-28s %8u %10u %10u\n", "(others)", call_others.calls,
+		(uint32_t)(call_others.incl / hal_cycles_per_us()),
+		(uint32_t)(call_others.excl / hal_cycles_per_us()) );
+  }
+}
+#endif // defined(MRBC_PROFILE_CALLS)
+
+#if defined(MRBC_CFUNC_LATENCY)
+//================================================================
+/*! a C function is going to be called.
+
+  @param  lat	state to be passed to mrbc_cfunc_latency_end().
+*/
+void mrbc_cfunc_latency_begin( mrbc_cfunc_latency *lat )
+{
+  lat->start = lat->segment_start = hal_cycle_count();
+  lat->max_segment = 0;
+  lat->prev = cfunc_current;
+  cfunc_current = lat;
+}
+
+
+//================================================================
+/*! a C function returned.
+
+  The time of the inner calls (e.g. by mrbc_send) is included,
+  because the task isn't preempted during them either.
+
+  @param  vm		pointer to VM.
+  @param  lat		state set by mrbc_cfunc_latency_begin().
+  @param  cls		class that owns the function.
+  @param  method_id	method ID.
+*/
+void mrbc_cfunc_latency_end( const struct VM *vm, mrbc_cfunc_latency *lat, const mrbc_class *cls, mrbc_sym method_id )
+{
+  uint32_t now = hal_cycle_count();
+  uint32_t cycles = now - lat->start;
+  uint32_t segment = now - lat->segment_start;
+  if( lat->max_segment < segment ) lat->max_segment = segment;
+  cfunc_current = lat->prev;
+
+  int i = ((uintptr_t)cls >> 2 ^ method_id) & (MRBC_CFUNC_LATENCY_SIZE - 1);
+  CFUNC_LATENCY *e = &cfunc_latency_others;
+
+  for( int n = 0; n < MRBC_CFUNC_LATENCY_SIZE; n++ ) {
+    CFUNC_LATENCY *e1 = &cfunc_latency[i];
+    if( e1->calls == 0 ) {
+      e1->cls = cls;
+      e1->method_id = method_id;
+      e = e1;
+      break;
+    }
+    if( e1->cls == cls && e1->method_id == method_id ) {
+      e = e1;
+      break;
+    }
+    i = (i + 1) & (MRBC_CFUNC_LATENCY_SIZE - 1);
+  }
+
+  e->calls++;
+  if( cycles > MRBC_CFUNC_LATENCY_BUDGET_US * hal_cycles_per_us() ) e->n_over++;
+  if( e->max_cycles < cycles ) {
+    e->max_cycles = cycles;
+    e->vm_id = vm->vm_id;
+  }
+  if( e->max_segment < lat->max_segment ) e->max_segment = lat->max_segment;
+}
+
+
+//================================================================
+/*! a yield point in a long loop of a C function.
+
+  This can't switch the task, because a C function runs on the stack
+  of the scheduler. It closes a segment of the current call, and kicks
+  the watchdog if HAL has hal_watchdog_kick().
+*/
+void mrbc_cfunc_yield_point( void )
+{
+#if defined(hal_watchdog_kick)
+  hal_watchdog_kick();
+#endif
+
+  mrbc_cfunc_latency *lat = cfunc_current;
+  if( !lat ) return;
+
+  uint32_t now = hal_cycle_count();
+  uint32_t segment = now - lat->segment_start;
+  if( lat->max_segment < segment ) lat->max_segment = segment;
+  lat->segment_start = now;
+}
+
+
+//================================================================
+/*! clear the C function latency table.
+*/
+void mrbc_cfunc_latency_clear( void )
+{
+  memset( cfunc_latency, 0, sizeof(cfunc_latency) );
+  memset( &cfunc_latency_others, 0, sizeof(cfunc_latency_others) );
+}
+
+
+//================================================================
+/*! print the top n of C functions by the longest call.
+
+  max is the longest call, and seg is the longest segment between
+  the yield points in it. (same as max if no yield point)
+  over is the number of calls over MRBC_CFUNC_LATENCY_BUDGET_US.
+
+  @param  n	number of lines.
+*/
+void mrbc_cfunc_latency_dump( int n )
+{
+  uint16_t idx[MRBC_CFUNC_LATENCY_SIZE];
+  int n_used = 0;
+
+  // insertion sort by the longest call.
+  for( int i = 0; i < MRBC_CFUNC_LATENCY_SIZE; i++ ) {
+    if( cfunc_latency[i].calls == 0 ) continue;
+    int j;
+    for( j = n_used; j > 0 &&
+	   cfunc_latency[idx[j-1]].max_cycles < cfunc_latency[i].max_cycles; j-- ) {
+      idx[j] = idx[j-1];
+    }
+    idx[j] = i;
+    n_used++;
+  }
+
+  mrbc_printf("<< C function latency >> budget %dus\n %-28s %8s %9s %9s %6s %3s\n",
+	      MRBC_CFUNC_LATENCY_BUDGET_US,
+	      "method", "calls", "max(us)", "seg(us)", "over", "vm");
+  for( int i = 0; i < n && i < n_used; i++ ) {
+    const CFUNC_LATENCY *e = &cfunc_latency[idx[i]];
+    char name[40];
+
+    mrbc_snprintf( name, sizeof(name), "%s#%s",
+		   e->cls ? mrbc_symid_to_str(e->cls->sym_id) : "",
+		   method_name(e->method_id) );
+    mrbc_printf(" %-28s %8u %9u %9u %6u %3d\n", name, e->calls,
+		e->max_cycles / hal_cycles_per_us(),
+		e->max_segment / hal_cycles_per_us(), e->n_over, e->vm_id );
+  }
+  if( cfunc_latency_others.calls ) {
+    const CFUNC_LATENCY *e = &cfunc_latency_others;
+    mrbc_printf(" %-28s %8u %9u %9u %6u %3d\n", "(others)", e->calls,
+		e->max_cycles / hal_cycles_per_us(),
+		e->max_segment / hal_cycles_per_us(), e->n_over, e->vm_id );
+  }
+}
+#endif // defined(MRBC_CFUNC_LATENCY)
+
+#endif // MRBC_PROFILE || MRBC_PROFILE_SAMPLING || MRBC_PROFILE_CALLS || MRBC_CFUNC_LATENCY
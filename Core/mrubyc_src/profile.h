@@ -0,0 +1,160 @@
+/*! @file
+  @brief
+  mruby/c opcode and hot-spot profiler.
+
+  <pre>
+  Copyright (C) 2015- Kyushu Institute of Technology.
+  Copyright (C) 2015- Shimane IT Open-Innovation Center.
+
+  This file is distributed under BSD 3-Clause License.
+
+  </pre>
+*/
+
+#ifndef MRBC_SRC_PROFILE_H_
+#define MRBC_SRC_PROFILE_H_
+
+/***** Feature test switches ************************************************/
+/***** System headers *******************************************************/
+//@cond
+#include <stdint.h>
+//@endcond
+
+/***** Local headers ********************************************************/
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/***** Constat values *******************************************************/
+//! number of (irep, pc) buckets.
+#if !defined(MRBC_PROFILE_BUCKETS)
+#define MRBC_PROFILE_BUCKETS 64
+#endif
+
+//! number of methods.
+#if !defined(MRBC_PROFILE_METHODS)
+#define MRBC_PROFILE_METHODS 32
+#endif
+
+//! number of samples in the ring buffer.
+#if !defined(MRBC_PROFILE_SAMPLE_SIZE)
+#define MRBC_PROFILE_SAMPLE_SIZE 128
+#endif
+
+//! default sampling rate. (prime, not to beat with the tick timer)
+#if !defined(MRBC_PROFILE_SAMPLE_HZ)
+#define MRBC_PROFILE_SAMPLE_HZ 997
+#endif
+
+//! number of (class, method) entries of the call profiler.
+#if !defined(MRBC_PROFILE_CALL_SIZE)
+#define MRBC_PROFILE_CALL_SIZE 32
+#endif
+
+//! number of (class, method) entries of the C function latency table.
+#if !defined(MRBC_CFUNC_LATENCY_SIZE)
+#define MRBC_CFUNC_LATENCY_SIZE 32
+#endif
+
+//! kind of frame for the call profiler.
+enum {
+  MRBC_PROFILE_METHOD = 0,	//!< Ruby method.
+  MRBC_PROFILE_BLOCK,		//!< block.
+  MRBC_PROFILE_C_ITER,		//!< C iterator frame.
+  MRBC_PROFILE_C_FUNC,		//!< C function.
+};
+
+
+/***** Macros ***************************************************************/
+#if defined(MRBC_PROFILE)
+//! count the instruction at vm->inst. (called at each dispatch)
+#define MRBC_PROFILE_COUNT(vm)	mrbc_profile_count(vm)
+//! mrbc_vm_run() is (re)entered, don't charge the cycles until now.
+#define MRBC_PROFILE_ENTER()	mrbc_profile_enter()
+#else
+#define MRBC_PROFILE_COUNT(vm)	((void)0)
+#define MRBC_PROFILE_ENTER()	((void)0)
+#endif
+
+#if defined(MRBC_PROFILE_CALLS)
+//! a frame is pushed or popped.
+#define MRBC_PROFILE_CALL_PUSH(vm, ci)	mrbc_profile_call_push(vm, ci)
+#define MRBC_PROFILE_CALL_POP(vm, ci)	mrbc_profile_call_pop(vm, ci)
+//! set the kind of frame after push.
+#define MRBC_PROFILE_CALL_KIND(ci, k)	((ci)->prof_kind = (k))
+#else
+#define MRBC_PROFILE_CALL_PUSH(vm, ci)	((void)0)
+#define MRBC_PROFILE_CALL_POP(vm, ci)	((void)0)
+#define MRBC_PROFILE_CALL_KIND(ci, k)	((void)0)
+#endif
+
+#if defined(MRBC_CFUNC_LATENCY)
+//! measure a C function call, that is not preempted.
+#define MRBC_CFUNC_LATENCY_BEGIN() \
+  mrbc_cfunc_latency cfunc_latency_; mrbc_cfunc_latency_begin(&cfunc_latency_)
+#define MRBC_CFUNC_LATENCY_END(vm, cls, method_id) \
+  mrbc_cfunc_latency_end(vm, &cfunc_latency_, cls, method_id)
+//! a point in a long loop of a C function.
+#define MRBC_YIELD_POINT()	mrbc_cfunc_yield_point()
+#else
+#define MRBC_CFUNC_LATENCY_BEGIN()		((void)0)
+#define MRBC_CFUNC_LATENCY_END(vm, cls, method_id)	((void)0)
+#define MRBC_YIELD_POINT()	((void)0)
+#endif
+
+
+/***** Typedefs *************************************************************/
+/*!@brief
+  State of the call profiler during a C function call.
+*/
+typedef struct mrbc_profile_cfunc {
+  uint32_t start;		//!< VM clock at the call.
+  uint32_t child;		//!< prof_child of the caller at the call.
+} mrbc_profile_cfunc;
+
+/*!@brief
+  State of the latency measurement during a C function call.
+*/
+typedef struct mrbc_cfunc_latency {
+  uint32_t start;		//!< cycles at the call.
+  uint32_t segment_start;	//!< cycles at the last yield point.
+  uint32_t max_segment;		//!< longest segment between yield points.
+  struct mrbc_cfunc_latency *prev;	//!< C function that called this.
+} mrbc_cfunc_latency;
+
+/***** Global variables *****************************************************/
+/***** Function prototypes **************************************************/
+struct VM;
+struct CALLINFO;
+struct RClass;
+void mrbc_profile_count(struct VM *vm);
+void mrbc_profile_enter(void);
+void mrbc_profile_clear(void);
+void mrbc_profile_dump(int n);
+void mrbc_profile_sample(const struct VM *vm);
+void mrbc_profile_sampling_start(int hz);
+void mrbc_profile_sampling_stop(void);
+void mrbc_profile_print_samples(int raw);
+void mrbc_profile_vm_resume(struct VM *vm);
+void mrbc_profile_vm_suspend(struct VM *vm);
+void mrbc_profile_call_push(const struct VM *vm, struct CALLINFO *ci);
+void mrbc_profile_call_pop(const struct VM *vm, const struct CALLINFO *ci);
+void mrbc_profile_cfunc_begin(const struct VM *vm, const struct CALLINFO *ci, mrbc_profile_cfunc *prof);
+void mrbc_profile_cfunc_end(const struct VM *vm, struct CALLINFO *ci, const mrbc_profile_cfunc *prof, const struct RClass *cls, mrbc_sym method_id);
+void mrbc_profile_calls_clear(void);
+void mrbc_profile_calls_dump(int n);
+void mrbc_cfunc_latency_begin(mrbc_cfunc_latency *lat);
+void mrbc_cfunc_latency_end(const struct VM *vm, mrbc_cfunc_latency *lat, const struct RClass *cls, mrbc_sym method_id);
+void mrbc_cfunc_yield_point(void);
+void mrbc_cfunc_latency_clear(void);
+void mrbc_cfunc_latency_dump(int n);
+
+
+/***** Inline functions *****************************************************/
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -31,7 +31,11 @@
 #include "console.h"
 #include "c_string.h"
 #include "c_array.h"
+#include "c_hash.h"
 #include "rrt0.h"
+#include "profile.h"
+#include "metrics.h"
+#include "cycle.h"
 #include "hal.h"
 
 
@@ -40,26 +44,261 @@
 #define MRBC_SCHEDULER_EXIT 0
 #endif
 
-#define VM2TCB(p) ((mrbc_tcb *)((uint8_t *)p - offsetof(mrbc_tcb, vm)))
 #define MRBC_MUTEX_TRACE(...) ((void)0)
 
+#if defined(MRBC_SCHED_EVENT_LOG)
+#define SCHED_EVENT(op,tcb,arg)	sched_event((op),(tcb),(arg))
+#if !defined(MRBC_SCHED_EVENT_LOG_SIZE)
+#define MRBC_SCHED_EVENT_LOG_SIZE 128
+#endif
+//! record the event, out of the interrupts disabled section.
+#define SCHED_EVENT_IRQ(op,tcb,arg) \
+  do { hal_disable_irq(); sched_event((op),(tcb),(arg)); hal_enable_irq(); } while(0)
+#else
+#define SCHED_EVENT(op,tcb,arg)	((void)0)
+#define SCHED_EVENT_IRQ(op,tcb,arg) ((void)0)
+#endif
+
 
 /***** Typedefs *************************************************************/
+#if defined(MRBC_SCHED_EVENT_LOG)
+/*
+  define scheduler event (12 bytes, little endian)
+
+  time is hal_cycle_count(), or the tick counter if not available.
+  state and reason are of the task at the event, and vm_id is 0
+  for the ISR events.
+*/
+typedef struct SCHED_EVENT {
+  uint32_t time;		//!< time of the event.
+  uint8_t  op;			//!< SCHED_EVENT_*
+  uint8_t  vm_id;		//!< VM ID of the task.
+  uint8_t  state;		//!< TASKSTATE_*
+  uint8_t  reason;		//!< TASKREASON_*
+  uint32_t arg;			//!< depends on op.
+} SCHED_EVENT;
+
+#define SCHED_EVENT_DISPATCH	'D'	// the task starts running.
+#define SCHED_EVENT_PREEMPT	'P'	// the time slice was used up.
+#define SCHED_EVENT_BLOCK	'B'	// it sleeps, waits or is suspended.
+#define SCHED_EVENT_END		'E'	// the task finished.
+#define SCHED_EVENT_WAKEUP	'W'	// to ready. arg: the reason waited.
+#define SCHED_EVENT_SLEEP	'S'	// arg: wakeup tick.
+#define SCHED_EVENT_LOCK	'L'	// locked the mutex. arg: mutex.
+#define SCHED_EVENT_LOCK_WAIT	'M'	// waits for the mutex. arg: mutex.
+#define SCHED_EVENT_UNLOCK	'U'	// unlocked the mutex. arg: mutex.
+#define SCHED_EVENT_ISR_ENTER	'I'	// arg: IRQ number.
+#define SCHED_EVENT_ISR_EXIT	'i'	// arg: IRQ number.
+#endif
+
+
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
-#define NUM_TASK_QUEUE 4
+#define NUM_TASK_QUEUE 5
 static mrbc_tcb *task_queue_[NUM_TASK_QUEUE];
 #define q_dormant_   (task_queue_[0])
 #define q_ready_     (task_queue_[1])
 #define q_waiting_   (task_queue_[2])
 #define q_suspended_ (task_queue_[3])
+#define q_sleeping_  (task_queue_[4])	// waiting by sleep, wakeup_tick order.
 static volatile uint32_t tick_;
-static volatile uint32_t wakeup_tick_ = (1 << 16); // no significant meaning.
+
+// ready queue index. the queue is a doubly linked list in priority order,
+// and the tasks of the same priority are kept together in FIFO order.
+#define NUM_TASK_PRIORITY 256
+static mrbc_tcb *ready_tail_[NUM_TASK_PRIORITY];  // last task of each priority.
+static uint32_t ready_map_[NUM_TASK_PRIORITY / 32]; // bit n: priority n exists.
+
+#if defined(MRBC_SCHED_EVENT_LOG)
+// event ring buffer. (not used if MRBC_SCHED_EVENT_OUTPUT is defined)
+#if !defined(MRBC_SCHED_EVENT_OUTPUT)
+static SCHED_EVENT sched_event_log_[MRBC_SCHED_EVENT_LOG_SIZE];
+#endif
+static uint32_t sched_event_count_;	//!< total number of events.
+#endif
+
+#if defined(MRBC_METRICS)
+static mrbc_metric metric_dispatch_ =
+  MRBC_METRIC_INITIALIZER("sched.dispatch", MRBC_METRIC_COUNTER);
+#endif
+
+#if defined(MRBC_CLOCK_GOVERNOR)
+static uint32_t governor_start_tick_;	 // tick at the start of the period.
+static volatile uint32_t governor_busy_; // ticks with a ready task in it.
+static uint8_t governor_hold_;		 // the clock is fixed by the program.
+#endif
+
+#if defined(MRBC_DEFERRED_QUEUE_SIZE)
+//! deferred call, posted by the interrupt handler.
+typedef struct DEFERRED_CALL {
+  mrbc_deferred_func func;
+  void *arg;
+  uint32_t post_cycle;		//!< cycle count at the post.
+  volatile uint8_t ready;	//!< written, and can be called.
+} DEFERRED_CALL;
+
+static DEFERRED_CALL deferred_queue_[MRBC_DEFERRED_QUEUE_SIZE];
+static volatile int deferred_head_;	 // slots reserved. (count up)
+static volatile int deferred_tail_;	 // slots called. (count up)
+static volatile int deferred_overflow_;	 // posts dropped by the full queue.
+static uint32_t deferred_max_latency_;	 // in cycles, from the post to the call.
+static uint32_t deferred_total_latency_;
+#endif
 
 
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Functions ************************************************************/
+#if defined(MRBC_SCHED_EVENT_LOG)
+//================================================================
+/*! put a scheduler event.
+
+  @param  op	SCHED_EVENT_*
+  @param  tcb	target task, or NULL.
+  @param  arg	argument of the event.
+  @note	Call this with interrupts disabled.
+*/
+static void sched_event(int op, const mrbc_tcb *tcb, uint32_t arg)
+{
+  SCHED_EVENT ev = {
+#if defined(hal_cycle_count)
+    .time = hal_cycle_count(),
+#else
+    .time = tick_,
+#endif
+    .op = op,
+    .vm_id = tcb ? tcb->vm.vm_id : 0,
+    .state = tcb ? tcb->state : 0,
+    .reason = tcb ? tcb->reason : 0,
+    .arg = arg,
+  };
+
+#if defined(MRBC_SCHED_EVENT_OUTPUT)
+  MRBC_SCHED_EVENT_OUTPUT( &ev, sizeof(ev) );
+#else
+  sched_event_log_[sched_event_count_ % MRBC_SCHED_EVENT_LOG_SIZE] = ev;
+#endif
+  sched_event_count_++;
+}
+#endif
+
+
+//================================================================
+/*! Select task queue by task state.
+
+  @param  p_tcb	Pointer to target TCB
+  @return	Pointer to the top of queue.
+*/
+static inline mrbc_tcb ** q_select(const mrbc_tcb *p_tcb)
+{
+  // sleeping task is in the separated queue.
+  if( p_tcb->state == TASKSTATE_WAITING &&
+      (p_tcb->reason & TASKREASON_SLEEP) ) return &q_sleeping_;
+
+  //                    state value = 0  1  2  3  4  5  6  7  8
+  //                             /2   0, 0, 1, 1, 2, 2, 3, 3, 4
+  static const uint8_t conv_tbl[] = { 0,    1,    2,    0,    3 };
+  return &task_queue_[ conv_tbl[ p_tcb->state / 2 ]];
+}
+
+
+//================================================================
+/*! count leading zeros.
+*/
+static inline int clz32(uint32_t x)
+{
+#if defined(__GNUC__)
+  return __builtin_clz(x);
+#else
+  int n = 0;
+  while( !(x & 0x80000000) ) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+
+//================================================================
+/*! find the last ready task that has higher priority than given one.
+
+  @param  pri	priority.
+  @return	pointer to TCB, or NULL if not exist.
+*/
+static mrbc_tcb * q_ready_find_prev(int pri)
+{
+  int i = pri >> 5;
+  uint32_t bits = ready_map_[i] & ((1U << (pri & 31)) - 1);
+
+  while( bits == 0 ) {
+    if( --i < 0 ) return NULL;
+    bits = ready_map_[i];
+  }
+
+  return ready_tail_[ (i << 5) + 31 - clz32(bits) ];
+}
+
+
+//================================================================
+/*! Insert task(TCB) to the ready queue, at the end of the same priority.
+
+  @param  p_tcb	Pointer to target TCB
+*/
+static void q_ready_insert(mrbc_tcb *p_tcb)
+{
+  int pri = p_tcb->priority_preemption;
+  mrbc_tcb *p = ready_tail_[pri];
+
+  if( p == NULL ) {
+    p = q_ready_find_prev(pri);
+    ready_map_[pri >> 5] |= 1U << (pri & 31);
+  }
+  ready_tail_[pri] = p_tcb;
+
+  p_tcb->prev = p;
+  if( p ) {
+    p_tcb->next = p->next;
+    p->next     = p_tcb;
+  } else {
+    p_tcb->next = q_ready_;
+    q_ready_    = p_tcb;
+  }
+  if( p_tcb->next ) p_tcb->next->prev = p_tcb;
+}
+
+
+//================================================================
+/*! Delete task(TCB) from the ready queue
+
+  @param  p_tcb	Pointer to target TCB
+*/
+static void q_ready_delete(mrbc_tcb *p_tcb)
+{
+  int pri = p_tcb->priority_preemption;
+  mrbc_tcb *prev = p_tcb->prev;
+
+  if( ready_tail_[pri] == p_tcb ) {
+    if( prev && prev->priority_preemption == pri ) {
+      ready_tail_[pri] = prev;
+    } else {
+      ready_tail_[pri] = NULL;
+      ready_map_[pri >> 5] &= ~(1U << (pri & 31));
+    }
+  }
+
+  if( prev ) {
+    prev->next = p_tcb->next;
+  } else {
+    q_ready_ = p_tcb->next;
+  }
+  if( p_tcb->next ) p_tcb->next->prev = prev;
+
+  p_tcb->next = NULL;
+  p_tcb->prev = NULL;
+}
+
+
 //================================================================
 /*! Insert task(TCB) to task queue
 
@@ -70,14 +309,33 @@ static volatile uint32_t wakeup_tick_ = (1 << 16); // no significant meaning.
   The queue is sorted in priority_preemption order.
   If the same priority_preemption value is in the TCB and queue,
   it will be inserted at the end of the same value in queue.
+  The ready queue is indexed by priority, so it takes constant time.
+  The sleeping queue is sorted in wakeup_tick order instead.
 */
 static void q_insert_task(mrbc_tcb *p_tcb)
 {
   // select target queue pointer.
-  //                    state value = 0  1  2  3  4  5  6  7  8
-  //                             /2   0, 0, 1, 1, 2, 2, 3, 3, 4
-  static const uint8_t conv_tbl[] = { 0,    1,    2,    0,    3 };
-  mrbc_tcb **pp_q = &task_queue_[ conv_tbl[ p_tcb->state / 2 ]];
+  mrbc_tcb **pp_q = q_select(p_tcb);
+
+  if( pp_q == &q_ready_ ) {
+#if defined(MRBC_TASK_STATS)
+    if( p_tcb->state == TASKSTATE_READY ) {
+      p_tcb->stats.ready_cycle = hal_cycle_count();
+    }
+#endif
+    q_ready_insert(p_tcb);
+    return;
+  }
+
+  if( pp_q == &q_sleeping_ ) {
+    while( *pp_q != NULL &&
+	   (int32_t)((*pp_q)->wakeup_tick - p_tcb->wakeup_tick) <= 0 ) {
+      pp_q = &(*pp_q)->next;
+    }
+    p_tcb->next = *pp_q;
+    *pp_q       = p_tcb;
+    return;
+  }
 
   // in case of insert on top.
   if((*pp_q == NULL) ||
@@ -108,8 +366,12 @@ static void q_insert_task(mrbc_tcb *p_tcb)
 static void q_delete_task(mrbc_tcb *p_tcb)
 {
   // select target queue pointer. (same as q_insert_task)
-  static const uint8_t conv_tbl[] = { 0,    1,    2,    0,    3 };
-  mrbc_tcb **pp_q = &task_queue_[ conv_tbl[ p_tcb->state / 2 ]];
+  mrbc_tcb **pp_q = q_select(p_tcb);
+
+  if( pp_q == &q_ready_ ) {
+    q_ready_delete(p_tcb);
+    return;
+  }
 
   if( *pp_q == p_tcb ) {
     *pp_q       = p_tcb->next;
@@ -132,6 +394,43 @@ static void q_delete_task(mrbc_tcb *p_tcb)
 }
 
 
+//================================================================
+/*! add the task to the waiting list of the mutex or the wait queue.
+
+  The list is in priority order, and FIFO in the same priority.
+
+  @param  pp	pointer to the head of the list.
+  @param  tcb	waiting task.
+*/
+static void waiter_insert( mrbc_tcb **pp, mrbc_tcb *tcb )
+{
+  while( *pp != NULL && (*pp)->priority_preemption <= tcb->priority_preemption ) {
+    pp = &(*pp)->wait_next;
+  }
+  tcb->wait_next = *pp;
+  *pp = tcb;
+}
+
+
+//================================================================
+/*! remove the task from the waiting list.
+
+  @param  pp	pointer to the head of the list.
+  @param  tcb	waiting task.
+*/
+static void waiter_delete( mrbc_tcb **pp, mrbc_tcb *tcb )
+{
+  while( *pp != NULL ) {
+    if( *pp == tcb ) {
+      *pp = tcb->wait_next;
+      break;
+    }
+    pp = &(*pp)->wait_next;
+  }
+  tcb->wait_next = NULL;
+}
+
+
 //================================================================
 /*! preempt running task
 */
@@ -150,6 +449,9 @@ inline static void preempt_running_task(void)
 void mrbc_tick(void)
 {
   tick_++;
+#if defined(MRBC_CLOCK_GOVERNOR)
+  if( q_ready_ != NULL ) governor_busy_++;
+#endif
 
   // Decrease the time slice value for running tasks.
   mrbc_tcb *tcb = q_ready_;
@@ -158,38 +460,81 @@ void mrbc_tick(void)
     if( tcb->timeslice == 0 ) tcb->vm.flag_preemption = 1;
   }
 
-  // Check the wakeup tick.
-  if( (int32_t)(wakeup_tick_ - tick_) < 0 ) {
-    int flag_preemption = 0;
-    wakeup_tick_ = tick_ + (1 << 16);
-
-    // Find a wake up task in waiting task queue.
-    tcb = q_waiting_;
-    while( tcb != NULL ) {
-      mrbc_tcb *t = tcb;
-      tcb = tcb->next;
-      if( t->reason != TASKREASON_SLEEP ) continue;
-
-      if( (int32_t)(t->wakeup_tick - tick_) < 0 ) {
-        q_delete_task(t);
-        t->state  = TASKSTATE_READY;
-        t->reason = 0;
-        q_insert_task(t);
-        flag_preemption = 1;
-      } else if( (int32_t)(t->wakeup_tick - wakeup_tick_) < 0 ) {
-        wakeup_tick_ = t->wakeup_tick;
+  // Wake up the tasks from the top of sleeping queue.
+  tcb = q_sleeping_;
+  if( (tcb != NULL) && ((int32_t)(tcb->wakeup_tick - tick_) < 0) ) {
+    do {
+      q_sleeping_ = tcb->next;
+      SCHED_EVENT( SCHED_EVENT_WAKEUP, tcb, tcb->reason );
+      if( tcb->reason & TASKREASON_WAITQ ) {	// timed out.
+	waiter_delete( &tcb->wait_queue->head, tcb );
+	tcb->wait_value = 0;
       }
+      tcb->state  = TASKSTATE_READY;
+      tcb->reason = 0;
+      q_insert_task(tcb);
+      tcb = q_sleeping_;
+    } while( (tcb != NULL) && ((int32_t)(tcb->wakeup_tick - tick_) < 0) );
+
+    preempt_running_task();
+  }
+}
+
+
+#if defined(MRBC_PROFILE_SAMPLING)
+//================================================================
+/*! Sampling timer interrupt handler.
+
+  Record the instruction of the running task.
+*/
+void mrbc_profile_tick(void)
+{
+  mrbc_tcb *tcb = q_ready_;
+
+  if( tcb && tcb->state == TASKSTATE_RUNNING ) {
+    mrbc_profile_sample( &tcb->vm );
+  } else {
+    mrbc_profile_sample( 0 );
+  }
+}
+#endif
+
+
+#if defined(MRBC_TICKLESS_IDLE)
+//================================================================
+/*! Idle the CPU without tick interrupts until the next wakeup tick.
+
+  The ticks skipped by HAL are added to tick_, and the last tick
+  is delivered by mrbc_tick() as usual to wake up the sleeping task.
+*/
+static void idle_tickless(void)
+{
+  hal_disable_irq();
+
+  if( q_ready_ == NULL ) {
+    uint32_t ticks = UINT32_MAX;
+    if( q_sleeping_ ) {
+      int32_t remain = (int32_t)(q_sleeping_->wakeup_tick - tick_);
+      ticks = (remain < 0) ? 0 : (uint32_t)remain + 1;
     }
 
-    if( flag_preemption ) preempt_running_task();
+    if( ticks >= 2 ) {
+      tick_ += hal_idle_cpu_tickless( ticks );
+    } else {
+      hal_idle_cpu();
+    }
   }
+
+  hal_enable_irq();
 }
+#endif
 
 
 //================================================================
 /*! create (allocate) TCB.
 
-  @param  regs_size	num of allocated registers.
+  @param  regs_size	num of allocated registers, or 0 to fit the
+			program at mrbc_create_task. (MRBC_TASK_REGS_FIT)
   @param  task_state	task initial state.
   @param  priority	task priority.
   @return pointer to TCB or NULL.
@@ -208,8 +553,15 @@ void mrbc_tick(void)
 mrbc_tcb * mrbc_tcb_new( int regs_size, enum MrbcTaskState task_state, int priority )
 {
   mrbc_tcb *tcb;
+  int regs_alloc = regs_size;
+
+#if defined(MRBC_TASK_REGS_FIT)
+  if( regs_size == 0 ) regs_alloc = MAX_REGS_SIZE;	// shrink later.
+#else
+  if( regs_size == 0 ) regs_alloc = regs_size = MAX_REGS_SIZE;
+#endif
 
-  tcb = mrbc_raw_alloc( sizeof(mrbc_tcb) + sizeof(mrbc_value) * regs_size );
+  tcb = mrbc_raw_alloc( sizeof(mrbc_tcb) + sizeof(mrbc_value) * regs_alloc );
   if( !tcb ) return NULL;	// ENOMEM
 
   memset(tcb, 0, sizeof(mrbc_tcb));
@@ -217,6 +569,7 @@ mrbc_tcb * mrbc_tcb_new( int regs_size, enum MrbcTaskState task_state, int prior
   memcpy( tcb->type, "TCB", 4 );
 #endif
   tcb->priority = priority;
+  tcb->timeslice_ticks = MRBC_TIMESLICE_TICK_COUNT;
   tcb->state = task_state;
   tcb->vm.regs_size = regs_size;
 
@@ -233,7 +586,7 @@ mrbc_tcb * mrbc_tcb_new( int regs_size, enum MrbcTaskState task_state, int prior
 */
 mrbc_tcb * mrbc_create_task(const void *byte_code, mrbc_tcb *tcb)
 {
-  if( !tcb ) tcb = mrbc_tcb_new( MAX_REGS_SIZE, MRBC_TASK_DEFAULT_STATE, MRBC_TASK_DEFAULT_PRIORITY );
+  if( !tcb ) tcb = mrbc_tcb_new( 0, MRBC_TASK_DEFAULT_STATE, MRBC_TASK_DEFAULT_PRIORITY );
   if( !tcb ) return NULL;	// ENOMEM
 
   tcb->priority_preemption = tcb->priority;
@@ -244,11 +597,37 @@ mrbc_tcb * mrbc_create_task(const void *byte_code, mrbc_tcb *tcb)
     return NULL;
   }
 
+#if defined(MRBC_ALLOC_ARENA)
+  if( tcb->arena_size != 0 ) {
+    int ret = tcb->arena_memory ?
+      mrbc_alloc_arena_attach( &tcb->vm, tcb->arena_memory, tcb->arena_size ) :
+      mrbc_alloc_arena_create( &tcb->vm, tcb->arena_size );
+    if( ret != 0 ) {
+      mrbc_printf("Warning: Can't reserve the arena, use the memory pool.\n");
+    }
+  }
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+  mrbc_alloc_set_quota( &tcb->vm, tcb->quota );
+#endif
+
   if( mrbc_load_mrb(&tcb->vm, byte_code) != 0 ) {
     mrbc_print_vm_exception( &tcb->vm );
     mrbc_vm_close( &tcb->vm );
     return NULL;
   }
+
+#if defined(MRBC_TASK_REGS_FIT)
+  if( tcb->vm.regs_size == 0 ) {
+    int regs_size = mrbc_irep_regs_depth( tcb->vm.top_irep ) + MRBC_TASK_REGS_MARGIN;
+    if( regs_size > MAX_REGS_SIZE ) regs_size = MAX_REGS_SIZE;
+    tcb->vm.regs_size = regs_size;
+#if !defined(MRBC_ALLOC_LIBC)
+    // shrink in place, the address doesn't change.
+    mrbc_raw_realloc( tcb, sizeof(mrbc_tcb) + sizeof(mrbc_value) * regs_size );
+#endif
+  }
+#endif
   mrbc_vm_begin( &tcb->vm );
 
   hal_disable_irq();
@@ -278,6 +657,88 @@ void mrbc_set_task_name(mrbc_tcb *tcb, const char *name)
 }
 
 
+//================================================================
+/*! set the time slice length of the task.
+
+  @param  tcb	target task.
+  @param  ticks	time slice in ticks (1..255), or 0 to run until it
+		blocks or a higher priority task becomes ready.
+  @note	0 can't be used with MRBC_NO_TIMER.
+*/
+void mrbc_set_task_timeslice(mrbc_tcb *tcb, int ticks)
+{
+  tcb->timeslice_ticks = ticks;
+}
+
+
+//================================================================
+/*! set the arena size for the task.
+
+  Call this before mrbc_create_task(). The task allocates its objects
+  in its own arena, and it is reset at once when the task finishes.
+  This is effective only if MRBC_ALLOC_ARENA is defined.
+
+  @param  tcb	target task.
+  @param  size	arena size in bytes, or 0 if not use.
+*/
+void mrbc_set_task_arena(mrbc_tcb *tcb, unsigned int size)
+{
+#if defined(MRBC_ALLOC_ARENA)
+  tcb->arena_size = size;
+  tcb->arena_memory = NULL;
+#else
+  (void)tcb;
+  (void)size;
+#endif
+}
+
+
+//================================================================
+/*! set the memory for the arena of the task.
+
+  Same as mrbc_set_task_arena(), but the arena is the given memory
+  out of the memory pool, as an independent heap of the task.
+  The memory can be reused after the task finishes.
+
+  @param  tcb	target task.
+  @param  ptr	pointer to the memory. (4 byte aligned)
+  @param  size	size of the memory in bytes. (max 64KB)
+*/
+void mrbc_set_task_arena_memory(mrbc_tcb *tcb, void *ptr, unsigned int size)
+{
+#if defined(MRBC_ALLOC_ARENA)
+  tcb->arena_size = ptr ? size : 0;
+  tcb->arena_memory = ptr;
+#else
+  (void)tcb;
+  (void)ptr;
+  (void)size;
+#endif
+}
+
+
+//================================================================
+/*! set the memory quota for the task.
+
+  Call this before mrbc_create_task(). The allocation over the quota
+  fails as ENOMEM and NoMemoryError in this task only, so the other
+  tasks are protected.
+  This is effective only if MRBC_ALLOC_VM_STATS is defined.
+
+  @param  tcb	target task.
+  @param  size	limit of the used bytes, or 0 if unlimited.
+*/
+void mrbc_set_task_quota(mrbc_tcb *tcb, unsigned int size)
+{
+#if defined(MRBC_ALLOC_VM_STATS)
+  tcb->quota = size;
+#else
+  (void)tcb;
+  (void)size;
+#endif
+}
+
+
 //================================================================
 /*! find task by name
 
@@ -318,7 +779,14 @@ int mrbc_start_task(mrbc_tcb *tcb)
   q_delete_task(tcb);
   tcb->state = TASKSTATE_READY;
   tcb->reason = 0;
+  tcb->event_mask = 0;
+  tcb->wait_queue = NULL;
+  tcb->period_ticks = 0;
+  tcb->n_overrun = 0;
   tcb->priority_preemption = tcb->priority;
+#if defined(MRBC_TASK_STATS)
+  memset( &tcb->stats, 0, sizeof(tcb->stats) );
+#endif
   q_insert_task(tcb);
 
   hal_enable_irq();
@@ -327,48 +795,255 @@ int mrbc_start_task(mrbc_tcb *tcb)
 }
 
 
+#if defined(MRBC_CLOCK_GOVERNOR)
 //================================================================
-/*! execute
+/*! restart the review period of the clock governor.
+*/
+static void governor_restart(void)
+{
+  hal_disable_irq();
+  governor_start_tick_ = tick_;
+  governor_busy_ = 0;
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! scale the CPU clock by the ready queue occupancy.
 
+  The load is the ratio of the ticks that any task was ready in the
+  period. The clock goes to the full speed at once when a task has to
+  wait for the CPU, or the load is high, and steps down a level when
+  the load is low. The tasks sleeping or waiting for I/O don't count.
 */
-int mrbc_run(void)
+static void clock_governor(void)
 {
-  int ret = 0;
-#if MRBC_SCHEDULER_EXIT
-  if( !q_ready_ && !q_waiting_ && !q_suspended_ ) return ret;
-#endif
+  if( governor_hold_ ) return;
 
-  while( 1 ) {
-    mrbc_tcb *tcb = q_ready_;
-    if( tcb == NULL ) {		// no task to run.
-      hal_idle_cpu();
-      continue;
-    }
+  int level = hal_clock_get_level();
 
-    /*
-      run the task.
-    */
-    tcb->state = TASKSTATE_RUNNING;   // to execute.
-    tcb->timeslice = MRBC_TIMESLICE_TICK_COUNT;
+  // a burst. the task behind the first one waits for the CPU.
+  if( level != 0 && q_ready_ != NULL && q_ready_->next != NULL ) {
+    hal_clock_set_level( 0 );
+    governor_restart();
+    return;
+  }
 
-#if !defined(MRBC_NO_TIMER)
-    // Using hardware timer.
-    int ret_vm_run = mrbc_vm_run(&tcb->vm);
-    tcb->vm.flag_preemption = 0;
-#else
-    // Emulate time slice preemption.
-    int ret_vm_run;
-    tcb->vm.flag_preemption = 1;
-    while( tcb->timeslice != 0 ) {
-      ret_vm_run = mrbc_vm_run( &tcb->vm );
-      tcb->timeslice--;
-      if( ret_vm_run != 0 ) break;
-      if( tcb->state != TASKSTATE_RUNNING ) break;
-    }
-    mrbc_tick();
-#endif
+  uint32_t ticks = tick_ - governor_start_tick_;
+  if( ticks < MRBC_CLOCK_GOVERNOR_PERIOD ) return;
 
-    /*
+  uint32_t load = governor_busy_ * 100 / ticks;
+  if( load >= MRBC_CLOCK_GOVERNOR_UP ) {
+    level = 0;
+  } else if( load <= MRBC_CLOCK_GOVERNOR_DOWN && level < MRBC_CLOCK_LEVELS-1 ) {
+    level++;
+  }
+  hal_clock_set_level( level );
+  governor_restart();
+}
+
+
+//================================================================
+/*! hold or release the clock governor.
+
+  The program fixes the clock by hal_clock_set_level() while holding.
+
+  @param  flag	1: hold, 0: release.
+*/
+void mrbc_clock_governor_hold(int flag)
+{
+  governor_hold_ = !!flag;
+  if( !flag ) governor_restart();
+}
+#endif
+
+
+#if defined(MRBC_DEFERRED_QUEUE_SIZE)
+//================================================================
+/*! post the deferred call, from the interrupt handler.
+
+  The function is called in the thread context by the scheduler, before
+  the next task runs. The slot is reserved by compare-and-swap, so this
+  can be called from the nested interrupts without disabling them.
+
+  @param  func	function to call.
+  @param  arg	argument of the function.
+  @return	0 if posted, or -1 if the queue is full.
+*/
+int mrbc_defer_from_isr(mrbc_deferred_func func, void *arg)
+{
+  int head;
+  do {
+    head = deferred_head_;
+    if( (unsigned int)(head - deferred_tail_) >= MRBC_DEFERRED_QUEUE_SIZE ) {
+      int n;
+      do {
+	n = deferred_overflow_;
+      } while( !hal_compare_and_swap( &deferred_overflow_, n, n+1 ) );
+      return -1;
+    }
+  } while( !hal_compare_and_swap( &deferred_head_, head, head+1 ) );
+
+  DEFERRED_CALL *dc = &deferred_queue_[(unsigned int)head % MRBC_DEFERRED_QUEUE_SIZE];
+  dc->func = func;
+  dc->arg = arg;
+#if defined(hal_cycle_count)
+  dc->post_cycle = hal_cycle_count();
+#endif
+  __DMB();
+  dc->ready = 1;
+
+  preempt_running_task();	// to run it before the time slice ends.
+  return 0;
+}
+
+
+//================================================================
+/*! call the deferred functions posted.
+
+  The slots are taken in the order of the reservation, so a slot that
+  is being written by an interrupted handler stops the drain until the
+  next time.
+*/
+static void deferred_drain(void)
+{
+  while( deferred_tail_ != deferred_head_ ) {
+    DEFERRED_CALL *dc = &deferred_queue_[(unsigned int)deferred_tail_ % MRBC_DEFERRED_QUEUE_SIZE];
+    if( !dc->ready ) break;
+
+    mrbc_deferred_func func = dc->func;
+    void *arg = dc->arg;
+#if defined(hal_cycle_count)
+    uint32_t latency = hal_cycle_count() - dc->post_cycle;
+    if( deferred_max_latency_ < latency ) deferred_max_latency_ = latency;
+    deferred_total_latency_ += latency;
+#endif
+    dc->ready = 0;
+    __DMB();
+    deferred_tail_++;	// the slot may be reused from here.
+
+    func( arg );
+  }
+}
+
+
+//================================================================
+/*! get the statistics of the deferred call queue.
+
+  @param  st	pointer to the result.
+*/
+void mrbc_deferred_statistics(MRBC_DEFERRED_STATISTICS *st)
+{
+  st->n_posted = deferred_head_;
+  st->n_run = deferred_tail_;
+  st->n_overflow = deferred_overflow_;
+  st->max_latency = deferred_max_latency_;
+  st->total_latency = deferred_total_latency_;
+}
+#endif
+
+
+//================================================================
+/*! execute
+
+*/
+int mrbc_run(void)
+{
+  int ret = 0;
+#if MRBC_SCHEDULER_EXIT
+  if( !q_ready_ && !q_waiting_ && !q_sleeping_ && !q_suspended_ ) return ret;
+#endif
+
+  while( 1 ) {
+#if defined(MRBC_CLOCK_GOVERNOR)
+    clock_governor();
+#endif
+#if defined(MRBC_DEFERRED_QUEUE_SIZE)
+    deferred_drain();		// prior to the tasks.
+#endif
+    mrbc_tcb *tcb = q_ready_;
+    if( tcb == NULL ) {		// no task to run.
+#if defined(MRBC_DEFERRED_QUEUE_SIZE)
+      if( deferred_tail_ != deferred_head_ ) continue;
+#endif
+      mrbc_console_flush();
+#if defined(MRBC_CYCLE_COLLECT)
+      if( mrbc_cycle_collect_step() ) continue;	// and check the ready queue.
+#endif
+#if defined(MRBC_ALLOC_COMPACT)
+      if( mrbc_alloc_compact_step() ) continue;
+#endif
+#if defined(MRBC_TICKLESS_IDLE)
+      idle_tickless();
+#else
+      hal_idle_cpu();
+#endif
+      continue;
+    }
+
+    /*
+      run the task.
+    */
+    tcb->state = TASKSTATE_RUNNING;   // to execute.
+    tcb->timeslice = tcb->timeslice_ticks;
+#if defined(MRBC_SCHED_EVENT_LOG)
+    hal_disable_irq();
+    SCHED_EVENT( SCHED_EVENT_DISPATCH, tcb, tcb->priority_preemption );
+    hal_enable_irq();
+#endif
+#if defined(MRBC_METRICS)
+    mrbc_metric_add( &metric_dispatch_, 1 );
+#endif
+
+#if defined(MRBC_TASK_STATS)
+    uint32_t cycle_start = hal_cycle_count();
+    uint32_t latency = cycle_start - tcb->stats.ready_cycle;
+    if( tcb->stats.max_latency < latency ) tcb->stats.max_latency = latency;
+    tcb->stats.n_dispatch++;
+#endif
+#if defined(MRBC_PROFILE_CALLS)
+    mrbc_profile_vm_resume( &tcb->vm );
+#endif
+
+#if !defined(MRBC_NO_TIMER)
+    // Using hardware timer.
+    int ret_vm_run = mrbc_vm_run(&tcb->vm);
+    tcb->vm.flag_preemption = 0;
+#else
+    // Emulate time slice preemption, by the budget of a tick.
+    int ret_vm_run;
+    while( tcb->timeslice != 0 ) {
+      tcb->vm.insn_budget = MRBC_NO_TIMER_BUDGET;
+      ret_vm_run = mrbc_vm_run( &tcb->vm );
+      tcb->vm.flag_preemption = 0;
+      tcb->timeslice--;
+      if( ret_vm_run != 0 ) break;
+      if( tcb->state != TASKSTATE_RUNNING ) break;
+    }
+    mrbc_tick();
+#endif
+
+#if defined(MRBC_PROFILE_CALLS)
+    mrbc_profile_vm_suspend( &tcb->vm );
+#endif
+#if defined(MRBC_TASK_STATS)
+    tcb->stats.cycles += hal_cycle_count() - cycle_start;
+    if( ret_vm_run == 0 && tcb->state == TASKSTATE_RUNNING ) {
+      tcb->stats.n_preempt++;
+    }
+#endif
+#if defined(MRBC_SCHED_EVENT_LOG)
+    hal_disable_irq();
+    if( ret_vm_run != 0 ) {
+      SCHED_EVENT( SCHED_EVENT_END, tcb, ret_vm_run );
+    } else {
+      SCHED_EVENT( tcb->state == TASKSTATE_RUNNING ?
+		   SCHED_EVENT_PREEMPT : SCHED_EVENT_BLOCK, tcb, 0 );
+    }
+    hal_enable_irq();
+#endif
+
+    /*
       did the task done?
     */
     if( ret_vm_run != 0 ) {
@@ -385,6 +1060,7 @@ int mrbc_run(void)
       for( mrbc_tcb *tcb1 = q_waiting_; tcb1 != NULL; tcb1 = tcb1->next ) {
         if( tcb1->reason == TASKREASON_JOIN && tcb1->tcb_join == tcb ) {
           hal_disable_irq();
+          SCHED_EVENT( SCHED_EVENT_WAKEUP, tcb1, tcb1->reason );
           q_delete_task(tcb1);
           tcb1->state = TASKSTATE_READY;
           tcb1->reason = 0;
@@ -399,7 +1075,7 @@ int mrbc_run(void)
       }
 
 #if MRBC_SCHEDULER_EXIT
-      if( !q_ready_ && !q_waiting_ && !q_suspended_ ) return ret;
+      if( !q_ready_ && !q_waiting_ && !q_sleeping_ && !q_suspended_ ) return ret;
 #endif
       continue;
     }
@@ -421,192 +1097,639 @@ int mrbc_run(void)
 
 
 //================================================================
-/*! sleep for a specified number of milliseconds.
+/*! sleep for a specified number of milliseconds.
+
+  @param  tcb	target task.
+  @param  ms	sleep milliseconds.
+*/
+void mrbc_sleep_ms(mrbc_tcb *tcb, uint32_t ms)
+{
+  hal_disable_irq();
+  q_delete_task(tcb);
+  tcb->state       = TASKSTATE_WAITING;
+  tcb->reason      = TASKREASON_SLEEP;
+  tcb->wakeup_tick = tick_ + (ms / MRBC_TICK_UNIT) + !!(ms % MRBC_TICK_UNIT);
+  q_insert_task(tcb);
+  SCHED_EVENT( SCHED_EVENT_SLEEP, tcb, tcb->wakeup_tick );
+  hal_enable_irq();
+
+  tcb->vm.flag_preemption = 1;
+}
+
+
+//================================================================
+/*! sleep until the tick.
+
+  @note	Call this with interrupts disabled.
+*/
+static void sleep_until_tick(mrbc_tcb *tcb, uint32_t tick)
+{
+  q_delete_task(tcb);
+  tcb->state       = TASKSTATE_WAITING;
+  tcb->reason      = TASKREASON_SLEEP;
+  tcb->wakeup_tick = tick - 1;		// mrbc_tick() wakes it up at tick.
+  q_insert_task(tcb);
+  SCHED_EVENT( SCHED_EVENT_SLEEP, tcb, tcb->wakeup_tick );
+
+  tcb->vm.flag_preemption = 1;
+}
+
+
+//================================================================
+/*! sleep until the absolute tick.
+
+  @param  tcb	target task.
+  @param  tick	wakeup tick.
+  @return	0 if sleeps, or -1 if the tick has already come.
+*/
+int mrbc_sleep_until(mrbc_tcb *tcb, uint32_t tick)
+{
+  int ret = -1;
+
+  hal_disable_irq();
+  if( (int32_t)(tick - tick_) > 0 ) {
+    sleep_until_tick( tcb, tick );
+    ret = 0;
+  }
+  hal_enable_irq();
+
+  return ret;
+}
+
+
+//================================================================
+/*! sleep until the next period.
+
+  The release times are counted from the first call, so that the
+  periods don't drift by the processing time. If the next release
+  time has already come (overrun), the task continues without sleep,
+  and the release times that have passed are skipped.
+
+  @param  tcb	target task.
+  @param  ms	period in milliseconds.
+  @return	number of missed periods, or 0 if in time.
+*/
+int mrbc_sleep_period(mrbc_tcb *tcb, uint32_t ms)
+{
+  uint32_t period = (ms / MRBC_TICK_UNIT) + !!(ms % MRBC_TICK_UNIT);
+  if( period == 0 ) period = 1;
+  int missed = 0;
+
+  hal_disable_irq();
+
+  // first call, or the period has been changed.
+  if( tcb->period_ticks != period ) {
+    tcb->period_ticks = period;
+    tcb->release_tick = tick_;
+  }
+
+  uint32_t next = tcb->release_tick + period;
+  int32_t late = (int32_t)(tick_ - next);
+  if( late < 0 ) {
+    sleep_until_tick( tcb, next );
+  } else {
+    missed = late / period + 1;
+    next += (missed - 1) * period;
+    tcb->n_overrun += missed;
+  }
+  tcb->release_tick = next;
+
+  hal_enable_irq();
+
+  return missed;
+}
+
+
+//================================================================
+/*! wake up the task.
+
+  @param  tcb		target task.
+*/
+void mrbc_wakeup_task(mrbc_tcb *tcb)
+{
+  switch( tcb->state ) {
+  case TASKSTATE_SUSPENDED:
+    mrbc_resume_task( tcb );    // for sleep without arguments.
+    break;
+
+  case TASKSTATE_WAITING:
+    if( tcb->reason != TASKREASON_SLEEP ) break;
+
+    hal_disable_irq();
+    SCHED_EVENT( SCHED_EVENT_WAKEUP, tcb, tcb->reason );
+    q_delete_task(tcb);
+    tcb->state = TASKSTATE_READY;
+    tcb->reason = 0;
+    q_insert_task(tcb);
+    hal_enable_irq();
+    break;
+
+  default:
+    break;
+  }
+}
+
+
+//================================================================
+/*! Relinquish control to other tasks.
+
+  @param  tcb	target task.
+*/
+void mrbc_relinquish(mrbc_tcb *tcb)
+{
+  tcb->timeslice          = 0;
+  tcb->vm.flag_preemption = 1;
+}
+
+
+//================================================================
+/*! update the effective priority of the mutex owner.
+
+  The owner inherits the highest priority of the tasks waiting for
+  the mutexes it holds, or goes back to its own priority.
+
+  @param  tcb	target task.
+  @return	non-zero if the priority has been changed.
+  @note	Call this with interrupts disabled.
+*/
+static int mutex_update_priority( mrbc_tcb *tcb )
+{
+  int pri = tcb->priority;
+
+  for( const mrbc_tcb *t = q_waiting_; t != NULL; t = t->next ) {
+    if( t->reason == TASKREASON_MUTEX && t->mutex->tcb == tcb &&
+	t->priority_preemption < pri ) pri = t->priority_preemption;
+  }
+  if( pri == tcb->priority_preemption ) return 0;
+
+  q_delete_task(tcb);		// reorder task queue according to priority.
+  tcb->priority_preemption = pri;
+  q_insert_task(tcb);
+
+  return 1;
+}
+
+
+//================================================================
+/*! change task priority.
+
+  @param  tcb		target task.
+  @param  priority	priority value. between 1 and 255.
+*/
+void mrbc_change_priority(mrbc_tcb *tcb, int priority)
+{
+  hal_disable_irq();
+  q_delete_task(tcb);       // reorder task queue according to priority.
+  tcb->priority            = priority;
+  tcb->priority_preemption = priority;
+  q_insert_task(tcb);
+  mutex_update_priority(tcb);	// keep the inherited priority.
+
+  if( tcb->state & TASKSTATE_READY ) preempt_running_task();
+
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! Suspend the task.
+
+  @param  tcb		target task.
+*/
+void mrbc_suspend_task(mrbc_tcb *tcb)
+{
+  if( tcb->state == TASKSTATE_SUSPENDED ) return;
+
+  hal_disable_irq();
+  q_delete_task(tcb);
+  tcb->state = TASKSTATE_SUSPENDED;
+  q_insert_task(tcb);
+  hal_enable_irq();
+
+  tcb->vm.flag_preemption = 1;
+}
+
+
+//================================================================
+/*! resume the task
+
+  @param  tcb		target task.
+*/
+void mrbc_resume_task(mrbc_tcb *tcb)
+{
+  if( tcb->state != TASKSTATE_SUSPENDED ) return;
+
+  int flag_to_ready_state = (tcb->reason == 0);
+
+  hal_disable_irq();
+
+  if( flag_to_ready_state ) {
+    preempt_running_task();
+    SCHED_EVENT( SCHED_EVENT_WAKEUP, tcb, 0 );
+  }
+
+  q_delete_task(tcb);
+  tcb->state = flag_to_ready_state ? TASKSTATE_READY : TASKSTATE_WAITING;
+  q_insert_task(tcb);
+
+  hal_enable_irq();
+}
+
+
+//================================================================
+/*! terminate the task.
+
+  @param  tcb		target task.
+  @note
+    This API simply ends the task.
+    note that this does not affect the lock status of mutex.
+*/
+void mrbc_terminate_task(mrbc_tcb *tcb)
+{
+  if( tcb->state == TASKSTATE_DORMANT ) return;
+
+  hal_disable_irq();
+  q_delete_task(tcb);
+  tcb->state = TASKSTATE_DORMANT;
+  q_insert_task(tcb);
+
+  // stop waiting for the mutex, and the owner loses the priority by it.
+  if( tcb->reason == TASKREASON_MUTEX ) {
+    waiter_delete( &tcb->mutex->waiter, tcb );
+    tcb->reason = 0;
+    mutex_update_priority( tcb->mutex->tcb );
+  }
+  if( tcb->reason & TASKREASON_WAITQ ) {
+    waiter_delete( &tcb->wait_queue->head, tcb );
+    tcb->reason = 0;
+  }
+  tcb->wait_queue = NULL;
+  hal_enable_irq();
+
+  tcb->vm.flag_preemption = 1;
+}
+
+
+//================================================================
+/*! join the task.
+
+  @param  tcb		target task.
+  @param  tcb_join	join task.
+*/
+void mrbc_join_task(mrbc_tcb *tcb, const mrbc_tcb *tcb_join)
+{
+  if( tcb->state == TASKSTATE_DORMANT ) return;
+  if( tcb_join->state == TASKSTATE_DORMANT ) return;
+
+  hal_disable_irq();
+  q_delete_task(tcb);
+
+  tcb->state    = TASKSTATE_WAITING;
+  tcb->reason   = TASKREASON_JOIN;
+  tcb->tcb_join = tcb_join;
+
+  q_insert_task(tcb);
+  hal_enable_irq();
+
+  tcb->vm.flag_preemption = 1;
+}
+
+
+//================================================================
+/*! wait for the I/O object to become ready.
+
+  @param  tcb		target task.
+  @param  io_obj	waiting I/O object, such as a device handle.
+  @note
+    Call this with interrupts disabled, following the check that
+    the I/O is not ready, so that the wakeup is not missed.
+*/
+void mrbc_wait_io(mrbc_tcb *tcb, const void *io_obj)
+{
+  q_delete_task(tcb);
+  tcb->state  = TASKSTATE_WAITING;
+  tcb->reason = TASKREASON_IO;
+  tcb->io_obj = io_obj;
+  tcb->n_io_set = 0;
+  q_insert_task(tcb);
+
+  tcb->vm.flag_preemption = 1;
+}
+
+
+//================================================================
+/*! wait for the I/O object to become ready, with timeout.
 
-  @param  tcb	target task.
-  @param  ms	sleep milliseconds.
+  @param  tcb		target task.
+  @param  io_obj	waiting I/O object, such as a device handle.
+  @param  ms		timeout in milliseconds.
+  @note
+    Same as mrbc_wait_io, but the task is also woken up by the timeout.
+    The caller distinguishes the two by checking the I/O again.
 */
-void mrbc_sleep_ms(mrbc_tcb *tcb, uint32_t ms)
+void mrbc_wait_io_timeout(mrbc_tcb *tcb, const void *io_obj, uint32_t ms)
 {
-  hal_disable_irq();
   q_delete_task(tcb);
-  tcb->state       = TASKSTATE_WAITING;
-  tcb->reason      = TASKREASON_SLEEP;
+  tcb->state  = TASKSTATE_WAITING;
+  tcb->reason = TASKREASON_IO | TASKREASON_SLEEP;
+  tcb->io_obj = io_obj;
+  tcb->n_io_set = 0;
   tcb->wakeup_tick = tick_ + (ms / MRBC_TICK_UNIT) + !!(ms % MRBC_TICK_UNIT);
-
-  if( (int32_t)(tcb->wakeup_tick - wakeup_tick_) < 0 ) {
-    wakeup_tick_ = tcb->wakeup_tick;
-  }
-
   q_insert_task(tcb);
-  hal_enable_irq();
+  SCHED_EVENT( SCHED_EVENT_SLEEP, tcb, tcb->wakeup_tick );
 
   tcb->vm.flag_preemption = 1;
 }
 
 
 //================================================================
-/*! wake up the task.
+/*! wait for any of the I/O objects to become ready.
 
   @param  tcb		target task.
+  @param  io_set	waiting I/O objects, kept until woken up.
+  @param  n		number of io_set. (1..255)
+  @param  ms		timeout in milliseconds, or -1 to wait forever.
+  @note
+    Same as mrbc_wait_io, for Reactor. The caller checks all of them
+    again to find the ready ones.
 */
-void mrbc_wakeup_task(mrbc_tcb *tcb)
+void mrbc_wait_io_set(mrbc_tcb *tcb, const void * const io_set[], int n, int ms)
 {
-  switch( tcb->state ) {
-  case TASKSTATE_SUSPENDED:
-    mrbc_resume_task( tcb );    // for sleep without arguments.
-    break;
+  q_delete_task(tcb);
+  tcb->state  = TASKSTATE_WAITING;
+  tcb->reason = TASKREASON_IO;
+  tcb->io_obj = NULL;
+  tcb->io_set = io_set;
+  tcb->n_io_set = n;
+  if( ms >= 0 ) {
+    tcb->reason |= TASKREASON_SLEEP;
+    tcb->wakeup_tick = tick_ + (ms / MRBC_TICK_UNIT) + !!(ms % MRBC_TICK_UNIT);
+  }
+  q_insert_task(tcb);
+  if( ms >= 0 ) SCHED_EVENT( SCHED_EVENT_SLEEP, tcb, tcb->wakeup_tick );
 
-  case TASKSTATE_WAITING:
-    if( tcb->reason != TASKREASON_SLEEP ) break;
+  tcb->vm.flag_preemption = 1;
+}
 
-    hal_disable_irq();
-    q_delete_task(tcb);
-    tcb->state = TASKSTATE_READY;
-    tcb->reason = 0;
-    q_insert_task(tcb);
 
-    for( mrbc_tcb *t = q_waiting_; t != NULL; t = t->next ) {
-      if( t->reason != TASKREASON_SLEEP ) continue;
-      if( (int32_t)(t->wakeup_tick - wakeup_tick_) < 0 ) {
-        wakeup_tick_ = t->wakeup_tick;
-      }
-    }
-    hal_enable_irq();
-    break;
+//================================================================
+/*! check the task waits for the I/O object.
+*/
+static int tcb_waits_io(const mrbc_tcb *tcb, const void *io_obj)
+{
+  if( !(tcb->reason & TASKREASON_IO) ) return 0;
+  if( tcb->io_obj == io_obj ) return 1;
 
-  default:
-    break;
+  for( int i = 0; i < tcb->n_io_set; i++ ) {
+    if( tcb->io_set[i] == io_obj ) return 1;
   }
+  return 0;
 }
 
 
 //================================================================
-/*! Relinquish control to other tasks.
+/*! wake up all tasks waiting for the I/O object.
 
-  @param  tcb	target task.
+  @param  io_obj	I/O object.
+  @note  This can be called from interrupt handler.
 */
-void mrbc_relinquish(mrbc_tcb *tcb)
+void mrbc_wakeup_io(const void *io_obj)
 {
-  tcb->timeslice          = 0;
-  tcb->vm.flag_preemption = 1;
+  int flag_wakeup = 0;
+
+  hal_disable_irq();
+
+  // waiting without timeout is in q_waiting_, with timeout in q_sleeping_.
+  mrbc_tcb *tcb;
+  for( int i = 0; i < 2; i++ ) {
+    tcb = (i == 0) ? q_waiting_ : q_sleeping_;
+    while( tcb != NULL ) {
+      mrbc_tcb *tcb_next = tcb->next;
+      if( tcb_waits_io( tcb, io_obj ) ) {
+        SCHED_EVENT( SCHED_EVENT_WAKEUP, tcb, tcb->reason );
+        q_delete_task(tcb);
+        tcb->state = TASKSTATE_READY;
+        tcb->reason = 0;
+        q_insert_task(tcb);
+        flag_wakeup = 1;
+      }
+      tcb = tcb_next;
+    }
+  }
+
+  for( tcb = q_suspended_; tcb != NULL; tcb = tcb->next ) {
+    if( tcb_waits_io( tcb, io_obj ) ) {
+      tcb->reason = 0;
+    }
+  }
+
+  if( flag_wakeup ) preempt_running_task();
+
+  hal_enable_irq();
 }
 
 
 //================================================================
-/*! change task priority.
+/*! notify events to the task.
+
+  Sets the bits to the event bits of the task, and wakes it up
+  if it is waiting for any of them by Task.wait_event.
 
   @param  tcb		target task.
-  @param  priority	priority value. between 1 and 255.
+  @param  bits		event bits.
+  @note  This can be called from interrupt handler, and also from tasks.
 */
-void mrbc_change_priority(mrbc_tcb *tcb, int priority)
+void mrbc_task_notify_from_isr(mrbc_tcb *tcb, uint32_t bits)
 {
-  tcb->priority            = priority;
-  tcb->priority_preemption = priority;
-
   hal_disable_irq();
-  q_delete_task(tcb);       // reorder task queue according to priority.
-  q_insert_task(tcb);
 
-  if( tcb->state & TASKSTATE_READY ) preempt_running_task();
+  tcb->event_bits |= bits;
+
+  if( (tcb->reason & TASKREASON_EVENT) && (tcb->event_bits & tcb->event_mask) ) {
+    if( tcb->state == TASKSTATE_WAITING ) {
+      SCHED_EVENT( SCHED_EVENT_WAKEUP, tcb, tcb->reason );
+      q_delete_task(tcb);
+      tcb->state = TASKSTATE_READY;
+      tcb->reason = 0;
+      q_insert_task(tcb);
+      preempt_running_task();
+    } else {
+      tcb->reason = 0;		// suspended. ready when resumed.
+    }
+  }
 
   hal_enable_irq();
 }
 
 
 //================================================================
-/*! Suspend the task.
-
-  @param  tcb		target task.
+/*! wait in the wait queue.
+
+  The C method calls this and sets vm->flag_retry_call, then it is
+  called again after the wakeup or the timeout. It gets the result by
+  mrbc_wait_queue_resumed() at the top.
+
+  @param  wq		target wait queue.
+  @param  tcb		waiting task.
+  @param  timeout	timeout in milliseconds, or -1 to wait forever.
+  @param  value		value kept in tcb->wait_value while waiting.
+  @note	Call this with interrupts disabled, following the check that
+	the object is not ready, so that the wakeup is not missed.
 */
-void mrbc_suspend_task(mrbc_tcb *tcb)
+void mrbc_wait_queue_wait(mrbc_wait_queue *wq, mrbc_tcb *tcb, int timeout, uint32_t value)
 {
-  if( tcb->state == TASKSTATE_SUSPENDED ) return;
-
-  hal_disable_irq();
   q_delete_task(tcb);
-  tcb->state = TASKSTATE_SUSPENDED;
+  tcb->state = TASKSTATE_WAITING;
+  tcb->reason = TASKREASON_WAITQ;
+  tcb->wait_queue = wq;
+  tcb->wait_value = value;
+  if( timeout >= 0 ) {
+    tcb->reason |= TASKREASON_SLEEP;
+    tcb->wakeup_tick = tick_ + (timeout / MRBC_TICK_UNIT) + !!(timeout % MRBC_TICK_UNIT);
+    SCHED_EVENT( SCHED_EVENT_SLEEP, tcb, tcb->wakeup_tick );
+  }
   q_insert_task(tcb);
-  hal_enable_irq();
+  waiter_insert( &wq->head, tcb );
 
   tcb->vm.flag_preemption = 1;
 }
 
 
 //================================================================
-/*! resume the task
+/*! check if the task is called again after waiting in the wait queue.
 
+  @param  wq		target wait queue.
   @param  tcb		target task.
+  @param  value		returns the value given at the wakeup, or 0 if timed out.
+  @return		non zero if it has waited.
 */
-void mrbc_resume_task(mrbc_tcb *tcb)
+int mrbc_wait_queue_resumed(mrbc_wait_queue *wq, mrbc_tcb *tcb, uint32_t *value)
 {
-  if( tcb->state != TASKSTATE_SUSPENDED ) return;
-
-  int flag_to_ready_state = (tcb->reason == 0);
+  if( tcb->wait_queue != wq ) return 0;
 
   hal_disable_irq();
+  tcb->wait_queue = NULL;
+  *value = tcb->wait_value;
+  hal_enable_irq();
 
-  if( flag_to_ready_state ) preempt_running_task();
+  return 1;
+}
 
-  q_delete_task(tcb);
-  tcb->state = flag_to_ready_state ? TASKSTATE_READY : TASKSTATE_WAITING;
-  q_insert_task(tcb);
 
-  hal_enable_irq();
+//================================================================
+/*! wake up the task waiting in the wait queue.
 
-  if( tcb->reason & TASKREASON_SLEEP ) {
-    if( (int32_t)(tcb->wakeup_tick - wakeup_tick_) < 0 ) {
-      wakeup_tick_ = tcb->wakeup_tick;
-    }
+  @param  wq		target wait queue.
+  @param  tcb		waiting task, in wq->head list.
+  @param  value		value given to the task, must not be 0.
+  @note	Call this with interrupts disabled. This can be called from
+	interrupt handler.
+*/
+void mrbc_wait_queue_wakeup_task(mrbc_wait_queue *wq, mrbc_tcb *tcb, uint32_t value)
+{
+  waiter_delete( &wq->head, tcb );
+  tcb->wait_value = value;
+
+  if( tcb->state == TASKSTATE_WAITING ) {
+    SCHED_EVENT( SCHED_EVENT_WAKEUP, tcb, tcb->reason );
+    q_delete_task(tcb);
+    tcb->state = TASKSTATE_READY;
+    tcb->reason = 0;
+    q_insert_task(tcb);
+    preempt_running_task();
+  } else {
+    tcb->reason = 0;		// suspended. ready when resumed.
   }
 }
 
 
 //================================================================
-/*! terminate the task.
+/*! wake up the tasks from the top of the wait queue.
 
-  @param  tcb		target task.
-  @note
-    This API simply ends the task.
-    note that this does not affect the lock status of mutex.
+  @param  wq		target wait queue.
+  @param  n		number of the tasks, or -1 for all.
+  @param  value		value given to the tasks, must not be 0.
+  @return		number of the tasks woken up.
+  @note	This can be called from interrupt handler.
 */
-void mrbc_terminate_task(mrbc_tcb *tcb)
+int mrbc_wait_queue_wakeup(mrbc_wait_queue *wq, int n, uint32_t value)
 {
-  if( tcb->state == TASKSTATE_DORMANT ) return;
+  int ret = 0;
 
   hal_disable_irq();
-  q_delete_task(tcb);
-  tcb->state = TASKSTATE_DORMANT;
-  q_insert_task(tcb);
+  while( wq->head != NULL && ret != n ) {
+    mrbc_wait_queue_wakeup_task( wq, wq->head, value );
+    ret++;
+  }
   hal_enable_irq();
 
-  tcb->vm.flag_preemption = 1;
+  return ret;
 }
 
 
+#if defined(MRBC_SCHED_EVENT_LOG)
 //================================================================
-/*! join the task.
+/*! record the entry or exit of an interrupt handler.
 
-  @param  tcb		target task.
-  @param  tcb_join	join task.
+  @param  irq		IRQ number.
+  @param  flag_exit	0: entry, 1: exit.
+  @note  Call this from interrupt handler. (see MRBC_ISR_ENTER)
 */
-void mrbc_join_task(mrbc_tcb *tcb, const mrbc_tcb *tcb_join)
+void mrbc_sched_event_isr(int irq, int flag_exit)
 {
-  if( tcb->state == TASKSTATE_DORMANT ) return;
-  if( tcb_join->state == TASKSTATE_DORMANT ) return;
-
   hal_disable_irq();
-  q_delete_task(tcb);
+  SCHED_EVENT( flag_exit ? SCHED_EVENT_ISR_EXIT : SCHED_EVENT_ISR_ENTER,
+	       NULL, irq );
+  hal_enable_irq();
+}
 
-  tcb->state    = TASKSTATE_WAITING;
-  tcb->reason   = TASKREASON_JOIN;
-  tcb->tcb_join = tcb_join;
 
-  q_insert_task(tcb);
-  hal_enable_irq();
+//================================================================
+/*! print the scheduler event ring buffer in hex, oldest first.
+
+  (format)
+    == SCHED EVENT LOG count:<total events> clock:<cycles/us or 0> ==
+    task <vm_id> <name>		for each task.
+    one event (12 bytes) in 24 hex digits per line
+    == END ==
+  clock:0 means the time is the tick counter. see tools/sched_event_decode.rb
+  If the events are streamed out, only the header and tasks are printed.
+*/
+void mrbc_print_sched_event_log(void)
+{
+#if defined(hal_cycles_per_us)
+  unsigned int clock = hal_cycles_per_us();
+#else
+  unsigned int clock = 0;
+#endif
+  uint32_t count = sched_event_count_;
 
-  tcb->vm.flag_preemption = 1;
+  mrbc_printf("== SCHED EVENT LOG count:%d clock:%d ==\n", count, clock );
+  for( int i = 0; i < NUM_TASK_QUEUE; i++ ) {
+    for( mrbc_tcb *tcb = task_queue_[i]; tcb != NULL; tcb = tcb->next ) {
+      mrbc_printf("task %d %s\n", tcb->vm.vm_id,
+		  tcb->name[0] ? tcb->name : "(noname)" );
+    }
+  }
+
+#if !defined(MRBC_SCHED_EVENT_OUTPUT)
+  uint32_t n = count < MRBC_SCHED_EVENT_LOG_SIZE ? count : MRBC_SCHED_EVENT_LOG_SIZE;
+  for( uint32_t i = count - n; i != count; i++ ) {
+    SCHED_EVENT ev;
+    hal_disable_irq();
+    ev = sched_event_log_[i % MRBC_SCHED_EVENT_LOG_SIZE];
+    hal_enable_irq();
+
+    const uint8_t *p = (const uint8_t *)&ev;
+    for( int j = 0; j < sizeof(SCHED_EVENT); j++ ) {
+      mrbc_printf("%02x", p[j] );
+    }
+    mrbc_printf("\n");
+  }
+#endif
+  mrbc_printf("== END ==\n");
 }
+#endif
 
 
 
@@ -640,13 +1763,25 @@ int mrbc_mutex_lock( mrbc_mutex *mutex, mrbc_tcb *tcb )
   MRBC_MUTEX_TRACE("mutex lock / MUTEX: %p TCB: %p",  mutex, tcb );
 
   int ret = 0;
+
+#if defined(hal_compare_and_swap)
+  // not contended, lock it without disabling interrupts.
+  if( hal_compare_and_swap( &mutex->lock, 0, 1 ) ) {
+    mutex->tcb = tcb;
+    MRBC_MUTEX_TRACE("  lock OK\n" );
+    SCHED_EVENT_IRQ( SCHED_EVENT_LOCK, tcb, (uintptr_t)mutex );
+    return 0;
+  }
+#endif
+
   hal_disable_irq();
 
   // Try lock mutex;
-  if( mutex->lock == 0 ) {      // a future does use TAS?
+  if( mutex->lock == 0 ) {
     mutex->lock = 1;
     mutex->tcb = tcb;
     MRBC_MUTEX_TRACE("  lock OK\n" );
+    SCHED_EVENT( SCHED_EVENT_LOCK, tcb, (uintptr_t)mutex );
     goto DONE;
   }
   MRBC_MUTEX_TRACE("  lock FAIL\n" );
@@ -664,7 +1799,22 @@ int mrbc_mutex_lock( mrbc_mutex *mutex, mrbc_tcb *tcb )
   tcb->reason = TASKREASON_MUTEX;
   tcb->mutex = mutex;
   q_insert_task(tcb);
+  waiter_insert( &mutex->waiter, tcb );
   tcb->vm.flag_preemption = 1;
+  SCHED_EVENT( SCHED_EVENT_LOCK_WAIT, tcb, (uintptr_t)mutex );
+
+  // priority inheritance, to the owner and the owner of the mutex
+  // that the owner is waiting for.
+  mrbc_tcb *owner = mutex->tcb;
+  while( owner->priority_preemption > tcb->priority_preemption ) {
+    q_delete_task(owner);
+    owner->priority_preemption = tcb->priority_preemption;
+    q_insert_task(owner);
+
+    if( owner->state != TASKSTATE_WAITING ||
+	owner->reason != TASKREASON_MUTEX ) break;
+    owner = owner->mutex->tcb;
+  }
 
  DONE:
   hal_enable_irq();
@@ -687,43 +1837,47 @@ int mrbc_mutex_unlock( mrbc_mutex *mutex, mrbc_tcb *tcb )
   if( !mutex->lock ) return 1;
   if( mutex->tcb != tcb ) return 2;
 
+  // no task is waiting, so no priority is inherited by this mutex.
+  // only the tasks lock and unlock, so interrupts need not be disabled.
+  if( mutex->waiter == NULL ) {
+    MRBC_MUTEX_TRACE("mutex unlock all.\n" );
+    SCHED_EVENT_IRQ( SCHED_EVENT_UNLOCK, tcb, (uintptr_t)mutex );
+    mutex->tcb = 0;
+    mutex->lock = 0;
+    return 0;
+  }
+
   hal_disable_irq();
+  SCHED_EVENT( SCHED_EVENT_UNLOCK, tcb, (uintptr_t)mutex );
 
-  // wakeup ONE waiting task if exist.
-  mrbc_tcb *tcb1;
-  for( tcb1 = q_waiting_; tcb1 != NULL; tcb1 = tcb1->next ) {
-    if( tcb1->reason == TASKREASON_MUTEX && tcb1->mutex == mutex ) break;
-  }
-  if( tcb1 ) {
+  // hand over to the first task of the waiting list.
+  mrbc_tcb *tcb1 = mutex->waiter;
+  mutex->waiter = tcb1->wait_next;
+  tcb1->wait_next = NULL;
+  mutex->tcb = tcb1;
+
+  if( tcb1->state == TASKSTATE_WAITING ) {
     MRBC_MUTEX_TRACE("SW1: TCB: %p\n", tcb1 );
-    mutex->tcb = tcb1;
 
+    SCHED_EVENT( SCHED_EVENT_WAKEUP, tcb1, tcb1->reason );
     q_delete_task(tcb1);
     tcb1->state = TASKSTATE_READY;
     tcb1->reason = 0;
     q_insert_task(tcb1);
 
+    mutex_update_priority(tcb1);
+    mutex_update_priority(tcb);
     preempt_running_task();
-    goto DONE;
-  }
 
-  // find ONE mutex locked task in suspended queue.
-  for( tcb1 = q_suspended_; tcb1 != NULL; tcb1 = tcb1->next ) {
-    if( tcb1->reason == TASKREASON_MUTEX && tcb1->mutex == mutex ) break;
-  }
-  if( tcb1 ) {
+  } else {
+    // the task is suspended. it has the mutex when resumed.
     MRBC_MUTEX_TRACE("SW2: TCB: %p\n", tcb1 );
-    mutex->tcb = tcb1;
     tcb1->reason = 0;
-    goto DONE;
+    SCHED_EVENT( SCHED_EVENT_LOCK, tcb1, (uintptr_t)mutex );
+    mutex_update_priority(tcb1);
+    if( mutex_update_priority(tcb) ) preempt_running_task();
   }
 
-  // other case, unlock mutex
-  MRBC_MUTEX_TRACE("mutex unlock all.\n" );
-  mutex->lock = 0;
-  mutex->tcb = 0;
-
- DONE:
   hal_enable_irq();
 
   return 0;
@@ -741,6 +1895,16 @@ int mrbc_mutex_trylock( mrbc_mutex *mutex, mrbc_tcb *tcb )
   MRBC_MUTEX_TRACE("mutex try lock / MUTEX: %p TCB: %p",  mutex, tcb );
 
   int ret;
+
+#if defined(hal_compare_and_swap)
+  if( hal_compare_and_swap( &mutex->lock, 0, 1 ) ) {
+    mutex->tcb = tcb;
+    MRBC_MUTEX_TRACE("  trylock OK\n" );
+    SCHED_EVENT_IRQ( SCHED_EVENT_LOCK, tcb, (uintptr_t)mutex );
+    return 0;
+  }
+#endif
+
   hal_disable_irq();
 
   if( mutex->lock == 0 ) {
@@ -748,6 +1912,7 @@ int mrbc_mutex_trylock( mrbc_mutex *mutex, mrbc_tcb *tcb )
     mutex->tcb = tcb;
     ret = 0;
     MRBC_MUTEX_TRACE("  trylock OK\n" );
+    SCHED_EVENT( SCHED_EVENT_LOCK, tcb, (uintptr_t)mutex );
   }
   else {
     MRBC_MUTEX_TRACE("  trylock FAIL\n" );
@@ -767,12 +1932,18 @@ void mrbc_cleanup(void)
 {
   mrbc_cleanup_vm();
   mrbc_cleanup_symbol();
+#if defined(MRBC_USE_SYMID_CACHE)
+  mrbc_cleanup_symid_cache();
+#endif
   mrbc_cleanup_alloc();
 
   q_dormant_ = 0;
   q_ready_ = 0;
   q_waiting_ = 0;
   q_suspended_ = 0;
+  q_sleeping_ = 0;
+  memset( ready_tail_, 0, sizeof(ready_tail_) );
+  memset( ready_map_, 0, sizeof(ready_map_) );
 }
 
 
@@ -830,6 +2001,23 @@ static void c_sleep_ms(mrbc_vm *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! (method) sleep until the tick
+
+  sleep_until( VM.tick + 100 ) -> true, or false if the tick has come.
+*/
+static void c_sleep_until(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( argc != 1 || v[1].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise( vm, MRBC_CLASS(ArgumentError), 0 );
+    return;
+  }
+
+  int ret = mrbc_sleep_until( VM2TCB(vm), mrbc_integer(v[1]) );
+  SET_BOOL_RETURN( ret == 0 );
+}
+
+
 
 /*
   Task class
@@ -961,13 +2149,84 @@ static void c_task_name(mrbc_vm *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! (method) periodic execution
+
+  while true
+    Task.every( 10 )	# every 10 ms, without drift.
+    ...
+  end
+
+  @return Integer	number of missed periods, or 0 if in time.
+*/
+static void c_task_every(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( v[0].tt != MRBC_TT_CLASS || argc != 1 ||
+      v[1].tt != MRBC_TT_INTEGER || mrbc_integer(v[1]) <= 0 ) {
+    mrbc_raise( vm, MRBC_CLASS(ArgumentError), 0 );
+    return;
+  }
+
+  SET_INT_RETURN( mrbc_sleep_period( VM2TCB(vm), mrbc_integer(v[1]) ));
+}
+
+
 //================================================================
 /*! (method) task priority setter
 
   Task.priority = n  # n = 0(high) .. 255(low)
   task.priority = n
 */
-static void c_task_set_priority(mrbc_vm *vm, mrbc_value v[], int argc)
+static void c_task_set_priority(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_tcb *tcb;
+
+  if( v[0].tt == MRBC_TT_CLASS ) {
+    tcb = VM2TCB(vm);
+  } else {
+    tcb = *(mrbc_tcb **)v[0].instance->data;
+  }
+
+  if( v[1].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise( vm, MRBC_CLASS(ArgumentError), 0 );
+    return;
+  }
+  int n = mrbc_integer( v[1] );
+  if( n < 0 || n > 255 ) {
+    mrbc_raise( vm, MRBC_CLASS(ArgumentError), 0 );
+    return;
+  }
+
+  mrbc_change_priority( tcb, n );
+}
+
+
+//================================================================
+/*! (method) task priority getter
+
+  task.priority() -> Integer
+*/
+static void c_task_priority(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_tcb *tcb;
+
+  if( v[0].tt == MRBC_TT_CLASS ) {
+    tcb = VM2TCB(vm);
+  } else {
+    tcb = *(mrbc_tcb **)v[0].instance->data;
+  }
+
+  SET_INT_RETURN( tcb->priority );
+}
+
+
+//================================================================
+/*! (method) time slice setter
+
+  Task.timeslice = 20	# current task, in milliseconds.
+  task.timeslice = 0	# no time slicing.
+*/
+static void c_task_set_timeslice(mrbc_vm *vm, mrbc_value v[], int argc)
 {
   mrbc_tcb *tcb;
 
@@ -981,22 +2240,26 @@ static void c_task_set_priority(mrbc_vm *vm, mrbc_value v[], int argc)
     mrbc_raise( vm, MRBC_CLASS(ArgumentError), 0 );
     return;
   }
-  int n = mrbc_integer( v[1] );
-  if( n < 0 || n > 255 ) {
+  int ms = mrbc_integer( v[1] );
+  int ticks = (ms / MRBC_TICK_UNIT) + !!(ms % MRBC_TICK_UNIT);
+#if defined(MRBC_NO_TIMER)
+  if( ticks == 0 ) ticks = -1;
+#endif
+  if( ticks < 0 || ticks > 255 ) {
     mrbc_raise( vm, MRBC_CLASS(ArgumentError), 0 );
     return;
   }
 
-  mrbc_change_priority( tcb, n );
+  mrbc_set_task_timeslice( tcb, ticks );
 }
 
 
 //================================================================
-/*! (method) task priority getter
+/*! (method) time slice getter
 
-  task.priority() -> Integer
+  Task.timeslice -> Integer	# in milliseconds.
 */
-static void c_task_priority(mrbc_vm *vm, mrbc_value v[], int argc)
+static void c_task_timeslice(mrbc_vm *vm, mrbc_value v[], int argc)
 {
   mrbc_tcb *tcb;
 
@@ -1006,7 +2269,7 @@ static void c_task_priority(mrbc_vm *vm, mrbc_value v[], int argc)
     tcb = *(mrbc_tcb **)v[0].instance->data;
   }
 
-  SET_INT_RETURN( tcb->priority );
+  SET_INT_RETURN( tcb->timeslice_ticks * MRBC_TICK_UNIT );
 }
 
 
@@ -1019,8 +2282,8 @@ static void c_task_status(mrbc_vm *vm, mrbc_value v[], int argc)
 {
   static const char *status_name[] =
     { "DORMANT", "READY", "WAITING ", "", "SUSPENDED" };
-  static const char *reason_name[] =
-    { "", "SLEEP", "MUTEX", "", "JOIN" };
+  static const char *reason_name[] =	// by bit position.
+    { "SLEEP", "MUTEX", "JOIN", "IO", "EVENT", "WAITQ" };
 
   if( v[0].tt == MRBC_TT_CLASS ) return;
 
@@ -1028,13 +2291,138 @@ static void c_task_status(mrbc_vm *vm, mrbc_value v[], int argc)
   mrbc_value ret = mrbc_string_new_cstr( vm, status_name[tcb->state / 2] );
 
   if( tcb->state == TASKSTATE_WAITING ) {
-    mrbc_string_append_cstr( &ret, reason_name[tcb->reason] );
+    // show the last one, such as EVENT of EVENT with SLEEP (timeout).
+    for( int i = 5; i >= 0; i-- ) {
+      if( tcb->reason & (1 << i) ) {
+	mrbc_string_append_cstr( &ret, reason_name[i] );
+	break;
+      }
+    }
+  }
+
+  SET_RETURN(ret);
+}
+
+
+#if defined(MRBC_TASK_STATS)
+//================================================================
+/*! (method) task statistics
+
+  Task.stats		# current task.
+  task.stats -> Hash
+
+  {:cpu_us=>Integer, :dispatch=>Integer, :preempt=>Integer,
+   :max_latency_us=>Integer, :overrun=>Integer}
+*/
+static void c_task_stats(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  const mrbc_tcb *tcb;
+
+  if( v[0].tt == MRBC_TT_CLASS ) {
+    tcb = VM2TCB(vm);
+  } else {
+    tcb = *(mrbc_tcb **)v[0].instance->data;
+  }
+
+  static const char * const key_name[] =
+    { "cpu_us", "dispatch", "preempt", "max_latency_us", "overrun" };
+  hal_disable_irq();
+  mrbc_int_t val[] = {
+    tcb->stats.cycles / hal_cycles_per_us(),
+    tcb->stats.n_dispatch,
+    tcb->stats.n_preempt,
+    tcb->stats.max_latency / hal_cycles_per_us(),
+    tcb->n_overrun,
+  };
+  hal_enable_irq();
+
+  mrbc_value ret = mrbc_hash_new( vm, 5 );
+  for( int i = 0; i < 5; i++ ) {
+    mrbc_value key = mrbc_symbol_value( mrbc_str_to_symid(key_name[i]) );
+    mrbc_hash_set( &ret, &key, &mrbc_integer_value(val[i]) );
+  }
+
+  SET_RETURN(ret);
+}
+#endif
+
+
+#if defined(MRBC_ALLOC_VM_STATS)
+//================================================================
+/*! (method) memory usage of the task
+
+  Task.memory_usage	# current task.
+  task.memory_usage -> Hash
+
+  {:used=>Integer, :peak=>Integer, :quota=>Integer, :quota_over=>Integer}
+
+  The counters are kept by the allocator at each alloc and free, so
+  this doesn't walk the heap. The bytes include the block headers.
+*/
+static void c_task_memory_usage(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  const mrbc_tcb *tcb;
+
+  if( v[0].tt == MRBC_TT_CLASS ) {
+    tcb = VM2TCB(vm);
+  } else {
+    tcb = *(mrbc_tcb **)v[0].instance->data;
+  }
+
+  struct MRBC_ALLOC_STATISTICS st;
+  if( tcb->state == TASKSTATE_DORMANT ||
+      mrbc_alloc_vm_statistics( tcb->vm.vm_id, &st ) != 0 ) {
+    SET_NIL_RETURN();
+    return;
+  }
+
+  static const char * const key_name[] =
+    { "used", "peak", "quota", "quota_over" };
+  mrbc_int_t val[] = { st.used, st.peak, st.quota, st.n_quota_over };
+
+  mrbc_value ret = mrbc_hash_new( vm, 4 );
+  for( int i = 0; i < 4; i++ ) {
+    mrbc_value key = mrbc_symbol_value( mrbc_str_to_symid(key_name[i]) );
+    mrbc_hash_set( &ret, &key, &mrbc_integer_value(val[i]) );
   }
 
   SET_RETURN(ret);
 }
 
 
+//================================================================
+/*! (method) set the memory quota of the task
+
+  Task.memory_quota = 8192	# current task.
+  task.memory_quota = 0		# unlimited.
+
+  The allocation over the quota raises NoMemoryError in the task only.
+  The quota is kept over Task#rewind and Task#run.
+*/
+static void c_task_set_memory_quota(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_tcb *tcb;
+
+  if( argc != 1 || mrbc_type(v[1]) != MRBC_TT_INTEGER ||
+      mrbc_integer(v[1]) < 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  if( v[0].tt == MRBC_TT_CLASS ) {
+    tcb = VM2TCB(vm);
+  } else {
+    tcb = *(mrbc_tcb **)v[0].instance->data;
+  }
+
+  tcb->quota = mrbc_integer(v[1]);
+  if( tcb->state != TASKSTATE_DORMANT ) {
+    mrbc_alloc_set_quota( &tcb->vm, tcb->quota );
+  }
+}
+#endif
+
+
 //================================================================
 /*! (method) suspend task
 
@@ -1174,6 +2562,86 @@ static void c_task_pass(mrbc_vm *vm, mrbc_value v[], int argc)
 }
 
 
+//================================================================
+/*! (method) wait for events.
+
+  Task.wait_event( mask, timeout_ms = nil ) -> Integer or nil
+
+  Returns the notified bits in the mask and clears them,
+  or nil if timed out.
+*/
+static void c_task_wait_event(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_tcb *tcb = VM2TCB(vm);
+
+  if( v[0].tt != MRBC_TT_CLASS || argc < 1 || argc > 2 ||
+      v[1].tt != MRBC_TT_INTEGER ) goto ERROR_ARGUMENT;
+
+  uint32_t mask = mrbc_integer(v[1]);
+  int timeout = -1;
+  if( argc == 2 && v[2].tt != MRBC_TT_NIL ) {
+    if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_ARGUMENT;
+    timeout = mrbc_integer(v[2]);
+    if( timeout < 0 ) goto ERROR_ARGUMENT;
+  }
+
+  hal_disable_irq();
+
+  uint32_t bits = tcb->event_bits & mask;
+  if( bits ) {
+    tcb->event_bits &= ~bits;
+    tcb->event_mask = 0;
+    hal_enable_irq();
+    SET_INT_RETURN( bits );
+    return;
+  }
+
+  // timed out, or no wait.
+  if( tcb->event_mask != 0 || timeout == 0 ) {
+    tcb->event_mask = 0;
+    hal_enable_irq();
+    SET_NIL_RETURN();
+    return;
+  }
+
+  // To WAITING state, and call this method again after wakeup.
+  q_delete_task(tcb);
+  tcb->state = TASKSTATE_WAITING;
+  tcb->reason = TASKREASON_EVENT;
+  tcb->event_mask = mask;
+  if( timeout > 0 ) {
+    tcb->reason |= TASKREASON_SLEEP;
+    tcb->wakeup_tick = tick_ + (timeout / MRBC_TICK_UNIT) + !!(timeout % MRBC_TICK_UNIT);
+  }
+  q_insert_task(tcb);
+  hal_enable_irq();
+
+  tcb->vm.flag_preemption = 1;
+  vm->flag_retry_call = 1;
+  return;
+
+ ERROR_ARGUMENT:
+  mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+}
+
+
+//================================================================
+/*! (method) notify events to the task.
+
+  task.notify( bits )
+*/
+static void c_task_notify(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  if( v[0].tt == MRBC_TT_CLASS || argc != 1 || v[1].tt != MRBC_TT_INTEGER ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+
+  mrbc_tcb *tcb = *(mrbc_tcb **)v[0].instance->data;
+  mrbc_task_notify_from_isr( tcb, mrbc_integer(v[1]) );
+}
+
+
 //================================================================
 /*! (method) create a task dynamically.
 
@@ -1182,7 +2650,7 @@ static void c_task_pass(mrbc_vm *vm, mrbc_value v[], int argc)
 static void c_task_create(mrbc_vm *vm, mrbc_value v[], int argc)
 {
   const char *byte_code;
-  int regs_size = MAX_REGS_SIZE;
+  int regs_size = 0;		// MAX_REGS_SIZE, or fit to the program.
 
   // check argument.
   if( v[0].tt != MRBC_TT_CLASS ) goto ERROR_ARGUMENT;
@@ -1191,9 +2659,10 @@ static void c_task_create(mrbc_vm *vm, mrbc_value v[], int argc)
   mrbc_incref( &v[1] );
   byte_code = mrbc_string_cstr(&v[1]);
 
-  if( argc >= 2 ) {
+  if( argc >= 2 && v[2].tt != MRBC_TT_NIL ) {
     if( v[2].tt != MRBC_TT_INTEGER ) goto ERROR_ARGUMENT;
     regs_size = mrbc_integer(v[2]);
+    if( regs_size <= 0 ) goto ERROR_ARGUMENT;
   }
 
   // create TCB
@@ -1262,6 +2731,8 @@ static void c_task_rewind(mrbc_vm *vm, mrbc_value v[], int argc)
   METHOD( "name", c_task_name )
   METHOD( "priority=", c_task_set_priority )
   METHOD( "priority", c_task_priority )
+  METHOD( "timeslice=", c_task_set_timeslice )
+  METHOD( "timeslice", c_task_timeslice )
   METHOD( "status", c_task_status )
 
   METHOD( "suspend", c_task_suspend )
@@ -1272,6 +2743,9 @@ static void c_task_rewind(mrbc_vm *vm, mrbc_value v[], int argc)
   METHOD( "join", c_task_join )
   METHOD( "value", c_task_value )
   METHOD( "pass", c_task_pass )
+  METHOD( "every", c_task_every )
+  METHOD( "wait_event", c_task_wait_event )
+  METHOD( "notify", c_task_notify )
 
   METHOD( "create", c_task_create )
   METHOD( "run", c_task_run )
@@ -1379,6 +2853,228 @@ static void c_vm_tick(mrbc_vm *vm, mrbc_value v[], int argc)
   SET_INT_RETURN(tick_);
 }
 
+#if !defined(MRBC_ALLOC_LIBC)
+//================================================================
+/*! (method) heap statistics and allocation rate
+
+  VM.alloc_stats		# memory pool.
+  VM.alloc_stats( vm_id )	# blocks owned by VM ID. (MRBC_ALLOC_VM_STATS)
+
+  {:used=>Integer, :peak=>Integer, :alloc_count=>Integer,
+   :free_count=>Integer, :alloc_bytes=>Integer, :alloc_rate=>Integer}
+
+  alloc_rate is bytes per second allocated since the previous call.
+*/
+static void c_vm_alloc_stats(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  static struct {
+    uint32_t alloc_bytes;
+    uint32_t tick;
+#if defined(MRBC_ALLOC_VM_STATS)
+  } last[MAX_VM_COUNT + 2];	// [0] is memory pool, [1..] are VM ID 0...
+#else
+  } last[1];
+#endif
+  struct MRBC_ALLOC_STATISTICS st;
+  int idx = 0;
+
+  if( argc >= 1 && mrbc_type(v[1]) != MRBC_TT_NIL ) {
+#if defined(MRBC_ALLOC_VM_STATS)
+    if( mrbc_type(v[1]) != MRBC_TT_INTEGER ||
+	mrbc_alloc_vm_statistics( mrbc_integer(v[1]), &st ) != 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+      return;
+    }
+    idx = mrbc_integer(v[1]) + 1;
+#else
+    mrbc_raise(vm, MRBC_CLASS(NotImplementedError), 0);
+    return;
+#endif
+  } else {
+    mrbc_alloc_statistics( &st );
+  }
+
+  uint32_t tick = tick_;
+  uint32_t ms = (tick - last[idx].tick) * MRBC_TICK_UNIT;
+  mrbc_int_t rate = 0;
+  if( ms != 0 ) {
+    rate = (uint64_t)(st.alloc_bytes - last[idx].alloc_bytes) * 1000 / ms;
+  }
+  last[idx].alloc_bytes = st.alloc_bytes;
+  last[idx].tick = tick;
+
+  static const char * const key_name[] =
+    { "used", "peak", "alloc_count", "free_count", "alloc_bytes", "alloc_rate" };
+  mrbc_int_t val[] = {
+    st.used, st.peak, st.n_alloc, st.n_free, st.alloc_bytes, rate,
+  };
+
+  mrbc_value ret = mrbc_hash_new( vm, 6 );
+  for( int i = 0; i < 6; i++ ) {
+    mrbc_value key = mrbc_symbol_value( mrbc_str_to_symid(key_name[i]) );
+    mrbc_hash_set( &ret, &key, &mrbc_integer_value(val[i]) );
+  }
+
+  SET_RETURN(ret);
+}
+
+
+//================================================================
+/*! (method) reset the high-water marks
+
+  VM.alloc_reset_peak
+*/
+static void c_vm_alloc_reset_peak(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_alloc_reset_peak();
+}
+#endif
+
+#if defined(MRBC_ALLOC_TRACE)
+//================================================================
+/*! (method) print heap report
+*/
+static void c_vm_heap_report(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_alloc_print_heap_report();
+}
+#endif
+
+#if defined(MRBC_ALLOC_EVENT_LOG)
+//================================================================
+/*! (method) print allocation event log
+*/
+static void c_vm_alloc_log(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_alloc_print_event_log();
+}
+#endif
+
+#if defined(MRBC_SCHED_EVENT_LOG)
+//================================================================
+/*! (method) print scheduler event log
+*/
+static void c_vm_sched_log(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_print_sched_event_log();
+}
+#endif
+
+#if defined(MRBC_PROFILE)
+//================================================================
+/*! (method) print the profile
+
+  VM.profile_dump( n = 10 )
+*/
+static void c_vm_profile_dump(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int n = 10;
+  if( argc >= 1 && mrbc_type(v[1]) == MRBC_TT_INTEGER ) {
+    n = mrbc_integer(v[1]);
+  }
+  mrbc_profile_dump( n );
+}
+
+
+//================================================================
+/*! (method) clear the profile
+*/
+static void c_vm_profile_clear(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_profile_clear();
+}
+#endif
+
+#if defined(MRBC_PROFILE_CALLS)
+//================================================================
+/*! (method) print the call profile
+
+  VM.call_profile_dump( n = 10 )
+*/
+static void c_vm_call_profile_dump(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int n = 10;
+  if( argc >= 1 && mrbc_type(v[1]) == MRBC_TT_INTEGER ) {
+    n = mrbc_integer(v[1]);
+  }
+  mrbc_profile_calls_dump( n );
+}
+
+
+//================================================================
+/*! (method) clear the call profile
+*/
+static void c_vm_call_profile_clear(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_profile_calls_clear();
+}
+#endif
+
+#if defined(MRBC_CFUNC_LATENCY)
+//================================================================
+/*! (method) print the C function latency
+
+  VM.cfunc_latency_dump( n = 10 )
+*/
+static void c_vm_cfunc_latency_dump(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int n = 10;
+  if( argc >= 1 && mrbc_type(v[1]) == MRBC_TT_INTEGER ) {
+    n = mrbc_integer(v[1]);
+  }
+  mrbc_cfunc_latency_dump( n );
+}
+
+
+//================================================================
+/*! (method) clear the C function latency
+*/
+static void c_vm_cfunc_latency_clear(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_cfunc_latency_clear();
+}
+#endif
+
+#if defined(MRBC_PROFILE_SAMPLING)
+//================================================================
+/*! (method) start the sampling profiler
+
+  VM.sampling_start( hz = MRBC_PROFILE_SAMPLE_HZ )
+*/
+static void c_vm_sampling_start(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  int hz = MRBC_PROFILE_SAMPLE_HZ;
+  if( argc >= 1 && mrbc_type(v[1]) == MRBC_TT_INTEGER ) {
+    hz = mrbc_integer(v[1]);
+  }
+  if( hz <= 0 ) {
+    mrbc_raise(vm, MRBC_CLASS(ArgumentError), 0);
+    return;
+  }
+  mrbc_profile_sampling_start( hz );
+}
+
+
+//================================================================
+/*! (method) stop the sampling profiler
+*/
+static void c_vm_sampling_stop(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_profile_sampling_stop();
+}
+
+
+//================================================================
+/*! (method) print the samples
+
+  VM.sampling_dump( raw = false )
+*/
+static void c_vm_sampling_dump(mrbc_vm *vm, mrbc_value v[], int argc)
+{
+  mrbc_profile_print_samples( argc >= 1 && mrbc_type(v[1]) == MRBC_TT_TRUE );
+}
+#endif
+
 /* MRBC_AUTOGEN_METHOD_TABLE
 
   CLASS("VM")
@@ -1412,8 +3108,52 @@ void mrbc_init(void *heap_ptr, unsigned int size)
   cls.cls = MRBC_CLASS(VM);
   mrbc_set_const( MRBC_SYM(VM), &cls );
 
+#if defined(MRBC_METRICS)
+  mrbc_metrics_init();
+  mrbc_metric_register( &metric_dispatch_ );
+  mrbc_init_class_metrics( MRBC_CLASS(VM) );
+#endif
+
   mrbc_define_method(0, mrbc_class_object, "sleep", c_sleep);
   mrbc_define_method(0, mrbc_class_object, "sleep_ms", c_sleep_ms);
+  mrbc_define_method(0, mrbc_class_object, "sleep_until", c_sleep_until);
+#if !defined(MRBC_ALLOC_LIBC)
+  mrbc_define_method(0, MRBC_CLASS(VM), "alloc_stats", c_vm_alloc_stats);
+  mrbc_define_method(0, MRBC_CLASS(VM), "alloc_reset_peak", c_vm_alloc_reset_peak);
+#endif
+#if defined(MRBC_ALLOC_TRACE)
+  mrbc_define_method(0, MRBC_CLASS(VM), "heap_report", c_vm_heap_report);
+#endif
+#if defined(MRBC_ALLOC_EVENT_LOG)
+  mrbc_define_method(0, MRBC_CLASS(VM), "alloc_log", c_vm_alloc_log);
+#endif
+#if defined(MRBC_SCHED_EVENT_LOG)
+  mrbc_define_method(0, MRBC_CLASS(VM), "sched_log", c_vm_sched_log);
+#endif
+#if defined(MRBC_PROFILE)
+  mrbc_define_method(0, MRBC_CLASS(VM), "profile_dump", c_vm_profile_dump);
+  mrbc_define_method(0, MRBC_CLASS(VM), "profile_clear", c_vm_profile_clear);
+#endif
+#if defined(MRBC_PROFILE_CALLS)
+  mrbc_define_method(0, MRBC_CLASS(VM), "call_profile_dump", c_vm_call_profile_dump);
+  mrbc_define_method(0, MRBC_CLASS(VM), "call_profile_clear", c_vm_call_profile_clear);
+#endif
+#if defined(MRBC_CFUNC_LATENCY)
+  mrbc_define_method(0, MRBC_CLASS(VM), "cfunc_latency_dump", c_vm_cfunc_latency_dump);
+  mrbc_define_method(0, MRBC_CLASS(VM), "cfunc_latency_clear", c_vm_cfunc_latency_clear);
+#endif
+#if defined(MRBC_PROFILE_SAMPLING)
+  mrbc_define_method(0, MRBC_CLASS(VM), "sampling_start", c_vm_sampling_start);
+  mrbc_define_method(0, MRBC_CLASS(VM), "sampling_stop", c_vm_sampling_stop);
+  mrbc_define_method(0, MRBC_CLASS(VM), "sampling_dump", c_vm_sampling_dump);
+#endif
+#if defined(MRBC_TASK_STATS)
+  mrbc_define_method(0, MRBC_CLASS(Task), "stats", c_task_stats);
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+  mrbc_define_method(0, MRBC_CLASS(Task), "memory_usage", c_task_memory_usage);
+  mrbc_define_method(0, MRBC_CLASS(Task), "memory_quota=", c_task_set_memory_quota);
+#endif
 }
 
 
@@ -1457,7 +3197,7 @@ void pq(const mrbc_tcb *p_tcb)
   // task priority, state.
   //  st:SsRr
   //     ^ suspended -> S:suspended
-  //      ^ waiting  -> s:sleep m:mutex J:join (uppercase is suspend state)
+  //      ^ waiting  -> s:sleep m:mutex J:join i:I/O e:event (uppercase is suspend state)
   //       ^ ready   -> R:ready
   //        ^ running-> r:running
   for( const mrbc_tcb *t = p_tcb; t; t = t->next ) {
@@ -1466,8 +3206,14 @@ void pq(const mrbc_tcb *p_tcb)
     mrbc_tcb t1 = *t;               // Copy the value at this timing.
     mrbc_printf(" st:%c%c%c%c    ",
       (t1.state & TASKSTATE_SUSPENDED)?'S':'-',
-      (t1.state & TASKSTATE_SUSPENDED)? ("-SM!J"[t1.reason]) :
-      (t1.state & TASKSTATE_WAITING)?   ("!sm!j"[t1.reason]) : '-',
+      (t1.reason & TASKREASON_WAITQ)?
+	((t1.state & TASKSTATE_SUSPENDED)? 'Q' : 'q') :
+      (t1.reason & TASKREASON_EVENT)?
+	((t1.state & TASKSTATE_SUSPENDED)? 'E' : 'e') :
+      (t1.reason & TASKREASON_IO)?
+	((t1.state & TASKSTATE_SUSPENDED)? 'I' : 'i') :
+      (t1.state & TASKSTATE_SUSPENDED)? ("-SM!J!!!I"[t1.reason]) :
+      (t1.state & TASKSTATE_WAITING)?   ("!sm!j!!!i"[t1.reason]) : '-',
       (t1.state & 0x02)?'R':'-',
       (t1.state & 0x01)?'r':'-' );
 #else
@@ -1486,15 +3232,32 @@ void pq(const mrbc_tcb *p_tcb)
     }
   }
   mrbc_printf("\n");
+
+#if defined(MRBC_TASK_STATS)
+  // CPU time (ms), dispatch count, preemption count, max latency (us)
+  for( const mrbc_tcb *t = p_tcb; t; t = t->next ) {
+    mrbc_printf(" ms:%-7u d:%-6u ",
+		(unsigned)(t->stats.cycles / (hal_cycles_per_us() * 1000)),
+		(unsigned)t->stats.n_dispatch );
+  }
+  mrbc_printf("\n");
+  for( const mrbc_tcb *t = p_tcb; t; t = t->next ) {
+    mrbc_printf(" p:%-6u lat:%-6u",
+		(unsigned)t->stats.n_preempt,
+		(unsigned)(t->stats.max_latency / hal_cycles_per_us()) );
+  }
+  mrbc_printf("\n");
+#endif
 }
 
 void pqall(void)
 {
   hal_disable_irq();
-  mrbc_printf("<< tick_ = %d, wakeup_tick_ = %d >>\n", tick_, wakeup_tick_);
+  mrbc_printf("<< tick_ = %d >>\n", tick_);
   mrbc_printf("<<<<< DORMANT >>>>>\n");   pq(q_dormant_);
   mrbc_printf("<<<<< READY >>>>>\n");     pq(q_ready_);
   mrbc_printf("<<<<< WAITING >>>>>\n");   pq(q_waiting_);
+  mrbc_printf("<<<<< SLEEPING >>>>>\n");  pq(q_sleeping_);
   mrbc_printf("<<<<< SUSPENDED >>>>>\n"); pq(q_suspended_);
   hal_enable_irq();
 }
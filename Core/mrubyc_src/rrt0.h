@@ -16,6 +16,7 @@
 /***** Feature test switches ************************************************/
 /***** System headers *******************************************************/
 //@cond
+#include <stddef.h>
 #include <stdint.h>
 //@endcond
 
@@ -50,6 +51,9 @@ enum MrbcTaskReason {
   TASKREASON_SLEEP = 0x01,
   TASKREASON_MUTEX = 0x02,
   TASKREASON_JOIN  = 0x04,
+  TASKREASON_IO    = 0x08,
+  TASKREASON_EVENT = 0x10,	//!< with TASKREASON_SLEEP if timeout is set.
+  TASKREASON_WAITQ = 0x20,	//!< with TASKREASON_SLEEP if timeout is set.
 };
 
 static const int MRBC_TASK_DEFAULT_PRIORITY = 128;
@@ -59,8 +63,29 @@ static const int MRBC_TASK_DEFAULT_STATE = TASKSTATE_READY;
 #define MRBC_TASK_NAME_LEN 15
 #endif
 
+#if defined(MRBC_TASK_REGS_FIT) && !defined(MRBC_TASK_REGS_MARGIN)
+#define MRBC_TASK_REGS_MARGIN 16
+#endif
+
+#if defined(MRBC_CLOCK_GOVERNOR)
+//! review period of the clock governor in ticks.
+#if !defined(MRBC_CLOCK_GOVERNOR_PERIOD)
+#define MRBC_CLOCK_GOVERNOR_PERIOD 100
+#endif
+//! the load in percent of the period, to step the clock up and down.
+#if !defined(MRBC_CLOCK_GOVERNOR_UP)
+#define MRBC_CLOCK_GOVERNOR_UP 75
+#endif
+#if !defined(MRBC_CLOCK_GOVERNOR_DOWN)
+#define MRBC_CLOCK_GOVERNOR_DOWN 25
+#endif
+#endif
+
 
 /***** Macros ***************************************************************/
+//! get TCB from VM pointer.
+#define VM2TCB(p) ((mrbc_tcb *)((uint8_t *)p - offsetof(mrbc_tcb, vm)))
+
 /***** Typedefs *************************************************************/
 
 struct RMutex;
@@ -74,9 +99,11 @@ typedef struct RTcb {
   uint8_t type[4];		//!< set "TCB\0" for debug.
 #endif
   struct RTcb *next;		//!< daisy chain in task queue.
+  struct RTcb *prev;		//!< back link, only in the ready queue.
   uint8_t priority;		//!< task priority. initial value.
   uint8_t priority_preemption;	//!< task priority. effective value.
   volatile uint8_t timeslice;	//!< time slice counter.
+  uint8_t timeslice_ticks;	//!< time slice length. 0 is no time slicing.
   uint8_t state;		//!< task state. defined in MrbcTaskState.
   uint8_t reason;		//!< sub state. defined in MrbcTaskReason.
   char name[MRBC_TASK_NAME_LEN+1]; //!< task name (optional)
@@ -85,7 +112,34 @@ typedef struct RTcb {
     uint32_t wakeup_tick;	//!< wakeup time for sleep state.
     struct RMutex *mutex;
   };
+  struct RTcb *wait_next;	//!< next task in the same mutex or wait queue.
+  struct RWaitQueue *wait_queue; //!< waited wait queue, until called again.
+  uint32_t wait_value;		//!< value given at the wakeup, or 0 if timed out.
+  const void *io_obj;		//!< waiting I/O object.
+  const void * const *io_set;	//!< waiting I/O objects, by mrbc_wait_io_set.
+  uint8_t n_io_set;		//!< number of io_set, or 0 if io_obj is used.
   const struct RTcb *tcb_join;  //!< joined task.
+  volatile uint32_t event_bits;	//!< notified event bits.
+  uint32_t event_mask;		//!< waiting event bits, or 0 if not waiting.
+  uint32_t period_ticks;	//!< period of Task.every, or 0 if not used.
+  uint32_t release_tick;	//!< last release time of the period.
+  uint32_t n_overrun;		//!< number of missed periods.
+#if defined(MRBC_ALLOC_ARENA)
+  unsigned int arena_size;	//!< per-VM arena size, or 0 if not use.
+  void *arena_memory;		//!< memory for the arena, or NULL if in the pool.
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+  unsigned int quota;		//!< limit of the used bytes, or 0 if unlimited.
+#endif
+#if defined(MRBC_TASK_STATS)
+  struct {
+    uint64_t cycles;		//!< CPU cycles consumed.
+    uint32_t n_dispatch;	//!< number of times dispatched.
+    uint32_t n_preempt;		//!< number of times preempted.
+    uint32_t max_latency;	//!< max cycles from ready to run.
+    uint32_t ready_cycle;	//!< cycle count when it became ready.
+  } stats;
+#endif
 
   struct VM vm;
 
@@ -99,35 +153,99 @@ typedef struct RTcb {
 typedef struct RMutex {
   volatile int lock;
   struct RTcb *tcb;
+  struct RTcb *waiter;		//!< waiting tasks, in priority order.
 } mrbc_mutex;
 
 #define MRBC_MUTEX_INITIALIZER { 0 }
 
 
+//================================================
+/*!@brief
+  Wait queue, for Semaphore, ConditionVariable and EventGroup.
+*/
+typedef struct RWaitQueue {
+  struct RTcb *head;		//!< waiting tasks, in priority order.
+} mrbc_wait_queue;
+
+#define MRBC_WAIT_QUEUE_INITIALIZER { 0 }
+
+#if defined(MRBC_DEFERRED_QUEUE_SIZE)
+//! function called from the deferred call queue.
+typedef void (*mrbc_deferred_func)(void *arg);
+
+//================================================
+/*!@brief
+  Statistics of the deferred call queue. (latency in CPU cycles)
+*/
+typedef struct DEFERRED_STATISTICS {
+  uint32_t n_posted;		//!< calls posted. (wraps around)
+  uint32_t n_run;		//!< calls done. (wraps around)
+  uint32_t n_overflow;		//!< posts dropped by the full queue.
+  uint32_t max_latency;		//!< maximum from the post to the call.
+  uint32_t total_latency;	//!< sum of the latencies. (wraps around)
+} MRBC_DEFERRED_STATISTICS;
+#endif
+
+// record the interrupt handler in the scheduler event log.
+// (needs hal_irq_number() in HAL)
+#if defined(MRBC_SCHED_EVENT_LOG)
+#define MRBC_ISR_ENTER()	mrbc_sched_event_isr( hal_irq_number(), 0 )
+#define MRBC_ISR_EXIT()		mrbc_sched_event_isr( hal_irq_number(), 1 )
+#else
+#define MRBC_ISR_ENTER()	((void)0)
+#define MRBC_ISR_EXIT()		((void)0)
+#endif
+
+
 /***** Global variables *****************************************************/
 /***** Function prototypes **************************************************/
 void mrbc_tick(void);
+void mrbc_profile_tick(void);
 mrbc_tcb *mrbc_tcb_new(int regs_size, enum MrbcTaskState task_state, int priority);
 mrbc_tcb *mrbc_create_task(const void *byte_code, mrbc_tcb *tcb);
 void mrbc_set_task_name(mrbc_tcb *tcb, const char *name);
+void mrbc_set_task_timeslice(mrbc_tcb *tcb, int ticks);
+void mrbc_set_task_arena(mrbc_tcb *tcb, unsigned int size);
+void mrbc_set_task_arena_memory(mrbc_tcb *tcb, void *ptr, unsigned int size);
+void mrbc_set_task_quota(mrbc_tcb *tcb, unsigned int size);
 mrbc_tcb *mrbc_find_task(const char *name);
 int mrbc_start_task(mrbc_tcb *tcb);
 int mrbc_run(void);
 void mrbc_sleep_ms(mrbc_tcb *tcb, uint32_t ms);
+int mrbc_sleep_until(mrbc_tcb *tcb, uint32_t tick);
+int mrbc_sleep_period(mrbc_tcb *tcb, uint32_t ms);
 void mrbc_relinquish(mrbc_tcb *tcb);
 void mrbc_change_priority(mrbc_tcb *tcb, int priority);
 void mrbc_suspend_task(mrbc_tcb *tcb);
 void mrbc_resume_task(mrbc_tcb *tcb);
 void mrbc_terminate_task(mrbc_tcb *tcb);
 void mrbc_join_task(mrbc_tcb *tcb, const mrbc_tcb *tcb_join);
+void mrbc_wait_io(mrbc_tcb *tcb, const void *io_obj);
+void mrbc_wait_io_timeout(mrbc_tcb *tcb, const void *io_obj, uint32_t ms);
+void mrbc_wait_io_set(mrbc_tcb *tcb, const void * const io_set[], int n, int ms);
+void mrbc_wakeup_io(const void *io_obj);
+void mrbc_task_notify_from_isr(mrbc_tcb *tcb, uint32_t bits);
+void mrbc_clock_governor_hold(int flag);
 mrbc_mutex *mrbc_mutex_init(mrbc_mutex *mutex);
 int mrbc_mutex_lock(mrbc_mutex *mutex, mrbc_tcb *tcb);
 int mrbc_mutex_unlock(mrbc_mutex *mutex, mrbc_tcb *tcb);
 int mrbc_mutex_trylock(mrbc_mutex *mutex, mrbc_tcb *tcb);
+void mrbc_wait_queue_wait(mrbc_wait_queue *wq, mrbc_tcb *tcb, int timeout, uint32_t value);
+int mrbc_wait_queue_resumed(mrbc_wait_queue *wq, mrbc_tcb *tcb, uint32_t *value);
+void mrbc_wait_queue_wakeup_task(mrbc_wait_queue *wq, mrbc_tcb *tcb, uint32_t value);
+int mrbc_wait_queue_wakeup(mrbc_wait_queue *wq, int n, uint32_t value);
 void mrbc_cleanup(void);
 void mrbc_init(void *heap_ptr, unsigned int size);
 void pq(const mrbc_tcb *p_tcb);
 void pqall(void);
+#if defined(MRBC_DEFERRED_QUEUE_SIZE)
+int mrbc_defer_from_isr(mrbc_deferred_func func, void *arg);
+void mrbc_deferred_statistics(MRBC_DEFERRED_STATISTICS *st);
+#endif
+#if defined(MRBC_SCHED_EVENT_LOG)
+void mrbc_sched_event_isr(int irq, int flag_exit);
+void mrbc_print_sched_event_log(void);
+#endif
 
 
 /***** Inline functions *****************************************************/
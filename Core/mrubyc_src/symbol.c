@@ -34,8 +34,8 @@
 #include "console.h"
 
 /***** Constant values ******************************************************/
-#if !defined(MRBC_SYMBOL_SEARCH_LINEAR) && !defined(MRBC_SYMBOL_SEARCH_BTREE)
-#define MRBC_SYMBOL_SEARCH_BTREE
+#if !defined(MRBC_SYMBOL_SEARCH_LINEAR) && !defined(MRBC_SYMBOL_SEARCH_BTREE) && !defined(MRBC_SYMBOL_SEARCH_HASH)
+#define MRBC_SYMBOL_SEARCH_HASH
 #endif
 
 #if MAX_SYMBOLS_COUNT <= UCHAR_MAX
@@ -44,7 +44,43 @@
 #define MRBC_SYMBOL_TABLE_INDEX_TYPE	uint16_t
 #endif
 
-#define OFFSET_BUILTIN_SYMBOL 256
+#define OFFSET_BUILTIN_SYMBOL 512
+
+// the next power of 2 of twice MAX_SYMBOLS_COUNT, to keep the load under 50%.
+#if defined(MRBC_SYMBOL_SEARCH_HASH) && !defined(MRBC_SYMBOL_HASH_SIZE)
+# if MAX_SYMBOLS_COUNT <= 32
+#  define MRBC_SYMBOL_HASH_SIZE 64
+# elif MAX_SYMBOLS_COUNT <= 64
+#  define MRBC_SYMBOL_HASH_SIZE 128
+# elif MAX_SYMBOLS_COUNT <= 128
+#  define MRBC_SYMBOL_HASH_SIZE 256
+# elif MAX_SYMBOLS_COUNT <= 256
+#  define MRBC_SYMBOL_HASH_SIZE 512
+# elif MAX_SYMBOLS_COUNT <= 512
+#  define MRBC_SYMBOL_HASH_SIZE 1024
+# elif MAX_SYMBOLS_COUNT <= 1024
+#  define MRBC_SYMBOL_HASH_SIZE 2048
+# elif MAX_SYMBOLS_COUNT <= 2048
+#  define MRBC_SYMBOL_HASH_SIZE 4096
+# elif MAX_SYMBOLS_COUNT <= 4096
+#  define MRBC_SYMBOL_HASH_SIZE 8192
+# elif MAX_SYMBOLS_COUNT <= 8192
+#  define MRBC_SYMBOL_HASH_SIZE 16384
+# elif MAX_SYMBOLS_COUNT <= 16384
+#  define MRBC_SYMBOL_HASH_SIZE 32768
+# else
+#  define MRBC_SYMBOL_HASH_SIZE 65536
+# endif
+#endif
+
+#if defined(MRBC_SYMBOL_SEARCH_HASH)
+# if (MRBC_SYMBOL_HASH_SIZE & (MRBC_SYMBOL_HASH_SIZE - 1)) != 0
+#  error "MRBC_SYMBOL_HASH_SIZE must be power of 2."
+# endif
+# if MRBC_SYMBOL_HASH_SIZE <= MAX_SYMBOLS_COUNT
+#  error "MRBC_SYMBOL_HASH_SIZE is too small."
+# endif
+#endif
 
 
 /***** Macros ***************************************************************/
@@ -63,6 +99,12 @@ struct SYM_INDEX {
 /***** Local variables ******************************************************/
 static struct SYM_INDEX sym_index[MAX_SYMBOLS_COUNT];
 static int sym_index_pos;	// point to the last(free) sym_index array.
+static uint8_t sym_generation = 1;	//!< incremented by mrbc_cleanup_symbol().
+
+#ifdef MRBC_SYMBOL_SEARCH_HASH
+//! open addressing hash table of sym_index. (index + 1, or 0 if empty)
+static MRBC_SYMBOL_TABLE_INDEX_TYPE sym_hash_table[MRBC_SYMBOL_HASH_SIZE];
+#endif
 
 
 /***** Global variables *****************************************************/
@@ -70,22 +112,47 @@ static int sym_index_pos;	// point to the last(free) sym_index array.
 /***** Local functions ******************************************************/
 
 //================================================================
-/*! Calculate hash value.
+/*! Calculate hash value. (FNV-1a, folded to 16bit)
 
   @param  str		Target string.
   @return uint16_t	Hash value.
 */
 static inline uint16_t calc_hash(const char *str)
 {
-  uint16_t h = 0;
+  uint32_t h = 2166136261u;
 
   while( *str != '\0' ) {
-    h = h * 17 + *str++;
+    h ^= (uint8_t)*str++;
+    h *= 16777619u;
   }
-  return h;
+  return (uint16_t)(h ^ (h >> 16));
 }
 
 
+#ifdef MRBC_SYMBOL_SEARCH_HASH
+//================================================================
+/*! find the hash table slot of the symbol, or the empty slot to add.
+
+  @param  hash	hash value.
+  @param  str	string ptr.
+  @return	slot index.
+*/
+static int search_hash_slot( uint16_t hash, const char *str )
+{
+  int i = hash & (MRBC_SYMBOL_HASH_SIZE - 1);
+
+  while( sym_hash_table[i] != 0 ) {
+    const struct SYM_INDEX *p = &sym_index[sym_hash_table[i] - 1];
+    if( p->hash == hash && strcmp(str, p->cstr) == 0 ) break;
+
+    i = (i + 1) & (MRBC_SYMBOL_HASH_SIZE - 1);
+  }
+
+  return i;
+}
+#endif
+
+
 //================================================================
 /*! search built-in symbol table
 
@@ -133,6 +200,10 @@ static int search_builtin_symbol( const char *str )
 */
 static int search_index( uint16_t hash, const char *str )
 {
+#ifdef MRBC_SYMBOL_SEARCH_HASH
+  return sym_hash_table[ search_hash_slot( hash, str ) ] - 1;
+#endif
+
 #ifdef MRBC_SYMBOL_SEARCH_LINEAR
   int i;
   for( i = 0; i < sym_index_pos; i++ ) {
@@ -163,7 +234,7 @@ static int search_index( uint16_t hash, const char *str )
 //================================================================
 /*! add to index table
 
-  @param  hash	return value.
+  @param  hash	hash value.
   @param  str	string ptr.
   @return	index. or -1 if error.
 */
@@ -203,6 +274,45 @@ static int add_index( uint16_t hash, const char *str )
 }
 
 
+//================================================================
+/*! search symbol
+
+  @param  hash	hash value.
+  @param  str	string ptr.
+  @return	symbol id. or -1 if not found.
+*/
+static mrbc_sym search_symbol( uint16_t hash, const char *str )
+{
+  mrbc_sym sym_id = search_builtin_symbol(str);
+  if( sym_id >= 0 ) return sym_id;
+
+  sym_id = search_index(hash, str);
+  if( sym_id < 0 ) return sym_id;
+
+  return sym_id + OFFSET_BUILTIN_SYMBOL;
+}
+
+
+//================================================================
+/*! add symbol
+
+  @param  hash	hash value.
+  @param  str	string ptr. (must be kept while the symbol is alive)
+  @return	symbol id. or -1 if error.
+*/
+static mrbc_sym add_symbol( uint16_t hash, const char *str )
+{
+  int idx = add_index( hash, str );
+  if( idx < 0 ) return idx;
+
+#ifdef MRBC_SYMBOL_SEARCH_HASH
+  sym_hash_table[ search_hash_slot( hash, str ) ] = idx + 1;
+#endif
+
+  return idx + OFFSET_BUILTIN_SYMBOL;
+}
+
+
 /***** Global functions *****************************************************/
 
 //================================================================
@@ -212,6 +322,10 @@ void mrbc_cleanup_symbol(void)
 {
   memset(sym_index, 0, sizeof(sym_index));
   sym_index_pos = 0;
+  if( ++sym_generation == 0 ) sym_generation = 1;
+#ifdef MRBC_SYMBOL_SEARCH_HASH
+  memset(sym_hash_table, 0, sizeof(sym_hash_table));
+#endif
 }
 
 
@@ -223,15 +337,45 @@ void mrbc_cleanup_symbol(void)
 */
 mrbc_sym mrbc_str_to_symid(const char *str)
 {
-  mrbc_sym sym_id = search_builtin_symbol(str);
-  if( sym_id >= 0 ) return sym_id;
-
   uint16_t h = calc_hash(str);
-  sym_id = search_index(h, str);
-  if( sym_id < 0 ) sym_id = add_index( h, str );
-  if( sym_id < 0 ) return sym_id;
+  mrbc_sym sym_id = search_symbol(h, str);
+  if( sym_id < 0 ) sym_id = add_symbol( h, str );
 
-  return sym_id + OFFSET_BUILTIN_SYMBOL;
+  return sym_id;
+}
+
+
+//================================================================
+/*! Convert string to symbol value, with the cache of the caller.
+
+  The cached ID is used until mrbc_cleanup_symbol() is called.
+  The cache must always be used with the same string.
+
+  @param  cache		pointer to the cache. (zero cleared)
+  @param  str		Target string.
+  @return mrbc_sym	Symbol value. -1 if error.
+*/
+mrbc_sym mrbc_str_to_symid_cached(mrbc_sym_cache *cache, const char *str)
+{
+  if( cache->generation == sym_generation ) return cache->sym_id;
+
+  mrbc_sym sym_id = mrbc_str_to_symid(str);
+  if( sym_id >= 0 ) {
+    cache->sym_id = sym_id;
+    cache->generation = sym_generation;
+  }
+  return sym_id;
+}
+
+
+//================================================================
+/*! get the next symbol ID to be assigned.
+
+  @return int	number of symbols, including builtin symbols.
+*/
+int mrbc_symbol_count(void)
+{
+  return sym_index_pos + OFFSET_BUILTIN_SYMBOL;
 }
 
 
@@ -264,14 +408,7 @@ const char * mrbc_symid_to_str(mrbc_sym sym_id)
 */
 mrbc_sym mrbc_search_symid( const char *str )
 {
-  mrbc_sym sym_id = search_builtin_symbol(str);
-  if( sym_id >= 0 ) return sym_id;
-
-  uint16_t h = calc_hash(str);
-  sym_id = search_index(h, str);
-  if( sym_id < 0 ) return sym_id;
-
-  return sym_id + OFFSET_BUILTIN_SYMBOL;
+  return search_symbol( calc_hash(str), str );
 }
 
 
@@ -349,15 +486,13 @@ mrbc_value mrbc_symbol_new(struct VM *vm, const char *str)
   if( buf == NULL ) return mrbc_nil_value();	// ENOMEM raise?
 
   memcpy(buf, str, size);
-  sym_id = add_index( calc_hash(buf), buf );
+  sym_id = add_symbol( calc_hash(buf), buf );
   if( sym_id < 0 ) {
     mrbc_raisef(vm, MRBC_CLASS(Exception),
 		"Overflow MAX_SYMBOLS_COUNT for '%s'", str );
     return mrbc_nil_value();
   }
 
-  sym_id += OFFSET_BUILTIN_SYMBOL;
-
  DONE:
   return mrbc_symbol_value( sym_id );
 }
@@ -402,11 +537,11 @@ static void c_symbol_inspect(struct VM *vm, mrbc_value v[], int argc)
 static void c_symbol_to_s(struct VM *vm, mrbc_value v[], int argc)
 {
   if( v[0].tt == MRBC_TT_CLASS ) {
-    v[0] = mrbc_string_new_cstr(vm, mrbc_symid_to_str( v[0].cls->sym_id ));
+    v[0] = mrbc_string_new_symbol(vm, v[0].cls->sym_id);
     return;
   }
 
-  v[0] = mrbc_string_new_cstr(vm, mrbc_symid_to_str( mrbc_symbol(v[0]) ));
+  v[0] = mrbc_string_new_symbol(vm, mrbc_symbol(v[0]));
 }
 #endif
 
@@ -26,10 +26,20 @@ extern "C" {
 /***** Constant values ******************************************************/
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
+//================================================================
+/*!@brief
+  Cache for mrbc_str_to_symid_cached(). Define it as static (zero cleared).
+*/
+typedef struct RSymbolCache {
+  mrbc_sym sym_id;
+  uint8_t generation;
+} mrbc_sym_cache;
+
 /***** Global variables *****************************************************/
 /***** Function prototypes **************************************************/
 void mrbc_cleanup_symbol(void);
 mrbc_sym mrbc_str_to_symid(const char *str);
+mrbc_sym mrbc_str_to_symid_cached(mrbc_sym_cache *cache, const char *str);
 const char *mrbc_symid_to_str(mrbc_sym sym_id);
 mrbc_sym mrbc_search_symid(const char *str);
 void make_nested_symbol_s(char *buf, mrbc_sym id1, mrbc_sym id2);
@@ -37,6 +47,7 @@ void mrbc_separate_nested_symid(mrbc_sym sym_id, mrbc_sym *id1, mrbc_sym *id2);
 mrbc_value mrbc_symbol_new(struct VM *vm, const char *str);
 void mrbc_debug_dump_symbol(void);
 void mrbc_symbol_statistics(int *total_used);
+int mrbc_symbol_count(void);
 
 
 /***** Inline functions *****************************************************/
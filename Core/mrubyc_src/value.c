@@ -29,6 +29,8 @@
 #include "c_range.h"
 #include "c_array.h"
 #include "c_hash.h"
+#include "c_numeric.h"
+#include "c_fixed.h"
 
 
 /***** Constant values ******************************************************/
@@ -43,19 +45,16 @@
   @note must be same order as mrbc_vtype.
   @see mrbc_vtype in value.h
 */
-void (* const mrbc_delfunc[])(mrbc_value *) = {
-  0, 0, 0, 0, 0, 0, 0, 0,
-  mrbc_instance_delete,		// MRBC_TT_OBJECT    = 8,
-  mrbc_proc_delete,		// MRBC_TT_PROC	     = 9,
-  mrbc_array_delete,		// MRBC_TT_ARRAY     = 10,
+void (* const mrbc_delfunc[MRBC_TT_MAXVAL+1])(mrbc_value *) = {
+  [MRBC_TT_OBJECT]    = mrbc_instance_delete,
+  [MRBC_TT_PROC]      = mrbc_proc_delete,
+  [MRBC_TT_ARRAY]     = mrbc_array_delete,
 #if MRBC_USE_STRING
-  mrbc_string_delete,		// MRBC_TT_STRING    = 11,
-#else
-  NULL,
+  [MRBC_TT_STRING]    = mrbc_string_delete,
 #endif
-  mrbc_range_delete,		// MRBC_TT_RANGE     = 12,
-  mrbc_hash_delete,		// MRBC_TT_HASH	     = 13,
-  mrbc_exception_delete,	// MRBC_TT_EXCEPTION = 14,
+  [MRBC_TT_RANGE]     = mrbc_range_delete,
+  [MRBC_TT_HASH]      = mrbc_hash_delete,
+  [MRBC_TT_EXCEPTION] = mrbc_exception_delete,
 };
 
 
@@ -77,6 +76,9 @@ int mrbc_compare(const mrbc_value *v1, const mrbc_value *v2)
 #if MRBC_USE_FLOAT
   mrbc_float_t d1, d2;
 #endif
+#if defined(MRBC_USE_FIXED) || defined(MRBC_INT_WIDE)
+  int64_t f1, f2;
+#endif
 
   // if TT_XXX is different
   if( mrbc_type(*v1) != mrbc_type(*v2) ) {
@@ -92,6 +94,50 @@ int mrbc_compare(const mrbc_value *v1, const mrbc_value *v2)
       d2 = v2->i;
       goto CMP_FLOAT;
     }
+#if defined(MRBC_USE_FIXED)
+    if( mrbc_type(*v1) == MRBC_TT_FIXED && mrbc_type(*v2) == MRBC_TT_FLOAT ) {
+      d1 = mrbc_fixed_to_float( v1->fx );
+      d2 = v2->d;
+      goto CMP_FLOAT;
+    }
+    if( mrbc_type(*v1) == MRBC_TT_FLOAT && mrbc_type(*v2) == MRBC_TT_FIXED ) {
+      d1 = v1->d;
+      d2 = mrbc_fixed_to_float( v2->fx );
+      goto CMP_FLOAT;
+    }
+#endif
+#if defined(MRBC_INT_WIDE)
+    if( mrbc_type(*v1) == MRBC_TT_WIDE_INT && mrbc_type(*v2) == MRBC_TT_FLOAT ) {
+      d1 = mrbc_int_wide_get( v1 );
+      d2 = v2->d;
+      goto CMP_FLOAT;
+    }
+    if( mrbc_type(*v1) == MRBC_TT_FLOAT && mrbc_type(*v2) == MRBC_TT_WIDE_INT ) {
+      d1 = v1->d;
+      d2 = mrbc_int_wide_get( v2 );
+      goto CMP_FLOAT;
+    }
+#endif
+#endif
+#if defined(MRBC_INT_WIDE)
+    if( (mrbc_type(*v1) == MRBC_TT_WIDE_INT && mrbc_type(*v2) == MRBC_TT_INTEGER) ||
+	(mrbc_type(*v1) == MRBC_TT_INTEGER && mrbc_type(*v2) == MRBC_TT_WIDE_INT) ) {
+      f1 = mrbc_int_wide_get( v1 );
+      f2 = mrbc_int_wide_get( v2 );
+      goto CMP_INT64;
+    }
+#endif
+#if defined(MRBC_USE_FIXED)
+    if( mrbc_type(*v1) == MRBC_TT_FIXED && mrbc_type(*v2) == MRBC_TT_INTEGER ) {
+      f1 = v1->fx;
+      f2 = (int64_t)v2->i * MRBC_FIXED_ONE;
+      goto CMP_INT64;
+    }
+    if( mrbc_type(*v1) == MRBC_TT_INTEGER && mrbc_type(*v2) == MRBC_TT_FIXED ) {
+      f1 = (int64_t)v1->i * MRBC_FIXED_ONE;
+      f2 = v2->fx;
+      goto CMP_INT64;
+    }
 #endif
 
     // leak Empty?
@@ -128,6 +174,20 @@ int mrbc_compare(const mrbc_value *v1, const mrbc_value *v2)
     goto CMP_FLOAT;
 #endif
 
+#if defined(MRBC_USE_FIXED)
+  case MRBC_TT_FIXED:
+    f1 = mrbc_fixed(*v1);
+    f2 = mrbc_fixed(*v2);
+    goto CMP_INT64;
+#endif
+
+#if defined(MRBC_INT_WIDE)
+  case MRBC_TT_WIDE_INT:
+    f1 = mrbc_int_wide_get( v1 );
+    f2 = mrbc_int_wide_get( v2 );
+    goto CMP_INT64;
+#endif
+
   case MRBC_TT_CLASS:
   case MRBC_TT_OBJECT:
   case MRBC_TT_PROC:
@@ -151,6 +211,11 @@ int mrbc_compare(const mrbc_value *v1, const mrbc_value *v2)
     return 1;
   }
 
+#if defined(MRBC_USE_FIXED) || defined(MRBC_INT_WIDE)
+ CMP_INT64:
+  return (f1 > f2) - (f1 < f2);
+#endif
+
 #if MRBC_USE_FLOAT
  CMP_FLOAT:
   return -1 + (d1 == d2) + (d1 > d2)*2;	// caution: NaN == NaN is false
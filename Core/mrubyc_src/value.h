@@ -51,8 +51,10 @@ typedef mrbc_int_t mrb_int;
 
 #if MRBC_USE_FLOAT == 1
 typedef float mrbc_float_t;
+#define MRBC_FLOAT_FUNC(fn) fn##f	//!< libm function of the same precision.
 #elif MRBC_USE_FLOAT == 2
 typedef double mrbc_float_t;
+#define MRBC_FLOAT_FUNC(fn) fn
 #endif
 #if MRBC_USE_FLOAT != 0
 typedef mrbc_float_t mrb_float;
@@ -86,17 +88,22 @@ typedef enum {
   MRBC_TT_FIXNUM  = 4,
   MRBC_TT_FLOAT	  = 5,		//!< Float
   MRBC_TT_SYMBOL  = 6,		//!< Symbol
-  MRBC_TT_CLASS	  = 7,		//!< Class
+  // (note) the followings are numbered by the options.
+#if defined(MRBC_USE_FIXED)
+  MRBC_TT_FIXED,		//!< Fixed (Q16.16)
+#endif
+  MRBC_TT_WIDE_INT,		//!< Integer beyond 32bit (MRBC_INT_WIDE)
+  MRBC_TT_CLASS,		//!< Class
   // (note) inc/dec ref threshold.
 
   /* non-primitive */
-  MRBC_TT_OBJECT    = 8,	//!< General instance
-  MRBC_TT_PROC	    = 9,	//!< Proc
-  MRBC_TT_ARRAY	    = 10,	//!< Array
-  MRBC_TT_STRING    = 11,	//!< String
-  MRBC_TT_RANGE	    = 12,	//!< Range
-  MRBC_TT_HASH	    = 13,	//!< Hash
-  MRBC_TT_EXCEPTION = 14,	//!< Exception
+  MRBC_TT_OBJECT,		//!< General instance
+  MRBC_TT_PROC,			//!< Proc
+  MRBC_TT_ARRAY,		//!< Array
+  MRBC_TT_STRING,		//!< String
+  MRBC_TT_RANGE,		//!< Range
+  MRBC_TT_HASH,			//!< Hash
+  MRBC_TT_EXCEPTION,		//!< Exception
 } mrbc_vtype;
 #define	MRBC_TT_INC_DEC_THRESHOLD MRBC_TT_CLASS
 #define	MRBC_TT_MAXVAL MRBC_TT_EXCEPTION
@@ -129,11 +136,19 @@ typedef enum {
 
 //================================================================
 /* Define the object structure having reference counter.
+   flag_cycle is set while the object is a candidate of the cycle
+   collector, and it fits in the padding before the next member.
 */
+#if defined(MRBC_CYCLE_COLLECT)
+#define MRBC_OBJECT_HEADER_CYCLE ; uint8_t flag_cycle
+#else
+#define MRBC_OBJECT_HEADER_CYCLE
+#endif
+
 #if defined(MRBC_DEBUG)
-#define MRBC_OBJECT_HEADER  uint8_t type[2]; uint16_t ref_count
+#define MRBC_OBJECT_HEADER  uint8_t type[2]; uint16_t ref_count MRBC_OBJECT_HEADER_CYCLE
 #else
-#define MRBC_OBJECT_HEADER  uint16_t ref_count
+#define MRBC_OBJECT_HEADER  uint16_t ref_count MRBC_OBJECT_HEADER_CYCLE
 #endif
 
 //================================================================
@@ -151,10 +166,16 @@ struct RBasic {
 */
 struct RObject {
   mrbc_vtype tt : 8;
+#if defined(MRBC_INT_WIDE)
+  int32_t i_hi : 24;		// upper bits of MRBC_TT_WIDE_INT, in the padding.
+#endif
   union {
     mrbc_int_t i;		// MRBC_TT_INTEGER, SYMBOL
 #if MRBC_USE_FLOAT
     mrbc_float_t d;		// MRBC_TT_FLOAT
+#endif
+#if defined(MRBC_USE_FIXED)
+    int32_t fx;			// MRBC_TT_FIXED
 #endif
     struct RBasic *obj;		// use inc/dec ref only.
     struct RClass *cls;		// MRBC_TT_CLASS
@@ -173,6 +194,10 @@ typedef struct RObject mrb_value;	// not recommended.
 typedef struct RObject mrbc_object;
 typedef struct RObject mrbc_value;
 
+#if defined(MRBC_COMPACT_VALUE) && defined(UINTPTR_MAX) && UINTPTR_MAX == 0xffffffff
+_Static_assert( sizeof(mrbc_value) == 8, "mrbc_value must be 8 bytes." );
+#endif
+
 
 /***** Macros ***************************************************************/
 
@@ -189,11 +214,15 @@ typedef struct RObject mrbc_value;
 
   @def mrbc_symbol(o)
   get symbol value (#mrbc_sym) from mrbc_value.
+
+  @def mrbc_fixed(o)
+  get the raw Q16.16 value (int32_t) of Fixed from mrbc_value.
 */
 #define mrbc_type(o)		((o).tt)
 #define mrbc_integer(o)		((o).i)
 #define mrbc_float(o)		((o).d)
 #define mrbc_symbol(o)		((o).i)
+#define mrbc_fixed(o)		((o).fx)
 
 // setters
 #define mrbc_set_integer(p,n)	(p)->tt = MRBC_TT_INTEGER; (p)->i = (n)
@@ -203,6 +232,7 @@ typedef struct RObject mrbc_value;
 #define mrbc_set_false(p)	(p)->tt = MRBC_TT_FALSE
 #define mrbc_set_bool(p,n)	(p)->tt = (n)? MRBC_TT_TRUE: MRBC_TT_FALSE
 #define mrbc_set_symbol(p,n)	(p)->tt = MRBC_TT_SYMBOL; (p)->i = (n)
+#define mrbc_set_fixed(p,n)	(p)->tt = MRBC_TT_FIXED; (p)->fx = (n)
 
 // make immediate values.
 #define mrbc_integer_value(n)	((mrbc_value){.tt = MRBC_TT_INTEGER, .i=(n)})
@@ -212,6 +242,7 @@ typedef struct RObject mrbc_value;
 #define mrbc_false_value()	((mrbc_value){.tt = MRBC_TT_FALSE})
 #define mrbc_bool_value(n)	((mrbc_value){.tt = (n)?MRBC_TT_TRUE:MRBC_TT_FALSE})
 #define mrbc_symbol_value(n)	((mrbc_value){.tt = MRBC_TT_SYMBOL, .i=(n)})
+#define mrbc_fixed_value(n)	((mrbc_value){.tt = MRBC_TT_FIXED, .fx=(n)})
 
 // (for mruby compatible)
 #define mrb_type(o)		mrbc_type(o)
@@ -301,10 +332,16 @@ typedef struct RObject mrbc_value;
 #define GET_STRING_ARG(n)	(v[(n)].string->data)
 
 
+#if defined(MRBC_CYCLE_COLLECT)
+#define MRBC_INIT_OBJECT_HEADER_CYCLE(p)  ; (p)->flag_cycle = 0
+#else
+#define MRBC_INIT_OBJECT_HEADER_CYCLE(p)
+#endif
+
 #if defined(MRBC_DEBUG)
-#define MRBC_INIT_OBJECT_HEADER(p, t)  (p)->ref_count = 1; (p)->type[0] = (t)[0]; (p)->type[1] = (t)[1]
+#define MRBC_INIT_OBJECT_HEADER(p, t)  (p)->ref_count = 1; (p)->type[0] = (t)[0]; (p)->type[1] = (t)[1] MRBC_INIT_OBJECT_HEADER_CYCLE(p)
 #else
-#define MRBC_INIT_OBJECT_HEADER(p, t)  (p)->ref_count = 1
+#define MRBC_INIT_OBJECT_HEADER(p, t)  (p)->ref_count = 1 MRBC_INIT_OBJECT_HEADER_CYCLE(p)
 #endif
 
 
@@ -334,6 +371,7 @@ typedef struct RObject mrbc_value;
   @def MRBC_KW_ARG(keyword1,...)
   Get keyword arguments and define mrbc_value with same name.
   Up to 30 arguments can be specified.
+  The symbol IDs of the keywords are cached in each call site.
 
   @def MRBC_KW_DICT(dict_var)
   Get remaining keyword arguments as hash.
@@ -360,8 +398,10 @@ typedef struct RObject mrbc_value;
   if( v[argc].tt == MRBC_TT_HASH ) { \
     MRBC_each(__VA_ARGS__)( MRBC_KW_ARG_decl2, __VA_ARGS__ ) \
   }
-#define MRBC_KW_ARG_decl1(kw) mrbc_value kw = {.tt = MRBC_TT_EMPTY};
-#define MRBC_KW_ARG_decl2(kw) kw = mrbc_hash_remove_by_id(&v[argc], mrbc_str_to_symid(#kw));
+#define MRBC_KW_ARG_decl1(kw) mrbc_value kw = {.tt = MRBC_TT_EMPTY}; \
+  static mrbc_sym_cache mrbc_kw_symid_##kw;
+#define MRBC_KW_ARG_decl2(kw) kw = mrbc_hash_remove_by_id(&v[argc], \
+  mrbc_str_to_symid_cached(&mrbc_kw_symid_##kw, #kw));
 
 #define MRBC_KW_DICT(dict) \
   mrbc_value dict; \
@@ -435,6 +475,9 @@ int mrbc_compare(const mrbc_value *v1, const mrbc_value *v2);
 void mrbc_clear_vm_id(mrbc_value *v);
 mrbc_int_t mrbc_atoi(const char *s, int base);
 int mrbc_strcpy(char *dest, int destsize, const char *src);
+#if defined(MRBC_CYCLE_COLLECT)
+void mrbc_cycle_candidate(mrbc_value *v);
+#endif
 
 
 /***** Inline functions *****************************************************/
@@ -466,7 +509,12 @@ static inline void mrbc_decref(mrbc_value *v)
   assert( v->obj->ref_count != 0 );
   assert( v->obj->ref_count != 0xffff );	// check broken data.
 
-  if( --v->obj->ref_count != 0 ) return;
+  if( --v->obj->ref_count != 0 ) {
+#if defined(MRBC_CYCLE_COLLECT)
+    if( !v->obj->flag_cycle && v->tt != MRBC_TT_STRING ) mrbc_cycle_candidate(v);
+#endif
+    return;
+  }
 
   (*mrbc_delfunc[v->tt])(v);
 }
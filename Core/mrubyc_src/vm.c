@@ -32,11 +32,17 @@
 #include "c_range.h"
 #include "c_array.h"
 #include "c_hash.h"
+#include "c_numeric.h"
+#include "c_fixed.h"
+#include "c_object.h"
 #include "global.h"
 #include "load.h"
 #include "console.h"
 #include "opcode.h"
 #include "vm.h"
+#include "profile.h"
+#include "cycle.h"
+#include "aot.h"
 
 
 /***** Constat values *******************************************************/
@@ -44,16 +50,371 @@
 
 
 /***** Macros ***************************************************************/
+#if defined(MRBC_NO_TIMER)
+//! count a backward jump or a call, and preempt at the end of the budget.
+#define BUDGET_CHECK(vm) \
+  do { if( --(vm)->insn_budget <= 0 ) (vm)->flag_preemption = 1; } while(0)
+#else
+#define BUDGET_CHECK(vm) ((void)0)
+#endif
+
+//! R[a] and R[a+1] are both Integer. (one branch)
+#define IS_INTEGER_PAIR(r) \
+  (((r)[0].tt == MRBC_TT_INTEGER) & ((r)[1].tt == MRBC_TT_INTEGER))
+
+//! Integer arithmetic that wraps around, instead of undefined overflow.
+#define INT_WRAP(x, op, y) \
+  ((mrbc_int_t)((mrbc_uint_t)(x) op (mrbc_uint_t)(y)))
+
+
 /***** Typedefs *************************************************************/
+#if defined(MRBC_USE_METHOD_CACHE)
+/*!@brief
+  Call site method cache entry.
+*/
+typedef struct CALLSITE_CACHE {
+  const uint8_t *inst;		//!< call site. (identifies irep and offset)
+  mrbc_class *cls;		//!< receiver's class.
+  uint32_t epoch;		//!< mrbc_method_cache_epoch at cached.
+  mrbc_method method;		//!< resolved method.
+  mrbc_sym ivar_id;		//!< instance variable of the accessor.
+  uint8_t accessor;		//!< 1:attr reader, 2:attr writer, 0:others.
+} CALLSITE_CACHE;
+#endif
+
+#if defined(MRBC_USE_CONST_CACHE)
+/*!@brief
+  Constant reference site cache entry.
+*/
+typedef struct CONST_CACHE {
+  const uint8_t *inst;		//!< reference site. (identifies irep and offset)
+  const mrbc_class *cls;	//!< class that starts the search.
+  uint32_t epoch;		//!< mrbc_const_cache_epoch at cached.
+  mrbc_value value;		//!< resolved constant.
+} CONST_CACHE;
+#endif
+
+#if defined(MRBC_USE_GLOBAL_CACHE)
+/*!@brief
+  Global variable reference site cache entry.
+*/
+typedef struct GLOBAL_CACHE {
+  const uint8_t *inst;		//!< reference site. (identifies irep and offset)
+  mrbc_sym sym_id;		//!< variable name.
+  int16_t slot;			//!< slot number in the global table.
+} GLOBAL_CACHE;
+#endif
+
+#if defined(MRBC_USE_AOT)
+/*!@brief
+  AOT compiled method, that replaces the method by OP_DEF.
+*/
+typedef struct AOT_METHOD {
+  mrbc_sym cls_id;		//!< class name.
+  mrbc_sym sym_id;		//!< method name.
+  uint32_t hash;		//!< of the instructions, to detect an update.
+  mrbc_func_t func;		//!< compiled function.
+} AOT_METHOD;
+#endif
+
+
 /***** Function prototypes **************************************************/
 /***** Local variables ******************************************************/
 //! for getting the VM ID
 static uint16_t free_vm_bitmap[MAX_VM_COUNT / 16 + 1];
 
+#if defined(MRBC_USE_METHOD_CACHE)
+//! call site method cache. (direct mapped)
+static CALLSITE_CACHE callsite_cache[MRBC_METHOD_CACHE_SIZE];
+#endif
+
+#if defined(MRBC_USE_CONST_CACHE)
+//! constant reference site cache. (direct mapped)
+static CONST_CACHE const_cache[MRBC_CONST_CACHE_SIZE];
+#endif
+
+#if defined(MRBC_USE_GLOBAL_CACHE)
+//! global variable reference site cache. (direct mapped)
+static GLOBAL_CACHE global_cache[MRBC_GLOBAL_CACHE_SIZE];
+#endif
+
+#if defined(MRBC_USE_AOT)
+static AOT_METHOD aot_methods[MRBC_AOT_METHODS_MAX];
+static int n_aot_methods;
+#endif
+
+//! pseudo IREP of the C iterator frame. OP_CALL resumes the C function.
+static const uint8_t c_iter_inst[] = { OP_CALL };
+static const mrbc_irep c_iter_irep = {
+#if defined(MRBC_DEBUG)
+  .type = "RP",
+#endif
+  .nregs = MRBC_C_ITER_REGS + 1,
+  .ilen = sizeof(c_iter_inst),
+  .inst = c_iter_inst,
+};
+
+//! pseudo IREP of the mrbc_funcall() frame. OP_STOP ends the nested run.
+static const uint8_t funcall_inst[] = { OP_STOP };
+static const mrbc_irep funcall_irep = {
+#if defined(MRBC_DEBUG)
+  .type = "RP",
+#endif
+  .nregs = 1,
+  .ilen = sizeof(funcall_inst),
+  .inst = funcall_inst,
+};
+
 
 /***** Global variables *****************************************************/
 /***** Signal catching functions ********************************************/
 /***** Local functions ******************************************************/
+#if defined(MRBC_USE_METHOD_CACHE)
+//================================================================
+/*! find method with call site cache.
+
+  @param  r_method	pointer to mrbc_method to return values.
+  @param  inst		call site. (vm->inst)
+  @param  cls		search class.
+  @param  sym_id	symbol id.
+  @return		pointer to method or NULL.
+*/
+static mrbc_method * find_method_by_callsite( mrbc_method *r_method, const uint8_t *inst, mrbc_class *cls, mrbc_sym sym_id )
+{
+  CALLSITE_CACHE *cache =
+    &callsite_cache[ ((uintptr_t)inst >> 2) & (MRBC_METHOD_CACHE_SIZE - 1) ];
+
+  if( cache->inst == inst && cache->cls == cls &&
+      cache->method.sym_id == sym_id &&
+      cache->epoch == mrbc_method_cache_epoch ) {
+    *r_method = cache->method;
+    return r_method;
+  }
+
+  if( mrbc_find_method( r_method, cls, sym_id ) == 0 ) return 0;
+
+  cache->inst = inst;
+  cache->cls = cls;
+  cache->epoch = mrbc_method_cache_epoch;
+  cache->method = *r_method;
+  cache->accessor = 0;
+
+  // the methods defined by attr_reader and attr_accessor.
+  if( !r_method->c_func ) return r_method;
+  if( r_method->func == c_object_getiv ) {
+    cache->ivar_id = sym_id;
+    cache->accessor = 1;
+
+  } else if( r_method->func == c_object_setiv ) {
+    const char *name = mrbc_symid_to_str( sym_id );
+    char buf[32];
+    int len = strlen(name) - 1;		// delete '='
+    if( len < 1 || len >= sizeof(buf) ) return r_method;
+
+    memcpy( buf, name, len );
+    buf[len] = '\0';
+    cache->ivar_id = mrbc_search_symid( buf );
+    if( cache->ivar_id >= 0 ) cache->accessor = 2;
+  }
+
+  return r_method;
+}
+
+
+//================================================================
+/*! execute attr_reader or attr_writer method in line, if the call site
+    cache says so. It needs no call frame.
+
+  @param  vm		pointer to VM.
+  @param  recv		receiver. (R[a])
+  @param  sym_id	method name.
+  @param  c		OP_SEND operand c (arguments count).
+  @retval 1		executed.
+  @retval 0		not an accessor. call the method normally.
+*/
+static inline int send_accessor( struct VM *vm, mrbc_value *recv, mrbc_sym sym_id, int c )
+{
+  if( mrbc_type(*recv) != MRBC_TT_OBJECT ) return 0;
+
+  const CALLSITE_CACHE *cache =
+    &callsite_cache[ ((uintptr_t)vm->inst >> 2) & (MRBC_METHOD_CACHE_SIZE - 1) ];
+
+  if( cache->accessor == 0 || c != cache->accessor - 1 ) return 0;
+  if( cache->inst != vm->inst || cache->cls != recv->instance->cls ||
+      cache->method.sym_id != sym_id ||
+      cache->epoch != mrbc_method_cache_epoch ) return 0;
+
+  if( cache->accessor == 1 ) {
+    mrbc_value ret = mrbc_instance_getiv( recv, cache->ivar_id );
+    mrbc_decref_empty( recv + 1 );
+    mrbc_decref( recv );
+    *recv = ret;
+
+  } else {
+    mrbc_instance_setiv( recv, cache->ivar_id, recv + 1 );
+    mrbc_decref_empty( recv + 1 );
+    mrbc_decref_empty( recv + 2 );
+  }
+
+  return 1;
+}
+#else
+#define find_method_by_callsite(r_method, inst, cls, sym_id) \
+  mrbc_find_method(r_method, cls, sym_id)
+#endif
+
+
+#if defined(MRBC_NUMERIC_FAST_SEND)
+//================================================================
+/*! execute the simple built-in methods of Integer and Float directly,
+    unless they are redefined.
+
+  The results are same as the methods in c_numeric.c. The other cases
+  (e.g. not Integer argument, or % 0) are left to the methods.
+
+  @param  vm		pointer to VM.
+  @param  recv		receiver. (R[a])
+  @param  sym_id	method name.
+  @param  c		OP_SEND operand c (arguments count).
+  @retval 1		executed.
+  @retval 0		call the method normally.
+*/
+static inline int send_numeric( struct VM *vm, mrbc_value *recv, mrbc_sym sym_id, int c )
+{
+  if( mrbc_numeric_redefined ) return 0;
+
+  if( mrbc_type(*recv) == MRBC_TT_INTEGER ) {
+    mrbc_int_t x = recv->i;
+
+    if( c == 0 ) {
+      switch( sym_id ) {
+      case MRBC_SYM(abs):	if( x < 0 ) recv->i = -x;	break;
+      case MRBC_SYM(to_i):					break;
+      case MRBC_SYM(NEG):	recv->i = ~x;			break;
+#if MRBC_USE_FLOAT
+      case MRBC_SYM(to_f):	mrbc_set_float( recv, x );	break;
+#endif
+      default:			return 0;
+      }
+      mrbc_decref_empty( recv + 1 );
+      return 1;
+    }
+
+    if( c != 1 || mrbc_type(recv[1]) != MRBC_TT_INTEGER ) return 0;
+    mrbc_int_t y = recv[1].i;
+
+    switch( sym_id ) {
+    case MRBC_SYM(MOD):
+      if( y == 0 || y == -1 ) return 0;
+      recv->i = x % y;
+      break;
+    case MRBC_SYM(AND):		recv->i = x & y;			break;
+    case MRBC_SYM(OR):		recv->i = x | y;			break;
+    case MRBC_SYM(XOR):		recv->i = x ^ y;			break;
+    case MRBC_SYM(LT_LT):	recv->i = mrbc_integer_shift( x, y );	break;
+    case MRBC_SYM(GT_GT):	recv->i = mrbc_integer_shift( x, -y );	break;
+    default:			return 0;
+    }
+    recv[1].tt = MRBC_TT_EMPTY;
+    mrbc_decref_empty( recv + 2 );
+    return 1;
+  }
+
+#if MRBC_USE_FLOAT
+  if( mrbc_type(*recv) == MRBC_TT_FLOAT && c == 0 ) {
+    switch( sym_id ) {
+    case MRBC_SYM(abs):	if( recv->d < 0 ) recv->d = -recv->d;		break;
+    case MRBC_SYM(to_i):	mrbc_set_integer( recv, (mrbc_int_t)recv->d );	break;
+    case MRBC_SYM(to_f):						break;
+    default:			return 0;
+    }
+    mrbc_decref_empty( recv + 1 );
+    return 1;
+  }
+#endif
+
+  return 0;
+}
+#endif
+
+
+#if defined(MRBC_USE_CONST_CACHE)
+//================================================================
+/*! get the constant cache entry of the reference site.
+
+  @param  inst		reference site. (vm->inst)
+  @return		pointer to cache entry.
+*/
+static inline CONST_CACHE * const_cache_entry( const uint8_t *inst )
+{
+  return &const_cache[ ((uintptr_t)inst >> 2) & (MRBC_CONST_CACHE_SIZE - 1) ];
+}
+
+
+//================================================================
+/*! find the constant in the cache.
+
+  @param  cache		cache entry.
+  @param  inst		reference site. (vm->inst)
+  @param  cls		class that starts the search.
+  @return		pointer to cached value or NULL.
+*/
+static inline mrbc_value * const_cache_find( CONST_CACHE *cache, const uint8_t *inst, const mrbc_class *cls )
+{
+  if( cache->inst == inst && cache->cls == cls &&
+      cache->epoch == mrbc_const_cache_epoch ) return &cache->value;
+
+  return 0;
+}
+
+
+//================================================================
+/*! store the constant to the cache.
+
+  @param  cache		cache entry.
+  @param  inst		reference site. (vm->inst)
+  @param  cls		class that starts the search.
+  @param  v		resolved constant.
+*/
+static inline void const_cache_store( CONST_CACHE *cache, const uint8_t *inst, const mrbc_class *cls, const mrbc_value *v )
+{
+  cache->inst = inst;
+  cache->cls = cls;
+  cache->epoch = mrbc_const_cache_epoch;
+  cache->value = *v;
+}
+#endif
+
+
+//================================================================
+/*! get the slot number of global variable, with reference site cache.
+
+  @param  inst		reference site. (vm->inst)
+  @param  sym_id	variable name.
+  @return		slot number, or -1 if not defined.
+*/
+static inline int global_slot_by_site( const uint8_t *inst, mrbc_sym sym_id )
+{
+#if defined(MRBC_USE_GLOBAL_CACHE)
+  GLOBAL_CACHE *cache =
+    &global_cache[ ((uintptr_t)inst >> 2) & (MRBC_GLOBAL_CACHE_SIZE - 1) ];
+
+  // slots never move, so no invalidation is needed.
+  if( cache->inst == inst && cache->sym_id == sym_id ) return cache->slot;
+
+  int slot = mrbc_get_global_slot( sym_id );
+  if( slot >= 0 ) {
+    cache->inst = inst;
+    cache->sym_id = sym_id;
+    cache->slot = slot;
+  }
+  return slot;
+#else
+  return mrbc_get_global_slot( sym_id );
+#endif
+}
+
+
 //================================================================
 /*! Method call by method name's id
 
@@ -63,6 +424,7 @@ static uint16_t free_vm_bitmap[MAX_VM_COUNT / 16 + 1];
   @param  c		bit: 0-3=narg, 4-7=karg, 8=have block param flag.
   @retval 0  No error.
 */
+MRBC_HOT_FUNC
 static void send_by_name( struct VM *vm, mrbc_sym sym_id, int a, int c )
 {
   int narg = c & 0x0f;
@@ -70,33 +432,68 @@ static void send_by_name( struct VM *vm, mrbc_sym sym_id, int a, int c )
   mrbc_value *regs = vm->cur_regs;
   mrbc_value *recv = regs + a;
 
+  BUDGET_CHECK(vm);
+
   // If it's packed in an array, expand it.
   if( narg == CALL_MAXARGS ) {
     mrbc_value argv = recv[1];
     narg = mrbc_array_size(&argv);
-    for( int i = 0; i < narg; i++ ) {
-      mrbc_incref( &argv.array->data[i] );
-    }
+    if( mrbc_check_regs( vm, recv, narg + karg * 2 + 2 ) != 0 ) return;
 
     memmove( recv + narg + 1, recv + 2, sizeof(mrbc_value) * (karg * 2 + 1) );
     memcpy( recv + 1, argv.array->data, sizeof(mrbc_value) * narg );
 
+    if( argv.array->ref_count == 1 && mrbc_array_modify(&argv) == 0 ) {
+      // the array is dropped here, so take over its elements.
+      argv.array->n_stored = 0;
+    } else {
+      for( int i = 0; i < narg; i++ ) {
+	mrbc_incref( &recv[i+1] );
+      }
+    }
     mrbc_decref(&argv);
   }
 
+  mrbc_class *cls = find_class_by_object(recv);
+  mrbc_method method;
+  if( find_method_by_callsite( &method, vm->inst, cls, sym_id ) == 0 ) {
+    mrbc_raisef(vm, MRBC_CLASS(NoMethodError),
+		"undefined local variable or method '%s' for %s",
+		mrbc_symid_to_str(sym_id), mrbc_symid_to_str( cls->sym_id ));
+    if( vm->callinfo_tail != 0 ) {
+      vm->exception.exception->method_id = vm->callinfo_tail->method_id;
+    }
+    return;
+  }
+
   // Convert keyword argument to hash.
+  mrbc_hash kw_regs = {.data = 0};
   if( karg ) {
     narg++;
     if( karg != CALL_MAXARGS ) {
-      mrbc_value h = mrbc_hash_new( vm, karg );
-      if( !h.hash ) return;	// ENOMEM
-
       mrbc_value *r1 = recv + narg;
-      memcpy( h.hash->data, r1, sizeof(mrbc_value) * karg * 2 );
-      h.hash->n_stored = karg * 2;
-
       mrbc_value block = r1[karg * 2];
-      memset( r1 + 2, 0, sizeof(mrbc_value) * (karg * 2 - 1) );
+      mrbc_value h = {.tt = MRBC_TT_HASH};
+
+      if( method.c_func == 3 ) {
+	// the hash refers to the arguments in the registers.
+	if( mrbc_check_regs( vm, recv, narg + karg * 2 + 2 ) != 0 ) return;
+	memmove( r1 + 2, r1, sizeof(mrbc_value) * karg * 2 );
+	kw_regs.ref_count = 1;
+#if defined(MRBC_CYCLE_COLLECT)
+	kw_regs.flag_cycle = 1;		// on the stack, never be a candidate.
+#endif
+	kw_regs.data_size = karg * 2;
+	kw_regs.n_stored = karg * 2;
+	kw_regs.data = r1 + 2;
+	h.hash = &kw_regs;
+
+      } else {
+	h = mrbc_hash_new_pairs( vm, r1, karg );
+	if( !h.hash ) return;	// ENOMEM
+
+	memset( r1 + 2, 0, sizeof(mrbc_value) * (karg * 2 - 1) );
+      }
       *r1++ = h;
       *r1 = block;
     }
@@ -108,186 +505,897 @@ static void send_by_name( struct VM *vm, mrbc_sym sym_id, int a, int c )
     mrbc_set_nil( recv + narg + 1 );
   }
 
-  mrbc_class *cls = find_class_by_object(recv);
-  mrbc_method method;
-  if( mrbc_find_method( &method, cls, sym_id ) == 0 ) {
-    mrbc_raisef(vm, MRBC_CLASS(NoMethodError),
-		"undefined local variable or method '%s' for %s",
-		mrbc_symid_to_str(sym_id), mrbc_symid_to_str( cls->sym_id ));
-    if( vm->callinfo_tail != 0 ) {
-      vm->exception.exception->method_id = vm->callinfo_tail->method_id;
+  // call C function and return.
+  if( method.c_func ) {
+    mrbc_callinfo *callinfo = vm->callinfo_tail;
+    MRBC_CFUNC_LATENCY_BEGIN();
+#if defined(MRBC_PROFILE_CALLS)
+    mrbc_profile_cfunc prof;
+    mrbc_profile_cfunc_begin( vm, callinfo, &prof );
+    method.func(vm, recv, narg);
+    mrbc_profile_cfunc_end( vm, callinfo, &prof, method.cls, sym_id );
+#else
+    method.func(vm, recv, narg);
+#endif
+    MRBC_CFUNC_LATENCY_END( vm, method.cls, sym_id );
+
+    // release the keyword arguments left in the registers.
+    if( kw_regs.data ) {
+      mrbc_value h = {.tt = MRBC_TT_HASH, .hash = &kw_regs};
+      mrbc_hash_clear( &h );
+      memset( recv + narg + 2, 0, sizeof(mrbc_value) * karg * 2 );
+      if( recv[narg].tt == MRBC_TT_HASH && recv[narg].hash == &kw_regs ) {
+	recv[narg].tt = MRBC_TT_EMPTY;
+      }
+    }
+
+    // The function has pushed a frame (e.g. C iterator) that uses the arguments.
+    if( vm->callinfo_tail != callinfo ) return;
+
+    // If the function wants to be called again after resume (e.g. I/O wait),
+    // keep the arguments as is. OP_SEND will be re-executed.
+    if( vm->flag_retry_call ) {
+      if( (c & 0x0f) != CALL_MAXARGS && karg == 0 ) return;
+      vm->flag_retry_call = 0;	// can't retry with rearranged arguments.
+    }
+
+    if( mrbc_israised(vm) && vm->exception.exception->method_id == 0 ) {
+      vm->exception.exception->method_id = sym_id;
+    }
+    if( sym_id == MRBC_SYM(call) ) return;
+    if( sym_id == MRBC_SYM(new) ) return;
+
+    for( int i = 1; i <= narg+1; i++ ) {
+      mrbc_decref_empty( recv + i );
     }
     return;
   }
 
-  // call C function and return.
-  if( method.c_func ) {
-    method.func(vm, recv, narg);
+  // call Ruby method.
+  if( mrbc_check_regs( vm, recv, method.irep->nregs ) != 0 ) return;
+  mrbc_callinfo *callinfo = mrbc_push_callinfo(vm, sym_id, a, narg);
+  callinfo->own_class = method.cls;
+
+  vm->cur_irep = method.irep;
+  vm->inst = vm->cur_irep->inst;
+  vm->cur_regs = recv;
+}
+
+
+//================================================================
+/*! Find catch handler
+
+  The catch table is sorted by begin address at load time.
+  Binary search the last handler that begins before inst, then search
+  backward, so that the innermost one of nested handlers is found.
+
+  @param  vm	pointer to VM.
+  @param  type	catch type. (0=rescue, 1=ensure) or -1 for any.
+  @return	pointer to handler or NULL.
+*/
+static const mrbc_irep_catch_handler *find_catch_handler( const struct VM *vm, int type )
+{
+  const mrbc_irep *irep = vm->cur_irep;
+  const mrbc_irep_catch_handler *catch_table = mrbc_irep_tbl_catch(irep);
+  uint32_t inst = vm->inst - irep->inst;
+  int left = 0;
+  int right = irep->clen;
+
+  while( left < right ) {
+    int mid = (left + right) / 2;
+    if( catch_table[mid].begin < inst ) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+
+  while( --left >= 0 ) {
+    const mrbc_irep_catch_handler *handler = catch_table + left;
+    if( (inst <= handler->end) &&
+	(type < 0 || handler->type == type) ) return handler;
+  }
+
+  return NULL;
+}
+
+
+//================================================================
+/*! Find ensure catch handler
+*/
+static inline const mrbc_irep_catch_handler *find_catch_handler_ensure( const struct VM *vm )
+{
+  return find_catch_handler( vm, 1 );	// 1=CATCH_FILTER_ENSURE
+}
+
+
+//================================================================
+/*! get the self object
+*/
+static mrbc_value * mrbc_get_self( struct VM *vm, mrbc_value *regs )
+{
+  mrbc_value *self = &regs[0];
+  if( mrbc_type(*self) == MRBC_TT_PROC ) {
+    mrbc_callinfo *callinfo = regs[0].proc->callinfo_self;
+    if( callinfo ) {
+      self = callinfo->cur_regs + callinfo->reg_offset;
+    } else {
+      self = &vm->regs[0];
+    }
+    assert( self->tt != MRBC_TT_PROC );
+  }
+
+  return self;
+}
+
+
+/***** Global functions *****************************************************/
+
+//================================================================
+/*! cleanup
+*/
+void mrbc_cleanup_vm(void)
+{
+  memset(free_vm_bitmap, 0, sizeof(free_vm_bitmap));
+}
+
+
+//================================================================
+/*! get callee symbol id
+
+  @param  vm	Pointer to VM
+  @return	string
+*/
+mrbc_sym mrbc_get_callee_symid( struct VM *vm )
+{
+  uint8_t rb = vm->inst[-2];
+  /* NOTE
+     -2 is not always better value.
+     This value is OP_SEND operator's B register.
+  */
+  return mrbc_irep_symbol_id(vm->cur_irep, rb);
+}
+
+
+//================================================================
+/*! get callee name
+
+  @param  vm	Pointer to VM
+  @return	string
+*/
+const char *mrbc_get_callee_name( struct VM *vm )
+{
+  uint8_t rb = vm->inst[-2];
+  return mrbc_irep_symbol_cstr(vm->cur_irep, rb);
+}
+
+
+//================================================================
+/*! check the register stack for the callee.
+
+  The registers can't grow because they are a part of the VM (or TCB)
+  structure, so raise SystemStackError instead of overrunning it.
+
+  @param  vm	Pointer to VM
+  @param  regs	register top of the callee.
+  @param  n	number of registers the callee uses.
+  @return	zero if no error, or non-zero if raised.
+*/
+int mrbc_check_regs( struct VM *vm, const mrbc_value *regs, int n )
+{
+#if defined(MRBC_USE_FIBER)
+  if( vm->cur_fiber ) {
+    if( regs + n < vm->cur_fiber->regs + vm->cur_fiber->regs_size ) return 0;
+  } else
+#endif
+  if( regs + n < vm->regs + vm->regs_size ) return 0;
+
+  mrbc_raise( vm, MRBC_CLASS(SystemStackError), "stack level too deep");
+  return 1;
+}
+
+
+//================================================================
+/*! Push current status to callinfo stack
+
+  The popped callinfo is kept in the free list of the VM and reused,
+  so that a method call doesn't need the memory allocator at steady state.
+*/
+mrbc_callinfo * mrbc_push_callinfo( struct VM *vm, mrbc_sym method_id, int reg_offset, int n_args )
+{
+  mrbc_callinfo *callinfo = vm->callinfo_free;
+  if( callinfo ) {
+    vm->callinfo_free = callinfo->prev;
+  } else {
+    callinfo = mrbc_alloc(vm, sizeof(mrbc_callinfo));
+    if( !callinfo ) return callinfo;
+  }
+
+  callinfo->cur_irep = vm->cur_irep;
+  callinfo->inst = vm->inst;
+  callinfo->cur_regs = vm->cur_regs;
+  callinfo->target_class = vm->target_class;
+
+  callinfo->own_class = 0;
+  callinfo->karg_keep = 0;
+  callinfo->method_id = method_id;
+  callinfo->reg_offset = reg_offset;
+  callinfo->n_args = n_args;
+  callinfo->is_called_super = 0;
+
+  callinfo->prev = vm->callinfo_tail;
+  vm->callinfo_tail = callinfo;
+  MRBC_PROFILE_CALL_PUSH(vm, callinfo);
+
+  return callinfo;
+}
+
+
+//================================================================
+/*! Pop current status from callinfo stack
+*/
+void mrbc_pop_callinfo( struct VM *vm )
+{
+  assert( vm->callinfo_tail );
+
+  // clear used register.
+  mrbc_callinfo *callinfo = vm->callinfo_tail;
+  MRBC_PROFILE_CALL_POP(vm, callinfo);
+  mrbc_value *reg1 = vm->cur_regs + callinfo->cur_irep->nregs - callinfo->reg_offset;
+  mrbc_value *reg2 = vm->cur_regs + vm->cur_irep->nregs;
+  while( reg1 < reg2 ) {
+    mrbc_decref_empty( reg1++ );
+  }
+  if( callinfo->karg_keep ) {
+    mrbc_hash_delete( &(mrbc_value){.tt = MRBC_TT_HASH, .hash = callinfo->karg_keep} );
+  }
+
+  // copy callinfo to vm
+  vm->cur_irep = callinfo->cur_irep;
+  vm->inst = callinfo->inst;
+  vm->cur_regs = callinfo->cur_regs;
+  vm->target_class = callinfo->target_class;
+  vm->callinfo_tail = callinfo->prev;
+
+  // keep it for the next call.
+  callinfo->prev = vm->callinfo_free;
+  vm->callinfo_free = callinfo;
+}
+
+
+//================================================================
+/*! Start the C iterator frame.
+
+  Pushes a frame for the C method, so that the method can call the block
+  with mrbc_c_iter_yield() and is called again each time the block returns.
+  The frame has MRBC_C_ITER_REGS registers from v[0], and v[argc+1] must
+  be the block.
+
+  @param  vm	Pointer to VM
+  @param  v	registers of the method. (v[0] is the receiver)
+  @param  argc	num of arguments.
+  @param  func	function that is called when the block returned.
+  @return	zero if no error.
+
+<b>Code example</b>
+@code
+  // v[0]: self, v[1]: block, v[2]: counter, v[MRBC_C_ITER_REGS]: block result
+  static void c_integer_times_resume(struct VM *vm, mrbc_value v[], int argc)
+  {
+    if( v[2].i >= v[0].i ) {
+      mrbc_c_iter_end(vm, v);		// return self.
+      return;
+    }
+    mrbc_value i = v[2];
+    v[2].i++;
+    mrbc_c_iter_yield(vm, v, &v[1], 1, &i);
+  }
+
+  static void c_integer_times(struct VM *vm, mrbc_value v[], int argc)
+  {
+    if( mrbc_c_iter_begin(vm, v, argc, c_integer_times_resume) != 0 ) return;
+    mrbc_decref(&v[2]);
+    v[2] = mrbc_integer_value(0);
+    c_integer_times_resume(vm, v, argc);
+  }
+@endcode
+*/
+int mrbc_c_iter_begin( struct VM *vm, mrbc_value v[], int argc, mrbc_func_t func )
+{
+  if( mrbc_type(v[argc+1]) != MRBC_TT_PROC ) {
+    mrbc_raise( vm, MRBC_CLASS(ArgumentError), "no block given");
+    return -1;
+  }
+  if( mrbc_check_regs( vm, v, MRBC_C_ITER_REGS + 1 ) != 0 ) return -1;
+
+  mrbc_callinfo *callinfo = mrbc_push_callinfo(vm, 0, v - vm->cur_regs, argc);
+  if( !callinfo ) return -1;	// ENOMEM
+  callinfo->c_iter = func;
+  MRBC_PROFILE_CALL_KIND(callinfo, MRBC_PROFILE_C_ITER);
+
+  vm->cur_irep = &c_iter_irep;
+  vm->inst = c_iter_inst;
+  vm->cur_regs = v;
+
+  return 0;
+}
+
+
+//================================================================
+/*! Call the block from the C iterator.
+
+  The block runs after the C function returned, and then the function
+  given to mrbc_c_iter_begin() is called again with the return value
+  of the block in v[MRBC_C_ITER_REGS]. The function must end with
+  mrbc_c_iter_yield(), mrbc_c_iter_end() or an exception.
+
+  @param  vm	Pointer to VM
+  @param  v	registers of the C iterator frame.
+  @param  blk	block. (Proc)
+  @param  argc	num of arguments.
+  @param  argv	arguments.
+*/
+void mrbc_c_iter_yield( struct VM *vm, mrbc_value v[], const mrbc_value *blk, int argc, const mrbc_value argv[] )
+{
+  assert( vm->cur_irep == &c_iter_irep );
+  assert( mrbc_type(*blk) == MRBC_TT_PROC );
+
+  mrbc_proc *proc = blk->proc;
+  mrbc_value *regs = v + MRBC_C_ITER_REGS;
+  if( mrbc_check_regs( vm, regs, proc->irep->nregs ) != 0 ) return;
+
+  mrbc_decref( &regs[0] );
+  regs[0] = *blk;
+  mrbc_incref( &regs[0] );
+  for( int i = 0; i < argc; i++ ) {
+    mrbc_decref( &regs[i+1] );
+    regs[i+1] = argv[i];
+    mrbc_incref( &regs[i+1] );
+  }
+  mrbc_decref( &regs[argc+1] );
+  mrbc_set_nil( &regs[argc+1] );
+
+  // the block returns to OP_CALL of this frame.
+  vm->inst = c_iter_inst;
+  mrbc_callinfo *callinfo_self = proc->callinfo_self;
+  mrbc_callinfo *callinfo = mrbc_push_callinfo(vm,
+				(callinfo_self ? callinfo_self->method_id : 0),
+				MRBC_C_ITER_REGS, argc);
+  if( !callinfo ) {
+    mrbc_raise( vm, MRBC_CLASS(NoMemoryError), 0 );
+    return;
+  }
+  MRBC_PROFILE_CALL_KIND(callinfo, MRBC_PROFILE_BLOCK);
+
+  if( callinfo_self ) {
+    callinfo->own_class = callinfo_self->own_class;
+  }
+
+  vm->cur_irep = proc->irep;
+  vm->inst = vm->cur_irep->inst;
+  vm->cur_regs = regs;
+}
+
+
+//================================================================
+/*! Finish the C iterator and return v[0] to the caller.
+
+  @param  vm	Pointer to VM
+  @param  v	registers of the C iterator frame.
+*/
+void mrbc_c_iter_end( struct VM *vm, mrbc_value v[] )
+{
+  assert( vm->cur_irep == &c_iter_irep );
+
+  for( int i = 1; i <= MRBC_C_ITER_REGS; i++ ) {
+    mrbc_decref_empty( &v[i] );
+  }
+  mrbc_pop_callinfo( vm );
+}
+
+
+#if defined(MRBC_USE_FIBER)
+//================================================================
+/*! make the value passed by resume or Fiber.yield.
+
+  @return	nil, the argument, or Array of the arguments. (counted)
+*/
+static mrbc_value fiber_value( struct VM *vm, mrbc_value v[], int argc )
+{
+  if( argc == 0 ) return mrbc_nil_value();
+  if( argc == 1 ) {
+    mrbc_incref( &v[1] );
+    return v[1];
+  }
+
+  mrbc_value ary = mrbc_array_new( vm, argc );
+  if( !ary.array ) return mrbc_nil_value();	// ENOMEM
+  for( int i = 1; i <= argc; i++ ) {
+    mrbc_incref( &v[i] );
+    mrbc_array_push( &ary, &v[i] );
+  }
+  return ary;
+}
+
+
+//================================================================
+/*! return from the fiber to the resumer, at the end of the block.
+
+  @param  vm	Pointer to VM
+  @param  ret	return value of the block, or NULL at an exception.
+*/
+static void fiber_return( struct VM *vm, mrbc_value *ret )
+{
+  mrbc_fiber *fiber = vm->cur_fiber;
+  assert( vm->callinfo_tail == fiber->ci_bottom );
+
+  for( int i = 1; i <= MRBC_C_ITER_REGS; i++ ) {
+    mrbc_decref_empty( &fiber->regs[i] );
+  }
+  mrbc_pop_callinfo( vm );	// back to the resumer.
+
+  vm->cur_fiber = fiber->resumer;
+  fiber->state = MRBC_FIBER_TERMINATED;
+  fiber->ci_bottom = NULL;
+  if( ret ) {
+    mrbc_decref( fiber->ret_reg );
+    *fiber->ret_reg = *ret;
+  }
+
+  // the fiber may be released by this.
+  mrbc_value self = fiber->self;
+  mrbc_decref( &self );
+}
+
+
+//================================================================
+/*! C iterator of the bottom frame, called when the block returned.
+*/
+static void fiber_finish( struct VM *vm, mrbc_value v[], int argc )
+{
+  assert( v == vm->cur_fiber->regs );
+
+  mrbc_value ret = v[MRBC_C_ITER_REGS];
+  v[MRBC_C_ITER_REGS].tt = MRBC_TT_EMPTY;
+  fiber_return( vm, &ret );
+}
+
+
+//================================================================
+/*! Resume the fiber.
+
+  The fiber runs from the next instruction, and its return value is set
+  to v[0] when the fiber yields or ends. At the first resume, v[1] of the
+  bottom frame of the fiber must be the block.
+
+  @param  vm	Pointer to VM
+  @param  v	v[0] is the Fiber object, followed by the arguments.
+  @param  argc	num of arguments.
+*/
+void mrbc_fiber_resume( struct VM *vm, mrbc_value v[], int argc )
+{
+  mrbc_fiber *fiber = (mrbc_fiber *)v[0].instance->data;
+
+  switch( fiber->state ) {
+  case MRBC_FIBER_RUNNING:
+    mrbc_raise( vm, MRBC_CLASS(RuntimeError), "double resume");
+    return;
+  case MRBC_FIBER_TERMINATED:
+    mrbc_raise( vm, MRBC_CLASS(RuntimeError), "dead fiber called");
+    return;
+  }
+
+  if( fiber->state == MRBC_FIBER_CREATED ) {
+    mrbc_callinfo *callinfo = mrbc_push_callinfo(vm, 0, 0, 0);
+    if( !callinfo ) return;	// ENOMEM
+    callinfo->c_iter = fiber_finish;
+    MRBC_PROFILE_CALL_KIND(callinfo, MRBC_PROFILE_C_ITER);
+
+    fiber->ci_bottom = callinfo;
+    fiber->self = v[0];
+    mrbc_incref( &fiber->self );
+    fiber->ret_reg = v;
+    fiber->resumer = vm->cur_fiber;
+    fiber->state = MRBC_FIBER_RUNNING;
+    vm->cur_fiber = fiber;
+
+    vm->cur_irep = &c_iter_irep;
+    vm->inst = c_iter_inst;
+    vm->cur_regs = fiber->regs;
+    mrbc_c_iter_yield( vm, fiber->regs, &fiber->regs[1], argc, &v[1] );
+    return;
+  }
+
+  // link the chain of the fiber on the resumer.
+  mrbc_callinfo *callinfo = fiber->ci_bottom;
+  callinfo->cur_irep = vm->cur_irep;
+  callinfo->inst = vm->inst;
+  callinfo->cur_regs = vm->cur_regs;
+  callinfo->target_class = vm->target_class;
+  callinfo->prev = vm->callinfo_tail;
+
+  mrbc_decref( fiber->yield_reg );
+  *fiber->yield_reg = fiber_value( vm, v, argc );
+  fiber->ret_reg = v;
+  fiber->resumer = vm->cur_fiber;
+  fiber->state = MRBC_FIBER_RUNNING;
+  vm->cur_fiber = fiber;
+
+  vm->cur_irep = fiber->cur_irep;
+  vm->inst = fiber->inst;
+  vm->cur_regs = fiber->cur_regs;
+  vm->target_class = fiber->target_class;
+  vm->callinfo_tail = fiber->callinfo_tail;
+}
+
+
+//================================================================
+/*! Suspend the current fiber, and return to the resumer.
+
+  The arguments are the return value of resume, and the arguments of
+  the next resume are set to v[0].
+
+  @param  vm	Pointer to VM
+  @param  v	v[0] is the receiver, followed by the arguments.
+  @param  argc	num of arguments.
+*/
+void mrbc_fiber_yield( struct VM *vm, mrbc_value v[], int argc )
+{
+  mrbc_fiber *fiber = vm->cur_fiber;
+  if( !fiber ) {
+    mrbc_raise( vm, MRBC_CLASS(RuntimeError), "can't yield from root fiber");
+    return;
+  }
+
+  // a nested mrbc_vm_run() of mrbc_funcall() can't be suspended.
+  if( vm->cur_irep == &funcall_irep ) goto ERROR_CROSS_C;
+  for( mrbc_callinfo *ci = vm->callinfo_tail; ci != fiber->ci_bottom; ci = ci->prev ) {
+    if( ci->cur_irep == &funcall_irep ) goto ERROR_CROSS_C;
+  }
+
+  fiber->cur_irep = vm->cur_irep;
+  fiber->inst = vm->inst;
+  fiber->cur_regs = vm->cur_regs;
+  fiber->target_class = vm->target_class;
+  fiber->callinfo_tail = vm->callinfo_tail;
+  fiber->yield_reg = v;
+  fiber->state = MRBC_FIBER_SUSPENDED;
+
+  // cut the chain at the bottom, and return to the resumer.
+  mrbc_callinfo *callinfo = fiber->ci_bottom;
+  vm->cur_irep = callinfo->cur_irep;
+  vm->inst = callinfo->inst;
+  vm->cur_regs = callinfo->cur_regs;
+  vm->target_class = callinfo->target_class;
+  vm->callinfo_tail = callinfo->prev;
+  vm->cur_fiber = fiber->resumer;
+
+  mrbc_decref( fiber->ret_reg );
+  *fiber->ret_reg = fiber_value( vm, v, argc );
+  return;
+
+ ERROR_CROSS_C:
+  mrbc_raise( vm, MRBC_CLASS(RuntimeError), "can't yield across C function");
+}
+#endif
+
+
+//================================================================
+/*! Call the method from C, and return the result.
+
+  The method can be a Ruby method, a C function, or a block by
+  MRBC_SYM(call) to Proc. A Ruby method runs in a nested mrbc_vm_run()
+  until it returns, so this can be called from a C method or the main
+  loop. The arguments are placed over the current frame of the VM.
+
+  The nested run ignores the time slice, so the method must not sleep
+  or wait for an event. A block must not break or return beyond this
+  call.
+
+  @param  vm	Pointer to VM
+  @param  recv	receiver.
+  @param  sym_id method name.
+  @param  argc	num of arguments.
+  @param  argv	arguments.
+  @return	return value, or nil if an exception is raised.
+		(the exception is left in vm->exception)
+
+<b>Code example</b>
+@code
+  static mrbc_sym sym_on_event;	// resolved once.
+  if( !sym_on_event ) sym_on_event = mrbc_str_to_symid("on_event");
+
+  mrbc_value arg = mrbc_integer_value( event );
+  mrbc_value ret = mrbc_funcall( vm, &handler, sym_on_event, 1, &arg );
+  mrbc_decref( &ret );
+@endcode
+*/
+mrbc_value mrbc_funcall( struct VM *vm, const mrbc_value *recv, mrbc_sym sym_id, int argc, const mrbc_value argv[] )
+{
+  if( argc >= CALL_MAXARGS ) {
+    mrbc_raise( vm, MRBC_CLASS(ArgumentError), "too many arguments");
+    return mrbc_nil_value();
+  }
+  mrbc_value *regs = vm->cur_irep ? vm->cur_regs + vm->cur_irep->nregs : vm->regs;
+  if( mrbc_check_regs( vm, regs, argc + 2 ) != 0 ) return mrbc_nil_value();
+
+  mrbc_decref( &regs[0] );
+  regs[0] = *recv;
+  mrbc_incref( &regs[0] );
+  for( int i = 0; i < argc; i++ ) {
+    mrbc_decref( &regs[i+1] );
+    regs[i+1] = argv[i];
+    mrbc_incref( &regs[i+1] );
+  }
 
-    if( mrbc_israised(vm) && vm->exception.exception->method_id == 0 ) {
-      vm->exception.exception->method_id = sym_id;
+  // send from the pseudo frame.
+  const mrbc_irep *cur_irep = vm->cur_irep;
+  const uint8_t *inst = vm->inst;
+  mrbc_value *cur_regs = vm->cur_regs;
+  mrbc_class *target_class = vm->target_class;
+
+  vm->cur_irep = &funcall_irep;
+  vm->inst = funcall_inst;
+  vm->cur_regs = regs;
+  send_by_name( vm, sym_id, 0, argc );
+
+  // a frame is pushed, run until it returns to the pseudo frame.
+  if( vm->cur_irep != &funcall_irep ) {
+    unsigned int flag_stop = vm->flag_stop;
+    while( mrbc_vm_run( vm ) == 0 ) {
+      vm->flag_preemption = 0;	// no task switch in the nested run.
     }
-    if( sym_id == MRBC_SYM(call) ) return;
-    if( sym_id == MRBC_SYM(new) ) return;
+    vm->flag_stop = flag_stop;
+  }
+  assert( vm->cur_irep == &funcall_irep );
 
-    for( int i = 1; i <= narg+1; i++ ) {
-      mrbc_decref_empty( recv + i );
-    }
-    return;
+  mrbc_value ret = regs[0];
+  regs[0].tt = MRBC_TT_EMPTY;
+  for( int i = 1; i <= argc+1; i++ ) {
+    mrbc_decref_empty( &regs[i] );
+  }
+  if( mrbc_israised(vm) ) {
+    mrbc_decref( &ret );
+    ret = mrbc_nil_value();
+    vm->flag_preemption = 2;	// to be handled after the C method returns.
   }
 
-  // call Ruby method.
-  mrbc_callinfo *callinfo = mrbc_push_callinfo(vm, sym_id, a, narg);
-  callinfo->own_class = method.cls;
+  vm->cur_irep = cur_irep;
+  vm->inst = inst;
+  vm->cur_regs = cur_regs;
+  vm->target_class = target_class;
 
-  vm->cur_irep = method.irep;
-  vm->inst = vm->cur_irep->inst;
-  vm->cur_regs = recv;
+  return ret;
 }
 
 
+#if defined(MRBC_USE_AOT)
 //================================================================
-/*! Find ensure catch handler
+/*! hash of the instructions. (FNV-1a, same as tools/mrbc_aot.rb)
 */
-static const mrbc_irep_catch_handler *find_catch_handler_ensure( const struct VM *vm )
+static uint32_t aot_hash( const mrbc_irep *irep )
 {
-  const mrbc_irep *irep = vm->cur_irep;
-  int cnt = irep->clen;
-  if( cnt == 0 ) return NULL;
+  uint32_t h = 2166136261UL;
+  for( int i = 0; i < irep->ilen; i++ ) {
+    h = (h ^ irep->inst[i]) * 16777619UL;
+  }
+  return h;
+}
 
-  const mrbc_irep_catch_handler *catch_table =
-    (const mrbc_irep_catch_handler *)(irep->inst + irep->ilen);
-  uint32_t inst = vm->inst - irep->inst;
 
-  for( cnt--; cnt >= 0 ; cnt-- ) {
-    const mrbc_irep_catch_handler *handler = catch_table + cnt;
-    // Catch type and range check
-    if( (handler->type == 1) &&		// 1=CATCH_FILTER_ENSURE
-	(bin_to_uint32(handler->begin) < inst) &&
-	(inst <= bin_to_uint32(handler->end)) ) {
-      return handler;
+//================================================================
+/*! run the nested VM in the pseudo frame until OP_STOP.
+*/
+static int aot_run_nested( struct VM *vm )
+{
+  if( vm->cur_irep != &funcall_irep || *vm->inst != OP_STOP ) {
+    unsigned int flag_stop = vm->flag_stop;
+    while( mrbc_vm_run( vm ) == 0 ) {
+      vm->flag_preemption = 0;	// no task switch in the nested run.
     }
+    vm->flag_stop = flag_stop;
   }
+  assert( vm->cur_irep == &funcall_irep );
 
-  return NULL;
+  if( vm->flag_retry_call ) {
+    vm->flag_retry_call = 0;
+    mrbc_raise( vm, MRBC_CLASS(RuntimeError), "can't wait in AOT compiled method");
+  }
+  if( !mrbc_israised(vm) ) return 0;
+
+  vm->flag_preemption = 2;	// to be handled after the C method returns.
+  return -1;
 }
 
 
 //================================================================
-/*! get the self object
+/*! Register the AOT compiled method.
+
+  The method defined by OP_DEF is replaced with the function, if the
+  instructions are the same as the compiled ones.
+
+  @param  class_name	class name. (innermost name, if nested)
+  @param  method_name	method name.
+  @param  hash		hash of the instructions.
+  @param  func		compiled function.
+  @return		0 if no error.
 */
-static mrbc_value * mrbc_get_self( struct VM *vm, mrbc_value *regs )
+int mrbc_aot_define( const char *class_name, const char *method_name, uint32_t hash, mrbc_func_t func )
 {
-  mrbc_value *self = &regs[0];
-  if( mrbc_type(*self) == MRBC_TT_PROC ) {
-    mrbc_callinfo *callinfo = regs[0].proc->callinfo_self;
-    if( callinfo ) {
-      self = callinfo->cur_regs + callinfo->reg_offset;
-    } else {
-      self = &vm->regs[0];
-    }
-    assert( self->tt != MRBC_TT_PROC );
-  }
+  if( n_aot_methods >= MRBC_AOT_METHODS_MAX ) return -1;
 
-  return self;
-}
+  AOT_METHOD *m = &aot_methods[n_aot_methods];
+  m->cls_id = mrbc_str_to_symid( class_name );
+  m->sym_id = mrbc_str_to_symid( method_name );
+  if( m->cls_id < 0 || m->sym_id < 0 ) return -1;
+  m->hash = hash;
+  m->func = func;
+  n_aot_methods++;
 
+  return 0;
+}
 
-/***** Global functions *****************************************************/
 
 //================================================================
-/*! cleanup
+/*! Find the AOT compiled method.
+
+  @param  cls		class to define the method.
+  @param  sym_id	method name.
+  @param  irep		IREP of the method.
+  @return		function, or NULL if not compiled.
 */
-void mrbc_cleanup_vm(void)
+mrbc_func_t mrbc_aot_find( const mrbc_class *cls, mrbc_sym sym_id, const mrbc_irep *irep )
 {
-  memset(free_vm_bitmap, 0, sizeof(free_vm_bitmap));
+  // the nested class, by the innermost name.
+  mrbc_sym cls_id = cls->sym_id;
+  if( mrbc_is_nested_symid( cls_id ) ) {
+    mrbc_sym outer_id;
+    mrbc_separate_nested_symid( cls_id, &outer_id, &cls_id );
+  }
+
+  for( int i = 0; i < n_aot_methods; i++ ) {
+    const AOT_METHOD *m = &aot_methods[i];
+    if( m->cls_id != cls_id || m->sym_id != sym_id ) continue;
+    if( m->hash != aot_hash( irep ) ) return NULL;	// not the compiled one.
+    return m->func;
+  }
+
+  return NULL;
 }
 
 
 //================================================================
-/*! get callee symbol id
+/*! Execute the instructions for the AOT compiled method.
+
+  The instructions must not refer to the symbols or the pool of the
+  IREP, and end with OP_STOP. A method call runs in a nested
+  mrbc_vm_run() as mrbc_funcall() does.
 
   @param  vm	Pointer to VM
-  @return	string
+  @param  regs	registers of the compiled method.
+  @param  inst	instructions.
+  @return	non-zero if an exception is raised.
 */
-mrbc_sym mrbc_get_callee_symid( struct VM *vm )
+int mrbc_aot_exec( struct VM *vm, mrbc_value *regs, const uint8_t *inst )
 {
-  uint8_t rb = vm->inst[-2];
-  /* NOTE
-     -2 is not always better value.
-     This value is OP_SEND operator's B register.
-  */
-  return mrbc_irep_symbol_id(vm->cur_irep, rb);
+  const mrbc_irep *cur_irep = vm->cur_irep;
+  const uint8_t *cur_inst = vm->inst;
+  mrbc_value *cur_regs = vm->cur_regs;
+  mrbc_class *target_class = vm->target_class;
+
+  vm->cur_irep = &funcall_irep;
+  vm->inst = inst;
+  vm->cur_regs = regs;
+  int ret = aot_run_nested( vm );
+
+  vm->cur_irep = cur_irep;
+  vm->inst = cur_inst;
+  vm->cur_regs = cur_regs;
+  vm->target_class = target_class;
+
+  return ret;
 }
 
 
 //================================================================
-/*! get callee name
+/*! Send the method for the AOT compiled method.
 
-  @param  vm	Pointer to VM
-  @return	string
+  R[a] = R[a].send(sym_id, R[a+1]..R[a+n]) (c=n)
+
+  @param  vm	 Pointer to VM
+  @param  regs	 registers of the compiled method.
+  @param  site	 OP_STOP, unique to the call site. (key of the method cache)
+  @param  sym_id method name.
+  @param  a	 register of the receiver.
+  @param  c	 num of arguments.
+  @return	 non-zero if an exception is raised.
 */
-const char *mrbc_get_callee_name( struct VM *vm )
+int mrbc_aot_send( struct VM *vm, mrbc_value *regs, const uint8_t *site, mrbc_sym sym_id, int a, int c )
 {
-  uint8_t rb = vm->inst[-2];
-  return mrbc_irep_symbol_cstr(vm->cur_irep, rb);
+  const mrbc_irep *cur_irep = vm->cur_irep;
+  const uint8_t *cur_inst = vm->inst;
+  mrbc_value *cur_regs = vm->cur_regs;
+  mrbc_class *target_class = vm->target_class;
+
+  vm->cur_irep = &funcall_irep;
+  vm->inst = site;
+  vm->cur_regs = regs;
+  send_by_name( vm, sym_id, a, c );
+  int ret = aot_run_nested( vm );
+
+  vm->cur_irep = cur_irep;
+  vm->inst = cur_inst;
+  vm->cur_regs = cur_regs;
+  vm->target_class = target_class;
+
+  return ret;
 }
 
 
 //================================================================
-/*! Push current status to callinfo stack
+/*! Get the constant for the AOT compiled method.
+
+  R[a] = constget(sym_id), searched from the class of self.
+
+  @return	non-zero if an exception is raised.
 */
-mrbc_callinfo * mrbc_push_callinfo( struct VM *vm, mrbc_sym method_id, int reg_offset, int n_args )
+int mrbc_aot_getconst( struct VM *vm, mrbc_value *regs, int a, mrbc_sym sym_id )
 {
-  mrbc_callinfo *callinfo = mrbc_alloc(vm, sizeof(mrbc_callinfo));
-  if( !callinfo ) return callinfo;
+  mrbc_class *cls = find_class_by_object( &regs[0] );
+  mrbc_value *v = NULL;
 
-  callinfo->cur_irep = vm->cur_irep;
-  callinfo->inst = vm->inst;
-  callinfo->cur_regs = vm->cur_regs;
-  callinfo->target_class = vm->target_class;
+  // my class and the nested outer classes, then the super classes.
+  mrbc_class *cls1 = cls;
+  while( cls1->sym_id != MRBC_SYM(Object) ) {
+    v = mrbc_get_class_const( cls1, sym_id );
+    if( v != NULL ) goto DONE;
+    if( !mrbc_is_nested_symid(cls1->sym_id) ) break;
 
-  callinfo->own_class = 0;
-  callinfo->karg_keep = 0;
-  callinfo->method_id = method_id;
-  callinfo->reg_offset = reg_offset;
-  callinfo->n_args = n_args;
-  callinfo->is_called_super = 0;
+    mrbc_sym outer_id;
+    mrbc_separate_nested_symid( cls1->sym_id, &outer_id, 0 );
+    cls1 = mrbc_get_const( outer_id )->cls;
+  }
+  for( cls1 = cls->super; cls1; cls1 = cls1->super ) {
+    v = mrbc_get_class_const( cls1, sym_id );
+    if( v != NULL ) goto DONE;
+  }
 
-  callinfo->prev = vm->callinfo_tail;
-  vm->callinfo_tail = callinfo;
+  v = mrbc_get_const( sym_id );
+  if( v == NULL ) {
+    mrbc_raisef( vm, MRBC_CLASS(NameError),
+		 "uninitialized constant %s", mrbc_symid_to_str(sym_id));
+    return -1;
+  }
 
-  return callinfo;
+ DONE:
+  mrbc_incref( v );
+  mrbc_decref( &regs[a] );
+  regs[a] = *v;
+  return 0;
 }
 
 
 //================================================================
-/*! Pop current status from callinfo stack
+/*! Return from the AOT compiled method.
+
+  R[0] = R[a], and release the other registers as OP_RETURN does.
+
+  @param  regs	registers of the compiled method.
+  @param  a	register of the return value.
+  @param  nregs	num of registers.
 */
-void mrbc_pop_callinfo( struct VM *vm )
+void mrbc_aot_return( mrbc_value *regs, int a, int nregs )
 {
-  assert( vm->callinfo_tail );
+  mrbc_value ret = regs[a];
+  regs[a].tt = MRBC_TT_EMPTY;
 
-  // clear used register.
-  mrbc_callinfo *callinfo = vm->callinfo_tail;
-  mrbc_value *reg1 = vm->cur_regs + callinfo->cur_irep->nregs - callinfo->reg_offset;
-  mrbc_value *reg2 = vm->cur_regs + vm->cur_irep->nregs;
-  while( reg1 < reg2 ) {
-    mrbc_decref_empty( reg1++ );
-  }
-  if( callinfo->karg_keep ) {
-    mrbc_hash_delete( &(mrbc_value){.tt = MRBC_TT_HASH, .hash = callinfo->karg_keep} );
+  for( int i = 1; i < nregs; i++ ) {
+    mrbc_decref_empty( &regs[i] );
   }
-
-  // copy callinfo to vm
-  vm->cur_irep = callinfo->cur_irep;
-  vm->inst = callinfo->inst;
-  vm->cur_regs = callinfo->cur_regs;
-  vm->target_class = callinfo->target_class;
-  vm->callinfo_tail = callinfo->prev;
-
-  mrbc_free(vm, callinfo);
+  mrbc_decref( &regs[0] );
+  regs[0] = ret;
 }
+#endif
 
 
 //================================================================
@@ -370,9 +1478,20 @@ void mrbc_vm_close( struct VM *vm )
   int bit = 1 << ((vm->vm_id-1) & 0x0f);
   free_vm_bitmap[idx] &= ~bit;
 
+#if defined(MRBC_ALLOC_ARENA)
+  mrbc_alloc_arena_delete(vm);
+#endif
+#if defined(MRBC_ALLOC_VM_STATS)
+  mrbc_alloc_set_quota(vm, 0);	// for the next VM of this ID.
+#endif
+
   // free irep and vm
-  if( vm->top_irep ) mrbc_irep_free( vm->top_irep );
+  if( vm->top_irep && !vm->flag_irep_image ) mrbc_irep_free( vm->top_irep );
   if( vm->flag_need_memfree ) mrbc_raw_free(vm);
+
+  // call sites, classes and methods of this VM may be reused.
+  mrbc_method_cache_invalidate();
+  mrbc_printf_clear_cache();
 }
 
 
@@ -392,6 +1511,9 @@ void mrbc_vm_begin( struct VM *vm )
   vm->exception = mrbc_nil_value();
   vm->flag_preemption = 0;
   vm->flag_stop = 0;
+#if defined(MRBC_USE_FIBER)
+  vm->cur_fiber = NULL;
+#endif
 
   // set self to reg[0], others nil
   mrbc_decref( &vm->regs[0] );
@@ -432,8 +1554,22 @@ void mrbc_vm_end( struct VM *vm )
 	      n_used, vm->vm_id );
 #endif
 
+  // release the callinfo free list.
+  while( vm->callinfo_free ) {
+    mrbc_callinfo *callinfo = vm->callinfo_free;
+    vm->callinfo_free = callinfo->prev;
+    mrbc_free(vm, callinfo);
+  }
+
 #if defined(MRBC_ALLOC_VMID)
   mrbc_global_clear_vm_id();
+#if MRBC_USE_STRING
+  mrbc_string_shared_release_vm(vm);
+#endif
+  mrbc_array_shared_release_vm(vm);
+#if defined(MRBC_CYCLE_COLLECT)
+  mrbc_cycle_purge_vm(vm);
+#endif
   mrbc_free_all(vm);
 #endif
 }
@@ -465,6 +1601,17 @@ static inline void op_move( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_BB();
 
+#if defined(MRBC_USE_MOVE_ELISION)
+  uint32_t ofs = vm->inst - vm->cur_irep->inst;
+  if( mrbc_irep_tbl_move_elision(vm->cur_irep)[ofs >> 3] & (1 << (ofs & 7)) ) {
+    // R[b] will be overwritten before read. move it without refcount.
+    mrbc_decref(&regs[a]);
+    regs[a] = regs[b];
+    regs[b].tt = MRBC_TT_NIL;
+    return;
+  }
+#endif
+
   mrbc_incref(&regs[b]);
   mrbc_decref(&regs[a]);
   regs[a] = regs[b];
@@ -481,6 +1628,13 @@ static inline void op_loadl( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_BB();
 
   mrbc_decref(&regs[a]);
+#if defined(MRBC_USE_POOL_VALUE)
+  const mrbc_value *pv = &mrbc_irep_tbl_pool_values(vm->cur_irep)[b];
+  if( pv->tt != MRBC_TT_EMPTY ) {
+    regs[a] = *pv;
+    return;
+  }
+#endif
   regs[a] = mrbc_irep_pool_value(vm, b);
 }
 
@@ -641,10 +1795,12 @@ static inline void op_getgv( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_BB();
 
   mrbc_decref(&regs[a]);
-  mrbc_value *v = mrbc_get_global( mrbc_irep_symbol_id(vm->cur_irep, b) );
-  if( v == NULL ) {
+  int slot = global_slot_by_site( vm->inst,
+				  mrbc_irep_symbol_id(vm->cur_irep, b) );
+  if( slot < 0 ) {
     mrbc_set_nil(&regs[a]);
   } else {
+    mrbc_value *v = mrbc_get_global_by_slot( slot );
     mrbc_incref(v);
     regs[a] = *v;
   }
@@ -660,11 +1816,34 @@ static inline void op_setgv( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_BB();
 
+  mrbc_sym sym_id = mrbc_irep_symbol_id(vm->cur_irep, b);
+  int slot = global_slot_by_site( vm->inst, sym_id );
+
   mrbc_incref(&regs[a]);
-  mrbc_set_global( mrbc_irep_symbol_id(vm->cur_irep, b), &regs[a] );
+  if( slot < 0 ) {
+    mrbc_set_global( sym_id, &regs[a] );
+  } else {
+    mrbc_set_global_by_slot( slot, &regs[a] );
+  }
 }
 
 
+#if defined(MRBC_USE_IVAR_SHAPE)
+//================================================================
+/*! get the slot index cache of the instance variable access.
+
+  @param  vm	pointer to VM.
+  @param  n	symbol index in the current irep.
+  @return	pointer to the cache, or NULL if the irep is read only.
+*/
+static inline uint8_t * ivar_slot_cache( mrbc_vm *vm, int n )
+{
+  if( vm->flag_irep_image ) return 0;	// in flash.
+  return &mrbc_irep_tbl_ivslots(vm->cur_irep)[n];
+}
+#endif
+
+
 //================================================================
 /*! OP_GETIV
 
@@ -674,12 +1853,7 @@ static inline void op_getiv( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_BB();
 
-  const char *sym_name = mrbc_irep_symbol_cstr(vm->cur_irep, b);
-  mrbc_sym sym_id = mrbc_str_to_symid(sym_name+1);   // skip '@'
-  if( sym_id < 0 ) {
-    mrbc_raise(vm, MRBC_CLASS(Exception), "Overflow MAX_SYMBOLS_COUNT");
-    return;
-  }
+  mrbc_sym sym_id = mrbc_irep_ivar_symbol_id(vm->cur_irep, b);
   mrbc_value *self = mrbc_get_self( vm, regs );
   if( self->tt != MRBC_TT_OBJECT ) {
     mrbc_raise(vm, MRBC_CLASS(NotImplementedError), 0);
@@ -687,7 +1861,11 @@ static inline void op_getiv( mrbc_vm *vm, mrbc_value *regs EXT )
   }
 
   mrbc_decref(&regs[a]);
+#if defined(MRBC_USE_IVAR_SHAPE)
+  regs[a] = mrbc_instance_getiv_cached(self, sym_id, ivar_slot_cache(vm, b));
+#else
   regs[a] = mrbc_instance_getiv(self, sym_id);
+#endif
 }
 
 
@@ -700,19 +1878,18 @@ static inline void op_setiv( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_BB();
 
-  const char *sym_name = mrbc_irep_symbol_cstr(vm->cur_irep, b);
-  mrbc_sym sym_id = mrbc_str_to_symid(sym_name+1);   // skip '@'
-  if( sym_id < 0 ) {
-    mrbc_raise(vm, MRBC_CLASS(Exception), "Overflow MAX_SYMBOLS_COUNT");
-    return;
-  }
+  mrbc_sym sym_id = mrbc_irep_ivar_symbol_id(vm->cur_irep, b);
   mrbc_value *self = mrbc_get_self( vm, regs );
   if( self->tt != MRBC_TT_OBJECT ) {
     mrbc_raise(vm, MRBC_CLASS(NotImplementedError), 0);
     return;
   }
 
+#if defined(MRBC_USE_IVAR_SHAPE)
+  mrbc_instance_setiv_cached(self, sym_id, &regs[a], ivar_slot_cache(vm, b));
+#else
   mrbc_instance_setiv(self, sym_id, &regs[a]);
+#endif
 }
 
 
@@ -734,6 +1911,12 @@ static inline void op_getconst( mrbc_vm *vm, mrbc_value *regs EXT )
   } else if( vm->callinfo_tail ) {
     cls = vm->callinfo_tail->own_class;	// References in methods.
   }
+
+#if defined(MRBC_USE_CONST_CACHE)
+  CONST_CACHE *cache = const_cache_entry( vm->inst );
+  v = const_cache_find( cache, vm->inst, cls );
+  if( v ) goto HIT;
+#endif
   if( !cls ) goto TOP_LEVEL;
 
   // search in my class, then search nested outer class.
@@ -766,6 +1949,10 @@ static inline void op_getconst( mrbc_vm *vm, mrbc_value *regs EXT )
   }
 
  DONE:
+#if defined(MRBC_USE_CONST_CACHE)
+  const_cache_store( cache, vm->inst, cls, v );
+ HIT:
+#endif
   mrbc_incref(v);
   mrbc_decref(&regs[a]);
   regs[a] = *v;
@@ -805,6 +1992,12 @@ static inline void op_getmcnst( mrbc_vm *vm, mrbc_value *regs EXT )
   mrbc_class *cls = regs[a].cls;
   mrbc_value *v;
 
+#if defined(MRBC_USE_CONST_CACHE)
+  CONST_CACHE *cache = const_cache_entry( vm->inst );
+  v = const_cache_find( cache, vm->inst, regs[a].cls );
+  if( v ) goto HIT;
+#endif
+
   while( !(v = mrbc_get_class_const(cls, sym_id)) ) {
     cls = cls->super;
     if( cls->sym_id == MRBC_SYM(Object) ) {
@@ -814,6 +2007,11 @@ static inline void op_getmcnst( mrbc_vm *vm, mrbc_value *regs EXT )
     }
   }
 
+#if defined(MRBC_USE_CONST_CACHE)
+  const_cache_store( cache, vm->inst, regs[a].cls, v );
+ HIT:
+#endif
+
   mrbc_incref(v);
   mrbc_decref(&regs[a]);
   regs[a] = *v;
@@ -833,22 +2031,10 @@ static inline void op_getupvar( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_BBB();
 
   assert( mrbc_type(regs[0]) == MRBC_TT_PROC );
-  mrbc_callinfo *callinfo = regs[0].proc->callinfo;
-
-  for( int i = 0; i < c; i++ ) {
-    assert( callinfo );
-    mrbc_value *reg0 = callinfo->cur_regs + callinfo->reg_offset;
-
-    if( mrbc_type(*reg0) != MRBC_TT_PROC ) break;	// What to do?
-    callinfo = reg0->proc->callinfo;
-  }
+  mrbc_proc *proc = regs[0].proc;
 
-  mrbc_value *p_val;
-  if( callinfo == 0 ) {
-    p_val = vm->regs + b;
-  } else {
-    p_val = callinfo->cur_regs + callinfo->reg_offset + b;
-  }
+  if( c >= proc->n_upvar_regs ) c = proc->n_upvar_regs - 1;	// What to do?
+  mrbc_value *p_val = proc->upvar_regs[c] + b;
   mrbc_incref( p_val );
 
   mrbc_decref( &regs[a] );
@@ -866,21 +2052,10 @@ static inline void op_setupvar( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_BBB();
 
   assert( regs[0].tt == MRBC_TT_PROC );
-  mrbc_callinfo *callinfo = regs[0].proc->callinfo;
-
-  for( int i = 0; i < c; i++ ) {
-    assert( callinfo );
-    mrbc_value *reg0 = callinfo->cur_regs + callinfo->reg_offset;
-    assert( reg0->tt == MRBC_TT_PROC );
-    callinfo = reg0->proc->callinfo;
-  }
+  mrbc_proc *proc = regs[0].proc;
 
-  mrbc_value *p_val;
-  if( callinfo == 0 ) {
-    p_val = vm->regs + b;
-  } else {
-    p_val = callinfo->cur_regs + callinfo->reg_offset + b;
-  }
+  assert( c < proc->n_upvar_regs );
+  mrbc_value *p_val = proc->upvar_regs[c] + b;
   mrbc_decref( p_val );
 
   mrbc_incref( &regs[a] );
@@ -924,6 +2099,7 @@ static inline void op_jmp( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_S();
 
   vm->inst += (int16_t)a;
+  if( (int16_t)a < 0 ) BUDGET_CHECK(vm);
 }
 
 
@@ -938,6 +2114,7 @@ static inline void op_jmpif( mrbc_vm *vm, mrbc_value *regs EXT )
 
   if( regs[a].tt > MRBC_TT_FALSE ) {
     vm->inst += (int16_t)b;
+    if( (int16_t)b < 0 ) BUDGET_CHECK(vm);
   }
 }
 
@@ -953,6 +2130,7 @@ static inline void op_jmpnot( mrbc_vm *vm, mrbc_value *regs EXT )
 
   if( regs[a].tt <= MRBC_TT_FALSE ) {
     vm->inst += (int16_t)b;
+    if( (int16_t)b < 0 ) BUDGET_CHECK(vm);
   }
 }
 
@@ -968,8 +2146,52 @@ static inline void op_jmpnil( mrbc_vm *vm, mrbc_value *regs EXT )
 
   if( regs[a].tt == MRBC_TT_NIL ) {
     vm->inst += (int16_t)b;
+    if( (int16_t)b < 0 ) BUDGET_CHECK(vm);
+  }
+}
+
+
+#if defined(MRBC_USE_FUSED_OPCODE)
+//================================================================
+/*! execute the following OP_JMPIF or OP_JMPNOT that tests R[a].
+
+  Fused into the comparison opcodes, so that the pair costs one dispatch.
+  The bytecode is left as is, so offsets of catch handlers don't change.
+*/
+static inline void fused_cond_jump( mrbc_vm *vm, mrbc_value *regs, unsigned int a )
+{
+  const uint8_t *inst = vm->inst;
+  int taken;
+
+  switch( inst[0] ) {
+  case OP_JMPIF:  taken = (regs[a].tt >  MRBC_TT_FALSE); break;
+  case OP_JMPNOT: taken = (regs[a].tt <= MRBC_TT_FALSE); break;
+  default: return;
   }
+  if( inst[1] != a ) return;
+
+  vm->inst += 4;
+  if( !taken ) return;
+
+  int16_t offset = inst[2] << 8 | inst[3];
+  vm->inst += offset;
+  if( offset < 0 ) BUDGET_CHECK(vm);
+}
+
+
+//================================================================
+/*! execute the following OP_JMP. (e.g. end of while loop)
+*/
+static inline void fused_jump( mrbc_vm *vm )
+{
+  const uint8_t *inst = vm->inst;
+  if( inst[0] != OP_JMP ) return;
+
+  int16_t offset = inst[1] << 8 | inst[2];
+  vm->inst += 3 + offset;
+  if( offset < 0 ) BUDGET_CHECK(vm);
 }
+#endif
 
 
 //================================================================
@@ -992,8 +2214,8 @@ static inline void op_jmpuw( mrbc_vm *vm, mrbc_value *regs EXT )
 
   // check whether the jump point is inside or outside the catch handler.
   uint32_t jump_point = jump_inst - vm->cur_irep->inst;
-  if( (bin_to_uint32(handler->begin) < jump_point) &&
-      (jump_point <= bin_to_uint32(handler->end)) ) {
+  if( (handler->begin < jump_point) &&
+      (jump_point <= handler->end) ) {
     vm->inst = jump_inst;
     return;
   }
@@ -1002,7 +2224,7 @@ static inline void op_jmpuw( mrbc_vm *vm, mrbc_value *regs EXT )
   assert( vm->exception.tt == MRBC_TT_NIL );
   vm->exception.tt = MRBC_TT_JMPUW;
   vm->exception.handle = (void*)jump_inst;
-  vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+  vm->inst = vm->cur_irep->inst + handler->target;
 }
 
 
@@ -1071,7 +2293,7 @@ CASE_OP_RETURN:
   const mrbc_irep_catch_handler *handler = find_catch_handler_ensure(vm);
   if( handler ) {
     vm->exception = ra;
-    vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+    vm->inst = vm->cur_irep->inst + handler->target;
     return;
   }
 
@@ -1095,7 +2317,7 @@ CASE_OP_RETURN_BLK:
     const mrbc_irep_catch_handler *handler = find_catch_handler_ensure(vm);
     if( handler ) {
       vm->exception = ra;
-      vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+      vm->inst = vm->cur_irep->inst + handler->target;
       return;
     }
 
@@ -1138,7 +2360,7 @@ CASE_OP_BREAK: {
     const mrbc_irep_catch_handler *handler = find_catch_handler_ensure(vm);
     if( handler ) {
       vm->exception = ra;
-      vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+      vm->inst = vm->cur_irep->inst + handler->target;
       return;
     }
 
@@ -1168,8 +2390,8 @@ CASE_OP_JMPUW:
 
   // check whether the jump point is inside or outside the catch handler.
   uint32_t jump_point = (uint8_t *)ra.handle - vm->cur_irep->inst;
-  if( (bin_to_uint32(handler->begin) < jump_point) &&
-      (jump_point <= bin_to_uint32(handler->end)) ) {
+  if( (handler->begin < jump_point) &&
+      (jump_point <= handler->end) ) {
     vm->inst = ra.handle;
     return;
   }
@@ -1177,7 +2399,7 @@ CASE_OP_JMPUW:
   // jump point is outside, thus jump to ensure.
   assert( vm->exception.tt == MRBC_TT_NIL );
   vm->exception = ra;
-  vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+  vm->inst = vm->cur_irep->inst + handler->target;
   return;
 }
 
@@ -1191,6 +2413,27 @@ CASE_OP_EXCEPTION:
 }
 
 
+//================================================================
+/*! rewind the instruction pointer to re-execute OP_SEND family,
+    if the called C function requested it.
+
+  @param  inst	the instruction pointer at the start of handler.
+*/
+#if defined(MRBC_SUPPORT_OP_EXT)
+#define RETRY_SEND(inst) \
+  if( vm->flag_retry_call ) { \
+    vm->flag_retry_call = 0; \
+    vm->inst = (inst) - 1 - (ext != 0); \
+  }
+#else
+#define RETRY_SEND(inst) \
+  if( vm->flag_retry_call ) { \
+    vm->flag_retry_call = 0; \
+    vm->inst = (inst) - 1; \
+  }
+#endif
+
+
 //================================================================
 /*! OP_SSEND
 
@@ -1198,13 +2441,20 @@ CASE_OP_EXCEPTION:
 */
 static inline void op_ssend( mrbc_vm *vm, mrbc_value *regs EXT )
 {
+  const uint8_t *inst = vm->inst;
   FETCH_BBB();
 
   mrbc_decref( &regs[a] );
   regs[a] = *mrbc_get_self( vm, regs );
   mrbc_incref( &regs[a] );
 
-  send_by_name( vm, mrbc_irep_symbol_id(vm->cur_irep, b), a, c );
+  mrbc_sym sym_id = mrbc_irep_symbol_id(vm->cur_irep, b);
+#if defined(MRBC_USE_METHOD_CACHE)
+  if( send_accessor( vm, &regs[a], sym_id, c ) ) return;
+#endif
+
+  send_by_name( vm, sym_id, a, c );
+  RETRY_SEND( inst );
 }
 
 
@@ -1216,6 +2466,7 @@ static inline void op_ssend( mrbc_vm *vm, mrbc_value *regs EXT )
 */
 static inline void op_ssendb( mrbc_vm *vm, mrbc_value *regs EXT )
 {
+  const uint8_t *inst = vm->inst;
   FETCH_BBB();
 
   mrbc_decref( &regs[a] );
@@ -1223,6 +2474,7 @@ static inline void op_ssendb( mrbc_vm *vm, mrbc_value *regs EXT )
   mrbc_incref( &regs[a] );
 
   send_by_name( vm, mrbc_irep_symbol_id(vm->cur_irep, b), a, c | 0x100 );
+  RETRY_SEND( inst );
 }
 
 
@@ -1234,9 +2486,19 @@ static inline void op_ssendb( mrbc_vm *vm, mrbc_value *regs EXT )
 */
 static inline void op_send( mrbc_vm *vm, mrbc_value *regs EXT )
 {
+  const uint8_t *inst = vm->inst;
   FETCH_BBB();
 
-  send_by_name( vm, mrbc_irep_symbol_id(vm->cur_irep, b), a, c );
+  mrbc_sym sym_id = mrbc_irep_symbol_id(vm->cur_irep, b);
+#if defined(MRBC_USE_METHOD_CACHE)
+  if( send_accessor( vm, &regs[a], sym_id, c ) ) return;
+#endif
+#if defined(MRBC_NUMERIC_FAST_SEND)
+  if( send_numeric( vm, &regs[a], sym_id, c ) ) return;
+#endif
+
+  send_by_name( vm, sym_id, a, c );
+  RETRY_SEND( inst );
 }
 
 
@@ -1247,9 +2509,31 @@ static inline void op_send( mrbc_vm *vm, mrbc_value *regs EXT )
 */
 static inline void op_sendb( mrbc_vm *vm, mrbc_value *regs EXT )
 {
+  const uint8_t *inst = vm->inst;
   FETCH_BBB();
 
   send_by_name( vm, mrbc_irep_symbol_id(vm->cur_irep, b), a, c | 0x100 );
+  RETRY_SEND( inst );
+}
+
+
+//================================================================
+/*! OP_CALL
+
+  resume the C iterator of this frame. (internal use only)
+*/
+static inline void op_call( mrbc_vm *vm, mrbc_value *regs EXT )
+{
+  FETCH_Z();
+
+  if( vm->cur_irep != &c_iter_irep ) {
+    mrbc_raisef( vm, MRBC_CLASS(Exception),
+		 "Unimplemented opcode (0x%02x) found.", *(vm->inst - 1));
+    return;
+  }
+
+  mrbc_callinfo *callinfo = vm->callinfo_tail;
+  callinfo->c_iter( vm, regs, callinfo->n_args );
 }
 
 
@@ -1266,6 +2550,8 @@ static inline void op_super( mrbc_vm *vm, mrbc_value *regs EXT )
   int karg = (b >> 4) & 0x0f;
   mrbc_value *recv = regs + a;	// new regs[0]
 
+  BUDGET_CHECK(vm);
+
   // set self to new regs[0]
   mrbc_value *self = mrbc_get_self(vm, regs);
   assert( self->tt != MRBC_TT_PROC );
@@ -1283,6 +2569,7 @@ static inline void op_super( mrbc_vm *vm, mrbc_value *regs EXT )
     */
 
     assert( recv[1].tt == MRBC_TT_ARRAY );
+    if( mrbc_array_modify(&recv[1]) != 0 ) return;	// ENOMEM
 
     mrbc_value argary = recv[1];
     mrbc_value proc = recv[2];
@@ -1290,6 +2577,7 @@ static inline void op_super( mrbc_vm *vm, mrbc_value *regs EXT )
     recv[2].tt = MRBC_TT_EMPTY;
 
     int argc = mrbc_array_size(&argary);
+    if( mrbc_check_regs( vm, recv, argc + 2 ) != 0 ) return;
     for( int i = 0; i < argc; i++ ) {
       mrbc_decref( &recv[i+1] );
       recv[i+1] = argary.array->data[i];
@@ -1304,12 +2592,9 @@ static inline void op_super( mrbc_vm *vm, mrbc_value *regs EXT )
   // Convert keyword argument to hash.
   if( karg && karg != CALL_MAXARGS ) {
     narg++;
-    mrbc_value h = mrbc_hash_new( vm, karg );
-    if( !h.hash ) return;	// ENOMEM
-
     mrbc_value *r1 = recv + narg;
-    memcpy( h.hash->data, r1, sizeof(mrbc_value) * karg * 2 );
-    h.hash->n_stored = karg * 2;
+    mrbc_value h = mrbc_hash_new_pairs( vm, r1, karg );
+    if( !h.hash ) return;	// ENOMEM
 
     mrbc_value block = r1[karg * 2];
     memset( r1 + 2, 0, sizeof(mrbc_value) * (karg * 2 - 1) );
@@ -1335,7 +2620,11 @@ static inline void op_super( mrbc_vm *vm, mrbc_value *regs EXT )
 
   // call C function and return.
   if( method.c_func ) {
+    mrbc_callinfo *callinfo_org = vm->callinfo_tail;
+    MRBC_CFUNC_LATENCY_BEGIN();
     method.func(vm, recv, narg);
+    MRBC_CFUNC_LATENCY_END( vm, method.cls, callinfo->method_id );
+    if( vm->callinfo_tail != callinfo_org ) return;	// C iterator.
     for( int i = 1; i <= narg+1; i++ ) {
       mrbc_decref_empty( recv + i );
     }
@@ -1343,6 +2632,7 @@ static inline void op_super( mrbc_vm *vm, mrbc_value *regs EXT )
   }
 
   // call Ruby method.
+  if( mrbc_check_regs( vm, recv, method.irep->nregs ) != 0 ) return;
   callinfo = mrbc_push_callinfo(vm, callinfo->method_id, a, narg);
   callinfo->own_class = method.cls;
   callinfo->is_called_super = 1;
@@ -1381,19 +2671,10 @@ static inline void op_argary( mrbc_vm *vm, mrbc_value *regs EXT )
   mrbc_value *reg0 = regs;
 
   // rewind proc nest
-  if( lv ) {
-    assert( mrbc_type(*reg0) == MRBC_TT_PROC );
-    mrbc_callinfo *callinfo = reg0->proc->callinfo;
-    assert( callinfo );
-
-    for( int i = 1; i < lv; i ++ ) {
-      reg0 = callinfo->cur_regs + callinfo->reg_offset;
-      assert( mrbc_type(*reg0) == MRBC_TT_PROC );
-      callinfo = reg0->proc->callinfo;
-      assert( callinfo );
-    }
-
-    reg0 = callinfo->cur_regs + callinfo->reg_offset;
+  if( lv ) {
+    assert( mrbc_type(*reg0) == MRBC_TT_PROC );
+    assert( lv <= reg0->proc->n_upvar_regs );
+    reg0 = reg0->proc->upvar_regs[lv-1];
   }
 
   // create arguent array.
@@ -1431,6 +2712,7 @@ static inline void op_argary( mrbc_vm *vm, mrbc_value *regs EXT )
 */
 static inline void op_enter( mrbc_vm *vm, mrbc_value *regs EXT )
 {
+#define FLAG_M1		0x7c0000
 #define FLAG_REST	0x1000
 #define FLAG_M2		0x0f80
 #define FLAG_KW		0x007c
@@ -1440,11 +2722,12 @@ static inline void op_enter( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_W();
 
   // Check the number of registers to use.
-  int reg_use_max = regs - vm->regs + vm->cur_irep->nregs;
-  if( reg_use_max >= vm->regs_size ) {
-    mrbc_raise( vm, MRBC_CLASS(Exception), "MAX_REGS_SIZE overflow.");
-    return;
-  }
+  if( mrbc_check_regs( vm, regs, vm->cur_irep->nregs ) != 0 ) return;
+
+  // fast path. required parameters only, and the number of arguments matches.
+  // the block is already in place, so nothing to do.
+  if( (a & ~(FLAG_M1|FLAG_BLOCK)) == 0 &&
+      (a >> 18) == vm->callinfo_tail->n_args ) return;
 
   // Check m2 parameter.
   if( a & FLAG_M2 ) {
@@ -1468,7 +2751,7 @@ static inline void op_enter( mrbc_vm *vm, mrbc_value *regs EXT )
   // support yield [...] pattern, to expand array.
   if( mrbc_type(regs[0]) == MRBC_TT_PROC &&
       mrbc_type(regs[1]) == MRBC_TT_ARRAY &&
-      argc == 1 && m1 > 1 ) {
+      argc == 1 && m1 > 1 && mrbc_array_modify(&regs[1]) == 0 ) {
     mrbc_value argary = regs[1];
     regs[1].tt = MRBC_TT_EMPTY;
 
@@ -1561,6 +2844,7 @@ static inline void op_enter( mrbc_vm *vm, mrbc_value *regs EXT )
     vm->inst += jmp_ofs * 3;	// 3 = bytecode size of OP_JMP
   }
 
+#undef FLAG_M1
 #undef FLAG_REST
 #undef FLAG_M2
 #undef FLAG_KW
@@ -1580,7 +2864,7 @@ static inline void op_key_p( mrbc_vm *vm, mrbc_value *regs EXT )
 
   mrbc_value *kdict = &regs[vm->callinfo_tail->n_args];
   mrbc_sym sym_id = mrbc_irep_symbol_id( vm->cur_irep, b );
-  mrbc_value *v = mrbc_hash_search_by_id( kdict, sym_id );
+  mrbc_value *v = mrbc_hash_get_by_id( kdict, sym_id );
 
   mrbc_decref(&regs[a]);
   mrbc_set_bool(&regs[a], v);
@@ -1648,7 +2932,7 @@ static inline void op_return__sub( mrbc_vm *vm, mrbc_value *regs, int a )
       regs[a].tt = MRBC_TT_EMPTY;
 
       vm->exception.tt = MRBC_TT_RETURN;
-      vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+      vm->inst = vm->cur_irep->inst + handler->target;
       return;
     }
   }
@@ -1720,7 +3004,7 @@ static inline void op_return_blk( mrbc_vm *vm, mrbc_value *regs EXT )
     if( handler ) {
       assert( vm->exception.tt == MRBC_TT_NIL );
       vm->exception.tt = MRBC_TT_RETURN_BLK;
-      vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+      vm->inst = vm->cur_irep->inst + handler->target;
       return;
     }
 
@@ -1772,7 +3056,7 @@ static inline void op_break( mrbc_vm *vm, mrbc_value *regs EXT )
     if( handler ) {
       assert( vm->exception.tt == MRBC_TT_NIL );
       vm->exception.tt = MRBC_TT_BREAK;
-      vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+      vm->inst = vm->cur_irep->inst + handler->target;
       return;
     }
 
@@ -1837,6 +3121,189 @@ static inline void op_blkpush( mrbc_vm *vm, mrbc_value *regs EXT )
 }
 
 
+#if defined(MRBC_USE_FIXED)
+//================================================================
+/*! arithmetic operations with Fixed.
+
+  One of the pair is Fixed, and another is Fixed, Integer or Float.
+  The result is Fixed, or Float if the pair has Float.
+  Integer added or subtracted must be in the range of Fixed, same as
+  Fixed.new, or RangeError is raised. Multiplication and division by
+  Integer need no conversion, and wrap around at overflow.
+
+  @param  vm	pointer to VM.
+  @param  r	pointer to the pair, R[a] and R[a+1].
+  @param  op	operator. '+', '-', '*' or '/'.
+  @return	1 if done, or 0 if not the case.
+*/
+static inline int op_arith_fixed( mrbc_vm *vm, mrbc_value *r, int op )
+{
+  int32_t x, y;
+
+  if( r[0].tt == MRBC_TT_FIXED ) {
+    x = r[0].fx;
+    switch( r[1].tt ) {
+    case MRBC_TT_FIXED:
+      y = r[1].fx;
+      break;
+
+    case MRBC_TT_INTEGER:
+      // Fixed * Integer and Fixed / Integer need no conversion.
+      if( op == '*' ) {
+	r[0].fx = (int32_t)((uint32_t)x * (uint32_t)r[1].i);
+	return 1;
+      }
+      if( op == '/' ) {
+	if( r[1].i == 0 ) goto ZERO_DIVISION;
+	r[0].fx = (int32_t)(x / (int64_t)r[1].i);
+	return 1;
+      }
+      if( r[1].i < INT16_MIN || r[1].i > INT16_MAX ) goto RANGE_ERROR;
+      y = mrbc_fixed_from_int( r[1].i );
+      break;
+
+#if MRBC_USE_FLOAT
+    case MRBC_TT_FLOAT:
+      goto FLOAT;
+#endif
+
+    default:
+      return 0;
+    }
+
+  } else if( r[1].tt == MRBC_TT_FIXED ) {
+    y = r[1].fx;
+    switch( r[0].tt ) {
+    case MRBC_TT_INTEGER:
+      if( op == '*' ) {
+	r[0].tt = MRBC_TT_FIXED;
+	r[0].fx = (int32_t)((uint32_t)r[0].i * (uint32_t)y);
+	return 1;
+      }
+      if( r[0].i < INT16_MIN || r[0].i > INT16_MAX ) goto RANGE_ERROR;
+      x = mrbc_fixed_from_int( r[0].i );
+      break;
+
+#if MRBC_USE_FLOAT
+    case MRBC_TT_FLOAT:
+      goto FLOAT;
+#endif
+
+    default:
+      return 0;
+    }
+
+  } else {
+    return 0;
+  }
+
+  switch( op ) {
+  case '+': x = mrbc_fixed_add( x, y );	break;
+  case '-': x = mrbc_fixed_sub( x, y );	break;
+  case '*': x = mrbc_fixed_mul( x, y );	break;
+  case '/':
+    if( y == 0 ) goto ZERO_DIVISION;
+    x = mrbc_fixed_div( x, y );
+    break;
+  }
+  r[0].tt = MRBC_TT_FIXED;
+  r[0].fx = x;
+  return 1;
+
+ ZERO_DIVISION:
+  mrbc_raise(vm, MRBC_CLASS(ZeroDivisionError), 0 );
+  return 1;
+
+ RANGE_ERROR:
+  mrbc_raise(vm, MRBC_CLASS(RangeError), "out of Fixed range");
+  return 1;
+
+#if MRBC_USE_FLOAT
+ FLOAT: {
+    mrbc_float_t d1, d2;
+    d1 = (r[0].tt == MRBC_TT_FIXED) ? mrbc_fixed_to_float( r[0].fx ) : r[0].d;
+    d2 = (r[1].tt == MRBC_TT_FIXED) ? mrbc_fixed_to_float( r[1].fx ) : r[1].d;
+    switch( op ) {
+    case '+': d1 += d2;	break;
+    case '-': d1 -= d2;	break;
+    case '*': d1 *= d2;	break;
+    case '/': d1 /= d2;	break;
+    }
+    r[0].tt = MRBC_TT_FLOAT;
+    r[0].d = d1;
+    return 1;
+  }
+#endif
+}
+#endif
+
+
+#if defined(MRBC_INT_WIDE)
+//================================================================
+/*! arithmetic operations with the wide Integer.
+
+  The pair is Integer, and overflowed in 32bit or has the wide one.
+  The result is normalized, wide only if it needs more than 32bit.
+  The wide one and Float makes Float.
+
+  @param  vm	pointer to VM.
+  @param  r	pointer to the pair, R[a] and R[a+1].
+  @param  op	operator. '+', '-', '*' or '/'.
+  @return	1 if done, or 0 if not the case.
+*/
+static inline int op_arith_wide( mrbc_vm *vm, mrbc_value *r, int op )
+{
+  int is_int0 = (r[0].tt == MRBC_TT_INTEGER || r[0].tt == MRBC_TT_WIDE_INT);
+  int is_int1 = (r[1].tt == MRBC_TT_INTEGER || r[1].tt == MRBC_TT_WIDE_INT);
+
+  if( !(is_int0 && is_int1) ) {
+#if MRBC_USE_FLOAT
+    if( (is_int0 && r[1].tt == MRBC_TT_FLOAT) ||
+	(r[0].tt == MRBC_TT_FLOAT && is_int1) ) {
+      mrbc_float_t d1, d2;
+      d1 = is_int0 ? (mrbc_float_t)mrbc_int_wide_get( &r[0] ) : r[0].d;
+      d2 = is_int1 ? (mrbc_float_t)mrbc_int_wide_get( &r[1] ) : r[1].d;
+      switch( op ) {
+      case '+': d1 += d2;	break;
+      case '-': d1 -= d2;	break;
+      case '*': d1 *= d2;	break;
+      case '/': d1 /= d2;	break;
+      }
+      r[0].tt = MRBC_TT_FLOAT;
+      r[0].d = d1;
+      return 1;
+    }
+#endif
+    return 0;
+  }
+
+  // both are in 56bit, so + and - never overflow in int64.
+  int64_t x = mrbc_int_wide_get( &r[0] );
+  int64_t y = mrbc_int_wide_get( &r[1] );
+
+  switch( op ) {
+  case '+': x += y;	break;
+  case '-': x -= y;	break;
+  case '*':
+    if( __builtin_mul_overflow( x, y, &x ) ) goto OVERFLOW;
+    break;
+  case '/':
+    if( y == 0 ) {
+      mrbc_raise(vm, MRBC_CLASS(ZeroDivisionError), 0 );
+      return 1;
+    }
+    x /= y;
+    break;
+  }
+  if( mrbc_int_wide_set( &r[0], x ) == 0 ) return 1;
+
+ OVERFLOW:
+  mrbc_raise(vm, MRBC_CLASS(RangeError), "integer overflow");
+  return 1;
+}
+#endif
+
+
 //================================================================
 /*! OP_ADD
 
@@ -1846,11 +3313,21 @@ static inline void op_add( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
-  if( regs[a].tt == MRBC_TT_INTEGER ) {
-    if( regs[a+1].tt == MRBC_TT_INTEGER ) {     // in case of Integer, Integer
-      regs[a].i += regs[a+1].i;
+  if( IS_INTEGER_PAIR(&regs[a]) ) {		// in case of Integer, Integer
+#if defined(MRBC_INT_WIDE)
+    mrbc_int_t n;
+    if( !__builtin_add_overflow( regs[a].i, regs[a+1].i, &n ) ) {
+      regs[a].i = n;
       return;
     }
+    // overflowed, see op_arith_wide()
+#else
+    regs[a].i = INT_WRAP( regs[a].i, +, regs[a+1].i );
+    return;
+#endif
+  }
+
+  if( regs[a].tt == MRBC_TT_INTEGER ) {
 #if MRBC_USE_FLOAT
     if( regs[a+1].tt == MRBC_TT_FLOAT ) {      // in case of Integer, Float
       regs[a].tt = MRBC_TT_FLOAT;
@@ -1870,6 +3347,13 @@ static inline void op_add( mrbc_vm *vm, mrbc_value *regs EXT )
 #endif
   }
 
+#if defined(MRBC_INT_WIDE)
+  if( op_arith_wide( vm, &regs[a], '+' ) ) return;
+#endif
+#if defined(MRBC_USE_FIXED)
+  if( op_arith_fixed( vm, &regs[a], '+' ) ) return;
+#endif
+
   // other case
   send_by_name( vm, MRBC_SYM(PLUS), a, 1 );
 }
@@ -1885,9 +3369,30 @@ static inline void op_addi( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_BB();
 
   if( regs[a].tt == MRBC_TT_INTEGER ) {
-    regs[a].i += b;
+#if defined(MRBC_INT_WIDE)
+    mrbc_int_t n;
+    if( __builtin_add_overflow( regs[a].i, b, &n ) ) {
+      mrbc_int_wide_set( &regs[a], (int64_t)regs[a].i + b );
+      return;
+    }
+    regs[a].i = n;
+#else
+    regs[a].i = INT_WRAP( regs[a].i, +, b );
+#endif
+#if defined(MRBC_USE_FUSED_OPCODE)
+    fused_jump( vm );
+#endif
+    return;
+  }
+
+#if defined(MRBC_INT_WIDE)
+  if( regs[a].tt == MRBC_TT_WIDE_INT ) {
+    if( mrbc_int_wide_set( &regs[a], mrbc_int_wide_get( &regs[a] ) + b ) ) {
+      mrbc_raise(vm, MRBC_CLASS(RangeError), "integer overflow");
+    }
     return;
   }
+#endif
 
 #if MRBC_USE_FLOAT
   if( regs[a].tt == MRBC_TT_FLOAT ) {
@@ -1896,6 +3401,17 @@ static inline void op_addi( mrbc_vm *vm, mrbc_value *regs EXT )
   }
 #endif
 
+#if defined(MRBC_USE_FIXED)
+  if( regs[a].tt == MRBC_TT_FIXED ) {
+    if( b > INT16_MAX ) {
+      mrbc_raise(vm, MRBC_CLASS(RangeError), "out of Fixed range");
+      return;
+    }
+    regs[a].fx = mrbc_fixed_add( regs[a].fx, mrbc_fixed_from_int(b) );
+    return;
+  }
+#endif
+
   mrbc_raise(vm, MRBC_CLASS(TypeError), "no implicit conversion of Integer");
 }
 
@@ -1909,11 +3425,21 @@ static inline void op_sub( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
-  if( regs[a].tt == MRBC_TT_INTEGER ) {
-    if( regs[a+1].tt == MRBC_TT_INTEGER ) {     // in case of Integer, Integer
-      regs[a].i -= regs[a+1].i;
+  if( IS_INTEGER_PAIR(&regs[a]) ) {		// in case of Integer, Integer
+#if defined(MRBC_INT_WIDE)
+    mrbc_int_t n;
+    if( !__builtin_sub_overflow( regs[a].i, regs[a+1].i, &n ) ) {
+      regs[a].i = n;
       return;
     }
+    // overflowed, see op_arith_wide()
+#else
+    regs[a].i = INT_WRAP( regs[a].i, -, regs[a+1].i );
+    return;
+#endif
+  }
+
+  if( regs[a].tt == MRBC_TT_INTEGER ) {
 #if MRBC_USE_FLOAT
     if( regs[a+1].tt == MRBC_TT_FLOAT ) {      // in case of Integer, Float
       regs[a].tt = MRBC_TT_FLOAT;
@@ -1933,6 +3459,13 @@ static inline void op_sub( mrbc_vm *vm, mrbc_value *regs EXT )
 #endif
   }
 
+#if defined(MRBC_INT_WIDE)
+  if( op_arith_wide( vm, &regs[a], '-' ) ) return;
+#endif
+#if defined(MRBC_USE_FIXED)
+  if( op_arith_fixed( vm, &regs[a], '-' ) ) return;
+#endif
+
   // other case
   send_by_name( vm, MRBC_SYM(MINUS), a, 1 );
 }
@@ -1948,9 +3481,30 @@ static inline void op_subi( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_BB();
 
   if( regs[a].tt == MRBC_TT_INTEGER ) {
-    regs[a].i -= b;
+#if defined(MRBC_INT_WIDE)
+    mrbc_int_t n;
+    if( __builtin_sub_overflow( regs[a].i, b, &n ) ) {
+      mrbc_int_wide_set( &regs[a], (int64_t)regs[a].i - b );
+      return;
+    }
+    regs[a].i = n;
+#else
+    regs[a].i = INT_WRAP( regs[a].i, -, b );
+#endif
+#if defined(MRBC_USE_FUSED_OPCODE)
+    fused_jump( vm );
+#endif
+    return;
+  }
+
+#if defined(MRBC_INT_WIDE)
+  if( regs[a].tt == MRBC_TT_WIDE_INT ) {
+    if( mrbc_int_wide_set( &regs[a], mrbc_int_wide_get( &regs[a] ) - b ) ) {
+      mrbc_raise(vm, MRBC_CLASS(RangeError), "integer overflow");
+    }
     return;
   }
+#endif
 
 #if MRBC_USE_FLOAT
   if( regs[a].tt == MRBC_TT_FLOAT ) {
@@ -1959,6 +3513,17 @@ static inline void op_subi( mrbc_vm *vm, mrbc_value *regs EXT )
   }
 #endif
 
+#if defined(MRBC_USE_FIXED)
+  if( regs[a].tt == MRBC_TT_FIXED ) {
+    if( b > INT16_MAX ) {
+      mrbc_raise(vm, MRBC_CLASS(RangeError), "out of Fixed range");
+      return;
+    }
+    regs[a].fx = mrbc_fixed_sub( regs[a].fx, mrbc_fixed_from_int(b) );
+    return;
+  }
+#endif
+
   mrbc_raise(vm, MRBC_CLASS(TypeError), "no implicit conversion of Integer");
 }
 
@@ -1972,11 +3537,21 @@ static inline void op_mul( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
-  if( regs[a].tt == MRBC_TT_INTEGER ) {
-    if( regs[a+1].tt == MRBC_TT_INTEGER ) {     // in case of Integer, Integer
-      regs[a].i *= regs[a+1].i;
+  if( IS_INTEGER_PAIR(&regs[a]) ) {		// in case of Integer, Integer
+#if defined(MRBC_INT_WIDE)
+    mrbc_int_t n;
+    if( !__builtin_mul_overflow( regs[a].i, regs[a+1].i, &n ) ) {
+      regs[a].i = n;
       return;
     }
+    // overflowed, see op_arith_wide()
+#else
+    regs[a].i = INT_WRAP( regs[a].i, *, regs[a+1].i );
+    return;
+#endif
+  }
+
+  if( regs[a].tt == MRBC_TT_INTEGER ) {
 #if MRBC_USE_FLOAT
     if( regs[a+1].tt == MRBC_TT_FLOAT ) {      // in case of Integer, Float
       regs[a].tt = MRBC_TT_FLOAT;
@@ -1996,6 +3571,13 @@ static inline void op_mul( mrbc_vm *vm, mrbc_value *regs EXT )
 #endif
   }
 
+#if defined(MRBC_INT_WIDE)
+  if( op_arith_wide( vm, &regs[a], '*' ) ) return;
+#endif
+#if defined(MRBC_USE_FIXED)
+  if( op_arith_fixed( vm, &regs[a], '*' ) ) return;
+#endif
+
   // other case
   send_by_name( vm, MRBC_SYM(MUL), a, 1 );
 }
@@ -2014,6 +3596,10 @@ static inline void op_div( mrbc_vm *vm, mrbc_value *regs EXT )
     if( regs[a+1].tt == MRBC_TT_INTEGER ) {     // in case of Integer, Integer
       if( regs[a+1].i == 0 ) {
 	mrbc_raise(vm, MRBC_CLASS(ZeroDivisionError), 0 );
+#if defined(MRBC_INT_WIDE)
+      } else if( regs[a+1].i == -1 ) {
+	mrbc_int_wide_set( &regs[a], -(int64_t)regs[a].i );	// for INT32_MIN
+#endif
       } else {
 	regs[a].i /= regs[a+1].i;
       }
@@ -2038,6 +3624,13 @@ static inline void op_div( mrbc_vm *vm, mrbc_value *regs EXT )
 #endif
   }
 
+#if defined(MRBC_INT_WIDE)
+  if( op_arith_wide( vm, &regs[a], '/' ) ) return;
+#endif
+#if defined(MRBC_USE_FIXED)
+  if( op_arith_fixed( vm, &regs[a], '/' ) ) return;
+#endif
+
   // other case
   send_by_name( vm, MRBC_SYM(DIV), a, 1 );
 }
@@ -2052,6 +3645,14 @@ static inline void op_eq( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
+  if( IS_INTEGER_PAIR(&regs[a]) ) {		// in case of Integer, Integer
+    regs[a].tt = MRBC_TT_FALSE + (regs[a].i == regs[a+1].i);
+#if defined(MRBC_USE_FUSED_OPCODE)
+    fused_cond_jump( vm, regs, a );
+#endif
+    return;
+  }
+
   if (regs[a].tt == MRBC_TT_OBJECT) {
     send_by_name(vm, MRBC_SYM(EQ_EQ), a, 1);
     return;
@@ -2061,6 +3662,9 @@ static inline void op_eq( mrbc_vm *vm, mrbc_value *regs EXT )
 
   mrbc_decref(&regs[a]);
   regs[a].tt = result ? MRBC_TT_FALSE : MRBC_TT_TRUE;
+#if defined(MRBC_USE_FUSED_OPCODE)
+  fused_cond_jump( vm, regs, a );
+#endif
 }
 
 
@@ -2073,6 +3677,14 @@ static inline void op_lt( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
+  if( IS_INTEGER_PAIR(&regs[a]) ) {		// in case of Integer, Integer
+    regs[a].tt = MRBC_TT_FALSE + (regs[a].i < regs[a+1].i);
+#if defined(MRBC_USE_FUSED_OPCODE)
+    fused_cond_jump( vm, regs, a );
+#endif
+    return;
+  }
+
   if (regs[a].tt == MRBC_TT_OBJECT) {
     send_by_name(vm, MRBC_SYM(LT), a, 1);
     return;
@@ -2082,6 +3694,9 @@ static inline void op_lt( mrbc_vm *vm, mrbc_value *regs EXT )
 
   mrbc_decref(&regs[a]);
   regs[a].tt = result < 0 ? MRBC_TT_TRUE : MRBC_TT_FALSE;
+#if defined(MRBC_USE_FUSED_OPCODE)
+  fused_cond_jump( vm, regs, a );
+#endif
 }
 
 
@@ -2094,6 +3709,14 @@ static inline void op_le( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
+  if( IS_INTEGER_PAIR(&regs[a]) ) {		// in case of Integer, Integer
+    regs[a].tt = MRBC_TT_FALSE + (regs[a].i <= regs[a+1].i);
+#if defined(MRBC_USE_FUSED_OPCODE)
+    fused_cond_jump( vm, regs, a );
+#endif
+    return;
+  }
+
   if (regs[a].tt == MRBC_TT_OBJECT) {
     send_by_name(vm, MRBC_SYM(LT_EQ), a, 1);
     return;
@@ -2103,6 +3726,9 @@ static inline void op_le( mrbc_vm *vm, mrbc_value *regs EXT )
 
   mrbc_decref(&regs[a]);
   regs[a].tt = result <= 0 ? MRBC_TT_TRUE : MRBC_TT_FALSE;
+#if defined(MRBC_USE_FUSED_OPCODE)
+  fused_cond_jump( vm, regs, a );
+#endif
 }
 
 
@@ -2115,6 +3741,14 @@ static inline void op_gt( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
+  if( IS_INTEGER_PAIR(&regs[a]) ) {		// in case of Integer, Integer
+    regs[a].tt = MRBC_TT_FALSE + (regs[a].i > regs[a+1].i);
+#if defined(MRBC_USE_FUSED_OPCODE)
+    fused_cond_jump( vm, regs, a );
+#endif
+    return;
+  }
+
   if (regs[a].tt == MRBC_TT_OBJECT) {
     send_by_name(vm, MRBC_SYM(GT), a, 1);
     return;
@@ -2124,6 +3758,9 @@ static inline void op_gt( mrbc_vm *vm, mrbc_value *regs EXT )
 
   mrbc_decref(&regs[a]);
   regs[a].tt = result > 0 ? MRBC_TT_TRUE : MRBC_TT_FALSE;
+#if defined(MRBC_USE_FUSED_OPCODE)
+  fused_cond_jump( vm, regs, a );
+#endif
 }
 
 
@@ -2136,6 +3773,14 @@ static inline void op_ge( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
+  if( IS_INTEGER_PAIR(&regs[a]) ) {		// in case of Integer, Integer
+    regs[a].tt = MRBC_TT_FALSE + (regs[a].i >= regs[a+1].i);
+#if defined(MRBC_USE_FUSED_OPCODE)
+    fused_cond_jump( vm, regs, a );
+#endif
+    return;
+  }
+
   if (regs[a].tt == MRBC_TT_OBJECT) {
     send_by_name(vm, MRBC_SYM(GT_EQ), a, 1);
     return;
@@ -2145,6 +3790,9 @@ static inline void op_ge( mrbc_vm *vm, mrbc_value *regs EXT )
 
   mrbc_decref(&regs[a]);
   regs[a].tt = result >= 0 ? MRBC_TT_TRUE : MRBC_TT_FALSE;
+#if defined(MRBC_USE_FUSED_OPCODE)
+  fused_cond_jump( vm, regs, a );
+#endif
 }
 
 
@@ -2213,6 +3861,8 @@ static inline void op_arycat( mrbc_vm *vm, mrbc_value *regs EXT )
   assert( regs[a  ].tt == MRBC_TT_ARRAY );
   assert( regs[a+1].tt == MRBC_TT_ARRAY );
 
+  if( mrbc_array_modify(&regs[a]) != 0 ) return;	// ENOMEM
+
   int size_1 = regs[a  ].array->n_stored;
   int size_2 = regs[a+1].array->n_stored;
   int new_size = size_1 + regs[a+1].array->n_stored;
@@ -2410,12 +4060,60 @@ static inline void op_string( mrbc_vm *vm, mrbc_value *regs EXT )
 /*! OP_STRCAT
 
   str_cat(R[a],R[a+1])
+
+  String, Integer, Float, Symbol and nil are appended directly as
+  their to_s does, without the temporary String. (as mruby does)
 */
 static inline void op_strcat( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_B();
 
 #if MRBC_USE_STRING
+  char buf[24];
+  const char *s = buf;
+  int len = -1;
+
+  switch( mrbc_type(regs[a+1]) ) {
+  case MRBC_TT_STRING:
+    mrbc_string_append( &regs[a], &regs[a+1] );
+    mrbc_decref_empty( &regs[a+1] );
+    return;
+
+  case MRBC_TT_INTEGER: {
+    mrbc_printf_t pf;
+    mrbc_printf_init( &pf, buf, sizeof(buf), NULL );
+    pf.fmt.type = 'd';
+    mrbc_printf_int( &pf, regs[a+1].i, 10 );
+    len = pf.p - buf;
+    break;
+  }
+
+#if MRBC_USE_FLOAT
+  case MRBC_TT_FLOAT:
+    mrbc_snprintf( buf, sizeof(buf), "%g", regs[a+1].d );
+    len = strlen( buf );
+    break;
+#endif
+
+  case MRBC_TT_SYMBOL:
+    s = mrbc_symid_to_str( mrbc_symbol(regs[a+1]) );
+    len = strlen( s );
+    break;
+
+  case MRBC_TT_NIL:
+    len = 0;
+    break;
+
+  default:
+    break;
+  }
+
+  if( len >= 0 ) {
+    if( len > 0 ) mrbc_string_append_cbuf( &regs[a], s, len );
+    regs[a+1].tt = MRBC_TT_EMPTY;
+    return;
+  }
+
   // call "to_s"
   mrbc_method method;
   if( mrbc_find_method( &method, find_class_by_object(&regs[a+1]),
@@ -2441,14 +4139,11 @@ static inline void op_hash( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_BB();
 
-  mrbc_value value = mrbc_hash_new(vm, b);
+  // note: Do not detect duplicate keys.
+  mrbc_value value = mrbc_hash_new_pairs(vm, &regs[a], b);
   if( value.hash == NULL ) return;   // ENOMEM
 
-  // note: Do not detect duplicate keys.
-  b *= 2;
-  memcpy( value.hash->data, &regs[a], sizeof(mrbc_value) * b );
-  memset( &regs[a], 0, sizeof(mrbc_value) * b );
-  value.hash->n_stored = b;
+  memset( &regs[a], 0, sizeof(mrbc_value) * b * 2 );
 
   mrbc_decref(&regs[a]);
   regs[a] = value;
@@ -2464,6 +4159,18 @@ static inline void op_hashadd( mrbc_vm *vm, mrbc_value *regs EXT )
 {
   FETCH_BB();
 
+#if defined(MRBC_USE_HASH_SYMKEY)
+  if( regs[a].hash->flag_symkey ) {
+    int i;
+    for( i = 1; i <= b * 2; i += 2 ) {
+      if( mrbc_hash_set( &regs[a], &regs[a+i], &regs[a+i+1] ) != 0 ) return;
+      mrbc_set_nil( &regs[a+i] );
+      mrbc_set_nil( &regs[a+i+1] );
+    }
+    return;
+  }
+#endif
+
   int sz1 = mrbc_array_size(&regs[a]);
   int sz2 = b * 2;
 
@@ -2510,7 +4217,10 @@ static inline void op_method( mrbc_vm *vm, mrbc_value *regs EXT )
 
   mrbc_decref(&regs[a]);
 
-  mrbc_value val = mrbc_proc_new(vm, mrbc_irep_child_irep(vm->cur_irep, b));
+  mrbc_irep *irep = mrbc_irep_load_child(vm, vm->cur_irep, b);
+  if( !irep ) return;		// ENOMEM or broken bytecode.
+
+  mrbc_value val = mrbc_proc_new(vm, irep);
   if( !val.proc ) return;	// ENOMEM
 
   regs[a] = val;
@@ -2618,11 +4328,15 @@ static inline void op_exec( mrbc_vm *vm, mrbc_value *regs EXT )
   FETCH_BB();
   assert( regs[a].tt == MRBC_TT_CLASS );
 
+  mrbc_irep *irep = mrbc_irep_load_child(vm, vm->cur_irep, b);
+  if( !irep ) return;		// ENOMEM or broken bytecode.
+
   // prepare callinfo
+  if( mrbc_check_regs( vm, regs + a, irep->nregs ) != 0 ) return;
   mrbc_push_callinfo(vm, 0, a, 0);
 
   // target irep
-  vm->cur_irep = mrbc_irep_child_irep(vm->cur_irep, b);
+  vm->cur_irep = irep;
   vm->inst = vm->cur_irep->inst;
   vm->cur_regs += a;
 
@@ -2658,6 +4372,13 @@ static inline void op_def( mrbc_vm *vm, mrbc_value *regs EXT )
   method->c_func = 0;
   method->sym_id = sym_id;
   method->irep = proc->irep;
+#if defined(MRBC_USE_AOT)
+  mrbc_func_t func = mrbc_aot_find( cls, sym_id, proc->irep );
+  if( func ) {
+    method->c_func = 1;
+    method->func = func;
+  }
+#endif
   method->next = cls->method_link;
   cls->method_link = method;
 
@@ -2673,6 +4394,7 @@ static inline void op_def( mrbc_vm *vm, mrbc_value *regs EXT )
       break;
     }
   }
+  mrbc_method_changed( cls );
 
   mrbc_set_symbol(&regs[a], sym_id);
 }
@@ -2715,6 +4437,7 @@ static inline void op_alias( mrbc_vm *vm, mrbc_value *regs EXT )
       break;
     }
   }
+  mrbc_method_changed( cls );
 }
 
 
@@ -2745,23 +4468,6 @@ static inline void op_tclass( mrbc_vm *vm, mrbc_value *regs EXT )
 }
 
 
-#if !defined(MRBC_SUPPORT_OP_EXT)
-//================================================================
-/*! OP_EXTn
-
-  make 1st operand (a) 16bit
-  make 2nd operand (b) 16bit
-  make 2nd operand (b) 16bit
-*/
-static inline void op_ext( mrbc_vm *vm, mrbc_value *regs EXT )
-{
-  FETCH_Z();
-  mrbc_raise(vm, MRBC_CLASS(Exception),
-	     "Not support op_ext. Re-compile with MRBC_SUPPORT_OP_EXT");
-}
-#endif
-
-
 //================================================================
 /*! OP_STOP
 
@@ -2785,8 +4491,59 @@ static inline void op_unsupported( mrbc_vm *vm, mrbc_value *regs EXT )
   mrbc_raisef( vm, MRBC_CLASS(Exception),
 	       "Unimplemented opcode (0x%02x) found.", *(vm->inst - 1));
 }
+
+
+#if defined(MRBC_SUPPORT_OP_EXT)
+//================================================================
+/*! OP_EXTn
+
+  make 1st operand (a) 16bit
+  make 2nd operand (b) 16bit
+  make 1st and 2nd operands 16bit
+
+  Execute the next instruction with the extended operands.
+  mrbc_vm_run() passes ext = 0 as a constant to the handlers, so only
+  this copy decodes the extended operands at run time.
+
+  @param  ext	1, 2 or 3. (EXT1, EXT2 or EXT3)
+*/
+static void op_ext( mrbc_vm *vm, mrbc_value *regs, int ext )
+{
+  switch( *vm->inst++ ) {
+#define OPCODE_CASE(name, func) \
+  case OP_##name: op_##func(vm, regs, ext); break;
+#define OPCODE_EXT_CASE(name, n) \
+  case OP_##name: op_unsupported(vm, regs, ext); break;
+
+    MRBC_OPCODE_LIST( OPCODE_CASE, OPCODE_EXT_CASE )
+  default: op_unsupported(vm, regs, ext); break;
+
+#undef OPCODE_CASE
+#undef OPCODE_EXT_CASE
+  }
+}
+
+#else
+//================================================================
+/*! OP_EXTn
+
+  make 1st operand (a) 16bit
+  make 2nd operand (b) 16bit
+  make 1st and 2nd operands 16bit
+*/
+static inline void op_ext( mrbc_vm *vm, mrbc_value *regs EXT )
+{
+  FETCH_Z();
+  mrbc_raise(vm, MRBC_CLASS(Exception),
+	     "Not support op_ext. Re-compile with MRBC_SUPPORT_OP_EXT");
+}
+#endif
 #undef EXT
 
+// MRBC_OPCODE_LIST must give the same numbers as the mruby 3 bytecode.
+_Static_assert( OP_EXT1 == 0x66 && OP_STOP == 0x69,
+		"MRBC_OPCODE_LIST does not match the mruby bytecode." );
+
 
 //================================================================
 /*! Fetch a bytecode and execute
@@ -2796,140 +4553,88 @@ static inline void op_unsupported( mrbc_vm *vm, mrbc_value *regs EXT )
   @retval 1	program done.
   @retval 2	exception occurred.
 */
+MRBC_HOT_FUNC
 int mrbc_vm_run( struct VM *vm )
 {
 #if defined(MRBC_SUPPORT_OP_EXT)
-  int ext = 0;
-#define EXT , ext
+#define EXT , 0		// not extended. OP_EXTn goes to op_ext().
 #else
 #define EXT
 #endif
 
+  MRBC_PROFILE_ENTER();
+
+#if defined(MRBC_USE_THREADED_CODE)
+  /*
+    Direct-threaded dispatch table, generated from MRBC_OPCODE_LIST.
+    Undefined opcodes jump to L_UNSUPPORTED.
+  */
+#define OPCODE_LABEL(name, ...) [OP_##name] = &&L_##name,
+  static const void * const dispatch_table[256] = {
+    MRBC_OPCODE_LIST( OPCODE_LABEL, OPCODE_LABEL )
+    [MRBC_NUM_OPCODES ... 255] = &&L_UNSUPPORTED,
+  };
+#undef OPCODE_LABEL
+
+#define DISPATCH_NEXT() \
+  if( vm->flag_preemption ) goto L_PREEMPTION; \
+  regs = vm->cur_regs; \
+  MRBC_PROFILE_COUNT(vm); \
+  goto *dispatch_table[ *vm->inst++ ]
+#endif
+
   while( 1 ) {
     mrbc_value *regs = vm->cur_regs;
+
+#if defined(MRBC_USE_THREADED_CODE)
+    MRBC_PROFILE_COUNT(vm);
+    goto *dispatch_table[ *vm->inst++ ];	// Dispatch
+
+#define OPCODE_BODY(name, func) \
+  L_##name: op_##func(vm, regs EXT); DISPATCH_NEXT();
+#if defined(MRBC_SUPPORT_OP_EXT)
+#define OPCODE_EXT_BODY(name, n) \
+  L_##name: op_ext(vm, regs, n); DISPATCH_NEXT();
+#else
+#define OPCODE_EXT_BODY(name, n) \
+  L_##name: op_ext(vm, regs EXT); DISPATCH_NEXT();
+#endif
+
+    MRBC_OPCODE_LIST( OPCODE_BODY, OPCODE_EXT_BODY )
+  L_UNSUPPORTED:
+    op_unsupported(vm, regs EXT); DISPATCH_NEXT();
+
+#undef OPCODE_BODY
+#undef OPCODE_EXT_BODY
+#undef DISPATCH_NEXT
+#undef EXT
+
+  L_PREEMPTION:
+#else
+    MRBC_PROFILE_COUNT(vm);
     uint8_t op = *vm->inst++;		// Dispatch
 
     switch( op ) {
-    case OP_NOP:        op_nop        (vm, regs EXT); break;
-    case OP_MOVE:       op_move       (vm, regs EXT); break;
-    case OP_LOADL:      op_loadl      (vm, regs EXT); break;
-    case OP_LOADI:      op_loadi      (vm, regs EXT); break;
-    case OP_LOADINEG:   op_loadineg   (vm, regs EXT); break;
-    case OP_LOADI__1:   // fall through
-    case OP_LOADI_0:    // fall through
-    case OP_LOADI_1:    // fall through
-    case OP_LOADI_2:    // fall through
-    case OP_LOADI_3:    // fall through
-    case OP_LOADI_4:    // fall through
-    case OP_LOADI_5:    // fall through
-    case OP_LOADI_6:    // fall through
-    case OP_LOADI_7:    op_loadi_n    (vm, regs EXT); break;
-    case OP_LOADI16:    op_loadi16    (vm, regs EXT); break;
-    case OP_LOADI32:    op_loadi32    (vm, regs EXT); break;
-    case OP_LOADSYM:    op_loadsym    (vm, regs EXT); break;
-    case OP_LOADNIL:    op_loadnil    (vm, regs EXT); break;
-    case OP_LOADSELF:   op_loadself   (vm, regs EXT); break;
-    case OP_LOADT:      op_loadt      (vm, regs EXT); break;
-    case OP_LOADF:      op_loadf      (vm, regs EXT); break;
-    case OP_GETGV:      op_getgv      (vm, regs EXT); break;
-    case OP_SETGV:      op_setgv      (vm, regs EXT); break;
-    case OP_GETSV:      op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_SETSV:      op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_GETIV:      op_getiv      (vm, regs EXT); break;
-    case OP_SETIV:      op_setiv      (vm, regs EXT); break;
-    case OP_GETCV:      op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_SETCV:      op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_GETCONST:   op_getconst   (vm, regs EXT); break;
-    case OP_SETCONST:   op_setconst   (vm, regs EXT); break;
-    case OP_GETMCNST:   op_getmcnst   (vm, regs EXT); break;
-    case OP_SETMCNST:   op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_GETUPVAR:   op_getupvar   (vm, regs EXT); break;
-    case OP_SETUPVAR:   op_setupvar   (vm, regs EXT); break;
-    case OP_GETIDX:     op_getidx     (vm, regs EXT); break;
-    case OP_SETIDX:     op_setidx     (vm, regs EXT); break;
-    case OP_JMP:        op_jmp        (vm, regs EXT); break;
-    case OP_JMPIF:      op_jmpif      (vm, regs EXT); break;
-    case OP_JMPNOT:     op_jmpnot     (vm, regs EXT); break;
-    case OP_JMPNIL:     op_jmpnil     (vm, regs EXT); break;
-    case OP_JMPUW:      op_jmpuw      (vm, regs EXT); break;
-    case OP_EXCEPT:     op_except     (vm, regs EXT); break;
-    case OP_RESCUE:     op_rescue     (vm, regs EXT); break;
-    case OP_RAISEIF:    op_raiseif    (vm, regs EXT); break;
-    case OP_SSEND:      op_ssend      (vm, regs EXT); break;
-    case OP_SSENDB:     op_ssendb     (vm, regs EXT); break;
-    case OP_SEND:       op_send       (vm, regs EXT); break;
-    case OP_SENDB:      op_sendb      (vm, regs EXT); break;
-    case OP_CALL:       op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_SUPER:      op_super      (vm, regs EXT); break;
-    case OP_ARGARY:     op_argary     (vm, regs EXT); break;
-    case OP_ENTER:      op_enter      (vm, regs EXT); break;
-    case OP_KEY_P:      op_key_p      (vm, regs EXT); break;
-    case OP_KEYEND:     op_keyend     (vm, regs EXT); break;
-    case OP_KARG:       op_karg       (vm, regs EXT); break;
-    case OP_RETURN:     op_return     (vm, regs EXT); break;
-    case OP_RETURN_BLK: op_return_blk (vm, regs EXT); break;
-    case OP_BREAK:      op_break      (vm, regs EXT); break;
-    case OP_BLKPUSH:    op_blkpush    (vm, regs EXT); break;
-    case OP_ADD:        op_add        (vm, regs EXT); break;
-    case OP_ADDI:       op_addi       (vm, regs EXT); break;
-    case OP_SUB:        op_sub        (vm, regs EXT); break;
-    case OP_SUBI:       op_subi       (vm, regs EXT); break;
-    case OP_MUL:        op_mul        (vm, regs EXT); break;
-    case OP_DIV:        op_div        (vm, regs EXT); break;
-    case OP_EQ:         op_eq         (vm, regs EXT); break;
-    case OP_LT:         op_lt         (vm, regs EXT); break;
-    case OP_LE:         op_le         (vm, regs EXT); break;
-    case OP_GT:         op_gt         (vm, regs EXT); break;
-    case OP_GE:         op_ge         (vm, regs EXT); break;
-    case OP_ARRAY:      op_array      (vm, regs EXT); break;
-    case OP_ARRAY2:     op_array2     (vm, regs EXT); break;
-    case OP_ARYCAT:     op_arycat     (vm, regs EXT); break;
-    case OP_ARYPUSH:    op_arypush    (vm, regs EXT); break;
-    case OP_ARYDUP:     op_arydup     (vm, regs EXT); break;
-    case OP_AREF:       op_aref       (vm, regs EXT); break;
-    case OP_ASET:       op_aset       (vm, regs EXT); break;
-    case OP_APOST:      op_apost      (vm, regs EXT); break;
-    case OP_INTERN:     op_intern     (vm, regs EXT); break;
-    case OP_SYMBOL:     op_symbol     (vm, regs EXT); break;
-    case OP_STRING:     op_string     (vm, regs EXT); break;
-    case OP_STRCAT:     op_strcat     (vm, regs EXT); break;
-    case OP_HASH:       op_hash       (vm, regs EXT); break;
-    case OP_HASHADD:    op_hashadd    (vm, regs EXT); break;
-    case OP_HASHCAT:    op_hashcat    (vm, regs EXT); break;
-    case OP_LAMBDA:     op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_BLOCK:      // fall through
-    case OP_METHOD:     op_method     (vm, regs EXT); break;
-    case OP_RANGE_INC:  op_range_inc  (vm, regs EXT); break;
-    case OP_RANGE_EXC:  op_range_exc  (vm, regs EXT); break;
-    case OP_OCLASS:     op_oclass     (vm, regs EXT); break;
-    case OP_CLASS:      op_class      (vm, regs EXT); break;
-    case OP_MODULE:     op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_EXEC:       op_exec       (vm, regs EXT); break;
-    case OP_DEF:        op_def        (vm, regs EXT); break;
-    case OP_ALIAS:      op_alias      (vm, regs EXT); break;
-    case OP_UNDEF:      op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_SCLASS:     op_sclass     (vm, regs EXT); break;
-    case OP_TCLASS:     op_tclass     (vm, regs EXT); break;
-    case OP_DEBUG:      op_unsupported(vm, regs EXT); break; // not implemented.
-    case OP_ERR:        op_unsupported(vm, regs EXT); break; // not implemented.
+#define OPCODE_CASE(name, func) \
+    case OP_##name: op_##func(vm, regs EXT); break;
 #if defined(MRBC_SUPPORT_OP_EXT)
-    case OP_EXT1:       ext = 1; continue;
-    case OP_EXT2:       ext = 2; continue;
-    case OP_EXT3:       ext = 3; continue;
+#define OPCODE_EXT_CASE(name, n) \
+    case OP_##name: op_ext(vm, regs, n); break;
 #else
-    case OP_EXT1:       // fall through
-    case OP_EXT2:       // fall through
-    case OP_EXT3:       op_ext        (vm, regs EXT); break;
+#define OPCODE_EXT_CASE(name, n) \
+    case OP_##name: op_ext(vm, regs EXT); break;
 #endif
-    case OP_STOP:       op_stop       (vm, regs EXT); break;
-    default:		op_unsupported(vm, regs EXT); break;
+
+      MRBC_OPCODE_LIST( OPCODE_CASE, OPCODE_EXT_CASE )
+    default: op_unsupported(vm, regs EXT); break;
+
+#undef OPCODE_CASE
+#undef OPCODE_EXT_CASE
     } // end switch.
 
 #undef EXT
-#if defined(MRBC_SUPPORT_OP_EXT)
-    ext = 0;
-#endif
     if( !vm->flag_preemption ) continue;	// execute next ope code.
+#endif
     if( !mrbc_israised(vm) ) return vm->flag_stop; // normal return.
 
 
@@ -2938,24 +4643,22 @@ int mrbc_vm_run( struct VM *vm )
     const mrbc_irep_catch_handler *handler;
 
     while( 1 ) {
-      const mrbc_irep *irep = vm->cur_irep;
-      const mrbc_irep_catch_handler *catch_table =
-	(const mrbc_irep_catch_handler *)(irep->inst + irep->ilen);
-      uint32_t inst = vm->inst - irep->inst;
-      int cnt = irep->clen;
-
-      for( cnt--; cnt >= 0 ; cnt-- ) {
-	handler = catch_table + cnt;
-	if( (bin_to_uint32(handler->begin) < inst) &&
-	    (inst <= bin_to_uint32(handler->end)) ) goto JUMP_TO_HANDLER;
-      }
+      handler = find_catch_handler( vm, -1 );
+      if( handler ) goto JUMP_TO_HANDLER;
 
       if( !vm->callinfo_tail ) return 2;	// return due to exception.
+      if( vm->cur_irep == &funcall_irep ) return 2;	// to mrbc_funcall().
+#if defined(MRBC_USE_FIBER)
+      if( vm->cur_fiber && vm->callinfo_tail == vm->cur_fiber->ci_bottom ) {
+	fiber_return( vm, NULL );	// the fiber ends, and raise in resumer.
+	continue;
+      }
+#endif
       mrbc_pop_callinfo( vm );
     }
 
   JUMP_TO_HANDLER:
     // jump to handler (rescue or ensure).
-    vm->inst = vm->cur_irep->inst + bin_to_uint32(handler->target);
+    vm->inst = vm->cur_irep->inst + handler->target;
   }
 }
@@ -58,7 +58,13 @@ typedef struct IREP {
   uint8_t data[];		//!< variable data. (see load.c)
 				//!<  mrbc_sym   tbl_syms[slen]
 				//!<  uint16_t   tbl_pools[plen]
+				//!<  mrbc_sym   tbl_ivsyms[slen]
+				//!<  uint8_t    tbl_ivslots[slen] (MRBC_USE_IVAR_SHAPE)
 				//!<  mrbc_irep *tbl_ireps[rlen]
+				//!<  uint8_t   *tbl_irep_bins[rlen] (MRBC_LAZY_IREP)
+				//!<  mrbc_value tbl_pool_values[plen] (MRBC_USE_POOL_VALUE)
+				//!<  mrbc_irep_catch_handler tbl_catch[clen]
+				//!<  uint8_t    tbl_move_elision[ilen/8+1] (MRBC_USE_MOVE_ELISION)
 } mrbc_irep;
 typedef struct IREP mrb_irep;
 
@@ -82,25 +88,77 @@ typedef struct IREP mrb_irep;
   ( (irep)->pool + mrbc_irep_tbl_pools(irep)[(n)] )
 
 
+//! get a instance variable symbol id table pointer.
+#define mrbc_irep_tbl_ivsyms(irep) \
+  ( (mrbc_sym *) ((irep)->data + (irep)->slen * sizeof(mrbc_sym) \
+		  + (irep)->plen * sizeof(uint16_t)) )
+
+//! get a n'th symbol id without '@' for instance variable access.
+#define mrbc_irep_ivar_symbol_id(irep, n)	mrbc_irep_tbl_ivsyms(irep)[(n)]
+
+#if defined(MRBC_USE_IVAR_SHAPE)
+//! get a slot index cache table pointer of instance variables.
+#define mrbc_irep_tbl_ivslots(irep) \
+  ( (uint8_t *) (mrbc_irep_tbl_ivsyms(irep) + (irep)->slen) )
+#endif
+
+
 //! get a child irep table pointer.
 #define mrbc_irep_tbl_ireps(irep) \
   ( (mrbc_irep **) ((irep)->data + (irep)->ofs_ireps * 4) )
 
-//! get a n'th child irep
+//! get a n'th child irep. (NULL if not loaded yet, in MRBC_LAZY_IREP)
 #define mrbc_irep_child_irep(irep, n) \
   ( mrbc_irep_tbl_ireps(irep)[(n)] )
 
+#if defined(MRBC_LAZY_IREP)
+//! get a RITE record table pointer of child ireps.
+#define mrbc_irep_tbl_irep_bins(irep) \
+  ( (const uint8_t **)(mrbc_irep_tbl_ireps(irep) + (irep)->rlen) )
+
+//! get a pointer to the end of the child tables.
+#define mrbc_irep_tbl_ireps_end(irep) \
+  ( (void *)(mrbc_irep_tbl_irep_bins(irep) + (irep)->rlen) )
+#else
+//! get a pointer to the end of the child tables.
+#define mrbc_irep_tbl_ireps_end(irep) \
+  ( (void *)(mrbc_irep_tbl_ireps(irep) + (irep)->rlen) )
+#endif
+
+#if defined(MRBC_USE_POOL_VALUE)
+//! get a decoded pool value table pointer. (MRBC_TT_EMPTY if not numeric)
+#define mrbc_irep_tbl_pool_values(irep) \
+  ( (mrbc_value *)mrbc_irep_tbl_ireps_end(irep) )
+
+//! get a catch handler table pointer. (decoded, sorted by begin)
+#define mrbc_irep_tbl_catch(irep) \
+  ( (const mrbc_irep_catch_handler *) \
+    (mrbc_irep_tbl_pool_values(irep) + (irep)->plen) )
+#else
+//! get a catch handler table pointer. (decoded, sorted by begin)
+#define mrbc_irep_tbl_catch(irep) \
+  ( (const mrbc_irep_catch_handler *)mrbc_irep_tbl_ireps_end(irep) )
+#endif
+
+#if defined(MRBC_USE_MOVE_ELISION)
+//! get a move elision bitmap pointer. (bit n is for OP_MOVE ends at offset n)
+#define mrbc_irep_tbl_move_elision(irep) \
+  ( (uint8_t *)(mrbc_irep_tbl_catch(irep) + (irep)->clen) )
+#endif
+
 
 
 //================================================================
 /*!@brief
   IREP Catch Handler
+
+  Decoded from the RITE binary at load time. (see load.c)
 */
 typedef struct IREP_CATCH_HANDLER {
+  uint32_t begin;	//!< The starting address to match the handler. Includes this.
+  uint32_t end;		//!< The endpoint address that matches the handler. Not Includes this.
+  uint32_t target;	//!< The address to jump to if a match is made.
   uint8_t type;		//!< enum mrb_catch_type, 1 byte. 0=rescue, 1=ensure
-  uint8_t begin[4];	//!< The starting address to match the handler. Includes this.
-  uint8_t end[4];	//!< The endpoint address that matches the handler. Not Includes this.
-  uint8_t target[4];	//!< The address to jump to if a match is made.
 } mrbc_irep_catch_handler;
 
 
@@ -121,6 +179,12 @@ typedef struct CALLINFO {
   uint8_t reg_offset;		//!< register offset after call.
   uint8_t n_args;		//!< num of arguments.
   uint8_t is_called_super;	//!< this is called by op_super.
+  mrbc_func_t c_iter;		//!< C iterator to resume. (see mrbc_c_iter_begin)
+#if defined(MRBC_PROFILE_CALLS)
+  uint32_t prof_start;		//!< VM clock at the call.
+  uint32_t prof_child;		//!< cycles spent in callees.
+  uint8_t prof_kind;		//!< kind of frame. (MRBC_PROFILE_METHOD etc.)
+#endif
 
 } mrbc_callinfo;
 typedef struct CALLINFO mrb_callinfo;
@@ -139,6 +203,8 @@ typedef struct VM {
   unsigned int flag_need_memfree : 1;
   unsigned int flag_stop : 1;
   unsigned int flag_permanence : 1;
+  unsigned int flag_retry_call : 1;	//!< call the C function again.
+  unsigned int flag_irep_image : 1;	//!< top_irep is in an IREP image.
 
   uint16_t	  regs_size;		//!< size of regs[]
 
@@ -148,21 +214,90 @@ typedef struct VM {
   mrbc_value	  *cur_regs;		//!< Current register top.
   mrbc_class      *target_class;	//!< Target class.
   mrbc_callinfo	  *callinfo_tail;	//!< Last point of CALLINFO link.
+  mrbc_callinfo	  *callinfo_free;	//!< Free list of popped CALLINFO.
   mrbc_proc	  *ret_blk;		//!< Return block.
 
   mrbc_value	  exception;		//!< Raised exception or nil.
+#if defined(MRBC_NO_TIMER)
+  int		  insn_budget;		//!< backward jumps and calls left in a tick.
+#endif
+#if defined(MRBC_USE_FIBER)
+  struct RFiber	  *cur_fiber;		//!< Fiber running, or NULL if root.
+#endif
+#if defined(MRBC_PROFILE_CALLS)
+  uint32_t	  prof_clock_off;	//!< cycles while switched out.
+  uint32_t	  prof_clock_stop;	//!< cycle count when switched out.
+#endif
   mrbc_value      regs[];
 } mrbc_vm;
 typedef struct VM mrb_vm;
 
 
+/*!@brief
+  Number of registers of the C iterator frame, kept while the block runs.
+
+  v[0] is the receiver and the return value, followed by the arguments,
+  the block and the iterator's own state. The block is called at
+  v[MRBC_C_ITER_REGS], where its return value is left for the iterator.
+*/
+#define MRBC_C_ITER_REGS 6
+
+
+#if defined(MRBC_USE_FIBER)
+//================================================================
+/*!@brief
+  Fiber, stored in the instance data area of the Fiber object.
+
+  The fiber runs in its own register segment regs[], with the C iterator
+  frame of the block at the bottom. While it runs, the callinfo chain of
+  the fiber is linked on the chain of the resumer, so an exception goes
+  through to the resumer. At Fiber.yield, the chain is cut at the bottom
+  frame and kept here.
+*/
+typedef struct RFiber {
+  uint8_t state;		//!< MRBC_FIBER_CREATED etc.
+  uint16_t regs_size;		//!< size of regs[]
+  struct RFiber *resumer;	//!< fiber that resumed this, or NULL if root.
+  mrbc_callinfo *ci_bottom;	//!< bottom frame, that returns to the resumer.
+  mrbc_value *ret_reg;		//!< register for the value of resume.
+  mrbc_value *yield_reg;	//!< register for the value of Fiber.yield.
+  mrbc_value self;		//!< Fiber object, kept while alive.
+
+  // context saved at Fiber.yield.
+  const mrbc_irep *cur_irep;
+  const uint8_t *inst;
+  mrbc_value *cur_regs;
+  mrbc_class *target_class;
+  mrbc_callinfo *callinfo_tail;
+
+  mrbc_value regs[];
+} mrbc_fiber;
+
+enum {
+  MRBC_FIBER_CREATED = 0,
+  MRBC_FIBER_RUNNING,
+  MRBC_FIBER_SUSPENDED,
+  MRBC_FIBER_TERMINATED,
+};
+#endif
+
+
 /***** Global variables *****************************************************/
 /***** Function prototypes **************************************************/
 void mrbc_cleanup_vm(void);
 mrbc_sym mrbc_get_callee_symid(struct VM *vm);
 const char *mrbc_get_callee_name(struct VM *vm);
+int mrbc_check_regs(struct VM *vm, const mrbc_value *regs, int n);
 mrbc_callinfo *mrbc_push_callinfo(struct VM *vm, mrbc_sym method_id, int reg_offset, int n_args);
 void mrbc_pop_callinfo(struct VM *vm);
+int mrbc_c_iter_begin(struct VM *vm, mrbc_value v[], int argc, mrbc_func_t func);
+void mrbc_c_iter_yield(struct VM *vm, mrbc_value v[], const mrbc_value *blk, int argc, const mrbc_value argv[]);
+void mrbc_c_iter_end(struct VM *vm, mrbc_value v[]);
+#if defined(MRBC_USE_FIBER)
+void mrbc_fiber_resume(struct VM *vm, mrbc_value v[], int argc);
+void mrbc_fiber_yield(struct VM *vm, mrbc_value v[], int argc);
+#endif
+mrbc_value mrbc_funcall(struct VM *vm, const mrbc_value *recv, mrbc_sym sym_id, int argc, const mrbc_value argv[]);
 mrbc_vm *mrbc_vm_new(int regs_size);
 mrbc_vm *mrbc_vm_open(struct VM *vm);
 void mrbc_vm_close(struct VM *vm);
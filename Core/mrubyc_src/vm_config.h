@@ -23,11 +23,19 @@
 #define MAX_REGS_SIZE 110
 #endif
 
-// maximum number of symbols
+// maximum number of symbols (excluding builtin symbols, up to 32000)
 #if !defined(MAX_SYMBOLS_COUNT)
 #define MAX_SYMBOLS_COUNT 255
 #endif
 
+// symbol search method
+//  MRBC_SYMBOL_SEARCH_HASH (default), MRBC_SYMBOL_SEARCH_BTREE
+//  or MRBC_SYMBOL_SEARCH_LINEAR
+// MRBC_SYMBOL_HASH_SIZE is the number of hash table entries, for the
+// symbols other than builtin. (power of 2, more than MAX_SYMBOLS_COUNT.
+// default is twice or more. 1 byte each, or 2 if MAX_SYMBOLS_COUNT > 255)
+// #define MRBC_SYMBOL_HASH_SIZE 512
+
 
 // memory management
 //  MRBC_ALLOC_16BIT or MRBC_ALLOC_24BIT
@@ -38,15 +46,31 @@
    0: NOT USE
    1: USE float
    2: USE double
+
+   Select 1 when the FPU supports single precision only (e.g. Cortex-M4F),
+   so that Float operations run on the FPU. Note that Float then has
+   about 7 digits, and Integers above 2^24 lose the low bits.
 */
 #if !defined(MRBC_USE_FLOAT)
-#define MRBC_USE_FLOAT 2
+# if defined(MRBC_COMPACT_VALUE)
+#  define MRBC_USE_FLOAT 1
+# else
+#  define MRBC_USE_FLOAT 2
+# endif
 #endif
 
 // Use math. Support Math class.
 #if !defined(MRBC_USE_MATH)
 #define MRBC_USE_MATH 0
 #endif
+
+// Compute the Math functions by the single precision libm (sinf, sqrtf...),
+// even if Float is double. It is always so when Float is float.
+// #define MRBC_MATH_SINGLE_PRECISION
+
+// Add Math.fast_sin, fast_cos and fast_atan2, by the tables of 129 floats
+// and the linear interpolation. The errors are less than 2.5e-5.
+// #define MRBC_USE_MATH_FAST
 /* (NOTE)
    maybe you need
    $ export LDFLAGS=-lm
@@ -74,6 +98,8 @@
 
 /* Word alignment
    If 32bit and/or 64bit alignment is required, enable the following line.
+   (note) Keep 64BIT even with float, because Float literals in the
+   bytecode are stored as unaligned 64bit doubles.
 */
 // #define MRBC_REQUIRE_32BIT_ALIGNMENT
 #define MRBC_REQUIRE_64BIT_ALIGNMENT
@@ -88,16 +114,358 @@
 
 // #define MRBC_NO_TIMER
 
+// Number of the backward jumps and the method calls run as a tick of
+// the time slice, with MRBC_NO_TIMER.
+#if defined(MRBC_NO_TIMER) && !defined(MRBC_NO_TIMER_BUDGET)
+#define MRBC_NO_TIMER_BUDGET 1000
+#endif
+
 // Console new-line mode.
 // If you need to convert LF to CRLF in console output, enable the following:
 // #define MRBC_CONVERT_CRLF
 
+// Console output (mrbc_printf, puts, p ...) goes to ITM stimulus port 0
+// (SWO) instead of the UART, that is left for the application and the
+// bytecode writer. It is dropped if no debugger enables the port.
+// #define MRBC_CONSOLE_ITM
+
+// Console output and the bytecode writer go through the USB CDC virtual
+// COM port on PA11 (D-) and PA12 (D+), instead of the UART.
+// The PLL is changed to make 48MHz for USB. (see usb_cdc.c)
+// #define MRBC_CONSOLE_USB_CDC
+
+// Collect console output in a buffer of this size, and write it at once
+// at a newline, when full, by hal_flush(1) and when the CPU goes idle.
+// #define MRBC_CONSOLE_BUFFER_SIZE 128
+
 // If you need 64bit integer.
 // #define MRBC_INT64
 
+// Integer stays 32bit, and the result beyond it in the VM arithmetic
+// becomes a wide Integer of 56bit, in the same mrbc_value without memory.
+// The common case keeps the 32bit operations, unlike MRBC_INT64.
+// #define MRBC_INT_WIDE
+
+// Fixed class, Q16.16 fixed-point number without Float.
+// #define MRBC_USE_FIXED
+
+// Guarantee 8 bytes mrbc_value on 32bit targets. (32bit Integer, float
+// Float) Registers, Array, Hash and instance variables take half size.
+// #define MRBC_COMPACT_VALUE
+
 // If you get exception with message "Not support op_ext..." when runtime.
+// Only the OP_EXTn prefixed instructions decode the extended operands,
+// so the others run as fast as without it. It costs the code size.
 // #define MRBC_SUPPORT_OP_EXT
 
+// Use direct-threaded dispatch (GCC labels as values) instead of switch.
+// #define MRBC_USE_THREADED_CODE
+
+// Place the hot functions of the VM (mrbc_vm_run with the op handlers
+// and the inline reference counters, send and the method lookup) in the
+// .RamFunc section, that the startup copies to SRAM with .data.
+// They run without the flash wait states, and the RAM is taken from
+// the memory pool. (see the linker script)
+// #define MRBC_USE_RAMFUNC
+#if !defined(MRBC_HOT_FUNC)
+#if defined(MRBC_USE_RAMFUNC)
+#define MRBC_HOT_FUNC __attribute__((section(".RamFunc")))
+#else
+#define MRBC_HOT_FUNC
+#endif
+#endif
+
+// Cache the method lookup result on each call site.
+// The accessors by attr_reader and attr_accessor are executed in line.
+// MRBC_METHOD_CACHE_SIZE is the number of entries. (must be power of 2)
+// #define MRBC_USE_METHOD_CACHE
+#if defined(MRBC_USE_METHOD_CACHE) && !defined(MRBC_METHOD_CACHE_SIZE)
+#define MRBC_METHOD_CACHE_SIZE 32
+#endif
+
+// Execute the simple built-in methods of Integer and Float
+// (abs to_i to_f % & | ^ ~ << >>) in OP_SEND directly, unless redefined.
+// #define MRBC_NUMERIC_FAST_SEND
+
+// Cache the method lookup result by the class and the symbol, for
+// mrbc_send() from C and the call sites that miss the cache above.
+// MRBC_GLOBAL_METHOD_CACHE_SIZE is the number of entries. (must be power of 2)
+// #define MRBC_USE_GLOBAL_METHOD_CACHE
+#if defined(MRBC_USE_GLOBAL_METHOD_CACHE) && !defined(MRBC_GLOBAL_METHOD_CACHE_SIZE)
+#define MRBC_GLOBAL_METHOD_CACHE_SIZE 64
+#endif
+
+// Search the methods defined at run time by binary search on an index
+// sorted by symbol ID, when a class has MRBC_METHOD_INDEX_MIN or more.
+// The index is built on the first lookup after a definition.
+// #define MRBC_USE_METHOD_INDEX
+#if defined(MRBC_USE_METHOD_INDEX) && !defined(MRBC_METHOD_INDEX_MIN)
+#define MRBC_METHOD_INDEX_MIN 8
+#endif
+
+// Cache the constant lookup result on each OP_GETCONST/OP_GETMCNST site.
+// MRBC_CONST_CACHE_SIZE is the number of entries. (must be power of 2)
+// #define MRBC_USE_CONST_CACHE
+#if defined(MRBC_USE_CONST_CACHE) && !defined(MRBC_CONST_CACHE_SIZE)
+#define MRBC_CONST_CACHE_SIZE 16
+#endif
+
+// Cache the global variable slot number on each OP_GETGV/OP_SETGV site.
+// MRBC_GLOBAL_CACHE_SIZE is the number of entries. (must be power of 2)
+// #define MRBC_USE_GLOBAL_CACHE
+#if defined(MRBC_USE_GLOBAL_CACHE) && !defined(MRBC_GLOBAL_CACHE_SIZE)
+#define MRBC_GLOBAL_CACHE_SIZE 8
+#endif
+
+// Cache the parsed format string of sprintf and printf, for a literal.
+// MRBC_FORMAT_CACHE_SIZE is the number of entries. (must be power of 2)
+// #define MRBC_USE_FORMAT_CACHE
+#if defined(MRBC_USE_FORMAT_CACHE) && !defined(MRBC_FORMAT_CACHE_SIZE)
+#define MRBC_FORMAT_CACHE_SIZE 4
+#endif
+
+// Execute common opcode pairs in one dispatch, by looking ahead at the
+// next opcode: comparison and OP_JMPIF/OP_JMPNOT, OP_ADDI/OP_SUBI and OP_JMP.
+// #define MRBC_USE_FUSED_OPCODE
+
+// Let OP_MOVE skip the refcount update when the source register is
+// overwritten right after. Needs ilen/8 bytes of RAM per irep.
+// #define MRBC_USE_MOVE_ELISION
+
+// Decode the Integer and Float literals of the pool at load time, so
+// OP_LOADL copies the value. Needs sizeof(mrbc_value) bytes per pool entry.
+// #define MRBC_USE_POOL_VALUE
+
+// Verify the bytecode once at mrbc_load_mrb() and at the upload, and
+// reject it if a register, symbol, pool or irep index, a jump target or
+// a catch handler is out of range.
+// #define MRBC_VERIFY_BYTECODE
+
+// Store instance variables in fixed slots by the class's ivar shape,
+// instead of the sorted key-value table.
+// #define MRBC_USE_IVAR_SHAPE
+
+// Fiber class, coroutines that run in one task. Each fiber has its own
+// register segment of MRBC_FIBER_REGS_SIZE, in the Fiber object.
+// #define MRBC_USE_FIBER
+#if defined(MRBC_USE_FIBER) && !defined(MRBC_FIBER_REGS_SIZE)
+#define MRBC_FIBER_REGS_SIZE 32
+#endif
+
+// Replace the methods annotated with "# @aot" by the C functions made by
+// tools/mrbc_aot.rb ("make aot" in Core/mrubyc), when they are defined.
+// MRBC_AOT_METHODS_MAX is the number of the methods. (default 16)
+// #define MRBC_USE_AOT
+
+// Keep the released instances of a class for reuse, by Frame.pool(n).
+// The pooled instances are freed at the out of memory.
+// #define MRBC_USE_OBJECT_POOL
+
+// Use hashed index for Hash search, when it has more entries than threshold.
+// #define MRBC_USE_HASH_INDEX
+#if defined(MRBC_USE_HASH_INDEX) && !defined(MRBC_HASH_INDEX_THRESHOLD)
+#define MRBC_HASH_INDEX_THRESHOLD 8
+#endif
+
+// Store Hash whose keys are all symbols (e.g. keyword arguments) as an
+// array of symbol ID and value sorted by symbol ID, up to
+// MRBC_HASH_SYMKEY_MAX entries. It is converted to the generic layout when
+// a non-symbol key is set. Such Hash iterates in the order of symbol ID,
+// not in the order of insertion.
+// #define MRBC_USE_HASH_SYMKEY
+#if defined(MRBC_USE_HASH_SYMKEY) && !defined(MRBC_HASH_SYMKEY_MAX)
+#define MRBC_HASH_SYMKEY_MAX 16
+#endif
+
+// Serve small fixed size objects (headers of String, Array, etc.) from
+// size-class slabs carved out of the TLSF memory pool.
+// #define MRBC_ALLOC_SLAB
+
+// Reserve bytes at the tail of the memory pool for permanent objects
+// (classes, methods, symbols), so that they never mix with other objects.
+// #define MRBC_ALLOC_PERMANENT_SIZE 4096
+
+// Reserve a block of the memory pool, released at the out of memory,
+// so that the program can rescue NoMemoryError and clean up.
+// #define MRBC_ALLOC_EMERGENCY_SIZE 256
+
+// Record the allocation site (irep and pc, or C caller) of each live
+// memory block, for VM.heap_report. (needs MRBC_DEBUG)
+// #define MRBC_ALLOC_TRACE
+
+// Record alloc/free/realloc events with tick, VM ID, caller and latency
+// in a ring buffer (VM.alloc_log prints it), or stream them out by
+// MRBC_ALLOC_EVENT_OUTPUT(ptr,size). see tools/alloc_event_decode.rb
+// #define MRBC_ALLOC_EVENT_LOG
+// #define MRBC_ALLOC_EVENT_LOG_SIZE 128
+// #define MRBC_ALLOC_EVENT_ITM		// stream to ITM port 1 (SWO)
+
+// Keep the count and the maximum cycles of mrbc_raw_alloc, free and
+// realloc, for mrbc_alloc_timing(). (needs hal_cycle_count() in HAL)
+// #define MRBC_ALLOC_TIMING
+
+// Don't run the allocator paths not bounded by a constant time: the
+// first-fit search and the caches eviction. Some allocations can fail
+// earlier instead. With MRBC_DEBUG, the double free check doesn't scan the
+// pool. (see TIME BOUNDS in alloc.c)
+// #define MRBC_ALLOC_REALTIME
+
+// Each task can reserve its own arena in the memory pool, or use the
+// memory given by mrbc_set_task_arena_memory() as an independent heap.
+// It is released at once when the task finishes. (needs MRBC_ALLOC_VMID)
+// #define MRBC_ALLOC_ARENA
+
+// Keep the used bytes, high-water mark and allocation counters of each
+// VM ID, for VM.alloc_stats(vm_id) and Task#memory_usage, and limit the
+// used bytes by mrbc_set_task_quota() or Task#memory_quota=.
+// (needs MRBC_ALLOC_VMID)
+// #define MRBC_ALLOC_VM_STATS
+
+// Release the garbage cycles of Object, Array, Range and Hash, that the
+// reference counter can't, by the trial deletion in small steps while
+// no task is ready. (see cycle.c)
+// #define MRBC_CYCLE_COLLECT
+// #define MRBC_CYCLE_BUFFER_SIZE 16
+// #define MRBC_CYCLE_MAX_NODES 32
+
+// Slide the data buffers of String, Array and Hash into the free block
+// before them while no task is ready, so that the free blocks are merged.
+// Up to MRBC_ALLOC_COMPACT_SLOTS buffers are known. (needs MRBC_ALLOC_VMID)
+// #define MRBC_ALLOC_COMPACT
+// #define MRBC_ALLOC_COMPACT_SLOTS 32
+
+// Suppress the tick interrupt while no task is ready, and sleep until
+// the next wakeup tick. (needs hal_idle_cpu_tickless() in HAL)
+// #define MRBC_TICKLESS_IDLE
+
+// Paint the main stack at the start for System.stack_used, and guard
+// the bottom of it by MPU, to stop at the overflow. (see start_mrubyc.c)
+// #define MRBC_STACK_CHECK
+
+// Scale the CPU clock by the scheduler load. The clock goes to the full
+// speed when a task waits for the CPU, and steps down while the ready
+// queue is mostly empty. (needs hal_clock_set_level() in HAL, see rrt0.c)
+// #define MRBC_CLOCK_GOVERNOR
+// #define MRBC_CLOCK_GOVERNOR_PERIOD 100
+
+// Call the functions posted by the interrupt handlers of C drivers
+// (mrbc_defer_from_isr) in the thread context, before the next task.
+// The value is the number of slots. (latency statistics need
+// hal_cycle_count() in HAL)
+// #define MRBC_DEFERRED_QUEUE_SIZE 16
+
+// Account CPU cycles, dispatches, preemptions and the maximum latency
+// from ready to run of each task, for Task#stats and pq().
+// (needs hal_cycle_count() in HAL)
+// #define MRBC_TASK_STATS
+
+// Record dispatch, preemption, wakeup, sleep, mutex and ISR (by
+// MRBC_ISR_ENTER/EXIT) events of the scheduler with time stamps in a
+// ring buffer (VM.sched_log prints it), or stream them out by
+// MRBC_SCHED_EVENT_OUTPUT(ptr,size). tools/sched_event_decode.rb
+// converts them to a Chrome trace JSON. (see SCHED_EVENT in rrt0.c)
+// #define MRBC_SCHED_EVENT_LOG
+// #define MRBC_SCHED_EVENT_LOG_SIZE 128
+// #define MRBC_SCHED_EVENT_ITM		// stream to ITM port 3 (SWO)
+
+// Count executions and cycles of each opcode, instruction (irep, pc)
+// and method, for VM.profile_dump(n) and VM.profile_clear.
+// (uses hal_cycle_count() if available)
+// #define MRBC_PROFILE
+// #define MRBC_PROFILE_BUCKETS 64
+// #define MRBC_PROFILE_METHODS 32
+
+// Sample the instruction of the running task at each interrupt of
+// a spare timer (TIM4), for VM.sampling_start(hz), VM.sampling_stop
+// and VM.sampling_dump(raw). (needs hal_profile_timer_start() in HAL)
+// #define MRBC_PROFILE_SAMPLING
+// #define MRBC_PROFILE_SAMPLE_SIZE 128
+// #define MRBC_PROFILE_SAMPLE_HZ 997
+// #define MRBC_PROFILE_SAMPLE_ITM	// also stream to ITM port 2 (SWO)
+
+// Count calls, inclusive and exclusive cycles of each (class, method),
+// including C functions, for VM.call_profile_dump(n) and
+// VM.call_profile_clear. (needs hal_cycle_count() in HAL)
+// #define MRBC_PROFILE_CALLS
+// #define MRBC_PROFILE_CALL_SIZE 32
+
+// Keep the longest call of each C function, during which the task can't
+// be preempted, and count the calls over the budget, for
+// VM.cfunc_latency_dump(n) and VM.cfunc_latency_clear. The yield points
+// in split, join, inspect and dup split the longest call into segments,
+// and kick the watchdog by hal_watchdog_kick() if HAL defines it.
+// (needs hal_cycle_count() in HAL)
+// #define MRBC_CFUNC_LATENCY
+// #define MRBC_CFUNC_LATENCY_SIZE 32
+// #define MRBC_CFUNC_LATENCY_BUDGET_US 1000
+
+// Registry of counters and gauges, registered from C (heap, scheduler,
+// UART, I2C) and from Ruby by VM.metric_add and VM.metric_set, read by
+// VM.metrics or by the "stats" command in a binary record (see
+// metrics.c). The command is in the boot prompt, and while running on
+// the UART unit MRBC_METRICS_UART, served from its interrupt.
+// #define MRBC_METRICS
+// #define MRBC_METRICS_MAX 32
+// #define MRBC_METRICS_UART 1
+
+// Boot into the benchmark mode by typing "bench" at the boot prompt,
+// to run the programs in Core/bench from flash and print the cycles,
+// peak heap and task statistics as CSV. ("make bench" in Core/mrubyc.
+// needs MRBC_SCHEDULER_EXIT=1, and MRBC_TASK_STATS for the task statistics)
+// #define MRBC_BENCH_FIRMWARE
+
+// Start the program without the 2.5 sec wait for the boot prompt. The
+// prompt is entered by holding the user button B1 at the reset, or by
+// Firmware.upload_mode from the program, or if no program is written.
+// #define MRBC_FAST_BOOT
+
+// Accept the bytecode files compressed by LZ4 ("mrbc_upload.rb --lz4"),
+// that are decompressed into the memory pool at the task creation.
+// #define MRBC_BYTECODE_LZ4
+
+// Address of this node for the bytecode upload on a shared bus such as
+// RS-485, to take the addressed and broadcast commands. (1..255, see
+// mrbc_firm.c. firm_node_address() can be overridden instead)
+// #define MRBC_FIRM_NODE_ADDRESS 1
+
+// Save the VM after the tasks are created to the active slot, at the
+// first boot after activating. The later boots restore it and skip the
+// initialization of the classes and the loading of the bytecode. The
+// state is the .data and .bss of the VM gathered by the linker script.
+// #define MRBC_SNAPSHOT
+// #define MRBC_SNAPSHOT_SIZE (1024*40)
+
+// Storage class, the key-value store in the STORAGE region of FLASH.
+// (see storage.c) The number of keys, the write buffer in bytes, and
+// the time to keep the changes in the buffer.
+// #define MRBC_STORAGE_KEYS 32
+// #define MRBC_STORAGE_BUFFER_SIZE 256
+// #define MRBC_STORAGE_FLUSH_MS 1000
+
+// Fit the registers of each task to the loaded program, instead of
+// MAX_REGS_SIZE. That is the sum of nregs along the deepest nesting of
+// its ireps, plus the margin for method calls. A deeper call raises
+// SystemStackError. (Task.create(code, regs_size)
+// and the TCB made by mrbc_tcb_new with non-zero regs_size are not fit)
+// #define MRBC_TASK_REGS_FIT
+// #define MRBC_TASK_REGS_MARGIN 16
+
+// Allow mrbc_load_mrb to run a prebuilt IREP image in place (e.g. in
+// flash, see mrbc_irep_image_build), without building ireps in heap.
+// #define MRBC_USE_IREP_IMAGE
+
+// Load child ireps (methods, blocks, class bodies) from the bytecode
+// when they are used first, instead of all at the task creation.
+// #define MRBC_LAZY_IREP
+
+// Keep the interned symbol IDs of each loaded bytecode (by its address),
+// so loading the same bytecode again skips symbol interning.
+// MRBC_SYMID_CACHE_SIZE is the number of bytecodes. (4 bytes per symbol)
+// #define MRBC_USE_SYMID_CACHE
+#if defined(MRBC_USE_SYMID_CACHE) && !defined(MRBC_SYMID_CACHE_SIZE)
+#define MRBC_SYMID_CACHE_SIZE 4
+#endif
+
 // If you use LIBC malloc instead of mruby/c malloc
 // #define MRBC_ALLOC_LIBC
 
@@ -108,6 +476,66 @@
 // #define MRBC_OUT_OF_MEMORY() mrbc_alloc_print_memory_pool(); hal_abort(0)
 // #define MRBC_ABORT_BY_EXCEPTION(vm) mrbc_p( &vm->exception ); hal_abort(0)
 
+#if defined(MRBC_USE_THREADED_CODE) && !defined(__GNUC__)
+#error "MRBC_USE_THREADED_CODE requires GCC compatible compiler."
+#endif
+
+#if defined(MRBC_ALLOC_TRACE) && !defined(MRBC_DEBUG)
+#error "MRBC_ALLOC_TRACE requires MRBC_DEBUG."
+#endif
+
+#if defined(MRBC_ALLOC_ARENA) && !defined(MRBC_ALLOC_VMID)
+#error "MRBC_ALLOC_ARENA requires MRBC_ALLOC_VMID."
+#endif
+
+#if defined(MRBC_ALLOC_VM_STATS) && !defined(MRBC_ALLOC_VMID)
+#error "MRBC_ALLOC_VM_STATS requires MRBC_ALLOC_VMID."
+#endif
+
+#if defined(MRBC_ALLOC_COMPACT) && !defined(MRBC_ALLOC_VMID)
+#error "MRBC_ALLOC_COMPACT requires MRBC_ALLOC_VMID."
+#endif
+
+#if defined(MRBC_COMPACT_VALUE) && (defined(MRBC_INT64) || MRBC_USE_FLOAT == 2)
+#error "MRBC_COMPACT_VALUE can't be used with MRBC_INT64 or double Float."
+#endif
+
+#if defined(MRBC_INT_WIDE) && (defined(MRBC_INT64) || defined(MRBC_INT16))
+#error "MRBC_INT_WIDE requires 32bit Integer."
+#endif
+
+#if defined(MRBC_LAZY_IREP) && defined(MRBC_USE_IREP_IMAGE)
+#error "MRBC_LAZY_IREP can't be used with MRBC_USE_IREP_IMAGE."
+#endif
+
+#if defined(MRBC_BYTECODE_LZ4) && defined(MRBC_USE_IREP_IMAGE)
+#error "MRBC_BYTECODE_LZ4 can't be used with MRBC_USE_IREP_IMAGE."
+#endif
+
+#if defined(MRBC_SNAPSHOT) && (defined(MRBC_METRICS) || defined(MRBC_ALLOC_LIBC))
+#error "MRBC_SNAPSHOT can't be used with MRBC_METRICS or MRBC_ALLOC_LIBC."
+#endif
+
+#if defined(MRBC_USE_OBJECT_POOL) && defined(MRBC_ALLOC_ARENA)
+#error "MRBC_USE_OBJECT_POOL can't be used with MRBC_ALLOC_ARENA."
+#endif
+
+#if defined(MRBC_LAZY_IREP) && defined(MRBC_USE_SYMID_CACHE)
+#error "MRBC_LAZY_IREP can't be used with MRBC_USE_SYMID_CACHE."
+#endif
+
+#if defined(MRBC_TICKLESS_IDLE) && defined(MRBC_NO_TIMER)
+#error "MRBC_TICKLESS_IDLE can't be used with MRBC_NO_TIMER."
+#endif
+
+#if defined(MRBC_SCHED_EVENT_ITM) && !defined(MRBC_SCHED_EVENT_LOG)
+#error "MRBC_SCHED_EVENT_ITM requires MRBC_SCHED_EVENT_LOG."
+#endif
+
+#if defined(MRBC_METRICS_UART) && !defined(MRBC_METRICS)
+#error "MRBC_METRICS_UART requires MRBC_METRICS."
+#endif
+
 #if defined(MRBC_SYMBOL_SEARCH_LINER)
 #warning "MRBC_SYMBOL_SEARCH_LINER will be removed in the future release (3.3 or 4.0). Use MRBC_SYMBOL_SEARCH_LINEAR instead."
 #define MRBC_SYMBOL_SEARCH_LINEAR
@@ -0,0 +1,186 @@
+#!/usr/bin/env ruby
+#
+# Make the builtin method tables from the comments in the C sources.
+#
+# usage:
+#   make_method_table.rb file.c ...
+#
+#   The table is written in the directory of file.c, with the name given
+#   by FILE or APPEND. Methods are sorted by name, because the VM finds
+#   them by binary search on the symbol ID, and the symbol IDs are given
+#   in the order of name by make_symbol_table.rb.
+#
+#   /* MRBC_AUTOGEN_METHOD_TABLE
+#
+#     CLASS("Array")
+#     FILE("_autogen_class_array.h")	# new file.
+#     APPEND("_autogen_class_xxx.h")	# append to the file.
+#     SUPER("Object")			# super class name, or 0.
+#
+#     METHOD( "new",	c_array_new )
+#   #if MRBC_USE_STRING
+#     METHOD( "inspect",	c_array_inspect )
+#   #endif
+#   */
+#
+
+require "pathname"
+
+SYMBOL_HEADER = File.expand_path("../mrubyc_src/_autogen_builtin_symbol.h", __dir__)
+
+OPERATOR_NAMES = {
+  "!"=>"NOT", "%"=>"MOD", "&"=>"AND", "*"=>"MUL", "+"=>"PLUS", "-"=>"MINUS",
+  "/"=>"DIV", "<"=>"LT", "="=>"EQ", ">"=>"GT", "@"=>"AT", "["=>"BL",
+  "]"=>"BR", "^"=>"XOR", "|"=>"OR", "~"=>"NEG",
+}
+
+##
+# C identifier of the symbol. (MRBC_SYM(x))
+#
+def c_name( name )
+  if name =~ /\A[A-Za-z_]/
+    name.sub(/\?\z/, "_Q").sub(/!\z/, "_E").sub(/=\z/, "_EQ")
+  else
+    name.chars.map {|c| OPERATOR_NAMES[c] || raise("unknown operator #{name}") }.join("_")
+  end
+end
+
+
+##
+# parse the comment blocks.
+#
+# @return [Array<Hash>]  classes. {name:, super:, file:, append:, methods:}
+#
+def parse( src, fname )
+  classes = []
+
+  src.scan(%r{/\* MRBC_AUTOGEN_METHOD_TABLE\b(.*?)\*/}m) {|(block)|
+    file = append = nil
+    conds = []
+    block_classes = []
+
+    block.each_line {|line|
+      case line.strip
+      when ""
+      when /\ACLASS\(\s*"(\w+)"\s*\)/
+        block_classes << {name: $1, super: "Object", methods: []}
+      when /\AFILE\(\s*"([^"]+)"\s*\)/
+        file = $1
+      when /\AAPPEND\(\s*"([^"]+)"\s*\)/
+        append = $1
+      when /\ASUPER\(\s*(?:"(\w+)"|(0))\s*\)/
+        block_classes.last[:super] = $1 || 0
+      when /\AMETHOD\(\s*"([^"]+)"\s*,\s*(\w+)\s*\)/
+        block_classes.last[:methods] << {name: $1, func: $2, conds: conds.dup}
+      when /\A#\s*if/
+        conds << line.strip
+      when /\A#\s*endif/
+        conds.pop
+      else
+        raise "#{fname}: unknown line in MRBC_AUTOGEN_METHOD_TABLE: #{line.strip}"
+      end
+    }
+    raise "#{fname}: FILE or APPEND is needed." if !file && !append
+    raise "#{fname}: #if and #endif don't match." if !conds.empty?
+
+    block_classes.each {|c|
+      c[:file] = file
+      c[:append] = append
+      classes << c
+    }
+  }
+
+  classes
+end
+
+
+##
+# lines of the table, with the #if of each method.
+#
+def table_lines( methods )
+  methods.map {|m|
+    [*m[:conds], yield(m), *m[:conds].map{"#endif"}]
+  }.flatten
+end
+
+
+##
+# C source of a class.
+#
+def class_source( c )
+  name = c[:name]
+  sup = (c[:super] == 0) ? "0" : "MRBC_CLASS(#{c[:super]})"
+  debug_name = ["#if defined(MRBC_DEBUG)", %Q(  .name = "#{name}",), "#endif"]
+
+  if c[:methods].empty?
+    return ["/*===== #{name} class =====*/",
+            "struct RClass mrbc_class_#{name} = {",
+            "  .sym_id = MRBC_SYM(#{name}),",
+            "  .num_builtin_method = 0,",
+            "  .super = #{sup},",
+            "  .method_link = 0,",
+            *debug_name,
+            "};", ""].join("\n")
+  end
+
+  methods = c[:methods].sort_by {|m| m[:name] }
+  [ "/*===== #{name} class =====*/",
+    "static const mrbc_sym method_symbols_#{name}[] = {",
+    *table_lines(methods) {|m| "  MRBC_SYM(#{c_name(m[:name])})," },
+    "};",
+    "",
+    "static const mrbc_func_t method_functions_#{name}[] = {",
+    *table_lines(methods) {|m| "  #{m[:func]}," },
+    "};",
+    "",
+    "struct RBuiltinClass mrbc_class_#{name} = {",
+    "  .sym_id = MRBC_SYM(#{name}),",
+    "  .num_builtin_method = sizeof(method_symbols_#{name}) / sizeof(mrbc_sym),",
+    "  .super = #{sup},",
+    "  .method_link = 0,",
+    *debug_name,
+    "  .method_symbols = method_symbols_#{name},",
+    "  .method_functions = method_functions_#{name},",
+    "};", ""].join("\n")
+end
+
+
+##
+# main
+#
+if ARGV.empty?
+  STDERR.puts "usage: #{File.basename($0)} file.c ..."
+  exit 1
+end
+
+ARGV.each {|fname|
+  dir = File.dirname(fname)
+  src = File.read(fname, encoding: "BINARY")
+  outputs = {}		# file name => [source of each class]
+  appends = {}
+
+  parse(src, fname).each {|c|
+    if c[:file]
+      (outputs[c[:file]] ||= []) << class_source(c)
+    else
+      (appends[c[:append]] ||= []) << class_source(c)
+    end
+  }
+
+  include_path = Pathname.new(SYMBOL_HEADER).relative_path_from(Pathname.new(File.expand_path(dir)))
+  outputs.each {|file, sources|
+    File.open(File.join(dir, file), "w") {|f|
+      f.puts "/* Auto generated by make_method_table.rb */"
+      f.puts %Q(#include "#{include_path}")
+      f.puts
+      f.print sources.join("\n").chomp
+      f.puts
+    }
+  }
+
+  appends.each {|file, sources|
+    File.open(File.join(dir, file), "a") {|f|
+      sources.each {|s| f.print "\n\n", s.chomp, "\n" }
+    }
+  }
+}
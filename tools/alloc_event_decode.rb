@@ -0,0 +1,167 @@
+#!/usr/bin/env ruby
+#
+# Decode mruby/c allocation events. (see MRBC_ALLOC_EVENT_LOG in alloc.c)
+#
+# usage:
+#   alloc_event_decode.rb [--itm] [--cpu-mhz=84] [--events] [file]
+#
+#   (default)  console log that includes the output of VM.alloc_log.
+#   --itm      raw SWO capture of ITM stimulus port 1.
+#   --events   print each event.
+#
+# event record (16 bytes, little endian):
+#   tick(32) caller(32) ofs(16) size(16) cycles(16) op(8) vm_id(8)
+#
+
+EVENT_SIZE = 16
+OP_NAMES = { "A" => "alloc", "F" => "free", "R" => "realloc",
+             "N" => "no_free", "X" => "reset" }
+
+Event = Struct.new(:tick, :caller, :ofs, :size, :cycles, :op, :vm_id)
+
+def parse_events(bin)
+  (0 ... bin.bytesize / EVENT_SIZE).map {|i|
+    Event.new(*bin.byteslice(i * EVENT_SIZE, EVENT_SIZE).unpack("VVvvvaC"))
+  }
+end
+
+# console log -> [pool address, total count, events]
+def read_console_log(text)
+  pool = nil
+  count = nil
+  bin = "".b
+  text.each_line {|line|
+    case line
+    when /== ALLOC EVENT LOG pool:(\S+) count:(\d+) ==/
+      pool = $1
+      count = $2.to_i
+      bin = "".b                        # use the last dump.
+    when /\A\s*([0-9a-fA-F]{32})\s*\z/
+      bin << [$1].pack("H*")
+    end
+  }
+  [pool, count, parse_events(bin)]
+end
+
+# ITM packets -> payload bytes of stimulus port 1.
+def read_itm(bin)
+  payload = "".b
+  bytes = bin.bytes
+  i = 0
+  while i < bytes.size
+    h = bytes[i]
+    i += 1
+    if h == 0x00 || h == 0x80 || h == 0x70
+      next                              # sync or overflow.
+    elsif (h & 0x03) != 0 && (h & 0x04) == 0
+      size = [0, 1, 2, 4][h & 0x03]     # source (instrumentation) packet.
+      payload << bytes[i, size].pack("C*") if (h >> 3) == 1
+      i += size
+    else
+      while (h & 0x80) != 0 && i < bytes.size  # protocol packet, skip.
+        h = bytes[i]
+        i += 1
+      end
+    end
+  end
+  payload
+end
+
+def opt(name)
+  ARGV.each {|a| return $1 || true if a =~ /\A--#{name}(?:=(.*))?\z/ }
+  nil
+end
+
+cpu_mhz = (opt("cpu-mhz") || 84).to_f
+files = ARGV.reject {|a| a.start_with?("--") }
+input = files.empty? ? $stdin.binmode.read : File.binread(files[0])
+
+if opt("itm")
+  pool = nil
+  count = nil
+  events = parse_events(read_itm(input))
+else
+  pool, count, events = read_console_log(input.force_encoding("ASCII-8BIT"))
+end
+
+if events.empty?
+  puts "no event found."
+  exit 1
+end
+
+puts "pool: #{pool}" if pool
+if count && count > events.size
+  puts "#{count - events.size} old events were overwritten, results are partial."
+end
+
+# replay
+live = {}                               # ofs -> Event
+usage = 0
+peak = 0
+peak_tick = events[0].tick
+permanent = 0
+n_oom = 0
+latency = Hash.new {|h, k| h[k] = [0, 0] }   # op -> [count, total cycles]
+
+events.each {|ev|
+  if opt("events")
+    printf("%10d %-7s vm:%-3d %08x ofs:%04x size:%5d cycles:%d\n",
+           ev.tick, OP_NAMES[ev.op] || ev.op, ev.vm_id, ev.caller,
+           ev.ofs, ev.size, ev.cycles)
+  end
+
+  if ev.ofs == 0xffff && ev.op != "F"
+    n_oom += 1
+    next
+  end
+
+  case ev.op
+  when "A"
+    live[ev.ofs] = ev
+    usage += ev.size
+  when "R"
+    old = live[ev.ofs]
+    usage -= old.size if old
+    live[ev.ofs] = Event.new(old ? old.tick : ev.tick, old ? old.caller : ev.caller,
+                             ev.ofs, ev.size, ev.cycles, ev.op, ev.vm_id)
+    usage += ev.size
+  when "F"
+    old = live.delete(ev.ofs)
+    usage -= old.size if old
+  when "N"
+    permanent += ev.size
+  when "X"
+    last = ev.ofs + ev.size / 4
+    live.keys.each {|ofs|
+      next if ofs < ev.ofs || ofs >= last
+      usage -= live.delete(ofs).size
+    }
+  end
+  latency[ev.op][0] += 1
+  latency[ev.op][1] += ev.cycles
+
+  if usage > peak
+    peak = usage
+    peak_tick = ev.tick
+  end
+}
+
+puts "events: #{events.size}  ticks: #{events[0].tick} .. #{events[-1].tick}"
+puts "peak usage: #{peak} bytes at tick #{peak_tick}  (requested size, w/o permanent #{permanent} bytes)"
+puts "final usage: #{usage} bytes in #{live.size} blocks"
+puts "out of memory: #{n_oom}" if n_oom > 0
+
+puts "mean latency:"
+latency.sort.each {|op, (n, cycles)|
+  next if n == 0
+  printf("  %-8s %7d calls %8.1f cycles %7.2f us\n",
+         OP_NAMES[op] || op, n, cycles.to_f / n, cycles.to_f / n / cpu_mhz)
+}
+
+# blocks still alive at the end, grouped by caller. oldest ones first.
+puts "leak candidates (live blocks by caller):"
+by_caller = live.values.group_by {|ev| [ev.caller, ev.vm_id] }
+by_caller.sort_by {|_, evs| evs.map(&:tick).min }.first(20).each {|(caller, vm_id), evs|
+  printf("  %08x vm:%-3d %5d blocks %7d bytes  oldest tick %d\n",
+         caller, vm_id, evs.size, evs.sum(&:size), evs.map(&:tick).min)
+}
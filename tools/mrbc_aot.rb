@@ -0,0 +1,408 @@
+#!/usr/bin/env ruby
+#
+# Compile the Ruby methods annotated with "# @aot" to C functions.
+# (needs MRBC_USE_AOT in the firmware, see Core/mrubyc_src/aot.h)
+#
+# usage:
+#   mrbc_aot.rb [--mrbc=mrbc] [--all] [-o mrbc_aot_methods.c] file.rb|file.mrb ...
+#
+#   --mrbc     command to compile file.rb to the bytecode.
+#   --all      compile all the methods that can be compiled.
+#   -o         output file. (default stdout)
+#
+#   The annotation is a comment line just before the def.
+#
+#     class Filter
+#       # @aot
+#       def step( x )
+#         @y = @y + (x - @y) * @k / 256
+#       end
+#     end
+#
+#   The output has mrbc_aot_init(), that is called at the start (see
+#   start_mrubyc.c) to register the functions. When the program defines
+#   the method by OP_DEF, the VM uses the function instead, only if the
+#   instructions are the same as the compiled ones. So a program changed
+#   after the firmware is built runs in the VM as before.
+#
+#   The method must take only the required arguments, and can have
+#   instance variables, constants, local variables, if/while, method calls
+#   without a block, and the operators. A method with the other features
+#   (blocks, strings, rescue, etc.) is left to the VM with a warning.
+#   A compiled method runs to the end without a task switch, and must not
+#   call a method that waits. (e.g. sleep, Semaphore#acquire)
+#
+
+# opcodes and the operand types, in the order of opcode.h
+OPCODES = <<EOS.split.each_slice(2).to_a
+  NOP Z  MOVE BB  LOADL BB  LOADI BB  LOADINEG BB  LOADI__1 B  LOADI_0 B
+  LOADI_1 B  LOADI_2 B  LOADI_3 B  LOADI_4 B  LOADI_5 B  LOADI_6 B  LOADI_7 B
+  LOADI16 BS  LOADI32 BSS  LOADSYM BB  LOADNIL B  LOADSELF B  LOADT B
+  LOADF B  GETGV BB  SETGV BB  GETSV BB  SETSV BB  GETIV BB  SETIV BB
+  GETCV BB  SETCV BB  GETCONST BB  SETCONST BB  GETMCNST BB  SETMCNST BB
+  GETUPVAR BBB  SETUPVAR BBB  GETIDX B  SETIDX B  JMP S  JMPIF BS
+  JMPNOT BS  JMPNIL BS  JMPUW S  EXCEPT B  RESCUE BB  RAISEIF B
+  SSEND BBB  SSENDB BBB  SEND BBB  SENDB BBB  CALL Z  SUPER BB  ARGARY BS
+  ENTER W  KEY_P BB  KEYEND Z  KARG BB  RETURN B  RETURN_BLK B  BREAK B
+  BLKPUSH BS  ADD B  ADDI BB  SUB B  SUBI BB  MUL B  DIV B  EQ B  LT B
+  LE B  GT B  GE B  ARRAY BB  ARRAY2 BBB  ARYCAT B  ARYPUSH BB  ARYDUP B
+  AREF BBB  ASET BBB  APOST BBB  INTERN B  SYMBOL BB  STRING BB  STRCAT B
+  HASH BB  HASHADD BB  HASHCAT B  LAMBDA BB  BLOCK BB  METHOD BB
+  RANGE_INC B  RANGE_EXC B  OCLASS B  CLASS BB  MODULE BB  EXEC BB  DEF BB
+  ALIAS BB  UNDEF B  SCLASS B  TCLASS B  DEBUG BBB  ERR B  EXT1 Z  EXT2 Z
+  EXT3 Z  STOP Z
+EOS
+OPERAND_LEN = { "Z" => 1, "B" => 2, "BB" => 3, "BBB" => 4, "BS" => 4,
+                "BSS" => 6, "S" => 3, "W" => 4 }
+
+# run in the VM by mrbc_aot_exec(), they don't refer to the IREP.
+EXEC_OPS = %w(GETIDX SETIDX ARRAY ARRAY2 ARYCAT ARYPUSH ARYDUP AREF ASET
+              APOST INTERN STRCAT HASH HASHADD HASHCAT RANGE_INC RANGE_EXC)
+ARITH_OPS = %w(ADD SUB MUL DIV EQ LT LE GT GE)
+
+Irep = Struct.new(:nregs, :ilen, :clen, :iseq, :pool, :syms, :children)
+Inst = Struct.new(:pos, :op, :a, :b, :c, :len)
+
+def opt(name)
+  ARGV.each {|a| return $1 || true if a =~ /\A--#{name}(?:=(.*))?\z/ }
+  nil
+end
+
+def fnv1a(bin)
+  bin.each_byte.inject(2166136261) {|h, b| ((h ^ b) * 16777619) & 0xffffffff }
+end
+
+# RITE binary -> top Irep
+def parse_mrb(bin)
+  abort "not a RITE binary." unless bin[0, 4] == "RITE"
+  abort "RITE version #{bin[4, 4]} is not supported." unless bin[4, 4] == "0300"
+  raise "no IREP section." unless bin[20, 4] == "IREP"
+  parse_irep(bin, 20 + 12)[0]
+end
+
+def parse_irep(bin, pos)
+  _, _, nregs, rlen, clen, ilen = bin[pos, 16].unpack("NnnnnN")
+  p = pos + 16
+  iseq = bin[p, ilen]
+  p += ilen + 13 * clen
+
+  pool = []
+  plen = bin[p, 2].unpack1("n"); p += 2
+  plen.times {
+    tt = bin.getbyte(p); p += 1
+    case tt
+    when 0, 2                           # STR, SSTR
+      len = bin[p, 2].unpack1("n")
+      pool << bin[p + 2, len]; p += len + 3
+    when 1 then pool << bin[p, 4].unpack1("l>"); p += 4
+    when 3 then pool << bin[p, 8].unpack1("q>"); p += 8
+    when 5 then pool << bin[p, 8].unpack1("E"); p += 8
+    else abort "unknown pool type #{tt}."
+    end
+  }
+
+  syms = []
+  slen = bin[p, 2].unpack1("n"); p += 2
+  slen.times {
+    len = bin[p, 2].unpack1("n")
+    syms << bin[p + 2, len]; p += len + 3
+  }
+
+  children = []
+  rlen.times {
+    child, p = parse_irep(bin, p)
+    children << child
+  }
+  [Irep.new(nregs, ilen, clen, iseq, pool, syms, children), p]
+end
+
+def decode(iseq)
+  insts = []
+  pos = 0
+  while pos < iseq.bytesize
+    op = iseq.getbyte(pos)
+    name, type = OPCODES[op] || abort("unknown opcode #{op}.")
+    len = OPERAND_LEN[type]
+    b1, b2, b3, b4, b5 = (1...len).map {|i| iseq.getbyte(pos + i) }
+    a, b, c = case type
+              when "Z"   then []
+              when "B"   then [b1]
+              when "BB"  then [b1, b2]
+              when "BBB" then [b1, b2, b3]
+              when "BS"  then [b1, b2 << 8 | b3]
+              when "BSS" then [b1, b2 << 8 | b3, b4 << 8 | b5]
+              when "S"   then [b1 << 8 | b2]
+              when "W"   then [b1 << 16 | b2 << 8 | b3]
+              end
+    insts << Inst.new(pos, name, a, b, c, len)
+    pos += len
+  end
+  insts
+end
+
+def s16(n)
+  n >= 0x8000 ? n - 0x10000 : n
+end
+
+# [[class name, method name, irep], ...] defined by "def" in the class bodies.
+def find_methods(irep, cls = "Object", list = [])
+  reg_tclass = {}
+  reg_irep = {}
+  class_regs = {}
+  decode(irep.iseq).each {|i|
+    case i.op
+    when "TCLASS" then reg_tclass[i.a] = true
+    when "METHOD" then reg_irep[i.a] = irep.children[i.b]
+    when "CLASS"  then class_regs[i.a] = irep.syms[i.b]
+    when "EXEC"
+      find_methods(irep.children[i.b], class_regs[i.a], list) if class_regs[i.a]
+    when "DEF"
+      if reg_tclass[i.a] && reg_irep[i.a + 1]
+        list << [cls, irep.syms[i.b], reg_irep[i.a + 1]]
+      end
+    end
+  }
+  list
+end
+
+# annotated method names by the class, {class name => [method name]}
+def find_annotations(src)
+  found = Hash.new {|h, k| h[k] = [] }
+  classes = []                          # [[indent, name]]
+  flag_aot = false
+  src.each_line {|line|
+    indent = line[/\A */].size
+    case line
+    when /\A *class +([A-Z]\w*)/
+      classes << [indent, $1]
+    when /\A *end\b/
+      classes.pop if classes.last && classes.last[0] == indent
+    when /\A *# *@aot\b/
+      flag_aot = true
+      next
+    when /\A *def +([^\s(;]+)/
+      found[classes.last ? classes.last[1] : "Object"] << $1 if flag_aot
+    end
+    flag_aot = false unless line.strip.empty?
+  }
+  found
+end
+
+def c_ident(s)
+  s.gsub(/[^A-Za-z0-9_]/) {|c| "_%02x" % c.ord }
+end
+
+def c_string(s)
+  '"' + s.gsub(/["\\]/) {|c| "\\" + c } + '"'
+end
+
+def c_float(f)
+  return "NAN" if f.nan?
+  return (f > 0 ? "INFINITY" : "-INFINITY") if f.infinite?
+  "%a" % f
+end
+
+
+# translator of a method.
+class Compiler
+  def initialize(syms)
+    @syms = syms                        # symbols of the output file.
+  end
+
+  def sym(name)
+    @syms.index(name) || (@syms << name; @syms.size - 1)
+  end
+
+  def sym_ref(name)
+    "aot_sym_[#{sym(name)}]"
+  end
+
+  # -> C function, or raise with the reason.
+  def compile(fname, irep)
+    raise "rescue or ensure" if irep.clen != 0
+    insts = decode(irep.iseq)
+    targets = {}
+    insts.each {|i|
+      case i.op
+      when "JMP"                      then targets[i.pos + i.len + s16(i.a)] = true
+      when "JMPIF", "JMPNOT", "JMPNIL" then targets[i.pos + i.len + s16(i.b)] = true
+      end
+    }
+
+    @inst_tbl = []
+    n = irep.nregs
+    body = []
+    argc = nil
+    insts.each {|i|
+      body << "L_%04x:" % i.pos if targets[i.pos]
+      if i.op == "ENTER"
+        raise "optional, rest or keyword arguments" if (i.a & ~(0x7c0000 | 1)) != 0
+        argc = i.a >> 18
+        next
+      end
+      body << "  " + translate(i, irep)
+    }
+    raise "no OP_ENTER" unless argc
+
+    out = []
+    out << "static void #{fname}(mrbc_vm *vm, mrbc_value v[], int argc)"
+    out << "{"
+    unless @inst_tbl.empty?
+      out << "  static const uint8_t inst[][8] = {"
+      @inst_tbl.each {|t| out << "    { #{t.join(', ')} }," }
+      out << "  };"
+    end
+    out << "  if( argc != #{argc} ) {"
+    out << "    mrbc_raise(vm, MRBC_CLASS(ArgumentError), \"wrong number of arguments.\");"
+    out << "    return;"
+    out << "  }"
+    out << "  if( mrbc_check_regs( vm, v, #{n} ) != 0 ) return;"
+    out << ""
+    out.concat body
+    out << ""
+    out << " RAISE:"
+    out << "  for( int i = 1; i < #{n}; i++ ) {"
+    out << "    mrbc_decref_empty( &v[i] );"
+    out << "  }"
+    out << "}"
+    out.join("\n")
+  end
+
+  # instruction run in the VM, -> "inst[n]"
+  def inst(*bytes)
+    @inst_tbl << bytes + ["OP_STOP"]
+    "inst[#{@inst_tbl.size - 1}]"
+  end
+
+  def translate(i, irep)
+    a, b, c = i.a, i.b, i.c
+    case i.op
+    when "NOP"      then ";"
+    when "MOVE"     then "mrbc_aot_move( &v[#{a}], &v[#{b}] );"
+    when "LOADI"    then "mrbc_aot_set( &v[#{a}], mrbc_integer_value(#{b}) );"
+    when "LOADINEG" then "mrbc_aot_set( &v[#{a}], mrbc_integer_value(-#{b}) );"
+    when /\ALOADI__1\z/ then "mrbc_aot_set( &v[#{a}], mrbc_integer_value(-1) );"
+    when /\ALOADI_(\d)\z/ then "mrbc_aot_set( &v[#{a}], mrbc_integer_value(#{$1}) );"
+    when "LOADI16"  then "mrbc_aot_set( &v[#{a}], mrbc_integer_value(#{s16(b)}) );"
+    when "LOADI32"  then "mrbc_aot_set( &v[#{a}], mrbc_integer_value(#{[b << 16 | c].pack('L').unpack1('l')}) );"
+    when "LOADL"
+      val = irep.pool[b]
+      case val
+      when Integer then "mrbc_aot_set( &v[#{a}], mrbc_integer_value(#{val}) );"
+      when Float   then "mrbc_aot_set( &v[#{a}], mrbc_float_value(vm, #{c_float(val)}) );"
+      else raise "string literal"
+      end
+    when "LOADSYM"  then "mrbc_aot_set( &v[#{a}], mrbc_symbol_value(#{sym_ref(irep.syms[b])}) );"
+    when "LOADNIL"  then "mrbc_aot_set( &v[#{a}], mrbc_nil_value() );"
+    when "LOADT"    then "mrbc_aot_set( &v[#{a}], mrbc_true_value() );"
+    when "LOADF"    then "mrbc_aot_set( &v[#{a}], mrbc_false_value() );"
+    when "LOADSELF" then "mrbc_aot_move( &v[#{a}], &v[0] );"
+    when "GETIV"
+      "if( mrbc_aot_getiv( vm, v, #{a}, #{sym_ref(irep.syms[b][1..])} ) ) goto RAISE;"
+    when "SETIV"
+      "if( mrbc_aot_setiv( vm, v, #{a}, #{sym_ref(irep.syms[b][1..])} ) ) goto RAISE;"
+    when "GETCONST"
+      "if( mrbc_aot_getconst( vm, v, #{a}, #{sym_ref(irep.syms[b])} ) ) goto RAISE;"
+    when "JMP"      then "goto L_%04x;" % (i.pos + i.len + s16(a))
+    when "JMPIF"    then "if( v[#{a}].tt > MRBC_TT_FALSE ) goto L_%04x;" % (i.pos + i.len + s16(b))
+    when "JMPNOT"   then "if( v[#{a}].tt <= MRBC_TT_FALSE ) goto L_%04x;" % (i.pos + i.len + s16(b))
+    when "JMPNIL"   then "if( v[#{a}].tt == MRBC_TT_NIL ) goto L_%04x;" % (i.pos + i.len + s16(b))
+    when "SEND", "SSEND"
+      raise "keyword arguments" if (c >> 4) != 0
+      raise "splat arguments" if (c & 0x0f) == 15
+      s = "if( mrbc_aot_send( vm, v, #{inst()}, #{sym_ref(irep.syms[b])}, #{a}, #{c} ) ) goto RAISE;"
+      i.op == "SSEND" ? "mrbc_aot_move( &v[#{a}], &v[0] );\n  " + s : s
+    when "RETURN"
+      "mrbc_aot_return( v, #{a}, #{irep.nregs} );\n  return;"
+    when *ARITH_OPS
+      "if( mrbc_aot_#{i.op.downcase}( vm, v, #{a}, #{inst("OP_#{i.op}", a)} ) ) goto RAISE;"
+    when "ADDI", "SUBI"
+      "if( mrbc_aot_#{i.op.downcase}( vm, v, #{a}, #{b}, #{inst("OP_#{i.op}", a, b)} ) ) goto RAISE;"
+    when *EXEC_OPS
+      bytes = ["OP_#{i.op}", a, b, c].compact
+      "if( mrbc_aot_exec( vm, v, #{inst(*bytes)} ) ) goto RAISE;"
+    else
+      raise "OP_#{i.op}"
+    end
+  end
+end
+
+
+mrbc = opt("mrbc") || "mrbc"
+flag_all = opt("all")
+output = nil
+files = []
+args = ARGV.dup
+while (a = args.shift)
+  if a == "-o" then output = args.shift
+  elsif !a.start_with?("--") then files << a
+  end
+end
+abort "usage: mrbc_aot.rb [--mrbc=mrbc] [--all] [-o output.c] file.rb ..." if files.empty?
+
+syms = []
+compiler = Compiler.new(syms)
+funcs = []                              # [class, method, hash, C function name]
+code = []
+
+files.each {|file|
+  rb = file.sub(/\.mrb\z/, ".rb")
+  if file.end_with?(".mrb")
+    bin = File.binread(file)
+  else
+    mrb = "#{file}.aot.mrb"
+    system("#{mrbc} -o #{mrb} #{file}") or abort "#{file}: mrbc failed."
+    bin = File.binread(mrb)
+    File.delete(mrb)
+  end
+  annotated = File.exist?(rb) ? find_annotations(File.read(rb, encoding: "UTF-8")) : {}
+
+  find_methods(parse_mrb(bin)).each {|cls, name, irep|
+    next unless flag_all || annotated[cls].include?(name)
+    fname = "aot_#{c_ident(cls)}_#{c_ident(name)}"
+    n_syms = syms.size
+    begin
+      code << "/* #{cls}##{name} (#{File.basename(file)}) */\n" +
+              compiler.compile(fname, irep)
+      funcs << [cls, name, fnv1a(irep.iseq), fname]
+    rescue => e
+      syms.slice!(n_syms..)
+      warn "#{file}: #{cls}##{name} is not compiled. (#{e.message})"
+    end
+  }
+  annotated.each {|cls, names|
+    names.each {|name|
+      next if funcs.any? {|f| f[0] == cls && f[1] == name }
+      warn "#{file}: #{cls}##{name} is annotated, but not found."
+    }
+  }
+}
+
+out = []
+out << "/* Auto generated by mrbc_aot.rb from #{files.join(' ')} */"
+out << "#include <math.h>"
+out << "#include \"../mrubyc_src/mrubyc.h\""
+out << "#include \"../mrubyc_src/opcode.h\""
+out << "#include \"../mrubyc_src/aot.h\""
+out << ""
+out << "#if defined(MRBC_USE_AOT)"
+out << "static mrbc_sym aot_sym_[#{[syms.size, 1].max}];"
+out << ""
+code.each {|c| out << c << "" }
+out << ""
+out << "void mrbc_aot_init(void)"
+out << "{"
+syms.each_with_index {|s, i|
+  out << "  aot_sym_[#{i}] = mrbc_str_to_symid(#{c_string(s)});"
+}
+funcs.each {|cls, name, hash, fname|
+  out << "  mrbc_aot_define(#{c_string(cls)}, #{c_string(name)}, 0x%08xUL, #{fname});" % hash
+}
+out << "}"
+out << "#endif"
+
+if output
+  File.write(output, out.join("\n") + "\n")
+else
+  puts out
+end
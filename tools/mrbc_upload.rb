@@ -0,0 +1,320 @@
+#!/usr/bin/env ruby
+#
+# Upload bytecode files by the binary framed mode of the firmware.
+# (see cmd_binary in Core/mrubyc/mrbc_firm.c)
+#
+# usage:
+#   mrbc_upload.rb [--port=/dev/ttyACM0] [--baud=115200] [--fast=921600]
+#                  [--image=last.img] [--lz4] [--execute]
+#                  file.mrb[:priority] ...
+#
+#   --port     serial port. (the device must be in the boot prompt)
+#   --baud     baud rate of the boot prompt.
+#   --fast     baud rate during the upload.
+#   --image    image of the slot written by the last upload. if it is
+#              found, only the difference from it is sent by 'patch'
+#              command. the new image is saved to it after the upload.
+#   --lz4      compress the files. (needs MRBC_BYTECODE_LZ4 in the firmware)
+#   --execute  start the VM after the upload.
+#
+#   The files are written to the inactive slot, and activated at last.
+#   Each task is named by the file name (up to 15 characters), and
+#   created with the priority, if it is given.
+#
+# frame (little endian):
+#   sync(8) 0xA5, type(8), seq(8), len(16), payload(len), crc(32)
+#
+#   crc is CRC-32/MPEG-2 on 32bit words, over sync..payload zero padded
+#   to 4 bytes and read as little endian words. (the CRC unit of STM32)
+#
+# image: directory and bytecode of a slot, as in the flash.
+#   entry * DIR_MAX: offset(32) size(32) crc(32) priority(8) 0(24) name(128)
+#   bytecode files, each padded by 0xff to 4 bytes.
+#
+# compressed file:
+#   "RLZ4", raw size(32), size(32) in big endian, and the LZ4 block.
+#
+# patch (little endian):
+#   'C' offset(32) len(32)    copy from the last image.
+#   'I' len(16) data(len)     insert the data.
+#
+
+SYNC = 0xA5
+TIMEOUT = 0.5
+ERASE_TIMEOUT = 5                       # 'S' frame erases the sectors.
+MAX_RETRY = 20
+DIR_MAX = 16
+ENTRY_SIZE = 32
+BLOCK = 16                              # minimum length of a copy.
+
+def opt(name)
+  ARGV.each {|a| return $1 || true if a =~ /\A--#{name}(?:=(.*))?\z/ }
+  nil
+end
+
+def stm32_crc(bin)
+  bin = bin + "\0" * (-bin.bytesize & 3)
+  crc = 0xffffffff
+  bin.unpack("V*").each {|w|
+    crc ^= w
+    32.times {
+      crc = (crc & 0x80000000) != 0 ? ((crc << 1) ^ 0x04c11db7) : (crc << 1)
+      crc &= 0xffffffff
+    }
+  }
+  crc
+end
+
+def make_frame(type, seq, payload = "".b)
+  f = [SYNC, type.ord, seq & 0xff, payload.bytesize].pack("CCCv") + payload
+  f + [stm32_crc(f)].pack("V")
+end
+
+def set_baud(port, baud)
+  system("stty", "-F", port, baud.to_s, "raw", "-echo", "-crtscts") or
+    abort "stty failed."
+end
+
+def read_bytes(io, n, timeout)
+  buf = "".b
+  while buf.bytesize < n
+    return nil unless IO.select([io], nil, nil, timeout)
+    buf << io.readpartial(n - buf.bytesize)
+  end
+  buf
+end
+
+# -> [type, seq, payload] or nil if timed out or broken.
+def read_frame(io, timeout)
+  loop {
+    b = read_bytes(io, 1, timeout) or return nil
+    break if b.ord == SYNC
+  }
+  head = read_bytes(io, 4, timeout) or return nil
+  type, seq, len = head.unpack("aCv")
+  rest = read_bytes(io, len + 4, timeout) or return nil
+  payload = rest.byteslice(0, len)
+  crc = rest.byteslice(len, 4).unpack1("V")
+  return nil if crc != stm32_crc([SYNC].pack("C") + head + payload)
+  [type, seq, payload]
+end
+
+# LZ4 block format, by the greedy match.
+def lz4_compress(src)
+  ext = ->(out, v) {
+    while v >= 255
+      out << 255
+      v -= 255
+    end
+    out << v
+  }
+  seq = ->(out, lit, offset, mlen) {
+    ll = lit.bytesize
+    ml = mlen ? mlen - 4 : 0
+    out << ([ll, 15].min << 4 | [ml, 15].min)
+    ext.(out, ll - 15) if ll >= 15
+    out << lit
+    if mlen
+      out << [offset].pack("v")
+      ext.(out, ml - 15) if ml >= 15
+    end
+  }
+
+  out = "".b
+  n = src.bytesize
+  table = {}
+  anchor = i = 0
+  while i < n - 12                      # the last match starts 12 bytes before the end.
+    key = src.byteslice(i, 4)
+    ref = table[key]
+    table[key] = i
+    if ref && i - ref <= 0xffff
+      len = 4
+      len += 1 while i + len < n - 5 && src.getbyte(ref + len) == src.getbyte(i + len)
+      seq.(out, src.byteslice(anchor, i - anchor), i - ref, len)
+      (i + 1 ... i + len).each {|j| table[src.byteslice(j, 4)] = j }
+      anchor = i += len
+    else
+      i += 1
+    end
+  end
+  seq.(out, src.byteslice(anchor, n - anchor), nil, nil)
+  out
+end
+
+# files -> image of the slot.
+def make_image(files)
+  dir = "".b
+  body = "".b
+  files.each {|name, priority, bin|
+    task_name = File.basename(name, ".*").byteslice(0, 15)
+    dir << [body.bytesize, bin.bytesize, stm32_crc(bin), priority, task_name].pack("VVVCx3a16")
+    body << bin << "\xff".b * (-bin.bytesize & 3)
+  }
+  dir << "\xff".b * (ENTRY_SIZE * (DIR_MAX - files.size))
+  dir + body
+end
+
+# -> patch to make the image from the base.
+def make_patch(base, image)
+  index = Hash.new {|h, k| h[k] = [] }
+  (0 .. base.bytesize - BLOCK).step(4) {|ofs| index[base.byteslice(ofs, BLOCK)] << ofs }
+
+  patch = "".b
+  insert = "".b
+  flush = -> {
+    insert.bytes.each_slice(0xffff) {|s| patch << ["I", s.size].pack("av") << s.pack("C*") }
+    insert = "".b
+  }
+  i = 0
+  while i < image.bytesize
+    best_ofs, best_len = nil, 0
+    index[image.byteslice(i, BLOCK)].each {|ofs|
+      len = BLOCK
+      len += 1 while i + len < image.bytesize && ofs + len < base.bytesize &&
+                     image.getbyte(i + len) == base.getbyte(ofs + len)
+      best_ofs, best_len = ofs, len if len > best_len
+    } if index.key?(image.byteslice(i, BLOCK))
+    if best_len >= BLOCK
+      flush.()
+      patch << ["C", best_ofs, best_len].pack("aVV")
+      i += best_len
+    else
+      insert << image.byteslice(i)
+      i += 1
+    end
+  end
+  flush.()
+  patch
+end
+
+# -> the reply line, that starts with + or -.
+def reply(io, timeout, what)
+  line = "".b
+  loop {
+    b = read_bytes(io, 1, timeout) or abort "no reply to #{what}."
+    line << b
+    next unless line.end_with?("\n")
+    return line.strip if line =~ /\A[+-]/
+    line = "".b
+  }
+end
+
+def command(io, cmd, timeout = 3)
+  io.write(cmd + "\r\n")
+  reply(io, timeout, "'#{cmd}'")
+end
+
+port = opt("port") || "/dev/ttyACM0"
+baud = (opt("baud") || 115200).to_i
+fast = (opt("fast") || baud).to_i
+image_file = opt("image")
+files = ARGV.reject {|a| a.start_with?("--") }
+abort "no file." if files.empty?
+abort "too many files." if files.size > DIR_MAX
+files.map! {|arg|
+  arg =~ /\A(.*?)(?::(\d+))?\z/
+  abort "priority must be 0..255." if $2.to_i > 255
+  [$1, $2.to_i, File.binread($1)]
+}
+if opt("lz4")
+  files.each {|file|
+    block = lz4_compress(file[2])
+    file[2] = "RLZ4".b + [file[2].bytesize, 12 + block.bytesize].pack("NN") + block
+  }
+end
+image = make_image(files)
+
+set_baud(port, baud)
+io = File.open(port, "r+b")
+io.sync = true
+
+command(io, "")
+
+# send the difference from the last image.
+if image_file.is_a?(String) && File.exist?(image_file)
+  base = File.binread(image_file)
+  patch = make_patch(base, image)
+  $stderr.printf("patch %d bytes for the image of %d bytes.\n", patch.bytesize, image.bytesize)
+  r = command(io, format("patch %d %d %x %x", patch.bytesize, image.bytesize,
+                         stm32_crc(base), stm32_crc(image)), 10)
+  if r.start_with?("+OK")
+    io.write(patch)
+    r = reply(io, 60, "the patch")
+    abort r unless r.start_with?("+DONE")
+    puts command(io, "activate")
+    File.binwrite(image_file, image)
+    puts command(io, "execute") if opt("execute")
+    exit
+  end
+  $stderr.puts "#{r}, send all the files."
+end
+
+r = command(io, "clear")
+abort r unless r.start_with?("+OK")
+
+r = command(io, "binary #{fast}")
+abort r unless r =~ /\A\+OK binary \d+ window (\d+) frame (\d+)/
+window = $1.to_i
+frame_size = $2.to_i & ~3
+set_baud(port, fast) if fast != baud
+sleep 0.05
+
+# all frames of the upload.
+frames = []
+files.each {|name, priority, bin|
+  task_name = File.basename(name, ".*").byteslice(0, 15)
+  frames << ["S", [bin.bytesize, priority].pack("VC") + task_name]
+  (0 ... bin.bytesize).step(frame_size) {|ofs|
+    frames << ["D", bin.byteslice(ofs, frame_size)]
+  }
+  frames << ["E", "".b]
+}
+frames << ["Q", "".b]
+
+# go-back-N
+base = 0                                # the oldest frame not acked.
+nxt = 0                                 # the next frame to send.
+retry_cnt = 0
+t0 = Time.now
+while base < frames.size
+  while nxt < frames.size && nxt < base + window
+    io.write(make_frame(frames[nxt][0], nxt, frames[nxt][1]))
+    nxt += 1
+  end
+
+  reply = read_frame(io, frames[base][0] == "S" ? ERASE_TIMEOUT : TIMEOUT)
+  if !reply
+    abort "no response." if (retry_cnt += 1) > MAX_RETRY
+    nxt = base                          # resend all in the window.
+    next
+  end
+
+  type, seq, payload = reply
+  idx = base + ((seq - base) & 0xff)    # frame index of the seq.
+  case type
+  when "A"
+    base = idx + 1 if idx < nxt
+    retry_cnt = 0
+  when "N"
+    if idx < nxt
+      abort "too many errors." if (retry_cnt += 1) > MAX_RETRY
+      base = nxt = idx
+    end
+  when "R"
+    set_baud(port, baud) if fast != baud
+    abort "rejected: #{payload}"
+  end
+  $stderr.printf("\r%d / %d frames", base, frames.size)
+end
+sec = Time.now - t0
+bytes = files.sum {|_, _, bin| bin.bytesize }
+$stderr.printf("\r%d bytes in %.2f sec (%.1f KB/s)\n", bytes, sec, bytes / sec / 1024)
+
+set_baud(port, baud) if fast != baud
+sleep 0.05
+puts command(io, "activate")
+File.binwrite(image_file, image) if image_file.is_a?(String)
+if opt("execute")
+  puts command(io, "execute")
+end
@@ -0,0 +1,240 @@
+#!/usr/bin/env ruby
+#
+# Decode mruby/c scheduler events. (see MRBC_SCHED_EVENT_LOG in rrt0.c)
+#
+# usage:
+#   sched_event_decode.rb [--itm] [--cpu-mhz=84] [--events] [--chrome] [file]
+#
+#   file       console log including VM.sched_log output, or
+#              raw SWO capture of ITM stimulus port 3 with --itm.
+#   --events   print each event.
+#   --chrome   print Chrome trace JSON, for chrome://tracing or
+#              https://ui.perfetto.dev
+#
+# event record (12 bytes, little endian):
+#   time(32) op(8) vm_id(8) state(8) reason(8) arg(32)
+#
+#   time is CPU cycles (DWT->CYCCNT), or ticks if the log says clock:0.
+#
+# console log format:
+#   == SCHED EVENT LOG count:<total events> clock:<cycles/us> ==
+#   task <vm_id> <name>
+#   <24 hex digits>
+#   == END ==
+#
+
+EVENT_SIZE = 12
+ITM_PORT = 3
+OP_NAMES = {
+  "D" => "dispatch", "P" => "preempt", "B" => "block", "E" => "end",
+  "W" => "wakeup", "S" => "sleep", "L" => "lock", "M" => "lock_wait",
+  "U" => "unlock", "I" => "isr_enter", "i" => "isr_exit",
+}
+ISR_TID = 0
+
+Event = Struct.new(:time, :op, :vm_id, :state, :reason, :arg)
+
+def parse_events(bin)
+  (0 ... bin.bytesize / EVENT_SIZE).map {|i|
+    Event.new(*bin.byteslice(i * EVENT_SIZE, EVENT_SIZE).unpack("VaCCCV"))
+  }
+end
+
+# ITM packets -> payload bytes of the stimulus port.
+def read_itm(bin, port)
+  payload = "".b
+  bytes = bin.bytes
+  i = 0
+  while i < bytes.size
+    h = bytes[i]
+    i += 1
+    if h == 0x00 || h == 0x80 || h == 0x70
+      next                              # sync or overflow.
+    elsif (h & 0x03) != 0 && (h & 0x04) == 0
+      size = [0, 1, 2, 4][h & 0x03]     # source (instrumentation) packet.
+      payload << bytes[i, size].pack("C*") if (h >> 3) == port
+      i += size
+    else
+      while (h & 0x80) != 0 && i < bytes.size  # protocol packet, skip.
+        h = bytes[i]
+        i += 1
+      end
+    end
+  end
+  payload
+end
+
+# console log -> [payload bytes, clock, task names]
+def read_log(text)
+  payload = "".b
+  clock = nil
+  names = {}
+  in_log = false
+  text.each_line {|line|
+    line = line.strip
+    if line =~ /== SCHED EVENT LOG count:\d+ clock:(\d+) ==/
+      payload = "".b                    # use the last dump.
+      names = {}
+      clock = $1.to_i
+      in_log = true
+    elsif !in_log
+      next
+    elsif line.start_with?("== END ==")
+      in_log = false
+    elsif line =~ /\Atask (\d+) (.*)\z/
+      names[$1.to_i] = $2
+    elsif line =~ /\A\h{#{EVENT_SIZE * 2}}\z/
+      payload << [line].pack("H*")
+    end
+  }
+  [payload, clock, names]
+end
+
+def opt(name)
+  ARGV.each {|a| return $1 || true if a =~ /\A--#{name}(?:=(.*))?\z/ }
+  nil
+end
+
+cpu_mhz = (opt("cpu-mhz") || 84).to_f
+files = ARGV.reject {|a| a.start_with?("--") }
+input = files.empty? ? $stdin.binmode.read : File.binread(files[0])
+
+names = {}
+if opt("itm")
+  events = parse_events(read_itm(input, ITM_PORT))
+else
+  payload, clock, names = read_log(input)
+  cpu_mhz = clock > 0 ? clock.to_f : nil if clock
+  events = parse_events(payload)
+end
+if events.empty?
+  $stderr.puts "no event found."
+  exit 1
+end
+
+# time -> micro seconds, from the first event. (CYCCNT wraps around)
+us_per_count = cpu_mhz ? 1 / cpu_mhz : 1000.0   # clock:0 is 1ms tick.
+elapsed = 0
+prev = events[0].time
+events.each {|ev|
+  elapsed += (ev.time - prev) & 0xffffffff
+  prev = ev.time
+  ev.time = elapsed * us_per_count
+}
+
+#
+# Chrome trace JSON
+#
+if opt("chrome")
+  def json_str(s)
+    '"' + s.to_s.gsub(/["\\]/) {|c| "\\" + c }.gsub(/[\x00-\x1f]/) {|c| format("\\u%04x", c.ord) } + '"'
+  end
+  def trace(h)
+    "{" + h.map {|k, v| "#{json_str(k)}:#{v.is_a?(Hash) ? trace(v) : v.is_a?(String) ? json_str(v) : v}" }.join(",") + "}"
+  end
+
+  out = []
+  running = {}                          # vm_id => dispatch event
+  isr = {}                              # irq => enter event
+  events.each {|ev|
+    tid = ev.op == "I" || ev.op == "i" ? ISR_TID : ev.vm_id
+    args = { "state" => format("%02x", ev.state), "reason" => format("%02x", ev.reason) }
+    case ev.op
+    when "D"
+      running[ev.vm_id] = ev
+    when "P", "B", "E"
+      if (d = running.delete(ev.vm_id))
+        out << trace("name" => "run", "cat" => "task", "ph" => "X", "pid" => 0,
+                     "tid" => tid, "ts" => d.time, "dur" => ev.time - d.time,
+                     "args" => { "priority" => d.arg, "end" => OP_NAMES[ev.op] })
+      end
+      out << trace("name" => OP_NAMES[ev.op], "cat" => "sched", "ph" => "i",
+                   "s" => "t", "pid" => 0, "tid" => tid, "ts" => ev.time, "args" => args)
+    when "I"
+      isr[ev.arg] = ev
+    when "i"
+      if (s = isr.delete(ev.arg))
+        out << trace("name" => "IRQ #{ev.arg}", "cat" => "isr", "ph" => "X", "pid" => 0,
+                     "tid" => tid, "ts" => s.time, "dur" => ev.time - s.time)
+      end
+    else
+      args["arg"] = ev.op =~ /[LMU]/ ? format("0x%08x", ev.arg) : ev.arg
+      out << trace("name" => OP_NAMES[ev.op] || ev.op, "cat" => "sched", "ph" => "i",
+                   "s" => "t", "pid" => 0, "tid" => tid, "ts" => ev.time, "args" => args)
+    end
+  }
+
+  tids = events.map {|ev| ev.op == "I" || ev.op == "i" ? ISR_TID : ev.vm_id }.uniq.sort
+  tids.each {|tid|
+    name = tid == ISR_TID ? "ISR" : "#{names[tid] || 'task'} (vm #{tid})"
+    out << trace("name" => "thread_name", "ph" => "M", "pid" => 0, "tid" => tid,
+                 "args" => { "name" => name })
+  }
+  out << trace("name" => "process_name", "ph" => "M", "pid" => 0,
+               "args" => { "name" => "mruby/c" })
+
+  puts "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+  puts out.join(",\n")
+  puts "]}"
+  exit
+end
+
+#
+# summary
+#
+Task = Struct.new(:us, :n_dispatch, :n_preempt, :n_block, :n_wakeup,
+                  :n_lock_wait, :max_slice, :max_latency)
+tasks = Hash.new {|h, k| h[k] = Task.new(0, 0, 0, 0, 0, 0, 0, 0) }
+running = nil                           # [vm_id, time of dispatch]
+ready_at = {}                           # vm_id => time of wakeup
+busy = 0
+isr_us = 0
+isr_start = {}
+
+events.each {|ev|
+  if opt("events")
+    printf("%14.3f %-10s vm:%-3d state:%02x reason:%02x arg:%08x\n",
+           ev.time, OP_NAMES[ev.op] || ev.op, ev.vm_id, ev.state, ev.reason, ev.arg)
+  end
+
+  t = tasks[ev.vm_id] if ev.vm_id != 0
+  case ev.op
+  when "D"
+    t.n_dispatch += 1
+    running = [ev.vm_id, ev.time]
+    if (w = ready_at.delete(ev.vm_id))
+      t.max_latency = ev.time - w if t.max_latency < ev.time - w
+    end
+  when "P", "B", "E"
+    t.n_preempt += 1 if ev.op == "P"
+    t.n_block += 1 if ev.op == "B"
+    if running && running[0] == ev.vm_id
+      slice = ev.time - running[1]
+      t.us += slice
+      t.max_slice = slice if t.max_slice < slice
+      busy += slice
+    end
+    running = nil
+  when "W"
+    t.n_wakeup += 1
+    ready_at[ev.vm_id] = ev.time
+  when "M"
+    t.n_lock_wait += 1
+  when "I"
+    isr_start[ev.arg] = ev.time
+  when "i"
+    isr_us += ev.time - isr_start.delete(ev.arg) if isr_start[ev.arg]
+  end
+}
+
+span = events[-1].time - events[0].time
+printf("events: %d  span: %.3f ms  busy: %.1f %%  isr: %.1f %%\n", events.size,
+       span / 1000, span > 0 ? busy * 100.0 / span : 0,
+       span > 0 ? isr_us * 100.0 / span : 0)
+
+puts "   vm      cpu_us  dispatch  preempt    block   wakeup lock_wait  max_slice_us  max_wakeup_us  name"
+tasks.sort.each {|vm_id, t|
+  printf("  %3d %11.1f %9d %8d %8d %8d %9d %13.1f %14.1f  %s\n",
+         vm_id, t.us, t.n_dispatch, t.n_preempt, t.n_block, t.n_wakeup,
+         t.n_lock_wait, t.max_slice, t.max_latency, names[vm_id])
+}